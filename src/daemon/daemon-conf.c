@@ -80,12 +80,16 @@ static const pa_daemon_conf default_conf = {
     .log_backtrace = 0,
     .log_meta = false,
     .log_time = false,
+    .log_async = false,
     .resample_method = PA_RESAMPLER_AUTO,
     .avoid_resampling = false,
     .disable_remixing = false,
     .remixing_use_all_sink_channels = true,
     .disable_lfe_remixing = true,
     .lfe_crossover_freq = 0,
+    .premix_inputs = false,
+    .render_threads = 0,
+    .io_thread_cpu_budget = 0,
     .config_file = NULL,
     .use_pid_file = true,
     .system_instance = false,
@@ -96,15 +100,20 @@ static const pa_daemon_conf default_conf = {
     .disable_shm = false,
     .disable_memfd = false,
     .lock_memory = false,
+    .lock_shm = false,
+    .shm_huge_pages = false,
     .deferred_volume = true,
     .default_n_fragments = 4,
     .default_fragment_size_msec = 25,
     .deferred_volume_safety_margin_usec = 8000,
     .deferred_volume_extra_delay_usec = 0,
+    .volume_horizon_msec = 0,
     .default_sample_spec = { .format = PA_SAMPLE_S16NE, .rate = 44100, .channels = 2 },
     .alternate_sample_rate = 48000,
     .default_channel_map = { .channels = 2, .map = { PA_CHANNEL_POSITION_LEFT, PA_CHANNEL_POSITION_RIGHT } },
-    .shm_size = 0
+    .shm_size = 0,
+    .shm_slot_sizes = PA_MEMPOOL_SLOT_SIZES_DEFAULT,
+    .n_shm_slot_sizes = PA_MEMPOOL_N_SLOT_SIZES_DEFAULT
 #ifdef HAVE_SYS_RESOURCE_H
    ,.rlimit_fsize = { .value = 0, .is_set = false },
     .rlimit_data = { .value = 0, .is_set = false },
@@ -171,6 +180,7 @@ void pa_daemon_conf_free(pa_daemon_conf *c) {
     pa_xfree(c->script_commands);
     pa_xfree(c->dl_search_path);
     pa_xfree(c->default_script_file);
+    pa_xfree(c->thread_affinity);
 
     if (c->log_target)
         pa_log_target_free(c->log_target);
@@ -373,6 +383,40 @@ static int parse_alternate_sample_rate(pa_config_parser_state *state) {
     return 0;
 }
 
+static int parse_shm_slot_sizes(pa_config_parser_state *state) {
+    pa_daemon_conf *c;
+    size_t sizes[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    const char *split_state = NULL;
+    char *word;
+    unsigned n = 0;
+
+    pa_assert(state);
+
+    c = state->data;
+
+    while ((word = pa_split_spaces(state->rvalue, &split_state))) {
+        uint32_t k;
+
+        if (n >= PA_MEMPOOL_SLOT_CLASSES_MAX || pa_atou(word, &k) < 0 || k <= 0 || (n > 0 && k <= sizes[n - 1])) {
+            pa_log(_("[%s:%u] Invalid shared memory slot sizes '%s'."), state->filename, state->lineno, state->rvalue);
+            pa_xfree(word);
+            return -1;
+        }
+
+        sizes[n++] = (size_t) k;
+        pa_xfree(word);
+    }
+
+    if (n <= 0) {
+        pa_log(_("[%s:%u] Invalid shared memory slot sizes '%s'."), state->filename, state->lineno, state->rvalue);
+        return -1;
+    }
+
+    memcpy(c->shm_slot_sizes, sizes, n * sizeof(size_t));
+    c->n_shm_slot_sizes = n;
+    return 0;
+}
+
 struct channel_conf_info {
     pa_daemon_conf *conf;
     bool default_sample_spec_set;
@@ -464,6 +508,24 @@ static int parse_nice_level(pa_config_parser_state *state) {
     return 0;
 }
 
+static int parse_thread_affinity(pa_config_parser_state *state) {
+    pa_daemon_conf *c;
+
+    pa_assert(state);
+
+    c = state->data;
+
+    if (pa_cpu_list_check(state->rvalue) < 0) {
+        pa_log("[%s:%u] Invalid CPU list '%s'.", state->filename, state->lineno, state->rvalue);
+        return -1;
+    }
+
+    pa_xfree(c->thread_affinity);
+    c->thread_affinity = pa_xstrdup(state->rvalue);
+
+    return 0;
+}
+
 static int parse_rtprio(pa_config_parser_state *state) {
 #if !defined(OS_IS_WIN32) && defined(HAVE_SCHED_H)
     pa_daemon_conf *c;
@@ -536,6 +598,7 @@ int pa_daemon_conf_load(pa_daemon_conf *c, const char *filename) {
         { "exit-idle-time",             pa_config_parse_int,      &c->exit_idle_time, NULL },
         { "scache-idle-time",           pa_config_parse_int,      &c->scache_idle_time, NULL },
         { "realtime-priority",          parse_rtprio,             c, NULL },
+        { "thread-affinity",            parse_thread_affinity,    c, NULL },
         { "dl-search-path",             pa_config_parse_string,   &c->dl_search_path, NULL },
         { "default-script-file",        pa_config_parse_string,   &c->default_script_file, NULL },
         { "log-target",                 parse_log_target,         c, NULL },
@@ -553,6 +616,7 @@ int pa_daemon_conf_load(pa_daemon_conf *c, const char *filename) {
                                         pa_config_parse_unsigned, &c->deferred_volume_safety_margin_usec, NULL },
         { "deferred-volume-extra-delay-usec",
                                         pa_config_parse_int,      &c->deferred_volume_extra_delay_usec, NULL },
+        { "volume-horizon-msec",        pa_config_parse_unsigned, &c->volume_horizon_msec, NULL },
         { "nice-level",                 parse_nice_level,         c, NULL },
         { "avoid-resampling",           pa_config_parse_bool,     &c->avoid_resampling, NULL },
         { "disable-remixing",           pa_config_parse_bool,     &c->disable_remixing, NULL },
@@ -562,10 +626,17 @@ int pa_daemon_conf_load(pa_daemon_conf *c, const char *filename) {
         { "disable-lfe-remixing",       pa_config_parse_bool,     &c->disable_lfe_remixing, NULL },
         { "enable-lfe-remixing",        pa_config_parse_not_bool, &c->disable_lfe_remixing, NULL },
         { "lfe-crossover-freq",         pa_config_parse_unsigned, &c->lfe_crossover_freq, NULL },
+        { "enable-premix",              pa_config_parse_bool,     &c->premix_inputs, NULL },
+        { "render-threads",             pa_config_parse_unsigned, &c->render_threads, NULL },
+        { "io-thread-cpu-budget",       pa_config_parse_unsigned, &c->io_thread_cpu_budget, NULL },
         { "load-default-script-file",   pa_config_parse_bool,     &c->load_default_script_file, NULL },
         { "shm-size-bytes",             pa_config_parse_size,     &c->shm_size, NULL },
+        { "shm-slot-sizes",             parse_shm_slot_sizes,     c, NULL },
+        { "lock-shm",                   pa_config_parse_bool,     &c->lock_shm, NULL },
+        { "shm-huge-pages",             pa_config_parse_bool,     &c->shm_huge_pages, NULL },
         { "log-meta",                   pa_config_parse_bool,     &c->log_meta, NULL },
         { "log-time",                   pa_config_parse_bool,     &c->log_time, NULL },
+        { "log-async",                  pa_config_parse_bool,     &c->log_async, NULL },
         { "log-backtrace",              pa_config_parse_unsigned, &c->log_backtrace, NULL },
 #ifdef HAVE_SYS_RESOURCE_H
         { "rlimit-fsize",               parse_rlimit,             &c->rlimit_fsize, NULL },
@@ -714,6 +785,7 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf *s;
     char cm[PA_CHANNEL_MAP_SNPRINT_MAX];
     char *log_target = NULL;
+    unsigned i;
 
     pa_assert(c);
 
@@ -733,6 +805,7 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf_printf(s, "nice-level = %i\n", c->nice_level);
     pa_strbuf_printf(s, "realtime-scheduling = %s\n", pa_yes_no(c->realtime_scheduling));
     pa_strbuf_printf(s, "realtime-priority = %i\n", c->realtime_priority);
+    pa_strbuf_printf(s, "thread-affinity = %s\n", pa_strempty(c->thread_affinity));
     pa_strbuf_printf(s, "allow-module-loading = %s\n", pa_yes_no(!c->disallow_module_loading));
     pa_strbuf_printf(s, "allow-exit = %s\n", pa_yes_no(!c->disallow_exit));
     pa_strbuf_printf(s, "use-pid-file = %s\n", pa_yes_no(c->use_pid_file));
@@ -757,6 +830,9 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf_printf(s, "remixing-use-all-sink-channels = %s\n", pa_yes_no(c->remixing_use_all_sink_channels));
     pa_strbuf_printf(s, "enable-lfe-remixing = %s\n", pa_yes_no(!c->disable_lfe_remixing));
     pa_strbuf_printf(s, "lfe-crossover-freq = %u\n", c->lfe_crossover_freq);
+    pa_strbuf_printf(s, "enable-premix = %s\n", pa_yes_no(c->premix_inputs));
+    pa_strbuf_printf(s, "render-threads = %u\n", c->render_threads);
+    pa_strbuf_printf(s, "io-thread-cpu-budget = %u\n", c->io_thread_cpu_budget);
     pa_strbuf_printf(s, "default-sample-format = %s\n", pa_sample_format_to_string(c->default_sample_spec.format));
     pa_strbuf_printf(s, "default-sample-rate = %u\n", c->default_sample_spec.rate);
     pa_strbuf_printf(s, "alternate-sample-rate = %u\n", c->alternate_sample_rate);
@@ -767,9 +843,17 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf_printf(s, "enable-deferred-volume = %s\n", pa_yes_no(c->deferred_volume));
     pa_strbuf_printf(s, "deferred-volume-safety-margin-usec = %u\n", c->deferred_volume_safety_margin_usec);
     pa_strbuf_printf(s, "deferred-volume-extra-delay-usec = %d\n", c->deferred_volume_extra_delay_usec);
+    pa_strbuf_printf(s, "volume-horizon-msec = %u\n", c->volume_horizon_msec);
     pa_strbuf_printf(s, "shm-size-bytes = %lu\n", (unsigned long) c->shm_size);
+    pa_strbuf_puts(s, "shm-slot-sizes =");
+    for (i = 0; i < c->n_shm_slot_sizes; i++)
+        pa_strbuf_printf(s, " %lu", (unsigned long) c->shm_slot_sizes[i]);
+    pa_strbuf_puts(s, "\n");
+    pa_strbuf_printf(s, "lock-shm = %s\n", pa_yes_no(c->lock_shm));
+    pa_strbuf_printf(s, "shm-huge-pages = %s\n", pa_yes_no(c->shm_huge_pages));
     pa_strbuf_printf(s, "log-meta = %s\n", pa_yes_no(c->log_meta));
     pa_strbuf_printf(s, "log-time = %s\n", pa_yes_no(c->log_time));
+    pa_strbuf_printf(s, "log-async = %s\n", pa_yes_no(c->log_async));
     pa_strbuf_printf(s, "log-backtrace = %u\n", c->log_backtrace);
 #ifdef HAVE_SYS_RESOURCE_H
     pa_strbuf_printf(s, "rlimit-fsize = %li\n", c->rlimit_fsize.is_set ? (long int) c->rlimit_fsize.value : -1);
@@ -71,12 +71,16 @@ typedef struct pa_daemon_conf {
         disable_remixing,
         remixing_use_all_sink_channels,
         disable_lfe_remixing,
+        premix_inputs,
         load_default_script_file,
         disallow_exit,
         log_meta,
         log_time,
+        log_async,
         flat_volumes,
         lock_memory,
+        lock_shm,
+        shm_huge_pages,
         deferred_volume;
     pa_server_type_t local_server_type;
     int exit_idle_time,
@@ -85,6 +89,7 @@ typedef struct pa_daemon_conf {
         nice_level,
         resample_method;
     char *script_commands, *dl_search_path, *default_script_file;
+    char *thread_affinity;
     pa_log_target *log_target;
     pa_log_level_t log_level;
     unsigned log_backtrace;
@@ -130,11 +135,16 @@ typedef struct pa_daemon_conf {
     unsigned default_n_fragments, default_fragment_size_msec;
     unsigned deferred_volume_safety_margin_usec;
     int deferred_volume_extra_delay_usec;
+    unsigned volume_horizon_msec;
     unsigned lfe_crossover_freq;
+    unsigned render_threads;
+    unsigned io_thread_cpu_budget;
     pa_sample_spec default_sample_spec;
     uint32_t alternate_sample_rate;
     pa_channel_map default_channel_map;
     size_t shm_size;
+    size_t shm_slot_sizes[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    unsigned n_shm_slot_sizes;
 } pa_daemon_conf;
 
 /* Allocate a new structure and fill it with sane defaults */
@@ -85,6 +85,7 @@
 #include <pulsecore/shm.h>
 #include <pulsecore/memtrap.h>
 #include <pulsecore/strlist.h>
+#include <pulsecore/ltdl-helper.h>
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-shared.h>
 #endif
@@ -111,6 +112,10 @@ int deny_severity = LOG_WARNING;
 int __padsp_disabled__ = 7;
 #endif
 
+static void shm_cleanup_cb(pa_mainloop_api *m, void *userdata) {
+    pa_shm_cleanup();
+}
+
 static void signal_callback(pa_mainloop_api* m, pa_signal_event *e, int sig, void *userdata) {
     pa_module *module = NULL;
 
@@ -528,6 +533,7 @@ int main(int argc, char *argv[]) {
 #endif
 
     LTDL_SET_PRELOADED_SYMBOLS();
+    pa_set_preloaded_symbols(lt_preloaded_symbols);
     pa_ltdl_init();
     ltdl_init = true;
 
@@ -1016,15 +1022,25 @@ int main(int argc, char *argv[]) {
 
     pa_memtrap_install();
 
+    if (conf->log_async)
+        pa_log_set_async(true);
+
     pa_assert_se(mainloop = pa_mainloop_new());
 
     if (!(c = pa_core_new(pa_mainloop_get_api(mainloop), !conf->disable_shm,
                           !conf->disable_shm && !conf->disable_memfd && pa_memfd_is_locally_supported(),
-                          conf->shm_size))) {
+                          conf->shm_size, conf->shm_slot_sizes, conf->n_shm_slot_sizes))) {
         pa_log(_("pa_core_new() failed."));
         goto finish;
     }
 
+    /* The IO threads shouldn't take page faults on the pool the first
+     * time a stream touches a slot */
+    if (conf->lock_shm || conf->shm_huge_pages) {
+        if (pa_mempool_pin(c->mempool, conf->shm_huge_pages, conf->lock_shm) >= 0 && conf->lock_shm)
+            pa_log_info("Locked the memory pool into memory.");
+    }
+
     c->default_sample_spec = conf->default_sample_spec;
     c->alternate_sample_rate = conf->alternate_sample_rate;
     c->default_channel_map = conf->default_channel_map;
@@ -1032,16 +1048,21 @@ int main(int argc, char *argv[]) {
     c->default_fragment_size_msec = conf->default_fragment_size_msec;
     c->deferred_volume_safety_margin_usec = conf->deferred_volume_safety_margin_usec;
     c->deferred_volume_extra_delay_usec = conf->deferred_volume_extra_delay_usec;
+    c->volume_horizon_usec = (pa_usec_t) conf->volume_horizon_msec * PA_USEC_PER_MSEC;
     c->lfe_crossover_freq = conf->lfe_crossover_freq;
     c->exit_idle_time = conf->exit_idle_time;
     c->scache_idle_time = conf->scache_idle_time;
     c->resample_method = conf->resample_method;
     c->realtime_priority = conf->realtime_priority;
     c->realtime_scheduling = conf->realtime_scheduling;
+    c->thread_affinity = pa_xstrdup(conf->thread_affinity);
     c->avoid_resampling = conf->avoid_resampling;
     c->disable_remixing = conf->disable_remixing;
     c->remixing_use_all_sink_channels = conf->remixing_use_all_sink_channels;
     c->disable_lfe_remixing = conf->disable_lfe_remixing;
+    c->premix_inputs = conf->premix_inputs;
+    c->render_threads = conf->render_threads;
+    c->io_thread_cpu_budget = conf->io_thread_cpu_budget;
     c->deferred_volume = conf->deferred_volume;
     c->running_as_daemon = conf->daemonize;
     c->disallow_exit = conf->disallow_exit;
@@ -1136,6 +1157,12 @@ int main(int argc, char *argv[]) {
 
     pa_log_info("Daemon startup complete.");
 
+    /* With a memfd pool we never create a POSIX SHM segment ourselves,
+     * and thus never look for the stale ones of crashed processes. Do
+     * that once now that we are up, instead of delaying the startup. */
+    if (pa_mempool_is_memfd_backed(c->mempool))
+        pa_mainloop_api_once(pa_mainloop_get_api(mainloop), shm_cleanup_cb, NULL);
+
 #ifdef HAVE_SYSTEMD_DAEMON
     sd_notify(0, "READY=1");
 #endif
@@ -1177,6 +1204,8 @@ finish:
         pa_log_info("Daemon terminated.");
     }
 
+    pa_log_set_async(false);
+
     if (!conf->no_cpu_limit)
         pa_cpu_limit_done();
 
@@ -31,6 +31,7 @@
 #endif
 
 #include <pulse/mainloop-api.h>
+#include <pulse/rtclock.h>
 #include <pulse/sample.h>
 #include <pulse/timeval.h>
 #include <pulse/util.h>
@@ -43,7 +44,9 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/conf-parser.h>
+#include <pulsecore/mutex.h>
 #include <pulsecore/strbuf.h>
+#include <pulsecore/thread.h>
 
 #include "alsa-mixer.h"
 #include "alsa-util.h"
@@ -436,16 +439,41 @@ int pa_alsa_fdlist_set_handle(struct pa_alsa_fdlist *fdl, snd_mixer_t *mixer_han
     return 0;
 }
 
+/* Don't complain about written volumes that are off by less than this */
+#define WRITER_ACCURACY (PA_VOLUME_NORM/100)
+
 struct pa_alsa_mixer_pdata {
     pa_rtpoll *rtpoll;
     pa_rtpoll_item *poll_item;
     snd_mixer_t *mixer;
+
+    /* Held by everyone using the mixer, recursive since the element
+     * callbacks run from snd_mixer_handle_events() use it again */
+    pa_mutex *mutex;
+
+    /* The volume writer thread and the volume it is to write next,
+     * protected by writer_mutex, which is never held while writing */
+    pa_thread *writer;
+    snd_mixer_t *writer_mixer;
+    pa_mutex *writer_mutex;
+    pa_cond *writer_cond;
+    bool writer_quit;
+
+    bool pending;
+    struct pending_volume {
+        pa_alsa_path *path;
+        pa_channel_map channel_map;
+        pa_cvolume volume;
+        pa_usec_t due;
+        unsigned n_coalesced;
+    } volume;
 };
 
 struct pa_alsa_mixer_pdata *pa_alsa_mixer_pdata_new(void) {
     struct pa_alsa_mixer_pdata *pd;
 
     pd = pa_xnew0(struct pa_alsa_mixer_pdata, 1);
+    pd->mutex = pa_mutex_new(true, true);
 
     return pd;
 }
@@ -453,13 +481,189 @@ struct pa_alsa_mixer_pdata *pa_alsa_mixer_pdata_new(void) {
 void pa_alsa_mixer_pdata_free(struct pa_alsa_mixer_pdata *pd) {
     pa_assert(pd);
 
+    if (pd->writer) {
+        pa_mutex_lock(pd->writer_mutex);
+        pd->writer_quit = true;
+        pa_cond_signal(pd->writer_cond, false);
+        pa_mutex_unlock(pd->writer_mutex);
+
+        pa_thread_free(pd->writer);
+    }
+
+    if (pd->writer_cond)
+        pa_cond_free(pd->writer_cond);
+
+    if (pd->writer_mutex)
+        pa_mutex_free(pd->writer_mutex);
+
     if (pd->poll_item) {
         pa_rtpoll_item_free(pd->poll_item);
     }
 
+    pa_mutex_free(pd->mutex);
+
     pa_xfree(pd);
 }
 
+/* Called with pd->mutex held */
+static void write_volume(pa_alsa_path *p, snd_mixer_t *m, const pa_channel_map *cm, const pa_cvolume *v) {
+    pa_cvolume written = *v, tmp;
+
+    if (pa_alsa_path_set_volume(p, m, cm, &written, true, true) < 0) {
+        pa_log_error("Writing HW volume failed");
+        return;
+    }
+
+    pa_sw_cvolume_divide(&tmp, &written, v);
+
+    if (pa_cvolume_min(&tmp) < PA_VOLUME_NORM - WRITER_ACCURACY ||
+        pa_cvolume_max(&tmp) > PA_VOLUME_NORM + WRITER_ACCURACY) {
+        char volume_buf[2][PA_CVOLUME_SNPRINT_VERBOSE_MAX];
+
+        pa_log_debug("Written HW volume did not match with the request: %s (request) != %s",
+                     pa_cvolume_snprint_verbose(volume_buf[0], sizeof(volume_buf[0]), v, cm, true),
+                     pa_cvolume_snprint_verbose(volume_buf[1], sizeof(volume_buf[1]), &written, cm, true));
+    }
+}
+
+/* Called with pd->mutex held */
+static void write_pending_volume(pa_alsa_mixer_pdata *pd, const struct pending_volume *pv) {
+    pa_usec_t now;
+
+    write_volume(pv->path, pd->writer_mixer, &pv->channel_map, &pv->volume);
+
+    now = pa_rtclock_now();
+
+    if (pv->n_coalesced > 0)
+        pa_log_debug("Skipped %u volume writes that were superseded before they were written.", pv->n_coalesced);
+
+    if (pa_log_ratelimit(PA_LOG_DEBUG))
+        pa_log_debug("HW volume was written %llu usec after it was due.", (unsigned long long) (now - pv->due));
+}
+
+/* Called with pd->writer_mutex held */
+static void take_pending_volume(pa_alsa_mixer_pdata *pd, struct pending_volume *pv) {
+    *pv = pd->volume;
+
+    pd->pending = false;
+    pd->volume.n_coalesced = 0;
+}
+
+static void writer_thread(void *userdata) {
+    pa_alsa_mixer_pdata *pd = userdata;
+
+    pa_assert(pd);
+
+    /* Nobody waits for the volume writes, they can wait for everybody
+     * else. The thread inherited the priority of the main thread,
+     * setpriority() only affects the calling thread on Linux. */
+    pa_reset_priority();
+
+    pa_mutex_lock(pd->writer_mutex);
+
+    for (;;) {
+        struct pending_volume pv;
+
+        while (!pd->pending && !pd->writer_quit)
+            pa_cond_wait(pd->writer_cond, pd->writer_mutex);
+
+        /* The last volume is still written when we are asked to quit */
+        if (!pd->pending)
+            break;
+
+        take_pending_volume(pd, &pv);
+        pa_mutex_unlock(pd->writer_mutex);
+
+        pa_mutex_lock(pd->mutex);
+        write_pending_volume(pd, &pv);
+        pa_mutex_unlock(pd->mutex);
+
+        pa_mutex_lock(pd->writer_mutex);
+    }
+
+    pa_mutex_unlock(pd->writer_mutex);
+}
+
+void pa_alsa_mixer_pdata_lock(pa_alsa_mixer_pdata *pd) {
+    struct pending_volume pv;
+    bool pending = false;
+
+    pa_assert(pd);
+
+    pa_mutex_lock(pd->mutex);
+
+    if (!pd->writer)
+        return;
+
+    /* Whoever looks at the mixer expects the volume that was handed to
+     * the writer to be there already, so if it wasn't written yet we do
+     * it right here */
+    pa_mutex_lock(pd->writer_mutex);
+    if (pd->pending) {
+        take_pending_volume(pd, &pv);
+        pending = true;
+    }
+    pa_mutex_unlock(pd->writer_mutex);
+
+    if (pending)
+        write_pending_volume(pd, &pv);
+}
+
+void pa_alsa_mixer_pdata_unlock(pa_alsa_mixer_pdata *pd) {
+    pa_assert(pd);
+
+    pa_mutex_unlock(pd->mutex);
+}
+
+int pa_alsa_mixer_pdata_start_writer(pa_alsa_mixer_pdata *pd, snd_mixer_t *mixer, const char *name) {
+    pa_assert(pd);
+    pa_assert(mixer);
+    pa_assert(name);
+    pa_assert(!pd->writer);
+
+    pd->writer_mixer = mixer;
+    pd->writer_mutex = pa_mutex_new(false, true);
+    pd->writer_cond = pa_cond_new();
+
+    if (!(pd->writer = pa_thread_new(name, writer_thread, pd))) {
+        pa_log_warn("Failed to create volume writer thread, writing the volume directly.");
+        return -1;
+    }
+
+    return 0;
+}
+
+void pa_alsa_mixer_pdata_write_volume(pa_alsa_mixer_pdata *pd, pa_alsa_path *p, snd_mixer_t *m, const pa_channel_map *cm, const pa_cvolume *v) {
+    pa_assert(pd);
+    pa_assert(p);
+    pa_assert(m);
+    pa_assert(cm);
+    pa_assert(v);
+
+    if (!pd->writer) {
+        pa_mutex_lock(pd->mutex);
+        write_volume(p, m, cm, v);
+        pa_mutex_unlock(pd->mutex);
+        return;
+    }
+
+    pa_assert(m == pd->writer_mixer);
+
+    pa_mutex_lock(pd->writer_mutex);
+
+    if (pd->pending)
+        pd->volume.n_coalesced++;
+
+    pd->pending = true;
+    pd->volume.path = p;
+    pd->volume.channel_map = *cm;
+    pd->volume.volume = *v;
+    pd->volume.due = pa_rtclock_now();
+
+    pa_cond_signal(pd->writer_cond, false);
+    pa_mutex_unlock(pd->writer_mutex);
+}
+
 static int rtpoll_work_cb(pa_rtpoll_item *i) {
     struct pa_alsa_mixer_pdata *pd;
     struct pollfd *p;
@@ -473,6 +677,8 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
 
     p = pa_rtpoll_item_get_pollfd(i, &n_fds);
 
+    pa_alsa_mixer_pdata_lock(pd);
+
     if ((err = snd_mixer_poll_descriptors_revents(pd->mixer, p, n_fds, &revents)) < 0) {
         pa_log_error("Unable to get poll revent: %s", pa_alsa_strerror(err));
         ret = -1;
@@ -501,6 +707,8 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
         }
     }
 
+    pa_alsa_mixer_pdata_unlock(pd);
+
     return ret;
 
 fail:
@@ -510,6 +718,8 @@ fail:
     pd->rtpoll = NULL;
     pd->mixer = NULL;
 
+    pa_alsa_mixer_pdata_unlock(pd);
+
     return ret;
 }
 
@@ -3933,8 +4143,10 @@ fail:
     return -1;
 }
 
+/* If the PCM of the mapping isn't open, the mixer of card_index is used */
 static void mapping_paths_probe(pa_alsa_mapping *m, pa_alsa_profile *profile,
-                                pa_alsa_direction_t direction, pa_hashmap *used_paths) {
+                                pa_alsa_direction_t direction, pa_hashmap *used_paths,
+                                pa_hashmap *mixers, int card_index) {
 
     pa_alsa_path *p;
     void *state;
@@ -3957,9 +4169,11 @@ static void mapping_paths_probe(pa_alsa_mapping *m, pa_alsa_profile *profile,
     if (!ps)
         return; /* No paths */
 
-    pa_assert(pcm_handle);
+    if (pcm_handle)
+        mixer_handle = pa_alsa_open_mixer_for_pcm_cached(mixers, pcm_handle);
+    else
+        mixer_handle = pa_alsa_open_mixer_cached(mixers, card_index);
 
-    mixer_handle = pa_alsa_open_mixer_for_pcm(pcm_handle, NULL);
     if (!mixer_handle) {
         /* Cannot open mixer, remove all entries */
         pa_hashmap_remove_all(ps->paths);
@@ -3975,9 +4189,6 @@ static void mapping_paths_probe(pa_alsa_mapping *m, pa_alsa_profile *profile,
     path_set_condense(ps, mixer_handle);
     path_set_make_path_descriptions_unique(ps);
 
-    if (mixer_handle)
-        snd_mixer_close(mixer_handle);
-
     PA_HASHMAP_FOREACH(p, ps->paths, state)
         pa_hashmap_put(used_paths, p, p);
 
@@ -4544,7 +4755,7 @@ void pa_alsa_profile_set_probe(
     pa_alsa_profile *p, *last = NULL;
     pa_alsa_profile **pp, **probe_order;
     pa_alsa_mapping *m;
-    pa_hashmap *broken_inputs, *broken_outputs, *used_paths;
+    pa_hashmap *broken_inputs, *broken_outputs, *used_paths, *mixers;
 
     pa_assert(ps);
     pa_assert(dev_id);
@@ -4556,6 +4767,7 @@ void pa_alsa_profile_set_probe(
     broken_inputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
     broken_outputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
     used_paths = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    mixers = pa_alsa_mixer_cache_new();
     pp = probe_order = pa_xnew0(pa_alsa_profile *, pa_hashmap_size(ps->profiles) + 1);
 
     pp += add_profiles_to_probe(pp, ps->profiles, false, false);
@@ -4657,14 +4869,14 @@ void pa_alsa_profile_set_probe(
             PA_IDXSET_FOREACH(m, p->output_mappings, idx)
                 if (m->output_pcm) {
                     found_output |= !p->fallback_output;
-                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT, used_paths);
+                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT, used_paths, mixers, -1);
                 }
 
         if (p->input_mappings)
             PA_IDXSET_FOREACH(m, p->input_mappings, idx)
                 if (m->input_pcm) {
                     found_input |= !p->fallback_input;
-                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT, used_paths);
+                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT, used_paths, mixers, -1);
                 }
     }
 
@@ -4678,11 +4890,163 @@ void pa_alsa_profile_set_probe(
     pa_hashmap_free(broken_inputs);
     pa_hashmap_free(broken_outputs);
     pa_hashmap_free(used_paths);
+    pa_hashmap_free(mixers);
     pa_xfree(probe_order);
 
     ps->probed = true;
 }
 
+/* The probe result is stored as one line per supported profile and
+ * mapping:
+ *
+ *   profile <profile name>
+ *   mapping <channel map> <mapping name>
+ *
+ * The channel map is stored since probing may change it for mappings
+ * that don't insist on exact channels. */
+
+char *pa_alsa_profile_set_probe_result(pa_alsa_profile_set *ps) {
+    pa_strbuf *buf;
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    void *state;
+    char cm[PA_CHANNEL_MAP_SNPRINT_MAX];
+
+    pa_assert(ps);
+    pa_assert(ps->probed);
+
+    buf = pa_strbuf_new();
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state)
+        pa_strbuf_printf(buf, "profile %s\n", p->name);
+
+    PA_HASHMAP_FOREACH(m, ps->mappings, state)
+        pa_strbuf_printf(buf, "mapping %s %s\n", pa_channel_map_snprint(cm, sizeof(cm), &m->channel_map), m->name);
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+int pa_alsa_profile_set_probe_from_result(pa_alsa_profile_set *ps, const char *dev_id, const char *result) {
+    pa_hashmap *profiles, *channel_maps, *used_paths, *mixers;
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    pa_channel_map *map;
+    const char *state = NULL;
+    char *line;
+    void *s;
+    uint32_t idx;
+    int card_index, ret = -1;
+
+    pa_assert(ps);
+    pa_assert(dev_id);
+    pa_assert(result);
+
+    if (ps->probed)
+        return 0;
+
+    if ((card_index = snd_card_get_index(dev_id)) < 0)
+        return -1;
+
+    profiles = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    channel_maps = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL, pa_xfree);
+
+    /* Everything has to match the current profile set, or we don't use
+     * any of it */
+    while ((line = pa_split(result, "\n", &state))) {
+        char *name;
+
+        if (pa_startswith(line, "profile ")) {
+            if (!(p = pa_hashmap_get(ps->profiles, line + 8))) {
+                pa_xfree(line);
+                goto finish;
+            }
+
+            pa_hashmap_put(profiles, p->name, p);
+        } else if (pa_startswith(line, "mapping ") && (name = strchr(line + 8, ' '))) {
+            *(name++) = 0;
+
+            if (!(m = pa_hashmap_get(ps->mappings, name))) {
+                pa_xfree(line);
+                goto finish;
+            }
+
+            map = pa_xnew(pa_channel_map, 1);
+            if (!pa_channel_map_parse(map, line + 8) || (m->exact_channels && map->channels != m->channel_map.channels)) {
+                pa_xfree(map);
+                pa_xfree(line);
+                goto finish;
+            }
+
+            pa_hashmap_put(channel_maps, m, map);
+        } else {
+            pa_xfree(line);
+            goto finish;
+        }
+
+        pa_xfree(line);
+    }
+
+    if (pa_hashmap_isempty(profiles))
+        goto finish;
+
+    PA_HASHMAP_FOREACH(p, profiles, s) {
+        if (p->output_mappings)
+            PA_IDXSET_FOREACH(m, p->output_mappings, idx)
+                if (!pa_hashmap_get(channel_maps, m))
+                    goto finish;
+
+        if (p->input_mappings)
+            PA_IDXSET_FOREACH(m, p->input_mappings, idx)
+                if (!pa_hashmap_get(channel_maps, m))
+                    goto finish;
+    }
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, s)
+        p->supported = !!pa_hashmap_get(profiles, p->name);
+
+    PA_HASHMAP_FOREACH(m, ps->mappings, s)
+        if ((map = pa_hashmap_get(channel_maps, m)))
+            m->channel_map = *map;
+
+    used_paths = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    mixers = pa_alsa_mixer_cache_new();
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, s) {
+        if (!p->supported)
+            continue;
+
+        pa_log_debug("Profile %s supported (cached).", p->name);
+
+        if (p->output_mappings)
+            PA_IDXSET_FOREACH(m, p->output_mappings, idx) {
+                m->supported++;
+                mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT, used_paths, mixers, card_index);
+            }
+
+        if (p->input_mappings)
+            PA_IDXSET_FOREACH(m, p->input_mappings, idx) {
+                m->supported++;
+                mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT, used_paths, mixers, card_index);
+            }
+    }
+
+    pa_alsa_profile_set_drop_unsupported(ps);
+
+    paths_drop_unused(ps->input_paths, used_paths);
+    paths_drop_unused(ps->output_paths, used_paths);
+    pa_hashmap_free(used_paths);
+    pa_hashmap_free(mixers);
+
+    ps->probed = true;
+    ret = 0;
+
+finish:
+    pa_hashmap_free(profiles);
+    pa_hashmap_free(channel_maps);
+
+    return ret;
+}
+
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *ps) {
     pa_alsa_profile *p;
     pa_alsa_mapping *m;
@@ -346,8 +346,25 @@ void pa_alsa_profile_set_free(pa_alsa_profile_set *s);
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *s);
 void pa_alsa_profile_set_drop_unsupported(pa_alsa_profile_set *s);
 
+/* Returns the outcome of pa_alsa_profile_set_probe() in a form that can
+ * be stored and handed to pa_alsa_profile_set_probe_from_result() later,
+ * which then only probes the mixer paths instead of opening every PCM.
+ * Returns a negative value if the result doesn't fit the profile set,
+ * which is then left untouched for a full probe. */
+char *pa_alsa_profile_set_probe_result(pa_alsa_profile_set *ps);
+int pa_alsa_profile_set_probe_from_result(pa_alsa_profile_set *ps, const char *dev_id, const char *result);
+
 snd_mixer_t *pa_alsa_open_mixer_for_pcm(snd_pcm_t *pcm, char **ctl_device);
 
+/* Opening and loading a mixer is slow on some devices (USB in
+ * particular), but probing needs one for every mapping of a card. A
+ * mixer cache lets all of them share one mixer per control device.
+ * Mixers returned by pa_alsa_open_mixer_for_pcm_cached() are owned by
+ * the cache and closed when it is freed with pa_hashmap_free(). */
+pa_hashmap *pa_alsa_mixer_cache_new(void);
+snd_mixer_t *pa_alsa_open_mixer_for_pcm_cached(pa_hashmap *mixers, snd_pcm_t *pcm);
+snd_mixer_t *pa_alsa_open_mixer_cached(pa_hashmap *mixers, int alsa_card_index);
+
 pa_alsa_fdlist *pa_alsa_fdlist_new(void);
 void pa_alsa_fdlist_free(pa_alsa_fdlist *fdl);
 int pa_alsa_fdlist_set_handle(pa_alsa_fdlist *fdl, snd_mixer_t *mixer_handle, snd_hctl_t *hctl_handle, pa_mainloop_api* m);
@@ -358,6 +375,18 @@ pa_alsa_mixer_pdata *pa_alsa_mixer_pdata_new(void);
 void pa_alsa_mixer_pdata_free(pa_alsa_mixer_pdata *pd);
 int pa_alsa_set_mixer_rtpoll(struct pa_alsa_mixer_pdata *pd, snd_mixer_t *mixer, pa_rtpoll *rtp);
 
+/* Mixer writes can take milliseconds on some codecs, so with deferred
+ * volume the IO thread hands them to a low priority thread. Only the
+ * latest volume that hasn't been written yet is kept, it is written to
+ * all elements of its path in one go. Whoever else uses the mixer while
+ * the writer runs has to hold the lock; the event handling set up with
+ * pa_alsa_set_mixer_rtpoll() takes it by itself. If the thread can't be
+ * started, pa_alsa_mixer_pdata_write_volume() writes directly. */
+int pa_alsa_mixer_pdata_start_writer(pa_alsa_mixer_pdata *pd, snd_mixer_t *mixer, const char *name);
+void pa_alsa_mixer_pdata_write_volume(pa_alsa_mixer_pdata *pd, pa_alsa_path *p, snd_mixer_t *m, const pa_channel_map *cm, const pa_cvolume *v);
+void pa_alsa_mixer_pdata_lock(pa_alsa_mixer_pdata *pd);
+void pa_alsa_mixer_pdata_unlock(pa_alsa_mixer_pdata *pd);
+
 /* Data structure for inclusion in pa_device_port for alsa
  * sinks/sources. This contains nothing that needs to be freed
  * individually */
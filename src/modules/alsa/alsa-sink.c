@@ -43,6 +43,7 @@
 #include <pulsecore/memchunk.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/modargs.h>
+#include <pulsecore/period-trace.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/sample-util.h>
@@ -52,6 +53,8 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/watermark-model.h>
+#include <pulsecore/trace.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -66,16 +69,13 @@
 #define DEFAULT_TSCHED_WATERMARK_USEC (20*PA_USEC_PER_MSEC)        /* 20ms  -- Fill up when only this much is left in the buffer */
 
 #define TSCHED_WATERMARK_INC_STEP_USEC (10*PA_USEC_PER_MSEC)       /* 10ms  -- On underrun, increase watermark by this */
-#define TSCHED_WATERMARK_DEC_STEP_USEC (5*PA_USEC_PER_MSEC)        /* 5ms   -- When everything's great, decrease watermark by this */
-#define TSCHED_WATERMARK_VERIFY_AFTER_USEC (20*PA_USEC_PER_SEC)    /* 20s   -- How long after a drop out recheck if things are good now */
-#define TSCHED_WATERMARK_INC_THRESHOLD_USEC (0*PA_USEC_PER_MSEC)   /* 0ms   -- If the buffer level ever below this threshold, increase the watermark */
-#define TSCHED_WATERMARK_DEC_THRESHOLD_USEC (100*PA_USEC_PER_MSEC) /* 100ms -- If the buffer level didn't drop below this threshold in the verification time, decrease the watermark */
-
-/* Note that TSCHED_WATERMARK_INC_THRESHOLD_USEC == 0 means that we
- * will increase the watermark only if we hit a real underrun. */
+#define TSCHED_WATERMARK_HALF_LIFE_USEC (10*PA_USEC_PER_SEC)       /* 10s   -- How quickly old wakeup lateness samples are forgotten */
+#define TSCHED_WATERMARK_HOLD_USEC (5*PA_USEC_PER_SEC)             /* 5s    -- Don't decrease the watermark for this long after raising it */
+#define TSCHED_WATERMARK_MARGIN_USEC (5*PA_USEC_PER_MSEC)          /* 5ms   -- Keep at least this much on top of the measured wakeup lateness */
 
 #define TSCHED_MIN_SLEEP_USEC (10*PA_USEC_PER_MSEC)                /* 10ms  -- Sleep at least 10ms on each iteration */
 #define TSCHED_MIN_WAKEUP_USEC (4*PA_USEC_PER_MSEC)                /* 4ms   -- Wakeup at least this long before the buffer runs empty*/
+#define TSCHED_TIMER_SLACK_USEC (50)                               /* 50us  -- Timer slack of the IO thread, for when there is no timerfd */
 
 #define SMOOTHER_WINDOW_USEC  (10*PA_USEC_PER_SEC)                 /* 10s   -- smoother windows size */
 #define SMOOTHER_ADJUST_USEC  (1*PA_USEC_PER_SEC)                  /* 1s    -- smoother adjust time */
@@ -90,6 +90,9 @@
 
 #define DEFAULT_WRITE_ITERATION_THRESHOLD 0.03 /* don't iterate write if < 3% of the buffer is available */
 
+#define BATCH_MIN_PERIOD_USEC (4*PA_USEC_PER_MSEC)                 /* 4ms   -- Shortest period for batch_fixed_latency, a few USB packets */
+#define BATCH_PERIODS 3                                            /* Periods in the buffer for batch_fixed_latency */
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -101,6 +104,12 @@ struct userdata {
 
     snd_pcm_t *pcm_handle;
 
+    /* What pcm_handle was configured for. While the sink is suspended
+     * for PA_SUSPEND_IDLE_SOFT alone pcm_handle is only stopped, and is
+     * reused on resume if these still match. */
+    pa_sample_spec pcm_sample_spec;
+    bool pcm_nonaudio;
+
     char *paths_dir;
     pa_alsa_fdlist *mixer_fdl;
     pa_alsa_mixer_pdata *mixer_pd;
@@ -122,29 +131,28 @@ struct userdata {
         min_sleep,
         min_wakeup,
         watermark_inc_step,
-        watermark_dec_step,
-        watermark_inc_threshold,
-        watermark_dec_threshold,
         rewind_safeguard;
 
     snd_pcm_uframes_t frames_per_block;
 
-    pa_usec_t watermark_dec_not_before;
     pa_usec_t min_latency_ref;
     pa_usec_t tsched_watermark_usec;
 
     pa_memchunk memchunk;
 
     char *device_name;  /* name of the PCM device */
+    char *thread_affinity;
     char *control_device; /* name of the control device */
 
-    bool use_mmap:1, use_tsched:1, deferred_volume:1, fixed_latency_range:1;
+    bool use_mmap:1, use_tsched:1, deferred_volume:1, fixed_latency_range:1, batch_mode:1;
 
     bool first, after_rewind;
 
     pa_rtpoll_item *alsa_rtpoll_item;
 
     pa_smoother *smoother;
+    pa_alsa_tstamp tstamp;
+    pa_watermark_model *watermark_model;
     uint64_t write_count;
     uint64_t since_start;
     pa_usec_t smoother_interval;
@@ -152,6 +160,12 @@ struct userdata {
 
     pa_idxset *formats;
 
+    /* Only if period_trace_file= is set. The record of the current
+     * iteration of the IO thread, and when its timer was due. */
+    pa_period_trace *period_trace;
+    pa_period_record *period_record;
+    pa_usec_t period_target;
+
     pa_reserve_wrapper *reserve;
     pa_hook_slot *reserve_slot;
     pa_reserve_monitor_wrapper *monitor;
@@ -161,6 +175,10 @@ struct userdata {
     pa_alsa_ucm_mapping_context *ucm_context;
 };
 
+enum {
+    SINK_MESSAGE_KEEP_OPEN = PA_SINK_MESSAGE_MAX
+};
+
 static void userdata_free(struct userdata *u);
 
 /* FIXME: Is there a better way to do this than device names? */
@@ -172,6 +190,17 @@ static bool is_hdmi(struct userdata *u) {
     return (strncmp("hdmi", u->device_name, 4) == 0);
 }
 
+/* Passthrough on these needs the device opened in NONAUDIO mode */
+static bool needs_nonaudio(struct userdata *u) {
+    return (is_iec958(u) || is_hdmi(u)) && pa_sink_is_passthrough(u->sink);
+}
+
+/* Whether the device may stay open while suspended for the given
+ * cause */
+static bool keep_open_for(pa_suspend_cause_t cause) {
+    return cause && !(cause & ~PA_SUSPEND_IDLE_SOFT);
+}
+
 static pa_hook_result_t reserve_cb(pa_reserve_wrapper *r, void *forced, struct userdata *u) {
     pa_assert(r);
     pa_assert(u);
@@ -363,38 +392,30 @@ static void increase_watermark(struct userdata *u) {
     /* When we reach this we're officially fucked! */
 }
 
-static void decrease_watermark(struct userdata *u) {
+static void update_watermark(struct userdata *u, pa_usec_t now) {
     size_t old_watermark;
-    pa_usec_t now;
+    pa_usec_t suggested;
 
     pa_assert(u);
     pa_assert(u->use_tsched);
 
-    now = pa_rtclock_now();
+    suggested = pa_watermark_model_suggest(u->watermark_model, now, u->tsched_watermark_usec);
 
-    if (u->watermark_dec_not_before <= 0)
-        goto restart;
-
-    if (u->watermark_dec_not_before > now)
+    if (suggested == u->tsched_watermark_usec)
         return;
 
     old_watermark = u->tsched_watermark;
-
-    if (u->tsched_watermark < u->watermark_dec_step)
-        u->tsched_watermark = u->tsched_watermark / 2;
-    else
-        u->tsched_watermark = PA_MAX(u->tsched_watermark / 2, u->tsched_watermark - u->watermark_dec_step);
-
+    u->tsched_watermark = pa_usec_to_bytes_round_up(suggested, &u->sink->sample_spec);
     fix_tsched_watermark(u);
 
-    if (old_watermark != u->tsched_watermark)
+    if (u->tsched_watermark > old_watermark)
+        pa_log_info("Increasing wakeup watermark to %0.2f ms",
+                    (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC);
+    else if (u->tsched_watermark < old_watermark)
         pa_log_info("Decreasing wakeup watermark to %0.2f ms",
                     (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC);
 
     /* We don't change the latency range*/
-
-restart:
-    u->watermark_dec_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
 }
 
 static void hw_sleep_time(struct userdata *u, pa_usec_t *sleep_usec, pa_usec_t*process_usec) {
@@ -436,8 +457,14 @@ static int try_recover(struct userdata *u, const char *call, int err) {
 
     pa_assert(err != -EAGAIN);
 
-    if (err == -EPIPE)
+    if (err == -EPIPE) {
         pa_log_debug("%s: Buffer underrun!", call);
+        PA_TRACE1(alsa_sink_underrun, u->sink->index);
+        if (u->period_trace)
+            pa_period_trace_glitch(u->period_trace, "Buffer underrun");
+        pa_core_post_xrun_event(u->core, PA_XRUN_CAUSE_HW_UNDERRUN, PA_DEVICE_TYPE_SINK, u->sink->index, PA_INVALID_INDEX,
+                                u->use_tsched ? u->tsched_watermark_usec : 0, u->use_tsched ? u->tsched_watermark_usec : 0);
+    }
 
     if (err == -ESTRPIPE)
         pa_log_debug("%s: System suspended!", call);
@@ -455,6 +482,11 @@ static int try_recover(struct userdata *u, const char *call, int err) {
 static size_t check_left_to_play(struct userdata *u, size_t n_bytes, bool on_timeout) {
     size_t left_to_play;
     bool underrun = false;
+    pa_usec_t watermark_before = u->use_tsched ? u->tsched_watermark_usec : 0;
+
+    /* The first call of an iteration sees the most room */
+    if (u->period_record)
+        u->period_record->avail = PA_MAX(u->period_record->avail, (uint32_t) n_bytes);
 
     /* We use <= instead of < for this check here because an underrun
      * only happens after the last sample was processed, not already when
@@ -479,34 +511,41 @@ static size_t check_left_to_play(struct userdata *u, size_t n_bytes, bool on_tim
     }
 
 #ifdef DEBUG_TIMING
-    pa_log_debug("%0.2f ms left to play; inc threshold = %0.2f ms; dec threshold = %0.2f ms",
+    pa_log_debug("%0.2f ms left to play; watermark = %0.2f ms; p99 wakeup lateness = %0.2f ms",
                  (double) pa_bytes_to_usec(left_to_play, &u->sink->sample_spec) / PA_USEC_PER_MSEC,
-                 (double) pa_bytes_to_usec(u->watermark_inc_threshold, &u->sink->sample_spec) / PA_USEC_PER_MSEC,
-                 (double) pa_bytes_to_usec(u->watermark_dec_threshold, &u->sink->sample_spec) / PA_USEC_PER_MSEC);
+                 (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC,
+                 (double) pa_watermark_model_quantile(u->watermark_model, 0.99) / PA_USEC_PER_MSEC);
 #endif
 
-    if (u->use_tsched) {
-        bool reset_not_before = true;
-
-        if (!u->first && !u->after_rewind) {
-            if (underrun || left_to_play < u->watermark_inc_threshold)
-                increase_watermark(u);
-            else if (left_to_play > u->watermark_dec_threshold) {
-                reset_not_before = false;
-
-                /* We decrease the watermark only if have actually
-                 * been woken up by a timeout. If something else woke
-                 * us up it's too easy to fulfill the deadlines... */
-
-                if (on_timeout)
-                    decrease_watermark(u);
-            }
+    if (u->use_tsched && !u->first && !u->after_rewind) {
+        pa_usec_t now = pa_rtclock_now();
+
+        if (underrun) {
+            pa_watermark_model_dropout(u->watermark_model, now, u->tsched_watermark_usec);
+            increase_watermark(u);
+        } else if (on_timeout) {
+            pa_usec_t left_usec = pa_bytes_to_usec(left_to_play, &u->sink->sample_spec);
+
+            /* We only learn from timer wakeups. We planned those for
+             * when exactly the watermark is left, whatever is missing
+             * is how late we were. If something else woke us up it
+             * tells us nothing about the timer. */
+            pa_watermark_model_add(u->watermark_model, now,
+                                   left_usec < u->tsched_watermark_usec ? u->tsched_watermark_usec - left_usec : 0);
+            update_watermark(u, now);
         }
-
-        if (reset_not_before)
-            u->watermark_dec_not_before = 0;
     }
 
+    if (underrun && !u->first && u->period_trace)
+        pa_period_trace_glitch(u->period_trace, u->after_rewind ? "Underrun after rewind" : "Underrun");
+
+    /* Underruns right after a rewind are expected and not fixed by a
+     * larger watermark, report them separately */
+    if (underrun && !u->first)
+        pa_core_post_xrun_event(u->core, u->after_rewind ? PA_XRUN_CAUSE_REWIND : PA_XRUN_CAUSE_HW_UNDERRUN,
+                                PA_DEVICE_TYPE_SINK, u->sink->index, PA_INVALID_INDEX,
+                                watermark_before, u->use_tsched ? u->tsched_watermark_usec : 0);
+
     return left_to_play;
 }
 
@@ -524,7 +563,7 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
 
     for (;;) {
         snd_pcm_sframes_t n;
-        size_t n_bytes;
+        size_t n_bytes, queued, unused;
         int r;
         bool after_avail = true;
 
@@ -546,6 +585,7 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
 #endif
 
         left_to_play = check_left_to_play(u, n_bytes, on_timeout);
+        queued = left_to_play;
         on_timeout = false;
 
         if (u->use_tsched)
@@ -564,9 +604,13 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
                 break;
             }
 
-        if (PA_UNLIKELY(n_bytes <= u->hwbuf_unused)) {
+        /* Right after a rewind for a stream volume change we don't
+         * refill the whole buffer, see pa_sink_refilled_within_thread() */
+        unused = pa_sink_get_refill_unused_within_thread(u->sink, u->hwbuf_size, u->hwbuf_unused);
+
+        if (PA_UNLIKELY(n_bytes <= unused)) {
 
-            if (polled)
+            if (polled && n_bytes <= u->hwbuf_unused)
                 PA_ONCE_BEGIN {
                     char *dn = pa_alsa_get_driver_name_by_pcm(u->pcm_handle);
                     pa_log(_("ALSA woke us up to write new data to the device, but there was actually nothing to write.\n"
@@ -597,7 +641,7 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
             break;
         }
 
-        n_bytes -= u->hwbuf_unused;
+        n_bytes -= unused;
         polled = false;
 
 #ifdef DEBUG_TIMING
@@ -627,8 +671,13 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
                 return r;
             }
 
-            /* Make sure that if these memblocks need to be copied they will fit into one slot */
-            frames = PA_MIN(frames, u->frames_per_block);
+            /* We render the whole contiguous area and commit it in one
+             * go, instead of doing a mmap_begin()/mmap_commit() round
+             * trip for every block. Those are expensive on some
+             * devices. The device only sees the data on commit, so
+             * don't keep more uncommitted than it still has queued,
+             * except for the first block. */
+            frames = PA_MIN(frames, PA_MAX(u->frames_per_block, (snd_pcm_uframes_t) (queued / u->frame_size)));
 
             if (!after_avail && frames == 0)
                 break;
@@ -646,13 +695,16 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
 
             p = (uint8_t*) areas[0].addr + (offset * u->frame_size);
 
-            written = frames * u->frame_size;
-            chunk.memblock = pa_memblock_new_fixed(u->core->mempool, p, written, true);
-            chunk.length = pa_memblock_get_length(chunk.memblock);
-            chunk.index = 0;
-
-            pa_sink_render_into_full(u->sink, &chunk);
-            pa_memblock_unref_fixed(chunk.memblock);
+            /* Make sure that if these memblocks need to be copied they will fit into one slot */
+            for (written = 0; written < frames * u->frame_size; written += chunk.length) {
+                chunk.memblock = pa_memblock_new_fixed(u->core->mempool, (uint8_t*) p + written,
+                                                       PA_MIN(frames * u->frame_size - written, u->frames_per_block * u->frame_size), true);
+                chunk.length = pa_memblock_get_length(chunk.memblock);
+                chunk.index = 0;
+
+                pa_sink_render_into_full(u->sink, &chunk);
+                pa_memblock_unref_fixed(chunk.memblock);
+            }
 
             if (PA_UNLIKELY((sframes = snd_pcm_mmap_commit(u->pcm_handle, offset, frames)) < 0)) {
 
@@ -669,6 +721,9 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
 
             u->write_count += written;
             u->since_start += written;
+            queued += written;
+
+            PA_TRACE2(alsa_sink_write, u->sink->index, written);
 
 #ifdef DEBUG_TIMING
             pa_log_debug("Wrote %lu bytes (of possible %lu bytes)", (unsigned long) written, (unsigned long) n_bytes);
@@ -681,6 +736,9 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
         }
     }
 
+    if (work_done)
+        pa_sink_refilled_within_thread(u->sink, u->hwbuf_size, u->hwbuf_unused);
+
     input_underrun = pa_sink_process_input_underruns(u->sink, left_to_play);
 
     if (u->use_tsched) {
@@ -715,7 +773,7 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
 
     for (;;) {
         snd_pcm_sframes_t n;
-        size_t n_bytes;
+        size_t n_bytes, unused;
         int r;
         bool after_avail = true;
 
@@ -748,9 +806,13 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
                 pa_bytes_to_usec(left_to_play, &u->sink->sample_spec) > process_usec+max_sleep_usec/2)
                 break;
 
-        if (PA_UNLIKELY(n_bytes <= u->hwbuf_unused)) {
+        /* Right after a rewind for a stream volume change we don't
+         * refill the whole buffer, see pa_sink_refilled_within_thread() */
+        unused = pa_sink_get_refill_unused_within_thread(u->sink, u->hwbuf_size, u->hwbuf_unused);
+
+        if (PA_UNLIKELY(n_bytes <= unused)) {
 
-            if (polled)
+            if (polled && n_bytes <= u->hwbuf_unused)
                 PA_ONCE_BEGIN {
                     char *dn = pa_alsa_get_driver_name_by_pcm(u->pcm_handle);
                     pa_log(_("ALSA woke us up to write new data to the device, but there was actually nothing to write!\n"
@@ -778,7 +840,7 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
             break;
         }
 
-        n_bytes -= u->hwbuf_unused;
+        n_bytes -= unused;
         polled = false;
 
         for (;;) {
@@ -833,6 +895,8 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
             u->write_count += written;
             u->since_start += written;
 
+            PA_TRACE2(alsa_sink_write, u->sink->index, written);
+
 /*         pa_log_debug("wrote %lu frames", (unsigned long) frames); */
 
             if (written >= n_bytes)
@@ -842,6 +906,9 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, bool polled, bo
         }
     }
 
+    if (work_done)
+        pa_sink_refilled_within_thread(u->sink, u->hwbuf_size, u->hwbuf_unused);
+
     input_underrun = pa_sink_process_input_underruns(u->sink, left_to_play);
 
     if (u->use_tsched) {
@@ -877,6 +944,8 @@ static void update_smoother(struct userdata *u) {
 
     /* Let's update the time smoother */
 
+    pa_alsa_tstamp_request(&u->tstamp, status);
+
     if (PA_UNLIKELY((err = pa_alsa_safe_delay(u->pcm_handle, status, &delay, u->hwbuf_size, &u->sink->sample_spec, false)) < 0)) {
         pa_log_warn("Failed to query DSP status data: %s", pa_alsa_strerror(err));
         return;
@@ -900,6 +969,7 @@ static void update_smoother(struct userdata *u) {
         position = 0;
 
     now2 = pa_bytes_to_usec((uint64_t) position, &u->sink->sample_spec);
+    now2 = pa_alsa_tstamp_position(&u->tstamp, status, now2);
 
     pa_smoother_put(u->smoother, now1, now2);
 
@@ -925,6 +995,21 @@ static int64_t sink_get_latency(struct userdata *u) {
     return delay;
 }
 
+/* Called from IO context. Lets the main thread calculate the latency
+ * like sink_get_latency() does. */
+static void update_latency_base(struct userdata *u) {
+    int64_t base;
+
+    pa_assert(u);
+
+    base = (int64_t) pa_bytes_to_usec(u->write_count, &u->sink->sample_spec);
+
+    if (u->memchunk.memblock)
+        base += pa_bytes_to_usec(u->memchunk.length, &u->sink->sample_spec);
+
+    pa_sink_set_latency_base_within_thread(u->sink, !!u->pcm_handle, base);
+}
+
 static int build_pollfd(struct userdata *u) {
     pa_assert(u);
     pa_assert(u->pcm_handle);
@@ -938,8 +1023,9 @@ static int build_pollfd(struct userdata *u) {
     return 0;
 }
 
-/* Called from IO context */
-static int suspend(struct userdata *u) {
+/* Called from IO context. If the sink is only suspended for being idle
+ * for a short while the device is just stopped, not closed. */
+static int suspend(struct userdata *u, bool keep_open) {
     pa_assert(u);
     pa_assert(u->pcm_handle);
 
@@ -947,8 +1033,12 @@ static int suspend(struct userdata *u) {
 
     /* Let's suspend -- we don't call snd_pcm_drain() here since that might
      * take awfully long with our long buffer sizes today. */
-    snd_pcm_close(u->pcm_handle);
-    u->pcm_handle = NULL;
+    if (keep_open)
+        snd_pcm_drop(u->pcm_handle);
+    else {
+        snd_pcm_close(u->pcm_handle);
+        u->pcm_handle = NULL;
+    }
 
     if (u->alsa_rtpoll_item) {
         pa_rtpoll_item_free(u->alsa_rtpoll_item);
@@ -963,7 +1053,9 @@ static int suspend(struct userdata *u) {
     pa_sink_set_max_rewind_within_thread(u->sink, 0);
     pa_sink_set_max_request_within_thread(u->sink, 0);
 
-    pa_log_info("Device suspended...");
+    update_latency_base(u);
+
+    pa_log_info(keep_open ? "Device stopped, keeping it open..." : "Device suspended...");
 
     return 0;
 }
@@ -1034,7 +1126,7 @@ static int update_sw_params(struct userdata *u, bool may_need_rewind) {
     }
 
     pa_sink_set_max_request_within_thread(u->sink, u->hwbuf_size - u->hwbuf_unused);
-    if (pa_alsa_pcm_is_hw(u->pcm_handle))
+    if (pa_alsa_pcm_is_hw(u->pcm_handle) && !u->batch_mode)
         pa_sink_set_max_rewind_within_thread(u->sink, u->hwbuf_size - u->hwbuf_unused);
     else {
         pa_log_info("Disabling rewind_within_thread for device %s", u->device_name);
@@ -1050,10 +1142,6 @@ static void reset_watermark(struct userdata *u, size_t tsched_watermark, pa_samp
     u->tsched_watermark = pa_convert_size(tsched_watermark, ss, &u->sink->sample_spec);
 
     u->watermark_inc_step = pa_usec_to_bytes(TSCHED_WATERMARK_INC_STEP_USEC, &u->sink->sample_spec);
-    u->watermark_dec_step = pa_usec_to_bytes(TSCHED_WATERMARK_DEC_STEP_USEC, &u->sink->sample_spec);
-
-    u->watermark_inc_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_INC_THRESHOLD_USEC, &u->sink->sample_spec);
-    u->watermark_dec_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_DEC_THRESHOLD_USEC, &u->sink->sample_spec);
 
     fix_min_sleep_wakeup(u);
     fix_tsched_watermark(u);
@@ -1077,8 +1165,9 @@ static void reset_watermark(struct userdata *u, size_t tsched_watermark, pa_samp
                 (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC);
 }
 
-/* Called from IO context */
-static int unsuspend(struct userdata *u) {
+/* Called from IO context. Opens the device again and configures it the
+ * way it was before it was closed by suspend(). */
+static int open_pcm(struct userdata *u) {
     pa_sample_spec ss;
     int err;
     bool b, d;
@@ -1088,9 +1177,7 @@ static int unsuspend(struct userdata *u) {
     pa_assert(u);
     pa_assert(!u->pcm_handle);
 
-    pa_log_info("Trying resume...");
-
-    if ((is_iec958(u) || is_hdmi(u)) && pa_sink_is_passthrough(u->sink)) {
+    if (needs_nonaudio(u)) {
         /* Need to open device in NONAUDIO mode */
         int len = strlen(u->device_name) + 8;
 
@@ -1136,9 +1223,52 @@ static int unsuspend(struct userdata *u) {
         goto fail;
     }
 
+    u->pcm_sample_spec = ss;
+    u->pcm_nonaudio = !!device_name;
+
+    pa_xfree(device_name);
+    return 0;
+
+fail:
+    if (u->pcm_handle) {
+        snd_pcm_close(u->pcm_handle);
+        u->pcm_handle = NULL;
+    }
+
+    pa_xfree(device_name);
+
+    return -PA_ERR_IO;
+}
+
+/* Called from IO context */
+static int unsuspend(struct userdata *u) {
+    int err;
+
+    pa_assert(u);
+
+    pa_log_info("Trying resume...");
+
+    /* A device that was only stopped can be started again right away,
+     * unless the rate or the passthrough mode changed meanwhile */
+    if (u->pcm_handle &&
+        (!pa_sample_spec_equal(&u->pcm_sample_spec, &u->sink->sample_spec) || u->pcm_nonaudio != needs_nonaudio(u))) {
+        snd_pcm_close(u->pcm_handle);
+        u->pcm_handle = NULL;
+    }
+
+    if (u->pcm_handle) {
+        if ((err = snd_pcm_prepare(u->pcm_handle)) < 0) {
+            pa_log("snd_pcm_prepare() failed: %s", pa_alsa_strerror(err));
+            goto fail;
+        }
+    } else if (open_pcm(u) < 0)
+        goto fail;
+
     if (update_sw_params(u, false) < 0)
         goto fail;
 
+    pa_alsa_tstamp_init(&u->tstamp, u->pcm_handle);
+
     if (build_pollfd(u) < 0)
         goto fail;
 
@@ -1150,13 +1280,14 @@ static int unsuspend(struct userdata *u) {
     u->first = true;
     u->since_start = 0;
 
+    update_latency_base(u);
+
     /* reset the watermark to the value defined when sink was created */
     if (u->use_tsched)
         reset_watermark(u, u->tsched_watermark_ref, &u->sink->sample_spec, true);
 
     pa_log_info("Resumed successfully...");
 
-    pa_xfree(device_name);
     return 0;
 
 fail:
@@ -1165,8 +1296,6 @@ fail:
         u->pcm_handle = NULL;
     }
 
-    pa_xfree(device_name);
-
     return -PA_ERR_IO;
 }
 
@@ -1196,7 +1325,9 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
                     pa_assert(PA_SINK_IS_OPENED(u->sink->thread_info.state));
 
-                    if ((r = suspend(u)) < 0)
+                    /* The main thread waits for us, so reading the
+                     * suspend cause is safe */
+                    if ((r = suspend(u, keep_open_for(u->sink->suspend_cause))) < 0)
                         return r;
 
                     break;
@@ -1226,6 +1357,24 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             }
 
             break;
+
+        case SINK_MESSAGE_KEEP_OPEN:
+
+            /* Posted by sink_suspend_cause_changed_cb(), the sink might
+             * have been resumed since */
+            if (u->sink->thread_info.state != PA_SINK_SUSPENDED)
+                return 0;
+
+            if (PA_PTR_TO_UINT(data) && !u->pcm_handle) {
+                if (open_pcm(u) >= 0)
+                    pa_log_info("Device opened in advance...");
+            } else if (!PA_PTR_TO_UINT(data) && u->pcm_handle) {
+                snd_pcm_close(u->pcm_handle);
+                u->pcm_handle = NULL;
+                pa_log_info("Device suspended...");
+            }
+
+            return 0;
     }
 
     return pa_sink_process_msg(o, code, data, offset, chunk);
@@ -1241,15 +1390,42 @@ static int sink_set_state_cb(pa_sink *s, pa_sink_state_t new_state) {
 
     old_state = pa_sink_get_state(u->sink);
 
-    if (PA_SINK_IS_OPENED(old_state) && new_state == PA_SINK_SUSPENDED)
-        reserve_done(u);
-    else if (old_state == PA_SINK_SUSPENDED && PA_SINK_IS_OPENED(new_state))
+    /* A device that stays open stays reserved */
+    if (PA_SINK_IS_OPENED(old_state) && new_state == PA_SINK_SUSPENDED) {
+        if (!keep_open_for(s->suspend_cause))
+            reserve_done(u);
+    } else if (old_state == PA_SINK_SUSPENDED && PA_SINK_IS_OPENED(new_state))
         if (reserve_init(u, u->device_name) < 0)
             return -PA_ERR_BUSY;
 
     return 0;
 }
 
+/* Called from main context */
+static void sink_suspend_cause_changed_cb(pa_sink *s, pa_suspend_cause_t old_cause) {
+    struct userdata *u;
+    bool keep_open;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if ((keep_open = keep_open_for(s->suspend_cause)) == keep_open_for(old_cause))
+        return;
+
+    if (keep_open) {
+        if (reserve_init(u, u->device_name) < 0)
+            return;
+
+        /* Opening the device can take a while, nobody needs to wait
+         * for it here */
+        pa_asyncmsgq_post(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_KEEP_OPEN, PA_UINT_TO_PTR(true), 0, NULL, NULL);
+    } else {
+        /* Whoever wants the device might be waiting for it */
+        pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_KEEP_OPEN, PA_UINT_TO_PTR(false), 0, NULL);
+        reserve_done(u);
+    }
+}
+
 static int ctl_mixer_callback(snd_mixer_elem_t *elem, unsigned int mask) {
     struct userdata *u = snd_mixer_elem_get_callback_private(elem);
 
@@ -1295,16 +1471,33 @@ static int io_mixer_callback(snd_mixer_elem_t *elem, unsigned int mask) {
     return 0;
 }
 
+/* With deferred volume the mixer is shared with the volume writer
+ * thread, see pa_alsa_mixer_pdata_start_writer() */
+static void mixer_lock(struct userdata *u) {
+    if (u->mixer_pd)
+        pa_alsa_mixer_pdata_lock(u->mixer_pd);
+}
+
+static void mixer_unlock(struct userdata *u) {
+    if (u->mixer_pd)
+        pa_alsa_mixer_pdata_unlock(u->mixer_pd);
+}
+
 static void sink_get_volume_cb(pa_sink *s) {
     struct userdata *u = s->userdata;
     pa_cvolume r;
     char volume_buf[PA_CVOLUME_SNPRINT_VERBOSE_MAX];
+    int ret;
 
     pa_assert(u);
     pa_assert(u->mixer_path);
     pa_assert(u->mixer_handle);
 
-    if (pa_alsa_path_get_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &r) < 0)
+    mixer_lock(u);
+    ret = pa_alsa_path_get_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &r);
+    mixer_unlock(u);
+
+    if (ret < 0)
         return;
 
     /* Shift down by the base volume, so that 0dB becomes maximum volume */
@@ -1328,6 +1521,7 @@ static void sink_set_volume_cb(pa_sink *s) {
     pa_cvolume r;
     char volume_buf[PA_CVOLUME_SNPRINT_VERBOSE_MAX];
     bool deferred_volume = !!(s->flags & PA_SINK_DEFERRED_VOLUME);
+    int ret;
 
     pa_assert(u);
     pa_assert(u->mixer_path);
@@ -1336,7 +1530,11 @@ static void sink_set_volume_cb(pa_sink *s) {
     /* Shift up by the base volume */
     pa_sw_cvolume_divide_scalar(&r, &s->real_volume, s->base_volume);
 
-    if (pa_alsa_path_set_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &r, deferred_volume, !deferred_volume) < 0)
+    mixer_lock(u);
+    ret = pa_alsa_path_set_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &r, deferred_volume, !deferred_volume);
+    mixer_unlock(u);
+
+    if (ret < 0)
         return;
 
     /* Shift down by the base volume, so that 0dB becomes maximum volume */
@@ -1392,45 +1590,27 @@ static void sink_write_volume_cb(pa_sink *s) {
     /* Shift up by the base volume */
     pa_sw_cvolume_divide_scalar(&hw_vol, &hw_vol, s->base_volume);
 
-    if (pa_alsa_path_set_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &hw_vol, true, true) < 0)
+    /* The mixer might be slow, so we don't wait for the write here. Only
+     * a port switch gets us here without the pdata. */
+    if (u->mixer_pd)
+        pa_alsa_mixer_pdata_write_volume(u->mixer_pd, u->mixer_path, u->mixer_handle, &s->channel_map, &hw_vol);
+    else if (pa_alsa_path_set_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &hw_vol, true, true) < 0)
         pa_log_error("Writing HW volume failed");
-    else {
-        pa_cvolume tmp_vol;
-        bool accurate_enough;
-
-        /* Shift down by the base volume, so that 0dB becomes maximum volume */
-        pa_sw_cvolume_multiply_scalar(&hw_vol, &hw_vol, s->base_volume);
-
-        pa_sw_cvolume_divide(&tmp_vol, &hw_vol, &s->thread_info.current_hw_volume);
-        accurate_enough =
-            (pa_cvolume_min(&tmp_vol) >= (PA_VOLUME_NORM - VOLUME_ACCURACY)) &&
-            (pa_cvolume_max(&tmp_vol) <= (PA_VOLUME_NORM + VOLUME_ACCURACY));
-
-        if (!accurate_enough) {
-            char volume_buf[2][PA_CVOLUME_SNPRINT_VERBOSE_MAX];
-
-            pa_log_debug("Written HW volume did not match with the request: %s (request) != %s",
-                         pa_cvolume_snprint_verbose(volume_buf[0],
-                                                    sizeof(volume_buf[0]),
-                                                    &s->thread_info.current_hw_volume,
-                                                    &s->channel_map,
-                                                    true),
-                         pa_cvolume_snprint_verbose(volume_buf[1], sizeof(volume_buf[1]), &hw_vol, &s->channel_map, true));
-        }
-    }
 }
 
 static int sink_get_mute_cb(pa_sink *s, bool *mute) {
     struct userdata *u = s->userdata;
+    int ret;
 
     pa_assert(u);
     pa_assert(u->mixer_path);
     pa_assert(u->mixer_handle);
 
-    if (pa_alsa_path_get_mute(u->mixer_path, u->mixer_handle, mute) < 0)
-        return -1;
+    mixer_lock(u);
+    ret = pa_alsa_path_get_mute(u->mixer_path, u->mixer_handle, mute);
+    mixer_unlock(u);
 
-    return 0;
+    return ret < 0 ? -1 : 0;
 }
 
 static void sink_set_mute_cb(pa_sink *s) {
@@ -1440,7 +1620,9 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_assert(u->mixer_path);
     pa_assert(u->mixer_handle);
 
+    mixer_lock(u);
     pa_alsa_path_set_mute(u->mixer_path, u->mixer_handle, s->muted);
+    mixer_unlock(u);
 }
 
 static void mixer_volume_init(struct userdata *u) {
@@ -1513,7 +1695,10 @@ static int sink_set_port_cb(pa_sink *s, pa_device_port *p) {
     data = PA_DEVICE_PORT_DATA(p);
 
     pa_assert_se(u->mixer_path = data->path);
+
+    mixer_lock(u);
     pa_alsa_path_select(u->mixer_path, data->setting, u->mixer_handle, s->muted);
+    mixer_unlock(u);
 
     mixer_volume_init(u);
 
@@ -1537,12 +1722,23 @@ static void sink_update_requested_latency_cb(pa_sink *s) {
                                * we can dynamically adjust the
                                * latency */
 
-    if (!u->pcm_handle)
+    /* A stopped device is configured again on resume */
+    if (!u->pcm_handle || u->sink->thread_info.state == PA_SINK_SUSPENDED)
         return;
 
     update_sw_params(u, true);
 }
 
+/* Called from IO thread context */
+static void sink_cpu_overload_cb(pa_sink *s) {
+    struct userdata *u = s->userdata;
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    /* Wake up less often */
+    increase_watermark(u);
+}
+
 static pa_idxset* sink_get_formats(pa_sink *s) {
     struct userdata *u = s->userdata;
 
@@ -1707,6 +1903,10 @@ static void thread_func(void *userdata) {
 
     pa_log_debug("Thread starting up");
 
+    /* Before anything is allocated here, so that it ends up on our node */
+    if (u->thread_affinity)
+        pa_set_thread_affinity(u->thread_affinity);
+
     if (u->core->realtime_scheduling)
         pa_make_realtime(u->core->realtime_priority);
 
@@ -1715,27 +1915,50 @@ static void thread_func(void *userdata) {
     for (;;) {
         int ret;
         pa_usec_t rtpoll_sleep = 0, real_sleep;
+        uint64_t write_count = u->write_count;
 
 #ifdef DEBUG_TIMING
         pa_log_debug("Loop");
 #endif
 
+        if (u->period_trace)
+            u->period_record = pa_period_trace_begin(u->period_trace, u->period_target);
+
         if (PA_UNLIKELY(u->sink->thread_info.rewind_requested)) {
             if (process_rewind(u) < 0)
                 goto fail;
+
+            if (u->period_record && u->write_count < write_count)
+                u->period_record->rewound = (uint32_t) (write_count - u->write_count);
+
+            write_count = u->write_count;
         }
 
         /* Render some data and write it to the dsp */
         if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
             int work_done;
-            pa_usec_t sleep_usec = 0;
+            pa_usec_t sleep_usec = 0, start, write_start = 0;
             bool on_timeout = pa_rtpoll_timer_elapsed(u->rtpoll);
 
+            start = pa_render_profile_start();
+
+            if (u->period_record)
+                write_start = pa_rtclock_now();
+
             if (u->use_mmap)
                 work_done = mmap_write(u, &sleep_usec, revents & POLLOUT, on_timeout);
             else
                 work_done = unix_write(u, &sleep_usec, revents & POLLOUT, on_timeout);
 
+            if (u->period_record) {
+                u->period_record->render_usec = pa_rtclock_now() - write_start;
+                if (u->write_count > write_count)
+                    u->period_record->written = (uint32_t) (u->write_count - write_count);
+            }
+
+            if (work_done > 0)
+                pa_render_profile_stop(&u->sink->thread_info.render_profile[PA_RENDER_STAGE_SINK_WRITE], start);
+
             if (work_done < 0)
                 goto fail;
 
@@ -1809,9 +2032,14 @@ static void thread_func(void *userdata) {
         if (rtpoll_sleep > 0) {
             pa_rtpoll_set_timer_relative(u->rtpoll, rtpoll_sleep);
             real_sleep = pa_rtclock_now();
+            u->period_target = real_sleep + rtpoll_sleep;
         }
-        else
+        else {
             pa_rtpoll_set_timer_disabled(u->rtpoll);
+            u->period_target = 0;
+        }
+
+        update_latency_base(u);
 
         /* Hmm, nothing to do. Let's sleep */
         if ((ret = pa_rtpoll_run(u->rtpoll)) < 0)
@@ -1991,6 +2219,8 @@ static int setup_mixer(struct userdata *u, bool ignore_dB) {
     if (need_mixer_callback) {
         int (*mixer_callback)(snd_mixer_elem_t *, unsigned int);
         if (u->sink->flags & PA_SINK_DEFERRED_VOLUME) {
+            char *name;
+
             u->mixer_pd = pa_alsa_mixer_pdata_new();
             mixer_callback = io_mixer_callback;
 
@@ -1998,6 +2228,11 @@ static int setup_mixer(struct userdata *u, bool ignore_dB) {
                 pa_log("Failed to initialize file descriptor monitoring");
                 return -1;
             }
+
+            /* Falls back to writing from the IO thread */
+            name = pa_sprintf_malloc("alsa-mixer-%s", pa_strnull(pa_proplist_gets(u->sink->proplist, "alsa.id")));
+            pa_alsa_mixer_pdata_start_writer(u->mixer_pd, u->mixer_handle, name);
+            pa_xfree(name);
         } else {
             u->mixer_fdl = pa_alsa_fdlist_new();
             mixer_callback = ctl_mixer_callback;
@@ -2017,6 +2252,46 @@ static int setup_mixer(struct userdata *u, bool ignore_dB) {
     return 0;
 }
 
+/* Called from main context. Batch devices move their pointer in chunks,
+ * USB ones with every packet, so neither the smoother nor rewinds into the
+ * buffer can be trusted with timer-based scheduling. Instead, wake up with
+ * the periods, as short as the device allows, never rewind, and keep a
+ * fixed latency of a few periods. */
+static int setup_batch_mode(struct userdata *u, pa_sample_spec *ss, snd_pcm_uframes_t *period_frames, snd_pcm_uframes_t *buffer_frames) {
+    snd_pcm_uframes_t granularity, period_size, buffer_size;
+    pa_sample_spec requested_ss = *ss;
+    bool b = u->use_mmap, d = false;
+    int err;
+
+    pa_assert(u);
+
+    granularity = pa_alsa_get_min_period_size(u->pcm_handle, ss);
+    period_size = PA_MAX(granularity, (snd_pcm_uframes_t) pa_usec_to_bytes(BATCH_MIN_PERIOD_USEC, ss) / pa_frame_size(ss));
+    buffer_size = period_size * BATCH_PERIODS;
+
+    if ((err = pa_alsa_set_hw_params(u->pcm_handle, &requested_ss, &period_size, &buffer_size, 0, &b, &d, true)) < 0) {
+        pa_log("Failed to set hardware parameters for batch mode: %s", pa_alsa_strerror(err));
+        return -1;
+    }
+
+    if (!pa_sample_spec_equal(&requested_ss, ss)) {
+        pa_log("Sample spec changed when setting up batch mode.");
+        return -1;
+    }
+
+    u->use_mmap = b;
+    u->use_tsched = false;
+    u->batch_mode = true;
+
+    *period_frames = period_size;
+    *buffer_frames = buffer_size;
+
+    pa_log_info("Batch device with a pointer granularity of %lu frames, using %lu frames per period.",
+                (unsigned long) granularity, (unsigned long) period_size);
+
+    return 0;
+}
+
 pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_card *card, pa_alsa_mapping *mapping) {
 
     struct userdata *u = NULL;
@@ -2026,9 +2301,12 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     uint32_t alternate_sample_rate;
     pa_channel_map map;
     uint32_t nfrags, frag_size, buffer_size, tsched_size, tsched_watermark, rewind_safeguard;
+    uint32_t deep_bus_latency_msec = 0;
     snd_pcm_uframes_t period_frames, buffer_frames, tsched_frames;
     size_t frame_size;
     bool use_mmap = true, b, use_tsched = true, d, ignore_dB = false, namereg_fail = false, deferred_volume = false, set_formats = false, fixed_latency_range = false;
+    bool batch_fixed_latency = false;
+    const char *thread_affinity, *period_trace_file;
     pa_sink_new_data data;
     bool volume_is_set;
     bool mute_is_set;
@@ -2121,6 +2399,19 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "batch_fixed_latency", &batch_fixed_latency) < 0) {
+        pa_log("Failed to parse batch_fixed_latency argument.");
+        goto fail;
+    }
+
+    if ((thread_affinity = pa_modargs_get_value(ma, "thread_affinity", m->core->thread_affinity)) &&
+        pa_cpu_list_check(thread_affinity) < 0) {
+        pa_log("Failed to parse thread_affinity argument.");
+        goto fail;
+    }
+
+    period_trace_file = pa_modargs_get_value(ma, "period_trace_file", NULL);
+
     use_tsched = pa_alsa_may_tsched(use_tsched);
 
     u = pa_xnew0(struct userdata, 1);
@@ -2130,6 +2421,7 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     u->use_tsched = use_tsched;
     u->deferred_volume = deferred_volume;
     u->fixed_latency_range = fixed_latency_range;
+    u->thread_affinity = pa_xstrdup(thread_affinity);
     u->first = true;
     u->rewind_safeguard = rewind_safeguard;
     u->rtpoll = pa_rtpoll_new();
@@ -2149,6 +2441,11 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
             true);
     u->smoother_interval = SMOOTHER_MIN_INTERVAL;
 
+    u->watermark_model = pa_watermark_model_new(
+            TSCHED_WATERMARK_HALF_LIFE_USEC,
+            TSCHED_WATERMARK_HOLD_USEC,
+            TSCHED_WATERMARK_MARGIN_USEC);
+
     /* use ucm */
     if (mapping && mapping->ucm_context.ucm)
         u->ucm_context = &mapping->ucm_context;
@@ -2247,6 +2544,14 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         u->use_tsched = use_tsched = false;
     }
 
+    if (batch_fixed_latency && pa_alsa_pcm_is_batch(u->pcm_handle)) {
+        if (setup_batch_mode(u, &ss, &period_frames, &buffer_frames) < 0)
+            goto fail;
+
+        use_mmap = u->use_mmap;
+        use_tsched = false;
+    }
+
     if (u->use_mmap)
         pa_log_info("Successfully enabled mmap() mode.");
 
@@ -2341,6 +2646,11 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         goto fail;
     }
 
+    u->pcm_sample_spec = u->sink->sample_spec;
+    u->pcm_nonaudio = false;
+
+    pa_sink_set_supported_rates(u->sink, u->rates);
+
     if (pa_modargs_get_value_u32(ma, "deferred_volume_safety_margin",
                                  &u->sink->thread_info.volume_change_safety_margin) < 0) {
         pa_log("Failed to parse deferred_volume_safety_margin parameter");
@@ -2353,10 +2663,22 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "deep_bus_latency_msec", &deep_bus_latency_msec) < 0) {
+        pa_log("Failed to parse deep_bus_latency_msec parameter");
+        goto fail;
+    }
+
+    /* Streams only get different latencies with timer based scheduling */
+    if (u->use_tsched && deep_bus_latency_msec > 0)
+        pa_sink_set_deep_bus_latency(u->sink, (pa_usec_t) deep_bus_latency_msec * PA_USEC_PER_MSEC);
+
     u->sink->parent.process_msg = sink_process_msg;
-    if (u->use_tsched)
+    if (u->use_tsched) {
         u->sink->update_requested_latency = sink_update_requested_latency_cb;
+        u->sink->cpu_overload = sink_cpu_overload_cb;
+    }
     u->sink->set_state = sink_set_state_cb;
+    u->sink->suspend_cause_changed = sink_suspend_cause_changed_cb;
     if (u->ucm_context)
         u->sink->set_port = sink_set_port_ucm_cb;
     else
@@ -2382,7 +2704,7 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
                 (double) pa_bytes_to_usec(u->hwbuf_size, &ss) / PA_USEC_PER_MSEC);
 
     pa_sink_set_max_request(u->sink, u->hwbuf_size);
-    if (pa_alsa_pcm_is_hw(u->pcm_handle))
+    if (pa_alsa_pcm_is_hw(u->pcm_handle) && !u->batch_mode)
         pa_sink_set_max_rewind(u->sink, u->hwbuf_size);
     else {
         pa_log_info("Disabling rewind for device %s", u->device_name);
@@ -2400,14 +2722,22 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     if (update_sw_params(u, false) < 0)
         goto fail;
 
+    pa_alsa_tstamp_init(&u->tstamp, u->pcm_handle);
+
     if (u->ucm_context) {
         if (u->sink->active_port && pa_alsa_ucm_set_port(u->ucm_context, u->sink->active_port, true) < 0)
             goto fail;
     } else if (setup_mixer(u, ignore_dB) < 0)
         goto fail;
 
+    if (u->use_tsched)
+        pa_rtpoll_set_timer_slack(u->rtpoll, TSCHED_TIMER_SLACK_USEC);
+
     pa_alsa_dump(PA_LOG_DEBUG, u->pcm_handle);
 
+    if (period_trace_file)
+        u->period_trace = pa_period_trace_new(u->sink->name, period_trace_file, u->thread_mq.inq, u->thread_mq.outq);
+
     thread_name = pa_sprintf_malloc("alsa-sink-%s", pa_strnull(pa_proplist_gets(u->sink->proplist, "alsa.id")));
     if (!(u->thread = pa_thread_new(thread_name, thread_func, u))) {
         pa_log("Failed to create thread.");
@@ -2455,6 +2785,7 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         u->sink->set_formats = sink_set_formats;
     }
 
+    pa_sink_set_latency_smoother(u->sink, u->smoother);
     pa_sink_put(u->sink);
 
     if (profile_set)
@@ -2485,8 +2816,12 @@ static void userdata_free(struct userdata *u) {
         pa_thread_free(u->thread);
     }
 
+    /* Writes out the glitches that are still queued */
     pa_thread_mq_done(&u->thread_mq);
 
+    if (u->period_trace)
+        pa_period_trace_free(u->period_trace);
+
     if (u->sink)
         pa_sink_unref(u->sink);
 
@@ -2519,6 +2854,9 @@ static void userdata_free(struct userdata *u) {
     if (u->smoother)
         pa_smoother_free(u->smoother);
 
+    if (u->watermark_model)
+        pa_watermark_model_free(u->watermark_model);
+
     if (u->formats)
         pa_idxset_free(u->formats, (pa_free_cb_t) pa_format_info_free);
 
@@ -2529,6 +2867,7 @@ static void userdata_free(struct userdata *u) {
     monitor_done(u);
 
     pa_xfree(u->device_name);
+    pa_xfree(u->thread_affinity);
     pa_xfree(u->control_device);
     pa_xfree(u->paths_dir);
     pa_xfree(u);
@@ -47,6 +47,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/watermark-model.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -61,14 +62,14 @@
 #define DEFAULT_TSCHED_WATERMARK_USEC (20*PA_USEC_PER_MSEC)        /* 20ms */
 
 #define TSCHED_WATERMARK_INC_STEP_USEC (10*PA_USEC_PER_MSEC)       /* 10ms  */
-#define TSCHED_WATERMARK_DEC_STEP_USEC (5*PA_USEC_PER_MSEC)        /* 5ms */
-#define TSCHED_WATERMARK_VERIFY_AFTER_USEC (20*PA_USEC_PER_SEC)    /* 20s */
-#define TSCHED_WATERMARK_INC_THRESHOLD_USEC (0*PA_USEC_PER_MSEC)   /* 0ms */
-#define TSCHED_WATERMARK_DEC_THRESHOLD_USEC (100*PA_USEC_PER_MSEC) /* 100ms */
+#define TSCHED_WATERMARK_HALF_LIFE_USEC (10*PA_USEC_PER_SEC)       /* 10s */
+#define TSCHED_WATERMARK_HOLD_USEC (5*PA_USEC_PER_SEC)             /* 5s */
+#define TSCHED_WATERMARK_MARGIN_USEC (5*PA_USEC_PER_MSEC)          /* 5ms */
 #define TSCHED_WATERMARK_STEP_USEC (10*PA_USEC_PER_MSEC)           /* 10ms */
 
 #define TSCHED_MIN_SLEEP_USEC (10*PA_USEC_PER_MSEC)                /* 10ms */
 #define TSCHED_MIN_WAKEUP_USEC (4*PA_USEC_PER_MSEC)                /* 4ms */
+#define TSCHED_TIMER_SLACK_USEC (50)                               /* 50us */
 
 #define SMOOTHER_WINDOW_USEC  (10*PA_USEC_PER_SEC)                 /* 10s */
 #define SMOOTHER_ADJUST_USEC  (1*PA_USEC_PER_SEC)                  /* 1s */
@@ -109,18 +110,15 @@ struct userdata {
         hwbuf_unused,
         min_sleep,
         min_wakeup,
-        watermark_inc_step,
-        watermark_dec_step,
-        watermark_inc_threshold,
-        watermark_dec_threshold;
+        watermark_inc_step;
 
     snd_pcm_uframes_t frames_per_block;
 
-    pa_usec_t watermark_dec_not_before;
     pa_usec_t min_latency_ref;
     pa_usec_t tsched_watermark_usec;
 
     char *device_name;  /* name of the PCM device */
+    char *thread_affinity;
     char *control_device; /* name of the control device */
 
     bool use_mmap:1, use_tsched:1, deferred_volume:1, fixed_latency_range:1;
@@ -130,6 +128,8 @@ struct userdata {
     pa_rtpoll_item *alsa_rtpoll_item;
 
     pa_smoother *smoother;
+    pa_alsa_tstamp tstamp;
+    pa_watermark_model *watermark_model;
     uint64_t read_count;
     pa_usec_t smoother_interval;
     pa_usec_t last_smoother_update;
@@ -336,38 +336,30 @@ static void increase_watermark(struct userdata *u) {
     /* When we reach this we're officially fucked! */
 }
 
-static void decrease_watermark(struct userdata *u) {
+static void update_watermark(struct userdata *u, pa_usec_t now) {
     size_t old_watermark;
-    pa_usec_t now;
+    pa_usec_t suggested;
 
     pa_assert(u);
     pa_assert(u->use_tsched);
 
-    now = pa_rtclock_now();
+    suggested = pa_watermark_model_suggest(u->watermark_model, now, u->tsched_watermark_usec);
 
-    if (u->watermark_dec_not_before <= 0)
-        goto restart;
-
-    if (u->watermark_dec_not_before > now)
+    if (suggested == u->tsched_watermark_usec)
         return;
 
     old_watermark = u->tsched_watermark;
-
-    if (u->tsched_watermark < u->watermark_dec_step)
-        u->tsched_watermark = u->tsched_watermark / 2;
-    else
-        u->tsched_watermark = PA_MAX(u->tsched_watermark / 2, u->tsched_watermark - u->watermark_dec_step);
-
+    u->tsched_watermark = pa_usec_to_bytes_round_up(suggested, &u->source->sample_spec);
     fix_tsched_watermark(u);
 
-    if (old_watermark != u->tsched_watermark)
+    if (u->tsched_watermark > old_watermark)
+        pa_log_info("Increasing wakeup watermark to %0.2f ms",
+                    (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC);
+    else if (u->tsched_watermark < old_watermark)
         pa_log_info("Decreasing wakeup watermark to %0.2f ms",
                     (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC);
 
     /* We don't change the latency range*/
-
-restart:
-    u->watermark_dec_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
 }
 
 static void hw_sleep_time(struct userdata *u, pa_usec_t *sleep_usec, pa_usec_t*process_usec) {
@@ -409,8 +401,11 @@ static int try_recover(struct userdata *u, const char *call, int err) {
 
     pa_assert(err != -EAGAIN);
 
-    if (err == -EPIPE)
+    if (err == -EPIPE) {
         pa_log_debug("%s: Buffer overrun!", call);
+        pa_core_post_xrun_event(u->core, PA_XRUN_CAUSE_HW_OVERRUN, PA_DEVICE_TYPE_SOURCE, u->source->index, PA_INVALID_INDEX,
+                                u->use_tsched ? u->tsched_watermark_usec : 0, u->use_tsched ? u->tsched_watermark_usec : 0);
+    }
 
     if (err == -ESTRPIPE)
         pa_log_debug("%s: System suspended!", call);
@@ -428,6 +423,7 @@ static size_t check_left_to_record(struct userdata *u, size_t n_bytes, bool on_t
     size_t left_to_record;
     size_t rec_space = u->hwbuf_size - u->hwbuf_unused;
     bool overrun = false;
+    pa_usec_t watermark_before = u->use_tsched ? u->tsched_watermark_usec : 0;
 
     /* We use <= instead of < for this check here because an overrun
      * only happens after the last sample was processed, not already when
@@ -455,25 +451,26 @@ static size_t check_left_to_record(struct userdata *u, size_t n_bytes, bool on_t
 #endif
 
     if (u->use_tsched) {
-        bool reset_not_before = true;
+        pa_usec_t now = pa_rtclock_now();
 
-        if (overrun || left_to_record < u->watermark_inc_threshold)
+        if (overrun) {
+            pa_watermark_model_dropout(u->watermark_model, now, u->tsched_watermark_usec);
             increase_watermark(u);
-        else if (left_to_record > u->watermark_dec_threshold) {
-            reset_not_before = false;
-
-            /* We decrease the watermark only if have actually
-             * been woken up by a timeout. If something else woke
-             * us up it's too easy to fulfill the deadlines... */
-
-            if (on_timeout)
-                decrease_watermark(u);
+        } else if (on_timeout) {
+            pa_usec_t left_usec = pa_bytes_to_usec(left_to_record, &u->source->sample_spec);
+
+            /* Only timer wakeups tell us how late the timer fires, see
+             * the sink */
+            pa_watermark_model_add(u->watermark_model, now,
+                                   left_usec < u->tsched_watermark_usec ? u->tsched_watermark_usec - left_usec : 0);
+            update_watermark(u, now);
         }
-
-        if (reset_not_before)
-            u->watermark_dec_not_before = 0;
     }
 
+    if (overrun)
+        pa_core_post_xrun_event(u->core, PA_XRUN_CAUSE_HW_OVERRUN, PA_DEVICE_TYPE_SOURCE, u->source->index, PA_INVALID_INDEX,
+                                watermark_before, u->use_tsched ? u->tsched_watermark_usec : 0);
+
     return left_to_record;
 }
 
@@ -782,6 +779,8 @@ static void update_smoother(struct userdata *u) {
 
     /* Let's update the time smoother */
 
+    pa_alsa_tstamp_request(&u->tstamp, status);
+
     if (PA_UNLIKELY((err = pa_alsa_safe_delay(u->pcm_handle, status, &delay, u->hwbuf_size, &u->source->sample_spec, true)) < 0)) {
         pa_log_warn("Failed to get delay: %s", pa_alsa_strerror(err));
         return;
@@ -801,6 +800,7 @@ static void update_smoother(struct userdata *u) {
 
     position = u->read_count + ((uint64_t) delay * (uint64_t) u->frame_size);
     now2 = pa_bytes_to_usec(position, &u->source->sample_spec);
+    now2 = pa_alsa_tstamp_position(&u->tstamp, status, now2);
 
     pa_smoother_put(u->smoother, now1, now2);
 
@@ -823,6 +823,15 @@ static int64_t source_get_latency(struct userdata *u) {
     return delay;
 }
 
+/* Called from IO context. Lets the main thread calculate the latency
+ * like source_get_latency() does. */
+static void update_latency_base(struct userdata *u) {
+    pa_assert(u);
+
+    pa_source_set_latency_base_within_thread(u->source, !!u->pcm_handle,
+                                             (int64_t) pa_bytes_to_usec(u->read_count, &u->source->sample_spec));
+}
+
 static int build_pollfd(struct userdata *u) {
     pa_assert(u);
     pa_assert(u->pcm_handle);
@@ -852,6 +861,8 @@ static int suspend(struct userdata *u) {
         u->alsa_rtpoll_item = NULL;
     }
 
+    update_latency_base(u);
+
     pa_log_info("Device suspended...");
 
     return 0;
@@ -916,10 +927,6 @@ static void reset_watermark(struct userdata *u, size_t tsched_watermark, pa_samp
     u->tsched_watermark = pa_convert_size(tsched_watermark, ss, &u->source->sample_spec);
 
     u->watermark_inc_step = pa_usec_to_bytes(TSCHED_WATERMARK_INC_STEP_USEC, &u->source->sample_spec);
-    u->watermark_dec_step = pa_usec_to_bytes(TSCHED_WATERMARK_DEC_STEP_USEC, &u->source->sample_spec);
-
-    u->watermark_inc_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_INC_THRESHOLD_USEC, &u->source->sample_spec);
-    u->watermark_dec_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_DEC_THRESHOLD_USEC, &u->source->sample_spec);
 
     fix_min_sleep_wakeup(u);
     fix_tsched_watermark(u);
@@ -996,6 +1003,8 @@ static int unsuspend(struct userdata *u) {
     if (update_sw_params(u) < 0)
         goto fail;
 
+    pa_alsa_tstamp_init(&u->tstamp, u->pcm_handle);
+
     if (build_pollfd(u) < 0)
         goto fail;
 
@@ -1008,6 +1017,8 @@ static int unsuspend(struct userdata *u) {
 
     u->first = true;
 
+    update_latency_base(u);
+
     /* reset the watermark to the value defined when source was created */
     if (u->use_tsched)
         reset_watermark(u, u->tsched_watermark_ref, &u->source->sample_spec, true);
@@ -1150,16 +1161,33 @@ static int io_mixer_callback(snd_mixer_elem_t *elem, unsigned int mask) {
     return 0;
 }
 
+/* With deferred volume the mixer is shared with the volume writer
+ * thread, see pa_alsa_mixer_pdata_start_writer() */
+static void mixer_lock(struct userdata *u) {
+    if (u->mixer_pd)
+        pa_alsa_mixer_pdata_lock(u->mixer_pd);
+}
+
+static void mixer_unlock(struct userdata *u) {
+    if (u->mixer_pd)
+        pa_alsa_mixer_pdata_unlock(u->mixer_pd);
+}
+
 static void source_get_volume_cb(pa_source *s) {
     struct userdata *u = s->userdata;
     pa_cvolume r;
     char volume_buf[PA_CVOLUME_SNPRINT_VERBOSE_MAX];
+    int ret;
 
     pa_assert(u);
     pa_assert(u->mixer_path);
     pa_assert(u->mixer_handle);
 
-    if (pa_alsa_path_get_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &r) < 0)
+    mixer_lock(u);
+    ret = pa_alsa_path_get_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &r);
+    mixer_unlock(u);
+
+    if (ret < 0)
         return;
 
     /* Shift down by the base volume, so that 0dB becomes maximum volume */
@@ -1183,6 +1211,7 @@ static void source_set_volume_cb(pa_source *s) {
     pa_cvolume r;
     char volume_buf[PA_CVOLUME_SNPRINT_VERBOSE_MAX];
     bool deferred_volume = !!(s->flags & PA_SOURCE_DEFERRED_VOLUME);
+    int ret;
 
     pa_assert(u);
     pa_assert(u->mixer_path);
@@ -1191,7 +1220,11 @@ static void source_set_volume_cb(pa_source *s) {
     /* Shift up by the base volume */
     pa_sw_cvolume_divide_scalar(&r, &s->real_volume, s->base_volume);
 
-    if (pa_alsa_path_set_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &r, deferred_volume, !deferred_volume) < 0)
+    mixer_lock(u);
+    ret = pa_alsa_path_set_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &r, deferred_volume, !deferred_volume);
+    mixer_unlock(u);
+
+    if (ret < 0)
         return;
 
     /* Shift down by the base volume, so that 0dB becomes maximum volume */
@@ -1247,45 +1280,27 @@ static void source_write_volume_cb(pa_source *s) {
     /* Shift up by the base volume */
     pa_sw_cvolume_divide_scalar(&hw_vol, &hw_vol, s->base_volume);
 
-    if (pa_alsa_path_set_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &hw_vol, true, true) < 0)
+    /* The mixer might be slow, so we don't wait for the write here. Only
+     * a port switch gets us here without the pdata. */
+    if (u->mixer_pd)
+        pa_alsa_mixer_pdata_write_volume(u->mixer_pd, u->mixer_path, u->mixer_handle, &s->channel_map, &hw_vol);
+    else if (pa_alsa_path_set_volume(u->mixer_path, u->mixer_handle, &s->channel_map, &hw_vol, true, true) < 0)
         pa_log_error("Writing HW volume failed");
-    else {
-        pa_cvolume tmp_vol;
-        bool accurate_enough;
-
-        /* Shift down by the base volume, so that 0dB becomes maximum volume */
-        pa_sw_cvolume_multiply_scalar(&hw_vol, &hw_vol, s->base_volume);
-
-        pa_sw_cvolume_divide(&tmp_vol, &hw_vol, &s->thread_info.current_hw_volume);
-        accurate_enough =
-            (pa_cvolume_min(&tmp_vol) >= (PA_VOLUME_NORM - VOLUME_ACCURACY)) &&
-            (pa_cvolume_max(&tmp_vol) <= (PA_VOLUME_NORM + VOLUME_ACCURACY));
-
-        if (!accurate_enough) {
-            char volume_buf[2][PA_CVOLUME_SNPRINT_VERBOSE_MAX];
-
-            pa_log_debug("Written HW volume did not match with the request: %s (request) != %s",
-                         pa_cvolume_snprint_verbose(volume_buf[0],
-                                                    sizeof(volume_buf[0]),
-                                                    &s->thread_info.current_hw_volume,
-                                                    &s->channel_map,
-                                                    true),
-                         pa_cvolume_snprint_verbose(volume_buf[1], sizeof(volume_buf[1]), &hw_vol, &s->channel_map, true));
-        }
-    }
 }
 
 static int source_get_mute_cb(pa_source *s, bool *mute) {
     struct userdata *u = s->userdata;
+    int ret;
 
     pa_assert(u);
     pa_assert(u->mixer_path);
     pa_assert(u->mixer_handle);
 
-    if (pa_alsa_path_get_mute(u->mixer_path, u->mixer_handle, mute) < 0)
-        return -1;
+    mixer_lock(u);
+    ret = pa_alsa_path_get_mute(u->mixer_path, u->mixer_handle, mute);
+    mixer_unlock(u);
 
-    return 0;
+    return ret < 0 ? -1 : 0;
 }
 
 static void source_set_mute_cb(pa_source *s) {
@@ -1295,7 +1310,9 @@ static void source_set_mute_cb(pa_source *s) {
     pa_assert(u->mixer_path);
     pa_assert(u->mixer_handle);
 
+    mixer_lock(u);
     pa_alsa_path_set_mute(u->mixer_path, u->mixer_handle, s->muted);
+    mixer_unlock(u);
 }
 
 static void mixer_volume_init(struct userdata *u) {
@@ -1368,7 +1385,10 @@ static int source_set_port_cb(pa_source *s, pa_device_port *p) {
     data = PA_DEVICE_PORT_DATA(p);
 
     pa_assert_se(u->mixer_path = data->path);
+
+    mixer_lock(u);
     pa_alsa_path_select(u->mixer_path, data->setting, u->mixer_handle, s->muted);
+    mixer_unlock(u);
 
     mixer_volume_init(u);
 
@@ -1398,6 +1418,16 @@ static void source_update_requested_latency_cb(pa_source *s) {
     update_sw_params(u);
 }
 
+/* Called from IO thread context */
+static void source_cpu_overload_cb(pa_source *s) {
+    struct userdata *u = s->userdata;
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    /* Wake up less often */
+    increase_watermark(u);
+}
+
 static int source_reconfigure_cb(pa_source *s, pa_sample_spec *spec, bool passthrough) {
     struct userdata *u = s->userdata;
     int i;
@@ -1436,6 +1466,10 @@ static void thread_func(void *userdata) {
 
     pa_log_debug("Thread starting up");
 
+    /* Before anything is allocated here, so that it ends up on our node */
+    if (u->thread_affinity)
+        pa_set_thread_affinity(u->thread_affinity);
+
     if (u->core->realtime_scheduling)
         pa_make_realtime(u->core->realtime_priority);
 
@@ -1514,6 +1548,8 @@ static void thread_func(void *userdata) {
         else
             pa_rtpoll_set_timer_disabled(u->rtpoll);
 
+        update_latency_base(u);
+
         /* Hmm, nothing to do. Let's sleep */
         if ((ret = pa_rtpoll_run(u->rtpoll)) < 0)
             goto fail;
@@ -1690,6 +1726,8 @@ static int setup_mixer(struct userdata *u, bool ignore_dB) {
     if (need_mixer_callback) {
         int (*mixer_callback)(snd_mixer_elem_t *, unsigned int);
         if (u->source->flags & PA_SOURCE_DEFERRED_VOLUME) {
+            char *name;
+
             u->mixer_pd = pa_alsa_mixer_pdata_new();
             mixer_callback = io_mixer_callback;
 
@@ -1697,6 +1735,11 @@ static int setup_mixer(struct userdata *u, bool ignore_dB) {
                 pa_log("Failed to initialize file descriptor monitoring");
                 return -1;
             }
+
+            /* Falls back to writing from the IO thread */
+            name = pa_sprintf_malloc("alsa-mixer-%s", pa_strnull(pa_proplist_gets(u->source->proplist, "alsa.id")));
+            pa_alsa_mixer_pdata_start_writer(u->mixer_pd, u->mixer_handle, name);
+            pa_xfree(name);
         } else {
             u->mixer_fdl = pa_alsa_fdlist_new();
             mixer_callback = ctl_mixer_callback;
@@ -1728,6 +1771,7 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     snd_pcm_uframes_t period_frames, buffer_frames, tsched_frames;
     size_t frame_size;
     bool use_mmap = true, b, use_tsched = true, d, ignore_dB = false, namereg_fail = false, deferred_volume = false, fixed_latency_range = false;
+    const char *thread_affinity;
     pa_source_new_data data;
     bool volume_is_set;
     bool mute_is_set;
@@ -1814,6 +1858,12 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
         goto fail;
     }
 
+    if ((thread_affinity = pa_modargs_get_value(ma, "thread_affinity", m->core->thread_affinity)) &&
+        pa_cpu_list_check(thread_affinity) < 0) {
+        pa_log("Failed to parse thread_affinity argument.");
+        goto fail;
+    }
+
     use_tsched = pa_alsa_may_tsched(use_tsched);
 
     u = pa_xnew0(struct userdata, 1);
@@ -1823,6 +1873,7 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     u->use_tsched = use_tsched;
     u->deferred_volume = deferred_volume;
     u->fixed_latency_range = fixed_latency_range;
+    u->thread_affinity = pa_xstrdup(thread_affinity);
     u->first = true;
     u->rtpoll = pa_rtpoll_new();
 
@@ -1841,6 +1892,11 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
             true);
     u->smoother_interval = SMOOTHER_MIN_INTERVAL;
 
+    u->watermark_model = pa_watermark_model_new(
+            TSCHED_WATERMARK_HALF_LIFE_USEC,
+            TSCHED_WATERMARK_HOLD_USEC,
+            TSCHED_WATERMARK_MARGIN_USEC);
+
     /* use ucm */
     if (mapping && mapping->ucm_context.ucm)
         u->ucm_context = &mapping->ucm_context;
@@ -2035,8 +2091,10 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     }
 
     u->source->parent.process_msg = source_process_msg;
-    if (u->use_tsched)
+    if (u->use_tsched) {
         u->source->update_requested_latency = source_update_requested_latency_cb;
+        u->source->cpu_overload = source_cpu_overload_cb;
+    }
     u->source->set_state = source_set_state_cb;
     if (u->ucm_context)
         u->source->set_port = source_set_port_ucm_cb;
@@ -2074,12 +2132,17 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     if (update_sw_params(u) < 0)
         goto fail;
 
+    pa_alsa_tstamp_init(&u->tstamp, u->pcm_handle);
+
     if (u->ucm_context) {
         if (u->source->active_port && pa_alsa_ucm_set_port(u->ucm_context, u->source->active_port, false) < 0)
             goto fail;
     } else if (setup_mixer(u, ignore_dB) < 0)
         goto fail;
 
+    if (u->use_tsched)
+        pa_rtpoll_set_timer_slack(u->rtpoll, TSCHED_TIMER_SLACK_USEC);
+
     pa_alsa_dump(PA_LOG_DEBUG, u->pcm_handle);
 
     thread_name = pa_sprintf_malloc("alsa-source-%s", pa_strnull(pa_proplist_gets(u->source->proplist, "alsa.id")));
@@ -2114,6 +2177,7 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     if ((volume_is_set || mute_is_set) && u->source->write_volume)
         u->source->write_volume(u->source);
 
+    pa_source_set_latency_smoother(u->source, u->smoother);
     pa_source_put(u->source);
 
     if (profile_set)
@@ -2175,6 +2239,9 @@ static void userdata_free(struct userdata *u) {
     if (u->smoother)
         pa_smoother_free(u->smoother);
 
+    if (u->watermark_model)
+        pa_watermark_model_free(u->watermark_model);
+
     if (u->rates)
         pa_xfree(u->rates);
 
@@ -2182,6 +2249,7 @@ static void userdata_free(struct userdata *u) {
     monitor_done(u);
 
     pa_xfree(u->device_name);
+    pa_xfree(u->thread_affinity);
     pa_xfree(u->control_device);
     pa_xfree(u->paths_dir);
     pa_xfree(u);
@@ -207,6 +207,7 @@ static int ucm_get_device_property(
         pa_alsa_ucm_device *device,
         snd_use_case_mgr_t *uc_mgr,
         pa_alsa_ucm_verb *verb,
+        const char *verb_name,
         const char *device_name) {
 
     const char *value;
@@ -218,7 +219,7 @@ static int ucm_get_device_property(
     int n_confdev, n_suppdev;
 
     for (i = 0; item[i].id; i++) {
-        id = pa_sprintf_malloc("=%s/%s", item[i].id, device_name);
+        id = pa_sprintf_malloc("=%s/%s/%s", item[i].id, device_name, verb_name);
         err = snd_use_case_get(uc_mgr, id, &value);
         pa_xfree(id);
         if (err < 0)
@@ -340,7 +341,7 @@ static int ucm_get_device_property(
         device->capture_priority = 100;
     }
 
-    id = pa_sprintf_malloc("%s/%s", "_conflictingdevs", device_name);
+    id = pa_sprintf_malloc("%s/%s/%s", "_conflictingdevs", device_name, verb_name);
     n_confdev = snd_use_case_get_list(uc_mgr, id, &devices);
     pa_xfree(id);
 
@@ -352,7 +353,7 @@ static int ucm_get_device_property(
         snd_use_case_free_list(devices, n_confdev);
     }
 
-    id = pa_sprintf_malloc("%s/%s", "_supporteddevs", device_name);
+    id = pa_sprintf_malloc("%s/%s/%s", "_supporteddevs", device_name, verb_name);
     n_suppdev = snd_use_case_get_list(uc_mgr, id, &devices);
     pa_xfree(id);
 
@@ -368,7 +369,11 @@ static int ucm_get_device_property(
 };
 
 /* Create a property list for this ucm modifier */
-static int ucm_get_modifier_property(pa_alsa_ucm_modifier *modifier, snd_use_case_mgr_t *uc_mgr, const char *modifier_name) {
+static int ucm_get_modifier_property(
+        pa_alsa_ucm_modifier *modifier,
+        snd_use_case_mgr_t *uc_mgr,
+        const char *verb_name,
+        const char *modifier_name) {
     const char *value;
     char *id;
     int i;
@@ -376,7 +381,7 @@ static int ucm_get_modifier_property(pa_alsa_ucm_modifier *modifier, snd_use_cas
     for (i = 0; item[i].id; i++) {
         int err;
 
-        id = pa_sprintf_malloc("=%s/%s", item[i].id, modifier_name);
+        id = pa_sprintf_malloc("=%s/%s/%s", item[i].id, modifier_name, verb_name);
         err = snd_use_case_get(uc_mgr, id, &value);
         pa_xfree(id);
         if (err < 0)
@@ -387,13 +392,13 @@ static int ucm_get_modifier_property(pa_alsa_ucm_modifier *modifier, snd_use_cas
         free((void*)value);
     }
 
-    id = pa_sprintf_malloc("%s/%s", "_conflictingdevs", modifier_name);
+    id = pa_sprintf_malloc("%s/%s/%s", "_conflictingdevs", modifier_name, verb_name);
     modifier->n_confdev = snd_use_case_get_list(uc_mgr, id, &modifier->conflicting_devices);
     pa_xfree(id);
     if (modifier->n_confdev < 0)
         pa_log_debug("No %s for modifier %s", "_conflictingdevs", modifier_name);
 
-    id = pa_sprintf_malloc("%s/%s", "_supporteddevs", modifier_name);
+    id = pa_sprintf_malloc("%s/%s/%s", "_supporteddevs", modifier_name, verb_name);
     modifier->n_suppdev = snd_use_case_get_list(uc_mgr, id, &modifier->supported_devices);
     pa_xfree(id);
     if (modifier->n_suppdev < 0)
@@ -403,11 +408,14 @@ static int ucm_get_modifier_property(pa_alsa_ucm_modifier *modifier, snd_use_cas
 };
 
 /* Create a list of devices for this verb */
-static int ucm_get_devices(pa_alsa_ucm_verb *verb, snd_use_case_mgr_t *uc_mgr) {
+static int ucm_get_devices(pa_alsa_ucm_verb *verb, snd_use_case_mgr_t *uc_mgr, const char *verb_name) {
     const char **dev_list;
+    char *id;
     int num_dev, i;
 
-    num_dev = snd_use_case_get_list(uc_mgr, "_devices", &dev_list);
+    id = pa_sprintf_malloc("%s/%s", "_devices", verb_name);
+    num_dev = snd_use_case_get_list(uc_mgr, id, &dev_list);
+    pa_xfree(id);
     if (num_dev < 0)
         return num_dev;
 
@@ -429,11 +437,14 @@ static int ucm_get_devices(pa_alsa_ucm_verb *verb, snd_use_case_mgr_t *uc_mgr) {
     return 0;
 };
 
-static int ucm_get_modifiers(pa_alsa_ucm_verb *verb, snd_use_case_mgr_t *uc_mgr) {
+static int ucm_get_modifiers(pa_alsa_ucm_verb *verb, snd_use_case_mgr_t *uc_mgr, const char *verb_name) {
     const char **mod_list;
+    char *id;
     int num_mod, i;
 
-    num_mod = snd_use_case_get_list(uc_mgr, "_modifiers", &mod_list);
+    id = pa_sprintf_malloc("%s/%s", "_modifiers", verb_name);
+    num_mod = snd_use_case_get_list(uc_mgr, id, &mod_list);
+    pa_xfree(id);
     if (num_mod < 0)
         return num_mod;
 
@@ -638,11 +649,13 @@ int pa_alsa_ucm_get_verb(snd_use_case_mgr_t *uc_mgr, const char *verb_name, cons
     pa_alsa_ucm_verb *verb;
     int err = 0;
 
+    /* Every identifier below names the verb explicitly, so the verb
+     * doesn't have to be made current. Setting it would run its enable
+     * sequence (and the disable sequence of the previous one) on the
+     * hardware, once per verb of the card. Only the verb of the
+     * profile that gets activated is set, see pa_alsa_ucm_set_profile(). */
     *p_verb = NULL;
-    pa_log_info("Set UCM verb to %s", verb_name);
-    err = snd_use_case_set(uc_mgr, "_verb", verb_name);
-    if (err < 0)
-        return err;
+    pa_log_info("Query UCM verb %s", verb_name);
 
     verb = pa_xnew0(pa_alsa_ucm_verb, 1);
     verb->proplist = pa_proplist_new();
@@ -650,11 +663,11 @@ int pa_alsa_ucm_get_verb(snd_use_case_mgr_t *uc_mgr, const char *verb_name, cons
     pa_proplist_sets(verb->proplist, PA_ALSA_PROP_UCM_NAME, pa_strnull(verb_name));
     pa_proplist_sets(verb->proplist, PA_ALSA_PROP_UCM_DESCRIPTION, pa_strna(verb_desc));
 
-    err = ucm_get_devices(verb, uc_mgr);
+    err = ucm_get_devices(verb, uc_mgr, verb_name);
     if (err < 0)
         pa_log("No UCM devices for verb %s", verb_name);
 
-    err = ucm_get_modifiers(verb, uc_mgr);
+    err = ucm_get_modifiers(verb, uc_mgr, verb_name);
     if (err < 0)
         pa_log("No UCM modifiers for verb %s", verb_name);
 
@@ -665,7 +678,7 @@ int pa_alsa_ucm_get_verb(snd_use_case_mgr_t *uc_mgr, const char *verb_name, cons
         const char *dev_name = pa_proplist_gets(d->proplist, PA_ALSA_PROP_UCM_NAME);
 
         /* Devices properties */
-        ucm_get_device_property(d, uc_mgr, verb, dev_name);
+        ucm_get_device_property(d, uc_mgr, verb, verb_name, dev_name);
     }
     /* make conflicting or supported device mutual */
     PA_LLIST_FOREACH(d, verb->devices)
@@ -675,7 +688,7 @@ int pa_alsa_ucm_get_verb(snd_use_case_mgr_t *uc_mgr, const char *verb_name, cons
         const char *mod_name = pa_proplist_gets(mod->proplist, PA_ALSA_PROP_UCM_NAME);
 
         /* Modifier properties */
-        ucm_get_modifier_property(mod, uc_mgr, mod_name);
+        ucm_get_modifier_property(mod, uc_mgr, verb_name, mod_name);
 
         /* Set PA_PROP_DEVICE_INTENDED_ROLES property to devices */
         pa_log_debug("Set media roles for verb %s, modifier %s", verb_name, mod_name);
@@ -707,7 +720,7 @@ static void ucm_add_port_combination(
     int i;
     unsigned priority;
     double prio2;
-    char *name, *desc;
+    char *name;
     const char *dev_name;
     const char *direction;
     pa_alsa_ucm_device *sorted[num], *dev;
@@ -723,8 +736,6 @@ static void ucm_add_port_combination(
     dev_name = pa_proplist_gets(dev->proplist, PA_ALSA_PROP_UCM_NAME);
 
     name = pa_sprintf_malloc("%s%s", is_sink ? PA_UCM_PRE_TAG_OUTPUT : PA_UCM_PRE_TAG_INPUT, dev_name);
-    desc = num == 1 ? pa_xstrdup(pa_proplist_gets(dev->proplist, PA_ALSA_PROP_UCM_DESCRIPTION))
-            : pa_sprintf_malloc("Combination port for %s", dev_name);
 
     priority = is_sink ? dev->playback_priority : dev->capture_priority;
     prio2 = (priority == 0 ? 0 : 1.0/priority);
@@ -739,10 +750,6 @@ static void ucm_add_port_combination(
         pa_xfree(name);
         name = tmp;
 
-        tmp = pa_sprintf_malloc("%s,%s", desc, dev_name);
-        pa_xfree(desc);
-        desc = tmp;
-
         priority = is_sink ? dev->playback_priority : dev->capture_priority;
         if (priority != 0 && prio2 > 0)
             prio2 += 1.0/priority;
@@ -756,12 +763,28 @@ static void ucm_add_port_combination(
     if (num > 1)
         priority = prio2 > 0 ? 1.0/prio2 : 0;
 
+    /* Every profile that contains the mapping's devices comes here with
+     * the same combinations, so the description is only put together
+     * for the first one */
     port = pa_hashmap_get(ports, name);
     if (!port) {
         struct ucm_port *ucm_port;
+        char *desc;
 
         pa_device_port_new_data port_data;
 
+        dev_name = pa_proplist_gets(sorted[0]->proplist, PA_ALSA_PROP_UCM_NAME);
+        desc = num == 1 ? pa_xstrdup(pa_proplist_gets(sorted[0]->proplist, PA_ALSA_PROP_UCM_DESCRIPTION))
+                : pa_sprintf_malloc("Combination port for %s", dev_name);
+
+        for (i = 1; i < num; i++) {
+            char *tmp;
+
+            tmp = pa_sprintf_malloc("%s,%s", desc, pa_proplist_gets(sorted[i]->proplist, PA_ALSA_PROP_UCM_NAME));
+            pa_xfree(desc);
+            desc = tmp;
+        }
+
         pa_device_port_new_data_init(&port_data);
         pa_device_port_new_data_set_name(&port_data, name);
         pa_device_port_new_data_set_description(&port_data, desc);
@@ -770,6 +793,7 @@ static void ucm_add_port_combination(
         port = pa_device_port_new(core, &port_data, sizeof(struct ucm_port));
         port->impl_free = ucm_port_free;
         pa_device_port_new_data_done(&port_data);
+        pa_xfree(desc);
 
         ucm_port = PA_DEVICE_PORT_DATA(port);
         ucm_port_init(ucm_port, context->ucm, port, pdevices, num);
@@ -781,7 +805,6 @@ static void ucm_add_port_combination(
     port->priority = priority;
 
     pa_xfree(name);
-    pa_xfree(desc);
 
     direction = is_sink ? "output" : "input";
     pa_log_debug("Port %s direction %s, priority %d", port->name, direction, priority);
@@ -1500,7 +1523,7 @@ static void profile_finalize_probing(pa_alsa_profile *p) {
     }
 }
 
-static void ucm_mapping_jack_probe(pa_alsa_mapping *m) {
+static void ucm_mapping_jack_probe(pa_alsa_mapping *m, pa_hashmap *mixers) {
     snd_pcm_t *pcm_handle;
     snd_mixer_t *mixer_handle;
     pa_alsa_ucm_mapping_context *context = &m->ucm_context;
@@ -1508,7 +1531,7 @@ static void ucm_mapping_jack_probe(pa_alsa_mapping *m) {
     uint32_t idx;
 
     pcm_handle = m->direction == PA_ALSA_DIRECTION_OUTPUT ? m->output_pcm : m->input_pcm;
-    mixer_handle = pa_alsa_open_mixer_for_pcm(pcm_handle, NULL);
+    mixer_handle = pa_alsa_open_mixer_for_pcm_cached(mixers, pcm_handle);
     if (!mixer_handle)
         return;
 
@@ -1519,8 +1542,6 @@ static void ucm_mapping_jack_probe(pa_alsa_mapping *m) {
         pa_alsa_jack_set_has_control(dev->jack, has_control);
         pa_log_info("UCM jack %s has_control=%d", dev->jack->name, dev->jack->has_control);
     }
-
-    snd_mixer_close(mixer_handle);
 }
 
 static void ucm_probe_profile_set(pa_alsa_ucm_config *ucm, pa_alsa_profile_set *ps) {
@@ -1528,6 +1549,9 @@ static void ucm_probe_profile_set(pa_alsa_ucm_config *ucm, pa_alsa_profile_set *
     pa_alsa_profile *p;
     pa_alsa_mapping *m;
     uint32_t idx;
+    pa_hashmap *mixers;
+
+    mixers = pa_alsa_mixer_cache_new();
 
     PA_HASHMAP_FOREACH(p, ps->profiles, state) {
         /* change verb */
@@ -1578,15 +1602,17 @@ static void ucm_probe_profile_set(pa_alsa_ucm_config *ucm, pa_alsa_profile_set *
 
         PA_IDXSET_FOREACH(m, p->output_mappings, idx)
             if (!PA_UCM_IS_MODIFIER_MAPPING(m))
-                ucm_mapping_jack_probe(m);
+                ucm_mapping_jack_probe(m, mixers);
 
         PA_IDXSET_FOREACH(m, p->input_mappings, idx)
             if (!PA_UCM_IS_MODIFIER_MAPPING(m))
-                ucm_mapping_jack_probe(m);
+                ucm_mapping_jack_probe(m, mixers);
 
         profile_finalize_probing(p);
     }
 
+    pa_hashmap_free(mixers);
+
     /* restore ucm state */
     snd_use_case_set(ucm->ucm_mgr, "_verb", SND_USE_CASE_VERB_INACTIVE);
 
@@ -40,6 +40,7 @@
 #include <pulsecore/thread.h>
 #include <pulsecore/conf-parser.h>
 #include <pulsecore/core-rtclock.h>
+#include <pulsecore/hashmap.h>
 
 #include "alsa-util.h"
 #include "alsa-mixer.h"
@@ -483,6 +484,12 @@ int pa_alsa_set_sw_params(snd_pcm_t *pcm, snd_pcm_uframes_t avail_min, bool peri
         return err;
     }
 
+#if (SND_LIB_VERSION >= ((1<<16)|(0<<8)|29)) /* API additions in 1.0.29 */
+    /* The timestamps go into the smoother together with pa_rtclock_now() */
+    if ((err = snd_pcm_sw_params_set_tstamp_type(pcm, swparams, SND_PCM_TSTAMP_TYPE_MONOTONIC)) < 0)
+        pa_log_debug("Unable to use monotonic time stamps: %s", pa_alsa_strerror(err));
+#endif
+
     if ((err = snd_pcm_sw_params_get_boundary(swparams, &boundary)) < 0) {
         pa_log_warn("Unable to get boundary: %s", pa_alsa_strerror(err));
         return err;
@@ -748,7 +755,8 @@ snd_pcm_t *pa_alsa_open_by_device_string(
         }
 
         if (ss->channels > PA_CHANNELS_MAX) {
-            pa_log("Device %s has %u channels, but PulseAudio supports only %u channels. Unable to use the device.",
+            pa_log("Device %s has %u channels, but PulseAudio supports only %u channels. Unable to use the device. "
+                   "ALSA's dshare and dsnoop plugins can split it into devices with fewer channels.",
                    d, ss->channels, PA_CHANNELS_MAX);
             snd_pcm_close(pcm_handle);
             goto fail;
@@ -1273,6 +1281,109 @@ int pa_alsa_safe_delay(snd_pcm_t *pcm, snd_pcm_status_t *status, snd_pcm_sframes
     return 0;
 }
 
+/* Average the jitter of the delay away over this many updates */
+#define TSTAMP_OFFSET_WEIGHT 16
+
+/* The stream was restarted if the offset moves more than this */
+#define TSTAMP_REBASE_USEC (20*PA_USEC_PER_MSEC)
+
+void pa_alsa_tstamp_init(pa_alsa_tstamp *t, snd_pcm_t *pcm) {
+#if (SND_LIB_VERSION >= ((1<<16)|(1<<8)|0)) /* API additions in 1.1.0 */
+    static const int types[] = {
+        SND_PCM_AUDIO_TSTAMP_TYPE_LINK_SYNCHRONIZED,
+        SND_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE,
+        SND_PCM_AUDIO_TSTAMP_TYPE_LINK
+    };
+    snd_pcm_hw_params_t *hwparams;
+    unsigned i;
+#endif
+
+    pa_assert(t);
+    pa_assert(pcm);
+
+    pa_zero(*t);
+    t->type = -1;
+
+#if (SND_LIB_VERSION >= ((1<<16)|(1<<8)|0))
+    snd_pcm_hw_params_alloca(&hwparams);
+
+    if (snd_pcm_hw_params_current(pcm, hwparams) < 0)
+        return;
+
+    for (i = 0; i < PA_ELEMENTSOF(types); i++)
+        if (snd_pcm_hw_params_supports_audio_ts_type(hwparams, types[i])) {
+            t->type = types[i];
+            break;
+        }
+
+    if (t->type >= 0)
+        pa_log_info("Using link audio timestamps of type %i for timing.", t->type);
+    else
+        pa_log_debug("No link audio timestamps, timing is based on the delay only.");
+#endif
+}
+
+void pa_alsa_tstamp_request(pa_alsa_tstamp *t, snd_pcm_status_t *status) {
+#if (SND_LIB_VERSION >= ((1<<16)|(1<<8)|0))
+    snd_pcm_audio_tstamp_config_t config;
+#endif
+
+    pa_assert(t);
+    pa_assert(status);
+
+    if (t->type < 0)
+        return;
+
+#if (SND_LIB_VERSION >= ((1<<16)|(1<<8)|0))
+    pa_zero(config);
+    config.type_requested = (unsigned) t->type;
+    config.report_delay = 0;
+
+    snd_pcm_status_set_audio_htstamp_config(status, &config);
+#endif
+}
+
+pa_usec_t pa_alsa_tstamp_position(pa_alsa_tstamp *t, snd_pcm_status_t *status, pa_usec_t position) {
+#if (SND_LIB_VERSION >= ((1<<16)|(1<<8)|0))
+    snd_pcm_audio_tstamp_report_t report;
+    snd_htimestamp_t audio_htstamp = { 0, 0 };
+    pa_usec_t audio;
+    int64_t offset;
+#endif
+
+    pa_assert(t);
+    pa_assert(status);
+
+    if (t->type < 0)
+        return position;
+
+#if (SND_LIB_VERSION >= ((1<<16)|(1<<8)|0))
+    snd_pcm_status_get_audio_htstamp_report(status, &report);
+
+    /* The driver may fall back to another type, e.g. while the link
+     * isn't running */
+    if (!report.valid || report.actual_type != (unsigned) t->type)
+        return position;
+
+    snd_pcm_status_get_audio_htstamp(status, &audio_htstamp);
+    audio = pa_timespec_load(&audio_htstamp);
+
+    offset = (int64_t) position - (int64_t) audio;
+
+    if (!t->anchored ||
+        offset > t->offset + (int64_t) TSTAMP_REBASE_USEC ||
+        offset < t->offset - (int64_t) TSTAMP_REBASE_USEC) {
+        t->offset = offset;
+        t->anchored = true;
+    } else
+        t->offset += (offset - t->offset) / TSTAMP_OFFSET_WEIGHT;
+
+    return (pa_usec_t) PA_MAX((int64_t) audio + t->offset, 0);
+#else
+    return position;
+#endif
+}
+
 int pa_alsa_safe_mmap_begin(snd_pcm_t *pcm, const snd_pcm_channel_area_t **areas, snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames, size_t hwbuf_size, const pa_sample_spec *ss) {
     int r;
     snd_pcm_uframes_t before;
@@ -1441,6 +1552,42 @@ bool pa_alsa_pcm_is_modem(snd_pcm_t *pcm) {
     return snd_pcm_info_get_class(info) == SND_PCM_CLASS_MODEM;
 }
 
+bool pa_alsa_pcm_is_batch(snd_pcm_t *pcm) {
+    snd_pcm_hw_params_t *hwparams;
+    snd_pcm_hw_params_alloca(&hwparams);
+
+    pa_assert(pcm);
+
+    if (snd_pcm_hw_params_current(pcm, hwparams) < 0)
+        return false;
+
+    return snd_pcm_hw_params_is_batch(hwparams);
+}
+
+snd_pcm_uframes_t pa_alsa_get_min_period_size(snd_pcm_t *pcm, const pa_sample_spec *ss) {
+    snd_pcm_hw_params_t *hwparams;
+    snd_pcm_uframes_t frames;
+    int dir = 0, ret;
+    snd_pcm_hw_params_alloca(&hwparams);
+
+    pa_assert(pcm);
+    pa_assert(ss);
+
+    if ((ret = snd_pcm_hw_params_any(pcm, hwparams)) < 0 ||
+        (ret = snd_pcm_hw_params_set_channels(pcm, hwparams, ss->channels)) < 0 ||
+        (ret = snd_pcm_hw_params_set_rate(pcm, hwparams, ss->rate, 0)) < 0 ||
+        (ret = snd_pcm_hw_params_get_period_size_min(hwparams, &frames, &dir)) < 0) {
+        pa_log_debug("Failed to query the minimum period size: %s", pa_alsa_strerror(ret));
+        return 0;
+    }
+
+    /* A period that is not a whole number of frames rounds up */
+    if (dir > 0)
+        frames++;
+
+    return frames;
+}
+
 PA_STATIC_TLS_DECLARE(cstrerror, pa_xfree);
 
 const char* pa_alsa_strerror(int errnum) {
@@ -1622,23 +1769,45 @@ snd_mixer_t *pa_alsa_open_mixer(int alsa_card_index, char **ctl_device) {
     return NULL;
 }
 
-snd_mixer_t *pa_alsa_open_mixer_for_pcm(snd_pcm_t *pcm, char **ctl_device) {
+/* Opens and loads the mixer for dev. If mixers is not NULL, a mixer
+ * that was already opened for the same device is taken from there, and
+ * a newly opened one is added to it. */
+static snd_mixer_t *open_mixer_by_name(pa_hashmap *mixers, const char *dev) {
     int err;
     snd_mixer_t *m;
-    const char *dev;
-    snd_pcm_info_t* info;
-    snd_pcm_info_alloca(&info);
 
-    pa_assert(pcm);
+    pa_assert(dev);
+
+    if (mixers && (m = pa_hashmap_get(mixers, dev)))
+        return m;
 
     if ((err = snd_mixer_open(&m, 0)) < 0) {
         pa_log("Error opening mixer: %s", pa_alsa_strerror(err));
         return NULL;
     }
 
+    if (prepare_mixer(m, dev) < 0) {
+        snd_mixer_close(m);
+        return NULL;
+    }
+
+    if (mixers)
+        pa_hashmap_put(mixers, pa_xstrdup(dev), m);
+
+    return m;
+}
+
+static snd_mixer_t *open_mixer_for_pcm(pa_hashmap *mixers, snd_pcm_t *pcm, char **ctl_device) {
+    snd_mixer_t *m;
+    const char *dev;
+    snd_pcm_info_t* info;
+    snd_pcm_info_alloca(&info);
+
+    pa_assert(pcm);
+
     /* First, try by name */
     if ((dev = snd_pcm_name(pcm)))
-        if (prepare_mixer(m, dev) >= 0) {
+        if ((m = open_mixer_by_name(mixers, dev))) {
             if (ctl_device)
                 *ctl_device = pa_xstrdup(dev);
 
@@ -1655,7 +1824,7 @@ snd_mixer_t *pa_alsa_open_mixer_for_pcm(snd_pcm_t *pcm, char **ctl_device) {
             md = pa_sprintf_malloc("hw:%i", card_idx);
 
             if (!dev || !pa_streq(dev, md))
-                if (prepare_mixer(m, md) >= 0) {
+                if ((m = open_mixer_by_name(mixers, md))) {
 
                     if (ctl_device)
                         *ctl_device = md;
@@ -1669,10 +1838,37 @@ snd_mixer_t *pa_alsa_open_mixer_for_pcm(snd_pcm_t *pcm, char **ctl_device) {
         }
     }
 
-    snd_mixer_close(m);
     return NULL;
 }
 
+snd_mixer_t *pa_alsa_open_mixer_for_pcm(snd_pcm_t *pcm, char **ctl_device) {
+    return open_mixer_for_pcm(NULL, pcm, ctl_device);
+}
+
+pa_hashmap *pa_alsa_mixer_cache_new(void) {
+    return pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func,
+                               pa_xfree, (pa_free_cb_t) snd_mixer_close);
+}
+
+snd_mixer_t *pa_alsa_open_mixer_cached(pa_hashmap *mixers, int alsa_card_index) {
+    snd_mixer_t *m;
+    char *md;
+
+    pa_assert(mixers);
+
+    md = pa_sprintf_malloc("hw:%i", alsa_card_index);
+    m = open_mixer_by_name(mixers, md);
+    pa_xfree(md);
+
+    return m;
+}
+
+snd_mixer_t *pa_alsa_open_mixer_for_pcm_cached(pa_hashmap *mixers, snd_pcm_t *pcm) {
+    pa_assert(mixers);
+
+    return open_mixer_for_pcm(mixers, pcm, NULL);
+}
+
 int pa_alsa_get_hdmi_eld(snd_hctl_elem_t *elem, pa_hdmi_eld *eld) {
 
     /* The ELD format is specific to HDA Intel sound cards and defined in the
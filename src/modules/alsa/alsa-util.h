@@ -124,6 +124,26 @@ pa_rtpoll_item* pa_alsa_build_pollfd(snd_pcm_t *pcm, pa_rtpoll *rtpoll);
 
 snd_pcm_sframes_t pa_alsa_safe_avail(snd_pcm_t *pcm, size_t hwbuf_size, const pa_sample_spec *ss);
 int pa_alsa_safe_delay(snd_pcm_t *pcm, snd_pcm_status_t *status, snd_pcm_sframes_t *delay, size_t hwbuf_size, const pa_sample_spec *ss, bool capture);
+
+/* Drivers that count the samples on the link report how much audio went
+ * through it with the same system timestamp as the status, which doesn't
+ * jitter with the DMA transfers like the delay does. The position from
+ * the delay anchors it, since it counts from the start of the stream
+ * only. */
+typedef struct pa_alsa_tstamp {
+    int type;       /* snd_pcm_audio_tstamp_type_t, -1 if there is none */
+    bool anchored;
+    int64_t offset; /* Averaged position from the delay minus the audio time */
+} pa_alsa_tstamp;
+
+/* Called after the hw params are set */
+void pa_alsa_tstamp_init(pa_alsa_tstamp *t, snd_pcm_t *pcm);
+
+/* Called before and after pa_alsa_safe_delay() with the same status.
+ * position is the one calculated from the delay, in usec, the refined
+ * one is returned. */
+void pa_alsa_tstamp_request(pa_alsa_tstamp *t, snd_pcm_status_t *status);
+pa_usec_t pa_alsa_tstamp_position(pa_alsa_tstamp *t, snd_pcm_status_t *status, pa_usec_t position);
 int pa_alsa_safe_mmap_begin(snd_pcm_t *pcm, const snd_pcm_channel_area_t **areas, snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames, size_t hwbuf_size, const pa_sample_spec *ss);
 
 char *pa_alsa_get_driver_name(int card);
@@ -136,6 +156,15 @@ unsigned int *pa_alsa_get_supported_rates(snd_pcm_t *pcm, unsigned int fallback_
 bool pa_alsa_pcm_is_hw(snd_pcm_t *pcm);
 bool pa_alsa_pcm_is_modem(snd_pcm_t *pcm);
 
+/* Whether the pointer of the configured PCM only moves in chunks, like
+ * the periods of some devices or the packets of USB audio */
+bool pa_alsa_pcm_is_batch(snd_pcm_t *pcm);
+
+/* The smallest period the device allows with this rate and channel
+ * count, which is as close as ALSA gets to telling how coarse a batch
+ * device moves its pointer. 0 if it can't be queried. */
+snd_pcm_uframes_t pa_alsa_get_min_period_size(snd_pcm_t *pcm, const pa_sample_spec *ss);
+
 const char* pa_alsa_strerror(int errnum);
 
 bool pa_alsa_may_tsched(bool want);
@@ -21,12 +21,18 @@
 #include <config.h>
 #endif
 
+#include <sys/utsname.h>
+
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
+#include <pulsecore/database.h>
 #include <pulsecore/i18n.h>
 #include <pulsecore/modargs.h>
+#include <pulsecore/msgobject.h>
 #include <pulsecore/queue.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -62,13 +68,19 @@ PA_MODULE_USAGE(
         "tsched=<enable system timer based scheduling mode?> "
         "tsched_buffer_size=<buffer size when using timer based scheduling> "
         "tsched_buffer_watermark=<lower fill watermark> "
+        "deep_bus_latency_msec=<mix streams accepting this latency ahead, apart from lower latency ones> "
         "profile=<profile name> "
         "fixed_latency_range=<disable latency range changes on underrun?> "
+        "batch_fixed_latency=<on batch devices like USB audio, wake up the sinks with short periods and don't rewind?> "
+        "thread_affinity=<CPUs to run the IO threads on> "
+        "period_trace_file=<append the timing of the last periods before an underrun of a sink to this file> "
         "ignore_dB=<ignore dB information from the device?> "
         "deferred_volume=<Synchronize software and hardware volume changes to avoid momentary jumps?> "
         "profile_set=<profile set configuration file> "
         "paths_dir=<directory containing the path configuration files> "
         "use_ucm=<load use case manager> "
+        "probe_cache=<reuse the profile probe result from the last time this card was seen?> "
+        "async_probe=<probe the profiles in a worker thread and publish the card afterwards?> "
 );
 
 static const char* const valid_modargs[] = {
@@ -89,18 +101,28 @@ static const char* const valid_modargs[] = {
     "tsched",
     "tsched_buffer_size",
     "tsched_buffer_watermark",
+    "deep_bus_latency_msec",
     "fixed_latency_range",
+    "batch_fixed_latency",
+    "thread_affinity",
+    "period_trace_file",
     "profile",
     "ignore_dB",
     "deferred_volume",
     "profile_set",
     "paths_dir",
     "use_ucm",
+    "probe_cache",
+    "async_probe",
     NULL
 };
 
 #define DEFAULT_DEVICE_ID "0"
 
+#define PROBE_CACHE_DB "alsa-card-probe"
+
+typedef struct probe_msg probe_msg;
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -122,6 +144,33 @@ struct userdata {
     bool use_ucm;
     pa_alsa_ucm_config ucm;
 
+    /* Set if the profiles were taken from the probe cache, which is
+     * then dropped if a mapping fails to open after all */
+    char *probe_cache_key;
+    bool probe_cached;
+
+    /* Set while the profiles are probed in the background. The card is
+     * only created once that is done. */
+    pa_reserve_wrapper *reserve;
+    pa_thread *probe_thread;
+    pa_thread_mq probe_mq;
+    pa_rtpoll *probe_rtpoll;
+    probe_msg *probe_msg;
+    pa_sample_spec probe_ss;
+    unsigned probe_n_fragments;
+    unsigned probe_fragment_size_msec;
+};
+
+struct probe_msg {
+    pa_msgobject parent;
+    struct userdata *userdata;
+};
+
+PA_DEFINE_PRIVATE_CLASS(probe_msg, pa_msgobject);
+#define PROBE_MSG(o) (probe_msg_cast(o))
+
+enum {
+    PROBE_MESSAGE_DONE
 };
 
 struct profile_data {
@@ -191,6 +240,103 @@ static void add_disabled_profile(pa_hashmap *profiles) {
     pa_hashmap_put(profiles, p->name, p);
 }
 
+/* Everything that can change the outcome of a probe goes into the key:
+ * the card itself, the kernel, our own version and configuration. */
+static char *probe_cache_key(struct userdata *u, const char *profile_set) {
+    struct utsname un;
+    char *longname = NULL, *driver, *key;
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX];
+
+    if (uname(&un) < 0)
+        return NULL;
+
+    if (snd_card_get_longname(u->alsa_card_index, &longname) < 0)
+        return NULL;
+
+    driver = pa_alsa_get_driver_name(u->alsa_card_index);
+
+    key = pa_sprintf_malloc("%s|%s|%s %s|%s|%s|%s %u %u",
+                            longname, pa_strnull(driver), un.release, un.version, PACKAGE_VERSION,
+                            profile_set ? profile_set : "default",
+                            pa_sample_spec_snprint(ss, sizeof(ss), &u->core->default_sample_spec),
+                            u->core->default_n_fragments, u->core->default_fragment_size_msec);
+
+    free(longname);
+    pa_xfree(driver);
+
+    return key;
+}
+
+static char *probe_cache_load(const char *key) {
+    pa_database *db;
+    pa_datum k, d;
+    char *fname, *result = NULL;
+
+    if (!(fname = pa_state_path(PROBE_CACHE_DB, true)))
+        return NULL;
+
+    db = pa_database_open(fname, false);
+    pa_xfree(fname);
+
+    if (!db)
+        return NULL;
+
+    k.data = (char*) key;
+    k.size = strlen(key);
+
+    if (pa_database_get(db, &k, &d)) {
+        result = pa_xstrndup(d.data, d.size);
+        pa_datum_free(&d);
+    }
+
+    pa_database_close(db);
+
+    return result;
+}
+
+/* result == NULL drops the entry */
+static void probe_cache_store(const char *key, const char *result) {
+    pa_database *db;
+    pa_datum k, d;
+    char *fname;
+
+    if (!(fname = pa_state_path(PROBE_CACHE_DB, true)))
+        return;
+
+    db = pa_database_open(fname, true);
+    pa_xfree(fname);
+
+    if (!db) {
+        pa_log_warn("Failed to open probe cache database.");
+        return;
+    }
+
+    k.data = (char*) key;
+    k.size = strlen(key);
+
+    if (result) {
+        d.data = (char*) result;
+        d.size = strlen(result);
+        pa_database_set(db, &k, &d, true);
+    } else
+        pa_database_unset(db, &k);
+
+    pa_database_sync(db);
+    pa_database_close(db);
+}
+
+/* Called when a sink or source couldn't be created for a mapping */
+static void probe_cache_verify_failed(struct userdata *u, pa_alsa_mapping *am) {
+    if (!u->probe_cached)
+        return;
+
+    pa_log_info("Mapping %s didn't open although the cached probe result says it should, dropping the cache for card %s.",
+                am->name, u->device_id);
+
+    probe_cache_store(u->probe_cache_key, NULL);
+    u->probe_cached = false;
+}
+
 static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
     struct userdata *u;
     struct profile_data *nd, *od;
@@ -249,7 +395,8 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
         PA_IDXSET_FOREACH(am, nd->profile->output_mappings, idx) {
 
             if (!am->sink)
-                am->sink = pa_alsa_sink_new(c->module, u->modargs, __FILE__, c, am);
+                if (!(am->sink = pa_alsa_sink_new(c->module, u->modargs, __FILE__, c, am)))
+                    probe_cache_verify_failed(u, am);
 
             if (sink_inputs && am->sink) {
                 pa_sink_move_all_finish(am->sink, sink_inputs, false);
@@ -261,7 +408,8 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
         PA_IDXSET_FOREACH(am, nd->profile->input_mappings, idx) {
 
             if (!am->source)
-                am->source = pa_alsa_source_new(c->module, u->modargs, __FILE__, c, am);
+                if (!(am->source = pa_alsa_source_new(c->module, u->modargs, __FILE__, c, am)))
+                    probe_cache_verify_failed(u, am);
 
             if (source_outputs && am->source) {
                 pa_source_move_all_finish(am->source, source_outputs, false);
@@ -299,11 +447,13 @@ static void init_profile(struct userdata *u) {
 
     if (d->profile && d->profile->output_mappings)
         PA_IDXSET_FOREACH(am, d->profile->output_mappings, idx)
-            am->sink = pa_alsa_sink_new(u->module, u->modargs, __FILE__, u->card, am);
+            if (!(am->sink = pa_alsa_sink_new(u->module, u->modargs, __FILE__, u->card, am)))
+                probe_cache_verify_failed(u, am);
 
     if (d->profile && d->profile->input_mappings)
         PA_IDXSET_FOREACH(am, d->profile->input_mappings, idx)
-            am->source = pa_alsa_source_new(u->module, u->modargs, __FILE__, u->card, am);
+            if (!(am->source = pa_alsa_source_new(u->module, u->modargs, __FILE__, u->card, am)))
+                probe_cache_verify_failed(u, am);
 }
 
 static pa_available_t calc_port_state(pa_device_port *p, struct userdata *u) {
@@ -432,25 +582,11 @@ static int report_jack_state(snd_mixer_elem_t *melem, unsigned int mask) {
      * unavailable ports) to PA_AVAILABLE_NO and all others to
      * PA_AVAILABLE_UNKNOWN. */
     PA_HASHMAP_FOREACH(profile, u->card->profiles, state) {
-        pa_device_port *port;
-        void *state2;
-        pa_available_t available = PA_AVAILABLE_NO;
-
         /* Don't touch the "off" profile. */
         if (profile->n_sources == 0 && profile->n_sinks == 0)
             continue;
 
-        PA_HASHMAP_FOREACH(port, u->card->ports, state2) {
-            if (!pa_hashmap_get(port->profiles, profile->name))
-                continue;
-
-            if (port->available != PA_AVAILABLE_NO) {
-                available = PA_AVAILABLE_UNKNOWN;
-                break;
-            }
-        }
-
-        pa_card_profile_set_available(profile, available);
+        pa_card_profile_set_available(profile, profile->n_available_ports > 0 ? PA_AVAILABLE_UNKNOWN : PA_AVAILABLE_NO);
     }
 
     pa_xfree(tports);
@@ -692,15 +828,191 @@ static pa_hook_result_t source_output_unlink_hook_callback(pa_core *c, pa_source
     return PA_HOOK_OK;
 }
 
-int pa__init(pa_module *m) {
+/* Called from main context, once the profiles are probed */
+static int init_card(struct userdata *u) {
+    pa_module *m = u->module;
     pa_card_new_data data;
+    const char *description;
+    const char *profile_str = NULL;
+    bool namereg_fail = false;
+
+    if (u->probe_cache_key && !u->probe_cached) {
+        char *result = pa_alsa_profile_set_probe_result(u->profile_set);
+
+        probe_cache_store(u->probe_cache_key, result);
+        pa_xfree(result);
+    }
+    pa_alsa_profile_set_dump(u->profile_set);
+
+    pa_card_new_data_init(&data);
+    data.driver = __FILE__;
+    data.module = m;
+
+    pa_alsa_init_proplist_card(m->core, data.proplist, u->alsa_card_index);
+
+    pa_proplist_sets(data.proplist, PA_PROP_DEVICE_STRING, u->device_id);
+    pa_alsa_init_description(data.proplist, NULL);
+    set_card_name(&data, u->modargs, u->device_id);
+
+    /* We need to give pa_modargs_get_value_boolean() a pointer to a local
+     * variable instead of using &data.namereg_fail directly, because
+     * data.namereg_fail is a bitfield and taking the address of a bitfield
+     * variable is impossible. */
+    namereg_fail = data.namereg_fail;
+    if (pa_modargs_get_value_boolean(u->modargs, "namereg_fail", &namereg_fail) < 0) {
+        pa_log("Failed to parse namereg_fail argument.");
+        pa_card_new_data_done(&data);
+        return -1;
+    }
+    data.namereg_fail = namereg_fail;
+
+    if (u->reserve)
+        if ((description = pa_proplist_gets(data.proplist, PA_PROP_DEVICE_DESCRIPTION)))
+            pa_reserve_wrapper_set_application_device_name(u->reserve, description);
+
+    add_profiles(u, data.profiles, data.ports);
+
+    if (pa_hashmap_isempty(data.profiles)) {
+        pa_log("Failed to find a working profile.");
+        pa_card_new_data_done(&data);
+        return -1;
+    }
+
+    add_disabled_profile(data.profiles);
+
+    if (pa_modargs_get_proplist(u->modargs, "card_properties", data.proplist, PA_UPDATE_REPLACE) < 0) {
+        pa_log("Invalid properties");
+        pa_card_new_data_done(&data);
+        return -1;
+    }
+
+    u->card = pa_card_new(m->core, &data);
+    pa_card_new_data_done(&data);
+
+    if (!u->card)
+        return -1;
+
+    u->card->userdata = u;
+    u->card->set_profile = card_set_profile;
+
+    pa_module_hook_connect(m, &m->core->hooks[PA_CORE_HOOK_CARD_SUSPEND_CHANGED], PA_HOOK_NORMAL,
+            (pa_hook_cb_t) card_suspend_changed, u);
+
+    init_jacks(u);
+
+    pa_card_choose_initial_profile(u->card);
+
+    /* If the "profile" modarg is given, we have to override whatever the usual
+     * policy chose in pa_card_choose_initial_profile(). */
+    profile_str = pa_modargs_get_value(u->modargs, "profile", NULL);
+    if (profile_str) {
+        pa_card_profile *profile;
+
+        profile = pa_hashmap_get(u->card->profiles, profile_str);
+        if (!profile) {
+            pa_log("No such profile: %s", profile_str);
+            return -1;
+        }
+
+        pa_card_set_profile(u->card, profile, false);
+    }
+
+    pa_card_put(u->card);
+
+    init_profile(u);
+    init_eld_ctls(u);
+
+    if (u->reserve) {
+        pa_reserve_wrapper_unref(u->reserve);
+        u->reserve = NULL;
+    }
+
+    if (!pa_hashmap_isempty(u->profile_set->decibel_fixes))
+        pa_log_warn("Card %s uses decibel fixes (i.e. overrides the decibel information for some alsa volume elements). "
+                    "Please note that this feature is meant just as a help for figuring out the correct decibel values. "
+                    "PulseAudio is not the correct place to maintain the decibel mappings! The fixed decibel values "
+                    "should be sent to ALSA developers so that they can fix the driver. If it turns out that this feature "
+                    "is abused (i.e. fixes are not pushed to ALSA), the decibel fix feature may be removed in some future "
+                    "PulseAudio version.", u->card->name);
+
+    return 0;
+}
+
+/* Called from the probe thread, or from main context if there is none */
+static void probe_profiles(struct userdata *u) {
+    pa_alsa_profile_set_probe(u->profile_set, u->device_id, &u->probe_ss, u->probe_n_fragments, u->probe_fragment_size_msec);
+}
+
+static void probe_thread_func(void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+
+    pa_thread_mq_install(&u->probe_mq);
+
+    probe_profiles(u);
+
+    pa_asyncmsgq_post(u->probe_mq.outq, PA_MSGOBJECT(u->probe_msg), PROBE_MESSAGE_DONE, NULL, 0, NULL, NULL);
+}
+
+/* Called from main context */
+static int probe_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    struct userdata *u;
+
+    pa_assert(o);
+    pa_assert_ctl_context();
+    pa_assert_se(u = PROBE_MSG(o)->userdata);
+
+    switch (code) {
+        case PROBE_MESSAGE_DONE:
+            pa_thread_free(u->probe_thread);
+            u->probe_thread = NULL;
+
+            pa_log_debug("Probing card %s finished.", u->device_id);
+
+            pa_module_init_finish(u->module, init_card(u));
+            return 0;
+    }
+
+    return 0;
+}
+
+/* Called from main context. Probing opens every PCM device of the card
+ * in every configuration that might work, which can take a while on
+ * USB devices. Only ALSA and our own profile set are touched meanwhile,
+ * the card is created when the thread is done. */
+static int start_probe_thread(struct userdata *u) {
+    pa_assert(u);
+    pa_assert(!u->probe_thread);
+
+    u->probe_rtpoll = pa_rtpoll_new();
+
+    if (pa_thread_mq_init(&u->probe_mq, u->core->mainloop, u->probe_rtpoll) < 0) {
+        pa_log("pa_thread_mq_init() failed.");
+        return -1;
+    }
+
+    u->probe_msg = pa_msgobject_new(probe_msg);
+    u->probe_msg->parent.process_msg = probe_process_msg;
+    u->probe_msg->userdata = u;
+
+    if (!(u->probe_thread = pa_thread_new("alsa-probe", probe_thread_func, u))) {
+        pa_log("Failed to create probe thread.");
+        return -1;
+    }
+
+    pa_log_debug("Probing card %s in the background.", u->device_id);
+
+    return 0;
+}
+
+int pa__init(pa_module *m) {
     bool ignore_dB = false;
     struct userdata *u;
     pa_reserve_wrapper *reserve = NULL;
-    const char *description;
-    const char *profile_str = NULL;
     char *fn = NULL;
-    bool namereg_fail = false;
+    bool probe_cache = true;
+    bool async_probe = false;
 
     pa_alsa_refcnt_inc();
 
@@ -746,6 +1058,16 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(u->modargs, "probe_cache", &probe_cache) < 0) {
+        pa_log("Failed to parse probe_cache argument.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(u->modargs, "async_probe", &async_probe) < 0) {
+        pa_log("Failed to parse async_probe argument.");
+        goto fail;
+    }
+
     /* Force ALSA to reread its configuration. This matters if our device
      * was hot-plugged after ALSA has already read its configuration - see
      * https://bugs.freedesktop.org/show_bug.cgi?id=54029
@@ -784,6 +1106,10 @@ int pa__init(pa_module *m) {
         }
 
         u->profile_set = pa_alsa_profile_set_new(fn, &u->core->default_channel_map);
+
+        if (u->profile_set && probe_cache)
+            u->probe_cache_key = probe_cache_key(u, fn);
+
         pa_xfree(fn);
     }
 
@@ -792,97 +1118,38 @@ int pa__init(pa_module *m) {
 
     u->profile_set->ignore_dB = ignore_dB;
 
-    pa_alsa_profile_set_probe(u->profile_set, u->device_id, &m->core->default_sample_spec, m->core->default_n_fragments, m->core->default_fragment_size_msec);
-    pa_alsa_profile_set_dump(u->profile_set);
-
-    pa_card_new_data_init(&data);
-    data.driver = __FILE__;
-    data.module = m;
-
-    pa_alsa_init_proplist_card(m->core, data.proplist, u->alsa_card_index);
+    if (u->probe_cache_key) {
+        char *result;
 
-    pa_proplist_sets(data.proplist, PA_PROP_DEVICE_STRING, u->device_id);
-    pa_alsa_init_description(data.proplist, NULL);
-    set_card_name(&data, u->modargs, u->device_id);
-
-    /* We need to give pa_modargs_get_value_boolean() a pointer to a local
-     * variable instead of using &data.namereg_fail directly, because
-     * data.namereg_fail is a bitfield and taking the address of a bitfield
-     * variable is impossible. */
-    namereg_fail = data.namereg_fail;
-    if (pa_modargs_get_value_boolean(u->modargs, "namereg_fail", &namereg_fail) < 0) {
-        pa_log("Failed to parse namereg_fail argument.");
-        pa_card_new_data_done(&data);
-        goto fail;
-    }
-    data.namereg_fail = namereg_fail;
-
-    if (reserve)
-        if ((description = pa_proplist_gets(data.proplist, PA_PROP_DEVICE_DESCRIPTION)))
-            pa_reserve_wrapper_set_application_device_name(reserve, description);
-
-    add_profiles(u, data.profiles, data.ports);
-
-    if (pa_hashmap_isempty(data.profiles)) {
-        pa_log("Failed to find a working profile.");
-        pa_card_new_data_done(&data);
-        goto fail;
-    }
-
-    add_disabled_profile(data.profiles);
+        if ((result = probe_cache_load(u->probe_cache_key))) {
+            if (pa_alsa_profile_set_probe_from_result(u->profile_set, u->device_id, result) >= 0) {
+                pa_log_debug("Using cached probe result for card %s.", u->device_id);
+                u->probe_cached = true;
+            }
 
-    if (pa_modargs_get_proplist(u->modargs, "card_properties", data.proplist, PA_UPDATE_REPLACE) < 0) {
-        pa_log("Invalid properties");
-        pa_card_new_data_done(&data);
-        goto fail;
+            pa_xfree(result);
+        }
     }
 
-    u->card = pa_card_new(m->core, &data);
-    pa_card_new_data_done(&data);
-
-    if (!u->card)
-        goto fail;
-
-    u->card->userdata = u;
-    u->card->set_profile = card_set_profile;
-
-    pa_module_hook_connect(m, &m->core->hooks[PA_CORE_HOOK_CARD_SUSPEND_CHANGED], PA_HOOK_NORMAL,
-            (pa_hook_cb_t) card_suspend_changed, u);
-
-    init_jacks(u);
-
-    pa_card_choose_initial_profile(u->card);
+    u->probe_ss = m->core->default_sample_spec;
+    u->probe_n_fragments = m->core->default_n_fragments;
+    u->probe_fragment_size_msec = m->core->default_fragment_size_msec;
 
-    /* If the "profile" modarg is given, we have to override whatever the usual
-     * policy chose in pa_card_choose_initial_profile(). */
-    profile_str = pa_modargs_get_value(u->modargs, "profile", NULL);
-    if (profile_str) {
-        pa_card_profile *profile;
+    u->reserve = reserve;
+    reserve = NULL;
 
-        profile = pa_hashmap_get(u->card->profiles, profile_str);
-        if (!profile) {
-            pa_log("No such profile: %s", profile_str);
+    if (async_probe && !u->profile_set->probed) {
+        if (start_probe_thread(u) < 0)
             goto fail;
-        }
 
-        pa_card_set_profile(u->card, profile, false);
+        pa_module_init_async(m);
+        return 0;
     }
 
-    pa_card_put(u->card);
-
-    init_profile(u);
-    init_eld_ctls(u);
-
-    if (reserve)
-        pa_reserve_wrapper_unref(reserve);
+    probe_profiles(u);
 
-    if (!pa_hashmap_isempty(u->profile_set->decibel_fixes))
-        pa_log_warn("Card %s uses decibel fixes (i.e. overrides the decibel information for some alsa volume elements). "
-                    "Please note that this feature is meant just as a help for figuring out the correct decibel values. "
-                    "PulseAudio is not the correct place to maintain the decibel mappings! The fixed decibel values "
-                    "should be sent to ALSA developers so that they can fix the driver. If it turns out that this feature "
-                    "is abused (i.e. fixes are not pushed to ALSA), the decibel fix feature may be removed in some future "
-                    "PulseAudio version.", u->card->name);
+    if (init_card(u) < 0)
+        goto fail;
 
     return 0;
 
@@ -904,7 +1171,10 @@ int pa__get_n_used(pa_module *m) {
 
     pa_assert(m);
     pa_assert_se(u = m->userdata);
-    pa_assert(u->card);
+
+    /* Still probing */
+    if (!u->card)
+        return 0;
 
     PA_IDXSET_FOREACH(sink, u->card->sinks, idx)
         n += pa_sink_linked_by(sink);
@@ -923,6 +1193,22 @@ void pa__done(pa_module*m) {
     if (!(u = m->userdata))
         goto finish;
 
+    /* Nothing else touches the profile set while the thread runs, so
+     * there is nothing to do but wait for it */
+    if (u->probe_thread)
+        pa_thread_free(u->probe_thread);
+
+    if (u->probe_msg) {
+        pa_thread_mq_done(&u->probe_mq);
+        probe_msg_unref(u->probe_msg);
+    }
+
+    if (u->probe_rtpoll)
+        pa_rtpoll_free(u->probe_rtpoll);
+
+    if (u->reserve)
+        pa_reserve_wrapper_unref(u->reserve);
+
     if (u->mixer_fdl)
         pa_alsa_fdlist_free(u->mixer_fdl);
     if (u->mixer_handle)
@@ -947,6 +1233,7 @@ void pa__done(pa_module*m) {
 
     pa_alsa_ucm_free(&u->ucm);
 
+    pa_xfree(u->probe_cache_key);
     pa_xfree(u->device_id);
     pa_xfree(u);
 
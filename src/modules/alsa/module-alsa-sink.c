@@ -55,10 +55,14 @@ PA_MODULE_USAGE(
         "ignore_dB=<ignore dB information from the device?> "
         "control=<name of mixer control> "
         "rewind_safeguard=<number of bytes that cannot be rewound> "
+        "deep_bus_latency_msec=<mix streams accepting this latency ahead, apart from lower latency ones> "
         "deferred_volume=<Synchronize software and hardware volume changes to avoid momentary jumps?> "
         "deferred_volume_safety_margin=<usec adjustment depending on volume direction> "
         "deferred_volume_extra_delay=<usec adjustment to HW volume changes> "
-        "fixed_latency_range=<disable latency range changes on underrun?>");
+        "fixed_latency_range=<disable latency range changes on underrun?> "
+        "batch_fixed_latency=<on batch devices like USB audio, wake up with short periods and don't rewind?> "
+        "thread_affinity=<CPUs to run the IO thread on> "
+        "period_trace_file=<append the timing of the last periods before an underrun to this file>");
 
 static const char* const valid_modargs[] = {
     "name",
@@ -81,10 +85,14 @@ static const char* const valid_modargs[] = {
     "ignore_dB",
     "control",
     "rewind_safeguard",
+    "deep_bus_latency_msec",
     "deferred_volume",
     "deferred_volume_safety_margin",
     "deferred_volume_extra_delay",
     "fixed_latency_range",
+    "batch_fixed_latency",
+    "thread_affinity",
+    "period_trace_file",
     NULL
 };
 
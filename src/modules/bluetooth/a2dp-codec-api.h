@@ -0,0 +1,95 @@
+#ifndef fooa2dpcodecapihfoo
+#define fooa2dpcodecapihfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulsecore/core.h>
+
+/* Capabilities and configurations are passed as D-Bus byte arrays, which
+ * BlueZ limits to this size */
+#define MAX_A2DP_CAPS_SIZE 254
+
+/* One A2DP codec. bluez5-util registers a sink and a source endpoint for
+ * each codec in the table of a2dp-codec-util.c, module-bluez5-device
+ * uses the stream part for the transport the remote device picked.
+ *
+ * The stream callbacks work on one RTP packet at a time, so that the
+ * render and push loops of the device module stay the same for all
+ * codecs. The mSBC codec of HFP reuses the stream part with its own
+ * framing instead of RTP, and has no endpoint part. */
+typedef struct pa_a2dp_codec {
+    /* Short name, used in endpoint paths and logs */
+    const char *name;
+    /* Human readable name */
+    const char *description;
+    /* A2DP codec id, one of A2DP_CODEC_* */
+    uint8_t id;
+
+    /* Endpoint part, called from the main thread */
+
+    /* Fills the capabilities we announce to BlueZ, returns their size */
+    uint8_t (*fill_capabilities)(uint8_t capabilities[MAX_A2DP_CAPS_SIZE]);
+    /* Returns true if the configuration set by the remote device is valid */
+    bool (*is_configuration_valid)(const uint8_t *config, uint8_t config_size);
+    /* Picks a configuration from the capabilities of the remote device,
+     * preferring the given sample spec. Returns the size of the
+     * configuration, or -1 if none is usable */
+    int (*fill_preferred_configuration)(const pa_sample_spec *default_sample_spec,
+                                        const uint8_t *capabilities, uint8_t capabilities_size,
+                                        uint8_t config[MAX_A2DP_CAPS_SIZE]);
+
+    /* Stream part */
+
+    /* Called from the main thread. Sets up an encoder or a decoder for a
+     * valid configuration and fills in the sample spec of the PCM side.
+     * Returns the codec state passed to the callbacks below */
+    void *(*init)(bool for_encoding, const uint8_t *config, uint8_t config_size, pa_sample_spec *sample_spec);
+    void (*deinit)(void *codec_info);
+    /* Called from the IO thread whenever the stream is (re)started.
+     * Restores the initial bitrate */
+    void (*reset)(void *codec_info);
+
+    /* Bytes of PCM that fit into one packet of the given link MTU */
+    size_t (*get_read_block_size)(void *codec_info, size_t read_link_mtu);
+    size_t (*get_write_block_size)(void *codec_info, size_t write_link_mtu);
+
+    /* Lowers the bitrate of the encoder a step. Returns the new write
+     * block size, or 0 if the bitrate can't go any lower. May be NULL */
+    size_t (*reduce_encoder_bitrate)(void *codec_info, size_t write_link_mtu);
+    /* Raises the bitrate of the encoder a step, up to the negotiated
+     * maximum. Returns the new write block size, or 0 if the bitrate is
+     * already at its maximum. May be NULL */
+    size_t (*increase_encoder_bitrate)(void *codec_info, size_t write_link_mtu);
+
+    /* Encodes PCM from input into one packet, RTP header included.
+     * Returns the size of the packet, or 0 on error, and the number of
+     * input bytes used in processed */
+    size_t (*encode_buffer)(void *codec_info, uint32_t timestamp,
+                            const uint8_t *input, size_t input_size,
+                            uint8_t *output, size_t output_size,
+                            size_t *processed);
+    /* Decodes one packet, RTP header included, into PCM. Returns the
+     * number of PCM bytes written to output, and the number of input
+     * bytes used in processed. Leaves processed at 0 on error */
+    size_t (*decode_buffer)(void *codec_info,
+                            const uint8_t *input, size_t input_size,
+                            uint8_t *output, size_t output_size,
+                            size_t *processed);
+} pa_a2dp_codec;
+
+#endif
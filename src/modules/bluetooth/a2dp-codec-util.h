@@ -0,0 +1,42 @@
+#ifndef fooa2dpcodecutilhfoo
+#define fooa2dpcodecutilhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "a2dp-codec-api.h"
+
+/* Number of supported A2DP codecs, in order of preference */
+unsigned pa_bluetooth_a2dp_codec_count(void);
+
+/* The i-th supported codec */
+const pa_a2dp_codec *pa_bluetooth_a2dp_codec_iter(unsigned i);
+
+/* The codec with the given name, or NULL */
+const pa_a2dp_codec *pa_bluetooth_get_a2dp_codec(const char *name);
+
+/* Size of one mSBC frame on the SCO link, H2 header and padding included */
+#define MSBC_PACKET_SIZE 60
+
+/* Duration of one mSBC frame */
+#define MSBC_PACKET_USEC 7500
+
+/* The mSBC codec of HFP wideband speech. Only has the stream part, and
+ * is not in the list of A2DP codecs above */
+extern const pa_a2dp_codec pa_hfp_codec_msbc;
+
+#endif
@@ -0,0 +1,200 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sbc/sbc.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/once.h>
+
+#include "a2dp-codec-api.h"
+#include "a2dp-codec-util.h"
+
+/* mSBC, the wideband speech codec of HFP 1.6. Every 7.5 ms of 16 kHz mono
+ * audio become one SBC frame, which travels with a two byte H2
+ * synchronization header and one byte of padding. These 60 byte frames
+ * don't line up with the SCO packets, so the decoder searches the
+ * received data for the next header. */
+
+#define MSBC_H2_ID0 0x01
+#define MSBC_SBC_SYNCWORD 0xAD
+
+struct msbc_info {
+    sbc_t sbc;                           /* Codec data */
+    size_t codesize, frame_length;       /* PCM and SBC bytes of one frame */
+    uint8_t seq_num;                     /* Sequence number of the next H2 header */
+    bool for_encoding;
+};
+
+/* The second H2 header byte, 0x08 with the two bit sequence number
+ * spread over the upper nibble */
+static const uint8_t h2_id1[4] = { 0x08, 0x38, 0xc8, 0xf8 };
+
+static void *init(bool for_encoding, const uint8_t *config_buffer, uint8_t config_size, pa_sample_spec *sample_spec) {
+    struct msbc_info *msbc_info;
+    int ret;
+
+    msbc_info = pa_xnew0(struct msbc_info, 1);
+    msbc_info->for_encoding = for_encoding;
+
+    if ((ret = sbc_init_msbc(&msbc_info->sbc, 0)) != 0) {
+        pa_xfree(msbc_info);
+        pa_log_error("mSBC initialization failed: %d", ret);
+        return NULL;
+    }
+
+    msbc_info->codesize = sbc_get_codesize(&msbc_info->sbc);
+    msbc_info->frame_length = sbc_get_frame_length(&msbc_info->sbc);
+
+    pa_assert(msbc_info->frame_length + 3 == MSBC_PACKET_SIZE);
+
+    sample_spec->format = PA_SAMPLE_S16LE;
+    sample_spec->channels = 1;
+    sample_spec->rate = 16000U;
+
+    return msbc_info;
+}
+
+static void deinit(void *codec_info) {
+    struct msbc_info *msbc_info = (struct msbc_info *) codec_info;
+
+    sbc_finish(&msbc_info->sbc);
+    pa_xfree(msbc_info);
+}
+
+static void reset(void *codec_info) {
+    struct msbc_info *msbc_info = (struct msbc_info *) codec_info;
+
+    msbc_info->seq_num = 0;
+}
+
+static size_t get_block_size(void *codec_info, size_t link_mtu) {
+    struct msbc_info *msbc_info = (struct msbc_info *) codec_info;
+
+    /* Frames are split over as many SCO packets as needed, so the PCM
+     * side always works on whole frames */
+    return msbc_info->codesize;
+}
+
+static size_t encode_buffer(void *codec_info, uint32_t timestamp,
+                            const uint8_t *input_buffer, size_t input_size,
+                            uint8_t *output_buffer, size_t output_size,
+                            size_t *processed) {
+    struct msbc_info *msbc_info = (struct msbc_info *) codec_info;
+    ssize_t encoded;
+    ssize_t written;
+
+    *processed = 0;
+
+    if (input_size < msbc_info->codesize || output_size < MSBC_PACKET_SIZE)
+        return 0;
+
+    output_buffer[0] = MSBC_H2_ID0;
+    output_buffer[1] = h2_id1[msbc_info->seq_num++ % PA_ELEMENTSOF(h2_id1)];
+
+    encoded = sbc_encode(&msbc_info->sbc,
+                         input_buffer, msbc_info->codesize,
+                         output_buffer + 2, output_size - 2,
+                         &written);
+
+    if (PA_UNLIKELY(encoded <= 0)) {
+        pa_log_error("mSBC encoding error (%li)", (long) encoded);
+        return 0;
+    }
+
+    pa_assert_fp((size_t) encoded == msbc_info->codesize);
+    pa_assert_fp((size_t) written == msbc_info->frame_length);
+
+    PA_ONCE_BEGIN {
+        pa_log_debug("Using mSBC encoder implementation: %s", pa_strnull(sbc_get_implementation_info(&msbc_info->sbc)));
+    } PA_ONCE_END;
+
+    output_buffer[MSBC_PACKET_SIZE - 1] = 0;
+
+    *processed = msbc_info->codesize;
+    return MSBC_PACKET_SIZE;
+}
+
+static bool is_frame_start(const uint8_t *p) {
+    return p[0] == MSBC_H2_ID0 && (p[1] & 0x0f) == 0x08 && p[2] == MSBC_SBC_SYNCWORD;
+}
+
+/* Unlike the A2DP codecs, the input may start or end with parts of a
+ * frame. processed is set to the number of input bytes that can be
+ * dropped: everything up to the decoded frame, or the garbage before the
+ * start of a frame that isn't complete yet. */
+static size_t decode_buffer(void *codec_info,
+                            const uint8_t *input_buffer, size_t input_size,
+                            uint8_t *output_buffer, size_t output_size,
+                            size_t *processed) {
+    struct msbc_info *msbc_info = (struct msbc_info *) codec_info;
+    size_t i, written;
+    ssize_t decoded;
+
+    for (i = 0; i + 3 <= input_size; i++)
+        if (is_frame_start(input_buffer + i))
+            break;
+
+    if (i + 3 > input_size) {
+        /* Keep what may be the beginning of the next header */
+        *processed = input_size > 2 ? input_size - 2 : 0;
+        return 0;
+    }
+
+    if (input_size - i < MSBC_PACKET_SIZE) {
+        *processed = i;
+        return 0;
+    }
+
+    pa_assert(output_size >= msbc_info->codesize);
+
+    decoded = sbc_decode(&msbc_info->sbc,
+                         input_buffer + i + 2, msbc_info->frame_length,
+                         output_buffer, output_size,
+                         &written);
+
+    if (PA_UNLIKELY(decoded <= 0)) {
+        /* A broken frame, or a header lookalike in the middle of one */
+        pa_log_debug("mSBC decoding error (%li)", (long) decoded);
+        *processed = i + 1;
+        return 0;
+    }
+
+    pa_assert_fp((size_t) written == msbc_info->codesize);
+
+    *processed = i + MSBC_PACKET_SIZE;
+    return written;
+}
+
+const pa_a2dp_codec pa_hfp_codec_msbc = {
+    .name = "msbc",
+    .description = "mSBC",
+    .init = init,
+    .deinit = deinit,
+    .reset = reset,
+    .get_read_block_size = get_block_size,
+    .get_write_block_size = get_block_size,
+    .encode_buffer = encode_buffer,
+    .decode_buffer = decode_buffer,
+};
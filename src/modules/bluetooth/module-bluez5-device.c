@@ -23,9 +23,11 @@
 #endif
 
 #include <errno.h>
+#include <math.h>
+#include <sys/ioctl.h>
 
 #include <arpa/inet.h>
-#include <sbc/sbc.h>
+#include <linux/sockios.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
@@ -35,9 +37,11 @@
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/i18n.h>
+#include <pulsecore/memblockq.h>
 #include <pulsecore/module.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/poll.h>
+#include <pulsecore/render-profile.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/shared.h>
 #include <pulsecore/socket-util.h>
@@ -45,7 +49,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/time-smoother.h>
 
-#include "a2dp-codecs.h"
+#include "a2dp-codec-util.h"
 #include "bluez5-util.h"
 #include "rtp.h"
 
@@ -64,10 +68,43 @@ PA_MODULE_USAGE("path=<device object path>"
 #define FIXED_LATENCY_RECORD_A2DP   (25 * PA_USEC_PER_MSEC)
 #define FIXED_LATENCY_RECORD_SCO    (25 * PA_USEC_PER_MSEC)
 
-#define BITPOOL_DEC_LIMIT 32
-#define BITPOOL_DEC_STEP 5
+/* Reduce the bitrate when encoding a packet takes longer than this share
+ * of the time the packet plays for */
+#define ENCODE_LOAD_MAX_PERCENT 50
+/* Packets to measure before judging the encoder load, also after each
+ * bitrate change */
+#define ENCODE_LOAD_MIN_PACKETS 16
+
+/* Reduce the bitrate when more than this many packets wait in the socket
+ * queue, the radio link doesn't keep up with the bitrate then */
+#define LINK_QUEUE_HIGH_PACKETS 3
+/* Leave the audio in the sink while this many packets wait in the socket
+ * queue. Above LINK_QUEUE_HIGH_PACKETS, so that the bitrate adaptation
+ * still sees the queue grow on a slow link */
+#define LINK_QUEUE_TARGET_PACKETS (LINK_QUEUE_HIGH_PACKETS + 1)
+/* Raise the bitrate again after the socket queue stayed at no more than
+ * one packet for this long */
+#define LINK_QUEUE_RAISE_USEC (5 * PA_USEC_PER_SEC)
+/* How often the bitrate and queue depth sink properties are refreshed */
+#define LINK_STATS_INTERVAL_USEC (1 * PA_USEC_PER_SEC)
 #define HSP_MAX_GAIN 15
 
+/* Received A2DP audio goes through a jitter buffer that aims to hold a
+ * packet plus JITTER_TARGET_FACTOR times the measured arrival jitter,
+ * but at least JITTER_MIN_USEC and at most JITTER_MAX_USEC */
+#define JITTER_MIN_USEC (10 * PA_USEC_PER_MSEC)
+#define JITTER_MAX_USEC (150 * PA_USEC_PER_MSEC)
+#define JITTER_TARGET_FACTOR 3
+
+/* The buffer is played out a bit faster or slower to follow the clock
+ * of the sender, correcting a level error over JITTER_RATE_ADJUST_USEC
+ * and never by more than JITTER_RATE_MAX */
+#define JITTER_RATE_ADJUST_USEC (10 * PA_USEC_PER_SEC)
+#define JITTER_RATE_MAX 0.005
+
+/* How often the jitter buffer is played out of */
+#define JITTER_PLAYOUT_USEC (10 * PA_USEC_PER_MSEC)
+
 static const char* const valid_modargs[] = {
     "path",
     "autodetect_mtu",
@@ -78,6 +115,7 @@ enum {
     BLUETOOTH_MESSAGE_IO_THREAD_FAILED,
     BLUETOOTH_MESSAGE_STREAM_FD_HUP,
     BLUETOOTH_MESSAGE_SET_TRANSPORT_PLAYING,
+    BLUETOOTH_MESSAGE_UPDATE_LINK_STATS,
     BLUETOOTH_MESSAGE_MAX
 };
 
@@ -96,18 +134,6 @@ typedef struct bluetooth_msg {
 PA_DEFINE_PRIVATE_CLASS(bluetooth_msg, pa_msgobject);
 #define BLUETOOTH_MSG(o) (bluetooth_msg_cast(o))
 
-typedef struct sbc_info {
-    sbc_t sbc;                           /* Codec data */
-    bool sbc_initialized;                /* Keep track if the encoder is initialized */
-    size_t codesize, frame_length;       /* SBC Codesize, frame_length. We simply cache those values here */
-    uint16_t seq_num;                    /* Cumulative packet sequence */
-    uint8_t min_bitpool;
-    uint8_t max_bitpool;
-
-    void* buffer;                        /* Codec transfer buffer */
-    size_t buffer_size;                  /* Size of the buffer */
-} sbc_info_t;
-
 struct userdata {
     pa_module *module;
     pa_core *core;
@@ -148,7 +174,38 @@ struct userdata {
     pa_smoother *read_smoother;
     pa_memchunk write_memchunk;
     pa_sample_spec sample_spec;
-    struct sbc_info sbc_info;
+
+    const pa_a2dp_codec *a2dp_codec;
+    void *a2dp_codec_info;               /* Encoder or decoder state, depending on the profile */
+    void *buffer;                        /* Codec transfer buffer */
+    size_t buffer_size;                  /* Size of the buffer */
+    size_t packet_size;                  /* Encoded packet in the buffer that still has to be sent, 0 if none */
+
+    pa_usec_t encode_usec;               /* Smoothed time to encode one packet */
+    unsigned encode_packets;             /* Packets encoded since the last bitrate change */
+
+    uint32_t bitrate;                    /* Bitrate of the last encoded packet, in bits per second */
+    size_t link_queued;                  /* Bytes in the socket queue at link_queued_at */
+    pa_usec_t link_queued_at;            /* When the socket queue was last looked at */
+    bool link_deferred;                  /* The last render was put off because the socket queue was full */
+    pa_usec_t link_good_since;           /* Since when the socket queue stays short, 0 if it doesn't */
+    pa_usec_t link_stats_posted_at;      /* When the link stats were last sent to the main thread */
+
+    pa_memblockq *jitter_q;              /* Decoded audio not posted yet, A2DP source only */
+    double jitter_usec;                  /* Smoothed variation of the packet arrival times */
+    int64_t jitter_last_offset;          /* Arrival time minus audio time of the last packet */
+    uint64_t jitter_received;            /* Bytes decoded since the stream was set up */
+    pa_usec_t playout_at;                /* When audio was last posted, 0 while the buffer fills up */
+    double playout_due;                  /* Audio due at playout_at that wasn't posted, in usec */
+
+    uint8_t sco_codec;                   /* HFP_AUDIO_CODEC_* the SCO sink and source were set up for */
+    void *msbc_encoder_info;             /* mSBC codec states, NULL for CVSD */
+    void *msbc_decoder_info;
+    uint8_t *sco_read_buffer;            /* Received mSBC data that doesn't make up a whole frame yet */
+    size_t sco_read_buffer_size;
+    size_t sco_read_buffer_fill;
+    pa_usec_t sco_packet_usec;           /* Interval between two SCO packets */
+    uint64_t sco_packets;                /* SCO packet slots passed since the stream was started */
 };
 
 typedef enum pa_bluetooth_form_factor {
@@ -266,6 +323,9 @@ static int sco_process_render(struct userdata *u) {
 
     pa_assert(memchunk.length == u->write_block_size);
 
+    /* The packet slot passes whether the write succeeds or not */
+    u->write_index += (uint64_t) memchunk.length;
+
     for (;;) {
         const void *p;
 
@@ -285,7 +345,10 @@ static int sco_process_render(struct userdata *u) {
         if (errno == EINTR)
             /* Retry right away if we got interrupted */
             continue;
-        else if (errno == EAGAIN)
+
+        pa_memblock_unref(memchunk.memblock);
+
+        if (errno == EAGAIN)
             /* Hmm, apparently the socket was not writable, give up for now */
             return 0;
 
@@ -294,20 +357,204 @@ static int sco_process_render(struct userdata *u) {
     }
 
     pa_assert((size_t) l <= memchunk.length);
+    pa_memblock_unref(memchunk.memblock);
 
-    if ((size_t) l != memchunk.length) {
+    if ((size_t) l != u->write_block_size) {
         pa_log_error("Wrote memory block to socket only partially! %llu written, wanted to write %llu.",
                     (unsigned long long) l,
-                    (unsigned long long) memchunk.length);
+                    (unsigned long long) u->write_block_size);
         return -1;
     }
 
-    u->write_index += (uint64_t) memchunk.length;
-    pa_memblock_unref(memchunk.memblock);
+    return 1;
+}
+
+/* Run from IO thread */
+static int sco_process_render_msbc(struct userdata *u) {
+    ssize_t l;
+
+    pa_assert(u);
+    pa_assert(u->sink);
+    pa_assert(u->msbc_encoder_info);
+
+    /* Encode frames until they fill one SCO packet */
+    while (u->packet_size < u->write_link_mtu) {
+        pa_memchunk memchunk;
+        const uint8_t *p;
+        size_t processed, written;
+
+        pa_sink_render_full(u->sink, u->write_block_size, &memchunk);
+
+        pa_assert(memchunk.length == u->write_block_size);
+
+        p = (const uint8_t *) pa_memblock_acquire_chunk(&memchunk);
+        written = pa_hfp_codec_msbc.encode_buffer(u->msbc_encoder_info, 0, p, memchunk.length,
+                                                  (uint8_t *) u->buffer + u->packet_size, u->buffer_size - u->packet_size,
+                                                  &processed);
+        pa_memblock_release(memchunk.memblock);
+        pa_memblock_unref(memchunk.memblock);
+
+        if (written == 0) {
+            pa_log_error("Failed to encode mSBC frame");
+            return -1;
+        }
+
+        u->packet_size += written;
+        u->write_index += (uint64_t) u->write_block_size;
+    }
+
+    for (;;) {
+        l = pa_write(u->stream_fd, u->buffer, u->write_link_mtu, &u->stream_write_type);
+
+        pa_assert(l != 0);
+
+        if (l > 0)
+            break;
+
+        if (errno == EINTR)
+            /* Retry right away if we got interrupted */
+            continue;
+        else if (errno == EAGAIN)
+            /* The encoded data stays queued and goes out with the next packet */
+            return 0;
+
+        pa_log_error("Failed to write data to SCO socket: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if ((size_t) l != u->write_link_mtu) {
+        pa_log_error("Wrote SCO packet to socket only partially! %llu written, wanted to write %llu.",
+                    (unsigned long long) l,
+                    (unsigned long long) u->write_link_mtu);
+        return -1;
+    }
+
+    u->packet_size -= (size_t) l;
+    memmove(u->buffer, (uint8_t *) u->buffer + l, u->packet_size);
 
     return 1;
 }
 
+/* Run from IO thread. SCO packets leave the adapter at a fixed rate.
+ * Writing whenever the socket is writable sends them in bursts, which
+ * headsets answer with dropouts, so they are paced by a timer tied to the
+ * packet interval instead. Returns when the next packet is due in
+ * *next_write_at. */
+static int sco_process_paced_render(struct userdata *u, pa_usec_t *next_write_at) {
+    pa_usec_t now, due;
+
+    pa_assert(u);
+    pa_assert(u->sco_packet_usec > 0);
+
+    now = pa_rtclock_now();
+
+    if (u->sco_packets == 0)
+        u->started_at = now;
+
+    due = u->started_at + u->sco_packets * u->sco_packet_usec;
+
+    /* Never try to catch up for more than 100ms */
+    if (now > due + MAX_PLAYBACK_CATCH_UP_USEC) {
+        uint64_t skip_packets;
+        pa_usec_t skip_usec;
+        uint64_t skip_bytes;
+
+        skip_packets = (now - due) / u->sco_packet_usec;
+        skip_usec = skip_packets * u->sco_packet_usec;
+        skip_bytes = pa_usec_to_bytes(skip_usec, &u->sample_spec);
+
+        pa_log_warn("Skipping %llu us (= %llu bytes) in audio stream",
+                    (unsigned long long) skip_usec,
+                    (unsigned long long) skip_bytes);
+
+        if (skip_bytes > 0) {
+            pa_memchunk tmp;
+
+            pa_sink_render_full(u->sink, skip_bytes, &tmp);
+            pa_memblock_unref(tmp.memblock);
+            u->write_index += skip_bytes;
+        }
+
+        u->sco_packets += skip_packets;
+    }
+
+    while (u->started_at + u->sco_packets * u->sco_packet_usec <= now) {
+        int n_written;
+
+        if (u->sco_codec == HFP_AUDIO_CODEC_MSBC)
+            n_written = sco_process_render_msbc(u);
+        else
+            n_written = sco_process_render(u);
+
+        if (n_written < 0)
+            return -1;
+
+        u->sco_packets++;
+
+        if (n_written == 0) {
+            pa_log_debug("SCO socket not writable, missed a packet slot");
+            break;
+        }
+    }
+
+    *next_write_at = u->started_at + u->sco_packets * u->sco_packet_usec;
+
+    return 0;
+}
+
+/* Run from IO thread. Appends the l bytes received into *memchunk to the
+ * mSBC data left over from the last packet, and replaces *memchunk with
+ * the PCM of all frames that are complete now. Returns the number of PCM
+ * bytes. */
+static size_t sco_msbc_decode(struct userdata *u, pa_memchunk *memchunk, size_t l) {
+    pa_memchunk pcm;
+    const uint8_t *p;
+    uint8_t *d;
+    size_t to_decode, pcm_size;
+
+    pa_assert(u->msbc_decoder_info);
+    pa_assert(u->sco_read_buffer_fill + l <= u->sco_read_buffer_size);
+
+    p = pa_memblock_acquire(memchunk->memblock);
+    memcpy(u->sco_read_buffer + u->sco_read_buffer_fill, p, l);
+    pa_memblock_release(memchunk->memblock);
+    pa_memblock_unref(memchunk->memblock);
+
+    u->sco_read_buffer_fill += l;
+
+    pcm_size = (u->sco_read_buffer_fill / MSBC_PACKET_SIZE + 1) * u->read_block_size;
+    pcm.memblock = pa_memblock_new(u->core->mempool, pcm_size);
+    pcm.index = pcm.length = 0;
+
+    p = u->sco_read_buffer;
+    to_decode = u->sco_read_buffer_fill;
+
+    d = pa_memblock_acquire(pcm.memblock);
+
+    for (;;) {
+        size_t processed = 0;
+
+        pcm.length += pa_hfp_codec_msbc.decode_buffer(u->msbc_decoder_info, p, to_decode,
+                                                      d + pcm.length, pcm_size - pcm.length, &processed);
+
+        /* Nothing more to do until more data arrives */
+        if (processed == 0)
+            break;
+
+        p += processed;
+        to_decode -= processed;
+    }
+
+    pa_memblock_release(pcm.memblock);
+
+    memmove(u->sco_read_buffer, p, to_decode);
+    u->sco_read_buffer_fill = to_decode;
+
+    *memchunk = pcm;
+
+    return pcm.length;
+}
+
 /* Run from IO thread */
 static int sco_process_push(struct userdata *u) {
     ssize_t l;
@@ -323,7 +570,8 @@ static int sco_process_push(struct userdata *u) {
     pa_assert(u->source);
     pa_assert(u->read_smoother);
 
-    memchunk.memblock = pa_memblock_new(u->core->mempool, u->read_block_size);
+    memchunk.memblock = pa_memblock_new(u->core->mempool,
+                                        u->sco_codec == HFP_AUDIO_CODEC_MSBC ? u->read_link_mtu : u->read_block_size);
     memchunk.index = memchunk.length = 0;
 
     for (;;) {
@@ -371,7 +619,14 @@ static int sco_process_push(struct userdata *u) {
      * issues in our Bluetooth adapter. In these cases, in order to avoid
      * an assertion failure due to unaligned data, just discard the whole
      * packet */
-    if (!pa_frame_aligned(l, &u->sample_spec)) {
+    if (u->sco_codec == HFP_AUDIO_CODEC_MSBC) {
+        /* mSBC frames span several packets, so there may be nothing to
+         * post yet */
+        if ((l = (ssize_t) sco_msbc_decode(u, &memchunk, (size_t) l)) == 0) {
+            pa_memblock_unref(memchunk.memblock);
+            return 0;
+        }
+    } else if (!pa_frame_aligned(l, &u->sample_spec)) {
         pa_log_warn("SCO packet received of unaligned size: %zu", l);
         pa_memblock_unref(memchunk.memblock);
         return -1;
@@ -409,29 +664,43 @@ static void a2dp_prepare_buffer(struct userdata *u) {
 
     pa_assert(u);
 
-    if (u->sbc_info.buffer_size >= min_buffer_size)
+    if (u->buffer_size >= min_buffer_size)
         return;
 
-    u->sbc_info.buffer_size = 2 * min_buffer_size;
-    pa_xfree(u->sbc_info.buffer);
-    u->sbc_info.buffer = pa_xmalloc(u->sbc_info.buffer_size);
+    u->buffer_size = 2 * min_buffer_size;
+    pa_xfree(u->buffer);
+    u->buffer = pa_xmalloc(u->buffer_size);
 }
 
-/* Run from IO thread */
-static int a2dp_process_render(struct userdata *u) {
-    struct sbc_info *sbc_info;
-    struct rtp_header *header;
-    struct rtp_payload *payload;
-    size_t nbytes;
-    void *d;
-    const void *p;
-    size_t to_write, to_encode;
-    unsigned frame_count;
-    int ret = 0;
+/* Run from IO thread. The transfer buffer queues encoded frames until
+ * they are sent, the read buffer collects the parts of a frame */
+static void sco_msbc_prepare_buffers(struct userdata *u) {
+    size_t write_size = u->write_link_mtu + MSBC_PACKET_SIZE;
+    size_t read_size = u->read_link_mtu + MSBC_PACKET_SIZE;
 
     pa_assert(u);
-    pa_assert(u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK);
-    pa_assert(u->sink);
+
+    if (u->buffer_size < write_size) {
+        u->buffer_size = write_size;
+        pa_xfree(u->buffer);
+        u->buffer = pa_xmalloc(u->buffer_size);
+    }
+
+    if (u->sco_read_buffer_size < read_size) {
+        u->sco_read_buffer_size = read_size;
+        pa_xfree(u->sco_read_buffer);
+        u->sco_read_buffer = pa_xmalloc(u->sco_read_buffer_size);
+    }
+
+    u->packet_size = 0;
+    u->sco_read_buffer_fill = 0;
+}
+
+/* Run from IO thread */
+static int a2dp_encode(struct userdata *u) {
+    size_t processed;
+    const uint8_t *p;
+    pa_usec_t start, encode_usec;
 
     /* First, render some data */
     if (!u->write_memchunk.memblock)
@@ -441,73 +710,94 @@ static int a2dp_process_render(struct userdata *u) {
 
     a2dp_prepare_buffer(u);
 
-    sbc_info = &u->sbc_info;
-    header = sbc_info->buffer;
-    payload = (struct rtp_payload*) ((uint8_t*) sbc_info->buffer + sizeof(*header));
-
-    frame_count = 0;
-
     /* Try to create a packet of the full MTU */
 
+    start = pa_rtclock_now();
+
     p = (const uint8_t *) pa_memblock_acquire_chunk(&u->write_memchunk);
-    to_encode = u->write_memchunk.length;
+    u->packet_size = u->a2dp_codec->encode_buffer(u->a2dp_codec_info, u->write_index / pa_frame_size(&u->sample_spec),
+                                                  p, u->write_memchunk.length,
+                                                  u->buffer, u->buffer_size,
+                                                  &processed);
+    pa_memblock_release(u->write_memchunk.memblock);
 
-    d = (uint8_t*) sbc_info->buffer + sizeof(*header) + sizeof(*payload);
-    to_write = sbc_info->buffer_size - sizeof(*header) - sizeof(*payload);
+    if (PA_UNLIKELY(u->packet_size <= 0))
+        return -1;
 
-    while (PA_LIKELY(to_encode > 0 && to_write > 0)) {
-        ssize_t written;
-        ssize_t encoded;
+    pa_assert(processed == u->write_memchunk.length);
 
-        encoded = sbc_encode(&sbc_info->sbc,
-                             p, to_encode,
-                             d, to_write,
-                             &written);
+    encode_usec = pa_rtclock_now() - start;
 
-        if (PA_UNLIKELY(encoded <= 0)) {
-            pa_log_error("SBC encoding error (%li)", (long) encoded);
-            pa_memblock_release(u->write_memchunk.memblock);
-            return -1;
-        }
+    if (pa_render_profile_get_enabled())
+        pa_render_profile_add(&u->sink->thread_info.render_profile[PA_RENDER_STAGE_SINK_ENCODE], encode_usec);
 
-        pa_assert_fp((size_t) encoded <= to_encode);
-        pa_assert_fp((size_t) encoded == sbc_info->codesize);
+    u->bitrate = (uint32_t) (u->packet_size * 8 * PA_USEC_PER_SEC
+                             / pa_bytes_to_usec(u->write_memchunk.length, &u->sample_spec));
 
-        pa_assert_fp((size_t) written <= to_write);
-        pa_assert_fp((size_t) written == sbc_info->frame_length);
+    if (u->encode_packets++ == 0)
+        u->encode_usec = encode_usec;
+    else
+        u->encode_usec = (7 * u->encode_usec + encode_usec) / 8;
 
-        p = (const uint8_t*) p + encoded;
-        to_encode -= encoded;
+    return 0;
+}
 
-        d = (uint8_t*) d + written;
-        to_write -= written;
+/* Run from IO thread. Refreshes link_queued, returns false if the socket
+ * can't tell */
+static bool a2dp_update_link_queue(struct userdata *u) {
+    int queued;
 
-        frame_count++;
-    }
+    if (u->stream_fd < 0 || ioctl(u->stream_fd, SIOCOUTQ, &queued) < 0 || queued < 0)
+        return false;
 
-    pa_memblock_release(u->write_memchunk.memblock);
+    u->link_queued = (size_t) queued;
+    u->link_queued_at = pa_rtclock_now();
 
-    pa_assert(to_encode == 0);
+    return true;
+}
 
-    PA_ONCE_BEGIN {
-        pa_log_debug("Using SBC encoder implementation: %s", pa_strnull(sbc_get_implementation_info(&sbc_info->sbc)));
-    } PA_ONCE_END;
+/* Run from IO thread. The audio still waiting in the socket queue,
+ * estimated from the last look at it and the bitrate */
+static pa_usec_t a2dp_link_queue_usec(struct userdata *u, pa_usec_t now) {
+    pa_usec_t queued_usec, drained_usec;
 
-    /* write it to the fifo */
-    memset(sbc_info->buffer, 0, sizeof(*header) + sizeof(*payload));
-    header->v = 2;
-    header->pt = 1;
-    header->sequence_number = htons(sbc_info->seq_num++);
-    header->timestamp = htonl(u->write_index / pa_frame_size(&u->sample_spec));
-    header->ssrc = htonl(1);
-    payload->frame_count = frame_count;
+    if (u->link_queued <= 0 || u->bitrate <= 0)
+        return 0;
+
+    queued_usec = (pa_usec_t) u->link_queued * 8 * PA_USEC_PER_SEC / u->bitrate;
+    drained_usec = now > u->link_queued_at ? now - u->link_queued_at : 0;
+
+    return queued_usec > drained_usec ? queued_usec - drained_usec : 0;
+}
+
+/* Run from IO thread */
+static int a2dp_process_render(struct userdata *u) {
+    int ret = 0;
+
+    pa_assert(u);
+    pa_assert(u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK);
+    pa_assert(u->sink);
 
-    nbytes = (uint8_t*) d - (uint8_t*) sbc_info->buffer;
+    /* While the socket holds enough to keep the link busy, the next
+     * block stays in the sink, where it can still be rewound, instead of
+     * waiting in a second queue in front of the socket */
+    u->link_deferred = u->packet_size <= 0 && a2dp_update_link_queue(u) &&
+        u->link_queued >= LINK_QUEUE_TARGET_PACKETS * u->write_link_mtu;
 
+    if (u->link_deferred)
+        return 0;
+
+    /* A packet that didn't fit into the socket last time is sent as is,
+     * instead of encoding the same data again */
+    if (u->packet_size <= 0)
+        if (a2dp_encode(u) < 0)
+            return -1;
+
+    /* write it to the fifo */
     for (;;) {
         ssize_t l;
 
-        l = pa_write(u->stream_fd, sbc_info->buffer, nbytes, &u->stream_write_type);
+        l = pa_write(u->stream_fd, u->buffer, u->packet_size, &u->stream_write_type);
 
         pa_assert(l != 0);
 
@@ -526,12 +816,12 @@ static int a2dp_process_render(struct userdata *u) {
             break;
         }
 
-        pa_assert((size_t) l <= nbytes);
+        pa_assert((size_t) l <= u->packet_size);
 
-        if ((size_t) l != nbytes) {
+        if ((size_t) l != u->packet_size) {
             pa_log_warn("Wrote memory block to socket only partially! %llu written, wanted to write %llu.",
                         (unsigned long long) l,
-                        (unsigned long long) nbytes);
+                        (unsigned long long) u->packet_size);
             ret = -1;
             break;
         }
@@ -539,6 +829,7 @@ static int a2dp_process_render(struct userdata *u) {
         u->write_index += (uint64_t) u->write_memchunk.length;
         pa_memblock_unref(u->write_memchunk.memblock);
         pa_memchunk_reset(&u->write_memchunk);
+        u->packet_size = 0;
 
         ret = 1;
 
@@ -548,38 +839,117 @@ static int a2dp_process_render(struct userdata *u) {
     return ret;
 }
 
+/* Run from IO thread */
+static pa_usec_t a2dp_jitter_target(struct userdata *u) {
+    pa_usec_t target;
+
+    target = pa_bytes_to_usec(u->read_block_size, &u->sample_spec) + (pa_usec_t) (JITTER_TARGET_FACTOR * u->jitter_usec);
+
+    return PA_CLAMP(target, JITTER_MIN_USEC, JITTER_MAX_USEC);
+}
+
+/* Run from IO thread */
+static void a2dp_jitter_push(struct userdata *u, const pa_memchunk *chunk, pa_usec_t tstamp) {
+    int64_t offset;
+
+    pa_assert(u);
+    pa_assert(chunk);
+
+    /* Like the interarrival jitter of RFC 3550 */
+    offset = (int64_t) tstamp - (int64_t) pa_bytes_to_usec(u->jitter_received, &u->sample_spec);
+    if (u->jitter_received > 0)
+        u->jitter_usec += (fabs((double) (offset - u->jitter_last_offset)) - u->jitter_usec) / 16;
+
+    u->jitter_last_offset = offset;
+    u->jitter_received += chunk->length;
+
+    if (pa_memblockq_push_align(u->jitter_q, chunk) < 0)
+        pa_log_debug("A2DP jitter buffer overflow, dropping %lu bytes", (unsigned long) chunk->length);
+}
+
+/* Run from IO thread, returns when to play out again, 0 to wait for the
+ * next packet */
+static pa_usec_t a2dp_jitter_playout(struct userdata *u, pa_usec_t now) {
+    pa_usec_t level, target;
+    pa_memchunk chunk;
+    double rate;
+    size_t n;
+
+    pa_assert(u);
+    pa_assert(u->jitter_q);
+    pa_assert(u->read_smoother);
+
+    target = a2dp_jitter_target(u);
+    level = pa_bytes_to_usec(pa_memblockq_get_length(u->jitter_q), &u->sample_spec);
+
+    if (u->playout_at <= 0) {
+        /* Fill up before posting anything */
+        if (level < target)
+            return 0;
+
+        u->playout_at = now;
+        u->playout_due = 0;
+        pa_smoother_resume(u->read_smoother, now, true);
+    }
+
+    rate = 1.0 + ((double) level - (double) target) / (double) JITTER_RATE_ADJUST_USEC;
+    rate = PA_CLAMP(rate, 1.0 - JITTER_RATE_MAX, 1.0 + JITTER_RATE_MAX);
+
+    u->playout_due += (double) (now - u->playout_at) * rate;
+    u->playout_at = now;
+
+    /* More than the buffer may hold is posted right away */
+    if (level > JITTER_MAX_USEC)
+        u->playout_due += (double) (level - target);
+
+    n = u->playout_due > 0 ? pa_usec_to_bytes((pa_usec_t) u->playout_due, &u->sample_spec) : 0;
+
+    while (n > 0 && pa_memblockq_peek(u->jitter_q, &chunk) >= 0) {
+        pa_assert(chunk.memblock);
+
+        chunk.length = PA_MIN(chunk.length, n);
+        pa_source_post(u->source, &chunk);
+        pa_memblock_unref(chunk.memblock);
+        pa_memblockq_drop(u->jitter_q, chunk.length);
+
+        n -= chunk.length;
+        u->read_index += (uint64_t) chunk.length;
+        u->playout_due -= (double) chunk.length * PA_USEC_PER_SEC / (double) pa_bytes_per_second(&u->sample_spec);
+    }
+
+    pa_smoother_put(u->read_smoother, now, pa_bytes_to_usec(u->read_index, &u->sample_spec));
+
+    if (n > 0) {
+        pa_log_debug("A2DP jitter buffer ran dry, refilling");
+        pa_smoother_pause(u->read_smoother, now);
+        u->playout_at = 0;
+        return 0;
+    }
+
+    return now + JITTER_PLAYOUT_USEC;
+}
+
 /* Run from IO thread */
 static int a2dp_process_push(struct userdata *u) {
     int ret = 0;
-    pa_memchunk memchunk;
 
     pa_assert(u);
     pa_assert(u->profile == PA_BLUETOOTH_PROFILE_A2DP_SOURCE);
     pa_assert(u->source);
-    pa_assert(u->read_smoother);
-
-    memchunk.memblock = pa_memblock_new(u->core->mempool, u->read_block_size);
-    memchunk.index = memchunk.length = 0;
+    pa_assert(u->jitter_q);
 
+    /* Take all packets that are queued up, the jitter buffer evens out
+     * the timing */
     for (;;) {
-        bool found_tstamp = false;
+        pa_memchunk memchunk;
         pa_usec_t tstamp;
-        struct sbc_info *sbc_info;
-        struct rtp_header *header;
-        struct rtp_payload *payload;
-        const void *p;
-        void *d;
+        uint8_t *d;
         ssize_t l;
-        size_t to_write, to_decode;
-        size_t total_written = 0;
+        size_t processed;
 
         a2dp_prepare_buffer(u);
 
-        sbc_info = &u->sbc_info;
-        header = sbc_info->buffer;
-        payload = (struct rtp_payload*) ((uint8_t*) sbc_info->buffer + sizeof(*header));
-
-        l = pa_read(u->stream_fd, sbc_info->buffer, sbc_info->buffer_size, &u->stream_write_type);
+        l = pa_read(u->stream_fd, u->buffer, u->buffer_size, &u->stream_write_type);
 
         if (l <= 0) {
 
@@ -588,7 +958,7 @@ static int a2dp_process_push(struct userdata *u) {
                 continue;
 
             else if (l < 0 && errno == EAGAIN)
-                /* Hmm, apparently the socket was not readable, give up for now. */
+                /* Nothing more queued, done for now. */
                 break;
 
             pa_log_error("Failed to read data from socket: %s", l < 0 ? pa_cstrerror(errno) : "EOF");
@@ -596,129 +966,142 @@ static int a2dp_process_push(struct userdata *u) {
             break;
         }
 
-        pa_assert((size_t) l <= sbc_info->buffer_size);
+        pa_assert((size_t) l <= u->buffer_size);
 
         /* TODO: get timestamp from rtp */
-        if (!found_tstamp) {
-            /* pa_log_warn("Couldn't find SO_TIMESTAMP data in auxiliary recvmsg() data!"); */
-            tstamp = pa_rtclock_now();
-        }
+        tstamp = pa_rtclock_now();
 
-        p = (uint8_t*) sbc_info->buffer + sizeof(*header) + sizeof(*payload);
-        to_decode = l - sizeof(*header) - sizeof(*payload);
+        memchunk.memblock = pa_memblock_new(u->core->mempool, u->read_block_size);
+        memchunk.index = 0;
 
         d = pa_memblock_acquire(memchunk.memblock);
-        to_write = memchunk.length = pa_memblock_get_length(memchunk.memblock);
-
-        while (PA_LIKELY(to_decode > 0)) {
-            size_t written;
-            ssize_t decoded;
-
-            decoded = sbc_decode(&sbc_info->sbc,
-                                 p, to_decode,
-                                 d, to_write,
-                                 &written);
-
-            if (PA_UNLIKELY(decoded <= 0)) {
-                pa_log_error("SBC decoding error (%li)", (long) decoded);
-                pa_memblock_release(memchunk.memblock);
-                pa_memblock_unref(memchunk.memblock);
-                return 0;
-            }
-
-            total_written += written;
+        memchunk.length = u->a2dp_codec->decode_buffer(u->a2dp_codec_info, u->buffer, l,
+                                                       d, pa_memblock_get_length(memchunk.memblock),
+                                                       &processed);
+        pa_memblock_release(memchunk.memblock);
 
-            /* Reset frame length, it can be changed due to bitpool change */
-            sbc_info->frame_length = sbc_get_frame_length(&sbc_info->sbc);
+        if (processed > 0 && memchunk.length > 0)
+            a2dp_jitter_push(u, &memchunk, tstamp);
 
-            pa_assert_fp((size_t) decoded <= to_decode);
-            pa_assert_fp((size_t) decoded == sbc_info->frame_length);
+        pa_memblock_unref(memchunk.memblock);
 
-            pa_assert_fp((size_t) written == sbc_info->codesize);
+        ret += (int) l;
+    }
 
-            p = (const uint8_t*) p + decoded;
-            to_decode -= decoded;
+    return ret;
+}
 
-            d = (uint8_t*) d + written;
-            to_write -= written;
-        }
+/* Run from I/O thread */
+static void a2dp_update_write_block_size(struct userdata *u, size_t write_block_size) {
+    pa_assert(u);
 
-        u->read_index += (uint64_t) total_written;
-        pa_smoother_put(u->read_smoother, tstamp, pa_bytes_to_usec(u->read_index, &u->sample_spec));
-        pa_smoother_resume(u->read_smoother, tstamp, true);
+    u->write_block_size = write_block_size;
+    u->encode_packets = 0;
 
-        memchunk.length -= to_write;
+    pa_sink_set_max_request_within_thread(u->sink, u->write_block_size);
+    pa_sink_set_fixed_latency_within_thread(u->sink,
+            FIXED_LATENCY_PLAYBACK_A2DP + pa_bytes_to_usec(u->write_block_size, &u->sample_spec));
+}
 
-        pa_memblock_release(memchunk.memblock);
+/* Run from I/O thread */
+static void a2dp_reduce_bitrate(struct userdata *u) {
+    size_t write_block_size;
 
-        pa_source_post(u->source, &memchunk);
+    pa_assert(u);
 
-        ret = l;
-        break;
-    }
+    if (!u->a2dp_codec->reduce_encoder_bitrate)
+        return;
 
-    pa_memblock_unref(memchunk.memblock);
+    if ((write_block_size = u->a2dp_codec->reduce_encoder_bitrate(u->a2dp_codec_info, u->write_link_mtu)) <= 0)
+        return;
 
-    return ret;
+    a2dp_update_write_block_size(u, write_block_size);
 }
 
 /* Run from I/O thread */
-static void a2dp_set_bitpool(struct userdata *u, uint8_t bitpool) {
-    struct sbc_info *sbc_info;
+static bool a2dp_increase_bitrate(struct userdata *u) {
+    size_t write_block_size;
 
     pa_assert(u);
 
-    sbc_info = &u->sbc_info;
+    if (!u->a2dp_codec->increase_encoder_bitrate)
+        return false;
 
-    if (sbc_info->sbc.bitpool == bitpool)
-        return;
+    if ((write_block_size = u->a2dp_codec->increase_encoder_bitrate(u->a2dp_codec_info, u->write_link_mtu)) <= 0)
+        return false;
 
-    if (bitpool > sbc_info->max_bitpool)
-        bitpool = sbc_info->max_bitpool;
-    else if (bitpool < sbc_info->min_bitpool)
-        bitpool = sbc_info->min_bitpool;
+    a2dp_update_write_block_size(u, write_block_size);
+    return true;
+}
 
-    sbc_info->sbc.bitpool = bitpool;
+/* Run from I/O thread */
+static pa_usec_t a2dp_encode_budget(struct userdata *u) {
+    return pa_bytes_to_usec(u->write_block_size, &u->sample_spec) * ENCODE_LOAD_MAX_PERCENT / 100;
+}
 
-    sbc_info->codesize = sbc_get_codesize(&sbc_info->sbc);
-    sbc_info->frame_length = sbc_get_frame_length(&sbc_info->sbc);
+/* Run from I/O thread */
+static void a2dp_check_encode_load(struct userdata *u) {
+    pa_usec_t budget;
 
-    pa_log_debug("Bitpool has changed to %u", sbc_info->sbc.bitpool);
+    pa_assert(u);
 
-    u->read_block_size =
-        (u->read_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / sbc_info->frame_length * sbc_info->codesize;
+    if (u->encode_packets < ENCODE_LOAD_MIN_PACKETS)
+        return;
 
-    u->write_block_size =
-        (u->write_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / sbc_info->frame_length * sbc_info->codesize;
+    budget = a2dp_encode_budget(u);
 
-    pa_sink_set_max_request_within_thread(u->sink, u->write_block_size);
-    pa_sink_set_fixed_latency_within_thread(u->sink,
-            FIXED_LATENCY_PLAYBACK_A2DP + pa_bytes_to_usec(u->write_block_size, &u->sample_spec));
+    if (u->encode_usec <= budget)
+        return;
+
+    pa_log_info("Encoding a packet takes %llu us on average, more than the budget of %llu us, reducing bitrate",
+                (unsigned long long) u->encode_usec,
+                (unsigned long long) budget);
+
+    a2dp_reduce_bitrate(u);
 }
 
 /* Run from I/O thread */
-static void a2dp_reduce_bitpool(struct userdata *u) {
-    struct sbc_info *sbc_info;
-    uint8_t bitpool;
+static void a2dp_check_link_queue(struct userdata *u) {
+    pa_usec_t now;
 
     pa_assert(u);
 
-    sbc_info = &u->sbc_info;
-
-    /* Check if bitpool is already at its limit */
-    if (sbc_info->sbc.bitpool <= BITPOOL_DEC_LIMIT)
+    if (!a2dp_update_link_queue(u))
         return;
 
-    bitpool = sbc_info->sbc.bitpool - BITPOOL_DEC_STEP;
+    now = u->link_queued_at;
 
-    if (bitpool < BITPOOL_DEC_LIMIT)
-        bitpool = BITPOOL_DEC_LIMIT;
+    if (u->link_queued > LINK_QUEUE_HIGH_PACKETS * u->write_link_mtu) {
+        u->link_good_since = 0;
 
-    a2dp_set_bitpool(u, bitpool);
+        /* Give the queue some packets to drain after the last change */
+        if (u->encode_packets >= ENCODE_LOAD_MIN_PACKETS) {
+            pa_log_debug("%llu bytes queued on the socket, reducing bitrate", (unsigned long long) u->link_queued);
+            a2dp_reduce_bitrate(u);
+        }
+
+    } else if (u->link_queued > u->write_link_mtu)
+        u->link_good_since = 0;
+
+    else if (u->link_good_since == 0)
+        u->link_good_since = now;
+
+    else if (now - u->link_good_since >= LINK_QUEUE_RAISE_USEC) {
+        u->link_good_since = now;
+
+        /* Don't undo a reduction the encoder load asked for */
+        if (u->encode_packets >= ENCODE_LOAD_MIN_PACKETS && u->encode_usec * 2 <= a2dp_encode_budget(u))
+            a2dp_increase_bitrate(u);
+    }
+
+    if (now - u->link_stats_posted_at >= LINK_STATS_INTERVAL_USEC) {
+        u->link_stats_posted_at = now;
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u->msg), BLUETOOTH_MESSAGE_UPDATE_LINK_STATS,
+                          PA_UINT_TO_PTR(u->link_queued), (int64_t) u->bitrate, NULL, NULL);
+    }
 }
 
+/* Run from I/O thread */
 static void teardown_stream(struct userdata *u) {
     if (u->rtpoll_item) {
         pa_rtpoll_item_free(u->rtpoll_item);
@@ -735,11 +1118,22 @@ static void teardown_stream(struct userdata *u) {
         u->read_smoother = NULL;
     }
 
+    if (u->jitter_q) {
+        pa_memblockq_free(u->jitter_q);
+        u->jitter_q = NULL;
+    }
+
     if (u->write_memchunk.memblock) {
         pa_memblock_unref(u->write_memchunk.memblock);
         pa_memchunk_reset(&u->write_memchunk);
     }
 
+    u->packet_size = 0;
+    u->link_good_since = 0;
+    u->link_queued = 0;
+    u->link_deferred = false;
+    u->sco_read_buffer_fill = 0;
+
     pa_log_debug("Audio stream torn down");
     u->stream_setup_done = false;
 }
@@ -794,7 +1188,14 @@ static void transport_release(struct userdata *u) {
 
 /* Run from I/O thread */
 static void transport_config_mtu(struct userdata *u) {
-    if (u->profile == PA_BLUETOOTH_PROFILE_HEADSET_HEAD_UNIT || u->profile == PA_BLUETOOTH_PROFILE_HEADSET_AUDIO_GATEWAY) {
+    if ((u->profile == PA_BLUETOOTH_PROFILE_HEADSET_HEAD_UNIT || u->profile == PA_BLUETOOTH_PROFILE_HEADSET_AUDIO_GATEWAY) &&
+        u->sco_codec == HFP_AUDIO_CODEC_MSBC) {
+        /* The PCM side works on whole frames, the link carries them in
+         * packets of the MTU size */
+        u->read_block_size = pa_hfp_codec_msbc.get_read_block_size(u->msbc_decoder_info, u->read_link_mtu);
+        u->write_block_size = pa_hfp_codec_msbc.get_write_block_size(u->msbc_encoder_info, u->write_link_mtu);
+        u->sco_packet_usec = MSBC_PACKET_USEC * u->write_link_mtu / MSBC_PACKET_SIZE;
+    } else if (u->profile == PA_BLUETOOTH_PROFILE_HEADSET_HEAD_UNIT || u->profile == PA_BLUETOOTH_PROFILE_HEADSET_AUDIO_GATEWAY) {
         u->read_block_size = u->read_link_mtu;
         u->write_block_size = u->write_link_mtu;
 
@@ -807,14 +1208,12 @@ static void transport_config_mtu(struct userdata *u) {
             pa_log_debug("Got invalid write MTU: %lu, rounding down", u->write_block_size);
             u->write_block_size = pa_frame_align(u->write_block_size, &u->sink->sample_spec);
         }
-    } else {
-        u->read_block_size =
-            (u->read_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-            / u->sbc_info.frame_length * u->sbc_info.codesize;
 
-        u->write_block_size =
-            (u->write_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-            / u->sbc_info.frame_length * u->sbc_info.codesize;
+        u->sco_packet_usec = pa_bytes_to_usec(u->write_block_size, &u->sample_spec);
+    } else {
+        u->read_block_size = u->a2dp_codec->get_read_block_size(u->a2dp_codec_info, u->read_link_mtu);
+        u->write_block_size = u->a2dp_codec->get_write_block_size(u->a2dp_codec_info, u->write_link_mtu);
+        u->encode_packets = 0;
     }
 
     if (u->sink) {
@@ -843,8 +1242,17 @@ static void setup_stream(struct userdata *u) {
 
     pa_log_info("Transport %s resuming", u->transport->path);
 
+    if (u->a2dp_codec)
+        u->a2dp_codec->reset(u->a2dp_codec_info);
+
     transport_config_mtu(u);
 
+    if (u->sco_codec == HFP_AUDIO_CODEC_MSBC) {
+        pa_hfp_codec_msbc.reset(u->msbc_encoder_info);
+        pa_hfp_codec_msbc.reset(u->msbc_decoder_info);
+        sco_msbc_prepare_buffers(u);
+    }
+
     pa_make_fd_nonblock(u->stream_fd);
     pa_make_socket_low_delay(u->stream_fd);
 
@@ -854,9 +1262,6 @@ static void setup_stream(struct userdata *u) {
 
     pa_log_debug("Stream properly set up, we're ready to roll!");
 
-    if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK)
-        a2dp_set_bitpool(u, u->sbc_info.max_bitpool);
-
     u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
     pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
     pollfd->fd = u->stream_fd;
@@ -864,10 +1269,21 @@ static void setup_stream(struct userdata *u) {
 
     u->read_index = u->write_index = 0;
     u->started_at = 0;
+    u->sco_packets = 0;
     u->stream_setup_done = true;
 
     if (u->source)
         u->read_smoother = pa_smoother_new(PA_USEC_PER_SEC, 2*PA_USEC_PER_SEC, true, true, 10, pa_rtclock_now(), true);
+
+    if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SOURCE) {
+        u->jitter_q = pa_memblockq_new("bluetooth a2dp jitter buffer", 0, pa_usec_to_bytes(2 * JITTER_MAX_USEC, &u->sample_spec),
+                                       0, &u->sample_spec, 0, 1, 0, NULL);
+        u->jitter_usec = 0;
+        u->jitter_last_offset = 0;
+        u->jitter_received = 0;
+        u->playout_at = 0;
+        u->playout_due = 0;
+    }
 }
 
 /* Called from I/O thread, returns true if the transport was acquired or
@@ -942,6 +1358,10 @@ static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t off
                 wi = pa_smoother_get(u->read_smoother, pa_rtclock_now());
                 ri = pa_bytes_to_usec(u->read_index, &u->sample_spec);
 
+                /* What waits in the jitter buffer was recorded as well */
+                if (u->jitter_q)
+                    wi += pa_bytes_to_usec(pa_memblockq_get_length(u->jitter_q), &u->sample_spec);
+
                 *((int64_t*) data) = u->source->thread_info.fixed_latency + wi - ri;
             } else
                 *((int64_t*) data) = 0;
@@ -1111,8 +1531,21 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
                 ri = pa_smoother_get(u->read_smoother, pa_rtclock_now());
                 wi = pa_bytes_to_usec(u->write_index + u->write_block_size, &u->sample_spec);
             } else {
-                ri = pa_rtclock_now() - u->started_at;
+                pa_usec_t now = pa_rtclock_now();
+
+                ri = now - u->started_at;
                 wi = pa_bytes_to_usec(u->write_index, &u->sample_spec);
+
+                if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK) {
+                    /* A packet that didn't fit into the socket yet has
+                     * left the sink already */
+                    if (u->packet_size > 0)
+                        wi += pa_bytes_to_usec(u->write_memchunk.length, &u->sample_spec);
+
+                    /* On a slow link the socket queue holds more than the
+                     * time line accounts for */
+                    ri = PA_MIN(ri, wi - (int64_t) a2dp_link_queue_usec(u, now));
+                }
             }
 
             *((int64_t*) data) = u->sink->thread_info.fixed_latency + wi - ri;
@@ -1228,118 +1661,62 @@ static int add_sink(struct userdata *u) {
 }
 
 /* Run from main thread */
-static void transport_config(struct userdata *u) {
-    if (u->profile == PA_BLUETOOTH_PROFILE_HEADSET_HEAD_UNIT || u->profile == PA_BLUETOOTH_PROFILE_HEADSET_AUDIO_GATEWAY) {
-        u->sample_spec.format = PA_SAMPLE_S16LE;
-        u->sample_spec.channels = 1;
-        u->sample_spec.rate = 8000;
-    } else {
-        sbc_info_t *sbc_info = &u->sbc_info;
-        a2dp_sbc_t *config;
+static void msbc_free(struct userdata *u) {
+    if (u->msbc_encoder_info) {
+        pa_hfp_codec_msbc.deinit(u->msbc_encoder_info);
+        u->msbc_encoder_info = NULL;
+    }
 
-        pa_assert(u->transport);
+    if (u->msbc_decoder_info) {
+        pa_hfp_codec_msbc.deinit(u->msbc_decoder_info);
+        u->msbc_decoder_info = NULL;
+    }
+}
 
-        u->sample_spec.format = PA_SAMPLE_S16LE;
-        config = (a2dp_sbc_t *) u->transport->config;
+/* Run from main thread */
+static int transport_config(struct userdata *u) {
+    if (u->profile == PA_BLUETOOTH_PROFILE_HEADSET_HEAD_UNIT || u->profile == PA_BLUETOOTH_PROFILE_HEADSET_AUDIO_GATEWAY) {
+        pa_assert(u->transport);
 
-        if (sbc_info->sbc_initialized)
-            sbc_reinit(&sbc_info->sbc, 0);
-        else
-            sbc_init(&sbc_info->sbc, 0);
-        sbc_info->sbc_initialized = true;
+        msbc_free(u);
 
-        switch (config->frequency) {
-            case SBC_SAMPLING_FREQ_16000:
-                sbc_info->sbc.frequency = SBC_FREQ_16000;
-                u->sample_spec.rate = 16000U;
-                break;
-            case SBC_SAMPLING_FREQ_32000:
-                sbc_info->sbc.frequency = SBC_FREQ_32000;
-                u->sample_spec.rate = 32000U;
-                break;
-            case SBC_SAMPLING_FREQ_44100:
-                sbc_info->sbc.frequency = SBC_FREQ_44100;
-                u->sample_spec.rate = 44100U;
-                break;
-            case SBC_SAMPLING_FREQ_48000:
-                sbc_info->sbc.frequency = SBC_FREQ_48000;
-                u->sample_spec.rate = 48000U;
-                break;
-            default:
-                pa_assert_not_reached();
-        }
+        u->sco_codec = u->transport->codec == HFP_AUDIO_CODEC_MSBC ? HFP_AUDIO_CODEC_MSBC : HFP_AUDIO_CODEC_CVSD;
 
-        switch (config->channel_mode) {
-            case SBC_CHANNEL_MODE_MONO:
-                sbc_info->sbc.mode = SBC_MODE_MONO;
-                u->sample_spec.channels = 1;
-                break;
-            case SBC_CHANNEL_MODE_DUAL_CHANNEL:
-                sbc_info->sbc.mode = SBC_MODE_DUAL_CHANNEL;
-                u->sample_spec.channels = 2;
-                break;
-            case SBC_CHANNEL_MODE_STEREO:
-                sbc_info->sbc.mode = SBC_MODE_STEREO;
-                u->sample_spec.channels = 2;
-                break;
-            case SBC_CHANNEL_MODE_JOINT_STEREO:
-                sbc_info->sbc.mode = SBC_MODE_JOINT_STEREO;
-                u->sample_spec.channels = 2;
-                break;
-            default:
-                pa_assert_not_reached();
-        }
+        if (u->sco_codec == HFP_AUDIO_CODEC_MSBC) {
+            if (!(u->msbc_encoder_info = pa_hfp_codec_msbc.init(true, NULL, 0, &u->sample_spec)) ||
+                !(u->msbc_decoder_info = pa_hfp_codec_msbc.init(false, NULL, 0, &u->sample_spec))) {
+                pa_log_error("Failed to initialize %s codec", pa_hfp_codec_msbc.description);
+                msbc_free(u);
+                return -1;
+            }
 
-        switch (config->allocation_method) {
-            case SBC_ALLOCATION_SNR:
-                sbc_info->sbc.allocation = SBC_AM_SNR;
-                break;
-            case SBC_ALLOCATION_LOUDNESS:
-                sbc_info->sbc.allocation = SBC_AM_LOUDNESS;
-                break;
-            default:
-                pa_assert_not_reached();
+            pa_log_info("Using %s codec for wideband speech", pa_hfp_codec_msbc.description);
+        } else {
+            u->sample_spec.format = PA_SAMPLE_S16LE;
+            u->sample_spec.channels = 1;
+            u->sample_spec.rate = 8000;
         }
+    } else {
+        bool is_a2dp_sink = u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK;
 
-        switch (config->subbands) {
-            case SBC_SUBBANDS_4:
-                sbc_info->sbc.subbands = SBC_SB_4;
-                break;
-            case SBC_SUBBANDS_8:
-                sbc_info->sbc.subbands = SBC_SB_8;
-                break;
-            default:
-                pa_assert_not_reached();
-        }
+        pa_assert(u->transport);
+        pa_assert(u->transport->a2dp_codec);
 
-        switch (config->block_length) {
-            case SBC_BLOCK_LENGTH_4:
-                sbc_info->sbc.blocks = SBC_BLK_4;
-                break;
-            case SBC_BLOCK_LENGTH_8:
-                sbc_info->sbc.blocks = SBC_BLK_8;
-                break;
-            case SBC_BLOCK_LENGTH_12:
-                sbc_info->sbc.blocks = SBC_BLK_12;
-                break;
-            case SBC_BLOCK_LENGTH_16:
-                sbc_info->sbc.blocks = SBC_BLK_16;
-                break;
-            default:
-                pa_assert_not_reached();
-        }
+        if (u->a2dp_codec_info)
+            u->a2dp_codec->deinit(u->a2dp_codec_info);
 
-        sbc_info->min_bitpool = config->min_bitpool;
-        sbc_info->max_bitpool = config->max_bitpool;
+        u->a2dp_codec = u->transport->a2dp_codec;
 
-        /* Set minimum bitpool for source to get the maximum possible block_size */
-        sbc_info->sbc.bitpool = u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK ? sbc_info->max_bitpool : sbc_info->min_bitpool;
-        sbc_info->codesize = sbc_get_codesize(&sbc_info->sbc);
-        sbc_info->frame_length = sbc_get_frame_length(&sbc_info->sbc);
+        if (!(u->a2dp_codec_info = u->a2dp_codec->init(is_a2dp_sink, u->transport->config, u->transport->config_size,
+                                                       &u->sample_spec))) {
+            pa_log_error("Failed to initialize %s codec", u->a2dp_codec->description);
+            return -1;
+        }
 
-        pa_log_info("SBC parameters: allocation=%u, subbands=%u, blocks=%u, bitpool=%u",
-                    sbc_info->sbc.allocation, sbc_info->sbc.subbands ? 8 : 4, sbc_info->sbc.blocks, sbc_info->sbc.bitpool);
+        pa_log_info("Using %s codec for %s", u->a2dp_codec->description, is_a2dp_sink ? "encoding" : "decoding");
     }
+
+    return 0;
 }
 
 /* Run from main thread */
@@ -1369,9 +1746,7 @@ static int setup_transport(struct userdata *u) {
             return -1; /* We need to fail here until the interactions with module-suspend-on-idle and alike get improved */
     }
 
-    transport_config(u);
-
-    return 0;
+    return transport_config(u);
 }
 
 /* Run from main thread */
@@ -1413,12 +1788,14 @@ static int init_profile(struct userdata *u) {
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
     unsigned do_write = 0;
-    unsigned pending_read_bytes = 0;
     bool writable = false;
+    bool is_sco;
 
     pa_assert(u);
     pa_assert(u->transport);
 
+    is_sco = u->profile == PA_BLUETOOTH_PROFILE_HEADSET_HEAD_UNIT || u->profile == PA_BLUETOOTH_PROFILE_HEADSET_AUDIO_GATEWAY;
+
     pa_log_debug("IO Thread starting up");
 
     if (u->core->realtime_scheduling)
@@ -1448,7 +1825,6 @@ static void thread_func(void *userdata) {
                 pollfd = NULL;
                 teardown_stream(u);
                 do_write = 0;
-                pending_read_bytes = 0;
                 writable = false;
                 pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u->msg), BLUETOOTH_MESSAGE_STREAM_FD_HUP, NULL, 0, NULL, NULL);
             } else
@@ -1457,12 +1833,6 @@ static void thread_func(void *userdata) {
 
         if (u->source && PA_SOURCE_IS_LINKED(u->source->thread_info.state)) {
 
-            /* We should send two blocks to the device before we expect
-             * a response. */
-
-            if (u->write_index == 0 && u->read_index <= 0)
-                do_write = 2;
-
             if (pollfd && (pollfd->revents & POLLIN)) {
                 int n_read;
 
@@ -1473,12 +1843,14 @@ static void thread_func(void *userdata) {
 
                 if (n_read < 0)
                     goto fail;
+            }
 
-                if (n_read > 0) {
-                    /* We just read something, so we are supposed to write something, too */
-                    pending_read_bytes += n_read;
-                    do_write += pending_read_bytes / u->write_block_size;
-                    pending_read_bytes = pending_read_bytes % u->write_block_size;
+            if (u->jitter_q) {
+                pa_usec_t next_playout_at;
+
+                if ((next_playout_at = a2dp_jitter_playout(u, pa_rtclock_now())) > 0) {
+                    pa_rtpoll_set_timer_absolute(u->rtpoll, next_playout_at);
+                    disable_timer = false;
                 }
             }
         }
@@ -1488,7 +1860,16 @@ static void thread_func(void *userdata) {
             if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
                 pa_sink_process_rewind(u->sink, 0);
 
-            if (pollfd) {
+            if (pollfd && is_sco) {
+                pa_usec_t next_write_at;
+
+                if (sco_process_paced_render(u, &next_write_at) < 0)
+                    goto fail;
+
+                pa_rtpoll_set_timer_absolute(u->rtpoll, next_write_at);
+                disable_timer = false;
+
+            } else if (pollfd) {
                 if (pollfd->revents & POLLOUT)
                     writable = true;
 
@@ -1525,12 +1906,11 @@ static void thread_func(void *userdata) {
                                 u->write_index += skip_bytes;
 
                                 if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK)
-                                    a2dp_reduce_bitpool(u);
+                                    a2dp_reduce_bitrate(u);
                             }
                         }
 
                         do_write = 1;
-                        pending_read_bytes = 0;
                     }
                 }
 
@@ -1540,19 +1920,25 @@ static void thread_func(void *userdata) {
                     if (u->write_index <= 0)
                         u->started_at = pa_rtclock_now();
 
-                    if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK) {
-                        if ((n_written = a2dp_process_render(u)) < 0)
-                            goto fail;
+                    if ((n_written = a2dp_process_render(u)) < 0)
+                        goto fail;
+
+                    if (u->link_deferred) {
+                        /* Try again once about a packet has drained */
+                        pa_rtpoll_set_timer_relative(u->rtpoll, pa_bytes_to_usec(u->write_block_size, &u->sample_spec));
+                        disable_timer = false;
                     } else {
-                        if ((n_written = sco_process_render(u)) < 0)
-                            goto fail;
-                    }
+                        a2dp_check_encode_load(u);
 
-                    if (n_written == 0)
-                        pa_log("Broken kernel: we got EAGAIN on write() after POLLOUT!");
+                        if (n_written > 0)
+                            a2dp_check_link_queue(u);
 
-                    do_write -= n_written;
-                    writable = false;
+                        if (n_written == 0)
+                            pa_log("Broken kernel: we got EAGAIN on write() after POLLOUT!");
+
+                        do_write -= n_written;
+                        writable = false;
+                    }
                 }
 
                 if ((!u->source || !PA_SOURCE_IS_LINKED(u->source->thread_info.state)) && do_write <= 0) {
@@ -1581,7 +1967,7 @@ static void thread_func(void *userdata) {
 
         /* Hmm, nothing to do. Let's sleep */
         if (pollfd)
-            pollfd->events = (short) (((u->sink && PA_SINK_IS_LINKED(u->sink->thread_info.state) && !writable) ? POLLOUT : 0) |
+            pollfd->events = (short) (((u->sink && PA_SINK_IS_LINKED(u->sink->thread_info.state) && !writable && !is_sco) ? POLLOUT : 0) |
                                       (u->source && PA_SOURCE_IS_LINKED(u->source->thread_info.state) ? POLLIN : 0));
 
         if ((ret = pa_rtpoll_run(u->rtpoll)) < 0) {
@@ -2084,6 +2470,25 @@ static void handle_transport_state_change(struct userdata *u, struct pa_bluetoot
     acquire = (t->state == PA_BLUETOOTH_TRANSPORT_STATE_PLAYING && u->profile == t->profile);
     release = (oldavail != PA_AVAILABLE_NO && t->state != PA_BLUETOOTH_TRANSPORT_STATE_PLAYING && u->profile == t->profile);
 
+    /* The codec of an HFP audio connection is only known once the
+     * connection is there. If it isn't the one the sink and source were
+     * set up for, set up the profile again to switch the sample rate. */
+    if (acquire && t == u->transport && !u->transport_acquired &&
+        (t->profile == PA_BLUETOOTH_PROFILE_HEADSET_HEAD_UNIT || t->profile == PA_BLUETOOTH_PROFILE_HEADSET_AUDIO_GATEWAY) &&
+        (t->codec == HFP_AUDIO_CODEC_MSBC) != (u->sco_codec == HFP_AUDIO_CODEC_MSBC)) {
+        pa_log_info("Audio connection of %s uses another codec, setting up profile %s again",
+                    t->path, pa_bluetooth_profile_to_string(u->profile));
+
+        stop_thread(u);
+
+        if (init_profile(u) < 0 || start_thread(u) < 0) {
+            stop_thread(u);
+            pa_assert_se(pa_card_set_profile(u->card, pa_hashmap_get(u->card->profiles, "off"), false) >= 0);
+        }
+
+        return;
+    }
+
     if (acquire && transport_acquire(u, true) >= 0) {
         if (u->source) {
             pa_log_debug("Resuming source %s because its transport state changed to playing", u->source->name);
@@ -2247,6 +2652,31 @@ static int device_process_msg(pa_msgobject *obj, int code, void *data, int64_t o
             if (u->transport_acquired)
                 pa_bluetooth_transport_set_state(u->transport, PA_BLUETOOTH_TRANSPORT_STATE_PLAYING);
             break;
+        case BLUETOOTH_MESSAGE_UPDATE_LINK_STATS: {
+            char bitrate[32], queued[32];
+            pa_proplist *p;
+
+            /* The sink the stats were measured for may be gone by now */
+            if (!u->sink || !PA_SINK_IS_LINKED(u->sink->state))
+                break;
+
+            pa_snprintf(bitrate, sizeof(bitrate), "%llu", (unsigned long long) offset);
+            pa_snprintf(queued, sizeof(queued), "%lu", (unsigned long) PA_PTR_TO_UINT(data));
+
+            /* Every update is sent to all subscribed clients, skip the
+             * ones that wouldn't tell them anything new */
+            p = pa_proplist_new();
+            if (!pa_safe_streq(pa_proplist_gets(u->sink->proplist, "bluetooth.a2dp.bitrate"), bitrate))
+                pa_proplist_sets(p, "bluetooth.a2dp.bitrate", bitrate);
+            if (!pa_safe_streq(pa_proplist_gets(u->sink->proplist, "bluetooth.a2dp.queued"), queued))
+                pa_proplist_sets(p, "bluetooth.a2dp.queued", queued);
+
+            if (!pa_proplist_isempty(p))
+                pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, p);
+
+            pa_proplist_free(p);
+            break;
+        }
     }
 
     return 0;
@@ -2371,11 +2801,14 @@ void pa__done(pa_module *m) {
     if (u->transport_microphone_gain_changed_slot)
         pa_hook_slot_free(u->transport_microphone_gain_changed_slot);
 
-    if (u->sbc_info.buffer)
-        pa_xfree(u->sbc_info.buffer);
+    if (u->buffer)
+        pa_xfree(u->buffer);
+
+    if (u->a2dp_codec_info)
+        u->a2dp_codec->deinit(u->a2dp_codec_info);
 
-    if (u->sbc_info.sbc_initialized)
-        sbc_finish(&u->sbc_info.sbc);
+    msbc_free(u);
+    pa_xfree(u->sco_read_buffer);
 
     if (u->msg)
         pa_xfree(u->msg);
@@ -62,6 +62,10 @@ struct pa_dbusiface_card {
     pa_hook_slot *card_profile_changed_slot;
     pa_hook_slot *card_profile_available_slot;
 
+    /* Valid until core->change_generation moves on, dropped early when the
+     * state mirrored above changes */
+    pa_dbus_reply_cache get_all_cache;
+
     pa_dbus_protocol *dbus_protocol;
 };
 
@@ -377,6 +381,9 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     pa_assert(msg);
     pa_assert(c);
 
+    if (pa_dbus_reply_cache_send(&c->get_all_cache, conn, msg, c->card->core->change_generation))
+        return;
+
     idx = c->card->index;
     if (c->card->module)
         owner_module = pa_dbusiface_core_get_module_path(c->core, c->card->module);
@@ -406,6 +413,8 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
 
     pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
 
+    pa_dbus_reply_cache_set(&c->get_all_cache, reply, c->card->core->change_generation);
+
     pa_assert_se(dbus_connection_send(conn, reply, NULL));
 
     dbus_message_unref(reply);
@@ -444,6 +453,7 @@ static void check_card_proplist(pa_dbusiface_card *c) {
         DBusMessageIter msg_iter;
 
         pa_proplist_update(c->proplist, PA_UPDATE_SET, c->card->proplist);
+        pa_dbus_reply_cache_done(&c->get_all_cache);
 
         pa_assert_se(signal_msg = dbus_message_new_signal(c->path,
                                                           PA_DBUSIFACE_CARD_INTERFACE,
@@ -451,7 +461,7 @@ static void check_card_proplist(pa_dbusiface_card *c) {
         dbus_message_iter_init_append(signal_msg, &msg_iter);
         pa_dbus_append_proplist(&msg_iter, c->proplist);
 
-        pa_dbus_protocol_send_signal(c->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(c->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 }
@@ -466,6 +476,7 @@ static pa_hook_result_t card_profile_changed_cb(void *hook_data, void *call_data
         return PA_HOOK_OK;
 
     dbus_card->active_profile = dbus_card->card->active_profile;
+    pa_dbus_reply_cache_done(&dbus_card->get_all_cache);
 
     object_path = pa_dbusiface_card_profile_get_path(pa_hashmap_get(dbus_card->profiles, dbus_card->active_profile->name));
 
@@ -474,7 +485,7 @@ static pa_hook_result_t card_profile_changed_cb(void *hook_data, void *call_data
                                                       signals[SIGNAL_ACTIVE_PROFILE_UPDATED].name));
     pa_assert_se(dbus_message_append_args(signal_msg, DBUS_TYPE_OBJECT_PATH, &object_path, DBUS_TYPE_INVALID));
 
-    pa_dbus_protocol_send_signal(dbus_card->dbus_protocol, signal_msg);
+    pa_dbus_protocol_send_signal_latest(dbus_card->dbus_protocol, signal_msg);
     dbus_message_unref(signal_msg);
 
     check_card_proplist(dbus_card);
@@ -495,6 +506,7 @@ static pa_hook_result_t card_profile_added_cb(void *hook_data, void *call_data,
 
     p = pa_dbusiface_card_profile_new(c, core, profile, c->next_profile_index++);
     pa_assert_se(pa_hashmap_put(c->profiles, (char *) pa_dbusiface_card_profile_get_name(p), p) >= 0);
+    pa_dbus_reply_cache_done(&c->get_all_cache);
 
     /* Send D-Bus signal */
     object_path = pa_dbusiface_card_profile_get_path(p);
@@ -588,6 +600,7 @@ void pa_dbusiface_card_free(pa_dbusiface_card *c) {
     pa_hook_slot_free(c->card_profile_changed_slot);
     pa_hook_slot_free(c->card_profile_available_slot);
 
+    pa_dbus_reply_cache_done(&c->get_all_cache);
     pa_hashmap_free(c->profiles);
     pa_proplist_free(c->proplist);
     pa_dbus_protocol_unref(c->dbus_protocol);
@@ -412,7 +412,7 @@ static pa_hook_result_t client_proplist_changed_cb(void *hook_data, void *call_d
         dbus_message_iter_init_append(signal_msg, &msg_iter);
         pa_dbus_append_proplist(&msg_iter, c->proplist);
 
-        pa_dbus_protocol_send_signal(c->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(c->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 
@@ -45,6 +45,9 @@ struct pa_dbusiface_device_port {
 
     pa_hook_slot *available_changed_slot;
 
+    /* Valid until core->change_generation moves on */
+    pa_dbus_reply_cache get_all_cache;
+
     pa_dbus_protocol *dbus_protocol;
 };
 
@@ -155,6 +158,9 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     pa_assert(msg);
     pa_assert(p);
 
+    if (pa_dbus_reply_cache_send(&p->get_all_cache, conn, msg, p->port->core->change_generation))
+        return;
+
     priority = p->port->priority;
 
     pa_assert_se((reply = dbus_message_new_method_return(msg)));
@@ -170,6 +176,8 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
 
     pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
 
+    pa_dbus_reply_cache_set(&p->get_all_cache, reply, p->port->core->change_generation);
+
     pa_assert_se(dbus_connection_send(conn, reply, NULL));
     dbus_message_unref(reply);
 }
@@ -193,7 +201,7 @@ static pa_hook_result_t available_changed_cb(void *hook_data, void *call_data, v
                                                       signals[SIGNAL_AVAILABLE_CHANGED].name));
     pa_assert_se(dbus_message_append_args(signal_msg, DBUS_TYPE_UINT32, &available, DBUS_TYPE_INVALID));
 
-    pa_dbus_protocol_send_signal(p->dbus_protocol, signal_msg);
+    pa_dbus_protocol_send_signal_latest(p->dbus_protocol, signal_msg);
     dbus_message_unref(signal_msg);
 
     return PA_HOOK_OK;
@@ -211,7 +219,7 @@ pa_dbusiface_device_port *pa_dbusiface_device_port_new(
     pa_assert(core);
     pa_assert(port);
 
-    p = pa_xnew(pa_dbusiface_device_port, 1);
+    p = pa_xnew0(pa_dbusiface_device_port, 1);
     p->index = idx;
     p->port = port;
     p->path = pa_sprintf_malloc("%s/%s%u", pa_dbusiface_device_get_path(device), OBJECT_NAME, idx);
@@ -230,6 +238,7 @@ void pa_dbusiface_device_port_free(pa_dbusiface_device_port *p) {
     pa_assert_se(pa_dbus_protocol_remove_interface(p->dbus_protocol, p->path, port_interface_info.name) >= 0);
 
     pa_hook_slot_free(p->available_changed_slot);
+    pa_dbus_reply_cache_done(&p->get_all_cache);
     pa_dbus_protocol_unref(p->dbus_protocol);
 
     pa_xfree(p->path);
@@ -100,6 +100,11 @@ struct pa_dbusiface_device {
     pa_hook_slot *port_changed_slot;
     pa_hook_slot *proplist_changed_slot;
 
+    /* Valid until core->change_generation moves on, dropped early when the
+     * state mirrored above changes. Not used while the device is running,
+     * because then the latency in the reply goes stale right away. */
+    pa_dbus_reply_cache get_all_cache;
+
     pa_dbus_protocol *dbus_protocol;
 };
 
@@ -824,11 +829,24 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     unsigned n_ports = 0;
     const char *active_port = NULL;
     unsigned i = 0;
+    pa_core *core;
+    bool cacheable;
 
     pa_assert(conn);
     pa_assert(msg);
     pa_assert(d);
 
+    if (d->type == PA_DEVICE_TYPE_SINK) {
+        core = d->sink->core;
+        cacheable = pa_sink_get_state(d->sink) != PA_SINK_RUNNING;
+    } else {
+        core = d->source->core;
+        cacheable = pa_source_get_state(d->source) != PA_SOURCE_RUNNING;
+    }
+
+    if (cacheable && pa_dbus_reply_cache_send(&d->get_all_cache, conn, msg, core->change_generation))
+        return;
+
     if (d->type == PA_DEVICE_TYPE_SINK) {
         idx = d->sink->index;
         name = d->sink->name;
@@ -925,6 +943,11 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
 
     pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
 
+    if (cacheable)
+        pa_dbus_reply_cache_set(&d->get_all_cache, reply, core->change_generation);
+    else
+        pa_dbus_reply_cache_done(&d->get_all_cache);
+
     pa_assert_se(dbus_connection_send(conn, reply, NULL));
 
     dbus_message_unref(reply);
@@ -1101,6 +1124,7 @@ static pa_hook_result_t volume_changed_cb(void *hook_data, void *call_data, void
         dbus_uint32_t *volume_ptr = volume;
 
         d->volume = *new_volume;
+        pa_dbus_reply_cache_done(&d->get_all_cache);
 
         for (i = 0; i < d->volume.channels; ++i)
             volume[i] = d->volume.values[i];
@@ -1112,7 +1136,7 @@ static pa_hook_result_t volume_changed_cb(void *hook_data, void *call_data, void
                                               DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &volume_ptr, d->volume.channels,
                                               DBUS_TYPE_INVALID));
 
-        pa_dbus_protocol_send_signal(d->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(d->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 
@@ -1134,13 +1158,14 @@ static pa_hook_result_t mute_changed_cb(void *hook_data, void *call_data, void *
 
     if (d->mute != new_mute) {
         d->mute = new_mute;
+        pa_dbus_reply_cache_done(&d->get_all_cache);
 
         pa_assert_se(signal_msg = dbus_message_new_signal(d->path,
                                                           PA_DBUSIFACE_DEVICE_INTERFACE,
                                                           signals[SIGNAL_MUTE_UPDATED].name));
         pa_assert_se(dbus_message_append_args(signal_msg, DBUS_TYPE_BOOLEAN, &d->mute, DBUS_TYPE_INVALID));
 
-        pa_dbus_protocol_send_signal(d->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(d->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 
@@ -1172,13 +1197,14 @@ static pa_hook_result_t state_changed_cb(void *hook_data, void *call_data, void
             d->source_state = new_source_state;
 
         state = (d->type == PA_DEVICE_TYPE_SINK) ? d->sink_state : d->source_state;
+        pa_dbus_reply_cache_done(&d->get_all_cache);
 
         pa_assert_se(signal_msg = dbus_message_new_signal(d->path,
                                                           PA_DBUSIFACE_DEVICE_INTERFACE,
                                                           signals[SIGNAL_STATE_UPDATED].name));
         pa_assert_se(dbus_message_append_args(signal_msg, DBUS_TYPE_UINT32, &state, DBUS_TYPE_INVALID));
 
-        pa_dbus_protocol_send_signal(d->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(d->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 
@@ -1200,6 +1226,7 @@ static pa_hook_result_t port_changed_cb(void *hook_data, void *call_data, void *
         const char *object_path = NULL;
 
         d->active_port = new_active_port;
+        pa_dbus_reply_cache_done(&d->get_all_cache);
         object_path = pa_dbusiface_device_port_get_path(pa_hashmap_get(d->ports, d->active_port->name));
 
         pa_assert_se(signal_msg = dbus_message_new_signal(d->path,
@@ -1207,7 +1234,7 @@ static pa_hook_result_t port_changed_cb(void *hook_data, void *call_data, void *
                                                           signals[SIGNAL_ACTIVE_PORT_UPDATED].name));
         pa_assert_se(dbus_message_append_args(signal_msg, DBUS_TYPE_OBJECT_PATH, &object_path, DBUS_TYPE_INVALID));
 
-        pa_dbus_protocol_send_signal(d->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(d->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 
@@ -1229,6 +1256,7 @@ static pa_hook_result_t proplist_changed_cb(void *hook_data, void *call_data, vo
         DBusMessageIter msg_iter;
 
         pa_proplist_update(d->proplist, PA_UPDATE_SET, new_proplist);
+        pa_dbus_reply_cache_done(&d->get_all_cache);
 
         pa_assert_se(signal_msg = dbus_message_new_signal(d->path,
                                                           PA_DBUSIFACE_DEVICE_INTERFACE,
@@ -1236,7 +1264,7 @@ static pa_hook_result_t proplist_changed_cb(void *hook_data, void *call_data, vo
         dbus_message_iter_init_append(signal_msg, &msg_iter);
         pa_dbus_append_proplist(&msg_iter, d->proplist);
 
-        pa_dbus_protocol_send_signal(d->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(d->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 
@@ -1348,6 +1376,7 @@ void pa_dbusiface_device_free(pa_dbusiface_device *d) {
         pa_assert_se(pa_dbus_protocol_remove_interface(d->dbus_protocol, d->path, source_interface_info.name) >= 0);
         pa_source_unref(d->source);
     }
+    pa_dbus_reply_cache_done(&d->get_all_cache);
     pa_hashmap_free(d->ports);
     pa_proplist_free(d->proplist);
     pa_dbus_protocol_unref(d->dbus_protocol);
@@ -27,6 +27,9 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/dbus-util.h>
 #include <pulsecore/protocol-dbus.h>
+#include <pulsecore/render-profile.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/source.h>
 
 #include "iface-memstats.h"
 
@@ -37,9 +40,13 @@ static void handle_get_current_memblocks_size(DBusConnection *conn, DBusMessage
 static void handle_get_accumulated_memblocks(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_accumulated_memblocks_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_sample_cache_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_render_profiling(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_set_render_profiling(DBusConnection *conn, DBusMessage *msg, DBusMessageIter *iter, void *userdata);
 
 static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
+static void handle_get_render_profile(DBusConnection *conn, DBusMessage *msg, void *userdata);
+
 struct pa_dbusiface_memstats {
     pa_core *core;
     char *path;
@@ -52,21 +59,41 @@ enum property_handler_index {
     PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS,
     PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE,
     PROPERTY_HANDLER_SAMPLE_CACHE_SIZE,
+    PROPERTY_HANDLER_RENDER_PROFILING,
     PROPERTY_HANDLER_MAX
 };
 
+enum method_handler_index {
+    METHOD_HANDLER_GET_RENDER_PROFILE,
+    METHOD_HANDLER_MAX
+};
+
 static pa_dbus_property_handler property_handlers[PROPERTY_HANDLER_MAX] = {
     [PROPERTY_HANDLER_CURRENT_MEMBLOCKS]          = { .property_name = "CurrentMemblocks",         .type = "u", .get_cb = handle_get_current_memblocks,          .set_cb = NULL },
     [PROPERTY_HANDLER_CURRENT_MEMBLOCKS_SIZE]     = { .property_name = "CurrentMemblocksSize",     .type = "u", .get_cb = handle_get_current_memblocks_size,     .set_cb = NULL },
     [PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS]      = { .property_name = "AccumulatedMemblocks",     .type = "u", .get_cb = handle_get_accumulated_memblocks,      .set_cb = NULL },
     [PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE] = { .property_name = "AccumulatedMemblocksSize", .type = "u", .get_cb = handle_get_accumulated_memblocks_size, .set_cb = NULL },
-    [PROPERTY_HANDLER_SAMPLE_CACHE_SIZE]          = { .property_name = "SampleCacheSize",          .type = "u", .get_cb = handle_get_sample_cache_size,          .set_cb = NULL }
+    [PROPERTY_HANDLER_SAMPLE_CACHE_SIZE]          = { .property_name = "SampleCacheSize",          .type = "u", .get_cb = handle_get_sample_cache_size,          .set_cb = NULL },
+    [PROPERTY_HANDLER_RENDER_PROFILING]           = { .property_name = "RenderProfiling",          .type = "b", .get_cb = handle_get_render_profiling,           .set_cb = handle_set_render_profiling }
+};
+
+/* One entry per object and render stage: object type ("sink", "sink-input",
+ * "source" or "source-output"), object index, stage name, number of calls,
+ * total and maximum duration in usec, and the duration histogram */
+static pa_dbus_arg_info get_render_profile_args[] = { { "profile", "a(sustttat)", "out" } };
+
+static pa_dbus_method_handler method_handlers[METHOD_HANDLER_MAX] = {
+    [METHOD_HANDLER_GET_RENDER_PROFILE] = {
+        .method_name = "GetRenderProfile",
+        .arguments = get_render_profile_args,
+        .n_arguments = sizeof(get_render_profile_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_render_profile }
 };
 
 static pa_dbus_interface_info memstats_interface_info = {
     .name = PA_DBUSIFACE_MEMSTATS_INTERFACE,
-    .method_handlers = NULL,
-    .n_method_handlers = 0,
+    .method_handlers = method_handlers,
+    .n_method_handlers = METHOD_HANDLER_MAX,
     .property_handlers = property_handlers,
     .n_property_handlers = PROPERTY_HANDLER_MAX,
     .get_all_properties_cb = handle_get_all,
@@ -151,6 +178,113 @@ static void handle_get_sample_cache_size(DBusConnection *conn, DBusMessage *msg,
     pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &sample_cache_size);
 }
 
+static void handle_get_render_profiling(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    dbus_bool_t render_profiling;
+
+    pa_assert(conn);
+    pa_assert(msg);
+
+    render_profiling = pa_render_profile_get_enabled();
+
+    pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_BOOLEAN, &render_profiling);
+}
+
+static void handle_set_render_profiling(DBusConnection *conn, DBusMessage *msg, DBusMessageIter *iter, void *userdata) {
+    dbus_bool_t render_profiling = FALSE;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(iter);
+
+    dbus_message_iter_get_basic(iter, &render_profiling);
+
+    pa_render_profile_set_enabled(render_profiling);
+
+    pa_dbus_send_empty_reply(conn, msg);
+}
+
+static void append_render_profile(DBusMessageIter *array_iter, const char *type, uint32_t idx, const pa_render_profile *profile) {
+    unsigned stage, k;
+
+    for (stage = 0; stage < PA_RENDER_STAGE_MAX; stage++) {
+        const pa_render_profile *p = &profile[stage];
+        DBusMessageIter struct_iter, buckets_iter;
+        const char *stage_name;
+        dbus_uint32_t object_index = idx;
+        dbus_uint64_t n, total, max;
+
+        if (p->n <= 0)
+            continue;
+
+        stage_name = pa_render_stage_to_string(stage);
+        n = p->n;
+        total = p->total;
+        max = p->max;
+
+        pa_assert_se(dbus_message_iter_open_container(array_iter, DBUS_TYPE_STRUCT, NULL, &struct_iter));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &object_index));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &stage_name));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &n));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &total));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &max));
+
+        pa_assert_se(dbus_message_iter_open_container(&struct_iter, DBUS_TYPE_ARRAY, "t", &buckets_iter));
+        for (k = 0; k < PA_RENDER_PROFILE_BUCKETS; k++) {
+            dbus_uint64_t b = p->buckets[k];
+            pa_assert_se(dbus_message_iter_append_basic(&buckets_iter, DBUS_TYPE_UINT64, &b));
+        }
+        pa_assert_se(dbus_message_iter_close_container(&struct_iter, &buckets_iter));
+
+        pa_assert_se(dbus_message_iter_close_container(array_iter, &struct_iter));
+    }
+}
+
+static void handle_get_render_profile(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+    DBusMessage *reply = NULL;
+    DBusMessageIter msg_iter;
+    DBusMessageIter array_iter;
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t idx, idx2;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    pa_assert_se((reply = dbus_message_new_method_return(msg)));
+
+    dbus_message_iter_init_append(reply, &msg_iter);
+    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "(sustttat)", &array_iter));
+
+    PA_IDXSET_FOREACH(sink, m->core->sinks, idx) {
+        pa_sink_input *i;
+
+        pa_sink_update_render_profile(sink);
+        append_render_profile(&array_iter, "sink", sink->index, sink->render_profile);
+
+        PA_IDXSET_FOREACH(i, sink->inputs, idx2)
+            append_render_profile(&array_iter, "sink-input", i->index, i->render_profile);
+    }
+
+    PA_IDXSET_FOREACH(source, m->core->sources, idx) {
+        pa_source_output *o;
+
+        pa_source_update_render_profile(source);
+        append_render_profile(&array_iter, "source", source->index, source->render_profile);
+
+        PA_IDXSET_FOREACH(o, source->outputs, idx2)
+            append_render_profile(&array_iter, "source-output", o->index, o->render_profile);
+    }
+
+    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &array_iter));
+
+    pa_assert_se(dbus_connection_send(conn, reply, NULL));
+
+    dbus_message_unref(reply);
+}
+
 static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata) {
     pa_dbusiface_memstats *m = userdata;
     const pa_mempool_stat *stat;
@@ -159,6 +293,7 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     dbus_uint32_t accumulated_memblocks;
     dbus_uint32_t accumulated_memblocks_size;
     dbus_uint32_t sample_cache_size;
+    dbus_bool_t render_profiling;
     DBusMessage *reply = NULL;
     DBusMessageIter msg_iter;
     DBusMessageIter dict_iter;
@@ -174,6 +309,7 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     accumulated_memblocks = pa_atomic_load(&stat->n_accumulated);
     accumulated_memblocks_size = pa_atomic_load(&stat->accumulated_size);
     sample_cache_size = pa_scache_total_size(m->core);
+    render_profiling = pa_render_profile_get_enabled();
 
     pa_assert_se((reply = dbus_message_new_method_return(msg)));
 
@@ -185,6 +321,7 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS].property_name, DBUS_TYPE_UINT32, &accumulated_memblocks);
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE].property_name, DBUS_TYPE_UINT32, &accumulated_memblocks_size);
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SAMPLE_CACHE_SIZE].property_name, DBUS_TYPE_UINT32, &sample_cache_size);
+    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_RENDER_PROFILING].property_name, DBUS_TYPE_BOOLEAN, &render_profiling);
 
     pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
 
@@ -286,7 +286,7 @@ static pa_hook_result_t module_proplist_changed_cb(void *hook_data, void *call_d
         dbus_message_iter_init_append(signal_msg, &msg_iter);
         pa_dbus_append_proplist(&msg_iter, module_iface->proplist);
 
-        pa_dbus_protocol_send_signal(module_iface->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(module_iface->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 
@@ -473,7 +473,7 @@ static pa_hook_result_t sample_cache_changed_cb(void *hook_data, void *call_data
         dbus_message_iter_init_append(signal_msg, &msg_iter);
         pa_dbus_append_proplist(&msg_iter, sample_iface->proplist);
 
-        pa_dbus_protocol_send_signal(sample_iface->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(sample_iface->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 
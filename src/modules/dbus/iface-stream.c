@@ -679,7 +679,7 @@ static void check_and_signal_rate(pa_dbusiface_stream *s) {
                                                           signals[SIGNAL_SAMPLE_RATE_UPDATED].name));
         pa_assert_se(dbus_message_append_args(signal_msg, DBUS_TYPE_UINT32, &s->sample_rate, DBUS_TYPE_INVALID));
 
-        pa_dbus_protocol_send_signal(s->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(s->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 }
@@ -707,7 +707,7 @@ static pa_hook_result_t move_finish_cb(void *hook_data, void *call_data, void *s
                                                               signals[SIGNAL_DEVICE_UPDATED].name));
             pa_assert_se(dbus_message_append_args(signal_msg, DBUS_TYPE_OBJECT_PATH, &new_device_path, DBUS_TYPE_INVALID));
 
-            pa_dbus_protocol_send_signal(s->dbus_protocol, signal_msg);
+            pa_dbus_protocol_send_signal_latest(s->dbus_protocol, signal_msg);
             dbus_message_unref(signal_msg);
         }
     } else {
@@ -724,7 +724,7 @@ static pa_hook_result_t move_finish_cb(void *hook_data, void *call_data, void *s
                                                               signals[SIGNAL_DEVICE_UPDATED].name));
             pa_assert_se(dbus_message_append_args(signal_msg, DBUS_TYPE_OBJECT_PATH, &new_device_path, DBUS_TYPE_INVALID));
 
-            pa_dbus_protocol_send_signal(s->dbus_protocol, signal_msg);
+            pa_dbus_protocol_send_signal_latest(s->dbus_protocol, signal_msg);
             dbus_message_unref(signal_msg);
         }
     }
@@ -764,7 +764,7 @@ static pa_hook_result_t volume_changed_cb(void *hook_data, void *call_data, void
                                                   DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &volume_ptr, s->volume.channels,
                                                   DBUS_TYPE_INVALID));
 
-            pa_dbus_protocol_send_signal(s->dbus_protocol, signal_msg);
+            pa_dbus_protocol_send_signal_latest(s->dbus_protocol, signal_msg);
             dbus_message_unref(signal_msg);
         }
     }
@@ -793,7 +793,7 @@ static pa_hook_result_t mute_changed_cb(void *hook_data, void *call_data, void *
                                                               signals[SIGNAL_MUTE_UPDATED].name));
             pa_assert_se(dbus_message_append_args(signal_msg, DBUS_TYPE_BOOLEAN, &s->mute, DBUS_TYPE_INVALID));
 
-            pa_dbus_protocol_send_signal(s->dbus_protocol, signal_msg);
+            pa_dbus_protocol_send_signal_latest(s->dbus_protocol, signal_msg);
             dbus_message_unref(signal_msg);
             signal_msg = NULL;
         }
@@ -824,7 +824,7 @@ static pa_hook_result_t proplist_changed_cb(void *hook_data, void *call_data, vo
         dbus_message_iter_init_append(signal_msg, &msg_iter);
         pa_dbus_append_proplist(&msg_iter, s->proplist);
 
-        pa_dbus_protocol_send_signal(s->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_latest(s->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
     }
 
@@ -47,11 +47,16 @@ PA_MODULE_DESCRIPTION("D-Bus interface");
 PA_MODULE_USAGE(
         "access=local|remote|local,remote "
         "tcp_port=<port number> "
-        "tcp_listen=<hostname>");
+        "tcp_listen=<hostname> "
+        "signal_coalesce_msec=<hold back property change signals for this long, 0 to disable>");
 PA_MODULE_LOAD_ONCE(true);
 PA_MODULE_AUTHOR("Tanu Kaskinen");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 
+/* Volume sliders generate change events at the rate the mouse moves, only
+ * the final value is of interest to clients */
+#define DEFAULT_SIGNAL_COALESCE_MSEC 50
+
 enum server_type {
     SERVER_TYPE_LOCAL,
     SERVER_TYPE_TCP
@@ -66,6 +71,7 @@ struct userdata {
     bool remote_access;
     uint32_t tcp_port;
     char *tcp_listen;
+    uint32_t signal_coalesce_msec;
 
     struct server *local_server;
     struct server *tcp_server;
@@ -94,6 +100,7 @@ static const char* const valid_modargs[] = {
     "access",
     "tcp_port",
     "tcp_listen",
+    "signal_coalesce_msec",
     NULL
 };
 
@@ -537,6 +544,7 @@ int pa__init(pa_module *m) {
     u->local_access = true;
     u->remote_access = false;
     u->tcp_port = PA_DBUS_DEFAULT_PORT;
+    u->signal_coalesce_msec = DEFAULT_SIGNAL_COALESCE_MSEC;
 
     if (get_access_arg(ma, &u->local_access, &u->remote_access) < 0) {
         pa_log("Invalid access argument: '%s'", pa_modargs_get_value(ma, "access", NULL));
@@ -550,6 +558,11 @@ int pa__init(pa_module *m) {
 
     u->tcp_listen = pa_xstrdup(pa_modargs_get_value(ma, "tcp_listen", "0.0.0.0"));
 
+    if (pa_modargs_get_value_u32(ma, "signal_coalesce_msec", &u->signal_coalesce_msec) < 0) {
+        pa_log("Invalid signal_coalesce_msec argument: '%s'", pa_modargs_get_value(ma, "signal_coalesce_msec", NULL));
+        goto fail;
+    }
+
     if (u->local_access && !(u->local_server = start_local_server(u))) {
         pa_log("Starting the local D-Bus server failed.");
         goto fail;
@@ -566,6 +579,7 @@ int pa__init(pa_module *m) {
     m->core->mainloop->defer_enable(u->cleanup_event, 0);
 
     u->dbus_protocol = pa_dbus_protocol_get(m->core);
+    pa_dbus_protocol_set_signal_coalesce_usec(u->dbus_protocol, u->signal_coalesce_msec * PA_USEC_PER_MSEC);
     u->core_iface = pa_dbusiface_core_new(m->core);
 
     pa_modargs_free(ma);
@@ -589,6 +603,10 @@ void pa__done(pa_module *m) {
     if (!(u = m->userdata))
         return;
 
+    /* Deliver whatever is still held back while the clients are connected */
+    if (u->dbus_protocol)
+        pa_dbus_protocol_set_signal_coalesce_usec(u->dbus_protocol, 0);
+
     if (u->core_iface)
         pa_dbusiface_core_free(u->core_iface);
 
@@ -30,10 +30,20 @@
 #include "adrian-aec-orc-gen.h"
 #endif
 
-#ifdef __SSE__
-#include <xmmintrin.h>
+#if defined(__i386__) || defined(__amd64__)
+#define AEC_X86 1
+#include <immintrin.h>
 #endif
 
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define AEC_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* The vector versions below load w[] aligned and b[] unaligned, as the
+ * latter runs over the tap delayed signals at varying offsets. They process
+ * 16 taps per iteration, which NLMS_LEN is a multiple of. */
+
 /* Vector Dot Product */
 static REAL dotp(REAL a[], REAL b[])
 {
@@ -48,9 +58,26 @@ static REAL dotp(REAL a[], REAL b[])
   return sum0 + sum1;
 }
 
+/* Tap weight update (filter learning) */
+static void update_w(REAL w[], REAL xf[], REAL mikro_ef)
+{
+#ifdef DISABLE_ORC
+  int i;
+
+  for (i = 0; i < NLMS_LEN; i += 2) {
+    // optimize: partial loop unrolling
+    w[i] += mikro_ef * xf[i];
+    w[i + 1] += mikro_ef * xf[i + 1];
+  }
+#else
+  update_tap_weights(w, xf, mikro_ef, NLMS_LEN);
+#endif
+}
+
+#ifdef AEC_X86
+__attribute__((target("sse")))
 static REAL dotp_sse(REAL a[], REAL b[])
 {
-#ifdef __SSE__
   /* This is taken from speex's inner product implementation */
   int j;
   REAL sum;
@@ -66,13 +93,84 @@ static REAL dotp_sse(REAL a[], REAL b[])
   _mm_store_ss(&sum, acc);
 
   return sum;
-#else
-  return dotp(a, b);
-#endif
 }
 
+__attribute__((target("sse")))
+static void update_w_sse(REAL w[], REAL xf[], REAL mikro_ef)
+{
+  int i;
+  __m128 m = _mm_set1_ps(mikro_ef);
+
+  for (i = 0; i < NLMS_LEN; i += 8) {
+    _mm_store_ps(w + i, _mm_add_ps(_mm_load_ps(w + i), _mm_mul_ps(m, _mm_loadu_ps(xf + i))));
+    _mm_store_ps(w + i + 4, _mm_add_ps(_mm_load_ps(w + i + 4), _mm_mul_ps(m, _mm_loadu_ps(xf + i + 4))));
+  }
+}
+
+__attribute__((target("avx")))
+static REAL dotp_avx(REAL a[], REAL b[])
+{
+  int j;
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+  __m128 acc;
+
+  for (j = 0; j < NLMS_LEN; j += 16) {
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_load_ps(a + j), _mm256_loadu_ps(b + j)));
+    acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_load_ps(a + j + 8), _mm256_loadu_ps(b + j + 8)));
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  acc = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+
+  return _mm_cvtss_f32(acc);
+}
+
+__attribute__((target("avx")))
+static void update_w_avx(REAL w[], REAL xf[], REAL mikro_ef)
+{
+  int i;
+  __m256 m = _mm256_set1_ps(mikro_ef);
+
+  for (i = 0; i < NLMS_LEN; i += 16) {
+    _mm256_store_ps(w + i, _mm256_add_ps(_mm256_load_ps(w + i), _mm256_mul_ps(m, _mm256_loadu_ps(xf + i))));
+    _mm256_store_ps(w + i + 8, _mm256_add_ps(_mm256_load_ps(w + i + 8), _mm256_mul_ps(m, _mm256_loadu_ps(xf + i + 8))));
+  }
+}
+#endif /* AEC_X86 */
 
-AEC* AEC_init(int RATE, int have_vector)
+#ifdef AEC_NEON
+static REAL dotp_neon(REAL a[], REAL b[])
+{
+  int j;
+  float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+  float32x2_t acc;
+
+  for (j = 0; j < NLMS_LEN; j += 8) {
+    acc0 = vmlaq_f32(acc0, vld1q_f32(a + j), vld1q_f32(b + j));
+    acc1 = vmlaq_f32(acc1, vld1q_f32(a + j + 4), vld1q_f32(b + j + 4));
+  }
+  acc0 = vaddq_f32(acc0, acc1);
+  acc = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+  acc = vpadd_f32(acc, acc);
+
+  return vget_lane_f32(acc, 0);
+}
+
+static void update_w_neon(REAL w[], REAL xf[], REAL mikro_ef)
+{
+  int i;
+  float32x4_t m = vdupq_n_f32(mikro_ef);
+
+  for (i = 0; i < NLMS_LEN; i += 8) {
+    vst1q_f32(w + i, vmlaq_f32(vld1q_f32(w + i), m, vld1q_f32(xf + i)));
+    vst1q_f32(w + i + 4, vmlaq_f32(vld1q_f32(w + i + 4), m, vld1q_f32(xf + i + 4)));
+  }
+}
+#endif /* AEC_NEON */
+
+
+AEC* AEC_init(int RATE, AEC_vector vector)
 {
   AEC *a = pa_xnew0(AEC, 1);
   a->j = NLMS_EXT;
@@ -90,14 +188,30 @@ AEC* AEC_init(int RATE, int have_vector)
 
   a->fdwdisplay = -1;
 
-  if (have_vector) {
-      /* Get a 16-byte aligned location */
-      a->w = (REAL *) (((uintptr_t) a->w_arr) - (((uintptr_t) a->w_arr) % 16) + 16);
+  /* Get a 32-byte aligned location, as needed for AVX */
+  a->w = (REAL *) (((uintptr_t) a->w_arr) - (((uintptr_t) a->w_arr) % 32) + 32);
+  a->dotp = dotp;
+  a->update_w = update_w;
+
+  switch (vector) {
+#ifdef AEC_X86
+    case AEC_VECTOR_SSE:
       a->dotp = dotp_sse;
-  } else {
-      /* We don't care about alignment, just use the array as-is */
-      a->w = a->w_arr;
-      a->dotp = dotp;
+      a->update_w = update_w_sse;
+      break;
+    case AEC_VECTOR_AVX:
+      a->dotp = dotp_avx;
+      a->update_w = update_w_avx;
+      break;
+#endif
+#ifdef AEC_NEON
+    case AEC_VECTOR_NEON:
+      a->dotp = dotp_neon;
+      a->update_w = update_w_neon;
+      break;
+#endif
+    default:
+      break;
   }
 
   return a;
@@ -207,17 +321,8 @@ static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize)
     // calculate variable step size
     REAL mikro_ef = stepsize * ef / a->dotp_xf_xf;
 
-#ifdef DISABLE_ORC
     // update tap weights (filter learning)
-    int i;
-    for (i = 0; i < NLMS_LEN; i += 2) {
-      // optimize: partial loop unrolling
-      a->w[i] += mikro_ef * a->xf[i + a->j];
-      a->w[i + 1] += mikro_ef * a->xf[i + a->j + 1];
-    }
-#else
-    update_tap_weights(a->w, &a->xf[a->j], mikro_ef, NLMS_LEN);
-#endif
+    a->update_w(a->w, &a->xf[a->j], mikro_ef);
   }
 
   if (--(a->j) < 0) {
@@ -238,11 +343,8 @@ static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize)
 }
 
 
-int AEC_doAEC(AEC *a, int d_, int x_)
+static inline REAL AEC_doAEC_sample(AEC *a, REAL d, REAL x)
 {
-  REAL d = (REAL) d_;
-  REAL x = (REAL) x_;
-
   // Mic Highpass Filter - to remove DC
   d = IIR_HP_highpass(a->acMic, d);
 
@@ -283,5 +385,18 @@ int AEC_doAEC(AEC *a, int d_, int x_)
   }
 #endif
 
-  return (int) d;
+  return d;
+}
+
+int AEC_doAEC(AEC *a, int d_, int x_)
+{
+  return (int) AEC_doAEC_sample(a, (REAL) d_, (REAL) x_);
+}
+
+void AEC_doAEC_block(AEC *a, const int16_t *d, const int16_t *x, int16_t *out, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++)
+    out[i] = (int16_t) AEC_doAEC_sample(a, (REAL) d[i], (REAL) x[i]);
 }
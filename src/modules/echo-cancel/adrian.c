@@ -59,7 +59,8 @@ bool pa_adrian_ec_init(pa_core *c, pa_echo_canceller *ec,
                        pa_sample_spec *play_ss, pa_channel_map *play_map,
                        pa_sample_spec *out_ss, pa_channel_map *out_map,
                        uint32_t *nframes, const char *args) {
-    int rate, have_vector = 0;
+    int rate;
+    AEC_vector vector = AEC_VECTOR_NONE;
     uint32_t frame_size_ms;
     pa_modargs *ma;
 
@@ -82,11 +83,17 @@ bool pa_adrian_ec_init(pa_core *c, pa_echo_canceller *ec,
 
     pa_log_debug ("Using nframes %d, blocksize %u, channels %d, rate %d", *nframes, ec->params.adrian.blocksize, out_ss->channels, out_ss->rate);
 
-    /* For now we only support SSE */
-    if (c->cpu_info.cpu_type == PA_CPU_X86 && (c->cpu_info.flags.x86 & PA_CPU_X86_SSE))
-        have_vector = 1;
+    if (c->cpu_info.cpu_type == PA_CPU_X86) {
+        if (c->cpu_info.flags.x86 & PA_CPU_X86_AVX)
+            vector = AEC_VECTOR_AVX;
+        else if (c->cpu_info.flags.x86 & PA_CPU_X86_SSE)
+            vector = AEC_VECTOR_SSE;
+    } else if (c->cpu_info.cpu_type == PA_CPU_ARM) {
+        if (c->cpu_info.flags.arm & PA_CPU_ARM_NEON)
+            vector = AEC_VECTOR_NEON;
+    }
 
-    ec->params.adrian.aec = AEC_init(rate, have_vector);
+    ec->params.adrian.aec = AEC_init(rate, vector);
     if (!ec->params.adrian.aec)
         goto fail;
 
@@ -100,14 +107,9 @@ fail:
 }
 
 void pa_adrian_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out) {
-    unsigned int i;
-
-    for (i = 0; i < ec->params.adrian.blocksize; i += 2) {
-        /* We know it's S16NE mono data */
-        int r = *(int16_t *)(rec + i);
-        int p = *(int16_t *)(play + i);
-        *(int16_t *)(out + i) = (int16_t) AEC_doAEC(ec->params.adrian.aec, r, p);
-    }
+    /* We know it's S16NE mono data */
+    AEC_doAEC_block(ec->params.adrian.aec, (const int16_t *) rec, (const int16_t *) play, (int16_t *) out,
+                    ec->params.adrian.blocksize / sizeof(int16_t));
 }
 
 void pa_adrian_ec_done(pa_echo_canceller *ec) {
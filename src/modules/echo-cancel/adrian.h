@@ -21,10 +21,26 @@
     along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#ifndef fooadrianhfoo
+#define fooadrianhfoo
+
+#include <stdint.h>
+
 /* Forward declarations */
 
 typedef struct AEC AEC;
 
-AEC* AEC_init(int RATE, int have_vector);
+/* Vector instructions the NLMS filter may use */
+typedef enum AEC_vector {
+    AEC_VECTOR_NONE,
+    AEC_VECTOR_SSE,
+    AEC_VECTOR_AVX,
+    AEC_VECTOR_NEON
+} AEC_vector;
+
+AEC* AEC_init(int RATE, AEC_vector vector);
 void AEC_done(AEC *a);
 int AEC_doAEC(AEC *a, int d_, int x_);
+void AEC_doAEC_block(AEC *a, const int16_t *d, const int16_t *x, int16_t *out, unsigned n);
+
+#endif
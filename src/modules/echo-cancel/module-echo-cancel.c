@@ -38,7 +38,10 @@
 #include <pulse/rtclock.h>
 
 #include <pulsecore/i18n.h>
+#include <pulsecore/asyncq.h>
 #include <pulsecore/atomic.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/llist.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sink.h>
@@ -50,6 +53,7 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/thread.h>
 
 #include "module-echo-cancel-symdef.h"
 
@@ -64,6 +68,7 @@ PA_MODULE_USAGE(
           "sink_name=<name for the sink> "
           "sink_properties=<properties for the sink> "
           "sink_master=<name of sink to filter> "
+          "reference_sink=<sink of another echo canceller to share> "
           "adjust_time=<how often to readjust rates in s> "
           "adjust_threshold=<how much drift to readjust after in ms> "
           "format=<sample format> "
@@ -76,6 +81,8 @@ PA_MODULE_USAGE(
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
           "use_master_format=<yes or no> "
+          "use_worker_thread=<yes or no> "
+          "worker_max_delay=<how long a block may wait for the worker in ms> "
         ));
 
 /* NOTE: Make sure the enum and ec_table are maintained in the correct order */
@@ -139,17 +146,33 @@ static const pa_echo_canceller ec_table[] = {
 #define DEFAULT_CHANNELS 1
 #define DEFAULT_ADJUST_TIME_USEC (1*PA_USEC_PER_SEC)
 #define DEFAULT_ADJUST_TOLERANCE (5*PA_USEC_PER_MSEC)
+
+/* Rate control, see time_callback(). An offset from the target alignment
+ * is corrected within about RATE_CORRECTION_USEC, the measurements are
+ * smoothed over RATE_SMOOTH_USEC and the rate stays within RATE_MAX_RATIO
+ * of the capture rate. */
+#define RATE_CORRECTION_USEC (10*PA_USEC_PER_SEC)
+#define RATE_SMOOTH_USEC (3*PA_USEC_PER_SEC)
+#define RATE_MAX_RATIO 0.01
 #define DEFAULT_SAVE_AEC false
 #define DEFAULT_AUTOLOADED false
 #define DEFAULT_USE_MASTER_FORMAT false
+#define DEFAULT_USE_WORKER_THREAD false
+#define DEFAULT_WORKER_MAX_DELAY (40*PA_USEC_PER_MSEC)
+
+#define WORKER_QUEUE_SIZE 128
+#define WORKER_STATS_INTERVAL (10*PA_USEC_PER_SEC)
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
 #define MAX_LATENCY_BLOCKS 10
 
+/* How many pieces of the queue skipped capture data is posted in */
+#define SKIP_CHUNKS_MAX 16
+
 /* Can only be used in main context */
 #define IS_ACTIVE(u) ((pa_source_get_state((u)->source) == PA_SOURCE_RUNNING) && \
-                      (pa_sink_get_state((u)->sink) == PA_SINK_RUNNING))
+                      (pa_sink_get_state((u)->reference->sink) == PA_SINK_RUNNING))
 
 /* This module creates a new (virtual) source and sink.
  *
@@ -173,11 +196,19 @@ static const pa_echo_canceller ec_table[] = {
  *    samples (because else the echo canceller does not work) or when the
  *    playback pointer drifts too far away.
  *
- * 2) periodically check the difference between capture and playback. We use a
- *    low and high watermark for adjusting the alignment. Playback should always
- *    be before capture and the difference should not be bigger than one frame
- *    size. We would ideally like to resample the sink_input but most driver
- *    don't give enough accuracy to be able to do that right now.
+ * 2) periodically check the difference between capture and playback. Playback
+ *    should always be before capture and the difference should not be bigger
+ *    than adjust_threshold. Between those, the rate of the sink input is
+ *    steered so that the difference stays halfway, which follows the drift
+ *    between the playback and capture clocks without ever dropping samples.
+ *    A resync as in 1) only happens when the difference leaves that range
+ *    anyway, e.g. after an underrun.
+ *
+ * To cancel echo in several capture sources against the same playback, only
+ * the first instance creates a sink. Others load with reference_sink= set to
+ * it and create just their source. The first instance renders the playback
+ * data once and posts the very same chunks to each of them, which align and
+ * cancel against their own source as above.
  */
 
 struct userdata;
@@ -202,6 +233,10 @@ struct snapshot {
     int64_t recv_counter;
     size_t rlen;
     size_t plen;
+
+    /* The instance the snapshot is taken for, as each counts what was
+     * sent to it */
+    struct userdata *receiver;
 };
 
 struct userdata {
@@ -232,7 +267,7 @@ struct userdata {
     bool sink_auto_desc;
     pa_sink_input *sink_input;
     pa_memblockq *sink_memblockq;
-    int64_t send_counter;          /* updated in sink IO thread */
+    int64_t send_counter;          /* updated in sink IO thread (of the reference) */
     int64_t recv_counter;
     size_t sink_skip;
 
@@ -246,6 +281,14 @@ struct userdata {
     pa_usec_t adjust_time;
     int adjust_threshold;
 
+    /* Main thread state of the rate control in time_callback(). The
+     * integral takes up the ratio between the clocks. */
+    struct {
+        pa_usec_t timestamp;
+        double diff;
+        double integral;
+    } drift;
+
     FILE *captured_file;
     FILE *played_file;
     FILE *canceled_file;
@@ -253,8 +296,39 @@ struct userdata {
 
     bool use_volume_sharing;
 
+    /* Average of thread_info.current_volume, for the canceller to read from
+     * whichever thread it runs in, and the volume it asked for last if that
+     * was from the worker thread */
+    pa_atomic_t capture_volume;
+    pa_atomic_t capture_volume_request;
+
+    /* When use_worker_thread is set, the source I/O thread just cuts the
+     * capture and playback data into blocks and queues them for the worker,
+     * which runs the canceller on them and posts the results back. */
+    pa_thread *worker_thread;
+    pa_asyncq *worker_queue;
+    pa_usec_t worker_max_delay;
+
+    /* The instance whose sink provides our playback data. That's us, unless
+     * reference_sink was given, and NULL once that instance went away. */
+    struct userdata *reference;
+    /* Instances using our sink as their reference */
+    pa_idxset *followers;
+
+    /* The same followers, for the sink I/O thread to post playback data to */
+    PA_LLIST_HEAD(struct userdata, sink_followers);
+    PA_LLIST_FIELDS(struct userdata);
+
     struct {
         pa_cvolume current_volume;
+        struct userdata *reference;
+
+        /* blocks queued to the worker and not posted to our source yet */
+        unsigned worker_pending;
+
+        pa_usec_t stats_start;
+        unsigned stats_blocks, stats_late;
+        pa_usec_t stats_total_usec, stats_max_usec;
     } thread_info;
 };
 
@@ -267,6 +341,7 @@ static const char* const valid_modargs[] = {
     "sink_name",
     "sink_properties",
     "sink_master",
+    "reference_sink",
     "adjust_time",
     "adjust_threshold",
     "format",
@@ -279,6 +354,8 @@ static const char* const valid_modargs[] = {
     "autoloaded",
     "use_volume_sharing",
     "use_master_format",
+    "use_worker_thread",
+    "worker_max_delay",
     NULL
 };
 
@@ -286,23 +363,27 @@ enum {
     SOURCE_OUTPUT_MESSAGE_POST = PA_SOURCE_OUTPUT_MESSAGE_MAX,
     SOURCE_OUTPUT_MESSAGE_REWIND,
     SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT,
-    SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME
+    SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME,
+    SOURCE_OUTPUT_MESSAGE_WORKER_DONE,
+    SOURCE_OUTPUT_MESSAGE_SET_REFERENCE
 };
 
 enum {
-    SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT
+    SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT = PA_SINK_INPUT_MESSAGE_MAX,
+    SINK_INPUT_MESSAGE_ADD_FOLLOWER,
+    SINK_INPUT_MESSAGE_REMOVE_FOLLOWER
 };
 
 enum {
     ECHO_CANCELLER_MESSAGE_SET_VOLUME,
 };
 
-static int64_t calc_diff(struct userdata *u, struct snapshot *snapshot) {
+static int64_t calc_diff(struct userdata *u, struct userdata *r, struct snapshot *snapshot) {
     int64_t diff_time, buffer_latency;
     pa_usec_t plen, rlen, source_delay, sink_delay, recv_counter, send_counter;
 
     /* get latency difference between playback and record */
-    plen = pa_bytes_to_usec(snapshot->plen, &u->sink_input->sample_spec);
+    plen = pa_bytes_to_usec(snapshot->plen, &r->sink_input->sample_spec);
     rlen = pa_bytes_to_usec(snapshot->rlen, &u->source_output->sample_spec);
     if (plen > rlen)
         buffer_latency = plen - rlen;
@@ -310,12 +391,12 @@ static int64_t calc_diff(struct userdata *u, struct snapshot *snapshot) {
         buffer_latency = 0;
 
     source_delay = pa_bytes_to_usec(snapshot->source_delay, &u->source_output->sample_spec);
-    sink_delay = pa_bytes_to_usec(snapshot->sink_delay, &u->sink_input->sample_spec);
+    sink_delay = pa_bytes_to_usec(snapshot->sink_delay, &r->sink_input->sample_spec);
     buffer_latency += source_delay + sink_delay;
 
     /* add the latency difference due to samples not yet transferred */
-    send_counter = pa_bytes_to_usec(snapshot->send_counter, &u->sink->sample_spec);
-    recv_counter = pa_bytes_to_usec(snapshot->recv_counter, &u->sink->sample_spec);
+    send_counter = pa_bytes_to_usec(snapshot->send_counter, &r->sink->sample_spec);
+    recv_counter = pa_bytes_to_usec(snapshot->recv_counter, &r->sink->sample_spec);
     if (recv_counter <= send_counter)
         buffer_latency += (int64_t) (send_counter - recv_counter);
     else
@@ -335,12 +416,59 @@ static int64_t calc_diff(struct userdata *u, struct snapshot *snapshot) {
     return diff_time;
 }
 
+/* Called from main context. Forget the clock ratio learned so far, e.g.
+ * because one of the devices changed. */
+static void reset_rate_control(struct userdata *u) {
+    u->drift.timestamp = 0;
+    u->drift.integral = 0;
+}
+
+/* Called from main context. Returns the sink input rate that moves the
+ * difference between capture and playback to target_time. Like in
+ * module-loopback, a PI controller does that, where ki = kp²/4 keeps it
+ * critically damped. */
+static uint32_t steer_rate(struct userdata *u, int64_t diff_time, int64_t target_time, uint32_t base_rate, pa_usec_t now) {
+    double dt, error, kp, ki, limit, correction;
+
+    kp = (double) PA_USEC_PER_SEC / (double) RATE_CORRECTION_USEC;
+    ki = kp * kp / 4;
+
+    if (u->drift.timestamp == 0 || now <= u->drift.timestamp) {
+        /* Start over from the clock ratio learned so far */
+        u->drift.timestamp = now;
+        u->drift.diff = (double) diff_time;
+        correction = ki * u->drift.integral;
+    } else {
+        dt = (double) (now - u->drift.timestamp);
+        u->drift.timestamp = now;
+
+        /* The snapshots jitter with the scheduling of both IO threads */
+        u->drift.diff += ((double) diff_time - u->drift.diff) * dt / (dt + (double) RATE_SMOOTH_USEC);
+
+        error = (u->drift.diff - (double) target_time) / PA_USEC_PER_SEC;
+        dt /= PA_USEC_PER_SEC;
+
+        u->drift.integral += error * dt;
+
+        /* Don't let the integral wind up beyond what the rate limit allows */
+        limit = RATE_MAX_RATIO / ki;
+        u->drift.integral = PA_CLAMP(u->drift.integral, -limit, limit);
+
+        /* A faster sink input puts more playback ahead of the capture,
+         * which makes the difference smaller */
+        correction = kp * error + ki * u->drift.integral;
+    }
+
+    correction = PA_CLAMP(correction, -RATE_MAX_RATIO, RATE_MAX_RATIO);
+
+    return (uint32_t) lrint(base_rate * (1.0 + correction));
+}
+
 /* Called from main context */
 static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
     struct userdata *u = userdata;
     uint32_t old_rate, base_rate, new_rate;
     int64_t diff_time;
-    /*size_t fs*/
     struct snapshot latency_snapshot;
 
     pa_assert(u);
@@ -348,48 +476,39 @@ static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct tim
     pa_assert(u->time_event == e);
     pa_assert_ctl_context();
 
-    if (!IS_ACTIVE(u))
+    if (!u->reference || !IS_ACTIVE(u)) {
+        u->drift.timestamp = 0;
         return;
+    }
 
     /* update our snapshots */
+    latency_snapshot.receiver = u;
     pa_asyncmsgq_send(u->source_output->source->asyncmsgq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT, &latency_snapshot, 0, NULL);
-    pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT, &latency_snapshot, 0, NULL);
+    pa_asyncmsgq_send(u->reference->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->reference->sink_input), SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT, &latency_snapshot, 0, NULL);
 
     /* calculate drift between capture and playback */
-    diff_time = calc_diff(u, &latency_snapshot);
+    diff_time = calc_diff(u, u->reference, &latency_snapshot);
 
-    /*fs = pa_frame_size(&u->source_output->sample_spec);*/
-    old_rate = u->sink_input->sample_spec.rate;
+    old_rate = u->reference->sink_input->sample_spec.rate;
     base_rate = u->source_output->sample_spec.rate;
 
-    if (diff_time < 0) {
-        /* recording before playback, we need to adjust quickly. The echo
-         * canceller does not work in this case. */
+    if (diff_time < 0 || diff_time > u->adjust_threshold) {
+        /* Recording before playback, which the echo canceller can't work
+         * with, or playback way ahead, e.g. after an underrun. Both are
+         * beyond what the rate can correct in time, resync. The rate
+         * control starts again from the next snapshot, after the jump. */
         pa_asyncmsgq_post(u->asyncmsgq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME,
             NULL, diff_time, NULL, NULL);
-        /*new_rate = base_rate - ((pa_usec_to_bytes(-diff_time, &u->source_output->sample_spec) / fs) * PA_USEC_PER_SEC) / u->adjust_time;*/
-        new_rate = base_rate;
-    }
-    else {
-        if (diff_time > u->adjust_threshold) {
-            /* diff too big, quickly adjust */
-            pa_asyncmsgq_post(u->asyncmsgq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME,
-                NULL, diff_time, NULL, NULL);
-        }
-
-        /* recording behind playback, we need to slowly adjust the rate to match */
-        /*new_rate = base_rate + ((pa_usec_to_bytes(diff_time, &u->source_output->sample_spec) / fs) * PA_USEC_PER_SEC) / u->adjust_time;*/
-
-        /* assume equal samplerates for now */
-        new_rate = base_rate;
-    }
-
-    /* make sure we don't make too big adjustments because that sounds horrible */
-    if (new_rate > base_rate * 1.1 || new_rate < base_rate * 0.9)
-        new_rate = base_rate;
+        u->drift.timestamp = 0;
+        new_rate = old_rate;
+    } else
+        /* Keep playback halfway between capture and adjust_threshold
+         * ahead of it, following the drift of the clocks */
+        new_rate = steer_rate(u, diff_time, u->adjust_threshold / 2, base_rate, latency_snapshot.source_now);
 
-    if (new_rate != old_rate) {
-        pa_log_info("Old rate %lu Hz, new rate %lu Hz", (unsigned long) old_rate, (unsigned long) new_rate);
+    /* The rate of a shared reference is not ours to change */
+    if (new_rate != old_rate && u->reference == u) {
+        pa_log_debug("Old rate %lu Hz, new rate %lu Hz", (unsigned long) old_rate, (unsigned long) new_rate);
 
         pa_sink_input_set_rate(u->sink_input, new_rate);
     }
@@ -421,12 +540,16 @@ static int source_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t
                 /* Add the latency internal to our source output on top */
                 pa_bytes_to_usec(pa_memblockq_get_length(u->source_output->thread_info.delay_memblockq), &u->source_output->source->sample_spec) +
                 /* and the buffering we do on the source */
-                pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec);
+                pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec) +
+                /* and whatever the worker thread has yet to give back */
+                pa_bytes_to_usec((uint64_t) u->thread_info.worker_pending * u->source_output_blocksize,
+                                 &u->source_output->source->sample_spec);
 
             return 0;
 
         case PA_SOURCE_MESSAGE_SET_VOLUME_SYNCED:
             u->thread_info.current_volume = u->source->reference_volume;
+            pa_atomic_store(&u->capture_volume, (int) pa_cvolume_avg(&u->thread_info.current_volume));
             break;
     }
 
@@ -490,7 +613,7 @@ static int source_set_state_cb(pa_source *s, pa_source_state_t state) {
 
     if (state == PA_SOURCE_RUNNING) {
         /* restart timer when both sink and source are active */
-        if ((pa_sink_get_state(u->sink) == PA_SINK_RUNNING) && u->adjust_time)
+        if (u->reference && (pa_sink_get_state(u->reference->sink) == PA_SINK_RUNNING) && u->adjust_time)
             pa_core_rttime_restart(u->core, u->time_event, pa_rtclock_now() + u->adjust_time);
 
         pa_atomic_store(&u->request_resync, 1);
@@ -514,11 +637,23 @@ static int sink_set_state_cb(pa_sink *s, pa_sink_state_t state) {
         return 0;
 
     if (state == PA_SINK_RUNNING) {
+        struct userdata *f;
+        uint32_t idx;
+
         /* restart timer when both sink and source are active */
         if ((pa_source_get_state(u->source) == PA_SOURCE_RUNNING) && u->adjust_time)
             pa_core_rttime_restart(u->core, u->time_event, pa_rtclock_now() + u->adjust_time);
 
         pa_atomic_store(&u->request_resync, 1);
+
+        /* and the same for those sharing the sink */
+        PA_IDXSET_FOREACH(f, u->followers, idx) {
+            if ((pa_source_get_state(f->source) == PA_SOURCE_RUNNING) && f->adjust_time)
+                pa_core_rttime_restart(f->core, f->time_event, pa_rtclock_now() + f->adjust_time);
+
+            pa_atomic_store(&f->request_resync, 1);
+        }
+
         pa_sink_input_cork(u->sink_input, false);
     } else if (state == PA_SINK_SUSPENDED) {
         pa_sink_input_cork(u->sink_input, true);
@@ -667,15 +802,19 @@ static void sink_set_mute_cb(pa_sink *s) {
 
 /* Called from source I/O thread context. */
 static void apply_diff_time(struct userdata *u, int64_t diff_time) {
+    struct userdata *r = u->thread_info.reference;
     int64_t diff;
 
+    if (!r)
+        return;
+
     if (diff_time < 0) {
-        diff = pa_usec_to_bytes(-diff_time, &u->sink_input->sample_spec);
+        diff = pa_usec_to_bytes(-diff_time, &r->sink_input->sample_spec);
 
         if (diff > 0) {
             /* add some extra safety samples to compensate for jitter in the
              * timings */
-            diff += 10 * pa_frame_size (&u->sink_input->sample_spec);
+            diff += 10 * pa_frame_size (&r->sink_input->sample_spec);
 
             pa_log("Playback after capture (%lld), drop sink %lld", (long long) diff_time, (long long) diff);
 
@@ -696,14 +835,19 @@ static void apply_diff_time(struct userdata *u, int64_t diff_time) {
 
 /* Called from source I/O thread context. */
 static void do_resync(struct userdata *u) {
+    struct userdata *r = u->thread_info.reference;
     int64_t diff_time;
     struct snapshot latency_snapshot;
 
+    if (!r)
+        return;
+
     pa_log("Doing resync");
 
     /* update our snapshot */
     /* 1. Get sink input latency snapshot, might cause buffers to be sent to source thread */
-    pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT, &latency_snapshot, 0, NULL);
+    latency_snapshot.receiver = u;
+    pa_asyncmsgq_send(r->sink_input->sink->asyncmsgq, PA_MSGOBJECT(r->sink_input), SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT, &latency_snapshot, 0, NULL);
     /* 2. Pick up any in-flight buffers (and discard if needed) */
     while (pa_asyncmsgq_process_one(u->asyncmsgq))
         ;
@@ -711,7 +855,7 @@ static void do_resync(struct userdata *u) {
     source_output_snapshot_within_thread(u, &latency_snapshot);
 
     /* calculate drift between capture and playback */
-    diff_time = calc_diff(u, &latency_snapshot);
+    diff_time = calc_diff(u, r, &latency_snapshot);
 
     /* and adjust for the drift */
     apply_diff_time(u, diff_time);
@@ -813,6 +957,236 @@ static void do_push_drift_comp(struct userdata *u) {
     }
 }
 
+/* Runs the canceller on one block each of capture and playback data, and
+ * returns the result in a new memblock.
+ *
+ * Called from source I/O thread context, or from the worker thread if there
+ * is one. */
+static void cancel_block(struct userdata *u, const pa_memchunk *rchunk, const pa_memchunk *pchunk, pa_memchunk *cchunk) {
+    uint8_t *rdata, *pdata, *cdata;
+    int unused PA_GCC_UNUSED;
+
+    rdata = pa_memblock_acquire_chunk(rchunk);
+    pdata = pa_memblock_acquire_chunk(pchunk);
+
+    cchunk->index = 0;
+    cchunk->length = u->source_blocksize;
+    cchunk->memblock = pa_memblock_new(u->source->core->mempool, cchunk->length);
+    cdata = pa_memblock_acquire(cchunk->memblock);
+
+    if (u->save_aec) {
+        if (u->captured_file)
+            unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
+        if (u->played_file)
+            unused = fwrite(pdata, 1, u->sink_blocksize, u->played_file);
+    }
+
+    /* perform echo cancellation */
+    u->ec->run(u->ec, rdata, pdata, cdata);
+
+    if (u->save_aec) {
+        if (u->canceled_file)
+            unused = fwrite(cdata, 1, u->source_blocksize, u->canceled_file);
+    }
+
+    pa_memblock_release(cchunk->memblock);
+    pa_memblock_release(pchunk->memblock);
+    pa_memblock_release(rchunk->memblock);
+}
+
+enum {
+    WORKER_ITEM_CANCEL,   /* run the canceller on the block */
+    WORKER_ITEM_PASS,     /* hand the capture block back as is */
+    WORKER_ITEM_QUIT
+};
+
+enum {
+    WORKER_RESULT_CANCELED,
+    WORKER_RESULT_PASSED,
+    WORKER_RESULT_LATE    /* waited longer than worker_max_delay, dropped */
+};
+
+struct worker_item {
+    int type;
+    pa_memchunk rchunk, pchunk;
+    pa_usec_t queued_at;
+};
+
+static void worker_item_free(struct worker_item *i) {
+    if (i->rchunk.memblock)
+        pa_memblock_unref(i->rchunk.memblock);
+    if (i->pchunk.memblock)
+        pa_memblock_unref(i->pchunk.memblock);
+
+    pa_xfree(i);
+}
+
+static void worker_thread_func(void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_log_debug("Echo canceller worker thread starting up");
+
+    for (;;) {
+        struct worker_item *i;
+        pa_memchunk cchunk;
+        pa_usec_t start;
+        int result;
+
+        pa_assert_se(i = pa_asyncq_pop(u->worker_queue, true));
+
+        if (i->type == WORKER_ITEM_QUIT) {
+            worker_item_free(i);
+            break;
+        }
+
+        start = pa_rtclock_now();
+
+        if (i->type == WORKER_ITEM_PASS) {
+            cchunk = i->rchunk;
+            pa_memblock_ref(cchunk.memblock);
+            result = WORKER_RESULT_PASSED;
+        } else if (start > i->queued_at + u->worker_max_delay) {
+            /* We fell behind. Skip cancellation so that the delay we add
+             * stays bounded; the canceller will have to cope with the gap. */
+            cchunk.index = 0;
+            cchunk.length = u->source_blocksize;
+            cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
+            pa_silence_memchunk(&cchunk, &u->source->sample_spec);
+            result = WORKER_RESULT_LATE;
+        } else {
+            cancel_block(u, &i->rchunk, &i->pchunk, &cchunk);
+            result = WORKER_RESULT_CANCELED;
+        }
+
+        pa_asyncmsgq_post(u->asyncmsgq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_WORKER_DONE,
+                          PA_INT_TO_PTR(result), (int64_t) (pa_rtclock_now() - start), &cchunk, NULL);
+        pa_memblock_unref(cchunk.memblock);
+
+        worker_item_free(i);
+    }
+
+    pa_log_debug("Echo canceller worker thread shutting down");
+}
+
+/* Called from main context. */
+static int worker_start(struct userdata *u) {
+    pa_assert(!u->worker_thread);
+
+    u->worker_queue = pa_asyncq_new(WORKER_QUEUE_SIZE);
+
+    if (!(u->worker_thread = pa_thread_new("echo-cancel", worker_thread_func, u))) {
+        pa_log("Failed to create echo canceller worker thread.");
+        pa_asyncq_free(u->worker_queue, NULL);
+        u->worker_queue = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Called from main context, once nothing pushes to the worker any more. */
+static void worker_stop(struct userdata *u) {
+    struct worker_item *i;
+
+    if (!u->worker_queue)
+        return;
+
+    if (u->worker_thread) {
+        i = pa_xnew0(struct worker_item, 1);
+        i->type = WORKER_ITEM_QUIT;
+        pa_asyncq_push(u->worker_queue, i, true);
+
+        pa_thread_free(u->worker_thread);
+        u->worker_thread = NULL;
+    }
+
+    while ((i = pa_asyncq_pop(u->worker_queue, false)))
+        worker_item_free(i);
+
+    pa_asyncq_free(u->worker_queue, NULL);
+    u->worker_queue = NULL;
+}
+
+/* Takes references to the chunks.
+ *
+ * Called from source I/O thread context. */
+static void worker_push(struct userdata *u, int type, const pa_memchunk *rchunk, const pa_memchunk *pchunk) {
+    struct worker_item *i;
+
+    i = pa_xnew0(struct worker_item, 1);
+    i->type = type;
+    i->queued_at = pa_rtclock_now();
+
+    i->rchunk = *rchunk;
+    pa_memblock_ref(i->rchunk.memblock);
+
+    if (pchunk) {
+        i->pchunk = *pchunk;
+        pa_memblock_ref(i->pchunk.memblock);
+    }
+
+    u->thread_info.worker_pending++;
+
+    /* The worker drops whatever waited too long, so it's hard to get this
+     * full for real */
+    pa_asyncq_push(u->worker_queue, i, true);
+}
+
+/* Called from source I/O thread context. */
+static void worker_done(struct userdata *u, int result, pa_usec_t processing_usec, const pa_memchunk *chunk) {
+    pa_usec_t now;
+    pa_volume_t v;
+
+    pa_assert(u->thread_info.worker_pending > 0);
+    u->thread_info.worker_pending--;
+
+    /* Pass on a volume change the canceller asked for, the same way as if it
+     * had run in this thread */
+    v = (pa_volume_t) pa_atomic_load(&u->capture_volume_request);
+    if (v != PA_VOLUME_INVALID && pa_atomic_cmpxchg(&u->capture_volume_request, (int) v, (int) PA_VOLUME_INVALID))
+        pa_echo_canceller_set_capture_volume(u->ec, v);
+
+    if (result == WORKER_RESULT_CANCELED) {
+        u->thread_info.stats_blocks++;
+        u->thread_info.stats_total_usec += processing_usec;
+        if (processing_usec > u->thread_info.stats_max_usec)
+            u->thread_info.stats_max_usec = processing_usec;
+    } else if (result == WORKER_RESULT_LATE)
+        u->thread_info.stats_late++;
+
+    now = pa_rtclock_now();
+    if (u->thread_info.stats_start == 0)
+        u->thread_info.stats_start = now;
+    else if (now >= u->thread_info.stats_start + WORKER_STATS_INTERVAL) {
+        if (u->thread_info.stats_blocks > 0 || u->thread_info.stats_late > 0)
+            pa_log_debug("Echo canceller worker: %u blocks of %0.2f ms, processing took %0.2f ms on average, "
+                         "%0.2f ms at most, %u blocks late",
+                         u->thread_info.stats_blocks,
+                         (double) pa_bytes_to_usec(u->source_blocksize, &u->source->sample_spec) / PA_USEC_PER_MSEC,
+                         (double) u->thread_info.stats_total_usec / PA_MAX(u->thread_info.stats_blocks, 1U) / PA_USEC_PER_MSEC,
+                         (double) u->thread_info.stats_max_usec / PA_USEC_PER_MSEC,
+                         u->thread_info.stats_late);
+
+        u->thread_info.stats_start = now;
+        u->thread_info.stats_blocks = u->thread_info.stats_late = 0;
+        u->thread_info.stats_total_usec = u->thread_info.stats_max_usec = 0;
+    }
+
+    if (PA_SOURCE_IS_LINKED(u->source->thread_info.state))
+        pa_source_post(u->source, chunk);
+}
+
+/* Forwards capture data to the virtual source without cancelling echo in it.
+ * With a worker, this goes through it to keep things in order.
+ *
+ * Called from source I/O thread context. */
+static void post_uncanceled(struct userdata *u, const pa_memchunk *chunk) {
+    if (u->worker_queue)
+        worker_push(u, WORKER_ITEM_PASS, chunk, NULL);
+    else
+        pa_source_post(u->source, chunk);
+}
+
 /* This one's simpler than the drift compensation case -- we just iterate over
  * the capture buffer, and pass the canceller blocksize bytes of playback and
  * capture data. If playback is currently inactive, we just push silence.
@@ -821,8 +1195,6 @@ static void do_push_drift_comp(struct userdata *u) {
 static void do_push(struct userdata *u) {
     size_t rlen, plen;
     pa_memchunk rchunk, pchunk, cchunk;
-    uint8_t *rdata, *pdata, *cdata;
-    int unused PA_GCC_UNUSED;
 
     rlen = pa_memblockq_get_length(u->source_memblockq);
     plen = pa_memblockq_get_length(u->sink_memblockq);
@@ -837,34 +1209,10 @@ static void do_push(struct userdata *u) {
         if (plen < u->sink_blocksize)
             pa_memblockq_seek(u->sink_memblockq, u->sink_blocksize - plen, PA_SEEK_RELATIVE, true);
 
-        rdata = pa_memblock_acquire(rchunk.memblock);
-        rdata += rchunk.index;
-        pdata = pa_memblock_acquire(pchunk.memblock);
-        pdata += pchunk.index;
-
-        cchunk.index = 0;
-        cchunk.length = u->source_blocksize;
-        cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
-        cdata = pa_memblock_acquire(cchunk.memblock);
-
-        if (u->save_aec) {
-            if (u->captured_file)
-                unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
-            if (u->played_file)
-                unused = fwrite(pdata, 1, u->sink_blocksize, u->played_file);
-        }
-
-        /* perform echo cancellation */
-        u->ec->run(u->ec, rdata, pdata, cdata);
-
-        if (u->save_aec) {
-            if (u->canceled_file)
-                unused = fwrite(cdata, 1, u->source_blocksize, u->canceled_file);
-        }
-
-        pa_memblock_release(cchunk.memblock);
-        pa_memblock_release(pchunk.memblock);
-        pa_memblock_release(rchunk.memblock);
+        if (u->worker_queue)
+            worker_push(u, WORKER_ITEM_CANCEL, &rchunk, &pchunk);
+        else
+            cancel_block(u, &rchunk, &pchunk, &cchunk);
 
         /* drop consumed source samples */
         pa_memblockq_drop(u->source_memblockq, u->source_output_blocksize);
@@ -880,6 +1228,9 @@ static void do_push(struct userdata *u) {
         else
             plen = 0;
 
+        if (u->worker_queue)
+            continue;
+
         /* forward the (echo-canceled) data to the virtual source */
         pa_source_post(u->source, &cchunk);
         pa_memblock_unref(cchunk.memblock);
@@ -890,7 +1241,6 @@ static void do_push(struct userdata *u) {
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
     size_t rlen, plen, to_skip;
-    pa_memchunk rchunk;
 
     pa_source_output_assert_ref(o);
     pa_source_output_assert_io_context(o);
@@ -933,10 +1283,18 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
         to_skip -= to_skip % u->source_output_blocksize;
 
         if (to_skip) {
-            pa_memblockq_peek_fixed_size(u->source_memblockq, to_skip, &rchunk);
-            pa_source_post(u->source, &rchunk);
+            pa_memchunk chunks[SKIP_CHUNKS_MAX];
+            unsigned n, j;
+
+            /* The skipped samples are passed on as they are, so there is
+             * no need to copy them into one block first */
+            n = pa_memblockq_peek_fixed_size_chunks(u->source_memblockq, to_skip, chunks, SKIP_CHUNKS_MAX);
+
+            for (j = 0; j < n; j++) {
+                post_uncanceled(u, &chunks[j]);
+                pa_memblock_unref(chunks[j].memblock);
+            }
 
-            pa_memblock_unref(rchunk.memblock);
             pa_memblockq_drop(u->source_memblockq, to_skip);
 
             rlen -= to_skip;
@@ -969,7 +1327,7 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
 
 /* Called from sink I/O thread context. */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
-    struct userdata *u;
+    struct userdata *u, *f;
 
     pa_sink_input_assert_ref(i);
     pa_assert(chunk);
@@ -986,6 +1344,9 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     if (i->thread_info.underrun_for > 0) {
         pa_log_debug("Handling end of underrun.");
         pa_atomic_store(&u->request_resync, 1);
+
+        PA_LLIST_FOREACH(f, u->sink_followers)
+            pa_atomic_store(&f->request_resync, 1);
     }
 
     /* let source thread handle the chunk. pass the sample count as well so that
@@ -994,6 +1355,13 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
         NULL, 0, chunk, NULL);
     u->send_counter += chunk->length;
 
+    /* Those sharing our sink get the same data */
+    PA_LLIST_FOREACH(f, u->sink_followers) {
+        pa_asyncmsgq_post(f->asyncmsgq, PA_MSGOBJECT(f->source_output), SOURCE_OUTPUT_MESSAGE_POST,
+            NULL, 0, chunk, NULL);
+        f->send_counter += chunk->length;
+    }
+
     return 0;
 }
 
@@ -1023,7 +1391,7 @@ static void source_output_process_rewind_cb(pa_source_output *o, size_t nbytes)
 
 /* Called from sink I/O thread context. */
 static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
-    struct userdata *u;
+    struct userdata *u, *f;
 
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
@@ -1038,6 +1406,11 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
 
     pa_asyncmsgq_post(u->asyncmsgq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_REWIND, NULL, (int64_t) nbytes, NULL, NULL);
     u->send_counter -= nbytes;
+
+    PA_LLIST_FOREACH(f, u->sink_followers) {
+        pa_asyncmsgq_post(f->asyncmsgq, PA_MSGOBJECT(f->source_output), SOURCE_OUTPUT_MESSAGE_REWIND, NULL, (int64_t) nbytes, NULL, NULL);
+        f->send_counter -= nbytes;
+    }
 }
 
 /* Called from source I/O thread context. */
@@ -1106,6 +1479,16 @@ static int source_output_process_msg_cb(pa_msgobject *obj, int code, void *data,
             apply_diff_time(u, offset);
             return 0;
 
+        case SOURCE_OUTPUT_MESSAGE_WORKER_DONE:
+            pa_source_output_assert_io_context(u->source_output);
+
+            worker_done(u, PA_PTR_TO_INT(data), (pa_usec_t) offset, chunk);
+            return 0;
+
+        case SOURCE_OUTPUT_MESSAGE_SET_REFERENCE:
+            u->thread_info.reference = data;
+            return 0;
+
     }
 
     return pa_source_output_process_msg(obj, code, data, offset, chunk);
@@ -1133,9 +1516,17 @@ static int sink_input_process_msg_cb(pa_msgobject *obj, int code, void *data, in
             snapshot->sink_now = now;
             snapshot->sink_latency = latency;
             snapshot->sink_delay = delay;
-            snapshot->send_counter = u->send_counter;
+            snapshot->send_counter = snapshot->receiver->send_counter;
             return 0;
         }
+
+        case SINK_INPUT_MESSAGE_ADD_FOLLOWER:
+            PA_LLIST_PREPEND(struct userdata, u->sink_followers, (struct userdata *) data);
+            return 0;
+
+        case SINK_INPUT_MESSAGE_REMOVE_FOLLOWER:
+            PA_LLIST_REMOVE(struct userdata, u->sink_followers, (struct userdata *) data);
+            return 0;
     }
 
     return pa_sink_input_process_msg(obj, code, data, offset, chunk);
@@ -1378,6 +1769,61 @@ static void sink_input_state_change_cb(pa_sink_input *i, pa_sink_input_state_t s
     pa_log_debug("Sink input %d state %d", i->index, state);
 }
 
+/* Starts posting the playback data of our sink to f as well.
+ *
+ * Called from main context. */
+static void add_follower(struct userdata *u, struct userdata *f) {
+    pa_assert(u->reference == u);
+    pa_assert(f->reference == u);
+
+    pa_idxset_put(u->followers, f, NULL);
+
+    if (PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(u->sink_input)) && u->sink_input->sink)
+        pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_ADD_FOLLOWER, f, 0, NULL);
+    else
+        PA_LLIST_PREPEND(struct userdata, u->sink_followers, f);
+}
+
+/* Detaches f from the instance it takes its playback data from. f gets no
+ * more playback data after this, and stops adjusting its alignment.
+ *
+ * Called from main context. */
+static void remove_follower(struct userdata *f) {
+    struct userdata *u = f->reference;
+
+    if (!u || u == f)
+        return;
+
+    if (u->sink_input && PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(u->sink_input)) && u->sink_input->sink)
+        pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_REMOVE_FOLLOWER, f, 0, NULL);
+    else
+        PA_LLIST_REMOVE(struct userdata, u->sink_followers, f);
+
+    pa_idxset_remove_by_data(u->followers, f, NULL);
+
+    if (f->source_output && PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(f->source_output)) && f->source_output->source)
+        pa_asyncmsgq_send(f->source_output->source->asyncmsgq, PA_MSGOBJECT(f->source_output), SOURCE_OUTPUT_MESSAGE_SET_REFERENCE, NULL, 0, NULL);
+    else
+        f->thread_info.reference = NULL;
+
+    f->reference = NULL;
+}
+
+/* Called from main context, before our sink goes away. */
+static void drop_followers(struct userdata *u) {
+    struct userdata *f;
+
+    if (!u->followers)
+        return;
+
+    while ((f = pa_idxset_first(u->followers, NULL))) {
+        pa_log_info("Reference sink %s going away, unloading module #%u too.", u->sink->name, f->module->index);
+
+        remove_follower(f);
+        pa_module_unload_request(f->module, true);
+    }
+}
+
 /* Called from main context. */
 static void source_output_kill_cb(pa_source_output *o) {
     struct userdata *u;
@@ -1388,12 +1834,15 @@ static void source_output_kill_cb(pa_source_output *o) {
 
     u->dead = true;
 
+    remove_follower(u);
+
     /* The order here matters! We first kill the source so that streams can
      * properly be moved away while the source output is still connected to
      * the master. */
     pa_source_output_cork(u->source_output, true);
     pa_source_unlink(u->source);
     pa_source_output_unlink(u->source_output);
+    worker_stop(u);
 
     pa_source_output_unref(u->source_output);
     u->source_output = NULL;
@@ -1415,6 +1864,8 @@ static void sink_input_kill_cb(pa_sink_input *i) {
 
     u->dead = true;
 
+    drop_followers(u);
+
     /* The order here matters! We first kill the sink so that streams
      * can properly be moved away while the sink input is still connected
      * to the master. */
@@ -1444,7 +1895,7 @@ static bool source_output_may_move_to_cb(pa_source_output *o, pa_source *dest) {
     if (u->dead)
         return false;
 
-    return (u->source != dest) && (u->sink != dest->monitor_of);
+    return (u->source != dest) && (!u->reference || u->reference->sink != dest->monitor_of);
 }
 
 /* Called from main context */
@@ -1474,19 +1925,23 @@ static void source_output_moving_cb(pa_source_output *o, pa_source *dest) {
     } else
         pa_source_set_asyncmsgq(u->source, NULL);
 
+    /* A different clock to follow */
+    reset_rate_control(u);
+
     if (u->source_auto_desc && dest) {
+        pa_sink_input *i = u->reference ? u->reference->sink_input : NULL;
         const char *y, *z;
         pa_proplist *pl;
 
         pl = pa_proplist_new();
-        if (u->sink_input->sink) {
-            pa_proplist_sets(pl, PA_PROP_DEVICE_MASTER_DEVICE, u->sink_input->sink->name);
-            y = pa_proplist_gets(u->sink_input->sink->proplist, PA_PROP_DEVICE_DESCRIPTION);
+        if (i && i->sink) {
+            pa_proplist_sets(pl, PA_PROP_DEVICE_MASTER_DEVICE, i->sink->name);
+            y = pa_proplist_gets(i->sink->proplist, PA_PROP_DEVICE_DESCRIPTION);
         } else
             y = "<unknown>"; /* Probably in the middle of a move */
         z = pa_proplist_gets(dest->proplist, PA_PROP_DEVICE_DESCRIPTION);
         pa_proplist_setf(pl, PA_PROP_DEVICE_DESCRIPTION, "%s (echo cancelled with %s)", z ? z : dest->name,
-                y ? y : u->sink_input->sink->name);
+                y ? y : i->sink->name);
 
         pa_source_update_proplist(u->source, PA_UPDATE_REPLACE, pl);
         pa_proplist_free(pl);
@@ -1506,6 +1961,8 @@ static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
     } else
         pa_sink_set_asyncmsgq(u->sink, NULL);
 
+    reset_rate_control(u);
+
     if (u->sink_auto_desc && dest) {
         const char *y, *z;
         pa_proplist *pl;
@@ -1579,19 +2036,28 @@ static int canceller_process_msg_cb(pa_msgobject *o, int code, void *userdata, i
     return 0;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread or worker thread context. */
 pa_volume_t pa_echo_canceller_get_capture_volume(pa_echo_canceller *ec) {
 #ifndef ECHO_CANCEL_TEST
-    return pa_cvolume_avg(&ec->msg->userdata->thread_info.current_volume);
+    return (pa_volume_t) pa_atomic_load(&ec->msg->userdata->capture_volume);
 #else
     return PA_VOLUME_NORM;
 #endif
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread or worker thread context. */
 void pa_echo_canceller_set_capture_volume(pa_echo_canceller *ec, pa_volume_t v) {
 #ifndef ECHO_CANCEL_TEST
-    if (pa_cvolume_avg(&ec->msg->userdata->thread_info.current_volume) != v) {
+    struct userdata *u = ec->msg->userdata;
+
+    /* The worker has no message queue to the main thread, so the source I/O
+     * thread picks this up with the next block it gets back */
+    if (u->worker_thread && pa_thread_self() == u->worker_thread) {
+        pa_atomic_store(&u->capture_volume_request, (int) v);
+        return;
+    }
+
+    if (pa_cvolume_avg(&u->thread_info.current_volume) != v) {
         pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME, PA_UINT_TO_PTR(v),
                 0, NULL, NULL);
     }
@@ -1671,6 +2137,110 @@ fail:
     return -1;
 }
 
+/* Creates our sink and the sink input feeding the master sink, unless we
+ * take our playback reference from another instance.
+ *
+ * Called from main context. */
+static int create_sink(struct userdata *u, pa_modargs *ma, pa_source *source_master, pa_sink *sink_master,
+                       const pa_sample_spec *sink_ss, const pa_channel_map *sink_map, bool autoloaded) {
+    pa_sink_input_new_data sink_input_data;
+    pa_sink_new_data sink_data;
+
+    /* Create sink */
+    pa_sink_new_data_init(&sink_data);
+    sink_data.driver = __FILE__;
+    sink_data.module = u->module;
+    if (!(sink_data.name = pa_xstrdup(pa_modargs_get_value(ma, "sink_name", NULL))))
+        sink_data.name = pa_sprintf_malloc("%s.echo-cancel", sink_master->name);
+    pa_sink_new_data_set_sample_spec(&sink_data, sink_ss);
+    pa_sink_new_data_set_channel_map(&sink_data, sink_map);
+    pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, sink_master->name);
+    pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
+    if (!autoloaded)
+        pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_INTENDED_ROLES, "phone");
+
+    if (pa_modargs_get_proplist(ma, "sink_properties", sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
+        pa_log("Invalid properties");
+        pa_sink_new_data_done(&sink_data);
+        return -1;
+    }
+
+    if ((u->sink_auto_desc = !pa_proplist_contains(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION))) {
+        const char *y, *z;
+
+        y = pa_proplist_gets(source_master->proplist, PA_PROP_DEVICE_DESCRIPTION);
+        z = pa_proplist_gets(sink_master->proplist, PA_PROP_DEVICE_DESCRIPTION);
+        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "%s (echo cancelled with %s)",
+                z ? z : sink_master->name, y ? y : source_master->name);
+    }
+
+    u->sink = pa_sink_new(u->core, &sink_data, (sink_master->flags & (PA_SINK_LATENCY | PA_SINK_DYNAMIC_LATENCY))
+                                               | (u->use_volume_sharing ? PA_SINK_SHARE_VOLUME_WITH_MASTER : 0));
+    pa_sink_new_data_done(&sink_data);
+
+    if (!u->sink) {
+        pa_log("Failed to create sink.");
+        return -1;
+    }
+
+    u->sink->parent.process_msg = sink_process_msg_cb;
+    u->sink->set_state = sink_set_state_cb;
+    u->sink->update_requested_latency = sink_update_requested_latency_cb;
+    u->sink->request_rewind = sink_request_rewind_cb;
+    pa_sink_set_set_mute_callback(u->sink, sink_set_mute_cb);
+    if (!u->use_volume_sharing) {
+        pa_sink_set_set_volume_callback(u->sink, sink_set_volume_cb);
+        pa_sink_enable_decibel_volume(u->sink, true);
+    }
+    u->sink->userdata = u;
+
+    pa_sink_set_asyncmsgq(u->sink, sink_master->asyncmsgq);
+
+    /* Create sink input */
+    pa_sink_input_new_data_init(&sink_input_data);
+    sink_input_data.driver = __FILE__;
+    sink_input_data.module = u->module;
+    pa_sink_input_new_data_set_sink(&sink_input_data, sink_master, false);
+    sink_input_data.origin_sink = u->sink;
+    pa_proplist_sets(sink_input_data.proplist, PA_PROP_MEDIA_NAME, "Echo-Cancel Sink Stream");
+    pa_proplist_sets(sink_input_data.proplist, PA_PROP_MEDIA_ROLE, "filter");
+    pa_sink_input_new_data_set_sample_spec(&sink_input_data, sink_ss);
+    pa_sink_input_new_data_set_channel_map(&sink_input_data, sink_map);
+    sink_input_data.flags = PA_SINK_INPUT_VARIABLE_RATE | PA_SINK_INPUT_START_CORKED;
+
+    if (autoloaded)
+        sink_input_data.flags |= PA_SINK_INPUT_DONT_MOVE;
+
+    pa_sink_input_new(&u->sink_input, u->core, &sink_input_data);
+    pa_sink_input_new_data_done(&sink_input_data);
+
+    if (!u->sink_input)
+        return -1;
+
+    u->sink_input->parent.process_msg = sink_input_process_msg_cb;
+    u->sink_input->pop = sink_input_pop_cb;
+    u->sink_input->process_rewind = sink_input_process_rewind_cb;
+    u->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
+    u->sink_input->update_max_request = sink_input_update_max_request_cb;
+    u->sink_input->update_sink_requested_latency = sink_input_update_sink_requested_latency_cb;
+    u->sink_input->update_sink_latency_range = sink_input_update_sink_latency_range_cb;
+    u->sink_input->update_sink_fixed_latency = sink_input_update_sink_fixed_latency_cb;
+    u->sink_input->kill = sink_input_kill_cb;
+    u->sink_input->attach = sink_input_attach_cb;
+    u->sink_input->detach = sink_input_detach_cb;
+    u->sink_input->state_change = sink_input_state_change_cb;
+    u->sink_input->may_move_to = sink_input_may_move_to_cb;
+    u->sink_input->moving = sink_input_moving_cb;
+    if (!u->use_volume_sharing)
+        u->sink_input->volume_changed = sink_input_volume_changed_cb;
+    u->sink_input->mute_changed = sink_input_mute_changed_cb;
+    u->sink_input->userdata = u;
+
+    u->sink->input_to_master = u->sink_input;
+
+    return 0;
+}
+
 /* Called from main context. */
 int pa__init(pa_module*m) {
     struct userdata *u;
@@ -1679,11 +2249,12 @@ int pa__init(pa_module*m) {
     pa_modargs *ma;
     pa_source *source_master=NULL;
     pa_sink *sink_master=NULL;
+    const char *reference_name;
+    struct userdata *reference = NULL;
     bool autoloaded;
+    bool use_worker_thread;
     pa_source_output_new_data source_output_data;
-    pa_sink_input_new_data sink_input_data;
     pa_source_new_data source_data;
-    pa_sink_new_data sink_data;
     pa_memchunk silence;
     uint32_t temp;
     uint32_t nframes = 0;
@@ -1703,7 +2274,34 @@ int pa__init(pa_module*m) {
     }
     pa_assert(source_master);
 
-    if (!(sink_master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "sink_master", NULL), PA_NAMEREG_SINK))) {
+    if ((reference_name = pa_modargs_get_value(ma, "reference_sink", NULL))) {
+        pa_sink *s;
+
+        if (pa_modargs_get_value(ma, "sink_master", NULL) || pa_modargs_get_value(ma, "sink_name", NULL) ||
+            pa_modargs_get_value(ma, "sink_properties", NULL)) {
+            pa_log("reference_sink= can't be used together with other sink arguments");
+            goto fail;
+        }
+
+        if (!(s = pa_namereg_get(m->core, reference_name, PA_NAMEREG_SINK)) ||
+            !s->module || !pa_streq(s->module->name, m->name)) {
+            pa_log("Reference sink %s is not an echo canceller sink", reference_name);
+            goto fail;
+        }
+
+        reference = s->userdata;
+        if (reference->dead || !reference->sink_input) {
+            pa_log("Reference sink %s is going away", reference_name);
+            goto fail;
+        }
+
+        sink_master = reference->sink_input->sink;
+
+        if (source_master->monitor_of == reference->sink) {
+            pa_log("Can't cancel echo between a sink and its monitor");
+            goto fail;
+        }
+    } else if (!(sink_master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "sink_master", NULL), PA_NAMEREG_SINK))) {
         pa_log("Master sink not found");
         goto fail;
     }
@@ -1739,6 +2337,12 @@ int pa__init(pa_module*m) {
         pa_channel_map_init_auto(&sink_map, sink_ss.channels, PA_CHANNEL_MAP_DEFAULT);
     }
 
+    /* The playback data comes in whatever format the reference sink has */
+    if (reference) {
+        sink_ss = reference->sink->sample_spec;
+        sink_map = reference->sink->channel_map;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     if (!u) {
         pa_log("Failed to alloc userdata");
@@ -1749,6 +2353,8 @@ int pa__init(pa_module*m) {
     m->userdata = u;
     u->dead = false;
 
+    u->followers = pa_idxset_new(NULL, NULL);
+
     u->use_volume_sharing = true;
     if (pa_modargs_get_value_boolean(ma, "use_volume_sharing", &u->use_volume_sharing) < 0) {
         pa_log("use_volume_sharing= expects a boolean argument");
@@ -1789,6 +2395,19 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    use_worker_thread = DEFAULT_USE_WORKER_THREAD;
+    if (pa_modargs_get_value_boolean(ma, "use_worker_thread", &use_worker_thread) < 0) {
+        pa_log("use_worker_thread= expects a boolean argument");
+        goto fail;
+    }
+
+    temp = DEFAULT_WORKER_MAX_DELAY / PA_USEC_PER_MSEC;
+    if (pa_modargs_get_value_u32(ma, "worker_max_delay", &temp) < 0 || temp < 1) {
+        pa_log("Failed to parse worker_max_delay value");
+        goto fail;
+    }
+    u->worker_max_delay = temp * PA_USEC_PER_MSEC;
+
     if (init_common(ma, u, &source_ss, &source_map) < 0)
         goto fail;
 
@@ -1814,6 +2433,16 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (reference && (!pa_sample_spec_equal(&sink_ss, &reference->sink->sample_spec) ||
+                      !pa_channel_map_equal(&sink_map, &reference->sink->channel_map))) {
+        char a[PA_SAMPLE_SPEC_SNPRINT_MAX], b[PA_SAMPLE_SPEC_SNPRINT_MAX];
+
+        pa_log("The canceller needs playback data as %s, but reference sink %s has %s",
+               pa_sample_spec_snprint(a, sizeof(a), &sink_ss), reference->sink->name,
+               pa_sample_spec_snprint(b, sizeof(b), &reference->sink->sample_spec));
+        goto fail;
+    }
+
     pa_assert(source_output_ss.rate == source_ss.rate);
     pa_assert(sink_ss.rate == source_ss.rate);
 
@@ -1874,56 +2503,6 @@ int pa__init(pa_module*m) {
 
     pa_source_set_asyncmsgq(u->source, source_master->asyncmsgq);
 
-    /* Create sink */
-    pa_sink_new_data_init(&sink_data);
-    sink_data.driver = __FILE__;
-    sink_data.module = m;
-    if (!(sink_data.name = pa_xstrdup(pa_modargs_get_value(ma, "sink_name", NULL))))
-        sink_data.name = pa_sprintf_malloc("%s.echo-cancel", sink_master->name);
-    pa_sink_new_data_set_sample_spec(&sink_data, &sink_ss);
-    pa_sink_new_data_set_channel_map(&sink_data, &sink_map);
-    pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, sink_master->name);
-    pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
-    if (!autoloaded)
-        pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_INTENDED_ROLES, "phone");
-
-    if (pa_modargs_get_proplist(ma, "sink_properties", sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
-        pa_log("Invalid properties");
-        pa_sink_new_data_done(&sink_data);
-        goto fail;
-    }
-
-    if ((u->sink_auto_desc = !pa_proplist_contains(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION))) {
-        const char *y, *z;
-
-        y = pa_proplist_gets(source_master->proplist, PA_PROP_DEVICE_DESCRIPTION);
-        z = pa_proplist_gets(sink_master->proplist, PA_PROP_DEVICE_DESCRIPTION);
-        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "%s (echo cancelled with %s)",
-                z ? z : sink_master->name, y ? y : source_master->name);
-    }
-
-    u->sink = pa_sink_new(m->core, &sink_data, (sink_master->flags & (PA_SINK_LATENCY | PA_SINK_DYNAMIC_LATENCY))
-                                               | (u->use_volume_sharing ? PA_SINK_SHARE_VOLUME_WITH_MASTER : 0));
-    pa_sink_new_data_done(&sink_data);
-
-    if (!u->sink) {
-        pa_log("Failed to create sink.");
-        goto fail;
-    }
-
-    u->sink->parent.process_msg = sink_process_msg_cb;
-    u->sink->set_state = sink_set_state_cb;
-    u->sink->update_requested_latency = sink_update_requested_latency_cb;
-    u->sink->request_rewind = sink_request_rewind_cb;
-    pa_sink_set_set_mute_callback(u->sink, sink_set_mute_cb);
-    if (!u->use_volume_sharing) {
-        pa_sink_set_set_volume_callback(u->sink, sink_set_volume_cb);
-        pa_sink_enable_decibel_volume(u->sink, true);
-    }
-    u->sink->userdata = u;
-
-    pa_sink_set_asyncmsgq(u->sink, sink_master->asyncmsgq);
-
     /* Create source output */
     pa_source_output_new_data_init(&source_output_data);
     source_output_data.driver = __FILE__;
@@ -1963,49 +2542,13 @@ int pa__init(pa_module*m) {
 
     u->source->output_from_master = u->source_output;
 
-    /* Create sink input */
-    pa_sink_input_new_data_init(&sink_input_data);
-    sink_input_data.driver = __FILE__;
-    sink_input_data.module = m;
-    pa_sink_input_new_data_set_sink(&sink_input_data, sink_master, false);
-    sink_input_data.origin_sink = u->sink;
-    pa_proplist_sets(sink_input_data.proplist, PA_PROP_MEDIA_NAME, "Echo-Cancel Sink Stream");
-    pa_proplist_sets(sink_input_data.proplist, PA_PROP_MEDIA_ROLE, "filter");
-    pa_sink_input_new_data_set_sample_spec(&sink_input_data, &sink_ss);
-    pa_sink_input_new_data_set_channel_map(&sink_input_data, &sink_map);
-    sink_input_data.flags = PA_SINK_INPUT_VARIABLE_RATE | PA_SINK_INPUT_START_CORKED;
-
-    if (autoloaded)
-        sink_input_data.flags |= PA_SINK_INPUT_DONT_MOVE;
+    u->reference = reference ? reference : u;
+    u->thread_info.reference = u->reference;
 
-    pa_sink_input_new(&u->sink_input, m->core, &sink_input_data);
-    pa_sink_input_new_data_done(&sink_input_data);
-
-    if (!u->sink_input)
+    if (!reference && create_sink(u, ma, source_master, sink_master, &sink_ss, &sink_map, autoloaded) < 0)
         goto fail;
 
-    u->sink_input->parent.process_msg = sink_input_process_msg_cb;
-    u->sink_input->pop = sink_input_pop_cb;
-    u->sink_input->process_rewind = sink_input_process_rewind_cb;
-    u->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
-    u->sink_input->update_max_request = sink_input_update_max_request_cb;
-    u->sink_input->update_sink_requested_latency = sink_input_update_sink_requested_latency_cb;
-    u->sink_input->update_sink_latency_range = sink_input_update_sink_latency_range_cb;
-    u->sink_input->update_sink_fixed_latency = sink_input_update_sink_fixed_latency_cb;
-    u->sink_input->kill = sink_input_kill_cb;
-    u->sink_input->attach = sink_input_attach_cb;
-    u->sink_input->detach = sink_input_detach_cb;
-    u->sink_input->state_change = sink_input_state_change_cb;
-    u->sink_input->may_move_to = sink_input_may_move_to_cb;
-    u->sink_input->moving = sink_input_moving_cb;
-    if (!u->use_volume_sharing)
-        u->sink_input->volume_changed = sink_input_volume_changed_cb;
-    u->sink_input->mute_changed = sink_input_mute_changed_cb;
-    u->sink_input->userdata = u;
-
-    u->sink->input_to_master = u->sink_input;
-
-    pa_sink_input_get_silence(u->sink_input, &silence);
+    pa_sink_input_get_silence(u->reference->sink_input, &silence);
 
     u->source_memblockq = pa_memblockq_new("module-echo-cancel source_memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0,
         &source_output_ss, 1, 1, 0, &silence);
@@ -2051,6 +2594,23 @@ int pa__init(pa_module*m) {
     u->ec->msg->userdata = u;
 
     u->thread_info.current_volume = u->source->reference_volume;
+    pa_atomic_store(&u->capture_volume, (int) pa_cvolume_avg(&u->thread_info.current_volume));
+    pa_atomic_store(&u->capture_volume_request, (int) PA_VOLUME_INVALID);
+
+    if (use_worker_thread) {
+        /* With drift compensation the canceller is fed playback and capture
+         * data separately, at the pace each arrives, so that stays here. */
+        if (u->ec->params.drift_compensation)
+            pa_log_warn("Canceller does drift compensation, not using a worker thread");
+        else if (worker_start(u) < 0)
+            goto fail;
+        else {
+            /* Account for the block that may be waiting in the worker */
+            blocksize_usec = pa_bytes_to_usec(u->source_blocksize, &u->source->sample_spec);
+            pa_log_debug("Running the canceller in a worker thread, adding up to %0.2f ms of latency",
+                         (double) (u->worker_max_delay + blocksize_usec) / PA_USEC_PER_MSEC);
+        }
+    }
 
     /* We don't want to deal with too many chunks at a time */
     blocksize_usec = pa_bytes_to_usec(u->source_blocksize, &u->source->sample_spec);
@@ -2058,22 +2618,32 @@ int pa__init(pa_module*m) {
         pa_source_set_latency_range(u->source, blocksize_usec, blocksize_usec * MAX_LATENCY_BLOCKS);
     pa_source_output_set_requested_latency(u->source_output, blocksize_usec * MAX_LATENCY_BLOCKS);
 
-    blocksize_usec = pa_bytes_to_usec(u->sink_blocksize, &u->sink->sample_spec);
-    if (u->sink->flags & PA_SINK_DYNAMIC_LATENCY)
-        pa_sink_set_latency_range(u->sink, blocksize_usec, blocksize_usec * MAX_LATENCY_BLOCKS);
-    pa_sink_input_set_requested_latency(u->sink_input, blocksize_usec * MAX_LATENCY_BLOCKS);
+    if (u->sink) {
+        blocksize_usec = pa_bytes_to_usec(u->sink_blocksize, &u->sink->sample_spec);
+        if (u->sink->flags & PA_SINK_DYNAMIC_LATENCY)
+            pa_sink_set_latency_range(u->sink, blocksize_usec, blocksize_usec * MAX_LATENCY_BLOCKS);
+        pa_sink_input_set_requested_latency(u->sink_input, blocksize_usec * MAX_LATENCY_BLOCKS);
+    }
 
     /* The order here is important. The input/output must be put first,
      * otherwise streams might attach to the sink/source before the
      * sink input or source output is attached to the master. */
-    pa_sink_input_put(u->sink_input);
+    if (u->sink_input)
+        pa_sink_input_put(u->sink_input);
     pa_source_output_put(u->source_output);
 
-    pa_sink_put(u->sink);
+    if (u->sink)
+        pa_sink_put(u->sink);
     pa_source_put(u->source);
 
     pa_source_output_cork(u->source_output, false);
-    pa_sink_input_cork(u->sink_input, false);
+    if (u->sink_input)
+        pa_sink_input_cork(u->sink_input, false);
+
+    if (reference) {
+        add_follower(reference, u);
+        pa_atomic_store(&u->request_resync, 1);
+    }
 
     pa_modargs_free(ma);
 
@@ -2095,7 +2665,8 @@ int pa__get_n_used(pa_module *m) {
     pa_assert(m);
     pa_assert_se(u = m->userdata);
 
-    return pa_sink_linked_by(u->sink) + pa_source_linked_by(u->source);
+    return (u->sink ? pa_sink_linked_by(u->sink) : 0) + pa_source_linked_by(u->source) +
+        (u->followers ? pa_idxset_size(u->followers) : 0);
 }
 
 /* Called from main context. */
@@ -2109,6 +2680,9 @@ void pa__done(pa_module*m) {
 
     u->dead = true;
 
+    remove_follower(u);
+    drop_followers(u);
+
     /* See comments in source_output_kill_cb() above regarding
      * destruction order! */
 
@@ -2127,6 +2701,11 @@ void pa__done(pa_module*m) {
 
     if (u->source_output) {
         pa_source_output_unlink(u->source_output);
+
+        /* Nothing gets queued for the worker any more, but it still posts to
+         * the source output until it's gone */
+        worker_stop(u);
+
         pa_source_output_unref(u->source_output);
     }
 
@@ -2155,6 +2734,9 @@ void pa__done(pa_module*m) {
     if (u->asyncmsgq)
         pa_asyncmsgq_unref(u->asyncmsgq);
 
+    if (u->followers)
+        pa_idxset_free(u->followers, NULL);
+
     if (u->save_aec) {
         if (u->played_file)
             fclose(u->played_file);
@@ -36,6 +36,7 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/log.h>
+#include <pulsecore/mutex.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
@@ -54,6 +55,12 @@
  * should hopefully not be that expensive if RT scheduling is
  * enabled. A better fix would only be possible with additional event
  * source support in JACK.
+ *
+ * With direct_render=1 the JACK thread renders itself whenever our RT
+ * thread is asleep in its poll. The latter holds render_mutex at all
+ * other times, so the sink is only ever driven by one thread at a
+ * time. The JACK thread never waits for the mutex: if our thread is
+ * busy it falls back to asking it as described above.
  */
 
 PA_MODULE_AUTHOR("Lennart Poettering");
@@ -67,7 +74,8 @@ PA_MODULE_USAGE(
         "client_name=<jack client name> "
         "channels=<number of channels> "
         "channel_map=<channel map> "
-        "connect=<connect ports?>");
+        "connect=<connect ports?> "
+        "direct_render=<render in the JACK thread if possible?>");
 
 #define DEFAULT_SINK_NAME "jack_out"
 
@@ -90,6 +98,9 @@ struct userdata {
 
     pa_thread *thread;
 
+    pa_mutex *render_mutex;
+    pa_rtpoll_item *render_item;
+
     jack_nframes_t frames_in_buffer;
     jack_nframes_t saved_frame_time;
     bool saved_frame_time_valid;
@@ -103,6 +114,7 @@ static const char* const valid_modargs[] = {
     "channels",
     "channel_map",
     "connect",
+    "direct_render",
     NULL
 };
 
@@ -112,48 +124,52 @@ enum {
     SINK_MESSAGE_ON_SHUTDOWN
 };
 
-static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *memchunk) {
-    struct userdata *u = PA_SINK(o)->userdata;
+/* Called from whichever thread drives the sink right now */
+static void render(struct userdata *u, jack_nframes_t nframes, jack_nframes_t frame_time) {
 
-    switch (code) {
+    if (u->sink->thread_info.state == PA_SINK_RUNNING) {
+        pa_memchunk chunk;
+        size_t nbytes;
+        void *p;
 
-        case SINK_MESSAGE_RENDER:
+        pa_assert(nframes > 0);
+        nbytes = (size_t) nframes * pa_frame_size(&u->sink->sample_spec);
 
-            /* Handle the request from the JACK thread */
+        pa_sink_render_full(u->sink, nbytes, &chunk);
 
-            if (u->sink->thread_info.state == PA_SINK_RUNNING) {
-                pa_memchunk chunk;
-                size_t nbytes;
-                void *p;
+        p = pa_memblock_acquire_chunk(&chunk);
+        pa_deinterleave(p, u->buffer, u->channels, sizeof(float), (unsigned) nframes);
+        pa_memblock_release(chunk.memblock);
 
-                pa_assert(offset > 0);
-                nbytes = (size_t) offset * pa_frame_size(&u->sink->sample_spec);
+        pa_memblock_unref(chunk.memblock);
+    } else {
+        unsigned c;
+        pa_sample_spec ss;
 
-                pa_sink_render_full(u->sink, nbytes, &chunk);
+        /* Humm, we're not RUNNING, hence let's write some silence */
+        /* This can happen if we're paused, or during shutdown (when we're unlinked but jack is still running). */
 
-                p = pa_memblock_acquire_chunk(&chunk);
-                pa_deinterleave(p, u->buffer, u->channels, sizeof(float), (unsigned) offset);
-                pa_memblock_release(chunk.memblock);
+        ss = u->sink->sample_spec;
+        ss.channels = 1;
 
-                pa_memblock_unref(chunk.memblock);
-            } else {
-                unsigned c;
-                pa_sample_spec ss;
+        for (c = 0; c < u->channels; c++)
+            pa_silence_memory(u->buffer[c], (size_t) nframes * pa_sample_size(&ss), &ss);
+    }
 
-                /* Humm, we're not RUNNING, hence let's write some silence */
-                /* This can happen if we're paused, or during shutdown (when we're unlinked but jack is still running). */
+    u->frames_in_buffer = nframes;
+    u->saved_frame_time = frame_time;
+    u->saved_frame_time_valid = true;
+}
 
-                ss = u->sink->sample_spec;
-                ss.channels = 1;
+static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *memchunk) {
+    struct userdata *u = PA_SINK(o)->userdata;
 
-                for (c = 0; c < u->channels; c++)
-                    pa_silence_memory(u->buffer[c], (size_t) offset * pa_sample_size(&ss), &ss);
-            }
+    switch (code) {
 
-            u->frames_in_buffer = (jack_nframes_t) offset;
-            u->saved_frame_time = * (jack_nframes_t*) data;
-            u->saved_frame_time_valid = true;
+        case SINK_MESSAGE_RENDER:
 
+            /* Handle the request from the JACK thread */
+            render(u, (jack_nframes_t) offset, * (jack_nframes_t*) data);
             return 0;
 
         case SINK_MESSAGE_BUFFER_SIZE:
@@ -214,10 +230,37 @@ static int jack_process(jack_nframes_t nframes, void *arg) {
 
     frame_time = jack_frame_time(u->client);
 
+    if (u->render_mutex && pa_mutex_try_lock(u->render_mutex)) {
+
+        /* Our RT thread is asleep, do its job ourselves */
+        if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
+            pa_sink_process_rewind(u->sink, 0);
+
+        render(u, nframes, frame_time);
+
+        pa_mutex_unlock(u->render_mutex);
+        return 0;
+    }
+
     pa_assert_se(pa_asyncmsgq_send(u->jack_msgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_RENDER, &frame_time, nframes, NULL) == 0);
     return 0;
 }
 
+/* Called from the RT thread, as the very last thing before it goes to
+ * sleep and the very first after it woke up */
+static int render_item_before(pa_rtpoll_item *i) {
+    struct userdata *u = pa_rtpoll_item_get_userdata(i);
+
+    pa_mutex_unlock(u->render_mutex);
+    return 0;
+}
+
+static void render_item_after(pa_rtpoll_item *i) {
+    struct userdata *u = pa_rtpoll_item_get_userdata(i);
+
+    pa_mutex_lock(u->render_mutex);
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -230,6 +273,9 @@ static void thread_func(void *userdata) {
 
     pa_thread_mq_install(&u->thread_mq);
 
+    if (u->render_mutex)
+        pa_mutex_lock(u->render_mutex);
+
     for (;;) {
         int ret;
 
@@ -250,6 +296,9 @@ fail:
     pa_asyncmsgq_wait_for(u->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
 
 finish:
+    if (u->render_mutex)
+        pa_mutex_unlock(u->render_mutex);
+
     pa_log_debug("Thread shutting down");
 }
 
@@ -270,6 +319,10 @@ static void jack_init(void *arg) {
 
     if (u->core->realtime_scheduling)
         pa_make_realtime(u->core->realtime_priority+4);
+
+    /* Rendering may post messages from this thread */
+    if (u->render_mutex)
+        pa_thread_mq_install(&u->thread_mq);
 }
 
 /* JACK Callback: This is called when JACK kicks us */
@@ -297,7 +350,7 @@ int pa__init(pa_module*m) {
     jack_status_t status;
     const char *server_name, *client_name;
     uint32_t channels = 0;
-    bool do_connect = true;
+    bool do_connect = true, direct_render = false;
     unsigned i;
     const char **ports = NULL, **p;
     pa_sink_new_data data;
@@ -318,6 +371,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "direct_render", &direct_render) < 0) {
+        pa_log("Failed to parse direct_render= argument.");
+        goto fail;
+    }
+
     server_name = pa_modargs_get_value(ma, "server_name", NULL);
     client_name = pa_modargs_get_value(ma, "client_name", "PulseAudio JACK Sink");
 
@@ -346,6 +404,17 @@ int pa__init(pa_module*m) {
      * anything else */
     u->rtpoll_item = pa_rtpoll_item_new_asyncmsgq_read(u->rtpoll, PA_RTPOLL_EARLY-1, u->jack_msgq);
 
+    if (direct_render) {
+        u->render_mutex = pa_mutex_new(false, true);
+
+        /* After everyone else, so that nothing runs without the mutex
+         * but the poll itself */
+        u->render_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER-1, 0);
+        pa_rtpoll_item_set_userdata(u->render_item, u);
+        pa_rtpoll_item_set_before_callback(u->render_item, render_item_before);
+        pa_rtpoll_item_set_after_callback(u->render_item, render_item_after);
+    }
+
     if (!(u->client = jack_client_open(client_name, server_name ? JackServerName : JackNullOption, &status, server_name))) {
         pa_log("jack_client_open() failed.");
         goto fail;
@@ -516,6 +585,12 @@ void pa__done(pa_module*m) {
     if (u->rtpoll_item)
         pa_rtpoll_item_free(u->rtpoll_item);
 
+    if (u->render_item)
+        pa_rtpoll_item_free(u->render_item);
+
+    if (u->render_mutex)
+        pa_mutex_free(u->render_mutex);
+
     if (u->jack_msgq)
         pa_asyncmsgq_unref(u->jack_msgq);
 
@@ -36,6 +36,7 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/log.h>
+#include <pulsecore/mutex.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
@@ -57,7 +58,8 @@ PA_MODULE_USAGE(
         "client_name=<jack client name> "
         "channels=<number of channels> "
         "channel_map=<channel map> "
-        "connect=<connect ports?>");
+        "connect=<connect ports?> "
+        "direct_render=<post in the JACK thread if possible?>");
 
 #define DEFAULT_SOURCE_NAME "jack_in"
 
@@ -78,6 +80,9 @@ struct userdata {
 
     pa_thread *thread;
 
+    pa_mutex *render_mutex;
+    pa_rtpoll_item *render_item;
+
     jack_nframes_t saved_frame_time;
     bool saved_frame_time_valid;
 };
@@ -90,6 +95,7 @@ static const char* const valid_modargs[] = {
     "channels",
     "channel_map",
     "connect",
+    "direct_render",
     NULL
 };
 
@@ -98,6 +104,18 @@ enum {
     SOURCE_MESSAGE_ON_SHUTDOWN
 };
 
+/* Called from whichever thread drives the source right now */
+static void post(struct userdata *u, const pa_memchunk *chunk, jack_nframes_t frame_time) {
+    pa_assert(chunk);
+    pa_assert(chunk->length > 0);
+
+    if (u->source->thread_info.state == PA_SOURCE_RUNNING)
+        pa_source_post(u->source, chunk);
+
+    u->saved_frame_time = frame_time;
+    u->saved_frame_time_valid = true;
+}
+
 static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SOURCE(o)->userdata;
 
@@ -106,15 +124,7 @@ static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t off
         case SOURCE_MESSAGE_POST:
 
             /* Handle the new block from the JACK thread */
-            pa_assert(chunk);
-            pa_assert(chunk->length > 0);
-
-            if (u->source->thread_info.state == PA_SOURCE_RUNNING)
-                pa_source_post(u->source, chunk);
-
-            u->saved_frame_time = (jack_nframes_t) offset;
-            u->saved_frame_time_valid = true;
-
+            post(u, chunk, (jack_nframes_t) offset);
             return 0;
 
         case SOURCE_MESSAGE_ON_SHUTDOWN:
@@ -174,13 +184,33 @@ static int jack_process(jack_nframes_t nframes, void *arg) {
 
     frame_time = jack_frame_time(u->client);
 
-    pa_asyncmsgq_post(u->jack_msgq, PA_MSGOBJECT(u->source), SOURCE_MESSAGE_POST, NULL, frame_time, &chunk, NULL);
+    if (u->render_mutex && pa_mutex_try_lock(u->render_mutex)) {
+        /* Our RT thread is asleep, do its job ourselves */
+        post(u, &chunk, frame_time);
+        pa_mutex_unlock(u->render_mutex);
+    } else
+        pa_asyncmsgq_post(u->jack_msgq, PA_MSGOBJECT(u->source), SOURCE_MESSAGE_POST, NULL, frame_time, &chunk, NULL);
 
     pa_memblock_unref(chunk.memblock);
 
     return 0;
 }
 
+/* Called from the RT thread, as the very last thing before it goes to
+ * sleep and the very first after it woke up. See module-jack-sink. */
+static int render_item_before(pa_rtpoll_item *i) {
+    struct userdata *u = pa_rtpoll_item_get_userdata(i);
+
+    pa_mutex_unlock(u->render_mutex);
+    return 0;
+}
+
+static void render_item_after(pa_rtpoll_item *i) {
+    struct userdata *u = pa_rtpoll_item_get_userdata(i);
+
+    pa_mutex_lock(u->render_mutex);
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -193,6 +223,9 @@ static void thread_func(void *userdata) {
 
     pa_thread_mq_install(&u->thread_mq);
 
+    if (u->render_mutex)
+        pa_mutex_lock(u->render_mutex);
+
     for (;;) {
         int ret;
 
@@ -210,6 +243,9 @@ fail:
     pa_asyncmsgq_wait_for(u->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
 
 finish:
+    if (u->render_mutex)
+        pa_mutex_unlock(u->render_mutex);
+
     pa_log_debug("Thread shutting down");
 }
 
@@ -228,6 +264,10 @@ static void jack_init(void *arg) {
 
     if (u->core->realtime_scheduling)
         pa_make_realtime(u->core->realtime_priority+4);
+
+    /* Posting may send messages from this thread */
+    if (u->render_mutex)
+        pa_thread_mq_install(&u->thread_mq);
 }
 
 static void jack_shutdown(void* arg) {
@@ -245,7 +285,7 @@ int pa__init(pa_module*m) {
     jack_status_t status;
     const char *server_name, *client_name;
     uint32_t channels = 0;
-    bool do_connect = true;
+    bool do_connect = true, direct_render = false;
     unsigned i;
     const char **ports = NULL, **p;
     pa_source_new_data data;
@@ -266,6 +306,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "direct_render", &direct_render) < 0) {
+        pa_log("Failed to parse direct_render= argument.");
+        goto fail;
+    }
+
     server_name = pa_modargs_get_value(ma, "server_name", NULL);
     client_name = pa_modargs_get_value(ma, "client_name", "PulseAudio JACK Source");
 
@@ -288,6 +333,15 @@ int pa__init(pa_module*m) {
 
     u->rtpoll_item = pa_rtpoll_item_new_asyncmsgq_read(u->rtpoll, PA_RTPOLL_EARLY-1, u->jack_msgq);
 
+    if (direct_render) {
+        u->render_mutex = pa_mutex_new(false, true);
+
+        u->render_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER-1, 0);
+        pa_rtpoll_item_set_userdata(u->render_item, u);
+        pa_rtpoll_item_set_before_callback(u->render_item, render_item_before);
+        pa_rtpoll_item_set_after_callback(u->render_item, render_item_after);
+    }
+
     if (!(u->client = jack_client_open(client_name, server_name ? JackServerName : JackNullOption, &status, server_name))) {
         pa_log("jack_client_open() failed.");
         goto fail;
@@ -456,6 +510,12 @@ void pa__done(pa_module*m) {
     if (u->rtpoll_item)
         pa_rtpoll_item_free(u->rtpoll_item);
 
+    if (u->render_item)
+        pa_rtpoll_item_free(u->render_item);
+
+    if (u->render_mutex)
+        pa_mutex_free(u->render_mutex);
+
     if (u->jack_msgq)
         pa_asyncmsgq_unref(u->jack_msgq);
 
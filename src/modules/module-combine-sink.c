@@ -55,7 +55,7 @@ PA_MODULE_USAGE(
         "sink_name=<name for the sink> "
         "sink_properties=<properties for the sink> "
         "slaves=<slave sinks> "
-        "adjust_time=<how often to readjust rates in s> "
+        "adjust_time=<time in s to correct a latency offset between outputs, 0 to disable> "
         "resample_method=<method> "
         "format=<sample format> "
         "rate=<sample rate> "
@@ -66,6 +66,16 @@ PA_MODULE_USAGE(
 
 #define MEMBLOCKQ_MAXLENGTH (1024*1024*16)
 
+/* Must be a power of two so that the ring position stays consistent when the
+ * chunk counters wrap around */
+#define RING_SLOTS 64
+
+/* Time constant for smoothing the measured output latency */
+#define RATE_SMOOTH_USEC (1*PA_USEC_PER_SEC)
+
+/* Outputs never run more than this much faster or slower than the sink */
+#define RATE_MAX_RATIO 0.005
+
 #define DEFAULT_ADJUST_TIME_USEC (10*PA_USEC_PER_SEC)
 
 #define BLOCK_USEC (PA_USEC_PER_MSEC * 200)
@@ -90,26 +100,22 @@ struct output {
     pa_sink_input *sink_input;
     bool ignore_state_change;
 
-    /* This message queue is only for POST messages, i.e. the messages that
-     * carry audio data from the sink thread to the output thread. The POST
-     * messages need to be handled in a separate queue, because the queue is
-     * processed not only in the output thread mainloop, but also inside the
-     * sink input pop() callback. Processing other messages (such as
-     * SET_REQUESTED_LATENCY) is not safe inside the pop() callback; at least
-     * one reason why it's not safe is that messages that generate rewind
-     * requests (such as SET_REQUESTED_LATENCY) cause crashes when processed
-     * in the pop() callback. */
-    pa_asyncmsgq *audio_inq;
-
-    /* This message queue is for all other messages than POST from the sink
-     * thread to the output thread (currently "all other messages" means just
-     * the SET_REQUESTED_LATENCY message). */
+    /* The audio itself doesn't go through a message queue, the output picks
+     * it up from the sink's chunk ring (see thread_info.ring) whenever it
+     * needs data. ring_read is the next chunk this output will read and is
+     * only touched by the output thread, ring_done publishes it to the sink
+     * thread. */
+    unsigned ring_read;
+    pa_atomic_t ring_done;
+    pa_atomic_t ring_state;
+
+    /* This message queue is for messages from the sink thread to the output
+     * thread (currently just the SET_REQUESTED_LATENCY message). */
     pa_asyncmsgq *control_inq;
 
     /* Message queue from the output thread to the sink thread. */
     pa_asyncmsgq *outq;
 
-    pa_rtpoll_item *audio_inq_rtpoll_item_read, *audio_inq_rtpoll_item_write;
     pa_rtpoll_item *control_inq_rtpoll_item_read, *control_inq_rtpoll_item_write;
     pa_rtpoll_item *outq_rtpoll_item_read, *outq_rtpoll_item_write;
 
@@ -118,6 +124,22 @@ struct output {
     /* For communication of the stream latencies to the main thread */
     pa_usec_t total_latency;
 
+    /* For communication of the stream latencies to the sink thread, which
+     * derives the common target latency from them */
+    pa_atomic_t thread_total_latency;
+    pa_atomic_t thread_sink_latency;
+
+    /* Drift compensation, run by the output thread on every pop(). base_rate
+     * is set before the sink input exists, the rest only in the output
+     * thread. */
+    struct {
+        uint32_t base_rate;
+        pa_usec_t timestamp;
+        double latency;
+        double integral;
+        double rate;
+    } drift;
+
     /* For communication of the stream parameters to the sink thread */
     pa_atomic_t max_request;
     pa_atomic_t max_latency;
@@ -160,9 +182,29 @@ struct userdata {
         bool in_null_mode;
         pa_smoother *smoother;
         uint64_t counter;
+
+        /* Rendered audio shared by all outputs. The sink thread is the only
+         * writer and ring_write counts the chunks it has published. A slot
+         * is reused only once every active output has read it; an output
+         * that stops reading altogether is evicted instead of holding
+         * everybody else up. */
+        pa_memchunk ring[RING_SLOTS];
+        pa_atomic_t ring_write;
+
+        /* Latency all outputs steer towards, 0 while unknown */
+        pa_atomic_t target_latency;
     } thread_info;
 };
 
+/* Values of output.ring_state. Only the output thread leaves READING and
+ * EVICTED, the sink thread moves IDLE outputs to EVICTED. */
+enum {
+    RING_DETACHED,
+    RING_IDLE,
+    RING_READING,
+    RING_EVICTED
+};
+
 enum {
     SINK_MESSAGE_ADD_OUTPUT = PA_SINK_MESSAGE_MAX,
     SINK_MESSAGE_REMOVE_OUTPUT,
@@ -173,8 +215,7 @@ enum {
 };
 
 enum {
-    SINK_INPUT_MESSAGE_POST = PA_SINK_INPUT_MESSAGE_MAX,
-    SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY
+    SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY = PA_SINK_INPUT_MESSAGE_MAX
 };
 
 static void output_disable(struct output *o);
@@ -185,7 +226,6 @@ static int output_create_sink_input(struct output *o);
 static void adjust_rates(struct userdata *u) {
     struct output *o;
     pa_usec_t max_sink_latency = 0, min_total_latency = (pa_usec_t) -1, target_latency, avg_total_latency = 0;
-    uint32_t base_rate;
     uint32_t idx;
     unsigned n = 0;
 
@@ -232,35 +272,11 @@ static void adjust_rates(struct userdata *u) {
     pa_log_info("[%s] avg total latency is %0.2f msec.", u->sink->name, (double) avg_total_latency / PA_USEC_PER_MSEC);
     pa_log_info("[%s] target latency is %0.2f msec.", u->sink->name, (double) target_latency / PA_USEC_PER_MSEC);
 
-    base_rate = u->sink->sample_spec.rate;
-
-    PA_IDXSET_FOREACH(o, u->outputs, idx) {
-        uint32_t new_rate = base_rate;
-        uint32_t current_rate;
-
-        if (!o->sink_input || !PA_SINK_IS_OPENED(pa_sink_get_state(o->sink)))
-            continue;
-
-        current_rate = o->sink_input->sample_spec.rate;
-
-        if (o->total_latency != target_latency)
-            new_rate += (uint32_t) (((double) o->total_latency - (double) target_latency) / (double) u->adjust_time * (double) new_rate);
-
-        if (new_rate < (uint32_t) (base_rate*0.8) || new_rate > (uint32_t) (base_rate*1.25)) {
-            pa_log_warn("[%s] sample rates too different, not adjusting (%u vs. %u).", o->sink_input->sink->name, base_rate, new_rate);
-            new_rate = base_rate;
-        } else {
-            if (base_rate < new_rate + 20 && new_rate < base_rate + 20)
-              new_rate = base_rate;
-            /* Do the adjustment in small steps; 2‰ can be considered inaudible */
-            if (new_rate < (uint32_t) (current_rate*0.998) || new_rate > (uint32_t) (current_rate*1.002)) {
-                pa_log_info("[%s] new rate of %u Hz not within 2‰ of %u Hz, forcing smaller adjustment", o->sink_input->sink->name, new_rate, current_rate);
-                new_rate = PA_CLAMP(new_rate, (uint32_t) (current_rate*0.998), (uint32_t) (current_rate*1.002));
-            }
-            pa_log_info("[%s] new rate is %u Hz; ratio is %0.3f; latency is %0.2f msec.", o->sink_input->sink->name, new_rate, (double) new_rate / base_rate, (double) o->total_latency / PA_USEC_PER_MSEC);
-        }
-        pa_sink_input_set_rate(o->sink_input, new_rate);
-    }
+    /* The rates themselves are adjusted by the output threads, see
+     * output_adjust_rate() */
+    PA_IDXSET_FOREACH(o, u->outputs, idx)
+        if (o->sink_input)
+            pa_log_debug("[%s] rate is %0.1f Hz.", o->sink->name, o->drift.rate);
 
     pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_LATENCY, NULL, (int64_t) avg_total_latency, NULL);
 }
@@ -272,13 +288,12 @@ static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct tim
     pa_assert(a);
     pa_assert(u->time_event == e);
 
+    pa_core_count_wakeup(u->core, "combine-sink");
+
     adjust_rates(u);
 
-    if (pa_sink_get_state(u->sink) == PA_SINK_SUSPENDED) {
-        u->core->mainloop->time_free(e);
-        u->time_event = NULL;
-    } else
-        pa_core_rttime_restart(u->core, e, pa_rtclock_now() + u->adjust_time);
+    /* While suspended there is no timer, see suspend() */
+    pa_core_rttime_restart(u->core, e, pa_rtclock_now() + u->adjust_time);
 }
 
 static void process_render_null(struct userdata *u, pa_usec_t now) {
@@ -370,46 +385,122 @@ finish:
     pa_log_debug("Thread shutting down");
 }
 
+/* Called from combine sink I/O thread context */
+static void ring_publish(struct userdata *u, const pa_memchunk *chunk) {
+    struct output *j;
+    pa_memchunk *slot;
+    unsigned w;
+
+    w = (unsigned) pa_atomic_load(&u->thread_info.ring_write);
+    slot = &u->thread_info.ring[w % RING_SLOTS];
+
+    /* Make sure no output still needs the slot we are about to reuse */
+    PA_LLIST_FOREACH(j, u->thread_info.active_outputs) {
+        while (w - (unsigned) pa_atomic_load(&j->ring_done) >= RING_SLOTS) {
+
+            if (pa_atomic_load(&j->ring_state) == RING_EVICTED)
+                break;
+
+            if (pa_atomic_cmpxchg(&j->ring_state, RING_IDLE, RING_EVICTED)) {
+                pa_log_debug("Output %s stopped reading, evicting it.", j->sink->name);
+                break;
+            }
+
+            /* The output is reading right now and will have caught up in a
+             * moment */
+            pa_thread_yield();
+        }
+    }
+
+    if (slot->memblock)
+        pa_memblock_unref(slot->memblock);
+
+    *slot = *chunk;
+    pa_memblock_ref(slot->memblock);
+
+    pa_atomic_store(&u->thread_info.ring_write, (int) (w + 1));
+}
+
+/* Called from combine sink I/O thread context */
+static void update_target_latency(struct userdata *u) {
+    struct output *j;
+    pa_usec_t max_sink_latency = 0, min_total_latency = (pa_usec_t) -1;
+
+    /* Same rule as in adjust_rates(): nobody can go below the slowest
+     * sink, and nobody needs to be above the fastest output */
+    PA_LLIST_FOREACH(j, u->thread_info.active_outputs) {
+        pa_usec_t total = (pa_usec_t) pa_atomic_load(&j->thread_total_latency);
+        pa_usec_t sink = (pa_usec_t) pa_atomic_load(&j->thread_sink_latency);
+
+        /* Not measured yet */
+        if (total == 0)
+            continue;
+
+        max_sink_latency = PA_MAX(max_sink_latency, sink);
+        min_total_latency = PA_MIN(min_total_latency, total);
+    }
+
+    if (min_total_latency == (pa_usec_t) -1)
+        return;
+
+    pa_atomic_store(&u->thread_info.target_latency, (int) PA_MAX(max_sink_latency, min_total_latency));
+}
+
 /* Called from combine sink I/O thread context */
 static void render_memblock(struct userdata *u, struct output *o, size_t length) {
+    pa_memchunk chunk;
+
     pa_assert(u);
     pa_assert(o);
 
-    /* We are run by the sink thread, on behalf of an output (o). The
-     * output is waiting for us, hence it is safe to access its
-     * mainblockq and asyncmsgq directly. */
-
     /* If we are not running, we cannot produce any data */
     if (!pa_atomic_load(&u->thread_info.running))
         return;
 
-    /* Maybe there's some data in the requesting output's queue
-     * now? */
-    while (pa_asyncmsgq_process_one(o->audio_inq) > 0)
-        ;
+    /* Maybe someone else made us render something since the requesting
+     * output last looked at the ring */
+    if ((unsigned) pa_atomic_load(&o->ring_done) != (unsigned) pa_atomic_load(&u->thread_info.ring_write))
+        return;
 
-    /* Ok, now let's prepare some data if we really have to */
-    while (!pa_memblockq_is_readable(o->memblockq)) {
-        struct output *j;
-        pa_memchunk chunk;
+    update_target_latency(u);
 
-        /* Render data! */
-        pa_sink_render(u->sink, length, &chunk);
+    /* Render data! */
+    pa_sink_render(u->sink, length, &chunk);
 
-        u->thread_info.counter += chunk.length;
+    u->thread_info.counter += chunk.length;
 
-        /* OK, let's send this data to the other threads */
-        PA_LLIST_FOREACH(j, u->thread_info.active_outputs) {
-            if (j == o)
-                continue;
+    /* One ring slot for all outputs, instead of a message for each */
+    ring_publish(u, &chunk);
+    pa_memblock_unref(chunk.memblock);
+}
 
-            pa_asyncmsgq_post(j->audio_inq, PA_MSGOBJECT(j->sink_input), SINK_INPUT_MESSAGE_POST, NULL, 0, &chunk, NULL);
-        }
+/* Called from I/O thread context */
+static void ring_read(struct output *o) {
+    struct userdata *u = o->userdata;
+    unsigned w;
 
-        /* And place it directly into the requesting output's queue */
-        pa_memblockq_push_align(o->memblockq, &chunk);
-        pa_memblock_unref(chunk.memblock);
+    if (!pa_atomic_cmpxchg(&o->ring_state, RING_IDLE, RING_READING)) {
+
+        if (!pa_atomic_cmpxchg(&o->ring_state, RING_EVICTED, RING_READING))
+            return;
+
+        /* We didn't read for too long and the sink thread moved on without
+         * us. What we still have queued is stale by now. */
+        pa_memblockq_flush_write(o->memblockq, true);
+        o->ring_read = (unsigned) pa_atomic_load(&u->thread_info.ring_write);
     }
+
+    w = (unsigned) pa_atomic_load(&u->thread_info.ring_write);
+
+    for (; o->ring_read != w; o->ring_read++) {
+        if (PA_SINK_IS_OPENED(o->sink_input->sink->thread_info.state))
+            pa_memblockq_push_align(o->memblockq, &u->thread_info.ring[o->ring_read % RING_SLOTS]);
+        else
+            pa_memblockq_flush_write(o->memblockq, true);
+    }
+
+    pa_atomic_store(&o->ring_done, (int) o->ring_read);
+    pa_atomic_store(&o->ring_state, RING_IDLE);
 }
 
 /* Called from I/O thread context */
@@ -418,19 +509,94 @@ static void request_memblock(struct output *o, size_t length) {
     pa_sink_input_assert_ref(o->sink_input);
     pa_sink_assert_ref(o->userdata->sink);
 
-    /* If another thread already prepared some data we received
-     * the data over the asyncmsgq, hence let's first process
-     * it. */
-    while (pa_asyncmsgq_process_one(o->audio_inq) > 0)
-        ;
+    /* If the sink thread already prepared some data for another output, we
+     * can use it too */
+    ring_read(o);
 
     /* Check whether we're now readable */
     if (pa_memblockq_is_readable(o->memblockq))
         return;
 
     /* OK, we need to prepare new data, but only if the sink is actually running */
-    if (pa_atomic_load(&o->userdata->thread_info.running))
+    while (pa_atomic_load(&o->userdata->thread_info.running) &&
+           PA_SINK_IS_OPENED(o->sink_input->sink->thread_info.state)) {
         pa_asyncmsgq_send(o->outq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_NEED, o, (int64_t) length, NULL);
+        ring_read(o);
+
+        if (pa_memblockq_is_readable(o->memblockq))
+            break;
+    }
+}
+
+/* Called from I/O thread context */
+static void output_adjust_rate(struct output *o) {
+    pa_sink_input *i = o->sink_input;
+    pa_usec_t now, total, sink, target;
+    double dt, error, kp, ki, ratio, limit;
+    uint32_t new_rate;
+
+    now = pa_rtclock_now();
+
+    sink = pa_sink_get_latency_within_thread(i->sink, false);
+    total = sink +
+        pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq), &o->userdata->sink->sample_spec) +
+        pa_bytes_to_usec(pa_memblockq_get_length(i->thread_info.render_memblockq), &i->sink->sample_spec);
+
+    pa_atomic_store(&o->thread_total_latency, (int) PA_MAX(total, 1U));
+    pa_atomic_store(&o->thread_sink_latency, (int) sink);
+
+    if (o->drift.timestamp == 0 || now <= o->drift.timestamp) {
+        o->drift.timestamp = now;
+        o->drift.latency = (double) total;
+        o->drift.rate = (double) i->thread_info.sample_spec.rate;
+        return;
+    }
+
+    dt = (double) (now - o->drift.timestamp);
+    o->drift.timestamp = now;
+
+    /* The latency seen here jumps by a chunk whenever new data was
+     * rendered, so smooth it before using it */
+    o->drift.latency += ((double) total - o->drift.latency) * dt / (dt + (double) RATE_SMOOTH_USEC);
+
+    if (o->userdata->adjust_time == 0)
+        return;
+
+    if ((target = (pa_usec_t) pa_atomic_load(&o->userdata->thread_info.target_latency)) == 0)
+        return;
+
+    /* A PI controller. The latency changes by the relative rate offset per
+     * unit of time, so an offset is corrected within roughly adjust_time
+     * and the integral term picks up the constant clock drift. ki = kp²/4
+     * keeps the loop critically damped. */
+    error = (o->drift.latency - (double) target) / PA_USEC_PER_SEC;
+    dt /= PA_USEC_PER_SEC;
+    kp = (double) PA_USEC_PER_SEC / (double) o->userdata->adjust_time;
+    ki = kp * kp / 4;
+
+    o->drift.integral += error * dt;
+
+    /* Don't let the integral wind up beyond what the rate limit allows */
+    limit = RATE_MAX_RATIO / ki;
+    o->drift.integral = PA_CLAMP(o->drift.integral, -limit, limit);
+
+    ratio = kp * error + ki * o->drift.integral;
+    ratio = PA_CLAMP(ratio, -RATE_MAX_RATIO, RATE_MAX_RATIO);
+
+    o->drift.rate = (double) o->drift.base_rate * (1.0 + ratio);
+
+    /* The resampler only takes whole rates. Move by at most 1 Hz per
+     * period, so the rate follows the controller output in tiny steps. */
+    new_rate = i->thread_info.sample_spec.rate;
+    if (o->drift.rate >= (double) new_rate + 1.0)
+        new_rate++;
+    else if (o->drift.rate <= (double) new_rate - 1.0)
+        new_rate--;
+
+    if (new_rate != i->thread_info.sample_spec.rate) {
+        i->thread_info.sample_spec.rate = new_rate;
+        pa_resampler_set_input_rate(i->thread_info.resampler, new_rate);
+    }
 }
 
 /* Called from I/O thread context */
@@ -443,6 +609,8 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     /* If necessary, get some new data */
     request_memblock(o, nbytes);
 
+    output_adjust_rate(o);
+
     /* pa_log("%s q size is %u + %u (%u/%u)", */
     /*        i->sink->name, */
     /*        pa_memblockq_get_nblocks(o->memblockq), */
@@ -532,15 +700,9 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_assert_se(o = i->userdata);
 
     /* Set up the queue from the sink thread to us */
-    pa_assert(!o->audio_inq_rtpoll_item_read);
     pa_assert(!o->control_inq_rtpoll_item_read);
     pa_assert(!o->outq_rtpoll_item_write);
 
-    o->audio_inq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
-            i->sink->thread_info.rtpoll,
-            PA_RTPOLL_LATE,  /* This one is not that important, since we check for data in _peek() anyway. */
-            o->audio_inq);
-
     o->control_inq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
             i->sink->thread_info.rtpoll,
             PA_RTPOLL_NORMAL,
@@ -553,6 +715,11 @@ static void sink_input_attach_cb(pa_sink_input *i) {
 
     pa_sink_input_request_rewind(i, 0, false, true, true);
 
+    /* Start measuring afresh on the new sink */
+    o->drift.timestamp = 0;
+    o->drift.integral = 0;
+    pa_atomic_store(&o->thread_total_latency, 0);
+
     nbytes = pa_sink_input_get_max_request(i);
     pa_atomic_store(&o->max_request, (int) nbytes);
     pa_log_debug("attach max request %lu", (unsigned long) nbytes);
@@ -584,11 +751,6 @@ static void sink_input_detach_cb(pa_sink_input *i) {
      * pass any further data to this output */
     pa_asyncmsgq_send(o->userdata->sink->asyncmsgq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_REMOVE_OUTPUT, o, 0, NULL);
 
-    if (o->audio_inq_rtpoll_item_read) {
-        pa_rtpoll_item_free(o->audio_inq_rtpoll_item_read);
-        o->audio_inq_rtpoll_item_read = NULL;
-    }
-
     if (o->control_inq_rtpoll_item_read) {
         pa_rtpoll_item_free(o->control_inq_rtpoll_item_read);
         o->control_inq_rtpoll_item_read = NULL;
@@ -622,6 +784,9 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
         case PA_SINK_INPUT_MESSAGE_GET_LATENCY: {
             pa_usec_t *r = data;
 
+            /* Count what is waiting for us in the ring too */
+            ring_read(o);
+
             *r = pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq), &o->sink_input->sample_spec);
 
             /* Fall through, the default handler will add in the extra
@@ -629,15 +794,6 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
             break;
         }
 
-        case SINK_INPUT_MESSAGE_POST:
-
-            if (PA_SINK_IS_OPENED(o->sink_input->sink->thread_info.state))
-                pa_memblockq_push_align(o->memblockq, chunk);
-            else
-                pa_memblockq_flush_write(o->memblockq, true);
-
-            return 0;
-
         case SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY: {
             pa_usec_t latency = (pa_usec_t) offset;
 
@@ -661,6 +817,12 @@ static void suspend(struct userdata *u) {
     PA_IDXSET_FOREACH(o, u->outputs, idx)
         output_disable(o);
 
+    /* Nothing to adjust until we are resumed */
+    if (u->time_event) {
+        u->core->mainloop->time_free(u->time_event);
+        u->time_event = NULL;
+    }
+
     pa_log_info("Device suspended...");
 }
 
@@ -786,18 +948,19 @@ static void output_add_within_thread(struct output *o) {
 
     PA_LLIST_PREPEND(struct output, o->userdata->thread_info.active_outputs, o);
 
+    /* The output thread waits for us, so we may set up its cursor. It
+     * starts with whatever gets rendered next. */
+    o->ring_read = (unsigned) pa_atomic_load(&o->userdata->thread_info.ring_write);
+    pa_atomic_store(&o->ring_done, (int) o->ring_read);
+    pa_atomic_store(&o->ring_state, RING_IDLE);
+
     pa_assert(!o->outq_rtpoll_item_read);
-    pa_assert(!o->audio_inq_rtpoll_item_write);
     pa_assert(!o->control_inq_rtpoll_item_write);
 
     o->outq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
             o->userdata->rtpoll,
             PA_RTPOLL_EARLY-1,  /* This item is very important */
             o->outq);
-    o->audio_inq_rtpoll_item_write = pa_rtpoll_item_new_asyncmsgq_write(
-            o->userdata->rtpoll,
-            PA_RTPOLL_EARLY,
-            o->audio_inq);
     o->control_inq_rtpoll_item_write = pa_rtpoll_item_new_asyncmsgq_write(
             o->userdata->rtpoll,
             PA_RTPOLL_NORMAL,
@@ -811,16 +974,14 @@ static void output_remove_within_thread(struct output *o) {
 
     PA_LLIST_REMOVE(struct output, o->userdata->thread_info.active_outputs, o);
 
+    /* The output thread waits for us, so it can't be reading the ring */
+    pa_atomic_store(&o->ring_state, RING_DETACHED);
+
     if (o->outq_rtpoll_item_read) {
         pa_rtpoll_item_free(o->outq_rtpoll_item_read);
         o->outq_rtpoll_item_read = NULL;
     }
 
-    if (o->audio_inq_rtpoll_item_write) {
-        pa_rtpoll_item_free(o->audio_inq_rtpoll_item_write);
-        o->audio_inq_rtpoll_item_write = NULL;
-    }
-
     if (o->control_inq_rtpoll_item_write) {
         pa_rtpoll_item_free(o->control_inq_rtpoll_item_write);
         o->control_inq_rtpoll_item_write = NULL;
@@ -980,6 +1141,7 @@ static int output_create_sink_input(struct output *o) {
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_ROLE, "filter");
     pa_sink_input_new_data_set_sample_spec(&data, &u->sink->sample_spec);
     pa_sink_input_new_data_set_channel_map(&data, &u->sink->channel_map);
+    o->drift.base_rate = u->sink->sample_spec.rate;
     data.module = u->module;
     data.resample_method = u->resample_method;
     data.flags = PA_SINK_INPUT_VARIABLE_RATE|PA_SINK_INPUT_DONT_MOVE|PA_SINK_INPUT_NO_CREATE_ON_SUSPEND;
@@ -1018,12 +1180,6 @@ static struct output *output_new(struct userdata *u, pa_sink *sink) {
     o = pa_xnew0(struct output, 1);
     o->userdata = u;
 
-    o->audio_inq = pa_asyncmsgq_new(0);
-    if (!o->audio_inq) {
-        pa_log("pa_asyncmsgq_new() failed.");
-        goto fail;
-    }
-
     o->control_inq = pa_asyncmsgq_new(0);
     if (!o->control_inq) {
         pa_log("pa_asyncmsgq_new() failed.");
@@ -1066,11 +1222,6 @@ static void output_free(struct output *o) {
     output_disable(o);
     update_description(o->userdata);
 
-    if (o->audio_inq_rtpoll_item_read)
-        pa_rtpoll_item_free(o->audio_inq_rtpoll_item_read);
-    if (o->audio_inq_rtpoll_item_write)
-        pa_rtpoll_item_free(o->audio_inq_rtpoll_item_write);
-
     if (o->control_inq_rtpoll_item_read)
         pa_rtpoll_item_free(o->control_inq_rtpoll_item_read);
     if (o->control_inq_rtpoll_item_write)
@@ -1081,9 +1232,6 @@ static void output_free(struct output *o) {
     if (o->outq_rtpoll_item_write)
         pa_rtpoll_item_free(o->outq_rtpoll_item_write);
 
-    if (o->audio_inq)
-        pa_asyncmsgq_unref(o->audio_inq);
-
     if (o->control_inq)
         pa_asyncmsgq_unref(o->control_inq);
 
@@ -1138,7 +1286,6 @@ static void output_disable(struct output *o) {
 
     /* Finally, drop all queued data */
     pa_memblockq_flush_write(o->memblockq, true);
-    pa_asyncmsgq_flush(o->audio_inq, false);
     pa_asyncmsgq_flush(o->control_inq, false);
     pa_asyncmsgq_flush(o->outq, false);
 }
@@ -1500,7 +1647,7 @@ int pa__init(pa_module*m) {
     PA_IDXSET_FOREACH(o, u->outputs, idx)
         output_verify(o);
 
-    if (u->adjust_time > 0)
+    if (u->adjust_time > 0 && pa_sink_get_state(u->sink) != PA_SINK_SUSPENDED)
         u->time_event = pa_core_rttime_new(m->core, pa_rtclock_now() + u->adjust_time, time_callback, u);
 
     pa_modargs_free(ma);
@@ -1519,6 +1666,7 @@ fail:
 
 void pa__done(pa_module*m) {
     struct userdata *u;
+    unsigned i;
 
     pa_assert(m);
 
@@ -1561,5 +1709,9 @@ void pa__done(pa_module*m) {
     if (u->thread_info.smoother)
         pa_smoother_free(u->thread_info.smoother);
 
+    for (i = 0; i < RING_SLOTS; i++)
+        if (u->thread_info.ring[i].memblock)
+            pa_memblock_unref(u->thread_info.ring[i].memblock);
+
     pa_xfree(u);
 }
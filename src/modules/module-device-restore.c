@@ -519,17 +519,48 @@ static bool perportentries_equal(const struct perportentry *a, const struct perp
 
 #ifdef ENABLE_LEGACY_DATABASE_ENTRY_FORMAT
 
+/* Legacy entries were written with room for 32 channels, what
+ * PA_CHANNELS_MAX was back then */
+#define LEGACY_CHANNELS_MAX 32
+
+struct legacy_channel_map {
+    uint8_t channels;
+    pa_channel_position_t map[LEGACY_CHANNELS_MAX];
+};
+
+struct legacy_cvolume {
+    uint8_t channels;
+    pa_volume_t values[LEGACY_CHANNELS_MAX];
+};
+
+static bool legacy_volume_get(pa_channel_map *map, pa_cvolume *v, const struct legacy_channel_map *lmap, const struct legacy_cvolume *lv) {
+    if (lmap->channels > LEGACY_CHANNELS_MAX || lv->channels > LEGACY_CHANNELS_MAX)
+        return false;
+
+    pa_channel_map_init(map);
+    map->channels = lmap->channels;
+    memcpy(map->map, lmap->map, sizeof(lmap->map[0]) * lmap->channels);
+
+    pa_cvolume_init(v);
+    v->channels = lv->channels;
+    memcpy(v->values, lv->values, sizeof(lv->values[0]) * lv->channels);
+
+    return true;
+}
+
 #define LEGACY_ENTRY_VERSION 2
 static bool legacy_entry_read(struct userdata *u, pa_datum *data, struct entry **entry, struct perportentry **perportentry) {
     struct legacy_entry {
         uint8_t version;
         bool muted_valid:1, volume_valid:1, port_valid:1;
         bool muted:1;
-        pa_channel_map channel_map;
-        pa_cvolume volume;
+        struct legacy_channel_map channel_map;
+        struct legacy_cvolume volume;
         char port[PA_NAME_MAX];
     } PA_GCC_PACKED;
     struct legacy_entry *le;
+    pa_channel_map channel_map;
+    pa_cvolume volume;
 
     pa_assert(u);
     pa_assert(data);
@@ -553,12 +584,12 @@ static bool legacy_entry_read(struct userdata *u, pa_datum *data, struct entry *
         return false;
     }
 
-    if (le->volume_valid && !pa_channel_map_valid(&le->channel_map)) {
+    if (le->volume_valid && (!legacy_volume_get(&channel_map, &volume, &le->channel_map, &le->volume) || !pa_channel_map_valid(&channel_map))) {
         pa_log_warn("Invalid channel map.");
         return false;
     }
 
-    if (le->volume_valid && (!pa_cvolume_valid(&le->volume) || !pa_cvolume_compatible_with_channel_map(&le->volume, &le->channel_map))) {
+    if (le->volume_valid && (!pa_cvolume_valid(&volume) || !pa_cvolume_compatible_with_channel_map(&volume, &channel_map))) {
         pa_log_warn("Volume and channel map don't match.");
         return false;
     }
@@ -571,8 +602,10 @@ static bool legacy_entry_read(struct userdata *u, pa_datum *data, struct entry *
     (*perportentry)->muted_valid = le->muted_valid;
     (*perportentry)->volume_valid = le->volume_valid;
     (*perportentry)->muted = le->muted;
-    (*perportentry)->channel_map = le->channel_map;
-    (*perportentry)->volume = le->volume;
+    if (le->volume_valid) {
+        (*perportentry)->channel_map = channel_map;
+        (*perportentry)->volume = volume;
+    }
 
     return true;
 }
@@ -63,6 +63,7 @@
 #include <pulsecore/database.h>
 #include <pulsecore/protocol-dbus.h>
 #include <pulsecore/dbus-util.h>
+#include <pulsecore/filter/convolver.h>
 
 #include "module-equalizer-sink-symdef.h"
 
@@ -80,10 +81,21 @@ PA_MODULE_USAGE(
           "channel_map=<channel map> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "low_latency=<yes or no> "
          ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED false
+#define DEFAULT_LOW_LATENCY false
+
+/* The low latency mode filters with a minimum phase FIR of IR_LENGTH(u)
+ * taps, using partitioned convolution with this partition size */
+#define PARTITION_SIZE 256
+#define IR_LENGTH(u) ((u)->fft_size / 4)
+#define MIN_MAGNITUDE 1e-6f
+
+#define FFTW_WISDOM_FILE "equalizer-fftw-wisdom"
+#define FFTW_PLANNING_TIME_LIMIT 2.0
 
 struct userdata {
     pa_module *module;
@@ -122,6 +134,15 @@ struct userdata {
     pa_memblockq *output_q;
     bool first_iteration;
 
+    /* low latency mode */
+    pa_convolver *convolver;
+    float ***irs;//minimum phase impulse responses, designed along with Hs
+    unsigned **ir_versions;
+    unsigned *ir_applied;//version of the impulse responses the convolver uses (I/O thread)
+    unsigned ir_version;
+    float *ir_work;
+    fftwf_complex *ir_spectrum;
+
     pa_dbus_protocol *dbus_protocol;
     char *dbus_path;
 
@@ -141,6 +162,7 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "autoloaded",
     "use_volume_sharing",
+    "low_latency",
     NULL
 };
 
@@ -239,6 +261,73 @@ static void alloc_input_buffers(struct userdata *u, size_t min_buffer_length) {
     u->input_buffer_max = min_buffer_length;
 }
 
+/* Called from main context, between pa_aupdate_write_begin() and
+ * pa_aupdate_write_end() of the channel.
+ *
+ * Designs the impulse response for the low latency mode from the magnitude
+ * response in Hs[channel][a_i]. A linear phase filter would delay the signal
+ * by half its length, so the minimum phase response is derived from the real
+ * cepstrum instead. */
+static void update_ir(struct userdata *u, size_t channel, unsigned a_i) {
+    const float X = u->Xs[channel][a_i];
+    const float *H = u->Hs[channel][a_i];
+    const size_t ir_length = IR_LENGTH(u), fade = ir_length / 4;
+    float *work = u->ir_work, *ir;
+    fftwf_complex *spectrum = u->ir_spectrum;
+
+    if (!u->convolver)
+        return;
+
+    ir = u->irs[channel][a_i];
+
+    /* log magnitude, H has the fft gain divided out */
+    for (size_t i = 0; i < FILTER_SIZE(u); ++i) {
+        spectrum[i][0] = logf(PA_MAX(X * H[i] * u->fft_size, MIN_MAGNITUDE));
+        spectrum[i][1] = 0;
+    }
+    fftwf_execute_dft_c2r(u->inverse_plan, spectrum, work);
+
+    /* fold the real cepstrum onto its causal part */
+    work[0] /= u->fft_size;
+    for (size_t i = 1; i < u->fft_size / 2; ++i)
+        work[i] *= 2.0f / u->fft_size;
+    work[u->fft_size / 2] /= u->fft_size;
+    memset(work + u->fft_size / 2 + 1, 0, (u->fft_size / 2 - 1) * sizeof(float));
+
+    /* back to the (now minimum phase) spectrum and into the time domain */
+    fftwf_execute_dft_r2c(u->forward_plan, work, spectrum);
+    for (size_t i = 0; i < FILTER_SIZE(u); ++i) {
+        float m = expf(spectrum[i][0]) / u->fft_size, phi = spectrum[i][1];
+
+        spectrum[i][0] = m * cosf(phi);
+        spectrum[i][1] = m * sinf(phi);
+    }
+    fftwf_execute_dft_c2r(u->inverse_plan, spectrum, work);
+
+    /* truncate with a half hanning fade out */
+    for (size_t i = 0; i < ir_length; ++i) {
+        ir[i] = work[i];
+        if (i >= ir_length - fade)
+            ir[i] *= (float) .5 * (1 + cos(M_PI * (i - (ir_length - fade)) / fade));
+    }
+
+    u->ir_versions[channel][a_i] = ++u->ir_version;
+}
+
+/* Called from I/O thread context */
+static void update_convolver(struct userdata *u) {
+    unsigned a_i;
+
+    for (size_t c = 0; c < u->channels; ++c) {
+        a_i = pa_aupdate_read_begin(u->a_H[c]);
+        if (u->ir_versions[c][a_i] != u->ir_applied[c]) {
+            pa_convolver_set_ir(u->convolver, c, c, u->irs[c][a_i], IR_LENGTH(u));
+            u->ir_applied[c] = u->ir_versions[c][a_i];
+        }
+        pa_aupdate_read_end(u->a_H[c]);
+    }
+}
+
 /* Called from I/O thread context */
 static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SINK(o)->userdata;
@@ -265,6 +354,11 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
                 pa_bytes_to_usec(pa_memblockq_get_length(u->output_q) +
                                  pa_memblockq_get_length(u->input_q), &u->sink_input->sink->sample_spec) +
                 pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
+
+            /* And the delay of the partitioned convolution */
+            if (u->convolver)
+                *((int64_t*) data) += pa_bytes_to_usec(pa_convolver_get_latency(u->convolver) * pa_frame_size(&u->sink->sample_spec),
+                                                       &u->sink->sample_spec);
             //    pa_bytes_to_usec(u->samples_gathered * fs, &u->sink->sample_spec);
             //+ pa_bytes_to_usec(u->latency * fs, ss)
             return 0;
@@ -694,6 +788,58 @@ END:
     return 0;
 }
 
+/* Called from I/O thread context */
+static int sink_input_pop_low_latency_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    struct userdata *u;
+    size_t fs, n;
+    float *src, *dst;
+    pa_memchunk tchunk;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+    pa_assert(chunk);
+    pa_assert(u->sink);
+
+    if (!PA_SINK_IS_LINKED(u->sink->thread_info.state))
+        return -1;
+
+    /* Hmm, process any rewind request that might be queued up */
+    pa_sink_process_rewind(u->sink, 0);
+
+    fs = pa_frame_size(&u->sink->sample_spec);
+    while (pa_memblockq_peek(u->input_q, &tchunk) < 0) {
+        pa_sink_render(u->sink, nbytes, &tchunk);
+        pa_memblockq_push(u->input_q, &tchunk);
+        pa_memblock_unref(tchunk.memblock);
+    }
+    pa_assert(tchunk.memblock);
+
+    tchunk.length = PA_MIN(nbytes, tchunk.length);
+    pa_assert(tchunk.length > 0);
+    n = tchunk.length / fs;
+
+    update_convolver(u);
+
+    chunk->index = 0;
+    chunk->length = n * fs;
+    chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
+
+    pa_memblockq_drop(u->input_q, chunk->length);
+
+    src = pa_memblock_acquire_chunk(&tchunk);
+    dst = pa_memblock_acquire(chunk->memblock);
+
+    pa_convolver_process(u->convolver, src, dst, n);
+    pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst, sizeof(float), dst, sizeof(float), n * u->channels);
+
+    pa_memblock_release(tchunk.memblock);
+    pa_memblock_release(chunk->memblock);
+
+    pa_memblock_unref(tchunk.memblock);
+
+    return 0;
+}
+
 /* Called from main context */
 static void sink_input_volume_changed_cb(pa_sink_input *i) {
     struct userdata *u;
@@ -732,6 +878,26 @@ static void reset_filter(struct userdata *u) {
 }
 #endif
 
+/* Called from I/O thread context */
+static void rebuild_convolver_state(struct userdata *u) {
+    size_t length;
+    pa_memchunk chunk;
+    float *history;
+
+    /* The input that precedes the read index is still in the queue, see
+     * sink_input_update_max_rewind_cb() */
+    length = pa_convolver_get_history(u->convolver) * pa_frame_size(&u->sink->sample_spec);
+    pa_memblockq_rewind(u->input_q, length);
+    pa_assert_se(pa_memblockq_peek_fixed_size(u->input_q, length, &chunk) >= 0);
+
+    history = pa_memblock_acquire_chunk(&chunk);
+    pa_convolver_rewind(u->convolver, history, pa_convolver_get_history(u->convolver));
+    pa_memblock_release(chunk.memblock);
+    pa_memblock_unref(chunk.memblock);
+
+    pa_memblockq_drop(u->input_q, length);
+}
+
 /* Called from I/O thread context */
 static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
     struct userdata *u;
@@ -764,6 +930,9 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
 
     pa_sink_process_rewind(u->sink, amount);
     pa_memblockq_rewind(u->input_q, nbytes);
+
+    if (u->convolver && nbytes > 0)
+        rebuild_convolver_state(u);
 }
 
 /* Called from I/O thread context */
@@ -775,7 +944,11 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
 
     /* FIXME: Too small max_rewind:
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
-    pa_memblockq_set_maxrewind(u->input_q, nbytes);
+    if (u->convolver)
+        /* Keep the history the filter state is rebuilt from on rewinds */
+        pa_memblockq_set_maxrewind(u->input_q, nbytes + pa_convolver_get_history(u->convolver) * pa_frame_size(&u->sink->sample_spec));
+    else
+        pa_memblockq_set_maxrewind(u->input_q, nbytes);
     pa_sink_set_max_rewind_within_thread(u->sink, nbytes);
 }
 
@@ -787,6 +960,11 @@ static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
 
+    if (u->convolver) {
+        pa_sink_set_max_request_within_thread(u->sink, nbytes);
+        return;
+    }
+
     fs = pa_frame_size(&u->sink_input->sample_spec);
     pa_sink_set_max_request_within_thread(u->sink, PA_ROUND_UP(nbytes / fs, u->R) * fs);
 }
@@ -836,12 +1014,16 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_sink_set_latency_range_within_thread(u->sink, i->sink->thread_info.min_latency, i->sink->thread_info.max_latency);
     pa_sink_set_fixed_latency_within_thread(u->sink, i->sink->thread_info.fixed_latency);
 
-    fs = pa_frame_size(&u->sink_input->sample_spec);
-    /* set buffer size to max request, no overlap copy */
-    max_request = PA_ROUND_UP(pa_sink_input_get_max_request(u->sink_input) / fs, u->R);
-    max_request = PA_MAX(max_request, u->window_size);
+    if (u->convolver)
+        pa_sink_set_max_request_within_thread(u->sink, pa_sink_input_get_max_request(u->sink_input));
+    else {
+        fs = pa_frame_size(&u->sink_input->sample_spec);
+        /* set buffer size to max request, no overlap copy */
+        max_request = PA_ROUND_UP(pa_sink_input_get_max_request(u->sink_input) / fs, u->R);
+        max_request = PA_MAX(max_request, u->window_size);
 
-    pa_sink_set_max_request_within_thread(u->sink, max_request * fs);
+        pa_sink_set_max_request_within_thread(u->sink, max_request * fs);
+    }
 
     /* FIXME: Too small max_rewind:
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
@@ -999,6 +1181,7 @@ static const char* load_profile(struct userdata *u, size_t channel, char *name)
             u->Xs[channel][a_i] = profile[0];
             memcpy(u->Hs[channel][a_i], profile + 1, FILTER_SIZE(u) * sizeof(float));
             fix_filter(u->Hs[channel][a_i], u->fft_size);
+            update_ir(u, channel, a_i);
             pa_aupdate_write_end(u->a_H[channel]);
             pa_xfree(u->base_profiles[channel]);
             u->base_profiles[channel] = pa_xstrdup(name);
@@ -1039,6 +1222,7 @@ static void load_state(struct userdata *u) {
                 H = state + c * CHANNEL_PROFILE_SIZE(u) + 1;
                 u->Xs[c][a_i] = state[c * CHANNEL_PROFILE_SIZE(u)];
                 memcpy(u->Hs[c][a_i], H, FILTER_SIZE(u) * sizeof(float));
+                update_ir(u, c, a_i);
                 pa_aupdate_write_end(u->a_H[c]);
             }
             unpack(((char *)value.data) + FILTER_STATE_SIZE(u) * sizeof(float), value.size - FILTER_STATE_SIZE(u) * sizeof(float), &names, &n_profs);
@@ -1097,6 +1281,39 @@ static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
         pa_sink_set_asyncmsgq(u->sink, NULL);
 }
 
+/* Planning with FFTW_MEASURE takes long for the large fft_size. The result
+ * is kept on disk, so it is only measured on the first load. */
+static void create_plans(struct userdata *u) {
+    char *path;
+
+    if ((path = pa_state_path(FFTW_WISDOM_FILE, true)) && !fftwf_import_wisdom_from_filename(path))
+        pa_log_debug("No FFTW wisdom in %s", path);
+
+    u->forward_plan = fftwf_plan_dft_r2c_1d(u->fft_size, u->work_buffer, u->output_window, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+    u->inverse_plan = fftwf_plan_dft_c2r_1d(u->fft_size, u->output_window, u->work_buffer, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+
+    if (!u->forward_plan || !u->inverse_plan) {
+        if (u->forward_plan)
+            fftwf_destroy_plan(u->forward_plan);
+        if (u->inverse_plan)
+            fftwf_destroy_plan(u->inverse_plan);
+
+        pa_log_info("Measuring FFTW plans for fft size %zd, this may take a moment.", u->fft_size);
+        fftwf_set_timelimit(FFTW_PLANNING_TIME_LIMIT);
+        u->forward_plan = fftwf_plan_dft_r2c_1d(u->fft_size, u->work_buffer, u->output_window, FFTW_MEASURE);
+        u->inverse_plan = fftwf_plan_dft_c2r_1d(u->fft_size, u->output_window, u->work_buffer, FFTW_MEASURE);
+
+        if (path && !fftwf_export_wisdom_to_filename(path))
+            pa_log_warn("Failed to save FFTW wisdom to %s", path);
+    }
+
+    /* Measuring overwrites the arrays */
+    pa_memzero(u->work_buffer, u->fft_size * sizeof(float));
+    pa_memzero(u->output_window, FILTER_SIZE(u) * sizeof(fftwf_complex));
+
+    pa_xfree(path);
+}
+
 int pa__init(pa_module*m) {
     struct userdata *u;
     pa_sample_spec ss;
@@ -1110,6 +1327,7 @@ int pa__init(pa_module*m) {
     float *H;
     unsigned a_i;
     bool use_volume_sharing = true;
+    bool low_latency = DEFAULT_LOW_LATENCY;
 
     pa_assert(m);
 
@@ -1142,6 +1360,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "low_latency", &low_latency) < 0) {
+        pa_log("low_latency= expects a boolean argument");
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
@@ -1178,12 +1401,29 @@ int pa__init(pa_module*m) {
         u->overlap_accum[c] = alloc(u->overlap_size, sizeof(float));
     }
     u->output_window = alloc(FILTER_SIZE(u), sizeof(fftwf_complex));
-    u->forward_plan = fftwf_plan_dft_r2c_1d(u->fft_size, u->work_buffer, u->output_window, FFTW_ESTIMATE);
-    u->inverse_plan = fftwf_plan_dft_c2r_1d(u->fft_size, u->output_window, u->work_buffer, FFTW_ESTIMATE);
+    create_plans(u);
 
     hanning_window(u->W, u->window_size);
     u->first_iteration = true;
 
+    if (low_latency) {
+        /* The filters are designed on the main thread, so this needs its
+         * own buffers to run the plans on */
+        u->ir_work = alloc(u->fft_size, sizeof(float));
+        u->ir_spectrum = alloc(FILTER_SIZE(u), sizeof(fftwf_complex));
+        u->irs = pa_xnew0(float **, u->channels);
+        u->ir_versions = pa_xnew0(unsigned *, u->channels);
+        u->ir_applied = pa_xnew0(unsigned, u->channels);
+        for (c = 0; c < u->channels; ++c) {
+            u->irs[c] = pa_xnew0(float *, 2);
+            u->ir_versions[c] = pa_xnew0(unsigned, 2);
+            for (i = 0; i < 2; ++i)
+                u->irs[c][i] = alloc(IR_LENGTH(u), sizeof(float));
+        }
+        u->convolver = pa_convolver_new(u->channels, u->channels, PARTITION_SIZE, IR_LENGTH(u));
+        pa_log_debug("low latency mode: %u frames of latency, %zd taps", pa_convolver_get_latency(u->convolver), IR_LENGTH(u));
+    }
+
     u->base_profiles = pa_xnew0(char *, u->channels);
     for (c = 0; c < u->channels; ++c)
         u->base_profiles[c] = pa_xstrdup("default");
@@ -1268,7 +1508,7 @@ int pa__init(pa_module*m) {
     if (!u->sink_input)
         goto fail;
 
-    u->sink_input->pop = sink_input_pop_cb;
+    u->sink_input->pop = u->convolver ? sink_input_pop_low_latency_cb : sink_input_pop_cb;
     u->sink_input->process_rewind = sink_input_process_rewind_cb;
     u->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
     u->sink_input->update_max_request = sink_input_update_max_request_cb;
@@ -1298,6 +1538,7 @@ int pa__init(pa_module*m) {
             H[i] = 1.0 / sqrtf(2.0f);
 
         fix_filter(H, u->fft_size);
+        update_ir(u, c, a_i);
         pa_aupdate_write_end(u->a_H[c]);
     }
 
@@ -1393,6 +1634,21 @@ void pa__done(pa_module*m) {
     pa_xfree(u->Xs);
     pa_xfree(u->Hs);
 
+    if (u->convolver) {
+        pa_convolver_free(u->convolver);
+        for (c = 0; c < u->channels; ++c) {
+            for (size_t i = 0; i < 2; ++i)
+                fftwf_free(u->irs[c][i]);
+            pa_xfree(u->irs[c]);
+            pa_xfree(u->ir_versions[c]);
+        }
+        pa_xfree(u->irs);
+        pa_xfree(u->ir_versions);
+        pa_xfree(u->ir_applied);
+        fftwf_free(u->ir_spectrum);
+        fftwf_free(u->ir_work);
+    }
+
     pa_xfree(u);
 }
 
@@ -1882,9 +2138,11 @@ void equalizer_handle_seed_filter(DBusConnection *conn, DBusMessage *msg, void *
             float *H_p = u->Hs[c][b_i];
             u->Xs[c][b_i] = preamp;
             memcpy(H_p, H, FILTER_SIZE(u) * sizeof(float));
+            update_ir(u, c, b_i);
             pa_aupdate_write_end(u->a_H[c]);
         }
     }
+    update_ir(u, r_channel, a_i);
     pa_aupdate_write_end(u->a_H[r_channel]);
     pa_xfree(ys);
 
@@ -2032,9 +2290,11 @@ static void set_filter(struct userdata *u, size_t channel, double *H_, double pr
             unsigned b_i = pa_aupdate_write_begin(u->a_H[c]);
             u->Xs[c][b_i] = u->Xs[r_channel][a_i];
             memcpy(u->Hs[c][b_i], u->Hs[r_channel][a_i], FILTER_SIZE(u) * sizeof(float));
+            update_ir(u, c, b_i);
             pa_aupdate_write_end(u->a_H[c]);
         }
     }
+    update_ir(u, r_channel, a_i);
     pa_aupdate_write_end(u->a_H[r_channel]);
 }
 
@@ -34,6 +34,7 @@
 #include <pulsecore/sink-input.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/proplist-util.h>
+#include <pulsecore/strbuf.h>
 
 #include "module-filter-apply-symdef.h"
 
@@ -46,15 +47,40 @@ PA_MODULE_AUTHOR("Colin Guthrie");
 PA_MODULE_DESCRIPTION("Load filter sinks automatically when needed");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(true);
-PA_MODULE_USAGE(_("autoclean=<automatically unload unused filters?>"));
+PA_MODULE_USAGE(_("autoclean=<automatically unload unused filters?> "
+                   "unload_delay=<seconds an unused filter stays loaded for new streams> "
+                   "merge_ladspa=<run a stream's LADSPA plugins in the chain of the LADSPA sink it plays on?>"));
 
 static const char* const valid_modargs[] = {
     "autoclean",
+    "unload_delay",
+    "merge_ladspa",
+    NULL
+};
+
+/* module-ladspa-sink arguments that take one '|' separated entry per chain
+ * stage, and the ones that are carried over unchanged when merging */
+static const char* const ladspa_chain_args[] = {
+    "plugin",
+    "label",
+    "control",
+    "input_ladspaport_map",
+    "output_ladspaport_map",
+    NULL
+};
+
+static const char* const ladspa_copied_args[] = {
+    "format",
+    "rate",
+    "channels",
+    "channel_map",
     NULL
 };
 
 #define DEFAULT_AUTOCLEAN true
+#define DEFAULT_MERGE_LADSPA false
 #define HOUSEKEEPING_INTERVAL (10 * PA_USEC_PER_SEC)
+#define DEFAULT_UNLOAD_DELAY 60
 
 struct filter {
     char *name;
@@ -64,6 +90,8 @@ struct filter {
     pa_sink *sink_master;
     pa_source *source;
     pa_source *source_master;
+    /* When housekeeping first found nothing attached, 0 while in use */
+    pa_usec_t idle_since;
 };
 
 struct userdata {
@@ -74,6 +102,8 @@ struct userdata {
      * pa_sink_input/pa_source_output. */
     pa_hashmap *mdm_ignored_inputs, *mdm_ignored_outputs;
     bool autoclean;
+    pa_usec_t unload_delay;
+    bool merge_ladspa;
     pa_time_event *housekeeping_time_event;
 };
 
@@ -96,6 +126,9 @@ static int filter_compare(const void *a, const void *b) {
         return 1;
     if ((r = strcmp(fa->name, fb->name)))
         return r;
+    /* Merged LADSPA chains share the name and master with plain ones */
+    if (!pa_safe_streq(fa->parameters, fb->parameters))
+        return 1;
 
     return 0;
 }
@@ -113,6 +146,7 @@ static struct filter *filter_new(const char *name, const char *parameters, pa_si
     f->module_index = PA_INVALID_INDEX;
     f->sink = NULL;
     f->source = NULL;
+    f->idle_since = 0;
 
     return f;
 }
@@ -318,10 +352,15 @@ static bool nothing_attached(struct filter *f) {
     return no_si && no_so;
 }
 
+/* Unused filters stay loaded for unload_delay, so that streams coming
+ * and going, like calls, find them ready instead of waiting for the
+ * module to initialize again. Meanwhile module-suspend-on-idle, if
+ * loaded, suspends them like any other idle device. */
 static void housekeeping_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct timeval *t, void *userdata) {
     struct userdata *u = userdata;
     struct filter *filter;
     void *state;
+    pa_usec_t now, next = 0;
 
     pa_assert(a);
     pa_assert(e);
@@ -331,8 +370,18 @@ static void housekeeping_time_callback(pa_mainloop_api*a, pa_time_event* e, cons
     u->core->mainloop->time_free(u->housekeeping_time_event);
     u->housekeeping_time_event = NULL;
 
+    now = pa_rtclock_now();
+
     PA_HASHMAP_FOREACH(filter, u->filters, state) {
-        if (nothing_attached(filter)) {
+        if (!nothing_attached(filter)) {
+            filter->idle_since = 0;
+            continue;
+        }
+
+        if (!filter->idle_since)
+            filter->idle_since = now;
+
+        if (now - filter->idle_since >= u->unload_delay) {
             uint32_t idx;
 
             pa_log_debug("Detected filter %s as no longer used. Unloading.", filter->name);
@@ -340,9 +389,14 @@ static void housekeeping_time_callback(pa_mainloop_api*a, pa_time_event* e, cons
             pa_hashmap_remove(u->filters, filter);
             filter_free(filter);
             pa_module_unload_request_by_index(u->core, idx, true);
-        }
+        } else if (!next || filter->idle_since + u->unload_delay < next)
+            next = filter->idle_since + u->unload_delay;
     }
 
+    /* Check again when the first of the remaining unused filters expires */
+    if (next)
+        u->housekeeping_time_event = pa_core_rttime_new(u->core, next, housekeeping_time_callback, u);
+
     pa_log_info("Housekeeping Done.");
 }
 
@@ -440,6 +494,90 @@ static void move_objects_for_filter(struct userdata *u, pa_object *o, struct fil
     }
 }
 
+static void append_chain_value(pa_strbuf *buf, const char *value, unsigned n_entries) {
+    char *e;
+    unsigned i;
+
+    if (value) {
+        e = pa_escape(value, "\"\\");
+        pa_strbuf_puts(buf, e);
+        pa_xfree(e);
+        return;
+    }
+
+    /* Keep the entries of the other stages in place */
+    for (i = 1; i < n_entries; i++)
+        pa_strbuf_putc(buf, '|');
+}
+
+/* Builds module-ladspa-sink arguments running the chain of the LADSPA sink
+ * followed by the plugins in parameters, directly on the sink's master. This
+ * avoids stacking a second LADSPA sink, with its own rewinds and buffering,
+ * on top of the first one. Returns NULL if there is nothing to merge. */
+static char *merge_ladspa_parameters(pa_sink *sink, const char *parameters) {
+    pa_modargs *sink_args = NULL, *stream_args = NULL;
+    const char *sink_plugin, *sink_label, *plugin, *label, *p;
+    unsigned n_entries = 1, i;
+    pa_strbuf *buf;
+    char *r = NULL;
+
+    if (!parameters || !sink->module || !sink->input_to_master)
+        return NULL;
+
+    if (!(sink_args = pa_modargs_new(sink->module->argument, NULL)) ||
+        !(stream_args = pa_modargs_new(parameters, NULL)))
+        goto finish;
+
+    sink_plugin = pa_modargs_get_value(sink_args, "plugin", NULL);
+    sink_label = pa_modargs_get_value(sink_args, "label", NULL);
+    plugin = pa_modargs_get_value(stream_args, "plugin", NULL);
+    label = pa_modargs_get_value(stream_args, "label", NULL);
+
+    if (!sink_plugin || !sink_label || !plugin || !label)
+        goto finish;
+
+    /* The sink already runs the requested plugin */
+    if (strstr(sink_plugin, plugin) && strstr(sink_label, label))
+        goto finish;
+
+    for (p = sink_plugin; *p; p++)
+        if (*p == '|')
+            n_entries++;
+
+    buf = pa_strbuf_new();
+
+    for (i = 0; ladspa_chain_args[i]; i++) {
+        const char *a = pa_modargs_get_value(sink_args, ladspa_chain_args[i], NULL);
+        const char *b = pa_modargs_get_value(stream_args, ladspa_chain_args[i], NULL);
+
+        if (!a && !b)
+            continue;
+
+        pa_strbuf_printf(buf, "%s=\"", ladspa_chain_args[i]);
+        append_chain_value(buf, a, n_entries);
+        pa_strbuf_putc(buf, '|');
+        append_chain_value(buf, b, 1);
+        pa_strbuf_puts(buf, "\" ");
+    }
+
+    for (i = 0; ladspa_copied_args[i]; i++) {
+        const char *a = pa_modargs_get_value(sink_args, ladspa_copied_args[i], NULL);
+
+        if (a)
+            pa_strbuf_printf(buf, "%s=%s ", ladspa_copied_args[i], a);
+    }
+
+    r = pa_strbuf_to_string_free(buf);
+
+finish:
+    if (sink_args)
+        pa_modargs_free(sink_args);
+    if (stream_args)
+        pa_modargs_free(stream_args);
+
+    return r;
+}
+
 /* Note that we assume a filter will provide at most one sink and at most one
  * source (and at least one of either). */
 static void find_filters_for_module(struct userdata *u, pa_module *m, const char *name, const char *parameters) {
@@ -500,7 +638,7 @@ static pa_hook_result_t process(struct userdata *u, pa_object *o, bool is_sink_i
     pa_sink *sink = NULL;
     pa_source *source = NULL;
     pa_module *module = NULL;
-    char *module_name = NULL;
+    char *module_name = NULL, *merged_parameters = NULL;
     struct filter *fltr = NULL, *filter = NULL;
     pa_proplist *pl;
 
@@ -528,8 +666,17 @@ static pa_hook_result_t process(struct userdata *u, pa_object *o, bool is_sink_i
 
         module_name = pa_sprintf_malloc("module-%s", want);
         if (pa_streq(module->name, module_name)) {
-            pa_log_debug("Stream appears to be playing on an appropriate sink already. Ignoring.");
-            goto done;
+            /* A stream wanting other LADSPA plugins than its LADSPA sink
+             * runs can get a single sink with both chains on the master */
+            if (!is_sink_input || !u->merge_ladspa || !pa_streq(want, "ladspa-sink") ||
+                pa_proplist_gets(pl, PA_PROP_FILTER_APPLY_SET_BY_MFA) ||
+                !(merged_parameters = merge_ladspa_parameters(sink, get_filter_parameters(o, want, is_sink_input)))) {
+                pa_log_debug("Stream appears to be playing on an appropriate sink already. Ignoring.");
+                goto done;
+            }
+
+            pa_log_debug("Merging the stream's LADSPA plugins into the chain of %s.", sink->name);
+            sink = sink->input_to_master->sink;
         }
 
         /* If the stream originally did not have the filter.apply property set and is
@@ -552,7 +699,7 @@ static pa_hook_result_t process(struct userdata *u, pa_object *o, bool is_sink_i
 
         /* Some filter modules might require parameters by default.
          * (e.g 'plugin', 'label', 'control' of module-ladspa-sink) */
-        parameters = get_filter_parameters(o, want, is_sink_input);
+        parameters = merged_parameters ? merged_parameters : get_filter_parameters(o, want, is_sink_input);
 
         fltr = filter_new(want, parameters, sink, source);
 
@@ -617,6 +764,7 @@ done:
         trigger_housekeeping(u);
 
     pa_xfree(module_name);
+    pa_xfree(merged_parameters);
     filter_free(fltr);
 
     return PA_HOOK_OK;
@@ -789,6 +937,7 @@ static void unset_mdm_ignore_output(pa_source_output *o)
 int pa__init(pa_module *m) {
     pa_modargs *ma = NULL;
     struct userdata *u;
+    uint32_t unload_delay;
 
     pa_assert(m);
 
@@ -807,6 +956,19 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    unload_delay = DEFAULT_UNLOAD_DELAY;
+    if (pa_modargs_get_value_u32(ma, "unload_delay", &unload_delay) < 0) {
+        pa_log("Failed to parse unload_delay value");
+        goto fail;
+    }
+    u->unload_delay = (pa_usec_t) unload_delay * PA_USEC_PER_SEC;
+
+    u->merge_ladspa = DEFAULT_MERGE_LADSPA;
+    if (pa_modargs_get_value_boolean(ma, "merge_ladspa", &u->merge_ladspa) < 0) {
+        pa_log("Failed to parse merge_ladspa value");
+        goto fail;
+    }
+
     u->filters = pa_hashmap_new(filter_hash, filter_compare);
     u->mdm_ignored_inputs = pa_hashmap_new_full(NULL, NULL, (pa_free_cb_t) unset_mdm_ignore_input, NULL);
     u->mdm_ignored_outputs = pa_hashmap_new_full(NULL, NULL, (pa_free_cb_t) unset_mdm_ignore_output, NULL);
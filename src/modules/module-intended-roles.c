@@ -391,7 +391,9 @@ int pa__init(pa_module*m) {
 
     /* A little bit later than module-stream-restore */
     u->sink_input_new_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_NEW], PA_HOOK_EARLY+10, (pa_hook_cb_t) sink_input_new_hook_callback, u);
+    pa_hook_slot_match_proplist(u->sink_input_new_hook_slot, PA_PROP_MEDIA_ROLE, NULL);
     u->source_output_new_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_NEW], PA_HOOK_EARLY+10, (pa_hook_cb_t) source_output_new_hook_callback, u);
+    pa_hook_slot_match_proplist(u->source_output_new_hook_slot, PA_PROP_MEDIA_ROLE, NULL);
 
     if (on_hotplug) {
         /* A little bit later than module-stream-restore */
@@ -17,8 +17,12 @@
   along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
 ***/
 
-/* TODO: Some plugins cause latency, and some even report it by using a control
-   out port. We don't currently use the latency information. */
+/* Several plugins can be chained in one sink by separating the plugin, label,
+   control and port map arguments with '|'. The chain is run in place on a
+   single deinterleaved copy of the audio, so each additional stage costs only
+   the plugin's own processing. Plugins reporting latency by the common
+   convention of a control out port named "latency" get it added to the sink
+   latency. */
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -37,6 +41,7 @@
 #include <pulsecore/log.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/strbuf.h>
 #include <pulsecore/ltdl-helper.h>
 
 #ifdef HAVE_DBUS
@@ -60,30 +65,56 @@ PA_MODULE_USAGE(
       "rate=<sample rate> "
       "channels=<number of channels> "
       "channel_map=<input channel map> "
-      "plugin=<ladspa plugin name> "
-      "label=<ladspa plugin label> "
-      "control=<comma separated list of input control values> "
-      "input_ladspaport_map=<comma separated list of input LADSPA port names> "
-      "output_ladspaport_map=<comma separated list of output LADSPA port names> "
+      "plugin=<ladspa plugin name, '|' separated for a chain> "
+      "label=<ladspa plugin label, '|' separated for a chain> "
+      "control=<comma separated list of input control values, '|' separated for a chain> "
+      "input_ladspaport_map=<comma separated list of input LADSPA port names, '|' separated for a chain> "
+      "output_ladspaport_map=<comma separated list of output LADSPA port names, '|' separated for a chain> "
       "autoloaded=<set if this module is being loaded automatically> "));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED false
+#define CHAIN_SEPARATOR "|"
 
 /* PLEASE NOTICE: The PortAudio ports and the LADSPA ports are two different concepts.
 They are not related and where possible the names of the LADSPA port variables contains "ladspa" to avoid confusion */
 
+/* One stage of the plugin chain. Instance h processes the channels starting
+   at h * max_ladspaport_count. */
+struct plugin {
+    lt_dlhandle dl;
+    const LADSPA_Descriptor *descriptor;
+    LADSPA_Handle handle[PA_CHANNELS_MAX];
+    unsigned long max_ladspaport_count, input_count, output_count, n_instances;
+    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
+
+    /* Scratch output buffers, only for plugins that can't run in place */
+    LADSPA_Data **output;
+
+    /* This stage's slice of the userdata control and use_default arrays */
+    LADSPA_Data *control;
+    bool *use_default;
+    long unsigned n_control;
+
+    /* Value of the "latency" control out port in frames, if the plugin has one */
+    LADSPA_Data latency;
+};
+
 struct userdata {
     pa_module *module;
 
     pa_sink *sink;
     pa_sink_input *sink_input;
 
-    const LADSPA_Descriptor *descriptor;
-    LADSPA_Handle handle[PA_CHANNELS_MAX];
-    unsigned long max_ladspaport_count, input_count, output_count, channels;
-    LADSPA_Data **input, **output;
+    struct plugin *plugins;
+    unsigned n_plugins;
+    unsigned long channels;
+
+    /* Deinterleaved audio, one buffer per channel, shared by all stages */
+    LADSPA_Data **work;
     size_t block_size;
+
+    /* Control values of all stages, concatenated in chain order */
     LADSPA_Data *control;
     long unsigned n_control;
 
@@ -335,6 +366,35 @@ static void dbus_done(struct userdata *u) {
 
 #endif /* HAVE_DBUS */
 
+/* Called from I/O thread context */
+static pa_usec_t get_plugin_latency(struct userdata *u) {
+    uint64_t frames = 0;
+    unsigned k;
+
+    for (k = 0; k < u->n_plugins; k++)
+        if (u->plugins[k].latency > 0)
+            frames += (uint64_t) u->plugins[k].latency;
+
+    return pa_bytes_to_usec(frames * pa_frame_size(&u->ss), &u->ss);
+}
+
+/* Called from I/O thread context */
+static void reset_plugins(struct userdata *u) {
+    unsigned k;
+    unsigned long h;
+
+    for (k = 0; k < u->n_plugins; k++) {
+        struct plugin *p = &u->plugins[k];
+
+        if (p->descriptor->deactivate)
+            for (h = 0; h < p->n_instances; h++)
+                p->descriptor->deactivate(p->handle[h]);
+        if (p->descriptor->activate)
+            for (h = 0; h < p->n_instances; h++)
+                p->descriptor->activate(p->handle[h]);
+    }
+}
+
 /* Called from I/O thread context */
 static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SINK(o)->userdata;
@@ -358,7 +418,10 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
             pa_sink_get_latency_within_thread(u->sink_input->sink, true) +
 
             /* Add the latency internal to our sink input on top */
-            pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
+            pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec) +
+
+            /* And the latency the plugins report */
+            get_plugin_latency(u);
 
         return 0;
 
@@ -458,8 +521,10 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     struct userdata *u;
     float *src, *dst;
     size_t fs;
-    unsigned n, h, c;
+    unsigned n, c, k;
+    unsigned long h;
     pa_memchunk tchunk;
+    bool in_place;
 
     pa_sink_input_assert_ref(i);
     pa_assert(chunk);
@@ -487,27 +552,41 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_assert(n > 0);
 
-    chunk->index = 0;
-    chunk->length = n*fs;
-    chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
+    tchunk.length = n*fs;
+    pa_memblockq_drop(u->memblockq, tchunk.length);
 
-    pa_memblockq_drop(u->memblockq, chunk->length);
+    /* The input is fully read into the work buffers before the output is
+     * written, so it can be the same block */
+    in_place = pa_memchunk_filter_output(chunk, &tchunk, tchunk.length);
 
     src = pa_memblock_acquire_chunk(&tchunk);
-    dst = pa_memblock_acquire(chunk->memblock);
-
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        for (c = 0; c < u->input_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c], sizeof(float), src+ h*u->max_ladspaport_count + c, u->channels*sizeof(float), n);
-        u->descriptor->run(u->handle[h], n);
-        for (c = 0; c < u->output_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->output[c], sizeof(float), n);
+    dst = pa_memblock_acquire_chunk(chunk);
+
+    /* Deinterleave once, run all stages on the work buffers and interleave
+     * once at the end */
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->work[c], sizeof(float), src + c, u->channels*sizeof(float), n);
+
+    for (k = 0; k < u->n_plugins; k++) {
+        struct plugin *p = &u->plugins[k];
+
+        for (h = 0; h < p->n_instances; h++) {
+            p->descriptor->run(p->handle[h], n);
+
+            if (p->output)
+                for (c = 0; c < p->output_count; c++)
+                    memcpy(u->work[h*p->max_ladspaport_count + c], p->output[c], n * sizeof(float));
+        }
     }
 
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + c, u->channels*sizeof(float), u->work[c], sizeof(float), n);
+
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
 
-    pa_memblock_unref(tchunk.memblock);
+    if (!in_place)
+        pa_memblock_unref(tchunk.memblock);
 
     return 0;
 }
@@ -532,19 +611,11 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         u->sink->thread_info.rewind_nbytes = 0;
 
         if (amount > 0) {
-            unsigned c;
-
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, true);
 
-            pa_log_debug("Resetting plugin");
+            pa_log_debug("Resetting plugins");
 
-            /* Reset the plugin */
-            if (u->descriptor->deactivate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->deactivate(u->handle[c]);
-            if (u->descriptor->activate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->activate(u->handle[c]);
+            reset_plugins(u);
         }
     }
 
@@ -701,23 +772,22 @@ static void sink_input_mute_changed_cb(pa_sink_input *i) {
     pa_sink_mute_changed(u->sink, i->muted);
 }
 
-static int parse_control_parameters(struct userdata *u, const char *cdata, double *read_values, bool *use_default) {
+static int parse_control_parameters(unsigned long n_control, const char *cdata, double *read_values, bool *use_default) {
     unsigned long p = 0;
     const char *state = NULL;
     char *k;
 
     pa_assert(read_values);
     pa_assert(use_default);
-    pa_assert(u);
 
-    pa_log_debug("Trying to read %lu control values", u->n_control);
+    pa_log_debug("Trying to read %lu control values", n_control);
 
-    if (!cdata && u->n_control > 0)
+    if (!cdata && n_control > 0)
         return -1;
 
     pa_log_debug("cdata: '%s'", cdata);
 
-    while ((k = pa_split(cdata, ",", &state)) && p < u->n_control) {
+    while ((k = pa_split(cdata, ",", &state)) && p < n_control) {
         double f;
 
         if (*k == 0) {
@@ -744,19 +814,19 @@ static int parse_control_parameters(struct userdata *u, const char *cdata, doubl
     /* The previous loop doesn't take the last control value into account
        if it is left empty, so we do it here. */
     if (*cdata == 0 || cdata[strlen(cdata) - 1] == ',') {
-        if (p < u->n_control)
+        if (p < n_control)
             use_default[p] = true;
         p++;
     }
 
-    if (p > u->n_control || k) {
-        pa_log("Too many control values passed, %lu expected.", u->n_control);
+    if (p > n_control || k) {
+        pa_log("Too many control values passed, %lu expected.", n_control);
         pa_xfree(k);
         goto fail;
     }
 
-    if (p < u->n_control) {
-        pa_log("Not enough control values passed, %lu expected, %lu passed.", u->n_control, p);
+    if (p < n_control) {
+        pa_log("Not enough control values passed, %lu expected, %lu passed.", n_control, p);
         goto fail;
     }
 
@@ -766,207 +836,400 @@ fail:
     return -1;
 }
 
+static LADSPA_Data *control_out_buffer(struct userdata *u, struct plugin *pl, unsigned long p) {
+    if (strcasecmp(pl->descriptor->PortNames[p], "latency") == 0)
+        return &pl->latency;
+
+    return &u->control_out;
+}
+
 static void connect_control_ports(struct userdata *u) {
-    unsigned long p = 0, h = 0, c;
-    const LADSPA_Descriptor *d;
+    unsigned long p, h, c;
+    unsigned k;
 
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
 
-    for (p = 0; p < d->PortCount; p++) {
-        if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
-            continue;
+    for (k = 0; k < u->n_plugins; k++) {
+        struct plugin *pl = &u->plugins[k];
+        const LADSPA_Descriptor *d = pl->descriptor;
 
-        if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
-            continue;
-        }
+        for (p = 0, h = 0; p < d->PortCount; p++) {
+            if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
+                continue;
+
+            if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
+                for (c = 0; c < pl->n_instances; c++)
+                    d->connect_port(pl->handle[c], p, control_out_buffer(u, pl, p));
+                continue;
+            }
 
-        /* input control port */
+            /* input control port */
 
-        pa_log_debug("Binding %f to port %s", u->control[h], d->PortNames[p]);
+            pa_log_debug("Binding %f to port %s", pl->control[h], d->PortNames[p]);
 
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->connect_port(u->handle[c], p, &u->control[h]);
+            for (c = 0; c < pl->n_instances; c++)
+                d->connect_port(pl->handle[c], p, &pl->control[h]);
 
-        h++;
+            h++;
+        }
     }
 }
 
 static int validate_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
     unsigned long p = 0, h = 0;
-    const LADSPA_Descriptor *d;
+    unsigned k;
     pa_sample_spec ss;
 
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
 
     ss = u->ss;
 
     /* Iterate over all ports. Check for every control port that 1) it
      * supports default values if a default value is provided and 2) the
-     * provided value is within the limits specified in the plugin. */
+     * provided value is within the limits specified in the plugin. h
+     * runs over the control ports of the whole chain. */
 
-    for (p = 0; p < d->PortCount; p++) {
-        LADSPA_PortRangeHintDescriptor hint = d->PortRangeHints[p].HintDescriptor;
+    for (k = 0; k < u->n_plugins; k++) {
+        const LADSPA_Descriptor *d = u->plugins[k].descriptor;
 
-        if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
-            continue;
+        for (p = 0; p < d->PortCount; p++) {
+            LADSPA_PortRangeHintDescriptor hint = d->PortRangeHints[p].HintDescriptor;
 
-        if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p]))
-            continue;
+            if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
+                continue;
 
-        if (use_default[h]) {
-            /* User wants to use default value. Check if the plugin
-             * provides it. */
-            if (!LADSPA_IS_HINT_HAS_DEFAULT(hint)) {
-                pa_log_warn("Control port value left empty but plugin defines no default.");
-                return -1;
-            }
-        }
-        else {
-            /* Check if the user-provided value is within the bounds. */
-            LADSPA_Data lower = d->PortRangeHints[p].LowerBound;
-            LADSPA_Data upper = d->PortRangeHints[p].UpperBound;
-
-            if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
-                upper *= (LADSPA_Data) ss.rate;
-                lower *= (LADSPA_Data) ss.rate;
-            }
+            if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p]))
+                continue;
 
-            if (LADSPA_IS_HINT_BOUNDED_ABOVE(hint)) {
-                if (control_values[h] > upper) {
-                    pa_log_warn("Control value %lu over upper bound: %f (upper bound: %f)", h, control_values[h], upper);
+            if (use_default[h]) {
+                /* User wants to use default value. Check if the plugin
+                 * provides it. */
+                if (!LADSPA_IS_HINT_HAS_DEFAULT(hint)) {
+                    pa_log_warn("Control port value left empty but plugin defines no default.");
                     return -1;
                 }
             }
-            if (LADSPA_IS_HINT_BOUNDED_BELOW(hint)) {
-                if (control_values[h] < lower) {
-                    pa_log_warn("Control value %lu below lower bound: %f (lower bound: %f)", h, control_values[h], lower);
-                    return -1;
+            else {
+                /* Check if the user-provided value is within the bounds. */
+                LADSPA_Data lower = d->PortRangeHints[p].LowerBound;
+                LADSPA_Data upper = d->PortRangeHints[p].UpperBound;
+
+                if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
+                    upper *= (LADSPA_Data) ss.rate;
+                    lower *= (LADSPA_Data) ss.rate;
+                }
+
+                if (LADSPA_IS_HINT_BOUNDED_ABOVE(hint)) {
+                    if (control_values[h] > upper) {
+                        pa_log_warn("Control value %lu over upper bound: %f (upper bound: %f)", h, control_values[h], upper);
+                        return -1;
+                    }
+                }
+                if (LADSPA_IS_HINT_BOUNDED_BELOW(hint)) {
+                    if (control_values[h] < lower) {
+                        pa_log_warn("Control value %lu below lower bound: %f (lower bound: %f)", h, control_values[h], lower);
+                        return -1;
+                    }
                 }
             }
-        }
 
-        h++;
+            h++;
+        }
     }
 
     return 0;
 }
 
 static int write_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
-    unsigned long p = 0, h = 0, c;
-    const LADSPA_Descriptor *d;
+    unsigned long p = 0, h = 0;
+    unsigned k;
     pa_sample_spec ss;
 
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
 
     ss = u->ss;
 
     if (validate_control_parameters(u, control_values, use_default) < 0)
         return -1;
 
-    /* p iterates over all ports, h is the control port iterator */
+    /* p iterates over all ports of a plugin, h is the control port
+     * iterator of the whole chain. The ports are bound to the new values
+     * by connect_control_ports(). */
 
-    for (p = 0; p < d->PortCount; p++) {
-        LADSPA_PortRangeHintDescriptor hint = d->PortRangeHints[p].HintDescriptor;
+    for (k = 0; k < u->n_plugins; k++) {
+        const LADSPA_Descriptor *d = u->plugins[k].descriptor;
 
-        if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
-            continue;
+        for (p = 0; p < d->PortCount; p++) {
+            LADSPA_PortRangeHintDescriptor hint = d->PortRangeHints[p].HintDescriptor;
 
-        if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
-            continue;
-        }
+            if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
+                continue;
+
+            if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p]))
+                continue;
 
-        if (use_default[h]) {
+            if (use_default[h]) {
 
-            LADSPA_Data lower, upper;
+                LADSPA_Data lower, upper;
 
-            lower = d->PortRangeHints[p].LowerBound;
-            upper = d->PortRangeHints[p].UpperBound;
+                lower = d->PortRangeHints[p].LowerBound;
+                upper = d->PortRangeHints[p].UpperBound;
 
-            if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
-                lower *= (LADSPA_Data) ss.rate;
-                upper *= (LADSPA_Data) ss.rate;
+                if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
+                    lower *= (LADSPA_Data) ss.rate;
+                    upper *= (LADSPA_Data) ss.rate;
+                }
+
+                switch (hint & LADSPA_HINT_DEFAULT_MASK) {
+
+                case LADSPA_HINT_DEFAULT_MINIMUM:
+                    u->control[h] = lower;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_MAXIMUM:
+                    u->control[h] = upper;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_LOW:
+                    if (LADSPA_IS_HINT_LOGARITHMIC(hint))
+                        u->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
+                    else
+                        u->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
+                    break;
+
+                case LADSPA_HINT_DEFAULT_MIDDLE:
+                    if (LADSPA_IS_HINT_LOGARITHMIC(hint))
+                        u->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
+                    else
+                        u->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
+                    break;
+
+                case LADSPA_HINT_DEFAULT_HIGH:
+                    if (LADSPA_IS_HINT_LOGARITHMIC(hint))
+                        u->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
+                    else
+                        u->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
+                    break;
+
+                case LADSPA_HINT_DEFAULT_0:
+                    u->control[h] = 0;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_1:
+                    u->control[h] = 1;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_100:
+                    u->control[h] = 100;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_440:
+                    u->control[h] = 440;
+                    break;
+
+                default:
+                    pa_assert_not_reached();
+                }
+            }
+            else {
+                if (LADSPA_IS_HINT_INTEGER(hint)) {
+                    u->control[h] = roundf(control_values[h]);
+                }
+                else {
+                    u->control[h] = control_values[h];
+                }
             }
 
-            switch (hint & LADSPA_HINT_DEFAULT_MASK) {
+            h++;
+        }
+    }
 
-            case LADSPA_HINT_DEFAULT_MINIMUM:
-                u->control[h] = lower;
-                break;
+    /* set the use_default array to the user data */
+    memcpy(u->use_default, use_default, u->n_control * sizeof(u->use_default[0]));
 
-            case LADSPA_HINT_DEFAULT_MAXIMUM:
-                u->control[h] = upper;
-                break;
+    return 0;
+}
 
-            case LADSPA_HINT_DEFAULT_LOW:
-                if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
-                else
-                    u->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
-                break;
+static int parse_ladspaport_map(const LADSPA_Descriptor *d, const char *map, bool output, unsigned long count, unsigned long *ladspaport) {
+    const char *state = NULL;
+    char *pname;
+    unsigned long p, c = 0;
 
-            case LADSPA_HINT_DEFAULT_MIDDLE:
-                if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
-                else
-                    u->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
-                break;
+    while ((pname = pa_split(map, ",", &state))) {
+        if (c == count) {
+            pa_log("Too many ports in %s ladspa port map", output ? "output" : "input");
+            pa_xfree(pname);
+            return -1;
+        }
 
-            case LADSPA_HINT_DEFAULT_HIGH:
-                if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
-                else
-                    u->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
-                break;
+        for (p = 0; p < d->PortCount; p++) {
+            if (pa_streq(d->PortNames[p], pname)) {
+                if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p]) &&
+                    (output ? LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p]) : LADSPA_IS_PORT_INPUT(d->PortDescriptors[p]))) {
+                    ladspaport[c] = p;
+                } else {
+                    pa_log("Port %s is not an audio %s ladspa port", pname, output ? "output" : "input");
+                    pa_xfree(pname);
+                    return -1;
+                }
+            }
+        }
+        c++;
+        pa_xfree(pname);
+    }
 
-            case LADSPA_HINT_DEFAULT_0:
-                u->control[h] = 0;
-                break;
+    return 0;
+}
 
-            case LADSPA_HINT_DEFAULT_1:
-                u->control[h] = 1;
-                break;
+/* Loads one stage of the chain and connects its audio ports to the work
+ * buffers. Control ports are connected later, once the values of all stages
+ * have been parsed. */
+static int load_plugin(struct userdata *u, struct plugin *pl, const char *search_path, const char *plugin, const char *label,
+                       const char *input_ladspaport_map, const char *output_ladspaport_map) {
+    LADSPA_Descriptor_Function descriptor_func;
+    const LADSPA_Descriptor *d;
+    unsigned long p, h, j, c;
+    char *t;
 
-            case LADSPA_HINT_DEFAULT_100:
-                u->control[h] = 100;
-                break;
+    /* FIXME: This is not exactly thread safe */
+    t = pa_xstrdup(lt_dlgetsearchpath());
+    lt_dlsetsearchpath(search_path);
+    pl->dl = lt_dlopenext(plugin);
+    lt_dlsetsearchpath(t);
+    pa_xfree(t);
 
-            case LADSPA_HINT_DEFAULT_440:
-                u->control[h] = 440;
-                break;
+    if (!pl->dl) {
+        pa_log("Failed to load LADSPA plugin: %s", lt_dlerror());
+        return -1;
+    }
 
-            default:
-                pa_assert_not_reached();
-            }
+    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(pl->dl, NULL, "ladspa_descriptor"))) {
+        pa_log("LADSPA module lacks ladspa_descriptor() symbol.");
+        return -1;
+    }
+
+    for (j = 0;; j++) {
+
+        if (!(d = descriptor_func(j))) {
+            pa_log("Failed to find plugin label '%s' in plugin '%s'.", label, plugin);
+            return -1;
         }
-        else {
-            if (LADSPA_IS_HINT_INTEGER(hint)) {
-                u->control[h] = roundf(control_values[h]);
-            }
-            else {
-                u->control[h] = control_values[h];
+
+        if (pa_streq(d->Label, label))
+            break;
+    }
+
+    pl->descriptor = d;
+
+    pa_log_debug("Module: %s", plugin);
+    pa_log_debug("Label: %s", d->Label);
+    pa_log_debug("Unique ID: %lu", d->UniqueID);
+    pa_log_debug("Name: %s", d->Name);
+    pa_log_debug("Maker: %s", d->Maker);
+    pa_log_debug("Copyright: %s", d->Copyright);
+
+    pl->max_ladspaport_count = 1;
+
+    /*
+    * Enumerate ladspa ports
+    * Default mapping is in order given by the plugin
+    */
+    for (p = 0; p < d->PortCount; p++) {
+        unsigned long port_count;
+
+        if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p])) {
+            if (LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
+                pa_log_debug("Port %lu is input: %s", p, d->PortNames[p]);
+                if (pl->input_count == PA_CHANNELS_MAX) {
+                    pa_log("Too many audio input ports");
+                    return -1;
+                }
+                pl->input_ladspaport[pl->input_count] = p;
+                pl->input_count++;
+            } else if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
+                pa_log_debug("Port %lu is output: %s", p, d->PortNames[p]);
+                if (pl->output_count == PA_CHANNELS_MAX) {
+                    pa_log("Too many audio output ports");
+                    return -1;
+                }
+                pl->output_ladspaport[pl->output_count] = p;
+                pl->output_count++;
             }
-        }
+        } else if (LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
+            pa_log_debug("Port %lu is control: %s", p, d->PortNames[p]);
+            pl->n_control++;
+        } else
+            pa_log_debug("Ignored port %s", d->PortNames[p]);
+        /* XXX: Has anyone ever seen an in-place plugin with non-equal number of input and output ports? */
+        /* Could be if the plugin is for up-mixing stereo to 5.1 channels */
+        /* Or if the plugin is down-mixing 5.1 to two channel stereo or binaural encoded signal */
+        port_count = PA_MAX(pl->input_count, pl->output_count);
+        pl->max_ladspaport_count = PA_MAX(pl->max_ladspaport_count, port_count);
+    }
 
-        h++;
+    if (u->channels % pl->max_ladspaport_count) {
+        pa_log("Cannot handle non-integral number of plugins required for given number of channels");
+        return -1;
     }
 
-    /* set the use_default array to the user data */
-    memcpy(u->use_default, use_default, u->n_control * sizeof(u->use_default[0]));
+    pl->n_instances = u->channels / pl->max_ladspaport_count;
+
+    pa_log_debug("Will run %lu plugin instances", pl->n_instances);
+
+    if (input_ladspaport_map && *input_ladspaport_map) {
+        if (parse_ladspaport_map(d, input_ladspaport_map, false, pl->input_count, pl->input_ladspaport) < 0)
+            return -1;
+    } else
+        pa_log_debug("Using default input ladspa port mapping");
+
+    if (output_ladspaport_map && *output_ladspaport_map) {
+        if (parse_ladspaport_map(d, output_ladspaport_map, true, pl->output_count, pl->output_ladspaport) < 0)
+            return -1;
+    } else
+        pa_log_debug("Using default output ladspa port mapping");
+
+    /* Plugins that can't run in place get their own output buffers, which
+     * are copied back to the work buffers after each run */
+    if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
+        pl->output = pa_xnew0(LADSPA_Data*, (unsigned) pl->output_count);
+        for (c = 0; c < pl->output_count; c++)
+            pl->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
+    }
+
+    /* Initialize plugin instances */
+    for (h = 0; h < pl->n_instances; h++) {
+        LADSPA_Data **work = u->work + h * pl->max_ladspaport_count;
+
+        if (!(pl->handle[h] = d->instantiate(d, u->ss.rate))) {
+            pa_log("Failed to instantiate plugin %s with label %s", plugin, d->Label);
+            return -1;
+        }
+
+        for (c = 0; c < pl->input_count; c++)
+            d->connect_port(pl->handle[h], pl->input_ladspaport[c], work[c]);
+        for (c = 0; c < pl->output_count; c++)
+            d->connect_port(pl->handle[h], pl->output_ladspaport[c], pl->output ? pl->output[c] : work[c]);
+    }
 
     return 0;
 }
 
+/* Returns the next '|' separated entry of a chain argument, or NULL if the
+ * argument isn't set or has no more entries */
+static char *next_chain_entry(const char *arg, const char **state) {
+    return arg ? pa_split(arg, CHAIN_SEPARATOR, state) : NULL;
+}
+
+static void append_plugin_field(pa_strbuf *buf, const char *v) {
+    if (!pa_strbuf_isempty(buf))
+        pa_strbuf_puts(buf, CHAIN_SEPARATOR);
+    pa_strbuf_puts(buf, v);
+}
+
 int pa__init(pa_module*m) {
     struct userdata *u;
     pa_sample_spec ss;
@@ -978,11 +1241,11 @@ int pa__init(pa_module*m) {
     pa_sink_input_new_data sink_input_data;
     pa_sink_new_data sink_data;
     const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
-    LADSPA_Descriptor_Function descriptor_func;
-    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
+    const char *plugin_state = NULL, *label_state = NULL, *input_state = NULL, *output_state = NULL, *control_state = NULL;
     const char *e, *cdata;
-    const LADSPA_Descriptor *d;
-    unsigned long p, h, j, n_control, c;
+    unsigned long h, c;
+    unsigned k;
+    pa_strbuf *names, *makers, *copyrights, *unique_ids;
     pa_memchunk silence;
 
     pa_assert(m);
@@ -1031,22 +1294,27 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
-    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
-        pa_log_debug("Using default input ladspa port mapping");
-
-    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
-        pa_log_debug("Using default output ladspa port mapping");
-
+    input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL);
+    output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL);
     cdata = pa_modargs_get_value(ma, "control", NULL);
 
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
-    u->max_ladspaport_count = 1; /*to avoid division by zero etc. in pa__done when failing before this value has been set*/
-    u->channels = 0;
-    u->input = NULL;
-    u->output = NULL;
+    u->channels = ss.channels;
     u->ss = ss;
+    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
+
+    /* One stage per '|' separated entry of the plugin argument */
+    u->n_plugins = 1;
+    for (e = plugin; *e; e++)
+        if (*e == CHAIN_SEPARATOR[0])
+            u->n_plugins++;
+    u->plugins = pa_xnew0(struct plugin, u->n_plugins);
+
+    u->work = pa_xnew0(LADSPA_Data*, (unsigned) u->channels);
+    for (c = 0; c < u->channels; c++)
+        u->work[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
 
     /* If the LADSPA_PATH environment variable is not set, we use the
      * LADSPA_PATH preprocessor macro instead. The macro can contain characters
@@ -1058,171 +1326,42 @@ int pa__init(pa_module*m) {
         e = QUOTE_MACRO(LADSPA_PATH);
 #undef QUOTE_MACRO
 
-    /* FIXME: This is not exactly thread safe */
-    t = pa_xstrdup(lt_dlgetsearchpath());
-    lt_dlsetsearchpath(e);
-    m->dl = lt_dlopenext(plugin);
-    lt_dlsetsearchpath(t);
-    pa_xfree(t);
+    for (k = 0; k < u->n_plugins; k++) {
+        char *plugin_name, *plugin_label, *input_map, *output_map;
+        int r;
 
-    if (!m->dl) {
-        pa_log("Failed to load LADSPA plugin: %s", lt_dlerror());
-        goto fail;
-    }
+        plugin_name = next_chain_entry(plugin, &plugin_state);
+        plugin_label = next_chain_entry(label, &label_state);
+        input_map = next_chain_entry(input_ladspaport_map, &input_state);
+        output_map = next_chain_entry(output_ladspaport_map, &output_state);
 
-    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(m->dl, NULL, "ladspa_descriptor"))) {
-        pa_log("LADSPA module lacks ladspa_descriptor() symbol.");
-        goto fail;
-    }
+        if (!plugin_name || !*plugin_name || !plugin_label) {
+            pa_log("Missing LADSPA plugin name or label for chain entry %u", k);
+            r = -1;
+        } else
+            r = load_plugin(u, &u->plugins[k], e, plugin_name, plugin_label, input_map, output_map);
 
-    for (j = 0;; j++) {
+        pa_xfree(plugin_name);
+        pa_xfree(plugin_label);
+        pa_xfree(input_map);
+        pa_xfree(output_map);
 
-        if (!(d = descriptor_func(j))) {
-            pa_log("Failed to find plugin label '%s' in plugin '%s'.", label, plugin);
+        if (r < 0)
             goto fail;
-        }
 
-        if (pa_streq(d->Label, label))
-            break;
+        u->n_control += u->plugins[k].n_control;
     }
 
-    u->descriptor = d;
-
-    pa_log_debug("Module: %s", plugin);
-    pa_log_debug("Label: %s", d->Label);
-    pa_log_debug("Unique ID: %lu", d->UniqueID);
-    pa_log_debug("Name: %s", d->Name);
-    pa_log_debug("Maker: %s", d->Maker);
-    pa_log_debug("Copyright: %s", d->Copyright);
-
-    n_control = 0;
-    u->channels = ss.channels;
-
-    /*
-    * Enumerate ladspa ports
-    * Default mapping is in order given by the plugin
-    */
-    for (p = 0; p < d->PortCount; p++) {
-        if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p])) {
-            if (LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
-                pa_log_debug("Port %lu is input: %s", p, d->PortNames[p]);
-                input_ladspaport[u->input_count] = p;
-                u->input_count++;
-            } else if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-                pa_log_debug("Port %lu is output: %s", p, d->PortNames[p]);
-                output_ladspaport[u->output_count] = p;
-                u->output_count++;
-            }
-        } else if (LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
-            pa_log_debug("Port %lu is control: %s", p, d->PortNames[p]);
-            n_control++;
-        } else
-            pa_log_debug("Ignored port %s", d->PortNames[p]);
-        /* XXX: Has anyone ever seen an in-place plugin with non-equal number of input and output ports? */
-        /* Could be if the plugin is for up-mixing stereo to 5.1 channels */
-        /* Or if the plugin is down-mixing 5.1 to two channel stereo or binaural encoded signal */
-        if (u->input_count > u->max_ladspaport_count)
-            u->max_ladspaport_count = u->input_count;
-        else
-            u->max_ladspaport_count = u->output_count;
-    }
-
-    if (u->channels % u->max_ladspaport_count) {
-        pa_log("Cannot handle non-integral number of plugins required for given number of channels");
+    if ((t = next_chain_entry(label, &label_state))) {
+        pa_log("More LADSPA plugin labels than plugins given");
+        pa_xfree(t);
         goto fail;
     }
 
-    pa_log_debug("Will run %lu plugin instances", u->channels / u->max_ladspaport_count);
-
-    /* Parse data for input ladspa port map */
-    if (input_ladspaport_map) {
-        const char *state = NULL;
-        char *pname;
-        c = 0;
-        while ((pname = pa_split(input_ladspaport_map, ",", &state))) {
-            if (c == u->input_count) {
-                pa_log("Too many ports in input ladspa port map");
-                pa_xfree(pname);
-                goto fail;
-            }
-
-            for (p = 0; p < d->PortCount; p++) {
-                if (pa_streq(d->PortNames[p], pname)) {
-                    if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
-                        input_ladspaport[c] = p;
-                    } else {
-                        pa_log("Port %s is not an audio input ladspa port", pname);
-                        pa_xfree(pname);
-                        goto fail;
-                    }
-                }
-            }
-            c++;
-            pa_xfree(pname);
-        }
-    }
-
-    /* Parse data for output port map */
-    if (output_ladspaport_map) {
-        const char *state = NULL;
-        char *pname;
-        c = 0;
-        while ((pname = pa_split(output_ladspaport_map, ",", &state))) {
-            if (c == u->output_count) {
-                pa_log("Too many ports in output ladspa port map");
-                pa_xfree(pname);
-                goto fail;
-            }
-            for (p = 0; p < d->PortCount; p++) {
-                if (pa_streq(d->PortNames[p], pname)) {
-                    if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p]) && LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-                        output_ladspaport[c] = p;
-                    } else {
-                        pa_log("Port %s is not an output ladspa port", pname);
-                        pa_xfree(pname);
-                        goto fail;
-                    }
-                }
-            }
-            c++;
-            pa_xfree(pname);
-        }
-    }
-
-    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
-
-    /* Create buffers */
-    if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->input_count);
-        for (c = 0; c < u->input_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->output_count);
-        for (c = 0; c < u->output_count; c++)
-            u->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-    } else {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->max_ladspaport_count);
-        for (c = 0; c < u->max_ladspaport_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = u->input;
-    }
-    /* Initialize plugin instances */
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        if (!(u->handle[h] = d->instantiate(d, ss.rate))) {
-            pa_log("Failed to instantiate plugin %s with label %s", plugin, d->Label);
-            goto fail;
-        }
-
-        for (c = 0; c < u->input_count; c++)
-            d->connect_port(u->handle[h], input_ladspaport[c], u->input[c]);
-        for (c = 0; c < u->output_count; c++)
-            d->connect_port(u->handle[h], output_ladspaport[c], u->output[c]);
-    }
-
-    u->n_control = n_control;
-
     if (u->n_control > 0) {
         double *control_values;
         bool *use_default;
+        unsigned long offset = 0;
 
         /* temporary storage for parser */
         control_values = pa_xnew(double, (unsigned) u->n_control);
@@ -1232,8 +1371,28 @@ int pa__init(pa_module*m) {
         u->control = pa_xnew(LADSPA_Data, (unsigned) u->n_control);
         u->use_default = pa_xnew(bool, (unsigned) u->n_control);
 
-        if ((parse_control_parameters(u, cdata, control_values, use_default) < 0) ||
-            (write_control_parameters(u, control_values, use_default) < 0)) {
+        for (k = 0; k < u->n_plugins; k++) {
+            struct plugin *pl = &u->plugins[k];
+            int r = 0;
+
+            pl->control = u->control + offset;
+            pl->use_default = u->use_default + offset;
+
+            /* A missing entry is an empty control list, as long as the
+             * control argument was given at all */
+            t = next_chain_entry(cdata, &control_state);
+
+            if (pl->n_control > 0)
+                r = parse_control_parameters(pl->n_control, t ? t : (cdata ? "" : NULL), control_values + offset, use_default + offset);
+
+            pa_xfree(t);
+            offset += pl->n_control;
+
+            if (r < 0)
+                break;
+        }
+
+        if (k < u->n_plugins || write_control_parameters(u, control_values, use_default) < 0) {
             pa_xfree(control_values);
             pa_xfree(use_default);
 
@@ -1244,11 +1403,17 @@ int pa__init(pa_module*m) {
         connect_control_ports(u);
         pa_xfree(control_values);
         pa_xfree(use_default);
-    }
+    } else
+        /* Control out ports still need to be connected */
+        connect_control_ports(u);
 
-    if (d->activate)
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->activate(u->handle[c]);
+    for (k = 0; k < u->n_plugins; k++) {
+        struct plugin *pl = &u->plugins[k];
+
+        if (pl->descriptor->activate)
+            for (h = 0; h < pl->n_instances; h++)
+                pl->descriptor->activate(pl->handle[h]);
+    }
 
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
@@ -1261,11 +1426,36 @@ int pa__init(pa_module*m) {
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
     pa_proplist_sets(sink_data.proplist, "device.ladspa.module", plugin);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", d->Label);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.name", d->Name);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", d->Maker);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.copyright", d->Copyright);
-    pa_proplist_setf(sink_data.proplist, "device.ladspa.unique_id", "%lu", (unsigned long) d->UniqueID);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", label);
+
+    names = pa_strbuf_new();
+    makers = pa_strbuf_new();
+    copyrights = pa_strbuf_new();
+    unique_ids = pa_strbuf_new();
+
+    for (k = 0; k < u->n_plugins; k++) {
+        const LADSPA_Descriptor *d = u->plugins[k].descriptor;
+
+        append_plugin_field(names, d->Name);
+        append_plugin_field(makers, d->Maker);
+        append_plugin_field(copyrights, d->Copyright);
+        if (!pa_strbuf_isempty(unique_ids))
+            pa_strbuf_puts(unique_ids, CHAIN_SEPARATOR);
+        pa_strbuf_printf(unique_ids, "%lu", (unsigned long) d->UniqueID);
+    }
+
+    t = pa_strbuf_to_string_free(names);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.name", t);
+    pa_xfree(t);
+    t = pa_strbuf_to_string_free(makers);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", t);
+    pa_xfree(t);
+    t = pa_strbuf_to_string_free(copyrights);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.copyright", t);
+    pa_xfree(t);
+    t = pa_strbuf_to_string_free(unique_ids);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.unique_id", t);
+    pa_xfree(t);
 
     if (pa_modargs_get_proplist(ma, "sink_properties", sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
         pa_log("Invalid properties");
@@ -1283,7 +1473,8 @@ int pa__init(pa_module*m) {
         const char *z;
 
         z = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
-        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s", d->Name, z ? z : master->name);
+        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s",
+                         pa_proplist_gets(sink_data.proplist, "device.ladspa.name"), z ? z : master->name);
     }
 
     u->sink = pa_sink_new(m->core, &sink_data,
@@ -1377,7 +1568,8 @@ int pa__get_n_used(pa_module *m) {
 
 void pa__done(pa_module*m) {
     struct userdata *u;
-    unsigned c;
+    unsigned long h, c;
+    unsigned k;
 
     pa_assert(m);
 
@@ -1405,31 +1597,32 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    for (c = 0; c < (u->channels / u->max_ladspaport_count); c++) {
-        if (u->handle[c]) {
-            if (u->descriptor->deactivate)
-                u->descriptor->deactivate(u->handle[c]);
-            u->descriptor->cleanup(u->handle[c]);
-        }
-    }
+    for (k = 0; k < u->n_plugins; k++) {
+        struct plugin *pl = &u->plugins[k];
 
-    if (u->output == u->input) {
-        if (u->input != NULL) {
-            for (c = 0; c < u->max_ladspaport_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-    } else {
-        if (u->input != NULL) {
-            for (c = 0; c < u->input_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
+        for (h = 0; h < pl->n_instances; h++) {
+            if (pl->handle[h]) {
+                if (pl->descriptor->deactivate)
+                    pl->descriptor->deactivate(pl->handle[h]);
+                pl->descriptor->cleanup(pl->handle[h]);
+            }
         }
-        if (u->output != NULL) {
-            for (c = 0; c < u->output_count; c++)
-                pa_xfree(u->output[c]);
-            pa_xfree(u->output);
+
+        if (pl->output) {
+            for (c = 0; c < pl->output_count; c++)
+                pa_xfree(pl->output[c]);
+            pa_xfree(pl->output);
         }
+
+        if (pl->dl)
+            lt_dlclose(pl->dl);
+    }
+    pa_xfree(u->plugins);
+
+    if (u->work) {
+        for (c = 0; c < u->channels; c++)
+            pa_xfree(u->work[c]);
+        pa_xfree(u->work);
     }
 
     if (u->memblockq)
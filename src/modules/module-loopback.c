@@ -23,6 +23,7 @@
 #endif
 
 #include <stdio.h>
+#include <math.h>
 
 #include <pulse/xmalloc.h>
 
@@ -32,6 +33,7 @@
 #include <pulsecore/namereg.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/time-smoother.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
@@ -45,7 +47,7 @@ PA_MODULE_LOAD_ONCE(false);
 PA_MODULE_USAGE(
         "source=<source to connect to> "
         "sink=<sink to connect to> "
-        "adjust_time=<how often to readjust rates in s> "
+        "adjust_time=<time in s to correct a latency offset, 0 to disable> "
         "latency_msec=<latency in ms> "
         "format=<sample format> "
         "rate=<sample rate> "
@@ -65,6 +67,22 @@ PA_MODULE_USAGE(
 
 #define DEFAULT_ADJUST_TIME_USEC (10*PA_USEC_PER_SEC)
 
+/* Smoothers tracking the source and sink clocks against the system clock */
+#define SMOOTHER_WINDOW_USEC (10*PA_USEC_PER_SEC)
+#define SMOOTHER_ADJUST_USEC (1*PA_USEC_PER_SEC)
+
+/* Give the smoothers this long after a reset before using their output */
+#define RATIO_SETTLE_USEC (2*PA_USEC_PER_SEC)
+
+/* The clock ratio is estimated over a span of one to two windows */
+#define RATIO_WINDOW_USEC (10*PA_USEC_PER_SEC)
+
+/* Time constant for smoothing the measured end to end latency */
+#define RATE_SMOOTH_USEC (1*PA_USEC_PER_SEC)
+
+/* The sink input never runs more than this much faster or slower than the source */
+#define RATE_MAX_RATIO 0.01
+
 typedef struct loopback_msg loopback_msg;
 
 struct userdata {
@@ -125,6 +143,7 @@ struct userdata {
         size_t loopback_memblockq_length;
         int64_t sink_latency;
         pa_usec_t sink_timestamp;
+        uint32_t sink_input_rate;
     } latency_snapshot;
 
     /* Input thread variable */
@@ -144,6 +163,31 @@ struct userdata {
         bool pop_adjust;
         bool first_pop_done;
         bool push_called;
+
+        /* Clock drift estimation and rate control. The smoothers and
+         * base_rate are set up before the streams are created, the rest is
+         * only touched by the output thread. */
+        struct {
+            pa_smoother *source_smoother;
+            pa_smoother *sink_smoother;
+            uint32_t base_rate;
+
+            pa_usec_t reset_time;
+            int64_t recv_base;
+            double sink_time;
+
+            struct {
+                pa_usec_t time;
+                pa_usec_t source;
+                pa_usec_t sink;
+            } ref, next_ref;
+            double ratio;
+
+            pa_usec_t timestamp;
+            double latency;
+            double integral;
+            double rate;
+        } drift;
     } output_thread_info;
 };
 
@@ -229,27 +273,6 @@ static void teardown(struct userdata *u) {
     }
 }
 
-/* rate controller, called from main context
- * - maximum deviation from base rate is less than 1%
- * - can create audible artifacts by changing the rate too quickly
- * - exhibits hunting with USB or Bluetooth sources
- */
-static uint32_t rate_controller(
-                uint32_t base_rate,
-                pa_usec_t adjust_time,
-                int32_t latency_difference_usec) {
-
-    uint32_t new_rate;
-    double min_cycles;
-
-    /* Calculate best rate to correct the current latency offset, limit at
-     * slightly below 1% difference from base_rate */
-    min_cycles = (double)abs(latency_difference_usec) / adjust_time / 0.01 + 1;
-    new_rate = base_rate * (1.0 + (double)latency_difference_usec / min_cycles / adjust_time);
-
-    return new_rate;
-}
-
 /* Called from main thread.
  * It has been a matter of discussion how to correctly calculate the minimum
  * latency that module-loopback can deliver with a given source and sink.
@@ -311,7 +334,7 @@ static void update_minimum_latency(struct userdata *u, pa_sink *sink, bool print
 /* Called from main context */
 static void adjust_rates(struct userdata *u) {
     size_t buffer;
-    uint32_t old_rate, base_rate, new_rate, run_hours;
+    uint32_t old_rate, base_rate, run_hours;
     int32_t latency_difference;
     pa_usec_t current_buffer_latency, snapshot_delay;
     int64_t current_source_sink_latency, current_latency, latency_at_optimum_rate;
@@ -350,7 +373,7 @@ static void adjust_rates(struct userdata *u) {
     u->adjust_time_stamp = now;
 
     /* Rates and latencies*/
-    old_rate = u->sink_input->sample_spec.rate;
+    old_rate = u->latency_snapshot.sink_input_rate;
     base_rate = u->source_output->sample_spec.rate;
 
     buffer = u->latency_snapshot.loopback_memblockq_length;
@@ -378,16 +401,15 @@ static void adjust_rates(struct userdata *u) {
                 (double) u->latency_snapshot.source_latency / PA_USEC_PER_MSEC,
                 (double) current_latency / PA_USEC_PER_MSEC);
 
-    pa_log_debug("Loopback latency at base rate is %0.2f ms", (double)latency_at_optimum_rate / PA_USEC_PER_MSEC);
-
-    /* Calculate new rate */
-    new_rate = rate_controller(base_rate, u->real_adjust_time, latency_difference);
+    pa_log_debug("Loopback latency at base rate is %0.2f ms, %0.2f ms off target",
+                (double)latency_at_optimum_rate / PA_USEC_PER_MSEC,
+                (double)latency_difference / PA_USEC_PER_MSEC);
 
     u->source_sink_changed = false;
 
-    /* Set rate */
-    pa_sink_input_set_rate(u->sink_input, new_rate);
-    pa_log_debug("[%s] Updated sampling rate to %lu Hz.", u->sink_input->sink->name, (unsigned long) new_rate);
+    /* The rate itself is steered by the output thread, see
+     * adjust_rate_within_thread() */
+    pa_log_debug("[%s] Sampling rate is %lu Hz.", u->sink_input->sink->name, (unsigned long) old_rate);
 }
 
 /* Called from main context */
@@ -398,6 +420,8 @@ static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct tim
     pa_assert(a);
     pa_assert(u->time_event == e);
 
+    pa_core_count_wakeup(u->core, "loopback");
+
     /* Restart timer right away */
     pa_core_rttime_restart(u->core, u->time_event, pa_rtclock_now() + u->adjust_time);
 
@@ -520,6 +544,218 @@ static void memblockq_adjust(struct userdata *u, int64_t latency_offset_usec, bo
     }
 }
 
+/* Called from output thread context
+ * Returns the source and sink latency of a chunk that has just been pushed to
+ * the memblockq. Added to the length of the memblockq, this is the end to end
+ * latency. */
+static int64_t get_chunk_latency_offset(struct userdata *u, int64_t source_latency, pa_usec_t push_time, const pa_memchunk *chunk, pa_usec_t now) {
+    int64_t time_delta;
+
+    /* This is the source latency at the time push was called */
+    time_delta = source_latency;
+    /* Add the time between push and post */
+    time_delta += now - push_time;
+    /* Add the sink latency */
+    time_delta += pa_sink_get_latency_within_thread(u->sink_input->sink, true);
+
+    /* The source latency report includes the audio in the chunk,
+     * but since we already pushed the chunk to the memblockq, we need
+     * to subtract the chunk size from the source latency so that it
+     * won't be counted towards both the memblockq latency and the
+     * source latency.
+     *
+     * Sometimes the alsa source reports way too low latency (might
+     * be a bug in the alsa source code). This seems to happen when
+     * there's an overrun. As an attempt to detect overruns, we
+     * check if the chunk size is larger than the configured source
+     * latency. If so, we assume that the source should have pushed
+     * a chunk whose size equals the configured latency, so we
+     * modify time_delta only by that amount, which makes
+     * memblockq_adjust() drop more data than it would otherwise.
+     * This seems to work quite well, but it's possible that the
+     * next push also contains too much data, and in that case the
+     * resulting latency will be wrong. */
+    if (pa_bytes_to_usec(chunk->length, &u->sink_input->sample_spec) > u->output_thread_info.effective_source_latency)
+        time_delta -= (int64_t)u->output_thread_info.effective_source_latency;
+    else
+        time_delta -= (int64_t)pa_bytes_to_usec(chunk->length, &u->sink_input->sample_spec);
+
+    return time_delta;
+}
+
+/* Called from output thread context
+ * The rate is only steered while both streams are running and the memblockq
+ * has received its final adjustment */
+static bool rate_control_active(struct userdata *u) {
+    return u->output_thread_info.push_called &&
+           u->output_thread_info.pop_called &&
+           !u->output_thread_info.pop_adjust;
+}
+
+/* Called from output thread context
+ * Restarts the clock drift estimation and returns to the base rate */
+static void reset_rate_control(struct userdata *u, pa_usec_t now) {
+    pa_sink_input *i = u->sink_input;
+
+    pa_smoother_reset(u->output_thread_info.drift.source_smoother, now, false);
+    pa_smoother_reset(u->output_thread_info.drift.sink_smoother, now, false);
+
+    u->output_thread_info.drift.reset_time = now;
+    u->output_thread_info.drift.recv_base = u->output_thread_info.recv_counter;
+    u->output_thread_info.drift.sink_time = 0;
+    u->output_thread_info.drift.ref.time = 0;
+    u->output_thread_info.drift.ratio = 1.0;
+    u->output_thread_info.drift.timestamp = 0;
+    u->output_thread_info.drift.integral = 0;
+
+    if (i->thread_info.sample_spec.rate != u->output_thread_info.drift.base_rate) {
+        i->thread_info.sample_spec.rate = u->output_thread_info.drift.base_rate;
+        pa_resampler_set_input_rate(i->thread_info.resampler, u->output_thread_info.drift.base_rate);
+    }
+}
+
+/* Called from output thread context
+ * Feeds the source smoother with the amount of audio the source has captured
+ * at push_time: everything received since the reset plus what was still
+ * buffered in the source. */
+static void update_source_clock(struct userdata *u, int64_t source_latency, pa_usec_t push_time) {
+    int64_t captured;
+
+    captured = source_latency;
+    if (u->output_thread_info.recv_counter > u->output_thread_info.drift.recv_base)
+        captured += (int64_t) pa_bytes_to_usec((uint64_t) (u->output_thread_info.recv_counter - u->output_thread_info.drift.recv_base),
+                                               &u->source_output->sample_spec);
+
+    if (captured > 0)
+        pa_smoother_put(u->output_thread_info.drift.source_smoother, push_time, (pa_usec_t) captured);
+}
+
+/* Called from output thread context
+ * Feeds the sink smoother with the amount of audio the sink has played, then
+ * accounts for nbytes just popped. The sink consumes our data at the sink input
+ * rate, so counting popped frames at that rate yields sink clock time. */
+static void update_sink_clock(struct userdata *u, size_t nbytes) {
+    pa_sink_input *i = u->sink_input;
+    int64_t played;
+
+    played = (int64_t) llrint(u->output_thread_info.drift.sink_time);
+    played -= pa_sink_get_latency_within_thread(i->sink, true);
+    played -= (int64_t) pa_bytes_to_usec(pa_memblockq_get_length(i->thread_info.render_memblockq), &i->sink->sample_spec);
+
+    if (played > 0)
+        pa_smoother_put(u->output_thread_info.drift.sink_smoother, pa_rtclock_now(), (pa_usec_t) played);
+
+    u->output_thread_info.drift.sink_time += (double) (nbytes / pa_frame_size(&i->thread_info.sample_spec)) *
+                                             PA_USEC_PER_SEC / i->thread_info.sample_spec.rate;
+}
+
+/* Called from output thread context
+ * Returns the ratio of source to sink clock speed. The slopes of both smoothers
+ * are compared over the last one to two RATIO_WINDOW_USEC, which keeps the
+ * jitter of individual pushes and pops out of the estimate. */
+static double get_clock_ratio(struct userdata *u, pa_usec_t now) {
+    pa_usec_t source, sink;
+
+    if (now < u->output_thread_info.drift.reset_time + RATIO_SETTLE_USEC)
+        return u->output_thread_info.drift.ratio;
+
+    source = pa_smoother_get(u->output_thread_info.drift.source_smoother, now);
+    sink = pa_smoother_get(u->output_thread_info.drift.sink_smoother, now);
+
+    if (u->output_thread_info.drift.ref.time == 0) {
+        u->output_thread_info.drift.ref.time = now;
+        u->output_thread_info.drift.ref.source = source;
+        u->output_thread_info.drift.ref.sink = sink;
+        u->output_thread_info.drift.next_ref = u->output_thread_info.drift.ref;
+        return u->output_thread_info.drift.ratio;
+    }
+
+    if (now >= u->output_thread_info.drift.next_ref.time + RATIO_WINDOW_USEC) {
+        u->output_thread_info.drift.ref = u->output_thread_info.drift.next_ref;
+        u->output_thread_info.drift.next_ref.time = now;
+        u->output_thread_info.drift.next_ref.source = source;
+        u->output_thread_info.drift.next_ref.sink = sink;
+    }
+
+    if (now < u->output_thread_info.drift.ref.time + SMOOTHER_ADJUST_USEC ||
+        source <= u->output_thread_info.drift.ref.source ||
+        sink <= u->output_thread_info.drift.ref.sink)
+        return u->output_thread_info.drift.ratio;
+
+    u->output_thread_info.drift.ratio = (double) (source - u->output_thread_info.drift.ref.source) /
+                                        (double) (sink - u->output_thread_info.drift.ref.sink);
+    u->output_thread_info.drift.ratio = PA_CLAMP(u->output_thread_info.drift.ratio, 1.0 - RATE_MAX_RATIO, 1.0 + RATE_MAX_RATIO);
+
+    return u->output_thread_info.drift.ratio;
+}
+
+/* Called from output thread context
+ * Steers the sink input rate on every push. The clock ratio is applied
+ * directly, a PI controller removes the remaining latency offset. */
+static void adjust_rate_within_thread(struct userdata *u, int64_t latency, pa_usec_t now) {
+    pa_sink_input *i = u->sink_input;
+    double dt, ratio, error, kp, ki, correction, limit;
+    pa_usec_t target;
+    uint32_t new_rate;
+
+    if (u->output_thread_info.drift.timestamp == 0 || now <= u->output_thread_info.drift.timestamp) {
+        u->output_thread_info.drift.timestamp = now;
+        u->output_thread_info.drift.latency = (double) latency;
+        u->output_thread_info.drift.rate = (double) i->thread_info.sample_spec.rate;
+        return;
+    }
+
+    dt = (double) (now - u->output_thread_info.drift.timestamp);
+    u->output_thread_info.drift.timestamp = now;
+
+    /* The latency seen here jumps by a chunk on every push and pop, so
+     * smooth it before using it */
+    u->output_thread_info.drift.latency += ((double) latency - u->output_thread_info.drift.latency) * dt / (dt + (double) RATE_SMOOTH_USEC);
+
+    ratio = get_clock_ratio(u, now);
+
+    if (u->adjust_time == 0)
+        return;
+
+    target = PA_MAX(u->latency, u->output_thread_info.minimum_latency);
+
+    /* The latency changes by the relative rate offset per unit of time, so
+     * an offset is corrected within roughly adjust_time. The integral term
+     * takes up what the clock ratio estimate misses. ki = kp²/4 keeps the
+     * loop critically damped. */
+    error = (u->output_thread_info.drift.latency - (double) target) / PA_USEC_PER_SEC;
+    dt /= PA_USEC_PER_SEC;
+    kp = (double) PA_USEC_PER_SEC / (double) u->adjust_time;
+    ki = kp * kp / 4;
+
+    u->output_thread_info.drift.integral += error * dt;
+
+    /* Don't let the integral wind up beyond what the rate limit allows */
+    limit = RATE_MAX_RATIO / ki;
+    u->output_thread_info.drift.integral = PA_CLAMP(u->output_thread_info.drift.integral, -limit, limit);
+
+    correction = kp * error + ki * u->output_thread_info.drift.integral;
+    correction = PA_CLAMP(correction, -RATE_MAX_RATIO, RATE_MAX_RATIO);
+
+    u->output_thread_info.drift.rate = (double) u->output_thread_info.drift.base_rate * ratio * (1.0 + correction);
+    u->output_thread_info.drift.rate = PA_CLAMP(u->output_thread_info.drift.rate,
+                                                u->output_thread_info.drift.base_rate * (1.0 - RATE_MAX_RATIO),
+                                                u->output_thread_info.drift.base_rate * (1.0 + RATE_MAX_RATIO));
+
+    /* The resampler only takes whole rates. Move by at most 1 Hz per
+     * push, so the rate follows the controller output in tiny steps. */
+    new_rate = i->thread_info.sample_spec.rate;
+    if (u->output_thread_info.drift.rate >= (double) new_rate + 1.0)
+        new_rate++;
+    else if (u->output_thread_info.drift.rate <= (double) new_rate - 1.0)
+        new_rate--;
+
+    if (new_rate != i->thread_info.sample_spec.rate) {
+        i->thread_info.sample_spec.rate = new_rate;
+        pa_resampler_set_input_rate(i->thread_info.resampler, new_rate);
+    }
+}
+
 /* Called from input thread context */
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
@@ -704,7 +940,7 @@ static void source_output_moving_cb(pa_source_output *o, pa_source *dest) {
     /* Uncork the sink input unless the destination is suspended for other
      * reasons than idle. */
     if (pa_source_get_state(dest) == PA_SOURCE_SUSPENDED)
-        pa_sink_input_cork(u->sink_input, (dest->suspend_cause != PA_SUSPEND_IDLE));
+        pa_sink_input_cork(u->sink_input, !!(dest->suspend_cause & ~(PA_SUSPEND_IDLE|PA_SUSPEND_IDLE_SOFT)));
     else
         pa_sink_input_cork(u->sink_input, false);
 
@@ -802,6 +1038,9 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     chunk->length = PA_MIN(chunk->length, nbytes);
     pa_memblockq_drop(u->memblockq, chunk->length);
 
+    if (rate_control_active(u))
+        update_sink_clock(u, chunk->length);
+
     /* Adjust the memblockq to ensure that there is
      * enough data in the queue to avoid underruns. */
     if (!u->output_thread_info.push_called)
@@ -819,6 +1058,12 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
     pa_assert_se(u = i->userdata);
 
     pa_memblockq_rewind(u->memblockq, nbytes);
+
+    if (rate_control_active(u)) {
+        u->output_thread_info.drift.sink_time -= (double) (nbytes / pa_frame_size(&i->thread_info.sample_spec)) *
+                                                 PA_USEC_PER_SEC / i->thread_info.sample_spec.rate;
+        u->output_thread_info.drift.sink_time = PA_MAX(u->output_thread_info.drift.sink_time, 0.0);
+    }
 }
 
 /* Called from output thread context */
@@ -839,51 +1084,35 @@ static int sink_input_process_msg_cb(pa_msgobject *obj, int code, void *data, in
             break;
         }
 
-        case SINK_INPUT_MESSAGE_POST:
+        case SINK_INPUT_MESSAGE_POST: {
+            int64_t latency_offset;
+            pa_usec_t now;
 
             pa_memblockq_push_align(u->memblockq, chunk);
 
+            now = pa_rtclock_now();
+            latency_offset = get_chunk_latency_offset(u, PA_PTR_TO_INT(data), (pa_usec_t) offset, chunk, now);
+
             /* If push has not been called yet, latency adjustments in sink_input_pop_cb()
              * are enabled. Disable them on first push and correct the memblockq. If pop
              * has not been called yet, wait until the pop_cb() requests the adjustment */
             if (u->output_thread_info.pop_called && (!u->output_thread_info.push_called || u->output_thread_info.pop_adjust)) {
-                int64_t time_delta;
-
-                /* This is the source latency at the time push was called */
-                time_delta = PA_PTR_TO_INT(data);
-                /* Add the time between push and post */
-                time_delta += pa_rtclock_now() - (pa_usec_t) offset;
-                /* Add the sink latency */
-                time_delta += pa_sink_get_latency_within_thread(u->sink_input->sink, true);
-
-                /* The source latency report includes the audio in the chunk,
-                 * but since we already pushed the chunk to the memblockq, we need
-                 * to subtract the chunk size from the source latency so that it
-                 * won't be counted towards both the memblockq latency and the
-                 * source latency.
-                 *
-                 * Sometimes the alsa source reports way too low latency (might
-                 * be a bug in the alsa source code). This seems to happen when
-                 * there's an overrun. As an attempt to detect overruns, we
-                 * check if the chunk size is larger than the configured source
-                 * latency. If so, we assume that the source should have pushed
-                 * a chunk whose size equals the configured latency, so we
-                 * modify time_delta only by that amount, which makes
-                 * memblockq_adjust() drop more data than it would otherwise.
-                 * This seems to work quite well, but it's possible that the
-                 * next push also contains too much data, and in that case the
-                 * resulting latency will be wrong. */
-                if (pa_bytes_to_usec(chunk->length, &u->sink_input->sample_spec) > u->output_thread_info.effective_source_latency)
-                    time_delta -= (int64_t)u->output_thread_info.effective_source_latency;
-                else
-                    time_delta -= (int64_t)pa_bytes_to_usec(chunk->length, &u->sink_input->sample_spec);
 
                 /* FIXME: We allow pushing silence here to fix up the latency. This
                  * might lead to a gap in the stream */
-                memblockq_adjust(u, time_delta, true);
+                memblockq_adjust(u, latency_offset, true);
 
                 u->output_thread_info.pop_adjust = false;
                 u->output_thread_info.push_called = true;
+
+                /* Source and sink are both running now, start tracking their clocks */
+                reset_rate_control(u, now);
+
+            } else if (rate_control_active(u)) {
+                update_source_clock(u, PA_PTR_TO_INT(data), (pa_usec_t) offset);
+                adjust_rate_within_thread(u, latency_offset +
+                                          (int64_t) pa_bytes_to_usec(pa_memblockq_get_length(u->memblockq), &u->sink_input->thread_info.sample_spec),
+                                          now);
             }
 
             /* If pop has not been called yet, make sure the latency does not grow too much.
@@ -910,6 +1139,7 @@ static int sink_input_process_msg_cb(pa_msgobject *obj, int code, void *data, in
             u->output_thread_info.recv_counter += (int64_t) chunk->length;
 
             return 0;
+        }
 
         case SINK_INPUT_MESSAGE_REWIND:
 
@@ -932,6 +1162,7 @@ static int sink_input_process_msg_cb(pa_msgobject *obj, int code, void *data, in
             u->latency_snapshot.sink_latency = pa_sink_get_latency_within_thread(u->sink_input->sink, true) +
                                                pa_bytes_to_usec(length, &u->sink_input->sink->sample_spec);
             u->latency_snapshot.sink_timestamp = pa_rtclock_now();
+            u->latency_snapshot.sink_input_rate = u->sink_input->thread_info.sample_spec.rate;
 
             return 0;
         }
@@ -1088,7 +1319,7 @@ static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
     /* Uncork the source output unless the destination is suspended for other
      * reasons than idle */
     if (pa_sink_get_state(dest) == PA_SINK_SUSPENDED)
-        pa_source_output_cork(u->source_output, (dest->suspend_cause != PA_SUSPEND_IDLE));
+        pa_source_output_cork(u->source_output, !!(dest->suspend_cause & ~(PA_SUSPEND_IDLE|PA_SUSPEND_IDLE_SOFT)));
     else
         pa_source_output_cork(u->source_output, false);
 
@@ -1365,6 +1596,9 @@ int pa__init(pa_module *m) {
 
     u->real_adjust_time = u->adjust_time;
 
+    u->output_thread_info.drift.source_smoother = pa_smoother_new(SMOOTHER_ADJUST_USEC, SMOOTHER_WINDOW_USEC, true, true, 5, pa_rtclock_now(), false);
+    u->output_thread_info.drift.sink_smoother = pa_smoother_new(SMOOTHER_ADJUST_USEC, SMOOTHER_WINDOW_USEC, true, true, 5, pa_rtclock_now(), false);
+
     pa_sink_input_new_data_init(&sink_input_data);
     sink_input_data.driver = __FILE__;
     sink_input_data.module = m;
@@ -1470,6 +1704,8 @@ int pa__init(pa_module *m) {
     if (!u->source_output)
         goto fail;
 
+    u->output_thread_info.drift.base_rate = u->source_output->sample_spec.rate;
+
     u->source_output->parent.process_msg = source_output_process_msg_cb;
     u->source_output->push = source_output_push_cb;
     u->source_output->process_rewind = source_output_process_rewind_cb;
@@ -1488,7 +1724,7 @@ int pa__init(pa_module *m) {
     set_source_output_latency(u, u->source_output->source);
 
     pa_sink_input_get_silence(u->sink_input, &silence);
-    u->memblockq = pa_memblockq_new(
+    u->memblockq = pa_memblockq_new_ring(
             "module-loopback memblockq",
             0,                      /* idx */
             MEMBLOCKQ_MAXLENGTH,    /* maxlength */
@@ -1577,5 +1813,11 @@ void pa__done(pa_module*m) {
     if (u->asyncmsgq)
         pa_asyncmsgq_unref(u->asyncmsgq);
 
+    if (u->output_thread_info.drift.source_smoother)
+        pa_smoother_free(u->output_thread_info.drift.source_smoother);
+
+    if (u->output_thread_info.drift.sink_smoother)
+        pa_smoother_free(u->output_thread_info.drift.sink_smoother);
+
     pa_xfree(u);
 }
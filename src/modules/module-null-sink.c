@@ -31,6 +31,7 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/i18n.h>
+#include <pulsecore/io-thread-pool.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/module.h>
@@ -53,11 +54,19 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "rate=<sample rate> "
         "channels=<number of channels> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "shared_thread_period=<in ms, run on a shared IO thread that wakes up at multiples of this period; 0 for a thread of its own> "
+        "thread_affinity=<CPUs to run the IO thread on, if it is not shared> "
+        "freewheel=<render as fast as the streams deliver data instead of in real time?>");
 
 #define DEFAULT_SINK_NAME "null"
 #define BLOCK_USEC (PA_USEC_PER_SEC * 2)
 
+/* In freewheel mode we render in small blocks so that the streams can keep
+ * up, and give them this long to catch up after one of them ran dry */
+#define FREEWHEEL_BLOCK_USEC (20 * PA_USEC_PER_MSEC)
+#define FREEWHEEL_RETRY_USEC (1 * PA_USEC_PER_MSEC)
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -67,8 +76,13 @@ struct userdata {
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
 
+    pa_io_client *io_client;
+    char *thread_affinity;
+
     pa_usec_t block_usec;
     pa_usec_t timestamp;
+
+    bool freewheel;
 };
 
 static const char* const valid_modargs[] = {
@@ -78,6 +92,9 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "shared_thread_period",
+    "thread_affinity",
+    "freewheel",
     NULL
 };
 
@@ -103,6 +120,12 @@ static int sink_process_msg(
         case PA_SINK_MESSAGE_GET_LATENCY: {
             pa_usec_t now;
 
+            /* Everything is played the moment it is rendered */
+            if (u->freewheel) {
+                *((int64_t*) data) = 0;
+                return 0;
+            }
+
             now = pa_rtclock_now();
             *((int64_t*) data) = (int64_t)u->timestamp - (int64_t)now;
 
@@ -178,15 +201,15 @@ static void process_render(struct userdata *u, pa_usec_t now) {
 
     /* Fill the buffer up the latency size */
     while (u->timestamp < now + u->block_usec) {
-        pa_memchunk chunk;
+        size_t nbytes;
 
-        pa_sink_render(u->sink, u->sink->thread_info.max_request, &chunk);
-        pa_memblock_unref(chunk.memblock);
+        /* Nothing is mixed unless somebody listens on the monitor */
+        nbytes = pa_sink_render_discard(u->sink, u->sink->thread_info.max_request);
 
-/*         pa_log_debug("Ate %lu bytes.", (unsigned long) chunk.length); */
-        u->timestamp += pa_bytes_to_usec(chunk.length, &u->sink->sample_spec);
+/*         pa_log_debug("Ate %lu bytes.", (unsigned long) nbytes); */
+        u->timestamp += pa_bytes_to_usec(nbytes, &u->sink->sample_spec);
 
-        ate += chunk.length;
+        ate += nbytes;
 
         if (ate >= u->sink->thread_info.max_request)
             break;
@@ -195,6 +218,68 @@ static void process_render(struct userdata *u, pa_usec_t now) {
 /*     pa_log_debug("Ate in sum %lu bytes (of %lu)", (unsigned long) ate, (unsigned long) nbytes); */
 }
 
+/* Returns when we want to be woken up next, 0 for never */
+static pa_usec_t process(struct userdata *u) {
+    pa_usec_t now = 0;
+
+    if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
+        now = pa_rtclock_now();
+
+    if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
+        process_rewind(u, now);
+
+    /* Render some data and drop it immediately */
+    if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
+        if (u->timestamp <= now)
+            process_render(u, now);
+
+        return u->timestamp;
+    }
+
+    return 0;
+}
+
+/* True if one of the streams had nothing to give in the last render */
+static bool inputs_starved(struct userdata *u) {
+    pa_sink_input *i;
+    void *state = NULL;
+
+    PA_HASHMAP_FOREACH(i, u->sink->thread_info.inputs, state)
+        if (i->thread_info.state == PA_SINK_INPUT_RUNNING && i->thread_info.underrun_for > 0)
+            return true;
+
+    return false;
+}
+
+/* Like process(), but renders without waiting for the clock. The time of
+ * the sink is the amount of data rendered, hence there is no latency and
+ * nothing to rewind. */
+static pa_usec_t process_freewheel(struct userdata *u) {
+    pa_usec_t now;
+    size_t nbytes;
+
+    if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
+        pa_sink_process_rewind(u->sink, 0);
+
+    /* Without streams there is nothing to hurry for */
+    if (u->sink->thread_info.state != PA_SINK_RUNNING)
+        return 0;
+
+    nbytes = pa_usec_to_bytes(PA_MIN(u->block_usec, FREEWHEEL_BLOCK_USEC), &u->sink->sample_spec);
+    nbytes = pa_sink_render_discard(u->sink, PA_MIN(nbytes, u->sink->thread_info.max_request));
+    u->timestamp += pa_bytes_to_usec(nbytes, &u->sink->sample_spec);
+
+    /* Come back right after handling the messages that arrived meanwhile,
+     * those carry the data of the streams */
+    now = pa_rtclock_now();
+
+    return inputs_starved(u) ? now + FREEWHEEL_RETRY_USEC : now;
+}
+
+static pa_usec_t io_client_cb(pa_io_client *c, void *userdata) {
+    return process(userdata);
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -202,27 +287,20 @@ static void thread_func(void *userdata) {
 
     pa_log_debug("Thread starting up");
 
+    if (u->thread_affinity)
+        pa_set_thread_affinity(u->thread_affinity);
+
     pa_thread_mq_install(&u->thread_mq);
 
     u->timestamp = pa_rtclock_now();
 
     for (;;) {
-        pa_usec_t now = 0;
+        pa_usec_t next;
         int ret;
 
-        if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
-            now = pa_rtclock_now();
-
-        if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
-            process_rewind(u, now);
-
-        /* Render some data and drop it immediately */
-        if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-            if (u->timestamp <= now)
-                process_render(u, now);
-
-            pa_rtpoll_set_timer_absolute(u->rtpoll, u->timestamp);
-        } else
+        if ((next = u->freewheel ? process_freewheel(u) : process(u)) > 0)
+            pa_rtpoll_set_timer_absolute(u->rtpoll, next);
+        else
             pa_rtpoll_set_timer_disabled(u->rtpoll);
 
         /* Hmm, nothing to do. Let's sleep */
@@ -250,6 +328,9 @@ int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     pa_sink_new_data data;
     size_t nbytes;
+    uint32_t shared_thread_period = 0;
+    const char *thread_affinity;
+    bool freewheel = false;
 
     pa_assert(m);
 
@@ -265,14 +346,40 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "shared_thread_period", &shared_thread_period) < 0) {
+        pa_log("Failed to parse shared_thread_period value.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "freewheel", &freewheel) < 0) {
+        pa_log("Failed to parse freewheel value.");
+        goto fail;
+    }
+
+    if (freewheel && shared_thread_period > 0) {
+        pa_log("A sink in freewheel mode needs an IO thread of its own.");
+        goto fail;
+    }
+
+    if ((thread_affinity = pa_modargs_get_value(ma, "thread_affinity", m->core->thread_affinity)) &&
+        pa_cpu_list_check(thread_affinity) < 0) {
+        pa_log("Failed to parse thread_affinity value.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
-    u->rtpoll = pa_rtpoll_new();
+    u->thread_affinity = pa_xstrdup(thread_affinity);
+    u->freewheel = freewheel;
 
-    if (pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll) < 0) {
-        pa_log("pa_thread_mq_init() failed.");
-        goto fail;
+    if (shared_thread_period == 0) {
+        u->rtpoll = pa_rtpoll_new();
+
+        if (pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll) < 0) {
+            pa_log("pa_thread_mq_init() failed.");
+            goto fail;
+        }
     }
 
     pa_sink_new_data_init(&data);
@@ -302,17 +409,29 @@ int pa__init(pa_module*m) {
     u->sink->update_requested_latency = sink_update_requested_latency_cb;
     u->sink->userdata = u;
 
-    pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
-    pa_sink_set_rtpoll(u->sink, u->rtpoll);
-
     u->block_usec = BLOCK_USEC;
     nbytes = pa_usec_to_bytes(u->block_usec, &u->sink->sample_spec);
     pa_sink_set_max_rewind(u->sink, nbytes);
     pa_sink_set_max_request(u->sink, nbytes);
 
-    if (!(u->thread = pa_thread_new("null-sink", thread_func, u))) {
-        pa_log("Failed to create thread.");
-        goto fail;
+    if (shared_thread_period > 0) {
+        u->timestamp = pa_rtclock_now();
+
+        if (!(u->io_client = pa_io_client_new(m->core, m, shared_thread_period * PA_USEC_PER_MSEC, io_client_cb, u))) {
+            pa_log("Failed to get a shared IO thread.");
+            goto fail;
+        }
+
+        pa_sink_set_asyncmsgq(u->sink, pa_io_client_get_asyncmsgq(u->io_client));
+        pa_sink_set_rtpoll(u->sink, pa_io_client_get_rtpoll(u->io_client));
+    } else {
+        pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
+        pa_sink_set_rtpoll(u->sink, u->rtpoll);
+
+        if (!(u->thread = pa_thread_new("null-sink", thread_func, u))) {
+            pa_log("Failed to create thread.");
+            goto fail;
+        }
     }
 
     pa_sink_set_latency_range(u->sink, 0, BLOCK_USEC);
@@ -357,6 +476,9 @@ void pa__done(pa_module*m) {
         pa_thread_free(u->thread);
     }
 
+    if (u->io_client)
+        pa_io_client_free(u->io_client);
+
     pa_thread_mq_done(&u->thread_mq);
 
     if (u->sink)
@@ -365,5 +487,6 @@ void pa__done(pa_module*m) {
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
 
+    pa_xfree(u->thread_affinity);
     pa_xfree(u);
 }
@@ -32,6 +32,7 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
+#include <pulsecore/io-thread-pool.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/modargs.h>
@@ -54,7 +55,9 @@ PA_MODULE_USAGE(
         "source_name=<name of source> "
         "channel_map=<channel map> "
         "description=<description for the source> "
-        "latency_time=<latency time in ms>");
+        "latency_time=<latency time in ms> "
+        "shared_thread_period=<in ms, run on a shared IO thread that wakes up at multiples of this period; 0 for a thread of its own> "
+        "thread_affinity=<CPUs to run the IO thread on, if it is not shared>");
 
 #define DEFAULT_SOURCE_NAME "source.null"
 #define DEFAULT_LATENCY_TIME 20
@@ -69,6 +72,9 @@ struct userdata {
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
 
+    pa_io_client *io_client;
+    char *thread_affinity;
+
     size_t block_size;
 
     pa_usec_t block_usec;
@@ -84,6 +90,8 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "description",
     "latency_time",
+    "shared_thread_period",
+    "thread_affinity",
     NULL
 };
 
@@ -121,6 +129,34 @@ static void source_update_requested_latency_cb(pa_source *s) {
     u->block_usec = pa_source_get_requested_latency_within_thread(s);
 }
 
+/* Returns when we want to be woken up next, 0 for never */
+static pa_usec_t process(struct userdata *u) {
+    pa_usec_t now;
+    pa_memchunk chunk;
+
+    if (!PA_SOURCE_IS_OPENED(u->source->thread_info.state))
+        return 0;
+
+    /* Generate some null data */
+    now = pa_rtclock_now();
+
+    if ((chunk.length = pa_usec_to_bytes(now - u->timestamp, &u->source->sample_spec)) > 0) {
+
+        chunk.memblock = pa_memblock_new(u->core->mempool, (size_t) -1); /* or chunk.length? */
+        chunk.index = 0;
+        pa_source_post(u->source, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
+        u->timestamp = now;
+    }
+
+    return u->timestamp + u->latency_time * PA_USEC_PER_MSEC;
+}
+
+static pa_usec_t io_client_cb(pa_io_client *c, void *userdata) {
+    return process(userdata);
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -128,32 +164,20 @@ static void thread_func(void *userdata) {
 
     pa_log_debug("Thread starting up");
 
+    if (u->thread_affinity)
+        pa_set_thread_affinity(u->thread_affinity);
+
     pa_thread_mq_install(&u->thread_mq);
 
     u->timestamp = pa_rtclock_now();
 
     for (;;) {
+        pa_usec_t next;
         int ret;
 
-        /* Generate some null data */
-        if (PA_SOURCE_IS_OPENED(u->source->thread_info.state)) {
-            pa_usec_t now;
-            pa_memchunk chunk;
-
-            now = pa_rtclock_now();
-
-            if ((chunk.length = pa_usec_to_bytes(now - u->timestamp, &u->source->sample_spec)) > 0) {
-
-                chunk.memblock = pa_memblock_new(u->core->mempool, (size_t) -1); /* or chunk.length? */
-                chunk.index = 0;
-                pa_source_post(u->source, &chunk);
-                pa_memblock_unref(chunk.memblock);
-
-                u->timestamp = now;
-            }
-
-            pa_rtpoll_set_timer_absolute(u->rtpoll, u->timestamp + u->latency_time * PA_USEC_PER_MSEC);
-        } else
+        if ((next = process(u)) > 0)
+            pa_rtpoll_set_timer_absolute(u->rtpoll, next);
+        else
             pa_rtpoll_set_timer_disabled(u->rtpoll);
 
         /* Hmm, nothing to do. Let's sleep */
@@ -181,6 +205,8 @@ int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     pa_source_new_data data;
     uint32_t latency_time = DEFAULT_LATENCY_TIME;
+    uint32_t shared_thread_period = 0;
+    const char *thread_affinity;
 
     pa_assert(m);
 
@@ -196,14 +222,29 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "shared_thread_period", &shared_thread_period) < 0) {
+        pa_log("Failed to parse shared_thread_period value.");
+        goto fail;
+    }
+
+    if ((thread_affinity = pa_modargs_get_value(ma, "thread_affinity", m->core->thread_affinity)) &&
+        pa_cpu_list_check(thread_affinity) < 0) {
+        pa_log("Failed to parse thread_affinity value.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
-    u->rtpoll = pa_rtpoll_new();
+    u->thread_affinity = pa_xstrdup(thread_affinity);
 
-    if (pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll) < 0) {
-        pa_log("pa_thread_mq_init() failed.");
-        goto fail;
+    if (shared_thread_period == 0) {
+        u->rtpoll = pa_rtpoll_new();
+
+        if (pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll) < 0) {
+            pa_log("pa_thread_mq_init() failed.");
+            goto fail;
+        }
     }
 
     pa_source_new_data_init(&data);
@@ -234,18 +275,30 @@ int pa__init(pa_module*m) {
     u->source->update_requested_latency = source_update_requested_latency_cb;
     u->source->userdata = u;
 
-    pa_source_set_asyncmsgq(u->source, u->thread_mq.inq);
-    pa_source_set_rtpoll(u->source, u->rtpoll);
-
     pa_source_set_latency_range(u->source, 0, MAX_LATENCY_USEC);
     u->block_usec = u->source->thread_info.max_latency;
 
     u->source->thread_info.max_rewind =
         pa_usec_to_bytes(u->block_usec, &u->source->sample_spec);
 
-    if (!(u->thread = pa_thread_new("null-source", thread_func, u))) {
-        pa_log("Failed to create thread.");
-        goto fail;
+    if (shared_thread_period > 0) {
+        u->timestamp = pa_rtclock_now();
+
+        if (!(u->io_client = pa_io_client_new(m->core, m, shared_thread_period * PA_USEC_PER_MSEC, io_client_cb, u))) {
+            pa_log("Failed to get a shared IO thread.");
+            goto fail;
+        }
+
+        pa_source_set_asyncmsgq(u->source, pa_io_client_get_asyncmsgq(u->io_client));
+        pa_source_set_rtpoll(u->source, pa_io_client_get_rtpoll(u->io_client));
+    } else {
+        pa_source_set_asyncmsgq(u->source, u->thread_mq.inq);
+        pa_source_set_rtpoll(u->source, u->rtpoll);
+
+        if (!(u->thread = pa_thread_new("null-source", thread_func, u))) {
+            pa_log("Failed to create thread.");
+            goto fail;
+        }
     }
 
     pa_source_put(u->source);
@@ -279,6 +332,9 @@ void pa__done(pa_module*m) {
         pa_thread_free(u->thread);
     }
 
+    if (u->io_client)
+        pa_io_client_free(u->io_client);
+
     pa_thread_mq_done(&u->thread_mq);
 
     if (u->source)
@@ -287,5 +343,6 @@ void pa__done(pa_module*m) {
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
 
+    pa_xfree(u->thread_affinity);
     pa_xfree(u);
 }
@@ -45,6 +45,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/poll.h>
+#include <pulsecore/llist.h>
 
 #include "module-pipe-sink-symdef.h"
 
@@ -59,11 +60,21 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "rate=<sample rate> "
         "channels=<number of channels> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "use_vmsplice=<hand the data to the FIFO without copying it?>");
 
 #define DEFAULT_FILE_NAME "fifo_output"
 #define DEFAULT_SINK_NAME "fifo_output"
 
+/* A block handed to the FIFO with vmsplice(), referenced until the reader
+ * has read everything up to end */
+struct spliced_block {
+    PA_LLIST_FIELDS(struct spliced_block);
+
+    pa_memblock *memblock;
+    uint64_t end;
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -82,6 +93,11 @@ struct userdata {
     pa_rtpoll_item *rtpoll_item;
 
     int write_type;
+
+    bool use_vmsplice;
+    uint64_t written;
+    PA_LLIST_HEAD(struct spliced_block, spliced);
+    struct spliced_block *spliced_tail;
 };
 
 static const char* const valid_modargs[] = {
@@ -92,6 +108,7 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "use_vmsplice",
     NULL
 };
 
@@ -120,6 +137,51 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+static void spliced_block_free(struct userdata *u, struct spliced_block *s) {
+    if (u->spliced_tail == s)
+        u->spliced_tail = s->prev;
+
+    PA_LLIST_REMOVE(struct spliced_block, u->spliced, s);
+    pa_memblock_unref(s->memblock);
+    pa_xfree(s);
+}
+
+/* Drops the references to the blocks the reader is done with */
+static void reap_spliced(struct userdata *u) {
+    size_t unread;
+
+    if (!u->spliced || pa_pipe_unread(u->fd, &unread) < 0)
+        return;
+
+    while (u->spliced && u->spliced->end + unread <= u->written)
+        spliced_block_free(u, u->spliced);
+}
+
+static ssize_t splice_chunk(struct userdata *u, const void *p) {
+    struct spliced_block *s;
+    ssize_t l;
+
+    reap_spliced(u);
+
+    if ((l = pa_vmsplice(u->fd, p, u->memchunk.length)) <= 0)
+        return l;
+
+    /* The pipe now references the block, keep it alive and unmodified */
+    s = pa_xnew(struct spliced_block, 1);
+    PA_LLIST_INIT(struct spliced_block, s);
+    s->memblock = pa_memblock_ref(u->memchunk.memblock);
+    s->end = u->written + (uint64_t) l;
+
+    if (u->spliced_tail)
+        PA_LLIST_INSERT_AFTER(struct spliced_block, u->spliced, u->spliced_tail, s);
+    else
+        PA_LLIST_PREPEND(struct spliced_block, u->spliced, s);
+
+    u->spliced_tail = s;
+
+    return l;
+}
+
 static int process_render(struct userdata *u) {
     pa_assert(u);
 
@@ -133,7 +195,21 @@ static int process_render(struct userdata *u) {
         void *p;
 
         p = pa_memblock_acquire(u->memchunk.memblock);
-        l = pa_write(u->fd, (uint8_t*) p + u->memchunk.index, u->memchunk.length, &u->write_type);
+
+        /* Memory imported from a client may be reused by it, which we
+         * can't prevent, so that is always copied */
+        if (u->use_vmsplice && pa_memblock_is_ours(u->memchunk.memblock)) {
+            l = splice_chunk(u, (uint8_t*) p + u->memchunk.index);
+
+            if (l < 0 && errno != EAGAIN && errno != EINTR) {
+                pa_log_warn("vmsplice() failed, falling back to copying: %s", pa_cstrerror(errno));
+                u->use_vmsplice = false;
+                pa_memblock_release(u->memchunk.memblock);
+                continue;
+            }
+        } else
+            l = pa_write(u->fd, (uint8_t*) p + u->memchunk.index, u->memchunk.length, &u->write_type);
+
         pa_memblock_release(u->memchunk.memblock);
 
         pa_assert(l != 0);
@@ -151,6 +227,7 @@ static int process_render(struct userdata *u) {
 
         } else {
 
+            u->written += (uint64_t) l;
             u->memchunk.index += (size_t) l;
             u->memchunk.length -= (size_t) l;
 
@@ -256,6 +333,11 @@ int pa__init(pa_module *m) {
 
     u->write_type = 0;
 
+    if (pa_modargs_get_value_boolean(ma, "use_vmsplice", &u->use_vmsplice) < 0) {
+        pa_log("Failed to parse use_vmsplice argument.");
+        goto fail;
+    }
+
     u->filename = pa_runtime_path(pa_modargs_get_value(ma, "file", DEFAULT_FILE_NAME));
 
     if (mkfifo(u->filename, 0666) < 0) {
@@ -370,6 +452,20 @@ void pa__done(pa_module *m) {
     if (u->memchunk.memblock)
         pa_memblock_unref(u->memchunk.memblock);
 
+    /* The memory of these goes back to the pool and may be reused while the
+     * pipe still references it. Rather than have the reader see that, throw
+     * away what it hasn't read yet, which is a pipe buffer at most. */
+    if (u->spliced) {
+        uint8_t buf[4096];
+        int read_type = 0;
+
+        while (pa_read(u->fd, buf, sizeof(buf), &read_type) > 0)
+            ;
+
+        while (u->spliced)
+            spliced_block_free(u, u->spliced);
+    }
+
     if (u->rtpoll_item)
         pa_rtpoll_item_free(u->rtpoll_item);
 
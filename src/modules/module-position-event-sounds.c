@@ -154,6 +154,7 @@ int pa__init(pa_module*m) {
 
     m->userdata = u = pa_xnew(struct userdata, 1);
     u->sink_input_fixate_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_FIXATE], PA_HOOK_EARLY, (pa_hook_cb_t) sink_input_fixate_hook_callback, u);
+    pa_hook_slot_match_proplist(u->sink_input_fixate_hook_slot, PA_PROP_MEDIA_ROLE, "event");
 
     pa_modargs_free(ma);
     u->name = m->name;
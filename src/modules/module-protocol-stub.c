@@ -46,10 +46,10 @@
 
 #ifdef USE_TCP_SOCKETS
 #define SOCKET_DESCRIPTION "(TCP sockets)"
-#define SOCKET_USAGE "port=<TCP port number> listen=<address to listen on>"
+#define SOCKET_USAGE "port=<TCP port number> listen=<address to listen on> backlog=<connections waiting to be accepted>"
 #else
 #define SOCKET_DESCRIPTION "(UNIX sockets)"
-#define SOCKET_USAGE "socket=<path to UNIX socket>"
+#define SOCKET_USAGE "socket=<path to UNIX socket> backlog=<connections waiting to be accepted>"
 #endif
 
 #if defined(USE_PROTOCOL_SIMPLE)
@@ -109,7 +109,8 @@
 #  define TCPWRAP_SERVICE "pulseaudio-native"
 #  define IPV4_PORT PA_NATIVE_DEFAULT_PORT
 #  define UNIX_SOCKET PA_NATIVE_DEFAULT_UNIX_SOCKET
-#  define MODULE_ARGUMENTS_COMMON "cookie", "auth-cookie", "auth-cookie-enabled", "auth-anonymous",
+#  define MODULE_ARGUMENTS_COMMON "cookie", "auth-cookie", "auth-cookie-enabled", "auth-anonymous", "subscription-coalesce-msec", \
+                                  "client-max-streams", "client-max-buffer", "client-max-request-rate", "trace-file",
 
 #  ifdef USE_TCP_SOCKETS
 #    include "module-native-protocol-tcp-symdef.h"
@@ -121,22 +122,31 @@
 #    define MODULE_ARGUMENTS MODULE_ARGUMENTS_COMMON "auth-group", "auth-group-enable", "srbchannel",
 #    define AUTH_USAGE "auth-group=<system group to allow access> auth-group-enable=<enable auth by UNIX group?> "
 #    define SRB_USAGE "srbchannel=<enable shared ringbuffer communication channel?> "
+#    define LATENCY_USAGE
 #  elif defined(USE_TCP_SOCKETS)
-#    define MODULE_ARGUMENTS MODULE_ARGUMENTS_COMMON "auth-ip-acl",
+#    define MODULE_ARGUMENTS MODULE_ARGUMENTS_COMMON "auth-ip-acl", "adaptive-latency",
 #    define AUTH_USAGE "auth-ip-acl=<IP address ACL to allow access> "
 #    define SRB_USAGE
+#    define LATENCY_USAGE "adaptive-latency=<size the buffers of remote clients after the network delay?> "
 #  else
 #    define MODULE_ARGUMENTS MODULE_ARGUMENTS_COMMON
 #    define AUTH_USAGE
 #    define SRB_USAGE
+#    define LATENCY_USAGE
 #    endif
 
   PA_MODULE_DESCRIPTION("Native protocol "SOCKET_DESCRIPTION);
   PA_MODULE_USAGE("auth-anonymous=<don't check for cookies?> "
                   "auth-cookie=<path to cookie file> "
                   "auth-cookie-enabled=<enable cookie authentication?> "
+                  "subscription-coalesce-msec=<collapse repeated subscription events within this time> "
+                  "client-max-streams=<streams per client> "
+                  "client-max-buffer=<bytes buffered per client> "
+                  "client-max-request-rate=<introspection requests per client and second> "
+                  "trace-file=<record what the clients do into this file, for pareplay> "
                   AUTH_USAGE
                   SRB_USAGE
+                  LATENCY_USAGE
                   SOCKET_USAGE);
 #elif defined(USE_PROTOCOL_ESOUND)
 #  include <pulsecore/protocol-esound.h>
@@ -183,6 +193,7 @@ static const char* const valid_modargs[] = {
 #else
     "socket",
 #endif
+    "backlog",
     NULL
 };
 
@@ -238,6 +249,7 @@ static void socket_server_on_connection_cb(pa_socket_server*s, pa_iochannel *io,
 int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     struct userdata *u = NULL;
+    uint32_t backlog = 0;
 
 #if defined(USE_TCP_SOCKETS)
     uint32_t port = IPV4_PORT;
@@ -258,6 +270,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "backlog", &backlog) < 0) {
+        pa_log("backlog= expects a numerical argument.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->module = m;
 
@@ -326,6 +343,15 @@ int pa__init(pa_module*m) {
         pa_socket_server_set_callback(u->socket_server_ipv6, socket_server_on_connection_cb, u);
 #  endif
 
+    if (backlog > 0) {
+        if (u->socket_server_ipv4 && pa_socket_server_set_backlog(u->socket_server_ipv4, backlog) < 0)
+            goto fail;
+#  ifdef HAVE_IPV6
+        if (u->socket_server_ipv6 && pa_socket_server_set_backlog(u->socket_server_ipv6, backlog) < 0)
+            goto fail;
+#  endif
+    }
+
 #else
 
 #  if defined(USE_PROTOCOL_ESOUND)
@@ -362,6 +388,9 @@ int pa__init(pa_module*m) {
 
     pa_socket_server_set_callback(u->socket_server_unix, socket_server_on_connection_cb, u);
 
+    if (backlog > 0 && pa_socket_server_set_backlog(u->socket_server_unix, backlog) < 0)
+        goto fail;
+
 #endif
 
 #if defined(USE_PROTOCOL_NATIVE)
@@ -36,6 +36,7 @@ PA_MODULE_USAGE(
         "ducking_roles=<Comma(and slash) separated list of roles which will be ducked. Slash can divide the roles into groups>"
         "global=<Should we operate globally or only inside the same device?>"
         "volume=<Volume for the attenuated streams. Default: -20dB. If trigger_roles and ducking_roles are separated by slash, use slash for dividing volume group>"
+        "fade_msec=<Time over which the volume of ducked streams is faded. Default: 100>"
 );
 
 static const char* const valid_modargs[] = {
@@ -43,6 +44,7 @@ static const char* const valid_modargs[] = {
     "ducking_roles",
     "global",
     "volume",
+    "fade_msec",
     NULL
 };
 
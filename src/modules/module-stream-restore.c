@@ -50,6 +50,8 @@
 #include <pulsecore/database.h>
 #include <pulsecore/tagstruct.h>
 #include <pulsecore/proplist-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/dynarray.h>
 
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-util.h>
@@ -68,7 +70,9 @@ PA_MODULE_USAGE(
         "restore_muted=<Save/restore muted states?> "
         "on_hotplug=<When new device becomes available, recheck streams?> "
         "on_rescue=<When device becomes unavailable, recheck streams?> "
-        "fallback_table=<filename>");
+        "fallback_table=<filename> "
+        "cache_size=<Number of entries kept in memory> "
+        "max_entries=<Maximum number of entries in the database, 0 for no limit>");
 
 #define SAVE_INTERVAL (10 * PA_USEC_PER_SEC)
 #define IDENTIFICATION_PROPERTY "module-stream-restore.id"
@@ -78,6 +82,8 @@ PA_MODULE_USAGE(
 
 #define WHITESPACE "\n\r \t"
 
+#define DEFAULT_CACHE_SIZE 256
+
 static const char* const valid_modargs[] = {
     "restore_device",
     "restore_volume",
@@ -85,9 +91,21 @@ static const char* const valid_modargs[] = {
     "on_hotplug",
     "on_rescue",
     "fallback_table",
+    "cache_size",
+    "max_entries",
     NULL
 };
 
+/* The most recently matched entries, decoded, so that creating a stream
+ * doesn't have to go to the database. A NULL entry means that the
+ * database doesn't have one. */
+struct cache_entry {
+    char *name;
+    struct entry *entry;
+
+    PA_LLIST_FIELDS(struct cache_entry);
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -105,6 +123,14 @@ struct userdata {
     pa_time_event *save_time_event;
     pa_database* database;
 
+    /* Most recently used first */
+    pa_hashmap *cache;
+    PA_LLIST_HEAD(struct cache_entry, cache_lru);
+    struct cache_entry *cache_tail;
+    uint32_t cache_size;
+    uint32_t max_entries;
+    char *hot_set_path;
+
     bool restore_device:1;
     bool restore_volume:1;
     bool restore_muted:1;
@@ -145,6 +171,11 @@ enum {
 static struct entry* entry_new(void);
 static void entry_free(struct entry *e);
 static struct entry *entry_read(struct userdata *u, const char *name);
+static struct entry *entry_read_db(struct userdata *u, const char *name);
+static int entry_remove(struct userdata *u, const char *name);
+static void entries_clear(struct userdata *u);
+static void evict_entries(struct userdata *u);
+static void save_hot_set(struct userdata *u);
 static bool entry_write(struct userdata *u, const char *name, const struct entry *e, bool replace);
 static struct entry* entry_copy(const struct entry *e);
 static void entry_apply(struct userdata *u, const char *name, struct entry *e);
@@ -933,16 +964,12 @@ static void handle_entry_get_all(DBusConnection *conn, DBusMessage *msg, void *u
 
 static void handle_entry_remove(DBusConnection *conn, DBusMessage *msg, void *userdata) {
     struct dbus_entry *de = userdata;
-    pa_datum key;
 
     pa_assert(conn);
     pa_assert(msg);
     pa_assert(de);
 
-    key.data = de->entry_name;
-    key.size = strlen(de->entry_name);
-
-    pa_assert_se(pa_database_unset(de->userdata->database, &key) == 0);
+    pa_assert_se(entry_remove(de->userdata, de->entry_name) == 0);
 
     send_entry_removed_signal(de);
     trigger_save(de->userdata);
@@ -965,6 +992,11 @@ static void save_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct
     u->core->mainloop->time_free(u->save_time_event);
     u->save_time_event = NULL;
 
+    pa_core_count_wakeup(u->core, "stream-restore");
+
+    evict_entries(u);
+    save_hot_set(u);
+
     pa_database_sync(u->database);
     pa_log_info("Synced.");
 }
@@ -983,6 +1015,81 @@ static void entry_free(struct entry* e) {
     pa_xfree(e);
 }
 
+static void cache_unlink(struct userdata *u, struct cache_entry *c) {
+    if (u->cache_tail == c)
+        u->cache_tail = c->prev;
+
+    PA_LLIST_REMOVE(struct cache_entry, u->cache_lru, c);
+}
+
+static void cache_link_front(struct userdata *u, struct cache_entry *c) {
+    PA_LLIST_PREPEND(struct cache_entry, u->cache_lru, c);
+
+    if (!u->cache_tail)
+        u->cache_tail = c;
+}
+
+static void cache_entry_free(struct cache_entry *c) {
+    pa_assert(c);
+
+    if (c->entry)
+        entry_free(c->entry);
+
+    pa_xfree(c->name);
+    pa_xfree(c);
+}
+
+static void cache_remove(struct userdata *u, const char *name) {
+    struct cache_entry *c;
+
+    if (!(c = pa_hashmap_remove(u->cache, name)))
+        return;
+
+    cache_unlink(u, c);
+    cache_entry_free(c);
+}
+
+/* Marks the entry as just used */
+static struct cache_entry *cache_get(struct userdata *u, const char *name) {
+    struct cache_entry *c;
+
+    if (!(c = pa_hashmap_get(u->cache, name)))
+        return NULL;
+
+    if (c != u->cache_lru) {
+        cache_unlink(u, c);
+        cache_link_front(u, c);
+    }
+
+    return c;
+}
+
+/* e may be NULL, if the database has no such entry */
+static void cache_put(struct userdata *u, const char *name, const struct entry *e) {
+    struct cache_entry *c;
+
+    if (u->cache_size == 0)
+        return;
+
+    if ((c = cache_get(u, name))) {
+        if (c->entry)
+            entry_free(c->entry);
+
+        c->entry = e ? entry_copy(e) : NULL;
+        return;
+    }
+
+    c = pa_xnew0(struct cache_entry, 1);
+    c->name = pa_xstrdup(name);
+    c->entry = e ? entry_copy(e) : NULL;
+
+    pa_assert_se(pa_hashmap_put(u->cache, c->name, c) == 0);
+    cache_link_front(u, c);
+
+    if (pa_hashmap_size(u->cache) > u->cache_size)
+        cache_remove(u, u->cache_tail->name);
+}
+
 static bool entry_write(struct userdata *u, const char *name, const struct entry *e, bool replace) {
     pa_tagstruct *t;
     pa_datum key, data;
@@ -1013,19 +1120,51 @@ static bool entry_write(struct userdata *u, const char *name, const struct entry
 
     pa_tagstruct_free(t);
 
+    if (r)
+        cache_put(u, name, e);
+
     return r;
 }
 
 #ifdef ENABLE_LEGACY_DATABASE_ENTRY_FORMAT
 
+/* Legacy entries were written with room for 32 channels, what
+ * PA_CHANNELS_MAX was back then */
+#define LEGACY_CHANNELS_MAX 32
+
+struct legacy_channel_map {
+    uint8_t channels;
+    pa_channel_position_t map[LEGACY_CHANNELS_MAX];
+};
+
+struct legacy_cvolume {
+    uint8_t channels;
+    pa_volume_t values[LEGACY_CHANNELS_MAX];
+};
+
+static bool legacy_volume_get(pa_channel_map *map, pa_cvolume *v, const struct legacy_channel_map *lmap, const struct legacy_cvolume *lv) {
+    if (lmap->channels > LEGACY_CHANNELS_MAX || lv->channels > LEGACY_CHANNELS_MAX)
+        return false;
+
+    pa_channel_map_init(map);
+    map->channels = lmap->channels;
+    memcpy(map->map, lmap->map, sizeof(lmap->map[0]) * lmap->channels);
+
+    pa_cvolume_init(v);
+    v->channels = lv->channels;
+    memcpy(v->values, lv->values, sizeof(lv->values[0]) * lv->channels);
+
+    return true;
+}
+
 #define LEGACY_ENTRY_VERSION 3
 static struct entry *legacy_entry_read(struct userdata *u, const char *name) {
     struct legacy_entry {
         uint8_t version;
         bool muted_valid:1, volume_valid:1, device_valid:1, card_valid:1;
         bool muted:1;
-        pa_channel_map channel_map;
-        pa_cvolume volume;
+        struct legacy_channel_map channel_map;
+        struct legacy_cvolume volume;
         char device[PA_NAME_MAX];
         char card[PA_NAME_MAX];
     } PA_GCC_PACKED;
@@ -1034,6 +1173,8 @@ static struct entry *legacy_entry_read(struct userdata *u, const char *name) {
     pa_datum data;
     struct legacy_entry *le;
     struct entry *e;
+    pa_channel_map channel_map;
+    pa_cvolume volume;
 
     pa_assert(u);
     pa_assert(name);
@@ -1078,12 +1219,12 @@ static struct entry *legacy_entry_read(struct userdata *u, const char *name) {
         goto fail;
     }
 
-    if (le->volume_valid && !pa_channel_map_valid(&le->channel_map)) {
+    if (le->volume_valid && (!legacy_volume_get(&channel_map, &volume, &le->channel_map, &le->volume) || !pa_channel_map_valid(&channel_map))) {
         pa_log_warn("Invalid channel map stored in database for legacy stream");
         goto fail;
     }
 
-    if (le->volume_valid && (!pa_cvolume_valid(&le->volume) || !pa_cvolume_compatible_with_channel_map(&le->volume, &le->channel_map))) {
+    if (le->volume_valid && (!pa_cvolume_valid(&volume) || !pa_cvolume_compatible_with_channel_map(&volume, &channel_map))) {
         pa_log_warn("Invalid volume stored in database for legacy stream");
         goto fail;
     }
@@ -1092,8 +1233,10 @@ static struct entry *legacy_entry_read(struct userdata *u, const char *name) {
     e->muted_valid = le->muted_valid;
     e->muted = le->muted;
     e->volume_valid = le->volume_valid;
-    e->channel_map = le->channel_map;
-    e->volume = le->volume;
+    if (le->volume_valid) {
+        e->channel_map = channel_map;
+        e->volume = volume;
+    }
     e->device_valid = le->device_valid;
     e->device = pa_xstrdup(le->device);
     e->card_valid = le->card_valid;
@@ -1107,7 +1250,7 @@ fail:
 }
 #endif
 
-static struct entry *entry_read(struct userdata *u, const char *name) {
+static struct entry *entry_read_db(struct userdata *u, const char *name) {
     pa_datum key, data;
     struct entry *e = NULL;
     pa_tagstruct *t = NULL;
@@ -1194,6 +1337,186 @@ static struct entry* entry_copy(const struct entry *e) {
     return r;
 }
 
+static struct entry *entry_read(struct userdata *u, const char *name) {
+    struct cache_entry *c;
+    struct entry *e;
+
+    pa_assert(u);
+    pa_assert(name);
+
+    if ((c = cache_get(u, name)))
+        return c->entry ? entry_copy(c->entry) : NULL;
+
+    e = entry_read_db(u, name);
+    cache_put(u, name, e);
+
+    return e;
+}
+
+static int entry_remove(struct userdata *u, const char *name) {
+    pa_datum key;
+
+    pa_assert(u);
+    pa_assert(name);
+
+    cache_remove(u, name);
+
+    key.data = (char *) name;
+    key.size = strlen(name);
+
+    return pa_database_unset(u->database, &key);
+}
+
+static void entries_clear(struct userdata *u) {
+    pa_assert(u);
+
+    pa_hashmap_remove_all(u->cache);
+    PA_LLIST_HEAD_INIT(struct cache_entry, u->cache_lru);
+    u->cache_tail = NULL;
+
+    pa_database_clear(u->database);
+}
+
+/* Removes the least recently matched entries from the database, until
+ * there are no more than max_entries. Entries that haven't been matched
+ * since the start go first, then the ones at the end of the cache. */
+static void evict_entries(struct userdata *u) {
+    pa_dynarray *cold;
+    pa_datum key;
+    signed n;
+    bool done;
+    char *name;
+
+    pa_assert(u);
+
+    if (u->max_entries == 0 || (n = pa_database_size(u->database)) <= (signed) u->max_entries)
+        return;
+
+    /* The database can't be modified while iterating through it */
+    cold = pa_dynarray_new(pa_xfree);
+
+    done = !pa_database_first(u->database, &key, NULL);
+    while (!done && n - (signed) pa_dynarray_size(cold) > (signed) u->max_entries) {
+        pa_datum next_key;
+
+        name = pa_xstrndup(key.data, key.size);
+
+        if (pa_hashmap_get(u->cache, name))
+            pa_xfree(name);
+        else
+            pa_dynarray_append(cold, name);
+
+        done = !pa_database_next(u->database, &key, &next_key, NULL);
+        pa_datum_free(&key);
+        key = next_key;
+    }
+
+    if (!done)
+        pa_datum_free(&key);
+
+    while ((name = pa_dynarray_steal_last(cold)) ||
+           (n > (signed) u->max_entries && u->cache_tail && (name = pa_xstrdup(u->cache_tail->name)))) {
+#ifdef HAVE_DBUS
+        struct dbus_entry *de;
+
+        if ((de = pa_hashmap_get(u->dbus_entries, name))) {
+            send_entry_removed_signal(de);
+            pa_hashmap_remove_and_free(u->dbus_entries, name);
+        }
+#endif
+
+        pa_log_debug("Evicting entry %s.", name);
+
+        if (entry_remove(u, name) == 0)
+            n--;
+
+        pa_xfree(name);
+    }
+
+    pa_dynarray_free(cold);
+}
+
+/* The names of the cached entries are saved, most recently used first,
+ * so that the next start can load them right away */
+static void save_hot_set(struct userdata *u) {
+    struct cache_entry *c;
+    char *tmp;
+    FILE *f;
+
+    pa_assert(u);
+
+    if (!u->hot_set_path)
+        return;
+
+    tmp = pa_sprintf_malloc("%s.tmp", u->hot_set_path);
+
+    if (!(f = pa_fopen_cloexec(tmp, "w"))) {
+        pa_log_warn("Failed to open %s: %s", tmp, pa_cstrerror(errno));
+        pa_xfree(tmp);
+        return;
+    }
+
+    PA_LLIST_FOREACH(c, u->cache_lru)
+        if (c->entry && !strchr(c->name, '\n'))
+            fprintf(f, "%s\n", c->name);
+
+    if (fclose(f) != 0 || rename(tmp, u->hot_set_path) < 0)
+        pa_log_warn("Failed to write %s: %s", u->hot_set_path, pa_cstrerror(errno));
+
+    pa_xfree(tmp);
+}
+
+static void load_hot_set(struct userdata *u) {
+    pa_dynarray *names;
+    char ln[256];
+    char *name;
+    FILE *f;
+
+    pa_assert(u);
+
+    if (!u->hot_set_path || u->cache_size == 0)
+        return;
+
+    if (!(f = pa_fopen_cloexec(u->hot_set_path, "r"))) {
+        if (errno != ENOENT)
+            pa_log_warn("Failed to open %s: %s", u->hot_set_path, pa_cstrerror(errno));
+
+        return;
+    }
+
+    names = pa_dynarray_new(pa_xfree);
+
+    while (fgets(ln, sizeof(ln), f) && pa_dynarray_size(names) < u->cache_size) {
+        size_t l = strlen(ln);
+
+        /* Too long for the buffer, it can just be read later */
+        if (l == 0 || ln[l - 1] != '\n')
+            continue;
+
+        ln[l - 1] = 0;
+        pa_dynarray_append(names, pa_xstrdup(ln));
+    }
+
+    fclose(f);
+
+    /* Least recently used first, so that the cache ends up in the same
+     * order */
+    while ((name = pa_dynarray_steal_last(names))) {
+        struct entry *e;
+
+        if ((e = entry_read(u, name)))
+            entry_free(e);
+        else
+            cache_remove(u, name);
+
+        pa_xfree(name);
+    }
+
+    pa_dynarray_free(names);
+
+    pa_log_debug("Preloaded %u entries.", pa_hashmap_size(u->cache));
+}
+
 static void trigger_save(struct userdata *u) {
     pa_native_connection *c;
     uint32_t idx;
@@ -1214,7 +1537,7 @@ static void trigger_save(struct userdata *u) {
     if (u->save_time_event)
         return;
 
-    u->save_time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + SAVE_INTERVAL, save_time_callback, u);
+    u->save_time_event = pa_core_rttime_new(u->core, pa_core_rttime_coarse(pa_rtclock_now() + SAVE_INTERVAL), save_time_callback, u);
 }
 
 static bool entries_equal(const struct entry *a, const struct entry *b) {
@@ -2024,7 +2347,7 @@ PA_GCC_UNUSED static void stream_restore_dump_database(struct userdata *u) {
         name = pa_xstrndup(key.data, key.size);
         pa_datum_free(&key);
 
-        if ((e = entry_read(u, name))) {
+        if ((e = entry_read_db(u, name))) {
             char t[256];
             pa_log("name=%s", name);
             pa_log("device=%s %s", e->device, pa_yes_no(e->device_valid));
@@ -2092,7 +2415,8 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
                 name = pa_xstrndup(key.data, key.size);
                 pa_datum_free(&key);
 
-                if ((e = entry_read(u, name))) {
+                /* Reading all of them shouldn't push the hot set out */
+                if ((e = entry_read_db(u, name))) {
                     pa_cvolume r;
                     pa_channel_map cm;
 
@@ -2136,7 +2460,7 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
                     pa_hashmap_remove_and_free(u->dbus_entries, de->entry_name);
                 }
 #endif
-                pa_database_clear(u->database);
+                entries_clear(u);
             }
 
             while (!pa_tagstruct_eof(t)) {
@@ -2236,7 +2560,6 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
 
             while (!pa_tagstruct_eof(t)) {
                 const char *name;
-                pa_datum key;
 #ifdef HAVE_DBUS
                 struct dbus_entry *de;
 #endif
@@ -2251,10 +2574,7 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
                 }
 #endif
 
-                key.data = (char*) name;
-                key.size = strlen(name);
-
-                pa_database_unset(u->database, &key);
+                entry_remove(u, name);
             }
 
             trigger_save(u);
@@ -2337,14 +2657,15 @@ static void clean_up_db(struct userdata *u) {
 
         entry_name = pa_xstrndup(key.data, key.size);
 
-        /* Use entry_read() to check whether this entry is valid. */
-        if (!(e = entry_read(u, entry_name))) {
+        /* Use entry_read_db() to check whether this entry is valid. It
+         * doesn't fill the cache, which is for the hot set. */
+        if (!(e = entry_read_db(u, entry_name))) {
             item = pa_xnew0(struct clean_up_item, 1);
             PA_LLIST_INIT(struct clean_up_item, item);
             item->entry_name = entry_name;
 
 #ifdef ENABLE_LEGACY_DATABASE_ENTRY_FORMAT
-            /* entry_read() failed, but what about legacy_entry_read()? */
+            /* entry_read_db() failed, but what about legacy_entry_read()? */
             if (!(e = legacy_entry_read(u, entry_name)))
                 /* Not a legacy entry either, let's remove this. */
                 PA_LLIST_PREPEND(struct clean_up_item, to_be_removed, item);
@@ -2368,12 +2689,9 @@ static void clean_up_db(struct userdata *u) {
     }
 
     PA_LLIST_FOREACH_SAFE(item, next, to_be_removed) {
-        key.data = item->entry_name;
-        key.size = strlen(item->entry_name);
-
         pa_log_debug("Removing an invalid entry: %s", item->entry_name);
 
-        pa_assert_se(pa_database_unset(u->database, &key) >= 0);
+        pa_assert_se(entry_remove(u, item->entry_name) >= 0);
         trigger_save(u);
 
         PA_LLIST_REMOVE(struct clean_up_item, to_be_removed, item);
@@ -2404,6 +2722,7 @@ int pa__init(pa_module*m) {
     pa_source_output *so;
     uint32_t idx;
     bool restore_device = true, restore_volume = true, restore_muted = true, on_hotplug = true, on_rescue = true;
+    uint32_t cache_size = DEFAULT_CACHE_SIZE, max_entries = 0;
 #ifdef HAVE_DBUS
     pa_datum key;
     bool done;
@@ -2428,6 +2747,17 @@ int pa__init(pa_module*m) {
     if (!restore_muted && !restore_volume && !restore_device)
         pa_log_warn("Neither restoring volume, nor restoring muted, nor restoring device enabled!");
 
+    if (pa_modargs_get_value_u32(ma, "cache_size", &cache_size) < 0 ||
+        pa_modargs_get_value_u32(ma, "max_entries", &max_entries) < 0) {
+        pa_log("cache_size= and max_entries= expect unsigned integer arguments");
+        goto fail;
+    }
+
+    if (max_entries > 0 && max_entries < cache_size) {
+        pa_log("max_entries= must not be smaller than cache_size=");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
@@ -2437,6 +2767,9 @@ int pa__init(pa_module*m) {
     u->on_hotplug = on_hotplug;
     u->on_rescue = on_rescue;
     u->subscribed = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    u->cache = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL, (pa_free_cb_t) cache_entry_free);
+    u->cache_size = cache_size;
+    u->max_entries = max_entries;
 
     u->protocol = pa_native_protocol_get(m->core);
     pa_native_protocol_install_ext(u->protocol, m, extension_cb);
@@ -2510,6 +2843,10 @@ int pa__init(pa_module*m) {
     }
 #endif
 
+    u->hot_set_path = pa_state_path("stream-volumes-hot-set", true);
+    load_hot_set(u);
+    evict_entries(u);
+
     PA_IDXSET_FOREACH(si, m->core->sink_inputs, idx)
         subscribe_callback(m->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_NEW, si->index, u);
 
@@ -2555,8 +2892,15 @@ void pa__done(pa_module*m) {
     if (u->save_time_event)
         u->core->mainloop->time_free(u->save_time_event);
 
-    if (u->database)
+    if (u->database) {
+        save_hot_set(u);
         pa_database_close(u->database);
+    }
+
+    if (u->cache)
+        pa_hashmap_free(u->cache);
+
+    pa_xfree(u->hot_set_path);
 
     if (u->protocol) {
         pa_native_protocol_remove_ext(u->protocol, m);
@@ -38,16 +38,20 @@ PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION("When a sink/source is idle for too long, suspend it");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(true);
-PA_MODULE_USAGE("timeout=<timeout>");
+PA_MODULE_USAGE(
+        "timeout=<timeout> "
+        "soft_timeout=<timeout after which sinks that support it are only stopped, in seconds>");
 
 static const char* const valid_modargs[] = {
     "timeout",
+    "soft_timeout",
     NULL,
 };
 
 struct userdata {
     pa_core *core;
     pa_usec_t timeout;
+    pa_usec_t soft_timeout;
     pa_hashmap *device_infos;
 };
 
@@ -60,6 +64,13 @@ struct device_info {
     pa_usec_t timeout;
 };
 
+/* Sinks that can keep their device open while suspended are first
+ * suspended with PA_SUSPEND_IDLE_SOFT after soft_timeout, which only
+ * stops them, and then with PA_SUSPEND_IDLE after the full timeout. */
+static bool use_soft_suspend(struct device_info *d) {
+    return d->sink && d->sink->suspend_cause_changed && d->userdata->soft_timeout < d->timeout;
+}
+
 static void timeout_cb(pa_mainloop_api*a, pa_time_event* e, const struct timeval *t, void *userdata) {
     struct device_info *d = userdata;
 
@@ -68,9 +79,22 @@ static void timeout_cb(pa_mainloop_api*a, pa_time_event* e, const struct timeval
     d->userdata->core->mainloop->time_restart(d->time_event, NULL);
 
     if (d->sink && pa_sink_check_suspend(d->sink, NULL, NULL) <= 0 && !(d->sink->suspend_cause & PA_SUSPEND_IDLE)) {
-        pa_log_info("Sink %s idle for too long, suspending ...", d->sink->name);
-        pa_sink_suspend(d->sink, true, PA_SUSPEND_IDLE);
-        pa_core_maybe_vacuum(d->userdata->core);
+        if (use_soft_suspend(d) && !(d->sink->suspend_cause & PA_SUSPEND_IDLE_SOFT)) {
+            pa_log_info("Sink %s idle for a while, stopping ...", d->sink->name);
+            pa_sink_suspend(d->sink, true, PA_SUSPEND_IDLE_SOFT);
+            pa_core_rttime_restart(d->userdata->core, d->time_event, d->last_use + d->timeout);
+
+        } else if (pa_rtclock_now() < d->last_use + d->timeout)
+            /* Opened in advance for a stream that never came */
+            pa_core_rttime_restart(d->userdata->core, d->time_event, d->last_use + d->timeout);
+
+        else {
+            pa_log_info("Sink %s idle for too long, suspending ...", d->sink->name);
+            pa_sink_suspend(d->sink, true, PA_SUSPEND_IDLE);
+            if (d->sink->suspend_cause & PA_SUSPEND_IDLE_SOFT)
+                pa_sink_suspend(d->sink, false, PA_SUSPEND_IDLE_SOFT);
+            pa_core_maybe_vacuum(d->userdata->core);
+        }
     }
 
     if (d->source && pa_source_check_suspend(d->source, NULL) <= 0 && !(d->source->suspend_cause & PA_SUSPEND_IDLE)) {
@@ -87,7 +111,7 @@ static void restart(struct device_info *d) {
     pa_assert(d->sink || d->source);
 
     d->last_use = now = pa_rtclock_now();
-    pa_core_rttime_restart(d->userdata->core, d->time_event, now + d->timeout);
+    pa_core_rttime_restart(d->userdata->core, d->time_event, now + (use_soft_suspend(d) ? d->userdata->soft_timeout : d->timeout));
 
     if (d->sink)
         pa_log_debug("Sink %s becomes idle, timeout in %" PRIu64 " seconds.", d->sink->name, d->timeout / PA_USEC_PER_SEC);
@@ -102,7 +126,7 @@ static void resume(struct device_info *d) {
 
     if (d->sink) {
         pa_log_debug("Sink %s becomes busy, resuming.", d->sink->name);
-        pa_sink_suspend(d->sink, false, PA_SUSPEND_IDLE);
+        pa_sink_suspend(d->sink, false, PA_SUSPEND_IDLE|PA_SUSPEND_IDLE_SOFT);
     }
 
     if (d->source) {
@@ -111,6 +135,23 @@ static void resume(struct device_info *d) {
     }
 }
 
+/* Lets a sink that was suspended for being idle open its device in the
+ * background, so that resuming it later is quick. */
+static void prepare_resume(struct device_info *d) {
+    pa_assert(d);
+    pa_assert(d->sink);
+
+    if (!(d->sink->suspend_cause & PA_SUSPEND_IDLE))
+        return;
+
+    pa_log_debug("Sink %s is about to become busy, opening it.", d->sink->name);
+    pa_sink_suspend(d->sink, true, PA_SUSPEND_IDLE_SOFT);
+    pa_sink_suspend(d->sink, false, PA_SUSPEND_IDLE);
+
+    /* In case the stream isn't created after all */
+    restart(d);
+}
+
 static pa_hook_result_t sink_input_fixate_hook_cb(pa_core *c, pa_sink_input_new_data *data, struct userdata *u) {
     struct device_info *d;
 
@@ -118,12 +159,39 @@ static pa_hook_result_t sink_input_fixate_hook_cb(pa_core *c, pa_sink_input_new_
     pa_assert(data);
     pa_assert(u);
 
+    if (!(d = pa_hashmap_get(u->device_infos, data->sink)))
+        return PA_HOOK_OK;
+
+    /* If the sink can open its device in the background, that happens
+     * while the stream is set up, and the sink is resumed once the
+     * stream is put. */
+    if (use_soft_suspend(d) && !(data->flags & PA_SINK_INPUT_NO_CREATE_ON_SUSPEND)) {
+        prepare_resume(d);
+        return PA_HOOK_OK;
+    }
+
     /* We need to resume the audio device here even for
      * PA_SINK_INPUT_START_CORKED, since we need the device parameters
      * to be fully available while the stream is set up. In that case,
      * make sure we close the sink again after the timeout interval. */
 
-    if ((d = pa_hashmap_get(u->device_infos, data->sink))) {
+    resume(d);
+    if (pa_sink_check_suspend(d->sink, NULL, NULL) <= 0)
+        restart(d);
+
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t sink_input_put_hook_cb(pa_core *c, pa_sink_input *s, struct userdata *u) {
+    struct device_info *d;
+
+    pa_assert(c);
+    pa_sink_input_assert_ref(s);
+    pa_assert(u);
+
+    /* Resume what sink_input_fixate_hook_cb() left to us */
+    if ((d = pa_hashmap_get(u->device_infos, s->sink)) && use_soft_suspend(d) &&
+        !(s->flags & PA_SINK_INPUT_NO_CREATE_ON_SUSPEND)) {
         resume(d);
         if (pa_sink_check_suspend(d->sink, NULL, NULL) <= 0)
             restart(d);
@@ -417,7 +485,7 @@ static pa_hook_result_t device_state_changed_hook_cb(pa_core *c, pa_object *o, s
 int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     struct userdata *u;
-    uint32_t timeout = 5;
+    uint32_t timeout = 5, soft_timeout = 1;
     uint32_t idx;
     pa_sink *sink;
     pa_source *source;
@@ -434,9 +502,15 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "soft_timeout", &soft_timeout) < 0) {
+        pa_log("Failed to parse soft_timeout value.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew(struct userdata, 1);
     u->core = m->core;
     u->timeout = timeout * PA_USEC_PER_SEC;
+    u->soft_timeout = soft_timeout * PA_USEC_PER_SEC;
     u->device_infos = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL, (pa_free_cb_t) device_info_free);
 
     PA_IDXSET_FOREACH(sink, m->core->sinks, idx)
@@ -454,6 +528,7 @@ int pa__init(pa_module*m) {
 
     pa_module_hook_connect(m, &m->core->hooks[PA_CORE_HOOK_SINK_INPUT_FIXATE], PA_HOOK_NORMAL, (pa_hook_cb_t) sink_input_fixate_hook_cb, u);
     pa_module_hook_connect(m, &m->core->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_FIXATE], PA_HOOK_NORMAL, (pa_hook_cb_t) source_output_fixate_hook_cb, u);
+    pa_module_hook_connect(m, &m->core->hooks[PA_CORE_HOOK_SINK_INPUT_PUT], PA_HOOK_NORMAL, (pa_hook_cb_t) sink_input_put_hook_cb, u);
     pa_module_hook_connect(m, &m->core->hooks[PA_CORE_HOOK_SINK_INPUT_UNLINK], PA_HOOK_NORMAL, (pa_hook_cb_t) sink_input_unlink_hook_cb, u);
     pa_module_hook_connect(m, &m->core->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_UNLINK], PA_HOOK_NORMAL, (pa_hook_cb_t) source_output_unlink_hook_cb, u);
     pa_module_hook_connect(m, &m->core->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_START], PA_HOOK_NORMAL, (pa_hook_cb_t) sink_input_move_start_hook_cb, u);
@@ -489,7 +564,7 @@ void pa__done(pa_module*m) {
     PA_HASHMAP_FOREACH(d, u->device_infos, state) {
         if (d->sink && pa_sink_get_state(d->sink) == PA_SINK_SUSPENDED) {
             pa_log_debug("Resuming sink %s on module unload.", d->sink->name);
-            pa_sink_suspend(d->sink, false, PA_SUSPEND_IDLE);
+            pa_sink_suspend(d->sink, false, PA_SUSPEND_IDLE|PA_SUSPEND_IDLE_SOFT);
         }
 
         if (d->source && pa_source_get_state(d->source) == PA_SOURCE_SUSPENDED) {
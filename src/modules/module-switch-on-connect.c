@@ -41,15 +41,18 @@ PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(true);
 PA_MODULE_USAGE(
         "only_from_unavailable=<boolean, only switch from unavailable ports> "
+        "seamless=<boolean, continue streams where they were instead of keeping them in sync with the clock> "
 );
 
 static const char* const valid_modargs[] = {
     "only_from_unavailable",
+    "seamless",
     NULL,
 };
 
 struct userdata {
     bool only_from_unavailable;
+    bool seamless;
 };
 
 static pa_hook_result_t sink_put_hook_callback(pa_core *c, pa_sink *sink, void* userdata) {
@@ -103,7 +106,7 @@ static pa_hook_result_t sink_put_hook_callback(pa_core *c, pa_sink *sink, void*
         if (i->save_sink || !PA_SINK_INPUT_IS_LINKED(i->state))
             continue;
 
-        if (pa_sink_input_move_to(i, sink, false) < 0)
+        if ((u->seamless ? pa_sink_input_move_to_seamless(i, sink, false) : pa_sink_input_move_to(i, sink, false)) < 0)
             pa_log_info("Failed to move sink input %u \"%s\" to %s.", i->index,
                         pa_strnull(pa_proplist_gets(i->proplist, PA_PROP_APPLICATION_NAME)), sink->name);
         else
@@ -202,6 +205,12 @@ int pa__init(pa_module*m) {
 	goto fail;
     }
 
+    u->seamless = true;
+    if (pa_modargs_get_value_boolean(ma, "seamless", &u->seamless) < 0) {
+        pa_log("Failed to get a boolean value for seamless.");
+        goto fail;
+    }
+
     pa_modargs_free(ma);
     return 0;
 
@@ -64,10 +64,8 @@ static void card_info_free(struct card_info *info) {
     pa_xfree(info);
 }
 
-static bool profile_good_for_output(pa_card_profile *profile, pa_device_port *port) {
+static bool profile_good_for_output(pa_card_profile *profile) {
     pa_card *card;
-    pa_sink *sink;
-    uint32_t idx;
 
     pa_assert(profile);
 
@@ -82,24 +80,11 @@ static bool profile_good_for_output(pa_card_profile *profile, pa_device_port *po
     if (card->active_profile->max_source_channels != profile->max_source_channels)
         return false;
 
-    if (port == card->preferred_output_port)
-        return true;
-
-    PA_IDXSET_FOREACH(sink, card->sinks, idx) {
-        if (!sink->active_port)
-            continue;
-
-        if ((sink->active_port->available != PA_AVAILABLE_NO) && (sink->active_port->priority >= port->priority))
-            return false;
-    }
-
     return true;
 }
 
-static bool profile_good_for_input(pa_card_profile *profile, pa_device_port *port) {
+static bool profile_good_for_input(pa_card_profile *profile) {
     pa_card *card;
-    pa_source *source;
-    uint32_t idx;
 
     pa_assert(profile);
 
@@ -114,15 +99,44 @@ static bool profile_good_for_input(pa_card_profile *profile, pa_device_port *por
     if (card->active_profile->max_sink_channels != profile->max_sink_channels)
         return false;
 
-    if (port == card->preferred_input_port)
-        return true;
+    return true;
+}
 
-    PA_IDXSET_FOREACH(source, card->sources, idx) {
-        if (!source->active_port)
-            continue;
+/* Whether the port may take over from the ports that are active now. That
+ * doesn't depend on the profile, so it's checked once and not for every
+ * profile of the port. */
+static bool port_may_replace_active(pa_device_port *port) {
+    pa_card *card = port->card;
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t idx;
 
-        if ((source->active_port->available != PA_AVAILABLE_NO) && (source->active_port->priority >= port->priority))
-            return false;
+    switch (port->direction) {
+        case PA_DIRECTION_OUTPUT:
+            if (port == card->preferred_output_port)
+                return true;
+
+            PA_IDXSET_FOREACH(sink, card->sinks, idx) {
+                if (!sink->active_port)
+                    continue;
+
+                if ((sink->active_port->available != PA_AVAILABLE_NO) && (sink->active_port->priority >= port->priority))
+                    return false;
+            }
+            break;
+
+        case PA_DIRECTION_INPUT:
+            if (port == card->preferred_input_port)
+                return true;
+
+            PA_IDXSET_FOREACH(source, card->sources, idx) {
+                if (!source->active_port)
+                    continue;
+
+                if ((source->active_port->available != PA_AVAILABLE_NO) && (source->active_port->priority >= port->priority))
+                    return false;
+            }
+            break;
     }
 
     return true;
@@ -136,6 +150,11 @@ static int try_to_switch_profile(pa_device_port *port) {
     pa_log_debug("Finding best profile for port %s, preferred = %s",
                  port->name, pa_strnull(port->preferred_profile));
 
+    if (!port_may_replace_active(port)) {
+        pa_log_debug("No suitable profile found");
+        return -1;
+    }
+
     PA_HASHMAP_FOREACH(profile, port->profiles, state) {
         bool good = false;
         const char *name;
@@ -145,12 +164,12 @@ static int try_to_switch_profile(pa_device_port *port) {
         switch (port->direction) {
             case PA_DIRECTION_OUTPUT:
                 name = profile->output_name;
-                good = profile_good_for_output(profile, port);
+                good = profile_good_for_output(profile);
                 break;
 
             case PA_DIRECTION_INPUT:
                 name = profile->input_name;
-                good = profile_good_for_input(profile, port);
+                good = profile_good_for_input(profile);
                 break;
         }
 
@@ -41,6 +41,10 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/proplist-util.h>
 
+#ifdef HAVE_OPUS
+#include <pulsecore/opus-codec.h>
+#endif
+
 #include "module-tunnel-sink-new-symdef.h"
 
 PA_MODULE_AUTHOR("Alexander Couzens");
@@ -56,11 +60,15 @@ PA_MODULE_USAGE(
         "channels=<number of channels> "
         "rate=<sample rate> "
         "channel_map=<channel map> "
-        "cookie=<cookie file path>"
+        "cookie=<cookie file path> "
+        "compression=<none or opus> "
+        "bitrate=<opus bitrate in bit/s>"
         );
 
 #define MAX_LATENCY_USEC (200 * PA_USEC_PER_MSEC)
 #define TUNNEL_THREAD_FAILED_MAINLOOP 1
+/* The first protocol version that knows about PA_ENCODING_OPUS */
+#define OPUS_PROTOCOL_VERSION 33
 
 static void stream_state_cb(pa_stream *stream, void *userdata);
 static void stream_changed_buffer_attr_cb(pa_stream *stream, void *userdata);
@@ -87,6 +95,18 @@ struct userdata {
     char *cookie_file;
     char *remote_server;
     char *remote_sink_name;
+
+    bool compression;
+    uint32_t bitrate;
+#ifdef HAVE_OPUS
+    /* Set while the remote server takes Opus from us */
+    pa_opus_worker *encoder;
+    /* PCM handed to the encoder that did not come back encoded yet */
+    size_t encoder_pending;
+    /* How much less was written than the remote server asked for, because
+     * of the compression */
+    int64_t encoder_saved;
+#endif
 };
 
 static const char* const valid_modargs[] = {
@@ -99,6 +119,8 @@ static const char* const valid_modargs[] = {
     "rate",
     "channel_map",
     "cookie",
+    "compression",
+    "bitrate",
    /* "reconnect", reconnect if server comes back again - unimplemented */
     NULL,
 };
@@ -116,6 +138,13 @@ static void cork_stream(struct userdata *u, bool cork) {
          * played at the time when the sink starts running again. */
         if ((operation = pa_stream_flush(u->stream, NULL, NULL)))
             pa_operation_unref(operation);
+
+#ifdef HAVE_OPUS
+        if (u->encoder) {
+            pa_opus_worker_flush(u->encoder);
+            u->encoder_pending = 0;
+        }
+#endif
     }
 
     if ((operation = pa_stream_cork(u->stream, cork, NULL, NULL)))
@@ -142,6 +171,74 @@ static pa_proplist* tunnel_new_proplist(struct userdata *u) {
     return proplist;
 }
 
+#ifdef HAVE_OPUS
+/* Called from the encoder thread */
+static void encoder_wakeup_cb(void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_mainloop_wakeup(u->thread_mainloop);
+}
+
+static void start_encoder(struct userdata *u) {
+    pa_opus_codec *codec;
+    pa_usec_t latency;
+
+    pa_assert(!u->encoder);
+
+    latency = pa_sink_get_requested_latency_within_thread(u->sink);
+    if (latency == (pa_usec_t) -1)
+        latency = u->sink->thread_info.max_latency;
+
+    if (!(codec = pa_opus_encoder_new(&u->sink->sample_spec, pa_opus_frame_usec_for_latency(latency), u->bitrate, u->module->core->mempool)))
+        goto fail;
+
+    if (!(u->encoder = pa_opus_worker_new(codec, encoder_wakeup_cb, u)))
+        goto fail;
+
+    u->encoder_pending = 0;
+    u->encoder_saved = 0;
+
+    pa_log_info("Sending Opus to the remote server.");
+    return;
+
+fail:
+    pa_log_error("Failed to set up the Opus encoder.");
+    u->thread_mainloop_api->quit(u->thread_mainloop_api, TUNNEL_THREAD_FAILED_MAINLOOP);
+}
+
+/* Passes whatever the encoder finished on to the remote server */
+static int write_encoded(struct userdata *u) {
+    pa_memchunk memchunk;
+    size_t pcm_length;
+
+    while (pa_opus_worker_pop(u->encoder, &memchunk, &pcm_length)) {
+        const void *p;
+        int ret;
+
+        p = pa_memblock_acquire(memchunk.memblock);
+        ret = pa_stream_write(u->stream, (uint8_t*) p + memchunk.index, memchunk.length, NULL, 0, PA_SEEK_RELATIVE);
+        pa_memblock_release(memchunk.memblock);
+        pa_memblock_unref(memchunk.memblock);
+
+        if (ret != 0)
+            return ret;
+
+        u->encoder_pending -= PA_MIN(u->encoder_pending, pcm_length);
+        u->encoder_saved += (int64_t) pcm_length - (int64_t) memchunk.length;
+    }
+
+    return 0;
+}
+
+/* The remote server asks for PCM bytes, but is sent fewer bytes of Opus
+ * for them */
+static size_t encoder_writable_size(struct userdata *u, size_t writable) {
+    int64_t left = (int64_t) writable - u->encoder_saved - (int64_t) u->encoder_pending;
+
+    return left > 0 ? (size_t) left : 0;
+}
+#endif
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
     pa_proplist *proplist;
@@ -194,6 +291,31 @@ static void thread_func(void *userdata) {
             size_t writable;
 
             writable = pa_stream_writable_size(u->stream);
+
+#ifdef HAVE_OPUS
+            if (u->encoder) {
+                if (write_encoded(u) != 0) {
+                    pa_log_error("Could not write data into the stream.");
+                    u->thread_mainloop_api->quit(u->thread_mainloop_api, TUNNEL_THREAD_FAILED_MAINLOOP);
+                    continue;
+                }
+
+                writable = encoder_writable_size(u, pa_stream_writable_size(u->stream));
+                if (writable > 0) {
+                    pa_memchunk memchunk;
+
+                    pa_sink_render_full(u->sink, writable, &memchunk);
+                    pa_assert(memchunk.length > 0);
+
+                    pa_opus_worker_push(u->encoder, &memchunk);
+                    u->encoder_pending += memchunk.length;
+                    pa_memblock_unref(memchunk.memblock);
+                }
+
+                continue;
+            }
+#endif
+
             if (writable > 0) {
                 pa_memchunk memchunk;
                 const void *p;
@@ -227,6 +349,13 @@ fail:
     pa_asyncmsgq_wait_for(u->thread_mq->inq, PA_MESSAGE_SHUTDOWN);
 
 finish:
+#ifdef HAVE_OPUS
+    if (u->encoder) {
+        pa_opus_worker_free(u->encoder);
+        u->encoder = NULL;
+    }
+#endif
+
     if (u->stream) {
         pa_stream_disconnect(u->stream);
         pa_stream_unref(u->stream);
@@ -257,6 +386,13 @@ static void stream_state_cb(pa_stream *stream, void *userdata) {
             pa_log_debug("Stream terminated.");
             break;
         case PA_STREAM_READY:
+#ifdef HAVE_OPUS
+            if (pa_stream_get_format_info(stream)->encoding == PA_ENCODING_OPUS)
+                start_encoder(u);
+            else if (u->compression)
+                pa_log_info("The remote server does not take Opus, sending PCM.");
+#endif
+
             if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
                 cork_stream(u, false);
 
@@ -314,6 +450,20 @@ static void context_state_cb(pa_context *c, void *userdata) {
             pa_assert(!u->stream);
 
             proplist = tunnel_new_proplist(u);
+#ifdef HAVE_OPUS
+            if (u->compression && pa_context_get_server_protocol_version(u->context) >= OPUS_PROTOCOL_VERSION) {
+                pa_format_info *formats[2];
+
+                /* Offer PCM too, for servers built without Opus */
+                formats[0] = pa_opus_format_new(&u->sink->sample_spec, &u->sink->channel_map);
+                formats[1] = pa_format_info_from_sample_spec(&u->sink->sample_spec, &u->sink->channel_map);
+
+                u->stream = pa_stream_new_extended(u->context, stream_name, formats, 2, proplist);
+
+                pa_format_info_free(formats[0]);
+                pa_format_info_free(formats[1]);
+            } else
+#endif
             u->stream = pa_stream_new_with_proplist(u->context,
                                                     stream_name,
                                                     &u->sink->sample_spec,
@@ -379,6 +529,11 @@ static void sink_update_requested_latency_cb(pa_sink *s) {
     nbytes = pa_usec_to_bytes(block_usec, &s->sample_spec);
     pa_sink_set_max_request_within_thread(s, nbytes);
 
+#ifdef HAVE_OPUS
+    if (u->encoder)
+        pa_opus_worker_set_frame_usec(u->encoder, pa_opus_frame_usec_for_latency(block_usec));
+#endif
+
     if (u->stream) {
         switch (pa_stream_get_state(u->stream)) {
             case PA_STREAM_READY:
@@ -429,6 +584,13 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
             }
 
             *((int64_t*) data) = remote_latency;
+
+#ifdef HAVE_OPUS
+            /* Audio waiting to be encoded */
+            if (u->encoder)
+                *((int64_t*) data) += pa_bytes_to_usec(u->encoder_pending, &u->sink->sample_spec);
+#endif
+
             return 0;
         }
         case PA_SINK_MESSAGE_SET_STATE:
@@ -455,6 +617,28 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+static int parse_compression(pa_modargs *ma, bool *compression, uint32_t *bitrate) {
+    const char *c;
+
+    c = pa_modargs_get_value(ma, "compression", "none");
+    if (pa_streq(c, "opus"))
+        *compression = true;
+    else if (pa_streq(c, "none"))
+        *compression = false;
+    else {
+        pa_log("Invalid compression \"%s\", expected \"none\" or \"opus\".", c);
+        return -1;
+    }
+
+    *bitrate = 0;
+    if (pa_modargs_get_value_u32(ma, "bitrate", bitrate) < 0) {
+        pa_log("Failed to parse \"bitrate\" parameter.");
+        return -1;
+    }
+
+    return 0;
+}
+
 int pa__init(pa_module *m) {
     struct userdata *u = NULL;
     pa_modargs *ma = NULL;
@@ -464,6 +648,8 @@ int pa__init(pa_module *m) {
     const char *remote_server = NULL;
     const char *sink_name = NULL;
     char *default_sink_name = NULL;
+    bool compression;
+    uint32_t bitrate;
 
     pa_assert(m);
 
@@ -479,6 +665,30 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    if (parse_compression(ma, &compression, &bitrate) < 0)
+        goto fail;
+
+    if (compression) {
+#ifdef HAVE_OPUS
+        /* Our sample spec is what the remote server decodes to, so pick
+         * one Opus can encode */
+        if (!pa_opus_sample_spec_supported(&ss)) {
+            char before[PA_SAMPLE_SPEC_SNPRINT_MAX], after[PA_SAMPLE_SPEC_SNPRINT_MAX];
+
+            pa_sample_spec_snprint(before, sizeof(before), &ss);
+            pa_opus_sample_spec_fix(&ss);
+            pa_sample_spec_snprint(after, sizeof(after), &ss);
+            pa_log_info("Opus can't encode %s, using %s instead.", before, after);
+
+            if (map.channels != ss.channels)
+                pa_channel_map_init_extend(&map, ss.channels, PA_CHANNEL_MAP_DEFAULT);
+        }
+#else
+        pa_log("Compression was requested, but Opus support is not available.");
+        goto fail;
+#endif
+    }
+
     remote_server = pa_modargs_get_value(ma, "server", NULL);
     if (!remote_server) {
         pa_log("No server given!");
@@ -489,6 +699,8 @@ int pa__init(pa_module *m) {
     u->module = m;
     m->userdata = u;
     u->remote_server = pa_xstrdup(remote_server);
+    u->compression = compression;
+    u->bitrate = bitrate;
     u->thread_mainloop = pa_mainloop_new();
     if (u->thread_mainloop == NULL) {
         pa_log("Failed to create mainloop");
@@ -41,6 +41,10 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/proplist-util.h>
 
+#ifdef HAVE_OPUS
+#include <pulsecore/opus-codec.h>
+#endif
+
 #include "module-tunnel-source-new-symdef.h"
 
 PA_MODULE_AUTHOR("Alexander Couzens");
@@ -56,10 +60,13 @@ PA_MODULE_USAGE(
         "channels=<number of channels> "
         "rate=<sample rate> "
         "channel_map=<channel map> "
-        "cookie=<cookie file path>"
+        "cookie=<cookie file path> "
+        "compression=<none or opus>"
         );
 
 #define TUNNEL_THREAD_FAILED_MAINLOOP 1
+/* The first protocol version that knows about PA_ENCODING_OPUS */
+#define OPUS_PROTOCOL_VERSION 33
 
 static void stream_state_cb(pa_stream *stream, void *userdata);
 static void stream_read_cb(pa_stream *s, size_t length, void *userdata);
@@ -85,6 +92,12 @@ struct userdata {
     char *cookie_file;
     char *remote_server;
     char *remote_source_name;
+
+    bool compression;
+#ifdef HAVE_OPUS
+    /* Set while the remote server sends Opus to us */
+    pa_opus_worker *decoder;
+#endif
 };
 
 static const char* const valid_modargs[] = {
@@ -97,6 +110,7 @@ static const char* const valid_modargs[] = {
     "rate",
     "channel_map",
     "cookie",
+    "compression",
    /* "reconnect", reconnect if server comes back again - unimplemented */
     NULL,
 };
@@ -136,6 +150,40 @@ static void stream_read_cb(pa_stream *s, size_t length, void *userdata) {
     u->new_data = true;
 }
 
+#ifdef HAVE_OPUS
+/* Called from the decoder thread */
+static void decoder_wakeup_cb(void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_mainloop_wakeup(u->thread_mainloop);
+}
+
+static void start_decoder(struct userdata *u) {
+    pa_opus_codec *codec;
+
+    pa_assert(!u->decoder);
+
+    if (!(codec = pa_opus_decoder_new(&u->source->sample_spec, u->module->core->mempool)) ||
+        !(u->decoder = pa_opus_worker_new(codec, decoder_wakeup_cb, u))) {
+        pa_log_error("Failed to set up the Opus decoder.");
+        u->thread_mainloop_api->quit(u->thread_mainloop_api, TUNNEL_THREAD_FAILED_MAINLOOP);
+        return;
+    }
+
+    pa_log_info("Receiving Opus from the remote server.");
+}
+
+/* Posts whatever the decoder finished to our source */
+static void post_decoded(struct userdata *u) {
+    pa_memchunk memchunk;
+
+    while (pa_opus_worker_pop(u->decoder, &memchunk, NULL)) {
+        pa_source_post(u->source, &memchunk);
+        pa_memblock_unref(memchunk.memblock);
+    }
+}
+#endif
+
 /* called from io context to read samples from the stream into our source */
 static void read_new_samples(struct userdata *u) {
     const void *p;
@@ -165,8 +213,18 @@ static void read_new_samples(struct userdata *u) {
             memchunk.length = nbytes;
             memchunk.index = 0;
 
+#ifdef HAVE_OPUS
+            if (u->decoder)
+                pa_opus_worker_push(u->decoder, &memchunk);
+            else
+#endif
             pa_source_post(u->source, &memchunk);
             pa_memblock_unref_fixed(memchunk.memblock);
+#ifdef HAVE_OPUS
+        } else if (u->decoder) {
+            /* Holes can't be part of a compressed stream */
+            pa_log_debug("Ignoring a hole in the Opus stream.");
+#endif
         } else {
             size_t bytes_to_generate = nbytes;
 
@@ -236,12 +294,24 @@ static void thread_func(void *userdata) {
 
         if (u->new_data)
             read_new_samples(u);
+
+#ifdef HAVE_OPUS
+        if (u->decoder)
+            post_decoded(u);
+#endif
     }
 fail:
     pa_asyncmsgq_post(u->thread_mq->outq, PA_MSGOBJECT(u->module->core), PA_CORE_MESSAGE_UNLOAD_MODULE, u->module, 0, NULL, NULL);
     pa_asyncmsgq_wait_for(u->thread_mq->inq, PA_MESSAGE_SHUTDOWN);
 
 finish:
+#ifdef HAVE_OPUS
+    if (u->decoder) {
+        pa_opus_worker_free(u->decoder);
+        u->decoder = NULL;
+    }
+#endif
+
     if (u->stream) {
         pa_stream_disconnect(u->stream);
         pa_stream_unref(u->stream);
@@ -272,6 +342,13 @@ static void stream_state_cb(pa_stream *stream, void *userdata) {
             pa_log_debug("Stream terminated.");
             break;
         case PA_STREAM_READY:
+#ifdef HAVE_OPUS
+            if (pa_stream_get_format_info(stream)->encoding == PA_ENCODING_OPUS)
+                start_decoder(u);
+            else if (u->compression)
+                pa_log_info("The remote server does not send Opus, receiving PCM.");
+#endif
+
             if (PA_SOURCE_IS_OPENED(u->source->thread_info.state))
                 cork_stream(u, false);
 
@@ -312,6 +389,20 @@ static void context_state_cb(pa_context *c, void *userdata) {
             pa_assert(!u->stream);
 
             proplist = tunnel_new_proplist(u);
+#ifdef HAVE_OPUS
+            if (u->compression && pa_context_get_server_protocol_version(u->context) >= OPUS_PROTOCOL_VERSION) {
+                pa_format_info *formats[2];
+
+                /* Accept PCM too, from servers built without Opus */
+                formats[0] = pa_opus_format_new(&u->source->sample_spec, &u->source->channel_map);
+                formats[1] = pa_format_info_from_sample_spec(&u->source->sample_spec, &u->source->channel_map);
+
+                u->stream = pa_stream_new_extended(u->context, stream_name, formats, 2, proplist);
+
+                pa_format_info_free(formats[0]);
+                pa_format_info_free(formats[1]);
+            } else
+#endif
             u->stream = pa_stream_new_with_proplist(u->context,
                                                     stream_name,
                                                     &u->source->sample_spec,
@@ -463,6 +554,7 @@ int pa__init(pa_module *m) {
     const char *remote_server = NULL;
     const char *source_name = NULL;
     char *default_source_name = NULL;
+    const char *compression;
 
     pa_assert(m);
 
@@ -478,6 +570,31 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    compression = pa_modargs_get_value(ma, "compression", "none");
+    if (pa_streq(compression, "opus")) {
+#ifdef HAVE_OPUS
+        /* Our sample spec is what the remote server encodes from, so pick
+         * one Opus can encode */
+        if (!pa_opus_sample_spec_supported(&ss)) {
+            char before[PA_SAMPLE_SPEC_SNPRINT_MAX], after[PA_SAMPLE_SPEC_SNPRINT_MAX];
+
+            pa_sample_spec_snprint(before, sizeof(before), &ss);
+            pa_opus_sample_spec_fix(&ss);
+            pa_sample_spec_snprint(after, sizeof(after), &ss);
+            pa_log_info("Opus can't encode %s, using %s instead.", before, after);
+
+            if (map.channels != ss.channels)
+                pa_channel_map_init_extend(&map, ss.channels, PA_CHANNEL_MAP_DEFAULT);
+        }
+#else
+        pa_log("Compression was requested, but Opus support is not available.");
+        goto fail;
+#endif
+    } else if (!pa_streq(compression, "none")) {
+        pa_log("Invalid compression \"%s\", expected \"none\" or \"opus\".", compression);
+        goto fail;
+    }
+
     remote_server = pa_modargs_get_value(ma, "server", NULL);
     if (!remote_server) {
         pa_log("No server given!");
@@ -488,6 +605,7 @@ int pa__init(pa_module *m) {
     u->module = m;
     m->userdata = u;
     u->remote_server = pa_xstrdup(remote_server);
+    u->compression = pa_streq(compression, "opus");
     u->thread_mainloop = pa_mainloop_new();
     if (u->thread_mainloop == NULL) {
         pa_log("Failed to create mainloop");
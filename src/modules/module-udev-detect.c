@@ -48,7 +48,8 @@ PA_MODULE_USAGE(
         "fixed_latency_range=<disable latency range changes on underrun?> "
         "ignore_dB=<ignore dB information from the device?> "
         "deferred_volume=<syncronize sw and hw volume changes in IO-thread?> "
-        "use_ucm=<use ALSA UCM for card configuration?>");
+        "use_ucm=<use ALSA UCM for card configuration?> "
+        "async_probe=<set up the cards found at startup in the background?>");
 
 struct device {
     char *path;
@@ -61,6 +62,7 @@ struct device {
 
 struct userdata {
     pa_core *core;
+    pa_module *module;
     pa_hashmap *devices;
 
     bool use_tsched:1;
@@ -69,6 +71,10 @@ struct userdata {
     bool ignore_dB:1;
     bool deferred_volume:1;
     bool use_ucm:1;
+    /* Whether module-alsa-card probes the card in a worker thread. Only
+     * off while the cards found at startup are set up with
+     * async_probe=false. */
+    bool card_async_probe:1;
 
     uint32_t tsched_buffer_size;
 
@@ -78,6 +84,11 @@ struct userdata {
 
     int inotify_fd;
     pa_io_event *inotify_io;
+
+    /* Cards found at startup that have not been set up yet */
+    struct udev_enumerate *probe_enumerate;
+    struct udev_list_entry *probe_next;
+    pa_defer_event *probe_event;
 };
 
 static const char* const valid_modargs[] = {
@@ -87,6 +98,7 @@ static const char* const valid_modargs[] = {
     "ignore_dB",
     "deferred_volume",
     "use_ucm",
+    "async_probe",
     NULL
 };
 
@@ -331,8 +343,15 @@ static void verify_access(struct userdata *u, struct device *d) {
                  * failure or a "fatal" failure. */
 
                 if (pa_ratelimit_test(&d->ratelimit, PA_LOG_DEBUG)) {
-                    pa_log_debug("Loading module-alsa-card with arguments '%s'", d->args);
-                    pa_module_load(&m, u->core, "module-alsa-card", d->args);
+                    char *args;
+
+                    /* Probing can take a while, let the main loop go on
+                     * meanwhile. The card appears once it is done. */
+                    args = pa_sprintf_malloc("%s async_probe=%s", d->args, pa_yes_no(u->card_async_probe));
+
+                    pa_log_debug("Loading module-alsa-card with arguments '%s'", args);
+                    pa_module_load(&m, u->core, "module-alsa-card", args);
+                    pa_xfree(args);
 
                     if (m) {
                         d->module = m->index;
@@ -484,6 +503,39 @@ static void process_path(struct userdata *u, const char *path) {
     udev_device_unref(dev);
 }
 
+static void probe_finish(struct userdata *u) {
+    pa_assert(u);
+
+    u->core->mainloop->defer_free(u->probe_event);
+    u->probe_event = NULL;
+
+    udev_enumerate_unref(u->probe_enumerate);
+    u->probe_enumerate = NULL;
+
+    pa_log_info("Found %u cards.", pa_hashmap_size(u->devices));
+
+    pa_module_init_finish(u->module, 0);
+}
+
+/* Sets up one card per main loop iteration. Probing a card can take a
+ * while, this way the other modules and the clients don't have to wait
+ * until all of them are done. */
+static void probe_cb(pa_mainloop_api *a, pa_defer_event *e, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(a);
+    pa_assert(e);
+    pa_assert(u);
+
+    if (!u->probe_next) {
+        probe_finish(u);
+        return;
+    }
+
+    process_path(u, udev_list_entry_get_name(u->probe_next));
+    u->probe_next = udev_list_entry_get_next(u->probe_next);
+}
+
 static void monitor_cb(
         pa_mainloop_api*a,
         pa_io_event* e,
@@ -683,7 +735,7 @@ int pa__init(pa_module *m) {
     struct udev_list_entry *item = NULL, *first = NULL;
     int fd;
     bool use_tsched = true, fixed_latency_range = false, ignore_dB = false, deferred_volume = m->core->deferred_volume;
-    bool use_ucm = true;
+    bool use_ucm = true, async_probe = true;
 
     pa_assert(m);
 
@@ -694,6 +746,7 @@ int pa__init(pa_module *m) {
 
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
+    u->module = m;
     u->devices = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL, (pa_free_cb_t) device_free);
     u->inotify_fd = -1;
 
@@ -736,6 +789,11 @@ int pa__init(pa_module *m) {
     }
     u->use_ucm = use_ucm;
 
+    if (pa_modargs_get_value_boolean(ma, "async_probe", &async_probe) < 0) {
+        pa_log("Failed to parse async_probe= argument.");
+        goto fail;
+    }
+
     if (!(u->udev = udev_new())) {
         pa_log("Failed to initialize udev library.");
         goto fail;
@@ -787,12 +845,27 @@ int pa__init(pa_module *m) {
     }
 
     first = udev_enumerate_get_list_entry(enumerate);
-    udev_list_entry_foreach(item, first)
-        process_path(u, udev_list_entry_get_name(item));
 
-    udev_enumerate_unref(enumerate);
+    u->card_async_probe = async_probe;
 
-    pa_log_info("Found %u cards.", pa_hashmap_size(u->devices));
+    if (async_probe) {
+        /* The monitor is already running, so cards that come and go in the
+         * meantime are handled as usual */
+        u->probe_enumerate = enumerate;
+        u->probe_next = first;
+        pa_assert_se(u->probe_event = u->core->mainloop->defer_new(u->core->mainloop, probe_cb, u));
+        pa_module_init_async(m);
+    } else {
+        udev_list_entry_foreach(item, first)
+            process_path(u, udev_list_entry_get_name(item));
+
+        udev_enumerate_unref(enumerate);
+
+        pa_log_info("Found %u cards.", pa_hashmap_size(u->devices));
+
+        /* Nobody waits for the cards that are hotplugged from now on */
+        u->card_async_probe = true;
+    }
 
     pa_modargs_free(ma);
 
@@ -819,6 +892,12 @@ void pa__done(pa_module *m) {
     if (!(u = m->userdata))
         return;
 
+    if (u->probe_event)
+        m->core->mainloop->defer_free(u->probe_event);
+
+    if (u->probe_enumerate)
+        udev_enumerate_unref(u->probe_enumerate);
+
     if (u->udev_io)
         m->core->mainloop->io_free(u->udev_io);
 
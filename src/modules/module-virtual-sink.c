@@ -209,6 +209,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     size_t fs;
     unsigned n, c;
     pa_memchunk tchunk;
+    bool in_place;
     pa_usec_t current_latency PA_GCC_UNUSED;
 
     pa_sink_input_assert_ref(i);
@@ -243,14 +244,17 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_assert(n > 0);
 
-    chunk->index = 0;
-    chunk->length = n*fs;
-    chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
+    tchunk.length = n*fs;
+    pa_memblockq_drop(u->memblockq, tchunk.length);
 
-    pa_memblockq_drop(u->memblockq, chunk->length);
+    /* IF THE OUTPUT HAS THE SAME FORMAT AS THE INPUT AND YOUR FILTER
+     * CAN DEAL WITH src == dst, THIS PROCESSES THE DATA IN PLACE WHEN
+     * NOBODY ELSE IS USING IT. OTHERWISE ALLOCATE THE OUTPUT BLOCK
+     * YOURSELF. */
+    in_place = pa_memchunk_filter_output(chunk, &tchunk, tchunk.length);
 
     src = pa_memblock_acquire_chunk(&tchunk);
-    dst = pa_memblock_acquire(chunk->memblock);
+    dst = pa_memblock_acquire_chunk(chunk);
 
     /* (3) PUT YOUR CODE HERE TO DO SOMETHING WITH THE DATA */
 
@@ -265,7 +269,8 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
 
-    pa_memblock_unref(tchunk.memblock);
+    if (!in_place)
+        pa_memblock_unref(tchunk.memblock);
 
     /* (4) IF YOU NEED THE LATENCY FOR SOMETHING ACQUIRE IT LIKE THIS: */
     current_latency =
@@ -38,6 +38,7 @@
 #include <pulsecore/ltdl-helper.h>
 #include <pulsecore/sound-file.h>
 #include <pulsecore/resampler.h>
+#include <pulsecore/filter/convolver.h>
 
 #include <math.h>
 
@@ -59,12 +60,33 @@ PA_MODULE_USAGE(
           "use_volume_sharing=<yes or no> "
           "force_flat_volume=<yes or no> "
           "hrir=/path/to/left_hrir.wav "
+          "convolution=<auto, direct or fft> "
           "autoloaded=<set if this module is being loaded automatically> "
         ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED false
 
+/* The direct form costs hrir_samples multiplications per channel and ear for
+ * every frame, so it is limited to short impulse responses. Longer ones are
+ * cut off, unless the FFT convolution is used. */
+#define DIRECT_MAX_HRIR_SAMPLES 64
+#define FFT_MAX_HRIR_SAMPLES 16384
+
+/* With convolution=auto, the FFT convolution is used for impulse responses
+ * longer than this */
+#define FFT_AUTO_MIN_HRIR_SAMPLES 32
+
+/* Block size of the uniformly partitioned FFT convolution. This is the
+ * additional latency it introduces. */
+#define FFT_PARTITION_SIZE 128
+
+enum convolution_mode {
+    CONVOLUTION_AUTO,
+    CONVOLUTION_DIRECT,
+    CONVOLUTION_FFT
+};
+
 struct userdata {
     pa_module *module;
 
@@ -88,8 +110,18 @@ struct userdata {
     unsigned hrir_samples;
     float *hrir_data;
 
+    /* impulse responses of the left and right ear for each input channel */
+    float *hrir_left;
+    float *hrir_right;
+
+    bool use_fft;
+
+    /* direct form: per channel history of 2 * hrir_samples, every sample is
+     * stored twice so that the last hrir_samples are always contiguous */
     float *input_buffer;
-    int input_buffer_offset;
+    unsigned input_buffer_offset;
+
+    pa_convolver *convolver;
 
     bool autoloaded;
 };
@@ -106,6 +138,7 @@ static const char* const valid_modargs[] = {
     "use_volume_sharing",
     "force_flat_volume",
     "hrir",
+    "convolution",
     "autoloaded",
     NULL
 };
@@ -133,7 +166,10 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
                 pa_sink_get_latency_within_thread(u->sink_input->sink, true) +
 
                 /* Add the latency internal to our sink input on top */
-                pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
+                pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec) +
+
+                /* Add the delay of the FFT convolution */
+                (u->use_fft ? pa_bytes_to_usec(pa_convolver_get_latency(u->convolver) * u->fs, &u->sink_input->sample_spec) : 0);
 
             return 0;
 
@@ -230,6 +266,77 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+/* Sum of x[j] * h[j], written with independent partial sums so that the
+ * compiler can vectorize it */
+static float dot_product(const float *x, const float *h, unsigned len) {
+    float acc[8] = { 0 };
+    float sum = 0;
+    unsigned j, t;
+
+    for (j = 0; j + 8 <= len; j += 8)
+        for (t = 0; t < 8; t++)
+            acc[t] += x[j + t] * h[j + t];
+
+    for (; j < len; j++)
+        sum += x[j] * h[j];
+
+    for (t = 0; t < 8; t++)
+        sum += acc[t];
+
+    return sum;
+}
+
+static void direct_convolution_reset(struct userdata *u) {
+    memset(u->input_buffer, 0, 2 * u->hrir_samples * u->sink_fs);
+    u->input_buffer_offset = 0;
+}
+
+/* Like direct_convolution_run(), but only fill the history */
+static void direct_convolution_feed(struct userdata *u, const float *src, unsigned n) {
+    unsigned l, k;
+
+    for (l = 0; l < n; l++) {
+        for (k = 0; k < u->channels; k++) {
+            float *history = u->input_buffer + k * 2 * u->hrir_samples;
+
+            history[u->input_buffer_offset] = src[l * u->channels + k];
+            history[u->input_buffer_offset + u->hrir_samples] = src[l * u->channels + k];
+        }
+
+        if (u->input_buffer_offset == 0)
+            u->input_buffer_offset = u->hrir_samples;
+        u->input_buffer_offset--;
+    }
+}
+
+static void direct_convolution_run(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned l, k;
+    float sum_left, sum_right;
+
+    for (l = 0; l < n; l++) {
+        sum_left = 0;
+        sum_right = 0;
+
+        /* fold the input history with the impulse response */
+        for (k = 0; k < u->channels; k++) {
+            float *history = u->input_buffer + k * 2 * u->hrir_samples;
+
+            history[u->input_buffer_offset] = src[l * u->channels + k];
+            history[u->input_buffer_offset + u->hrir_samples] = src[l * u->channels + k];
+
+            sum_left += dot_product(history + u->input_buffer_offset, u->hrir_left + k * u->hrir_samples, u->hrir_samples);
+            sum_right += dot_product(history + u->input_buffer_offset, u->hrir_right + k * u->hrir_samples, u->hrir_samples);
+        }
+
+        dst[2 * l] = PA_CLAMP_UNLIKELY(sum_left, -1.0f, 1.0f);
+        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(sum_right, -1.0f, 1.0f);
+
+        if (u->input_buffer_offset == 0)
+            u->input_buffer_offset = u->hrir_samples;
+        u->input_buffer_offset--;
+    }
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
@@ -237,10 +344,6 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     unsigned n;
     pa_memchunk tchunk;
 
-    unsigned j, k, l;
-    float sum_right, sum_left;
-    float current_sample;
-
     pa_sink_input_assert_ref(i);
     pa_assert(chunk);
     pa_assert_se(u = i->userdata);
@@ -275,29 +378,15 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = pa_memblock_acquire_chunk(&tchunk);
     dst = pa_memblock_acquire(chunk->memblock);
 
-    for (l = 0; l < n; l++) {
-        memcpy(((char*) u->input_buffer) + u->input_buffer_offset * u->sink_fs, ((char *) src) + l * u->sink_fs, u->sink_fs);
-
-        sum_right = 0;
-        sum_left = 0;
+    if (u->use_fft) {
+        unsigned l;
 
-        /* fold the input buffer with the impulse response */
-        for (j = 0; j < u->hrir_samples; j++) {
-            for (k = 0; k < u->channels; k++) {
-                current_sample = u->input_buffer[((u->input_buffer_offset + j) % u->hrir_samples) * u->channels + k];
-
-                sum_left += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_left[k]];
-                sum_right += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_right[k]];
-            }
-        }
-
-        dst[2 * l] = PA_CLAMP_UNLIKELY(sum_left, -1.0f, 1.0f);
-        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(sum_right, -1.0f, 1.0f);
+        pa_convolver_process(u->convolver, src, dst, n);
 
-        u->input_buffer_offset--;
-        if (u->input_buffer_offset < 0)
-            u->input_buffer_offset += u->hrir_samples;
-    }
+        for (l = 0; l < 2 * n; l++)
+            dst[l] = PA_CLAMP_UNLIKELY(dst[l], -1.0f, 1.0f);
+    } else
+        direct_convolution_run(u, src, dst, n);
 
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
@@ -307,6 +396,37 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     return 0;
 }
 
+static unsigned convolution_history(struct userdata *u) {
+    return u->use_fft ? pa_convolver_get_history(u->convolver) : u->hrir_samples;
+}
+
+/* Called from I/O thread context */
+static void rebuild_convolution_state(struct userdata *u) {
+    size_t length;
+    pa_memchunk chunk;
+    float *history;
+
+    /* The input that precedes the read index is still in the queue, see
+     * sink_input_update_max_rewind_cb() */
+    length = convolution_history(u) * u->sink_fs;
+    pa_memblockq_rewind(u->memblockq, length);
+    pa_assert_se(pa_memblockq_peek_fixed_size(u->memblockq, length, &chunk) >= 0);
+
+    history = pa_memblock_acquire_chunk(&chunk);
+
+    if (u->use_fft)
+        pa_convolver_rewind(u->convolver, history, convolution_history(u));
+    else {
+        direct_convolution_reset(u);
+        direct_convolution_feed(u, history, convolution_history(u));
+    }
+
+    pa_memblock_release(chunk.memblock);
+    pa_memblock_unref(chunk.memblock);
+
+    pa_memblockq_drop(u->memblockq, length);
+}
+
 /* Called from I/O thread context */
 static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
     struct userdata *u;
@@ -326,17 +446,17 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         amount = PA_MIN(u->sink->thread_info.rewind_nbytes * u->sink_fs / u->fs, max_rewrite);
         u->sink->thread_info.rewind_nbytes = 0;
 
-        if (amount > 0) {
+        if (amount > 0)
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, true);
-
-            /* Reset the input buffer */
-            memset(u->input_buffer, 0, u->hrir_samples * u->sink_fs);
-            u->input_buffer_offset = 0;
-        }
     }
 
     pa_sink_process_rewind(u->sink, amount);
     pa_memblockq_rewind(u->memblockq, nbytes * u->sink_fs / u->fs);
+
+    /* The filter has already seen the rewound input, so bring it back to
+     * the state at the new read index */
+    if (nbytes > 0)
+        rebuild_convolution_state(u);
 }
 
 /* Called from I/O thread context */
@@ -348,7 +468,8 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
 
     /* FIXME: Too small max_rewind:
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
-    pa_memblockq_set_maxrewind(u->memblockq, nbytes * u->sink_fs / u->fs);
+    /* Keep the history the filter state is rebuilt from on rewinds */
+    pa_memblockq_set_maxrewind(u->memblockq, nbytes * u->sink_fs / u->fs + convolution_history(u) * u->sink_fs);
     pa_sink_set_max_rewind_within_thread(u->sink, nbytes * u->sink_fs / u->fs);
 }
 
@@ -595,8 +716,9 @@ int pa__init(pa_module*m) {
     bool force_flat_volume = false;
     pa_memchunk silence;
 
-    const char *hrir_file;
-    unsigned i, j, found_channel_left, found_channel_right;
+    const char *hrir_file, *convolution;
+    enum convolution_mode convolution_mode = CONVOLUTION_AUTO;
+    unsigned i, j, max_hrir_samples, found_channel_left, found_channel_right;
     float *hrir_data;
 
     pa_sample_spec hrir_ss;
@@ -681,6 +803,19 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if ((convolution = pa_modargs_get_value(ma, "convolution", NULL))) {
+        if (pa_streq(convolution, "auto"))
+            convolution_mode = CONVOLUTION_AUTO;
+        else if (pa_streq(convolution, "direct"))
+            convolution_mode = CONVOLUTION_DIRECT;
+        else if (pa_streq(convolution, "fft"))
+            convolution_mode = CONVOLUTION_FFT;
+        else {
+            pa_log("convolution= expects auto, direct or fft");
+            goto fail;
+        }
+    }
+
     /* sample spec / map of sink input */
     pa_channel_map_init_stereo(&sink_input_map);
     sink_input_ss.channels = 2;
@@ -790,9 +925,16 @@ int pa__init(pa_module*m) {
                                  PA_RESAMPLER_SRC_SINC_BEST_QUALITY, PA_RESAMPLER_NO_REMAP);
 
     u->hrir_samples = hrir_temp_chunk.length / pa_frame_size(&hrir_temp_ss) * hrir_ss.rate / hrir_temp_ss.rate;
-    if (u->hrir_samples > 64) {
-        u->hrir_samples = 64;
-        pa_log("The (resampled) hrir contains more than 64 samples. Only the first 64 samples will be used to limit processor usage.");
+
+    if (convolution_mode == CONVOLUTION_AUTO)
+        convolution_mode = u->hrir_samples > FFT_AUTO_MIN_HRIR_SAMPLES ? CONVOLUTION_FFT : CONVOLUTION_DIRECT;
+    u->use_fft = convolution_mode == CONVOLUTION_FFT;
+
+    max_hrir_samples = u->use_fft ? FFT_MAX_HRIR_SAMPLES : DIRECT_MAX_HRIR_SAMPLES;
+    if (u->hrir_samples > max_hrir_samples) {
+        u->hrir_samples = max_hrir_samples;
+        pa_log("The (resampled) hrir contains more than %u samples. Only the first %u samples will be used to limit processor usage.",
+               max_hrir_samples, max_hrir_samples);
     }
 
     hrir_total_length = u->hrir_samples * pa_frame_size(&hrir_ss);
@@ -868,8 +1010,29 @@ int pa__init(pa_module*m) {
         }
     }
 
-    u->input_buffer = pa_xmalloc0(u->hrir_samples * u->sink_fs);
-    u->input_buffer_offset = 0;
+    /* split the hrir into one impulse response per input channel and ear */
+    u->hrir_left = pa_xnew(float, u->channels * u->hrir_samples);
+    u->hrir_right = pa_xnew(float, u->channels * u->hrir_samples);
+    for (i = 0; i < u->channels; i++) {
+        for (j = 0; j < u->hrir_samples; j++) {
+            u->hrir_left[i * u->hrir_samples + j] = u->hrir_data[j * u->hrir_channels + u->mapping_left[i]];
+            u->hrir_right[i * u->hrir_samples + j] = u->hrir_data[j * u->hrir_channels + u->mapping_right[i]];
+        }
+    }
+
+    if (u->use_fft) {
+        u->convolver = pa_convolver_new(u->channels, 2, FFT_PARTITION_SIZE, u->hrir_samples);
+
+        for (i = 0; i < u->channels; i++) {
+            pa_convolver_set_ir(u->convolver, i, 0, u->hrir_left + i * u->hrir_samples, u->hrir_samples);
+            pa_convolver_set_ir(u->convolver, i, 1, u->hrir_right + i * u->hrir_samples, u->hrir_samples);
+        }
+    } else {
+        u->input_buffer = pa_xmalloc0(2 * u->hrir_samples * u->sink_fs);
+        u->input_buffer_offset = 0;
+    }
+
+    pa_log_debug("Using %s convolution with %u hrir samples", u->use_fft ? "FFT" : "direct", u->hrir_samples);
 
     /* The order here is important. The input must be put first,
      * otherwise streams might attach to the sink before the sink
@@ -939,6 +1102,12 @@ void pa__done(pa_module*m) {
     if (u->input_buffer)
         pa_xfree(u->input_buffer);
 
+    pa_xfree(u->hrir_left);
+    pa_xfree(u->hrir_right);
+
+    if (u->convolver)
+        pa_convolver_free(u->convolver);
+
     if (u->mapping_left)
         pa_xfree(u->mapping_left);
     if (u->mapping_right)
@@ -29,12 +29,17 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <math.h>
 
 #ifdef HAVE_SYS_FILIO_H
 #include <sys/filio.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #include <pulse/xmalloc.h>
 #include <pulse/timeval.h>
 #include <pulse/sample.h>
@@ -43,6 +48,7 @@
 #include <pulsecore/core-error.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/endianmacros.h>
 #include <pulsecore/iochannel.h>
 #include <pulsecore/arpa-inet.h>
 #include <pulsecore/socket-client.h>
@@ -68,6 +74,13 @@
 
 #define RTX_BUFFERING_SECONDS 4
 
+/* Retransmitted packets sent with one system call */
+#ifdef HAVE_SENDMMSG
+#define RESEND_BATCH 16
+#else
+#define RESEND_BATCH 1
+#endif
+
 #define DEFAULT_TCP_AUDIO_PORT   6000
 #define DEFAULT_UDP_AUDIO_PORT   6000
 #define DEFAULT_UDP_CONTROL_PORT 6001
@@ -109,6 +122,9 @@ struct pa_raop_client {
     int udp_tfd;
 
     pa_raop_packet_buffer *pbuf;
+    /* Packets the receiver asked for again, and the ones we still had */
+    uint64_t resend_requested;
+    uint64_t resent;
 
     uint16_t seq;
     uint32_t rtptime;
@@ -217,94 +233,88 @@ static inline uint64_t timeval_to_ntp(struct timeval *tv) {
     return ntp;
 }
 
+/* Packs bits MSB first into a buffer, a 32 bit word at a time */
+typedef struct bit_writer {
+    uint8_t *buffer;
+    uint64_t bits;
+    unsigned n_bits;
+} bit_writer;
+
 /**
  * Function to write bits into a buffer.
- * @param buffer Handle to the buffer. It will be incremented if new data requires it.
- * @param bit_pos A pointer to a position buffer to keep track the current write location (0 for MSB, 7 for LSB)
- * @param size A pointer to the byte size currently written. This allows the calling function to do simple buffer overflow checks
- * @param data The data to write
- * @param data_bit_len The number of bits from data to write
+ * @param w The writer, with fewer than 32 bits pending
+ * @param data The data to write, right aligned
+ * @param data_bit_len The number of bits from data to write, at most 32
  */
-static inline void bit_writer(uint8_t **buffer, uint8_t *bit_pos, size_t *size, uint8_t data, uint8_t data_bit_len) {
-    int bits_left, bit_overflow;
-    uint8_t bit_data;
+static inline void bit_writer_put(bit_writer *w, uint32_t data, unsigned data_bit_len) {
+    uint32_t word;
 
-    if (!data_bit_len)
+    w->bits = (w->bits << data_bit_len) | (data & ((UINT64_C(1) << data_bit_len) - 1));
+    w->n_bits += data_bit_len;
+
+    if (w->n_bits < 32)
         return;
 
-    /* If bit pos is zero, we will definately use at least one bit from the current byte so size increments. */
-    if (!*bit_pos)
-        *size += 1;
-
-    /* Calc the number of bits left in the current byte of buffer. */
-    bits_left = 7 - *bit_pos  + 1;
-    /* Calc the overflow of bits in relation to how much space we have left... */
-    bit_overflow = bits_left - data_bit_len;
-    if (bit_overflow >= 0) {
-        /* We can fit the new data in our current byte.
-         * As we write from MSB->LSB we need to left shift by the overflow amount. */
-        bit_data = data << bit_overflow;
-        if (*bit_pos)
-            **buffer |= bit_data;
-        else
-            **buffer = bit_data;
-        /* If our data fits exactly into the current byte, we need to increment our pointer. */
-        if (0 == bit_overflow) {
-            /* Do not increment size as it will be incremented on next call as bit_pos is zero. */
-            *buffer += 1;
-            *bit_pos = 0;
-        } else {
-            *bit_pos += data_bit_len;
-        }
-    } else {
-        /* bit_overflow is negative, there for we will need a new byte from our buffer
-         * Firstly fill up what's left in the current byte. */
-        bit_data = data >> -bit_overflow;
-        **buffer |= bit_data;
-        /* Increment our buffer pointer and size counter. */
-        *buffer += 1;
-        *size += 1;
-        **buffer = data << (8 + bit_overflow);
-        *bit_pos = -bit_overflow;
+    w->n_bits -= 32;
+    word = htonl((uint32_t) (w->bits >> w->n_bits));
+    memcpy(w->buffer, &word, sizeof(word));
+    w->buffer += sizeof(word);
+}
+
+/* Writes out the pending bits, padded with zeros to a full byte */
+static inline void bit_writer_flush(bit_writer *w) {
+    while (w->n_bits >= 8) {
+        w->n_bits -= 8;
+        *(w->buffer++) = (uint8_t) (w->bits >> w->n_bits);
+    }
+
+    if (w->n_bits > 0) {
+        *(w->buffer++) = (uint8_t) (w->bits << (8 - w->n_bits));
+        w->n_bits = 0;
     }
 }
 
+/* Size of the header of an uncompressed ALAC frame, in bits */
+#define ALAC_HEADER_BITS (3 + 4 + 8 + 4 + 1 + 2 + 1 + 32)
+
 static size_t write_ALAC_data(uint8_t *packet, const size_t max, uint8_t *raw, size_t *length, bool compress) {
     uint32_t nbs = (*length / 2) / 2;
-    uint8_t *ibp, *maxibp;
-    uint8_t *bp, bpos;
-    size_t size = 0;
+    bit_writer w;
+    uint32_t i;
 
-    bp = packet;
-    pa_memzero(packet, max);
-    size = bpos = 0;
-
-    bit_writer(&bp, &bpos, &size, 1, 3); /* channel=1, stereo */
-    bit_writer(&bp, &bpos, &size, 0, 4); /* Unknown */
-    bit_writer(&bp, &bpos, &size, 0, 8); /* Unknown */
-    bit_writer(&bp, &bpos, &size, 0, 4); /* Unknown */
-    bit_writer(&bp, &bpos, &size, 1, 1); /* Hassize */
-    bit_writer(&bp, &bpos, &size, 0, 2); /* Unused */
-    bit_writer(&bp, &bpos, &size, 1, 1); /* Is-not-compressed */
+    /* Never write more than fits into the packet */
+    if (8 * max < ALAC_HEADER_BITS)
+        nbs = 0;
+    else
+        nbs = PA_MIN(nbs, (uint32_t) ((8 * max - ALAC_HEADER_BITS) / 32));
+
+    w.buffer = packet;
+    w.bits = 0;
+    w.n_bits = 0;
+
+    bit_writer_put(&w, 1, 3); /* channel=1, stereo */
+    bit_writer_put(&w, 0, 4); /* Unknown */
+    bit_writer_put(&w, 0, 8); /* Unknown */
+    bit_writer_put(&w, 0, 4); /* Unknown */
+    bit_writer_put(&w, 1, 1); /* Hassize */
+    bit_writer_put(&w, 0, 2); /* Unused */
+    bit_writer_put(&w, 1, 1); /* Is-not-compressed */
     /* Size of data, integer, big endian. */
-    bit_writer(&bp, &bpos, &size, (nbs >> 24) & 0xff, 8);
-    bit_writer(&bp, &bpos, &size, (nbs >> 16) & 0xff, 8);
-    bit_writer(&bp, &bpos, &size, (nbs >> 8)  & 0xff, 8);
-    bit_writer(&bp, &bpos, &size, (nbs)       & 0xff, 8);
-
-    ibp = raw;
-    maxibp = raw + (4 * nbs) - 4;
-    while (ibp <= maxibp) {
-        /* Byte swap stereo data. */
-        bit_writer(&bp, &bpos, &size, *(ibp + 1), 8);
-        bit_writer(&bp, &bpos, &size, *(ibp + 0), 8);
-        bit_writer(&bp, &bpos, &size, *(ibp + 3), 8);
-        bit_writer(&bp, &bpos, &size, *(ibp + 2), 8);
-        ibp += 4;
+    bit_writer_put(&w, nbs, 32);
+
+    for (i = 0; i < nbs; i++) {
+        uint32_t frame;
+
+        /* Little endian stereo frame to two big endian samples, left first */
+        memcpy(&frame, raw + 4 * i, sizeof(frame));
+        frame = PA_UINT32_FROM_LE(frame);
+        bit_writer_put(&w, (frame << 16) | (frame >> 16), 32);
     }
 
-    *length = (ibp - raw);
-    return size;
+    bit_writer_flush(&w);
+
+    *length = 4 * nbs;
+    return w.buffer - packet;
 }
 
 static size_t build_tcp_audio_packet(pa_raop_client *c, pa_memchunk *block, pa_memchunk *packet) {
@@ -500,14 +510,83 @@ static size_t rebuild_udp_audio_packet(pa_raop_client *c, uint16_t seq, pa_memch
     return size;
 }
 
+/* Sends n packets on the connected socket fd, skipping packets the
+ * socket has no room for. Returns the number of bytes sent. */
+static ssize_t send_udp_packets(int fd, pa_memchunk **packets, uint16_t *seqs, unsigned n) {
+    ssize_t total = 0;
+    unsigned i;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr mm[RESEND_BATCH];
+    struct iovec iov[RESEND_BATCH];
+    unsigned sent = 0;
+
+    pa_assert(n <= RESEND_BATCH);
+
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = (uint8_t *) pa_memblock_acquire(packets[i]->memblock) + packets[i]->index;
+        iov[i].iov_len = packets[i]->length;
+
+        pa_zero(mm[i]);
+        mm[i].msg_hdr.msg_iov = &iov[i];
+        mm[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (sent < n) {
+        int r;
+
+        if ((r = sendmmsg(fd, mm + sent, n - sent, MSG_DONTWAIT)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN) {
+                pa_log("sendmmsg() failed: %s", pa_cstrerror(errno));
+                break;
+            }
+
+            pa_log_debug("Discarding UDP (audio-retransmitted, seq=%d) packet due to EAGAIN", seqs[sent]);
+            sent++;
+            continue;
+        }
+
+        for (i = sent; i < sent + (unsigned) r; i++)
+            total += mm[i].msg_len;
+
+        sent += (unsigned) r;
+    }
+
+    for (i = 0; i < n; i++)
+        pa_memblock_release(packets[i]->memblock);
+#else
+    for (i = 0; i < n; i++) {
+        uint8_t *buffer;
+        ssize_t written;
+
+        buffer = pa_memblock_acquire(packets[i]->memblock);
+        written = pa_write(fd, buffer + packets[i]->index, packets[i]->length, NULL);
+        pa_memblock_release(packets[i]->memblock);
+
+        if (written < 0) {
+            if (errno == EAGAIN)
+                pa_log_debug("Discarding UDP (audio-retransmitted, seq=%d) packet due to EAGAIN", seqs[i]);
+            continue;
+        }
+
+        total += written;
+    }
+#endif
+
+    return total;
+}
+
 static ssize_t resend_udp_audio_packets(pa_raop_client *c, uint16_t seq, uint16_t nbp) {
+    pa_memchunk *packets[RESEND_BATCH];
+    uint16_t seqs[RESEND_BATCH];
     ssize_t total = 0;
+    unsigned n = 0;
     int i = 0;
 
     for (i = 0; i < nbp; i++) {
         pa_memchunk *packet = NULL;
-        uint8_t *buffer = NULL;
-        ssize_t written = -1;
 
         if (!(packet = pa_raop_packet_buffer_retrieve(c->pbuf, seq + i)))
             continue;
@@ -519,22 +598,22 @@ static ssize_t resend_udp_audio_packets(pa_raop_client *c, uint16_t seq, uint16_
 
         pa_assert(packet->index == 0);
 
-        buffer = pa_memblock_acquire(packet->memblock);
+        if (packet->length <= 0)
+            continue;
 
-        pa_assert(buffer);
+        packets[n] = packet;
+        seqs[n] = seq + i;
+        c->resent++;
 
-        if (buffer && packet->length > 0)
-            written = pa_write(c->udp_cfd, buffer, packet->length, NULL);
-        if (written < 0 && errno == EAGAIN) {
-            pa_log_debug("Discarding UDP (audio-retransmitted, seq=%d) packet due to EAGAIN", seq + i);
-            pa_memblock_release(packet->memblock);
-            continue;
+        if (++n >= RESEND_BATCH) {
+            total += send_udp_packets(c->udp_cfd, packets, seqs, n);
+            n = 0;
         }
-
-        pa_memblock_release(packet->memblock);
-        total +=  written;
     }
 
+    if (n > 0)
+        total += send_udp_packets(c->udp_cfd, packets, seqs, n);
+
     return total;
 }
 
@@ -599,6 +678,7 @@ static size_t handle_udp_control_packet(pa_raop_client *c, const uint8_t packet[
     switch (payload) {
         case PAYLOAD_RETRANSMIT_REQUEST:
             pa_log_debug("Resending %u packets starting at %u", nbp, seq);
+            c->resend_requested += nbp;
             written = resend_udp_audio_packets(c, seq, nbp);
             break;
         case PAYLOAD_RETRANSMIT_REPLY:
@@ -1658,6 +1738,16 @@ int pa_raop_client_teardown(pa_raop_client *c) {
     return rv;
 }
 
+/* Called from IO context, like the retransmissions themselves */
+void pa_raop_client_get_resend_stats(pa_raop_client *c, uint64_t *requested, uint64_t *resent) {
+    pa_assert(c);
+    pa_assert(requested);
+    pa_assert(resent);
+
+    *requested = c->resend_requested;
+    *resent = c->resent;
+}
+
 void pa_raop_client_get_frames_per_block(pa_raop_client *c, size_t *frames) {
     pa_assert(c);
     pa_assert(frames);
@@ -72,6 +72,7 @@ int pa_raop_client_flush(pa_raop_client *c);
 int pa_raop_client_teardown(pa_raop_client *c);
 
 void pa_raop_client_get_frames_per_block(pa_raop_client *c, size_t *size);
+void pa_raop_client_get_resend_stats(pa_raop_client *c, uint64_t *requested, uint64_t *resent);
 bool pa_raop_client_register_pollfd(pa_raop_client *c, pa_rtpoll *poll, pa_rtpoll_item **poll_item);
 pa_volume_t pa_raop_client_adjust_volume(pa_raop_client *c, pa_volume_t volume);
 void pa_raop_client_handle_oob_packet(pa_raop_client *c, const int fd, const uint8_t packet[], ssize_t size);
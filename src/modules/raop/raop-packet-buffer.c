@@ -31,19 +31,23 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
 #include <pulsecore/macro.h>
 
 #include "raop-packet-buffer.h"
 
+/* Packets are stored at their sequence number modulo the (power of two)
+ * size. Memory blocks stay allocated and are reused for later packets,
+ * so there is no allocation per packet once the ring went round once. */
 struct pa_raop_packet_buffer {
     pa_memchunk *packets;
     pa_mempool *mempool;
 
     size_t size;
+    size_t mask;
     size_t count;
 
     uint16_t seq;
-    size_t pos;
 };
 
 pa_raop_packet_buffer *pa_raop_packet_buffer_new(pa_mempool *mempool, const size_t size) {
@@ -53,10 +57,12 @@ pa_raop_packet_buffer *pa_raop_packet_buffer_new(pa_mempool *mempool, const size
     pa_assert(size > 0);
 
     pb->count = 0;
-    pb->size = size;
+    /* Sequence numbers are 16 bit, there cannot be more packets than that */
+    pb->size = pa_make_power_of_two((unsigned) PA_MIN(size, (size_t) UINT16_MAX + 1));
+    pb->mask = pb->size - 1;
     pb->mempool = mempool;
-    pb->packets = pa_xnew0(pa_memchunk, size);
-    pb->seq = pb->pos = 0;
+    pb->packets = pa_xnew0(pa_memchunk, pb->size);
+    pb->seq = 0;
 
     return pb;
 }
@@ -83,79 +89,67 @@ void pa_raop_packet_buffer_reset(pa_raop_packet_buffer *pb, uint16_t seq) {
     pa_assert(pb);
     pa_assert(pb->packets);
 
-    pb->pos = 0;
     pb->count = 0;
-    pb->seq = (!seq) ? UINT16_MAX : seq - 1;
+    pb->seq = seq - 1;
+
+    /* Keep the memory blocks around for reuse */
     for (i = 0; i < pb->size; i++) {
-        if (pb->packets[i].memblock)
-            pa_memblock_unref(pb->packets[i].memblock);
-        pa_memchunk_reset(&pb->packets[i]);
+        pb->packets[i].index = 0;
+        pb->packets[i].length = 0;
     }
 }
 
 pa_memchunk *pa_raop_packet_buffer_prepare(pa_raop_packet_buffer *pb, uint16_t seq, const size_t size) {
     pa_memchunk *packet = NULL;
-    size_t i;
 
     pa_assert(pb);
     pa_assert(pb->packets);
 
-    if (seq == 0) {
-        /* 0 means seq reached UINT16_MAX and has been wrapped... */
-        pa_assert(pb->seq == UINT16_MAX);
-        pb->seq = 0;
-    } else {
-        /* ...otherwise, seq MUST have be increased! */
-        pa_assert(seq == pb->seq + 1);
-        pb->seq++;
-    }
+    /* seq MUST have be increased, 0 means it wrapped */
+    pa_assert(seq == (uint16_t) (pb->seq + 1));
+    pb->seq = seq;
 
-    i = (pb->pos + 1) % pb->size;
+    packet = &pb->packets[seq & pb->mask];
 
-    if (pb->packets[i].memblock)
-        pa_memblock_unref(pb->packets[i].memblock);
-    pa_memchunk_reset(&pb->packets[i]);
+    /* Nobody else may see a block we write to again */
+    if (packet->memblock &&
+        (!pa_memblock_ref_is_one(packet->memblock) || pa_memblock_get_length(packet->memblock) < size)) {
+        pa_memblock_unref(packet->memblock);
+        packet->memblock = NULL;
+    }
 
-    pb->packets[i].memblock = pa_memblock_new(pb->mempool, size);
-    pb->packets[i].length = size;
-    pb->packets[i].index = 0;
+    if (!packet->memblock)
+        packet->memblock = pa_memblock_new(pb->mempool, size);
 
-    packet = &pb->packets[i];
+    packet->length = size;
+    packet->index = 0;
 
     if (pb->count < pb->size)
         pb->count++;
-    pb->pos = i;
 
     return packet;
 }
 
 pa_memchunk *pa_raop_packet_buffer_retrieve(pa_raop_packet_buffer *pb, uint16_t seq) {
     pa_memchunk *packet = NULL;
-    size_t delta, i;
+    uint16_t delta;
 
     pa_assert(pb);
     pa_assert(pb->packets);
 
+    packet = &pb->packets[seq & pb->mask];
+
+    /* The newest slot is always handed out, even if nothing was prepared
+     * since the last reset */
     if (seq == pb->seq)
-        packet = &pb->packets[pb->pos];
-    else {
-        if (seq < pb->seq) {
-            /* Regular case: pb->seq did not wrapped since seq. */
-            delta = pb->seq - seq;
-        } else {
-            /* Tricky case: pb->seq wrapped since seq! */
-            delta = pb->seq + (UINT16_MAX - seq);
-        }
-
-        /* If the requested packet is too old, do nothing and return */
-        if (delta > pb->count)
-            return NULL;
-
-        i = (pb->size + pb->pos - delta) % pb->size;
-
-        if (delta < pb->size && pb->packets[i].memblock)
-            packet = &pb->packets[i];
-    }
+        return packet;
+
+    /* Modulo 2^16, so this is right when pb->seq wrapped since seq, too */
+    delta = (uint16_t) (pb->seq - seq);
+
+    /* If the requested packet is too old, do nothing and return */
+    if (delta >= pb->count || !packet->memblock)
+        return NULL;
 
     return packet;
 }
@@ -65,6 +65,9 @@
 #include "raop-client.h"
 #include "raop-util.h"
 
+/* How often the retransmission properties are updated at most */
+#define RESEND_STATS_INTERVAL_USEC (5*PA_USEC_PER_SEC)
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -91,10 +94,25 @@ struct userdata {
     uint64_t write_count;
 
     uint32_t latency;
+
+    /* What the IO thread last told the main thread */
+    struct {
+        pa_usec_t time;
+        uint64_t requested;
+        uint64_t resent;
+        bool idle;
+    } resend_stats;
+};
+
+struct resend_stats {
+    uint64_t requested;
+    uint64_t resent;
+    double rate;
 };
 
 enum {
-    PA_SINK_MESSAGE_SET_RAOP_STATE = PA_SINK_MESSAGE_MAX
+    PA_SINK_MESSAGE_SET_RAOP_STATE = PA_SINK_MESSAGE_MAX,
+    SINK_MESSAGE_UPDATE_RESEND_STATS
 };
 
 static void userdata_free(struct userdata *u);
@@ -129,6 +147,41 @@ static int64_t sink_get_latency(const struct userdata *u) {
     return latency;
 }
 
+/* Called from IO context. Hands the retransmission counters to the
+ * main thread, at most once per RESEND_STATS_INTERVAL_USEC. */
+static void report_resend_stats(struct userdata *u) {
+    struct resend_stats *stats;
+    uint64_t requested, resent;
+    pa_usec_t now;
+
+    pa_assert(u);
+
+    now = pa_rtclock_now();
+    if (u->resend_stats.time > 0 && now < u->resend_stats.time + RESEND_STATS_INTERVAL_USEC)
+        return;
+
+    pa_raop_client_get_resend_stats(u->raop, &requested, &resent);
+
+    /* Once the rate went back to zero there is nothing new to tell */
+    if (requested == u->resend_stats.requested && u->resend_stats.idle)
+        return;
+
+    stats = pa_xnew(struct resend_stats, 1);
+    stats->requested = requested;
+    stats->resent = resent;
+    stats->rate = 0;
+
+    if (u->resend_stats.time > 0)
+        stats->rate = (double) (resent - u->resend_stats.resent) * PA_USEC_PER_SEC / (double) (now - u->resend_stats.time);
+
+    u->resend_stats.idle = requested == u->resend_stats.requested;
+    u->resend_stats.time = now;
+    u->resend_stats.requested = requested;
+    u->resend_stats.resent = resent;
+
+    pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_RESEND_STATS, stats, 0, NULL, pa_xfree);
+}
+
 static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SINK(o)->userdata;
 
@@ -136,6 +189,22 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
     pa_assert(u->raop);
 
     switch (code) {
+        case SINK_MESSAGE_UPDATE_RESEND_STATS: {
+            struct resend_stats *stats = data;
+            pa_proplist *pl;
+
+            /* This one is delivered from the IO thread to the main
+             * context, unlike the other messages */
+            pl = pa_proplist_new();
+            pa_proplist_setf(pl, "raop.resend.requested", "%llu", (unsigned long long) stats->requested);
+            pa_proplist_setf(pl, "raop.resend.sent", "%llu", (unsigned long long) stats->resent);
+            pa_proplist_setf(pl, "raop.resend.rate", "%0.1f", stats->rate);
+            pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, pl);
+            pa_proplist_free(pl);
+
+            return 0;
+        }
+
         case PA_SINK_MESSAGE_SET_STATE: {
             switch ((pa_sink_state_t) PA_PTR_TO_UINT(data)) {
                 case PA_SINK_SUSPENDED: {
@@ -388,6 +457,8 @@ static void thread_func(void *userdata) {
                     pollfd++;
                 }
 
+                report_resend_stats(u);
+
                 continue;
             }
         }
@@ -0,0 +1,537 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sconv.h>
+
+#include "jitter-buffer.h"
+
+/* Sequence number jumps that are taken as a restart of the sender instead
+ * of lost or late packets, see RFC 3550, appendix A.1 */
+#define MAX_DROPOUT 3000
+#define MAX_MISORDER 100
+
+/* A missing packet is waited for this many times the interarrival
+ * jitter, but at least MIN_DELAY */
+#define JITTER_FACTOR 4
+#define MIN_DELAY (5*PA_USEC_PER_MSEC)
+
+/* Give up waiting once this many packets are queued behind a gap */
+#define MAX_QUEUED 64
+
+/* Pitch periods the concealment searches for, 50 Hz to 400 Hz */
+#define PLC_MIN_PITCH (2500)
+#define PLC_MAX_PITCH (20*PA_USEC_PER_MSEC)
+/* Length of the audio the candidate periods are compared on */
+#define PLC_MATCH (5*PA_USEC_PER_MSEC)
+/* Concealed audio is played at full volume for PLC_FADE_START, then faded
+ * out until PLC_FADE_END, after which a gap is filled with silence */
+#define PLC_FADE_START (10*PA_USEC_PER_MSEC)
+#define PLC_FADE_END (60*PA_USEC_PER_MSEC)
+/* The audio after a concealed gap is cross-faded in for this long */
+#define PLC_MERGE (5*PA_USEC_PER_MSEC)
+
+struct packet {
+    PA_LLIST_FIELDS(struct packet);
+
+    uint16_t seq;
+    uint32_t timestamp;
+    pa_usec_t arrival;
+    pa_memchunk chunk;
+};
+
+struct pa_jitter_buffer {
+    pa_sample_spec sample_spec;
+    size_t frame_size;
+    pa_mempool *pool;
+    pa_usec_t max_delay;
+
+    /* Sorted by sequence number */
+    PA_LLIST_HEAD(struct packet, packets);
+    struct packet *last_packet;
+    unsigned n_packets;
+    size_t length;
+
+    bool synced;
+    uint16_t next_seq;
+    uint32_t next_timestamp;
+    uint16_t highest_seq;
+
+    /* Interarrival jitter in usec, as in RFC 3550, section 6.4.1 */
+    double jitter;
+    bool have_last;
+    pa_usec_t last_arrival;
+    uint32_t last_timestamp;
+
+    pa_convert_func_t to_float, from_float;
+
+    /* The audio written last, as float */
+    float *history;
+    unsigned history_frames;
+
+    float *work;
+    unsigned work_frames;
+    float *merge;
+
+    /* Frames concealed since the last real audio */
+    unsigned concealed_frames;
+    unsigned pitch;
+
+    unsigned min_pitch, max_pitch, match_frames;
+    unsigned fade_start, fade_end, merge_frames;
+
+    pa_jitter_buffer_stats stats;
+};
+
+static unsigned usec_to_frames(pa_jitter_buffer *jb, pa_usec_t usec) {
+    return PA_MAX((unsigned) (pa_usec_to_bytes(usec, &jb->sample_spec) / jb->frame_size), 1U);
+}
+
+pa_jitter_buffer* pa_jitter_buffer_new(const pa_sample_spec *ss, pa_mempool *pool, pa_usec_t max_delay) {
+    pa_jitter_buffer *jb;
+
+    pa_assert(ss);
+    pa_assert(pa_sample_spec_valid(ss));
+    pa_assert(pool);
+
+    jb = pa_xnew0(pa_jitter_buffer, 1);
+    jb->sample_spec = *ss;
+    jb->frame_size = pa_frame_size(ss);
+    jb->pool = pool;
+    jb->max_delay = PA_MAX(max_delay, MIN_DELAY);
+
+    PA_LLIST_HEAD_INIT(struct packet, jb->packets);
+
+    pa_assert_se(jb->to_float = pa_get_convert_to_float32ne_function(ss->format));
+    pa_assert_se(jb->from_float = pa_get_convert_from_float32ne_function(ss->format));
+
+    jb->min_pitch = usec_to_frames(jb, PLC_MIN_PITCH);
+    jb->max_pitch = usec_to_frames(jb, PLC_MAX_PITCH);
+    jb->match_frames = usec_to_frames(jb, PLC_MATCH);
+    jb->fade_start = usec_to_frames(jb, PLC_FADE_START);
+    jb->fade_end = usec_to_frames(jb, PLC_FADE_END);
+    jb->merge_frames = usec_to_frames(jb, PLC_MERGE);
+
+    jb->history = pa_xnew(float, (jb->max_pitch + jb->match_frames) * ss->channels);
+    jb->merge = pa_xnew(float, jb->merge_frames * ss->channels);
+
+    return jb;
+}
+
+void pa_jitter_buffer_free(pa_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    pa_jitter_buffer_reset(jb);
+
+    pa_xfree(jb->history);
+    pa_xfree(jb->work);
+    pa_xfree(jb->merge);
+    pa_xfree(jb);
+}
+
+static void free_packet(struct packet *p) {
+    pa_memblock_unref(p->chunk.memblock);
+    pa_xfree(p);
+}
+
+/* Removes the first packet from the queue and returns it */
+static struct packet *dequeue(pa_jitter_buffer *jb) {
+    struct packet *p;
+
+    pa_assert_se(p = jb->packets);
+
+    if (p == jb->last_packet)
+        jb->last_packet = NULL;
+
+    PA_LLIST_REMOVE(struct packet, jb->packets, p);
+    jb->n_packets--;
+    jb->length -= p->chunk.length;
+
+    return p;
+}
+
+void pa_jitter_buffer_reset(pa_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    while (jb->packets)
+        free_packet(dequeue(jb));
+
+    jb->synced = false;
+    jb->have_last = false;
+    jb->history_frames = 0;
+    jb->concealed_frames = 0;
+}
+
+static pa_usec_t get_target(pa_jitter_buffer *jb) {
+    return PA_CLAMP((pa_usec_t) (JITTER_FACTOR * jb->jitter), MIN_DELAY, jb->max_delay);
+}
+
+static void update_jitter(pa_jitter_buffer *jb, uint32_t timestamp, pa_usec_t now) {
+    if (jb->have_last) {
+        double d;
+
+        /* Difference of the transit times of this and the last packet */
+        d = (double) now - (double) jb->last_arrival
+            - (double) (int32_t) (timestamp - jb->last_timestamp) * PA_USEC_PER_SEC / jb->sample_spec.rate;
+
+        jb->jitter += (fabs(d) - jb->jitter) / 16;
+    }
+
+    jb->have_last = true;
+    jb->last_arrival = now;
+    jb->last_timestamp = timestamp;
+}
+
+void pa_jitter_buffer_push(pa_jitter_buffer *jb, uint16_t seq, uint32_t timestamp, pa_usec_t now, const pa_memchunk *chunk) {
+    struct packet *p, *after;
+    uint16_t udelta;
+
+    pa_assert(jb);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+    pa_assert(chunk->length % jb->frame_size == 0);
+
+    if (chunk->length <= 0)
+        return;
+
+    if (jb->synced) {
+        udelta = (uint16_t) (seq - jb->next_seq);
+
+        if (udelta >= MAX_DROPOUT) {
+            if (udelta <= 0x10000 - MAX_MISORDER) {
+                pa_log_debug("Sequence number jumped from %u to %u, resynchronizing.", jb->next_seq, seq);
+                pa_jitter_buffer_reset(jb);
+            } else {
+                /* The place of this packet has been concealed already,
+                 * so the wait was too short */
+                jb->stats.late++;
+                jb->jitter = PA_MIN(2 * jb->jitter + PA_USEC_PER_MSEC, (double) jb->max_delay / JITTER_FACTOR);
+                return;
+            }
+        }
+    }
+
+    if (!jb->synced) {
+        jb->synced = true;
+        jb->next_seq = jb->highest_seq = seq;
+        jb->next_timestamp = timestamp;
+    }
+
+    /* Find the place of the packet, usually at the end */
+    for (after = jb->last_packet; after; after = after->prev)
+        if ((int16_t) (seq - after->seq) >= 0)
+            break;
+
+    if (after && after->seq == seq)
+        return;
+
+    if ((int16_t) (seq - jb->highest_seq) < 0)
+        jb->stats.reordered++;
+    else {
+        update_jitter(jb, timestamp, now);
+        jb->highest_seq = seq;
+    }
+
+    p = pa_xnew(struct packet, 1);
+    p->seq = seq;
+    p->timestamp = timestamp;
+    p->arrival = now;
+    p->chunk = *chunk;
+    pa_memblock_ref(p->chunk.memblock);
+
+    PA_LLIST_INSERT_AFTER(struct packet, jb->packets, after, p);
+
+    if (!p->next)
+        jb->last_packet = p;
+
+    jb->n_packets++;
+    jb->length += chunk->length;
+}
+
+static void ensure_work(pa_jitter_buffer *jb, unsigned frames) {
+    if (jb->work_frames >= frames)
+        return;
+
+    jb->work_frames = frames;
+    pa_xfree(jb->work);
+    jb->work = pa_xnew(float, frames * jb->sample_spec.channels);
+}
+
+static void append_history(pa_jitter_buffer *jb, const float *src, unsigned n) {
+    unsigned channels = jb->sample_spec.channels;
+    unsigned max = jb->max_pitch + jb->match_frames;
+
+    if (n >= max) {
+        memcpy(jb->history, src + (n - max) * channels, max * channels * sizeof(float));
+        jb->history_frames = max;
+        return;
+    }
+
+    if (jb->history_frames + n > max) {
+        unsigned drop = jb->history_frames + n - max;
+
+        memmove(jb->history, jb->history + drop * channels, (jb->history_frames - drop) * channels * sizeof(float));
+        jb->history_frames -= drop;
+    }
+
+    memcpy(jb->history + jb->history_frames * channels, src, n * channels * sizeof(float));
+    jb->history_frames += n;
+}
+
+static bool history_full(pa_jitter_buffer *jb) {
+    return jb->history_frames >= jb->max_pitch + jb->match_frames;
+}
+
+/* Returns the period that makes the end of the history most similar to
+ * the audio one period before it */
+static unsigned find_pitch(pa_jitter_buffer *jb) {
+    unsigned channels = jb->sample_spec.channels;
+    const float *t = jb->history + (jb->history_frames - jb->match_frames) * channels;
+    unsigned n = jb->match_frames * channels;
+    unsigned p, best = jb->max_pitch;
+    double best_score = 0;
+
+    for (p = jb->min_pitch; p <= jb->max_pitch; p++) {
+        const float *c = t - p * channels;
+        double xy = 0, yy = 0, score;
+        unsigned i;
+
+        for (i = 0; i < n; i++) {
+            xy += (double) t[i] * c[i];
+            yy += (double) c[i] * c[i];
+        }
+
+        if (yy <= 0)
+            continue;
+
+        score = xy / sqrt(yy);
+
+        if (score > best_score) {
+            best_score = score;
+            best = p;
+        }
+    }
+
+    return best;
+}
+
+/* Continues the history by repeating its last pitch period */
+static void extrapolate(pa_jitter_buffer *jb, float *dst, unsigned n) {
+    unsigned channels = jb->sample_spec.channels;
+    const float *period = jb->history + (jb->history_frames - jb->pitch) * channels;
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        memcpy(dst + i * channels, period + (i % jb->pitch) * channels, channels * sizeof(float));
+}
+
+static void fade(pa_jitter_buffer *jb, float *dst, unsigned n) {
+    unsigned channels = jb->sample_spec.channels;
+    unsigned i, c;
+
+    for (i = 0; i < n; i++) {
+        unsigned pos = jb->concealed_frames + i;
+        float gain;
+
+        if (pos < jb->fade_start)
+            continue;
+
+        if (pos >= jb->fade_end)
+            gain = 0;
+        else
+            gain = 1.0f - (float) (pos - jb->fade_start) / (float) (jb->fade_end - jb->fade_start);
+
+        for (c = 0; c < channels; c++)
+            dst[i * channels + c] *= gain;
+    }
+}
+
+static void push_to_queue(pa_memblockq *q, const pa_memchunk *chunk) {
+    if (pa_memblockq_push(q, chunk) < 0) {
+        pa_log_warn("Queue overrun");
+        pa_memblockq_seek(q, (int64_t) chunk->length, PA_SEEK_RELATIVE, true);
+    }
+}
+
+/* Fills n missing frames */
+static void conceal(pa_jitter_buffer *jb, pa_memblockq *q, unsigned n) {
+    unsigned k = 0;
+
+    if (history_full(jb) && jb->concealed_frames < jb->fade_end) {
+        pa_memchunk chunk;
+        void *d;
+
+        if (jb->concealed_frames == 0)
+            jb->pitch = find_pitch(jb);
+
+        k = PA_MIN(n, jb->fade_end - jb->concealed_frames);
+
+        ensure_work(jb, k);
+        extrapolate(jb, jb->work, k);
+
+        /* The history is continued without the fade, so that the next
+         * gap of the same loss continues the same waveform */
+        append_history(jb, jb->work, k);
+        fade(jb, jb->work, k);
+
+        chunk.memblock = pa_memblock_new(jb->pool, k * jb->frame_size);
+        chunk.index = 0;
+        chunk.length = k * jb->frame_size;
+
+        d = pa_memblock_acquire(chunk.memblock);
+        jb->from_float(k * jb->sample_spec.channels, jb->work, d);
+        pa_memblock_release(chunk.memblock);
+
+        push_to_queue(q, &chunk);
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    /* Past the fade out, or without enough audio to repeat, leave a hole,
+     * which plays back as silence */
+    if (n > k)
+        pa_memblockq_seek(q, (int64_t) (n - k) * (int64_t) jb->frame_size, PA_SEEK_RELATIVE, true);
+
+    jb->concealed_frames = PA_MIN(jb->concealed_frames + n, jb->fade_end);
+}
+
+/* Writes received audio, cross-fading it with the concealment if it
+ * follows a gap */
+static void write_audio(pa_jitter_buffer *jb, pa_memblockq *q, const pa_memchunk *chunk) {
+    unsigned channels = jb->sample_spec.channels;
+    unsigned n = (unsigned) (chunk->length / jb->frame_size);
+    pa_memchunk merged;
+    const void *s;
+
+    ensure_work(jb, n);
+
+    s = pa_memblock_acquire_chunk(chunk);
+    jb->to_float(n * channels, s, jb->work);
+    pa_memblock_release(chunk->memblock);
+
+    if (jb->concealed_frames <= 0) {
+        push_to_queue(q, chunk);
+        append_history(jb, jb->work, n);
+        return;
+    }
+
+    {
+        unsigned m = PA_MIN(jb->merge_frames, n), i, c;
+        void *d;
+
+        if (history_full(jb)) {
+            extrapolate(jb, jb->merge, m);
+            fade(jb, jb->merge, m);
+        } else
+            memset(jb->merge, 0, m * channels * sizeof(float));
+
+        for (i = 0; i < m; i++) {
+            float w = (float) (i + 1) / (float) (m + 1);
+
+            for (c = 0; c < channels; c++)
+                jb->work[i * channels + c] = jb->merge[i * channels + c] * (1.0f - w) + jb->work[i * channels + c] * w;
+        }
+
+        merged.memblock = pa_memblock_new(jb->pool, chunk->length);
+        merged.index = 0;
+        merged.length = chunk->length;
+
+        d = pa_memblock_acquire(merged.memblock);
+        s = pa_memblock_acquire_chunk(chunk);
+        memcpy(d, s, chunk->length);
+        jb->from_float(m * channels, jb->work, d);
+        pa_memblock_release(chunk->memblock);
+        pa_memblock_release(merged.memblock);
+    }
+
+    push_to_queue(q, &merged);
+    pa_memblock_unref(merged.memblock);
+
+    append_history(jb, jb->work, n);
+    jb->concealed_frames = 0;
+}
+
+static void write_packet(pa_jitter_buffer *jb, pa_memblockq *q, struct packet *p) {
+    pa_memchunk chunk = p->chunk;
+    int32_t delta;
+
+    delta = (int32_t) (p->timestamp - jb->next_timestamp);
+
+    if (delta < 0) {
+        /* Overlaps with what was written already */
+        size_t overlap = (size_t) -(int64_t) delta * jb->frame_size;
+
+        if (overlap >= chunk.length)
+            return;
+
+        chunk.index += overlap;
+        chunk.length -= overlap;
+    } else if (delta > 0)
+        conceal(jb, q, (unsigned) delta);
+
+    jb->next_timestamp = p->timestamp + (uint32_t) (p->chunk.length / jb->frame_size);
+
+    write_audio(jb, q, &chunk);
+}
+
+void pa_jitter_buffer_release(pa_jitter_buffer *jb, pa_usec_t now, pa_memblockq *q, bool force) {
+    pa_assert(jb);
+    pa_assert(q);
+
+    while (jb->packets) {
+        struct packet *p = jb->packets;
+
+        if (p->seq != jb->next_seq) {
+            if (!force && jb->n_packets < MAX_QUEUED && now < p->arrival + get_target(jb))
+                break;
+
+            jb->stats.lost += (uint16_t) (p->seq - jb->next_seq);
+        }
+
+        dequeue(jb);
+        jb->next_seq = (uint16_t) (p->seq + 1);
+
+        write_packet(jb, q, p);
+        free_packet(p);
+    }
+}
+
+size_t pa_jitter_buffer_get_length(pa_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    return jb->length;
+}
+
+void pa_jitter_buffer_get_stats(pa_jitter_buffer *jb, pa_jitter_buffer_stats *stats) {
+    pa_assert(jb);
+    pa_assert(stats);
+
+    *stats = jb->stats;
+    stats->depth = pa_bytes_to_usec(jb->length, &jb->sample_spec);
+    stats->target = get_target(jb);
+}
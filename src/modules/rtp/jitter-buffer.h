@@ -0,0 +1,74 @@
+#ifndef foortpjitterbufferhfoo
+#define foortpjitterbufferhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/memchunk.h>
+
+/* Reorders received RTP packets by sequence number before they are
+ * written to the playback queue. When a packet is missing, the packets
+ * behind it are held back for a while, adapted to the jitter of the
+ * stream, in case it arrives late. Once the wait is over, the gap is
+ * filled by repeating the last pitch period of the audio before it.
+ *
+ * Not thread safe, all functions are to be called from one thread. */
+
+typedef struct pa_jitter_buffer pa_jitter_buffer;
+
+typedef struct pa_jitter_buffer_stats {
+    /* Packets that arrived after the gap they belong to was concealed */
+    uint64_t late;
+    /* Packets that never arrived in time and were concealed */
+    uint64_t lost;
+    /* Packets that arrived out of order, but in time */
+    uint64_t reordered;
+    /* Audio held back in the jitter buffer */
+    pa_usec_t depth;
+    /* How long a missing packet is currently waited for */
+    pa_usec_t target;
+} pa_jitter_buffer_stats;
+
+/* max_delay is the longest time a missing packet is ever waited for */
+pa_jitter_buffer* pa_jitter_buffer_new(const pa_sample_spec *ss, pa_mempool *pool, pa_usec_t max_delay);
+void pa_jitter_buffer_free(pa_jitter_buffer *jb);
+
+/* Drops all queued packets and starts over with the next packet pushed,
+ * to be used when the stream was interrupted or the sender changed */
+void pa_jitter_buffer_reset(pa_jitter_buffer *jb);
+
+/* Queues one packet that arrived at the given time. Takes a reference
+ * to the chunk. */
+void pa_jitter_buffer_push(pa_jitter_buffer *jb, uint16_t seq, uint32_t timestamp, pa_usec_t now, const pa_memchunk *chunk);
+
+/* Writes all packets that are due to q, in order, concealing the packets
+ * that were waited for long enough. With force, the wait is given up
+ * right away, to be used when q is about to run dry. */
+void pa_jitter_buffer_release(pa_jitter_buffer *jb, pa_usec_t now, pa_memblockq *q, bool force);
+
+/* Returns the number of bytes held back */
+size_t pa_jitter_buffer_get_length(pa_jitter_buffer *jb);
+
+void pa_jitter_buffer_get_stats(pa_jitter_buffer *jb, pa_jitter_buffer_stats *stats);
+
+#endif
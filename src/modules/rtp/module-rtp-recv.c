@@ -55,6 +55,7 @@
 
 #include "module-rtp-recv-symdef.h"
 
+#include "jitter-buffer.h"
 #include "rtp.h"
 #include "sdp.h"
 #include "sap.h"
@@ -76,6 +77,7 @@ PA_MODULE_USAGE(
 #define MAX_SESSIONS 16
 #define DEATH_TIMEOUT 20
 #define RATE_UPDATE_INTERVAL (5*PA_USEC_PER_SEC)
+#define STATS_UPDATE_INTERVAL (2*PA_USEC_PER_SEC)
 
 static const char* const valid_modargs[] = {
     "sink",
@@ -90,10 +92,10 @@ struct session {
 
     pa_sink_input *sink_input;
     pa_memblockq *memblockq;
+    pa_jitter_buffer *jitter_buffer;
 
     bool first_packet;
     uint32_t ssrc;
-    uint32_t offset;
 
     struct pa_sdp_info sdp_info;
 
@@ -103,6 +105,14 @@ struct session {
 
     pa_atomic_t timestamp;
 
+    /* Jitter buffer statistics, written from the I/O thread and shown
+     * in the sink input properties by the main thread */
+    pa_atomic_t stats_late;
+    pa_atomic_t stats_lost;
+    pa_atomic_t stats_reordered;
+    pa_atomic_t stats_depth;
+    pa_atomic_t stats_target;
+
     pa_usec_t intended_latency;
     pa_usec_t sink_latency;
 
@@ -121,6 +131,7 @@ struct userdata {
     pa_io_event* sap_event;
 
     pa_time_event *check_death_event;
+    pa_time_event *stats_event;
 
     char *sink_name;
 
@@ -139,7 +150,9 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *data, int64_t
 
     switch (code) {
         case PA_SINK_INPUT_MESSAGE_GET_LATENCY:
-            *((pa_usec_t*) data) = pa_bytes_to_usec(pa_memblockq_get_length(s->memblockq), &s->sink_input->sample_spec);
+            *((pa_usec_t*) data) = pa_bytes_to_usec(pa_memblockq_get_length(s->memblockq) +
+                                                    pa_jitter_buffer_get_length(s->jitter_buffer),
+                                                    &s->sink_input->sample_spec);
 
             /* Fall through, the default handler will add in the extra
              * latency added by the resampler */
@@ -155,6 +168,11 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
     pa_sink_input_assert_ref(i);
     pa_assert_se(s = i->userdata);
 
+    /* Stop waiting for missing packets once their time is up, or right
+     * away if the queue would run dry otherwise */
+    pa_jitter_buffer_release(s->jitter_buffer, pa_rtclock_now(), s->memblockq,
+                             pa_memblockq_is_readable(s->memblockq) && pa_memblockq_get_length(s->memblockq) < length);
+
     if (pa_memblockq_peek(s->memblockq, chunk) < 0)
         return -1;
 
@@ -202,84 +220,102 @@ static void sink_input_suspend_within_thread(pa_sink_input* i, bool b) {
         pa_memblockq_flush_read(s->memblockq);
     else
         s->first_packet = false;
+
+    pa_jitter_buffer_reset(s->jitter_buffer);
 }
 
 /* Called from I/O thread context */
-static int rtpoll_work_cb(pa_rtpoll_item *i) {
-    pa_memchunk chunk;
-    int64_t k, j, delta;
-    struct timeval now = { 0, 0 };
-    struct session *s;
-    struct pollfd *p;
+static void update_stats(struct session *s) {
+    pa_jitter_buffer_stats stats;
+    size_t length;
 
-    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
+    pa_jitter_buffer_get_stats(s->jitter_buffer, &stats);
 
-    p = pa_rtpoll_item_get_pollfd(i, NULL);
+    length = pa_memblockq_get_length(s->memblockq) + pa_jitter_buffer_get_length(s->jitter_buffer);
 
-    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
-        pa_log("poll() signalled bad revents.");
-        return -1;
-    }
-
-    if ((p->revents & POLLIN) == 0)
-        return 0;
-
-    p->revents = 0;
-
-    if (pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now) < 0)
-        return 0;
+    pa_atomic_store(&s->stats_late, (int) stats.late);
+    pa_atomic_store(&s->stats_lost, (int) stats.lost);
+    pa_atomic_store(&s->stats_reordered, (int) stats.reordered);
+    pa_atomic_store(&s->stats_depth, (int) pa_bytes_to_usec(length, &s->sink_input->sample_spec));
+    pa_atomic_store(&s->stats_target, (int) stats.target);
+}
 
+/* Called from I/O thread context. Queues one received packet, returns
+ * false if it doesn't belong to the session. */
+static bool process_packet(struct session *s, pa_memchunk *chunk, struct timeval *now) {
     if (s->sdp_info.payload != s->rtp_context.payload ||
         !PA_SINK_IS_OPENED(s->sink_input->sink->thread_info.state)) {
-        pa_memblock_unref(chunk.memblock);
-        return 0;
+        pa_memblock_unref(chunk->memblock);
+        return false;
     }
 
     if (!s->first_packet) {
         s->first_packet = true;
 
         s->ssrc = s->rtp_context.ssrc;
-        s->offset = s->rtp_context.timestamp;
+        pa_jitter_buffer_reset(s->jitter_buffer);
 
         if (s->ssrc == s->userdata->module->core->cookie)
             pa_log_warn("Detected RTP packet loop!");
     } else {
         if (s->ssrc != s->rtp_context.ssrc) {
-            pa_memblock_unref(chunk.memblock);
-            return 0;
+            pa_memblock_unref(chunk->memblock);
+            return false;
         }
     }
 
-    /* Check whether there was a timestamp overflow */
-    k = (int64_t) s->rtp_context.timestamp - (int64_t) s->offset;
-    j = (int64_t) 0x100000000LL - (int64_t) s->offset + (int64_t) s->rtp_context.timestamp;
-
-    if ((k < 0 ? -k : k) < (j < 0 ? -j : j))
-        delta = k;
-    else
-        delta = j;
-
-    pa_memblockq_seek(s->memblockq, delta * (int64_t) s->rtp_context.frame_size, PA_SEEK_RELATIVE, true);
-
-    if (now.tv_sec == 0) {
+    if (now->tv_sec == 0) {
         PA_ONCE_BEGIN {
             pa_log_warn("Using artificial time instead of timestamp");
         } PA_ONCE_END;
-        pa_rtclock_get(&now);
+        pa_rtclock_get(now);
     } else
-        pa_rtclock_from_wallclock(&now);
+        pa_rtclock_from_wallclock(now);
+
+    pa_jitter_buffer_push(s->jitter_buffer, s->rtp_context.sequence, s->rtp_context.timestamp, pa_timeval_load(now), chunk);
+    pa_memblock_unref(chunk->memblock);
 
-    if (pa_memblockq_push(s->memblockq, &chunk) < 0) {
-        pa_log_warn("Queue overrun");
-        pa_memblockq_seek(s->memblockq, (int64_t) chunk.length, PA_SEEK_RELATIVE, true);
+    pa_jitter_buffer_release(s->jitter_buffer, pa_timeval_load(now), s->memblockq, false);
+
+    return true;
+}
+
+/* Called from I/O thread context */
+static int rtpoll_work_cb(pa_rtpoll_item *i) {
+    pa_memchunk chunk;
+    struct timeval tstamp, now = { 0, 0 };
+    bool received = false;
+    struct session *s;
+    struct pollfd *p;
+
+    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
+
+    p = pa_rtpoll_item_get_pollfd(i, NULL);
+
+    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
+        pa_log("poll() signalled bad revents.");
+        return -1;
     }
 
-/*     pa_log("blocks in q: %u", pa_memblockq_get_nblocks(s->memblockq)); */
+    if ((p->revents & POLLIN) == 0)
+        return 0;
+
+    p->revents = 0;
 
-    pa_memblock_unref(chunk.memblock);
+    /* Take everything that is pending, so that a burst of packets costs
+     * one wakeup */
+    while (pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &tstamp) >= 0)
+        if (process_packet(s, &chunk, &tstamp)) {
+            now = tstamp;
+            received = true;
+        }
+
+    if (!received)
+        return 0;
+
+/*     pa_log("blocks in q: %u", pa_memblockq_get_nblocks(s->memblockq)); */
 
-    /* The next timestamp we expect */
-    s->offset = s->rtp_context.timestamp + (uint32_t) (chunk.length / s->rtp_context.frame_size);
+    update_stats(s);
 
     pa_atomic_store(&s->timestamp, (int) now.tv_sec);
 
@@ -490,6 +526,9 @@ fail:
     return -1;
 }
 
+static void check_death_event_cb(pa_mainloop_api *m, pa_time_event *t, const struct timeval *tv, void *userdata);
+static void stats_event_cb(pa_mainloop_api *m, pa_time_event *t, const struct timeval *tv, void *userdata);
+
 static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_info) {
     struct session *s = NULL;
     pa_sink *sink;
@@ -574,7 +613,7 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     if (s->intended_latency < s->sink_latency*2)
         s->intended_latency = s->sink_latency*2;
 
-    s->memblockq = pa_memblockq_new(
+    s->memblockq = pa_memblockq_new_ring(
             "module-rtp-recv memblockq",
             0,
             MEMBLOCKQ_MAXLENGTH,
@@ -587,12 +626,25 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
 
     pa_memblock_unref(silence.memblock);
 
+    /* Missing packets can't be waited for longer than the queue lasts */
+    s->jitter_buffer = pa_jitter_buffer_new(&s->sink_input->sample_spec, u->module->core->mempool,
+                                            (s->intended_latency - s->sink_latency) / 2);
+
     pa_rtp_context_init_recv(&s->rtp_context, fd, pa_frame_size(&s->sdp_info.sample_spec));
 
     pa_hashmap_put(s->userdata->by_origin, s->sdp_info.origin, s);
     u->n_sessions++;
     PA_LLIST_PREPEND(struct session, s->userdata->sessions, s);
 
+    /* The timers only run while there are sessions, they free themselves
+     * once the last one is gone */
+    if (!u->check_death_event)
+        u->check_death_event = pa_core_rttime_new(u->module->core, pa_core_rttime_coarse(pa_rtclock_now() + DEATH_TIMEOUT * PA_USEC_PER_SEC),
+                                                  check_death_event_cb, u);
+
+    if (!u->stats_event)
+        u->stats_event = pa_core_rttime_new(u->module->core, pa_rtclock_now() + STATS_UPDATE_INTERVAL, stats_event_cb, u);
+
     pa_sink_input_put(s->sink_input);
 
     pa_log_info("New session '%s'", s->sdp_info.session_name);
@@ -621,6 +673,7 @@ static void session_free(struct session *s) {
     s->userdata->n_sessions--;
 
     pa_memblockq_free(s->memblockq);
+    pa_jitter_buffer_free(s->jitter_buffer);
     pa_sdp_info_destroy(&s->sdp_info);
     pa_rtp_context_destroy(&s->rtp_context);
 
@@ -673,6 +726,8 @@ static void check_death_event_cb(pa_mainloop_api *m, pa_time_event *t, const str
     pa_assert(t);
     pa_assert(u);
 
+    pa_core_count_wakeup(u->module->core, "rtp-recv");
+
     pa_rtclock_get(&now);
 
     pa_log_debug("Checking for dead streams ...");
@@ -687,8 +742,57 @@ static void check_death_event_cb(pa_mainloop_api *m, pa_time_event *t, const str
             pa_hashmap_remove_and_free(u->by_origin, s->sdp_info.origin);
     }
 
+    if (u->n_sessions == 0) {
+        m->time_free(t);
+        u->check_death_event = NULL;
+        return;
+    }
+
     /* Restart timer */
-    pa_core_rttime_restart(u->module->core, t, pa_rtclock_now() + DEATH_TIMEOUT * PA_USEC_PER_SEC);
+    pa_core_rttime_restart(u->module->core, t, pa_core_rttime_coarse(pa_rtclock_now() + DEATH_TIMEOUT * PA_USEC_PER_SEC));
+}
+
+/* Adds the key to p, if its value differs from the one in the sink input */
+static void set_stat(pa_proplist *p, struct session *s, const char *key, pa_atomic_t *value) {
+    char t[16];
+    const char *old;
+
+    pa_snprintf(t, sizeof(t), "%i", pa_atomic_load(value));
+
+    if (!(old = pa_proplist_gets(s->sink_input->proplist, key)) || !pa_streq(old, t))
+        pa_proplist_sets(p, key, t);
+}
+
+static void stats_event_cb(pa_mainloop_api *m, pa_time_event *t, const struct timeval *tv, void *userdata) {
+    struct userdata *u = userdata;
+    struct session *s;
+
+    pa_assert(m);
+    pa_assert(t);
+    pa_assert(u);
+
+    for (s = u->sessions; s; s = s->next) {
+        pa_proplist *p = pa_proplist_new();
+
+        set_stat(p, s, "rtp.jitter.late", &s->stats_late);
+        set_stat(p, s, "rtp.jitter.lost", &s->stats_lost);
+        set_stat(p, s, "rtp.jitter.reordered", &s->stats_reordered);
+        set_stat(p, s, "rtp.jitter.depth_usec", &s->stats_depth);
+        set_stat(p, s, "rtp.jitter.target_usec", &s->stats_target);
+
+        if (!pa_proplist_isempty(p))
+            pa_sink_input_update_proplist(s->sink_input, PA_UPDATE_REPLACE, p);
+
+        pa_proplist_free(p);
+    }
+
+    if (u->n_sessions == 0) {
+        m->time_free(t);
+        u->stats_event = NULL;
+        return;
+    }
+
+    pa_core_rttime_restart(u->module->core, t, pa_rtclock_now() + STATS_UPDATE_INTERVAL);
 }
 
 int pa__init(pa_module*m) {
@@ -752,7 +856,8 @@ int pa__init(pa_module*m) {
     u->n_sessions = 0;
     u->by_origin = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL, (pa_free_cb_t) session_free);
 
-    u->check_death_event = pa_core_rttime_new(m->core, pa_rtclock_now() + DEATH_TIMEOUT * PA_USEC_PER_SEC, check_death_event_cb, u);
+    u->check_death_event = NULL;
+    u->stats_event = NULL;
 
     pa_modargs_free(ma);
 
@@ -782,6 +887,9 @@ void pa__done(pa_module*m) {
     if (u->check_death_event)
         m->core->mainloop->time_free(u->check_death_event);
 
+    if (u->stats_event)
+        m->core->mainloop->time_free(u->stats_event);
+
     pa_sap_context_destroy(&u->sap_context);
 
     if (u->by_origin)
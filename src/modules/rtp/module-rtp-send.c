@@ -67,6 +67,7 @@ PA_MODULE_USAGE(
         "mtu=<maximum transfer unit> "
         "loop=<loopback to local host?> "
         "ttl=<ttl value> "
+        "pacing=<spread packets evenly with SO_TXTIME?> "
         "inhibit_auto_suspend=<always|never|only_with_non_monitor_sources>"
 );
 
@@ -77,6 +78,8 @@ PA_MODULE_USAGE(
 #define DEFAULT_DESTINATION_IP "224.0.0.56"
 #define MEMBLOCKQ_MAXLENGTH (1024*170)
 #define DEFAULT_MTU 1280
+/* What telephony equipment expects for G.711, see RFC 3551 */
+#define DEFAULT_G711_PACKET_USEC (20*PA_USEC_PER_MSEC)
 #define SAP_INTERVAL (5*PA_USEC_PER_SEC)
 
 static const char* const valid_modargs[] = {
@@ -91,6 +94,7 @@ static const char* const valid_modargs[] = {
     "mtu" ,
     "loop",
     "ttl",
+    "pacing",
     "inhibit_auto_suspend",
     NULL
 };
@@ -228,7 +232,7 @@ int pa__init(pa_module*m) {
     int r, j;
     socklen_t k;
     char hn[128], *n;
-    bool loop = false;
+    bool loop = false, pacing = false;
     enum inhibit_auto_suspend inhibit_auto_suspend = INHIBIT_AUTO_SUSPEND_ONLY_WITH_NON_MONITOR_SOURCES;
     const char *inhibit_auto_suspend_str;
     pa_source_output_new_data data;
@@ -250,6 +254,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "pacing", &pacing) < 0) {
+        pa_log("Failed to parse \"pacing\" parameter.");
+        goto fail;
+    }
+
     if ((inhibit_auto_suspend_str = pa_modargs_get_value(ma, "inhibit_auto_suspend", NULL))) {
         if (pa_streq(inhibit_auto_suspend_str, "always"))
             inhibit_auto_suspend = INHIBIT_AUTO_SUSPEND_ALWAYS;
@@ -281,7 +290,10 @@ int pa__init(pa_module*m) {
 
     payload = pa_rtp_payload_from_sample_spec(&ss);
 
-    mtu = (uint32_t) pa_frame_align(DEFAULT_MTU, &ss);
+    if (ss.format == PA_SAMPLE_ULAW || ss.format == PA_SAMPLE_ALAW)
+        mtu = (uint32_t) pa_usec_to_bytes(DEFAULT_G711_PACKET_USEC, &ss);
+    else
+        mtu = (uint32_t) pa_frame_align(DEFAULT_MTU, &ss);
 
     if (pa_modargs_get_value_u32(ma, "mtu", &mtu) < 0 || mtu < 1 || mtu % pa_frame_size(&ss) != 0) {
         pa_log("Invalid MTU.");
@@ -490,6 +502,10 @@ int pa__init(pa_module*m) {
     pa_xfree(n);
 
     pa_rtp_context_init_send(&u->rtp_context, fd, m->core->cookie, payload, pa_frame_size(&ss));
+
+    if (pacing && pa_rtp_context_set_pacing(&u->rtp_context, ss.rate) < 0)
+        pa_log_warn("Failed to enable pacing, packets will be sent as they come.");
+
     pa_sap_context_init_send(&u->sap_context, sap_fd, p);
 
     pa_log_info("RTP stream initialized with mtu %u on %s:%u from %s ttl=%u, SSRC=0x%08x, payload=%u, initial sequence #%u", mtu, dst_addr, port, src_addr, ttl, u->rtp_context.ssrc, payload, u->rtp_context.sequence);
@@ -25,16 +25,20 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-
-#ifdef HAVE_SYS_FILIO_H
-#include <sys/filio.h>
-#endif
+#include <time.h>
+#include <sys/socket.h>
 
 #ifdef HAVE_SYS_UIO_H
 #include <sys/uio.h>
 #endif
 
+#ifdef HAVE_LINUX_NET_TSTAMP_H
+#include <linux/net_tstamp.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
 #include <pulsecore/core-error.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -43,6 +47,24 @@
 
 #include "rtp.h"
 
+/* Datagrams fetched with one system call */
+#ifdef HAVE_RECVMMSG
+#define RECV_BATCH 16
+#else
+#define RECV_BATCH 1
+#endif
+
+/* Room for the receive timestamp and whatever else comes along */
+#define RECV_AUX_SIZE 256
+
+struct pa_rtp_recv_slot {
+    uint8_t *data;
+    size_t length;
+    bool truncated;
+    bool found_tstamp;
+    struct timeval tstamp;
+};
+
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size) {
     pa_assert(c);
     pa_assert(fd >= 0);
@@ -54,8 +76,13 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
     c->payload = (uint8_t) (payload & 127U);
     c->frame_size = frame_size;
 
+    c->pacing_rate = 0;
+    c->next_txtime = 0;
+
     c->recv_buf = NULL;
     c->recv_buf_size = 0;
+    c->recv_slots = NULL;
+    c->n_recv_slots = c->next_recv_slot = 0;
     pa_memchunk_reset(&c->memchunk);
 
     return c;
@@ -63,11 +90,110 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
 
 #define MAX_IOVECS 16
 
+/* Packets sent with one system call */
+#ifdef HAVE_SENDMMSG
+#define SEND_BATCH 16
+#else
+#define SEND_BATCH 1
+#endif
+
+#ifdef SO_TXTIME
+#define SEND_AUX_SIZE CMSG_SPACE(sizeof(uint64_t))
+#endif
+
+int pa_rtp_context_set_pacing(pa_rtp_context *c, uint32_t rate) {
+#if defined(SO_TXTIME) && defined(HAVE_LINUX_NET_TSTAMP_H)
+    struct sock_txtime txtime;
+
+    pa_assert(c);
+    pa_assert(rate > 0);
+
+    pa_zero(txtime);
+    txtime.clockid = CLOCK_MONOTONIC;
+
+    if (setsockopt(c->fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+        pa_log_warn("SO_TXTIME failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    c->pacing_rate = rate;
+    c->next_txtime = 0;
+
+    return 0;
+#else
+    pa_log_warn("SO_TXTIME unsupported on this platform");
+    return -1;
+#endif
+}
+
+/* Sends the first n messages, returns -1 if any of them failed */
+static int send_messages(pa_rtp_context *c, struct msghdr *m, unsigned n) {
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr mm[SEND_BATCH];
+    unsigned i, sent = 0;
+
+    for (i = 0; i < n; i++) {
+        mm[i].msg_hdr = m[i];
+        mm[i].msg_len = 0;
+    }
+
+    while (sent < n) {
+        int r;
+
+        if ((r = sendmmsg(c->fd, mm + sent, n - sent, MSG_DONTWAIT)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN) /* If the queue is full, just ignore it */
+                pa_log("sendmmsg() failed: %s", pa_cstrerror(errno));
+            return -1;
+        }
+
+        sent += (unsigned) r;
+    }
+#else
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        if (sendmsg(c->fd, &m[i], MSG_DONTWAIT) < 0) {
+            if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
+                pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
+            return -1;
+        }
+#endif
+
+    return 0;
+}
+
+#ifdef SO_TXTIME
+/* Asks the kernel to hold the packet back until the given time */
+static void set_txtime(struct msghdr *m, uint8_t *aux, pa_usec_t t) {
+    struct cmsghdr *cm;
+    uint64_t ns = (uint64_t) t * PA_NSEC_PER_USEC;
+
+    m->msg_control = aux;
+    m->msg_controllen = SEND_AUX_SIZE;
+
+    cm = CMSG_FIRSTHDR(m);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_TXTIME;
+    cm->cmsg_len = CMSG_LEN(sizeof(ns));
+    memcpy(CMSG_DATA(cm), &ns, sizeof(ns));
+}
+#endif
+
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
-    struct iovec iov[MAX_IOVECS];
-    pa_memblock* mb[MAX_IOVECS];
+    struct iovec iov[SEND_BATCH][MAX_IOVECS];
+    pa_memblock* mb[SEND_BATCH][MAX_IOVECS];
+    uint32_t header[SEND_BATCH][3];
+    struct msghdr m[SEND_BATCH];
+#ifdef SO_TXTIME
+    uint8_t aux[SEND_BATCH][SEND_AUX_SIZE];
+#endif
+    unsigned n_packets = 0;
     int iov_idx = 1;
     size_t n = 0;
+    int ret = 0;
 
     pa_assert(c);
     pa_assert(size > 0);
@@ -76,6 +202,16 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
     if (pa_memblockq_get_length(q) < size)
         return 0;
 
+    if (c->pacing_rate > 0) {
+        pa_usec_t now = pa_rtclock_now();
+        pa_usec_t span = (pa_usec_t) (pa_memblockq_get_length(q) / size * size / c->frame_size) * PA_USEC_PER_SEC / c->pacing_rate;
+
+        /* Spread the packets evenly, continuing where the last ones
+         * ended, but don't let the schedule run away from the clock */
+        if (c->next_txtime < now || c->next_txtime > now + span)
+            c->next_txtime = now;
+    }
+
     for (;;) {
         int r;
         pa_memchunk chunk;
@@ -88,9 +224,9 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
 
             pa_assert(chunk.memblock);
 
-            iov[iov_idx].iov_base = pa_memblock_acquire_chunk(&chunk);
-            iov[iov_idx].iov_len = k;
-            mb[iov_idx] = chunk.memblock;
+            iov[n_packets][iov_idx].iov_base = pa_memblock_acquire_chunk(&chunk);
+            iov[n_packets][iov_idx].iov_len = k;
+            mb[n_packets][iov_idx] = chunk.memblock;
             iov_idx ++;
 
             n += k;
@@ -100,47 +236,55 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
         pa_assert(n % c->frame_size == 0);
 
         if (r < 0 || n >= size || iov_idx >= MAX_IOVECS) {
-            uint32_t header[3];
-            struct msghdr m;
-            ssize_t k;
-            int i;
+            bool done;
 
             if (n > 0) {
-                header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
-                header[1] = htonl(c->timestamp);
-                header[2] = htonl(c->ssrc);
-
-                iov[0].iov_base = (void*)header;
-                iov[0].iov_len = sizeof(header);
-
-                m.msg_name = NULL;
-                m.msg_namelen = 0;
-                m.msg_iov = iov;
-                m.msg_iovlen = (size_t) iov_idx;
-                m.msg_control = NULL;
-                m.msg_controllen = 0;
-                m.msg_flags = 0;
-
-                k = sendmsg(c->fd, &m, MSG_DONTWAIT);
-
-                for (i = 1; i < iov_idx; i++) {
-                    pa_memblock_release(mb[i]);
-                    pa_memblock_unref(mb[i]);
+                header[n_packets][0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
+                header[n_packets][1] = htonl(c->timestamp);
+                header[n_packets][2] = htonl(c->ssrc);
+
+                iov[n_packets][0].iov_base = (void*)header[n_packets];
+                iov[n_packets][0].iov_len = sizeof(header[n_packets]);
+
+                pa_zero(m[n_packets]);
+                m[n_packets].msg_iov = iov[n_packets];
+                m[n_packets].msg_iovlen = (size_t) iov_idx;
+
+#ifdef SO_TXTIME
+                if (c->pacing_rate > 0) {
+                    set_txtime(&m[n_packets], aux[n_packets], c->next_txtime);
+                    c->next_txtime += (pa_usec_t) (n / c->frame_size) * PA_USEC_PER_SEC / c->pacing_rate;
                 }
+#endif
 
+                n_packets++;
                 c->sequence++;
-            } else
-                k = 0;
+            }
 
             c->timestamp += (unsigned) (n/c->frame_size);
 
-            if (k < 0) {
-                if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
-                    pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
-                return -1;
+            done = r < 0 || pa_memblockq_get_length(q) < size;
+
+            if (n_packets > 0 && (done || n_packets >= SEND_BATCH)) {
+                unsigned i;
+                size_t j;
+
+                if (send_messages(c, m, n_packets) < 0)
+                    ret = -1;
+
+                for (i = 0; i < n_packets; i++)
+                    for (j = 1; j < m[i].msg_iovlen; j++) {
+                        pa_memblock_release(mb[i][j]);
+                        pa_memblock_unref(mb[i][j]);
+                    }
+
+                n_packets = 0;
+
+                if (ret < 0)
+                    break;
             }
 
-            if (r < 0 || pa_memblockq_get_length(q) < size)
+            if (done)
                 break;
 
             n = 0;
@@ -148,7 +292,7 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
         }
     }
 
-    return 0;
+    return ret;
 }
 
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size) {
@@ -158,96 +302,119 @@ pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame
     c->frame_size = frame_size;
 
     c->recv_buf_size = 2000;
-    c->recv_buf = pa_xmalloc(c->recv_buf_size);
+    c->recv_buf = pa_xmalloc(c->recv_buf_size * RECV_BATCH);
+    c->recv_slots = pa_xnew0(struct pa_rtp_recv_slot, RECV_BATCH);
+    c->n_recv_slots = c->next_recv_slot = 0;
     pa_memchunk_reset(&c->memchunk);
     return c;
 }
 
-int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
-    int size;
-    size_t audio_length;
-    size_t metadata_length;
-    struct msghdr m;
+static void fill_slot(struct pa_rtp_recv_slot *slot, struct msghdr *m, size_t length) {
     struct cmsghdr *cm;
-    struct iovec iov;
-    uint32_t header;
-    unsigned cc;
-    ssize_t r;
-    uint8_t aux[1024];
-    bool found_tstamp = false;
 
-    pa_assert(c);
-    pa_assert(chunk);
+    slot->length = length;
+    slot->truncated = !!(m->msg_flags & MSG_TRUNC);
+    slot->found_tstamp = false;
 
-    pa_memchunk_reset(chunk);
+    for (cm = CMSG_FIRSTHDR(m); cm; cm = CMSG_NXTHDR(m, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
+            memcpy(&slot->tstamp, CMSG_DATA(cm), sizeof(struct timeval));
+            slot->found_tstamp = true;
+            break;
+        }
+}
 
-    if (ioctl(c->fd, FIONREAD, &size) < 0) {
-        pa_log_warn("FIONREAD failed: %s", pa_cstrerror(errno));
-        goto fail;
-    }
+/* Reads as many datagrams as are pending, up to RECV_BATCH, without
+ * blocking. Returns how many were read. */
+static int recv_batch(pa_rtp_context *c) {
+    struct iovec iov[RECV_BATCH];
+    uint8_t aux[RECV_BATCH][RECV_AUX_SIZE];
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgs[RECV_BATCH];
+#else
+    struct msghdr m;
+    ssize_t l;
+#endif
+    bool grow = false;
+    unsigned i;
+    int r;
 
-    if (size <= 0) {
-        /* size can be 0 due to any of the following reasons:
-         *
-         * 1. Somebody sent us a perfectly valid zero-length UDP packet.
-         * 2. Somebody sent us a UDP packet with a bad CRC.
-         *
-         * It is unknown whether size can actually be less than zero.
-         *
-         * In the first case, the packet has to be read out, otherwise the
-         * kernel will tell us again and again about it, thus preventing
-         * reception of any further packets. So let's just read it out
-         * now and discard it later, when comparing the number of bytes
-         * received (0) with the number of bytes wanted (1, see below).
-         *
-         * In the second case, recvmsg() will fail, thus allowing us to
-         * return the error.
-         *
-         * Just to avoid passing zero-sized memchunks and NULL pointers to
-         * recvmsg(), let's force allocation of at least one byte by setting
-         * size to 1.
-         */
-        size = 1;
+    /* Make room for datagrams as large as the ones that didn't fit last time */
+    for (i = 0; i < c->n_recv_slots; i++)
+        grow = grow || c->recv_slots[i].truncated;
+
+    if (grow) {
+        c->recv_buf_size *= 2;
+        c->recv_buf = pa_xrealloc(c->recv_buf, c->recv_buf_size * RECV_BATCH);
     }
 
-    if (c->recv_buf_size < (size_t) size) {
-        do
-            c->recv_buf_size *= 2;
-        while (c->recv_buf_size < (size_t) size);
+    c->n_recv_slots = c->next_recv_slot = 0;
 
-        c->recv_buf = pa_xrealloc(c->recv_buf, c->recv_buf_size);
+    for (i = 0; i < RECV_BATCH; i++) {
+        c->recv_slots[i].data = c->recv_buf + i * c->recv_buf_size;
+        iov[i].iov_base = c->recv_slots[i].data;
+        iov[i].iov_len = c->recv_buf_size;
     }
 
-    pa_assert(c->recv_buf_size >= (size_t) size);
+#ifdef HAVE_RECVMMSG
+    for (i = 0; i < RECV_BATCH; i++) {
+        pa_zero(msgs[i]);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = aux[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(aux[i]);
+    }
 
-    iov.iov_base = c->recv_buf;
-    iov.iov_len = (size_t) size;
+    if ((r = recvmmsg(c->fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            pa_log_warn("recvmmsg() failed: %s", pa_cstrerror(errno));
+
+        return 0;
+    }
 
-    m.msg_name = NULL;
-    m.msg_namelen = 0;
-    m.msg_iov = &iov;
+    for (i = 0; i < (unsigned) r; i++)
+        fill_slot(&c->recv_slots[i], &msgs[i].msg_hdr, msgs[i].msg_len);
+#else
+    pa_zero(m);
+    m.msg_iov = &iov[0];
     m.msg_iovlen = 1;
-    m.msg_control = aux;
-    m.msg_controllen = sizeof(aux);
-    m.msg_flags = 0;
+    m.msg_control = aux[0];
+    m.msg_controllen = sizeof(aux[0]);
 
-    r = recvmsg(c->fd, &m, 0);
+    if ((l = recvmsg(c->fd, &m, MSG_DONTWAIT)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            pa_log_warn("recvmsg() failed: %s", pa_cstrerror(errno));
 
-    if (r != size) {
-        if (r < 0 && errno != EAGAIN && errno != EINTR)
-            pa_log_warn("recvmsg() failed: %s", r < 0 ? pa_cstrerror(errno) : "size mismatch");
+        return 0;
+    }
+
+    fill_slot(&c->recv_slots[0], &m, (size_t) l);
+    r = 1;
+#endif
+
+    c->n_recv_slots = (unsigned) r;
+    return r;
+}
+
+static int parse_packet(pa_rtp_context *c, struct pa_rtp_recv_slot *slot, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
+    size_t audio_length;
+    size_t metadata_length;
+    uint32_t header;
+    unsigned cc;
 
-        goto fail;
+    if (slot->truncated) {
+        pa_log_warn("RTP packet larger than %llu bytes, dropped.", (unsigned long long) c->recv_buf_size);
+        return -1;
     }
 
-    if (size < 12) {
+    if (slot->length < 12) {
         pa_log_warn("RTP packet too short.");
-        goto fail;
+        return -1;
     }
 
-    memcpy(&header, iov.iov_base, sizeof(uint32_t));
-    memcpy(&c->timestamp, (uint8_t*) iov.iov_base + 4, sizeof(uint32_t));
-    memcpy(&c->ssrc, (uint8_t*) iov.iov_base + 8, sizeof(uint32_t));
+    memcpy(&header, slot->data, sizeof(uint32_t));
+    memcpy(&c->timestamp, slot->data + 4, sizeof(uint32_t));
+    memcpy(&c->ssrc, slot->data + 8, sizeof(uint32_t));
 
     header = ntohl(header);
     c->timestamp = ntohl(c->timestamp);
@@ -255,17 +422,17 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
 
     if ((header >> 30) != 2) {
         pa_log_warn("Unsupported RTP version.");
-        goto fail;
+        return -1;
     }
 
     if ((header >> 29) & 1) {
         pa_log_warn("RTP padding not supported.");
-        goto fail;
+        return -1;
     }
 
     if ((header >> 28) & 1) {
         pa_log_warn("RTP header extensions not supported.");
-        goto fail;
+        return -1;
     }
 
     cc = (header >> 24) & 0xF;
@@ -274,16 +441,16 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
 
     metadata_length = 12 + cc * 4;
 
-    if (metadata_length > (unsigned) size) {
+    if (metadata_length > slot->length) {
         pa_log_warn("RTP packet too short. (CSRC)");
-        goto fail;
+        return -1;
     }
 
-    audio_length = size - metadata_length;
+    audio_length = slot->length - metadata_length;
 
     if (audio_length % c->frame_size != 0) {
         pa_log_warn("Bad RTP packet size.");
-        goto fail;
+        return -1;
     }
 
     if (c->memchunk.length < (unsigned) audio_length) {
@@ -299,7 +466,7 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
         c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock);
     }
 
-    memcpy(pa_memblock_acquire_chunk(&c->memchunk), c->recv_buf + metadata_length, audio_length);
+    memcpy(pa_memblock_acquire_chunk(&c->memchunk), slot->data + metadata_length, audio_length);
     pa_memblock_release(c->memchunk.memblock);
 
     chunk->memblock = pa_memblock_ref(c->memchunk.memblock);
@@ -314,25 +481,32 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
         pa_memchunk_reset(&c->memchunk);
     }
 
-    for (cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm))
-        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
-            memcpy(tstamp, CMSG_DATA(cm), sizeof(struct timeval));
-            found_tstamp = true;
-            break;
-        }
-
-    if (!found_tstamp) {
+    if (slot->found_tstamp)
+        *tstamp = slot->tstamp;
+    else {
         pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
         pa_zero(*tstamp);
     }
 
     return 0;
+}
 
-fail:
-    if (chunk->memblock)
-        pa_memblock_unref(chunk->memblock);
+int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
+    pa_assert(c);
+    pa_assert(chunk);
+    pa_assert(tstamp);
 
-    return -1;
+    pa_memchunk_reset(chunk);
+
+    for (;;) {
+        if (c->next_recv_slot >= c->n_recv_slots)
+            if (recv_batch(c) <= 0)
+                return -1;
+
+        /* Invalid packets are skipped */
+        if (parse_packet(c, &c->recv_slots[c->next_recv_slot++], chunk, pool, tstamp) >= 0)
+            return 0;
+    }
 }
 
 uint8_t pa_rtp_payload_from_sample_spec(const pa_sample_spec *ss) {
@@ -419,6 +593,10 @@ void pa_rtp_context_destroy(pa_rtp_context *c) {
     pa_xfree(c->recv_buf);
     c->recv_buf = NULL;
     c->recv_buf_size = 0;
+
+    pa_xfree(c->recv_slots);
+    c->recv_slots = NULL;
+    c->n_recv_slots = c->next_recv_slot = 0;
 }
 
 const char* pa_rtp_format_to_string(pa_sample_format_t f) {
@@ -23,6 +23,7 @@
 #include <inttypes.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <pulse/sample.h>
 #include <pulsecore/memblockq.h>
 #include <pulsecore/memchunk.h>
 
@@ -34,18 +35,34 @@ typedef struct pa_rtp_context {
     uint8_t payload;
     size_t frame_size;
 
+    uint32_t pacing_rate;                /* Sample rate the sent packets are paced with, 0 if not paced */
+    pa_usec_t next_txtime;               /* When the next paced packet is to leave */
+
     uint8_t *recv_buf;
     size_t recv_buf_size;
+    struct pa_rtp_recv_slot *recv_slots;
+    unsigned n_recv_slots;
+    unsigned next_recv_slot;
     pa_memchunk memchunk;
 } pa_rtp_context;
 
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size);
 
+/* Has the kernel spread the packets sent over the time they play for,
+ * instead of sending them in a burst. Needs a qdisc that honours
+ * SO_TXTIME, like fq. */
+int pa_rtp_context_set_pacing(pa_rtp_context *c, uint32_t rate);
+
 /* If the memblockq doesn't have a silence memchunk set, then the caller must
  * guarantee that the current read index doesn't point to a hole. */
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q);
 
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size);
+
+/* Returns the next valid packet received, without blocking. Packets are
+ * read from the socket in batches where supported, so call this until it
+ * returns a negative value to drain all pending packets. tstamp is the
+ * kernel receive time, or zeroed if it isn't available. */
 int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp);
 
 void pa_rtp_context_destroy(pa_rtp_context *c);
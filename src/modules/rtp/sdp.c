@@ -104,7 +104,7 @@ static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
     if (sscanf(c, "%u/%u", &rate, &channels) == 2) {
         ss->rate = (uint32_t) rate;
         ss->channels = (uint8_t) channels;
-    } else if (sscanf(c, "%u", &rate) == 2) {
+    } else if (sscanf(c, "%u", &rate) == 1) {
         ss->rate = (uint32_t) rate;
         ss->channels = 1;
     } else
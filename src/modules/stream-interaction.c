@@ -23,6 +23,7 @@
 
 #include <pulse/xmalloc.h>
 #include <pulse/volume.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/macro.h>
 #include <pulsecore/hashmap.h>
@@ -48,6 +49,7 @@ struct userdata {
     struct group **groups;
     bool global:1;
     bool duck:1;
+    pa_usec_t fade_usec;
     pa_hook_slot
         *sink_input_put_slot,
         *sink_input_unlink_slot,
@@ -124,12 +126,8 @@ static const char *find_global_trigger_stream(struct userdata *u, pa_sink *s, pa
 static void cork_or_duck(struct userdata *u, pa_sink_input *i, const char *interaction_role,  const char *trigger_role, bool interaction_applied, struct group *g) {
 
     if (u->duck && !interaction_applied) {
-        pa_cvolume vol;
-        vol.channels = 1;
-        vol.values[0] = g->volume;
-
         pa_log_debug("Found a '%s' stream of '%s' that ducks a '%s' stream.", trigger_role, g->name, interaction_role);
-        pa_sink_input_add_volume_factor(i, g->name, &vol);
+        pa_sink_input_add_ramp_factor(i, g->name, g->volume, u->fade_usec);
 
     } else if (!u->duck) {
         pa_log_debug("Found a '%s' stream that corks/mutes a '%s' stream.", trigger_role, interaction_role);
@@ -142,7 +140,7 @@ static void uncork_or_unduck(struct userdata *u, pa_sink_input *i, const char *i
 
     if (u->duck) {
        pa_log_debug("In '%s', found a '%s' stream that should be unducked", g->name, interaction_role);
-       pa_sink_input_remove_volume_factor(i, g->name);
+       pa_sink_input_remove_ramp_factor(i, g->name, u->fade_usec);
     }
     else if (corked || i->muted) {
        pa_log_debug("Found a '%s' stream that should be uncorked/unmuted.", interaction_role);
@@ -321,6 +319,7 @@ int pa_stream_interaction_init(pa_module *m, const char* const v_modargs[]) {
     const char *roles;
     char *roles_in_group = NULL;
     bool global = false;
+    uint32_t fade_msec = 100;
     uint32_t i = 0;
 
     pa_assert(m);
@@ -489,6 +488,12 @@ int pa_stream_interaction_init(pa_module *m, const char* const v_modargs[]) {
     }
     u->global = global;
 
+    if (pa_modargs_get_value_u32(ma, "fade_msec", &fade_msec) < 0) {
+        pa_log("Invalid fade_msec parameter");
+        goto fail;
+    }
+    u->fade_usec = fade_msec * PA_USEC_PER_MSEC;
+
     u->sink_input_put_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_PUT], PA_HOOK_LATE, (pa_hook_cb_t) sink_input_put_cb, u);
     u->sink_input_unlink_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_UNLINK], PA_HOOK_LATE, (pa_hook_cb_t) sink_input_unlink_cb, u);
     u->sink_input_move_start_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_START], PA_HOOK_LATE, (pa_hook_cb_t) sink_input_move_start_cb, u);
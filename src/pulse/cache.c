@@ -0,0 +1,857 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/macro.h>
+
+#include "internal.h"
+#include "cache.h"
+
+#define N_FACILITIES (PA_SUBSCRIPTION_EVENT_CARD + 1)
+
+#define CACHEABLE_MASK                          \
+    (PA_SUBSCRIPTION_MASK_SINK|                 \
+     PA_SUBSCRIPTION_MASK_SOURCE|               \
+     PA_SUBSCRIPTION_MASK_SINK_INPUT|           \
+     PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT|        \
+     PA_SUBSCRIPTION_MASK_CLIENT|               \
+     PA_SUBSCRIPTION_MASK_CARD)
+
+struct entry {
+    pa_cache *cache;
+    pa_subscription_event_type_t facility;
+    uint32_t index;
+
+    /* NULL until the object was fetched for the first time */
+    void *info;
+
+    /* The fetch of the object in progress, if any */
+    pa_operation *operation;
+
+    /* Set when the object changed again while it was fetched */
+    bool refetch;
+};
+
+struct pa_cache {
+    PA_LLIST_FIELDS(pa_cache);
+
+    pa_context *context;
+    pa_subscription_mask_t mask;
+
+    pa_hashmap *entries[N_FACILITIES];
+
+    /* The fetches of the initial lists still in progress */
+    pa_operation *list_operations[N_FACILITIES];
+    unsigned n_lists_pending;
+
+    pa_cache_notify_cb_t notify_callback;
+    void *notify_userdata;
+};
+
+struct kind {
+    pa_operation *(*fetch)(pa_context *c, uint32_t idx, struct entry *e);
+    pa_operation *(*fetch_list)(pa_context *c, pa_cache *cache);
+    void (*free)(void *info);
+};
+
+static const struct kind kinds[N_FACILITIES];
+
+static void notify(pa_cache *cache, pa_subscription_event_type_t t, uint32_t idx) {
+    if (cache->notify_callback)
+        cache->notify_callback(cache, t, idx, cache->notify_userdata);
+}
+
+static void entry_free(struct entry *e) {
+    pa_assert(e);
+
+    if (e->operation) {
+        pa_operation_cancel(e->operation);
+        pa_operation_unref(e->operation);
+    }
+
+    if (e->info)
+        kinds[e->facility].free(e->info);
+
+    pa_xfree(e);
+}
+
+static struct entry *entry_get(pa_cache *cache, pa_subscription_event_type_t facility, uint32_t idx) {
+    struct entry *e;
+
+    if ((e = pa_hashmap_get(cache->entries[facility], PA_UINT32_TO_PTR(idx))))
+        return e;
+
+    e = pa_xnew0(struct entry, 1);
+    e->cache = cache;
+    e->facility = facility;
+    e->index = idx;
+    pa_hashmap_put(cache->entries[facility], PA_UINT32_TO_PTR(idx), e);
+
+    return e;
+}
+
+static void entry_fetch(struct entry *e) {
+    pa_assert(!e->operation);
+
+    e->refetch = false;
+    e->operation = kinds[e->facility].fetch(e->cache->context, e->index, e);
+}
+
+/* Takes over info, the copy of a fetched object */
+static void entry_set_info(struct entry *e, void *info) {
+    pa_subscription_event_type_t t = PA_SUBSCRIPTION_EVENT_CHANGE;
+
+    if (e->info)
+        kinds[e->facility].free(e->info);
+    else
+        t = PA_SUBSCRIPTION_EVENT_NEW;
+
+    e->info = info;
+    notify(e->cache, e->facility|t, e->index);
+}
+
+static void entry_remove(struct entry *e) {
+    pa_cache *cache = e->cache;
+    pa_subscription_event_type_t facility = e->facility;
+    uint32_t idx = e->index;
+    bool known = !!e->info;
+
+    pa_hashmap_remove_and_free(cache->entries[facility], PA_UINT32_TO_PTR(idx));
+
+    if (known)
+        notify(cache, facility|PA_SUBSCRIPTION_EVENT_REMOVE, idx);
+}
+
+/* Called for the replies to the fetch of a single object */
+static void entry_fetched(struct entry *e, void *info, int eol) {
+    if (info) {
+        entry_set_info(e, info);
+        return;
+    }
+
+    pa_operation_unref(e->operation);
+    e->operation = NULL;
+
+    /* The object is gone, the event of its removal may still come */
+    if (eol < 0) {
+        entry_remove(e);
+        return;
+    }
+
+    if (e->refetch)
+        entry_fetch(e);
+}
+
+/* Called for the replies to the fetch of the initial list of a facility */
+static void list_fetched(pa_cache *cache, pa_subscription_event_type_t facility, uint32_t idx, void *info, int eol) {
+    if (info) {
+        struct entry *e = entry_get(cache, facility, idx);
+
+        /* What a fetch in progress brings is more recent */
+        if (e->operation && e->info)
+            kinds[facility].free(info);
+        else
+            entry_set_info(e, info);
+
+        return;
+    }
+
+    pa_operation_unref(cache->list_operations[facility]);
+    cache->list_operations[facility] = NULL;
+
+    pa_assert(cache->n_lists_pending > 0);
+
+    if (--cache->n_lists_pending == 0)
+        notify(cache, 0, PA_INVALID_INDEX);
+}
+
+static pa_proplist *proplist_copy(const pa_proplist *p) {
+    return p ? pa_proplist_copy(p) : NULL;
+}
+
+static void proplist_free(pa_proplist *p) {
+    if (p)
+        pa_proplist_free(p);
+}
+
+static pa_format_info **formats_copy(pa_format_info **formats, unsigned n) {
+    pa_format_info **r;
+    unsigned j;
+
+    if (!formats)
+        return NULL;
+
+    r = pa_xnew0(pa_format_info*, n);
+
+    for (j = 0; j < n; j++)
+        r[j] = pa_format_info_copy(formats[j]);
+
+    return r;
+}
+
+static void formats_free(pa_format_info **formats, unsigned n) {
+    unsigned j;
+
+    if (!formats)
+        return;
+
+    for (j = 0; j < n; j++)
+        pa_format_info_free(formats[j]);
+
+    pa_xfree(formats);
+}
+
+static void *sink_info_copy(const pa_sink_info *i) {
+    pa_sink_info *r;
+    uint32_t j;
+
+    r = pa_xmemdup(i, sizeof(*i));
+    r->name = pa_xstrdup(i->name);
+    r->description = pa_xstrdup(i->description);
+    r->monitor_source_name = pa_xstrdup(i->monitor_source_name);
+    r->driver = pa_xstrdup(i->driver);
+    r->proplist = proplist_copy(i->proplist);
+    r->active_port = NULL;
+
+    if (i->ports) {
+        r->ports = pa_xnew0(pa_sink_port_info*, i->n_ports + 1);
+
+        for (j = 0; j < i->n_ports; j++) {
+            r->ports[j] = pa_xmemdup(i->ports[j], sizeof(pa_sink_port_info));
+            r->ports[j]->name = pa_xstrdup(i->ports[j]->name);
+            r->ports[j]->description = pa_xstrdup(i->ports[j]->description);
+
+            if (i->active_port == i->ports[j])
+                r->active_port = r->ports[j];
+        }
+    }
+
+    r->formats = formats_copy(i->formats, i->n_formats);
+
+    return r;
+}
+
+static void sink_info_free(void *info) {
+    pa_sink_info *i = info;
+    uint32_t j;
+
+    pa_xfree((char *) i->name);
+    pa_xfree((char *) i->description);
+    pa_xfree((char *) i->monitor_source_name);
+    pa_xfree((char *) i->driver);
+    proplist_free(i->proplist);
+
+    if (i->ports) {
+        for (j = 0; j < i->n_ports; j++) {
+            pa_xfree((char *) i->ports[j]->name);
+            pa_xfree((char *) i->ports[j]->description);
+            pa_xfree(i->ports[j]);
+        }
+
+        pa_xfree(i->ports);
+    }
+
+    formats_free(i->formats, i->n_formats);
+    pa_xfree(i);
+}
+
+static void *source_info_copy(const pa_source_info *i) {
+    pa_source_info *r;
+    uint32_t j;
+
+    r = pa_xmemdup(i, sizeof(*i));
+    r->name = pa_xstrdup(i->name);
+    r->description = pa_xstrdup(i->description);
+    r->monitor_of_sink_name = pa_xstrdup(i->monitor_of_sink_name);
+    r->driver = pa_xstrdup(i->driver);
+    r->proplist = proplist_copy(i->proplist);
+    r->active_port = NULL;
+
+    if (i->ports) {
+        r->ports = pa_xnew0(pa_source_port_info*, i->n_ports + 1);
+
+        for (j = 0; j < i->n_ports; j++) {
+            r->ports[j] = pa_xmemdup(i->ports[j], sizeof(pa_source_port_info));
+            r->ports[j]->name = pa_xstrdup(i->ports[j]->name);
+            r->ports[j]->description = pa_xstrdup(i->ports[j]->description);
+
+            if (i->active_port == i->ports[j])
+                r->active_port = r->ports[j];
+        }
+    }
+
+    r->formats = formats_copy(i->formats, i->n_formats);
+
+    return r;
+}
+
+static void source_info_free(void *info) {
+    pa_source_info *i = info;
+    uint32_t j;
+
+    pa_xfree((char *) i->name);
+    pa_xfree((char *) i->description);
+    pa_xfree((char *) i->monitor_of_sink_name);
+    pa_xfree((char *) i->driver);
+    proplist_free(i->proplist);
+
+    if (i->ports) {
+        for (j = 0; j < i->n_ports; j++) {
+            pa_xfree((char *) i->ports[j]->name);
+            pa_xfree((char *) i->ports[j]->description);
+            pa_xfree(i->ports[j]);
+        }
+
+        pa_xfree(i->ports);
+    }
+
+    formats_free(i->formats, i->n_formats);
+    pa_xfree(i);
+}
+
+static void *sink_input_info_copy(const pa_sink_input_info *i) {
+    pa_sink_input_info *r;
+
+    r = pa_xmemdup(i, sizeof(*i));
+    r->name = pa_xstrdup(i->name);
+    r->resample_method = pa_xstrdup(i->resample_method);
+    r->driver = pa_xstrdup(i->driver);
+    r->proplist = proplist_copy(i->proplist);
+    r->format = i->format ? pa_format_info_copy(i->format) : NULL;
+
+    return r;
+}
+
+static void sink_input_info_free(void *info) {
+    pa_sink_input_info *i = info;
+
+    pa_xfree((char *) i->name);
+    pa_xfree((char *) i->resample_method);
+    pa_xfree((char *) i->driver);
+    proplist_free(i->proplist);
+
+    if (i->format)
+        pa_format_info_free(i->format);
+
+    pa_xfree(i);
+}
+
+static void *source_output_info_copy(const pa_source_output_info *i) {
+    pa_source_output_info *r;
+
+    r = pa_xmemdup(i, sizeof(*i));
+    r->name = pa_xstrdup(i->name);
+    r->resample_method = pa_xstrdup(i->resample_method);
+    r->driver = pa_xstrdup(i->driver);
+    r->proplist = proplist_copy(i->proplist);
+    r->format = i->format ? pa_format_info_copy(i->format) : NULL;
+
+    return r;
+}
+
+static void source_output_info_free(void *info) {
+    pa_source_output_info *i = info;
+
+    pa_xfree((char *) i->name);
+    pa_xfree((char *) i->resample_method);
+    pa_xfree((char *) i->driver);
+    proplist_free(i->proplist);
+
+    if (i->format)
+        pa_format_info_free(i->format);
+
+    pa_xfree(i);
+}
+
+static void *client_info_copy(const pa_client_info *i) {
+    pa_client_info *r;
+
+    r = pa_xmemdup(i, sizeof(*i));
+    r->name = pa_xstrdup(i->name);
+    r->driver = pa_xstrdup(i->driver);
+    r->proplist = proplist_copy(i->proplist);
+
+    return r;
+}
+
+static void client_info_free(void *info) {
+    pa_client_info *i = info;
+
+    pa_xfree((char *) i->name);
+    pa_xfree((char *) i->driver);
+    proplist_free(i->proplist);
+    pa_xfree(i);
+}
+
+/* Returns the position of a profile of i, n_profiles if there is none */
+static uint32_t card_profile_find(const pa_card_info *i, const pa_card_profile_info2 *p) {
+    uint32_t j;
+
+    for (j = 0; j < i->n_profiles; j++)
+        if (i->profiles2 && i->profiles2[j] == p)
+            break;
+
+    return j;
+}
+
+static void *card_info_copy(const pa_card_info *i) {
+    pa_card_info *r;
+    uint32_t j, k;
+
+    r = pa_xmemdup(i, sizeof(*i));
+    r->name = pa_xstrdup(i->name);
+    r->driver = pa_xstrdup(i->driver);
+    r->proplist = proplist_copy(i->proplist);
+    r->active_profile = NULL;
+    r->active_profile2 = NULL;
+
+    /* The two profile arrays share their strings, as when they are
+     * received from the server */
+    r->profiles = pa_xnew0(pa_card_profile_info, i->n_profiles + 1);
+    r->profiles2 = pa_xnew0(pa_card_profile_info2*, i->n_profiles + 1);
+
+    for (j = 0; j < i->n_profiles; j++) {
+        r->profiles2[j] = pa_xmemdup(i->profiles2[j], sizeof(pa_card_profile_info2));
+        r->profiles2[j]->name = pa_xstrdup(i->profiles2[j]->name);
+        r->profiles2[j]->description = pa_xstrdup(i->profiles2[j]->description);
+
+        r->profiles[j].name = r->profiles2[j]->name;
+        r->profiles[j].description = r->profiles2[j]->description;
+        r->profiles[j].n_sinks = r->profiles2[j]->n_sinks;
+        r->profiles[j].n_sources = r->profiles2[j]->n_sources;
+        r->profiles[j].priority = r->profiles2[j]->priority;
+
+        if (i->active_profile2 == i->profiles2[j]) {
+            r->active_profile = &r->profiles[j];
+            r->active_profile2 = r->profiles2[j];
+        }
+    }
+
+    if (i->ports) {
+        r->ports = pa_xnew0(pa_card_port_info*, i->n_ports + 1);
+
+        for (j = 0; j < i->n_ports; j++) {
+            const pa_card_port_info *p = i->ports[j];
+            pa_card_port_info *q;
+
+            q = r->ports[j] = pa_xmemdup(p, sizeof(pa_card_port_info));
+            q->name = pa_xstrdup(p->name);
+            q->description = pa_xstrdup(p->description);
+            q->proplist = proplist_copy(p->proplist);
+            q->profiles = NULL;
+            q->profiles2 = NULL;
+
+            if (p->n_profiles <= 0 || !p->profiles2)
+                continue;
+
+            q->profiles = pa_xnew0(pa_card_profile_info*, i->n_profiles + 1);
+            q->profiles2 = pa_xnew0(pa_card_profile_info2*, i->n_profiles + 1);
+
+            for (k = 0; k < p->n_profiles; k++) {
+                uint32_t l = card_profile_find(i, p->profiles2[k]);
+
+                pa_assert(l < i->n_profiles);
+                q->profiles[k] = &r->profiles[l];
+                q->profiles2[k] = r->profiles2[l];
+            }
+        }
+    }
+
+    return r;
+}
+
+static void card_info_free(void *info) {
+    pa_card_info *i = info;
+    uint32_t j;
+
+    pa_xfree((char *) i->name);
+    pa_xfree((char *) i->driver);
+    proplist_free(i->proplist);
+
+    for (j = 0; j < i->n_profiles; j++) {
+        pa_xfree((char *) i->profiles2[j]->name);
+        pa_xfree((char *) i->profiles2[j]->description);
+        pa_xfree(i->profiles2[j]);
+    }
+
+    pa_xfree(i->profiles);
+    pa_xfree(i->profiles2);
+
+    if (i->ports) {
+        for (j = 0; j < i->n_ports; j++) {
+            pa_xfree((char *) i->ports[j]->name);
+            pa_xfree((char *) i->ports[j]->description);
+            proplist_free(i->ports[j]->proplist);
+            pa_xfree(i->ports[j]->profiles);
+            pa_xfree(i->ports[j]->profiles2);
+            pa_xfree(i->ports[j]);
+        }
+
+        pa_xfree(i->ports);
+    }
+
+    pa_xfree(i);
+}
+
+static void sink_cb(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    entry_fetched(userdata, i ? sink_info_copy(i) : NULL, eol);
+}
+
+static void sink_list_cb(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    list_fetched(userdata, PA_SUBSCRIPTION_EVENT_SINK, i ? i->index : PA_INVALID_INDEX, i ? sink_info_copy(i) : NULL, eol);
+}
+
+static pa_operation *sink_fetch(pa_context *c, uint32_t idx, struct entry *e) {
+    return pa_context_get_sink_info_by_index(c, idx, sink_cb, e);
+}
+
+static pa_operation *sink_fetch_list(pa_context *c, pa_cache *cache) {
+    return pa_context_get_sink_info_list(c, sink_list_cb, cache);
+}
+
+static void source_cb(pa_context *c, const pa_source_info *i, int eol, void *userdata) {
+    entry_fetched(userdata, i ? source_info_copy(i) : NULL, eol);
+}
+
+static void source_list_cb(pa_context *c, const pa_source_info *i, int eol, void *userdata) {
+    list_fetched(userdata, PA_SUBSCRIPTION_EVENT_SOURCE, i ? i->index : PA_INVALID_INDEX, i ? source_info_copy(i) : NULL, eol);
+}
+
+static pa_operation *source_fetch(pa_context *c, uint32_t idx, struct entry *e) {
+    return pa_context_get_source_info_by_index(c, idx, source_cb, e);
+}
+
+static pa_operation *source_fetch_list(pa_context *c, pa_cache *cache) {
+    return pa_context_get_source_info_list(c, source_list_cb, cache);
+}
+
+static void sink_input_cb(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata) {
+    entry_fetched(userdata, i ? sink_input_info_copy(i) : NULL, eol);
+}
+
+static void sink_input_list_cb(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata) {
+    list_fetched(userdata, PA_SUBSCRIPTION_EVENT_SINK_INPUT, i ? i->index : PA_INVALID_INDEX, i ? sink_input_info_copy(i) : NULL, eol);
+}
+
+static pa_operation *sink_input_fetch(pa_context *c, uint32_t idx, struct entry *e) {
+    return pa_context_get_sink_input_info(c, idx, sink_input_cb, e);
+}
+
+static pa_operation *sink_input_fetch_list(pa_context *c, pa_cache *cache) {
+    return pa_context_get_sink_input_info_list(c, sink_input_list_cb, cache);
+}
+
+static void source_output_cb(pa_context *c, const pa_source_output_info *i, int eol, void *userdata) {
+    entry_fetched(userdata, i ? source_output_info_copy(i) : NULL, eol);
+}
+
+static void source_output_list_cb(pa_context *c, const pa_source_output_info *i, int eol, void *userdata) {
+    list_fetched(userdata, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT, i ? i->index : PA_INVALID_INDEX, i ? source_output_info_copy(i) : NULL, eol);
+}
+
+static pa_operation *source_output_fetch(pa_context *c, uint32_t idx, struct entry *e) {
+    return pa_context_get_source_output_info(c, idx, source_output_cb, e);
+}
+
+static pa_operation *source_output_fetch_list(pa_context *c, pa_cache *cache) {
+    return pa_context_get_source_output_info_list(c, source_output_list_cb, cache);
+}
+
+static void client_cb(pa_context *c, const pa_client_info *i, int eol, void *userdata) {
+    entry_fetched(userdata, i ? client_info_copy(i) : NULL, eol);
+}
+
+static void client_list_cb(pa_context *c, const pa_client_info *i, int eol, void *userdata) {
+    list_fetched(userdata, PA_SUBSCRIPTION_EVENT_CLIENT, i ? i->index : PA_INVALID_INDEX, i ? client_info_copy(i) : NULL, eol);
+}
+
+static pa_operation *client_fetch(pa_context *c, uint32_t idx, struct entry *e) {
+    return pa_context_get_client_info(c, idx, client_cb, e);
+}
+
+static pa_operation *client_fetch_list(pa_context *c, pa_cache *cache) {
+    return pa_context_get_client_info_list(c, client_list_cb, cache);
+}
+
+static void card_cb(pa_context *c, const pa_card_info *i, int eol, void *userdata) {
+    entry_fetched(userdata, i ? card_info_copy(i) : NULL, eol);
+}
+
+static void card_list_cb(pa_context *c, const pa_card_info *i, int eol, void *userdata) {
+    list_fetched(userdata, PA_SUBSCRIPTION_EVENT_CARD, i ? i->index : PA_INVALID_INDEX, i ? card_info_copy(i) : NULL, eol);
+}
+
+static pa_operation *card_fetch(pa_context *c, uint32_t idx, struct entry *e) {
+    return pa_context_get_card_info_by_index(c, idx, card_cb, e);
+}
+
+static pa_operation *card_fetch_list(pa_context *c, pa_cache *cache) {
+    return pa_context_get_card_info_list(c, card_list_cb, cache);
+}
+
+static const struct kind kinds[N_FACILITIES] = {
+    [PA_SUBSCRIPTION_EVENT_SINK] = { sink_fetch, sink_fetch_list, sink_info_free },
+    [PA_SUBSCRIPTION_EVENT_SOURCE] = { source_fetch, source_fetch_list, source_info_free },
+    [PA_SUBSCRIPTION_EVENT_SINK_INPUT] = { sink_input_fetch, sink_input_fetch_list, sink_input_info_free },
+    [PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT] = { source_output_fetch, source_output_fetch_list, source_output_info_free },
+    [PA_SUBSCRIPTION_EVENT_CLIENT] = { client_fetch, client_fetch_list, client_info_free },
+    [PA_SUBSCRIPTION_EVENT_CARD] = { card_fetch, card_fetch_list, card_info_free },
+};
+
+pa_cache *pa_cache_new(pa_context *c, pa_subscription_mask_t mask) {
+    pa_cache *cache;
+    unsigned f;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, mask != 0 && !(mask & ~CACHEABLE_MASK), PA_ERR_INVALID);
+
+    cache = pa_xnew0(pa_cache, 1);
+    cache->context = pa_context_ref(c);
+    cache->mask = mask;
+
+    PA_LLIST_PREPEND(pa_cache, c->caches, cache);
+
+    /* Subscribe before fetching the lists, so that no change falls
+     * between the two */
+    pa_context_update_subscription(c);
+
+    for (f = 0; f < N_FACILITIES; f++) {
+        if (!kinds[f].fetch)
+            continue;
+
+        cache->entries[f] = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL, (pa_free_cb_t) entry_free);
+
+        if (!pa_subscription_match_flags(mask, f))
+            continue;
+
+        cache->list_operations[f] = kinds[f].fetch_list(c, cache);
+        cache->n_lists_pending++;
+    }
+
+    return cache;
+}
+
+void pa_cache_free(pa_cache *cache) {
+    unsigned f;
+
+    pa_assert(cache);
+
+    PA_LLIST_REMOVE(pa_cache, cache->context->caches, cache);
+    pa_context_update_subscription(cache->context);
+
+    for (f = 0; f < N_FACILITIES; f++) {
+        if (cache->list_operations[f]) {
+            pa_operation_cancel(cache->list_operations[f]);
+            pa_operation_unref(cache->list_operations[f]);
+        }
+
+        if (cache->entries[f])
+            pa_hashmap_free(cache->entries[f]);
+    }
+
+    pa_context_unref(cache->context);
+    pa_xfree(cache);
+}
+
+void pa_cache_set_notify_callback(pa_cache *cache, pa_cache_notify_cb_t cb, void *userdata) {
+    pa_assert(cache);
+
+    cache->notify_callback = cb;
+    cache->notify_userdata = userdata;
+}
+
+int pa_cache_is_ready(const pa_cache *cache) {
+    pa_assert(cache);
+
+    return cache->n_lists_pending == 0;
+}
+
+pa_context *pa_cache_get_context(const pa_cache *cache) {
+    pa_assert(cache);
+
+    return cache->context;
+}
+
+pa_subscription_mask_t pa_cache_get_subscription_mask(pa_context *c) {
+    pa_subscription_mask_t mask = 0;
+    pa_cache *cache;
+
+    pa_assert(c);
+
+    PA_LLIST_FOREACH(cache, c->caches)
+        mask |= cache->mask;
+
+    return mask;
+}
+
+static void handle_event(pa_cache *cache, pa_subscription_event_type_t t, uint32_t idx) {
+    pa_subscription_event_type_t facility = t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+    struct entry *e;
+
+    if (!pa_subscription_match_flags(cache->mask, t))
+        return;
+
+    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+        if ((e = pa_hashmap_get(cache->entries[facility], PA_UINT32_TO_PTR(idx))))
+            entry_remove(e);
+
+        return;
+    }
+
+    e = entry_get(cache, facility, idx);
+
+    /* A fetch that was sent before the change might miss it */
+    if (e->operation)
+        e->refetch = true;
+    else
+        entry_fetch(e);
+}
+
+void pa_cache_handle_event(pa_context *c, pa_subscription_event_type_t t, uint32_t idx) {
+    pa_cache *cache, *n;
+
+    pa_assert(c);
+
+    PA_LLIST_FOREACH_SAFE(cache, n, c->caches)
+        handle_event(cache, t, idx);
+}
+
+static const void *get(pa_cache *cache, pa_subscription_event_type_t facility, uint32_t idx) {
+    struct entry *e;
+
+    pa_assert(cache);
+
+    if (!cache->entries[facility] || !(e = pa_hashmap_get(cache->entries[facility], PA_UINT32_TO_PTR(idx))))
+        return NULL;
+
+    return e->info;
+}
+
+static const void *iterate(pa_cache *cache, pa_subscription_event_type_t facility, void **state) {
+    struct entry *e;
+
+    pa_assert(cache);
+    pa_assert(state);
+
+    if (!cache->entries[facility])
+        return NULL;
+
+    /* Skip the objects that are still being fetched for the first time */
+    while ((e = pa_hashmap_iterate(cache->entries[facility], state, NULL)))
+        if (e->info)
+            return e->info;
+
+    return NULL;
+}
+
+const pa_sink_info *pa_cache_get_sink(pa_cache *cache, uint32_t idx) {
+    return get(cache, PA_SUBSCRIPTION_EVENT_SINK, idx);
+}
+
+const pa_sink_info *pa_cache_get_sink_by_name(pa_cache *cache, const char *name) {
+    const pa_sink_info *i;
+    void *state = NULL;
+
+    pa_assert(name);
+
+    while ((i = pa_cache_iterate_sinks(cache, &state)))
+        if (pa_streq(i->name, name))
+            return i;
+
+    return NULL;
+}
+
+const pa_sink_info *pa_cache_iterate_sinks(pa_cache *cache, void **state) {
+    return iterate(cache, PA_SUBSCRIPTION_EVENT_SINK, state);
+}
+
+const pa_source_info *pa_cache_get_source(pa_cache *cache, uint32_t idx) {
+    return get(cache, PA_SUBSCRIPTION_EVENT_SOURCE, idx);
+}
+
+const pa_source_info *pa_cache_get_source_by_name(pa_cache *cache, const char *name) {
+    const pa_source_info *i;
+    void *state = NULL;
+
+    pa_assert(name);
+
+    while ((i = pa_cache_iterate_sources(cache, &state)))
+        if (pa_streq(i->name, name))
+            return i;
+
+    return NULL;
+}
+
+const pa_source_info *pa_cache_iterate_sources(pa_cache *cache, void **state) {
+    return iterate(cache, PA_SUBSCRIPTION_EVENT_SOURCE, state);
+}
+
+const pa_sink_input_info *pa_cache_get_sink_input(pa_cache *cache, uint32_t idx) {
+    return get(cache, PA_SUBSCRIPTION_EVENT_SINK_INPUT, idx);
+}
+
+const pa_sink_input_info *pa_cache_iterate_sink_inputs(pa_cache *cache, void **state) {
+    return iterate(cache, PA_SUBSCRIPTION_EVENT_SINK_INPUT, state);
+}
+
+const pa_source_output_info *pa_cache_get_source_output(pa_cache *cache, uint32_t idx) {
+    return get(cache, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT, idx);
+}
+
+const pa_source_output_info *pa_cache_iterate_source_outputs(pa_cache *cache, void **state) {
+    return iterate(cache, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT, state);
+}
+
+const pa_client_info *pa_cache_get_client(pa_cache *cache, uint32_t idx) {
+    return get(cache, PA_SUBSCRIPTION_EVENT_CLIENT, idx);
+}
+
+const pa_client_info *pa_cache_iterate_clients(pa_cache *cache, void **state) {
+    return iterate(cache, PA_SUBSCRIPTION_EVENT_CLIENT, state);
+}
+
+const pa_card_info *pa_cache_get_card(pa_cache *cache, uint32_t idx) {
+    return get(cache, PA_SUBSCRIPTION_EVENT_CARD, idx);
+}
+
+const pa_card_info *pa_cache_get_card_by_name(pa_cache *cache, const char *name) {
+    const pa_card_info *i;
+    void *state = NULL;
+
+    pa_assert(name);
+
+    while ((i = pa_cache_iterate_cards(cache, &state)))
+        if (pa_streq(i->name, name))
+            return i;
+
+    return NULL;
+}
+
+const pa_card_info *pa_cache_iterate_cards(pa_cache *cache, void **state) {
+    return iterate(cache, PA_SUBSCRIPTION_EVENT_CARD, state);
+}
@@ -0,0 +1,132 @@
+#ifndef foopulsecachehfoo
+#define foopulsecachehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulse/cdecl.h>
+#include <pulse/context.h>
+#include <pulse/def.h>
+#include <pulse/introspect.h>
+#include <pulse/version.h>
+
+/** \file
+ *
+ * A local copy of the objects of the server, kept up to date with
+ * subscription events.
+ *
+ * \section cache_sec Object Cache
+ *
+ * Applications that show the state of the server, like volume
+ * controls, usually subscribe to events and fetch the object of every
+ * event they get. A #pa_cache does this for them: it fetches all objects
+ * of the facilities it is created for, and then fetches again only the
+ * objects that the server reports changed. The objects can be looked up
+ * at any time without a round trip to the server.
+ *
+ * The cache subscribes to the events it needs on its own, in addition to
+ * whatever the application subscribed to with pa_context_subscribe().
+ * The subscription callback of the context still only gets the
+ * events the application subscribed to.
+ *
+ * Fields that change all the time without an event being sent, like
+ * latencies, are only as recent as the last fetch of their object.
+ *
+ * Pointers returned by the cache are valid until the next time the
+ * main loop runs.
+ */
+
+PA_C_DECL_BEGIN
+
+/** An object cache. \since 12.0 */
+typedef struct pa_cache pa_cache;
+
+/** Called after an object in the cache was added, changed or removed.
+ * t is the facility and the type of the change, like a subscription
+ * event. The callback is called once more with t set to 0 and idx set
+ * to PA_INVALID_INDEX, when the cache has fetched all objects for the
+ * first time. \since 12.0 */
+typedef void (*pa_cache_notify_cb_t)(pa_cache *cache, pa_subscription_event_type_t t, uint32_t idx, void *userdata);
+
+/** Create a cache of the objects of the facilities in mask. Only sinks,
+ * sources, sink inputs, source outputs, clients and cards can be
+ * cached. The context has to be ready. \since 12.0 */
+pa_cache *pa_cache_new(pa_context *c, pa_subscription_mask_t mask);
+
+/** Free a cache. \since 12.0 */
+void pa_cache_free(pa_cache *cache);
+
+/** Set the callback that is called when the contents of the cache
+ * change. \since 12.0 */
+void pa_cache_set_notify_callback(pa_cache *cache, pa_cache_notify_cb_t cb, void *userdata);
+
+/** Return non-zero once the cache has fetched all objects for the first
+ * time. \since 12.0 */
+int pa_cache_is_ready(const pa_cache *cache);
+
+/** Return the context of the cache. \since 12.0 */
+pa_context *pa_cache_get_context(const pa_cache *cache);
+
+/** Look up a sink, NULL if there is none. \since 12.0 */
+const pa_sink_info *pa_cache_get_sink(pa_cache *cache, uint32_t idx);
+
+/** Look up a sink by its name. \since 12.0 */
+const pa_sink_info *pa_cache_get_sink_by_name(pa_cache *cache, const char *name);
+
+/** Iterate through the sinks. state has to point to a NULL pointer
+ * before the first call. Returns NULL after the last sink. \since 12.0 */
+const pa_sink_info *pa_cache_iterate_sinks(pa_cache *cache, void **state);
+
+/** Look up a source, NULL if there is none. \since 12.0 */
+const pa_source_info *pa_cache_get_source(pa_cache *cache, uint32_t idx);
+
+/** Look up a source by its name. \since 12.0 */
+const pa_source_info *pa_cache_get_source_by_name(pa_cache *cache, const char *name);
+
+/** Iterate through the sources, like pa_cache_iterate_sinks(). \since 12.0 */
+const pa_source_info *pa_cache_iterate_sources(pa_cache *cache, void **state);
+
+/** Look up a sink input, NULL if there is none. \since 12.0 */
+const pa_sink_input_info *pa_cache_get_sink_input(pa_cache *cache, uint32_t idx);
+
+/** Iterate through the sink inputs, like pa_cache_iterate_sinks(). \since 12.0 */
+const pa_sink_input_info *pa_cache_iterate_sink_inputs(pa_cache *cache, void **state);
+
+/** Look up a source output, NULL if there is none. \since 12.0 */
+const pa_source_output_info *pa_cache_get_source_output(pa_cache *cache, uint32_t idx);
+
+/** Iterate through the source outputs, like pa_cache_iterate_sinks(). \since 12.0 */
+const pa_source_output_info *pa_cache_iterate_source_outputs(pa_cache *cache, void **state);
+
+/** Look up a client, NULL if there is none. \since 12.0 */
+const pa_client_info *pa_cache_get_client(pa_cache *cache, uint32_t idx);
+
+/** Iterate through the clients, like pa_cache_iterate_sinks(). \since 12.0 */
+const pa_client_info *pa_cache_iterate_clients(pa_cache *cache, void **state);
+
+/** Look up a card, NULL if there is none. \since 12.0 */
+const pa_card_info *pa_cache_get_card(pa_cache *cache, uint32_t idx);
+
+/** Look up a card by its name. \since 12.0 */
+const pa_card_info *pa_cache_get_card_by_name(pa_cache *cache, const char *name);
+
+/** Iterate through the cards, like pa_cache_iterate_sinks(). \since 12.0 */
+const pa_card_info *pa_cache_iterate_cards(pa_cache *cache, void **state);
+
+PA_C_DECL_END
+
+#endif
@@ -61,6 +61,7 @@
 #include <pulsecore/socket.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
 #include <pulsecore/proplist-util.h>
 
 #include "internal.h"
@@ -103,6 +104,108 @@ pa_context *pa_context_new(pa_mainloop_api *mainloop, const char *name) {
     return pa_context_new_with_proplist(mainloop, name, NULL);
 }
 
+/* Applications tend to open lots of short lived contexts, so all contexts
+ * of the process share one memory pool instead of mapping (and, for memfd,
+ * registering) a new one each time. The pool is created as a "global" one,
+ * which keeps its memfd open, so that it can be registered with every
+ * connection the process makes. It is only shared within this process:
+ * pa_context_new() refuses to work in a forked child. */
+static pa_static_mutex shared_mempool_mutex = PA_STATIC_MUTEX_INIT;
+static pa_mempool *shared_mempool = NULL;
+static pa_mem_type_t shared_mempool_type;
+static size_t shared_mempool_size;
+static unsigned shared_mempool_users = 0;
+
+static pa_mempool *shared_mempool_get(pa_mem_type_t type, size_t size) {
+    pa_mutex *m;
+    pa_mempool *pool = NULL;
+
+    m = pa_static_mutex_get(&shared_mempool_mutex, false, false);
+    pa_mutex_lock(m);
+
+    if (shared_mempool) {
+        if (shared_mempool_type == type && shared_mempool_size == size) {
+            pool = pa_mempool_ref(shared_mempool);
+            shared_mempool_users++;
+        }
+
+    } else if ((pool = pa_mempool_new(type, size, false))) {
+        shared_mempool = pool;
+        shared_mempool_type = type;
+        shared_mempool_size = size;
+        shared_mempool_users = 1;
+        pa_mempool_ref(pool);
+    }
+
+    pa_mutex_unlock(m);
+
+    /* A context with a different configuration than the first one gets a
+     * pool of its own */
+    if (!pool)
+        pool = pa_mempool_new(type, size, true);
+
+    return pool;
+}
+
+static void shared_mempool_put(pa_mempool *pool) {
+    pa_mutex *m;
+
+    m = pa_static_mutex_get(&shared_mempool_mutex, false, false);
+    pa_mutex_lock(m);
+
+    if (pool == shared_mempool && --shared_mempool_users == 0) {
+        pa_mempool_unref(shared_mempool);
+        shared_mempool = NULL;
+    }
+
+    pa_mutex_unlock(m);
+
+    pa_mempool_unref(pool);
+}
+
+/* The server the last context of this process got ready on, and the
+ * protocol version it spoke. A new context tries that server first, and
+ * since it knows the version the server will answer with, it can send its
+ * name along with the auth request instead of waiting a round trip. */
+static pa_static_mutex last_server_mutex = PA_STATIC_MUTEX_INIT;
+static char *last_server = NULL;
+static uint32_t last_server_version = 0;
+
+static char *last_server_dup(uint32_t *version) {
+    pa_mutex *m;
+    char *server = NULL;
+
+    m = pa_static_mutex_get(&last_server_mutex, false, false);
+    pa_mutex_lock(m);
+
+    if (last_server) {
+        server = pa_xstrdup(last_server);
+        if (version)
+            *version = last_server_version;
+    }
+
+    pa_mutex_unlock(m);
+
+    return server;
+}
+
+static void last_server_set(const char *server, uint32_t version) {
+    pa_mutex *m;
+
+    pa_assert(server);
+
+    m = pa_static_mutex_get(&last_server_mutex, false, false);
+    pa_mutex_lock(m);
+
+    if (!pa_safe_streq(last_server, server)) {
+        pa_xfree(last_server);
+        last_server = pa_xstrdup(server);
+    }
+    last_server_version = version;
+
+    pa_mutex_unlock(m);
+}
+
 static void reset_callbacks(pa_context *c) {
     pa_assert(c);
 
@@ -155,6 +258,7 @@ pa_context *pa_context_new_with_proplist(pa_mainloop_api *mainloop, const char *
 
     PA_LLIST_HEAD_INIT(pa_stream, c->streams);
     PA_LLIST_HEAD_INIT(pa_operation, c->operations);
+    PA_LLIST_HEAD_INIT(pa_cache, c->caches);
 
     c->error = PA_OK;
     c->state = PA_CONTEXT_UNCONNECTED;
@@ -179,11 +283,11 @@ pa_context *pa_context_new_with_proplist(pa_mainloop_api *mainloop, const char *
            ((!c->memfd_on_local) ?
                PA_MEM_TYPE_SHARED_POSIX : PA_MEM_TYPE_SHARED_MEMFD);
 
-    if (!(c->mempool = pa_mempool_new(type, c->conf->shm_size, true))) {
+    if (!(c->mempool = shared_mempool_get(type, c->conf->shm_size))) {
 
         if (!c->conf->disable_shm) {
             pa_log_warn("Failed to allocate shared memory pool. Falling back to a normal private one.");
-            c->mempool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, c->conf->shm_size, true);
+            c->mempool = shared_mempool_get(PA_MEM_TYPE_PRIVATE, c->conf->shm_size);
         }
 
         if (!c->mempool) {
@@ -227,6 +331,11 @@ static void context_unlink(pa_context *c) {
         c->srb_template.memblock = NULL;
     }
 
+    if (c->meter_page) {
+        pa_memblock_unref(c->meter_page);
+        c->meter_page = NULL;
+    }
+
     if (c->client) {
         pa_socket_client_unref(c->client);
         c->client = NULL;
@@ -260,7 +369,7 @@ static void context_free(pa_context *c) {
         pa_hashmap_free(c->playback_streams);
 
     if (c->mempool)
-        pa_mempool_unref(c->mempool);
+        shared_mempool_put(c->mempool);
 
     if (c->conf)
         pa_client_conf_free(c->conf);
@@ -425,6 +534,22 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
             if ((l = pa_memblockq_get_length(s->record_memblockq)) > 0)
                 s->read_callback(s, l, s->read_userdata);
         }
+
+    } else if (chunk->memblock && chunk->index == 0 &&
+               (s = pa_hashmap_get(c->playback_streams, PA_UINT32_TO_PTR(channel)))) {
+
+        /* The only blocks a server sends on a playback channel, told
+         * apart by the offset */
+        if (offset == PA_NATIVE_DATA_RING_OFFSET)
+            pa_stream_set_data_ring(s, chunk->memblock, chunk->length);
+        else
+            pa_stream_set_timing_page(s, chunk->memblock, chunk->length);
+
+    } else if (channel == PA_NATIVE_METER_CHANNEL && chunk->memblock && chunk->index == 0) {
+
+        /* Like the timing page, a copy would never change */
+        if (!c->meter_page && chunk->length >= sizeof(pa_native_meter_page) && !pa_memblock_is_ours(chunk->memblock))
+            c->meter_page = pa_memblock_ref(chunk->memblock);
     }
 
     pa_context_unref(c);
@@ -469,6 +594,26 @@ int pa_context_handle_error(pa_context *c, uint32_t command, pa_tagstruct *t, bo
     return 0;
 }
 
+static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+
+static void send_client_name(pa_context *c, uint32_t version) {
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(c);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_SET_CLIENT_NAME, &tag);
+
+    if (version >= 13) {
+        pa_init_proplist(c->proplist);
+        pa_tagstruct_put_proplist(t, c->proplist);
+    } else
+        pa_tagstruct_puts(t, pa_proplist_gets(c->proplist, PA_PROP_APPLICATION_NAME));
+
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, setup_complete_callback, c, NULL);
+}
+
 static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_context *c = userdata;
 
@@ -485,7 +630,6 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
 
     switch(c->state) {
         case PA_CONTEXT_AUTHORIZING: {
-            pa_tagstruct *reply;
             bool shm_on_remote = false;
             bool memfd_on_remote = false;
 
@@ -540,6 +684,9 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
             pa_log_debug("Negotiated SHM: %s", pa_yes_no(c->do_shm));
             pa_pstream_enable_shm(c->pstream, c->do_shm);
 
+            if (c->do_shm && c->version >= 33)
+                pa_pstream_set_max_exports(c->pstream, PA_MEMEXPORT_SLOTS_MAX);
+
             c->shm_type = PA_MEM_TYPE_PRIVATE;
             if (c->do_shm) {
                 if (c->version >= 31 && memfd_on_remote && c->memfd_on_local) {
@@ -560,16 +707,10 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
             pa_log_debug("Memfd possible: %s", pa_yes_no(c->memfd_on_local));
             pa_log_debug("Negotiated SHM type: %s", pa_mem_type_to_string(c->shm_type));
 
-            reply = pa_tagstruct_command(c, PA_COMMAND_SET_CLIENT_NAME, &tag);
-
-            if (c->version >= 13) {
-                pa_init_proplist(c->proplist);
-                pa_tagstruct_put_proplist(reply, c->proplist);
-            } else
-                pa_tagstruct_puts(reply, pa_proplist_gets(c->proplist, PA_PROP_APPLICATION_NAME));
-
-            pa_pstream_send_tagstruct(c->pstream, reply);
-            pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, setup_complete_callback, c, NULL);
+            /* The name was sent right after the auth request already if
+             * we knew the server */
+            if (!c->name_pipelined)
+                send_client_name(c, c->version);
 
             pa_context_set_state(c, PA_CONTEXT_SETTING_NAME);
             break;
@@ -584,6 +725,11 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
                 goto finish;
             }
 
+            /* Only servers we found on our own are worth trying first for
+             * other contexts */
+            if (!c->server_specified)
+                last_server_set(c->server, c->version);
+
             pa_context_set_state(c, PA_CONTEXT_READY);
             break;
 
@@ -599,6 +745,8 @@ static void setup_context(pa_context *c, pa_iochannel *io) {
     uint8_t cookie[PA_NATIVE_COOKIE_LENGTH];
     pa_tagstruct *t;
     uint32_t tag;
+    char *last;
+    uint32_t last_version = 0;
 
     pa_assert(c);
     pa_assert(io);
@@ -651,6 +799,17 @@ static void setup_context(pa_context *c, pa_iochannel *io) {
 
     pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, setup_complete_callback, c, NULL);
 
+    /* The server handles the auth request synchronously, so a name sent
+     * right behind it is processed as if we had waited for the reply */
+    c->name_pipelined = false;
+    if (c->server && (last = last_server_dup(&last_version))) {
+        if (pa_streq(last, c->server) && last_version >= 13) {
+            send_client_name(c, last_version);
+            c->name_pipelined = true;
+        }
+        pa_xfree(last);
+    }
+
     pa_context_set_state(c, PA_CONTEXT_AUTHORIZING);
 
     pa_context_unref(c);
@@ -1021,6 +1180,13 @@ int pa_context_connect(
 
         /* The user instance via PF_LOCAL */
         c->server_list = prepend_per_user(c->server_list);
+
+        /* Whatever worked for the last context comes first */
+        if ((d = last_server_dup(NULL))) {
+            c->server_list = pa_strlist_remove(c->server_list, d);
+            c->server_list = pa_strlist_prepend(c->server_list, d);
+            pa_xfree(d);
+        }
     }
 
     /* Set up autospawning */
@@ -1632,6 +1798,65 @@ size_t pa_context_get_tile_size(pa_context *c, const pa_sample_spec *ss) {
     return PA_MAX(mbs, fs);
 }
 
+pa_pool_buffer* pa_context_new_pool_buffer(pa_context *c, size_t *nbytes) {
+    pa_pool_buffer *b;
+    size_t m;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, nbytes && *nbytes != 0, PA_ERR_INVALID);
+
+    m = pa_mempool_block_size_max(c->mempool);
+    if (*nbytes > m)
+        *nbytes = m;
+
+    b = pa_xnew(pa_pool_buffer, 1);
+    PA_REFCNT_INIT(b);
+    b->memblock = pa_memblock_new(c->mempool, *nbytes);
+    b->data = pa_memblock_acquire(b->memblock);
+
+    *nbytes = pa_memblock_get_length(b->memblock);
+
+    return b;
+}
+
+pa_pool_buffer* pa_pool_buffer_ref(pa_pool_buffer *b) {
+    pa_assert(b);
+    pa_assert(PA_REFCNT_VALUE(b) >= 1);
+
+    PA_REFCNT_INC(b);
+    return b;
+}
+
+void pa_pool_buffer_unref(pa_pool_buffer *b) {
+    pa_assert(b);
+    pa_assert(PA_REFCNT_VALUE(b) >= 1);
+
+    if (PA_REFCNT_DEC(b) > 0)
+        return;
+
+    /* Pending writes hold references of their own to the memblock */
+    pa_memblock_release(b->memblock);
+    pa_memblock_unref(b->memblock);
+    pa_xfree(b);
+}
+
+void* pa_pool_buffer_get_data(pa_pool_buffer *b) {
+    pa_assert(b);
+    pa_assert(PA_REFCNT_VALUE(b) >= 1);
+
+    return b->data;
+}
+
+size_t pa_pool_buffer_get_size(pa_pool_buffer *b) {
+    pa_assert(b);
+    pa_assert(PA_REFCNT_VALUE(b) >= 1);
+
+    return pa_memblock_get_length(b->memblock);
+}
+
 int pa_context_load_cookie_from_file(pa_context *c, const char *cookie_file_path) {
     pa_assert(c);
     pa_assert(PA_REFCNT_VALUE(c) >= 1);
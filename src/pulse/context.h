@@ -153,6 +153,10 @@ PA_C_DECL_BEGIN
 /** An opaque connection context to a daemon */
 typedef struct pa_context pa_context;
 
+/** An opaque buffer allocated from the memory pool of a context, see
+ * pa_context_new_pool_buffer(). \since 12.0 */
+typedef struct pa_pool_buffer pa_pool_buffer;
+
 /** Generic notification callback prototype */
 typedef void (*pa_context_notify_cb_t)(pa_context *c, void *userdata);
 
@@ -286,6 +290,37 @@ size_t pa_context_get_tile_size(pa_context *c, const pa_sample_spec *ss);
  * location, feel free to use this function. \since 5.0 */
 int pa_context_load_cookie_from_file(pa_context *c, const char *cookie_file_path);
 
+/** Allocate a buffer from the memory pool of the context, which is
+ * shared with the server if the connection permits it. Audio placed
+ * in it can be passed to pa_stream_write_pool_buffer() without being
+ * copied, which makes this useful for decoding directly into
+ * PulseAudio memory. Any number of these buffers may be allocated,
+ * filled and written in any order, and they may be used with any
+ * stream of the context.
+ *
+ * Place the size you want in \a *nbytes, or (size_t) -1 for the tile
+ * size. On return \a *nbytes contains the actual size, which may be
+ * smaller. Returns NULL on failure. Release the buffer with
+ * pa_pool_buffer_unref(). \since 12.0 */
+pa_pool_buffer* pa_context_new_pool_buffer(pa_context *c, size_t *nbytes);
+
+/** Increase the reference count of the buffer by one. \since 12.0 */
+pa_pool_buffer* pa_pool_buffer_ref(pa_pool_buffer *b);
+
+/** Decrease the reference count of the buffer by one. The memory is
+ * returned to the pool once neither the application nor any pending
+ * write refers to it anymore. \since 12.0 */
+void pa_pool_buffer_unref(pa_pool_buffer *b);
+
+/** Return a pointer to the memory of the buffer. It stays valid for as
+ * long as the application holds a reference. Parts of it that have
+ * been passed to pa_stream_write_pool_buffer() must not be modified
+ * anymore. \since 12.0 */
+void* pa_pool_buffer_get_data(pa_pool_buffer *b);
+
+/** Return the size of the buffer in bytes. \since 12.0 */
+size_t pa_pool_buffer_get_size(pa_pool_buffer *b);
+
 PA_C_DECL_END
 
 #endif
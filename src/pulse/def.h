@@ -152,6 +152,58 @@ typedef enum pa_device_type {
 #define PA_DEVICE_TYPE_SOURCE PA_DEVICE_TYPE_SOURCE
 /** \endcond */
 
+/** What caused an xrun event. \since 12.0 */
+typedef enum pa_xrun_cause {
+    PA_XRUN_CAUSE_HW_UNDERRUN,
+    /**< The playback device ran out of data */
+
+    PA_XRUN_CAUSE_HW_OVERRUN,
+    /**< The capture device ran out of buffer space */
+
+    PA_XRUN_CAUSE_CLIENT_UNDERRUN,
+    /**< A playback stream ran out of data */
+
+    PA_XRUN_CAUSE_REWIND
+    /**< The playback device ran out of data right after a rewind */
+} pa_xrun_cause_t;
+
+/** \cond fulldocs */
+#define PA_XRUN_CAUSE_HW_UNDERRUN PA_XRUN_CAUSE_HW_UNDERRUN
+#define PA_XRUN_CAUSE_HW_OVERRUN PA_XRUN_CAUSE_HW_OVERRUN
+#define PA_XRUN_CAUSE_CLIENT_UNDERRUN PA_XRUN_CAUSE_CLIENT_UNDERRUN
+#define PA_XRUN_CAUSE_REWIND PA_XRUN_CAUSE_REWIND
+/** \endcond */
+
+/** Fields of pa_sink_input_info that pa_context_get_sink_input_info_list_filtered()
+ * can be asked for. The index is always filled in. \since 12.0 */
+typedef enum pa_sink_input_info_field {
+    PA_SINK_INPUT_INFO_FIELD_NAME = 0x0001U,        /**< name */
+    PA_SINK_INPUT_INFO_FIELD_OWNER = 0x0002U,       /**< owner_module and client */
+    PA_SINK_INPUT_INFO_FIELD_SINK = 0x0004U,        /**< sink */
+    PA_SINK_INPUT_INFO_FIELD_SAMPLE_SPEC = 0x0008U, /**< sample_spec and channel_map */
+    PA_SINK_INPUT_INFO_FIELD_VOLUME = 0x0010U,      /**< volume, mute, has_volume and volume_writable */
+    PA_SINK_INPUT_INFO_FIELD_LATENCY = 0x0020U,     /**< buffer_usec and sink_usec */
+    PA_SINK_INPUT_INFO_FIELD_DRIVER = 0x0040U,      /**< resample_method and driver */
+    PA_SINK_INPUT_INFO_FIELD_CORKED = 0x0080U,      /**< corked */
+    PA_SINK_INPUT_INFO_FIELD_PROPLIST = 0x0100U,    /**< proplist */
+    PA_SINK_INPUT_INFO_FIELD_FORMAT = 0x0200U,      /**< format */
+    PA_SINK_INPUT_INFO_FIELD_ALL = 0x03FFU          /**< All of the above */
+} pa_sink_input_info_field_t;
+
+/** \cond fulldocs */
+#define PA_SINK_INPUT_INFO_FIELD_NAME PA_SINK_INPUT_INFO_FIELD_NAME
+#define PA_SINK_INPUT_INFO_FIELD_OWNER PA_SINK_INPUT_INFO_FIELD_OWNER
+#define PA_SINK_INPUT_INFO_FIELD_SINK PA_SINK_INPUT_INFO_FIELD_SINK
+#define PA_SINK_INPUT_INFO_FIELD_SAMPLE_SPEC PA_SINK_INPUT_INFO_FIELD_SAMPLE_SPEC
+#define PA_SINK_INPUT_INFO_FIELD_VOLUME PA_SINK_INPUT_INFO_FIELD_VOLUME
+#define PA_SINK_INPUT_INFO_FIELD_LATENCY PA_SINK_INPUT_INFO_FIELD_LATENCY
+#define PA_SINK_INPUT_INFO_FIELD_DRIVER PA_SINK_INPUT_INFO_FIELD_DRIVER
+#define PA_SINK_INPUT_INFO_FIELD_CORKED PA_SINK_INPUT_INFO_FIELD_CORKED
+#define PA_SINK_INPUT_INFO_FIELD_PROPLIST PA_SINK_INPUT_INFO_FIELD_PROPLIST
+#define PA_SINK_INPUT_INFO_FIELD_FORMAT PA_SINK_INPUT_INFO_FIELD_FORMAT
+#define PA_SINK_INPUT_INFO_FIELD_ALL PA_SINK_INPUT_INFO_FIELD_ALL
+/** \endcond */
+
 /** The direction of a pa_stream object */
 typedef enum pa_stream_direction {
     PA_STREAM_NODIRECTION,   /**< Invalid direction */
@@ -549,7 +601,10 @@ typedef enum pa_subscription_mask {
     PA_SUBSCRIPTION_MASK_CARD = 0x0200U,
     /**< Card events. \since 0.9.15 */
 
-    PA_SUBSCRIPTION_MASK_ALL = 0x02ffU
+    PA_SUBSCRIPTION_MASK_XRUN = 0x0400U,
+    /**< Xrun events. \since 12.0 */
+
+    PA_SUBSCRIPTION_MASK_ALL = 0x06ffU
     /**< Catch all events */
 } pa_subscription_mask_t;
 
@@ -587,6 +642,11 @@ typedef enum pa_subscription_event_type {
     PA_SUBSCRIPTION_EVENT_CARD = 0x0009U,
     /**< Event type: Card \since 0.9.15 */
 
+    PA_SUBSCRIPTION_EVENT_XRUN = 0x000AU,
+    /**< Event type: Xrun, only occurring with PA_SUBSCRIPTION_EVENT_NEW. The
+     * index is the lower 32 bits of the serial of the new event, see
+     * pa_context_get_xrun_event_info_list(). \since 12.0 */
+
     PA_SUBSCRIPTION_EVENT_FACILITY_MASK = 0x000FU,
     /**< A mask to extract the event type from an event value */
 
@@ -619,6 +679,7 @@ typedef enum pa_subscription_event_type {
 #define PA_SUBSCRIPTION_MASK_SERVER PA_SUBSCRIPTION_MASK_SERVER
 #define PA_SUBSCRIPTION_MASK_AUTOLOAD PA_SUBSCRIPTION_MASK_AUTOLOAD
 #define PA_SUBSCRIPTION_MASK_CARD PA_SUBSCRIPTION_MASK_CARD
+#define PA_SUBSCRIPTION_MASK_XRUN PA_SUBSCRIPTION_MASK_XRUN
 #define PA_SUBSCRIPTION_MASK_ALL PA_SUBSCRIPTION_MASK_ALL
 #define PA_SUBSCRIPTION_EVENT_SINK PA_SUBSCRIPTION_EVENT_SINK
 #define PA_SUBSCRIPTION_EVENT_SOURCE PA_SUBSCRIPTION_EVENT_SOURCE
@@ -630,6 +691,7 @@ typedef enum pa_subscription_event_type {
 #define PA_SUBSCRIPTION_EVENT_SERVER PA_SUBSCRIPTION_EVENT_SERVER
 #define PA_SUBSCRIPTION_EVENT_AUTOLOAD PA_SUBSCRIPTION_EVENT_AUTOLOAD
 #define PA_SUBSCRIPTION_EVENT_CARD PA_SUBSCRIPTION_EVENT_CARD
+#define PA_SUBSCRIPTION_EVENT_XRUN PA_SUBSCRIPTION_EVENT_XRUN
 #define PA_SUBSCRIPTION_EVENT_FACILITY_MASK PA_SUBSCRIPTION_EVENT_FACILITY_MASK
 #define PA_SUBSCRIPTION_EVENT_NEW PA_SUBSCRIPTION_EVENT_NEW
 #define PA_SUBSCRIPTION_EVENT_CHANGE PA_SUBSCRIPTION_EVENT_CHANGE
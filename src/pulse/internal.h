@@ -26,6 +26,7 @@
 #include <pulse/stream.h>
 #include <pulse/operation.h>
 #include <pulse/subscribe.h>
+#include <pulse/cache.h>
 #include <pulse/ext-device-manager.h>
 #include <pulse/ext-device-restore.h>
 #include <pulse/ext-stream-restore.h>
@@ -40,6 +41,8 @@
 #include <pulsecore/memblockq.h>
 #include <pulsecore/hashmap.h>
 #include <pulsecore/refcnt.h>
+#include <pulsecore/ringbuffer.h>
+#include <pulsecore/fdsem.h>
 #include <pulsecore/time-smoother.h>
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-util.h>
@@ -76,6 +79,10 @@ struct pa_context {
     pa_hashmap *record_streams, *playback_streams;
     PA_LLIST_HEAD(pa_stream, streams);
     PA_LLIST_HEAD(pa_operation, operations);
+    PA_LLIST_HEAD(pa_cache, caches);
+
+    /* What the application subscribed to, the caches may need more */
+    pa_subscription_mask_t subscribe_mask;
 
     uint32_t version;
     uint32_t ctag;
@@ -92,6 +99,10 @@ struct pa_context {
 
     pa_mempool *mempool;
 
+    /* The levels of our meters, kept up to date by the server in shared
+     * memory, see pa_context_enable_meter() */
+    pa_memblock *meter_page;
+
     bool is_local:1;
     bool do_shm:1;
     bool memfd_on_local:1;
@@ -100,6 +111,7 @@ struct pa_context {
     bool do_autospawn:1;
     bool use_rtclock:1;
     bool filter_added:1;
+    bool name_pipelined:1;
     pa_spawn_api spawn_api;
 
     pa_mem_type_t shm_type;
@@ -139,6 +151,13 @@ typedef struct pa_index_correction {
 
 #define PA_MAX_FORMATS (PA_ENCODING_MAX)
 
+struct pa_pool_buffer {
+    PA_REFCNT_DECLARE;
+
+    pa_memblock *memblock;
+    void *data;
+};
+
 struct pa_stream {
     PA_REFCNT_DECLARE;
     PA_LLIST_FIELDS(pa_stream);
@@ -165,6 +184,7 @@ struct pa_stream {
     bool corked:1;
     bool timing_info_valid:1;
     bool auto_timing_update_requested:1;
+    bool timing_batch_pending:1;
 
     uint32_t channel;
     uint32_t syncid;
@@ -181,11 +201,22 @@ struct pa_stream {
     void *write_data;
     int64_t latest_underrun_at_index;
 
+    /* Filled by the application without the mainloop lock, drained
+     * by write_ring_cb(), see pa_stream_enable_write_ring() */
+    pa_ringbuffer write_ring;
+    pa_atomic_t write_ring_count;
+    pa_fdsem *write_ring_sem;
+    pa_io_event *write_ring_event;
+
     /* recording */
     pa_memchunk peek_memchunk;
     void *peek_data;
     pa_memblockq *record_memblockq;
 
+    /* What pa_stream_peek_fragments() returned, acquired */
+    pa_memchunk *peek_fragments;
+    unsigned n_peek_fragments, n_peek_fragments_allocated;
+
     /* Store latest latency info */
     pa_timing_info timing_info;
 
@@ -203,9 +234,25 @@ struct pa_stream {
     /* Latency interpolation stuff */
     pa_time_event *auto_timing_update_event;
     pa_usec_t auto_timing_interval_usec;
+    pa_usec_t auto_timing_update_at;
 
     pa_smoother *smoother;
 
+    /* Timing data the server keeps up to date for us in shared memory */
+    pa_memblock *timing_page;
+    pa_usec_t timing_page_read_at;
+
+    /* Shared ring for playback data the server's sink thread reads
+     * directly, see data_ring_write(). It may only be used while
+     * data_ring_ok is set, i.e. when nothing we sent over the pstream
+     * could still be overtaken by it. */
+    pa_memblock *data_ring;
+    pa_ringbuffer data_ring_rb;
+    pa_fdsem *data_ring_sem;
+    bool data_ring_ok:1;
+    bool data_ring_syncing:1;
+    bool data_ring_dirty:1;
+
     /* Callbacks */
     pa_stream_notify_cb_t state_callback;
     void *state_userdata;
@@ -253,6 +300,10 @@ struct pa_operation {
 void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_killed(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+void pa_context_update_subscription(pa_context *c);
+
+pa_subscription_mask_t pa_cache_get_subscription_mask(pa_context *c);
+void pa_cache_handle_event(pa_context *c, pa_subscription_event_type_t t, uint32_t idx);
 void pa_command_overflow_or_underflow(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_suspended(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_moved(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
@@ -276,6 +327,8 @@ int pa_context_handle_error(pa_context *c, uint32_t command, pa_tagstruct *t, bo
 pa_operation* pa_context_send_simple_command(pa_context *c, uint32_t command, void (*internal_callback)(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata), void (*cb)(void), void *userdata);
 
 void pa_stream_set_state(pa_stream *s, pa_stream_state_t st);
+void pa_stream_set_timing_page(pa_stream *s, pa_memblock *b, size_t length);
+void pa_stream_set_data_ring(pa_stream *s, pa_memblock *b, size_t length);
 
 pa_tagstruct *pa_tagstruct_command(pa_context *c, uint32_t command, uint32_t *tag);
 
@@ -707,7 +707,10 @@ static void context_get_client_info_callback(pa_pdispatch *pd, uint32_t command,
                 pa_tagstruct_gets(t, &i.name) < 0 ||
                 pa_tagstruct_getu32(t, &i.owner_module) < 0 ||
                 pa_tagstruct_gets(t, &i.driver) < 0 ||
-                (o->context->version >= 13 && pa_tagstruct_get_proplist(t, i.proplist) < 0)) {
+                (o->context->version >= 13 && pa_tagstruct_get_proplist(t, i.proplist) < 0) ||
+                (o->context->version >= 33 &&
+                 (pa_tagstruct_get_usec(t, &i.render_usec) < 0 ||
+                  pa_tagstruct_getu64(t, &i.memory) < 0))) {
 
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
                 pa_proplist_free(i.proplist);
@@ -1285,6 +1288,127 @@ pa_operation* pa_context_get_sink_input_info_list(pa_context *c, void (*cb)(pa_c
     return pa_context_send_simple_command(c, PA_COMMAND_GET_SINK_INPUT_INFO_LIST, context_get_sink_input_info_callback, (pa_operation_cb_t) cb, userdata);
 }
 
+static void context_get_sink_input_info_filtered_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    pa_sink_input_info_field_t fields;
+    uint64_t generation = 0;
+    int eol = 1;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (!o->context)
+        goto finish;
+
+    fields = (pa_sink_input_info_field_t) PA_PTR_TO_UINT(o->private);
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, false) < 0)
+            goto finish;
+
+        eol = -1;
+    } else {
+
+        if (pa_tagstruct_getu64(t, &generation) < 0) {
+            pa_context_fail(o->context, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        while (!pa_tagstruct_eof(t)) {
+            pa_sink_input_info i;
+            bool mute = false, corked = false, has_volume = false, volume_writable = false;
+
+            pa_zero(i);
+            i.proplist = pa_proplist_new();
+            i.format = pa_format_info_new();
+
+            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_NAME) &&
+                 pa_tagstruct_gets(t, &i.name) < 0) ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_OWNER) &&
+                 (pa_tagstruct_getu32(t, &i.owner_module) < 0 ||
+                  pa_tagstruct_getu32(t, &i.client) < 0)) ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_SINK) &&
+                 pa_tagstruct_getu32(t, &i.sink) < 0) ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_SAMPLE_SPEC) &&
+                 (pa_tagstruct_get_sample_spec(t, &i.sample_spec) < 0 ||
+                  pa_tagstruct_get_channel_map(t, &i.channel_map) < 0)) ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_VOLUME) &&
+                 (pa_tagstruct_get_cvolume(t, &i.volume) < 0 ||
+                  pa_tagstruct_get_boolean(t, &mute) < 0 ||
+                  pa_tagstruct_get_boolean(t, &has_volume) < 0 ||
+                  pa_tagstruct_get_boolean(t, &volume_writable) < 0)) ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_LATENCY) &&
+                 (pa_tagstruct_get_usec(t, &i.buffer_usec) < 0 ||
+                  pa_tagstruct_get_usec(t, &i.sink_usec) < 0)) ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_DRIVER) &&
+                 (pa_tagstruct_gets(t, &i.resample_method) < 0 ||
+                  pa_tagstruct_gets(t, &i.driver) < 0)) ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_CORKED) &&
+                 pa_tagstruct_get_boolean(t, &corked) < 0) ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_PROPLIST) &&
+                 pa_tagstruct_get_proplist(t, i.proplist) < 0) ||
+                ((fields & PA_SINK_INPUT_INFO_FIELD_FORMAT) &&
+                 pa_tagstruct_get_format_info(t, i.format) < 0)) {
+
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                pa_proplist_free(i.proplist);
+                pa_format_info_free(i.format);
+                goto finish;
+            }
+
+            i.mute = (int) mute;
+            i.corked = (int) corked;
+            i.has_volume = (int) has_volume;
+            i.volume_writable = (int) volume_writable;
+
+            if (o->callback) {
+                pa_sink_input_info_filtered_cb_t cb = (pa_sink_input_info_filtered_cb_t) o->callback;
+                cb(o->context, &i, generation, 0, o->userdata);
+            }
+
+            pa_proplist_free(i.proplist);
+            pa_format_info_free(i.format);
+        }
+    }
+
+    if (o->callback) {
+        pa_sink_input_info_filtered_cb_t cb = (pa_sink_input_info_filtered_cb_t) o->callback;
+        cb(o->context, NULL, generation, eol, o->userdata);
+    }
+
+finish:
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+pa_operation* pa_context_get_sink_input_info_list_filtered(pa_context *c, pa_sink_input_info_field_t fields, uint64_t since, pa_sink_input_info_filtered_cb_t cb, void *userdata) {
+    pa_tagstruct *t;
+    pa_operation *o;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+    pa_assert(cb);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 33, PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, (fields & ~PA_SINK_INPUT_INFO_FIELD_ALL) == 0, PA_ERR_INVALID);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+    o->private = PA_UINT_TO_PTR(fields);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_GET_SINK_INPUT_INFO_LIST_FILTERED, &tag);
+    pa_tagstruct_putu32(t, fields);
+    pa_tagstruct_putu64(t, since);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, context_get_sink_input_info_filtered_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
 /*** Source output info ***/
 
 static void context_get_source_output_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -1926,6 +2050,172 @@ pa_operation* pa_context_set_port_latency_offset(pa_context *c, const char *card
     return o;
 }
 
+/*** Xrun events ***/
+
+static void context_get_xrun_event_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    int eol = 1;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (!o->context)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, false) < 0)
+            goto finish;
+
+        eol = -1;
+    } else {
+
+        while (!pa_tagstruct_eof(t)) {
+            pa_xrun_event_info i;
+            uint32_t cause, device_type;
+
+            pa_zero(i);
+
+            if (pa_tagstruct_getu64(t, &i.serial) < 0 ||
+                pa_tagstruct_get_timeval(t, &i.timestamp) < 0 ||
+                pa_tagstruct_getu32(t, &cause) < 0 ||
+                pa_tagstruct_getu32(t, &device_type) < 0 ||
+                pa_tagstruct_getu32(t, &i.device_index) < 0 ||
+                pa_tagstruct_getu32(t, &i.stream_index) < 0 ||
+                pa_tagstruct_get_usec(t, &i.watermark_before) < 0 ||
+                pa_tagstruct_get_usec(t, &i.watermark_after) < 0) {
+
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                goto finish;
+            }
+
+            i.cause = cause;
+            i.device_type = device_type;
+
+            if (o->callback) {
+                pa_xrun_event_info_cb_t cb = (pa_xrun_event_info_cb_t) o->callback;
+                cb(o->context, &i, 0, o->userdata);
+            }
+        }
+    }
+
+    if (o->callback) {
+        pa_xrun_event_info_cb_t cb = (pa_xrun_event_info_cb_t) o->callback;
+        cb(o->context, NULL, eol, o->userdata);
+    }
+
+finish:
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+pa_operation* pa_context_get_xrun_event_info_list(pa_context *c, pa_xrun_event_info_cb_t cb, void *userdata) {
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 33, PA_ERR_NOTSUPPORTED);
+
+    return pa_context_send_simple_command(c, PA_COMMAND_GET_XRUN_EVENT_INFO_LIST, context_get_xrun_event_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+/*** Level meters ***/
+
+#define METER_READ_TRIES 16
+
+pa_operation* pa_context_enable_meter(pa_context *c, pa_subscription_event_type_t facility, uint32_t idx, pa_usec_t period, pa_context_index_cb_t cb, void *userdata) {
+    pa_operation *o;
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 33, PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, pa_pstream_get_shm(c->pstream), PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c,
+                                  facility == PA_SUBSCRIPTION_EVENT_SINK ||
+                                  facility == PA_SUBSCRIPTION_EVENT_SOURCE ||
+                                  facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, idx != PA_INVALID_INDEX, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, period > 0, PA_ERR_INVALID);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_ENABLE_METER, &tag);
+    pa_tagstruct_putu32(t, (uint32_t) facility);
+    pa_tagstruct_putu32(t, idx);
+    pa_tagstruct_put_usec(t, period);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, context_index_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+pa_operation* pa_context_disable_meter(pa_context *c, uint32_t meter, pa_context_success_cb_t cb, void *userdata) {
+    pa_operation *o;
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 33, PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, meter < PA_NATIVE_METER_SLOTS, PA_ERR_INVALID);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_DISABLE_METER, &tag);
+    pa_tagstruct_putu32(t, meter);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+int pa_context_get_meter_levels(pa_context *c, uint32_t meter, pa_meter_info *info) {
+    const pa_native_meter_page *p;
+    const pa_meter_levels *l;
+    unsigned tries;
+    int ret = 0;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+    pa_assert(info);
+
+    PA_CHECK_VALIDITY(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(c, meter < PA_NATIVE_METER_SLOTS, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(c, c->meter_page, PA_ERR_NODATA);
+
+    p = pa_memblock_acquire(c->meter_page);
+    l = &p->slots[meter];
+
+    for (tries = 0;; tries++) {
+        int seq;
+
+        if (tries >= METER_READ_TRIES) {
+            ret = -pa_context_set_error(c, PA_ERR_BUSY);
+            break;
+        }
+
+        /* See pa_meter_levels for how the server updates the slot */
+        if ((seq = pa_atomic_load(&l->seq)) & 1)
+            continue;
+
+        info->channels = (uint8_t) PA_MIN(l->channels, PA_CHANNELS_MAX);
+        memcpy(info->peak, l->peak, sizeof(info->peak));
+        memcpy(info->rms, l->rms, sizeof(info->rms));
+        info->timestamp = l->timestamp;
+
+        if (pa_atomic_load(&l->seq) == seq)
+            break;
+    }
+
+    pa_memblock_release(c->meter_page);
+
+    return ret;
+}
+
 /*** Autoload stuff ***/
 
 PA_WARN_REFERENCE(pa_context_get_autoload_info_by_name, "Module auto-loading no longer supported.");
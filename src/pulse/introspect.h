@@ -110,6 +110,11 @@
  * The structure returned is the pa_sink_input_info or pa_source_output_info
  * structure.
  *
+ * Clients that poll the sink inputs regularly can save most of the work
+ * with pa_context_get_sink_input_info_list_filtered(), which returns only
+ * the fields asked for, and only for the sink inputs that changed since
+ * the last call.
+ *
  * \subsection samples_subsec Samples
  *
  * The list of cached samples can be retrieved from the server. Three methods
@@ -199,6 +204,23 @@
  * system mixer application) and update its user interface accordingly. Use
  * \ref subscribe to get such notifications.
  *
+ * \subsection xrun_subsec Underruns and Overruns
+ *
+ * The daemon keeps a short history of device underruns and overruns and
+ * of streams that ran out of data. It can be fetched with
+ * pa_context_get_xrun_event_info_list(), and new events are announced
+ * through the PA_SUBSCRIPTION_MASK_XRUN subscription facility.
+ *
+ * \subsection meter_subsec Level Meters
+ *
+ * Instead of creating a PA_STREAM_PEAK_DETECT record stream for every
+ * level meter it shows, a client may ask the daemon to measure a sink,
+ * source or sink input with pa_context_enable_meter(). The daemon
+ * publishes the levels in memory shared with the client once per
+ * period, and pa_context_get_meter_levels() reads the latest ones
+ * without talking to the daemon. This needs a local connection with
+ * shared memory.
+ *
  * \subsection module_subsec Modules
  *
  * Server modules can be remotely loaded and unloaded using
@@ -451,6 +473,8 @@ typedef struct pa_client_info {
     uint32_t owner_module;               /**< Index of the owning module, or PA_INVALID_INDEX. */
     const char *driver;                  /**< Driver name */
     pa_proplist *proplist;               /**< Property list \since 0.9.11 */
+    pa_usec_t render_usec;               /**< Time the server spent processing the streams of this client, while render profiling was enabled. \since 12.0 */
+    uint64_t memory;                     /**< Bytes of memory blocks the server holds on behalf of this client. \since 12.0 */
 } pa_client_info;
 
 /** Callback prototype for pa_context_get_client_info() and friends */
@@ -587,6 +611,19 @@ pa_operation* pa_context_get_sink_input_info(pa_context *c, uint32_t idx, pa_sin
 /** Get the complete sink input list */
 pa_operation* pa_context_get_sink_input_info_list(pa_context *c, pa_sink_input_info_cb_t cb, void *userdata);
 
+/** Callback prototype for pa_context_get_sink_input_info_list_filtered().
+ * generation is the server's change generation at the time of the reply,
+ * to be passed as since to the next call. \since 12.0 */
+typedef void (*pa_sink_input_info_filtered_cb_t) (pa_context *c, const pa_sink_input_info *i, uint64_t generation, int eol, void *userdata);
+
+/** Get the sink inputs that were created or changed after the change
+ * generation since, 0 for all of them. Only the given fields are filled
+ * in, the others are zero, and proplist and format are empty. Removed sink
+ * inputs are not reported, subscribe to sink input events to learn about
+ * them. Note that the latency fields change all the time without being
+ * considered a change. \since 12.0 */
+pa_operation* pa_context_get_sink_input_info_list_filtered(pa_context *c, pa_sink_input_info_field_t fields, uint64_t since, pa_sink_input_info_filtered_cb_t cb, void *userdata);
+
 /** Move the specified sink input to a different sink. \since 0.9.5 */
 pa_operation* pa_context_move_sink_input_by_name(pa_context *c, uint32_t idx, const char *sink_name, pa_context_success_cb_t cb, void* userdata);
 
@@ -709,6 +746,62 @@ pa_operation* pa_context_get_sample_info_list(pa_context *c, pa_sample_info_cb_t
 
 /** @} */
 
+/** @{ \name Underruns and Overruns */
+
+/** Stores information about a recent underrun or overrun recorded by
+ * the daemon. Please note that this structure can be extended as part
+ * of evolutionary API updates at any time in any new release. \since 12.0 */
+typedef struct pa_xrun_event_info {
+    uint64_t serial;                      /**< Serial number of this event, increasing monotonically. The lower 32 bits are passed as index in PA_SUBSCRIPTION_EVENT_XRUN notifications. */
+    struct timeval timestamp;             /**< Wallclock time at which the event was recorded */
+    pa_xrun_cause_t cause;                /**< What kind of xrun this was */
+    pa_device_type_t device_type;         /**< Whether the event happened on a sink or a source */
+    uint32_t device_index;                /**< Index of the sink or source */
+    uint32_t stream_index;                /**< Index of the sink input that ran dry, or PA_INVALID_INDEX for device level events */
+    pa_usec_t watermark_before;           /**< Wakeup watermark of the device before the event, or 0 if not applicable */
+    pa_usec_t watermark_after;            /**< Wakeup watermark of the device after the event, or 0 if not applicable */
+} pa_xrun_event_info;
+
+/** Callback prototype for pa_context_get_xrun_event_info_list() \since 12.0 */
+typedef void (*pa_xrun_event_info_cb_t)(pa_context *c, const pa_xrun_event_info *i, int eol, void *userdata);
+
+/** Get the most recent underrun and overrun events kept by the
+ * daemon, oldest first. \since 12.0 */
+pa_operation* pa_context_get_xrun_event_info_list(pa_context *c, pa_xrun_event_info_cb_t cb, void *userdata);
+
+/** @} */
+
+/** @{ \name Level Meters */
+
+/** Peak and RMS levels of a sink, source or sink input, as published by
+ * the daemon for a meter enabled with pa_context_enable_meter(). Levels
+ * are linear, 1.0 being full scale. Please note that this structure can
+ * be extended as part of evolutionary API updates at any time in any new
+ * release. \since 12.0 */
+typedef struct pa_meter_info {
+    uint8_t channels;                     /**< Number of channels in peak and rms */
+    float peak[PA_CHANNELS_MAX];          /**< Highest absolute sample value of each channel during the last period */
+    float rms[PA_CHANNELS_MAX];           /**< RMS of each channel during the last period */
+    pa_usec_t timestamp;                  /**< pa_rtclock_now() at the time the levels were published, 0 if they weren't yet */
+} pa_meter_info;
+
+/** Let the daemon measure the levels of the sink, source or sink input
+ * idx, facility being PA_SUBSCRIPTION_EVENT_SINK, _SOURCE or _SINK_INPUT,
+ * every period usec. The callback gets the index of the meter, or
+ * PA_INVALID_INDEX on failure. Sink input meters measure the stream
+ * after its volume, and follow it when it is moved. \since 12.0 */
+pa_operation* pa_context_enable_meter(pa_context *c, pa_subscription_event_type_t facility, uint32_t idx, pa_usec_t period, pa_context_index_cb_t cb, void *userdata);
+
+/** Stop a meter enabled with pa_context_enable_meter(). \since 12.0 */
+pa_operation* pa_context_disable_meter(pa_context *c, uint32_t meter, pa_context_success_cb_t cb, void *userdata);
+
+/** Copy the latest levels of a meter to *info, without a round trip to
+ * the daemon. Returns a negative error code on failure. A meter whose
+ * object went away simply isn't updated anymore. \since 12.0 */
+int pa_context_get_meter_levels(pa_context *c, uint32_t meter, pa_meter_info *info);
+
+/** @} */
+
 /** \cond fulldocs */
 
 /** @{ \name Autoload Entries */
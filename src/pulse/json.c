@@ -21,6 +21,7 @@
 #include <config.h>
 #endif
 
+#include <limits.h>
 #include <math.h>
 
 #include <pulse/json.h>
@@ -312,6 +313,13 @@ static const char *parse_object(const char *str, pa_json_object *obj, unsigned i
     while (*str != '}') {
         str++; /* Consume leading '{' or ',' */
 
+        /* An object may be empty, but a trailing comma is invalid */
+        while (is_whitespace(*str))
+            str++;
+
+        if (*str == '}' && pa_hashmap_isempty(obj->object_values))
+            break;
+
         str = parse_value(str, ":", &name, depth + 1);
         if (!str || pa_json_object_get_type(name) != PA_JSON_TYPE_STRING) {
             pa_log("Could not parse key for object");
@@ -612,3 +620,207 @@ bool pa_json_object_equal(const pa_json_object *o1, const pa_json_object *o2) {
             pa_assert_not_reached();
     }
 }
+
+struct pa_json_encoder {
+    pa_strbuf *buffer;
+    unsigned depth;
+    /* Per open container, outermost first: its type, and whether a
+     * value was written into it already */
+    pa_json_type container[MAX_NESTING_DEPTH + 1];
+    bool need_comma[MAX_NESTING_DEPTH + 1];
+};
+
+pa_json_encoder *pa_json_encoder_new(void) {
+    pa_json_encoder *encoder;
+
+    encoder = pa_xnew0(pa_json_encoder, 1);
+    encoder->buffer = pa_strbuf_new();
+    encoder->container[0] = PA_JSON_TYPE_INIT;
+
+    return encoder;
+}
+
+void pa_json_encoder_free(pa_json_encoder *encoder) {
+    pa_assert(encoder);
+
+    pa_strbuf_free(encoder->buffer);
+    pa_xfree(encoder);
+}
+
+char *pa_json_encoder_to_string_free(pa_json_encoder *encoder) {
+    char *result;
+
+    pa_assert(encoder);
+    pa_assert(encoder->depth == 0);
+
+    result = pa_strbuf_to_string_free(encoder->buffer);
+    pa_xfree(encoder);
+
+    return result;
+}
+
+static void json_write_string_escaped(pa_strbuf *buffer, const char *value) {
+    const char *p;
+
+    pa_strbuf_putc(buffer, '"');
+
+    for (p = value; *p; p++) {
+        switch (*p) {
+            case '"':
+                pa_strbuf_puts(buffer, "\\\"");
+                break;
+            case '\\':
+                pa_strbuf_puts(buffer, "\\\\");
+                break;
+            case '\n':
+                pa_strbuf_puts(buffer, "\\n");
+                break;
+            case '\r':
+                pa_strbuf_puts(buffer, "\\r");
+                break;
+            case '\t':
+                pa_strbuf_puts(buffer, "\\t");
+                break;
+            case '\b':
+                pa_strbuf_puts(buffer, "\\b");
+                break;
+            case '\f':
+                pa_strbuf_puts(buffer, "\\f");
+                break;
+            default:
+                if ((unsigned char) *p < 0x20)
+                    pa_strbuf_printf(buffer, "\\u%04x", (unsigned char) *p);
+                else
+                    pa_strbuf_putc(buffer, *p);
+        }
+    }
+
+    pa_strbuf_putc(buffer, '"');
+}
+
+/* Writes the separator and, inside an object, the name of the next value */
+static void json_encoder_start_value(pa_json_encoder *encoder, const char *name) {
+    pa_assert(encoder);
+
+    if (encoder->depth == 0) {
+        pa_assert(!encoder->need_comma[0]);
+        pa_assert(!name);
+    } else if (encoder->container[encoder->depth] == PA_JSON_TYPE_OBJECT)
+        pa_assert(name);
+    else
+        pa_assert(!name);
+
+    if (encoder->need_comma[encoder->depth])
+        pa_strbuf_putc(encoder->buffer, ',');
+    encoder->need_comma[encoder->depth] = true;
+
+    if (name) {
+        json_write_string_escaped(encoder->buffer, name);
+        pa_strbuf_putc(encoder->buffer, ':');
+    }
+}
+
+static void json_encoder_begin(pa_json_encoder *encoder, const char *name, pa_json_type type) {
+    json_encoder_start_value(encoder, name);
+
+    pa_assert(encoder->depth < MAX_NESTING_DEPTH);
+    encoder->depth++;
+    encoder->container[encoder->depth] = type;
+    encoder->need_comma[encoder->depth] = false;
+
+    pa_strbuf_putc(encoder->buffer, type == PA_JSON_TYPE_OBJECT ? '{' : '[');
+}
+
+static void json_encoder_end(pa_json_encoder *encoder, pa_json_type type) {
+    pa_assert(encoder);
+    pa_assert(encoder->depth > 0);
+    pa_assert(encoder->container[encoder->depth] == type);
+
+    encoder->depth--;
+    pa_strbuf_putc(encoder->buffer, type == PA_JSON_TYPE_OBJECT ? '}' : ']');
+}
+
+void pa_json_encoder_begin_element_object(pa_json_encoder *encoder) {
+    json_encoder_begin(encoder, NULL, PA_JSON_TYPE_OBJECT);
+}
+
+void pa_json_encoder_begin_member_object(pa_json_encoder *encoder, const char *name) {
+    json_encoder_begin(encoder, name, PA_JSON_TYPE_OBJECT);
+}
+
+void pa_json_encoder_end_object(pa_json_encoder *encoder) {
+    json_encoder_end(encoder, PA_JSON_TYPE_OBJECT);
+}
+
+void pa_json_encoder_begin_element_array(pa_json_encoder *encoder) {
+    json_encoder_begin(encoder, NULL, PA_JSON_TYPE_ARRAY);
+}
+
+void pa_json_encoder_begin_member_array(pa_json_encoder *encoder, const char *name) {
+    json_encoder_begin(encoder, name, PA_JSON_TYPE_ARRAY);
+}
+
+void pa_json_encoder_end_array(pa_json_encoder *encoder) {
+    json_encoder_end(encoder, PA_JSON_TYPE_ARRAY);
+}
+
+static void json_write_string(pa_json_encoder *encoder, const char *name, const char *value) {
+    json_encoder_start_value(encoder, name);
+
+    if (value)
+        json_write_string_escaped(encoder->buffer, value);
+    else
+        pa_strbuf_puts(encoder->buffer, "null");
+}
+
+void pa_json_encoder_add_element_string(pa_json_encoder *encoder, const char *value) {
+    json_write_string(encoder, NULL, value);
+}
+
+void pa_json_encoder_add_member_string(pa_json_encoder *encoder, const char *name, const char *value) {
+    json_write_string(encoder, name, value);
+}
+
+void pa_json_encoder_add_element_int(pa_json_encoder *encoder, int64_t value) {
+    json_encoder_start_value(encoder, NULL);
+    pa_strbuf_printf(encoder->buffer, "%lld", (long long) value);
+}
+
+void pa_json_encoder_add_member_int(pa_json_encoder *encoder, const char *name, int64_t value) {
+    json_encoder_start_value(encoder, name);
+    pa_strbuf_printf(encoder->buffer, "%lld", (long long) value);
+}
+
+void pa_json_encoder_add_member_null(pa_json_encoder *encoder, const char *name) {
+    json_encoder_start_value(encoder, name);
+    pa_strbuf_puts(encoder->buffer, "null");
+}
+
+void pa_json_encoder_add_member_bool(pa_json_encoder *encoder, const char *name, bool value) {
+    json_encoder_start_value(encoder, name);
+    pa_strbuf_puts(encoder->buffer, value ? "true" : "false");
+}
+
+void pa_json_encoder_add_member_double(pa_json_encoder *encoder, const char *name, double value, int precision) {
+    long long scale = 1, v;
+    int i;
+
+    pa_assert(precision >= 0 && precision <= 9);
+
+    json_encoder_start_value(encoder, name);
+
+    /* printf() would use the decimal separator of the locale */
+    for (i = 0; i < precision; i++)
+        scale *= 10;
+
+    if (!isfinite(value) || fabs(value) * scale >= (double) LLONG_MAX) {
+        pa_strbuf_puts(encoder->buffer, "null");
+        return;
+    }
+
+    v = llround(fabs(value) * scale);
+
+    pa_strbuf_printf(encoder->buffer, "%s%lld", value < 0 && v > 0 ? "-" : "", v / scale);
+    if (precision > 0)
+        pa_strbuf_printf(encoder->buffer, ".%0*lld", precision, v % scale);
+}
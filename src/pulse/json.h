@@ -18,6 +18,7 @@
 ***/
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define PA_DOUBLE_IS_EQUAL(x, y) (((x) - (y)) < 0.000001 && ((x) - (y)) > -0.000001)
 
@@ -51,3 +52,31 @@ int pa_json_object_get_array_length(const pa_json_object *o);
 const pa_json_object* pa_json_object_get_array_member(const pa_json_object *o, int index);
 
 bool pa_json_object_equal(const pa_json_object *o1, const pa_json_object *o2);
+
+/* A writer for compact JSON. Values go into the innermost open array
+ * ("element" functions) or object ("member" functions, with the member's
+ * name). At the top level exactly one element may be written. */
+typedef struct pa_json_encoder pa_json_encoder;
+
+pa_json_encoder *pa_json_encoder_new(void);
+void pa_json_encoder_free(pa_json_encoder *encoder);
+/* Frees the encoder and returns the text, every container must be closed */
+char *pa_json_encoder_to_string_free(pa_json_encoder *encoder);
+
+void pa_json_encoder_begin_element_object(pa_json_encoder *encoder);
+void pa_json_encoder_begin_member_object(pa_json_encoder *encoder, const char *name);
+void pa_json_encoder_end_object(pa_json_encoder *encoder);
+void pa_json_encoder_begin_element_array(pa_json_encoder *encoder);
+void pa_json_encoder_begin_member_array(pa_json_encoder *encoder, const char *name);
+void pa_json_encoder_end_array(pa_json_encoder *encoder);
+
+/* A NULL string is written as null */
+void pa_json_encoder_add_element_string(pa_json_encoder *encoder, const char *value);
+void pa_json_encoder_add_element_int(pa_json_encoder *encoder, int64_t value);
+void pa_json_encoder_add_member_string(pa_json_encoder *encoder, const char *name, const char *value);
+void pa_json_encoder_add_member_null(pa_json_encoder *encoder, const char *name);
+void pa_json_encoder_add_member_bool(pa_json_encoder *encoder, const char *name, bool value);
+void pa_json_encoder_add_member_int(pa_json_encoder *encoder, const char *name, int64_t value);
+/* Written with the given number of decimals, independent of the locale.
+ * Infinite and NaN values become null. */
+void pa_json_encoder_add_member_double(pa_json_encoder *encoder, const char *name, double value, int precision);
@@ -28,6 +28,10 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #ifndef HAVE_PIPE
 #include <pulsecore/pipe.h>
 #endif
@@ -39,6 +43,7 @@
 #include <pulsecore/poll.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
 #include <pulsecore/i18n.h>
 #include <pulsecore/llist.h>
 #include <pulsecore/log.h>
@@ -49,6 +54,8 @@
 #include "mainloop.h"
 #include "internal.h"
 
+#define TIME_HEAP_NONE ((unsigned) -1)
+
 struct pa_io_event {
     pa_mainloop *mainloop;
     bool dead:1;
@@ -57,6 +64,10 @@ struct pa_io_event {
     pa_io_event_flags_t events;
     struct pollfd *pollfd;
 
+    /* Tells this event apart from earlier ones on the same fd when
+     * we get it back from epoll */
+    uint32_t serial;
+
     pa_io_event_cb_t callback;
     void *userdata;
     pa_io_event_destroy_cb_t destroy_callback;
@@ -72,6 +83,11 @@ struct pa_time_event {
     bool use_rtclock:1;
     pa_usec_t time;
 
+    /* Position in the heap of enabled time events, and a number that
+     * changes whenever the event is restarted */
+    unsigned heap_index;
+    uint64_t serial;
+
     pa_time_event_cb_t callback;
     void *userdata;
     pa_time_event_destroy_cb_t destroy_callback;
@@ -104,8 +120,32 @@ struct pa_mainloop {
     struct pollfd *pollfds;
     unsigned max_pollfds, n_pollfds;
 
+#ifdef HAVE_SYS_EPOLL_H
+    /* -1 if we use poll() */
+    int epoll_fd;
+    struct epoll_event *epoll_events;
+    unsigned max_epoll_events;
+    struct pollfd epoll_pollfd;
+
+    /* fd -> pa_io_event, without dead events */
+    pa_hashmap *epoll_io_events;
+    uint32_t io_event_serial;
+    unsigned n_io_events_freed, n_io_events_freed_at_poll;
+#endif
+
     pa_usec_t prepared_timeout;
-    pa_time_event *cached_next_time_event;
+
+    /* Enabled time events, ordered by time */
+    pa_time_event **time_heap;
+    unsigned max_time_heap;
+    uint64_t time_event_serial;
+
+    /* Scratch space for dispatch_timeout() */
+    struct {
+        pa_time_event *event;
+        uint64_t serial;
+    } *due_time_events;
+    unsigned max_due_time_events;
 
     pa_mainloop_api api;
 
@@ -144,6 +184,125 @@ static pa_io_event_flags_t map_flags_from_libc(short flags) {
         (flags & POLLHUP ? PA_IO_EVENT_HANGUP : 0);
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static uint32_t map_flags_to_epoll(pa_io_event_flags_t flags) {
+    return
+        (flags & PA_IO_EVENT_INPUT ? EPOLLIN : 0) |
+        (flags & PA_IO_EVENT_OUTPUT ? EPOLLOUT : 0) |
+        (flags & PA_IO_EVENT_ERROR ? EPOLLERR : 0) |
+        (flags & PA_IO_EVENT_HANGUP ? EPOLLHUP : 0);
+}
+
+static pa_io_event_flags_t map_flags_from_epoll(uint32_t flags) {
+    return
+        (flags & EPOLLIN ? PA_IO_EVENT_INPUT : 0) |
+        (flags & EPOLLOUT ? PA_IO_EVENT_OUTPUT : 0) |
+        (flags & EPOLLERR ? PA_IO_EVENT_ERROR : 0) |
+        (flags & EPOLLHUP ? PA_IO_EVENT_HANGUP : 0);
+}
+
+static void epoll_init(pa_mainloop *m) {
+    struct epoll_event ev;
+
+    pa_assert(m);
+
+    m->epoll_fd = -1;
+
+    if ((m->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        pa_log_debug("epoll_create1() failed, using poll(): %s", pa_cstrerror(errno));
+        return;
+    }
+
+    pa_zero(ev);
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint32_t) m->wakeup_pipe[0];
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->wakeup_pipe[0], &ev) < 0) {
+        pa_log_debug("Failed to add wakeup pipe to epoll, using poll(): %s", pa_cstrerror(errno));
+        pa_close(m->epoll_fd);
+        m->epoll_fd = -1;
+        return;
+    }
+
+    m->epoll_io_events = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+}
+
+/* Used whenever epoll can't do what poll() can, e.g. when two events
+ * watch the same fd. From then on we stay with poll(). */
+static void epoll_done(pa_mainloop *m, const char *reason) {
+    pa_assert(m);
+
+    if (m->epoll_fd < 0)
+        return;
+
+    if (reason)
+        pa_log_debug("Switching to poll(): %s", reason);
+
+    pa_close(m->epoll_fd);
+    m->epoll_fd = -1;
+
+    pa_hashmap_free(m->epoll_io_events);
+    m->epoll_io_events = NULL;
+
+    pa_xfree(m->epoll_events);
+    m->epoll_events = NULL;
+    m->max_epoll_events = 0;
+
+    m->rebuild_pollfds = true;
+}
+
+static void epoll_add_io(pa_mainloop *m, pa_io_event *e) {
+    struct epoll_event ev;
+
+    if (m->epoll_fd < 0)
+        return;
+
+    if (pa_hashmap_get(m->epoll_io_events, PA_INT_TO_PTR(e->fd))) {
+        epoll_done(m, "more than one event for an fd");
+        return;
+    }
+
+    e->serial = ++m->io_event_serial;
+
+    pa_zero(ev);
+    ev.events = map_flags_to_epoll(e->events);
+    ev.data.u64 = ((uint64_t) e->serial << 32) | (uint32_t) e->fd;
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, e->fd, &ev) < 0) {
+        epoll_done(m, pa_cstrerror(errno));
+        return;
+    }
+
+    pa_assert_se(pa_hashmap_put(m->epoll_io_events, PA_INT_TO_PTR(e->fd), e) == 0);
+}
+
+static void epoll_update_io(pa_mainloop *m, pa_io_event *e) {
+    struct epoll_event ev;
+
+    if (m->epoll_fd < 0)
+        return;
+
+    pa_zero(ev);
+    ev.events = map_flags_to_epoll(e->events);
+    ev.data.u64 = ((uint64_t) e->serial << 32) | (uint32_t) e->fd;
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_MOD, e->fd, &ev) < 0)
+        epoll_done(m, pa_cstrerror(errno));
+}
+
+static void epoll_remove_io(pa_mainloop *m, pa_io_event *e) {
+    if (m->epoll_fd < 0)
+        return;
+
+    pa_assert_se(pa_hashmap_remove(m->epoll_io_events, PA_INT_TO_PTR(e->fd)) == e);
+
+    /* This fails if the fd was already closed, which is fine */
+    (void) epoll_ctl(m->epoll_fd, EPOLL_CTL_DEL, e->fd, NULL);
+
+    m->n_io_events_freed++;
+}
+#endif
+
 /* IO events */
 static pa_io_event* mainloop_io_new(
         pa_mainloop_api *a,
@@ -176,6 +335,10 @@ static pa_io_event* mainloop_io_new(
     m->rebuild_pollfds = true;
     m->n_io_events ++;
 
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_add_io(m, e);
+#endif
+
     pa_mainloop_wakeup(m);
 
     return e;
@@ -190,6 +353,10 @@ static void mainloop_io_enable(pa_io_event *e, pa_io_event_flags_t events) {
 
     e->events = events;
 
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_update_io(e->mainloop, e);
+#endif
+
     if (e->pollfd)
         e->pollfd->events = map_flags_to_libc(events);
     else
@@ -208,6 +375,10 @@ static void mainloop_io_free(pa_io_event *e) {
     e->mainloop->n_io_events --;
     e->mainloop->rebuild_pollfds = true;
 
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_remove_io(e->mainloop, e);
+#endif
+
     pa_mainloop_wakeup(e->mainloop);
 }
 
@@ -286,6 +457,91 @@ static void mainloop_defer_set_destroy(pa_defer_event *e, pa_defer_event_destroy
 }
 
 /* Time events */
+static void time_heap_set(pa_mainloop *m, unsigned idx, pa_time_event *e) {
+    m->time_heap[idx] = e;
+    e->heap_index = idx;
+}
+
+static void time_heap_sift_up(pa_mainloop *m, unsigned idx) {
+    pa_time_event *e = m->time_heap[idx];
+
+    while (idx > 0) {
+        unsigned parent = (idx - 1) / 2;
+
+        if (m->time_heap[parent]->time <= e->time)
+            break;
+
+        time_heap_set(m, idx, m->time_heap[parent]);
+        idx = parent;
+    }
+
+    time_heap_set(m, idx, e);
+}
+
+static void time_heap_sift_down(pa_mainloop *m, unsigned idx) {
+    pa_time_event *e = m->time_heap[idx];
+    unsigned n = m->n_enabled_time_events;
+
+    for (;;) {
+        unsigned child = 2 * idx + 1;
+
+        if (child >= n)
+            break;
+
+        if (child + 1 < n && m->time_heap[child + 1]->time < m->time_heap[child]->time)
+            child++;
+
+        if (e->time <= m->time_heap[child]->time)
+            break;
+
+        time_heap_set(m, idx, m->time_heap[child]);
+        idx = child;
+    }
+
+    time_heap_set(m, idx, e);
+}
+
+/* To be called after n_enabled_time_events has been increased */
+static void time_heap_insert(pa_mainloop *m, pa_time_event *e) {
+    unsigned idx = m->n_enabled_time_events - 1;
+
+    pa_assert(e->heap_index == TIME_HEAP_NONE);
+
+    if (m->max_time_heap < m->n_enabled_time_events) {
+        m->max_time_heap = PA_MAX(16u, m->max_time_heap * 2);
+        m->time_heap = pa_xrealloc(m->time_heap, sizeof(pa_time_event *) * m->max_time_heap);
+    }
+
+    time_heap_set(m, idx, e);
+    time_heap_sift_up(m, idx);
+}
+
+/* To be called after n_enabled_time_events has been decreased */
+static void time_heap_remove(pa_mainloop *m, pa_time_event *e) {
+    unsigned idx = e->heap_index, last = m->n_enabled_time_events;
+    pa_time_event *moved;
+
+    pa_assert(idx <= last);
+    pa_assert(m->time_heap[idx] == e);
+
+    e->heap_index = TIME_HEAP_NONE;
+
+    if (idx == last)
+        return;
+
+    /* Fill the hole with the last event and move that one to where it
+     * belongs */
+    moved = m->time_heap[last];
+    time_heap_set(m, idx, moved);
+    time_heap_sift_up(m, idx);
+    time_heap_sift_down(m, moved->heap_index);
+}
+
+static void time_heap_update(pa_mainloop *m, pa_time_event *e) {
+    time_heap_sift_up(m, e->heap_index);
+    time_heap_sift_down(m, e->heap_index);
+}
+
 static pa_usec_t make_rt(const struct timeval *tv, bool *use_rtclock) {
     struct timeval ttv;
 
@@ -327,19 +583,15 @@ static pa_time_event* mainloop_time_new(
 
     e = pa_xnew0(pa_time_event, 1);
     e->mainloop = m;
+    e->heap_index = TIME_HEAP_NONE;
 
     if ((e->enabled = (t != PA_USEC_INVALID))) {
         e->time = t;
         e->use_rtclock = use_rtclock;
+        e->serial = m->time_event_serial++;
 
         m->n_enabled_time_events++;
-
-        if (m->cached_next_time_event) {
-            pa_assert(m->cached_next_time_event->enabled);
-
-            if (t < m->cached_next_time_event->time)
-                m->cached_next_time_event = e;
-        }
+        time_heap_insert(m, e);
     }
 
     e->callback = callback;
@@ -363,28 +615,30 @@ static void mainloop_time_restart(pa_time_event *e, const struct timeval *tv) {
 
     t = make_rt(tv, &use_rtclock);
 
+    e->serial = e->mainloop->time_event_serial++;
+
     valid = (t != PA_USEC_INVALID);
     if (e->enabled && !valid) {
         pa_assert(e->mainloop->n_enabled_time_events > 0);
         e->mainloop->n_enabled_time_events--;
-    } else if (!e->enabled && valid)
-        e->mainloop->n_enabled_time_events++;
+        time_heap_remove(e->mainloop, e);
+    }
 
-    if ((e->enabled = valid)) {
+    if (valid) {
         e->time = t;
         e->use_rtclock = use_rtclock;
-        pa_mainloop_wakeup(e->mainloop);
-    }
 
-    if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
-
-    if (e->mainloop->cached_next_time_event && e->enabled) {
-        pa_assert(e->mainloop->cached_next_time_event->enabled);
+        if (e->enabled)
+            time_heap_update(e->mainloop, e);
+        else {
+            e->mainloop->n_enabled_time_events++;
+            time_heap_insert(e->mainloop, e);
+        }
 
-        if (t < e->mainloop->cached_next_time_event->time)
-            e->mainloop->cached_next_time_event = e;
+        pa_mainloop_wakeup(e->mainloop);
     }
+
+    e->enabled = valid;
 }
 
 static void mainloop_time_free(pa_time_event *e) {
@@ -397,12 +651,10 @@ static void mainloop_time_free(pa_time_event *e) {
     if (e->enabled) {
         pa_assert(e->mainloop->n_enabled_time_events > 0);
         e->mainloop->n_enabled_time_events--;
+        time_heap_remove(e->mainloop, e);
         e->enabled = false;
     }
 
-    if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
-
     /* no wakeup needed here. Think about it! */
 }
 
@@ -463,6 +715,10 @@ pa_mainloop *pa_mainloop_new(void) {
     pa_make_fd_nonblock(m->wakeup_pipe[0]);
     pa_make_fd_nonblock(m->wakeup_pipe[1]);
 
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_init(m);
+#endif
+
     m->rebuild_pollfds = true;
 
     m->api = vtable;
@@ -522,6 +778,7 @@ static void cleanup_time_events(pa_mainloop *m, bool force) {
             if (!e->dead && e->enabled) {
                 pa_assert(m->n_enabled_time_events > 0);
                 m->n_enabled_time_events--;
+                time_heap_remove(m, e);
                 e->enabled = false;
             }
 
@@ -575,6 +832,12 @@ void pa_mainloop_free(pa_mainloop *m) {
     cleanup_time_events(m, true);
 
     pa_xfree(m->pollfds);
+    pa_xfree(m->time_heap);
+    pa_xfree(m->due_time_events);
+
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_done(m, NULL);
+#endif
 
     pa_close_pipe(m->wakeup_pipe);
 
@@ -661,6 +924,47 @@ static unsigned dispatch_pollfds(pa_mainloop *m) {
     return r;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static unsigned dispatch_epoll(pa_mainloop *m) {
+    unsigned r = 0, k;
+
+    pa_assert(m->poll_func_ret > 0);
+
+    for (k = 0; k < (unsigned) m->poll_func_ret; k++) {
+        struct epoll_event *ev = &m->epoll_events[k];
+        int fd = (int) (uint32_t) ev->data.u64;
+        pa_io_event *e;
+
+        if (m->quit || m->epoll_fd < 0)
+            break;
+
+        if (fd == m->wakeup_pipe[0])
+            continue;
+
+        if (!(e = pa_hashmap_get(m->epoll_io_events, PA_INT_TO_PTR(fd))) ||
+            e->serial != (uint32_t) (ev->data.u64 >> 32)) {
+
+            /* Freed by one of the callbacks of this iteration */
+            if (m->n_io_events_freed != m->n_io_events_freed_at_poll)
+                continue;
+
+            /* Otherwise this comes from an fd that was closed before its
+             * event was freed while a duplicate of it is still open
+             * somewhere. epoll keeps watching it then, and we have no
+             * way to make it stop. */
+            epoll_done(m, "got event for an fd we don't watch");
+            break;
+        }
+
+        pa_assert(e->callback);
+        e->callback(&m->api, e, e->fd, map_flags_from_epoll(ev->events), e->userdata);
+        r++;
+    }
+
+    return r;
+}
+#endif
+
 static unsigned dispatch_defer(pa_mainloop *m) {
     pa_defer_event *e;
     unsigned r = 0;
@@ -685,28 +989,12 @@ static unsigned dispatch_defer(pa_mainloop *m) {
 }
 
 static pa_time_event* find_next_time_event(pa_mainloop *m) {
-    pa_time_event *t, *n = NULL;
     pa_assert(m);
 
-    if (m->cached_next_time_event)
-        return m->cached_next_time_event;
-
-    PA_LLIST_FOREACH(t, m->time_events) {
-
-        if (t->dead || !t->enabled)
-            continue;
-
-        if (!n || t->time < n->time) {
-            n = t;
-
-            /* Shortcut for time == 0 */
-            if (n->time == 0)
-                break;
-        }
-    }
+    if (m->n_enabled_time_events <= 0)
+        return NULL;
 
-    m->cached_next_time_event = n;
-    return n;
+    return m->time_heap[0];
 }
 
 static pa_usec_t calc_next_timeout(pa_mainloop *m) {
@@ -732,7 +1020,7 @@ static pa_usec_t calc_next_timeout(pa_mainloop *m) {
 static unsigned dispatch_timeout(pa_mainloop *m) {
     pa_time_event *e;
     pa_usec_t now;
-    unsigned r = 0;
+    unsigned r = 0, n = 0, i;
     pa_assert(m);
 
     if (m->n_enabled_time_events <= 0)
@@ -740,25 +1028,37 @@ static unsigned dispatch_timeout(pa_mainloop *m) {
 
     now = pa_rtclock_now();
 
-    PA_LLIST_FOREACH(e, m->time_events) {
+    /* Take all due events off the heap first, so that events which the
+     * callbacks set up again are left for the next iteration */
+    while (m->n_enabled_time_events > 0 && m->time_heap[0]->time <= now) {
+        e = m->time_heap[0];
 
-        if (m->quit)
-            break;
+        if (m->max_due_time_events <= n) {
+            m->max_due_time_events = PA_MAX(16u, m->max_due_time_events * 2);
+            m->due_time_events = pa_xrealloc(m->due_time_events, sizeof(*m->due_time_events) * m->max_due_time_events);
+        }
 
-        if (e->dead || !e->enabled)
-            continue;
+        /* Disable time event */
+        mainloop_time_restart(e, NULL);
+
+        m->due_time_events[n].event = e;
+        m->due_time_events[n].serial = e->serial;
+        n++;
+    }
 
-        if (e->time <= now) {
-            struct timeval tv;
-            pa_assert(e->callback);
+    for (i = 0; i < n && !m->quit; i++) {
+        struct timeval tv;
 
-            /* Disable time event */
-            mainloop_time_restart(e, NULL);
+        e = m->due_time_events[i].event;
 
-            e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
+        /* Freed or restarted by an earlier callback */
+        if (e->dead || e->serial != m->due_time_events[i].serial)
+            continue;
 
-            r++;
-        }
+        pa_assert(e->callback);
+        e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
+
+        r++;
     }
 
     return r;
@@ -768,8 +1068,9 @@ void pa_mainloop_wakeup(pa_mainloop *m) {
     char c = 'W';
     pa_assert(m);
 
-    if (pa_write(m->wakeup_pipe[1], &c, sizeof(c), &m->wakeup_pipe_type) < 0)
-        /* Not many options for recovering from the error. Let's at least log something. */
+    if (pa_write(m->wakeup_pipe[1], &c, sizeof(c), &m->wakeup_pipe_type) < 0 && errno != EAGAIN)
+        /* Not many options for recovering from the error. Let's at least log something.
+         * A full pipe is fine though, the main loop will wake up anyway. */
         pa_log("pa_write() failed while trying to wake up the mainloop: %s", pa_cstrerror(errno));
 }
 
@@ -794,6 +1095,14 @@ int pa_mainloop_prepare(pa_mainloop *m, int timeout) {
 
     if (m->n_enabled_defer_events <= 0) {
 
+#ifdef HAVE_SYS_EPOLL_H
+        if (m->epoll_fd >= 0) {
+            if (m->max_epoll_events < m->n_io_events + 1) {
+                m->max_epoll_events = (m->n_io_events + 1) * 2;
+                m->epoll_events = pa_xrealloc(m->epoll_events, sizeof(struct epoll_event) * m->max_epoll_events);
+            }
+        } else
+#endif
         if (m->rebuild_pollfds)
             rebuild_pollfds(m);
 
@@ -837,6 +1146,39 @@ int pa_mainloop_poll(pa_mainloop *m) {
 
     if (m->n_enabled_defer_events)
         m->poll_func_ret = 0;
+#ifdef HAVE_SYS_EPOLL_H
+    else if (m->epoll_fd >= 0) {
+        int timeout = usec_to_timeout(m->prepared_timeout);
+
+        /* A poll() replacement gets to wait for the epoll fd */
+        if (m->poll_func) {
+            m->epoll_pollfd.fd = m->epoll_fd;
+            m->epoll_pollfd.events = POLLIN;
+            m->epoll_pollfd.revents = 0;
+
+            if ((m->poll_func_ret = m->poll_func(&m->epoll_pollfd, 1, timeout, m->poll_func_userdata)) > 0)
+                timeout = 0;
+
+            /* The lock may have been dropped while waiting, and another
+             * thread may have switched us to poll() in the meantime. The
+             * pollfds get rebuilt in the next iteration then. */
+            if (m->epoll_fd < 0)
+                m->poll_func_ret = 0;
+        }
+
+        if (!m->poll_func || m->poll_func_ret > 0)
+            m->poll_func_ret = epoll_wait(m->epoll_fd, m->epoll_events, (int) m->max_epoll_events, timeout);
+
+        m->n_io_events_freed_at_poll = m->n_io_events_freed;
+
+        if (m->poll_func_ret < 0) {
+            if (errno == EINTR)
+                m->poll_func_ret = 0;
+            else
+                pa_log("epoll_wait(): %s", pa_cstrerror(errno));
+        }
+    }
+#endif
     else {
         pa_assert(!m->rebuild_pollfds);
 
@@ -894,8 +1236,14 @@ int pa_mainloop_dispatch(pa_mainloop *m) {
         if (m->quit)
             goto quit;
 
-        if (m->poll_func_ret > 0)
-            dispatched += dispatch_pollfds(m);
+        if (m->poll_func_ret > 0) {
+#ifdef HAVE_SYS_EPOLL_H
+            if (m->epoll_fd >= 0)
+                dispatched += dispatch_epoll(m);
+            else
+#endif
+                dispatched += dispatch_pollfds(m);
+        }
     }
 
     if (m->quit)
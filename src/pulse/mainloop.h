@@ -123,7 +123,8 @@ void pa_mainloop_wakeup(pa_mainloop *m);
 /** Generic prototype of a poll() like function */
 typedef int (*pa_poll_func)(struct pollfd *ufds, unsigned long nfds, int timeout, void*userdata);
 
-/** Change the poll() implementation */
+/** Change the poll() implementation. Where the main loop waits with
+ * epoll, the function is passed the epoll file descriptor only. */
 void pa_mainloop_set_poll_func(pa_mainloop *m, pa_poll_func poll_func, void *userdata);
 
 PA_C_DECL_END
@@ -21,6 +21,7 @@
 #include <config.h>
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
@@ -30,6 +31,8 @@
 #include <pulsecore/hashmap.h>
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/proplist-util.h>
 
 #include "proplist.h"
 
@@ -37,11 +40,111 @@ struct property {
     char *key;
     void *value;
     size_t nbytes;
+
+    /* The value is valid UTF-8 with a single terminating NUL, i.e. what
+     * pa_proplist_gets() hands out. Checked once when it is set. */
+    bool is_string:1;
+    /* The key points into well_known_keys[] */
+    bool static_key:1;
 };
 
 #define MAKE_HASHMAP(p) ((pa_hashmap*) (p))
 #define MAKE_PROPLIST(p) ((pa_proplist*) (p))
 
+/* Sorted by value, for bsearch(). Properties with one of these keys
+ * don't need a copy of it. */
+static const char * const well_known_keys[] = {
+    PA_PROP_APPLICATION_ICON,
+    PA_PROP_APPLICATION_ICON_NAME,
+    PA_PROP_APPLICATION_ID,
+    PA_PROP_APPLICATION_LANGUAGE,
+    PA_PROP_APPLICATION_NAME,
+    PA_PROP_APPLICATION_PROCESS_BINARY,
+    PA_PROP_APPLICATION_PROCESS_HOST,
+    PA_PROP_APPLICATION_PROCESS_ID,
+    PA_PROP_APPLICATION_PROCESS_MACHINE_ID,
+    PA_PROP_APPLICATION_PROCESS_SESSION_ID,
+    PA_PROP_APPLICATION_PROCESS_USER,
+    PA_PROP_APPLICATION_VERSION,
+    PA_PROP_DEVICE_ACCESS_MODE,
+    PA_PROP_DEVICE_API,
+    PA_PROP_DEVICE_BUFFERING_BUFFER_SIZE,
+    PA_PROP_DEVICE_BUFFERING_FRAGMENT_SIZE,
+    PA_PROP_DEVICE_BUS,
+    PA_PROP_DEVICE_BUS_PATH,
+    PA_PROP_DEVICE_CLASS,
+    PA_PROP_DEVICE_DESCRIPTION,
+    PA_PROP_DEVICE_FORM_FACTOR,
+    PA_PROP_DEVICE_ICON,
+    PA_PROP_DEVICE_ICON_NAME,
+    PA_PROP_DEVICE_INTENDED_ROLES,
+    PA_PROP_DEVICE_MASTER_DEVICE,
+    PA_PROP_DEVICE_PRODUCT_ID,
+    PA_PROP_DEVICE_PRODUCT_NAME,
+    PA_PROP_DEVICE_PROFILE_DESCRIPTION,
+    PA_PROP_DEVICE_PROFILE_NAME,
+    PA_PROP_DEVICE_SERIAL,
+    PA_PROP_DEVICE_STRING,
+    PA_PROP_DEVICE_VENDOR_ID,
+    PA_PROP_DEVICE_VENDOR_NAME,
+    PA_PROP_EVENT_DESCRIPTION,
+    PA_PROP_EVENT_ID,
+    PA_PROP_EVENT_MOUSE_BUTTON,
+    PA_PROP_EVENT_MOUSE_HPOS,
+    PA_PROP_EVENT_MOUSE_VPOS,
+    PA_PROP_EVENT_MOUSE_X,
+    PA_PROP_EVENT_MOUSE_Y,
+    PA_PROP_FILTER_APPLY,
+    PA_PROP_FILTER_SUPPRESS,
+    PA_PROP_FILTER_WANT,
+    PA_PROP_FORMAT_CHANNEL_MAP,
+    PA_PROP_FORMAT_CHANNELS,
+    PA_PROP_FORMAT_RATE,
+    PA_PROP_FORMAT_SAMPLE_FORMAT,
+    PA_PROP_MEDIA_ARTIST,
+    PA_PROP_MEDIA_COPYRIGHT,
+    PA_PROP_MEDIA_FILENAME,
+    PA_PROP_MEDIA_ICON,
+    PA_PROP_MEDIA_ICON_NAME,
+    PA_PROP_MEDIA_LANGUAGE,
+    PA_PROP_MEDIA_NAME,
+    PA_PROP_MEDIA_ROLE,
+    PA_PROP_MEDIA_SOFTWARE,
+    PA_PROP_MEDIA_TITLE,
+    PA_PROP_MODULE_AUTHOR,
+    PA_PROP_MODULE_DESCRIPTION,
+    PA_PROP_MODULE_USAGE,
+    PA_PROP_MODULE_VERSION,
+    PA_PROP_WINDOW_DESKTOP,
+    PA_PROP_WINDOW_HEIGHT,
+    PA_PROP_WINDOW_HPOS,
+    PA_PROP_WINDOW_ICON,
+    PA_PROP_WINDOW_ICON_NAME,
+    PA_PROP_WINDOW_ID,
+    PA_PROP_WINDOW_NAME,
+    PA_PROP_WINDOW_VPOS,
+    PA_PROP_WINDOW_WIDTH,
+    PA_PROP_WINDOW_X,
+    PA_PROP_WINDOW_X11_DISPLAY,
+    PA_PROP_WINDOW_X11_MONITOR,
+    PA_PROP_WINDOW_X11_SCREEN,
+    PA_PROP_WINDOW_X11_XID,
+    PA_PROP_WINDOW_Y,
+};
+
+static int key_compare(const void *a, const void *b) {
+    return strcmp(a, *(const char * const *) b);
+}
+
+static const char *intern_key(const char *key) {
+    const char * const *k;
+
+    if (!(k = bsearch(key, well_known_keys, PA_ELEMENTSOF(well_known_keys), sizeof(well_known_keys[0]), key_compare)))
+        return NULL;
+
+    return *k;
+}
+
 int pa_proplist_key_valid(const char *key) {
 
     if (!pa_ascii_valid(key))
@@ -53,10 +156,24 @@ int pa_proplist_key_valid(const char *key) {
     return 1;
 }
 
+static bool value_is_string(const void *value, size_t nbytes) {
+    if (nbytes <= 0)
+        return false;
+
+    if (((const char*) value)[nbytes-1] != 0)
+        return false;
+
+    if (strlen((const char*) value) != nbytes-1)
+        return false;
+
+    return pa_utf8_valid((const char*) value);
+}
+
 static void property_free(struct property *prop) {
     pa_assert(prop);
 
-    pa_xfree(prop->key);
+    if (!prop->static_key)
+        pa_xfree(prop->key);
     pa_xfree(prop->value);
     pa_xfree(prop);
 }
@@ -71,11 +188,37 @@ void pa_proplist_free(pa_proplist* p) {
     pa_hashmap_free(MAKE_HASHMAP(p));
 }
 
-/** Will accept only valid UTF-8 */
-int pa_proplist_sets(pa_proplist *p, const char *key, const char *value) {
+/* Stores value, which must be followed by a NUL byte (which may or may
+ * not be counted in nbytes), under key, which must be valid. Takes
+ * ownership of value. */
+static void proplist_put(pa_proplist *p, const char *key, void *value, size_t nbytes, bool is_string) {
     struct property *prop;
-    bool add = false;
 
+    if ((prop = pa_hashmap_get(MAKE_HASHMAP(p), key)))
+        pa_xfree(prop->value);
+    else {
+        const char *k;
+
+        prop = pa_xnew(struct property, 1);
+
+        if ((k = intern_key(key))) {
+            prop->key = (char*) k;
+            prop->static_key = true;
+        } else {
+            prop->key = pa_xstrdup(key);
+            prop->static_key = false;
+        }
+
+        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    }
+
+    prop->value = value;
+    prop->nbytes = nbytes;
+    prop->is_string = is_string;
+}
+
+/** Will accept only valid UTF-8 */
+int pa_proplist_sets(pa_proplist *p, const char *key, const char *value) {
     pa_assert(p);
     pa_assert(key);
     pa_assert(value);
@@ -83,26 +226,13 @@ int pa_proplist_sets(pa_proplist *p, const char *key, const char *value) {
     if (!pa_proplist_key_valid(key) || !pa_utf8_valid(value))
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = true;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = pa_xstrdup(value);
-    prop->nbytes = strlen(value)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    proplist_put(p, key, pa_xstrdup(value), strlen(value)+1, true);
 
     return 0;
 }
 
 /** Will accept only valid UTF-8 */
 static int proplist_setn(pa_proplist *p, const char *key, size_t key_length, const char *value, size_t value_length) {
-    struct property *prop;
-    bool add = false;
     char *k, *v;
 
     pa_assert(p);
@@ -118,20 +248,8 @@ static int proplist_setn(pa_proplist *p, const char *key, size_t key_length, con
         return -1;
     }
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), k))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = k;
-        add = true;
-    } else {
-        pa_xfree(prop->value);
-        pa_xfree(k);
-    }
-
-    prop->value = v;
-    prop->nbytes = strlen(v)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    proplist_put(p, k, v, strlen(v)+1, true);
+    pa_xfree(k);
 
     return 0;
 }
@@ -152,8 +270,6 @@ int pa_proplist_setp(pa_proplist *p, const char *pair) {
 }
 
 static int proplist_sethex(pa_proplist *p, const char *key, size_t key_length, const char *value, size_t value_length) {
-    struct property *prop;
-    bool add = false;
     char *k, *v;
     uint8_t *d;
     size_t dn;
@@ -181,29 +297,15 @@ static int proplist_sethex(pa_proplist *p, const char *key, size_t key_length, c
 
     pa_xfree(v);
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), k))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = k;
-        add = true;
-    } else {
-        pa_xfree(prop->value);
-        pa_xfree(k);
-    }
-
     d[dn] = 0;
-    prop->value = d;
-    prop->nbytes = dn;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    proplist_put(p, k, d, dn, value_is_string(d, dn));
+    pa_xfree(k);
 
     return 0;
 }
 
 /** Will accept only valid UTF-8 */
 int pa_proplist_setf(pa_proplist *p, const char *key, const char *format, ...) {
-    struct property *prop;
-    bool add = false;
     va_list ap;
     char *v;
 
@@ -221,18 +323,7 @@ int pa_proplist_setf(pa_proplist *p, const char *key, const char *format, ...) {
     if (!pa_utf8_valid(v))
         goto fail;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = true;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = v;
-    prop->nbytes = strlen(v)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    proplist_put(p, key, v, strlen(v)+1, true);
 
     return 0;
 
@@ -242,8 +333,7 @@ fail:
 }
 
 int pa_proplist_set(pa_proplist *p, const char *key, const void *data, size_t nbytes) {
-    struct property *prop;
-    bool add = false;
+    char *v;
 
     pa_assert(p);
     pa_assert(key);
@@ -252,47 +342,28 @@ int pa_proplist_set(pa_proplist *p, const char *key, const void *data, size_t nb
     if (!pa_proplist_key_valid(key))
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = true;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = pa_xmalloc(nbytes+1);
+    v = pa_xmalloc(nbytes+1);
     if (nbytes > 0)
-        memcpy(prop->value, data, nbytes);
-    ((char*) prop->value)[nbytes] = 0;
-    prop->nbytes = nbytes;
+        memcpy(v, data, nbytes);
+    v[nbytes] = 0;
 
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    proplist_put(p, key, v, nbytes, value_is_string(v, nbytes));
 
     return 0;
 }
 
+/* Only valid keys are ever stored, so looking up an invalid one fails
+ * just like checking it first would */
 const char *pa_proplist_gets(pa_proplist *p, const char *key) {
     struct property *prop;
 
     pa_assert(p);
     pa_assert(key);
 
-    if (!pa_proplist_key_valid(key))
-        return NULL;
-
     if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key)))
         return NULL;
 
-    if (prop->nbytes <= 0)
-        return NULL;
-
-    if (((char*) prop->value)[prop->nbytes-1] != 0)
-        return NULL;
-
-    if (strlen((char*) prop->value) != prop->nbytes-1)
-        return NULL;
-
-    if (!pa_utf8_valid((char*) prop->value))
+    if (!prop->is_string)
         return NULL;
 
     return (char*) prop->value;
@@ -306,9 +377,6 @@ int pa_proplist_get(pa_proplist *p, const char *key, const void **data, size_t *
     pa_assert(data);
     pa_assert(nbytes);
 
-    if (!pa_proplist_key_valid(key))
-        return -1;
-
     if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key)))
         return -1;
 
@@ -332,11 +400,16 @@ void pa_proplist_update(pa_proplist *p, pa_update_mode_t mode, const pa_proplist
     /* MAKE_HASHMAP turns the const pointer into a non-const pointer, but
      * that's ok, because we don't modify the hashmap contents. */
     while ((prop = pa_hashmap_iterate(MAKE_HASHMAP(other), &state, NULL))) {
+        char *v;
 
-        if (mode == PA_UPDATE_MERGE && pa_proplist_contains(p, prop->key))
+        if (mode == PA_UPDATE_MERGE && pa_hashmap_get(MAKE_HASHMAP(p), prop->key))
             continue;
 
-        pa_assert_se(pa_proplist_set(p, prop->key, prop->value, prop->nbytes) == 0);
+        /* The other list checked the key and the value already */
+        v = pa_xmalloc(prop->nbytes+1);
+        memcpy(v, prop->value, prop->nbytes);
+        v[prop->nbytes] = 0;
+        proplist_put(p, prop->key, v, prop->nbytes, prop->is_string);
     }
 }
 
@@ -380,6 +453,21 @@ const char *pa_proplist_iterate(pa_proplist *p, void **state) {
     return prop->key;
 }
 
+const char *pa_proplist_iterate_data(pa_proplist *p, void **state, const void **data, size_t *nbytes) {
+    struct property *prop;
+
+    pa_assert(data);
+    pa_assert(nbytes);
+
+    if (!(prop = pa_hashmap_iterate(MAKE_HASHMAP(p), state, NULL)))
+        return NULL;
+
+    *data = prop->value;
+    *nbytes = prop->nbytes;
+
+    return prop->key;
+}
+
 char *pa_proplist_to_string_sep(pa_proplist *p, const char *sep) {
     const char *key;
     void *state = NULL;
@@ -637,13 +725,13 @@ int pa_proplist_contains(pa_proplist *p, const char *key) {
     pa_assert(p);
     pa_assert(key);
 
+    if (pa_hashmap_get(MAKE_HASHMAP(p), key))
+        return 1;
+
     if (!pa_proplist_key_valid(key))
         return -1;
 
-    if (!(pa_hashmap_get(MAKE_HASHMAP(p), key)))
-        return 0;
-
-    return 1;
+    return 0;
 }
 
 void pa_proplist_clear(pa_proplist *p) {
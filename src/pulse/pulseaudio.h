@@ -45,6 +45,7 @@
 #include <pulse/timeval.h>
 #include <pulse/proplist.h>
 #include <pulse/rtclock.h>
+#include <pulse/cache.h>
 
 /** \file
  * Include all libpulse header files at once. The following files are
@@ -53,8 +54,8 @@
  * scache.h, \ref version.h, \ref error.h, \ref channelmap.h, \ref
  * operation.h,\ref volume.h, \ref xmalloc.h, \ref utf8.h, \ref
  * thread-mainloop.h, \ref mainloop.h, \ref util.h, \ref proplist.h,
- * \ref timeval.h, \ref rtclock.h and \ref mainloop-signal.h at
- * once */
+ * \ref timeval.h, \ref rtclock.h, \ref mainloop-signal.h and
+ * \ref cache.h at once */
 
 /** \mainpage
  *
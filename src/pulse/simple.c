@@ -44,6 +44,10 @@ struct pa_simple {
     const void *read_data;
     size_t read_index, read_length;
 
+    /* Handed out by pa_simple_begin_write() */
+    pa_pool_buffer *write_buffer;
+    size_t write_buffer_length;
+
     int operation_success;
 };
 
@@ -249,12 +253,47 @@ fail:
     return NULL;
 }
 
+pa_simple* pa_simple_new_with_latency(
+        const char *server,
+        const char *name,
+        pa_stream_direction_t dir,
+        const char *dev,
+        const char *stream_name,
+        const pa_sample_spec *ss,
+        const pa_channel_map *map,
+        pa_usec_t latency,
+        int *rerror) {
+
+    pa_buffer_attr attr;
+
+    CHECK_VALIDITY_RETURN_ANY(rerror, ss && pa_sample_spec_valid(ss), PA_ERR_INVALID, NULL);
+    CHECK_VALIDITY_RETURN_ANY(rerror, latency > 0, PA_ERR_INVALID, NULL);
+
+    /* With PA_STREAM_ADJUST_LATENCY tlength resp. fragsize is the
+     * total latency, the server picks the rest */
+    attr.maxlength = (uint32_t) -1;
+    attr.prebuf = (uint32_t) -1;
+    attr.minreq = (uint32_t) -1;
+    attr.tlength = (uint32_t) -1;
+    attr.fragsize = (uint32_t) -1;
+
+    if (dir == PA_STREAM_PLAYBACK)
+        attr.tlength = (uint32_t) pa_usec_to_bytes(latency, ss);
+    else
+        attr.fragsize = (uint32_t) pa_usec_to_bytes(latency, ss);
+
+    return pa_simple_new(server, name, dir, dev, stream_name, ss, map, &attr, rerror);
+}
+
 void pa_simple_free(pa_simple *s) {
     pa_assert(s);
 
     if (s->mainloop)
         pa_threaded_mainloop_stop(s->mainloop);
 
+    if (s->write_buffer)
+        pa_pool_buffer_unref(s->write_buffer);
+
     if (s->stream)
         pa_stream_unref(s->stream);
 
@@ -309,6 +348,93 @@ unlock_and_fail:
     return -1;
 }
 
+/* Called with the mainloop lock held */
+static int alloc_write_buffer(pa_simple *p, size_t length) {
+    if (p->write_buffer)
+        pa_pool_buffer_unref(p->write_buffer);
+
+    if (!(p->write_buffer = pa_context_new_pool_buffer(p->context, &length)))
+        return -1;
+
+    p->write_buffer_length = length;
+    return 0;
+}
+
+int pa_simple_begin_write(pa_simple *p, void **data, size_t *length, int *rerror) {
+    pa_assert(p);
+
+    CHECK_VALIDITY_RETURN_ANY(rerror, p->direction == PA_STREAM_PLAYBACK, PA_ERR_BADSTATE, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, data, PA_ERR_INVALID, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, length && *length > 0, PA_ERR_INVALID, -1);
+
+    /* Usually pa_simple_commit_write() already allocated the next
+     * buffer, so this doesn't need the mainloop lock */
+    if (!p->write_buffer || (*length != (size_t) -1 && *length > p->write_buffer_length)) {
+        pa_threaded_mainloop_lock(p->mainloop);
+
+        CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+        CHECK_SUCCESS_GOTO(p, rerror, alloc_write_buffer(p, *length) >= 0, unlock_and_fail);
+
+        pa_threaded_mainloop_unlock(p->mainloop);
+    }
+
+    *data = pa_pool_buffer_get_data(p->write_buffer);
+    if (*length == (size_t) -1 || *length > p->write_buffer_length)
+        *length = p->write_buffer_length;
+
+    return 0;
+
+unlock_and_fail:
+    pa_threaded_mainloop_unlock(p->mainloop);
+    return -1;
+}
+
+int pa_simple_commit_write(pa_simple *p, size_t length, int *rerror) {
+    size_t index = 0;
+
+    pa_assert(p);
+
+    CHECK_VALIDITY_RETURN_ANY(rerror, p->direction == PA_STREAM_PLAYBACK, PA_ERR_BADSTATE, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, p->write_buffer, PA_ERR_BADSTATE, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, length > 0 && length <= p->write_buffer_length, PA_ERR_INVALID, -1);
+
+    pa_threaded_mainloop_lock(p->mainloop);
+
+    CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+
+    while (index < length) {
+        size_t l;
+        int r;
+
+        while (!(l = pa_stream_writable_size(p->stream))) {
+            pa_threaded_mainloop_wait(p->mainloop);
+            CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+        }
+
+        CHECK_SUCCESS_GOTO(p, rerror, l != (size_t) -1, unlock_and_fail);
+
+        if (l > length - index)
+            l = length - index;
+
+        /* The stream references the memory, nothing is copied */
+        r = pa_stream_write_pool_buffer(p->stream, p->write_buffer, index, l, 0LL, PA_SEEK_RELATIVE);
+        CHECK_SUCCESS_GOTO(p, rerror, r >= 0, unlock_and_fail);
+
+        index += l;
+    }
+
+    /* The memory we handed out belongs to the stream now, get the
+     * next buffer ready while we hold the lock anyway */
+    CHECK_SUCCESS_GOTO(p, rerror, alloc_write_buffer(p, p->write_buffer_length) >= 0, unlock_and_fail);
+
+    pa_threaded_mainloop_unlock(p->mainloop);
+    return 0;
+
+unlock_and_fail:
+    pa_threaded_mainloop_unlock(p->mainloop);
+    return -1;
+}
+
 int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
     pa_assert(p);
 
@@ -74,6 +74,10 @@
  * system calls. The main difference is that they're called pa_simple_read()
  * and pa_simple_write(). Note that these operations always block.
  *
+ * To avoid copying playback data, it can be placed directly in a buffer
+ * obtained with pa_simple_begin_write() and passed on with
+ * pa_simple_commit_write().
+ *
  * \section ctrl_sec Buffer control
  *
  * \li pa_simple_get_latency() - Will return the total latency of
@@ -127,12 +131,43 @@ pa_simple* pa_simple_new(
     int *error                          /**< A pointer where the error code is stored when the routine returns NULL. It is OK to pass NULL here. */
     );
 
+/** Create a new connection to the server, asking for a total
+ * playback resp. record latency of \a latency. This is a shortcut
+ * for pa_simple_new() with buffering attributes derived from that
+ * latency. \since 12.0 */
+pa_simple* pa_simple_new_with_latency(
+    const char *server,                 /**< Server name, or NULL for default */
+    const char *name,                   /**< A descriptive name for this client (application name, ...) */
+    pa_stream_direction_t dir,          /**< Open this stream for recording or playback? */
+    const char *dev,                    /**< Sink (resp. source) name, or NULL for default */
+    const char *stream_name,            /**< A descriptive name for this stream (application name, song title, ...) */
+    const pa_sample_spec *ss,           /**< The sample type to use */
+    const pa_channel_map *map,          /**< The channel map to use, or NULL for default */
+    pa_usec_t latency,                  /**< The target latency in usec */
+    int *error                          /**< A pointer where the error code is stored when the routine returns NULL. It is OK to pass NULL here. */
+    );
+
 /** Close and free the connection to the server. The connection object becomes invalid when this is called. */
 void pa_simple_free(pa_simple *s);
 
 /** Write some data to the server. */
 int pa_simple_write(pa_simple *s, const void *data, size_t bytes, int *error);
 
+/** Get a buffer to place playback data in, which is then passed to
+ * the server with pa_simple_commit_write() without being copied. On
+ * invocation \a *bytes is the size wanted, or (size_t) -1 for the
+ * default, on return it is the size available, which may be smaller.
+ * Usually this doesn't block or take any locks. Calling it again
+ * before pa_simple_commit_write() returns the same buffer. Returns a
+ * negative value on failure. \since 12.0 */
+int pa_simple_begin_write(pa_simple *s, void **data, size_t *bytes, int *error);
+
+/** Write the first \a bytes bytes of the buffer returned by
+ * pa_simple_begin_write() to the server. Blocks like pa_simple_write()
+ * until the data was accepted. The buffer must not be accessed
+ * afterwards. Returns a negative value on failure. \since 12.0 */
+int pa_simple_commit_write(pa_simple *s, size_t bytes, int *error);
+
 /** Wait until all data already written is played by the daemon. */
 int pa_simple_drain(pa_simple *s, int *error);
 
@@ -24,6 +24,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 #include <string.h>
 
 #include <pulse/def.h>
@@ -48,10 +49,22 @@
 #define AUTO_TIMING_INTERVAL_START_USEC (10*PA_USEC_PER_MSEC)
 #define AUTO_TIMING_INTERVAL_END_USEC (1500*PA_USEC_PER_MSEC)
 
+/* The timing page is updated whenever the sink asks the stream for data,
+ * which it doesn't do while it or the stream is not playing */
+#define TIMING_PAGE_MAX_AGE_USEC (100*PA_USEC_PER_MSEC)
+#define TIMING_PAGE_READ_TRIES 16
+
 #define SMOOTHER_ADJUST_TIME (1000*PA_USEC_PER_MSEC)
 #define SMOOTHER_HISTORY_TIME (5000*PA_USEC_PER_MSEC)
 #define SMOOTHER_MIN_HISTORY (4)
 
+static bool timing_page_update(pa_stream *s);
+static void timing_batch_send(pa_context *c);
+static void enable_timing_page(pa_stream *s);
+static void data_ring_sync(pa_stream *s);
+static void data_ring_invalidate(pa_stream *s);
+static void data_ring_free(pa_stream *s);
+
 pa_stream *pa_stream_new(pa_context *c, const char *name, const pa_sample_spec *ss, const pa_channel_map *map) {
     return pa_stream_new_with_proplist(c, name, ss, map, NULL);
 }
@@ -173,8 +186,15 @@ static pa_stream *pa_stream_new_with_proplist_internal(
     s->write_memblock = NULL;
     s->write_data = NULL;
 
+    pa_zero(s->write_ring);
+    pa_atomic_store(&s->write_ring_count, 0);
+    s->write_ring_sem = NULL;
+    s->write_ring_event = NULL;
+
     pa_memchunk_reset(&s->peek_memchunk);
     s->peek_data = NULL;
+    s->peek_fragments = NULL;
+    s->n_peek_fragments = s->n_peek_fragments_allocated = 0;
     s->record_memblockq = NULL;
 
     memset(&s->timing_info, 0, sizeof(s->timing_info));
@@ -191,12 +211,22 @@ static pa_stream *pa_stream_new_with_proplist_internal(
 
     s->auto_timing_update_event = NULL;
     s->auto_timing_update_requested = false;
+    s->timing_batch_pending = false;
     s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
+    s->auto_timing_update_at = 0;
 
     reset_callbacks(s);
 
     s->smoother = NULL;
 
+    s->timing_page = NULL;
+    s->timing_page_read_at = 0;
+
+    s->data_ring = NULL;
+    pa_zero(s->data_ring_rb);
+    s->data_ring_sem = NULL;
+    s->data_ring_ok = s->data_ring_syncing = s->data_ring_dirty = false;
+
     /* Refcounting is strictly one-way: from the "bigger" to the "smaller" object. */
     PA_LLIST_PREPEND(pa_stream, c->streams, s);
     pa_stream_ref(s);
@@ -264,6 +294,14 @@ static void stream_unlink(pa_stream *s) {
         s->channel_valid = false;
     }
 
+    if (s->timing_page) {
+        pa_memblock_unref(s->timing_page);
+        s->timing_page = NULL;
+    }
+
+    data_ring_free(s);
+    s->data_ring_syncing = false;
+
     PA_LLIST_REMOVE(pa_stream, s->context->streams, s);
     pa_stream_unref(s);
 
@@ -274,9 +312,31 @@ static void stream_unlink(pa_stream *s) {
         s->mainloop->time_free(s->auto_timing_update_event);
     }
 
+    if (s->write_ring_event) {
+        pa_assert(s->mainloop);
+        s->mainloop->io_free(s->write_ring_event);
+        s->write_ring_event = NULL;
+    }
+
     reset_callbacks(s);
 }
 
+/* Returns the number of bytes the fragments covered */
+static size_t peek_fragments_release(pa_stream *s) {
+    size_t length = 0;
+    unsigned k;
+
+    for (k = 0; k < s->n_peek_fragments; k++) {
+        length += s->peek_fragments[k].length;
+        pa_memblock_release(s->peek_fragments[k].memblock);
+        pa_memblock_unref(s->peek_fragments[k].memblock);
+    }
+
+    s->n_peek_fragments = 0;
+
+    return length;
+}
+
 static void stream_free(pa_stream *s) {
     unsigned int i;
 
@@ -290,12 +350,19 @@ static void stream_free(pa_stream *s) {
         pa_memblock_unref(s->write_memblock);
     }
 
+    if (s->write_ring_sem)
+        pa_fdsem_free(s->write_ring_sem);
+    pa_xfree(s->write_ring.memory);
+
     if (s->peek_memchunk.memblock) {
         if (s->peek_data)
             pa_memblock_release(s->peek_memchunk.memblock);
         pa_memblock_unref(s->peek_memchunk.memblock);
     }
 
+    peek_fragments_release(s);
+    pa_xfree(s->peek_fragments);
+
     if (s->record_memblockq)
         pa_memblockq_free(s->record_memblockq);
 
@@ -355,6 +422,8 @@ uint32_t pa_stream_get_index(pa_stream *s) {
     return s->stream_index;
 }
 
+static void write_ring_drain(pa_stream *s);
+
 void pa_stream_set_state(pa_stream *s, pa_stream_state_t st) {
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
@@ -366,6 +435,10 @@ void pa_stream_set_state(pa_stream *s, pa_stream_state_t st) {
 
     s->state = st;
 
+    /* Send what was queued in the write ring before we were ready */
+    if (st == PA_STREAM_READY && s->write_ring_sem)
+        write_ring_drain(s);
+
     if (s->state_callback)
         s->state_callback(s, s->state_userdata);
 
@@ -386,18 +459,31 @@ static void request_auto_timing_update(pa_stream *s, bool force) {
         (force || !s->auto_timing_update_requested)) {
         pa_operation *o;
 
+        if (!force && timing_page_update(s)) {
+            if (s->latency_update_callback)
+                s->latency_update_callback(s, s->latency_update_userdata);
+
+        } else if (!force && s->context->version >= 33) {
+            /* Queried together with the other streams of the context by
+             * timing_batch_send() */
+            s->timing_batch_pending = true;
+
+        } else {
 #ifdef STREAM_DEBUG
-        pa_log_debug("Automatically requesting new timing data");
+            pa_log_debug("Automatically requesting new timing data");
 #endif
 
-        if ((o = pa_stream_update_timing_info(s, NULL, NULL))) {
-            pa_operation_unref(o);
-            s->auto_timing_update_requested = true;
+            if ((o = pa_stream_update_timing_info(s, NULL, NULL))) {
+                pa_operation_unref(o);
+                s->auto_timing_update_requested = true;
+            }
         }
     }
 
     if (s->auto_timing_update_event) {
-        if (s->suspended && !force) {
+        /* Nothing moves while corked or suspended, so don't keep the
+         * client waking up, see start_auto_timing_update() */
+        if ((s->suspended || s->corked) && !force) {
             pa_assert(s->mainloop);
             s->mainloop->time_free(s->auto_timing_update_event);
             s->auto_timing_update_event = NULL;
@@ -405,7 +491,8 @@ static void request_auto_timing_update(pa_stream *s, bool force) {
             if (force)
                 s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
 
-            pa_context_rttime_restart(s->context, s->auto_timing_update_event, pa_rtclock_now() + s->auto_timing_interval_usec);
+            s->auto_timing_update_at = pa_rtclock_now() + s->auto_timing_interval_usec;
+            pa_context_rttime_restart(s->context, s->auto_timing_update_event, s->auto_timing_update_at);
 
             s->auto_timing_interval_usec = PA_MIN(AUTO_TIMING_INTERVAL_END_USEC, s->auto_timing_interval_usec*2);
         }
@@ -491,6 +578,21 @@ static void check_smoother_status(pa_stream *s, bool aposteriori, bool force_sta
 
 static void auto_timing_update_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata);
 
+/* Starts the timer again if request_auto_timing_update() freed it,
+ * returns true if it did */
+static bool start_auto_timing_update(pa_stream *s) {
+    pa_assert(s);
+
+    if (!(s->flags & PA_STREAM_AUTO_TIMING_UPDATE) || s->auto_timing_update_event || s->suspended || s->corked)
+        return false;
+
+    s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
+    s->auto_timing_update_at = pa_rtclock_now() + s->auto_timing_interval_usec;
+    s->auto_timing_update_event = pa_context_rttime_new(s->context, s->auto_timing_update_at, &auto_timing_update_callback, s);
+
+    return true;
+}
+
 void pa_command_stream_moved(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_context *c = userdata;
     pa_stream *s;
@@ -578,11 +680,8 @@ void pa_command_stream_moved(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
 
     s->suspended = suspended;
 
-    if ((s->flags & PA_STREAM_AUTO_TIMING_UPDATE) && !suspended && !s->auto_timing_update_event) {
-        s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
-        s->auto_timing_update_event = pa_context_rttime_new(s->context, pa_rtclock_now() + s->auto_timing_interval_usec, &auto_timing_update_callback, s);
+    if (start_auto_timing_update(s))
         request_auto_timing_update(s, true);
-    }
 
     check_smoother_status(s, true, false, false);
     request_auto_timing_update(s, true);
@@ -702,11 +801,8 @@ void pa_command_stream_suspended(pa_pdispatch *pd, uint32_t command, uint32_t ta
 
     s->suspended = suspended;
 
-    if ((s->flags & PA_STREAM_AUTO_TIMING_UPDATE) && !suspended && !s->auto_timing_update_event) {
-        s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
-        s->auto_timing_update_event = pa_context_rttime_new(s->context, pa_rtclock_now() + s->auto_timing_interval_usec, &auto_timing_update_callback, s);
+    if (start_auto_timing_update(s))
         request_auto_timing_update(s, true);
-    }
 
     check_smoother_status(s, true, false, false);
     request_auto_timing_update(s, true);
@@ -950,12 +1046,28 @@ static void invalidate_indexes(pa_stream *s, bool r, bool w) {
 
 static void auto_timing_update_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     pa_stream *s = userdata;
+    pa_context *c;
 
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
 
     pa_stream_ref(s);
     request_auto_timing_update(s, false);
+
+    /* Take along the streams whose timers would fire soon anyway, so
+     * that they end up in the same batch from now on */
+    if ((c = s->context) && c->version >= 33) {
+        pa_usec_t now = pa_rtclock_now();
+        pa_stream *i;
+
+        PA_LLIST_FOREACH(i, c->streams)
+            if (i != s && i->auto_timing_update_event &&
+                i->auto_timing_update_at <= now + i->auto_timing_interval_usec / 4)
+                request_auto_timing_update(i, false);
+
+        timing_batch_send(c);
+    }
+
     pa_stream_unref(s);
 }
 
@@ -966,15 +1078,25 @@ static void create_stream_complete(pa_stream *s) {
 
     pa_stream_set_state(s, PA_STREAM_READY);
 
+    /* Before the application gets to write anything, so that the ring
+     * is there as early as possible */
+    if (s->context->version >= 33 &&
+        s->direction == PA_STREAM_PLAYBACK &&
+        pa_pstream_get_shm(s->context->pstream) &&
+        (size_t) s->buffer_attr.tlength * 2 <= pa_mempool_block_size_max(s->context->mempool))
+        data_ring_sync(s);
+
     if (s->requested_bytes > 0 && s->write_callback)
         s->write_callback(s, (size_t) s->requested_bytes, s->write_userdata);
 
     if (s->flags & PA_STREAM_AUTO_TIMING_UPDATE) {
-        s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
         pa_assert(!s->auto_timing_update_event);
-        s->auto_timing_update_event = pa_context_rttime_new(s->context, pa_rtclock_now() + s->auto_timing_interval_usec, &auto_timing_update_callback, s);
+
+        /* Streams created corked get their timer once uncorked */
+        start_auto_timing_update(s);
 
         request_auto_timing_update(s, true);
+        enable_timing_page(s);
     }
 
     check_smoother_status(s, true, false, false);
@@ -1471,6 +1593,90 @@ int pa_stream_cancel_write(
     return 0;
 }
 
+/* Update the write index bookkeeping after length bytes were sent */
+static void account_write(pa_stream *s, size_t length, int64_t offset, pa_seek_mode_t seek) {
+    /* This is obviously wrong since we ignore the seeking index . But
+     * that's OK, the server side applies the same error */
+    s->requested_bytes -= (seek == PA_SEEK_RELATIVE ? offset : 0) + (int64_t) length;
+
+#ifdef STREAM_DEBUG
+    pa_log_debug("wrote %lli, now at %lli", (long long) length, (long long) s->requested_bytes);
+#endif
+
+    if (s->direction == PA_STREAM_PLAYBACK) {
+
+        /* Update latency request correction */
+        if (s->write_index_corrections[s->current_write_index_correction].valid) {
+
+            if (seek == PA_SEEK_ABSOLUTE) {
+                s->write_index_corrections[s->current_write_index_correction].corrupt = false;
+                s->write_index_corrections[s->current_write_index_correction].absolute = true;
+                s->write_index_corrections[s->current_write_index_correction].value = offset + (int64_t) length;
+            } else if (seek == PA_SEEK_RELATIVE) {
+                if (!s->write_index_corrections[s->current_write_index_correction].corrupt)
+                    s->write_index_corrections[s->current_write_index_correction].value += offset + (int64_t) length;
+            } else
+                s->write_index_corrections[s->current_write_index_correction].corrupt = true;
+        }
+
+        /* Update the write index in the already available latency data */
+        if (s->timing_info_valid) {
+
+            if (seek == PA_SEEK_ABSOLUTE) {
+                s->timing_info.write_index_corrupt = false;
+                s->timing_info.write_index = offset + (int64_t) length;
+            } else if (seek == PA_SEEK_RELATIVE) {
+                if (!s->timing_info.write_index_corrupt)
+                    s->timing_info.write_index += offset + (int64_t) length;
+            } else
+                s->timing_info.write_index_corrupt = true;
+        }
+
+        if (!s->timing_info_valid || s->timing_info.write_index_corrupt)
+            request_auto_timing_update(s, true);
+    }
+}
+
+/* Puts the chunk into the data ring, if we may and it fits. Records only
+ * become visible to the server once they are complete. */
+static bool data_ring_write(pa_stream *s, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk) {
+    pa_ringbuffer *rb = &s->data_ring_rb;
+    pa_native_data_record r;
+    size_t n;
+    void *d;
+
+    if (!s->data_ring_ok)
+        return false;
+
+    n = sizeof(r) + chunk->length;
+    if (n > (size_t) (rb->capacity - pa_atomic_load(rb->count)))
+        return false;
+
+    r.offset = offset;
+    r.seek = (uint32_t) seek;
+    r.length = (uint32_t) chunk->length;
+
+    d = pa_memblock_acquire(chunk->memblock);
+    pa_ringbuffer_copy_in(rb, 0, &r, sizeof(r));
+    pa_ringbuffer_copy_in(rb, sizeof(r), (const uint8_t*) d + chunk->index, (int) chunk->length);
+    pa_memblock_release(chunk->memblock);
+
+    /* The sink thread might be asleep only if it found the ring empty */
+    if (pa_ringbuffer_end_write(rb, (int) n))
+        pa_fdsem_post(s->data_ring_sem);
+
+    return true;
+}
+
+static void stream_send_chunk(pa_stream *s, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk) {
+    if (data_ring_write(s, offset, seek, chunk))
+        return;
+
+    /* The ring must not overtake this */
+    data_ring_invalidate(s);
+    pa_pstream_send_memblock(s->context->pstream, s->channel, offset, seek, chunk);
+}
+
 int pa_stream_write_ext_free(
         pa_stream *s,
         const void *data,
@@ -1512,7 +1718,7 @@ int pa_stream_write_ext_free(
         s->write_memblock = NULL;
         s->write_data = NULL;
 
-        pa_pstream_send_memblock(s->context->pstream, s->channel, offset, seek, &chunk);
+        stream_send_chunk(s, offset, seek, &chunk);
         pa_memblock_unref(chunk.memblock);
 
     } else {
@@ -1546,7 +1752,7 @@ int pa_stream_write_ext_free(
                 pa_memblock_release(chunk.memblock);
             }
 
-            pa_pstream_send_memblock(s->context->pstream, s->channel, t_offset, t_seek, &chunk);
+            stream_send_chunk(s, t_offset, t_seek, &chunk);
 
             t_offset = 0;
             t_seek = PA_SEEK_RELATIVE;
@@ -1561,50 +1767,195 @@ int pa_stream_write_ext_free(
             free_cb(free_cb_data);
     }
 
-    /* This is obviously wrong since we ignore the seeking index . But
-     * that's OK, the server side applies the same error */
-    s->requested_bytes -= (seek == PA_SEEK_RELATIVE ? offset : 0) + (int64_t) length;
+    account_write(s, length, offset, seek);
 
-#ifdef STREAM_DEBUG
-    pa_log_debug("wrote %lli, now at %lli", (long long) length, (long long) s->requested_bytes);
-#endif
+    return 0;
+}
 
-    if (s->direction == PA_STREAM_PLAYBACK) {
+int pa_stream_write_pool_buffer(
+        pa_stream *s,
+        pa_pool_buffer *b,
+        size_t index,
+        size_t length,
+        int64_t offset,
+        pa_seek_mode_t seek) {
 
-        /* Update latency request correction */
-        if (s->write_index_corrections[s->current_write_index_correction].valid) {
+    pa_memchunk chunk;
 
-            if (seek == PA_SEEK_ABSOLUTE) {
-                s->write_index_corrections[s->current_write_index_correction].corrupt = false;
-                s->write_index_corrections[s->current_write_index_correction].absolute = true;
-                s->write_index_corrections[s->current_write_index_correction].value = offset + (int64_t) length;
-            } else if (seek == PA_SEEK_RELATIVE) {
-                if (!s->write_index_corrections[s->current_write_index_correction].corrupt)
-                    s->write_index_corrections[s->current_write_index_correction].value += offset + (int64_t) length;
-            } else
-                s->write_index_corrections[s->current_write_index_correction].corrupt = true;
-        }
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(b);
+    pa_assert(PA_REFCNT_VALUE(b) >= 1);
 
-        /* Update the write index in the already available latency data */
-        if (s->timing_info_valid) {
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, seek <= PA_SEEK_RELATIVE_END, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || (seek == PA_SEEK_RELATIVE && offset == 0), PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, pa_memblock_get_pool(b->memblock) == s->context->mempool, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, length > 0 && index + length <= pa_memblock_get_length(b->memblock), PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, offset % pa_frame_size(&s->sample_spec) == 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, length % pa_frame_size(&s->sample_spec) == 0, PA_ERR_INVALID);
 
-            if (seek == PA_SEEK_ABSOLUTE) {
-                s->timing_info.write_index_corrupt = false;
-                s->timing_info.write_index = offset + (int64_t) length;
-            } else if (seek == PA_SEEK_RELATIVE) {
-                if (!s->timing_info.write_index_corrupt)
-                    s->timing_info.write_index += offset + (int64_t) length;
-            } else
-                s->timing_info.write_index_corrupt = true;
-        }
+    /* The pstream takes its own reference to the memblock, the
+     * application keeps the buffer and its mapping. */
+    chunk.memblock = b->memblock;
+    chunk.index = index;
+    chunk.length = length;
 
-        if (!s->timing_info_valid || s->timing_info.write_index_corrupt)
-            request_auto_timing_update(s, true);
+    stream_send_chunk(s, offset, seek, &chunk);
+
+    account_write(s, length, offset, seek);
+
+    return 0;
+}
+
+/* Called from the mainloop thread, with the lock held. Sends everything
+ * the application has put into the write ring so far. */
+static void write_ring_drain(pa_stream *s) {
+    size_t blk_size_max;
+
+    if (s->state != PA_STREAM_READY)
+        return;
+
+    blk_size_max = pa_frame_align(pa_mempool_block_size_max(s->context->mempool), &s->sample_spec);
+
+    for (;;) {
+        pa_memchunk chunk;
+        void *p, *d;
+        int n;
+
+        p = pa_ringbuffer_peek(&s->write_ring, &n);
+        if (n <= 0)
+            break;
+
+        /* The ring only ever holds whole frames and its capacity is
+         * a multiple of the frame size, so n is frame aligned. */
+        chunk.index = 0;
+        chunk.length = PA_MIN((size_t) n, blk_size_max);
+        chunk.memblock = pa_memblock_new(s->context->mempool, chunk.length);
+
+        d = pa_memblock_acquire(chunk.memblock);
+        memcpy(d, p, chunk.length);
+        pa_memblock_release(chunk.memblock);
+
+        pa_ringbuffer_drop(&s->write_ring, (int) chunk.length);
+
+        stream_send_chunk(s, 0, PA_SEEK_RELATIVE, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
+        account_write(s, chunk.length, 0, PA_SEEK_RELATIVE);
     }
+}
+
+/* The writer only posts write_ring_sem when it put data into an empty
+ * ring, so we keep draining until pa_fdsem_before_poll() confirms that
+ * nothing slipped in after we last looked. */
+static void write_ring_cb(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    pa_stream_ref(s);
+
+    pa_fdsem_after_poll(s->write_ring_sem);
+
+    do
+        write_ring_drain(s);
+    while (s->write_ring_sem && pa_fdsem_before_poll(s->write_ring_sem) < 0);
+
+    pa_stream_unref(s);
+}
+
+int pa_stream_enable_write_ring(pa_stream *s, size_t nbytes) {
+    size_t fs;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_CREATING || s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, !s->write_ring_sem, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, nbytes > 0 && nbytes <= INT_MAX / 2, PA_ERR_INVALID);
+
+    fs = pa_frame_size(&s->sample_spec);
+
+    if (!(s->write_ring_sem = pa_fdsem_new()))
+        PA_FAIL(s->context, PA_ERR_INTERNAL);
+
+    s->write_ring.capacity = (int) PA_ROUND_UP(nbytes, fs);
+    s->write_ring.memory = pa_xmalloc((size_t) s->write_ring.capacity);
+    s->write_ring.count = &s->write_ring_count;
+    s->write_ring.readindex = s->write_ring.writeindex = 0;
+    pa_atomic_store(&s->write_ring_count, 0);
+
+    s->write_ring_event = s->mainloop->io_new(s->mainloop, pa_fdsem_get(s->write_ring_sem), PA_IO_EVENT_INPUT, write_ring_cb, s);
+
+    /* Announce that we're waiting, so that the first write wakes us up */
+    pa_assert_se(pa_fdsem_before_poll(s->write_ring_sem) >= 0);
 
     return 0;
 }
 
+size_t pa_stream_ring_writable_size(pa_stream *s) {
+    size_t n;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    /* Called without the mainloop lock, so don't touch the context */
+    if (!s->write_ring.memory)
+        return (size_t) -1;
+
+    n = (size_t) (s->write_ring.capacity - pa_atomic_load(&s->write_ring_count));
+    return pa_frame_align(n, &s->sample_spec);
+}
+
+size_t pa_stream_ring_write(pa_stream *s, const void *data, size_t nbytes) {
+    size_t written = 0;
+    bool was_empty = false;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(data);
+
+    /* Called without the mainloop lock, so don't touch the context */
+    if (!s->write_ring.memory)
+        return (size_t) -1;
+
+    nbytes = pa_frame_align(nbytes, &s->sample_spec);
+
+    /* Only write whole frames, so that the reader never has to split
+     * one. The capacity is frame aligned, hence so is every region
+     * handed out by pa_ringbuffer_begin_write() once we stick to it. */
+    nbytes = PA_MIN(nbytes, pa_stream_ring_writable_size(s));
+
+    while (written < nbytes) {
+        int n;
+        void *p = pa_ringbuffer_begin_write(&s->write_ring, &n);
+
+        if ((size_t) n > nbytes - written)
+            n = (int) (nbytes - written);
+
+        if (n <= 0)
+            break;
+
+        memcpy(p, (const uint8_t*) data + written, (size_t) n);
+
+        if (pa_ringbuffer_end_write(&s->write_ring, n))
+            was_empty = true;
+
+        written += (size_t) n;
+    }
+
+    if (was_empty)
+        pa_fdsem_post(s->write_ring_sem);
+
+    return written;
+}
+
 int pa_stream_write(
         pa_stream *s,
         const void *data,
@@ -1625,6 +1976,7 @@ int pa_stream_peek(pa_stream *s, const void **data, size_t *length) {
     PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
     PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_RECORD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->n_peek_fragments <= 0, PA_ERR_BADSTATE);
 
     if (!s->peek_memchunk.memblock) {
 
@@ -1651,20 +2003,82 @@ int pa_stream_peek(pa_stream *s, const void **data, size_t *length) {
     return 0;
 }
 
+int pa_stream_peek_fragments(pa_stream *s, pa_stream_fragment *fragments, unsigned n, size_t max_bytes) {
+    unsigned m, k;
+    size_t left = max_bytes;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(fragments);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_RECORD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, n > 0 && max_bytes > 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, s->peek_memchunk.length <= 0, PA_ERR_BADSTATE);
+
+    /* Nothing was dropped yet, so peek again from the same place */
+    peek_fragments_release(s);
+
+    if (n > s->n_peek_fragments_allocated) {
+        s->peek_fragments = pa_xrenew(pa_memchunk, s->peek_fragments, n);
+        s->n_peek_fragments_allocated = n;
+    }
+
+    if (!(m = pa_memblockq_peek_chunks(s->record_memblockq, s->peek_fragments, n))) {
+        const void *data;
+        size_t length;
+
+        /* The buffer is empty, or there is a hole at the read index,
+         * which is what pa_stream_peek() is there for */
+        pa_assert_se(pa_stream_peek(s, &data, &length) == 0);
+        pa_assert(!data);
+
+        if (length <= 0)
+            return 0;
+
+        fragments[0].data = NULL;
+        fragments[0].length = s->peek_memchunk.length = PA_MIN(length, max_bytes);
+        return 1;
+    }
+
+    for (k = 0; k < m; k++) {
+        pa_memchunk *chunk = &s->peek_fragments[k];
+
+        if (left <= 0) {
+            pa_memblock_unref(chunk->memblock);
+            continue;
+        }
+
+        chunk->length = PA_MIN(chunk->length, left);
+        left -= chunk->length;
+
+        fragments[k].data = (const uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+        fragments[k].length = chunk->length;
+        s->n_peek_fragments++;
+    }
+
+    return (int) s->n_peek_fragments;
+}
+
 int pa_stream_drop(pa_stream *s) {
+    size_t length;
+
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
 
     PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
     PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_RECORD, PA_ERR_BADSTATE);
-    PA_CHECK_VALIDITY(s->context, s->peek_memchunk.length > 0, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->peek_memchunk.length > 0 || s->n_peek_fragments > 0, PA_ERR_BADSTATE);
 
-    pa_memblockq_drop(s->record_memblockq, s->peek_memchunk.length);
+    length = s->peek_memchunk.length + peek_fragments_release(s);
+
+    pa_memblockq_drop(s->record_memblockq, length);
 
     /* Fix the simulated local read index */
     if (s->timing_info_valid && !s->timing_info.read_index_corrupt)
-        s->timing_info.read_index += (int64_t) s->peek_memchunk.length;
+        s->timing_info.read_index += (int64_t) length;
 
     if (s->peek_memchunk.memblock) {
         pa_assert(s->peek_data);
@@ -1724,6 +2138,8 @@ pa_operation * pa_stream_drain(pa_stream *s, pa_stream_success_cb_t cb, void *us
     pa_pstream_send_tagstruct(s->context->pstream, t);
     pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, pa_stream_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
+    data_ring_invalidate(s);
+
     /* This might cause the read index to continue again, hence
      * let's request a timing update */
     request_auto_timing_update(s, true);
@@ -1792,12 +2208,221 @@ static pa_usec_t calc_time(pa_stream *s, bool ignore_transport) {
     return usec;
 }
 
+static void update_smoother(pa_stream *s) {
+    pa_timing_info *i = &s->timing_info;
+    pa_usec_t u, x;
+
+    /* Update smoother if we're not corked */
+    if (!s->smoother || s->corked)
+        return;
+
+    u = x = pa_rtclock_now() - i->transport_usec;
+
+    if (s->direction == PA_STREAM_PLAYBACK && s->context->version >= 13) {
+        pa_usec_t su;
+
+        /* If we weren't playing then it will take some time
+         * until the audio will actually come out through the
+         * speakers. Since we follow that timing here, we need
+         * to try to fix this up */
+
+        su = pa_bytes_to_usec((uint64_t) i->since_underrun, &s->sample_spec);
+
+        if (su < i->sink_usec)
+            x += i->sink_usec - su;
+    }
+
+    if (!i->playing)
+        pa_smoother_pause(s->smoother, x);
+
+    /* Update the smoother */
+    if ((s->direction == PA_STREAM_PLAYBACK && !i->read_index_corrupt) ||
+        (s->direction == PA_STREAM_RECORD && !i->write_index_corrupt))
+        pa_smoother_put(s->smoother, u, calc_time(s, true));
+
+    if (i->playing)
+        pa_smoother_resume(s->smoother, x, true);
+}
+
+/* The fields of a latency reply */
+struct timing_reply {
+    pa_usec_t sink_usec, source_usec;
+    bool playing;
+    struct timeval local, remote;
+    int64_t write_index, read_index;
+    uint64_t underrun_for, playing_for;
+};
+
+/* Streams whose timing is queried with one PA_COMMAND_GET_LATENCY_BATCH */
+struct timing_batch {
+    pa_context *context;
+    unsigned n_streams;
+    pa_stream **streams;
+};
+
+static int timing_reply_get(pa_stream *s, pa_tagstruct *t, struct timing_reply *r) {
+    pa_zero(*r);
+
+    if (pa_tagstruct_get_usec(t, &r->sink_usec) < 0 ||
+        pa_tagstruct_get_usec(t, &r->source_usec) < 0 ||
+        pa_tagstruct_get_boolean(t, &r->playing) < 0 ||
+        pa_tagstruct_get_timeval(t, &r->local) < 0 ||
+        pa_tagstruct_get_timeval(t, &r->remote) < 0 ||
+        pa_tagstruct_gets64(t, &r->write_index) < 0 ||
+        pa_tagstruct_gets64(t, &r->read_index) < 0)
+        return -1;
+
+    if (s->context->version >= 13 &&
+        s->direction == PA_STREAM_PLAYBACK)
+        if (pa_tagstruct_getu64(t, &r->underrun_for) < 0 ||
+            pa_tagstruct_getu64(t, &r->playing_for) < 0)
+            return -1;
+
+    return 0;
+}
+
+static void timing_info_invalidate(pa_stream *s) {
+    s->timing_info_valid = false;
+    s->timing_info.write_index_corrupt = true;
+    s->timing_info.read_index_corrupt = true;
+}
+
+/* Takes over the fields of a reply to the query sent with tag */
+static void timing_info_update(pa_stream *s, uint32_t tag, const struct timing_reply *r) {
+    pa_timing_info *i = &s->timing_info;
+    struct timeval now;
+
+    s->timing_info_valid = true;
+    i->sink_usec = r->sink_usec;
+    i->source_usec = r->source_usec;
+    i->write_index = r->write_index;
+    i->read_index = r->read_index;
+    i->write_index_corrupt = false;
+    i->read_index_corrupt = false;
+
+    i->playing = (int) r->playing;
+    i->since_underrun = (int64_t) (r->playing ? r->playing_for : r->underrun_for);
+
+    pa_gettimeofday(&now);
+
+    /* Calculate timestamps */
+    if (pa_timeval_cmp(&r->local, &r->remote) <= 0 && pa_timeval_cmp(&r->remote, &now) <= 0) {
+        /* local and remote seem to have synchronized clocks */
+
+        if (s->direction == PA_STREAM_PLAYBACK)
+            i->transport_usec = pa_timeval_diff(&r->remote, &r->local);
+        else
+            i->transport_usec = pa_timeval_diff(&now, &r->remote);
+
+        i->synchronized_clocks = true;
+        i->timestamp = r->remote;
+    } else {
+        /* clocks are not synchronized, let's estimate latency then */
+        i->transport_usec = pa_timeval_diff(&now, &r->local)/2;
+        i->synchronized_clocks = false;
+        i->timestamp = r->local;
+        pa_timeval_add(&i->timestamp, i->transport_usec);
+    }
+
+    /* Invalidate read and write indexes if necessary */
+    if (tag < s->read_index_not_before)
+        i->read_index_corrupt = true;
+
+    if (tag < s->write_index_not_before)
+        i->write_index_corrupt = true;
+
+    if (s->direction == PA_STREAM_PLAYBACK) {
+        /* Write index correction */
+
+        int n, j;
+        uint32_t ctag = tag;
+
+        /* Go through the saved correction values and add up the
+         * total correction.*/
+        for (n = 0, j = s->current_write_index_correction+1;
+             n < PA_MAX_WRITE_INDEX_CORRECTIONS;
+             n++, j = (j + 1) % PA_MAX_WRITE_INDEX_CORRECTIONS) {
+
+            /* Step over invalid data or out-of-date data */
+            if (!s->write_index_corrections[j].valid ||
+                s->write_index_corrections[j].tag < ctag)
+                continue;
+
+            /* Make sure that everything is in order */
+            ctag = s->write_index_corrections[j].tag+1;
+
+            /* Now fix the write index */
+            if (s->write_index_corrections[j].corrupt) {
+                /* A corrupting seek was made */
+                i->write_index_corrupt = true;
+            } else if (s->write_index_corrections[j].absolute) {
+                /* An absolute seek was made */
+                i->write_index = s->write_index_corrections[j].value;
+                i->write_index_corrupt = false;
+            } else if (!i->write_index_corrupt) {
+                /* A relative seek was made */
+                i->write_index += s->write_index_corrections[j].value;
+            }
+        }
+
+        /* Clear old correction entries */
+        for (n = 0; n < PA_MAX_WRITE_INDEX_CORRECTIONS; n++) {
+            if (!s->write_index_corrections[n].valid)
+                continue;
+
+            if (s->write_index_corrections[n].tag <= tag)
+                s->write_index_corrections[n].valid = false;
+        }
+    }
+
+    if (s->direction == PA_STREAM_RECORD) {
+        /* Read index correction */
+
+        if (!i->read_index_corrupt)
+            i->read_index -= (int64_t) pa_memblockq_get_length(s->record_memblockq);
+    }
+
+    update_smoother(s);
+}
+
+static void timing_info_done(pa_stream *s) {
+    s->auto_timing_update_requested = false;
+
+    if (s->latency_update_callback)
+        s->latency_update_callback(s, s->latency_update_userdata);
+}
+
+/* Finds a place to store the write_index correction data of a new query.
+ * Returns false if there are too many outstanding queries. */
+static bool timing_query_reserve(pa_stream *s, int *cidx) {
+    *cidx = 0;
+
+    if (s->direction != PA_STREAM_PLAYBACK)
+        return true;
+
+    *cidx = (s->current_write_index_correction + 1) % PA_MAX_WRITE_INDEX_CORRECTIONS;
+
+    return !s->write_index_corrections[*cidx].valid;
+}
+
+static void timing_query_sent(pa_stream *s, int cidx, uint32_t tag) {
+    if (s->direction != PA_STREAM_PLAYBACK)
+        return;
+
+    /* Fill in initial correction data */
+
+    s->current_write_index_correction = cidx;
+
+    s->write_index_corrections[cidx].valid = true;
+    s->write_index_corrections[cidx].absolute = false;
+    s->write_index_corrections[cidx].corrupt = false;
+    s->write_index_corrections[cidx].tag = tag;
+    s->write_index_corrections[cidx].value = 0;
+}
+
 static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
-    struct timeval local, remote, now;
-    pa_timing_info *i;
-    bool playing = false;
-    uint64_t underrun_for = 0, playing_for = 0;
+    struct timing_reply r;
 
     pa_assert(pd);
     pa_assert(o);
@@ -1806,11 +2431,7 @@ static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command,
     if (!o->context || !o->stream)
         goto finish;
 
-    i = &o->stream->timing_info;
-
-    o->stream->timing_info_valid = false;
-    i->write_index_corrupt = true;
-    i->read_index_corrupt = true;
+    timing_info_invalidate(o->stream);
 
     if (command != PA_COMMAND_REPLY) {
         if (pa_context_handle_error(o->context, command, t, false) < 0)
@@ -1818,164 +2439,412 @@ static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command,
 
     } else {
 
-        if (pa_tagstruct_get_usec(t, &i->sink_usec) < 0 ||
-            pa_tagstruct_get_usec(t, &i->source_usec) < 0 ||
-            pa_tagstruct_get_boolean(t, &playing) < 0 ||
-            pa_tagstruct_get_timeval(t, &local) < 0 ||
-            pa_tagstruct_get_timeval(t, &remote) < 0 ||
-            pa_tagstruct_gets64(t, &i->write_index) < 0 ||
-            pa_tagstruct_gets64(t, &i->read_index) < 0) {
-
+        if (timing_reply_get(o->stream, t, &r) < 0 ||
+            !pa_tagstruct_eof(t)) {
             pa_context_fail(o->context, PA_ERR_PROTOCOL);
             goto finish;
         }
 
-        if (o->context->version >= 13 &&
-            o->stream->direction == PA_STREAM_PLAYBACK)
-            if (pa_tagstruct_getu64(t, &underrun_for) < 0 ||
-                pa_tagstruct_getu64(t, &playing_for) < 0) {
+        timing_info_update(o->stream, tag, &r);
+    }
+
+    timing_info_done(o->stream);
 
-                pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                goto finish;
+    if (o->callback && o->stream && o->stream->state == PA_STREAM_READY) {
+        pa_stream_success_cb_t cb = (pa_stream_success_cb_t) o->callback;
+        cb(o->stream, o->stream->timing_info_valid, o->userdata);
+    }
+
+finish:
+
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+static void timing_batch_free(struct timing_batch *b) {
+    unsigned k;
+
+    for (k = 0; k < b->n_streams; k++)
+        pa_stream_unref(b->streams[k]);
+
+    pa_xfree(b->streams);
+    pa_xfree(b);
+}
+
+static void timing_batch_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    struct timing_batch *b = userdata;
+    unsigned k;
+
+    pa_assert(pd);
+    pa_assert(b);
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(b->context, command, t, false) < 0)
+            return;
+
+        for (k = 0; k < b->n_streams; k++)
+            if (b->streams[k]->state == PA_STREAM_READY) {
+                timing_info_invalidate(b->streams[k]);
+                timing_info_done(b->streams[k]);
             }
 
-        if (!pa_tagstruct_eof(t)) {
-            pa_context_fail(o->context, PA_ERR_PROTOCOL);
+        return;
+    }
+
+    pa_context_ref(b->context);
+
+    for (k = 0; k < b->n_streams; k++) {
+        pa_stream *s = b->streams[k];
+        struct timing_reply r;
+        bool valid;
+
+        if (pa_tagstruct_get_boolean(t, &valid) < 0 ||
+            (valid && timing_reply_get(s, t, &r) < 0)) {
+            pa_context_fail(b->context, PA_ERR_PROTOCOL);
             goto finish;
         }
-        o->stream->timing_info_valid = true;
-        i->write_index_corrupt = false;
-        i->read_index_corrupt = false;
 
-        i->playing = (int) playing;
-        i->since_underrun = (int64_t) (playing ? playing_for : underrun_for);
+        /* A callback of an earlier stream may have disconnected this one */
+        if (s->state != PA_STREAM_READY)
+            continue;
 
-        pa_gettimeofday(&now);
+        timing_info_invalidate(s);
 
-        /* Calculate timestamps */
-        if (pa_timeval_cmp(&local, &remote) <= 0 && pa_timeval_cmp(&remote, &now) <= 0) {
-            /* local and remote seem to have synchronized clocks */
+        if (valid)
+            timing_info_update(s, tag, &r);
 
-            if (o->stream->direction == PA_STREAM_PLAYBACK)
-                i->transport_usec = pa_timeval_diff(&remote, &local);
-            else
-                i->transport_usec = pa_timeval_diff(&now, &remote);
+        timing_info_done(s);
 
-            i->synchronized_clocks = true;
-            i->timestamp = remote;
-        } else {
-            /* clocks are not synchronized, let's estimate latency then */
-            i->transport_usec = pa_timeval_diff(&now, &local)/2;
-            i->synchronized_clocks = false;
-            i->timestamp = local;
-            pa_timeval_add(&i->timestamp, i->transport_usec);
-        }
+        if (b->context->state != PA_CONTEXT_READY)
+            goto finish;
+    }
 
-        /* Invalidate read and write indexes if necessary */
-        if (tag < o->stream->read_index_not_before)
-            i->read_index_corrupt = true;
+    if (!pa_tagstruct_eof(t))
+        pa_context_fail(b->context, PA_ERR_PROTOCOL);
 
-        if (tag < o->stream->write_index_not_before)
-            i->write_index_corrupt = true;
+finish:
+    pa_context_unref(b->context);
+}
 
-        if (o->stream->direction == PA_STREAM_PLAYBACK) {
-            /* Write index correction */
-
-            int n, j;
-            uint32_t ctag = tag;
-
-            /* Go through the saved correction values and add up the
-             * total correction.*/
-            for (n = 0, j = o->stream->current_write_index_correction+1;
-                 n < PA_MAX_WRITE_INDEX_CORRECTIONS;
-                 n++, j = (j + 1) % PA_MAX_WRITE_INDEX_CORRECTIONS) {
-
-                /* Step over invalid data or out-of-date data */
-                if (!o->stream->write_index_corrections[j].valid ||
-                    o->stream->write_index_corrections[j].tag < ctag)
-                    continue;
-
-                /* Make sure that everything is in order */
-                ctag = o->stream->write_index_corrections[j].tag+1;
-
-                /* Now fix the write index */
-                if (o->stream->write_index_corrections[j].corrupt) {
-                    /* A corrupting seek was made */
-                    i->write_index_corrupt = true;
-                } else if (o->stream->write_index_corrections[j].absolute) {
-                    /* An absolute seek was made */
-                    i->write_index = o->stream->write_index_corrections[j].value;
-                    i->write_index_corrupt = false;
-                } else if (!i->write_index_corrupt) {
-                    /* A relative seek was made */
-                    i->write_index += o->stream->write_index_corrections[j].value;
-                }
-            }
+/* Sends one query for the timing of all streams that are waiting for an
+ * automatic update */
+static void timing_batch_send(pa_context *c) {
+    struct timing_batch *b;
+    pa_tagstruct *t;
+    pa_stream *s;
+    struct timeval now;
+    uint32_t tag;
+    unsigned n = 0, k;
+    int cidx;
 
-            /* Clear old correction entries */
-            for (n = 0; n < PA_MAX_WRITE_INDEX_CORRECTIONS; n++) {
-                if (!o->stream->write_index_corrections[n].valid)
-                    continue;
+    PA_LLIST_FOREACH(s, c->streams)
+        if (s->timing_batch_pending)
+            n++;
 
-                if (o->stream->write_index_corrections[n].tag <= tag)
-                    o->stream->write_index_corrections[n].valid = false;
-            }
-        }
+    if (n <= 0)
+        return;
+
+    b = pa_xnew0(struct timing_batch, 1);
+    b->context = c;
+    b->streams = pa_xnew(pa_stream*, n);
+
+    PA_LLIST_FOREACH(s, c->streams) {
+        if (!s->timing_batch_pending)
+            continue;
+
+        s->timing_batch_pending = false;
 
-        if (o->stream->direction == PA_STREAM_RECORD) {
-            /* Read index correction */
+        if (s->state != PA_STREAM_READY || !timing_query_reserve(s, &cidx))
+            continue;
 
-            if (!i->read_index_corrupt)
-                i->read_index -= (int64_t) pa_memblockq_get_length(o->stream->record_memblockq);
+        b->streams[b->n_streams++] = pa_stream_ref(s);
+    }
+
+    if (b->n_streams <= 0) {
+        timing_batch_free(b);
+        return;
+    }
+
+    t = pa_tagstruct_command(c, PA_COMMAND_GET_LATENCY_BATCH, &tag);
+    pa_tagstruct_put_timeval(t, pa_gettimeofday(&now));
+    pa_tagstruct_putu32(t, b->n_streams);
+
+    for (k = 0; k < b->n_streams; k++) {
+        s = b->streams[k];
+
+        pa_tagstruct_putu32(t, s->channel);
+        pa_tagstruct_put_boolean(t, s->direction == PA_STREAM_RECORD);
+
+        pa_assert_se(timing_query_reserve(s, &cidx));
+        timing_query_sent(s, cidx, tag);
+        s->auto_timing_update_requested = true;
+    }
+
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, timing_batch_callback, b, (pa_free_cb_t) timing_batch_free);
+}
+
+/* Refreshes the timing info from the timing page, if we have a recent
+ * one. Returns false if a round trip to the server is needed instead. */
+static bool timing_page_update(pa_stream *s) {
+    const pa_native_timing_page *p;
+    pa_timing_info *i = &s->timing_info;
+    uint64_t underrun_for, playing_for, sink_usec, timestamp;
+    int64_t read_index;
+    bool playing;
+    unsigned tries;
+    pa_usec_t now;
+
+    if (!s->timing_page)
+        return false;
+
+    /* If the server went away what we have now is just a copy */
+    if (pa_memblock_is_ours(s->timing_page)) {
+        pa_memblock_unref(s->timing_page);
+        s->timing_page = NULL;
+        return false;
+    }
+
+    /* Only a reply tells us when the server has dealt with a flush or
+     * seek. Outside of those we track the write index ourselves. */
+    if (!s->timing_info_valid || i->read_index_corrupt || i->write_index_corrupt)
+        return false;
+
+    p = pa_memblock_acquire(s->timing_page);
+
+    for (tries = 0;; tries++) {
+        int seq;
+
+        if (tries >= TIMING_PAGE_READ_TRIES) {
+            pa_memblock_release(s->timing_page);
+            return false;
         }
 
-        /* Update smoother if we're not corked */
-        if (o->stream->smoother && !o->stream->corked) {
-            pa_usec_t u, x;
+        if ((seq = pa_atomic_load(&p->seq)) & 1)
+            continue;
 
-            u = x = pa_rtclock_now() - i->transport_usec;
+        playing = !!p->playing;
+        read_index = p->read_index;
+        sink_usec = p->sink_usec;
+        underrun_for = p->underrun_for;
+        playing_for = p->playing_for;
+        timestamp = p->timestamp;
 
-            if (o->stream->direction == PA_STREAM_PLAYBACK && o->context->version >= 13) {
-                pa_usec_t su;
+        if (pa_atomic_load(&p->seq) == seq)
+            break;
+    }
 
-                /* If we weren't playing then it will take some time
-                 * until the audio will actually come out through the
-                 * speakers. Since we follow that timing here, we need
-                 * to try to fix this up */
+    pa_memblock_release(s->timing_page);
 
-                su = pa_bytes_to_usec((uint64_t) i->since_underrun, &o->stream->sample_spec);
+    now = pa_rtclock_now();
 
-                if (su < i->sink_usec)
-                    x += i->sink_usec - su;
-            }
+    if (timestamp > now || now - timestamp > TIMING_PAGE_MAX_AGE_USEC)
+        return false;
 
-            if (!i->playing)
-                pa_smoother_pause(o->stream->smoother, x);
+    i->sink_usec = sink_usec;
+    i->source_usec = 0;
+    i->playing = (int) playing;
+    i->since_underrun = (int64_t) (playing ? playing_for : underrun_for);
+    i->read_index = read_index;
 
-            /* Update the smoother */
-            if ((o->stream->direction == PA_STREAM_PLAYBACK && !i->read_index_corrupt) ||
-                (o->stream->direction == PA_STREAM_RECORD && !i->write_index_corrupt))
-                pa_smoother_put(o->stream->smoother, u, calc_time(o->stream, true));
+    /* Both sides use the same clock, and the page is as old as the
+     * data it holds */
+    i->transport_usec = now - timestamp;
+    i->synchronized_clocks = true;
+    pa_gettimeofday(&i->timestamp);
+    pa_timeval_sub(&i->timestamp, i->transport_usec);
+
+    s->timing_page_read_at = now;
+
+    update_smoother(s);
+
+    return true;
+}
+
+static void stream_enable_timing_page_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(pd);
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    /* Not getting a page is fine, we just keep asking for timing info */
+    if (command != PA_COMMAND_REPLY)
+        pa_log_debug("Server did not set up a timing page, using round trips.");
+    else if (!pa_tagstruct_eof(t))
+        pa_context_fail(s->context, PA_ERR_PROTOCOL);
+}
+
+static void enable_timing_page(pa_stream *s) {
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
 
-            if (i->playing)
-                pa_smoother_resume(o->stream->smoother, x, true);
+    if (s->context->version < 33 ||
+        s->direction != PA_STREAM_PLAYBACK ||
+        !pa_pstream_get_shm(s->context->pstream))
+        return;
+
+    t = pa_tagstruct_command(s->context, PA_COMMAND_ENABLE_TIMING_PAGE, &tag);
+    pa_tagstruct_putu32(t, s->channel);
+    pa_pstream_send_tagstruct(s->context->pstream, t);
+    pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, stream_enable_timing_page_callback, s, NULL);
+}
+
+static void stream_sync_data_ring_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(pd);
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    if (command != PA_COMMAND_REPLY || !s->data_ring) {
+        /* Not getting a ring is fine, everything goes over the pstream */
+        pa_log_debug("Server did not set up a data ring, sending data over the socket.");
+        s->data_ring_syncing = false;
+        return;
+    }
+
+    if (!pa_tagstruct_eof(t)) {
+        pa_context_fail(s->context, PA_ERR_PROTOCOL);
+        return;
+    }
+
+    /* The reply that set the ring up carries the semaphore */
+    if (!s->data_ring_sem) {
+#ifdef HAVE_CREDS
+        pa_cmsg_ancil_data *ancil = pa_pdispatch_take_ancil_data(pd);
+
+        if (ancil && ancil->nfd == 1 && ancil->fds[0] >= 0) {
+            pa_native_data_ring *ring = (pa_native_data_ring*) (s->data_ring_rb.memory - PA_ALIGN(sizeof(pa_native_data_ring)));
+
+            if ((s->data_ring_sem = pa_fdsem_open_shm(&ring->sem, ancil->fds[0])))
+                ancil->close_fds_on_cleanup = false;
+        }
+#endif
+
+        if (!s->data_ring_sem) {
+            pa_log_debug("Server did not pass a semaphore for the data ring, sending data over the socket.");
+            data_ring_free(s);
+            s->data_ring_syncing = false;
+            return;
         }
     }
 
-    o->stream->auto_timing_update_requested = false;
+    s->data_ring_syncing = false;
 
-    if (o->stream->latency_update_callback)
-        o->stream->latency_update_callback(o->stream, o->stream->latency_update_userdata);
+    /* Something went out over the pstream or reordered the queue while
+     * we were waiting, that needs to be waited for first */
+    if (s->data_ring_dirty)
+        data_ring_sync(s);
+    else
+        s->data_ring_ok = true;
+}
 
-    if (o->callback && o->stream && o->stream->state == PA_STREAM_READY) {
-        pa_stream_success_cb_t cb = (pa_stream_success_cb_t) o->callback;
-        cb(o->stream, o->stream->timing_info_valid, o->userdata);
+/* Asks the server to take everything that is in the ring now before
+ * it looks at anything we send from here on. The first time around it
+ * sets the ring up. */
+static void data_ring_sync(pa_stream *s) {
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(s);
+    pa_assert(!s->data_ring_syncing);
+
+    s->data_ring_dirty = false;
+    s->data_ring_syncing = true;
+
+    t = pa_tagstruct_command(s->context, PA_COMMAND_SYNC_DATA_RING, &tag);
+    pa_tagstruct_putu32(t, s->channel);
+    pa_pstream_send_tagstruct(s->context->pstream, t);
+    pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, stream_sync_data_ring_callback, s, NULL);
+}
+
+/* To be called after sending anything that the server's sink thread
+ * handles only after its main thread has seen it, since data put into
+ * the ring from now on could get there first. */
+static void data_ring_invalidate(pa_stream *s) {
+    pa_assert(s);
+
+    if (!s->data_ring && !s->data_ring_syncing)
+        return;
+
+    s->data_ring_ok = false;
+    s->data_ring_dirty = true;
+
+    if (!s->data_ring_syncing)
+        data_ring_sync(s);
+}
+
+static void data_ring_free(pa_stream *s) {
+    pa_assert(s);
+
+    if (s->data_ring_sem) {
+        pa_fdsem_free(s->data_ring_sem);
+        s->data_ring_sem = NULL;
     }
 
-finish:
+    if (s->data_ring) {
+        pa_memblock_release(s->data_ring);
+        pa_memblock_unref(s->data_ring);
+        s->data_ring = NULL;
+        pa_zero(s->data_ring_rb);
+    }
 
-    pa_operation_done(o);
-    pa_operation_unref(o);
+    s->data_ring_ok = false;
+}
+
+void pa_stream_set_data_ring(pa_stream *s, pa_memblock *b, size_t length) {
+    pa_native_data_ring *ring;
+    size_t header;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(b);
+
+    header = PA_ALIGN(sizeof(pa_native_data_ring));
+
+    if (s->data_ring || length <= header)
+        return;
+
+    /* We need to write into the very memory the server reads from */
+    if (pa_memblock_is_ours(b) || pa_memblock_is_read_only(b)) {
+        pa_log_debug("Got a copy of the data ring, ignoring.");
+        return;
+    }
+
+    ring = pa_memblock_acquire(b);
+
+    if (ring->capacity == 0 || ring->capacity > length - header) {
+        pa_memblock_release(b);
+        pa_log_debug("Got a data ring with a bogus header, ignoring.");
+        return;
+    }
+
+    s->data_ring = pa_memblock_ref(b);
+    s->data_ring_rb.count = &ring->count;
+    s->data_ring_rb.capacity = (int) ring->capacity;
+    s->data_ring_rb.memory = (uint8_t*) ring + header;
+    s->data_ring_rb.readindex = s->data_ring_rb.writeindex = 0;
+}
+
+void pa_stream_set_timing_page(pa_stream *s, pa_memblock *b, size_t length) {
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(b);
+
+    if (s->timing_page || length < sizeof(pa_native_timing_page))
+        return;
+
+    /* A copy would never change, so it is of no use to us */
+    if (pa_memblock_is_ours(b)) {
+        pa_log_debug("Got a copy of the timing page, ignoring.");
+        return;
+    }
+
+    s->timing_page = pa_memblock_ref(b);
 }
 
 pa_operation* pa_stream_update_timing_info(pa_stream *s, pa_stream_success_cb_t cb, void *userdata) {
@@ -1983,7 +2852,7 @@ pa_operation* pa_stream_update_timing_info(pa_stream *s, pa_stream_success_cb_t
     pa_operation *o;
     pa_tagstruct *t;
     struct timeval now;
-    int cidx = 0;
+    int cidx;
 
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
@@ -1992,13 +2861,9 @@ pa_operation* pa_stream_update_timing_info(pa_stream *s, pa_stream_success_cb_t
     PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->direction != PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
 
-    if (s->direction == PA_STREAM_PLAYBACK) {
-        /* Find a place to store the write_index correction data for this entry */
-        cidx = (s->current_write_index_correction + 1) % PA_MAX_WRITE_INDEX_CORRECTIONS;
+    /* Check if we could allocate a correction slot. If not, there are too many outstanding queries */
+    PA_CHECK_VALIDITY_RETURN_NULL(s->context, timing_query_reserve(s, &cidx), PA_ERR_INTERNAL);
 
-        /* Check if we could allocate a correction slot. If not, there are too many outstanding queries */
-        PA_CHECK_VALIDITY_RETURN_NULL(s->context, !s->write_index_corrections[cidx].valid, PA_ERR_INTERNAL);
-    }
     o = pa_operation_new(s->context, s, (pa_operation_cb_t) cb, userdata);
 
     t = pa_tagstruct_command(
@@ -2011,17 +2876,7 @@ pa_operation* pa_stream_update_timing_info(pa_stream *s, pa_stream_success_cb_t
     pa_pstream_send_tagstruct(s->context->pstream, t);
     pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, stream_get_timing_info_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
-    if (s->direction == PA_STREAM_PLAYBACK) {
-        /* Fill in initial correction data */
-
-        s->current_write_index_correction = cidx;
-
-        s->write_index_corrections[cidx].valid = true;
-        s->write_index_corrections[cidx].absolute = false;
-        s->write_index_corrections[cidx].corrupt = false;
-        s->write_index_corrections[cidx].tag = tag;
-        s->write_index_corrections[cidx].value = 0;
-    }
+    timing_query_sent(s, cidx, tag);
 
     return o;
 }
@@ -2281,6 +3136,7 @@ pa_operation* pa_stream_cork(pa_stream *s, int b, pa_stream_success_cb_t cb, voi
     request_auto_timing_update(s, true);
 
     s->corked = b;
+    start_auto_timing_update(s);
 
     o = pa_operation_new(s->context, s, (pa_operation_cb_t) cb, userdata);
 
@@ -2343,6 +3199,8 @@ pa_operation* pa_stream_flush(pa_stream *s, pa_stream_success_cb_t cb, void *use
 
     if (s->direction == PA_STREAM_PLAYBACK) {
 
+        data_ring_invalidate(s);
+
         if (s->write_index_corrections[s->current_write_index_correction].valid)
             s->write_index_corrections[s->current_write_index_correction].corrupt = true;
 
@@ -2385,6 +3243,8 @@ pa_operation* pa_stream_prebuf(pa_stream *s, pa_stream_success_cb_t cb, void *us
     if (!(o = stream_send_simple_command(s, PA_COMMAND_PREBUF_PLAYBACK_STREAM, cb, userdata)))
         return NULL;
 
+    data_ring_invalidate(s);
+
     /* This might cause the read index to hang again, hence
      * let's request a timing update */
     request_auto_timing_update(s, true);
@@ -2411,6 +3271,8 @@ pa_operation* pa_stream_trigger(pa_stream *s, pa_stream_success_cb_t cb, void *u
     if (!(o = stream_send_simple_command(s, PA_COMMAND_TRIGGER_PLAYBACK_STREAM, cb, userdata)))
         return NULL;
 
+    data_ring_invalidate(s);
+
     /* This might cause the read index to start moving again, hence
      * let's request a timing update */
     request_auto_timing_update(s, true);
@@ -2466,6 +3328,11 @@ int pa_stream_get_time(pa_stream *s, pa_usec_t *r_usec) {
     PA_CHECK_VALIDITY(s->context, s->direction != PA_STREAM_PLAYBACK || !s->timing_info.read_index_corrupt, PA_ERR_NODATA);
     PA_CHECK_VALIDITY(s->context, s->direction != PA_STREAM_RECORD || !s->timing_info.write_index_corrupt, PA_ERR_NODATA);
 
+    /* Reading the timing page is cheap, so there is no need to wait for
+     * the next automatic update */
+    if (s->timing_page && pa_rtclock_now() - s->timing_page_read_at >= AUTO_TIMING_INTERVAL_START_USEC)
+        timing_page_update(s);
+
     if (s->smoother)
         usec = pa_smoother_get(s->smoother, pa_rtclock_now());
     else
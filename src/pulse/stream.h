@@ -563,6 +563,47 @@ int pa_stream_write_ext_free(
         int64_t offset           /**< Offset for seeking, must be 0 for upload streams */,
         pa_seek_mode_t seek      /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */);
 
+/** Write \a nbytes bytes at \a index of a buffer allocated with
+ * pa_context_new_pool_buffer() to the stream (for playback streams).
+ * This works like pa_stream_write(), but the memory is passed on
+ * without being copied. The stream keeps its own reference to the
+ * buffer until the data has been sent or consumed, so the application
+ * may unref it right after this call. The written range must not be
+ * modified afterwards. The same buffer may be written in several
+ * parts. \since 12.0 */
+int pa_stream_write_pool_buffer(
+        pa_stream *p             /**< The stream to use */,
+        pa_pool_buffer *b        /**< The buffer holding the data */,
+        size_t index             /**< Where the data starts in the buffer, in bytes */,
+        size_t nbytes            /**< The length of the data to write in bytes, must be in multiples of the stream's sample spec frame size */,
+        int64_t offset           /**< Offset for seeking, must be 0 for upload streams, must be in multiples of the stream's sample spec frame size */,
+        pa_seek_mode_t seek      /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */);
+
+/** Set up a write ring of \a nbytes bytes for a playback stream. Data
+ * can then be passed to pa_stream_ring_write() from one application
+ * thread without taking the lock of a pa_threaded_mainloop, and
+ * without waiting for write callbacks. The mainloop thread picks it
+ * up and sends it to the server as if it was passed to
+ * pa_stream_write(). Only one thread may write into the ring, and
+ * it must stop doing so before the stream is disconnected or
+ * unreferenced. Call this with the mainloop lock held after
+ * pa_stream_connect_playback(). Mixing this with pa_stream_write()
+ * is allowed, but the order between the two is undefined. \since 12.0 */
+int pa_stream_enable_write_ring(pa_stream *p, size_t nbytes);
+
+/** Copy up to \a nbytes bytes of \a data into the write ring set up
+ * with pa_stream_enable_write_ring(). Only whole frames are copied.
+ * Returns the number of bytes that fit, which is less than \a nbytes
+ * if the ring is full, or (size_t) -1 if the ring was not set up.
+ * May be called without the mainloop lock, the mainloop thread is
+ * only woken up when the ring was empty. \since 12.0 */
+size_t pa_stream_ring_write(pa_stream *p, const void *data, size_t nbytes);
+
+/** Return the number of bytes that can currently be passed to
+ * pa_stream_ring_write(), or (size_t) -1 if the ring was not set
+ * up. May be called without the mainloop lock. \since 12.0 */
+size_t pa_stream_ring_writable_size(pa_stream *p);
+
 /** Read the next fragment from the buffer (for recording streams).
  * If there is data at the current read index, \a data will point to
  * the actual data and \a nbytes will contain the size of the data in
@@ -584,8 +625,33 @@ int pa_stream_peek(
         const void **data            /**< Pointer to pointer that will point to data */,
         size_t *nbytes               /**< The length of the data read in bytes */);
 
+/** A piece of recorded data, see pa_stream_peek_fragments(). \since 12.0 */
+typedef struct pa_stream_fragment {
+    const void *data;   /**< The data, or NULL for a hole */
+    size_t length;      /**< The length of the data in bytes */
+} pa_stream_fragment;
+
+/** Like pa_stream_peek(), but fill in up to \a n consecutive fragments
+ * of the buffer at once, without copying them, and no more than \a
+ * max_bytes in total. Pass (size_t) -1 for no limit. Returns the
+ * number of fragments filled in, or a negative error code. The
+ * fragments end before the first hole in the buffer. If there is a hole
+ * at the current read index, a single fragment with \a data NULL and
+ * the length of the hole is returned instead. 0 means that the buffer
+ * is empty.
+ *
+ * The fragments stay valid until pa_stream_drop(), which removes all
+ * of them from the buffer. Calling this function again before that
+ * replaces them. This can't be mixed with pa_stream_peek() on the same
+ * data. \since 12.0 */
+int pa_stream_peek_fragments(
+        pa_stream *p                    /**< The stream to use */,
+        pa_stream_fragment *fragments   /**< Array to fill in */,
+        unsigned n                      /**< Number of entries of the array */,
+        size_t max_bytes                /**< The most bytes to return */);
+
 /** Remove the current fragment on record streams. It is invalid to do this without first
- * calling pa_stream_peek(). */
+ * calling pa_stream_peek() or pa_stream_peek_fragments(). */
 int pa_stream_drop(pa_stream *p);
 
 /** Return the number of bytes requested by the server that have not yet
@@ -49,33 +49,53 @@ void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag
         goto finish;
     }
 
-    if (c->subscribe_callback)
+    pa_cache_handle_event(c, e, idx);
+
+    /* The caches may have subscribed to more than the application */
+    if (c->subscribe_callback && pa_subscription_match_flags(c->subscribe_mask, e))
         c->subscribe_callback(c, e, idx, c->subscribe_userdata);
 
 finish:
     pa_context_unref(c);
 }
 
-pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_context_success_cb_t cb, void *userdata) {
+static pa_operation* send_subscribe(pa_context *c, pa_context_success_cb_t cb, void *userdata) {
     pa_operation *o;
     pa_tagstruct *t;
     uint32_t tag;
 
-    pa_assert(c);
-    pa_assert(PA_REFCNT_VALUE(c) >= 1);
-
-    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
-
     o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
 
     t = pa_tagstruct_command(c, PA_COMMAND_SUBSCRIBE, &tag);
-    pa_tagstruct_putu32(t, m);
+    pa_tagstruct_putu32(t, c->subscribe_mask | pa_cache_get_subscription_mask(c));
     pa_pstream_send_tagstruct(c->pstream, t);
     pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
     return o;
 }
 
+pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_context_success_cb_t cb, void *userdata) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+
+    c->subscribe_mask = m;
+
+    return send_subscribe(c, cb, userdata);
+}
+
+/* Tells the server about a change of what the caches need */
+void pa_context_update_subscription(pa_context *c) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (c->state != PA_CONTEXT_READY)
+        return;
+
+    pa_operation_unref(send_subscribe(c, NULL, NULL));
+}
+
 void pa_context_set_subscribe_callback(pa_context *c, pa_context_subscribe_cb_t cb, void *userdata) {
     pa_assert(c);
     pa_assert(PA_REFCNT_VALUE(c) >= 1);
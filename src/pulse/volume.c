@@ -231,20 +231,25 @@ pa_volume_t pa_sw_volume_divide(pa_volume_t a, pa_volume_t b) {
     return (pa_volume_t) PA_CLAMP_VOLUME(result);
 }
 
-/* Amplitude, not power */
-static double linear_to_dB(double v) {
-    return 20.0 * log10(v);
-}
-
-static double dB_to_linear(double v) {
-    return pow(10.0, v / 20.0);
-}
+/* With the cubic mapping below the amplitude in dB is
+ * 20*log10((v/PA_VOLUME_NORM)^3) = 60*log10(v/PA_VOLUME_NORM). We go
+ * through log2() and exp2() rather than log10() and pow() plus a cube
+ * (root), which is several times faster and still converts every
+ * volume to dB and back to the same value. */
+#define DB_PER_OCTAVE (60.0 / 3.32192809488736234787)
 
 pa_volume_t pa_sw_volume_from_dB(double dB) {
+    double f;
+
     if (isinf(dB) < 0 || dB <= PA_DECIBEL_MININFTY)
         return PA_VOLUME_MUTED;
 
-    return pa_sw_volume_from_linear(dB_to_linear(dB));
+    f = exp2(dB / DB_PER_OCTAVE) * PA_VOLUME_NORM;
+
+    if (f >= (double) PA_VOLUME_MAX)
+        return PA_VOLUME_MAX;
+
+    return (pa_volume_t) lround(f);
 }
 
 double pa_sw_volume_to_dB(pa_volume_t v) {
@@ -254,7 +259,7 @@ double pa_sw_volume_to_dB(pa_volume_t v) {
     if (v <= PA_VOLUME_MUTED)
         return PA_DECIBEL_MININFTY;
 
-    return linear_to_dB(pa_sw_volume_to_linear(v));
+    return DB_PER_OCTAVE * log2((double) v / PA_VOLUME_NORM);
 }
 
 pa_volume_t pa_sw_volume_from_linear(double v) {
@@ -291,6 +296,69 @@ double pa_sw_volume_to_linear(pa_volume_t v) {
     return f*f*f;
 }
 
+double *pa_sw_cvolume_to_linear(double *linear, const pa_cvolume *v) {
+    unsigned c;
+
+    pa_assert(linear);
+    pa_assert(v);
+
+    pa_return_val_if_fail(pa_cvolume_valid(v), NULL);
+
+    for (c = 0; c < v->channels; c++) {
+        double f = (double) v->values[c] / PA_VOLUME_NORM;
+
+        linear[c] = f * f * f;
+    }
+
+    return linear;
+}
+
+pa_cvolume *pa_sw_cvolume_from_linear(pa_cvolume *v, const double *linear, unsigned channels) {
+    unsigned c;
+
+    pa_assert(v);
+    pa_assert(linear);
+
+    pa_return_val_if_fail(channels > 0 && channels <= PA_CHANNELS_MAX, NULL);
+
+    v->channels = (uint8_t) channels;
+
+    for (c = 0; c < channels; c++)
+        v->values[c] = pa_sw_volume_from_linear(linear[c]);
+
+    return v;
+}
+
+double *pa_sw_cvolume_to_dB(double *dB, const pa_cvolume *v) {
+    unsigned c;
+
+    pa_assert(dB);
+    pa_assert(v);
+
+    pa_return_val_if_fail(pa_cvolume_valid(v), NULL);
+
+    for (c = 0; c < v->channels; c++)
+        dB[c] = pa_sw_volume_to_dB(v->values[c]);
+
+    return dB;
+}
+
+pa_cvolume *pa_sw_cvolume_from_dB(pa_cvolume *v, const double *dB, unsigned channels) {
+    unsigned c;
+
+    pa_assert(v);
+    pa_assert(dB);
+
+    pa_return_val_if_fail(channels > 0 && channels <= PA_CHANNELS_MAX, NULL);
+
+    v->channels = (uint8_t) channels;
+
+    for (c = 0; c < channels; c++)
+        v->values[c] = pa_sw_volume_from_dB(dB[c]);
+
+    return v;
+}
+
 char *pa_cvolume_snprint(char *s, size_t l, const pa_cvolume *c) {
     unsigned channel;
     bool first = true;
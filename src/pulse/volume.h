@@ -315,6 +315,27 @@ pa_volume_t pa_sw_volume_from_linear(double v) PA_GCC_CONST;
 /** Convert a volume to a linear factor. This is only valid for software volumes! */
 double pa_sw_volume_to_linear(pa_volume_t v) PA_GCC_CONST;
 
+/** Convert all channels of a volume to linear factors, like
+ * pa_sw_volume_to_linear(). \a linear needs room for v->channels
+ * values. Returns \a linear, or NULL if \a v is invalid. This is only
+ * valid for software volumes! \since 12.0 */
+double *pa_sw_cvolume_to_linear(double *linear, const pa_cvolume *v);
+
+/** Set up \a v with \a channels channels from linear factors, like
+ * pa_sw_volume_from_linear(). Returns \a v, or NULL if \a channels is
+ * out of range. This is only valid for software volumes! \since 12.0 */
+pa_cvolume *pa_sw_cvolume_from_linear(pa_cvolume *v, const double *linear, unsigned channels);
+
+/** Convert all channels of a volume to dB, like pa_sw_volume_to_dB().
+ * \a dB needs room for v->channels values. Returns \a dB, or NULL if
+ * \a v is invalid. This is only valid for software volumes! \since 12.0 */
+double *pa_sw_cvolume_to_dB(double *dB, const pa_cvolume *v);
+
+/** Set up \a v with \a channels channels from dB values, like
+ * pa_sw_volume_from_dB(). Returns \a v, or NULL if \a channels is out
+ * of range. This is only valid for software volumes! \since 12.0 */
+pa_cvolume *pa_sw_cvolume_from_dB(pa_cvolume *v, const double *dB, unsigned channels);
+
 #ifdef INFINITY
 #define PA_DECIBEL_MININFTY ((double) -INFINITY)
 #else
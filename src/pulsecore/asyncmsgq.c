@@ -32,9 +32,14 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/mutex.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/llist.h>
 
 #include "asyncmsgq.h"
 
+/* Items each queue keeps for posted messages. Beyond that, they come
+ * from the static flist. */
+#define N_ITEMS 32
+
 PA_STATIC_FLIST_DECLARE(asyncmsgq, 0, pa_xfree);
 PA_STATIC_FLIST_DECLARE(semaphores, 0, (void(*)(void*)) pa_semaphore_free);
 
@@ -47,6 +52,11 @@ struct asyncmsgq_item {
     pa_memchunk memchunk;
     pa_semaphore *semaphore;
     int ret;
+
+    /* Set for messages from pa_asyncmsgq_post_latest() that are still
+     * in the queue, which are then also in the latest list */
+    bool latest;
+    PA_LLIST_FIELDS(struct asyncmsgq_item);
 };
 
 struct pa_asyncmsgq {
@@ -54,12 +64,52 @@ struct pa_asyncmsgq {
     pa_asyncq *asyncq;
     pa_mutex *mutex; /* only for the writer side */
 
+    struct asyncmsgq_item items[N_ITEMS];
+    pa_flist *free_items;
+
+    /* Never held while waiting for the reader, since the reader takes
+     * it too */
+    pa_mutex *latest_mutex;
+    PA_LLIST_HEAD(struct asyncmsgq_item, latest);
+
     struct asyncmsgq_item *current;
 };
 
+static struct asyncmsgq_item *item_new(pa_asyncmsgq *a) {
+    struct asyncmsgq_item *i;
+
+    if ((i = pa_flist_pop(a->free_items)))
+        return i;
+
+    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(asyncmsgq))))
+        i = pa_xnew(struct asyncmsgq_item, 1);
+
+    return i;
+}
+
+/* Drops everything a posted message holds, and the item itself */
+static void item_free(pa_asyncmsgq *a, struct asyncmsgq_item *i) {
+    pa_assert(!i->semaphore);
+
+    if (i->free_cb)
+        i->free_cb(i->userdata);
+
+    if (i->object)
+        pa_msgobject_unref(i->object);
+
+    if (i->memchunk.memblock)
+        pa_memblock_unref(i->memchunk.memblock);
+
+    if (i >= a->items && i < a->items + N_ITEMS)
+        pa_assert_se(pa_flist_push(a->free_items, i) >= 0);
+    else if (pa_flist_push(PA_STATIC_FLIST_GET(asyncmsgq), i) < 0)
+        pa_xfree(i);
+}
+
 pa_asyncmsgq *pa_asyncmsgq_new(unsigned size) {
     pa_asyncq *asyncq;
     pa_asyncmsgq *a;
+    unsigned j;
 
     asyncq = pa_asyncq_new(size);
     if (!asyncq)
@@ -71,6 +121,12 @@ pa_asyncmsgq *pa_asyncmsgq_new(unsigned size) {
     a->asyncq = asyncq;
     pa_assert_se(a->mutex = pa_mutex_new(false, true));
     a->current = NULL;
+    pa_assert_se(a->latest_mutex = pa_mutex_new(false, true));
+    PA_LLIST_HEAD_INIT(struct asyncmsgq_item, a->latest);
+
+    a->free_items = pa_flist_new(N_ITEMS);
+    for (j = 0; j < N_ITEMS; j++)
+        pa_assert_se(pa_flist_push(a->free_items, &a->items[j]) >= 0);
 
     return a;
 }
@@ -79,24 +135,12 @@ static void asyncmsgq_free(pa_asyncmsgq *a) {
     struct asyncmsgq_item *i;
     pa_assert(a);
 
-    while ((i = pa_asyncq_pop(a->asyncq, false))) {
-
-        pa_assert(!i->semaphore);
-
-        if (i->object)
-            pa_msgobject_unref(i->object);
-
-        if (i->memchunk.memblock)
-            pa_memblock_unref(i->memchunk.memblock);
-
-        if (i->free_cb)
-            i->free_cb(i->userdata);
-
-        if (pa_flist_push(PA_STATIC_FLIST_GET(asyncmsgq), i) < 0)
-            pa_xfree(i);
-    }
+    while ((i = pa_asyncq_pop(a->asyncq, false)))
+        item_free(a, i);
 
     pa_asyncq_free(a->asyncq, NULL);
+    pa_flist_free(a->free_items, NULL);
+    pa_mutex_free(a->latest_mutex);
     pa_mutex_free(a->mutex);
     pa_xfree(a);
 }
@@ -119,8 +163,7 @@ void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const vo
     struct asyncmsgq_item *i;
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(asyncmsgq))))
-        i = pa_xnew(struct asyncmsgq_item, 1);
+    i = item_new(a);
 
     i->code = code;
     i->object = object ? pa_msgobject_ref(object) : NULL;
@@ -134,6 +177,7 @@ void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const vo
     } else
         pa_memchunk_reset(&i->memchunk);
     i->semaphore = NULL;
+    i->latest = false;
 
     /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
     pa_mutex_lock(a->mutex);
@@ -141,6 +185,58 @@ void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const vo
     pa_mutex_unlock(a->mutex);
 }
 
+void pa_asyncmsgq_post_latest(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, pa_free_cb_t free_cb) {
+    struct asyncmsgq_item *i;
+    pa_assert(PA_REFCNT_VALUE(a) > 0);
+    pa_assert(object);
+
+    pa_mutex_lock(a->mutex);
+    pa_mutex_lock(a->latest_mutex);
+
+    /* If the reader hasn't taken the last one yet, it will get our data
+     * instead. It can't take it while we hold the mutex. */
+    PA_LLIST_FOREACH(i, a->latest) {
+        void *old_userdata;
+        pa_free_cb_t old_free_cb;
+
+        if (i->object != object || i->code != code)
+            continue;
+
+        old_userdata = i->userdata;
+        old_free_cb = i->free_cb;
+
+        i->userdata = (void*) userdata;
+        i->free_cb = free_cb;
+        i->offset = offset;
+
+        pa_mutex_unlock(a->latest_mutex);
+        pa_mutex_unlock(a->mutex);
+
+        if (old_free_cb)
+            old_free_cb(old_userdata);
+
+        return;
+    }
+
+    i = item_new(a);
+
+    i->code = code;
+    i->object = pa_msgobject_ref(object);
+    i->userdata = (void*) userdata;
+    i->free_cb = free_cb;
+    i->offset = offset;
+    pa_memchunk_reset(&i->memchunk);
+    i->semaphore = NULL;
+    i->latest = true;
+
+    PA_LLIST_PREPEND(struct asyncmsgq_item, a->latest, i);
+    pa_mutex_unlock(a->latest_mutex);
+
+    pa_asyncq_post(a->asyncq, i);
+
+    pa_mutex_unlock(a->mutex);
+}
+
 int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk) {
     struct asyncmsgq_item i;
     pa_assert(PA_REFCNT_VALUE(a) > 0);
@@ -150,6 +246,7 @@ int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const voi
     i.userdata = (void*) userdata;
     i.free_cb = NULL;
     i.ret = -1;
+    i.latest = false;
     i.offset = offset;
     if (chunk) {
         pa_assert(chunk->memblock);
@@ -184,6 +281,13 @@ int pa_asyncmsgq_get(pa_asyncmsgq *a, pa_msgobject **object, int *code, void **u
 
 /*     pa_log("success"); */
 
+    if (a->current->latest) {
+        pa_mutex_lock(a->latest_mutex);
+        PA_LLIST_REMOVE(struct asyncmsgq_item, a->latest, a->current);
+        a->current->latest = false;
+        pa_mutex_unlock(a->latest_mutex);
+    }
+
     if (code)
         *code = a->current->code;
     if (userdata)
@@ -216,20 +320,8 @@ void pa_asyncmsgq_done(pa_asyncmsgq *a, int ret) {
     if (a->current->semaphore) {
         a->current->ret = ret;
         pa_semaphore_post(a->current->semaphore);
-    } else {
-
-        if (a->current->free_cb)
-            a->current->free_cb(a->current->userdata);
-
-        if (a->current->object)
-            pa_msgobject_unref(a->current->object);
-
-        if (a->current->memchunk.memblock)
-            pa_memblock_unref(a->current->memchunk.memblock);
-
-        if (pa_flist_push(PA_STATIC_FLIST_GET(asyncmsgq), a->current) < 0)
-            pa_xfree(a->current);
-    }
+    } else
+        item_free(a, a->current);
 
     a->current = NULL;
 }
@@ -281,6 +373,12 @@ int pa_asyncmsgq_process_one(pa_asyncmsgq *a) {
     return 1;
 }
 
+unsigned pa_asyncmsgq_get_length(pa_asyncmsgq *a) {
+    pa_assert(PA_REFCNT_VALUE(a) > 0);
+
+    return pa_asyncq_get_length(a->asyncq);
+}
+
 int pa_asyncmsgq_read_fd(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
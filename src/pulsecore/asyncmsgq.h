@@ -42,7 +42,11 @@
  *
  * There are two functions for submitting messages: _post and
  * _send. The former just enqueues the message asynchronously, the
- * latter waits for completion, synchronously. */
+ * latter waits for completion, synchronously. _post_latest is like
+ * _post, but for messages that only carry the latest value of
+ * something: if a message for the same object and code is still
+ * waiting in the queue, it gets the new userdata and offset, and the
+ * old userdata is freed. */
 
 enum {
     PA_MESSAGE_SHUTDOWN = -1/* A generic message to inform the handler of this queue to quit */
@@ -56,6 +60,7 @@ pa_asyncmsgq* pa_asyncmsgq_ref(pa_asyncmsgq *q);
 void pa_asyncmsgq_unref(pa_asyncmsgq* q);
 
 void pa_asyncmsgq_post(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *memchunk, pa_free_cb_t userdata_free_cb);
+void pa_asyncmsgq_post_latest(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, pa_free_cb_t userdata_free_cb);
 int pa_asyncmsgq_send(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *memchunk);
 
 int pa_asyncmsgq_get(pa_asyncmsgq *q, pa_msgobject **object, int *code, void **userdata, int64_t *offset, pa_memchunk *memchunk, bool wait);
@@ -66,6 +71,9 @@ int pa_asyncmsgq_process_one(pa_asyncmsgq *a);
 
 void pa_asyncmsgq_flush(pa_asyncmsgq *a, bool run);
 
+/* Returns how many messages are waiting, see pa_asyncq_get_length() */
+unsigned pa_asyncmsgq_get_length(pa_asyncmsgq *a);
+
 /* For the reading side */
 int pa_asyncmsgq_read_fd(pa_asyncmsgq *q);
 int pa_asyncmsgq_read_before_poll(pa_asyncmsgq *a);
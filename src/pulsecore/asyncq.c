@@ -232,7 +232,7 @@ void* pa_asyncq_pop(pa_asyncq*l, bool wait_op) {
     _Y;
     idx = reduce(l, l->read_idx);
 
-    if (!(ret = pa_atomic_ptr_load(&cells[idx]))) {
+    if (!(ret = pa_atomic_ptr_load_acquire(&cells[idx]))) {
 
         if (!wait_op)
             return NULL;
@@ -241,7 +241,7 @@ void* pa_asyncq_pop(pa_asyncq*l, bool wait_op) {
 
         do {
             pa_fdsem_wait(l->write_fdsem);
-        } while (!(ret = pa_atomic_ptr_load(&cells[idx])));
+        } while (!(ret = pa_atomic_ptr_load_acquire(&cells[idx])));
     }
 
     pa_assert(ret);
@@ -257,6 +257,21 @@ void* pa_asyncq_pop(pa_asyncq*l, bool wait_op) {
     return ret;
 }
 
+unsigned pa_asyncq_get_length(pa_asyncq *l) {
+    pa_atomic_ptr_t *cells;
+    unsigned i, n = 0;
+
+    pa_assert(l);
+
+    cells = PA_ASYNCQ_CELLS(l);
+
+    for (i = 0; i < l->size; i++)
+        if (pa_atomic_ptr_load(&cells[i]))
+            n++;
+
+    return n;
+}
+
 int pa_asyncq_read_fd(pa_asyncq *q) {
     pa_assert(q);
 
@@ -275,7 +290,7 @@ int pa_asyncq_read_before_poll(pa_asyncq *l) {
     idx = reduce(l, l->read_idx);
 
     for (;;) {
-        if (pa_atomic_ptr_load(&cells[idx]))
+        if (pa_atomic_ptr_load_acquire(&cells[idx]))
             return -1;
 
         if (pa_fdsem_before_poll(l->write_fdsem) >= 0)
@@ -51,6 +51,12 @@ int pa_asyncq_push(pa_asyncq *q, void *p, bool wait);
  * pa_asyncq_before_poll_post() is called. */
 void pa_asyncq_post(pa_asyncq*l, void *p);
 
+/* Returns how many items are waiting to be popped, not counting those
+ * postponed by pa_asyncq_post(). Only a snapshot, which may be called
+ * from either side. Looks at every cell, so don't use it in a tight
+ * loop. */
+unsigned pa_asyncq_get_length(pa_asyncq *l);
+
 /* For the reading side */
 int pa_asyncq_read_fd(pa_asyncq *q);
 int pa_asyncq_read_before_poll(pa_asyncq *a);
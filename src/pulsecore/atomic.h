@@ -28,19 +28,127 @@
  * not guaranteed however, that sizeof(AO_t) == sizeof(size_t).
  * however very likely.
  *
- * For now we do only full memory barriers. Eventually we might want
- * to support more elaborate memory barriers, in which case we will add
- * suffixes to the function names.
+ * The functions without a suffix imply full memory barriers. The
+ * _relaxed, _acquire, _release and _acq_rel variants only give the
+ * ordering their name says, as in C11. Backends that cannot express
+ * that map them to the full barrier versions.
  *
- * On gcc >= 4.1 we use the builtin atomic functions. otherwise we use
- * libatomic_ops
+ * On gcc >= 4.7 and clang we use the __atomic builtins, on gcc >= 4.1
+ * the __sync ones. otherwise we use libatomic_ops
  */
 
 #ifndef PACKAGE
 #error "Please include config.h before including this file!"
 #endif
 
-#ifdef HAVE_ATOMIC_BUILTINS
+#ifdef HAVE_ATOMIC_BUILTINS_MEMORY_MODEL
+
+/* __atomic based implementation */
+
+#define PA_ATOMIC_HAVE_MEMORY_ORDER
+
+typedef struct pa_atomic {
+    volatile int value;
+} pa_atomic_t;
+
+#define PA_ATOMIC_INIT(v) { .value = (v) }
+
+static inline int pa_atomic_load(const pa_atomic_t *a) {
+    return __atomic_load_n(&a->value, __ATOMIC_SEQ_CST);
+}
+
+static inline int pa_atomic_load_relaxed(const pa_atomic_t *a) {
+    return __atomic_load_n(&a->value, __ATOMIC_RELAXED);
+}
+
+static inline int pa_atomic_load_acquire(const pa_atomic_t *a) {
+    return __atomic_load_n(&a->value, __ATOMIC_ACQUIRE);
+}
+
+static inline void pa_atomic_store(pa_atomic_t *a, int i) {
+    __atomic_store_n(&a->value, i, __ATOMIC_SEQ_CST);
+}
+
+static inline void pa_atomic_store_relaxed(pa_atomic_t *a, int i) {
+    __atomic_store_n(&a->value, i, __ATOMIC_RELAXED);
+}
+
+static inline void pa_atomic_store_release(pa_atomic_t *a, int i) {
+    __atomic_store_n(&a->value, i, __ATOMIC_RELEASE);
+}
+
+/* Returns the previously set value */
+static inline int pa_atomic_add(pa_atomic_t *a, int i) {
+    return __atomic_fetch_add(&a->value, i, __ATOMIC_SEQ_CST);
+}
+
+/* Returns the previously set value */
+static inline int pa_atomic_sub(pa_atomic_t *a, int i) {
+    return __atomic_fetch_sub(&a->value, i, __ATOMIC_SEQ_CST);
+}
+
+/* Returns the previously set value */
+static inline int pa_atomic_inc(pa_atomic_t *a) {
+    return pa_atomic_add(a, 1);
+}
+
+/* Returns the previously set value */
+static inline int pa_atomic_inc_relaxed(pa_atomic_t *a) {
+    return __atomic_fetch_add(&a->value, 1, __ATOMIC_RELAXED);
+}
+
+/* Returns the previously set value */
+static inline int pa_atomic_dec(pa_atomic_t *a) {
+    return pa_atomic_sub(a, 1);
+}
+
+/* Returns the previously set value */
+static inline int pa_atomic_dec_acq_rel(pa_atomic_t *a) {
+    return __atomic_fetch_sub(&a->value, 1, __ATOMIC_ACQ_REL);
+}
+
+/* Returns true when the operation was successful. */
+static inline bool pa_atomic_cmpxchg(pa_atomic_t *a, int old_i, int new_i) {
+    return __atomic_compare_exchange_n(&a->value, &old_i, new_i, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+typedef struct pa_atomic_ptr {
+    volatile unsigned long value;
+} pa_atomic_ptr_t;
+
+#define PA_ATOMIC_PTR_INIT(v) { .value = (long) (v) }
+
+static inline void* pa_atomic_ptr_load(const pa_atomic_ptr_t *a) {
+    return (void*) __atomic_load_n(&a->value, __ATOMIC_SEQ_CST);
+}
+
+static inline void* pa_atomic_ptr_load_relaxed(const pa_atomic_ptr_t *a) {
+    return (void*) __atomic_load_n(&a->value, __ATOMIC_RELAXED);
+}
+
+static inline void* pa_atomic_ptr_load_acquire(const pa_atomic_ptr_t *a) {
+    return (void*) __atomic_load_n(&a->value, __ATOMIC_ACQUIRE);
+}
+
+static inline void pa_atomic_ptr_store(pa_atomic_ptr_t *a, void *p) {
+    __atomic_store_n(&a->value, (unsigned long) p, __ATOMIC_SEQ_CST);
+}
+
+static inline void pa_atomic_ptr_store_relaxed(pa_atomic_ptr_t *a, void *p) {
+    __atomic_store_n(&a->value, (unsigned long) p, __ATOMIC_RELAXED);
+}
+
+static inline void pa_atomic_ptr_store_release(pa_atomic_ptr_t *a, void *p) {
+    __atomic_store_n(&a->value, (unsigned long) p, __ATOMIC_RELEASE);
+}
+
+static inline bool pa_atomic_ptr_cmpxchg(pa_atomic_ptr_t *a, void *old_p, void* new_p) {
+    unsigned long old_v = (unsigned long) old_p;
+
+    return __atomic_compare_exchange_n(&a->value, &old_v, (unsigned long) new_p, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#elif defined(HAVE_ATOMIC_BUILTINS)
 
 /* __sync based implementation */
 
@@ -647,4 +755,50 @@ static inline bool pa_atomic_ptr_cmpxchg(pa_atomic_ptr_t *a, void *old_p, void*
 
 #endif
 
+#ifndef PA_ATOMIC_HAVE_MEMORY_ORDER
+
+/* Weaker orderings are always allowed to be stronger */
+
+static inline int pa_atomic_load_relaxed(const pa_atomic_t *a) {
+    return pa_atomic_load(a);
+}
+
+static inline int pa_atomic_load_acquire(const pa_atomic_t *a) {
+    return pa_atomic_load(a);
+}
+
+static inline void pa_atomic_store_relaxed(pa_atomic_t *a, int i) {
+    pa_atomic_store(a, i);
+}
+
+static inline void pa_atomic_store_release(pa_atomic_t *a, int i) {
+    pa_atomic_store(a, i);
+}
+
+static inline int pa_atomic_inc_relaxed(pa_atomic_t *a) {
+    return pa_atomic_inc(a);
+}
+
+static inline int pa_atomic_dec_acq_rel(pa_atomic_t *a) {
+    return pa_atomic_dec(a);
+}
+
+static inline void* pa_atomic_ptr_load_relaxed(const pa_atomic_ptr_t *a) {
+    return pa_atomic_ptr_load(a);
+}
+
+static inline void* pa_atomic_ptr_load_acquire(const pa_atomic_ptr_t *a) {
+    return pa_atomic_ptr_load(a);
+}
+
+static inline void pa_atomic_ptr_store_relaxed(pa_atomic_ptr_t *a, void *p) {
+    pa_atomic_ptr_store(a, p);
+}
+
+static inline void pa_atomic_ptr_store_release(pa_atomic_ptr_t *a, void *p) {
+    pa_atomic_ptr_store(a, p);
+}
+
+#endif
+
 #endif
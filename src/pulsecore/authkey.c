@@ -37,6 +37,7 @@
 #include <pulsecore/log.h>
 #include <pulsecore/random.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
 
 #include "authkey.h"
 
@@ -129,6 +130,79 @@ finish:
     return ret;
 }
 
+/* The last cookie loaded by this process. Clients that open a context per
+ * sound would otherwise open, lock and read the cookie file every time; a
+ * stat() is enough to tell that it didn't change. */
+static pa_static_mutex cache_mutex = PA_STATIC_MUTEX_INIT;
+static struct {
+    char *fn;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    void *data;
+    size_t length;
+} cache;
+
+static bool cache_get(const char *fn, void *data, size_t length) {
+    struct stat st;
+    bool found = false;
+    pa_mutex *m;
+
+    if (stat(fn, &st) < 0)
+        return false;
+
+    m = pa_static_mutex_get(&cache_mutex, false, false);
+    pa_mutex_lock(m);
+
+    if (cache.fn && pa_streq(cache.fn, fn) && cache.length == length &&
+        cache.dev == st.st_dev && cache.ino == st.st_ino &&
+        cache.size == st.st_size && cache.mtime == st.st_mtime) {
+        memcpy(data, cache.data, length);
+        found = true;
+    }
+
+    pa_mutex_unlock(m);
+
+    return found;
+}
+
+static void cache_put(const char *fn, const void *data, size_t length) {
+    struct stat st;
+    pa_mutex *m;
+
+    if (stat(fn, &st) < 0 || (size_t) st.st_size != length)
+        return;
+
+    m = pa_static_mutex_get(&cache_mutex, false, false);
+    pa_mutex_lock(m);
+
+    pa_xfree(cache.fn);
+    pa_xfree(cache.data);
+    cache.fn = pa_xstrdup(fn);
+    cache.dev = st.st_dev;
+    cache.ino = st.st_ino;
+    cache.size = st.st_size;
+    cache.mtime = st.st_mtime;
+    cache.data = pa_xmemdup(data, length);
+    cache.length = length;
+
+    pa_mutex_unlock(m);
+}
+
+static void cache_drop(void) {
+    pa_mutex *m;
+
+    m = pa_static_mutex_get(&cache_mutex, false, false);
+    pa_mutex_lock(m);
+
+    pa_xfree(cache.fn);
+    pa_xfree(cache.data);
+    pa_zero(cache);
+
+    pa_mutex_unlock(m);
+}
+
 /* If the specified file path starts with / return it, otherwise
  * return path prepended with the config home directory. */
 static int normalize_path(const char *fn, char **_r) {
@@ -153,8 +227,15 @@ int pa_authkey_load(const char *fn, bool create, void *data, size_t length) {
     if ((ret = normalize_path(fn, &p)) < 0)
         return ret;
 
+    if (cache_get(p, data, length)) {
+        pa_xfree(p);
+        return 0;
+    }
+
     if ((ret = load(p, create, data, length)) < 0)
         pa_log_warn("Failed to load authentication key '%s': %s", p, (ret < 0) ? pa_cstrerror(errno) : "File corrupt");
+    else
+        cache_put(p, data, length);
 
     pa_xfree(p);
 
@@ -175,6 +256,9 @@ int pa_authkey_save(const char *fn, const void *data, size_t length) {
     if ((ret = normalize_path(fn, &p)) < 0)
         return ret;
 
+    /* mtime may not tell the new cookie from the old one */
+    cache_drop();
+
     if ((fd = pa_open_cloexec(p, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)) < 0) {
         pa_log_warn("Failed to open cookie file '%s': %s", fn, pa_cstrerror(errno));
         ret = -1;
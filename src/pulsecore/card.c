@@ -120,6 +120,24 @@ void pa_card_new_data_done(pa_card_new_data *data) {
     pa_xfree(data->name);
 }
 
+static void profile_count_ports(pa_card *c, pa_card_profile *profile) {
+    pa_device_port *port;
+    void *state;
+
+    profile->n_ports = 0;
+    profile->n_available_ports = 0;
+
+    PA_HASHMAP_FOREACH(port, c->ports, state) {
+        if (pa_hashmap_get(port->profiles, profile->name) != profile)
+            continue;
+
+        profile->n_ports++;
+
+        if (port->available != PA_AVAILABLE_NO)
+            profile->n_available_ports++;
+    }
+}
+
 pa_card *pa_card_new(pa_core *core, pa_card_new_data *data) {
     pa_card *c;
     const char *name;
@@ -159,12 +177,25 @@ pa_card *pa_card_new(pa_core *core, pa_card_new_data *data) {
     pa_assert_se(c->ports = data->ports);
     data->ports = NULL;
 
-    PA_HASHMAP_FOREACH(profile, c->profiles, state)
+    PA_HASHMAP_FOREACH(profile, c->profiles, state) {
         profile->card = c;
+        profile->n_ports = 0;
+        profile->n_available_ports = 0;
+    }
+
+    PA_HASHMAP_FOREACH(port, c->ports, state) {
+        void *state2;
 
-    PA_HASHMAP_FOREACH(port, c->ports, state)
         port->card = c;
 
+        PA_HASHMAP_FOREACH(profile, port->profiles, state2) {
+            profile->n_ports++;
+
+            if (port->available != PA_AVAILABLE_NO)
+                profile->n_available_ports++;
+        }
+    }
+
     c->preferred_input_port = data->preferred_input_port;
     c->preferred_output_port = data->preferred_output_port;
 
@@ -261,6 +292,7 @@ void pa_card_add_profile(pa_card *c, pa_card_profile *profile) {
     /* take ownership of the profile */
     pa_assert_se(pa_hashmap_put(c->profiles, profile->name, profile) >= 0);
     profile->card = c;
+    profile_count_ports(c, profile);
 
     pa_subscription_post(c->core, PA_SUBSCRIPTION_EVENT_CARD|PA_SUBSCRIPTION_EVENT_CHANGE, c->index);
 
@@ -57,6 +57,13 @@ struct pa_card_profile {
     unsigned max_sink_channels;
     unsigned max_source_channels;
 
+    /* How many of the card's ports list this profile, and how many of
+     * those aren't PA_AVAILABLE_NO. Kept up to date by the card and
+     * pa_device_port_set_available(), so that availability decisions
+     * don't have to scan every port. */
+    unsigned n_ports;
+    unsigned n_available_ports;
+
     /* .. followed by some implementation specific data */
 };
 
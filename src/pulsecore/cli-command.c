@@ -135,6 +135,8 @@ static int pa_cli_command_sink_port(pa_core *c, pa_tokenizer *t, pa_strbuf *buf,
 static int pa_cli_command_source_port(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
 static int pa_cli_command_port_offset(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
 static int pa_cli_command_dump_volumes(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
+static int pa_cli_command_render_profile(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
+static int pa_cli_command_render_profiling(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
 
 /* A method table for all available commands */
 
@@ -194,6 +196,8 @@ static const struct command commands[] = {
     { "play-file",               pa_cli_command_play_file,          "Play a sound file (args: filename, sink|index)", 3},
     { "dump",                    pa_cli_command_dump,               "Dump daemon configuration", 1},
     { "dump-volumes",            pa_cli_command_dump_volumes,       "Debug: Show the state of all volumes", 1 },
+    { "render-profile",          pa_cli_command_render_profile,     "Debug: Show how long the IO threads spend in each render stage", 1 },
+    { "set-render-profiling",    pa_cli_command_render_profiling,   "Debug: Time the render stages in the IO threads (args: bool)", 2 },
     { "shared",                  pa_cli_command_list_shared_props,  "Debug: Show shared properties", 1},
     { "exit",                    pa_cli_command_exit,               "Terminate the daemon",         1 },
     { "vacuum",                  pa_cli_command_vacuum,             NULL, 1},
@@ -343,6 +347,9 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool
     char cm[PA_CHANNEL_MAP_SNPRINT_MAX];
     char bytes[PA_BYTES_SNPRINT_MAX];
     const pa_mempool_stat *mstat;
+    const uint64_t *n;
+    const void *source;
+    void *state;
     unsigned k;
 
     static const char* const type_table[PA_MEMBLOCK_TYPE_MAX] = {
@@ -398,6 +405,25 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool
                          (unsigned) pa_atomic_load(&mstat->n_allocated_by_type[k]),
                          (unsigned) pa_atomic_load(&mstat->n_accumulated_by_type[k]));
 
+    for (k = 0; k < mstat->n_slot_classes; k++)
+        pa_strbuf_printf(buf,
+                         "Memory pool slots of size %s: %u/%u in use, %u times full.\n",
+                         pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) mstat->slot_size[k]),
+                         (unsigned) pa_atomic_load(&mstat->n_slots_allocated[k]),
+                         mstat->n_slots[k],
+                         (unsigned) pa_atomic_load(&mstat->n_slot_class_full[k]));
+
+    pa_strbuf_printf(buf, "Memory pool thread cache: %u hits, %u misses.\n",
+                     (unsigned) pa_atomic_load(&mstat->n_cache_hits),
+                     (unsigned) pa_atomic_load(&mstat->n_cache_misses));
+
+    pa_strbuf_printf(buf, "Memory blocks copied because they could not be exported: %u, dropped because they could not be imported: %u.\n",
+                     (unsigned) pa_atomic_load(&mstat->n_export_failed),
+                     (unsigned) pa_atomic_load(&mstat->n_import_failed));
+
+    PA_HASHMAP_FOREACH_KV(source, n, c->wakeups, state)
+        pa_strbuf_printf(buf, "Main loop wakeups by %s timer: %llu.\n", (const char *) source, (unsigned long long) *n);
+
     return 0;
 }
 
@@ -1873,6 +1899,44 @@ static int pa_cli_command_dump(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool
     return 0;
 }
 
+static int pa_cli_command_render_profile(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail) {
+    char *s;
+
+    pa_core_assert_ref(c);
+    pa_assert(t);
+    pa_assert(buf);
+    pa_assert(fail);
+
+    pa_assert_se(s = pa_render_profile_to_string(c));
+    pa_strbuf_puts(buf, s);
+    pa_xfree(s);
+    return 0;
+}
+
+static int pa_cli_command_render_profiling(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail) {
+    const char *m;
+    int b;
+
+    pa_core_assert_ref(c);
+    pa_assert(t);
+    pa_assert(buf);
+    pa_assert(fail);
+
+    if (!(m = pa_tokenizer_get(t, 1))) {
+        pa_strbuf_puts(buf, "You need to specify a boolean.\n");
+        return -1;
+    }
+
+    if ((b = pa_parse_boolean(m)) < 0) {
+        pa_strbuf_puts(buf, "Failed to parse render profiling switch.\n");
+        return -1;
+    }
+
+    pa_render_profile_set_enabled(b);
+
+    return 0;
+}
+
 static int pa_cli_command_dump_volumes(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail) {
     pa_sink *s;
     pa_source *so;
@@ -39,66 +39,54 @@
 
 #include "cli-text.h"
 
-char *pa_module_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_module *m;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
-
-    s = pa_strbuf_new();
-
-    pa_strbuf_printf(s, "%u module(s) loaded.\n", pa_idxset_size(c->modules));
-
-    PA_IDXSET_FOREACH(m, c->modules, idx) {
-        char *t;
-
-        pa_strbuf_printf(s, "    index: %u\n"
-                         "\tname: <%s>\n"
-                         "\targument: <%s>\n"
-                         "\tused: %i\n"
-                         "\tload once: %s\n",
-                         m->index,
-                         m->name,
-                         pa_strempty(m->argument),
-                         pa_module_get_n_used(m),
-                         pa_yes_no(m->load_once));
-
-        t = pa_proplist_to_string_sep(m->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
-    }
-
-    return pa_strbuf_to_string_free(s);
+static void append_module(pa_strbuf *s, pa_module *m) {
+    char *t;
+
+    pa_assert(s);
+    pa_assert(m);
+
+    pa_strbuf_printf(s, "    index: %u\n"
+                     "\tname: <%s>\n"
+                     "\targument: <%s>\n"
+                     "\tused: %i\n"
+                     "\tload once: %s\n",
+                     m->index,
+                     m->name,
+                     pa_strempty(m->argument),
+                     pa_module_get_n_used(m),
+                     pa_yes_no(m->load_once));
+
+    t = pa_proplist_to_string_sep(m->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
 }
 
-char *pa_client_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_client *client;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
+static void append_client(pa_strbuf *s, pa_client *client) {
+    char *t;
 
-    s = pa_strbuf_new();
-
-    pa_strbuf_printf(s, "%u client(s) logged in.\n", pa_idxset_size(c->clients));
-
-    PA_IDXSET_FOREACH(client, c->clients, idx) {
-        char *t;
-        pa_strbuf_printf(
-                s,
-                "    index: %u\n"
-                "\tdriver: <%s>\n",
-                client->index,
-                client->driver);
+    pa_assert(s);
+    pa_assert(client);
 
-        if (client->module)
-            pa_strbuf_printf(s, "\towner module: %u\n", client->module->index);
+    pa_strbuf_printf(
+            s,
+            "    index: %u\n"
+            "\tdriver: <%s>\n",
+            client->index,
+            client->driver);
 
-        t = pa_proplist_to_string_sep(client->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
-    }
+    if (client->module)
+        pa_strbuf_printf(s, "\towner module: %u\n", client->module->index);
 
-    return pa_strbuf_to_string_free(s);
+    pa_strbuf_printf(
+            s,
+            "\trender time: %0.2f ms\n"
+            "\tmemory: %lu bytes\n",
+            (double) pa_client_get_render_usec(client) / PA_USEC_PER_MSEC,
+            (unsigned long) pa_client_get_memory(client));
+
+    t = pa_proplist_to_string_sep(client->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
 }
 
 static const char *available_to_string(pa_available_t a) {
@@ -134,66 +122,56 @@ static void append_port_list(pa_strbuf *s, pa_hashmap *ports) {
     }
 }
 
-char *pa_card_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_card *card;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
-
-    s = pa_strbuf_new();
+static void append_card(pa_strbuf *s, pa_card *card) {
+    char *t;
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t sidx;
+    pa_card_profile *profile;
+    void *state;
 
-    pa_strbuf_printf(s, "%u card(s) available.\n", pa_idxset_size(c->cards));
+    pa_assert(s);
+    pa_assert(card);
 
-    PA_IDXSET_FOREACH(card, c->cards, idx) {
-        char *t;
-        pa_sink *sink;
-        pa_source *source;
-        uint32_t sidx;
-        pa_card_profile *profile;
-        void *state;
+    pa_strbuf_printf(
+            s,
+            "    index: %u\n"
+            "\tname: <%s>\n"
+            "\tdriver: <%s>\n",
+            card->index,
+            card->name,
+            card->driver);
 
-        pa_strbuf_printf(
-                s,
-                "    index: %u\n"
-                "\tname: <%s>\n"
-                "\tdriver: <%s>\n",
-                card->index,
-                card->name,
-                card->driver);
-
-        if (card->module)
-            pa_strbuf_printf(s, "\towner module: %u\n", card->module->index);
-
-        t = pa_proplist_to_string_sep(card->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
+    if (card->module)
+        pa_strbuf_printf(s, "\towner module: %u\n", card->module->index);
 
-        pa_strbuf_puts(s, "\tprofiles:\n");
-        PA_HASHMAP_FOREACH(profile, card->profiles, state)
-            pa_strbuf_printf(s, "\t\t%s: %s (priority %u, available: %s)\n", profile->name, profile->description,
-                             profile->priority, available_to_string(profile->available));
+    t = pa_proplist_to_string_sep(card->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
 
-        pa_strbuf_printf(
-                s,
-                "\tactive profile: <%s>\n",
-                card->active_profile->name);
+    pa_strbuf_puts(s, "\tprofiles:\n");
+    PA_HASHMAP_FOREACH(profile, card->profiles, state)
+        pa_strbuf_printf(s, "\t\t%s: %s (priority %u, available: %s)\n", profile->name, profile->description,
+                         profile->priority, available_to_string(profile->available));
 
-        if (!pa_idxset_isempty(card->sinks)) {
-            pa_strbuf_puts(s, "\tsinks:\n");
-            PA_IDXSET_FOREACH(sink, card->sinks, sidx)
-                pa_strbuf_printf(s, "\t\t%s/#%u: %s\n", sink->name, sink->index, pa_strna(pa_proplist_gets(sink->proplist, PA_PROP_DEVICE_DESCRIPTION)));
-        }
+    pa_strbuf_printf(
+            s,
+            "\tactive profile: <%s>\n",
+            card->active_profile->name);
 
-        if (!pa_idxset_isempty(card->sources)) {
-            pa_strbuf_puts(s, "\tsources:\n");
-            PA_IDXSET_FOREACH(source, card->sources, sidx)
-                pa_strbuf_printf(s, "\t\t%s/#%u: %s\n", source->name, source->index, pa_strna(pa_proplist_gets(source->proplist, PA_PROP_DEVICE_DESCRIPTION)));
-        }
+    if (!pa_idxset_isempty(card->sinks)) {
+        pa_strbuf_puts(s, "\tsinks:\n");
+        PA_IDXSET_FOREACH(sink, card->sinks, sidx)
+            pa_strbuf_printf(s, "\t\t%s/#%u: %s\n", sink->name, sink->index, pa_strna(pa_proplist_gets(sink->proplist, PA_PROP_DEVICE_DESCRIPTION)));
+    }
 
-        append_port_list(s, card->ports);
+    if (!pa_idxset_isempty(card->sources)) {
+        pa_strbuf_puts(s, "\tsources:\n");
+        PA_IDXSET_FOREACH(source, card->sources, sidx)
+            pa_strbuf_printf(s, "\t\t%s/#%u: %s\n", source->name, source->index, pa_strna(pa_proplist_gets(source->proplist, PA_PROP_DEVICE_DESCRIPTION)));
     }
 
-    return pa_strbuf_to_string_free(s);
+    append_port_list(s, card->ports);
 }
 
 static const char *sink_state_to_string(pa_sink_state_t state) {
@@ -230,481 +208,691 @@ static const char *source_state_to_string(pa_source_state_t state) {
     }
 }
 
-char *pa_sink_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_sink *sink;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
+static void append_sink(pa_strbuf *s, pa_sink *sink) {
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX],
+        cv[PA_CVOLUME_SNPRINT_VERBOSE_MAX],
+        v[PA_VOLUME_SNPRINT_VERBOSE_MAX],
+        cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t;
+    const char *cmn;
+    pa_sink_rewind_stats rs;
+    pa_sink_passthrough_stats ps;
+
+    pa_assert(s);
+    pa_assert(sink);
+
+    cmn = pa_channel_map_to_pretty_name(&sink->channel_map);
+
+    pa_strbuf_printf(
+        s,
+        "  %c index: %u\n"
+        "\tname: <%s>\n"
+        "\tdriver: <%s>\n"
+        "\tflags: %s%s%s%s%s%s%s%s\n"
+        "\tstate: %s\n"
+        "\tsuspend cause: %s%s%s%s\n"
+        "\tpriority: %u\n"
+        "\tvolume: %s\n"
+        "\t        balance %0.2f\n"
+        "\tbase volume: %s\n"
+        "\tvolume steps: %u\n"
+        "\tmuted: %s\n"
+        "\tcurrent latency: %0.2f ms\n"
+        "\tmax request: %lu KiB\n"
+        "\tmax rewind: %lu KiB\n"
+        "\tmonitor source: %u\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tused by: %u\n"
+        "\tlinked by: %u\n",
+        sink == sink->core->default_sink ? '*' : ' ',
+        sink->index,
+        sink->name,
+        sink->driver,
+        sink->flags & PA_SINK_HARDWARE ? "HARDWARE " : "",
+        sink->flags & PA_SINK_NETWORK ? "NETWORK " : "",
+        sink->flags & PA_SINK_HW_MUTE_CTRL ? "HW_MUTE_CTRL " : "",
+        sink->flags & PA_SINK_HW_VOLUME_CTRL ? "HW_VOLUME_CTRL " : "",
+        sink->flags & PA_SINK_DECIBEL_VOLUME ? "DECIBEL_VOLUME " : "",
+        sink->flags & PA_SINK_LATENCY ? "LATENCY " : "",
+        sink->flags & PA_SINK_FLAT_VOLUME ? "FLAT_VOLUME " : "",
+        sink->flags & PA_SINK_DYNAMIC_LATENCY ? "DYNAMIC_LATENCY" : "",
+        sink_state_to_string(pa_sink_get_state(sink)),
+        sink->suspend_cause & PA_SUSPEND_USER ? "USER " : "",
+        sink->suspend_cause & PA_SUSPEND_APPLICATION ? "APPLICATION " : "",
+        sink->suspend_cause & (PA_SUSPEND_IDLE|PA_SUSPEND_IDLE_SOFT) ? "IDLE " : "",
+        sink->suspend_cause & PA_SUSPEND_SESSION ? "SESSION" : "",
+        sink->priority,
+        pa_cvolume_snprint_verbose(cv,
+                                   sizeof(cv),
+                                   pa_sink_get_volume(sink, false),
+                                   &sink->channel_map,
+                                   sink->flags & PA_SINK_DECIBEL_VOLUME),
+        pa_cvolume_get_balance(pa_sink_get_volume(sink, false), &sink->channel_map),
+        pa_volume_snprint_verbose(v, sizeof(v), sink->base_volume, sink->flags & PA_SINK_DECIBEL_VOLUME),
+        sink->n_volume_steps,
+        pa_yes_no(pa_sink_get_mute(sink, false)),
+        (double) pa_sink_get_latency(sink) / (double) PA_USEC_PER_MSEC,
+        (unsigned long) pa_sink_get_max_request(sink) / 1024,
+        (unsigned long) pa_sink_get_max_rewind(sink) / 1024,
+        sink->monitor_source ? sink->monitor_source->index : PA_INVALID_INDEX,
+        pa_sample_spec_snprint(ss, sizeof(ss), &sink->sample_spec),
+        pa_channel_map_snprint(cm, sizeof(cm), &sink->channel_map),
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        pa_sink_used_by(sink),
+        pa_sink_linked_by(sink));
+
+    if (sink->flags & PA_SINK_DYNAMIC_LATENCY) {
+        pa_usec_t min_latency, max_latency;
+        pa_sink_get_latency_range(sink, &min_latency, &max_latency);
 
-    s = pa_strbuf_new();
-
-    pa_strbuf_printf(s, "%u sink(s) available.\n", pa_idxset_size(c->sinks));
+        pa_strbuf_printf(
+                s,
+                "\tconfigured latency: %0.2f ms; range is %0.2f .. %0.2f ms\n",
+                (double) pa_sink_get_requested_latency(sink) / (double) PA_USEC_PER_MSEC,
+                (double) min_latency / PA_USEC_PER_MSEC,
+                (double) max_latency / PA_USEC_PER_MSEC);
+    } else
+        pa_strbuf_printf(
+                s,
+                "\tfixed latency: %0.2f ms\n",
+                (double) pa_sink_get_fixed_latency(sink) / PA_USEC_PER_MSEC);
 
-    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
-        char ss[PA_SAMPLE_SPEC_SNPRINT_MAX],
-            cv[PA_CVOLUME_SNPRINT_VERBOSE_MAX],
-            v[PA_VOLUME_SNPRINT_VERBOSE_MAX],
-            cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t;
-        const char *cmn;
+    pa_sink_get_rewind_stats(sink, &rs);
+    pa_strbuf_printf(
+            s,
+            "\trewinds: %llu of %llu requested, %llu KiB rendered again\n",
+            (unsigned long long) rs.n_rewinds,
+            (unsigned long long) rs.n_requested,
+            (unsigned long long) (rs.n_bytes / 1024));
 
-        cmn = pa_channel_map_to_pretty_name(&sink->channel_map);
+    if (rs.n_fast_lane > 0)
+        pa_strbuf_printf(
+                s,
+                "\tfast lane rewinds: %llu, the deep bus was played again\n",
+                (unsigned long long) rs.n_fast_lane);
 
+    pa_sink_get_passthrough_stats(sink, &ps);
+    if (ps.n_renders > 0)
         pa_strbuf_printf(
-            s,
-            "  %c index: %u\n"
-            "\tname: <%s>\n"
-            "\tdriver: <%s>\n"
-            "\tflags: %s%s%s%s%s%s%s%s\n"
-            "\tstate: %s\n"
-            "\tsuspend cause: %s%s%s%s\n"
-            "\tpriority: %u\n"
-            "\tvolume: %s\n"
-            "\t        balance %0.2f\n"
-            "\tbase volume: %s\n"
-            "\tvolume steps: %u\n"
-            "\tmuted: %s\n"
-            "\tcurrent latency: %0.2f ms\n"
-            "\tmax request: %lu KiB\n"
-            "\tmax rewind: %lu KiB\n"
-            "\tmonitor source: %u\n"
-            "\tsample spec: %s\n"
-            "\tchannel map: %s%s%s\n"
-            "\tused by: %u\n"
-            "\tlinked by: %u\n",
-            sink == c->default_sink ? '*' : ' ',
-            sink->index,
-            sink->name,
-            sink->driver,
-            sink->flags & PA_SINK_HARDWARE ? "HARDWARE " : "",
-            sink->flags & PA_SINK_NETWORK ? "NETWORK " : "",
-            sink->flags & PA_SINK_HW_MUTE_CTRL ? "HW_MUTE_CTRL " : "",
-            sink->flags & PA_SINK_HW_VOLUME_CTRL ? "HW_VOLUME_CTRL " : "",
-            sink->flags & PA_SINK_DECIBEL_VOLUME ? "DECIBEL_VOLUME " : "",
-            sink->flags & PA_SINK_LATENCY ? "LATENCY " : "",
-            sink->flags & PA_SINK_FLAT_VOLUME ? "FLAT_VOLUME " : "",
-            sink->flags & PA_SINK_DYNAMIC_LATENCY ? "DYNAMIC_LATENCY" : "",
-            sink_state_to_string(pa_sink_get_state(sink)),
-            sink->suspend_cause & PA_SUSPEND_USER ? "USER " : "",
-            sink->suspend_cause & PA_SUSPEND_APPLICATION ? "APPLICATION " : "",
-            sink->suspend_cause & PA_SUSPEND_IDLE ? "IDLE " : "",
-            sink->suspend_cause & PA_SUSPEND_SESSION ? "SESSION" : "",
-            sink->priority,
-            pa_cvolume_snprint_verbose(cv,
-                                       sizeof(cv),
-                                       pa_sink_get_volume(sink, false),
-                                       &sink->channel_map,
-                                       sink->flags & PA_SINK_DECIBEL_VOLUME),
-            pa_cvolume_get_balance(pa_sink_get_volume(sink, false), &sink->channel_map),
-            pa_volume_snprint_verbose(v, sizeof(v), sink->base_volume, sink->flags & PA_SINK_DECIBEL_VOLUME),
-            sink->n_volume_steps,
-            pa_yes_no(pa_sink_get_mute(sink, false)),
-            (double) pa_sink_get_latency(sink) / (double) PA_USEC_PER_MSEC,
-            (unsigned long) pa_sink_get_max_request(sink) / 1024,
-            (unsigned long) pa_sink_get_max_rewind(sink) / 1024,
-            sink->monitor_source ? sink->monitor_source->index : PA_INVALID_INDEX,
-            pa_sample_spec_snprint(ss, sizeof(ss), &sink->sample_spec),
-            pa_channel_map_snprint(cm, sizeof(cm), &sink->channel_map),
-            cmn ? "\n\t             " : "",
-            cmn ? cmn : "",
-            pa_sink_used_by(sink),
-            pa_sink_linked_by(sink));
-
-        if (sink->flags & PA_SINK_DYNAMIC_LATENCY) {
-            pa_usec_t min_latency, max_latency;
-            pa_sink_get_latency_range(sink, &min_latency, &max_latency);
-
-            pa_strbuf_printf(
-                    s,
-                    "\tconfigured latency: %0.2f ms; range is %0.2f .. %0.2f ms\n",
-                    (double) pa_sink_get_requested_latency(sink) / (double) PA_USEC_PER_MSEC,
-                    (double) min_latency / PA_USEC_PER_MSEC,
-                    (double) max_latency / PA_USEC_PER_MSEC);
-        } else
-            pa_strbuf_printf(
-                    s,
-                    "\tfixed latency: %0.2f ms\n",
-                    (double) pa_sink_get_fixed_latency(sink) / PA_USEC_PER_MSEC);
-
-        if (sink->card)
-            pa_strbuf_printf(s, "\tcard: %u <%s>\n", sink->card->index, sink->card->name);
-        if (sink->module)
-            pa_strbuf_printf(s, "\tmodule: %u\n", sink->module->index);
-
-        t = pa_proplist_to_string_sep(sink->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
+                s,
+                "\tpassthrough: %llu blocks, %llu KiB, %llu without data, %llu short\n",
+                (unsigned long long) ps.n_renders,
+                (unsigned long long) (ps.n_bytes / 1024),
+                (unsigned long long) ps.n_silence,
+                (unsigned long long) ps.n_short);
 
-        append_port_list(s, sink->ports);
+    if (sink->card)
+        pa_strbuf_printf(s, "\tcard: %u <%s>\n", sink->card->index, sink->card->name);
+    if (sink->module)
+        pa_strbuf_printf(s, "\tmodule: %u\n", sink->module->index);
 
-        if (sink->active_port)
-            pa_strbuf_printf(
-                    s,
-                    "\tactive port: <%s>\n",
-                    sink->active_port->name);
-    }
+    t = pa_proplist_to_string_sep(sink->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
 
-    return pa_strbuf_to_string_free(s);
+    append_port_list(s, sink->ports);
+
+    if (sink->active_port)
+        pa_strbuf_printf(
+                s,
+                "\tactive port: <%s>\n",
+                sink->active_port->name);
 }
 
-char *pa_source_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_source *source;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
+static void append_source(pa_strbuf *s, pa_source *source) {
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX],
+        cv[PA_CVOLUME_SNPRINT_VERBOSE_MAX],
+        v[PA_VOLUME_SNPRINT_VERBOSE_MAX],
+        cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t;
+    const char *cmn;
+
+    pa_assert(s);
+    pa_assert(source);
+
+    cmn = pa_channel_map_to_pretty_name(&source->channel_map);
+
+    pa_strbuf_printf(
+        s,
+        "  %c index: %u\n"
+        "\tname: <%s>\n"
+        "\tdriver: <%s>\n"
+        "\tflags: %s%s%s%s%s%s%s\n"
+        "\tstate: %s\n"
+        "\tsuspend cause: %s%s%s%s\n"
+        "\tpriority: %u\n"
+        "\tvolume: %s\n"
+        "\t        balance %0.2f\n"
+        "\tbase volume: %s\n"
+        "\tvolume steps: %u\n"
+        "\tmuted: %s\n"
+        "\tcurrent latency: %0.2f ms\n"
+        "\tmax rewind: %lu KiB\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tused by: %u\n"
+        "\tlinked by: %u\n",
+        source == source->core->default_source ? '*' : ' ',
+        source->index,
+        source->name,
+        source->driver,
+        source->flags & PA_SOURCE_HARDWARE ? "HARDWARE " : "",
+        source->flags & PA_SOURCE_NETWORK ? "NETWORK " : "",
+        source->flags & PA_SOURCE_HW_MUTE_CTRL ? "HW_MUTE_CTRL " : "",
+        source->flags & PA_SOURCE_HW_VOLUME_CTRL ? "HW_VOLUME_CTRL " : "",
+        source->flags & PA_SOURCE_DECIBEL_VOLUME ? "DECIBEL_VOLUME " : "",
+        source->flags & PA_SOURCE_LATENCY ? "LATENCY " : "",
+        source->flags & PA_SOURCE_DYNAMIC_LATENCY ? "DYNAMIC_LATENCY" : "",
+        source_state_to_string(pa_source_get_state(source)),
+        source->suspend_cause & PA_SUSPEND_USER ? "USER " : "",
+        source->suspend_cause & PA_SUSPEND_APPLICATION ? "APPLICATION " : "",
+        source->suspend_cause & (PA_SUSPEND_IDLE|PA_SUSPEND_IDLE_SOFT) ? "IDLE " : "",
+        source->suspend_cause & PA_SUSPEND_SESSION ? "SESSION" : "",
+        source->priority,
+        pa_cvolume_snprint_verbose(cv,
+                                   sizeof(cv),
+                                   pa_source_get_volume(source, false),
+                                   &source->channel_map,
+                                   source->flags & PA_SOURCE_DECIBEL_VOLUME),
+        pa_cvolume_get_balance(pa_source_get_volume(source, false), &source->channel_map),
+        pa_volume_snprint_verbose(v, sizeof(v), source->base_volume, source->flags & PA_SOURCE_DECIBEL_VOLUME),
+        source->n_volume_steps,
+        pa_yes_no(pa_source_get_mute(source, false)),
+        (double) pa_source_get_latency(source) / PA_USEC_PER_MSEC,
+        (unsigned long) pa_source_get_max_rewind(source) / 1024,
+        pa_sample_spec_snprint(ss, sizeof(ss), &source->sample_spec),
+        pa_channel_map_snprint(cm, sizeof(cm), &source->channel_map),
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        pa_source_used_by(source),
+        pa_source_linked_by(source));
+
+    if (source->flags & PA_SOURCE_DYNAMIC_LATENCY) {
+        pa_usec_t min_latency, max_latency;
+        pa_source_get_latency_range(source, &min_latency, &max_latency);
 
-    s = pa_strbuf_new();
+        pa_strbuf_printf(
+                s,
+                "\tconfigured latency: %0.2f ms; range is %0.2f .. %0.2f ms\n",
+                (double) pa_source_get_requested_latency(source) / PA_USEC_PER_MSEC,
+                (double) min_latency / PA_USEC_PER_MSEC,
+                (double) max_latency / PA_USEC_PER_MSEC);
+    } else
+        pa_strbuf_printf(
+                s,
+                "\tfixed latency: %0.2f ms\n",
+                (double) pa_source_get_fixed_latency(source) / PA_USEC_PER_MSEC);
 
-    pa_strbuf_printf(s, "%u source(s) available.\n", pa_idxset_size(c->sources));
+    if (source->monitor_of)
+        pa_strbuf_printf(s, "\tmonitor_of: %u\n", source->monitor_of->index);
+    if (source->card)
+        pa_strbuf_printf(s, "\tcard: %u <%s>\n", source->card->index, source->card->name);
+    if (source->module)
+        pa_strbuf_printf(s, "\tmodule: %u\n", source->module->index);
 
-    PA_IDXSET_FOREACH(source, c->sources, idx) {
-        char ss[PA_SAMPLE_SPEC_SNPRINT_MAX],
-            cv[PA_CVOLUME_SNPRINT_VERBOSE_MAX],
-            v[PA_VOLUME_SNPRINT_VERBOSE_MAX],
-            cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t;
-        const char *cmn;
+    t = pa_proplist_to_string_sep(source->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
 
-        cmn = pa_channel_map_to_pretty_name(&source->channel_map);
+    append_port_list(s, source->ports);
 
+    if (source->active_port)
         pa_strbuf_printf(
-            s,
-            "  %c index: %u\n"
-            "\tname: <%s>\n"
-            "\tdriver: <%s>\n"
-            "\tflags: %s%s%s%s%s%s%s\n"
-            "\tstate: %s\n"
-            "\tsuspend cause: %s%s%s%s\n"
-            "\tpriority: %u\n"
-            "\tvolume: %s\n"
-            "\t        balance %0.2f\n"
-            "\tbase volume: %s\n"
-            "\tvolume steps: %u\n"
-            "\tmuted: %s\n"
-            "\tcurrent latency: %0.2f ms\n"
-            "\tmax rewind: %lu KiB\n"
-            "\tsample spec: %s\n"
-            "\tchannel map: %s%s%s\n"
-            "\tused by: %u\n"
-            "\tlinked by: %u\n",
-            source == c->default_source ? '*' : ' ',
-            source->index,
-            source->name,
-            source->driver,
-            source->flags & PA_SOURCE_HARDWARE ? "HARDWARE " : "",
-            source->flags & PA_SOURCE_NETWORK ? "NETWORK " : "",
-            source->flags & PA_SOURCE_HW_MUTE_CTRL ? "HW_MUTE_CTRL " : "",
-            source->flags & PA_SOURCE_HW_VOLUME_CTRL ? "HW_VOLUME_CTRL " : "",
-            source->flags & PA_SOURCE_DECIBEL_VOLUME ? "DECIBEL_VOLUME " : "",
-            source->flags & PA_SOURCE_LATENCY ? "LATENCY " : "",
-            source->flags & PA_SOURCE_DYNAMIC_LATENCY ? "DYNAMIC_LATENCY" : "",
-            source_state_to_string(pa_source_get_state(source)),
-            source->suspend_cause & PA_SUSPEND_USER ? "USER " : "",
-            source->suspend_cause & PA_SUSPEND_APPLICATION ? "APPLICATION " : "",
-            source->suspend_cause & PA_SUSPEND_IDLE ? "IDLE " : "",
-            source->suspend_cause & PA_SUSPEND_SESSION ? "SESSION" : "",
-            source->priority,
-            pa_cvolume_snprint_verbose(cv,
-                                       sizeof(cv),
-                                       pa_source_get_volume(source, false),
-                                       &source->channel_map,
-                                       source->flags & PA_SOURCE_DECIBEL_VOLUME),
-            pa_cvolume_get_balance(pa_source_get_volume(source, false), &source->channel_map),
-            pa_volume_snprint_verbose(v, sizeof(v), source->base_volume, source->flags & PA_SOURCE_DECIBEL_VOLUME),
-            source->n_volume_steps,
-            pa_yes_no(pa_source_get_mute(source, false)),
-            (double) pa_source_get_latency(source) / PA_USEC_PER_MSEC,
-            (unsigned long) pa_source_get_max_rewind(source) / 1024,
-            pa_sample_spec_snprint(ss, sizeof(ss), &source->sample_spec),
-            pa_channel_map_snprint(cm, sizeof(cm), &source->channel_map),
-            cmn ? "\n\t             " : "",
-            cmn ? cmn : "",
-            pa_source_used_by(source),
-            pa_source_linked_by(source));
-
-        if (source->flags & PA_SOURCE_DYNAMIC_LATENCY) {
-            pa_usec_t min_latency, max_latency;
-            pa_source_get_latency_range(source, &min_latency, &max_latency);
-
-            pa_strbuf_printf(
-                    s,
-                    "\tconfigured latency: %0.2f ms; range is %0.2f .. %0.2f ms\n",
-                    (double) pa_source_get_requested_latency(source) / PA_USEC_PER_MSEC,
-                    (double) min_latency / PA_USEC_PER_MSEC,
-                    (double) max_latency / PA_USEC_PER_MSEC);
-        } else
-            pa_strbuf_printf(
-                    s,
-                    "\tfixed latency: %0.2f ms\n",
-                    (double) pa_source_get_fixed_latency(source) / PA_USEC_PER_MSEC);
-
-        if (source->monitor_of)
-            pa_strbuf_printf(s, "\tmonitor_of: %u\n", source->monitor_of->index);
-        if (source->card)
-            pa_strbuf_printf(s, "\tcard: %u <%s>\n", source->card->index, source->card->name);
-        if (source->module)
-            pa_strbuf_printf(s, "\tmodule: %u\n", source->module->index);
-
-        t = pa_proplist_to_string_sep(source->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
-
-        append_port_list(s, source->ports);
-
-        if (source->active_port)
-            pa_strbuf_printf(
-                    s,
-                    "\tactive port: <%s>\n",
-                    source->active_port->name);
-    }
-
-    return pa_strbuf_to_string_free(s);
+                s,
+                "\tactive port: <%s>\n",
+                source->active_port->name);
 }
 
-char *pa_source_output_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_source_output *o;
-    uint32_t idx = PA_IDXSET_INVALID;
+static void append_source_output(pa_strbuf *s, pa_source_output *o) {
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cv[PA_CVOLUME_SNPRINT_VERBOSE_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t, clt[28];
+    pa_usec_t cl;
+    const char *cmn;
+    pa_cvolume v;
+    char *volume_str = NULL;
     static const char* const state_table[] = {
         [PA_SOURCE_OUTPUT_INIT] = "INIT",
         [PA_SOURCE_OUTPUT_RUNNING] = "RUNNING",
         [PA_SOURCE_OUTPUT_CORKED] = "CORKED",
         [PA_SOURCE_OUTPUT_UNLINKED] = "UNLINKED"
     };
-    pa_assert(c);
 
-    s = pa_strbuf_new();
+    pa_assert(s);
+    pa_assert(o);
+
+    cmn = pa_channel_map_to_pretty_name(&o->channel_map);
+
+    if ((cl = pa_source_output_get_requested_latency(o)) == (pa_usec_t) -1)
+        pa_snprintf(clt, sizeof(clt), "n/a");
+    else
+        pa_snprintf(clt, sizeof(clt), "%0.2f ms", (double) cl / PA_USEC_PER_MSEC);
+
+    pa_assert(o->source);
+
+    if (pa_source_output_is_volume_readable(o)) {
+        pa_source_output_get_volume(o, &v, true);
+        volume_str = pa_sprintf_malloc("%s\n\t        balance %0.2f",
+                                       pa_cvolume_snprint_verbose(cv, sizeof(cv), &v, &o->channel_map, true),
+                                       pa_cvolume_get_balance(&v, &o->channel_map));
+    } else
+        volume_str = pa_xstrdup("n/a");
+
+    pa_strbuf_printf(
+        s,
+        "    index: %u\n"
+        "\tdriver: <%s>\n"
+        "\tflags: %s%s%s%s%s%s%s%s%s%s%s%s\n"
+        "\tstate: %s\n"
+        "\tsource: %u <%s>\n"
+        "\tvolume: %s\n"
+        "\tmuted: %s\n"
+        "\tcurrent latency: %0.2f ms\n"
+        "\trequested latency: %s\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tresample method: %s\n",
+        o->index,
+        o->driver,
+        o->flags & PA_SOURCE_OUTPUT_VARIABLE_RATE ? "VARIABLE_RATE " : "",
+        o->flags & PA_SOURCE_OUTPUT_DONT_MOVE ? "DONT_MOVE " : "",
+        o->flags & PA_SOURCE_OUTPUT_START_CORKED ? "START_CORKED " : "",
+        o->flags & PA_SOURCE_OUTPUT_NO_REMAP ? "NO_REMAP " : "",
+        o->flags & PA_SOURCE_OUTPUT_NO_REMIX ? "NO_REMIX " : "",
+        o->flags & PA_SOURCE_OUTPUT_FIX_FORMAT ? "FIX_FORMAT " : "",
+        o->flags & PA_SOURCE_OUTPUT_FIX_RATE ? "FIX_RATE " : "",
+        o->flags & PA_SOURCE_OUTPUT_FIX_CHANNELS ? "FIX_CHANNELS " : "",
+        o->flags & PA_SOURCE_OUTPUT_DONT_INHIBIT_AUTO_SUSPEND ? "DONT_INHIBIT_AUTO_SUSPEND " : "",
+        o->flags & PA_SOURCE_OUTPUT_NO_CREATE_ON_SUSPEND ? "NO_CREATE_ON_SUSPEND " : "",
+        o->flags & PA_SOURCE_OUTPUT_KILL_ON_SUSPEND ? "KILL_ON_SUSPEND " : "",
+        o->flags & PA_SOURCE_OUTPUT_PASSTHROUGH ? "PASSTHROUGH " : "",
+        state_table[pa_source_output_get_state(o)],
+        o->source->index, o->source->name,
+        volume_str,
+        pa_yes_no(o->muted),
+        (double) pa_source_output_get_latency(o, NULL) / PA_USEC_PER_MSEC,
+        clt,
+        pa_sample_spec_snprint(ss, sizeof(ss), &o->sample_spec),
+        pa_channel_map_snprint(cm, sizeof(cm), &o->channel_map),
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        pa_resample_method_to_string(pa_source_output_get_resample_method(o)));
+
+    pa_xfree(volume_str);
+
+    if (o->module)
+        pa_strbuf_printf(s, "\towner module: %u\n", o->module->index);
+    if (o->client)
+        pa_strbuf_printf(s, "\tclient: %u <%s>\n", o->client->index, pa_strnull(pa_proplist_gets(o->client->proplist, PA_PROP_APPLICATION_NAME)));
+    if (o->direct_on_input)
+        pa_strbuf_printf(s, "\tdirect on input: %u\n", o->direct_on_input->index);
+
+    t = pa_proplist_to_string_sep(o->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
+}
 
-    pa_strbuf_printf(s, "%u source output(s) available.\n", pa_idxset_size(c->source_outputs));
+static void append_sink_input(pa_strbuf *s, pa_sink_input *i) {
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cv[PA_CVOLUME_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t, clt[28];
+    pa_usec_t cl;
+    const char *cmn;
+    pa_cvolume v;
+    char *volume_str = NULL;
+    static const char* const state_table[] = {
+        [PA_SINK_INPUT_INIT] = "INIT",
+        [PA_SINK_INPUT_RUNNING] = "RUNNING",
+        [PA_SINK_INPUT_DRAINED] = "DRAINED",
+        [PA_SINK_INPUT_CORKED] = "CORKED",
+        [PA_SINK_INPUT_UNLINKED] = "UNLINKED"
+    };
 
-    PA_IDXSET_FOREACH(o, c->source_outputs, idx) {
-        char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cv[PA_CVOLUME_SNPRINT_VERBOSE_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t, clt[28];
-        pa_usec_t cl;
-        const char *cmn;
-        pa_cvolume v;
-        char *volume_str = NULL;
+    pa_assert(s);
+    pa_assert(i);
+
+    cmn = pa_channel_map_to_pretty_name(&i->channel_map);
+
+    if ((cl = pa_sink_input_get_requested_latency(i)) == (pa_usec_t) -1)
+        pa_snprintf(clt, sizeof(clt), "n/a");
+    else
+        pa_snprintf(clt, sizeof(clt), "%0.2f ms", (double) cl / PA_USEC_PER_MSEC);
+
+    pa_assert(i->sink);
+
+    if (pa_sink_input_is_volume_readable(i)) {
+        pa_sink_input_get_volume(i, &v, true);
+        volume_str = pa_sprintf_malloc("%s\n\t        balance %0.2f",
+                                       pa_cvolume_snprint_verbose(cv, sizeof(cv), &v, &i->channel_map, true),
+                                       pa_cvolume_get_balance(&v, &i->channel_map));
+    } else
+        volume_str = pa_xstrdup("n/a");
+
+    pa_strbuf_printf(
+        s,
+        "    index: %u\n"
+        "\tdriver: <%s>\n"
+        "\tflags: %s%s%s%s%s%s%s%s%s%s%s%s\n"
+        "\tstate: %s\n"
+        "\tsink: %u <%s>\n"
+        "\tvolume: %s\n"
+        "\tmuted: %s\n"
+        "\tcurrent latency: %0.2f ms\n"
+        "\trequested latency: %s\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tresample method: %s\n",
+        i->index,
+        i->driver,
+        i->flags & PA_SINK_INPUT_VARIABLE_RATE ? "VARIABLE_RATE " : "",
+        i->flags & PA_SINK_INPUT_DONT_MOVE ? "DONT_MOVE " : "",
+        i->flags & PA_SINK_INPUT_START_CORKED ? "START_CORKED " : "",
+        i->flags & PA_SINK_INPUT_NO_REMAP ? "NO_REMAP " : "",
+        i->flags & PA_SINK_INPUT_NO_REMIX ? "NO_REMIX " : "",
+        i->flags & PA_SINK_INPUT_FIX_FORMAT ? "FIX_FORMAT " : "",
+        i->flags & PA_SINK_INPUT_FIX_RATE ? "FIX_RATE " : "",
+        i->flags & PA_SINK_INPUT_FIX_CHANNELS ? "FIX_CHANNELS " : "",
+        i->flags & PA_SINK_INPUT_DONT_INHIBIT_AUTO_SUSPEND ? "DONT_INHIBIT_AUTO_SUSPEND " : "",
+        i->flags & PA_SINK_INPUT_NO_CREATE_ON_SUSPEND ? "NO_CREATE_SUSPEND " : "",
+        i->flags & PA_SINK_INPUT_KILL_ON_SUSPEND ? "KILL_ON_SUSPEND " : "",
+        i->flags & PA_SINK_INPUT_PASSTHROUGH ? "PASSTHROUGH " : "",
+        state_table[pa_sink_input_get_state(i)],
+        i->sink->index, i->sink->name,
+        volume_str,
+        pa_yes_no(i->muted),
+        (double) pa_sink_input_get_latency(i, NULL) / PA_USEC_PER_MSEC,
+        clt,
+        pa_sample_spec_snprint(ss, sizeof(ss), &i->sample_spec),
+        pa_channel_map_snprint(cm, sizeof(cm), &i->channel_map),
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        pa_resample_method_to_string(pa_sink_input_get_resample_method(i)));
+
+    pa_xfree(volume_str);
+
+    if (i->module)
+        pa_strbuf_printf(s, "\tmodule: %u\n", i->module->index);
+    if (i->client)
+        pa_strbuf_printf(s, "\tclient: %u <%s>\n", i->client->index, pa_strnull(pa_proplist_gets(i->client->proplist, PA_PROP_APPLICATION_NAME)));
+
+    t = pa_proplist_to_string_sep(i->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
+}
 
-        cmn = pa_channel_map_to_pretty_name(&o->channel_map);
+static void append_scache_entry(pa_strbuf *s, pa_scache_entry *e) {
+    double l = 0;
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX] = "n/a", cv[PA_CVOLUME_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX] = "n/a", *t;
+    const char *cmn;
 
-        if ((cl = pa_source_output_get_requested_latency(o)) == (pa_usec_t) -1)
-            pa_snprintf(clt, sizeof(clt), "n/a");
-        else
-            pa_snprintf(clt, sizeof(clt), "%0.2f ms", (double) cl / PA_USEC_PER_MSEC);
+    pa_assert(s);
+    pa_assert(e);
 
-        pa_assert(o->source);
+    cmn = pa_channel_map_to_pretty_name(&e->channel_map);
 
-        if (pa_source_output_is_volume_readable(o)) {
-            pa_source_output_get_volume(o, &v, true);
-            volume_str = pa_sprintf_malloc("%s\n\t        balance %0.2f",
-                                           pa_cvolume_snprint_verbose(cv, sizeof(cv), &v, &o->channel_map, true),
-                                           pa_cvolume_get_balance(&v, &o->channel_map));
-        } else
-            volume_str = pa_xstrdup("n/a");
+    if (e->memchunk.memblock) {
+        pa_sample_spec_snprint(ss, sizeof(ss), &e->sample_spec);
+        pa_channel_map_snprint(cm, sizeof(cm), &e->channel_map);
+        l = (double) e->memchunk.length / (double) pa_bytes_per_second(&e->sample_spec);
+    }
 
-        pa_strbuf_printf(
-            s,
-            "    index: %u\n"
-            "\tdriver: <%s>\n"
-            "\tflags: %s%s%s%s%s%s%s%s%s%s%s%s\n"
-            "\tstate: %s\n"
-            "\tsource: %u <%s>\n"
-            "\tvolume: %s\n"
-            "\tmuted: %s\n"
-            "\tcurrent latency: %0.2f ms\n"
-            "\trequested latency: %s\n"
-            "\tsample spec: %s\n"
-            "\tchannel map: %s%s%s\n"
-            "\tresample method: %s\n",
-            o->index,
-            o->driver,
-            o->flags & PA_SOURCE_OUTPUT_VARIABLE_RATE ? "VARIABLE_RATE " : "",
-            o->flags & PA_SOURCE_OUTPUT_DONT_MOVE ? "DONT_MOVE " : "",
-            o->flags & PA_SOURCE_OUTPUT_START_CORKED ? "START_CORKED " : "",
-            o->flags & PA_SOURCE_OUTPUT_NO_REMAP ? "NO_REMAP " : "",
-            o->flags & PA_SOURCE_OUTPUT_NO_REMIX ? "NO_REMIX " : "",
-            o->flags & PA_SOURCE_OUTPUT_FIX_FORMAT ? "FIX_FORMAT " : "",
-            o->flags & PA_SOURCE_OUTPUT_FIX_RATE ? "FIX_RATE " : "",
-            o->flags & PA_SOURCE_OUTPUT_FIX_CHANNELS ? "FIX_CHANNELS " : "",
-            o->flags & PA_SOURCE_OUTPUT_DONT_INHIBIT_AUTO_SUSPEND ? "DONT_INHIBIT_AUTO_SUSPEND " : "",
-            o->flags & PA_SOURCE_OUTPUT_NO_CREATE_ON_SUSPEND ? "NO_CREATE_ON_SUSPEND " : "",
-            o->flags & PA_SOURCE_OUTPUT_KILL_ON_SUSPEND ? "KILL_ON_SUSPEND " : "",
-            o->flags & PA_SOURCE_OUTPUT_PASSTHROUGH ? "PASSTHROUGH " : "",
-            state_table[pa_source_output_get_state(o)],
-            o->source->index, o->source->name,
-            volume_str,
-            pa_yes_no(o->muted),
-            (double) pa_source_output_get_latency(o, NULL) / PA_USEC_PER_MSEC,
-            clt,
-            pa_sample_spec_snprint(ss, sizeof(ss), &o->sample_spec),
-            pa_channel_map_snprint(cm, sizeof(cm), &o->channel_map),
-            cmn ? "\n\t             " : "",
-            cmn ? cmn : "",
-            pa_resample_method_to_string(pa_source_output_get_resample_method(o)));
-
-        pa_xfree(volume_str);
-
-        if (o->module)
-            pa_strbuf_printf(s, "\towner module: %u\n", o->module->index);
-        if (o->client)
-            pa_strbuf_printf(s, "\tclient: %u <%s>\n", o->client->index, pa_strnull(pa_proplist_gets(o->client->proplist, PA_PROP_APPLICATION_NAME)));
-        if (o->direct_on_input)
-            pa_strbuf_printf(s, "\tdirect on input: %u\n", o->direct_on_input->index);
-
-        t = pa_proplist_to_string_sep(o->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
+    pa_strbuf_printf(
+        s,
+        "    name: <%s>\n"
+        "\tindex: %u\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tlength: %lu\n"
+        "\tduration: %0.1f s\n"
+        "\tvolume: %s\n"
+        "\t        balance %0.2f\n"
+        "\tlazy: %s\n"
+        "\tfilename: <%s>\n",
+        e->name,
+        e->index,
+        ss,
+        cm,
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        (long unsigned)(e->memchunk.memblock ? e->memchunk.length : 0),
+        l,
+        e->volume_is_set ? pa_cvolume_snprint_verbose(cv, sizeof(cv), &e->volume, &e->channel_map, true) : "n/a",
+        (e->memchunk.memblock && e->volume_is_set) ? pa_cvolume_get_balance(&e->volume, &e->channel_map) : 0.0f,
+        pa_yes_no(e->lazy),
+        e->filename ? e->filename : "n/a");
+
+    t = pa_proplist_to_string_sep(e->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
+}
+
+static pa_idxset *list_idxset(pa_core *c, pa_cli_text_list_t list) {
+    switch (list) {
+        case PA_CLI_TEXT_MODULES:
+            return c->modules;
+        case PA_CLI_TEXT_CLIENTS:
+            return c->clients;
+        case PA_CLI_TEXT_CARDS:
+            return c->cards;
+        case PA_CLI_TEXT_SINKS:
+            return c->sinks;
+        case PA_CLI_TEXT_SOURCES:
+            return c->sources;
+        case PA_CLI_TEXT_SINK_INPUTS:
+            return c->sink_inputs;
+        case PA_CLI_TEXT_SOURCE_OUTPUTS:
+            return c->source_outputs;
+        case PA_CLI_TEXT_SCACHE:
+            /* Only created with the first sample */
+            return c->scache;
+        default:
+            pa_assert_not_reached();
     }
+}
 
-    return pa_strbuf_to_string_free(s);
+void pa_cli_text_list_begin(pa_strbuf *s, pa_core *c, pa_cli_text_list_t list) {
+    pa_idxset *set;
+    unsigned n;
+
+    pa_assert(s);
+    pa_assert(c);
+
+    n = (set = list_idxset(c, list)) ? pa_idxset_size(set) : 0;
+
+    switch (list) {
+        case PA_CLI_TEXT_MODULES:
+            pa_strbuf_printf(s, "%u module(s) loaded.\n", n);
+            break;
+        case PA_CLI_TEXT_CLIENTS:
+            pa_strbuf_printf(s, "%u client(s) logged in.\n", n);
+            break;
+        case PA_CLI_TEXT_CARDS:
+            pa_strbuf_printf(s, "%u card(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SINKS:
+            pa_strbuf_printf(s, "%u sink(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SOURCES:
+            pa_strbuf_printf(s, "%u source(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SINK_INPUTS:
+            pa_strbuf_printf(s, "%u sink input(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SOURCE_OUTPUTS:
+            pa_strbuf_printf(s, "%u source output(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SCACHE:
+            pa_strbuf_printf(s, "%u cache entrie(s) available.\n", n);
+            break;
+        default:
+            pa_assert_not_reached();
+    }
 }
 
-char *pa_sink_input_list_to_string(pa_core *c) {
+bool pa_cli_text_list_next(pa_strbuf *s, pa_core *c, pa_cli_text_list_t list, uint32_t *idx) {
+    pa_idxset *set;
+    void *o;
+
+    pa_assert(s);
+    pa_assert(c);
+    pa_assert(idx);
+
+    if (!(set = list_idxset(c, list)))
+        return false;
+
+    /* pa_idxset_next() copes with the previous object being gone */
+    if (!(o = *idx == PA_IDXSET_INVALID ? pa_idxset_first(set, idx) : pa_idxset_next(set, idx)))
+        return false;
+
+    switch (list) {
+        case PA_CLI_TEXT_MODULES:
+            append_module(s, o);
+            break;
+        case PA_CLI_TEXT_CLIENTS:
+            append_client(s, o);
+            break;
+        case PA_CLI_TEXT_CARDS:
+            append_card(s, o);
+            break;
+        case PA_CLI_TEXT_SINKS:
+            append_sink(s, o);
+            break;
+        case PA_CLI_TEXT_SOURCES:
+            append_source(s, o);
+            break;
+        case PA_CLI_TEXT_SINK_INPUTS:
+            append_sink_input(s, o);
+            break;
+        case PA_CLI_TEXT_SOURCE_OUTPUTS:
+            append_source_output(s, o);
+            break;
+        case PA_CLI_TEXT_SCACHE:
+            append_scache_entry(s, o);
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+
+    return true;
+}
+
+static char *list_to_string(pa_core *c, pa_cli_text_list_t list) {
     pa_strbuf *s;
-    pa_sink_input *i;
     uint32_t idx = PA_IDXSET_INVALID;
-    static const char* const state_table[] = {
-        [PA_SINK_INPUT_INIT] = "INIT",
-        [PA_SINK_INPUT_RUNNING] = "RUNNING",
-        [PA_SINK_INPUT_DRAINED] = "DRAINED",
-        [PA_SINK_INPUT_CORKED] = "CORKED",
-        [PA_SINK_INPUT_UNLINKED] = "UNLINKED"
-    };
 
     pa_assert(c);
+
     s = pa_strbuf_new();
 
-    pa_strbuf_printf(s, "%u sink input(s) available.\n", pa_idxset_size(c->sink_inputs));
+    pa_cli_text_list_begin(s, c, list);
+    while (pa_cli_text_list_next(s, c, list, &idx))
+        ;
 
-    PA_IDXSET_FOREACH(i, c->sink_inputs, idx) {
-        char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cv[PA_CVOLUME_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t, clt[28];
-        pa_usec_t cl;
-        const char *cmn;
-        pa_cvolume v;
-        char *volume_str = NULL;
+    return pa_strbuf_to_string_free(s);
+}
 
-        cmn = pa_channel_map_to_pretty_name(&i->channel_map);
+char *pa_module_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_MODULES);
+}
 
-        if ((cl = pa_sink_input_get_requested_latency(i)) == (pa_usec_t) -1)
-            pa_snprintf(clt, sizeof(clt), "n/a");
-        else
-            pa_snprintf(clt, sizeof(clt), "%0.2f ms", (double) cl / PA_USEC_PER_MSEC);
+char *pa_client_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_CLIENTS);
+}
 
-        pa_assert(i->sink);
+char *pa_card_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_CARDS);
+}
 
-        if (pa_sink_input_is_volume_readable(i)) {
-            pa_sink_input_get_volume(i, &v, true);
-            volume_str = pa_sprintf_malloc("%s\n\t        balance %0.2f",
-                                           pa_cvolume_snprint_verbose(cv, sizeof(cv), &v, &i->channel_map, true),
-                                           pa_cvolume_get_balance(&v, &i->channel_map));
-        } else
-            volume_str = pa_xstrdup("n/a");
+char *pa_sink_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SINKS);
+}
 
-        pa_strbuf_printf(
-            s,
-            "    index: %u\n"
-            "\tdriver: <%s>\n"
-            "\tflags: %s%s%s%s%s%s%s%s%s%s%s%s\n"
-            "\tstate: %s\n"
-            "\tsink: %u <%s>\n"
-            "\tvolume: %s\n"
-            "\tmuted: %s\n"
-            "\tcurrent latency: %0.2f ms\n"
-            "\trequested latency: %s\n"
-            "\tsample spec: %s\n"
-            "\tchannel map: %s%s%s\n"
-            "\tresample method: %s\n",
-            i->index,
-            i->driver,
-            i->flags & PA_SINK_INPUT_VARIABLE_RATE ? "VARIABLE_RATE " : "",
-            i->flags & PA_SINK_INPUT_DONT_MOVE ? "DONT_MOVE " : "",
-            i->flags & PA_SINK_INPUT_START_CORKED ? "START_CORKED " : "",
-            i->flags & PA_SINK_INPUT_NO_REMAP ? "NO_REMAP " : "",
-            i->flags & PA_SINK_INPUT_NO_REMIX ? "NO_REMIX " : "",
-            i->flags & PA_SINK_INPUT_FIX_FORMAT ? "FIX_FORMAT " : "",
-            i->flags & PA_SINK_INPUT_FIX_RATE ? "FIX_RATE " : "",
-            i->flags & PA_SINK_INPUT_FIX_CHANNELS ? "FIX_CHANNELS " : "",
-            i->flags & PA_SINK_INPUT_DONT_INHIBIT_AUTO_SUSPEND ? "DONT_INHIBIT_AUTO_SUSPEND " : "",
-            i->flags & PA_SINK_INPUT_NO_CREATE_ON_SUSPEND ? "NO_CREATE_SUSPEND " : "",
-            i->flags & PA_SINK_INPUT_KILL_ON_SUSPEND ? "KILL_ON_SUSPEND " : "",
-            i->flags & PA_SINK_INPUT_PASSTHROUGH ? "PASSTHROUGH " : "",
-            state_table[pa_sink_input_get_state(i)],
-            i->sink->index, i->sink->name,
-            volume_str,
-            pa_yes_no(i->muted),
-            (double) pa_sink_input_get_latency(i, NULL) / PA_USEC_PER_MSEC,
-            clt,
-            pa_sample_spec_snprint(ss, sizeof(ss), &i->sample_spec),
-            pa_channel_map_snprint(cm, sizeof(cm), &i->channel_map),
-            cmn ? "\n\t             " : "",
-            cmn ? cmn : "",
-            pa_resample_method_to_string(pa_sink_input_get_resample_method(i)));
-
-        pa_xfree(volume_str);
-
-        if (i->module)
-            pa_strbuf_printf(s, "\tmodule: %u\n", i->module->index);
-        if (i->client)
-            pa_strbuf_printf(s, "\tclient: %u <%s>\n", i->client->index, pa_strnull(pa_proplist_gets(i->client->proplist, PA_PROP_APPLICATION_NAME)));
-
-        t = pa_proplist_to_string_sep(i->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
-    }
+char *pa_source_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SOURCES);
+}
 
-    return pa_strbuf_to_string_free(s);
+char *pa_sink_input_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SINK_INPUTS);
+}
+
+char *pa_source_output_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SOURCE_OUTPUTS);
 }
 
 char *pa_scache_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SCACHE);
+}
+
+static void append_render_profile(pa_strbuf *s, const char *indent, const pa_render_profile *profile) {
+    unsigned stage, k;
+
+    for (stage = 0; stage < PA_RENDER_STAGE_MAX; stage++) {
+        const pa_render_profile *p = &profile[stage];
+        bool first = true;
+
+        if (p->n <= 0)
+            continue;
+
+        pa_strbuf_printf(s, "%s%s: %llu calls, %0.1f usec average, %llu usec max\n%s\t",
+                         indent,
+                         pa_render_stage_to_string(stage),
+                         (unsigned long long) p->n,
+                         (double) p->total / (double) p->n,
+                         (unsigned long long) p->max,
+                         indent);
+
+        for (k = 0; k < PA_RENDER_PROFILE_BUCKETS; k++) {
+            if (p->buckets[k] <= 0)
+                continue;
+
+            if (k < PA_RENDER_PROFILE_BUCKETS - 1)
+                pa_strbuf_printf(s, "%s< %llu: %llu", first ? "" : ", ",
+                                 (unsigned long long) pa_render_profile_bucket_limit(k),
+                                 (unsigned long long) p->buckets[k]);
+            else
+                pa_strbuf_printf(s, "%s>= %llu: %llu", first ? "" : ", ",
+                                 (unsigned long long) pa_render_profile_bucket_limit(k - 1),
+                                 (unsigned long long) p->buckets[k]);
+            first = false;
+        }
+
+        pa_strbuf_puts(s, "\n");
+    }
+}
+
+char *pa_render_profile_to_string(pa_core *c) {
     pa_strbuf *s;
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t idx, idx2;
+
     pa_assert(c);
 
     s = pa_strbuf_new();
 
-    pa_strbuf_printf(s, "%u cache entrie(s) available.\n", c->scache ? pa_idxset_size(c->scache) : 0);
+    pa_strbuf_printf(s, "Render profiling is %s, durations in usec.\n", pa_render_profile_get_enabled() ? "enabled" : "disabled");
 
-    if (c->scache) {
-        pa_scache_entry *e;
-        uint32_t idx = PA_IDXSET_INVALID;
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        pa_sink_input *i;
 
-        PA_IDXSET_FOREACH(e, c->scache, idx) {
-            double l = 0;
-            char ss[PA_SAMPLE_SPEC_SNPRINT_MAX] = "n/a", cv[PA_CVOLUME_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX] = "n/a", *t;
-            const char *cmn;
+        pa_sink_update_render_profile(sink);
 
-            cmn = pa_channel_map_to_pretty_name(&e->channel_map);
+        pa_strbuf_printf(s, "sink %u <%s>\n", sink->index, sink->name);
+        append_render_profile(s, "\t", sink->render_profile);
 
-            if (e->memchunk.memblock) {
-                pa_sample_spec_snprint(ss, sizeof(ss), &e->sample_spec);
-                pa_channel_map_snprint(cm, sizeof(cm), &e->channel_map);
-                l = (double) e->memchunk.length / (double) pa_bytes_per_second(&e->sample_spec);
-            }
+        PA_IDXSET_FOREACH(i, sink->inputs, idx2) {
+            pa_strbuf_printf(s, "\tsink input %u <%s>\n", i->index, pa_strnull(pa_proplist_gets(i->proplist, PA_PROP_MEDIA_NAME)));
+            append_render_profile(s, "\t\t", i->render_profile);
+        }
+    }
 
-            pa_strbuf_printf(
-                s,
-                "    name: <%s>\n"
-                "\tindex: %u\n"
-                "\tsample spec: %s\n"
-                "\tchannel map: %s%s%s\n"
-                "\tlength: %lu\n"
-                "\tduration: %0.1f s\n"
-                "\tvolume: %s\n"
-                "\t        balance %0.2f\n"
-                "\tlazy: %s\n"
-                "\tfilename: <%s>\n",
-                e->name,
-                e->index,
-                ss,
-                cm,
-                cmn ? "\n\t             " : "",
-                cmn ? cmn : "",
-                (long unsigned)(e->memchunk.memblock ? e->memchunk.length : 0),
-                l,
-                e->volume_is_set ? pa_cvolume_snprint_verbose(cv, sizeof(cv), &e->volume, &e->channel_map, true) : "n/a",
-                (e->memchunk.memblock && e->volume_is_set) ? pa_cvolume_get_balance(&e->volume, &e->channel_map) : 0.0f,
-                pa_yes_no(e->lazy),
-                e->filename ? e->filename : "n/a");
-
-            t = pa_proplist_to_string_sep(e->proplist, "\n\t\t");
-            pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-            pa_xfree(t);
+    PA_IDXSET_FOREACH(source, c->sources, idx) {
+        pa_source_output *o;
+
+        pa_source_update_render_profile(source);
+
+        pa_strbuf_printf(s, "source %u <%s>\n", source->index, source->name);
+        append_render_profile(s, "\t", source->render_profile);
+
+        PA_IDXSET_FOREACH(o, source->outputs, idx2) {
+            pa_strbuf_printf(s, "\tsource output %u <%s>\n", o->index, pa_strnull(pa_proplist_gets(o->proplist, PA_PROP_MEDIA_NAME)));
+            append_render_profile(s, "\t\t", o->render_profile);
         }
     }
 
@@ -21,6 +21,7 @@
 ***/
 
 #include <pulsecore/core.h>
+#include <pulsecore/strbuf.h>
 
 /* Some functions to generate pretty formatted listings of
  * entities. The returned strings have to be freed manually. */
@@ -33,7 +34,29 @@ char *pa_card_list_to_string(pa_core *c);
 char *pa_client_list_to_string(pa_core *c);
 char *pa_module_list_to_string(pa_core *c);
 char *pa_scache_list_to_string(pa_core *c);
+char *pa_render_profile_to_string(pa_core *c);
 
 char *pa_full_status_string(pa_core *c);
 
+/* The same listings, one object at a time, for writing them out
+ * without formatting everything in one go */
+typedef enum pa_cli_text_list {
+    PA_CLI_TEXT_MODULES,
+    PA_CLI_TEXT_CLIENTS,
+    PA_CLI_TEXT_CARDS,
+    PA_CLI_TEXT_SINKS,
+    PA_CLI_TEXT_SOURCES,
+    PA_CLI_TEXT_SINK_INPUTS,
+    PA_CLI_TEXT_SOURCE_OUTPUTS,
+    PA_CLI_TEXT_SCACHE
+} pa_cli_text_list_t;
+
+/* Append the line with the number of objects */
+void pa_cli_text_list_begin(pa_strbuf *s, pa_core *c, pa_cli_text_list_t list);
+
+/* Append the object following the one with index *idx, or the first
+ * one if *idx is PA_IDXSET_INVALID, and update *idx. Returns false when
+ * there is none left. Objects may come and go between two calls. */
+bool pa_cli_text_list_next(pa_strbuf *s, pa_core *c, pa_cli_text_list_t list, uint32_t *idx);
+
 #endif
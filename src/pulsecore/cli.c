@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <pulse/xmalloc.h>
 
@@ -36,11 +37,49 @@
 #include <pulsecore/cli-command.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/queue.h>
 
 #include "cli.h"
 
 #define PROMPT ">>> "
 
+/* How many objects of a listing are formatted in one go. The next ones
+ * follow once they have been written out. */
+#define LISTING_BATCH 8
+
+static const char whitespace[] = " \t\n\r";
+
+#define INFO_LISTS                              \
+    8, { PA_CLI_TEXT_MODULES,                   \
+         PA_CLI_TEXT_SINKS,                     \
+         PA_CLI_TEXT_SOURCES,                   \
+         PA_CLI_TEXT_CLIENTS,                   \
+         PA_CLI_TEXT_CARDS,                     \
+         PA_CLI_TEXT_SINK_INPUTS,               \
+         PA_CLI_TEXT_SOURCE_OUTPUTS,            \
+         PA_CLI_TEXT_SCACHE }
+
+/* The commands that list objects, with what they list. "info" starts
+ * with the output of "stat". */
+static const struct listing {
+    const char *name;
+    bool stat;
+    unsigned n_lists;
+    pa_cli_text_list_t lists[8];
+} listings[] = {
+    { "list-modules",        false, 1, { PA_CLI_TEXT_MODULES } },
+    { "list-cards",          false, 1, { PA_CLI_TEXT_CARDS } },
+    { "list-sinks",          false, 1, { PA_CLI_TEXT_SINKS } },
+    { "list-sources",        false, 1, { PA_CLI_TEXT_SOURCES } },
+    { "list-clients",        false, 1, { PA_CLI_TEXT_CLIENTS } },
+    { "list-sink-inputs",    false, 1, { PA_CLI_TEXT_SINK_INPUTS } },
+    { "list-source-outputs", false, 1, { PA_CLI_TEXT_SOURCE_OUTPUTS } },
+    { "list-samples",        false, 1, { PA_CLI_TEXT_SCACHE } },
+    { "info",                true,  INFO_LISTS },
+    { "ls",                  true,  INFO_LISTS },
+    { "list",                true,  INFO_LISTS },
+};
+
 struct pa_cli {
     pa_core *core;
     pa_ioline *line;
@@ -55,9 +94,23 @@ struct pa_cli {
 
     bool interactive;
     char *last_line;
+
+    /* The listing that is being written out */
+    const struct listing *listing;
+    unsigned list;
+    bool list_begun;
+    uint32_t idx;
+    pa_defer_event *defer_event;
+
+    /* Lines that came in meanwhile, and whether there will be more */
+    pa_queue *pending;
+    bool eof;
 };
 
 static void line_callback(pa_ioline *line, const char *s, void *userdata);
+static void line_drain_callback(pa_ioline *line, void *userdata);
+static void line_eof_callback(pa_ioline *line, void *userdata);
+static void defer_callback(pa_mainloop_api *m, pa_defer_event *e, void *userdata);
 static void client_kill(pa_client *c);
 
 pa_cli* pa_cli_new(pa_core *core, pa_iochannel *io, pa_module *m) {
@@ -88,7 +141,13 @@ pa_cli* pa_cli_new(pa_core *core, pa_iochannel *io, pa_module *m) {
     c->client->kill = client_kill;
     c->client->userdata = c;
 
+    c->pending = pa_queue_new();
+    c->defer_event = core->mainloop->defer_new(core->mainloop, defer_callback, c);
+    core->mainloop->defer_enable(c->defer_event, 0);
+
     pa_ioline_set_callback(c->line, line_callback, c);
+    pa_ioline_set_drain_callback(c->line, line_drain_callback, c);
+    pa_ioline_set_eof_callback(c->line, line_eof_callback, c);
 
     return c;
 }
@@ -96,9 +155,13 @@ pa_cli* pa_cli_new(pa_core *core, pa_iochannel *io, pa_module *m) {
 void pa_cli_free(pa_cli *c) {
     pa_assert(c);
 
+    pa_ioline_set_drain_callback(c->line, NULL, NULL);
+    pa_ioline_set_eof_callback(c->line, NULL, NULL);
     pa_ioline_close(c->line);
     pa_ioline_unref(c->line);
     pa_client_free(c->client);
+    c->core->mainloop->defer_free(c->defer_event);
+    pa_queue_free(c->pending, pa_xfree);
     pa_xfree(c->last_line);
     pa_xfree(c);
 }
@@ -117,22 +180,26 @@ static void client_kill(pa_client *client) {
         c->eof_callback(c, c->userdata);
 }
 
-static void line_callback(pa_ioline *line, const char *s, void *userdata) {
-    pa_strbuf *buf;
-    pa_cli *c = userdata;
-    char *p;
+static const struct listing *find_listing(const char *s) {
+    const char *cs;
+    size_t l;
+    unsigned i;
 
-    pa_assert(line);
-    pa_assert(c);
+    cs = s+strspn(s, whitespace);
+    l = strcspn(cs, whitespace);
 
-    if (!s) {
-        pa_log_debug("CLI got EOF from user.");
+    for (i = 0; i < PA_ELEMENTSOF(listings); i++)
+        if (strlen(listings[i].name) == l && !strncmp(cs, listings[i].name, l))
+            return &listings[i];
 
-        if (c->eof_callback)
-            c->eof_callback(c, c->userdata);
+    return NULL;
+}
 
-        return;
-    }
+/* Returns false if nothing more is to be done on this connection */
+static bool execute_line(pa_cli *c, const char *s) {
+    const struct listing *l = NULL;
+    pa_strbuf *buf;
+    char *p;
 
     /* Magic command, like they had in AT Hayes Modems! Those were the good days! */
     if (pa_streq(s, "/"))
@@ -149,17 +216,146 @@ static void line_callback(pa_ioline *line, const char *s, void *userdata) {
             "Use \"help\" for usage information.\n", PACKAGE_VERSION);
         c->interactive = true;
     }
+    else if ((l = find_listing(s))) {
+        /* The objects themselves follow from defer_callback() */
+        if (l->stat)
+            pa_cli_command_execute_line(c->core, "stat", buf, &c->fail);
+    }
     else
         pa_cli_command_execute_line(c->core, s, buf, &c->fail);
     c->defer_kill--;
-    pa_ioline_puts(line, p = pa_strbuf_to_string_free(buf));
+    pa_ioline_puts(c->line, p = pa_strbuf_to_string_free(buf));
     pa_xfree(p);
 
     if (c->kill_requested) {
         if (c->eof_callback)
             c->eof_callback(c, c->userdata);
+        return false;
+    }
+
+    if (l) {
+        c->listing = l;
+        c->list = 0;
+        c->list_begun = false;
+        c->idx = PA_IDXSET_INVALID;
+        c->core->mainloop->defer_enable(c->defer_event, 1);
     } else if (c->interactive)
-        pa_ioline_puts(line, PROMPT);
+        pa_ioline_puts(c->line, PROMPT);
+
+    return true;
+}
+
+/* Called when a listing is complete */
+static void process_pending(pa_cli *c) {
+    char *s;
+
+    while (!c->listing && (s = pa_queue_pop(c->pending))) {
+        bool more = execute_line(c, s);
+
+        pa_xfree(s);
+
+        if (!more)
+            return;
+    }
+
+    if (!c->listing && c->eof && pa_ioline_is_drained(c->line) && c->eof_callback)
+        c->eof_callback(c, c->userdata);
+}
+
+static void defer_callback(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_cli *c = userdata;
+    pa_strbuf *buf;
+    unsigned n = 0;
+    char *p;
+
+    pa_assert(c);
+    pa_assert(c->listing);
+
+    m->defer_enable(e, 0);
+
+    pa_assert_se(buf = pa_strbuf_new());
+
+    while (c->list < c->listing->n_lists && n < LISTING_BATCH) {
+        pa_cli_text_list_t list = c->listing->lists[c->list];
+
+        if (!c->list_begun) {
+            pa_cli_text_list_begin(buf, c->core, list);
+            c->list_begun = true;
+        }
+
+        if (pa_cli_text_list_next(buf, c->core, list, &c->idx))
+            n++;
+        else {
+            c->list++;
+            c->list_begun = false;
+            c->idx = PA_IDXSET_INVALID;
+        }
+    }
+
+    pa_ioline_puts(c->line, p = pa_strbuf_to_string_free(buf));
+    pa_xfree(p);
+
+    /* If there is more, line_drain_callback() gets us here again */
+    if (c->list < c->listing->n_lists)
+        return;
+
+    c->listing = NULL;
+
+    if (c->interactive)
+        pa_ioline_puts(c->line, PROMPT);
+
+    process_pending(c);
+}
+
+static void line_drain_callback(pa_ioline *line, void *userdata) {
+    pa_cli *c = userdata;
+
+    pa_assert(line);
+    pa_assert(c);
+
+    if (c->listing)
+        c->core->mainloop->defer_enable(c->defer_event, 1);
+    else if (c->eof && c->eof_callback)
+        c->eof_callback(c, c->userdata);
+}
+
+static void line_eof_callback(pa_ioline *line, void *userdata) {
+    pa_cli *c = userdata;
+
+    pa_assert(line);
+    pa_assert(c);
+
+    pa_log_debug("CLI got EOF from user.");
+
+    c->eof = true;
+
+    /* Otherwise process_pending() or line_drain_callback() take care of it */
+    if (!c->listing && pa_ioline_is_drained(line) && c->eof_callback)
+        c->eof_callback(c, c->userdata);
+}
+
+static void line_callback(pa_ioline *line, const char *s, void *userdata) {
+    pa_cli *c = userdata;
+
+    pa_assert(line);
+    pa_assert(c);
+
+    if (!s) {
+        pa_log_debug("CLI connection closed.");
+
+        if (c->eof_callback)
+            c->eof_callback(c, c->userdata);
+
+        return;
+    }
+
+    /* Keep the output in order */
+    if (c->listing) {
+        pa_queue_push(c->pending, pa_xstrdup(s));
+        return;
+    }
+
+    execute_line(c, s);
 }
 
 void pa_cli_set_eof_callback(pa_cli *c, pa_cli_eof_cb_t cb, void *userdata) {
@@ -33,6 +33,8 @@
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/source-output.h>
 
 #include "client.h"
 
@@ -166,3 +168,36 @@ finish:
     if (pl)
         pa_proplist_free(pl);
 }
+
+pa_usec_t pa_client_get_render_usec(pa_client *c) {
+    pa_sink_input *i;
+    pa_source_output *o;
+    pa_usec_t usec;
+    uint32_t idx;
+
+    pa_assert(c);
+
+    usec = c->unlinked_render_usec;
+
+    PA_IDXSET_FOREACH(i, c->sink_inputs, idx) {
+        if (i->sink)
+            pa_sink_update_render_profile(i->sink);
+
+        usec += i->render_profile[PA_RENDER_STAGE_INPUT_PEEK].total;
+    }
+
+    PA_IDXSET_FOREACH(o, c->source_outputs, idx) {
+        if (o->source)
+            pa_source_update_render_profile(o->source);
+
+        usec += o->render_profile[PA_RENDER_STAGE_OUTPUT_PUSH].total;
+    }
+
+    return usec;
+}
+
+size_t pa_client_get_memory(pa_client *c) {
+    pa_assert(c);
+
+    return c->get_memory ? c->get_memory(c) : 0;
+}
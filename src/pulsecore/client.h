@@ -47,6 +47,13 @@ struct pa_client {
     void (*kill)(pa_client *c);
 
     void (*send_event)(pa_client *c, const char *name, pa_proplist *data);
+
+    /* Optional, returns how many bytes of the client's memory blocks
+     * the server holds, see pa_client_get_memory() */
+    size_t (*get_memory)(pa_client *c);
+
+    /* Render time of the streams of the client that are gone */
+    pa_usec_t unlinked_render_usec;
 };
 
 typedef struct pa_client_new_data {
@@ -74,6 +81,18 @@ void pa_client_update_proplist(pa_client *c, pa_update_mode_t mode, pa_proplist
 
 void pa_client_send_event(pa_client *c, const char *event, pa_proplist *data);
 
+/* Returns how long the IO threads spent rendering the client's streams
+ * so far: peeking from its sink inputs, including resampling, volume
+ * and filters, and pushing to its source outputs. Only the time while
+ * render profiling was enabled is counted. Updates the render profiles
+ * of the devices the streams are connected to. */
+pa_usec_t pa_client_get_render_usec(pa_client *c);
+
+/* Returns how many bytes of memory blocks the server holds on behalf of
+ * the client, currently those imported from its shared memory, or 0 if
+ * the client's driver doesn't know */
+size_t pa_client_get_memory(pa_client *c);
+
 typedef struct pa_client_send_event_hook_data {
     pa_client *client;
     const char *event;
@@ -225,6 +225,20 @@ int pa_format_info_to_sample_spec_fake(const pa_format_info *f, pa_sample_spec *
     /* Note: When we add support for non-IEC61937 encapsulated compressed
      * formats, this function should return a non-zero values for these. */
 
+    if (f->encoding == PA_ENCODING_OPUS) {
+        /* Opus streams carry the channels and rate of the audio itself, so
+         * that they can be exchanged for the decoded PCM one-to-one. */
+        ss->format = PA_SAMPLE_S16NE;
+
+        pa_return_val_if_fail(pa_format_info_get_channels(f, &ss->channels) == 0, -PA_ERR_INVALID);
+        pa_return_val_if_fail(pa_format_info_get_rate(f, &ss->rate) == 0, -PA_ERR_INVALID);
+
+        if (map && pa_format_info_get_channel_map(f, map) < 0)
+            pa_channel_map_init_extend(map, ss->channels, PA_CHANNEL_MAP_DEFAULT);
+
+        return 0;
+    }
+
     ss->format = PA_SAMPLE_S16LE;
     ss->channels = 2;
 
@@ -183,6 +183,22 @@ void pa_rtclock_hrtimer_enable(void) {
 #endif
 }
 
+int pa_rtclock_set_thread_timer_slack(pa_usec_t slack) {
+
+#ifdef PR_SET_TIMERSLACK
+    /* 0 would mean "back to the default" for prctl(), so use the
+     * smallest slack there is instead */
+    if (prctl(PR_SET_TIMERSLACK, PA_MAX((unsigned long) (slack * PA_NSEC_PER_USEC), 1UL), 0, 0, 0) < 0) {
+        pa_log_warn("PR_SET_TIMERSLACK failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 struct timeval* pa_rtclock_from_wallclock(struct timeval *tv) {
     struct timeval wc_now, rt_now;
 
@@ -33,6 +33,9 @@ pa_usec_t pa_rtclock_age(const struct timeval *tv);
 bool pa_rtclock_hrtimer(void);
 void pa_rtclock_hrtimer_enable(void);
 
+/* Sets the timer slack of the calling thread only */
+int pa_rtclock_set_thread_timer_slack(pa_usec_t slack);
+
 /* timer with a resolution better than this are considered high-resolution */
 #define PA_HRTIMER_THRESHOLD_USEC 10
 
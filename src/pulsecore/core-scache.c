@@ -28,8 +28,15 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #ifdef HAVE_GLOB_H
 #include <glob.h>
@@ -57,10 +64,41 @@
 #include <pulsecore/log.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/resampler.h>
 
 #include "core-scache.h"
 
-#define UNLOAD_POLL_TIME (60 * PA_USEC_PER_SEC)
+/* Lazy samples are decoded once into a file in this directory, which is
+ * then mapped instead of decoding again after each unload. The files are
+ * in host byte order, like the name says. */
+#define DECODED_DIR "sample-cache"
+#define DECODED_MAGIC "PASCDEC1"
+
+typedef struct decoded_header {
+    char magic[8];
+    uint64_t source_size;
+    int64_t source_mtime;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    uint32_t path_size;       /* of the source, to catch hash collisions */
+    uint32_t proplist_size;   /* as from pa_proplist_to_string() */
+    uint64_t data_offset;     /* page aligned */
+    uint64_t data_size;
+} decoded_header;
+
+static void free_variants(pa_scache_entry *e) {
+    pa_scache_variant *v;
+
+    while ((v = e->variants)) {
+        PA_LLIST_REMOVE(pa_scache_variant, e->variants, v);
+        pa_memblock_unref(v->memchunk.memblock);
+        pa_xfree(v);
+    }
+
+    e->n_variants = 0;
+}
+
+static void update_unload_event(pa_core *c);
 
 static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     pa_core *c = userdata;
@@ -69,9 +107,52 @@ static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct
     pa_assert(c->mainloop == m);
     pa_assert(c->scache_auto_unload_event == e);
 
+    pa_core_count_wakeup(c, "scache-unload");
+
     pa_scache_unload_unused(c);
+    update_unload_event(c);
+}
+
+/* Arms the unload timer for when the first loaded lazy sample has been
+ * idle long enough, and frees it if there is none. */
+static void update_unload_event(pa_core *c) {
+    pa_scache_entry *e;
+    uint32_t idx;
+    time_t now, next = 0;
+    bool loaded = false;
+    pa_usec_t delay, when;
+
+    pa_assert(c);
+
+    PA_IDXSET_FOREACH(e, c->scache, idx) {
+        if (!e->lazy || !e->memchunk.memblock)
+            continue;
+
+        if (!loaded || e->last_used_time + c->scache_idle_time < next)
+            next = e->last_used_time + c->scache_idle_time;
 
-    pa_core_rttime_restart(c, e, pa_rtclock_now() + UNLOAD_POLL_TIME);
+        loaded = true;
+    }
+
+    if (!loaded) {
+        if (c->scache_auto_unload_event) {
+            c->mainloop->time_free(c->scache_auto_unload_event);
+            c->scache_auto_unload_event = NULL;
+        }
+
+        return;
+    }
+
+    time(&now);
+
+    /* time() has a resolution of seconds, so wait at least one */
+    delay = next > now ? (pa_usec_t) (next - now) * PA_USEC_PER_SEC : 0;
+    when = pa_core_rttime_coarse(pa_rtclock_now() + PA_MAX(delay, PA_USEC_PER_SEC));
+
+    if (c->scache_auto_unload_event)
+        pa_core_rttime_restart(c, c->scache_auto_unload_event, when);
+    else
+        c->scache_auto_unload_event = pa_core_rttime_new(c, when, timeout_callback, c);
 }
 
 static void free_entry(pa_scache_entry *e) {
@@ -84,6 +165,7 @@ static void free_entry(pa_scache_entry *e) {
     pa_xfree(e->filename);
     if (e->memchunk.memblock)
         pa_memblock_unref(e->memchunk.memblock);
+    free_variants(e);
     if (e->proplist)
         pa_proplist_free(e->proplist);
     pa_xfree(e);
@@ -100,6 +182,8 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name, bool *new_
         if (e->memchunk.memblock)
             pa_memblock_unref(e->memchunk.memblock);
 
+        free_variants(e);
+
         pa_xfree(e->filename);
         pa_proplist_clear(e->proplist);
 
@@ -118,6 +202,8 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name, bool *new_
         e->name = pa_xstrdup(name);
         e->core = c;
         e->proplist = pa_proplist_new();
+        PA_LLIST_HEAD_INIT(pa_scache_variant, e->variants);
+        e->n_variants = 0;
 
         pa_idxset_put(c->scache, e, &e->index);
 
@@ -260,9 +346,6 @@ int pa_scache_add_file_lazy(pa_core *c, const char *name, const char *filename,
 
     pa_proplist_sets(e->proplist, PA_PROP_MEDIA_FILENAME, filename);
 
-    if (!c->scache_auto_unload_event)
-        c->scache_auto_unload_event = pa_core_rttime_new(c, pa_rtclock_now() + UNLOAD_POLL_TIME, timeout_callback, c);
-
     if (idx)
         *idx = e->index;
 
@@ -300,8 +383,319 @@ void pa_scache_free_all(pa_core *c) {
     }
 }
 
+#ifdef HAVE_SYS_MMAN_H
+
+typedef struct decoded_map {
+    void *data;
+    size_t size;
+} decoded_map;
+
+static void decoded_unmap(void *p) {
+    decoded_map *m = p;
+
+    munmap(m->data, m->size);
+    pa_xfree(m);
+}
+
+static char *decoded_path(pa_scache_entry *e) {
+    char *dir, *fn;
+
+    if (!(dir = pa_state_path(DECODED_DIR, true)))
+        return NULL;
+
+    if (pa_make_secure_dir(dir, 0700U, (uid_t) -1, (gid_t) -1, false) < 0) {
+        pa_log_debug("Failed to create %s: %s", dir, pa_cstrerror(errno));
+        pa_xfree(dir);
+        return NULL;
+    }
+
+    fn = pa_sprintf_malloc("%s" PA_PATH_SEP "%08x." CANONICAL_HOST ".pcm", dir, pa_idxset_string_hash_func(e->filename));
+    pa_xfree(dir);
+
+    return fn;
+}
+
+/* Maps the decoded copy of a lazy sample, if it's still up to date */
+static int decoded_load(pa_scache_entry *e, pa_proplist *p) {
+    struct stat st;
+    decoded_header h;
+    decoded_map *m = NULL;
+    const char *d;
+    char *fn, *props = NULL;
+    int fd = -1, r = -1;
+    size_t l;
+
+    if (stat(e->filename, &st) < 0)
+        return -1;
+
+    if (!(fn = decoded_path(e)))
+        return -1;
+
+    if ((fd = pa_open_cloexec(fn, O_RDONLY, 0)) < 0)
+        goto finish;
+
+    if (read(fd, &h, sizeof(h)) != sizeof(h) ||
+        memcmp(h.magic, DECODED_MAGIC, sizeof(h.magic)) != 0 ||
+        h.source_size != (uint64_t) st.st_size ||
+        h.source_mtime != (int64_t) st.st_mtime ||
+        !pa_sample_spec_valid(&h.sample_spec) ||
+        !pa_channel_map_valid(&h.channel_map) ||
+        !pa_channel_map_compatible(&h.channel_map, &h.sample_spec) ||
+        h.data_size == 0 ||
+        h.data_size > PA_SCACHE_ENTRY_SIZE_MAX ||
+        h.data_size % pa_frame_size(&h.sample_spec) != 0 ||
+        h.data_offset < sizeof(h) + (uint64_t) h.path_size + h.proplist_size)
+        goto finish;
+
+    m = pa_xnew0(decoded_map, 1);
+    m->size = (size_t) (h.data_offset + h.data_size);
+
+    if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < m->size)
+        goto finish;
+
+    if ((m->data = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        m->data = NULL;
+        goto finish;
+    }
+
+    d = (const char*) m->data + sizeof(h);
+    l = strlen(e->filename);
+
+    if (h.path_size != l || memcmp(d, e->filename, l) != 0)
+        goto finish;
+
+    d += h.path_size;
+
+    if (h.proplist_size > 0) {
+        pa_proplist *fp;
+
+        props = pa_xstrndup(d, h.proplist_size);
+
+        if ((fp = pa_proplist_from_string(props))) {
+            pa_proplist_update(p, PA_UPDATE_REPLACE, fp);
+            pa_proplist_free(fp);
+        }
+    }
+
+    e->sample_spec = h.sample_spec;
+    e->channel_map = h.channel_map;
+    e->memchunk.memblock = pa_memblock_new_user(e->core->mempool, (uint8_t*) m->data + h.data_offset, (size_t) h.data_size, decoded_unmap, m, true);
+    e->memchunk.index = 0;
+    e->memchunk.length = (size_t) h.data_size;
+    m = NULL;
+
+    pa_log_debug("Mapped decoded sample \"%s\" from %s", e->name, fn);
+    r = 0;
+
+finish:
+    if (m) {
+        if (m->data)
+            munmap(m->data, m->size);
+        pa_xfree(m);
+    }
+
+    if (fd >= 0)
+        pa_close(fd);
+
+    pa_xfree(props);
+    pa_xfree(fn);
+
+    return r;
+}
+
+static int write_all(int fd, const void *d, size_t l) {
+    return pa_loop_write(fd, d, l, NULL) == (ssize_t) l ? 0 : -1;
+}
+
+/* Stores the freshly decoded lazy sample for decoded_load() */
+static void decoded_save(pa_scache_entry *e, pa_proplist *p) {
+    struct stat st;
+    decoded_header h;
+    char *fn, *tmp = NULL, *props = NULL;
+    const void *d;
+    uint8_t *padding = NULL;
+    int fd = -1;
+    bool ok = false;
+
+    if (stat(e->filename, &st) < 0)
+        return;
+
+    if (!(fn = decoded_path(e)))
+        return;
+
+    props = pa_proplist_to_string(p);
+
+    pa_zero(h);
+    memcpy(h.magic, DECODED_MAGIC, sizeof(h.magic));
+    h.source_size = (uint64_t) st.st_size;
+    h.source_mtime = (int64_t) st.st_mtime;
+    h.sample_spec = e->sample_spec;
+    h.channel_map = e->channel_map;
+    h.path_size = (uint32_t) strlen(e->filename);
+    h.proplist_size = (uint32_t) strlen(props);
+    h.data_offset = PA_ROUND_UP(sizeof(h) + h.path_size + h.proplist_size, pa_page_size());
+    h.data_size = e->memchunk.length;
+
+    tmp = pa_sprintf_malloc("%s.tmp", fn);
+
+    if ((fd = pa_open_cloexec(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0)
+        goto finish;
+
+    padding = pa_xmalloc0((size_t) h.data_offset - sizeof(h) - h.path_size - h.proplist_size);
+
+    if (write_all(fd, &h, sizeof(h)) < 0 ||
+        write_all(fd, e->filename, h.path_size) < 0 ||
+        write_all(fd, props, h.proplist_size) < 0 ||
+        write_all(fd, padding, (size_t) h.data_offset - sizeof(h) - h.path_size - h.proplist_size) < 0)
+        goto finish;
+
+    d = pa_memblock_acquire_chunk(&e->memchunk);
+    ok = write_all(fd, d, e->memchunk.length) == 0;
+    pa_memblock_release(e->memchunk.memblock);
+
+    if (!ok)
+        goto finish;
+
+    ok = pa_close(fd) == 0;
+    fd = -1;
+
+    if (ok && rename(tmp, fn) < 0)
+        ok = false;
+
+finish:
+    if (fd >= 0)
+        pa_close(fd);
+
+    if (!ok) {
+        pa_log_debug("Failed to store decoded sample \"%s\" in %s: %s", e->name, fn, pa_cstrerror(errno));
+        unlink(tmp);
+    }
+
+    pa_xfree(padding);
+    pa_xfree(props);
+    pa_xfree(tmp);
+    pa_xfree(fn);
+}
+
+#else
+
+static int decoded_load(pa_scache_entry *e, pa_proplist *p) {
+    return -1;
+}
+
+static void decoded_save(pa_scache_entry *e, pa_proplist *p) {
+}
+
+#endif /* HAVE_SYS_MMAN_H */
+
+/* Returns the sample converted to the spec of the sink, or NULL to play
+ * it as it is */
+static pa_scache_variant *get_variant(pa_scache_entry *e, pa_sink *sink) {
+    pa_core *c = e->core;
+    pa_scache_variant *v;
+    pa_resampler *r;
+    size_t block, done = 0, filled = 0, length;
+    uint8_t *d;
+
+    if (pa_sample_spec_equal(&e->sample_spec, &sink->sample_spec) &&
+        pa_channel_map_equal(&e->channel_map, &sink->channel_map))
+        return NULL;
+
+    /* The sink might rather switch to the rate of the sample */
+    if (c->avoid_resampling && e->sample_spec.rate != sink->sample_spec.rate)
+        return NULL;
+
+    PA_LLIST_FOREACH(v, e->variants)
+        if (pa_sample_spec_equal(&v->sample_spec, &sink->sample_spec) &&
+            pa_channel_map_equal(&v->channel_map, &sink->channel_map)) {
+
+            if (v != e->variants) {
+                PA_LLIST_REMOVE(pa_scache_variant, e->variants, v);
+                PA_LLIST_PREPEND(pa_scache_variant, e->variants, v);
+            }
+
+            return v;
+        }
+
+    /* The same flags as a sink input without any of its own */
+    if (!(r = pa_resampler_new(c->mempool,
+                               &e->sample_spec, &e->channel_map,
+                               &sink->sample_spec, &sink->channel_map,
+                               c->lfe_crossover_freq,
+                               c->resample_method,
+                               (c->disable_remixing ? PA_RESAMPLER_NO_REMIX : 0) |
+                               (c->remixing_use_all_sink_channels ? 0 : PA_RESAMPLER_NO_FILL_SINK) |
+                               (c->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0))))
+        return NULL;
+
+    length = pa_resampler_result(r, e->memchunk.length);
+    d = pa_xmalloc(length);
+    block = pa_resampler_max_block_size(r);
+
+    while (done < e->memchunk.length) {
+        pa_memchunk in, out;
+        const void *src;
+
+        in = e->memchunk;
+        in.index += done;
+        in.length = PA_MIN(block, e->memchunk.length - done);
+        done += in.length;
+
+        pa_resampler_run(r, &in, &out);
+
+        if (!out.memblock)
+            continue;
+
+        /* Rounding may give us a frame more than expected per block */
+        if (filled + out.length > length) {
+            length = filled + out.length;
+            d = pa_xrealloc(d, length);
+        }
+
+        src = pa_memblock_acquire_chunk(&out);
+        memcpy(d + filled, src, out.length);
+        pa_memblock_release(out.memblock);
+        pa_memblock_unref(out.memblock);
+
+        filled += out.length;
+    }
+
+    pa_resampler_free(r);
+
+    if (filled == 0) {
+        pa_xfree(d);
+        return NULL;
+    }
+
+    v = pa_xnew0(pa_scache_variant, 1);
+    v->sample_spec = sink->sample_spec;
+    v->channel_map = sink->channel_map;
+    v->memchunk.memblock = pa_memblock_new_malloced(c->mempool, d, filled);
+    v->memchunk.index = 0;
+    v->memchunk.length = filled;
+
+    PA_LLIST_PREPEND(pa_scache_variant, e->variants, v);
+
+    if (++e->n_variants > PA_SCACHE_VARIANTS_MAX) {
+        pa_scache_variant *last;
+
+        for (last = v; last->next; last = last->next)
+            ;
+
+        PA_LLIST_REMOVE(pa_scache_variant, e->variants, last);
+        pa_memblock_unref(last->memchunk.memblock);
+        pa_xfree(last);
+        e->n_variants--;
+    }
+
+    pa_log_debug("Converted sample \"%s\" for sink \"%s\"", e->name, sink->name);
+
+    return v;
+}
+
 int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
     pa_scache_entry *e;
+    pa_scache_variant *v;
     pa_cvolume r;
     pa_proplist *merged;
     bool pass_volume;
@@ -320,8 +714,12 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     if (e->lazy && !e->memchunk.memblock) {
         pa_channel_map old_channel_map = e->channel_map;
 
-        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
-            goto fail;
+        if (decoded_load(e, merged) < 0) {
+            if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
+                goto fail;
+
+            decoded_save(e, merged);
+        }
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
 
@@ -338,6 +736,8 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
 
     pa_log_debug("Playing sample \"%s\" on \"%s\"", name, sink->name);
 
+    v = get_variant(e, sink);
+
     pass_volume = true;
 
     if (e->volume_is_set && PA_VOLUME_IS_VALID(volume)) {
@@ -350,14 +750,18 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     else
         pass_volume = false;
 
+    if (v && pass_volume)
+        pa_cvolume_remap(&r, &e->channel_map, &v->channel_map);
+
     pa_proplist_update(merged, PA_UPDATE_REPLACE, e->proplist);
 
     if (p)
         pa_proplist_update(merged, PA_UPDATE_REPLACE, p);
 
     if (pa_play_memchunk(sink,
-                         &e->sample_spec, &e->channel_map,
-                         &e->memchunk,
+                         v ? &v->sample_spec : &e->sample_spec,
+                         v ? &v->channel_map : &e->channel_map,
+                         v ? &v->memchunk : &e->memchunk,
                          pass_volume ? &r : NULL,
                          merged,
                          PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
@@ -365,13 +769,22 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
 
     pa_proplist_free(merged);
 
-    if (e->lazy)
+    if (e->lazy) {
         time(&e->last_used_time);
+        update_unload_event(c);
+    }
 
     return 0;
 
 fail:
     pa_proplist_free(merged);
+
+    /* We might have loaded it anyway */
+    if (e->lazy && e->memchunk.memblock) {
+        time(&e->last_used_time);
+        update_unload_event(c);
+    }
+
     return -1;
 }
 
@@ -450,6 +863,7 @@ void pa_scache_unload_unused(pa_core *c) {
 
         pa_memblock_unref(e->memchunk.memblock);
         pa_memchunk_reset(&e->memchunk);
+        free_variants(e);
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
     }
@@ -22,11 +22,24 @@
 ***/
 
 #include <pulsecore/core.h>
+#include <pulsecore/llist.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/sink.h>
 
 #define PA_SCACHE_ENTRY_SIZE_MAX (1024*1024*16)
 
+/* Sink specs that a sample keeps a converted copy for */
+#define PA_SCACHE_VARIANTS_MAX 4
+
+/* The sample, converted to the spec of a sink it was played on */
+typedef struct pa_scache_variant {
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_memchunk memchunk;
+
+    PA_LLIST_FIELDS(struct pa_scache_variant);
+} pa_scache_variant;
+
 typedef struct pa_scache_entry {
     uint32_t index;
     pa_core *core;
@@ -45,6 +58,10 @@ typedef struct pa_scache_entry {
     time_t last_used_time;
 
     pa_proplist *proplist;
+
+    /* Most recently used first */
+    PA_LLIST_HEAD(pa_scache_variant, variants);
+    unsigned n_variants;
 } pa_scache_entry;
 
 int pa_scache_add_item(pa_core *c, const char *name, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk, pa_proplist *p, uint32_t *idx);
@@ -28,6 +28,8 @@
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 
+#include <pulsecore/sink-input.h>
+
 #include "core-subscribe.h"
 
 /* The subscription subsystem may be used to be notified whenever an
@@ -133,7 +135,9 @@ static void dump_event(const char * prefix, pa_subscription_event*e) {
         [PA_SUBSCRIPTION_EVENT_CLIENT] = "CLIENT",
         [PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE] = "SAMPLE_CACHE",
         [PA_SUBSCRIPTION_EVENT_SERVER] = "SERVER",
-        [PA_SUBSCRIPTION_EVENT_AUTOLOAD] = "AUTOLOAD"
+        [PA_SUBSCRIPTION_EVENT_AUTOLOAD] = "AUTOLOAD",
+        [PA_SUBSCRIPTION_EVENT_CARD] = "CARD",
+        [PA_SUBSCRIPTION_EVENT_XRUN] = "XRUN"
     };
 
     const char * const type_table[] = {
@@ -206,6 +210,18 @@ void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t i
     pa_subscription_event *e;
     pa_assert(c);
 
+    c->change_generation++;
+
+    /* Remember when sink inputs changed, so that clients can ask for
+     * just what changed since they last looked */
+    if ((t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) == PA_SUBSCRIPTION_EVENT_SINK_INPUT &&
+        (t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_REMOVE) {
+        pa_sink_input *i;
+
+        if ((i = pa_idxset_get_by_index(c->sink_inputs, idx)))
+            i->change_generation = c->change_generation;
+    }
+
     /* No need for queuing subscriptions of no one is listening */
     if (!c->subscriptions)
         return;
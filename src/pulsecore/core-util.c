@@ -81,6 +81,11 @@
 #include <sys/mman.h>
 #endif
 
+#ifdef HAVE_VMSPLICE
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#endif
+
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
 #endif
@@ -846,6 +851,81 @@ int pa_make_realtime(int rtprio) {
     return -1;
 }
 
+/* Calls cb for every CPU in a list like "0-3,8". Returns the number of
+ * CPUs in the list, or negative if it can't be parsed. */
+static int parse_cpu_list(const char *cpus, void (*cb)(unsigned cpu, void *userdata), void *userdata) {
+    const char *state = NULL;
+    char *word;
+    int n = 0;
+
+    pa_assert(cpus);
+
+    while ((word = pa_split(cpus, ",", &state))) {
+        char *dash;
+        uint32_t first, last, k;
+
+        if ((dash = strchr(word, '-')))
+            *dash = 0;
+
+        if (pa_atou(word, &first) < 0 || (dash ? pa_atou(dash + 1, &last) : pa_atou(word, &last)) < 0 ||
+            first > last || last >= PA_MAX_CPUS) {
+            pa_xfree(word);
+            return -1;
+        }
+
+        pa_xfree(word);
+
+        for (k = first; k <= last; k++) {
+            if (cb)
+                cb(k, userdata);
+            n++;
+        }
+    }
+
+    return n > 0 ? n : -1;
+}
+
+int pa_cpu_list_check(const char *cpus) {
+    return parse_cpu_list(cpus, NULL, NULL);
+}
+
+#if defined(HAVE_SCHED_H) && defined(CPU_SET)
+static void cpu_set_add(unsigned cpu, void *userdata) {
+    CPU_SET(cpu, (cpu_set_t *) userdata);
+}
+#endif
+
+int pa_set_thread_affinity(const char *cpus) {
+#if defined(HAVE_SCHED_H) && defined(CPU_SET)
+    cpu_set_t set;
+
+    pa_assert(cpus);
+
+    CPU_ZERO(&set);
+
+    if (parse_cpu_list(cpus, cpu_set_add, &set) < 0) {
+        pa_log("Invalid CPU list: %s", cpus);
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* 0 stands for the calling thread here, not the whole process */
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        pa_log_warn("Failed to set the CPU affinity to %s: %s", cpus, pa_cstrerror(errno));
+        return -1;
+    }
+
+    pa_log_info("Running on CPUs %s.", cpus);
+    return 0;
+#else
+    pa_assert(cpus);
+
+    errno = ENOTSUP;
+    pa_log_warn("Setting the CPU affinity is not supported on this platform.");
+    return -1;
+#endif
+}
+
 #ifdef HAVE_SYS_RESOURCE_H
 static int set_nice(int nice_level) {
 #ifdef HAVE_DBUS
@@ -3423,6 +3503,43 @@ size_t pa_pipe_buf(int fd) {
 #endif
 }
 
+ssize_t pa_vmsplice(int fd, const void *buf, size_t count) {
+#ifdef HAVE_VMSPLICE
+    struct iovec iov;
+
+    pa_assert(fd >= 0);
+    pa_assert(buf);
+    pa_assert(count > 0);
+
+    iov.iov_base = (void*) buf;
+    iov.iov_len = count;
+
+    /* No SPLICE_F_GIFT: the memory stays ours, the pipe only references it */
+    return vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int pa_pipe_unread(int fd, size_t *n) {
+#if defined(HAVE_VMSPLICE) && defined(FIONREAD)
+    int l;
+
+    pa_assert(fd >= 0);
+    pa_assert(n);
+
+    if (ioctl(fd, FIONREAD, &l) < 0)
+        return -1;
+
+    *n = l > 0 ? (size_t) l : 0;
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
 void pa_reset_personality(void) {
 
 #if defined(__linux__) && !defined(__ANDROID__)
@@ -82,6 +82,13 @@ char *pa_strlcpy(char *b, const char *s, size_t l);
 char *pa_parent_dir(const char *fn);
 
 int pa_make_realtime(int rtprio);
+
+/* CPU lists are given like "0-3,8". pa_cpu_list_check() returns the
+ * number of CPUs in the list, negative if it is invalid.
+ * pa_set_thread_affinity() pins the calling thread only. */
+#define PA_MAX_CPUS 1024
+int pa_cpu_list_check(const char *cpus);
+int pa_set_thread_affinity(const char *cpus);
 int pa_raise_priority(int nice_level);
 void pa_reset_priority(void);
 
@@ -284,6 +291,16 @@ char* pa_maybe_prefix_path(const char *path, const char *prefix);
 /* Returns size of the specified pipe or 4096 on failure */
 size_t pa_pipe_buf(int fd);
 
+/* Hands the memory to the pipe fd without copying it. The pipe references
+ * the memory until the reader has consumed it, so it must neither be
+ * modified nor freed before, see pa_pipe_unread(). The call doesn't
+ * block. Fails with EBADF or EINVAL if fd is not a pipe, and with ENOSYS
+ * if the system has no vmsplice(). */
+ssize_t pa_vmsplice(int fd, const void *buf, size_t count);
+
+/* Stores in *n how many bytes in the pipe fd nobody has read yet */
+int pa_pipe_unread(int fd, size_t *n);
+
 void pa_reset_personality(void);
 
 bool pa_run_from_build_tree(void) PA_GCC_CONST;
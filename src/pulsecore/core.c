@@ -24,6 +24,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 
 #include <pulse/rtclock.h>
@@ -36,8 +37,11 @@
 #include <pulsecore/core-scache.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/random.h>
+#include <pulsecore/thread-mq.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/source-output.h>
 
 #include "core.h"
 
@@ -54,6 +58,16 @@ static int core_process_msg(pa_msgobject *o, int code, void *userdata, int64_t o
             pa_module_unload(userdata, true);
             return 0;
 
+        case PA_CORE_MESSAGE_XRUN_EVENT: {
+            pa_xrun_event *e = &c->xrun_events[c->n_xrun_events % PA_CORE_XRUN_EVENTS_MAX];
+
+            *e = *(pa_xrun_event*) userdata;
+            e->serial = c->n_xrun_events++;
+
+            pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_XRUN|PA_SUBSCRIPTION_EVENT_NEW, (uint32_t) e->serial);
+            return 0;
+        }
+
         default:
             return -1;
     }
@@ -61,17 +75,34 @@ static int core_process_msg(pa_msgobject *o, int code, void *userdata, int64_t o
 
 static void core_free(pa_object *o);
 
-pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t shm_size) {
+static pa_proplist *sink_input_new_data_proplist(pa_sink_input_new_data *data) {
+    return data->proplist;
+}
+
+static pa_proplist *sink_input_proplist(pa_sink_input *i) {
+    return i->proplist;
+}
+
+static pa_proplist *source_output_new_data_proplist(pa_source_output_new_data *data) {
+    return data->proplist;
+}
+
+static pa_proplist *source_output_proplist(pa_source_output *o) {
+    return o->proplist;
+}
+
+pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t shm_size, const size_t *shm_slot_sizes, unsigned n_shm_slot_sizes) {
     pa_core* c;
     pa_mempool *pool;
     pa_mem_type_t type;
     int j;
 
     pa_assert(m);
+    pa_assert(n_shm_slot_sizes <= PA_MEMPOOL_SLOT_CLASSES_MAX);
 
     if (shared) {
         type = (enable_memfd) ? PA_MEM_TYPE_SHARED_MEMFD : PA_MEM_TYPE_SHARED_POSIX;
-        if (!(pool = pa_mempool_new(type, shm_size, false))) {
+        if (!(pool = pa_mempool_new_with_slot_sizes(type, shm_size, false, shm_slot_sizes, n_shm_slot_sizes))) {
             pa_log_warn("Failed to allocate %s memory pool. Falling back to a normal memory pool.",
                         pa_mem_type_to_string(type));
             shared = false;
@@ -79,7 +110,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t
     }
 
     if (!shared) {
-        if (!(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, shm_size, false))) {
+        if (!(pool = pa_mempool_new_with_slot_sizes(PA_MEM_TYPE_PRIVATE, shm_size, false, shm_slot_sizes, n_shm_slot_sizes))) {
             pa_log("pa_mempool_new() failed.");
             return NULL;
         }
@@ -116,6 +147,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t
 
     c->deferred_volume_safety_margin_usec = 8000;
     c->deferred_volume_extra_delay_usec = 0;
+    c->volume_horizon_usec = 0;
 
     c->module_defer_unload_event = NULL;
     c->modules_pending_unload = pa_hashmap_new(NULL, NULL);
@@ -127,10 +159,15 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t
 
     c->mempool = pool;
     c->shm_size = shm_size;
+    if (n_shm_slot_sizes > 0)
+        memcpy(c->shm_slot_sizes, shm_slot_sizes, n_shm_slot_sizes * sizeof(size_t));
+    c->n_shm_slot_sizes = n_shm_slot_sizes;
     pa_silence_cache_init(&c->silence_cache);
+    pa_resampler_cache_init(&c->resampler_cache);
 
     c->exit_event = NULL;
     c->scache_auto_unload_event = NULL;
+    c->wakeups = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL, pa_xfree);
 
     c->exit_idle_time = -1;
     c->scache_idle_time = 20;
@@ -141,16 +178,27 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t
     c->running_as_daemon = false;
     c->realtime_scheduling = false;
     c->realtime_priority = 5;
+    c->thread_affinity = NULL;
     c->disable_remixing = false;
     c->remixing_use_all_sink_channels = true;
     c->disable_lfe_remixing = true;
     c->lfe_crossover_freq = 0;
+    c->premix_inputs = false;
+    c->render_threads = 0;
+    c->io_thread_cpu_budget = 0;
     c->deferred_volume = true;
     c->resample_method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 1;
 
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
         pa_hook_init(&c->hooks[j], c);
 
+    pa_hook_set_proplist_cb(&c->hooks[PA_CORE_HOOK_SINK_INPUT_NEW], (pa_hook_proplist_cb_t) sink_input_new_data_proplist);
+    pa_hook_set_proplist_cb(&c->hooks[PA_CORE_HOOK_SINK_INPUT_FIXATE], (pa_hook_proplist_cb_t) sink_input_new_data_proplist);
+    pa_hook_set_proplist_cb(&c->hooks[PA_CORE_HOOK_SINK_INPUT_PUT], (pa_hook_proplist_cb_t) sink_input_proplist);
+    pa_hook_set_proplist_cb(&c->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_NEW], (pa_hook_proplist_cb_t) source_output_new_data_proplist);
+    pa_hook_set_proplist_cb(&c->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_FIXATE], (pa_hook_proplist_cb_t) source_output_new_data_proplist);
+    pa_hook_set_proplist_cb(&c->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_PUT], (pa_hook_proplist_cb_t) source_output_proplist);
+
     pa_random(&c->cookie, sizeof(c->cookie));
 
 #ifdef SIGPIPE
@@ -212,12 +260,16 @@ static void core_free(pa_object *o) {
     if (c->exit_event)
         c->mainloop->time_free(c->exit_event);
 
+    pa_hashmap_free(c->wakeups);
+
     pa_assert(!c->default_source);
     pa_assert(!c->default_sink);
     pa_xfree(c->configured_default_source);
     pa_xfree(c->configured_default_sink);
+    pa_xfree(c->thread_affinity);
 
     pa_silence_cache_done(&c->silence_cache);
+    pa_resampler_cache_done(&c->resampler_cache);
     pa_mempool_unref(c->mempool);
 
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
@@ -226,6 +278,28 @@ static void core_free(pa_object *o) {
     pa_xfree(c);
 }
 
+void pa_core_post_xrun_event(pa_core *c, pa_xrun_cause_t cause, pa_device_type_t device_type, uint32_t device_index,
+                             uint32_t stream_index, pa_usec_t watermark_before, pa_usec_t watermark_after) {
+    pa_xrun_event *e;
+    pa_thread_mq *q;
+    struct timeval now;
+
+    pa_core_assert_ref(c);
+    pa_assert_se(q = pa_thread_mq_get());
+
+    e = pa_xnew(pa_xrun_event, 1);
+    e->serial = 0;
+    e->timestamp = pa_timeval_load(pa_gettimeofday(&now));
+    e->cause = cause;
+    e->device_type = device_type;
+    e->device_index = device_index;
+    e->stream_index = stream_index;
+    e->watermark_before = watermark_before;
+    e->watermark_after = watermark_after;
+
+    pa_asyncmsgq_post(q->outq, PA_MSGOBJECT(c), PA_CORE_MESSAGE_XRUN_EVENT, e, 0, NULL, pa_xfree);
+}
+
 void pa_core_set_configured_default_sink(pa_core *core, const char *sink) {
     char *old_sink;
 
@@ -430,6 +504,8 @@ static void exit_callback(pa_mainloop_api *m, pa_time_event *e, const struct tim
     pa_core *c = userdata;
     pa_assert(c->exit_event == e);
 
+    pa_core_count_wakeup(c, "exit-idle");
+
     pa_log_info("We are idle, quitting...");
     pa_core_exit(c, true, 0);
 }
@@ -502,3 +578,21 @@ void pa_core_rttime_restart(pa_core *c, pa_time_event *e, pa_usec_t usec) {
 
     c->mainloop->time_restart(e, pa_timeval_rtstore(&tv, usec, true));
 }
+
+pa_usec_t pa_core_rttime_coarse(pa_usec_t usec) {
+    return ((usec + PA_CORE_COARSE_TIMER_USEC - 1) / PA_CORE_COARSE_TIMER_USEC) * PA_CORE_COARSE_TIMER_USEC;
+}
+
+void pa_core_count_wakeup(pa_core *c, const char *source) {
+    uint64_t *n;
+
+    pa_assert(c);
+    pa_assert(source);
+
+    if (!(n = pa_hashmap_get(c->wakeups, source))) {
+        n = pa_xnew0(uint64_t, 1);
+        pa_hashmap_put(c->wakeups, (void *) source, n);
+    }
+
+    (*n)++;
+}
@@ -34,6 +34,7 @@ typedef enum pa_suspend_cause {
     PA_SUSPEND_SESSION = 8,      /* Used by module-hal for mark inactive sessions */
     PA_SUSPEND_PASSTHROUGH = 16, /* Used to suspend monitor sources when the sink is in passthrough mode */
     PA_SUSPEND_INTERNAL = 32,    /* This is used for short period server-internal suspends, such as for sample rate updates */
+    PA_SUSPEND_IDLE_SOFT = 64,   /* Used by module-suspend-on-idle before PA_SUSPEND_IDLE, the device may stay open for a quick resume */
     PA_SUSPEND_ALL = 0xFFFF      /* Magic cause that can be used to resume forcibly */
 } pa_suspend_cause_t;
 
@@ -141,6 +142,20 @@ typedef enum pa_core_hook {
     PA_CORE_HOOK_MAX
 } pa_core_hook_t;
 
+/* Number of xrun events the core remembers */
+#define PA_CORE_XRUN_EVENTS_MAX 64
+
+typedef struct pa_xrun_event {
+    uint64_t serial;
+    pa_usec_t timestamp;          /* Wall clock time */
+    pa_xrun_cause_t cause;
+    pa_device_type_t device_type;
+    uint32_t device_index;
+    uint32_t stream_index;        /* PA_INVALID_INDEX unless a stream caused it */
+    pa_usec_t watermark_before;   /* The wakeup watermark of timer */
+    pa_usec_t watermark_after;    /* based devices, otherwise 0 */
+} pa_xrun_event;
+
 /* The core structure of PulseAudio. Every PulseAudio daemon contains
  * exactly one of these. It is used for storing kind of global
  * variables for the daemon. */
@@ -184,8 +199,18 @@ struct pa_core {
     unsigned default_n_fragments, default_fragment_size_msec;
     unsigned deferred_volume_safety_margin_usec;
     int deferred_volume_extra_delay_usec;
+    pa_usec_t volume_horizon_usec;
     unsigned lfe_crossover_freq;
 
+    /* Threads that help IO threads peeking their inputs, 0 for none.
+     * See render-pool.h. */
+    unsigned render_threads;
+
+    /* Share of one CPU in percent each sink and source IO thread may
+     * use before making its work cheaper, 0 for no limit. See
+     * cpu-budget.h. */
+    unsigned io_thread_cpu_budget;
+
     pa_defer_event *module_defer_unload_event;
     pa_hashmap *modules_pending_unload; /* pa_module -> pa_module (hashmap-as-a-set) */
 
@@ -193,6 +218,8 @@ struct pa_core {
     PA_LLIST_HEAD(pa_subscription, subscriptions);
     PA_LLIST_HEAD(pa_subscription_event, subscription_event_queue);
     pa_subscription_event *subscription_event_last;
+    /* Bumped for every event passed to pa_subscription_post() */
+    uint64_t change_generation;
 
     /* The mempool is used for data we write to, it's readonly for the client. */
     pa_mempool *mempool;
@@ -201,11 +228,30 @@ struct pa_core {
      * or PA daemon defaults (~ 64 MiB). */
     size_t shm_size;
 
+    /* Slot sizes of the mempools, 0 entries for the defaults. The
+     * per-client pools are created with the same layout. */
+    size_t shm_slot_sizes[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    unsigned n_shm_slot_sizes;
+
     pa_silence_cache silence_cache;
 
+    /* Idle stream resamplers, for reusing them when streams with the
+     * same conversion come and go */
+    pa_resampler_cache resampler_cache;
+
+    /* The last xrun events of all devices, oldest first starting at
+     * n_xrun_events % PA_CORE_XRUN_EVENTS_MAX once the ring is full.
+     * n_xrun_events counts all events ever recorded. */
+    pa_xrun_event xrun_events[PA_CORE_XRUN_EVENTS_MAX];
+    uint64_t n_xrun_events;
+
     pa_time_event *exit_event;
     pa_time_event *scache_auto_unload_event;
 
+    /* Name of a main loop timer -> uint64_t* how often it fired, see
+     * pa_core_count_wakeup() */
+    pa_hashmap *wakeups;
+
     int exit_idle_time, scache_idle_time;
 
     bool flat_volumes:1;
@@ -217,11 +263,15 @@ struct pa_core {
     bool disable_remixing:1;
     bool remixing_use_all_sink_channels:1;
     bool disable_lfe_remixing:1;
+    bool premix_inputs:1;
     bool deferred_volume:1;
 
     pa_resample_method_t resample_method;
     int realtime_priority;
 
+    /* CPUs the IO threads are pinned to, NULL for no pinning */
+    char *thread_affinity;
+
     pa_server_type_t server_type;
     pa_cpu_info cpu_info;
 
@@ -234,10 +284,16 @@ PA_DECLARE_PUBLIC_CLASS(pa_core);
 
 enum {
     PA_CORE_MESSAGE_UNLOAD_MODULE,
+    PA_CORE_MESSAGE_XRUN_EVENT,
     PA_CORE_MESSAGE_MAX
 };
 
-pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t shm_size);
+pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t shm_size, const size_t *shm_slot_sizes, unsigned n_shm_slot_sizes);
+
+/* Called from IO thread context. Records an xrun event in the core and
+ * tells the subscribers about it. */
+void pa_core_post_xrun_event(pa_core *c, pa_xrun_cause_t cause, pa_device_type_t device_type, uint32_t device_index,
+                             uint32_t stream_index, pa_usec_t watermark_before, pa_usec_t watermark_after);
 
 void pa_core_set_configured_default_sink(pa_core *core, const char *sink);
 void pa_core_set_configured_default_source(pa_core *core, const char *source);
@@ -265,4 +321,16 @@ void pa_core_maybe_vacuum(pa_core *c);
 pa_time_event* pa_core_rttime_new(pa_core *c, pa_usec_t usec, pa_time_event_cb_t cb, void *userdata);
 void pa_core_rttime_restart(pa_core *c, pa_time_event *e, pa_usec_t usec);
 
+/* Housekeeping timers that don't have to be on time round their RT time
+ * up with pa_core_rttime_coarse() to a multiple of this, so that they
+ * wake up the daemon together instead of one by one. */
+#define PA_CORE_COARSE_TIMER_USEC PA_USEC_PER_SEC
+
+pa_usec_t pa_core_rttime_coarse(pa_usec_t usec);
+
+/* Called from main loop timers, counts how often the one called source
+ * woke up the daemon, for "pacmd stat". source has to be a static
+ * string. */
+void pa_core_count_wakeup(pa_core *c, const char *source);
+
 #endif
@@ -0,0 +1,104 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core-rtclock.h>
+
+#include "cpu-budget.h"
+
+/* The share of the CPU is looked at over this long */
+#define WINDOW_USEC PA_USEC_PER_SEC
+
+static pa_usec_t thread_cpu_now(void) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return pa_timespec_load(&ts);
+#endif
+
+    return 0;
+}
+
+void pa_cpu_budget_init(pa_cpu_budget *b, unsigned percent) {
+    pa_assert(b);
+
+    memset(b, 0, sizeof(*b));
+    b->percent = percent;
+
+#if defined(HAVE_SYS_RESOURCE_H) && defined(RLIMIT_RTTIME)
+    if (percent > 0) {
+        struct rlimit rl;
+
+        if (getrlimit(RLIMIT_RTTIME, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+            b->burst_max = (pa_usec_t) rl.rlim_cur / 2;
+    }
+#endif
+}
+
+bool pa_cpu_budget_test(pa_cpu_budget *b) {
+    pa_usec_t now, cpu;
+    bool over = false;
+
+    pa_assert(b);
+
+    if (b->percent <= 0)
+        return false;
+
+    if ((cpu = thread_cpu_now()) <= 0)
+        return false;
+
+    now = pa_rtclock_now();
+
+    /* The thread sleeps between two renders, so this is an upper bound
+     * of what it used without sleeping */
+    if (b->burst_max > 0 && b->last_cpu > 0 && cpu - b->last_cpu > b->burst_max)
+        over = true;
+
+    b->last_cpu = cpu;
+
+    if (b->window_begin <= 0) {
+        b->window_begin = now;
+        b->window_cpu = cpu;
+    } else if (now >= b->window_begin + WINDOW_USEC) {
+        if ((cpu - b->window_cpu) * 100 > (now - b->window_begin) * b->percent)
+            over = true;
+
+        b->window_begin = now;
+        b->window_cpu = cpu;
+    }
+
+    /* Give whatever the caller does about it time to take effect */
+    if (!over || (b->last_overload > 0 && now < b->last_overload + WINDOW_USEC))
+        return false;
+
+    b->last_overload = now;
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef foopulsecorecpubudgethfoo
+#define foopulsecorecpubudgethfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulse/sample.h>
+#include <pulsecore/macro.h>
+
+/* Watches the CPU time an IO thread uses, so that it can make its work
+ * cheaper before it starves the rest of the system, or before the
+ * kernel kills it for exceeding RLIMIT_RTTIME, which is what rtkit
+ * relies on for realtime threads. The thread calls pa_cpu_budget_test()
+ * from its render path, which measures with CLOCK_THREAD_CPUTIME_ID. */
+
+typedef struct pa_cpu_budget {
+    /* Share of one CPU the thread may use, 0 if unlimited */
+    unsigned percent;
+    /* Half of RLIMIT_RTTIME, 0 if there is no such limit */
+    pa_usec_t burst_max;
+
+    pa_usec_t window_begin, window_cpu;
+    pa_usec_t last_cpu;
+    pa_usec_t last_overload;
+} pa_cpu_budget;
+
+/* Called from main context. The thread may use percent of one CPU over
+ * a second, and half of RLIMIT_RTTIME between two consecutive calls to
+ * pa_cpu_budget_test(). A percent of 0 disables the budget. */
+void pa_cpu_budget_init(pa_cpu_budget *b, unsigned percent);
+
+/* Called from IO thread context. Returns true if the calling thread
+ * used more than its budget, at most once a second. */
+bool pa_cpu_budget_test(pa_cpu_budget *b);
+
+#endif
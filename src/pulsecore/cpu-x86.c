@@ -37,9 +37,23 @@ static void get_cpuid(uint32_t op, uint32_t *a, uint32_t *b, uint32_t *c, uint32
         "  pop %%"PA_REG_b"    \n\t"
 
         : "=a" (*a), "=S" (*b), "=c" (*c), "=d" (*d)
-        : "0" (op)
+        : "0" (op), "2" (0)
     );
 }
+
+/* Returns the OS-enabled state components (XCR0), only valid if the CPU
+ * supports OSXSAVE */
+static uint64_t get_xcr0(void) {
+    uint32_t eax, edx;
+
+    __asm__ __volatile__ (
+        "  xgetbv              \n\t"
+        : "=a" (eax), "=d" (edx)
+        : "c" (0)
+    );
+
+    return ((uint64_t) edx << 32) | eax;
+}
 #endif
 
 void pa_cpu_get_x86_flags(pa_cpu_x86_flag_t *flags) {
@@ -77,6 +91,26 @@ void pa_cpu_get_x86_flags(pa_cpu_x86_flag_t *flags) {
 
         if (ecx & (1<<20))
           *flags |= PA_CPU_X86_SSE4_2;
+
+        /* AVX needs OS support for saving the YMM registers (and ZMM
+         * registers for AVX-512) on context switches */
+        if ((ecx & (1<<27)) && (ecx & (1<<28))) {
+            uint64_t xcr0 = get_xcr0();
+
+            if ((xcr0 & 0x06) == 0x06) {
+                *flags |= PA_CPU_X86_AVX;
+
+                if (level >= 7) {
+                    get_cpuid(0x00000007, &eax, &ebx, &ecx, &edx);
+
+                    if (ebx & (1<<5))
+                      *flags |= PA_CPU_X86_AVX2;
+
+                    if ((ebx & (1<<16)) && (xcr0 & 0xe6) == 0xe6)
+                      *flags |= PA_CPU_X86_AVX512F;
+                }
+            }
+        }
     }
 
     /* get extended level */
@@ -97,7 +131,7 @@ void pa_cpu_get_x86_flags(pa_cpu_x86_flag_t *flags) {
           *flags |= PA_CPU_X86_3DNOW;
     }
 
-    pa_log_info("CPU flags: %s%s%s%s%s%s%s%s%s%s%s",
+    pa_log_info("CPU flags: %s%s%s%s%s%s%s%s%s%s%s%s%s%s",
     (*flags & PA_CPU_X86_CMOV) ? "CMOV " : "",
     (*flags & PA_CPU_X86_MMX) ? "MMX " : "",
     (*flags & PA_CPU_X86_SSE) ? "SSE " : "",
@@ -106,6 +140,9 @@ void pa_cpu_get_x86_flags(pa_cpu_x86_flag_t *flags) {
     (*flags & PA_CPU_X86_SSSE3) ? "SSSE3 " : "",
     (*flags & PA_CPU_X86_SSE4_1) ? "SSE4_1 " : "",
     (*flags & PA_CPU_X86_SSE4_2) ? "SSE4_2 " : "",
+    (*flags & PA_CPU_X86_AVX) ? "AVX " : "",
+    (*flags & PA_CPU_X86_AVX2) ? "AVX2 " : "",
+    (*flags & PA_CPU_X86_AVX512F) ? "AVX512F " : "",
     (*flags & PA_CPU_X86_MMXEXT) ? "MMXEXT " : "",
     (*flags & PA_CPU_X86_3DNOW) ? "3DNOW " : "",
     (*flags & PA_CPU_X86_3DNOWEXT) ? "3DNOWEXT " : "");
@@ -126,8 +163,14 @@ bool pa_cpu_init_x86(pa_cpu_x86_flag_t *flags) {
         pa_volume_func_init_sse(*flags);
         pa_remap_func_init_sse(*flags);
         pa_convert_func_init_sse(*flags);
+        pa_mix_func_init_sse(*flags);
+        pa_polyphase_func_init_x86(*flags);
+        pa_peaks_func_init_x86(*flags);
     }
 
+    if (*flags & PA_CPU_X86_AVX)
+        pa_volume_func_init_avx(*flags);
+
     return true;
 #else /* defined (__i386__) || defined (__amd64__) */
     return false;
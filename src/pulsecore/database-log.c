@@ -0,0 +1,657 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+
+#include "database.h"
+
+/* A log structured database: every set or unset appends one record to
+ * the file, which is mapped into memory. Only the keys and the file
+ * offsets of the data are kept in memory, so opening the database is a
+ * single pass over the mapping and a save doesn't rewrite anything. Once
+ * most of the file is made of overwritten records, pa_database_sync()
+ * compacts it into a new file.
+ *
+ * Records are in host byte order, like the file name says. */
+
+#define FILE_MAGIC "PADBLOG1"
+#define FILE_MAGIC_SIZE 8
+
+#define RECORD_MAGIC 0x5041524cU /* "PARL" */
+#define RECORD_UNSET 0xffffffffU /* as data_size */
+#define RECORD_ALIGN 8
+
+/* Don't bother compacting less than this much garbage */
+#define COMPACT_MIN_BYTES (64 * 1024)
+
+typedef struct record_header {
+    uint32_t magic;
+    uint32_t key_size;
+    uint32_t data_size;
+    uint32_t checksum;
+} record_header;
+
+typedef struct entry {
+    pa_datum key;
+    uint64_t data_offset;
+    uint32_t data_size;
+
+    PA_LLIST_FIELDS(struct entry);
+} entry;
+
+typedef struct log_data {
+    char *filename;
+    char *tmp_filename;
+    int fd;
+    bool read_only;
+
+    const uint8_t *map;
+    size_t map_size;
+    uint64_t file_size;
+
+    /* The hashmap owns the entries, the list keeps the order for
+     * pa_database_next() */
+    pa_hashmap *index;
+    PA_LLIST_HEAD(entry, entries);
+
+    uint64_t live_bytes;
+} log_data;
+
+void pa_datum_free(pa_datum *d) {
+    pa_assert(d);
+
+    pa_xfree(d->data);
+    d->data = NULL;
+    d->size = 0;
+}
+
+static int compare_func(const void *a, const void *b) {
+    const pa_datum *aa, *bb;
+
+    aa = (const pa_datum*)a;
+    bb = (const pa_datum*)b;
+
+    if (aa->size != bb->size)
+        return aa->size > bb->size ? 1 : -1;
+
+    return memcmp(aa->data, bb->data, aa->size);
+}
+
+/* pa_idxset_string_hash_func modified for our use */
+static unsigned hash_func(const void *p) {
+    const pa_datum *d;
+    unsigned hash = 0;
+    const char *c;
+    unsigned i;
+
+    d = (const pa_datum*)p;
+    c = d->data;
+
+    for (i = 0; i < d->size; i++) {
+        hash = 31 * hash + (unsigned) *c;
+        c++;
+    }
+
+    return hash;
+}
+
+/* FNV-1a, to tell a record that was only partially written */
+static uint32_t checksum(uint32_t h, const void *p, size_t size) {
+    const uint8_t *c = p;
+
+    for (; size > 0; size--, c++) {
+        h ^= *c;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static uint32_t record_checksum(const pa_datum *key, const void *data, uint32_t data_size) {
+    uint32_t h = 2166136261U;
+
+    h = checksum(h, key->data, key->size);
+    h = checksum(h, &data_size, sizeof(data_size));
+
+    if (data_size != RECORD_UNSET)
+        h = checksum(h, data, data_size);
+
+    return h;
+}
+
+static uint64_t record_size(uint32_t key_size, uint32_t data_size) {
+    uint64_t s = sizeof(record_header) + key_size;
+
+    if (data_size != RECORD_UNSET)
+        s += data_size;
+
+    return PA_ROUND_UP(s, RECORD_ALIGN);
+}
+
+static void free_entry(entry *e) {
+    pa_xfree(e->key.data);
+    pa_xfree(e);
+}
+
+static void remove_entry(log_data *db, entry *e) {
+    pa_hashmap_remove(db->index, &e->key);
+    PA_LLIST_REMOVE(entry, db->entries, e);
+
+    db->live_bytes -= record_size(e->key.size, e->data_size);
+    free_entry(e);
+}
+
+static void put_entry(log_data *db, const pa_datum *key, uint64_t data_offset, uint32_t data_size) {
+    entry *e;
+
+    if ((e = pa_hashmap_get(db->index, key)))
+        remove_entry(db, e);
+
+    e = pa_xnew0(entry, 1);
+    e->key.data = key->size > 0 ? pa_xmemdup(key->data, key->size) : NULL;
+    e->key.size = key->size;
+    e->data_offset = data_offset;
+    e->data_size = data_size;
+
+    pa_hashmap_put(db->index, &e->key, e);
+    PA_LLIST_PREPEND(entry, db->entries, e);
+
+    db->live_bytes += record_size(key->size, data_size);
+}
+
+static void unmap_file(log_data *db) {
+    if (db->map)
+        munmap((void*) db->map, db->map_size);
+
+    db->map = NULL;
+    db->map_size = 0;
+}
+
+/* Makes sure that everything up to the end of the file is mapped */
+static int map_file(log_data *db) {
+    void *p;
+
+    if (db->map && db->map_size >= db->file_size)
+        return 0;
+
+    unmap_file(db);
+
+    if ((p = mmap(NULL, (size_t) db->file_size, PROT_READ, MAP_SHARED, db->fd, 0)) == MAP_FAILED) {
+        pa_log_warn("mmap() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    db->map = p;
+    db->map_size = (size_t) db->file_size;
+
+    return 0;
+}
+
+static int write_all(int fd, const void *p, size_t size, uint64_t offset) {
+    const uint8_t *c = p;
+
+    while (size > 0) {
+        ssize_t r;
+
+        if ((r = pwrite(fd, c, size, (off_t) offset)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        c += r;
+        size -= (size_t) r;
+        offset += (uint64_t) r;
+    }
+
+    return 0;
+}
+
+/* Appends a record, data NULL for an unset. Returns the file offset of
+ * the data. */
+static int64_t append_record(log_data *db, const pa_datum *key, const pa_datum *data) {
+    record_header h;
+    uint8_t *buf;
+    uint64_t size, offset;
+
+    h.magic = RECORD_MAGIC;
+    h.key_size = (uint32_t) key->size;
+    h.data_size = data ? (uint32_t) data->size : RECORD_UNSET;
+    h.checksum = record_checksum(key, data ? data->data : NULL, h.data_size);
+
+    size = record_size(h.key_size, h.data_size);
+    buf = pa_xmalloc0((size_t) size);
+
+    memcpy(buf, &h, sizeof(h));
+    if (key->size > 0)
+        memcpy(buf + sizeof(h), key->data, key->size);
+    if (data && data->size > 0)
+        memcpy(buf + sizeof(h) + key->size, data->data, data->size);
+
+    offset = db->file_size;
+
+    if (write_all(db->fd, buf, (size_t) size, offset) < 0) {
+        pa_log_warn("error while writing to file. %s", pa_cstrerror(errno));
+        pa_xfree(buf);
+
+        /* Don't leave half a record behind for the next append */
+        if (ftruncate(db->fd, (off_t) offset) < 0)
+            pa_log_warn("error while truncating file. %s", pa_cstrerror(errno));
+
+        return -1;
+    }
+
+    pa_xfree(buf);
+    db->file_size += size;
+
+    return (int64_t) (offset + sizeof(h) + key->size);
+}
+
+static void load_records(log_data *db) {
+    uint64_t pos = FILE_MAGIC_SIZE;
+
+    while (pos + sizeof(record_header) <= db->file_size) {
+        record_header h;
+        pa_datum key;
+        const uint8_t *data;
+        uint64_t size;
+
+        memcpy(&h, db->map + pos, sizeof(h));
+
+        if (h.magic != RECORD_MAGIC)
+            break;
+
+        size = record_size(h.key_size, h.data_size);
+        if (size > db->file_size - pos)
+            break;
+
+        key.data = (void*) (db->map + pos + sizeof(h));
+        key.size = h.key_size;
+        data = db->map + pos + sizeof(h) + h.key_size;
+
+        if (record_checksum(&key, data, h.data_size) != h.checksum)
+            break;
+
+        if (h.data_size == RECORD_UNSET) {
+            entry *e;
+
+            if ((e = pa_hashmap_get(db->index, &key)))
+                remove_entry(db, e);
+        } else
+            put_entry(db, &key, pos + sizeof(h) + h.key_size, h.data_size);
+
+        pos += size;
+    }
+
+    if (pos == db->file_size)
+        return;
+
+    /* The daemon was killed in the middle of a write, forget the rest */
+    pa_log_warn("Ignoring %llu bytes of damaged records at the end of %s.", (unsigned long long) (db->file_size - pos), db->filename);
+
+    if (!db->read_only) {
+        if (ftruncate(db->fd, (off_t) pos) < 0)
+            pa_log_warn("error while truncating file. %s", pa_cstrerror(errno));
+        else
+            db->file_size = pos;
+    }
+}
+
+static int open_file(log_data *db, const char *fn) {
+    struct stat st;
+
+    if ((db->fd = pa_open_cloexec(fn, db->read_only ? O_RDONLY : O_RDWR|O_CREAT, 0600)) < 0)
+        return -1;
+
+    if (fstat(db->fd, &st) < 0)
+        return -1;
+
+    db->file_size = (uint64_t) st.st_size;
+
+    if (db->file_size == 0 && !db->read_only) {
+        if (write_all(db->fd, FILE_MAGIC, FILE_MAGIC_SIZE, 0) < 0)
+            return -1;
+
+        db->file_size = FILE_MAGIC_SIZE;
+    }
+
+    if (db->file_size < FILE_MAGIC_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (map_file(db) < 0)
+        return -1;
+
+    if (memcmp(db->map, FILE_MAGIC, FILE_MAGIC_SIZE) != 0) {
+        pa_log_warn("%s is not a database file.", fn);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void close_file(log_data *db) {
+    unmap_file(db);
+
+    if (db->fd >= 0)
+        pa_close(db->fd);
+
+    db->fd = -1;
+}
+
+pa_database* pa_database_open(const char *fn, bool for_write) {
+    char *path;
+    log_data *db;
+    int saved_errno;
+
+    pa_assert(fn);
+
+    path = pa_sprintf_malloc("%s."CANONICAL_HOST".log", fn);
+
+    db = pa_xnew0(log_data, 1);
+    db->fd = -1;
+    db->read_only = !for_write;
+    db->filename = path;
+    db->tmp_filename = pa_sprintf_malloc("%s.tmp", path);
+    db->index = pa_hashmap_new_full(hash_func, compare_func, NULL, (pa_free_cb_t) free_entry);
+    PA_LLIST_HEAD_INIT(entry, db->entries);
+
+    errno = 0;
+
+    if (open_file(db, path) < 0) {
+        saved_errno = errno;
+
+        /* Like the other backends, a missing file is an empty database */
+        if (db->read_only && saved_errno == ENOENT)
+            return (pa_database*) db;
+
+        close_file(db);
+        pa_hashmap_free(db->index);
+        pa_xfree(db->tmp_filename);
+        pa_xfree(db->filename);
+        pa_xfree(db);
+
+        errno = saved_errno ? saved_errno : EIO;
+        return NULL;
+    }
+
+    load_records(db);
+
+    return (pa_database*) db;
+}
+
+void pa_database_close(pa_database *database) {
+    log_data *db = (log_data*)database;
+
+    pa_assert(db);
+
+    pa_database_sync(database);
+
+    close_file(db);
+    pa_hashmap_free(db->index);
+    pa_xfree(db->tmp_filename);
+    pa_xfree(db->filename);
+    pa_xfree(db);
+}
+
+static void copy_data(log_data *db, const entry *e, pa_datum *data) {
+    data->data = e->data_size > 0 ? pa_xmemdup(db->map + e->data_offset, e->data_size) : NULL;
+    data->size = e->data_size;
+}
+
+pa_datum* pa_database_get(pa_database *database, const pa_datum *key, pa_datum* data) {
+    log_data *db = (log_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    if (!(e = pa_hashmap_get(db->index, key)))
+        return NULL;
+
+    if (map_file(db) < 0)
+        return NULL;
+
+    copy_data(db, e, data);
+
+    return data;
+}
+
+int pa_database_set(pa_database *database, const pa_datum *key, const pa_datum* data, bool overwrite) {
+    log_data *db = (log_data*)database;
+    int64_t offset;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    if (db->read_only)
+        return -1;
+
+    if (!overwrite && pa_hashmap_get(db->index, key))
+        return -1;
+
+    if ((offset = append_record(db, key, data)) < 0)
+        return -1;
+
+    put_entry(db, key, (uint64_t) offset, (uint32_t) data->size);
+
+    return 0;
+}
+
+int pa_database_unset(pa_database *database, const pa_datum *key) {
+    log_data *db = (log_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    if (db->read_only)
+        return -1;
+
+    if (!(e = pa_hashmap_get(db->index, key)))
+        return -1;
+
+    if (append_record(db, key, NULL) < 0)
+        return -1;
+
+    remove_entry(db, e);
+
+    return 0;
+}
+
+/* Writes the live records to a new file and replaces the old one with
+ * it */
+static int compact(log_data *db) {
+    log_data new_db;
+    entry *e;
+
+    pa_zero(new_db);
+    new_db.filename = db->tmp_filename;
+    new_db.fd = -1;
+
+    if ((new_db.fd = pa_open_cloexec(db->tmp_filename, O_RDWR|O_CREAT|O_TRUNC, 0600)) < 0)
+        goto fail;
+
+    if (write_all(new_db.fd, FILE_MAGIC, FILE_MAGIC_SIZE, 0) < 0)
+        goto fail;
+
+    new_db.file_size = FILE_MAGIC_SIZE;
+
+    if (map_file(db) < 0)
+        goto fail;
+
+    /* Oldest first, so that a later load puts them in the same order */
+    for (e = db->entries; e && e->next; e = e->next)
+        ;
+
+    for (; e; e = e->prev) {
+        pa_datum data;
+        int64_t offset;
+
+        data.data = (void*) (db->map + e->data_offset);
+        data.size = e->data_size;
+
+        if ((offset = append_record(&new_db, &e->key, &data)) < 0)
+            goto fail;
+
+        e->data_offset = (uint64_t) offset;
+    }
+
+    if (fdatasync(new_db.fd) < 0)
+        goto fail;
+
+    if (rename(db->tmp_filename, db->filename) < 0)
+        goto fail;
+
+    pa_log_debug("Compacted %s from %llu to %llu bytes.", db->filename,
+                 (unsigned long long) db->file_size, (unsigned long long) new_db.file_size);
+
+    close_file(db);
+    db->fd = new_db.fd;
+    db->file_size = new_db.file_size;
+
+    return map_file(db);
+
+fail:
+    pa_log_warn("error while compacting %s. %s", db->filename, pa_cstrerror(errno));
+
+    if (new_db.fd >= 0) {
+        pa_close(new_db.fd);
+        unlink(db->tmp_filename);
+    }
+
+    /* The offsets of the entries that were already copied point into
+     * the new file now, so start over from the old one */
+    pa_hashmap_remove_all(db->index);
+    PA_LLIST_HEAD_INIT(entry, db->entries);
+    db->live_bytes = 0;
+
+    if (map_file(db) == 0)
+        load_records(db);
+
+    return -1;
+}
+
+int pa_database_clear(pa_database *database) {
+    log_data *db = (log_data*)database;
+
+    pa_assert(db);
+
+    if (db->read_only)
+        return -1;
+
+    pa_hashmap_remove_all(db->index);
+    PA_LLIST_HEAD_INIT(entry, db->entries);
+    db->live_bytes = 0;
+
+    return compact(db);
+}
+
+signed pa_database_size(pa_database *database) {
+    log_data *db = (log_data*)database;
+
+    pa_assert(db);
+
+    return (signed) pa_hashmap_size(db->index);
+}
+
+static pa_datum* copy_entry(log_data *db, const entry *e, pa_datum *key, pa_datum *data) {
+    if (data) {
+        if (map_file(db) < 0)
+            return NULL;
+
+        copy_data(db, e, data);
+    }
+
+    key->data = e->key.size > 0 ? pa_xmemdup(e->key.data, e->key.size) : NULL;
+    key->size = e->key.size;
+
+    return key;
+}
+
+pa_datum* pa_database_first(pa_database *database, pa_datum *key, pa_datum *data) {
+    log_data *db = (log_data*)database;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    if (!db->entries)
+        return NULL;
+
+    return copy_entry(db, db->entries, key, data);
+}
+
+pa_datum* pa_database_next(pa_database *database, const pa_datum *key, pa_datum *next, pa_datum *data) {
+    log_data *db = (log_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(next);
+
+    if (!key)
+        return pa_database_first(database, next, data);
+
+    if (!(e = pa_hashmap_get(db->index, key)) || !e->next)
+        return NULL;
+
+    return copy_entry(db, e->next, next, data);
+}
+
+int pa_database_sync(pa_database *database) {
+    log_data *db = (log_data*)database;
+    uint64_t garbage;
+
+    pa_assert(db);
+
+    if (db->read_only || db->fd < 0)
+        return 0;
+
+    garbage = db->file_size - FILE_MAGIC_SIZE - db->live_bytes;
+
+    if (garbage >= COMPACT_MIN_BYTES && garbage > db->live_bytes)
+        return compact(db);
+
+    if (fdatasync(db->fd) < 0) {
+        pa_log_warn("error while syncing file. %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
@@ -595,6 +595,45 @@ void pa_dbus_send_proplist_variant_reply(DBusConnection *c, DBusMessage *in_repl
     dbus_message_unref(reply);
 }
 
+bool pa_dbus_reply_cache_send(pa_dbus_reply_cache *cache, DBusConnection *c, DBusMessage *in_reply_to, uint64_t generation) {
+    DBusMessage *reply = NULL;
+
+    pa_assert(cache);
+    pa_assert(c);
+    pa_assert(in_reply_to);
+
+    if (!cache->reply || cache->generation != generation)
+        return false;
+
+    /* The copy gets a fresh serial, only the addressing needs fixing up */
+    pa_assert_se((reply = dbus_message_copy(cache->reply)));
+    pa_assert_se(dbus_message_set_reply_serial(reply, dbus_message_get_serial(in_reply_to)));
+    pa_assert_se(dbus_message_set_destination(reply, dbus_message_get_sender(in_reply_to)));
+    pa_assert_se(dbus_connection_send(c, reply, NULL));
+    dbus_message_unref(reply);
+
+    return true;
+}
+
+void pa_dbus_reply_cache_set(pa_dbus_reply_cache *cache, DBusMessage *reply, uint64_t generation) {
+    pa_assert(cache);
+    pa_assert(reply);
+
+    pa_dbus_reply_cache_done(cache);
+
+    cache->reply = dbus_message_ref(reply);
+    cache->generation = generation;
+}
+
+void pa_dbus_reply_cache_done(pa_dbus_reply_cache *cache) {
+    pa_assert(cache);
+
+    if (cache->reply) {
+        dbus_message_unref(cache->reply);
+        cache->reply = NULL;
+    }
+}
+
 void pa_dbus_append_basic_array(DBusMessageIter *iter, int item_type, const void *array, unsigned n) {
     DBusMessageIter array_iter;
     unsigned i;
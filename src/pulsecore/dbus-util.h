@@ -91,6 +91,22 @@ void pa_dbus_send_basic_array_variant_reply(
         unsigned n);
 void pa_dbus_send_proplist_variant_reply(DBusConnection *c, DBusMessage *in_reply_to, pa_proplist *proplist);
 
+/* Keeps a built reply (typically to GetAll) around, so that repeated calls
+ * can be answered with a copy instead of serializing the object again. The
+ * cached reply is valid as long as the caller passes the same generation
+ * counter value it was stored with. A zeroed struct is an empty cache. */
+typedef struct pa_dbus_reply_cache {
+    DBusMessage *reply;
+    uint64_t generation;
+} pa_dbus_reply_cache;
+
+/* Sends a copy of the cached reply as the reply to in_reply_to and returns
+ * true, or returns false if nothing valid for generation is cached. */
+bool pa_dbus_reply_cache_send(pa_dbus_reply_cache *cache, DBusConnection *c, DBusMessage *in_reply_to, uint64_t generation);
+/* Replaces the cached reply. The cache takes its own reference. */
+void pa_dbus_reply_cache_set(pa_dbus_reply_cache *cache, DBusMessage *reply, uint64_t generation);
+void pa_dbus_reply_cache_done(pa_dbus_reply_cache *cache);
+
 void pa_dbus_append_basic_array(DBusMessageIter *iter, int item_type, const void *array, unsigned n);
 void pa_dbus_append_basic_array_variant(DBusMessageIter *iter, int item_type, const void *array, unsigned n);
 void pa_dbus_append_basic_variant(DBusMessageIter *iter, int type, void *data);
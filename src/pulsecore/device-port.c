@@ -83,6 +83,21 @@ void pa_device_port_set_available(pa_device_port *p, pa_available_t status) {
 
 /*    pa_assert(status != PA_AVAILABLE_UNKNOWN); */
 
+    /* The card counts the ports of each profile that aren't
+     * unavailable; before the card exists there is nothing to update. */
+    if (p->card && (p->available == PA_AVAILABLE_NO) != (status == PA_AVAILABLE_NO)) {
+        pa_card_profile *profile;
+        void *state;
+
+        PA_HASHMAP_FOREACH(profile, p->profiles, state) {
+            if (status == PA_AVAILABLE_NO) {
+                pa_assert(profile->n_available_ports > 0);
+                profile->n_available_ports--;
+            } else
+                profile->n_available_ports++;
+        }
+    }
+
     p->available = status;
     pa_log_debug("Setting port %s to status %s", p->name, status == PA_AVAILABLE_YES ? "yes" :
        status == PA_AVAILABLE_NO ? "no" : "unknown");
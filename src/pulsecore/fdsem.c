@@ -43,8 +43,21 @@
 #include <sys/eventfd.h>
 #endif
 
+#ifdef HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#endif
+
 #include "fdsem.h"
 
+/* Threads blocking in pa_fdsem_wait() on a semaphore that isn't shared
+ * with other processes sleep on a futex rather than the fd. Only a
+ * thread sleeping in poll() needs the fd to be written to. The futex
+ * word is the signalled counter itself, which needs to be a plain int
+ * for that. */
+#if defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H) && defined(SYS_futex) && defined(HAVE_ATOMIC_BUILTINS)
+#define USE_FUTEX
+#endif
+
 struct pa_fdsem {
     int fds[2];
 #ifdef HAVE_SYS_EVENTFD_H
@@ -52,6 +65,10 @@ struct pa_fdsem {
 #endif
     int write_type;
     pa_fdsem_data *data;
+#ifdef USE_FUTEX
+    bool use_futex;
+    pa_atomic_t futex_waiting;
+#endif
 };
 
 pa_fdsem *pa_fdsem_new(void) {
@@ -77,6 +94,11 @@ pa_fdsem *pa_fdsem_new(void) {
     pa_atomic_store(&f->data->signalled, 0);
     pa_atomic_store(&f->data->in_pipe, 0);
 
+#ifdef USE_FUTEX
+    f->use_futex = true;
+    pa_atomic_store(&f->futex_waiting, 0);
+#endif
+
     return f;
 }
 
@@ -176,11 +198,33 @@ static void flush(pa_fdsem *f) {
     } while (pa_atomic_sub(&f->data->in_pipe, (int) r) > (int) r);
 }
 
+#ifdef USE_FUTEX
+static void futex_wait(pa_fdsem *f) {
+    pa_atomic_inc(&f->futex_waiting);
+
+    /* EINTR and EAGAIN just mean that we need to check again */
+    while (!pa_atomic_cmpxchg(&f->data->signalled, 1, 0))
+        syscall(SYS_futex, &f->data->signalled.value, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+
+    pa_assert_se(pa_atomic_dec(&f->futex_waiting) >= 1);
+}
+
+static void futex_wake(pa_fdsem *f) {
+    if (pa_atomic_load(&f->futex_waiting))
+        syscall(SYS_futex, &f->data->signalled.value, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#endif
+
 void pa_fdsem_post(pa_fdsem *f) {
     pa_assert(f);
 
     if (pa_atomic_cmpxchg(&f->data->signalled, 0, 1)) {
 
+#ifdef USE_FUTEX
+        if (f->use_futex)
+            futex_wake(f);
+#endif
+
         if (pa_atomic_load(&f->data->waiting)) {
             ssize_t r;
             char x = 'x';
@@ -227,6 +271,13 @@ void pa_fdsem_wait(pa_fdsem *f) {
     if (pa_atomic_cmpxchg(&f->data->signalled, 1, 0))
         return;
 
+#ifdef USE_FUTEX
+    if (f->use_futex) {
+        futex_wait(f);
+        return;
+    }
+#endif
+
     pa_atomic_inc(&f->data->waiting);
 
     while (!pa_atomic_cmpxchg(&f->data->signalled, 1, 0)) {
@@ -0,0 +1,371 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "convolver.h"
+
+/* The input of a channel is transformed once per partition_size frames, using
+ * the last fft_size = 2 * partition_size samples. The spectra of the last
+ * n_partitions blocks are kept in a frequency domain delay line (FDL) and
+ * multiplied with the spectra of the corresponding impulse response
+ * partitions. The second half of the inverse transform of the sum is the
+ * output of the block.
+ *
+ * The output channels are real, so two of them are computed at once: the
+ * impulse responses of output 2k and 2k+1 form the real and imaginary part
+ * of one complex filter, and the real and imaginary part of its output are
+ * the two output channels. */
+
+struct pa_convolver {
+    unsigned n_inputs, n_outputs, n_pairs;
+    unsigned partition_size, n_partitions, fft_size;
+    unsigned max_ir_length;
+
+    unsigned *bitrev;
+    float *twiddle_re, *twiddle_im;
+
+    /* impulse responses, (input * n_outputs + output) * max_ir_length */
+    float *ir;
+    /* whether any impulse response of a pair of outputs is set, per input */
+    bool *active;
+    /* spectra of the partitions, ((input * n_pairs + pair) * n_partitions + partition) * fft_size */
+    float *filter_re, *filter_im;
+
+    /* FDL, (input * n_partitions + slot) * fft_size */
+    float *fdl_re, *fdl_im;
+    unsigned fdl_pos;
+
+    float *block_input;     /* input * fft_size */
+    float *block_output;    /* partition_size interleaved frames */
+    float *acc_re, *acc_im;
+    unsigned block_pos;
+};
+
+/* In-place radix-2 FFT in split complex format. The inverse transform is not
+ * scaled. */
+static void fft(pa_convolver *c, float *re, float *im, bool inverse) {
+    const float sign = inverse ? -1.0f : 1.0f;
+    unsigned i, j, k, half;
+
+    for (i = 0; i < c->fft_size; i++) {
+        j = c->bitrev[i];
+
+        if (i < j) {
+            float t;
+
+            t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    /* The twiddle factors of the stage with butterflies of size 2 * half are
+     * stored at offset half */
+    for (half = 1; half < c->fft_size; half <<= 1) {
+        const float *w_re = c->twiddle_re + half;
+        const float *w_im = c->twiddle_im + half;
+
+        for (i = 0; i < c->fft_size; i += 2 * half) {
+            float *a_re = re + i, *a_im = im + i;
+            float *b_re = a_re + half, *b_im = a_im + half;
+
+            for (k = 0; k < half; k++) {
+                float t_re = b_re[k] * w_re[k] - b_im[k] * w_im[k] * sign;
+                float t_im = b_re[k] * w_im[k] * sign + b_im[k] * w_re[k];
+
+                b_re[k] = a_re[k] - t_re;
+                b_im[k] = a_im[k] - t_im;
+                a_re[k] += t_re;
+                a_im[k] += t_im;
+            }
+        }
+    }
+}
+
+/* acc += x * h for n complex values, n is a multiple of 4 */
+static void complex_mac(float *acc_re, float *acc_im, const float *x_re, const float *x_im,
+                        const float *h_re, const float *h_im, unsigned n) {
+    unsigned j;
+
+#if defined(__SSE__)
+    for (j = 0; j < n; j += 4) {
+        __m128 xr = _mm_loadu_ps(x_re + j), xi = _mm_loadu_ps(x_im + j);
+        __m128 hr = _mm_loadu_ps(h_re + j), hi = _mm_loadu_ps(h_im + j);
+
+        _mm_storeu_ps(acc_re + j, _mm_add_ps(_mm_loadu_ps(acc_re + j), _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi))));
+        _mm_storeu_ps(acc_im + j, _mm_add_ps(_mm_loadu_ps(acc_im + j), _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr))));
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (j = 0; j < n; j += 4) {
+        float32x4_t xr = vld1q_f32(x_re + j), xi = vld1q_f32(x_im + j);
+        float32x4_t hr = vld1q_f32(h_re + j), hi = vld1q_f32(h_im + j);
+
+        vst1q_f32(acc_re + j, vmlsq_f32(vmlaq_f32(vld1q_f32(acc_re + j), xr, hr), xi, hi));
+        vst1q_f32(acc_im + j, vmlaq_f32(vmlaq_f32(vld1q_f32(acc_im + j), xr, hi), xi, hr));
+    }
+#else
+    for (j = 0; j < n; j++) {
+        acc_re[j] += x_re[j] * h_re[j] - x_im[j] * h_im[j];
+        acc_im[j] += x_re[j] * h_im[j] + x_im[j] * h_re[j];
+    }
+#endif
+}
+
+pa_convolver *pa_convolver_new(unsigned n_inputs, unsigned n_outputs, unsigned partition_size, unsigned max_ir_length) {
+    pa_convolver *c;
+    unsigned i, bits, half, n;
+
+    pa_assert(n_inputs > 0);
+    pa_assert(n_outputs > 0);
+    pa_assert(partition_size >= 4);
+    pa_assert((partition_size & (partition_size - 1)) == 0);
+    pa_assert(max_ir_length > 0);
+
+    c = pa_xnew0(pa_convolver, 1);
+    c->n_inputs = n_inputs;
+    c->n_outputs = n_outputs;
+    c->n_pairs = (n_outputs + 1) / 2;
+    c->partition_size = partition_size;
+    c->n_partitions = (max_ir_length + partition_size - 1) / partition_size;
+    c->fft_size = 2 * partition_size;
+    c->max_ir_length = max_ir_length;
+
+    for (bits = 0; (1U << bits) < c->fft_size; bits++)
+        ;
+
+    c->bitrev = pa_xnew(unsigned, c->fft_size);
+    for (i = 0; i < c->fft_size; i++) {
+        unsigned b, r = 0;
+
+        for (b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+
+        c->bitrev[i] = r;
+    }
+
+    c->twiddle_re = pa_xnew0(float, c->fft_size);
+    c->twiddle_im = pa_xnew0(float, c->fft_size);
+    for (half = 1; half < c->fft_size; half <<= 1) {
+        for (i = 0; i < half; i++) {
+            c->twiddle_re[half + i] = (float) cos(M_PI * i / half);
+            c->twiddle_im[half + i] = (float) -sin(M_PI * i / half);
+        }
+    }
+
+    c->ir = pa_xnew0(float, n_inputs * n_outputs * max_ir_length);
+    c->active = pa_xnew0(bool, n_inputs * c->n_pairs);
+
+    n = n_inputs * c->n_pairs * c->n_partitions * c->fft_size;
+    c->filter_re = pa_xnew0(float, n);
+    c->filter_im = pa_xnew0(float, n);
+
+    n = n_inputs * c->n_partitions * c->fft_size;
+    c->fdl_re = pa_xnew0(float, n);
+    c->fdl_im = pa_xnew0(float, n);
+
+    c->block_input = pa_xnew0(float, n_inputs * c->fft_size);
+    c->block_output = pa_xnew0(float, n_outputs * partition_size);
+    c->acc_re = pa_xnew(float, c->fft_size);
+    c->acc_im = pa_xnew(float, c->fft_size);
+
+    return c;
+}
+
+void pa_convolver_free(pa_convolver *c) {
+    pa_assert(c);
+
+    pa_xfree(c->bitrev);
+    pa_xfree(c->twiddle_re);
+    pa_xfree(c->twiddle_im);
+    pa_xfree(c->ir);
+    pa_xfree(c->active);
+    pa_xfree(c->filter_re);
+    pa_xfree(c->filter_im);
+    pa_xfree(c->fdl_re);
+    pa_xfree(c->fdl_im);
+    pa_xfree(c->block_input);
+    pa_xfree(c->block_output);
+    pa_xfree(c->acc_re);
+    pa_xfree(c->acc_im);
+    pa_xfree(c);
+}
+
+void pa_convolver_set_ir(pa_convolver *c, unsigned input, unsigned output, const float *ir, unsigned length) {
+    unsigned pair, p, j;
+    const float *ir_re, *ir_im;
+
+    pa_assert(c);
+    pa_assert(input < c->n_inputs);
+    pa_assert(output < c->n_outputs);
+    pa_assert(ir || length == 0);
+
+    length = PA_MIN(length, c->max_ir_length);
+    memset(c->ir + (input * c->n_outputs + output) * c->max_ir_length, 0, c->max_ir_length * sizeof(float));
+    if (length > 0)
+        memcpy(c->ir + (input * c->n_outputs + output) * c->max_ir_length, ir, length * sizeof(float));
+
+    /* Recalculate the spectra of the pair of outputs */
+    pair = output / 2;
+    ir_re = c->ir + (input * c->n_outputs + 2 * pair) * c->max_ir_length;
+    ir_im = 2 * pair + 1 < c->n_outputs ? ir_re + c->max_ir_length : NULL;
+
+    c->active[input * c->n_pairs + pair] = false;
+
+    for (p = 0; p < c->n_partitions; p++) {
+        float *re = c->filter_re + ((input * c->n_pairs + pair) * c->n_partitions + p) * c->fft_size;
+        float *im = c->filter_im + ((input * c->n_pairs + pair) * c->n_partitions + p) * c->fft_size;
+
+        memset(re, 0, c->fft_size * sizeof(float));
+        memset(im, 0, c->fft_size * sizeof(float));
+
+        for (j = 0; j < c->partition_size && p * c->partition_size + j < c->max_ir_length; j++) {
+            re[j] = ir_re[p * c->partition_size + j];
+            if (ir_im)
+                im[j] = ir_im[p * c->partition_size + j];
+
+            if (re[j] != 0.0f || im[j] != 0.0f)
+                c->active[input * c->n_pairs + pair] = true;
+        }
+
+        fft(c, re, im, false);
+    }
+}
+
+static void process_block(pa_convolver *c) {
+    const float scale = 1.0f / c->fft_size;
+    unsigned in, pair, p, j;
+
+    for (in = 0; in < c->n_inputs; in++) {
+        float *x = c->block_input + in * c->fft_size;
+        float *x_re = c->fdl_re + (in * c->n_partitions + c->fdl_pos) * c->fft_size;
+        float *x_im = c->fdl_im + (in * c->n_partitions + c->fdl_pos) * c->fft_size;
+
+        memcpy(x_re, x, c->fft_size * sizeof(float));
+        memset(x_im, 0, c->fft_size * sizeof(float));
+        fft(c, x_re, x_im, false);
+
+        /* The input of this block is the first half of the next one */
+        memcpy(x, x + c->partition_size, c->partition_size * sizeof(float));
+    }
+
+    for (pair = 0; pair < c->n_pairs; pair++) {
+        memset(c->acc_re, 0, c->fft_size * sizeof(float));
+        memset(c->acc_im, 0, c->fft_size * sizeof(float));
+
+        for (in = 0; in < c->n_inputs; in++) {
+            if (!c->active[in * c->n_pairs + pair])
+                continue;
+
+            for (p = 0; p < c->n_partitions; p++) {
+                unsigned slot = (c->fdl_pos + p) % c->n_partitions;
+                unsigned h = ((in * c->n_pairs + pair) * c->n_partitions + p) * c->fft_size;
+                unsigned x = (in * c->n_partitions + slot) * c->fft_size;
+
+                complex_mac(c->acc_re, c->acc_im, c->fdl_re + x, c->fdl_im + x, c->filter_re + h, c->filter_im + h, c->fft_size);
+            }
+        }
+
+        fft(c, c->acc_re, c->acc_im, true);
+
+        for (j = 0; j < c->partition_size; j++) {
+            c->block_output[j * c->n_outputs + 2 * pair] = c->acc_re[c->partition_size + j] * scale;
+            if (2 * pair + 1 < c->n_outputs)
+                c->block_output[j * c->n_outputs + 2 * pair + 1] = c->acc_im[c->partition_size + j] * scale;
+        }
+    }
+
+    /* The oldest slot receives the next block */
+    c->fdl_pos = (c->fdl_pos + c->n_partitions - 1) % c->n_partitions;
+}
+
+/* dst may be NULL if the output is not needed */
+static void run(pa_convolver *c, const float *src, float *dst, unsigned n_frames) {
+    unsigned l, k;
+
+    for (l = 0; l < n_frames; l++) {
+        for (k = 0; k < c->n_inputs; k++)
+            c->block_input[k * c->fft_size + c->partition_size + c->block_pos] = src[l * c->n_inputs + k];
+
+        if (dst)
+            memcpy(dst + l * c->n_outputs, c->block_output + c->block_pos * c->n_outputs, c->n_outputs * sizeof(float));
+
+        if (++c->block_pos >= c->partition_size) {
+            process_block(c);
+            c->block_pos = 0;
+        }
+    }
+}
+
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n_frames) {
+    pa_assert(c);
+    pa_assert(src);
+    pa_assert(dst);
+
+    run(c, src, dst, n_frames);
+}
+
+void pa_convolver_reset(pa_convolver *c) {
+    pa_assert(c);
+
+    memset(c->fdl_re, 0, c->n_inputs * c->n_partitions * c->fft_size * sizeof(float));
+    memset(c->fdl_im, 0, c->n_inputs * c->n_partitions * c->fft_size * sizeof(float));
+    memset(c->block_input, 0, c->n_inputs * c->fft_size * sizeof(float));
+    memset(c->block_output, 0, c->n_outputs * c->partition_size * sizeof(float));
+    c->fdl_pos = 0;
+    c->block_pos = 0;
+}
+
+void pa_convolver_rewind(pa_convolver *c, const float *history, unsigned n_frames) {
+    unsigned skip;
+
+    pa_assert(c);
+    pa_assert(history || n_frames == 0);
+
+    pa_convolver_reset(c);
+
+    /* Older input doesn't contribute to the output any more */
+    skip = n_frames > pa_convolver_get_history(c) ? n_frames - pa_convolver_get_history(c) : 0;
+
+    run(c, history + skip * c->n_inputs, NULL, n_frames - skip);
+}
+
+unsigned pa_convolver_get_history(pa_convolver *c) {
+    pa_assert(c);
+
+    return c->max_ir_length + c->partition_size - 1;
+}
+
+unsigned pa_convolver_get_latency(pa_convolver *c) {
+    pa_assert(c);
+
+    return c->partition_size;
+}
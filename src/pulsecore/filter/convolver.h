@@ -0,0 +1,60 @@
+#ifndef fooconvolverhfoo
+#define fooconvolverhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+
+/* Multi-channel FIR filter based on uniformly partitioned overlap-save FFT
+ * convolution. Every output channel is the sum of all input channels, each
+ * convolved with its own impulse response; impulse responses that are never
+ * set are treated as zero and cost nothing.
+ *
+ * The samples are interleaved float. The output lags the input by
+ * partition_size frames, independent of the length of the impulse
+ * responses. */
+
+typedef struct pa_convolver pa_convolver;
+
+/* partition_size must be a power of two. Impulse responses are cut off after
+ * max_ir_length samples. */
+pa_convolver *pa_convolver_new(unsigned n_inputs, unsigned n_outputs, unsigned partition_size, unsigned max_ir_length);
+void pa_convolver_free(pa_convolver *c);
+
+/* Set the impulse response from input to output. This does not change the
+ * filter history, so it can also be used for updating a running filter. */
+void pa_convolver_set_ir(pa_convolver *c, unsigned input, unsigned output, const float *ir, unsigned length);
+
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n_frames);
+
+/* Clear the filter history, as if only silence had been processed */
+void pa_convolver_reset(pa_convolver *c);
+
+/* Rebuild the filter state after a rewind from the n_frames input frames
+ * that precede the new position. With pa_convolver_get_history() frames
+ * the output continues as if there had been no rewind, less history
+ * (including none at all) is taken to be preceded by silence. */
+void pa_convolver_rewind(pa_convolver *c, const float *history, unsigned n_frames);
+
+/* Number of input frames needed by pa_convolver_rewind() */
+unsigned pa_convolver_get_history(pa_convolver *c);
+
+/* Delay of the output in frames */
+unsigned pa_convolver_get_latency(pa_convolver *c);
+
+#endif
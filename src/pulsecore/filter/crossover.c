@@ -7,76 +7,196 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <pulsecore/macro.h>
 
 #include "crossover.h"
 
-void lr4_set(struct lr4 *lr4, enum biquad_type type, float freq)
+#if defined(__SSE__)
+#include <xmmintrin.h>
+typedef __m128 lr4_vec;
+#define VEC_LOAD(p) _mm_loadu_ps(p)
+#define VEC_STORE(p, v) _mm_storeu_ps(p, v)
+#define VEC_ADD(a, b) _mm_add_ps(a, b)
+#define VEC_SUB(a, b) _mm_sub_ps(a, b)
+#define VEC_MUL(a, b) _mm_mul_ps(a, b)
+#define VEC_SET(a, b, c, d) _mm_setr_ps(a, b, c, d)
+#define VEC_LANE(v, k) _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(k, k, k, k)))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+typedef float32x4_t lr4_vec;
+#define VEC_LOAD(p) vld1q_f32(p)
+#define VEC_STORE(p, v) vst1q_f32(p, v)
+#define VEC_ADD(a, b) vaddq_f32(a, b)
+#define VEC_SUB(a, b) vsubq_f32(a, b)
+#define VEC_MUL(a, b) vmulq_f32(a, b)
+#define VEC_SET(a, b, c, d) ((float32x4_t) { a, b, c, d })
+#define VEC_LANE(v, k) vgetq_lane_f32(v, k)
+#endif
+
+void lr4_bank_init(struct lr4_bank *bank, int channels)
+{
+	pa_assert(channels > 0 && channels <= PA_CHANNELS_MAX);
+
+	memset(bank, 0, sizeof(*bank));
+	bank->channels = channels;
+	bank->stride = PA_ROUND_UP(channels, LR4_BANK_WIDTH);
+}
+
+void lr4_bank_set(struct lr4_bank *bank, int channel, enum biquad_type type, float freq)
+{
+	struct lr4_bank_state *st = &bank->state;
+	struct biquad bq;
+
+	pa_assert(channel >= 0 && channel < bank->channels);
+
+	biquad_set(&bq, type, freq);
+	bank->b0[channel] = bq.b0;
+	bank->b1[channel] = bq.b1;
+	bank->b2[channel] = bq.b2;
+	bank->a1[channel] = bq.a1;
+	bank->a2[channel] = bq.a2;
+
+	st->x1[channel] = st->x2[channel] = 0;
+	st->y1[channel] = st->y2[channel] = 0;
+	st->z1[channel] = st->z2[channel] = 0;
+}
+
+size_t lr4_bank_trail_size(const struct lr4_bank *bank, int frames)
+{
+	return (size_t) frames * 3 * bank->stride;
+}
+
+#ifdef VEC_LOAD
+
+/* Channels c to c + n - 1 of a frame, n <= LR4_BANK_WIDTH. Partial vectors
+ * are assembled lane by lane so nothing outside the frame is touched. */
+static inline float lane_in(const float *f, const short *s, int n, int k)
+{
+	if (k >= n)
+		return 0;
+
+	return f ? f[k] : s[k];
+}
+
+static inline lr4_vec load_lanes(const float *f, const short *s, int n)
 {
-	biquad_set(&lr4->bq, type, freq);
-	lr4->x1 = 0;
-	lr4->x2 = 0;
-	lr4->y1 = 0;
-	lr4->y2 = 0;
-	lr4->z1 = 0;
-	lr4->z2 = 0;
+	if (f && n == LR4_BANK_WIDTH)
+		return VEC_LOAD(f);
+
+	return VEC_SET(lane_in(f, s, n, 0), lane_in(f, s, n, 1),
+		       lane_in(f, s, n, 2), lane_in(f, s, n, 3));
 }
 
-void lr4_process_float32(struct lr4 *lr4, int samples, int channels, float *src, float *dest)
+static inline void lane_out(float *f, short *s, int n, int k, float v)
 {
-	float lx1 = lr4->x1;
-	float lx2 = lr4->x2;
-	float ly1 = lr4->y1;
-	float ly2 = lr4->y2;
-	float lz1 = lr4->z1;
-	float lz2 = lr4->z2;
-	float lb0 = lr4->bq.b0;
-	float lb1 = lr4->bq.b1;
-	float lb2 = lr4->bq.b2;
-	float la1 = lr4->bq.a1;
-	float la2 = lr4->bq.a2;
+	if (k >= n)
+		return;
+
+	if (f)
+		f[k] = v;
+	else
+		s[k] = PA_CLAMP_UNLIKELY((int) v, -0x8000, 0x7fff);
+}
+
+static inline void store_lanes(float *f, short *s, int n, lr4_vec v)
+{
+	if (f && n == LR4_BANK_WIDTH) {
+		VEC_STORE(f, v);
+		return;
+	}
 
+	lane_out(f, s, n, 0, VEC_LANE(v, 0));
+	lane_out(f, s, n, 1, VEC_LANE(v, 1));
+	lane_out(f, s, n, 2, VEC_LANE(v, 2));
+	lane_out(f, s, n, 3, VEC_LANE(v, 3));
+}
+
+/* Run LR4_BANK_WIDTH channels starting at c over all frames, keeping the
+ * filter history in registers. The expressions are evaluated in the same
+ * order as in the scalar version. */
+static void process_vec(struct lr4_bank *bank, int c, int frames, float *fdata, short *sdata, float *trail)
+{
+	struct lr4_bank_state *st = &bank->state;
+	int n = PA_MIN(bank->channels - c, LR4_BANK_WIDTH);
+	int step = 3 * bank->stride;
+	lr4_vec x1 = VEC_LOAD(st->x1 + c), x2 = VEC_LOAD(st->x2 + c);
+	lr4_vec y1 = VEC_LOAD(st->y1 + c), y2 = VEC_LOAD(st->y2 + c);
+	lr4_vec z1 = VEC_LOAD(st->z1 + c), z2 = VEC_LOAD(st->z2 + c);
+	lr4_vec b0 = VEC_LOAD(bank->b0 + c), b1 = VEC_LOAD(bank->b1 + c);
+	lr4_vec b2 = VEC_LOAD(bank->b2 + c);
+	lr4_vec a1 = VEC_LOAD(bank->a1 + c), a2 = VEC_LOAD(bank->a2 + c);
+	float *f = fdata ? fdata + c : NULL;
+	short *s = sdata ? sdata + c : NULL;
 	int i;
-	for (i = 0; i < samples * channels; i += channels) {
-		float x, y, z;
-		x = src[i];
-		y = lb0*x + lb1*lx1 + lb2*lx2 - la1*ly1 - la2*ly2;
-		z = lb0*y + lb1*ly1 + lb2*ly2 - la1*lz1 - la2*lz2;
-		lx2 = lx1;
-		lx1 = x;
-		ly2 = ly1;
-		ly1 = y;
-		lz2 = lz1;
-		lz1 = z;
-		dest[i] = z;
+
+	for (i = 0; i < frames; i++) {
+		lr4_vec x, y, z;
+
+		x = load_lanes(f, s, n);
+
+		y = VEC_ADD(VEC_MUL(b0, x), VEC_MUL(b1, x1));
+		y = VEC_ADD(y, VEC_MUL(b2, x2));
+		y = VEC_SUB(y, VEC_MUL(a1, y1));
+		y = VEC_SUB(y, VEC_MUL(a2, y2));
+
+		z = VEC_ADD(VEC_MUL(b0, y), VEC_MUL(b1, y1));
+		z = VEC_ADD(z, VEC_MUL(b2, y2));
+		z = VEC_SUB(z, VEC_MUL(a1, z1));
+		z = VEC_SUB(z, VEC_MUL(a2, z2));
+
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		z2 = z1;
+		z1 = z;
+
+		store_lanes(f, s, n, z);
+
+		if (trail) {
+			VEC_STORE(trail + c, x);
+			VEC_STORE(trail + bank->stride + c, y);
+			VEC_STORE(trail + 2 * bank->stride + c, z);
+			trail += step;
+		}
+
+		if (f)
+			f += bank->channels;
+		else
+			s += bank->channels;
 	}
 
-	lr4->x1 = lx1;
-	lr4->x2 = lx2;
-	lr4->y1 = ly1;
-	lr4->y2 = ly2;
-	lr4->z1 = lz1;
-	lr4->z2 = lz2;
+	VEC_STORE(st->x1 + c, x1);
+	VEC_STORE(st->x2 + c, x2);
+	VEC_STORE(st->y1 + c, y1);
+	VEC_STORE(st->y2 + c, y2);
+	VEC_STORE(st->z1 + c, z1);
+	VEC_STORE(st->z2 + c, z2);
 }
 
-void lr4_process_s16(struct lr4 *lr4, int samples, int channels, short *src, short *dest)
+#endif
+
+static void process_one(struct lr4_bank *bank, int c, int frames, float *fdata, short *sdata, float *trail)
 {
-	float lx1 = lr4->x1;
-	float lx2 = lr4->x2;
-	float ly1 = lr4->y1;
-	float ly2 = lr4->y2;
-	float lz1 = lr4->z1;
-	float lz2 = lr4->z2;
-	float lb0 = lr4->bq.b0;
-	float lb1 = lr4->bq.b1;
-	float lb2 = lr4->bq.b2;
-	float la1 = lr4->bq.a1;
-	float la2 = lr4->bq.a2;
+	struct lr4_bank_state *st = &bank->state;
+	float lx1 = st->x1[c];
+	float lx2 = st->x2[c];
+	float ly1 = st->y1[c];
+	float ly2 = st->y2[c];
+	float lz1 = st->z1[c];
+	float lz2 = st->z2[c];
+	float lb0 = bank->b0[c];
+	float lb1 = bank->b1[c];
+	float lb2 = bank->b2[c];
+	float la1 = bank->a1[c];
+	float la2 = bank->a2[c];
 
-	int i;
-	for (i = 0; i < samples * channels; i += channels) {
+	int i, j;
+	for (i = 0, j = c; i < frames; i++, j += bank->channels) {
 		float x, y, z;
-		x = src[i];
+		x = fdata ? fdata[j] : sdata[j];
 		y = lb0*x + lb1*lx1 + lb2*lx2 - la1*ly1 - la2*ly2;
 		z = lb0*y + lb1*ly1 + lb2*ly2 - la1*lz1 - la2*lz2;
 		lx2 = lx1;
@@ -85,13 +205,76 @@ void lr4_process_s16(struct lr4 *lr4, int samples, int channels, short *src, sho
 		ly1 = y;
 		lz2 = lz1;
 		lz1 = z;
-		dest[i] = PA_CLAMP_UNLIKELY((int) z, -0x8000, 0x7fff);
+		if (fdata)
+			fdata[j] = z;
+		else
+			sdata[j] = PA_CLAMP_UNLIKELY((int) z, -0x8000, 0x7fff);
+
+		if (trail) {
+			float *t = trail + (size_t) i * 3 * bank->stride + c;
+			t[0] = x;
+			t[bank->stride] = y;
+			t[2 * bank->stride] = z;
+		}
 	}
 
-	lr4->x1 = lx1;
-	lr4->x2 = lx2;
-	lr4->y1 = ly1;
-	lr4->y2 = ly2;
-	lr4->z1 = lz1;
-	lr4->z2 = lz2;
+	st->x1[c] = lx1;
+	st->x2[c] = lx2;
+	st->y1[c] = ly1;
+	st->y2[c] = ly2;
+	st->z1[c] = lz1;
+	st->z2[c] = lz2;
+}
+
+static void process(struct lr4_bank *bank, int frames, float *fdata, short *sdata, float *trail)
+{
+	int c = 0;
+
+#ifdef VEC_LOAD
+	/* A single channel is faster with plain scalar code */
+	if (bank->channels > 1)
+		for (; c < bank->channels; c += LR4_BANK_WIDTH)
+			process_vec(bank, c, frames, fdata, sdata, trail);
+#endif
+
+	for (; c < bank->channels; c++)
+		process_one(bank, c, frames, fdata, sdata, trail);
+}
+
+void lr4_bank_process_float32(struct lr4_bank *bank, int frames, float *data, float *trail)
+{
+	process(bank, frames, data, NULL, trail);
+}
+
+void lr4_bank_process_s16(struct lr4_bank *bank, int frames, short *data, float *trail)
+{
+	process(bank, frames, NULL, data, trail);
+}
+
+void lr4_bank_restore(struct lr4_bank *bank, const struct lr4_bank_state *start, const float *trail, int frames)
+{
+	struct lr4_bank_state *st = &bank->state;
+	size_t len = bank->stride * sizeof(float);
+	const float *t1, *t2;
+
+	if (frames <= 0) {
+		*st = *start;
+		return;
+	}
+
+	t1 = trail + (size_t) (frames - 1) * 3 * bank->stride;
+	memcpy(st->x1, t1, len);
+	memcpy(st->y1, t1 + bank->stride, len);
+	memcpy(st->z1, t1 + 2 * bank->stride, len);
+
+	if (frames >= 2) {
+		t2 = t1 - 3 * bank->stride;
+		memcpy(st->x2, t2, len);
+		memcpy(st->y2, t2 + bank->stride, len);
+		memcpy(st->z2, t2 + 2 * bank->stride, len);
+	} else {
+		memcpy(st->x2, start->x1, len);
+		memcpy(st->y2, start->y1, len);
+		memcpy(st->z2, start->z1, len);
+	}
 }
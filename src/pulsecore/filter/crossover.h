@@ -6,6 +6,8 @@
 #ifndef CROSSOVER_H_
 #define CROSSOVER_H_
 
+#include <pulse/sample.h>
+
 #include "biquad.h"
 /* An LR4 filter is two biquads with the same parameters connected in series:
  *
@@ -13,17 +15,42 @@
  *
  * Both biquad filter has the same parameter b[012] and a[12],
  * The variable [xyz][12] keep the history values.
+ *
+ * The filters of all channels of a stream are kept in a bank and run over
+ * interleaved frames together, LR4_BANK_WIDTH channels at a time. Each
+ * parameter and history value is an array indexed by channel, padded to a
+ * multiple of LR4_BANK_WIDTH; the padding channels have all-zero
+ * parameters.
  */
-struct lr4 {
-	struct biquad bq;
-	float x1, x2;
-	float y1, y2;
-	float z1, z2;
+#define LR4_BANK_WIDTH 4
+
+struct lr4_bank_state {
+	float x1[PA_CHANNELS_MAX], x2[PA_CHANNELS_MAX];
+	float y1[PA_CHANNELS_MAX], y2[PA_CHANNELS_MAX];
+	float z1[PA_CHANNELS_MAX], z2[PA_CHANNELS_MAX];
 };
 
-void lr4_set(struct lr4 *lr4, enum biquad_type type, float freq);
+struct lr4_bank {
+	int channels;
+	int stride;
+	float b0[PA_CHANNELS_MAX], b1[PA_CHANNELS_MAX], b2[PA_CHANNELS_MAX];
+	float a1[PA_CHANNELS_MAX], a2[PA_CHANNELS_MAX];
+	struct lr4_bank_state state;
+};
+
+void lr4_bank_init(struct lr4_bank *bank, int channels);
+void lr4_bank_set(struct lr4_bank *bank, int channel, enum biquad_type type, float freq);
+
+/* The process functions filter data in place. If trail is not NULL, the
+ * x, y and z values of every frame are stored there, which takes
+ * lr4_bank_trail_size() floats for the given number of frames. Together
+ * with the state from before the call, lr4_bank_restore() can then
+ * recreate the state after any of these frames without filtering again. */
+size_t lr4_bank_trail_size(const struct lr4_bank *bank, int frames);
+
+void lr4_bank_process_float32(struct lr4_bank *bank, int frames, float *data, float *trail);
+void lr4_bank_process_s16(struct lr4_bank *bank, int frames, short *data, float *trail);
 
-void lr4_process_float32(struct lr4 *lr4, int samples, int channels, float *src, float *dest);
-void lr4_process_s16(struct lr4 *lr4, int samples, int channels, short *src, short *dest);
+void lr4_bank_restore(struct lr4_bank *bank, const struct lr4_bank_state *start, const float *trail, int frames);
 
 #endif /* CROSSOVER_H_ */
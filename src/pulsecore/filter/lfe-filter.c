@@ -28,11 +28,14 @@
 #include <pulsecore/filter/biquad.h>
 #include <pulsecore/filter/crossover.h>
 
+/* The filter state before a processed block, plus the trail of filter values
+ * within the block, so any position in it can be restored on rewind. */
 struct saved_state {
     PA_LLIST_FIELDS(struct saved_state);
-    pa_memchunk chunk;
     int64_t index;
-    struct lr4 lr4[PA_CHANNELS_MAX];
+    int64_t frames;
+    float *trail;
+    struct lr4_bank_state state;
 };
 
 PA_STATIC_FLIST_DECLARE(lfe_state, 0, pa_xfree);
@@ -53,12 +56,12 @@ struct pa_lfe_filter {
     pa_sample_spec ss;
     size_t maxrewind;
     bool active;
-    struct lr4 lr4[PA_CHANNELS_MAX];
+    struct lr4_bank bank;
 };
 
 static void remove_state(pa_lfe_filter_t *f, struct saved_state *s) {
     PA_LLIST_REMOVE(struct saved_state, f->saved, s);
-    pa_memblock_unref(s->chunk.memblock);
+    pa_xfree(s->trail);
     pa_xfree(s);
 }
 
@@ -84,42 +87,34 @@ void pa_lfe_filter_reset(pa_lfe_filter_t *f) {
     pa_lfe_filter_update_rate(f, f->ss.rate);
 }
 
-static void process_block(pa_lfe_filter_t *f, pa_memchunk *buf, bool store_result) {
+static void process_block(pa_lfe_filter_t *f, pa_memchunk *buf, float *trail) {
     int samples = buf->length / pa_frame_size(&f->ss);
 
-    void *garbage = store_result ? NULL : pa_xmalloc(buf->length);
-
     if (f->ss.format == PA_SAMPLE_FLOAT32NE) {
-        int i;
         float *data = pa_memblock_acquire_chunk(buf);
-        for (i = 0; i < f->cm.channels; i++)
-            lr4_process_float32(&f->lr4[i], samples, f->cm.channels, &data[i], garbage ? garbage : &data[i]);
+        lr4_bank_process_float32(&f->bank, samples, data, trail);
         pa_memblock_release(buf->memblock);
     }
     else if (f->ss.format == PA_SAMPLE_S16NE) {
-        int i;
         short *data = pa_memblock_acquire_chunk(buf);
-        for (i = 0; i < f->cm.channels; i++)
-            lr4_process_s16(&f->lr4[i], samples, f->cm.channels, &data[i], garbage ? garbage : &data[i]);
+        lr4_bank_process_s16(&f->bank, samples, data, trail);
         pa_memblock_release(buf->memblock);
     }
     else pa_assert_not_reached();
 
-    pa_xfree(garbage);
     f->index += samples;
 }
 
 pa_memchunk * pa_lfe_filter_process(pa_lfe_filter_t *f, pa_memchunk *buf) {
-    pa_mempool *pool;
     struct saved_state *s, *s2;
-    void *data;
+    int64_t frames;
 
     if (!f->active || !buf->length)
         return buf;
 
     /* Remove old states (FIXME: we could do better than searching the entire array here?) */
     PA_LLIST_FOREACH_SAFE(s, s2, f->saved)
-        if (s->index + (int64_t) (s->chunk.length / pa_frame_size(&f->ss) + f->maxrewind) < f->index)
+        if (s->index + s->frames + (int64_t) f->maxrewind < f->index)
             remove_state(f, s);
 
     /* Insert our existing state into the flist */
@@ -127,21 +122,14 @@ pa_memchunk * pa_lfe_filter_process(pa_lfe_filter_t *f, pa_memchunk *buf) {
         s = pa_xnew(struct saved_state, 1);
     PA_LLIST_INIT(struct saved_state, s);
 
-    /* TODO: This actually memcpys the entire chunk into a new allocation, because we need to retain the original
-       in case of rewinding. Investigate whether this can be avoided. */
-    data = pa_memblock_acquire_chunk(buf);
-    pool = pa_memblock_get_pool(buf->memblock);
-    s->chunk.memblock = pa_memblock_new_malloced(pool, pa_xmemdup(data, buf->length), buf->length);
-    s->chunk.length = buf->length;
-    s->chunk.index = 0;
-    pa_memblock_release(buf->memblock);
-    pa_mempool_unref(pool), pool = NULL;
-
+    frames = buf->length / pa_frame_size(&f->ss);
     s->index = f->index;
-    memcpy(s->lr4, f->lr4, sizeof(struct lr4) * f->cm.channels);
+    s->frames = frames;
+    s->trail = pa_xnew(float, lr4_bank_trail_size(&f->bank, frames));
+    s->state = f->bank.state;
     PA_LLIST_PREPEND(struct saved_state, f->saved, s);
 
-    process_block(f, buf, true);
+    process_block(f, buf, s->trail);
     return buf;
 }
 
@@ -160,14 +148,15 @@ void pa_lfe_filter_update_rate(pa_lfe_filter_t *f, uint32_t new_rate) {
         return;
     }
 
+    lr4_bank_init(&f->bank, f->cm.channels);
     for (i = 0; i < f->cm.channels; i++)
-        lr4_set(&f->lr4[i], f->cm.map[i] == PA_CHANNEL_POSITION_LFE ? BQ_LOWPASS : BQ_HIGHPASS, biquad_freq);
+        lr4_bank_set(&f->bank, i, f->cm.map[i] == PA_CHANNEL_POSITION_LFE ? BQ_LOWPASS : BQ_HIGHPASS, biquad_freq);
 
     f->active = true;
 }
 
 void pa_lfe_filter_rewind(pa_lfe_filter_t *f, size_t amount) {
-    struct saved_state *i, *s = NULL;
+    struct saved_state *i, *i2, *s = NULL;
     size_t samples = amount / pa_frame_size(&f->ss);
     f->index -= samples;
 
@@ -185,17 +174,21 @@ void pa_lfe_filter_rewind(pa_lfe_filter_t *f, size_t amount) {
     }
     pa_log_debug("Rewinding LFE filter %zu samples to position %lli. Found saved state at position %lli",
         samples, (long long) f->index, (long long) s->index);
-    memcpy(f->lr4, s->lr4, sizeof(struct lr4) * f->cm.channels);
-
-    /* now fast forward to the actual position */
-    if (f->index > s->index) {
-        pa_memchunk x = s->chunk;
-        x.length = (f->index - s->index) * pa_frame_size(&f->ss);
-        if (x.length > s->chunk.length) {
-            pa_log_error("Hole in stream, cannot fast forward LFE filter");
-            return;
-        }
-        f->index = s->index;
-        process_block(f, &x, false);
+
+    if (f->index - s->index > s->frames) {
+        pa_log_error("Hole in stream, cannot restore LFE filter state");
+        return;
+    }
+
+    /* The trail holds the filter values after every frame of the block, so
+     * there is no need to run the filter over the data again */
+    lr4_bank_restore(&f->bank, &s->state, s->trail, f->index - s->index);
+
+    /* Everything after the new position is going to be rendered again */
+    PA_LLIST_FOREACH_SAFE(i, i2, f->saved) {
+        if (i->index >= f->index)
+            remove_state(f, i);
+        else if (i->index + i->frames > f->index)
+            i->frames = f->index - i->index;
     }
 }
@@ -74,11 +74,11 @@ static pa_flist_elem *stack_pop(pa_flist *flist, pa_atomic_t *list) {
     pa_assert(list);
 
     do {
-        idx = pa_atomic_load(list);
+        idx = pa_atomic_load_acquire(list);
         if (idx < 0)
             return NULL;
         popped = &flist->table[idx & flist->index_mask];
-    } while (!pa_atomic_cmpxchg(list, idx, pa_atomic_load(&popped->next)));
+    } while (!pa_atomic_cmpxchg(list, idx, pa_atomic_load_relaxed(&popped->next)));
 
     return popped;
 }
@@ -88,14 +88,14 @@ static void stack_push(pa_flist *flist, pa_atomic_t *list, pa_flist_elem *new_el
     int tag, newindex, next;
     pa_assert(list);
 
-    tag = pa_atomic_inc(&flist->current_tag);
+    tag = pa_atomic_inc_relaxed(&flist->current_tag);
     newindex = new_elem - flist->table;
     pa_assert(newindex >= 0 && newindex < (int) flist->size);
     newindex |= (tag << flist->tag_shift) & flist->tag_mask;
 
     do {
-        next = pa_atomic_load(list);
-        pa_atomic_store(&new_elem->next, next);
+        next = pa_atomic_load_relaxed(list);
+        pa_atomic_store_relaxed(&new_elem->next, next);
     } while (!pa_atomic_cmpxchg(list, next, newindex));
 }
 
@@ -154,7 +154,7 @@ int pa_flist_push(pa_flist *l, void *p) {
             pa_log_debug("%s flist is full (don't worry)", l->name);
         return -1;
     }
-    pa_atomic_ptr_store(&elem->ptr, p);
+    pa_atomic_ptr_store_relaxed(&elem->ptr, p);
     stack_push(l, &l->stored, elem);
 
     return 0;
@@ -169,7 +169,7 @@ void* pa_flist_pop(pa_flist *l) {
     if (elem == NULL)
         return NULL;
 
-    ptr = pa_atomic_ptr_load(&elem->ptr);
+    ptr = pa_atomic_ptr_load_relaxed(&elem->ptr);
 
     stack_push(l, &l->empty, elem);
 
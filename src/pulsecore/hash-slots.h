@@ -0,0 +1,122 @@
+#ifndef foopulsecorehashslotshfoo
+#define foopulsecorehashslotshfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/macro.h>
+
+/* Open addressing hash table with linear probing, shared by pa_hashmap and
+ * pa_idxset. The table doesn't store the entries itself, only their
+ * positions in a separate dense array, together with the full hash value so
+ * that most mismatches are rejected without touching the entry. The table
+ * has 1 << bits slots and the lowest bits of the hash value select the home
+ * slot. The caller keeps the load below 3/4 and does the key comparison.
+ * Deletion shifts the following slots back, so there are no tombstones. */
+
+#define PA_HASH_SLOT_EMPTY ((uint32_t) -1)
+
+typedef struct pa_hash_slot {
+    uint32_t position;
+    unsigned hash;
+} pa_hash_slot;
+
+/* Maximum number of entries for a table of 1 << bits slots */
+#define PA_HASH_SLOTS_CAPACITY(bits) ((3U << (bits)) / 4)
+
+/* Spread the bits of a hash value over its lowest bits, which select the
+ * home slot. This is the finalizer of MurmurHash3, a bijection, so distinct
+ * values stay distinct. Values that are already well distributed in their
+ * lowest bits, like sequential numbers, can be used directly. */
+static inline unsigned pa_hash_mix(unsigned hash) {
+    uint32_t h = (uint32_t) hash;
+
+    h ^= h >> 16;
+    h *= UINT32_C(0x85ebca6b);
+    h ^= h >> 13;
+    h *= UINT32_C(0xc2b2ae35);
+    h ^= h >> 16;
+
+    return (unsigned) h;
+}
+
+static inline unsigned pa_hash_slot_home(unsigned hash, unsigned bits) {
+    return hash & ((1U << bits) - 1);
+}
+
+static inline unsigned pa_hash_slot_next(unsigned slot, unsigned bits) {
+    return (slot + 1) & ((1U << bits) - 1);
+}
+
+static inline void pa_hash_slots_clear(pa_hash_slot *slots, unsigned bits) {
+    memset(slots, 0xFF, sizeof(pa_hash_slot) << bits);
+}
+
+static inline pa_hash_slot *pa_hash_slots_new(unsigned bits) {
+    pa_hash_slot *slots;
+
+    pa_assert(bits > 0 && bits < 32);
+
+    slots = pa_xnew(pa_hash_slot, 1U << bits);
+    pa_hash_slots_clear(slots, bits);
+
+    return slots;
+}
+
+static inline void pa_hash_slots_insert(pa_hash_slot *slots, unsigned bits, unsigned hash, uint32_t position) {
+    unsigned i;
+
+    for (i = pa_hash_slot_home(hash, bits); slots[i].position != PA_HASH_SLOT_EMPTY; i = pa_hash_slot_next(i, bits))
+        ;
+
+    slots[i].position = position;
+    slots[i].hash = hash;
+}
+
+/* Return the slot referring to the given position, which must be stored in
+ * the table with the given hash */
+static inline unsigned pa_hash_slots_find_position(const pa_hash_slot *slots, unsigned bits, unsigned hash, uint32_t position) {
+    unsigned i;
+
+    for (i = pa_hash_slot_home(hash, bits); slots[i].position != position; i = pa_hash_slot_next(i, bits))
+        pa_assert(slots[i].position != PA_HASH_SLOT_EMPTY);
+
+    return i;
+}
+
+static inline void pa_hash_slots_remove(pa_hash_slot *slots, unsigned bits, unsigned slot) {
+    unsigned mask = (1U << bits) - 1, i, home;
+
+    for (i = pa_hash_slot_next(slot, bits); slots[i].position != PA_HASH_SLOT_EMPTY; i = pa_hash_slot_next(i, bits)) {
+        home = pa_hash_slot_home(slots[i].hash, bits);
+
+        /* The slot may move into the gap only if the gap lies between its
+         * home and its current place, otherwise lookups would miss it */
+        if (((i - home) & mask) >= ((i - slot) & mask)) {
+            slots[slot] = slots[i];
+            slot = i;
+        }
+    }
+
+    slots[slot].position = PA_HASH_SLOT_EMPTY;
+}
+
+#endif
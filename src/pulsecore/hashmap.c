@@ -25,19 +25,25 @@
 
 #include <pulse/xmalloc.h>
 #include <pulsecore/idxset.h>
-#include <pulsecore/flist.h>
+#include <pulsecore/hash-slots.h>
 #include <pulsecore/macro.h>
 
 #include "hashmap.h"
 
-#define NBUCKETS 127
+#define MIN_BITS 3
+
+#define NO_SLOT ((unsigned) -1)
+
+/* Iteration states are positions in the entry array, offset by one so that
+ * NULL can still mean "start" */
+#define POSITION_TO_STATE(p) PA_UINT_TO_PTR((p) + 1)
+#define STATE_TO_POSITION(s) (PA_PTR_TO_UINT(s) - 1)
 
 struct hashmap_entry {
     void *key;
     void *value;
-
-    struct hashmap_entry *bucket_next, *bucket_previous;
-    struct hashmap_entry *iterate_next, *iterate_previous;
+    unsigned hash;
+    bool removed;
 };
 
 struct pa_hashmap {
@@ -47,18 +53,23 @@ struct pa_hashmap {
     pa_free_cb_t key_free_func;
     pa_free_cb_t value_free_func;
 
-    struct hashmap_entry *iterate_list_head, *iterate_list_tail;
-    unsigned n_entries;
-};
+    /* The entries in insertion order. Removed entries stay in place until
+     * the array is compacted when it runs full, so positions don't change
+     * while iterating. All entries before first and from n_used on are
+     * removed ones. */
+    struct hashmap_entry *entries;
+    unsigned first, n_used;
 
-#define BY_HASH(h) ((struct hashmap_entry**) ((uint8_t*) (h) + PA_ALIGN(sizeof(pa_hashmap))))
+    pa_hash_slot *slots;
+    unsigned bits;
 
-PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
+    unsigned n_entries;
+};
 
 pa_hashmap *pa_hashmap_new_full(pa_hash_func_t hash_func, pa_compare_func_t compare_func, pa_free_cb_t key_free_func, pa_free_cb_t value_free_func) {
     pa_hashmap *h;
 
-    h = pa_xmalloc0(PA_ALIGN(sizeof(pa_hashmap)) + NBUCKETS*sizeof(struct hashmap_entry*));
+    h = pa_xnew0(pa_hashmap, 1);
 
     h->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     h->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
@@ -66,8 +77,11 @@ pa_hashmap *pa_hashmap_new_full(pa_hash_func_t hash_func, pa_compare_func_t comp
     h->key_free_func = key_free_func;
     h->value_free_func = value_free_func;
 
-    h->n_entries = 0;
-    h->iterate_list_head = h->iterate_list_tail = NULL;
+    /* The tables are allocated with the first entry */
+    h->entries = NULL;
+    h->slots = NULL;
+    h->bits = 0;
+    h->first = h->n_used = h->n_entries = 0;
 
     return h;
 }
@@ -76,59 +90,90 @@ pa_hashmap *pa_hashmap_new(pa_hash_func_t hash_func, pa_compare_func_t compare_f
     return pa_hashmap_new_full(hash_func, compare_func, NULL, NULL);
 }
 
-static void remove_entry(pa_hashmap *h, struct hashmap_entry *e) {
+static void remove_entry(pa_hashmap *h, unsigned slot) {
+    struct hashmap_entry *e;
+    void *key;
+
     pa_assert(h);
-    pa_assert(e);
+    pa_assert(slot != NO_SLOT);
 
-    /* Remove from iteration list */
-    if (e->iterate_next)
-        e->iterate_next->iterate_previous = e->iterate_previous;
-    else
-        h->iterate_list_tail = e->iterate_previous;
+    e = &h->entries[h->slots[slot].position];
+    key = e->key;
 
-    if (e->iterate_previous)
-        e->iterate_previous->iterate_next = e->iterate_next;
-    else
-        h->iterate_list_head = e->iterate_next;
+    pa_hash_slots_remove(h->slots, h->bits, slot);
+    e->removed = true;
 
-    /* Remove from hash table bucket list */
-    if (e->bucket_next)
-        e->bucket_next->bucket_previous = e->bucket_previous;
+    pa_assert(h->n_entries >= 1);
+    h->n_entries--;
 
-    if (e->bucket_previous)
-        e->bucket_previous->bucket_next = e->bucket_next;
+    if (h->n_entries == 0)
+        h->first = h->n_used = 0;
     else {
-        unsigned hash = h->hash_func(e->key) % NBUCKETS;
-        BY_HASH(h)[hash] = e->bucket_next;
+        while (h->entries[h->first].removed)
+            h->first++;
+
+        while (h->entries[h->n_used - 1].removed)
+            h->n_used--;
     }
 
     if (h->key_free_func)
-        h->key_free_func(e->key);
-
-    if (pa_flist_push(PA_STATIC_FLIST_GET(entries), e) < 0)
-        pa_xfree(e);
-
-    pa_assert(h->n_entries >= 1);
-    h->n_entries--;
+        h->key_free_func(key);
 }
 
 void pa_hashmap_free(pa_hashmap *h) {
     pa_assert(h);
 
     pa_hashmap_remove_all(h);
+
+    pa_xfree(h->entries);
+    pa_xfree(h->slots);
     pa_xfree(h);
 }
 
-static struct hashmap_entry *hash_scan(pa_hashmap *h, unsigned hash, const void *key) {
-    struct hashmap_entry *e;
+static unsigned hash_scan(pa_hashmap *h, unsigned hash, const void *key) {
+    unsigned i;
+
     pa_assert(h);
-    pa_assert(hash < NBUCKETS);
 
-    for (e = BY_HASH(h)[hash]; e; e = e->bucket_next)
-        if (h->compare_func(e->key, key) == 0)
-            return e;
+    if (h->n_entries == 0)
+        return NO_SLOT;
 
-    return NULL;
+    for (i = pa_hash_slot_home(hash, h->bits); h->slots[i].position != PA_HASH_SLOT_EMPTY; i = pa_hash_slot_next(i, h->bits))
+        if (h->slots[i].hash == hash && h->compare_func(h->entries[h->slots[i].position].key, key) == 0)
+            return i;
+
+    return NO_SLOT;
+}
+
+/* Drop the removed entries and resize the tables, so that the remaining
+ * entries take up at most two thirds of the capacity */
+static void resize(pa_hashmap *h) {
+    unsigned bits, i, n = 0;
+
+    pa_assert(h);
+
+    for (bits = MIN_BITS; PA_HASH_SLOTS_CAPACITY(bits) <= h->n_entries + h->n_entries / 2; bits++)
+        ;
+
+    for (i = h->first; i < h->n_used; i++)
+        if (!h->entries[i].removed)
+            h->entries[n++] = h->entries[i];
+
+    pa_assert(n == h->n_entries);
+    h->first = 0;
+    h->n_used = n;
+
+    if (bits != h->bits) {
+        h->entries = pa_xrenew(struct hashmap_entry, h->entries, PA_HASH_SLOTS_CAPACITY(bits));
+
+        pa_xfree(h->slots);
+        h->slots = pa_hash_slots_new(bits);
+        h->bits = bits;
+    } else
+        pa_hash_slots_clear(h->slots, bits);
+
+    for (i = 0; i < n; i++)
+        pa_hash_slots_insert(h->slots, h->bits, h->entries[i].hash, i);
 }
 
 int pa_hashmap_put(pa_hashmap *h, void *key, void *value) {
@@ -137,35 +182,22 @@ int pa_hashmap_put(pa_hashmap *h, void *key, void *value) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = pa_hash_mix(h->hash_func(key));
 
-    if (hash_scan(h, hash, key))
+    if (hash_scan(h, hash, key) != NO_SLOT)
         return -1;
 
-    if (!(e = pa_flist_pop(PA_STATIC_FLIST_GET(entries))))
-        e = pa_xnew(struct hashmap_entry, 1);
+    if (h->n_used >= PA_HASH_SLOTS_CAPACITY(h->bits))
+        resize(h);
 
+    e = &h->entries[h->n_used];
     e->key = key;
     e->value = value;
+    e->hash = hash;
+    e->removed = false;
 
-    /* Insert into hash table */
-    e->bucket_next = BY_HASH(h)[hash];
-    e->bucket_previous = NULL;
-    if (BY_HASH(h)[hash])
-        BY_HASH(h)[hash]->bucket_previous = e;
-    BY_HASH(h)[hash] = e;
-
-    /* Insert into iteration list */
-    e->iterate_previous = h->iterate_list_tail;
-    e->iterate_next = NULL;
-    if (h->iterate_list_tail) {
-        pa_assert(h->iterate_list_head);
-        h->iterate_list_tail->iterate_next = e;
-    } else {
-        pa_assert(!h->iterate_list_head);
-        h->iterate_list_head = e;
-    }
-    h->iterate_list_tail = e;
+    pa_hash_slots_insert(h->slots, h->bits, hash, h->n_used);
+    h->n_used++;
 
     h->n_entries++;
     pa_assert(h->n_entries >= 1);
@@ -174,33 +206,27 @@ int pa_hashmap_put(pa_hashmap *h, void *key, void *value) {
 }
 
 void* pa_hashmap_get(pa_hashmap *h, const void *key) {
-    unsigned hash;
-    struct hashmap_entry *e;
+    unsigned slot;
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
-
-    if (!(e = hash_scan(h, hash, key)))
+    if ((slot = hash_scan(h, pa_hash_mix(h->hash_func(key)), key)) == NO_SLOT)
         return NULL;
 
-    return e->value;
+    return h->entries[h->slots[slot].position].value;
 }
 
 void* pa_hashmap_remove(pa_hashmap *h, const void *key) {
-    struct hashmap_entry *e;
-    unsigned hash;
+    unsigned slot;
     void *data;
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
-
-    if (!(e = hash_scan(h, hash, key)))
+    if ((slot = hash_scan(h, pa_hash_mix(h->hash_func(key)), key)) == NO_SLOT)
         return NULL;
 
-    data = e->value;
-    remove_entry(h, e);
+    data = h->entries[h->slots[slot].position].value;
+    remove_entry(h, slot);
 
     return data;
 }
@@ -218,13 +244,20 @@ int pa_hashmap_remove_and_free(pa_hashmap *h, const void *key) {
     return data ? 0 : -1;
 }
 
+static unsigned first_slot(pa_hashmap *h) {
+    pa_assert(h);
+    pa_assert(h->n_entries > 0);
+
+    return pa_hash_slots_find_position(h->slots, h->bits, h->entries[h->first].hash, h->first);
+}
+
 void pa_hashmap_remove_all(pa_hashmap *h) {
     pa_assert(h);
 
-    while (h->iterate_list_head) {
+    while (h->n_entries > 0) {
         void *data;
-        data = h->iterate_list_head->value;
-        remove_entry(h, h->iterate_list_head);
+        data = h->entries[h->first].value;
+        remove_entry(h, first_slot(h));
 
         if (h->value_free_func)
             h->value_free_func(data);
@@ -232,7 +265,7 @@ void pa_hashmap_remove_all(pa_hashmap *h) {
 }
 
 void *pa_hashmap_iterate(pa_hashmap *h, void **state, const void **key) {
-    struct hashmap_entry *e;
+    unsigned i;
 
     pa_assert(h);
     pa_assert(state);
@@ -240,20 +273,19 @@ void *pa_hashmap_iterate(pa_hashmap *h, void **state, const void **key) {
     if (*state == (void*) -1)
         goto at_end;
 
-    if (!*state && !h->iterate_list_head)
-        goto at_end;
+    for (i = *state ? STATE_TO_POSITION(*state) : h->first; i < h->n_used; i++) {
+        struct hashmap_entry *e = &h->entries[i];
 
-    e = *state ? *state : h->iterate_list_head;
+        if (e->removed)
+            continue;
 
-    if (e->iterate_next)
-        *state = e->iterate_next;
-    else
-        *state = (void*) -1;
+        *state = POSITION_TO_STATE(i + 1);
 
-    if (key)
-        *key = e->key;
+        if (key)
+            *key = e->key;
 
-    return e->value;
+        return e->value;
+    }
 
 at_end:
     *state = (void *) -1;
@@ -265,7 +297,7 @@ at_end:
 }
 
 void *pa_hashmap_iterate_backwards(pa_hashmap *h, void **state, const void **key) {
-    struct hashmap_entry *e;
+    unsigned i;
 
     pa_assert(h);
     pa_assert(state);
@@ -273,20 +305,22 @@ void *pa_hashmap_iterate_backwards(pa_hashmap *h, void **state, const void **key
     if (*state == (void*) -1)
         goto at_beginning;
 
-    if (!*state && !h->iterate_list_tail)
-        goto at_beginning;
+    /* i is one past the next position to look at */
+    i = *state ? STATE_TO_POSITION(*state) + 1 : h->n_used;
 
-    e = *state ? *state : h->iterate_list_tail;
+    for (i = PA_MIN(i, h->n_used); i > h->first; i--) {
+        struct hashmap_entry *e = &h->entries[i - 1];
 
-    if (e->iterate_previous)
-        *state = e->iterate_previous;
-    else
-        *state = (void*) -1;
+        if (e->removed)
+            continue;
 
-    if (key)
-        *key = e->key;
+        *state = i > 1 ? POSITION_TO_STATE(i - 2) : (void*) -1;
+
+        if (key)
+            *key = e->key;
 
-    return e->value;
+        return e->value;
+    }
 
 at_beginning:
     *state = (void *) -1;
@@ -300,19 +334,19 @@ at_beginning:
 void* pa_hashmap_first(pa_hashmap *h) {
     pa_assert(h);
 
-    if (!h->iterate_list_head)
+    if (h->n_entries == 0)
         return NULL;
 
-    return h->iterate_list_head->value;
+    return h->entries[h->first].value;
 }
 
 void* pa_hashmap_last(pa_hashmap *h) {
     pa_assert(h);
 
-    if (!h->iterate_list_tail)
+    if (h->n_entries == 0)
         return NULL;
 
-    return h->iterate_list_tail->value;
+    return h->entries[h->n_used - 1].value;
 }
 
 void* pa_hashmap_steal_first(pa_hashmap *h) {
@@ -320,11 +354,11 @@ void* pa_hashmap_steal_first(pa_hashmap *h) {
 
     pa_assert(h);
 
-    if (!h->iterate_list_head)
+    if (h->n_entries == 0)
         return NULL;
 
-    data = h->iterate_list_head->value;
-    remove_entry(h, h->iterate_list_head);
+    data = h->entries[h->first].value;
+    remove_entry(h, first_slot(h));
 
     return data;
 }
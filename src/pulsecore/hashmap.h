@@ -68,8 +68,8 @@ bool pa_hashmap_isempty(pa_hashmap *h);
 
 /* May be used to iterate through the hashmap. Initially the opaque
    pointer *state has to be set to NULL. The hashmap may not be
-   modified during iteration -- except for deleting the current entry
-   via pa_hashmap_remove(). The key of the entry is returned in *key,
+   modified during iteration -- except for deleting entries via
+   pa_hashmap_remove(). The key of the entry is returned in *key,
    if key is non-NULL. After the last entry in the hashmap NULL is
    returned. */
 void *pa_hashmap_iterate(pa_hashmap *h, void **state, const void**key);
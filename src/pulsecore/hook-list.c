@@ -23,6 +23,7 @@
 
 #include <pulse/xmalloc.h>
 
+#include <pulsecore/core-util.h>
 #include <pulsecore/macro.h>
 
 #include "hook-list.h"
@@ -33,6 +34,13 @@ void pa_hook_init(pa_hook *hook, void *data) {
     PA_LLIST_HEAD_INIT(pa_hook_slot, hook->slots);
     hook->n_dead = hook->n_firing = 0;
     hook->data = data;
+    hook->get_proplist = NULL;
+}
+
+void pa_hook_set_proplist_cb(pa_hook *hook, pa_hook_proplist_cb_t cb) {
+    pa_assert(hook);
+
+    hook->get_proplist = cb;
 }
 
 static void slot_free(pa_hook *hook, pa_hook_slot *slot) {
@@ -41,6 +49,8 @@ static void slot_free(pa_hook *hook, pa_hook_slot *slot) {
 
     PA_LLIST_REMOVE(pa_hook_slot, hook->slots, slot);
 
+    pa_xfree(slot->match_key);
+    pa_xfree(slot->match_value);
     pa_xfree(slot);
 }
 
@@ -65,6 +75,8 @@ pa_hook_slot* pa_hook_connect(pa_hook *hook, pa_hook_priority_t prio, pa_hook_cb
     slot->callback = cb;
     slot->data = data;
     slot->priority = prio;
+    slot->match_key = NULL;
+    slot->match_value = NULL;
 
     prev = NULL;
     for (where = hook->slots; where; where = where->next) {
@@ -89,18 +101,51 @@ void pa_hook_slot_free(pa_hook_slot *slot) {
         slot_free(slot->hook, slot);
 }
 
+void pa_hook_slot_match_proplist(pa_hook_slot *slot, const char *key, const char *value) {
+    pa_assert(slot);
+    pa_assert(key);
+
+    pa_xfree(slot->match_key);
+    pa_xfree(slot->match_value);
+
+    slot->match_key = pa_xstrdup(key);
+    slot->match_value = pa_xstrdup(value);
+}
+
+static bool slot_matches(pa_hook_slot *slot, pa_proplist *p) {
+    const char *v;
+
+    if (!slot->match_key || !slot->hook->get_proplist)
+        return true;
+
+    if (!p || !(v = pa_proplist_gets(p, slot->match_key)))
+        return false;
+
+    return !slot->match_value || pa_streq(v, slot->match_value);
+}
+
 pa_hook_result_t pa_hook_fire(pa_hook *hook, void *data) {
     pa_hook_slot *slot, *next;
     pa_hook_result_t result = PA_HOOK_OK;
+    pa_proplist *p = NULL;
 
     pa_assert(hook);
 
     hook->n_firing ++;
 
+    /* The property list is looked up once, but the match rules are
+     * checked right before each slot, since earlier slots may have
+     * changed the properties. */
+    if (hook->get_proplist)
+        p = hook->get_proplist(data);
+
     PA_LLIST_FOREACH(slot, hook->slots) {
         if (slot->dead)
             continue;
 
+        if (!slot_matches(slot, p))
+            continue;
+
         if ((result = slot->callback(hook->data, data, slot->data)) != PA_HOOK_OK)
             break;
     }
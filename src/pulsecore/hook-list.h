@@ -20,6 +20,8 @@
   License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <pulse/proplist.h>
+
 #include <pulsecore/llist.h>
 
 typedef struct pa_hook_slot pa_hook_slot;
@@ -42,12 +44,22 @@ typedef pa_hook_result_t (*pa_hook_cb_t)(
         void *call_data,
         void *slot_data);
 
+/* Returns the property list of the object a hook is fired for */
+typedef pa_proplist* (*pa_hook_proplist_cb_t)(void *call_data);
+
 struct pa_hook_slot {
     bool dead;
     pa_hook *hook;
     pa_hook_priority_t priority;
     pa_hook_cb_t callback;
     void *data;
+
+    /* If match_key is set, the slot is only called if the property
+     * list of the call data contains that key, and if match_value is
+     * set, only if the key has that value. */
+    char *match_key;
+    char *match_value;
+
     PA_LLIST_FIELDS(pa_hook_slot);
 };
 
@@ -56,14 +68,26 @@ struct pa_hook {
     int n_firing, n_dead;
 
     void *data;
+    pa_hook_proplist_cb_t get_proplist;
 };
 
 void pa_hook_init(pa_hook *hook, void *data);
 void pa_hook_done(pa_hook *hook);
 
+/* Tells the hook how to find the property list in its call data. Only
+ * hooks with such a function honour the slot match rules below. */
+void pa_hook_set_proplist_cb(pa_hook *hook, pa_hook_proplist_cb_t cb);
+
 pa_hook_slot* pa_hook_connect(pa_hook *hook, pa_hook_priority_t prio, pa_hook_cb_t cb, void *data);
 void pa_hook_slot_free(pa_hook_slot *slot);
 
+/* Restricts the slot to call data whose property list contains key,
+ * and if value is non-NULL, where key is set to that value. This is
+ * checked by the hook before the callback is run, so that slots
+ * which care about a few streams only don't get called for all of
+ * them. */
+void pa_hook_slot_match_proplist(pa_hook_slot *slot, const char *key, const char *value);
+
 pa_hook_result_t pa_hook_fire(pa_hook *hook, void *data);
 
 bool pa_hook_is_firing(pa_hook *hook);
@@ -27,20 +27,29 @@
 #include <string.h>
 
 #include <pulse/xmalloc.h>
-#include <pulsecore/flist.h>
+#include <pulsecore/hash-slots.h>
 #include <pulsecore/macro.h>
 
 #include "idxset.h"
 
-#define NBUCKETS 127
+#define MIN_BITS 3
+
+#define NO_SLOT ((unsigned) -1)
+
+/* Iteration states are the index of the next entry, offset by one so that
+ * NULL can still mean "start". Unlike positions, indexes stay valid when the
+ * entry array is compacted. */
+#define INDEX_TO_STATE(idx) PA_UINT32_TO_PTR((idx) + 1)
+#define STATE_TO_INDEX(s) (PA_PTR_TO_UINT32(s) - 1)
 
 struct idxset_entry {
     uint32_t idx;
-    void *data;
 
-    struct idxset_entry *data_next, *data_previous;
-    struct idxset_entry *index_next, *index_previous;
-    struct idxset_entry *iterate_next, *iterate_previous;
+    /* The mixed hash of data, the index is used as its own hash */
+    unsigned hash;
+
+    /* NULL for removed entries */
+    void *data;
 };
 
 struct pa_idxset {
@@ -49,14 +58,18 @@ struct pa_idxset {
 
     uint32_t current_index;
 
-    struct idxset_entry *iterate_list_head, *iterate_list_tail;
-    unsigned n_entries;
-};
+    /* The entries in insertion order, which is also the order of their
+     * indexes. Removed entries stay in place until the array is compacted
+     * when it runs full. All entries before first and from n_used on are
+     * removed ones. */
+    struct idxset_entry *entries;
+    unsigned first, n_used;
 
-#define BY_DATA(i) ((struct idxset_entry**) ((uint8_t*) (i) + PA_ALIGN(sizeof(pa_idxset))))
-#define BY_INDEX(i) (BY_DATA(i) + NBUCKETS)
+    pa_hash_slot *by_data, *by_index;
+    unsigned bits;
 
-PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
+    unsigned n_entries;
+};
 
 unsigned pa_idxset_string_hash_func(const void *p) {
     unsigned hash = 0;
@@ -83,140 +96,191 @@ int pa_idxset_trivial_compare_func(const void *a, const void *b) {
 pa_idxset* pa_idxset_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func) {
     pa_idxset *s;
 
-    s = pa_xmalloc0(PA_ALIGN(sizeof(pa_idxset)) + NBUCKETS*2*sizeof(struct idxset_entry*));
+    s = pa_xnew0(pa_idxset, 1);
 
     s->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     s->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
 
     s->current_index = 0;
-    s->n_entries = 0;
-    s->iterate_list_head = s->iterate_list_tail = NULL;
+
+    /* The tables are allocated with the first entry */
+    s->entries = NULL;
+    s->by_data = s->by_index = NULL;
+    s->bits = 0;
+    s->first = s->n_used = s->n_entries = 0;
 
     return s;
 }
 
-static void remove_entry(pa_idxset *s, struct idxset_entry *e) {
+static unsigned data_scan(pa_idxset *s, unsigned hash, const void *p) {
+    unsigned i;
+
     pa_assert(s);
-    pa_assert(e);
+    pa_assert(p);
 
-    /* Remove from iteration linked list */
-    if (e->iterate_next)
-        e->iterate_next->iterate_previous = e->iterate_previous;
-    else
-        s->iterate_list_tail = e->iterate_previous;
+    if (s->n_entries == 0)
+        return NO_SLOT;
 
-    if (e->iterate_previous)
-        e->iterate_previous->iterate_next = e->iterate_next;
-    else
-        s->iterate_list_head = e->iterate_next;
+    for (i = pa_hash_slot_home(hash, s->bits); s->by_data[i].position != PA_HASH_SLOT_EMPTY; i = pa_hash_slot_next(i, s->bits))
+        if (s->by_data[i].hash == hash && s->compare_func(s->entries[s->by_data[i].position].data, p) == 0)
+            return i;
 
-    /* Remove from data hash table */
-    if (e->data_next)
-        e->data_next->data_previous = e->data_previous;
+    return NO_SLOT;
+}
 
-    if (e->data_previous)
-        e->data_previous->data_next = e->data_next;
-    else {
-        unsigned hash = s->hash_func(e->data) % NBUCKETS;
-        BY_DATA(s)[hash] = e->data_next;
+static unsigned index_scan(pa_idxset *s, uint32_t idx) {
+    unsigned i;
+
+    pa_assert(s);
+
+    if (s->n_entries == 0)
+        return NO_SLOT;
+
+    for (i = pa_hash_slot_home(idx, s->bits); s->by_index[i].position != PA_HASH_SLOT_EMPTY; i = pa_hash_slot_next(i, s->bits))
+        if (s->by_index[i].hash == idx)
+            return i;
+
+    return NO_SLOT;
+}
+
+/* Position of the first entry with an index not smaller than idx */
+static unsigned index_lower_bound(pa_idxset *s, uint32_t idx) {
+    unsigned slot, low, high;
+
+    pa_assert(s);
+
+    if ((slot = index_scan(s, idx)) != NO_SLOT)
+        return s->by_index[slot].position;
+
+    /* Removed entries keep their index, so the array stays sorted */
+    low = s->first;
+    high = s->n_used;
+
+    while (low < high) {
+        unsigned middle = low + (high - low) / 2;
+
+        if (s->entries[middle].idx < idx)
+            low = middle + 1;
+        else
+            high = middle;
     }
 
-    /* Remove from index hash table */
-    if (e->index_next)
-        e->index_next->index_previous = e->index_previous;
+    return low;
+}
 
-    if (e->index_previous)
-        e->index_previous->index_next = e->index_next;
-    else
-        BY_INDEX(s)[e->idx % NBUCKETS] = e->index_next;
+/* Position of the first entry that is not removed at or after i, n_used if
+ * there is none */
+static unsigned skip_removed(pa_idxset *s, unsigned i) {
+    pa_assert(s);
+
+    for (i = PA_MAX(i, s->first); i < s->n_used; i++)
+        if (s->entries[i].data)
+            break;
 
-    if (pa_flist_push(PA_STATIC_FLIST_GET(entries), e) < 0)
-        pa_xfree(e);
+    return PA_MIN(i, s->n_used);
+}
+
+static void remove_entry(pa_idxset *s, unsigned position) {
+    struct idxset_entry *e;
+
+    pa_assert(s);
+    pa_assert(position < s->n_used);
+
+    e = &s->entries[position];
+    pa_assert(e->data);
+
+    pa_hash_slots_remove(s->by_data, s->bits, pa_hash_slots_find_position(s->by_data, s->bits, e->hash, position));
+    pa_hash_slots_remove(s->by_index, s->bits, pa_hash_slots_find_position(s->by_index, s->bits, e->idx, position));
+    e->data = NULL;
 
     pa_assert(s->n_entries >= 1);
     s->n_entries--;
+
+    if (s->n_entries == 0)
+        s->first = s->n_used = 0;
+    else {
+        while (!s->entries[s->first].data)
+            s->first++;
+
+        while (!s->entries[s->n_used - 1].data)
+            s->n_used--;
+    }
 }
 
 void pa_idxset_free(pa_idxset *s, pa_free_cb_t free_cb) {
     pa_assert(s);
 
     pa_idxset_remove_all(s, free_cb);
+
+    pa_xfree(s->entries);
+    pa_xfree(s->by_data);
+    pa_xfree(s->by_index);
     pa_xfree(s);
 }
 
-static struct idxset_entry* data_scan(pa_idxset *s, unsigned hash, const void *p) {
-    struct idxset_entry *e;
+/* Drop the removed entries and resize the tables, so that the remaining
+ * entries take up at most two thirds of the capacity */
+static void resize(pa_idxset *s) {
+    unsigned bits, i, n = 0;
+
     pa_assert(s);
-    pa_assert(hash < NBUCKETS);
-    pa_assert(p);
 
-    for (e = BY_DATA(s)[hash]; e; e = e->data_next)
-        if (s->compare_func(e->data, p) == 0)
-            return e;
+    for (bits = MIN_BITS; PA_HASH_SLOTS_CAPACITY(bits) <= s->n_entries + s->n_entries / 2; bits++)
+        ;
 
-    return NULL;
-}
+    for (i = s->first; i < s->n_used; i++)
+        if (s->entries[i].data)
+            s->entries[n++] = s->entries[i];
 
-static struct idxset_entry* index_scan(pa_idxset *s, unsigned hash, uint32_t idx) {
-    struct idxset_entry *e;
-    pa_assert(s);
-    pa_assert(hash < NBUCKETS);
+    pa_assert(n == s->n_entries);
+    s->first = 0;
+    s->n_used = n;
 
-    for (e = BY_INDEX(s)[hash]; e; e = e->index_next)
-        if (e->idx == idx)
-            return e;
+    if (bits != s->bits) {
+        s->entries = pa_xrenew(struct idxset_entry, s->entries, PA_HASH_SLOTS_CAPACITY(bits));
 
-    return NULL;
+        pa_xfree(s->by_data);
+        pa_xfree(s->by_index);
+        s->by_data = pa_hash_slots_new(bits);
+        s->by_index = pa_hash_slots_new(bits);
+        s->bits = bits;
+    } else {
+        pa_hash_slots_clear(s->by_data, bits);
+        pa_hash_slots_clear(s->by_index, bits);
+    }
+
+    for (i = 0; i < n; i++) {
+        pa_hash_slots_insert(s->by_data, s->bits, s->entries[i].hash, i);
+        pa_hash_slots_insert(s->by_index, s->bits, s->entries[i].idx, i);
+    }
 }
 
 int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
-    unsigned hash;
+    unsigned hash, slot;
     struct idxset_entry *e;
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
+    hash = pa_hash_mix(s->hash_func(p));
 
-    if ((e = data_scan(s, hash, p))) {
+    if ((slot = data_scan(s, hash, p)) != NO_SLOT) {
         if (idx)
-            *idx = e->idx;
+            *idx = s->entries[s->by_data[slot].position].idx;
 
         return -1;
     }
 
-    if (!(e = pa_flist_pop(PA_STATIC_FLIST_GET(entries))))
-        e = pa_xnew(struct idxset_entry, 1);
+    if (s->n_used >= PA_HASH_SLOTS_CAPACITY(s->bits))
+        resize(s);
 
+    e = &s->entries[s->n_used];
     e->data = p;
+    e->hash = hash;
     e->idx = s->current_index++;
 
-    /* Insert into data hash table */
-    e->data_next = BY_DATA(s)[hash];
-    e->data_previous = NULL;
-    if (BY_DATA(s)[hash])
-        BY_DATA(s)[hash]->data_previous = e;
-    BY_DATA(s)[hash] = e;
-
-    hash = e->idx % NBUCKETS;
-
-    /* Insert into index hash table */
-    e->index_next = BY_INDEX(s)[hash];
-    e->index_previous = NULL;
-    if (BY_INDEX(s)[hash])
-        BY_INDEX(s)[hash]->index_previous = e;
-    BY_INDEX(s)[hash] = e;
-
-    /* Insert into iteration list */
-    e->iterate_previous = s->iterate_list_tail;
-    e->iterate_next = NULL;
-    if (s->iterate_list_tail) {
-        pa_assert(s->iterate_list_head);
-        s->iterate_list_tail->iterate_next = e;
-    } else {
-        pa_assert(!s->iterate_list_head);
-        s->iterate_list_head = e;
-    }
-    s->iterate_list_tail = e;
+    pa_hash_slots_insert(s->by_data, s->bits, hash, s->n_used);
+    pa_hash_slots_insert(s->by_index, s->bits, e->idx, s->n_used);
+    s->n_used++;
 
     s->n_entries++;
     pa_assert(s->n_entries >= 1);
@@ -228,30 +292,27 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
 }
 
 void* pa_idxset_get_by_index(pa_idxset*s, uint32_t idx) {
-    unsigned hash;
-    struct idxset_entry *e;
+    unsigned slot;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if ((slot = index_scan(s, idx)) == NO_SLOT)
         return NULL;
 
-    return e->data;
+    return s->entries[s->by_index[slot].position].data;
 }
 
 void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
-    unsigned hash;
+    unsigned slot;
     struct idxset_entry *e;
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
-
-    if (!(e = data_scan(s, hash, p)))
+    if ((slot = data_scan(s, pa_hash_mix(s->hash_func(p)), p)) == NO_SLOT)
         return NULL;
 
+    e = &s->entries[s->by_data[slot].position];
+
     if (idx)
         *idx = e->idx;
 
@@ -259,41 +320,39 @@ void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
 }
 
 void* pa_idxset_remove_by_index(pa_idxset*s, uint32_t idx) {
-    struct idxset_entry *e;
-    unsigned hash;
+    unsigned slot, position;
     void *data;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if ((slot = index_scan(s, idx)) == NO_SLOT)
         return NULL;
 
-    data = e->data;
-    remove_entry(s, e);
+    position = s->by_index[slot].position;
+    data = s->entries[position].data;
+    remove_entry(s, position);
 
     return data;
 }
 
 void* pa_idxset_remove_by_data(pa_idxset*s, const void *data, uint32_t *idx) {
     struct idxset_entry *e;
-    unsigned hash;
+    unsigned slot, position;
     void *r;
 
     pa_assert(s);
 
-    hash = s->hash_func(data) % NBUCKETS;
-
-    if (!(e = data_scan(s, hash, data)))
+    if ((slot = data_scan(s, pa_hash_mix(s->hash_func(data)), data)) == NO_SLOT)
         return NULL;
 
+    position = s->by_data[slot].position;
+    e = &s->entries[position];
     r = e->data;
 
     if (idx)
         *idx = e->idx;
 
-    remove_entry(s, e);
+    remove_entry(s, position);
 
     return r;
 }
@@ -301,10 +360,10 @@ void* pa_idxset_remove_by_data(pa_idxset*s, const void *data, uint32_t *idx) {
 void pa_idxset_remove_all(pa_idxset *s, pa_free_cb_t free_cb) {
     pa_assert(s);
 
-    while (s->iterate_list_head) {
-        void *data = s->iterate_list_head->data;
+    while (s->n_entries > 0) {
+        void *data = s->entries[s->first].data;
 
-        remove_entry(s, s->iterate_list_head);
+        remove_entry(s, s->first);
 
         if (free_cb)
             free_cb(data);
@@ -312,30 +371,29 @@ void pa_idxset_remove_all(pa_idxset *s, pa_free_cb_t free_cb) {
 }
 
 void* pa_idxset_rrobin(pa_idxset *s, uint32_t *idx) {
-    unsigned hash;
-    struct idxset_entry *e;
+    unsigned slot, i;
 
     pa_assert(s);
     pa_assert(idx);
 
-    hash = *idx % NBUCKETS;
+    i = s->n_used;
 
-    e = index_scan(s, hash, *idx);
+    if ((slot = index_scan(s, *idx)) != NO_SLOT)
+        i = skip_removed(s, s->by_index[slot].position + 1);
 
-    if (e && e->iterate_next)
-        e = e->iterate_next;
-    else
-        e = s->iterate_list_head;
+    if (i >= s->n_used)
+        i = skip_removed(s, s->first);
 
-    if (!e)
+    if (i >= s->n_used)
         return NULL;
 
-    *idx = e->idx;
-    return e->data;
+    *idx = s->entries[i].idx;
+    return s->entries[i].data;
 }
 
 void *pa_idxset_iterate(pa_idxset *s, void **state, uint32_t *idx) {
     struct idxset_entry *e;
+    unsigned i, next;
 
     pa_assert(s);
     pa_assert(state);
@@ -343,13 +401,17 @@ void *pa_idxset_iterate(pa_idxset *s, void **state, uint32_t *idx) {
     if (*state == (void*) -1)
         goto at_end;
 
-    if ((!*state && !s->iterate_list_head))
+    /* The entry noted in the state may have been removed in the meantime,
+     * so this looks for the first one at or after it */
+    i = skip_removed(s, *state ? index_lower_bound(s, STATE_TO_INDEX(*state)) : s->first);
+
+    if (i >= s->n_used)
         goto at_end;
 
-    e = *state ? *state : s->iterate_list_head;
+    e = &s->entries[i];
 
-    if (e->iterate_next)
-        *state = e->iterate_next;
+    if ((next = skip_removed(s, i + 1)) < s->n_used)
+        *state = INDEX_TO_STATE(s->entries[next].idx);
     else
         *state = (void*) -1;
 
@@ -372,15 +434,15 @@ void* pa_idxset_steal_first(pa_idxset *s, uint32_t *idx) {
 
     pa_assert(s);
 
-    if (!s->iterate_list_head)
+    if (s->n_entries == 0)
         return NULL;
 
-    data = s->iterate_list_head->data;
+    data = s->entries[s->first].data;
 
     if (idx)
-        *idx = s->iterate_list_head->idx;
+        *idx = s->entries[s->first].idx;
 
-    remove_entry(s, s->iterate_list_head);
+    remove_entry(s, s->first);
 
     return data;
 }
@@ -388,21 +450,20 @@ void* pa_idxset_steal_first(pa_idxset *s, uint32_t *idx) {
 void* pa_idxset_first(pa_idxset *s, uint32_t *idx) {
     pa_assert(s);
 
-    if (!s->iterate_list_head) {
+    if (s->n_entries == 0) {
         if (idx)
             *idx = PA_IDXSET_INVALID;
         return NULL;
     }
 
     if (idx)
-        *idx = s->iterate_list_head->idx;
+        *idx = s->entries[s->first].idx;
 
-    return s->iterate_list_head->data;
+    return s->entries[s->first].data;
 }
 
 void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
-    struct idxset_entry *e;
-    unsigned hash;
+    unsigned slot, i;
 
     pa_assert(s);
     pa_assert(idx);
@@ -410,38 +471,20 @@ void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
     if (*idx == PA_IDXSET_INVALID)
         return NULL;
 
-    hash = *idx % NBUCKETS;
-
-    if ((e = index_scan(s, hash, *idx))) {
-
-        e = e->iterate_next;
-
-        if (e) {
-            *idx = e->idx;
-            return e->data;
-        } else {
-            *idx = PA_IDXSET_INVALID;
-            return NULL;
-        }
-
-    } else {
-
+    if ((slot = index_scan(s, *idx)) != NO_SLOT)
+        i = s->by_index[slot].position + 1;
+    else
         /* If the entry passed doesn't exist anymore we try to find
          * the next following */
+        i = index_lower_bound(s, *idx);
 
-        for ((*idx)++; *idx < s->current_index; (*idx)++) {
-
-            hash = *idx % NBUCKETS;
-
-            if ((e = index_scan(s, hash, *idx))) {
-                *idx = e->idx;
-                return e->data;
-            }
-        }
-
+    if ((i = skip_removed(s, i)) >= s->n_used) {
         *idx = PA_IDXSET_INVALID;
         return NULL;
     }
+
+    *idx = s->entries[i].idx;
+    return s->entries[i].data;
 }
 
 unsigned pa_idxset_size(pa_idxset*s) {
@@ -458,14 +501,15 @@ bool pa_idxset_isempty(pa_idxset *s) {
 
 pa_idxset *pa_idxset_copy(pa_idxset *s, pa_copy_func_t copy_func) {
     pa_idxset *copy;
-    struct idxset_entry *i;
+    unsigned i;
 
     pa_assert(s);
 
     copy = pa_idxset_new(s->hash_func, s->compare_func);
 
-    for (i = s->iterate_list_head; i; i = i->iterate_next)
-        pa_idxset_put(copy, copy_func ? copy_func(i->data) : i->data, NULL);
+    for (i = s->first; i < s->n_used; i++)
+        if (s->entries[i].data)
+            pa_idxset_put(copy, copy_func ? copy_func(s->entries[i].data) : s->entries[i].data, NULL);
 
     return copy;
 }
@@ -0,0 +1,313 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/shared.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+#include "io-thread-pool.h"
+
+#define MAX_CLIENTS_PER_THREAD 32
+
+typedef struct io_thread_pool io_thread_pool;
+typedef struct io_thread io_thread;
+
+struct io_thread_pool {
+    PA_REFCNT_DECLARE;
+
+    pa_core *core;
+    PA_LLIST_HEAD(io_thread, threads);
+};
+
+struct io_thread {
+    pa_msgobject parent;
+
+    io_thread_pool *pool;
+    pa_usec_t period;
+    unsigned n_clients;
+
+    pa_thread *thread;
+    pa_thread_mq thread_mq;
+    pa_rtpoll *rtpoll;
+
+    struct {
+        PA_LLIST_HEAD(pa_io_client, clients);
+    } thread_info;
+
+    PA_LLIST_FIELDS(io_thread);
+};
+
+PA_DEFINE_PRIVATE_CLASS(io_thread, pa_msgobject);
+#define IO_THREAD(o) (io_thread_cast(o))
+
+struct pa_io_client {
+    io_thread *thread;
+    pa_module *module;
+
+    pa_io_client_cb_t cb;
+    void *userdata;
+
+    PA_LLIST_FIELDS(pa_io_client);
+};
+
+enum {
+    IO_THREAD_MESSAGE_ADD_CLIENT,
+    IO_THREAD_MESSAGE_REMOVE_CLIENT
+};
+
+/* Called from the IO thread */
+static int io_thread_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    io_thread *t = IO_THREAD(o);
+    pa_io_client *c = data;
+
+    switch (code) {
+        case IO_THREAD_MESSAGE_ADD_CLIENT:
+            PA_LLIST_PREPEND(pa_io_client, t->thread_info.clients, c);
+            return 0;
+
+        case IO_THREAD_MESSAGE_REMOVE_CLIENT:
+            PA_LLIST_REMOVE(pa_io_client, t->thread_info.clients, c);
+            return 0;
+    }
+
+    return 0;
+}
+
+static void thread_func(void *userdata) {
+    io_thread *t = userdata;
+    pa_io_client *c;
+
+    pa_assert(t);
+
+    pa_log_debug("Thread starting up");
+
+    if (t->pool->core->thread_affinity)
+        pa_set_thread_affinity(t->pool->core->thread_affinity);
+
+    if (t->pool->core->realtime_scheduling)
+        pa_make_realtime(t->pool->core->realtime_priority);
+
+    pa_thread_mq_install(&t->thread_mq);
+
+    for (;;) {
+        pa_usec_t next = 0;
+        int ret;
+
+        for (c = t->thread_info.clients; c; c = c->next) {
+            pa_usec_t d;
+
+            if ((d = c->cb(c, c->userdata)) > 0 && (next == 0 || d < next))
+                next = d;
+        }
+
+        /* Round up to the period, so that everyone due in the same
+         * period is served by the same wakeup */
+        if (next > 0)
+            pa_rtpoll_set_timer_absolute(t->rtpoll, ((next + t->period - 1) / t->period) * t->period);
+        else
+            pa_rtpoll_set_timer_disabled(t->rtpoll);
+
+        if ((ret = pa_rtpoll_run(t->rtpoll)) < 0)
+            goto fail;
+
+        if (ret == 0)
+            goto finish;
+    }
+
+fail:
+    /* Take everyone down that runs here, the last one of them to go
+     * will stop the thread */
+    for (c = t->thread_info.clients; c; c = c->next)
+        pa_asyncmsgq_post(t->thread_mq.outq, PA_MSGOBJECT(t->pool->core), PA_CORE_MESSAGE_UNLOAD_MODULE, c->module, 0, NULL, NULL);
+
+    pa_asyncmsgq_wait_for(t->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+
+finish:
+    pa_log_debug("Thread shutting down");
+}
+
+static void io_thread_free(pa_object *o) {
+    io_thread *t = IO_THREAD(o);
+
+    pa_assert(!t->thread);
+
+    pa_thread_mq_done(&t->thread_mq);
+
+    if (t->rtpoll)
+        pa_rtpoll_free(t->rtpoll);
+
+    pa_xfree(t);
+}
+
+static io_thread *io_thread_new(io_thread_pool *p, pa_usec_t period) {
+    io_thread *t;
+    char *name;
+
+    t = pa_msgobject_new(io_thread);
+    t->parent.parent.free = io_thread_free;
+    t->parent.process_msg = io_thread_process_msg;
+    t->pool = p;
+    t->period = period;
+    t->n_clients = 0;
+    t->thread = NULL;
+    pa_zero(t->thread_mq);
+    t->rtpoll = pa_rtpoll_new();
+    t->thread_info.clients = NULL;
+
+    if (pa_thread_mq_init(&t->thread_mq, p->core->mainloop, t->rtpoll) < 0) {
+        pa_log("pa_thread_mq_init() failed.");
+        goto fail;
+    }
+
+    name = pa_sprintf_malloc("io-%llums", (unsigned long long) (period / PA_USEC_PER_MSEC));
+    t->thread = pa_thread_new(name, thread_func, t);
+    pa_xfree(name);
+
+    if (!t->thread) {
+        pa_log("Failed to create thread.");
+        goto fail;
+    }
+
+    PA_LLIST_PREPEND(io_thread, p->threads, t);
+
+    pa_log_debug("Started shared IO thread with a period of %0.2f ms.", (double) period / PA_USEC_PER_MSEC);
+
+    return t;
+
+fail:
+    io_thread_unref(t);
+    return NULL;
+}
+
+static void io_thread_stop(io_thread *t) {
+    pa_assert(t->n_clients == 0);
+
+    PA_LLIST_REMOVE(io_thread, t->pool->threads, t);
+
+    pa_asyncmsgq_send(t->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(t->thread);
+    t->thread = NULL;
+
+    pa_log_debug("Stopped shared IO thread with a period of %0.2f ms.", (double) t->period / PA_USEC_PER_MSEC);
+
+    io_thread_unref(t);
+}
+
+static io_thread_pool *io_thread_pool_get(pa_core *core) {
+    io_thread_pool *p;
+
+    if ((p = pa_shared_get(core, "io-thread-pool"))) {
+        PA_REFCNT_INC(p);
+        return p;
+    }
+
+    p = pa_xnew0(io_thread_pool, 1);
+    PA_REFCNT_INIT(p);
+    p->core = core;
+
+    pa_assert_se(pa_shared_set(core, "io-thread-pool", p) >= 0);
+
+    return p;
+}
+
+static void io_thread_pool_unref(io_thread_pool *p) {
+    pa_assert(PA_REFCNT_VALUE(p) >= 1);
+
+    if (PA_REFCNT_DEC(p) > 0)
+        return;
+
+    pa_assert(!p->threads);
+    pa_assert_se(pa_shared_remove(p->core, "io-thread-pool") >= 0);
+
+    pa_xfree(p);
+}
+
+pa_io_client *pa_io_client_new(pa_core *core, pa_module *m, pa_usec_t period, pa_io_client_cb_t cb, void *userdata) {
+    io_thread_pool *p;
+    io_thread *t;
+    pa_io_client *c;
+
+    pa_assert(core);
+    pa_assert(m);
+    pa_assert(period > 0);
+    pa_assert(cb);
+
+    p = io_thread_pool_get(core);
+
+    for (t = p->threads; t; t = t->next)
+        if (t->period == period && t->n_clients < MAX_CLIENTS_PER_THREAD)
+            break;
+
+    if (!t && !(t = io_thread_new(p, period))) {
+        io_thread_pool_unref(p);
+        return NULL;
+    }
+
+    c = pa_xnew0(pa_io_client, 1);
+    c->thread = t;
+    c->module = m;
+    c->cb = cb;
+    c->userdata = userdata;
+
+    t->n_clients++;
+    pa_assert_se(pa_asyncmsgq_send(t->thread_mq.inq, PA_MSGOBJECT(t), IO_THREAD_MESSAGE_ADD_CLIENT, c, 0, NULL) == 0);
+
+    return c;
+}
+
+void pa_io_client_free(pa_io_client *c) {
+    io_thread *t;
+    io_thread_pool *p;
+
+    pa_assert(c);
+
+    t = c->thread;
+    p = t->pool;
+
+    pa_assert_se(pa_asyncmsgq_send(t->thread_mq.inq, PA_MSGOBJECT(t), IO_THREAD_MESSAGE_REMOVE_CLIENT, c, 0, NULL) == 0);
+    pa_xfree(c);
+
+    if (--t->n_clients == 0)
+        io_thread_stop(t);
+
+    io_thread_pool_unref(p);
+}
+
+pa_asyncmsgq *pa_io_client_get_asyncmsgq(pa_io_client *c) {
+    pa_assert(c);
+
+    return c->thread->thread_mq.inq;
+}
+
+pa_rtpoll *pa_io_client_get_rtpoll(pa_io_client *c) {
+    pa_assert(c);
+
+    return c->thread->rtpoll;
+}
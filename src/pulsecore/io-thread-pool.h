@@ -0,0 +1,55 @@
+#ifndef foopulsecoreiothreadpoolhfoo
+#define foopulsecoreiothreadpoolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulse/sample.h>
+
+#include <pulsecore/asyncmsgq.h>
+#include <pulsecore/core.h>
+#include <pulsecore/module.h>
+#include <pulsecore/rtpoll.h>
+
+/* IO threads shared by sinks and sources that only ever wake up on a
+ * timer, like the null sink. Instead of starting a thread of its own,
+ * such a device registers a client, and up to a few dozen clients that
+ * asked for the same period share one thread and its message queue.
+ * The wakeups of a thread are rounded up to multiples of its period, so
+ * all clients that are due at about the same time are served by one
+ * wakeup, at most one period late. */
+
+typedef struct pa_io_client pa_io_client;
+
+/* Called from the IO thread each time it wakes up, whether the client
+ * is due or not. Does whatever is due and returns the absolute time at
+ * which the client wants to be called next, or 0 if it has nothing
+ * scheduled. */
+typedef pa_usec_t (*pa_io_client_cb_t)(pa_io_client *c, void *userdata);
+
+/* Both to be called from the main thread. The callback is called from
+ * the moment pa_io_client_new() returns until pa_io_client_free() does.
+ * If the thread fails, the module is unloaded. */
+pa_io_client *pa_io_client_new(pa_core *core, pa_module *m, pa_usec_t period, pa_io_client_cb_t cb, void *userdata);
+void pa_io_client_free(pa_io_client *c);
+
+/* The queue and rtpoll of the thread the client runs in, to be used for
+ * the asyncmsgq and rtpoll of the client's sink or source */
+pa_asyncmsgq *pa_io_client_get_asyncmsgq(pa_io_client *c);
+pa_rtpoll *pa_io_client_get_rtpoll(pa_io_client *c);
+
+#endif
@@ -59,8 +59,12 @@ struct pa_ioline {
     pa_ioline_drain_cb_t drain_callback;
     void *drain_userdata;
 
+    pa_ioline_drain_cb_t eof_callback;
+    void *eof_userdata;
+
     bool dead:1;
     bool defer_close:1;
+    bool read_eof:1;
 };
 
 static void io_callback(pa_iochannel*io, void *userdata);
@@ -86,6 +90,9 @@ pa_ioline* pa_ioline_new(pa_iochannel *io) {
     l->drain_callback = NULL;
     l->drain_userdata = NULL;
 
+    l->eof_callback = NULL;
+    l->eof_userdata = NULL;
+
     l->mainloop = pa_iochannel_get_mainloop_api(io);
 
     l->defer_event = l->mainloop->defer_new(l->mainloop, defer_callback, l);
@@ -93,6 +100,7 @@ pa_ioline* pa_ioline_new(pa_iochannel *io) {
 
     l->dead = false;
     l->defer_close = false;
+    l->read_eof = false;
 
     pa_iochannel_set_callback(io, io_callback, l);
 
@@ -218,20 +226,36 @@ void pa_ioline_set_drain_callback(pa_ioline*l, pa_ioline_drain_cb_t callback, vo
     l->drain_userdata = userdata;
 }
 
-static void failure(pa_ioline *l, bool process_leftover) {
+void pa_ioline_set_eof_callback(pa_ioline*l, pa_ioline_drain_cb_t callback, void *userdata) {
     pa_assert(l);
     pa_assert(PA_REFCNT_VALUE(l) >= 1);
-    pa_assert(!l->dead);
 
-    if (process_leftover && l->rbuf_valid_length > 0) {
+    l->eof_callback = callback;
+    l->eof_userdata = userdata;
+}
+
+static void pass_leftover(pa_ioline *l) {
+    pa_assert(l);
+
+    if (l->rbuf_valid_length > 0) {
         /* Pass the last missing bit to the client */
 
         if (l->callback) {
             char *p = pa_xstrndup(l->rbuf+l->rbuf_index, l->rbuf_valid_length);
+            l->rbuf_valid_length = 0;
             l->callback(l, p, l->userdata);
             pa_xfree(p);
         }
     }
+}
+
+static void failure(pa_ioline *l, bool process_leftover) {
+    pa_assert(l);
+    pa_assert(PA_REFCNT_VALUE(l) >= 1);
+    pa_assert(!l->dead);
+
+    if (process_leftover)
+        pass_leftover(l);
 
     if (l->callback) {
         l->callback(l, NULL, l->userdata);
@@ -282,7 +306,7 @@ static int do_read(pa_ioline *l) {
     pa_assert(l);
     pa_assert(PA_REFCNT_VALUE(l) >= 1);
 
-    while (l->io && !l->dead && pa_iochannel_is_readable(l->io)) {
+    while (l->io && !l->dead && !l->read_eof && pa_iochannel_is_readable(l->io)) {
         ssize_t r;
         size_t len;
 
@@ -325,6 +349,13 @@ static int do_read(pa_ioline *l) {
             if (r < 0 && errno != ECONNRESET) {
                 pa_log("read(): %s", pa_cstrerror(errno));
                 failure(l, false);
+            } else if (r == 0 && l->eof_callback) {
+                /* Stop reading, but keep on writing */
+                l->read_eof = true;
+                pass_leftover(l);
+
+                if (!l->dead)
+                    l->eof_callback(l, l->eof_userdata);
             } else
                 failure(l, true);
 
@@ -50,6 +50,12 @@ void pa_ioline_set_callback(pa_ioline*io, pa_ioline_cb_t callback, void *userdat
 /* Set the callback function that is called when everything has been written */
 void pa_ioline_set_drain_callback(pa_ioline*io, pa_ioline_drain_cb_t callback, void *userdata);
 
+/* Set the callback function that is called when the other side shut
+ * down its end of the connection. The ioline is kept open for writing
+ * then, until it is closed. Without this callback the line callback is
+ * called with NULL and the ioline is closed right away. */
+void pa_ioline_set_eof_callback(pa_ioline*io, pa_ioline_drain_cb_t callback, void *userdata);
+
 /* Make sure to close the ioline object as soon as the send buffer is emptied */
 void pa_ioline_defer_close(pa_ioline *io);
 
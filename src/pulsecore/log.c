@@ -30,6 +30,10 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
 #ifdef HAVE_EXECINFO_H
 #include <execinfo.h>
 #endif
@@ -67,6 +71,10 @@
 #include <pulsecore/ratelimit.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/i18n.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/llist.h>
 
 #include "log.h"
 
@@ -83,6 +91,33 @@
 #define ENV_LOG_NO_RATELIMIT "PULSE_LOG_NO_RATE_LIMIT"
 #define LOG_MAX_SUFFIX_NUMBER 99
 
+/* Per thread buffer for asynchronous logging. Must be a power of two. */
+#define ASYNC_RING_SLOTS 64
+#define ASYNC_TEXT_MAX 512
+#define ASYNC_NICE_LEVEL 10
+
+typedef struct log_record {
+    pa_log_level_t level;
+    int line;
+    pa_usec_t time;
+    char file[128];
+    char func[64];
+    char text[ASYNC_TEXT_MAX];
+} log_record;
+
+typedef struct log_ring log_ring;
+
+/* Single producer (the thread owning it), single consumer (the logger
+ * thread). The indexes are free running. */
+struct log_ring {
+    pa_atomic_t write_idx, read_idx;
+    pa_atomic_t dropped;
+    pa_atomic_t dead;
+    char thread_name[32];
+    log_record records[ASYNC_RING_SLOTS];
+    PA_LLIST_FIELDS(log_ring);
+};
+
 static char *ident = NULL; /* in local charset format */
 static pa_log_target target = { PA_LOG_STDERR, NULL };
 static pa_log_target_type_t target_override;
@@ -94,6 +129,16 @@ static bool no_rate_limit = false;
 static int log_fd = -1;
 static int write_type = 0;
 
+static pa_atomic_t async_enabled = PA_ATOMIC_INIT(0);
+static pa_static_mutex async_mutex = PA_STATIC_MUTEX_INIT;
+static PA_LLIST_HEAD(log_ring, async_rings) = NULL;
+static pa_thread *async_thread = NULL, *async_owner = NULL;
+static pa_semaphore *async_semaphore = NULL;
+static bool async_quit = false;
+
+static void ring_free_cb(void *p);
+PA_STATIC_TLS_DECLARE(current_ring, ring_free_cb);
+
 #ifdef HAVE_SYSLOG_H
 static const int level_to_syslog[] = {
     [PA_LOG_ERROR] = LOG_ERR,
@@ -368,69 +413,56 @@ static void log_syslog(pa_log_level_t level, char *t, char *timestamp, char *loc
 }
 #endif
 
-void pa_log_levelv_meta(
+/* Formats the location and time stamp belonging to a message and
+ * hands it line by line to the current log target. thread_name may be
+ * NULL to refer to the calling thread. */
+static void log_text(
         pa_log_level_t level,
-        const char*file,
+        const char *file,
         int line,
         const char *func,
-        const char *format,
-        va_list ap) {
+        const char *thread_name,
+        pa_usec_t now,
+        char *text,
+        const char *bt) {
 
     char *t, *n;
-    int saved_errno = errno;
-    char *bt = NULL;
     pa_log_target_type_t _target;
-    pa_log_level_t _maximum_level;
-    unsigned _show_backtrace;
     pa_log_flags_t _flags;
-
-    /* We don't use dynamic memory allocation here to minimize the hit
-     * in RT threads */
-    char text[16*1024], location[128], timestamp[32];
-
-    pa_assert(level < PA_LOG_LEVEL_MAX);
-    pa_assert(format);
-
-    init_defaults();
+    char location[128], timestamp[32];
 
     _target = target_override_set ? target_override : target.type;
-    _maximum_level = PA_MAX(maximum_level, maximum_level_override);
-    _show_backtrace = PA_MAX(show_backtrace, show_backtrace_override);
     _flags = flags | flags_override;
 
-    if (PA_LIKELY(level > _maximum_level)) {
-        errno = saved_errno;
-        return;
-    }
-
-    pa_vsnprintf(text, sizeof(text), format, ap);
+    if (!thread_name && (_flags & (PA_LOG_PRINT_META|PA_LOG_PRINT_FILE)))
+        thread_name = pa_strnull(pa_thread_get_name(pa_thread_self()));
 
     if ((_flags & PA_LOG_PRINT_META) && file && line > 0 && func)
         pa_snprintf(location, sizeof(location), "[%s][%s:%i %s()] ",
-                    pa_strnull(pa_thread_get_name(pa_thread_self())), file, line, func);
+                    thread_name, file, line, func);
     else if ((_flags & (PA_LOG_PRINT_META|PA_LOG_PRINT_FILE)) && file)
         pa_snprintf(location, sizeof(location), "[%s] %s: ",
-                    pa_strnull(pa_thread_get_name(pa_thread_self())), pa_path_get_filename(file));
+                    thread_name, pa_path_get_filename(file));
     else
         location[0] = 0;
 
     if (_flags & PA_LOG_PRINT_TIME) {
         static pa_usec_t start, last;
-        pa_usec_t u, a, r;
-
-        u = pa_rtclock_now();
+        pa_usec_t a, r;
 
         PA_ONCE_BEGIN {
-            start = u;
-            last = u;
+            start = now;
+            last = now;
         } PA_ONCE_END;
 
-        r = u - last;
-        a = u - start;
+        /* Messages drained from the asynchronous buffers may be
+         * slightly older than the last one printed */
+        r = now > last ? now - last : 0;
+        a = now > start ? now - start : 0;
 
         /* This is not thread safe, but this is a debugging tool only
          * anyway. */
-        last = u;
+        last = now;
 
         pa_snprintf(timestamp, sizeof(timestamp), "(%4llu.%03llu|%4llu.%03llu) ",
                     (unsigned long long) (a / PA_USEC_PER_SEC),
@@ -441,11 +473,6 @@ void pa_log_levelv_meta(
     } else
         timestamp[0] = 0;
 
-#ifdef HAVE_EXECINFO_H
-    if (_show_backtrace > 0)
-        bt = get_backtrace(_show_backtrace);
-#endif
-
     if (!pa_utf8_valid(text))
         pa_logl(level, "Invalid UTF-8 string following below:");
 
@@ -523,7 +550,6 @@ void pa_log_levelv_meta(
 #else
                     pa_log_target new_target = { .type = PA_LOG_STDERR, .file = NULL };
 
-                    saved_errno = errno;
                     fprintf(stderr, "%s\n", "Error writing logs to the journal. Redirect log messages to console.");
                     fprintf(stderr, "%s %s\n", metadata, t);
 #endif
@@ -552,7 +578,6 @@ void pa_log_levelv_meta(
                             || (bt && pa_write(log_fd, bt, strlen(bt), &write_type) < 0)
                             || (pa_write(log_fd, "\n", 1, &write_type) < 0)) {
                         pa_log_target new_target = { .type = PA_LOG_STDERR, .file = NULL };
-                        saved_errno = errno;
                         fprintf(stderr, "%s\n", "Error writing logs to a file descriptor. Redirect log messages to console.");
                         fprintf(stderr, "%s %s\n", metadata, t);
                         pa_log_set_target(&new_target);
@@ -569,6 +594,260 @@ void pa_log_levelv_meta(
         }
     }
 
+}
+
+
+/* Asynchronous logging: messages from threads other than the one that
+ * enabled it are formatted into a small per-thread ring buffer and
+ * written out by a separate low priority thread, so that the IO
+ * threads never block on stderr, syslog or the journal. */
+
+static void async_drain(void);
+
+static log_ring *get_ring(pa_thread *self) {
+    log_ring *r;
+    pa_mutex *m;
+
+    if ((r = PA_STATIC_TLS_GET(current_ring)))
+        return r;
+
+    r = pa_xnew0(log_ring, 1);
+    pa_strlcpy(r->thread_name, pa_strnull(pa_thread_get_name(self)), sizeof(r->thread_name));
+
+    m = pa_static_mutex_get(&async_mutex, false, false);
+    pa_mutex_lock(m);
+    PA_LLIST_PREPEND(log_ring, async_rings, r);
+    pa_mutex_unlock(m);
+
+    PA_STATIC_TLS_SET(current_ring, r);
+    return r;
+}
+
+static void ring_free_cb(void *p) {
+    log_ring *r = p;
+    pa_mutex *m;
+    bool running;
+
+    m = pa_static_mutex_get(&async_mutex, false, false);
+    pa_mutex_lock(m);
+
+    /* If the logger thread is around, let it write out whatever is
+     * left and free the ring; otherwise do it ourselves */
+    pa_atomic_store(&r->dead, 1);
+
+    if ((running = !!async_thread))
+        pa_semaphore_post(async_semaphore);
+
+    pa_mutex_unlock(m);
+
+    if (!running)
+        async_drain();
+}
+
+static bool log_async(
+        pa_log_level_t level,
+        const char *file,
+        int line,
+        const char *func,
+        const char *format,
+        va_list ap) {
+
+    pa_thread *self;
+    log_ring *r;
+    log_record *rec;
+    unsigned w;
+
+    self = pa_thread_self();
+
+    if (self == async_owner || self == async_thread)
+        return false;
+
+    r = get_ring(self);
+
+    w = (unsigned) pa_atomic_load(&r->write_idx);
+
+    if (w - (unsigned) pa_atomic_load(&r->read_idx) >= ASYNC_RING_SLOTS) {
+        pa_atomic_inc(&r->dropped);
+        return true;
+    }
+
+    rec = &r->records[w % ASYNC_RING_SLOTS];
+    rec->level = level;
+    rec->line = line;
+    rec->time = pa_rtclock_now();
+    pa_strlcpy(rec->file, pa_strempty(file), sizeof(rec->file));
+    pa_strlcpy(rec->func, pa_strempty(func), sizeof(rec->func));
+    pa_vsnprintf(rec->text, sizeof(rec->text), format, ap);
+
+    pa_atomic_inc(&r->write_idx);
+    pa_semaphore_post(async_semaphore);
+
+    return true;
+}
+
+/* Called with async_mutex held */
+static void ring_drain(log_ring *r) {
+    unsigned i, w;
+    int dropped;
+
+    i = (unsigned) pa_atomic_load(&r->read_idx);
+    w = (unsigned) pa_atomic_load(&r->write_idx);
+
+    for (; i != w; i++) {
+        log_record *rec = &r->records[i % ASYNC_RING_SLOTS];
+
+        log_text(rec->level,
+                 rec->file[0] ? rec->file : NULL, rec->line,
+                 rec->func[0] ? rec->func : NULL,
+                 r->thread_name, rec->time, rec->text, NULL);
+
+        pa_atomic_inc(&r->read_idx);
+    }
+
+    if ((dropped = pa_atomic_load(&r->dropped)) > 0) {
+        char text[128];
+
+        pa_atomic_sub(&r->dropped, dropped);
+
+        pa_snprintf(text, sizeof(text), "%i log messages dropped, asynchronous log buffer full.", dropped);
+        log_text(PA_LOG_WARN, NULL, 0, NULL, r->thread_name, pa_rtclock_now(), text, NULL);
+    }
+}
+
+static void async_drain(void) {
+    log_ring *r, *n;
+    pa_mutex *m;
+
+    m = pa_static_mutex_get(&async_mutex, false, false);
+    pa_mutex_lock(m);
+
+    for (r = async_rings; r; r = n) {
+        n = r->next;
+
+        ring_drain(r);
+
+        if (pa_atomic_load(&r->dead)) {
+            PA_LLIST_REMOVE(log_ring, async_rings, r);
+            pa_xfree(r);
+        }
+    }
+
+    pa_mutex_unlock(m);
+}
+
+static void async_thread_func(void *userdata) {
+
+#if defined(__linux__) && defined(HAVE_SYS_RESOURCE_H)
+    /* On Linux the nice level is per thread, so this doesn't affect
+     * the rest of the daemon */
+    setpriority(PRIO_PROCESS, 0, ASYNC_NICE_LEVEL);
+#endif
+
+    for (;;) {
+        pa_semaphore_wait(async_semaphore);
+
+        async_drain();
+
+        if (async_quit)
+            break;
+    }
+}
+
+void pa_log_set_async(bool enabled) {
+    pa_mutex *m;
+
+    if (enabled == !!async_thread)
+        return;
+
+    init_defaults();
+
+    if (enabled) {
+        PA_ONCE_BEGIN {
+            /* Never freed, threads racing with pa_log_set_async(false)
+             * might still post it */
+            async_semaphore = pa_semaphore_new(0);
+        } PA_ONCE_END;
+
+        async_quit = false;
+        async_owner = pa_thread_self();
+
+        if (!(async_thread = pa_thread_new("log", async_thread_func, NULL))) {
+            pa_log_warn("Failed to create asynchronous logging thread.");
+            async_owner = NULL;
+            return;
+        }
+
+        pa_atomic_store(&async_enabled, 1);
+
+    } else {
+        pa_atomic_store(&async_enabled, 0);
+
+        async_quit = true;
+        pa_semaphore_post(async_semaphore);
+        pa_thread_free(async_thread);
+
+        m = pa_static_mutex_get(&async_mutex, false, false);
+        pa_mutex_lock(m);
+        async_thread = NULL;
+        pa_mutex_unlock(m);
+
+        /* Write out whatever came in while the thread was shutting down */
+        async_drain();
+
+        async_owner = NULL;
+    }
+}
+
+void pa_log_levelv_meta(
+        pa_log_level_t level,
+        const char*file,
+        int line,
+        const char *func,
+        const char *format,
+        va_list ap) {
+
+    int saved_errno = errno;
+    char *bt = NULL;
+    pa_log_level_t _maximum_level;
+    unsigned _show_backtrace;
+
+    /* We don't use dynamic memory allocation here to minimize the hit
+     * in RT threads */
+    char text[16*1024];
+
+    pa_assert(level < PA_LOG_LEVEL_MAX);
+    pa_assert(format);
+
+    init_defaults();
+
+    _maximum_level = PA_MAX(maximum_level, maximum_level_override);
+    _show_backtrace = PA_MAX(show_backtrace, show_backtrace_override);
+
+    if (PA_LIKELY(level > _maximum_level)) {
+        errno = saved_errno;
+        return;
+    }
+
+    /* Errors are always written out right away, since they might be
+     * followed by an abort(). Backtraces need to be collected on the
+     * calling thread, too. */
+    if (pa_atomic_load(&async_enabled) && level > PA_LOG_ERROR && _show_backtrace == 0 &&
+        log_async(level, file, line, func, format, ap)) {
+        errno = saved_errno;
+        return;
+    }
+
+    pa_vsnprintf(text, sizeof(text), format, ap);
+
+#ifdef HAVE_EXECINFO_H
+    if (_show_backtrace > 0)
+        bt = get_backtrace(_show_backtrace);
+#endif
+
+    log_text(level, file, line, func, NULL,
+             ((flags | flags_override) & PA_LOG_PRINT_TIME) ? pa_rtclock_now() : 0,
+             text, bt);
+
     pa_xfree(bt);
     errno = saved_errno;
 }
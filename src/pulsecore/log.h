@@ -87,6 +87,11 @@ void pa_log_set_show_backtrace(unsigned nlevels);
 /* Skip the first backtrace frames */
 void pa_log_set_skip_backtrace(unsigned nlevels);
 
+/* Hand messages below PA_LOG_ERROR that are logged by other threads
+ * than the calling one to a low priority logger thread, instead of
+ * writing them out right away. Disabling flushes what is pending. */
+void pa_log_set_async(bool enabled);
+
 void pa_log_level_meta(
         pa_log_level_t level,
         const char*file,
@@ -23,6 +23,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 
 #include <pulse/xmalloc.h>
@@ -32,8 +33,22 @@
 
 #include "ltdl-helper.h"
 
-pa_void_func_t pa_load_sym(lt_dlhandle handle, const char *module, const char *symbol) {
+static const lt_dlsymlist *preloaded_symbols = NULL;
+
+static char *mangle(const char *module, const char *symbol) {
     char *sn, *c;
+
+    sn = pa_sprintf_malloc("%s_LTX_%s", module, symbol);
+
+    for (c = sn; *c; c++)
+        if (!isalnum((unsigned char)*c))
+            *c = '_';
+
+    return sn;
+}
+
+pa_void_func_t pa_load_sym(lt_dlhandle handle, const char *module, const char *symbol) {
+    char *sn;
     pa_void_func_t f;
 
     pa_assert(handle);
@@ -50,14 +65,57 @@ pa_void_func_t pa_load_sym(lt_dlhandle handle, const char *module, const char *s
     /* As the .la files might have been cleansed from the system, we should
      * try with the ltdl prefix as well. */
 
-    sn = pa_sprintf_malloc("%s_LTX_%s", module, symbol);
-
-    for (c = sn; *c; c++)
-        if (!isalnum((unsigned char)*c))
-            *c = '_';
-
+    sn = mangle(module, symbol);
     f = (pa_void_func_t) lt_dlsym(handle, sn);
     pa_xfree(sn);
 
     return f;
 }
+
+void pa_set_preloaded_symbols(const lt_dlsymlist *symbols) {
+    preloaded_symbols = symbols;
+}
+
+/* The table is a sequence of modules, each one an entry with the module
+ * file name and no address, followed by the symbols of the module */
+const lt_dlsymlist *pa_find_preloaded(const char *module) {
+    const lt_dlsymlist *l;
+    size_t n;
+
+    pa_assert(module);
+
+    if (!preloaded_symbols)
+        return NULL;
+
+    n = strlen(module);
+
+    for (l = preloaded_symbols; l->name; l++) {
+        if (l->address)
+            continue;
+
+        /* Compare without the file name extension */
+        if (strncmp(l->name, module, n) == 0 && (l->name[n] == 0 || l->name[n] == '.'))
+            return l;
+    }
+
+    return NULL;
+}
+
+pa_void_func_t pa_load_preloaded_sym(const lt_dlsymlist *entry, const char *module, const char *symbol) {
+    const lt_dlsymlist *l;
+    char *sn;
+
+    pa_assert(entry);
+    pa_assert(module);
+    pa_assert(symbol);
+
+    sn = mangle(module, symbol);
+
+    for (l = entry + 1; l->name && l->address; l++)
+        if (pa_streq(l->name, sn) || pa_streq(l->name, symbol))
+            break;
+
+    pa_xfree(sn);
+
+    return l->name && l->address ? (pa_void_func_t) l->address : NULL;
+}
@@ -26,4 +26,15 @@ typedef void (*pa_void_func_t)(void);
 
 pa_void_func_t pa_load_sym(lt_dlhandle handle, const char*module, const char *symbol);
 
+/* Modules linked into the daemon with -dlpreopen are registered from the
+ * symbol table libtool generates for it. Loading them then skips ltdl, the
+ * module search path and dlopen() altogether. */
+void pa_set_preloaded_symbols(const lt_dlsymlist *symbols);
+
+/* Returns the table entry that starts the given preloaded module, or NULL
+ * if the module isn't linked in */
+const lt_dlsymlist *pa_find_preloaded(const char *module);
+
+pa_void_func_t pa_load_preloaded_sym(const lt_dlsymlist *entry, const char *module, const char *symbol);
+
 #endif
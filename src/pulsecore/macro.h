@@ -68,6 +68,14 @@ static inline size_t PA_ALIGN(size_t l) {
     #define PA_DECLARE_ALIGNED(n,t,v)      t v
 #endif
 
+/* The cache line size of the CPUs we care about */
+#define PA_CACHELINE_SIZE 64
+
+/* Keeps the struct members before and after it on different cache
+ * lines, so that fields written by different threads don't share one.
+ * Unlike PA_DECLARE_ALIGNED() this works with any allocation. */
+#define PA_CACHELINE_PAD(name) char name[PA_CACHELINE_SIZE]
+
 #ifdef __GNUC__
 #define typeof __typeof__
 #endif
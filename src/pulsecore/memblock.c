@@ -45,6 +45,7 @@
 #include <pulsecore/refcnt.h>
 #include <pulsecore/llist.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/thread.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/memtrap.h>
 
@@ -54,12 +55,19 @@
  * note that the footprint is usually much smaller, since the data is
  * stored in SHM and our OS does not commit the memory before we use
  * it for the first time. */
-#define PA_MEMPOOL_SLOTS_MAX 1024
-#define PA_MEMPOOL_SLOT_SIZE (64*1024)
+#define PA_MEMPOOL_SIZE_DEFAULT (64*1024*1024)
 
-#define PA_MEMEXPORT_SLOTS_MAX 128
+/* Every slot class but the largest gets this fraction of the pool, the
+ * largest one gets the rest */
+#define PA_MEMPOOL_SMALL_CLASS_SHARE 16
+
+/* Slots smaller than a page are kept aligned to this */
+#define PA_MEMPOOL_SLOT_ALIGN 64
+
+/* Maximum number of free slots per class, and of unused pa_memblock
+ * structures, a thread keeps for itself */
+#define PA_MEMBLOCK_CACHE_SIZE 32
 
-#define PA_MEMIMPORT_SLOTS_MAX 160
 #define PA_MEMIMPORT_SEGMENTS_MAX 16
 
 struct pa_memblock {
@@ -130,6 +138,9 @@ struct pa_memimport {
     pa_hashmap *segments;
     pa_hashmap *blocks;
 
+    /* Total length of the blocks in blocks */
+    size_t size;
+
     /* Called whenever an imported memory block is no longer
      * needed. */
     pa_memimport_release_cb_t release_cb;
@@ -141,18 +152,22 @@ struct pa_memimport {
 struct memexport_slot {
     PA_LLIST_FIELDS(struct memexport_slot);
     pa_memblock *block;
+    uint32_t id;
 };
 
 struct pa_memexport {
     pa_mutex *mutex;
     pa_mempool *pool;
 
-    struct memexport_slot slots[PA_MEMEXPORT_SLOTS_MAX];
-
+    /* Slots are allocated as needed, up to max_slots, and keep their
+     * id for good. Used ones are found by id in used_slots, and those
+     * holding imported blocks, the only ones that may be revoked, are
+     * also kept in imported_slots. */
+    pa_hashmap *used_slots;
     PA_LLIST_HEAD(struct memexport_slot, free_slots);
-    PA_LLIST_HEAD(struct memexport_slot, used_slots);
-    unsigned n_init;
-    unsigned baseidx;
+    PA_LLIST_HEAD(struct memexport_slot, imported_slots);
+    unsigned n_slots;
+    unsigned max_slots;
 
     /* Called whenever a client from which we imported a memory block
        which we in turn exported to another client dies and we need to
@@ -163,6 +178,22 @@ struct pa_memexport {
     PA_LLIST_FIELDS(pa_memexport);
 };
 
+/* The slots of one size. The slots of all classes are laid out one class
+ * after the other in the pool memory, so exported blocks are still just
+ * an offset into a single segment. */
+struct mempool_slot_class {
+    size_t slot_size;
+    unsigned n_slots;
+
+    /* Offset of the first slot in the pool memory */
+    size_t offset;
+
+    pa_atomic_t n_init;
+
+    /* A list of free slots that may be reused */
+    pa_flist *free_slots;
+};
+
 struct pa_mempool {
     /* Reference count the mempool
      *
@@ -188,25 +219,145 @@ struct pa_mempool {
 
     bool global;
 
-    size_t block_size;
-    unsigned n_blocks;
     bool is_remote_writable;
 
-    pa_atomic_t n_init;
+    /* Unique for the lifetime of the process, so that thread caches can
+     * tell whether their pool is still around */
+    unsigned id;
+
+    /* In increasing order of the slot size */
+    struct mempool_slot_class classes[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    unsigned n_classes;
 
     PA_LLIST_HEAD(pa_memimport, imports);
     PA_LLIST_HEAD(pa_memexport, exports);
 
-    /* A list of free slots that may be reused */
-    pa_flist *free_slots;
-
     pa_mempool_stat stat;
+
+    PA_LLIST_FIELDS(pa_mempool);
+};
+
+/* Every thread keeps a few free slots of the pool it last freed blocks
+ * to, and a few unused pa_memblock structures, so that most allocations
+ * don't have to touch the shared free lists at all. The cache doesn't
+ * hold a reference to the pool: when it switches pools it returns the
+ * slots only if the old pool is still registered in the list of live
+ * pools, otherwise they are dropped together with the pool memory. */
+struct memblock_cache {
+    unsigned pool_id;
+    struct mempool_slot *slots[PA_MEMPOOL_SLOT_CLASSES_MAX][PA_MEMBLOCK_CACHE_SIZE];
+    unsigned n_slots[PA_MEMPOOL_SLOT_CLASSES_MAX];
+
+    pa_memblock *memblocks[PA_MEMBLOCK_CACHE_SIZE];
+    unsigned n_memblocks;
 };
 
 static void segment_detach(pa_memimport_segment *seg);
+static void memblock_cache_free(void *userdata);
 
 PA_STATIC_FLIST_DECLARE(unused_memblocks, 0, pa_xfree);
 
+PA_STATIC_TLS_DECLARE(memblock_cache, memblock_cache_free);
+
+/* Protects the list of live pools, which is only touched when pools are
+ * created or freed and when a thread cache switches pools */
+static pa_static_mutex pools_mutex = PA_STATIC_MUTEX_INIT;
+static PA_LLIST_HEAD(pa_mempool, pools) = NULL;
+static pa_atomic_t pool_id_counter = PA_ATOMIC_INIT(0);
+
+static struct memblock_cache *memblock_cache_get(void) {
+    struct memblock_cache *cache;
+
+    if (PA_LIKELY(cache = PA_STATIC_TLS_GET(memblock_cache)))
+        return cache;
+
+    cache = pa_xnew0(struct memblock_cache, 1);
+    PA_STATIC_TLS_SET(memblock_cache, cache);
+
+    return cache;
+}
+
+/* Hand the cached slots back to their pool, if it still exists */
+static void memblock_cache_flush_slots(struct memblock_cache *cache) {
+    pa_mutex *m;
+    pa_mempool *p;
+    unsigned c;
+
+    if (cache->pool_id == 0)
+        return;
+
+    m = pa_static_mutex_get(&pools_mutex, false, false);
+    pa_mutex_lock(m);
+
+    PA_LLIST_FOREACH(p, pools)
+        if (p->id == cache->pool_id)
+            break;
+
+    for (c = 0; c < PA_MEMPOOL_SLOT_CLASSES_MAX; c++) {
+        if (p)
+            while (cache->n_slots[c] > 0)
+                while (pa_flist_push(p->classes[c].free_slots, cache->slots[c][--cache->n_slots[c]]) < 0)
+                    ;
+
+        cache->n_slots[c] = 0;
+    }
+
+    pa_mutex_unlock(m);
+
+    cache->pool_id = 0;
+}
+
+static void memblock_cache_free(void *userdata) {
+    struct memblock_cache *cache = userdata;
+
+    memblock_cache_flush_slots(cache);
+
+    while (cache->n_memblocks > 0) {
+        pa_memblock *b = cache->memblocks[--cache->n_memblocks];
+
+        if (pa_flist_push(PA_STATIC_FLIST_GET(unused_memblocks), b) < 0)
+            pa_xfree(b);
+    }
+
+    pa_xfree(cache);
+}
+
+/* No lock necessary */
+static pa_memblock *memblock_struct_new(pa_mempool *p) {
+    struct memblock_cache *cache = memblock_cache_get();
+    pa_memblock *b;
+
+    if (cache->n_memblocks > 0) {
+        pa_atomic_inc(&p->stat.n_cache_hits);
+        return cache->memblocks[--cache->n_memblocks];
+    }
+
+    pa_atomic_inc(&p->stat.n_cache_misses);
+
+    if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
+        b = pa_xnew(pa_memblock, 1);
+
+    return b;
+}
+
+/* No lock necessary */
+static void memblock_struct_free(pa_memblock *b) {
+    struct memblock_cache *cache = memblock_cache_get();
+
+    if (cache->n_memblocks >= PA_MEMBLOCK_CACHE_SIZE) {
+        /* Keep half of them, so that alternating frees and allocations
+         * stay in the cache */
+        while (cache->n_memblocks > PA_MEMBLOCK_CACHE_SIZE / 2) {
+            pa_memblock *k = cache->memblocks[--cache->n_memblocks];
+
+            if (pa_flist_push(PA_STATIC_FLIST_GET(unused_memblocks), k) < 0)
+                pa_xfree(k);
+        }
+    }
+
+    cache->memblocks[cache->n_memblocks++] = b;
+}
+
 /* No lock necessary */
 static void stat_add(pa_memblock*b) {
     pa_assert(b);
@@ -292,60 +443,143 @@ static pa_memblock *memblock_new_appended(pa_mempool *p, size_t length) {
 }
 
 /* No lock necessary */
-static struct mempool_slot* mempool_allocate_slot(pa_mempool *p) {
+static struct mempool_slot* mempool_allocate_slot_from_class(pa_mempool *p, unsigned c) {
+    struct mempool_slot_class *class;
+    struct memblock_cache *cache;
     struct mempool_slot *slot;
     pa_assert(p);
+    pa_assert(c < p->n_classes);
 
-    if (!(slot = pa_flist_pop(p->free_slots))) {
-        int idx;
+    class = &p->classes[c];
+    cache = memblock_cache_get();
 
-        /* The free list was empty, we have to allocate a new entry */
+    if (cache->pool_id == p->id && cache->n_slots[c] > 0) {
+        slot = cache->slots[c][--cache->n_slots[c]];
+        pa_atomic_inc(&p->stat.n_cache_hits);
 
-        if ((unsigned) (idx = pa_atomic_inc(&p->n_init)) >= p->n_blocks)
-            pa_atomic_dec(&p->n_init);
-        else
-            slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (p->block_size * (size_t) idx));
+    } else {
+        pa_atomic_inc(&p->stat.n_cache_misses);
 
-        if (!slot) {
-            if (pa_log_ratelimit(PA_LOG_DEBUG))
-                pa_log_debug("Pool full");
-            pa_atomic_inc(&p->stat.n_pool_full);
-            return NULL;
+        if (!(slot = pa_flist_pop(class->free_slots))) {
+            int idx;
+
+            /* The free list was empty, we have to allocate a new entry */
+
+            if ((unsigned) (idx = pa_atomic_inc(&class->n_init)) >= class->n_slots) {
+                pa_atomic_dec(&class->n_init);
+                return NULL;
+            }
+
+            slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + class->offset + (class->slot_size * (size_t) idx));
         }
     }
 
+    pa_atomic_inc(&p->stat.n_slots_allocated[c]);
+
 /* #ifdef HAVE_VALGRIND_MEMCHECK_H */
 /*     if (PA_UNLIKELY(pa_in_valgrind())) { */
-/*         VALGRIND_MALLOCLIKE_BLOCK(slot, p->block_size, 0, 0); */
+/*         VALGRIND_MALLOCLIKE_BLOCK(slot, class->slot_size, 0, 0); */
 /*     } */
 /* #endif */
 
     return slot;
 }
 
+/* No lock necessary */
+static void mempool_free_slot(pa_mempool *p, unsigned c, struct mempool_slot *slot) {
+    struct mempool_slot_class *class = &p->classes[c];
+    struct memblock_cache *cache = memblock_cache_get();
+    unsigned max;
+
+    if (cache->pool_id != p->id) {
+        memblock_cache_flush_slots(cache);
+        cache->pool_id = p->id;
+    }
+
+    /* Don't let the threads hide more than a small part of a class from
+     * each other */
+    max = PA_MIN(class->n_slots / 16, PA_MEMBLOCK_CACHE_SIZE);
+
+    if (cache->n_slots[c] >= max) {
+        /* Keep half of them, so that alternating frees and allocations
+         * stay in the cache. The free list dimensions should easily
+         * allow all slots to fit in, hence try harder if pushing a slot
+         * into the free list fails */
+        while (cache->n_slots[c] > max / 2)
+            while (pa_flist_push(class->free_slots, cache->slots[c][--cache->n_slots[c]]) < 0)
+                ;
+
+        if (max <= 0) {
+            while (pa_flist_push(class->free_slots, slot) < 0)
+                ;
+            return;
+        }
+    }
+
+    cache->slots[c][cache->n_slots[c]++] = slot;
+}
+
+/* No lock necessary. Takes a slot from the smallest class that can hold
+ * size bytes, or from the next larger one if that class is full. */
+static struct mempool_slot* mempool_allocate_slot(pa_mempool *p, size_t size) {
+    struct mempool_slot *slot;
+    unsigned c;
+    pa_assert(p);
+
+    for (c = 0; c < p->n_classes && p->classes[c].slot_size < size; c++)
+        ;
+
+    for (; c < p->n_classes; c++) {
+        if ((slot = mempool_allocate_slot_from_class(p, c)))
+            return slot;
+
+        pa_atomic_inc(&p->stat.n_slot_class_full[c]);
+    }
+
+    if (pa_log_ratelimit(PA_LOG_DEBUG))
+        pa_log_debug("Pool full");
+    pa_atomic_inc(&p->stat.n_pool_full);
+    return NULL;
+}
+
 /* No lock necessary, totally redundant anyway */
 static inline void* mempool_slot_data(struct mempool_slot *slot) {
     return slot;
 }
 
 /* No lock necessary */
-static unsigned mempool_slot_idx(pa_mempool *p, void *ptr) {
+static unsigned mempool_slot_class_by_ptr(pa_mempool *p, void *ptr) {
+    size_t offset;
+    unsigned c;
+
     pa_assert(p);
 
     pa_assert((uint8_t*) ptr >= (uint8_t*) p->memory.ptr);
     pa_assert((uint8_t*) ptr < (uint8_t*) p->memory.ptr + p->memory.size);
 
-    return (unsigned) ((size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr) / p->block_size);
+    offset = (size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr);
+
+    for (c = p->n_classes - 1; c > 0; c--)
+        if (offset >= p->classes[c].offset)
+            break;
+
+    return c;
 }
 
 /* No lock necessary */
-static struct mempool_slot* mempool_slot_by_ptr(pa_mempool *p, void *ptr) {
-    unsigned idx;
+static struct mempool_slot* mempool_slot_by_ptr(pa_mempool *p, unsigned c, void *ptr) {
+    struct mempool_slot_class *class;
+    size_t idx;
+
+    pa_assert(c < p->n_classes);
+    class = &p->classes[c];
 
-    if ((idx = mempool_slot_idx(p, ptr)) == (unsigned) -1)
+    idx = ((size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr) - class->offset) / class->slot_size;
+
+    if (idx >= class->n_slots)
         return NULL;
 
-    return (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (idx * p->block_size));
+    return (struct mempool_slot*) ((uint8_t*) p->memory.ptr + class->offset + (idx * class->slot_size));
 }
 
 /* No lock necessary */
@@ -361,6 +595,14 @@ void pa_mempool_set_is_remote_writable(pa_mempool *p, bool writable) {
     p->is_remote_writable = writable;
 }
 
+/* Should be called right after creating the pool, before any blocks are
+ * allocated from it */
+int pa_mempool_pin(pa_mempool *p, bool huge_pages, bool lock) {
+    pa_assert(p);
+
+    return pa_shm_pin(&p->memory, huge_pages, lock);
+}
+
 /* No lock necessary */
 pa_memblock *pa_memblock_new_pool(pa_mempool *p, size_t length) {
     pa_memblock *b = NULL;
@@ -382,28 +624,27 @@ pa_memblock *pa_memblock_new_pool(pa_mempool *p, size_t length) {
     if (length == (size_t) -1)
         length = pa_mempool_block_size_max(p);
 
-    if (p->block_size >= PA_ALIGN(sizeof(pa_memblock)) + length) {
+    if (pa_mempool_block_size_max(p) >= length) {
 
-        if (!(slot = mempool_allocate_slot(p)))
+        if (!(slot = mempool_allocate_slot(p, PA_ALIGN(sizeof(pa_memblock)) + length)))
             return NULL;
 
         b = mempool_slot_data(slot);
         b->type = PA_MEMBLOCK_POOL;
         pa_atomic_ptr_store(&b->data, (uint8_t*) b + PA_ALIGN(sizeof(pa_memblock)));
 
-    } else if (p->block_size >= length) {
+    } else if (p->classes[p->n_classes - 1].slot_size >= length) {
 
-        if (!(slot = mempool_allocate_slot(p)))
+        if (!(slot = mempool_allocate_slot(p, length)))
             return NULL;
 
-        if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
-            b = pa_xnew(pa_memblock, 1);
+        b = memblock_struct_new(p);
 
         b->type = PA_MEMBLOCK_POOL_EXTERNAL;
         pa_atomic_ptr_store(&b->data, mempool_slot_data(slot));
 
     } else {
-        pa_log_debug("Memory block too large for pool: %lu > %lu", (unsigned long) length, (unsigned long) p->block_size);
+        pa_log_debug("Memory block too large for pool: %lu > %lu", (unsigned long) length, (unsigned long) p->classes[p->n_classes - 1].slot_size);
         pa_atomic_inc(&p->stat.n_too_large_for_pool);
         return NULL;
     }
@@ -429,8 +670,7 @@ pa_memblock *pa_memblock_new_fixed(pa_mempool *p, void *d, size_t length, bool r
     pa_assert(length != (size_t) -1);
     pa_assert(length);
 
-    if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
-        b = pa_xnew(pa_memblock, 1);
+    b = memblock_struct_new(p);
 
     PA_REFCNT_INIT(b);
     b->pool = p;
@@ -463,8 +703,7 @@ pa_memblock *pa_memblock_new_user(
     pa_assert(length != (size_t) -1);
     pa_assert(free_cb);
 
-    if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
-        b = pa_xnew(pa_memblock, 1);
+    b = memblock_struct_new(p);
 
     PA_REFCNT_INIT(b);
     b->pool = p;
@@ -601,8 +840,7 @@ static void memblock_free(pa_memblock *b) {
             /* Fall through */
 
         case PA_MEMBLOCK_FIXED:
-            if (pa_flist_push(PA_STATIC_FLIST_GET(unused_memblocks), b) < 0)
-                pa_xfree(b);
+            memblock_struct_free(b);
 
             break;
 
@@ -625,6 +863,7 @@ static void memblock_free(pa_memblock *b) {
             pa_mutex_lock(import->mutex);
 
             pa_assert_se(pa_hashmap_remove(import->blocks, PA_UINT32_TO_PTR(b->per_type.imported.id)));
+            import->size -= b->length;
 
             pa_assert(segment->n_blocks >= 1);
             if (-- segment->n_blocks <= 0)
@@ -634,8 +873,7 @@ static void memblock_free(pa_memblock *b) {
 
             import->release_cb(import, b->per_type.imported.id, import->userdata);
 
-            if (pa_flist_push(PA_STATIC_FLIST_GET(unused_memblocks), b) < 0)
-                pa_xfree(b);
+            memblock_struct_free(b);
 
             break;
         }
@@ -643,27 +881,26 @@ static void memblock_free(pa_memblock *b) {
         case PA_MEMBLOCK_POOL_EXTERNAL:
         case PA_MEMBLOCK_POOL: {
             struct mempool_slot *slot;
+            unsigned c;
             bool call_free;
 
-            pa_assert_se(slot = mempool_slot_by_ptr(b->pool, pa_atomic_ptr_load(&b->data)));
+            c = mempool_slot_class_by_ptr(b->pool, pa_atomic_ptr_load(&b->data));
+            pa_assert_se(slot = mempool_slot_by_ptr(b->pool, c, pa_atomic_ptr_load(&b->data)));
 
             call_free = b->type == PA_MEMBLOCK_POOL_EXTERNAL;
 
 /* #ifdef HAVE_VALGRIND_MEMCHECK_H */
 /*             if (PA_UNLIKELY(pa_in_valgrind())) { */
-/*                 VALGRIND_FREELIKE_BLOCK(slot, b->pool->block_size); */
+/*                 VALGRIND_FREELIKE_BLOCK(slot, b->pool->classes[c].slot_size); */
 /*             } */
 /* #endif */
 
-            /* The free list dimensions should easily allow all slots
-             * to fit in, hence try harder if pushing this slot into
-             * the free list fails */
-            while (pa_flist_push(b->pool->free_slots, slot) < 0)
-                ;
+            pa_atomic_dec(&b->pool->stat.n_slots_allocated[c]);
+
+            mempool_free_slot(b->pool, c, slot);
 
             if (call_free)
-                if (pa_flist_push(PA_STATIC_FLIST_GET(unused_memblocks), b) < 0)
-                    pa_xfree(b);
+                memblock_struct_free(b);
 
             break;
         }
@@ -711,10 +948,10 @@ static void memblock_make_local(pa_memblock *b) {
 
     pa_atomic_dec(&b->pool->stat.n_allocated_by_type[b->type]);
 
-    if (b->length <= b->pool->block_size) {
+    if (b->length <= b->pool->classes[b->pool->n_classes - 1].slot_size) {
         struct mempool_slot *slot;
 
-        if ((slot = mempool_allocate_slot(b->pool))) {
+        if ((slot = mempool_allocate_slot(b->pool, b->length))) {
             void *new_data;
             /* We can move it into a local pool, perfect! */
 
@@ -788,6 +1025,7 @@ static void memblock_replace_import(pa_memblock *b) {
     pa_mutex_lock(import->mutex);
 
     pa_assert_se(pa_hashmap_remove(import->blocks, PA_UINT32_TO_PTR(b->per_type.imported.id)));
+    import->size -= b->length;
 
     memblock_make_local(b);
 
@@ -826,41 +1064,95 @@ static void memblock_replace_import(pa_memblock *b) {
  * TODO-1: Transform the global core mempool to a per-client one
  * TODO-2: Remove global mempools support */
 pa_mempool *pa_mempool_new(pa_mem_type_t type, size_t size, bool per_client) {
+    return pa_mempool_new_with_slot_sizes(type, size, per_client, NULL, 0);
+}
+
+static size_t slot_size_align(size_t size) {
+    const size_t page_size = pa_page_size();
+
+    /* Small slots are packed, but never straddle more pages than
+     * necessary; larger ones occupy whole pages so they can be
+     * punched on vacuum */
+    if (size < page_size)
+        return PA_MIN(((size + PA_MEMPOOL_SLOT_ALIGN - 1) / PA_MEMPOOL_SLOT_ALIGN) * PA_MEMPOOL_SLOT_ALIGN, page_size);
+
+    return PA_PAGE_ALIGN(size);
+}
+
+pa_mempool *pa_mempool_new_with_slot_sizes(pa_mem_type_t type, size_t size, bool per_client, const size_t *slot_sizes, unsigned n_slot_sizes) {
+    static const size_t default_slot_sizes[] = PA_MEMPOOL_SLOT_SIZES_DEFAULT;
     pa_mempool *p;
+    pa_mutex *m;
     char t1[PA_BYTES_SNPRINT_MAX], t2[PA_BYTES_SNPRINT_MAX];
-    const size_t page_size = pa_page_size();
+    size_t aligned[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    size_t offset = 0;
+    unsigned c, n_aligned = 0;
+
+    pa_assert(n_slot_sizes <= PA_MEMPOOL_SLOT_CLASSES_MAX);
+    pa_assert(n_slot_sizes == 0 || slot_sizes);
+
+    if (n_slot_sizes == 0) {
+        slot_sizes = default_slot_sizes;
+        n_slot_sizes = PA_MEMPOOL_N_SLOT_SIZES_DEFAULT;
+    }
+
+    if (size <= 0)
+        size = PA_MEMPOOL_SIZE_DEFAULT;
+
+    /* Identical sizes after alignment are merged, before the shares are
+     * handed out so that the largest class left gets the rest */
+    for (c = 0; c < n_slot_sizes; c++) {
+        size_t slot_size = slot_size_align(slot_sizes[c]);
+
+        if (n_aligned > 0 && slot_size <= aligned[n_aligned - 1])
+            continue;
+
+        aligned[n_aligned++] = slot_size;
+    }
 
     p = pa_xnew0(pa_mempool, 1);
     PA_REFCNT_INIT(p);
 
-    p->block_size = PA_PAGE_ALIGN(PA_MEMPOOL_SLOT_SIZE);
-    if (p->block_size < page_size)
-        p->block_size = page_size;
+    for (c = 0; c < n_aligned; c++) {
+        struct mempool_slot_class *class = &p->classes[p->n_classes];
+        size_t slot_size = aligned[c], share;
 
-    if (size <= 0)
-        p->n_blocks = PA_MEMPOOL_SLOTS_MAX;
-    else {
-        p->n_blocks = (unsigned) (size / p->block_size);
+        if (c < n_aligned - 1)
+            share = size / PA_MEMPOOL_SMALL_CLASS_SHARE;
+        else
+            share = size > offset ? size - offset : 0;
 
-        if (p->n_blocks < 2)
-            p->n_blocks = 2;
+        class->slot_size = slot_size;
+        class->n_slots = PA_MAX((unsigned) (share / slot_size), 2U);
+        class->offset = offset;
+        pa_atomic_store(&class->n_init, 0);
+
+        offset = PA_PAGE_ALIGN(offset + class->n_slots * slot_size);
+
+        p->stat.slot_size[p->n_classes] = class->slot_size;
+        p->stat.n_slots[p->n_classes] = class->n_slots;
+        p->n_classes++;
     }
 
-    if (pa_shm_create_rw(&p->memory, type, p->n_blocks * p->block_size, 0700) < 0) {
+    p->stat.n_slot_classes = p->n_classes;
+
+    if (pa_shm_create_rw(&p->memory, type, offset, 0700) < 0) {
         pa_xfree(p);
         return NULL;
     }
 
-    pa_log_debug("Using %s memory pool with %u slots of size %s each, total size is %s, maximum usable slot size is %lu",
+    pa_log_debug("Using %s memory pool with %u slot classes, total size is %s, maximum usable slot size is %lu",
                  pa_mem_type_to_string(type),
-                 p->n_blocks,
-                 pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->block_size),
-                 pa_bytes_snprint(t2, sizeof(t2), (unsigned) (p->n_blocks * p->block_size)),
+                 p->n_classes,
+                 pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->memory.size),
                  (unsigned long) pa_mempool_block_size_max(p));
 
-    p->global = !per_client;
+    for (c = 0; c < p->n_classes; c++)
+        pa_log_debug("  %u slots of size %s",
+                     p->classes[c].n_slots,
+                     pa_bytes_snprint(t2, sizeof(t2), (unsigned) p->classes[c].slot_size));
 
-    pa_atomic_store(&p->n_init, 0);
+    p->global = !per_client;
 
     PA_LLIST_HEAD_INIT(pa_memimport, p->imports);
     PA_LLIST_HEAD_INIT(pa_memexport, p->exports);
@@ -868,14 +1160,31 @@ pa_mempool *pa_mempool_new(pa_mem_type_t type, size_t size, bool per_client) {
     p->mutex = pa_mutex_new(true, true);
     p->semaphore = pa_semaphore_new(0);
 
-    p->free_slots = pa_flist_new(p->n_blocks);
+    for (c = 0; c < p->n_classes; c++)
+        p->classes[c].free_slots = pa_flist_new(p->classes[c].n_slots);
+
+    p->id = (unsigned) pa_atomic_inc(&pool_id_counter) + 1;
+
+    m = pa_static_mutex_get(&pools_mutex, false, false);
+    pa_mutex_lock(m);
+    PA_LLIST_PREPEND(pa_mempool, pools, p);
+    pa_mutex_unlock(m);
 
     return p;
 }
 
 static void mempool_free(pa_mempool *p) {
+    pa_mutex *m;
+    unsigned c;
+
     pa_assert(p);
 
+    /* From now on the thread caches drop their slots of this pool */
+    m = pa_static_mutex_get(&pools_mutex, false, false);
+    pa_mutex_lock(m);
+    PA_LLIST_REMOVE(pa_mempool, pools, p);
+    pa_mutex_unlock(m);
+
     pa_mutex_lock(p->mutex);
 
     while (p->imports)
@@ -886,45 +1195,45 @@ static void mempool_free(pa_mempool *p) {
 
     pa_mutex_unlock(p->mutex);
 
-    pa_flist_free(p->free_slots, NULL);
-
     if (pa_atomic_load(&p->stat.n_allocated) > 0) {
 
         /* Ouch, somebody is retaining a memory block reference! */
 
 #ifdef DEBUG_REF
-        unsigned i;
-        pa_flist *list;
-
-        /* Let's try to find at least one of those leaked memory blocks */
+        for (c = 0; c < p->n_classes; c++) {
+            struct mempool_slot_class *class = &p->classes[c];
+            unsigned i;
+            pa_flist *list;
 
-        list = pa_flist_new(p->n_blocks);
+            /* Let's try to find at least one of those leaked memory blocks */
 
-        for (i = 0; i < (unsigned) pa_atomic_load(&p->n_init); i++) {
-            struct mempool_slot *slot;
-            pa_memblock *b, *k;
+            list = pa_flist_new(class->n_slots);
 
-            slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (p->block_size * (size_t) i));
-            b = mempool_slot_data(slot);
+            for (i = 0; i < (unsigned) pa_atomic_load(&class->n_init); i++) {
+                struct mempool_slot *slot;
+                pa_memblock *b, *k;
 
-            while ((k = pa_flist_pop(p->free_slots))) {
-                while (pa_flist_push(list, k) < 0)
-                    ;
+                slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + class->offset + (class->slot_size * (size_t) i));
+                b = mempool_slot_data(slot);
 
-                if (b == k)
-                    break;
-            }
+                while ((k = pa_flist_pop(class->free_slots))) {
+                    while (pa_flist_push(list, k) < 0)
+                        ;
 
-            if (!k)
-                pa_log("REF: Leaked memory block %p", b);
+                    if (b == k)
+                        break;
+                }
 
-            while ((k = pa_flist_pop(list)))
-                while (pa_flist_push(p->free_slots, k) < 0)
-                    ;
-        }
+                if (!k)
+                    pa_log("REF: Leaked memory block %p", b);
 
-        pa_flist_free(list, NULL);
+                while ((k = pa_flist_pop(list)))
+                    while (pa_flist_push(class->free_slots, k) < 0)
+                        ;
+            }
 
+            pa_flist_free(list, NULL);
+        }
 #endif
 
         pa_log_error("Memory pool destroyed but not all memory blocks freed! %u remain.", pa_atomic_load(&p->stat.n_allocated));
@@ -932,6 +1241,9 @@ static void mempool_free(pa_mempool *p) {
 /*         PA_DEBUG_TRAP; */
     }
 
+    for (c = 0; c < p->n_classes; c++)
+        pa_flist_free(p->classes[c].free_slots, NULL);
+
     pa_shm_free(&p->memory);
 
     pa_mutex_free(p->mutex);
@@ -951,30 +1263,44 @@ const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p) {
 size_t pa_mempool_block_size_max(pa_mempool *p) {
     pa_assert(p);
 
-    return p->block_size - PA_ALIGN(sizeof(pa_memblock));
+    return p->classes[p->n_classes - 1].slot_size - PA_ALIGN(sizeof(pa_memblock));
 }
 
 /* No lock necessary */
 void pa_mempool_vacuum(pa_mempool *p) {
     struct mempool_slot *slot;
     pa_flist *list;
+    unsigned c;
 
     pa_assert(p);
 
-    list = pa_flist_new(p->n_blocks);
+    /* A pinned pool keeps its pages faulted in for good */
+    if (p->memory.pinned)
+        return;
 
-    while ((slot = pa_flist_pop(p->free_slots)))
-        while (pa_flist_push(list, slot) < 0)
-            ;
+    for (c = 0; c < p->n_classes; c++) {
+        struct mempool_slot_class *class = &p->classes[c];
 
-    while ((slot = pa_flist_pop(list))) {
-        pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), p->block_size);
+        /* Slots smaller than a page share their pages with other
+         * slots, which might be in use */
+        if (class->slot_size < pa_page_size())
+            continue;
 
-        while (pa_flist_push(p->free_slots, slot))
-            ;
-    }
+        list = pa_flist_new(class->n_slots);
+
+        while ((slot = pa_flist_pop(class->free_slots)))
+            while (pa_flist_push(list, slot) < 0)
+                ;
 
-    pa_flist_free(list, NULL);
+        while ((slot = pa_flist_pop(list))) {
+            pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), class->slot_size);
+
+            while (pa_flist_push(class->free_slots, slot))
+                ;
+        }
+
+        pa_flist_free(list, NULL);
+    }
 }
 
 /* No lock necessary */
@@ -1096,6 +1422,7 @@ pa_memimport* pa_memimport_new(pa_mempool *p, pa_memimport_release_cb_t cb, void
     pa_mempool_ref(i->pool);
     i->segments = pa_hashmap_new(NULL, NULL);
     i->blocks = pa_hashmap_new(NULL, NULL);
+    i->size = 0;
     i->release_cb = cb;
     i->userdata = userdata;
 
@@ -1127,7 +1454,11 @@ static pa_memimport_segment* segment_attach(pa_memimport *i, pa_mem_type_t type,
 
     seg->writable = writable;
     seg->import = i;
-    seg->trap = pa_memtrap_add(seg->memory.ptr, seg->memory.size);
+
+    /* A sealed memfd can't be truncated by the exporter, so there's no
+     * SIGBUS to trap and the segment can stay off the memtrap list */
+    if (!seg->memory.sealed)
+        seg->trap = pa_memtrap_add(seg->memory.ptr, seg->memory.size);
 
     pa_hashmap_put(i->segments, PA_UINT32_TO_PTR(seg->memory.id), seg);
     return seg;
@@ -1242,8 +1573,10 @@ pa_memblock* pa_memimport_get(pa_memimport *i, pa_mem_type_t type, uint32_t bloc
         goto finish;
     }
 
-    if (pa_hashmap_size(i->blocks) >= PA_MEMIMPORT_SLOTS_MAX)
+    if (pa_hashmap_size(i->blocks) >= PA_MEMIMPORT_SLOTS_MAX) {
+        pa_atomic_inc(&i->pool->stat.n_import_failed);
         goto finish;
+    }
 
     if (!(seg = pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id)))) {
         if (type == PA_MEM_TYPE_SHARED_MEMFD) {
@@ -1265,8 +1598,7 @@ pa_memblock* pa_memimport_get(pa_memimport *i, pa_mem_type_t type, uint32_t bloc
     if (offset+size > seg->memory.size)
         goto finish;
 
-    if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
-        b = pa_xnew(pa_memblock, 1);
+    b = memblock_struct_new(i->pool);
 
     PA_REFCNT_INIT(b);
     b->pool = i->pool;
@@ -1282,6 +1614,7 @@ pa_memblock* pa_memimport_get(pa_memimport *i, pa_mem_type_t type, uint32_t bloc
     b->per_type.imported.segment = seg;
 
     pa_hashmap_put(i->blocks, PA_UINT32_TO_PTR(block_id), b);
+    i->size += size;
 
     seg->n_blocks++;
 
@@ -1293,6 +1626,19 @@ finish:
     return b;
 }
 
+/* Self-locked */
+size_t pa_memimport_get_size(pa_memimport *i) {
+    size_t size;
+
+    pa_assert(i);
+
+    pa_mutex_lock(i->mutex);
+    size = i->size;
+    pa_mutex_unlock(i->mutex);
+
+    return size;
+}
+
 int pa_memimport_process_revoke(pa_memimport *i, uint32_t id) {
     pa_memblock *b;
     int ret = 0;
@@ -1317,8 +1663,6 @@ finish:
 pa_memexport* pa_memexport_new(pa_mempool *p, pa_memexport_revoke_cb_t cb, void *userdata) {
     pa_memexport *e;
 
-    static pa_atomic_t export_baseidx = PA_ATOMIC_INIT(0);
-
     pa_assert(p);
     pa_assert(cb);
 
@@ -1329,29 +1673,39 @@ pa_memexport* pa_memexport_new(pa_mempool *p, pa_memexport_revoke_cb_t cb, void
     e->mutex = pa_mutex_new(true, true);
     e->pool = p;
     pa_mempool_ref(e->pool);
+    e->used_slots = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
     PA_LLIST_HEAD_INIT(struct memexport_slot, e->free_slots);
-    PA_LLIST_HEAD_INIT(struct memexport_slot, e->used_slots);
-    e->n_init = 0;
+    PA_LLIST_HEAD_INIT(struct memexport_slot, e->imported_slots);
+    e->n_slots = 0;
+    e->max_slots = PA_MEMEXPORT_SLOTS_DEFAULT;
     e->revoke_cb = cb;
     e->userdata = userdata;
 
     pa_mutex_lock(p->mutex);
 
     PA_LLIST_PREPEND(pa_memexport, p->exports, e);
-    e->baseidx = (uint32_t) pa_atomic_add(&export_baseidx, PA_MEMEXPORT_SLOTS_MAX);
 
     pa_mutex_unlock(p->mutex);
     return e;
 }
 
 void pa_memexport_free(pa_memexport *e) {
+    struct memexport_slot *slot;
+
     pa_assert(e);
 
     pa_mutex_lock(e->mutex);
-    while (e->used_slots)
-        pa_memexport_process_release(e, (uint32_t) (e->used_slots - e->slots + e->baseidx));
+    while ((slot = pa_hashmap_first(e->used_slots)))
+        pa_memexport_process_release(e, slot->id);
     pa_mutex_unlock(e->mutex);
 
+    pa_hashmap_free(e->used_slots);
+
+    while ((slot = e->free_slots)) {
+        PA_LLIST_REMOVE(struct memexport_slot, e->free_slots, slot);
+        pa_xfree(slot);
+    }
+
     pa_mutex_lock(e->pool->mutex);
     PA_LLIST_REMOVE(pa_memexport, e->pool->exports, e);
     pa_mutex_unlock(e->pool->mutex);
@@ -1361,29 +1715,38 @@ void pa_memexport_free(pa_memexport *e) {
     pa_xfree(e);
 }
 
+/* Self-locked */
+void pa_memexport_set_max_slots(pa_memexport *e, unsigned n) {
+    pa_assert(e);
+    pa_assert(n > 0);
+
+    pa_mutex_lock(e->mutex);
+
+    /* Slots already handed out are kept */
+    e->max_slots = PA_MIN(n, PA_MEMEXPORT_SLOTS_MAX);
+
+    pa_mutex_unlock(e->mutex);
+}
+
 /* Self-locked */
 int pa_memexport_process_release(pa_memexport *e, uint32_t id) {
+    struct memexport_slot *slot;
     pa_memblock *b;
 
     pa_assert(e);
 
     pa_mutex_lock(e->mutex);
 
-    if (id < e->baseidx)
-        goto fail;
-    id -= e->baseidx;
-
-    if (id >= e->n_init)
+    if (!(slot = pa_hashmap_remove(e->used_slots, PA_UINT32_TO_PTR(id))))
         goto fail;
 
-    if (!e->slots[id].block)
-        goto fail;
+    b = slot->block;
+    slot->block = NULL;
 
-    b = e->slots[id].block;
-    e->slots[id].block = NULL;
+    if (b->type == PA_MEMBLOCK_IMPORTED)
+        PA_LLIST_REMOVE(struct memexport_slot, e->imported_slots, slot);
 
-    PA_LLIST_REMOVE(struct memexport_slot, e->used_slots, &e->slots[id]);
-    PA_LLIST_PREPEND(struct memexport_slot, e->free_slots, &e->slots[id]);
+    PA_LLIST_PREPEND(struct memexport_slot, e->free_slots, slot);
 
     pa_mutex_unlock(e->mutex);
 
@@ -1413,17 +1776,14 @@ static void memexport_revoke_blocks(pa_memexport *e, pa_memimport *i) {
 
     pa_mutex_lock(e->mutex);
 
-    for (slot = e->used_slots; slot; slot = next) {
-        uint32_t idx;
+    for (slot = e->imported_slots; slot; slot = next) {
         next = slot->next;
 
-        if (slot->block->type != PA_MEMBLOCK_IMPORTED ||
-            slot->block->per_type.imported.segment->import != i)
+        if (slot->block->per_type.imported.segment->import != i)
             continue;
 
-        idx = (uint32_t) (slot - e->slots + e->baseidx);
-        e->revoke_cb(e, idx, e->userdata);
-        pa_memexport_process_release(e, idx);
+        e->revoke_cb(e, slot->id, e->userdata);
+        pa_memexport_process_release(e, slot->id);
     }
 
     pa_mutex_unlock(e->mutex);
@@ -1466,25 +1826,38 @@ int pa_memexport_put(pa_memexport *e, pa_memblock *b, pa_mem_type_t *type, uint3
     pa_assert(size);
     pa_assert(b->pool == e->pool);
 
-    if (!(b = memblock_shared_copy(e->pool, b)))
+    if (!(b = memblock_shared_copy(e->pool, b))) {
+        pa_atomic_inc(&e->pool->stat.n_export_failed);
         return -1;
+    }
 
     pa_mutex_lock(e->mutex);
 
     if (e->free_slots) {
         slot = e->free_slots;
         PA_LLIST_REMOVE(struct memexport_slot, e->free_slots, slot);
-    } else if (e->n_init < PA_MEMEXPORT_SLOTS_MAX)
-        slot = &e->slots[e->n_init++];
-    else {
+    } else if (e->n_slots < e->max_slots) {
+        /* Ids are unique across all exports, so that the importer can
+         * tell the blocks apart that one of our imports relays */
+        static pa_atomic_t next_id = PA_ATOMIC_INIT(0);
+
+        slot = pa_xnew(struct memexport_slot, 1);
+        slot->id = (uint32_t) pa_atomic_inc(&next_id);
+        e->n_slots++;
+    } else {
         pa_mutex_unlock(e->mutex);
         pa_memblock_unref(b);
+        pa_atomic_inc(&e->pool->stat.n_export_failed);
         return -1;
     }
 
-    PA_LLIST_PREPEND(struct memexport_slot, e->used_slots, slot);
     slot->block = b;
-    *block_id = (uint32_t) (slot - e->slots + e->baseidx);
+    pa_assert_se(pa_hashmap_put(e->used_slots, PA_UINT32_TO_PTR(slot->id), slot) == 0);
+
+    if (b->type == PA_MEMBLOCK_IMPORTED)
+        PA_LLIST_PREPEND(struct memexport_slot, e->imported_slots, slot);
+
+    *block_id = slot->id;
 
     pa_mutex_unlock(e->mutex);
 /*     pa_log("Got block id %u", *block_id); */
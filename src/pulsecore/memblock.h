@@ -54,6 +54,23 @@ typedef struct pa_memimport_segment pa_memimport_segment;
 typedef struct pa_memimport pa_memimport;
 typedef struct pa_memexport pa_memexport;
 
+/* The pool is split into slots of up to this many different sizes */
+#define PA_MEMPOOL_SLOT_CLASSES_MAX 8
+
+/* Small blocks are common (control data, short periods), so by default
+ * they don't each take up a full 64K slot */
+#define PA_MEMPOOL_SLOT_SIZES_DEFAULT { 1024, 4096, 16384, 65536 }
+#define PA_MEMPOOL_N_SLOT_SIZES_DEFAULT 4
+
+/* How many blocks an export hands out at a time by default, and at
+ * most. Importers take up to PA_MEMIMPORT_SLOTS_MAX blocks, those of
+ * peers before protocol version 33 only 160, so more than the default
+ * may only be exported to newer peers. */
+#define PA_MEMEXPORT_SLOTS_DEFAULT 128
+#define PA_MEMEXPORT_SLOTS_MAX 1024
+
+#define PA_MEMIMPORT_SLOTS_MAX 1280
+
 typedef void (*pa_memimport_release_cb_t)(pa_memimport *i, uint32_t block_id, void *userdata);
 typedef void (*pa_memexport_revoke_cb_t)(pa_memexport *e, uint32_t block_id, void *userdata);
 
@@ -74,8 +91,29 @@ struct pa_mempool_stat {
     pa_atomic_t n_too_large_for_pool;
     pa_atomic_t n_pool_full;
 
+    /* Blocks that could not be exported, for lack of a slot or of pool
+     * memory, and were therefore copied over the socket, and imported
+     * blocks that were dropped for lack of a slot */
+    pa_atomic_t n_export_failed;
+    pa_atomic_t n_import_failed;
+
     pa_atomic_t n_allocated_by_type[PA_MEMBLOCK_TYPE_MAX];
     pa_atomic_t n_accumulated_by_type[PA_MEMBLOCK_TYPE_MAX];
+
+    /* Layout of the pool's slot classes, fixed at creation */
+    unsigned n_slot_classes;
+    size_t slot_size[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    unsigned n_slots[PA_MEMPOOL_SLOT_CLASSES_MAX];
+
+    /* Slots in use, and how often a class was full so that a larger
+     * one had to be used */
+    pa_atomic_t n_slots_allocated[PA_MEMPOOL_SLOT_CLASSES_MAX];
+    pa_atomic_t n_slot_class_full[PA_MEMPOOL_SLOT_CLASSES_MAX];
+
+    /* Slots and pa_memblock structures taken from the calling thread's
+     * own cache, or from the shared free lists */
+    pa_atomic_t n_cache_hits;
+    pa_atomic_t n_cache_misses;
 };
 
 /* Allocate a new memory block of type PA_MEMBLOCK_MEMPOOL or PA_MEMBLOCK_APPENDED, depending on the size */
@@ -125,6 +163,11 @@ pa_memblock *pa_memblock_will_need(pa_memblock *b);
 
 /* The memory block manager */
 pa_mempool *pa_mempool_new(pa_mem_type_t type, size_t size, bool per_client);
+
+/* Like pa_mempool_new(), but with the given slot sizes, which must be
+ * increasing. With n_slot_sizes == 0 the default sizes are used. */
+pa_mempool *pa_mempool_new_with_slot_sizes(pa_mem_type_t type, size_t size, bool per_client, const size_t *slot_sizes, unsigned n_slot_sizes);
+
 void pa_mempool_unref(pa_mempool *p);
 pa_mempool* pa_mempool_ref(pa_mempool *p);
 const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p);
@@ -136,6 +179,9 @@ bool pa_mempool_is_global(pa_mempool *p);
 bool pa_mempool_is_per_client(pa_mempool *p);
 bool pa_mempool_is_remote_writable(pa_mempool *p);
 void pa_mempool_set_is_remote_writable(pa_mempool *p, bool writable);
+/* Prefaults (and optionally locks) the pool memory, see pa_shm_pin(). A
+ * pinned pool is no longer vacuumed. */
+int pa_mempool_pin(pa_mempool *p, bool huge_pages, bool lock);
 size_t pa_mempool_block_size_max(pa_mempool *p);
 
 int pa_mempool_take_memfd_fd(pa_mempool *p);
@@ -149,9 +195,13 @@ pa_memblock* pa_memimport_get(pa_memimport *i, pa_mem_type_t type, uint32_t bloc
                               uint32_t shm_id, size_t offset, size_t size, bool writable);
 int pa_memimport_process_revoke(pa_memimport *i, uint32_t block_id);
 
+/* Returns the total length of the blocks currently imported */
+size_t pa_memimport_get_size(pa_memimport *i);
+
 /* For sending blocks to other nodes */
 pa_memexport* pa_memexport_new(pa_mempool *p, pa_memexport_revoke_cb_t cb, void *userdata);
 void pa_memexport_free(pa_memexport *e);
+void pa_memexport_set_max_slots(pa_memexport *e, unsigned n);
 int pa_memexport_put(pa_memexport *e, pa_memblock *b, pa_mem_type_t *type, uint32_t *block_id,
                      uint32_t *shm_id, size_t *offset, size_t * size);
 int pa_memexport_process_release(pa_memexport *e, uint32_t id);
@@ -42,12 +42,22 @@ struct list_item {
     pa_memchunk chunk;
 };
 
+/* Initial number of entries of the array backend */
+#define RING_SIZE_INITIAL 16
+
 PA_STATIC_FLIST_DECLARE(list_items, 0, pa_xfree);
 
 struct pa_memblockq {
     struct list_item *blocks, *blocks_tail;
     struct list_item *current_read, *current_write;
     unsigned n_blocks;
+
+    /* With the array backend the entries are kept in this ring of
+     * ring_size entries instead, sorted by index and starting at
+     * ring_first; next and prev are unused then and the list above
+     * stays empty */
+    struct list_item *ring;
+    unsigned ring_first, ring_size;
     size_t maxlength, tlength, base, prebuf, minreq, maxrewind;
     int64_t read_index, write_index;
     bool in_prebuf;
@@ -58,7 +68,7 @@ struct pa_memblockq {
     pa_sample_spec sample_spec;
 };
 
-pa_memblockq* pa_memblockq_new(
+static pa_memblockq* memblockq_new(
         const char *name,
         int64_t idx,
         size_t maxlength,
@@ -67,7 +77,8 @@ pa_memblockq* pa_memblockq_new(
         size_t prebuf,
         size_t minreq,
         size_t maxrewind,
-        pa_memchunk *silence) {
+        pa_memchunk *silence,
+        bool ring) {
 
     pa_memblockq* bq;
 
@@ -77,6 +88,11 @@ pa_memblockq* pa_memblockq_new(
     bq = pa_xnew0(pa_memblockq, 1);
     bq->name = pa_xstrdup(name);
 
+    if (ring) {
+        bq->ring = pa_xnew(struct list_item, RING_SIZE_INITIAL);
+        bq->ring_size = RING_SIZE_INITIAL;
+    }
+
     bq->sample_spec = *sample_spec;
     bq->base = pa_frame_size(sample_spec);
     bq->read_index = bq->write_index = idx;
@@ -105,6 +121,34 @@ pa_memblockq* pa_memblockq_new(
     return bq;
 }
 
+pa_memblockq* pa_memblockq_new(
+        const char *name,
+        int64_t idx,
+        size_t maxlength,
+        size_t tlength,
+        const pa_sample_spec *sample_spec,
+        size_t prebuf,
+        size_t minreq,
+        size_t maxrewind,
+        pa_memchunk *silence) {
+
+    return memblockq_new(name, idx, maxlength, tlength, sample_spec, prebuf, minreq, maxrewind, silence, false);
+}
+
+pa_memblockq* pa_memblockq_new_ring(
+        const char *name,
+        int64_t idx,
+        size_t maxlength,
+        size_t tlength,
+        const pa_sample_spec *sample_spec,
+        size_t prebuf,
+        size_t minreq,
+        size_t maxrewind,
+        pa_memchunk *silence) {
+
+    return memblockq_new(name, idx, maxlength, tlength, sample_spec, prebuf, minreq, maxrewind, silence, true);
+}
+
 void pa_memblockq_free(pa_memblockq* bq) {
     pa_assert(bq);
 
@@ -116,10 +160,111 @@ void pa_memblockq_free(pa_memblockq* bq) {
     if (bq->mcalign)
         pa_mcalign_free(bq->mcalign);
 
+    pa_xfree(bq->ring);
     pa_xfree(bq->name);
     pa_xfree(bq);
 }
 
+static inline int64_t item_end(const struct list_item *q) {
+    return q->index + (int64_t) q->chunk.length;
+}
+
+static inline struct list_item *ring_item(pa_memblockq *bq, unsigned k) {
+    return bq->ring + ((bq->ring_first + k) & (bq->ring_size - 1));
+}
+
+/* Position of the first entry that ends after idx */
+static unsigned ring_lower_bound(pa_memblockq *bq, int64_t idx) {
+    unsigned lo = 0, hi = bq->n_blocks;
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (item_end(ring_item(bq, mid)) <= idx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static void ring_grow(pa_memblockq *bq, unsigned n) {
+    struct list_item *r;
+    unsigned size, k;
+
+    if (n <= bq->ring_size)
+        return;
+
+    for (size = bq->ring_size; size < n; size *= 2)
+        ;
+
+    r = pa_xnew(struct list_item, size);
+
+    for (k = 0; k < bq->n_blocks; k++)
+        r[k] = *ring_item(bq, k);
+
+    pa_xfree(bq->ring);
+    bq->ring = r;
+    bq->ring_size = size;
+    bq->ring_first = 0;
+}
+
+/* Replace n_remove entries starting at pos by n_insert new ones, which
+ * already hold their own memblock references */
+static void ring_replace(pa_memblockq *bq, unsigned pos, unsigned n_remove, const struct list_item *items, unsigned n_insert) {
+    unsigned k, n_after;
+
+    pa_assert(pos + n_remove <= bq->n_blocks);
+
+    for (k = 0; k < n_remove; k++)
+        pa_memblock_unref(ring_item(bq, pos + k)->chunk.memblock);
+
+    ring_grow(bq, bq->n_blocks - n_remove + n_insert);
+
+    /* Appending, the common case, doesn't move anything */
+    n_after = bq->n_blocks - pos - n_remove;
+
+    if (n_insert > n_remove) {
+        for (k = n_after; k > 0; k--)
+            *ring_item(bq, pos + n_insert + k - 1) = *ring_item(bq, pos + n_remove + k - 1);
+    } else if (n_insert < n_remove) {
+        for (k = 0; k < n_after; k++)
+            *ring_item(bq, pos + n_insert + k) = *ring_item(bq, pos + n_remove + k);
+    }
+
+    for (k = 0; k < n_insert; k++)
+        *ring_item(bq, pos + k) = items[k];
+
+    bq->n_blocks = bq->n_blocks - n_remove + n_insert;
+}
+
+static void ring_drop_first(pa_memblockq *bq) {
+    pa_assert(bq->n_blocks >= 1);
+
+    pa_memblock_unref(ring_item(bq, 0)->chunk.memblock);
+    bq->ring_first = (bq->ring_first + 1) & (bq->ring_size - 1);
+    bq->n_blocks--;
+}
+
+static struct list_item *last_block(pa_memblockq *bq) {
+    if (bq->ring)
+        return bq->n_blocks > 0 ? ring_item(bq, bq->n_blocks - 1) : NULL;
+
+    return bq->blocks_tail;
+}
+
+static struct list_item *next_block(pa_memblockq *bq, struct list_item *q) {
+    unsigned k;
+
+    if (!bq->ring)
+        return q->next;
+
+    k = ((unsigned) (q - bq->ring) - bq->ring_first) & (bq->ring_size - 1);
+
+    return k + 1 < bq->n_blocks ? ring_item(bq, k + 1) : NULL;
+}
+
 static void fix_current_read(pa_memblockq *bq) {
     pa_assert(bq);
 
@@ -148,6 +293,21 @@ static void fix_current_read(pa_memblockq *bq) {
        the queue was already played */
 }
 
+/* Return the block at the read index or, if there is a hole there, the
+ * first one after it */
+static struct list_item *read_block(pa_memblockq *bq) {
+    unsigned k;
+
+    if (!bq->ring) {
+        fix_current_read(bq);
+        return bq->current_read;
+    }
+
+    k = ring_lower_bound(bq, bq->read_index);
+
+    return k < bq->n_blocks ? ring_item(bq, k) : NULL;
+}
+
 static void fix_current_write(pa_memblockq *bq) {
     pa_assert(bq);
 
@@ -216,11 +376,19 @@ static void drop_backlog(pa_memblockq *bq) {
 
     boundary = bq->read_index - (int64_t) bq->maxrewind;
 
+    if (bq->ring) {
+        while (bq->n_blocks > 0 && item_end(ring_item(bq, 0)) <= boundary)
+            ring_drop_first(bq);
+
+        return;
+    }
+
     while (bq->blocks && (bq->blocks->index + (int64_t) bq->blocks->chunk.length <= boundary))
         drop_block(bq, bq->blocks);
 }
 
 static bool can_push(pa_memblockq *bq, size_t l) {
+    struct list_item *tail;
     int64_t end;
 
     pa_assert(bq);
@@ -234,7 +402,8 @@ static bool can_push(pa_memblockq *bq, size_t l) {
             return true;
     }
 
-    end = bq->blocks_tail ? bq->blocks_tail->index + (int64_t) bq->blocks_tail->chunk.length : bq->write_index;
+    tail = last_block(bq);
+    end = tail ? item_end(tail) : bq->write_index;
 
     /* Make sure that the list doesn't get too long */
     if (bq->write_index + (int64_t) l > end)
@@ -274,6 +443,57 @@ static void read_index_changed(pa_memblockq *bq, int64_t old_read_index) {
 #endif
 }
 
+/* The array backend version of the list manipulation in
+ * pa_memblockq_push() */
+static void ring_push(pa_memblockq *bq, const pa_memchunk *chunk) {
+    struct list_item items[3], *q;
+    int64_t end = bq->write_index + (int64_t) chunk->length;
+    unsigned first, last, n = 0;
+
+    /* Find the entries we will overwrite */
+    first = ring_lower_bound(bq, bq->write_index);
+    for (last = first; last < bq->n_blocks && ring_item(bq, last)->index < end; last++)
+        ;
+
+    if (first < last && (q = ring_item(bq, first))->index < bq->write_index) {
+        /* We need to save the beginning of this memchunk */
+        items[n] = *q;
+        items[n].chunk.length = (size_t) (bq->write_index - q->index);
+        pa_memblock_ref(items[n].chunk.memblock);
+        n++;
+    }
+
+    /* Try to merge memory blocks */
+    q = n > 0 ? &items[n - 1] : (first > 0 ? ring_item(bq, first - 1) : NULL);
+
+    if (q &&
+        q->chunk.memblock == chunk->memblock &&
+        q->chunk.index + q->chunk.length == chunk->index &&
+        item_end(q) == bq->write_index)
+        q->chunk.length += chunk->length;
+    else {
+        items[n].index = bq->write_index;
+        items[n].chunk = *chunk;
+        pa_memblock_ref(items[n].chunk.memblock);
+        n++;
+    }
+
+    if (first < last && item_end(q = ring_item(bq, last - 1)) > end) {
+        /* We need to save the end of this memchunk */
+        size_t d = (size_t) (end - q->index);
+
+        items[n] = *q;
+        items[n].index += (int64_t) d;
+        items[n].chunk.index += d;
+        items[n].chunk.length -= d;
+        pa_memblock_ref(items[n].chunk.memblock);
+        n++;
+    }
+
+    ring_replace(bq, first, last - first, items, n);
+    bq->write_index = end;
+}
+
 int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
     struct list_item *q, *n;
     pa_memchunk chunk;
@@ -294,6 +514,22 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
     old = bq->write_index;
     chunk = *uchunk;
 
+    /* Silence appended at the end doesn't need to be stored, a hole
+     * reads back as our silence chunk anyway. That way the readers
+     * notice it is silence without having to look at any data. */
+    if (bq->silence.memblock &&
+        pa_memblock_is_silence(chunk.memblock) &&
+        (!(q = last_block(bq)) || bq->write_index >= item_end(q))) {
+
+        bq->write_index += (int64_t) chunk.length;
+        goto finish;
+    }
+
+    if (bq->ring) {
+        ring_push(bq, &chunk);
+        goto finish;
+    }
+
     fix_current_write(bq);
     q = bq->current_write;
 
@@ -354,6 +590,7 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
 
                 /* Drop it from the new entry */
                 p->index = q->index + (int64_t) d;
+                p->chunk.index += d;
                 p->chunk.length -= d;
 
                 /* Add it to the list */
@@ -472,6 +709,7 @@ static bool update_prebuf(pa_memblockq *bq) {
 }
 
 int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
+    struct list_item *q;
     int64_t d;
     pa_assert(bq);
     pa_assert(chunk);
@@ -480,15 +718,15 @@ int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
     if (update_prebuf(bq))
         return -1;
 
-    fix_current_read(bq);
+    q = read_block(bq);
 
     /* Do we need to spit out silence? */
-    if (!bq->current_read || bq->current_read->index > bq->read_index) {
+    if (!q || q->index > bq->read_index) {
         size_t length;
 
         /* How much silence shall we return? */
-        if (bq->current_read)
-            length = (size_t) (bq->current_read->index - bq->read_index);
+        if (q)
+            length = (size_t) (q->index - bq->read_index);
         else if (bq->write_index > bq->read_index)
             length = (size_t) (bq->write_index - bq->read_index);
         else
@@ -518,22 +756,113 @@ int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
     }
 
     /* Ok, let's pass real data to the caller */
-    *chunk = bq->current_read->chunk;
+    *chunk = q->chunk;
     pa_memblock_ref(chunk->memblock);
 
-    pa_assert(bq->read_index >= bq->current_read->index);
-    d = bq->read_index - bq->current_read->index;
+    pa_assert(bq->read_index >= q->index);
+    d = bq->read_index - q->index;
     chunk->index += (size_t) d;
     chunk->length -= (size_t) d;
 
     return 0;
 }
 
-int pa_memblockq_peek_fixed_size(pa_memblockq *bq, size_t block_size, pa_memchunk *chunk) {
+unsigned pa_memblockq_peek_chunks(pa_memblockq *bq, pa_memchunk *chunks, unsigned n) {
+    struct list_item *q;
+    int64_t ri;
+    unsigned i = 0;
+
+    pa_assert(bq);
+    pa_assert(chunks);
+    pa_assert(n > 0);
+
+    if (update_prebuf(bq))
+        return 0;
+
+    ri = bq->read_index;
+
+    for (q = read_block(bq); q && i < n && q->index <= ri; q = next_block(bq, q)) {
+        int64_t d = ri - q->index;
+
+        pa_assert((size_t) d < q->chunk.length);
+
+        chunks[i] = q->chunk;
+        pa_memblock_ref(chunks[i].memblock);
+        chunks[i].index += (size_t) d;
+        chunks[i].length -= (size_t) d;
+
+        ri += (int64_t) chunks[i].length;
+        i++;
+    }
+
+    return i;
+}
+
+/* Returns in slice the data at ri, or the silence to fill the hole at ri,
+ * but no more than max bytes. No reference is taken. Returns the item
+ * to look at for the slice after this one. */
+static struct list_item *next_slice(pa_memblockq *bq, struct list_item *item, int64_t ri, size_t max, pa_memchunk *slice) {
+
+    if (!item || item->index > ri) {
+        /* Do we need to append silence? */
+        *slice = bq->silence;
+
+        if (item)
+            slice->length = PA_MIN(slice->length, (size_t) (item->index - ri));
+
+    } else {
+        int64_t d;
+
+        /* We can append real data! */
+        *slice = item->chunk;
+
+        d = ri - item->index;
+        slice->index += (size_t) d;
+        slice->length -= (size_t) d;
+
+        /* Go to next item for the next iteration */
+        item = next_block(bq, item);
+    }
+
+    slice->length = PA_MIN(slice->length, max);
+    return item;
+}
+
+/* Fills chunk with a new memblock of length bytes that holds first, if
+ * not NULL, followed by the slices starting at ri. */
+static void copy_slices(pa_memblockq *bq, struct list_item *item, int64_t ri, pa_memchunk *first, size_t length, pa_memchunk *chunk) {
     pa_mempool *pool;
     pa_memchunk tchunk, rchunk;
-    int64_t ri;
-    struct list_item *item;
+
+    pool = pa_memblock_get_pool(bq->silence.memblock);
+    rchunk.memblock = pa_memblock_new(pool, length);
+    rchunk.index = 0;
+    pa_mempool_unref(pool), pool = NULL;
+
+    if (first) {
+        rchunk.length = first->length;
+        pa_memchunk_memcpy(&rchunk, first);
+        rchunk.index += first->length;
+    }
+
+    while (rchunk.index < length) {
+        item = next_slice(bq, item, ri, length - rchunk.index, &tchunk);
+
+        rchunk.length = tchunk.length;
+        pa_memchunk_memcpy(&rchunk, &tchunk);
+
+        rchunk.index += rchunk.length;
+        ri += rchunk.length;
+    }
+
+    rchunk.index = 0;
+    rchunk.length = length;
+
+    *chunk = rchunk;
+}
+
+int pa_memblockq_peek_fixed_size(pa_memblockq *bq, size_t block_size, pa_memchunk *chunk) {
+    pa_memchunk tchunk;
 
     pa_assert(bq);
     pa_assert(block_size > 0);
@@ -549,60 +878,77 @@ int pa_memblockq_peek_fixed_size(pa_memblockq *bq, size_t block_size, pa_memchun
         return 0;
     }
 
-    pool = pa_memblock_get_pool(tchunk.memblock);
-    rchunk.memblock = pa_memblock_new(pool, block_size);
-    rchunk.index = 0;
-    rchunk.length = tchunk.length;
-    pa_mempool_unref(pool), pool = NULL;
-
-    pa_memchunk_memcpy(&rchunk, &tchunk);
+    /* For the list backend this is cheap, since pa_memblock_peek()
+     * already moved current_read */
+    copy_slices(bq, read_block(bq), bq->read_index + (int64_t) tchunk.length, &tchunk, block_size, chunk);
     pa_memblock_unref(tchunk.memblock);
 
-    rchunk.index += tchunk.length;
+    return 0;
+}
+
+unsigned pa_memblockq_peek_fixed_size_chunks(pa_memblockq *bq, size_t block_size, pa_memchunk *chunks, unsigned n) {
+    struct list_item *item;
+    size_t left;
+    int64_t ri;
+    unsigned i = 1;
+
+    pa_assert(bq);
+    pa_assert(block_size > 0);
+    pa_assert(chunks);
+    pa_assert(n > 0);
+    pa_assert(bq->silence.memblock);
 
-    /* We don't need to call fix_current_read() here, since
-     * pa_memblock_peek() already did that */
-    item = bq->current_read;
-    ri = bq->read_index + tchunk.length;
+    if (pa_memblockq_peek(bq, &chunks[0]) < 0)
+        return 0;
 
-    while (rchunk.index < block_size) {
+    if (chunks[0].length >= block_size) {
+        chunks[0].length = block_size;
+        return 1;
+    }
 
-        if (!item || item->index > ri) {
-            /* Do we need to append silence? */
-            tchunk = bq->silence;
+    item = read_block(bq);
+    ri = bq->read_index + (int64_t) chunks[0].length;
+    left = block_size - chunks[0].length;
 
-            if (item)
-                tchunk.length = PA_MIN(tchunk.length, (size_t) (item->index - ri));
+    while (left > 0) {
+        pa_memchunk tchunk;
+        struct list_item *next;
 
-        } else {
-            int64_t d;
+        next = next_slice(bq, item, ri, left, &tchunk);
 
-            /* We can append real data! */
-            tchunk = item->chunk;
+        /* The block we started from may end right at ri */
+        if (tchunk.length <= 0) {
+            item = next;
+            continue;
+        }
 
-            d = ri - item->index;
-            tchunk.index += (size_t) d;
-            tchunk.length -= (size_t) d;
+        if (tchunk.length < left && i >= n - 1) {
+            /* Out of slots, copy what is left into the last one */
+            if (i >= n) {
+                pa_memchunk first = chunks[--i];
 
-            /* Go to next item for the next iteration */
-            item = item->next;
+                copy_slices(bq, item, ri, &first, first.length + left, &chunks[i]);
+                pa_memblock_unref(first.memblock);
+            } else
+                copy_slices(bq, item, ri, NULL, left, &chunks[i]);
+
+            return i + 1;
         }
 
-        rchunk.length = tchunk.length = PA_MIN(tchunk.length, block_size - rchunk.index);
-        pa_memchunk_memcpy(&rchunk, &tchunk);
+        chunks[i] = tchunk;
+        pa_memblock_ref(chunks[i].memblock);
+        i++;
 
-        rchunk.index += rchunk.length;
-        ri += rchunk.length;
+        item = next;
+        ri += (int64_t) tchunk.length;
+        left -= tchunk.length;
     }
 
-    rchunk.index = 0;
-    rchunk.length = block_size;
-
-    *chunk = rchunk;
-    return 0;
+    return i;
 }
 
 void pa_memblockq_drop(pa_memblockq *bq, size_t length) {
+    struct list_item *q;
     int64_t old;
     pa_assert(bq);
     pa_assert(length % bq->base == 0);
@@ -615,15 +961,13 @@ void pa_memblockq_drop(pa_memblockq *bq, size_t length) {
         if (update_prebuf(bq))
             break;
 
-        fix_current_read(bq);
-
-        if (bq->current_read) {
+        if ((q = read_block(bq))) {
             int64_t p, d;
 
             /* We go through this piece by piece to make sure we don't
              * drop more than allowed by prebuf */
 
-            p = bq->current_read->index + (int64_t) bq->current_read->chunk.length;
+            p = item_end(q);
             pa_assert(p >= bq->read_index);
             d = p - bq->read_index;
 
@@ -681,6 +1025,7 @@ size_t pa_memblockq_get_length(pa_memblockq *bq) {
 }
 
 void pa_memblockq_seek(pa_memblockq *bq, int64_t offset, pa_seek_mode_t seek, bool account) {
+    struct list_item *tail;
     int64_t old;
     pa_assert(bq);
 
@@ -697,7 +1042,8 @@ void pa_memblockq_seek(pa_memblockq *bq, int64_t offset, pa_seek_mode_t seek, bo
             bq->write_index = bq->read_index + offset;
             break;
         case PA_SEEK_RELATIVE_END:
-            bq->write_index = (bq->blocks_tail ? bq->blocks_tail->index + (int64_t) bq->blocks_tail->chunk.length : bq->read_index) + offset;
+            tail = last_block(bq);
+            bq->write_index = (tail ? item_end(tail) : bq->read_index) + offset;
             break;
         default:
             pa_assert_not_reached();
@@ -972,9 +1318,7 @@ void pa_memblockq_willneed(pa_memblockq *bq) {
 
     pa_assert(bq);
 
-    fix_current_read(bq);
-
-    for (q = bq->current_read; q; q = q->next)
+    for (q = read_block(bq); q; q = next_block(bq, q))
         pa_memchunk_will_need(&q->chunk);
 }
 
@@ -994,12 +1338,15 @@ void pa_memblockq_set_silence(pa_memblockq *bq, pa_memchunk *silence) {
 bool pa_memblockq_is_empty(pa_memblockq *bq) {
     pa_assert(bq);
 
-    return !bq->blocks;
+    return bq->n_blocks <= 0;
 }
 
 void pa_memblockq_silence(pa_memblockq *bq) {
     pa_assert(bq);
 
+    while (bq->ring && bq->n_blocks > 0)
+        ring_drop_first(bq);
+
     while (bq->blocks)
         drop_block(bq, bq->blocks);
 
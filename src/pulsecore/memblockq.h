@@ -74,6 +74,22 @@ pa_memblockq* pa_memblockq_new(
         size_t maxrewind,
         pa_memchunk *silence);
 
+/* The same, but the chunks are kept in a growing array used as a ring
+ * instead of a list. Appending and dropping from the front never
+ * allocate, and finding the chunk at an index is a binary search
+ * instead of a walk. Overwriting queued data has to move the following
+ * chunks, so this is meant for queues that are mostly appended to. */
+pa_memblockq* pa_memblockq_new_ring(
+        const char *name,
+        int64_t idx,
+        size_t maxlength,
+        size_t tlength,
+        const pa_sample_spec *sample_spec,
+        size_t prebuf,
+        size_t minreq,
+        size_t maxrewind,
+        pa_memchunk *silence);
+
 void pa_memblockq_free(pa_memblockq*bq);
 
 /* Push a new memory chunk into the queue.  */
@@ -100,6 +116,20 @@ int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk);
  * silence memchunk for this memblockq if you use this call. */
 int pa_memblockq_peek_fixed_size(pa_memblockq *bq, size_t block_size, pa_memchunk *chunk);
 
+/* Like pa_memblockq_peek_fixed_size(), but return the block as up to n
+ * chunks that refer to the data in the queue, instead of copying them
+ * into a new memblock. Holes are filled with silence chunks. If n
+ * chunks are not enough, the remainder is copied into the last one.
+ * Returns the number of chunks filled in, or 0 if there is nothing to
+ * read. The caller has to unref their memblocks. */
+unsigned pa_memblockq_peek_fixed_size_chunks(pa_memblockq *bq, size_t block_size, pa_memchunk *chunks, unsigned n);
+
+/* Like pa_memblockq_peek(), but return up to n consecutive chunks of
+ * real data at once, e.g. to write them out with a single writev().
+ * Stops at the first hole, never returns silence. Returns the number
+ * of chunks filled in, the caller has to unref their memblocks. */
+unsigned pa_memblockq_peek_chunks(pa_memblockq *bq, pa_memchunk *chunks, unsigned n);
+
 /* Drop the specified bytes from the queue. */
 void pa_memblockq_drop(pa_memblockq *bq, size_t length);
 
@@ -67,6 +67,55 @@ pa_memchunk* pa_memchunk_make_writable(pa_memchunk *c, size_t min) {
     return c;
 }
 
+pa_memchunk* pa_memchunk_take(pa_memchunk *dst, pa_memchunk *src, size_t length) {
+    pa_assert(dst);
+    pa_assert(src);
+    pa_assert(src->memblock);
+    pa_assert(length > 0);
+
+    *dst = *src;
+
+    if (src->length <= length) {
+        /* The last piece, pass our reference on */
+        pa_memchunk_reset(src);
+        return dst;
+    }
+
+    pa_memblock_ref(dst->memblock);
+    dst->length = length;
+
+    src->index += length;
+    src->length -= length;
+
+    return dst;
+}
+
+bool pa_memchunk_filter_output(pa_memchunk *dst, pa_memchunk *src, size_t length) {
+    pa_mempool *pool;
+
+    pa_assert(dst);
+    pa_assert(src);
+    pa_assert(src->memblock);
+    pa_assert(length > 0);
+
+    if (src->length == length &&
+        pa_memblock_ref_is_one(src->memblock) &&
+        !pa_memblock_is_read_only(src->memblock)) {
+        /* Nobody else can see the data, the filter may overwrite it */
+        *dst = *src;
+        return true;
+    }
+
+    pool = pa_memblock_get_pool(src->memblock);
+    dst->memblock = pa_memblock_new(pool, length);
+    pa_mempool_unref(pool), pool = NULL;
+
+    dst->index = 0;
+    dst->length = length;
+
+    return false;
+}
+
 pa_memchunk* pa_memchunk_reset(pa_memchunk *c) {
     pa_assert(c);
 
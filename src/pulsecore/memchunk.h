@@ -40,6 +40,25 @@ struct pa_memchunk {
  * specified size, i.e. is enlarged if necessary. */
 pa_memchunk* pa_memchunk_make_writable(pa_memchunk *c, size_t min);
 
+/* Move the first length bytes of src to dst, or all of them if src is
+ * shorter. If that leaves nothing in src, its reference is handed over
+ * to dst and src is reset, otherwise dst takes a new reference. That
+ * way a consumer processing the last piece holds the only reference we
+ * have, and pa_memchunk_make_writable() won't copy it if nobody else
+ * does. Either way dst has to be unreferenced by the caller. */
+pa_memchunk* pa_memchunk_take(pa_memchunk *dst, pa_memchunk *src, size_t length);
+
+/* Set up dst to receive length bytes of output of a filter that reads
+ * src. If the output has the length of src and src holds the only
+ * reference to a writable memblock, dst refers to the same data, so
+ * that the filter processes it in place, and true is returned. src
+ * may still be acquired then, but its reference now belongs to dst.
+ * Otherwise dst gets a new memblock and false is returned.
+ * The filter has to cope with its input and output being the same
+ * buffer either way. dst has to be unreferenced by the caller, and
+ * src too if false was returned. */
+bool pa_memchunk_filter_output(pa_memchunk *dst, pa_memchunk *src, size_t length);
+
 /* Invalidate a memchunk. This does not free the containing memblock,
  * but sets all members to zero. */
 pa_memchunk* pa_memchunk_reset(pa_memchunk *c);
@@ -0,0 +1,169 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/resampler.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/sconv.h>
+
+#include "meter.h"
+
+/* How many samples are converted to float on the stack at a time */
+#define CONVERT_SAMPLES 1024
+
+pa_meter *pa_meter_new(pa_meter_levels *levels, pa_usec_t period) {
+    pa_meter *m;
+
+    pa_assert(levels);
+    pa_assert(period > 0);
+
+    m = pa_xnew0(pa_meter, 1);
+    PA_LLIST_INIT(pa_meter, m);
+    m->levels = levels;
+    m->period = period;
+
+    return m;
+}
+
+void pa_meter_free(pa_meter *m) {
+    pa_assert(m);
+
+    pa_xfree(m);
+}
+
+static void reset(pa_meter *m, unsigned channels) {
+    m->channels = channels;
+    m->n_frames = 0;
+    memset(m->peak, 0, sizeof(m->peak));
+    memset(m->sum, 0, sizeof(m->sum));
+}
+
+static void publish(pa_meter *m) {
+    pa_meter_levels *l = m->levels;
+    unsigned c;
+
+    /* Make the sequence number odd while we write, see meter.h */
+    pa_atomic_inc(&l->seq);
+
+    l->channels = m->channels;
+
+    for (c = 0; c < m->channels; c++) {
+        l->peak[c] = m->peak[c];
+        l->rms[c] = (float) sqrt(m->sum[c] / (double) m->n_frames);
+    }
+
+    l->timestamp = pa_rtclock_now();
+
+    pa_atomic_inc(&l->seq);
+
+    reset(m, m->channels);
+}
+
+/* Called from IO thread context */
+void pa_meter_process(pa_meter *m, const pa_memchunk *chunk, const pa_sample_spec *ss, const pa_cvolume *volume) {
+    float buf[CONVERT_SAMPLES], factor[PA_CHANNELS_MAX];
+    pa_convert_func_t convert;
+    pa_peaks_float_func_t peaks;
+    size_t period_frames, n_samples, max_samples;
+    const uint8_t *p;
+    unsigned c;
+
+    pa_assert(m);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+    pa_assert(ss);
+    pa_assert(pa_frame_aligned(chunk->length, ss));
+
+    if (m->channels != ss->channels)
+        reset(m, ss->channels);
+
+    period_frames = PA_MAX(pa_usec_to_bytes(m->period, ss) / pa_frame_size(ss), (size_t) 1);
+    n_samples = chunk->length / pa_sample_size(ss);
+
+    /* Nothing to look at, only the time passes */
+    if (pa_memblock_is_silence(chunk->memblock) || !(convert = pa_get_convert_to_float32ne_function(ss->format))) {
+        size_t n_frames = n_samples / ss->channels;
+
+        while (m->n_frames + n_frames >= period_frames) {
+            n_frames -= period_frames - m->n_frames;
+            m->n_frames = period_frames;
+            publish(m);
+        }
+
+        m->n_frames += n_frames;
+        return;
+    }
+
+    for (c = 0; c < ss->channels; c++)
+        factor[c] = volume && volume->channels == ss->channels ? (float) pa_sw_volume_to_linear(volume->values[c]) : 1.0f;
+
+    peaks = pa_get_peaks_float_func();
+
+    /* Convert whole frames only, so that each batch starts on the first
+     * channel */
+    max_samples = CONVERT_SAMPLES - CONVERT_SAMPLES % ss->channels;
+
+    p = (const uint8_t*) pa_memblock_acquire_chunk(chunk);
+
+    while (n_samples > 0) {
+        size_t n = PA_MIN(n_samples, max_samples), k = 0;
+
+        convert((unsigned) n, p, buf);
+        p += n * pa_sample_size(ss);
+        n_samples -= n;
+
+        /* Split the batch where periods end, the factors are not negative
+         * so the peak of the scaled data is the scaled peak */
+        while (k < n) {
+            size_t n_frames = PA_MIN((n - k) / ss->channels, period_frames - m->n_frames), j;
+            float peak[PA_CHANNELS_MAX] = { 0 };
+
+            peaks(buf + k, ss->channels, (unsigned) n_frames, peak);
+
+            for (c = 0; c < ss->channels; c++)
+                if (peak[c] * factor[c] > m->peak[c])
+                    m->peak[c] = peak[c] * factor[c];
+
+            for (j = 0, c = 0; j < n_frames * ss->channels; j++) {
+                float v = buf[k + j] * factor[c];
+
+                m->sum[c] += (double) v * v;
+
+                if (++c >= ss->channels)
+                    c = 0;
+            }
+
+            k += n_frames * ss->channels;
+
+            if ((m->n_frames += n_frames) >= period_frames)
+                publish(m);
+        }
+    }
+
+    pa_memblock_release(chunk->memblock);
+}
@@ -0,0 +1,72 @@
+#ifndef foopulsecoremeterhfoo
+#define foopulsecoremeterhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+#include <pulse/volume.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/memchunk.h>
+
+/* Level meters, fed by the IO thread of a sink, source or sink input
+ * with the data it renders or posts anyway. Every period the meter
+ * publishes the per channel peak and RMS of what it has seen into a
+ * pa_meter_levels, which usually lives in memory shared with a client,
+ * so that nobody has to create a record stream just to draw a meter. */
+
+/* seq is odd while the levels are being updated, and changes with every
+ * update, so readers retry until they see the same even value before and
+ * after copying the fields. Levels are linear, 1.0 being full scale.
+ * timestamp is pa_rtclock_now() of the update, 0 before the first one. */
+typedef struct pa_meter_levels {
+    pa_atomic_t seq;
+    uint32_t channels;
+    uint64_t timestamp;
+    float peak[PA_CHANNELS_MAX];
+    float rms[PA_CHANNELS_MAX];
+} pa_meter_levels;
+
+typedef struct pa_meter pa_meter;
+
+struct pa_meter {
+    PA_LLIST_FIELDS(pa_meter);
+
+    pa_meter_levels *levels;
+    pa_usec_t period;
+
+    /* Only used from the IO thread */
+    unsigned channels;
+    size_t n_frames;
+    float peak[PA_CHANNELS_MAX];
+    double sum[PA_CHANNELS_MAX];
+};
+
+/* Called from main context. levels has to stay valid until the meter
+ * is freed. */
+pa_meter *pa_meter_new(pa_meter_levels *levels, pa_usec_t period);
+void pa_meter_free(pa_meter *m);
+
+/* Called from IO thread context. volume, if not NULL, is applied to the
+ * data before measuring it. */
+void pa_meter_process(pa_meter *m, const pa_memchunk *chunk, const pa_sample_spec *ss, const pa_cvolume *volume);
+
+#endif
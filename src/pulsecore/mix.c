@@ -24,27 +24,42 @@
 #endif
 
 #include <math.h>
+#include <string.h>
 
 #include <pulsecore/sample-util.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/g711.h>
 #include <pulsecore/endianmacros.h>
+#include <pulsecore/sconv.h>
 
 #include "cpu.h"
 #include "mix.h"
 
 #define VOLUME_PADDING 32
 
+/* pa_mix() processes its input in tiles so that the input data of all
+ * streams that is touched by one pass of the mixing loop stays in the L1
+ * cache. The tile never gets shorter than MIX_TILE_MIN_FRAMES though, to
+ * keep the per-call overhead of the mixing functions low. */
+#define MIX_TILE_CACHE_BYTES (16*1024)
+#define MIX_TILE_MIN_FRAMES 64
+
+/* Formats without a ramp function are converted to float in blocks of
+ * this many samples */
+#define RAMP_CONVERT_SAMPLES 1024
+
 static void calc_linear_integer_volume(int32_t linear[], const pa_cvolume *volume) {
     unsigned channel, nchannels, padding;
+    double f[PA_CHANNELS_MAX];
 
     pa_assert(linear);
     pa_assert(volume);
 
     nchannels = volume->channels;
+    pa_sw_cvolume_to_linear(f, volume);
 
     for (channel = 0; channel < nchannels; channel++)
-        linear[channel] = (int32_t) lrint(pa_sw_volume_to_linear(volume->values[channel]) * 0x10000);
+        linear[channel] = (int32_t) lrint(f[channel] * 0x10000);
 
     for (padding = 0; padding < VOLUME_PADDING; padding++, channel++)
         linear[channel] = linear[padding];
@@ -52,14 +67,16 @@ static void calc_linear_integer_volume(int32_t linear[], const pa_cvolume *volum
 
 static void calc_linear_float_volume(float linear[], const pa_cvolume *volume) {
     unsigned channel, nchannels, padding;
+    double f[PA_CHANNELS_MAX];
 
     pa_assert(linear);
     pa_assert(volume);
 
     nchannels = volume->channels;
+    pa_sw_cvolume_to_linear(f, volume);
 
     for (channel = 0; channel < nchannels; channel++)
-        linear[channel] = (float) pa_sw_volume_to_linear(volume->values[channel]);
+        linear[channel] = (float) f[channel];
 
     for (padding = 0; padding < VOLUME_PADDING; padding++, channel++)
         linear[channel] = linear[padding];
@@ -76,11 +93,13 @@ static void calc_linear_integer_stream_volumes(pa_mix_info streams[], unsigned n
     calc_linear_float_volume(linear, volume);
 
     for (k = 0; k < nstreams; k++) {
+        pa_mix_info *m = streams + k;
+        double f[PA_CHANNELS_MAX];
 
-        for (channel = 0; channel < spec->channels; channel++) {
-            pa_mix_info *m = streams + k;
-            m->linear[channel].i = (int32_t) lrint(pa_sw_volume_to_linear(m->volume.values[channel]) * linear[channel] * 0x10000);
-        }
+        pa_sw_cvolume_to_linear(f, &m->volume);
+
+        for (channel = 0; channel < spec->channels; channel++)
+            m->linear[channel].i = (int32_t) lrint(f[channel] * linear[channel] * 0x10000);
     }
 }
 
@@ -95,11 +114,13 @@ static void calc_linear_float_stream_volumes(pa_mix_info streams[], unsigned nst
     calc_linear_float_volume(linear, volume);
 
     for (k = 0; k < nstreams; k++) {
+        pa_mix_info *m = streams + k;
+        double f[PA_CHANNELS_MAX];
 
-        for (channel = 0; channel < spec->channels; channel++) {
-            pa_mix_info *m = streams + k;
-            m->linear[channel].f = (float) (pa_sw_volume_to_linear(m->volume.values[channel]) * linear[channel]);
-        }
+        pa_sw_cvolume_to_linear(f, &m->volume);
+
+        for (channel = 0; channel < spec->channels; channel++)
+            m->linear[channel].f = (float) (f[channel] * linear[channel]);
     }
 }
 
@@ -589,6 +610,69 @@ static void pa_mix_float32re_c(pa_mix_info streams[], unsigned nstreams, unsigne
     }
 }
 
+/* Mixing functions for a fixed channel count, for the formats sinks
+ * usually run in. The per channel loops have constant bounds, so the
+ * compiler unrolls them and keeps the sums of a frame in registers. The
+ * results are identical to the generic functions above. */
+#define DEFINE_MIX_CHANNELS_FUNC(name, n_channels, type, sum_type, ACCUMULATE, STORE) \
+    static void name(pa_mix_info streams[], unsigned nstreams, unsigned channels, type *data, unsigned length) { \
+        length /= sizeof(type) * n_channels; \
+                                                                        \
+        for (; length > 0; length--, data += n_channels) { \
+            sum_type sum[n_channels] = { 0 }; \
+            unsigned i, c; \
+                                                                        \
+            for (i = 0; i < nstreams; i++) { \
+                pa_mix_info *m = streams + i; \
+                const type *ptr = m->ptr; \
+                                                                        \
+                for (c = 0; c < n_channels; c++) \
+                    ACCUMULATE(sum[c], ptr[c], m->linear[c]); \
+                m->ptr = (uint8_t*) m->ptr + n_channels * sizeof(type); \
+            } \
+                                                                        \
+            for (c = 0; c < n_channels; c++) \
+                STORE(data[c], sum[c]); \
+        } \
+    }
+
+#define ACCUMULATE_S16(sum, v, l) \
+    sum += pa_mult_s16_volume(v, (l).i)
+#define STORE_S16(d, sum) \
+    d = (int16_t) PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF)
+
+#define ACCUMULATE_S32(sum, v, l) \
+    do { if (PA_LIKELY((l).i > 0)) sum += ((int64_t) (v) * (l).i) >> 16; } while (0)
+#define STORE_S32(d, sum) \
+    d = (int32_t) PA_CLAMP_UNLIKELY(sum, -0x80000000LL, 0x7FFFFFFFLL)
+
+#define ACCUMULATE_FLOAT32(sum, v, l) \
+    do { if (PA_LIKELY((l).f > 0)) sum += (v) * (l).f; } while (0)
+#define STORE_FLOAT32(d, sum) \
+    d = sum
+
+DEFINE_MIX_CHANNELS_FUNC(pa_mix_ch6_s16ne, 6, int16_t, int32_t, ACCUMULATE_S16, STORE_S16)
+DEFINE_MIX_CHANNELS_FUNC(pa_mix_ch2_s32ne, 2, int32_t, int64_t, ACCUMULATE_S32, STORE_S32)
+DEFINE_MIX_CHANNELS_FUNC(pa_mix_ch6_s32ne, 6, int32_t, int64_t, ACCUMULATE_S32, STORE_S32)
+DEFINE_MIX_CHANNELS_FUNC(pa_mix_ch2_float32ne, 2, float, float, ACCUMULATE_FLOAT32, STORE_FLOAT32)
+DEFINE_MIX_CHANNELS_FUNC(pa_mix_ch6_float32ne, 6, float, float, ACCUMULATE_FLOAT32, STORE_FLOAT32)
+
+/* S16NE stereo is already special cased in pa_mix_s16ne_c() */
+static const pa_do_mix_func_t do_mix_ch2_table_c[PA_SAMPLE_MAX] = {
+    [PA_SAMPLE_S32NE]     = (pa_do_mix_func_t) pa_mix_ch2_s32ne,
+    [PA_SAMPLE_FLOAT32NE] = (pa_do_mix_func_t) pa_mix_ch2_float32ne
+};
+
+static const pa_do_mix_func_t do_mix_ch6_table_c[PA_SAMPLE_MAX] = {
+    [PA_SAMPLE_S16NE]     = (pa_do_mix_func_t) pa_mix_ch6_s16ne,
+    [PA_SAMPLE_S32NE]     = (pa_do_mix_func_t) pa_mix_ch6_s32ne,
+    [PA_SAMPLE_FLOAT32NE] = (pa_do_mix_func_t) pa_mix_ch6_float32ne
+};
+
+/* Cleared for a format once an optimized function is installed for it */
+static pa_do_mix_func_t do_mix_ch2_table[PA_SAMPLE_MAX];
+static pa_do_mix_func_t do_mix_ch6_table[PA_SAMPLE_MAX];
+
 static pa_do_mix_func_t do_mix_table[] = {
     [PA_SAMPLE_U8]        = (pa_do_mix_func_t) pa_mix_u8_c,
     [PA_SAMPLE_ALAW]      = (pa_do_mix_func_t) pa_mix_alaw_c,
@@ -606,10 +690,15 @@ static pa_do_mix_func_t do_mix_table[] = {
 };
 
 void pa_mix_func_init(const pa_cpu_info *cpu_info) {
-    if (cpu_info->force_generic_code)
+    if (cpu_info->force_generic_code) {
         do_mix_table[PA_SAMPLE_S16NE] = (pa_do_mix_func_t) pa_mix_generic_s16ne;
-    else
+        memset(do_mix_ch2_table, 0, sizeof(do_mix_ch2_table));
+        memset(do_mix_ch6_table, 0, sizeof(do_mix_ch6_table));
+    } else {
         do_mix_table[PA_SAMPLE_S16NE] = (pa_do_mix_func_t) pa_mix_s16ne_c;
+        memcpy(do_mix_ch2_table, do_mix_ch2_table_c, sizeof(do_mix_ch2_table));
+        memcpy(do_mix_ch6_table, do_mix_ch6_table_c, sizeof(do_mix_ch6_table));
+    }
 }
 
 size_t pa_mix(
@@ -621,9 +710,27 @@ size_t pa_mix(
         const pa_cvolume *volume,
         bool mute) {
 
+    pa_assert(spec);
+
+    return pa_mix_with_func(pa_get_mix_func_for_channels(spec->format, spec->channels),
+                            streams, nstreams, data, length, spec, volume, mute);
+}
+
+size_t pa_mix_with_func(
+        pa_do_mix_func_t do_mix,
+        pa_mix_info streams[],
+        unsigned nstreams,
+        void *data,
+        size_t length,
+        const pa_sample_spec *spec,
+        const pa_cvolume *volume,
+        bool mute) {
+
     pa_cvolume full_volume;
+    size_t frame_size, tile, offset;
     unsigned k;
 
+    pa_assert(do_mix);
     pa_assert(streams);
     pa_assert(data);
     pa_assert(length);
@@ -640,11 +747,27 @@ size_t pa_mix(
 
     for (k = 0; k < nstreams; k++) {
         pa_assert(length <= streams[k].chunk.length);
-        streams[k].ptr = pa_memblock_acquire_chunk(&streams[k].chunk);
+        streams[k].base = pa_memblock_acquire_chunk(&streams[k].chunk);
     }
 
     calc_stream_volumes_table[spec->format](streams, nstreams, volume, spec);
-    do_mix_table[spec->format](streams, nstreams, spec->channels, data, length);
+
+    /* Not all mixing functions advance the stream pointers, hence we
+     * position them explicitly for each tile. Every tile starts on a frame
+     * boundary, so the channel position is the same for all of them. */
+    frame_size = pa_frame_size(spec);
+    tile = PA_MAX(MIX_TILE_CACHE_BYTES / (nstreams + 1), MIX_TILE_MIN_FRAMES * frame_size);
+    tile = (tile / frame_size) * frame_size;
+
+    for (offset = 0; offset < length; offset += tile) {
+        if (tile > length - offset)
+            tile = length - offset;
+
+        for (k = 0; k < nstreams; k++)
+            streams[k].ptr = (uint8_t*) streams[k].base + offset;
+
+        do_mix(streams, nstreams, spec->channels, (uint8_t*) data + offset, (unsigned) tile);
+    }
 
     for (k = 0; k < nstreams; k++)
         pa_memblock_release(streams[k].chunk.memblock);
@@ -658,10 +781,26 @@ pa_do_mix_func_t pa_get_mix_func(pa_sample_format_t f) {
     return do_mix_table[f];
 }
 
+pa_do_mix_func_t pa_get_mix_func_for_channels(pa_sample_format_t f, unsigned channels) {
+    pa_assert(pa_sample_format_valid(f));
+
+    if (channels == 2 && do_mix_ch2_table[f])
+        return do_mix_ch2_table[f];
+
+    if (channels == 6 && do_mix_ch6_table[f])
+        return do_mix_ch6_table[f];
+
+    return do_mix_table[f];
+}
+
 void pa_set_mix_func(pa_sample_format_t f, pa_do_mix_func_t func) {
     pa_assert(pa_sample_format_valid(f));
 
     do_mix_table[f] = func;
+
+    /* Vectorized functions beat the unrolled C ones */
+    do_mix_ch2_table[f] = NULL;
+    do_mix_ch6_table[f] = NULL;
 }
 
 typedef union {
@@ -724,3 +863,92 @@ void pa_volume_memchunk(
 
     pa_memblock_release(c->memblock);
 }
+
+static void volume_ramp_via_float(
+        void *ptr,
+        const pa_sample_spec *spec,
+        float *volumes,
+        const float *steps,
+        size_t nframes) {
+
+    float buf[RAMP_CONVERT_SAMPLES];
+    pa_convert_func_t to_float, from_float;
+    pa_do_volume_ramp_func_t do_ramp;
+    size_t fs = pa_frame_size(spec), block = RAMP_CONVERT_SAMPLES / spec->channels;
+
+    pa_assert_se(to_float = pa_get_convert_to_float32ne_function(spec->format));
+    pa_assert_se(from_float = pa_get_convert_from_float32ne_function(spec->format));
+    pa_assert_se(do_ramp = pa_get_volume_ramp_func(PA_SAMPLE_FLOAT32NE));
+
+    while (nframes > 0) {
+        size_t n = PA_MIN(nframes, block);
+        unsigned nsamples = (unsigned) (n * spec->channels);
+
+        to_float(nsamples, ptr, buf);
+        do_ramp(buf, volumes, steps, spec->channels, nsamples * sizeof(float));
+        from_float(nsamples, buf, ptr);
+
+        ptr = (uint8_t*) ptr + n * fs;
+        nframes -= n;
+    }
+}
+
+/* Ramps the volume linearly from 'from' at the first frame of the chunk
+ * to 'to' at frame ramp_frames, and applies 'to' to whatever follows. */
+void pa_volume_memchunk_ramp(
+        pa_memchunk *c,
+        const pa_sample_spec *spec,
+        const pa_cvolume *from,
+        const pa_cvolume *to,
+        size_t ramp_frames) {
+
+    void *ptr;
+    float volumes[PA_CHANNELS_MAX], steps[PA_CHANNELS_MAX];
+    pa_do_volume_ramp_func_t do_ramp;
+    size_t fs, nframes, n;
+    unsigned channel;
+
+    pa_assert(c);
+    pa_assert(spec);
+    pa_assert(pa_sample_spec_valid(spec));
+    pa_assert(pa_frame_aligned(c->length, spec));
+    pa_assert(from);
+    pa_assert(to);
+    pa_assert(from->channels == spec->channels);
+    pa_assert(to->channels == spec->channels);
+
+    if (ramp_frames == 0 || pa_cvolume_equal(from, to)) {
+        pa_volume_memchunk(c, spec, to);
+        return;
+    }
+
+    if (pa_memblock_is_silence(c->memblock))
+        return;
+
+    fs = pa_frame_size(spec);
+    nframes = c->length / fs;
+    n = PA_MIN(nframes, ramp_frames);
+
+    for (channel = 0; channel < spec->channels; channel++) {
+        volumes[channel] = (float) pa_sw_volume_to_linear(from->values[channel]);
+        steps[channel] = ((float) pa_sw_volume_to_linear(to->values[channel]) - volumes[channel]) / (float) ramp_frames;
+    }
+
+    ptr = pa_memblock_acquire_chunk(c);
+
+    if ((do_ramp = pa_get_volume_ramp_func(spec->format)))
+        do_ramp(ptr, volumes, steps, spec->channels, (unsigned) (n * fs));
+    else
+        volume_ramp_via_float(ptr, spec, volumes, steps, n);
+
+    pa_memblock_release(c->memblock);
+
+    if (n < nframes) {
+        pa_memchunk rest = *c;
+
+        rest.index += n * fs;
+        rest.length -= n * fs;
+
+        pa_volume_memchunk(&rest, spec, to);
+    }
+}
@@ -26,6 +26,11 @@
 #include <pulse/volume.h>
 #include <pulsecore/memchunk.h>
 
+/* Number of extra entries at the end of pa_mix_info.linear, used by the
+ * vectorized mixing functions to load the factors of a whole vector
+ * regardless of the channel it starts at */
+#define PA_MIX_LINEAR_PADDING 16
+
 typedef struct pa_mix_info {
     pa_memchunk chunk;
     pa_cvolume volume;
@@ -33,11 +38,12 @@ typedef struct pa_mix_info {
 
     /* The following fields are used internally by pa_mix(), should
      * not be initialised by the caller of pa_mix(). */
+    void *base;
     void *ptr;
     union {
         int32_t i;
         float f;
-    } linear[PA_CHANNELS_MAX];
+    } linear[PA_CHANNELS_MAX + PA_MIX_LINEAR_PADDING];
 } pa_mix_info;
 
 size_t pa_mix(
@@ -51,12 +57,37 @@ size_t pa_mix(
 
 typedef void (*pa_do_mix_func_t) (pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, unsigned length);
 
+/* Like pa_mix(), but with a mixing function that was looked up before,
+ * e.g. with pa_get_mix_func_for_channels() when a sink started */
+size_t pa_mix_with_func(
+    pa_do_mix_func_t do_mix,
+    pa_mix_info channels[],
+    unsigned nchannels,
+    void *data,
+    size_t length,
+    const pa_sample_spec *spec,
+    const pa_cvolume *volume,
+    bool mute);
+
 pa_do_mix_func_t pa_get_mix_func(pa_sample_format_t f);
 void pa_set_mix_func(pa_sample_format_t f, pa_do_mix_func_t func);
 
+/* Return the best mixing function for this format and channel count.
+ * That is a function specialized for the channel count if there is one
+ * and no optimized function was set with pa_set_mix_func(), the
+ * function of pa_get_mix_func() otherwise. */
+pa_do_mix_func_t pa_get_mix_func_for_channels(pa_sample_format_t f, unsigned channels);
+
 void pa_volume_memchunk(
     pa_memchunk*c,
     const pa_sample_spec *spec,
     const pa_cvolume *volume);
 
+void pa_volume_memchunk_ramp(
+    pa_memchunk *c,
+    const pa_sample_spec *spec,
+    const pa_cvolume *from,
+    const pa_cvolume *to,
+    size_t ramp_frames);
+
 #endif
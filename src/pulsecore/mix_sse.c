@@ -0,0 +1,403 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/endianmacros.h>
+#include <pulsecore/sample-util.h>
+
+#include "cpu-x86.h"
+#include "mix.h"
+
+#if (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__)
+
+#include <immintrin.h>
+
+/* The functions in this file produce bit-identical results to the generic
+ * implementations in mix.c. They are compiled with per-function target
+ * attributes, so no special compiler flags are needed, and are only
+ * installed if the CPU supports the respective instruction set.
+ *
+ * The vector loops load the volume factors of a whole vector starting at
+ * the current channel position, which may run past the last channel. Hence
+ * the factors are repeated into the padding of the linear[] array first. */
+
+static void pad_linear_volumes(pa_mix_info streams[], unsigned nstreams, unsigned channels) {
+    unsigned k, c;
+
+    for (k = 0; k < nstreams; k++)
+        for (c = channels; c < channels + PA_MIX_LINEAR_PADDING; c++)
+            streams[k].linear[c] = streams[k].linear[c - channels];
+}
+
+static inline unsigned advance_channel(unsigned channel, unsigned n, unsigned channels) {
+    channel += n;
+
+    while (channel >= channels)
+        channel -= channels;
+
+    return channel;
+}
+
+static void mix_s16ne_tail(pa_mix_info streams[], unsigned nstreams, unsigned channels, unsigned channel, int16_t *data, unsigned n) {
+    for (; n > 0; n--, data++) {
+        int32_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            int32_t cv = m->linear[channel].i;
+
+            if (PA_LIKELY(cv > 0))
+                sum += pa_mult_s16_volume(*((int16_t*) m->ptr), cv);
+            m->ptr = (uint8_t*) m->ptr + sizeof(int16_t);
+        }
+
+        *data = PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void mix_s32ne_tail(pa_mix_info streams[], unsigned nstreams, unsigned channels, unsigned channel, int32_t *data, unsigned n) {
+    for (; n > 0; n--, data++) {
+        int64_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            int32_t cv = m->linear[channel].i;
+            int64_t v;
+
+            if (PA_LIKELY(cv > 0)) {
+                v = *((int32_t*) m->ptr);
+                v = (v * cv) >> 16;
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(int32_t);
+        }
+
+        sum = PA_CLAMP_UNLIKELY(sum, -0x80000000LL, 0x7FFFFFFFLL);
+        *data = (int32_t) sum;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void mix_float32ne_tail(pa_mix_info streams[], unsigned nstreams, unsigned channels, unsigned channel, float *data, unsigned n) {
+    for (; n > 0; n--, data++) {
+        float sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            float v, cv = m->linear[channel].f;
+
+            if (PA_LIKELY(cv > 0)) {
+                v = *((float*) m->ptr);
+                v *= cv;
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(float);
+        }
+
+        *data = sum;
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+/* (s * cv) >> 16 for 8 s16 samples, computed as s * hi + ((s * lo) >> 16)
+ * with hi and lo being the upper and lower 16 bits of the 32 bit factor,
+ * which is exactly what pa_mult_s16_volume() calculates. */
+__attribute__((target("sse2")))
+static inline void mult_s16_volume_sse2(__m128i s, const int32_t *cv, __m128i *r0, __m128i *r1) {
+    __m128i v0, v1, hi, lo, t, p_lo, p_hi;
+
+    v0 = _mm_loadu_si128((const __m128i*) cv);
+    v1 = _mm_loadu_si128((const __m128i*) (cv + 4));
+
+    hi = _mm_packs_epi32(_mm_srai_epi32(v0, 16), _mm_srai_epi32(v1, 16));
+    lo = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(v0, 16), 16), _mm_srai_epi32(_mm_slli_epi32(v1, 16), 16));
+
+    /* Signed times unsigned 16 bit high multiplication */
+    t = _mm_sub_epi16(_mm_mulhi_epu16(s, lo), _mm_and_si128(_mm_srai_epi16(s, 15), lo));
+
+    p_lo = _mm_mullo_epi16(s, hi);
+    p_hi = _mm_mulhi_epi16(s, hi);
+
+    *r0 = _mm_add_epi32(_mm_unpacklo_epi16(p_lo, p_hi), _mm_srai_epi32(_mm_unpacklo_epi16(t, t), 16));
+    *r1 = _mm_add_epi32(_mm_unpackhi_epi16(p_lo, p_hi), _mm_srai_epi32(_mm_unpackhi_epi16(t, t), 16));
+}
+
+__attribute__((target("sse2")))
+static void pa_mix_s16ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    unsigned channel = 0, n;
+
+    pad_linear_volumes(streams, nstreams, channels);
+
+    length /= sizeof(int16_t);
+
+    for (n = length / 8; n > 0; n--, data += 8) {
+        __m128i sum0 = _mm_setzero_si128(), sum1 = _mm_setzero_si128();
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            __m128i r0, r1;
+
+            mult_s16_volume_sse2(_mm_loadu_si128((const __m128i*) m->ptr), &m->linear[channel].i, &r0, &r1);
+            sum0 = _mm_add_epi32(sum0, r0);
+            sum1 = _mm_add_epi32(sum1, r1);
+
+            m->ptr = (uint8_t*) m->ptr + 8 * sizeof(int16_t);
+        }
+
+        _mm_storeu_si128((__m128i*) data, _mm_packs_epi32(sum0, sum1));
+
+        channel = advance_channel(channel, 8, channels);
+    }
+
+    mix_s16ne_tail(streams, nstreams, channels, channel, data, length % 8);
+}
+
+__attribute__((target("sse")))
+static void pa_mix_float32ne_sse(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    unsigned channel = 0, n;
+    const __m128 zero = _mm_setzero_ps();
+
+    pad_linear_volumes(streams, nstreams, channels);
+
+    length /= sizeof(float);
+
+    for (n = length / 4; n > 0; n--, data += 4) {
+        __m128 sum = _mm_setzero_ps();
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            __m128 cv = _mm_loadu_ps(&m->linear[channel].f);
+
+            /* Samples with a zero factor are skipped by the generic code,
+             * mask the product so that NaNs don't leak into the sum. */
+            sum = _mm_add_ps(sum, _mm_and_ps(_mm_mul_ps(_mm_loadu_ps(m->ptr), cv), _mm_cmpgt_ps(cv, zero)));
+
+            m->ptr = (uint8_t*) m->ptr + 4 * sizeof(float);
+        }
+
+        _mm_storeu_ps(data, sum);
+
+        channel = advance_channel(channel, 4, channels);
+    }
+
+    mix_float32ne_tail(streams, nstreams, channels, channel, data, length % 4);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mult_s16_volume_avx2(__m128i s, const int32_t *cv) {
+    __m256i v, s32;
+
+    v = _mm256_loadu_si256((const __m256i*) cv);
+    s32 = _mm256_cvtepi16_epi32(s);
+
+    /* |s * lo| < 2^31, so both products fit into 32 bits */
+    return _mm256_add_epi32(
+            _mm256_mullo_epi32(s32, _mm256_srai_epi32(v, 16)),
+            _mm256_srai_epi32(_mm256_mullo_epi32(s32, _mm256_and_si256(v, _mm256_set1_epi32(0xFFFF))), 16));
+}
+
+__attribute__((target("avx2")))
+static void pa_mix_s16ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    unsigned channel = 0, channel8, n;
+
+    pad_linear_volumes(streams, nstreams, channels);
+
+    length /= sizeof(int16_t);
+
+    for (n = length / 16; n > 0; n--, data += 16) {
+        __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+        unsigned i;
+
+        channel8 = advance_channel(channel, 8, channels);
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            __m256i s = _mm256_loadu_si256((const __m256i*) m->ptr);
+
+            sum0 = _mm256_add_epi32(sum0, mult_s16_volume_avx2(_mm256_castsi256_si128(s), &m->linear[channel].i));
+            sum1 = _mm256_add_epi32(sum1, mult_s16_volume_avx2(_mm256_extracti128_si256(s, 1), &m->linear[channel8].i));
+
+            m->ptr = (uint8_t*) m->ptr + 16 * sizeof(int16_t);
+        }
+
+        /* packs works on 128 bit lanes, restore the sample order */
+        _mm256_storeu_si256((__m256i*) data, _mm256_permute4x64_epi64(_mm256_packs_epi32(sum0, sum1), 0xD8));
+
+        channel = advance_channel(channel8, 8, channels);
+    }
+
+    mix_s16ne_tail(streams, nstreams, channels, channel, data, length % 16);
+}
+
+/* (s * cv) >> 16 for 4 s32 samples with 64 bit intermediates. AVX2 has no
+ * 64 bit arithmetic shift, so the sign is shifted in by hand. */
+__attribute__((target("avx2")))
+static inline __m256i mult_s32_volume_avx2(const int32_t *s, const int32_t *cv) {
+    __m256i p, sign;
+
+    p = _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) s)),
+                         _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) cv)));
+    sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), p);
+
+    return _mm256_or_si256(_mm256_srli_epi64(p, 16), _mm256_slli_epi64(sign, 48));
+}
+
+__attribute__((target("avx2")))
+static inline __m128i clamp_s64_to_s32_avx2(__m256i sum) {
+    const __m256i max = _mm256_set1_epi64x(0x7FFFFFFFLL);
+    const __m256i min = _mm256_set1_epi64x(-0x80000000LL);
+
+    sum = _mm256_blendv_epi8(sum, max, _mm256_cmpgt_epi64(sum, max));
+    sum = _mm256_blendv_epi8(sum, min, _mm256_cmpgt_epi64(min, sum));
+
+    /* Pick the low 32 bits of each 64 bit lane */
+    return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(sum, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7)));
+}
+
+__attribute__((target("avx2")))
+static void pa_mix_s32ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    unsigned channel = 0, channel4, n;
+
+    pad_linear_volumes(streams, nstreams, channels);
+
+    length /= sizeof(int32_t);
+
+    for (n = length / 8; n > 0; n--, data += 8) {
+        __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+        unsigned i;
+
+        channel4 = advance_channel(channel, 4, channels);
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+
+            sum0 = _mm256_add_epi64(sum0, mult_s32_volume_avx2(m->ptr, &m->linear[channel].i));
+            sum1 = _mm256_add_epi64(sum1, mult_s32_volume_avx2((int32_t*) m->ptr + 4, &m->linear[channel4].i));
+
+            m->ptr = (uint8_t*) m->ptr + 8 * sizeof(int32_t);
+        }
+
+        _mm_storeu_si128((__m128i*) data, clamp_s64_to_s32_avx2(sum0));
+        _mm_storeu_si128((__m128i*) (data + 4), clamp_s64_to_s32_avx2(sum1));
+
+        channel = advance_channel(channel4, 4, channels);
+    }
+
+    mix_s32ne_tail(streams, nstreams, channels, channel, data, length % 8);
+}
+
+__attribute__((target("avx")))
+static void pa_mix_float32ne_avx(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    unsigned channel = 0, n;
+    const __m256 zero = _mm256_setzero_ps();
+
+    pad_linear_volumes(streams, nstreams, channels);
+
+    length /= sizeof(float);
+
+    for (n = length / 8; n > 0; n--, data += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            __m256 cv = _mm256_loadu_ps(&m->linear[channel].f);
+
+            sum = _mm256_add_ps(sum, _mm256_and_ps(_mm256_mul_ps(_mm256_loadu_ps(m->ptr), cv), _mm256_cmp_ps(cv, zero, _CMP_GT_OQ)));
+
+            m->ptr = (uint8_t*) m->ptr + 8 * sizeof(float);
+        }
+
+        _mm256_storeu_ps(data, sum);
+
+        channel = advance_channel(channel, 8, channels);
+    }
+
+    mix_float32ne_tail(streams, nstreams, channels, channel, data, length % 8);
+}
+
+__attribute__((target("avx512f")))
+static void pa_mix_float32ne_avx512(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    unsigned channel = 0, n;
+    const __m512 zero = _mm512_setzero_ps();
+
+    pad_linear_volumes(streams, nstreams, channels);
+
+    length /= sizeof(float);
+
+    for (n = length / 16; n > 0; n--, data += 16) {
+        __m512 sum = _mm512_setzero_ps();
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            __m512 cv = _mm512_loadu_ps(&m->linear[channel].f);
+            __mmask16 mask = _mm512_cmp_ps_mask(cv, zero, _CMP_GT_OQ);
+
+            sum = _mm512_mask_add_ps(sum, mask, sum, _mm512_mul_ps(_mm512_loadu_ps(m->ptr), cv));
+
+            m->ptr = (uint8_t*) m->ptr + 16 * sizeof(float);
+        }
+
+        _mm512_storeu_ps(data, sum);
+
+        channel = advance_channel(channel, 16, channels);
+    }
+
+    mix_float32ne_tail(streams, nstreams, channels, channel, data, length % 16);
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_mix_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__)
+
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized mixing functions.");
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_avx2);
+        pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_avx2);
+    } else if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized mixing functions.");
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_sse2);
+    }
+
+    if (flags & PA_CPU_X86_AVX512F)
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_avx512);
+    else if (flags & PA_CPU_X86_AVX)
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_avx);
+    else if (flags & PA_CPU_X86_SSE)
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_sse);
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -35,27 +35,50 @@
 #include "modargs.h"
 
 struct pa_modargs {
-    pa_hashmap *raw;
-    pa_hashmap *unescaped;
+    pa_hashmap *entries;
 };
 
+/* Key, raw and unescaped value of an argument live in one allocation
+ * following the entry. Most values contain no backslash, then value
+ * and raw point to the same string. */
 struct entry {
-    char *key, *value;
+    char *key, *value, *raw;
 };
 
-static int add_key_value(pa_modargs *ma, char *key, char *value, const char* const valid_keys[], bool ignore_dupes) {
+/* key and value point into the string that is being parsed */
+static int add_key_value(pa_modargs *ma, const char *key, size_t key_len, const char *value, size_t value_len,
+                         const char* const valid_keys[], bool ignore_dupes) {
     struct entry *e;
-    char *raw;
+    bool escaped;
+    char *p;
 
     pa_assert(ma);
-    pa_assert(ma->raw);
-    pa_assert(ma->unescaped);
+    pa_assert(ma->entries);
     pa_assert(key);
     pa_assert(value);
 
-    if (pa_hashmap_get(ma->unescaped, key)) {
-        pa_xfree(key);
-        pa_xfree(value);
+    escaped = memchr(value, '\\', value_len);
+
+    e = pa_xmalloc(PA_ALIGN(sizeof(struct entry)) + key_len + 1 + (value_len + 1) * (escaped ? 2 : 1));
+    p = (char *) e + PA_ALIGN(sizeof(struct entry));
+
+    e->key = p;
+    memcpy(p, key, key_len);
+    p[key_len] = 0;
+    p += key_len + 1;
+
+    e->raw = p;
+    memcpy(p, value, value_len);
+    p[value_len] = 0;
+
+    if (escaped) {
+        p += value_len + 1;
+        e->value = pa_unescape(memcpy(p, e->raw, value_len + 1));
+    } else
+        e->value = e->raw;
+
+    if (pa_hashmap_get(ma->entries, e->key)) {
+        pa_xfree(e);
 
         if (ignore_dupes)
             return 0;
@@ -66,44 +89,20 @@ static int add_key_value(pa_modargs *ma, char *key, char *value, const char* con
     if (valid_keys) {
         const char*const* v;
         for (v = valid_keys; *v; v++)
-            if (pa_streq(*v, key))
+            if (pa_streq(*v, e->key))
                 break;
 
         if (!*v) {
-            pa_xfree(key);
-            pa_xfree(value);
+            pa_xfree(e);
             return -1;
         }
     }
 
-    raw = pa_xstrdup(value);
-
-    e = pa_xnew(struct entry, 1);
-    e->key = key;
-    e->value = pa_unescape(value);
-    pa_hashmap_put(ma->unescaped, key, e);
-
-    if (pa_streq(raw, value))
-        pa_xfree(raw);
-    else {
-        e = pa_xnew(struct entry, 1);
-        e->key = pa_xstrdup(key);
-        e->value = raw;
-        pa_hashmap_put(ma->raw, key, e);
-    }
+    pa_hashmap_put(ma->entries, e->key, e);
 
     return 0;
 }
 
-static void free_func(void *p) {
-    struct entry *e = p;
-    pa_assert(e);
-
-    pa_xfree(e->key);
-    pa_xfree(e->value);
-    pa_xfree(e);
-}
-
 static int parse(pa_modargs *ma, const char *args, const char* const* valid_keys, bool ignore_dupes) {
     enum {
         WHITESPACE,
@@ -154,11 +153,7 @@ static int parse(pa_modargs *ma, const char *args, const char* const* valid_keys
                     value = p+1;
                     value_len = 0;
                 } else if (isspace((unsigned char)*p)) {
-                    if (add_key_value(ma,
-                                      pa_xstrndup(key, key_len),
-                                      pa_xstrdup(""),
-                                      valid_keys,
-                                      ignore_dupes) < 0)
+                    if (add_key_value(ma, key, key_len, "", 0, valid_keys, ignore_dupes) < 0)
                         goto fail;
                     state = WHITESPACE;
                 } else if (*p == '\\') {
@@ -174,11 +169,7 @@ static int parse(pa_modargs *ma, const char *args, const char* const* valid_keys
 
             case VALUE_SIMPLE:
                 if (isspace((unsigned char)*p)) {
-                    if (add_key_value(ma,
-                                      pa_xstrndup(key, key_len),
-                                      pa_xstrndup(value, value_len),
-                                      valid_keys,
-                                      ignore_dupes) < 0)
+                    if (add_key_value(ma, key, key_len, value, value_len, valid_keys, ignore_dupes) < 0)
                         goto fail;
                     state = WHITESPACE;
                 } else if (*p == '\\') {
@@ -195,11 +186,7 @@ static int parse(pa_modargs *ma, const char *args, const char* const* valid_keys
 
             case VALUE_DOUBLE_QUOTES:
                 if (*p == '"') {
-                    if (add_key_value(ma,
-                                      pa_xstrndup(key, key_len),
-                                      pa_xstrndup(value, value_len),
-                                      valid_keys,
-                                      ignore_dupes) < 0)
+                    if (add_key_value(ma, key, key_len, value, value_len, valid_keys, ignore_dupes) < 0)
                         goto fail;
                     state = WHITESPACE;
                 } else if (*p == '\\') {
@@ -216,11 +203,7 @@ static int parse(pa_modargs *ma, const char *args, const char* const* valid_keys
 
             case VALUE_TICKS:
                 if (*p == '\'') {
-                    if (add_key_value(ma,
-                                      pa_xstrndup(key, key_len),
-                                      pa_xstrndup(value, value_len),
-                                      valid_keys,
-                                      ignore_dupes) < 0)
+                    if (add_key_value(ma, key, key_len, value, value_len, valid_keys, ignore_dupes) < 0)
                         goto fail;
                     state = WHITESPACE;
                 } else if (*p == '\\') {
@@ -238,10 +221,10 @@ static int parse(pa_modargs *ma, const char *args, const char* const* valid_keys
     }
 
     if (state == VALUE_START) {
-        if (add_key_value(ma, pa_xstrndup(key, key_len), pa_xstrdup(""), valid_keys, ignore_dupes) < 0)
+        if (add_key_value(ma, key, key_len, "", 0, valid_keys, ignore_dupes) < 0)
             goto fail;
     } else if (state == VALUE_SIMPLE) {
-        if (add_key_value(ma, pa_xstrndup(key, key_len), pa_xstrdup(value), valid_keys, ignore_dupes) < 0)
+        if (add_key_value(ma, key, key_len, value, value_len, valid_keys, ignore_dupes) < 0)
             goto fail;
     } else if (state != WHITESPACE)
         goto fail;
@@ -255,8 +238,7 @@ fail:
 pa_modargs *pa_modargs_new(const char *args, const char* const* valid_keys) {
     pa_modargs *ma = pa_xnew(pa_modargs, 1);
 
-    ma->raw = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL, free_func);
-    ma->unescaped = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL, free_func);
+    ma->entries = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL, pa_xfree);
 
     if (args && parse(ma, args, valid_keys, false) < 0)
         goto fail;
@@ -275,8 +257,7 @@ int pa_modargs_append(pa_modargs *ma, const char *args, const char* const* valid
 void pa_modargs_free(pa_modargs*ma) {
     pa_assert(ma);
 
-    pa_hashmap_free(ma->raw);
-    pa_hashmap_free(ma->unescaped);
+    pa_hashmap_free(ma->entries);
     pa_xfree(ma);
 }
 
@@ -286,7 +267,7 @@ const char *pa_modargs_get_value(pa_modargs *ma, const char *key, const char *de
     pa_assert(ma);
     pa_assert(key);
 
-    if (!(e = pa_hashmap_get(ma->unescaped, key)))
+    if (!(e = pa_hashmap_get(ma->entries, key)))
         return def;
 
     return e->value;
@@ -298,11 +279,10 @@ static const char *modargs_get_value_raw(pa_modargs *ma, const char *key, const
     pa_assert(ma);
     pa_assert(key);
 
-    if (!(e = pa_hashmap_get(ma->raw, key)))
-        if (!(e = pa_hashmap_get(ma->unescaped, key)))
-            return def;
+    if (!(e = pa_hashmap_get(ma->entries, key)))
+        return def;
 
-    return e->value;
+    return e->raw;
 }
 
 int pa_modargs_get_value_u32(pa_modargs *ma, const char *key, uint32_t *value) {
@@ -539,7 +519,7 @@ const char *pa_modargs_iterate(pa_modargs *ma, void **state) {
 
     pa_assert(ma);
 
-    if (!(e = pa_hashmap_iterate(ma->unescaped, state, NULL)))
+    if (!(e = pa_hashmap_iterate(ma->entries, state, NULL)))
         return NULL;
 
     return e->key;
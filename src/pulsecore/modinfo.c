@@ -38,42 +38,65 @@
 #define PA_SYMBOL_DEPRECATED "pa__get_deprecated"
 #define PA_SYMBOL_LOAD_ONCE "pa__load_once"
 
-pa_modinfo *pa_modinfo_get_by_handle(lt_dlhandle dl, const char *module_name) {
+static pa_modinfo *modinfo_get(pa_void_func_t (*load_sym)(const void *handle, const char *module, const char *symbol),
+                               const void *handle, const char *module_name) {
     pa_modinfo *i;
     const char* (*func)(void);
     bool (*func2) (void);
 
-    pa_assert(dl);
-
     i = pa_xnew0(pa_modinfo, 1);
 
-    if ((func = (const char* (*)(void)) pa_load_sym(dl, module_name, PA_SYMBOL_AUTHOR)))
+    if ((func = (const char* (*)(void)) load_sym(handle, module_name, PA_SYMBOL_AUTHOR)))
         i->author = pa_xstrdup(func());
 
-    if ((func = (const char* (*)(void)) pa_load_sym(dl, module_name, PA_SYMBOL_DESCRIPTION)))
+    if ((func = (const char* (*)(void)) load_sym(handle, module_name, PA_SYMBOL_DESCRIPTION)))
         i->description = pa_xstrdup(func());
 
-    if ((func = (const char* (*)(void)) pa_load_sym(dl, module_name, PA_SYMBOL_USAGE)))
+    if ((func = (const char* (*)(void)) load_sym(handle, module_name, PA_SYMBOL_USAGE)))
         i->usage = pa_xstrdup(func());
 
-    if ((func = (const char* (*)(void)) pa_load_sym(dl, module_name, PA_SYMBOL_VERSION)))
+    if ((func = (const char* (*)(void)) load_sym(handle, module_name, PA_SYMBOL_VERSION)))
         i->version = pa_xstrdup(func());
 
-    if ((func = (const char* (*)(void)) pa_load_sym(dl, module_name, PA_SYMBOL_DEPRECATED)))
+    if ((func = (const char* (*)(void)) load_sym(handle, module_name, PA_SYMBOL_DEPRECATED)))
         i->deprecated = pa_xstrdup(func());
 
-    if ((func2 = (bool (*)(void)) pa_load_sym(dl, module_name, PA_SYMBOL_LOAD_ONCE)))
+    if ((func2 = (bool (*)(void)) load_sym(handle, module_name, PA_SYMBOL_LOAD_ONCE)))
         i->load_once = func2();
 
     return i;
 }
 
+static pa_void_func_t load_dl_sym(const void *handle, const char *module, const char *symbol) {
+    return pa_load_sym((lt_dlhandle) handle, module, symbol);
+}
+
+static pa_void_func_t load_preloaded_sym(const void *handle, const char *module, const char *symbol) {
+    return pa_load_preloaded_sym(handle, module, symbol);
+}
+
+pa_modinfo *pa_modinfo_get_by_handle(lt_dlhandle dl, const char *module_name) {
+    pa_assert(dl);
+
+    return modinfo_get(load_dl_sym, dl, module_name);
+}
+
+pa_modinfo *pa_modinfo_get_by_preloaded(const lt_dlsymlist *entry, const char *module_name) {
+    pa_assert(entry);
+
+    return modinfo_get(load_preloaded_sym, entry, module_name);
+}
+
 pa_modinfo *pa_modinfo_get_by_name(const char *name) {
+    const lt_dlsymlist *entry;
     lt_dlhandle dl;
     pa_modinfo *i;
 
     pa_assert(name);
 
+    if ((entry = pa_find_preloaded(name)))
+        return pa_modinfo_get_by_preloaded(entry, name);
+
     if (!(dl = lt_dlopenext(name))) {
         pa_log("Failed to open module \"%s\": %s", name, lt_dlerror());
         return NULL;
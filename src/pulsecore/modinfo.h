@@ -35,6 +35,9 @@ typedef struct pa_modinfo {
 /* Read meta data from an libtool handle */
 pa_modinfo *pa_modinfo_get_by_handle(lt_dlhandle dl, const char *module_name);
 
+/* Read meta data from a module linked into the daemon, see pa_find_preloaded() */
+pa_modinfo *pa_modinfo_get_by_preloaded(const lt_dlsymlist *entry, const char *module_name);
+
 /* Read meta data from a module file */
 pa_modinfo *pa_modinfo_get_by_name(const char *name);
 
@@ -26,14 +26,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <ltdl.h>
 
 #include <pulse/xmalloc.h>
 #include <pulse/proplist.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/dynarray.h>
+#include <pulsecore/hashmap.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/ltdl-helper.h>
 #include <pulsecore/modinfo.h>
@@ -46,13 +52,149 @@
 #define PA_SYMBOL_GET_N_USED "pa__get_n_used"
 #define PA_SYMBOL_GET_DEPRECATE "pa__get_deprecated"
 
+static pa_void_func_t module_sym(pa_module *m, const char *symbol) {
+    if (m->preloaded)
+        return pa_load_preloaded_sym(m->preloaded, m->name, symbol);
+
+    return pa_load_sym(m->dl, m->name, symbol);
+}
+
+/* A startup script usually asks pa_module_exists() about a whole run of
+ * modules through .ifexists. Instead of probing every directory of the
+ * search path for every name, the directories are listed once and the names
+ * kept until one of them changes. Checking for changes needs a stat() per
+ * directory, which is done at most every MODULE_CACHE_CHECK_USEC. Like the
+ * ltdl search path itself, the cache is global to the process. */
+#define MODULE_CACHE_CHECK_USEC (1*PA_USEC_PER_SEC)
+
+struct module_dir {
+    char *path;
+    bool exists;
+    time_t mtime;
+};
+
+static struct {
+    char *search_path;
+    pa_dynarray *dirs;
+    pa_hashmap *names;
+    pa_usec_t checked;
+} module_cache;
+
+static void module_dir_free(struct module_dir *d) {
+    pa_xfree(d->path);
+    pa_xfree(d);
+}
+
+static void module_dir_stat(struct module_dir *d) {
+    struct stat st;
+
+    d->exists = stat(d->path, &st) == 0;
+    d->mtime = d->exists ? st.st_mtime : 0;
+}
+
+static void module_dir_scan(struct module_dir *d) {
+    DIR *dir;
+    struct dirent *de;
+
+    if (!d->exists || !(dir = opendir(d->path)))
+        return;
+
+    while ((de = readdir(dir))) {
+        size_t l = strlen(de->d_name);
+
+        if (l <= sizeof(PA_SOEXT)-1 || !pa_streq(de->d_name + l - (sizeof(PA_SOEXT)-1), PA_SOEXT))
+            continue;
+
+        if (!pa_hashmap_get(module_cache.names, de->d_name)) {
+            char *n = pa_xstrndup(de->d_name, l - (sizeof(PA_SOEXT)-1));
+            if (pa_hashmap_put(module_cache.names, n, n) < 0)
+                pa_xfree(n);
+        }
+    }
+
+    closedir(dir);
+}
+
+static void module_cache_add_dir(const char *path) {
+    struct module_dir *d;
+
+    d = pa_xnew0(struct module_dir, 1);
+    d->path = pa_xstrdup(path);
+    module_dir_stat(d);
+    module_dir_scan(d);
+
+    pa_dynarray_append(module_cache.dirs, d);
+}
+
+static bool module_cache_valid(const char *paths, pa_usec_t now) {
+    struct module_dir *d;
+    unsigned idx;
+
+    if (!module_cache.search_path || !pa_streq(module_cache.search_path, paths))
+        return false;
+
+    if (now < module_cache.checked + MODULE_CACHE_CHECK_USEC)
+        return true;
+
+    PA_DYNARRAY_FOREACH(d, module_cache.dirs, idx) {
+        bool exists = d->exists;
+        time_t mtime = d->mtime;
+
+        module_dir_stat(d);
+        if (d->exists != exists || d->mtime != mtime)
+            return false;
+    }
+
+    module_cache.checked = now;
+    return true;
+}
+
+static void module_cache_update(const char *paths) {
+    const char *state = NULL;
+    pa_usec_t now;
+    char *p;
+
+    now = pa_rtclock_now();
+
+    if (module_cache_valid(paths, now))
+        return;
+
+    pa_xfree(module_cache.search_path);
+    if (module_cache.dirs)
+        pa_dynarray_free(module_cache.dirs);
+    if (module_cache.names)
+        pa_hashmap_free(module_cache.names);
+
+    module_cache.search_path = pa_xstrdup(paths);
+    module_cache.dirs = pa_dynarray_new((pa_free_cb_t) module_dir_free);
+    module_cache.names = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, pa_xfree, NULL);
+    module_cache.checked = now;
+
+    while ((p = pa_split(paths, ":", &state))) {
+        module_cache_add_dir(p);
+
+        if (PA_UNLIKELY(pa_run_from_build_tree())) {
+            char *pathname = pa_sprintf_malloc("%s" PA_PATH_SEP ".libs", p);
+            module_cache_add_dir(pathname);
+            pa_xfree(pathname);
+        }
+
+        pa_xfree(p);
+    }
+
+    pa_log_debug("Found %u modules in '%s'.", pa_hashmap_size(module_cache.names), paths);
+}
+
 bool pa_module_exists(const char *name) {
-    const char *paths, *state = NULL;
-    char *n, *p, *pathname;
+    const char *paths;
+    char *n, *p;
     bool result;
 
     pa_assert(name);
 
+    if (pa_find_preloaded(name))
+        return true;
+
     if (name[0] == PA_PATH_SEP_CHAR) {
         result = access(name, F_OK) == 0 ? true : false;
         pa_log_debug("Checking for existence of '%s': %s", name, result ? "success" : "failure");
@@ -69,35 +211,13 @@ bool pa_module_exists(const char *name) {
     if (p && pa_streq(p, PA_SOEXT))
         p[0] = 0;
 
-    while ((p = pa_split(paths, ":", &state))) {
-        pathname = pa_sprintf_malloc("%s" PA_PATH_SEP "%s" PA_SOEXT, p, n);
-        result = access(pathname, F_OK) == 0 ? true : false;
-        pa_log_debug("Checking for existence of '%s': %s", pathname, result ? "success" : "failure");
-        pa_xfree(pathname);
-        pa_xfree(p);
-        if (result) {
-            pa_xfree(n);
-            return true;
-        }
-    }
+    module_cache_update(paths);
 
-    state = NULL;
-    if (PA_UNLIKELY(pa_run_from_build_tree())) {
-        while ((p = pa_split(paths, ":", &state))) {
-            pathname = pa_sprintf_malloc("%s" PA_PATH_SEP ".libs" PA_PATH_SEP "%s" PA_SOEXT, p, n);
-            result = access(pathname, F_OK) == 0 ? true : false;
-            pa_log_debug("Checking for existence of '%s': %s", pathname, result ? "success" : "failure");
-            pa_xfree(pathname);
-            pa_xfree(p);
-            if (result) {
-                pa_xfree(n);
-                return true;
-            }
-        }
-    }
+    result = !!pa_hashmap_get(module_cache.names, n);
+    pa_log_debug("Checking for existence of '%s': %s", n, result ? "success" : "failure");
 
     pa_xfree(n);
-    return false;
+    return result;
 }
 
 void pa_module_hook_connect(pa_module *m, pa_hook *hook, pa_hook_priority_t prio, pa_hook_cb_t cb, void *data) {
@@ -130,8 +250,12 @@ int pa_module_load(pa_module** module, pa_core *c, const char *name, const char
     m->proplist = pa_proplist_new();
     m->hooks = pa_dynarray_new((pa_free_cb_t) pa_hook_slot_free);
     m->index = PA_IDXSET_INVALID;
+    m->dl = NULL;
 
-    if (!(m->dl = lt_dlopenext(name))) {
+    /* Modules linked into the daemon don't need to be looked for */
+    if ((m->preloaded = pa_find_preloaded(name)))
+        pa_log_debug("Using preloaded module \"%s\".", name);
+    else if (!(m->dl = lt_dlopenext(name))) {
         /* We used to print the error that is returned by lt_dlerror(), but
          * lt_dlerror() is useless. It returns pretty much always "file not
          * found". That's because if there are any problems with loading the
@@ -143,7 +267,7 @@ int pa_module_load(pa_module** module, pa_core *c, const char *name, const char
         goto fail;
     }
 
-    if ((load_once = (bool (*)(void)) pa_load_sym(m->dl, name, PA_SYMBOL_LOAD_ONCE))) {
+    if ((load_once = (bool (*)(void)) module_sym(m, PA_SYMBOL_LOAD_ONCE))) {
 
         m->load_once = load_once();
 
@@ -162,24 +286,25 @@ int pa_module_load(pa_module** module, pa_core *c, const char *name, const char
         }
     }
 
-    if ((get_deprecated = (const char* (*) (void)) pa_load_sym(m->dl, name, PA_SYMBOL_GET_DEPRECATE))) {
+    if ((get_deprecated = (const char* (*) (void)) module_sym(m, PA_SYMBOL_GET_DEPRECATE))) {
         const char *t;
 
         if ((t = get_deprecated()))
             pa_log_warn("%s is deprecated: %s", name, t);
     }
 
-    if (!(m->init = (int (*)(pa_module*_m)) pa_load_sym(m->dl, name, PA_SYMBOL_INIT))) {
+    if (!(m->init = (int (*)(pa_module*_m)) module_sym(m, PA_SYMBOL_INIT))) {
         pa_log("Failed to load module \"%s\": symbol \""PA_SYMBOL_INIT"\" not found.", name);
         errcode = -PA_ERR_IO;
         goto fail;
     }
 
-    m->done = (void (*)(pa_module*_m)) pa_load_sym(m->dl, name, PA_SYMBOL_DONE);
-    m->get_n_used = (int (*)(pa_module*_m)) pa_load_sym(m->dl, name, PA_SYMBOL_GET_N_USED);
+    m->done = (void (*)(pa_module*_m)) module_sym(m, PA_SYMBOL_DONE);
+    m->get_n_used = (int (*)(pa_module*_m)) module_sym(m, PA_SYMBOL_GET_N_USED);
     m->userdata = NULL;
     m->core = c;
     m->unload_requested = false;
+    m->init_pending = false;
 
     pa_assert_se(pa_idxset_put(c->modules, m, &m->index) >= 0);
     pa_assert(m->index != PA_IDXSET_INVALID);
@@ -190,11 +315,14 @@ int pa_module_load(pa_module** module, pa_core *c, const char *name, const char
         goto fail;
     }
 
-    pa_log_info("Loaded \"%s\" (index: #%u; argument: \"%s\").", m->name, m->index, m->argument ? m->argument : "");
+    if (m->init_pending)
+        pa_log_info("Loaded \"%s\" (index: #%u; argument: \"%s\"), initialization continues in the background.", m->name, m->index, m->argument ? m->argument : "");
+    else
+        pa_log_info("Loaded \"%s\" (index: #%u; argument: \"%s\").", m->name, m->index, m->argument ? m->argument : "");
 
     pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_MODULE|PA_SUBSCRIPTION_EVENT_NEW, m->index);
 
-    if ((mi = pa_modinfo_get_by_handle(m->dl, name))) {
+    if ((mi = m->preloaded ? pa_modinfo_get_by_preloaded(m->preloaded, name) : pa_modinfo_get_by_handle(m->dl, name))) {
 
         if (mi->author && !pa_proplist_contains(m->proplist, PA_PROP_MODULE_AUTHOR))
             pa_proplist_sets(m->proplist, PA_PROP_MODULE_AUTHOR, mi->author);
@@ -240,6 +368,28 @@ fail:
     return errcode;
 }
 
+void pa_module_init_async(pa_module *m) {
+    pa_assert(m);
+    pa_assert(!m->init_pending);
+
+    m->init_pending = true;
+}
+
+void pa_module_init_finish(pa_module *m, int result) {
+    pa_assert(m);
+    pa_assert(m->init_pending);
+
+    m->init_pending = false;
+
+    if (result < 0) {
+        pa_log_error("Failed to load module \"%s\" (argument: \"%s\"): initialization failed.", m->name, m->argument ? m->argument : "");
+        pa_module_unload_request(m, true);
+        return;
+    }
+
+    pa_log_info("Initialized \"%s\" (index: #%u).", m->name, m->index);
+}
+
 static void postponed_dlclose(pa_mainloop_api *api, void *userdata) {
     lt_dlhandle dl = userdata;
 
@@ -272,7 +422,8 @@ static void pa_module_free(pa_module *m) {
      * Apparently lt_dlclose() doesn't always remove the module from memory,
      * but it can happen, as can be seen here:
      * https://bugs.freedesktop.org/show_bug.cgi?id=96831 */
-    pa_mainloop_api_once(m->core->mainloop, postponed_dlclose, m->dl);
+    if (m->dl)
+        pa_mainloop_api_once(m->core->mainloop, postponed_dlclose, m->dl);
 
     pa_hashmap_remove(m->core->modules_pending_unload, m);
 
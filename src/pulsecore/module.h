@@ -35,7 +35,10 @@ struct pa_module {
     char *name, *argument;
     uint32_t index;
 
+    /* Exactly one of these is set, dl for modules loaded from a file,
+     * preloaded for modules linked into the daemon */
     lt_dlhandle dl;
+    const lt_dlsymlist *preloaded;
 
     int (*init)(pa_module*m);
     void (*done)(pa_module*m);
@@ -45,6 +48,7 @@ struct pa_module {
 
     bool load_once:1;
     bool unload_requested:1;
+    bool init_pending:1;
 
     pa_proplist *proplist;
     pa_dynarray *hooks;
@@ -68,6 +72,15 @@ void pa_module_update_proplist(pa_module *m, pa_update_mode_t mode, pa_proplist
 
 void pa_module_hook_connect(pa_module *m, pa_hook *hook, pa_hook_priority_t prio, pa_hook_cb_t cb, void *data);
 
+/* For modules whose initialization waits for slow things like device
+ * probing, D-Bus round trips or the network. pa__init() sets up what can be
+ * done right away, calls pa_module_init_async() and returns 0. The remaining
+ * work is then driven from the main loop, while the following modules load,
+ * and the module reports the outcome with pa_module_init_finish(). A module
+ * whose async initialization fails is unloaded. */
+void pa_module_init_async(pa_module *m);
+void pa_module_init_finish(pa_module *m, int result);
+
 #define PA_MODULE_AUTHOR(s)                                     \
     const char *pa__get_author(void) { return s; }              \
     struct __stupid_useless_struct_to_allow_trailing_semicolon
@@ -24,6 +24,9 @@
 #include <pulse/cdecl.h>
 #include <pulse/def.h>
 
+#include <pulsecore/atomic.h>
+#include <pulsecore/meter.h>
+#include <pulsecore/fdsem.h>
 #include <pulsecore/pdispatch.h>
 #include <pulsecore/pstream.h>
 #include <pulsecore/tagstruct.h>
@@ -187,6 +190,15 @@ enum {
      * BOTH DIRECTIONS */
     PA_COMMAND_REGISTER_MEMFD_SHMID,
 
+    /* Supported since protocol v33 (12.0) */
+    PA_COMMAND_GET_XRUN_EVENT_INFO_LIST,
+    PA_COMMAND_GET_SINK_INPUT_INFO_LIST_FILTERED,
+    PA_COMMAND_ENABLE_TIMING_PAGE,
+    PA_COMMAND_SYNC_DATA_RING,
+    PA_COMMAND_ENABLE_METER,
+    PA_COMMAND_DISABLE_METER,
+    PA_COMMAND_GET_LATENCY_BATCH,
+
     PA_COMMAND_MAX
 };
 
@@ -201,6 +213,55 @@ enum {
 
 #define PA_NATIVE_DEFAULT_UNIX_SOCKET "native"
 
+/* The timing data of a playback stream, as kept up to date by the server
+ * in a block of shared memory after PA_COMMAND_ENABLE_TIMING_PAGE. seq is
+ * odd while the sink thread is updating the page, and changes with every
+ * update, so readers retry until they see the same even value before and
+ * after copying the fields. timestamp is pa_rtclock_now() of the update. */
+typedef struct pa_native_timing_page {
+    pa_atomic_t seq;
+    uint32_t playing;
+    int64_t write_index;
+    int64_t read_index;
+    uint64_t sink_usec;
+    uint64_t underrun_for;
+    uint64_t playing_for;
+    uint64_t timestamp;
+} pa_native_timing_page;
+
+/* The memblock offset the server sends the data ring of a playback
+ * stream with, to tell it apart from the timing page */
+#define PA_NATIVE_DATA_RING_OFFSET 1
+
+/* The header of the block of shared memory a client writes playback
+ * data into after PA_COMMAND_SYNC_DATA_RING, followed by the ring
+ * memory at PA_ALIGN(sizeof(pa_native_data_ring)). count is the number
+ * of bytes in the ring, which holds a sequence of records, each a
+ * pa_native_data_record followed by length bytes of audio. The client
+ * only adds to count once a record is complete. When it finds the ring
+ * empty before that it posts sem, which wakes up the sink thread. */
+typedef struct pa_native_data_ring {
+    pa_atomic_t count;
+    uint32_t capacity;
+    pa_fdsem_data sem;
+} pa_native_data_ring;
+
+typedef struct pa_native_data_record {
+    int64_t offset;
+    uint32_t seek;
+    uint32_t length;
+} pa_native_data_record;
+
+/* The level meters of a connection, in a block of shared memory the
+ * server sends on PA_NATIVE_METER_CHANNEL after the first
+ * PA_COMMAND_ENABLE_METER. Each enabled meter has a slot of its own. */
+#define PA_NATIVE_METER_CHANNEL ((uint32_t) -2)
+#define PA_NATIVE_METER_SLOTS 64
+
+typedef struct pa_native_meter_page {
+    pa_meter_levels slots[PA_NATIVE_METER_SLOTS];
+} pa_native_meter_page;
+
 int pa_common_command_register_memfd_shmid(pa_pstream *p, pa_pdispatch *pd, uint32_t version,
                                            uint32_t command, pa_tagstruct *t);
 
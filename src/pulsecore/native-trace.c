@@ -0,0 +1,342 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/arpa-inet.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/tagstruct.h>
+
+#include "native-trace.h"
+
+#define TRACE_MAGIC "pulseaudio-native-trace"
+#define TRACE_VERSION 1
+
+/* No record comes anywhere near this, anything bigger is garbage */
+#define RECORD_MAX (64*1024)
+
+struct pa_native_trace {
+    FILE *file;
+    pa_usec_t start;
+    bool failed;
+};
+
+static int write_block(pa_native_trace *t, pa_tagstruct *ts) {
+    const uint8_t *data;
+    size_t length;
+    uint32_t n;
+
+    data = pa_tagstruct_data(ts, &length);
+    n = htonl((uint32_t) length);
+
+    if (fwrite(&n, sizeof(n), 1, t->file) != 1 ||
+        fwrite(data, length, 1, t->file) != 1)
+        return -1;
+
+    return 0;
+}
+
+/* Returns 1 and a tagstruct to be freed, 0 at the end and -1 on errors */
+static int read_block(pa_native_trace *t, pa_tagstruct **ts, uint8_t **data) {
+    uint32_t n;
+
+    if (fread(&n, sizeof(n), 1, t->file) != 1)
+        return feof(t->file) ? 0 : -1;
+
+    n = ntohl(n);
+    if (n == 0 || n > RECORD_MAX)
+        return -1;
+
+    *data = pa_xmalloc(n);
+    if (fread(*data, n, 1, t->file) != 1) {
+        pa_xfree(*data);
+        return -1;
+    }
+
+    *ts = pa_tagstruct_new_fixed(*data, n);
+    return 1;
+}
+
+pa_native_trace *pa_native_trace_new(const char *path) {
+    pa_native_trace *t;
+    pa_tagstruct *ts;
+    int r;
+
+    pa_assert(path);
+
+    t = pa_xnew0(pa_native_trace, 1);
+
+    if (!(t->file = pa_fopen_cloexec(path, "w"))) {
+        pa_log("Failed to create trace file %s: %s", path, pa_cstrerror(errno));
+        pa_xfree(t);
+        return NULL;
+    }
+
+    t->start = pa_rtclock_now();
+
+    ts = pa_tagstruct_new();
+    pa_tagstruct_puts(ts, TRACE_MAGIC);
+    pa_tagstruct_putu32(ts, TRACE_VERSION);
+    r = write_block(t, ts);
+    pa_tagstruct_free(ts);
+
+    if (r < 0) {
+        pa_log("Failed to write trace file %s: %s", path, pa_cstrerror(errno));
+        pa_native_trace_free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+pa_native_trace *pa_native_trace_open(const char *path) {
+    pa_native_trace *t;
+    pa_tagstruct *ts;
+    uint8_t *data;
+    const char *magic;
+    uint32_t version;
+    int r;
+
+    pa_assert(path);
+
+    t = pa_xnew0(pa_native_trace, 1);
+
+    if (!(t->file = pa_fopen_cloexec(path, "r"))) {
+        pa_log("Failed to open trace file %s: %s", path, pa_cstrerror(errno));
+        pa_xfree(t);
+        return NULL;
+    }
+
+    if ((r = read_block(t, &ts, &data)) <= 0) {
+        pa_log("Trace file %s is empty or broken.", path);
+        pa_native_trace_free(t);
+        return NULL;
+    }
+
+    r = pa_tagstruct_gets(ts, &magic) < 0 || !magic || !pa_streq(magic, TRACE_MAGIC) ||
+        pa_tagstruct_getu32(ts, &version) < 0 ? -1 : 0;
+
+    pa_tagstruct_free(ts);
+    pa_xfree(data);
+
+    if (r < 0) {
+        pa_log("%s is not a trace file.", path);
+        pa_native_trace_free(t);
+        return NULL;
+    }
+
+    if (version != TRACE_VERSION) {
+        pa_log("Trace file %s has version %u, only version %u is supported.", path, version, TRACE_VERSION);
+        pa_native_trace_free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void pa_native_trace_free(pa_native_trace *t) {
+    pa_assert(t);
+
+    if (t->file)
+        fclose(t->file);
+
+    pa_xfree(t);
+}
+
+static void put_buffer_attr(pa_tagstruct *ts, const pa_buffer_attr *a) {
+    pa_tagstruct_putu32(ts, a->maxlength);
+    pa_tagstruct_putu32(ts, a->tlength);
+    pa_tagstruct_putu32(ts, a->prebuf);
+    pa_tagstruct_putu32(ts, a->minreq);
+    pa_tagstruct_putu32(ts, a->fragsize);
+}
+
+static int get_buffer_attr(pa_tagstruct *ts, pa_buffer_attr *a) {
+    if (pa_tagstruct_getu32(ts, &a->maxlength) < 0 ||
+        pa_tagstruct_getu32(ts, &a->tlength) < 0 ||
+        pa_tagstruct_getu32(ts, &a->prebuf) < 0 ||
+        pa_tagstruct_getu32(ts, &a->minreq) < 0 ||
+        pa_tagstruct_getu32(ts, &a->fragsize) < 0)
+        return -1;
+
+    return 0;
+}
+
+void pa_native_trace_write(pa_native_trace *t, pa_native_trace_record *r) {
+    pa_tagstruct *ts;
+
+    pa_assert(t);
+    pa_assert(r);
+    pa_assert(r->type < PA_NATIVE_TRACE_MAX);
+
+    /* Don't flood the log if the disk is full */
+    if (t->failed)
+        return;
+
+    r->time = pa_rtclock_now() - t->start;
+
+    ts = pa_tagstruct_new();
+    pa_tagstruct_putu32(ts, r->type);
+    pa_tagstruct_put_usec(ts, r->time);
+    pa_tagstruct_putu32(ts, r->client);
+
+    switch (r->type) {
+        case PA_NATIVE_TRACE_CLIENT_NEW:
+        case PA_NATIVE_TRACE_CLIENT_FREE:
+            break;
+
+        case PA_NATIVE_TRACE_COMMAND:
+            pa_tagstruct_putu32(ts, r->command);
+            pa_tagstruct_putu32(ts, r->length);
+            pa_tagstruct_putu32(ts, r->channel);
+            pa_tagstruct_put_boolean(ts, r->flag);
+            break;
+
+        case PA_NATIVE_TRACE_PLAYBACK_STREAM:
+        case PA_NATIVE_TRACE_RECORD_STREAM:
+            pa_tagstruct_putu32(ts, r->channel);
+            pa_tagstruct_put_sample_spec(ts, &r->sample_spec);
+            pa_tagstruct_put_channel_map(ts, &r->channel_map);
+            put_buffer_attr(ts, &r->buffer_attr);
+            pa_tagstruct_putu32(ts, r->flags);
+            break;
+
+        case PA_NATIVE_TRACE_DELETE_STREAM:
+            pa_tagstruct_putu32(ts, r->channel);
+            pa_tagstruct_put_boolean(ts, r->record);
+            break;
+
+        case PA_NATIVE_TRACE_WRITE:
+            pa_tagstruct_putu32(ts, r->channel);
+            pa_tagstruct_putu32(ts, r->length);
+            pa_tagstruct_puts64(ts, r->offset);
+            pa_tagstruct_putu32(ts, r->seek);
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+
+    if (write_block(t, ts) < 0) {
+        pa_log("Failed to write trace, stopping it: %s", pa_cstrerror(errno));
+        t->failed = true;
+    }
+
+    pa_tagstruct_free(ts);
+}
+
+int pa_native_trace_read(pa_native_trace *t, pa_native_trace_record *r) {
+    pa_tagstruct *ts;
+    uint8_t *data;
+    uint32_t type, seek;
+    int ret;
+
+    pa_assert(t);
+    pa_assert(r);
+
+    if ((ret = read_block(t, &ts, &data)) <= 0)
+        return ret;
+
+    memset(r, 0, sizeof(*r));
+    ret = -1;
+
+    if (pa_tagstruct_getu32(ts, &type) < 0 || type >= PA_NATIVE_TRACE_MAX ||
+        pa_tagstruct_get_usec(ts, &r->time) < 0 ||
+        pa_tagstruct_getu32(ts, &r->client) < 0)
+        goto finish;
+
+    r->type = type;
+
+    switch (r->type) {
+        case PA_NATIVE_TRACE_CLIENT_NEW:
+        case PA_NATIVE_TRACE_CLIENT_FREE:
+            break;
+
+        case PA_NATIVE_TRACE_COMMAND:
+            if (pa_tagstruct_getu32(ts, &r->command) < 0 ||
+                pa_tagstruct_getu32(ts, &r->length) < 0 ||
+                pa_tagstruct_getu32(ts, &r->channel) < 0 ||
+                pa_tagstruct_get_boolean(ts, &r->flag) < 0)
+                goto finish;
+            break;
+
+        case PA_NATIVE_TRACE_PLAYBACK_STREAM:
+        case PA_NATIVE_TRACE_RECORD_STREAM:
+            if (pa_tagstruct_getu32(ts, &r->channel) < 0 ||
+                pa_tagstruct_get_sample_spec(ts, &r->sample_spec) < 0 ||
+                pa_tagstruct_get_channel_map(ts, &r->channel_map) < 0 ||
+                get_buffer_attr(ts, &r->buffer_attr) < 0 ||
+                pa_tagstruct_getu32(ts, &r->flags) < 0)
+                goto finish;
+            break;
+
+        case PA_NATIVE_TRACE_DELETE_STREAM:
+            if (pa_tagstruct_getu32(ts, &r->channel) < 0 ||
+                pa_tagstruct_get_boolean(ts, &r->record) < 0)
+                goto finish;
+            break;
+
+        case PA_NATIVE_TRACE_WRITE:
+            if (pa_tagstruct_getu32(ts, &r->channel) < 0 ||
+                pa_tagstruct_getu32(ts, &r->length) < 0 ||
+                pa_tagstruct_gets64(ts, &r->offset) < 0 ||
+                pa_tagstruct_getu32(ts, &seek) < 0)
+                goto finish;
+            r->seek = seek;
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+
+    ret = 1;
+
+finish:
+    pa_tagstruct_free(ts);
+    pa_xfree(data);
+
+    return ret;
+}
+
+const char *pa_native_trace_type_to_string(pa_native_trace_type_t type) {
+    static const char* const table[PA_NATIVE_TRACE_MAX] = {
+        [PA_NATIVE_TRACE_CLIENT_NEW] = "client-new",
+        [PA_NATIVE_TRACE_CLIENT_FREE] = "client-free",
+        [PA_NATIVE_TRACE_COMMAND] = "command",
+        [PA_NATIVE_TRACE_PLAYBACK_STREAM] = "playback-stream",
+        [PA_NATIVE_TRACE_RECORD_STREAM] = "record-stream",
+        [PA_NATIVE_TRACE_DELETE_STREAM] = "delete-stream",
+        [PA_NATIVE_TRACE_WRITE] = "write"
+    };
+
+    if (type >= PA_NATIVE_TRACE_MAX)
+        return NULL;
+
+    return table[type];
+}
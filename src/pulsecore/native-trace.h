@@ -0,0 +1,98 @@
+#ifndef foonativetracehfoo
+#define foonativetracehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <pulse/channelmap.h>
+#include <pulse/def.h>
+#include <pulse/sample.h>
+
+/* A trace of what the clients of the native protocol did and when: the
+ * commands they sent, the streams they created and how much they wrote
+ * when. No audio and no command arguments beyond that are recorded.
+ * pareplay recreates the same load from a trace.
+ *
+ * The file starts with a header and is followed by the records, each
+ * one a tagstruct preceded by its length as 32 bit value in network
+ * byte order. */
+
+typedef enum pa_native_trace_type {
+    PA_NATIVE_TRACE_CLIENT_NEW,
+    PA_NATIVE_TRACE_CLIENT_FREE,
+    PA_NATIVE_TRACE_COMMAND,
+    PA_NATIVE_TRACE_PLAYBACK_STREAM,
+    PA_NATIVE_TRACE_RECORD_STREAM,
+    PA_NATIVE_TRACE_DELETE_STREAM,
+    PA_NATIVE_TRACE_WRITE,
+    PA_NATIVE_TRACE_MAX
+} pa_native_trace_type_t;
+
+typedef struct pa_native_trace_record {
+    pa_native_trace_type_t type;
+
+    /* Since the trace was opened, set by pa_native_trace_write() */
+    pa_usec_t time;
+
+    /* Index of the pa_client */
+    uint32_t client;
+
+    /* COMMAND: the command, and its first argument if that is a number
+     * (usually the channel of the stream it is for) and the second if
+     * that is a boolean, PA_INVALID_INDEX and false otherwise */
+    uint32_t command;
+    bool flag;
+
+    /* COMMAND: size of the packet, WRITE: bytes written */
+    uint32_t length;
+
+    /* COMMAND, PLAYBACK_STREAM, RECORD_STREAM, DELETE_STREAM, WRITE */
+    uint32_t channel;
+
+    /* PLAYBACK_STREAM and RECORD_STREAM, as the server set them up */
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_buffer_attr buffer_attr;
+    pa_stream_flags_t flags;
+
+    /* DELETE_STREAM */
+    bool record;
+
+    /* WRITE */
+    int64_t offset;
+    pa_seek_mode_t seek;
+} pa_native_trace_record;
+
+typedef struct pa_native_trace pa_native_trace;
+
+/* Create a trace file, or open one to read it */
+pa_native_trace *pa_native_trace_new(const char *path);
+pa_native_trace *pa_native_trace_open(const char *path);
+void pa_native_trace_free(pa_native_trace *t);
+
+void pa_native_trace_write(pa_native_trace *t, pa_native_trace_record *r);
+
+/* Returns 1 if a record was read, 0 at the end of the trace and -1 if the
+ * file is broken */
+int pa_native_trace_read(pa_native_trace *t, pa_native_trace_record *r);
+
+const char *pa_native_trace_type_to_string(pa_native_trace_type_t type);
+
+#endif
@@ -0,0 +1,651 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <opus.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/asyncq.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-format.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
+
+#include "opus-codec.h"
+
+/* What opus_encode() is recommended to be given */
+#define MAX_PACKET_SIZE 4000
+#define LENGTH_SIZE 2
+
+#define WORKER_QUEUE_SIZE 128
+
+struct pa_opus_codec {
+    pa_sample_spec ss;
+    size_t frame_size;
+    pa_mempool *pool;
+
+    OpusEncoder *encoder;
+    OpusDecoder *decoder;
+
+    /* Samples per channel in one Opus frame, encoders only */
+    unsigned frame_samples;
+
+    /* PCM not making a full Opus frame yet, or compressed data not making
+     * a full packet yet */
+    uint8_t *buffer;
+    size_t buffer_length, buffer_size;
+};
+
+enum {
+    ITEM_DATA,
+    ITEM_SET_FRAME_USEC,
+    ITEM_QUIT
+};
+
+struct item {
+    int type;
+    unsigned generation;
+    pa_memchunk chunk;
+    /* The PCM a result stands for */
+    size_t pcm_length;
+    pa_usec_t frame_usec;
+};
+
+struct pa_opus_worker {
+    pa_opus_codec *codec;
+    pa_thread *thread;
+
+    /* Owner to worker and back */
+    pa_asyncq *inq, *outq;
+    /* Bumped on every flush, stale items are dropped on both ends */
+    pa_atomic_t generation;
+
+    void (*wakeup)(void *userdata);
+    void *userdata;
+};
+
+static const uint32_t supported_rates[] = { 8000, 12000, 16000, 24000, 48000 };
+
+/* Frame durations Opus supports, in units of 2.5 ms */
+static const unsigned frame_quarters[] = { 1, 2, 4, 8, 16, 24 };
+
+bool pa_opus_sample_spec_supported(const pa_sample_spec *ss) {
+    unsigned i;
+
+    pa_assert(ss);
+
+    if (ss->format != PA_SAMPLE_S16NE || ss->channels < 1 || ss->channels > 2)
+        return false;
+
+    for (i = 0; i < PA_ELEMENTSOF(supported_rates); i++)
+        if (ss->rate == supported_rates[i])
+            return true;
+
+    return false;
+}
+
+void pa_opus_sample_spec_fix(pa_sample_spec *ss) {
+    unsigned i;
+
+    pa_assert(ss);
+
+    ss->format = PA_SAMPLE_S16NE;
+    ss->channels = PA_MIN(ss->channels, 2);
+
+    for (i = 0; i < PA_ELEMENTSOF(supported_rates); i++)
+        if (ss->rate <= supported_rates[i])
+            break;
+
+    ss->rate = supported_rates[PA_MIN(i, PA_ELEMENTSOF(supported_rates) - 1)];
+}
+
+pa_usec_t pa_opus_frame_usec_for_latency(pa_usec_t latency) {
+    unsigned i;
+
+    /* Leave room for the frame being filled, the one on the wire and the
+     * remote buffering */
+    for (i = PA_ELEMENTSOF(frame_quarters); i > 1; i--)
+        if (frame_quarters[i - 1] * 2500 * 4 <= latency)
+            break;
+
+    return frame_quarters[i - 1] * 2500;
+}
+
+pa_format_info *pa_opus_format_new(const pa_sample_spec *ss, const pa_channel_map *map) {
+    pa_format_info *f;
+
+    pa_assert(ss);
+    pa_assert(pa_opus_sample_spec_supported(ss));
+
+    f = pa_format_info_new();
+    f->encoding = PA_ENCODING_OPUS;
+    pa_format_info_set_rate(f, (int) ss->rate);
+    pa_format_info_set_channels(f, ss->channels);
+
+    if (map)
+        pa_format_info_set_channel_map(f, map);
+
+    return f;
+}
+
+int pa_opus_format_to_sample_spec(const pa_format_info *f, pa_sample_spec *ss, pa_channel_map *map) {
+    pa_assert(f);
+    pa_assert(ss);
+
+    if (f->encoding != PA_ENCODING_OPUS)
+        return -PA_ERR_INVALID;
+
+    if (pa_format_info_to_sample_spec_fake(f, ss, map) < 0)
+        return -PA_ERR_INVALID;
+
+    if (!pa_opus_sample_spec_supported(ss))
+        return -PA_ERR_NOTSUPPORTED;
+
+    if (map && map->channels != ss->channels)
+        return -PA_ERR_INVALID;
+
+    return 0;
+}
+
+static unsigned usec_to_frame_samples(pa_usec_t usec, uint32_t rate) {
+    unsigned i;
+
+    /* Round down to a duration Opus supports */
+    for (i = PA_ELEMENTSOF(frame_quarters); i > 1; i--)
+        if (frame_quarters[i - 1] * 2500 <= usec)
+            break;
+
+    return frame_quarters[i - 1] * rate / 400;
+}
+
+static pa_opus_codec *codec_new(const pa_sample_spec *ss, pa_mempool *pool) {
+    pa_opus_codec *c;
+
+    c = pa_xnew0(pa_opus_codec, 1);
+    c->ss = *ss;
+    c->frame_size = pa_frame_size(ss);
+    c->pool = pool;
+
+    return c;
+}
+
+pa_opus_codec *pa_opus_encoder_new(const pa_sample_spec *ss, pa_usec_t frame_usec, uint32_t bitrate, pa_mempool *pool) {
+    pa_opus_codec *c;
+    int error;
+
+    pa_assert(ss);
+    pa_assert(pool);
+    pa_assert(pa_opus_sample_spec_supported(ss));
+
+    c = codec_new(ss, pool);
+
+    if (!(c->encoder = opus_encoder_create((opus_int32) ss->rate, ss->channels, OPUS_APPLICATION_AUDIO, &error))) {
+        pa_log("Failed to create Opus encoder: %s", opus_strerror(error));
+        pa_xfree(c);
+        return NULL;
+    }
+
+    if (bitrate > 0)
+        opus_encoder_ctl(c->encoder, OPUS_SET_BITRATE((opus_int32) bitrate));
+
+    c->frame_samples = usec_to_frame_samples(frame_usec, ss->rate);
+
+    c->buffer_size = c->frame_samples * c->frame_size;
+    c->buffer = pa_xmalloc(c->buffer_size);
+
+    pa_log_debug("Opus encoder running with %0.1f ms frames", (double) c->frame_samples * PA_MSEC_PER_SEC / ss->rate);
+
+    return c;
+}
+
+pa_opus_codec *pa_opus_decoder_new(const pa_sample_spec *ss, pa_mempool *pool) {
+    pa_opus_codec *c;
+    int error;
+
+    pa_assert(ss);
+    pa_assert(pool);
+    pa_assert(pa_opus_sample_spec_supported(ss));
+
+    c = codec_new(ss, pool);
+
+    if (!(c->decoder = opus_decoder_create((opus_int32) ss->rate, ss->channels, &error))) {
+        pa_log("Failed to create Opus decoder: %s", opus_strerror(error));
+        pa_xfree(c);
+        return NULL;
+    }
+
+    c->buffer_size = LENGTH_SIZE + MAX_PACKET_SIZE + c->frame_size;
+    c->buffer = pa_xmalloc(c->buffer_size);
+
+    return c;
+}
+
+void pa_opus_codec_free(pa_opus_codec *c) {
+    pa_assert(c);
+
+    if (c->encoder)
+        opus_encoder_destroy(c->encoder);
+
+    if (c->decoder)
+        opus_decoder_destroy(c->decoder);
+
+    pa_xfree(c->buffer);
+    pa_xfree(c);
+}
+
+void pa_opus_codec_reset(pa_opus_codec *c) {
+    pa_assert(c);
+
+    c->buffer_length = 0;
+
+    if (c->encoder)
+        opus_encoder_ctl(c->encoder, OPUS_RESET_STATE);
+
+    if (c->decoder)
+        opus_decoder_ctl(c->decoder, OPUS_RESET_STATE);
+}
+
+void pa_opus_codec_set_frame_usec(pa_opus_codec *c, pa_usec_t frame_usec) {
+    unsigned frame_samples;
+
+    pa_assert(c);
+    pa_assert(c->encoder);
+
+    frame_samples = usec_to_frame_samples(frame_usec, c->ss.rate);
+    if (frame_samples == c->frame_samples)
+        return;
+
+    pa_log_debug("Opus encoder switching to %0.1f ms frames", (double) frame_samples * PA_MSEC_PER_SEC / c->ss.rate);
+
+    c->frame_samples = frame_samples;
+}
+
+unsigned pa_opus_codec_get_lookahead(pa_opus_codec *c) {
+    opus_int32 lookahead = 0;
+
+    pa_assert(c);
+    pa_assert(c->encoder);
+
+    opus_encoder_ctl(c->encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+
+    return (unsigned) ((uint64_t) lookahead * 48000 / c->ss.rate);
+}
+
+static size_t padded_packet_size(pa_opus_codec *c, size_t length) {
+    return PA_ROUND_UP(LENGTH_SIZE + length, c->frame_size);
+}
+
+static int encode(pa_opus_codec *c, const pa_memchunk *in, pa_memchunk *out) {
+    const uint8_t *src;
+    uint8_t *dst, *d;
+    size_t frame_length, done = 0;
+
+    if (c->buffer_length + in->length > c->buffer_size) {
+        c->buffer_size = c->buffer_length + in->length;
+        c->buffer = pa_xrealloc(c->buffer, c->buffer_size);
+    }
+
+    src = pa_memblock_acquire_chunk(in);
+    memcpy(c->buffer + c->buffer_length, src, in->length);
+    pa_memblock_release(in->memblock);
+    c->buffer_length += in->length;
+
+    frame_length = c->frame_samples * c->frame_size;
+    if (c->buffer_length < frame_length)
+        return 0;
+
+    out->memblock = pa_memblock_new(c->pool, (c->buffer_length / frame_length) * padded_packet_size(c, MAX_PACKET_SIZE));
+    out->index = 0;
+
+    d = dst = pa_memblock_acquire(out->memblock);
+
+    for (; c->buffer_length - done >= frame_length; done += frame_length) {
+        opus_int32 r;
+        size_t padded;
+
+        if ((r = opus_encode(c->encoder, (const opus_int16 *) (c->buffer + done), (int) c->frame_samples, d + LENGTH_SIZE, MAX_PACKET_SIZE)) < 0) {
+            pa_log("Opus encoding failed: %s", opus_strerror(r));
+            pa_memblock_release(out->memblock);
+            pa_memblock_unref(out->memblock);
+            pa_memchunk_reset(out);
+            pa_opus_codec_reset(c);
+            return -1;
+        }
+
+        d[0] = (uint8_t) (r >> 8);
+        d[1] = (uint8_t) r;
+
+        padded = padded_packet_size(c, (size_t) r);
+        memset(d + LENGTH_SIZE + r, 0, padded - LENGTH_SIZE - (size_t) r);
+        d += padded;
+    }
+
+    pa_memblock_release(out->memblock);
+    out->length = (size_t) (d - dst);
+
+    /* Keep the partial frame for the next call */
+    c->buffer_length -= done;
+    memmove(c->buffer, c->buffer + done, c->buffer_length);
+
+    return 0;
+}
+
+/* Calls func for every complete packet at the start of data, returns the
+ * bytes consumed or -1 if the stream is garbled */
+static ssize_t for_each_packet(pa_opus_codec *c, const uint8_t *data, size_t length,
+                               int (*func)(pa_opus_codec *c, const uint8_t *packet, size_t length, void *userdata),
+                               void *userdata) {
+    size_t done = 0;
+
+    while (length - done >= LENGTH_SIZE) {
+        size_t l, padded;
+
+        l = ((size_t) data[done] << 8) | data[done + 1];
+        padded = padded_packet_size(c, l);
+
+        if (l > MAX_PACKET_SIZE)
+            return -1;
+
+        if (length - done < padded)
+            break;
+
+        /* An empty packet is only there for padding */
+        if (l > 0 && func(c, data + done + LENGTH_SIZE, l, userdata) < 0)
+            return -1;
+
+        done += padded;
+    }
+
+    return (ssize_t) done;
+}
+
+static int count_samples(pa_opus_codec *c, const uint8_t *packet, size_t length, void *userdata) {
+    size_t *samples = userdata;
+    int r;
+
+    if ((r = opus_packet_get_nb_samples(packet, (opus_int32) length, (opus_int32) c->ss.rate)) < 0)
+        return -1;
+
+    *samples += (size_t) r;
+    return 0;
+}
+
+static int decode_packet(pa_opus_codec *c, const uint8_t *packet, size_t length, void *userdata) {
+    opus_int16 **dst = userdata;
+    int r;
+
+    /* count_samples() made sure there's room */
+    if ((r = opus_decode(c->decoder, packet, (opus_int32) length, *dst, 120 * (int) c->ss.rate / 1000, 0)) < 0) {
+        pa_log("Opus decoding failed: %s", opus_strerror(r));
+        return -1;
+    }
+
+    *dst += (size_t) r * c->ss.channels;
+    return 0;
+}
+
+static int decode(pa_opus_codec *c, const pa_memchunk *in, pa_memchunk *out) {
+    const uint8_t *src;
+    uint8_t *data;
+    opus_int16 *dst, *start;
+    size_t length, samples = 0;
+    ssize_t consumed;
+
+    /* Continue where the last call left off, the packets being small
+     * this extra copy is cheap */
+    length = c->buffer_length + in->length;
+    data = pa_xmalloc(length);
+    memcpy(data, c->buffer, c->buffer_length);
+
+    src = pa_memblock_acquire_chunk(in);
+    memcpy(data + c->buffer_length, src, in->length);
+    pa_memblock_release(in->memblock);
+
+    /* First count what the complete packets decode to, then decode them */
+    if ((consumed = for_each_packet(c, data, length, count_samples, &samples)) < 0)
+        goto fail;
+
+    if (samples > 0) {
+        ssize_t r;
+
+        out->memblock = pa_memblock_new(c->pool, samples * c->frame_size);
+        out->index = 0;
+
+        start = dst = pa_memblock_acquire(out->memblock);
+        r = for_each_packet(c, data, length, decode_packet, &dst);
+        pa_memblock_release(out->memblock);
+
+        if (r < 0) {
+            pa_memblock_unref(out->memblock);
+            pa_memchunk_reset(out);
+            goto fail;
+        }
+
+        out->length = (size_t) (dst - start) * sizeof(opus_int16);
+    }
+
+    /* Keep the partial packet at the end for the next call */
+    c->buffer_length = length - (size_t) consumed;
+    pa_assert(c->buffer_length <= c->buffer_size);
+    memcpy(c->buffer, data + consumed, c->buffer_length);
+
+    pa_xfree(data);
+    return 0;
+
+fail:
+    pa_log("Received a garbled Opus stream.");
+    pa_xfree(data);
+    pa_opus_codec_reset(c);
+    return -1;
+}
+
+int pa_opus_codec_process(pa_opus_codec *c, const pa_memchunk *in, pa_memchunk *out) {
+    pa_assert(c);
+    pa_assert(in);
+    pa_assert(in->memblock);
+    pa_assert(out);
+
+    pa_memchunk_reset(out);
+
+    if (c->encoder) {
+        pa_assert(in->length % c->frame_size == 0);
+        return encode(c, in, out);
+    }
+
+    return decode(c, in, out);
+}
+
+static struct item *item_new(int type, unsigned generation) {
+    struct item *i;
+
+    i = pa_xnew0(struct item, 1);
+    i->type = type;
+    i->generation = generation;
+
+    return i;
+}
+
+static void item_free(struct item *i) {
+    if (i->chunk.memblock)
+        pa_memblock_unref(i->chunk.memblock);
+
+    pa_xfree(i);
+}
+
+static void worker_thread_func(void *userdata) {
+    pa_opus_worker *w = userdata;
+    unsigned generation;
+
+    generation = (unsigned) pa_atomic_load(&w->generation);
+
+    for (;;) {
+        struct item *i;
+        pa_memchunk out;
+        unsigned current;
+
+        pa_assert_se(i = pa_asyncq_pop(w->inq, true));
+
+        if (i->type == ITEM_QUIT) {
+            item_free(i);
+            break;
+        }
+
+        if (i->type == ITEM_SET_FRAME_USEC) {
+            pa_opus_codec_set_frame_usec(w->codec, i->frame_usec);
+            item_free(i);
+            continue;
+        }
+
+        /* Data pushed before a flush is of no interest anymore */
+        current = (unsigned) pa_atomic_load(&w->generation);
+        if (i->generation != current) {
+            item_free(i);
+            continue;
+        }
+
+        if (i->generation != generation) {
+            pa_opus_codec_reset(w->codec);
+            generation = i->generation;
+        }
+
+        /* Everything pushed and not kept back is in the result */
+        i->pcm_length = w->codec->buffer_length + i->chunk.length;
+
+        if (pa_opus_codec_process(w->codec, &i->chunk, &out) >= 0 && out.memblock) {
+            pa_memblock_unref(i->chunk.memblock);
+            i->chunk = out;
+
+            if (w->codec->encoder)
+                i->pcm_length -= w->codec->buffer_length;
+            else
+                i->pcm_length = out.length;
+
+            pa_asyncq_push(w->outq, i, true);
+            w->wakeup(w->userdata);
+        } else
+            item_free(i);
+    }
+}
+
+pa_opus_worker *pa_opus_worker_new(pa_opus_codec *c, void (*wakeup)(void *userdata), void *userdata) {
+    pa_opus_worker *w;
+
+    pa_assert(c);
+    pa_assert(wakeup);
+
+    w = pa_xnew0(pa_opus_worker, 1);
+    w->codec = c;
+    w->wakeup = wakeup;
+    w->userdata = userdata;
+    pa_atomic_store(&w->generation, 0);
+
+    w->inq = pa_asyncq_new(WORKER_QUEUE_SIZE);
+    w->outq = pa_asyncq_new(WORKER_QUEUE_SIZE);
+
+    if (!(w->thread = pa_thread_new(c->encoder ? "opus-encoder" : "opus-decoder", worker_thread_func, w))) {
+        pa_log("Failed to create Opus worker thread.");
+        w->codec = NULL;
+        pa_opus_worker_free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+void pa_opus_worker_free(pa_opus_worker *w) {
+    struct item *i;
+
+    pa_assert(w);
+
+    if (w->thread) {
+        pa_asyncq_push(w->inq, item_new(ITEM_QUIT, 0), true);
+        pa_thread_free(w->thread);
+    }
+
+    while ((i = pa_asyncq_pop(w->inq, false)))
+        item_free(i);
+    pa_asyncq_free(w->inq, NULL);
+
+    while ((i = pa_asyncq_pop(w->outq, false)))
+        item_free(i);
+    pa_asyncq_free(w->outq, NULL);
+
+    if (w->codec)
+        pa_opus_codec_free(w->codec);
+
+    pa_xfree(w);
+}
+
+void pa_opus_worker_push(pa_opus_worker *w, const pa_memchunk *chunk) {
+    struct item *i;
+
+    pa_assert(w);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+
+    i = item_new(ITEM_DATA, (unsigned) pa_atomic_load(&w->generation));
+    i->chunk = *chunk;
+    pa_memblock_ref(i->chunk.memblock);
+
+    pa_asyncq_push(w->inq, i, true);
+}
+
+bool pa_opus_worker_pop(pa_opus_worker *w, pa_memchunk *chunk, size_t *pcm_length) {
+    struct item *i;
+
+    pa_assert(w);
+    pa_assert(chunk);
+
+    while ((i = pa_asyncq_pop(w->outq, false))) {
+        if (i->generation == (unsigned) pa_atomic_load(&w->generation)) {
+            *chunk = i->chunk;
+            if (pcm_length)
+                *pcm_length = i->pcm_length;
+            pa_xfree(i);
+            return true;
+        }
+
+        item_free(i);
+    }
+
+    return false;
+}
+
+void pa_opus_worker_flush(pa_opus_worker *w) {
+    pa_assert(w);
+
+    pa_atomic_inc(&w->generation);
+}
+
+void pa_opus_worker_set_frame_usec(pa_opus_worker *w, pa_usec_t frame_usec) {
+    struct item *i;
+
+    pa_assert(w);
+
+    i = item_new(ITEM_SET_FRAME_USEC, (unsigned) pa_atomic_load(&w->generation));
+    i->frame_usec = frame_usec;
+
+    pa_asyncq_push(w->inq, i, true);
+}
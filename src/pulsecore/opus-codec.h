@@ -0,0 +1,91 @@
+#ifndef foopulsecoreopuscodechfoo
+#define foopulsecoreopuscodechfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulse/channelmap.h>
+#include <pulse/format.h>
+#include <pulse/sample.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/memchunk.h>
+
+/* Encoding and decoding of PA_ENCODING_OPUS streams, as used between the
+ * tunnel modules and the native protocol. Such a stream is a sequence of
+ * Opus packets, each preceded by its length as a 16-bit big endian integer
+ * and padded with zeros to a whole number of frames of the stream sample
+ * spec, which is S16NE with the channels and rate of the audio itself.
+ * That way the stream can take the place of the PCM one in all the usual
+ * byte accounting, only it is much shorter. */
+
+typedef struct pa_opus_codec pa_opus_codec;
+typedef struct pa_opus_worker pa_opus_worker;
+
+/* Returns true if audio in this sample spec can be encoded as is */
+bool pa_opus_sample_spec_supported(const pa_sample_spec *ss);
+
+/* Adjusts ss to the nearest sample spec Opus can encode */
+void pa_opus_sample_spec_fix(pa_sample_spec *ss);
+
+/* Returns the longest Opus frame that fits into the given latency a few
+ * times over */
+pa_usec_t pa_opus_frame_usec_for_latency(pa_usec_t latency);
+
+/* Returns a new PA_ENCODING_OPUS format info for audio in ss and map */
+pa_format_info *pa_opus_format_new(const pa_sample_spec *ss, const pa_channel_map *map);
+
+/* Finds the audio sample spec and channel map carried by an Opus format
+ * info. Fails if the format can't be decoded. */
+int pa_opus_format_to_sample_spec(const pa_format_info *f, pa_sample_spec *ss, pa_channel_map *map);
+
+/* bitrate is in bits per second, 0 lets the encoder choose */
+pa_opus_codec *pa_opus_encoder_new(const pa_sample_spec *ss, pa_usec_t frame_usec, uint32_t bitrate, pa_mempool *pool);
+pa_opus_codec *pa_opus_decoder_new(const pa_sample_spec *ss, pa_mempool *pool);
+void pa_opus_codec_free(pa_opus_codec *c);
+
+/* Drops any partial frame or packet kept from earlier calls */
+void pa_opus_codec_reset(pa_opus_codec *c);
+
+/* Takes effect with the next frame started. Encoders only. */
+void pa_opus_codec_set_frame_usec(pa_opus_codec *c, pa_usec_t frame_usec);
+
+/* Returns the encoder delay in samples at 48 kHz, as Ogg Opus expects it for
+ * the pre-skip. Encoders only. */
+unsigned pa_opus_codec_get_lookahead(pa_opus_codec *c);
+
+/* Encodes PCM or decodes a compressed stream. Whatever does not make a
+ * complete frame or packet yet is kept for the next call. On success,
+ * out->memblock is NULL if there was nothing to return. */
+int pa_opus_codec_process(pa_opus_codec *c, const pa_memchunk *in, pa_memchunk *out);
+
+/* Runs a codec in a thread of its own. Chunks pushed are processed in
+ * order, and wakeup is called from the worker thread whenever a result
+ * becomes available. The push, pop and flush functions are all to be
+ * called from one and the same thread. Takes ownership of the codec. */
+pa_opus_worker *pa_opus_worker_new(pa_opus_codec *c, void (*wakeup)(void *userdata), void *userdata);
+void pa_opus_worker_free(pa_opus_worker *w);
+
+void pa_opus_worker_push(pa_opus_worker *w, const pa_memchunk *chunk);
+/* Returns false if no result is available. pcm_length is set to the
+ * length of the PCM the result was encoded from or decoded to. */
+bool pa_opus_worker_pop(pa_opus_worker *w, pa_memchunk *chunk, size_t *pcm_length);
+/* Discards everything pushed so far, and any result not popped yet */
+void pa_opus_worker_flush(pa_opus_worker *w);
+void pa_opus_worker_set_frame_usec(pa_opus_worker *w, pa_usec_t frame_usec);
+
+#endif
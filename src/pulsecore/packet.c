@@ -30,7 +30,10 @@
 
 #include "packet.h"
 
-#define MAX_APPENDED_SIZE 128
+/* Enough for the control packets that make up most of the traffic,
+ * like requests, timing replies and subscription events */
+#define MAX_APPENDED_SIZE 256
+#define PACKETS_FLIST_SIZE 1024
 
 struct pa_packet {
     PA_REFCNT_DECLARE;
@@ -42,7 +45,7 @@ struct pa_packet {
     } per_type;
 };
 
-PA_STATIC_FLIST_DECLARE(packets, 0, pa_xfree);
+PA_STATIC_FLIST_DECLARE(packets, PACKETS_FLIST_SIZE, pa_xfree);
 
 pa_packet* pa_packet_new(size_t length) {
     pa_packet *p;
@@ -0,0 +1,231 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/msgobject.h>
+
+#include "period-trace.h"
+
+/* Don't write more than one glitch in this time */
+#define GLITCH_INTERVAL_USEC PA_USEC_PER_SEC
+
+struct pa_period_trace {
+    pa_msgobject parent;
+
+    char *device;
+    char *path;
+    pa_asyncmsgq *inq, *outq;
+
+    struct {
+        pa_period_record records[PA_PERIOD_TRACE_RECORDS];
+        uint64_t n_records;
+
+        /* Set until the ring is handed on */
+        const char *glitch;
+        pa_usec_t glitch_time;
+        pa_usec_t last_glitch;
+    } thread_info;
+};
+
+PA_DEFINE_PRIVATE_CLASS(pa_period_trace, pa_msgobject);
+#define PERIOD_TRACE(o) (pa_period_trace_cast(o))
+
+enum {
+    PERIOD_TRACE_MESSAGE_GLITCH
+};
+
+struct glitch {
+    const char *reason;
+    pa_usec_t time;
+    unsigned n_records;
+    pa_period_record records[];
+};
+
+/* Called from main context */
+static void write_glitch(pa_period_trace *t, const struct glitch *g) {
+    FILE *f;
+    struct timeval tv;
+    unsigned i;
+
+    pa_assert(t);
+    pa_assert(g);
+
+    if (!(f = pa_fopen_cloexec(t->path, "a"))) {
+        pa_log_warn("Failed to open %s: %s", t->path, pa_cstrerror(errno));
+        return;
+    }
+
+    pa_gettimeofday(&tv);
+
+    fprintf(f, "# %s: %s at %lu.%06lu, last %u periods, times in usec relative to the glitch\n"
+            "#     wakeup     late   render  written    avail  rewound  inq outq\n",
+            t->device, g->reason, (unsigned long) tv.tv_sec, (unsigned long) tv.tv_usec, g->n_records);
+
+    for (i = 0; i < g->n_records; i++) {
+        const pa_period_record *r = &g->records[i];
+        char late[16];
+
+        if (r->target > 0)
+            pa_snprintf(late, sizeof(late), "%lli", (long long) ((int64_t) r->wakeup - (int64_t) r->target));
+        else
+            pa_snprintf(late, sizeof(late), "-");
+
+        fprintf(f, "%12lli %8s %8llu %8u %8u %8u %4u %4u\n",
+                (long long) ((int64_t) r->wakeup - (int64_t) g->time), late, (unsigned long long) r->render_usec,
+                r->written, r->avail, r->rewound, r->inq_length, r->outq_length);
+    }
+
+    fprintf(f, "\n");
+
+    if (fclose(f) != 0)
+        pa_log_warn("Failed to write %s: %s", t->path, pa_cstrerror(errno));
+    else
+        pa_log_info("%s on %s, wrote the last %u periods to %s.", g->reason, t->device, g->n_records, t->path);
+}
+
+/* Called from main context */
+static int period_trace_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    pa_period_trace *t = PERIOD_TRACE(o);
+
+    switch (code) {
+        case PERIOD_TRACE_MESSAGE_GLITCH:
+            write_glitch(t, data);
+            return 0;
+    }
+
+    return 0;
+}
+
+/* Called from main context */
+static void period_trace_free(pa_object *o) {
+    pa_period_trace *t = PERIOD_TRACE(o);
+
+    pa_xfree(t->device);
+    pa_xfree(t->path);
+
+    if (t->inq)
+        pa_asyncmsgq_unref(t->inq);
+
+    if (t->outq)
+        pa_asyncmsgq_unref(t->outq);
+
+    pa_xfree(t);
+}
+
+pa_period_trace *pa_period_trace_new(const char *device, const char *path, pa_asyncmsgq *inq, pa_asyncmsgq *outq) {
+    pa_period_trace *t;
+
+    pa_assert(device);
+    pa_assert(path);
+    pa_assert(inq);
+    pa_assert(outq);
+
+    t = pa_msgobject_new(pa_period_trace);
+    t->parent.parent.free = period_trace_free;
+    t->parent.process_msg = period_trace_process_msg;
+
+    t->device = pa_xstrdup(device);
+    t->path = pa_xstrdup(path);
+    t->inq = pa_asyncmsgq_ref(inq);
+    t->outq = pa_asyncmsgq_ref(outq);
+
+    memset(&t->thread_info, 0, sizeof(t->thread_info));
+
+    return t;
+}
+
+void pa_period_trace_free(pa_period_trace *t) {
+    pa_assert(t);
+
+    /* Glitches still in the queue keep the object alive */
+    pa_period_trace_unref(t);
+}
+
+/* Called from IO context */
+static void hand_on(pa_period_trace *t) {
+    struct glitch *g;
+    unsigned n, first, i;
+
+    n = (unsigned) PA_MIN(t->thread_info.n_records, (uint64_t) PA_PERIOD_TRACE_RECORDS);
+    first = (unsigned) ((t->thread_info.n_records - n) % PA_PERIOD_TRACE_RECORDS);
+
+    g = pa_xmalloc(sizeof(struct glitch) + n * sizeof(pa_period_record));
+    g->reason = t->thread_info.glitch;
+    g->time = t->thread_info.glitch_time;
+    g->n_records = n;
+
+    /* Oldest first */
+    for (i = 0; i < n; i++)
+        g->records[i] = t->thread_info.records[(first + i) % PA_PERIOD_TRACE_RECORDS];
+
+    pa_asyncmsgq_post(t->outq, PA_MSGOBJECT(t), PERIOD_TRACE_MESSAGE_GLITCH, g, 0, NULL, pa_xfree);
+
+    t->thread_info.glitch = NULL;
+}
+
+pa_period_record *pa_period_trace_begin(pa_period_trace *t, pa_usec_t target) {
+    pa_period_record *r;
+
+    pa_assert(t);
+
+    if (t->thread_info.glitch)
+        hand_on(t);
+
+    r = &t->thread_info.records[t->thread_info.n_records++ % PA_PERIOD_TRACE_RECORDS];
+
+    pa_zero(*r);
+    r->wakeup = pa_rtclock_now();
+    r->target = target;
+    r->inq_length = pa_asyncmsgq_get_length(t->inq);
+    r->outq_length = pa_asyncmsgq_get_length(t->outq);
+
+    return r;
+}
+
+void pa_period_trace_glitch(pa_period_trace *t, const char *reason) {
+    pa_usec_t now;
+
+    pa_assert(t);
+    pa_assert(reason);
+
+    if (t->thread_info.glitch)
+        return;
+
+    now = pa_rtclock_now();
+
+    if (t->thread_info.last_glitch > 0 && now < t->thread_info.last_glitch + GLITCH_INTERVAL_USEC)
+        return;
+
+    t->thread_info.glitch = reason;
+    t->thread_info.glitch_time = now;
+    t->thread_info.last_glitch = now;
+}
@@ -0,0 +1,66 @@
+#ifndef foopulsecoreperiodtracehfoo
+#define foopulsecoreperiodtracehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+
+#include <pulsecore/asyncmsgq.h>
+
+/* A flight recorder for the IO thread of a device. The thread fills in
+ * one record per iteration of its loop, which go into a ring of the last
+ * PA_PERIOD_TRACE_RECORDS. When something went wrong, like an underrun,
+ * the thread reports a glitch, and once the iteration is complete the
+ * ring is handed to the main thread, which appends it to a file. At most
+ * one glitch per second is written, those that follow right after one
+ * are in its ring anyway. */
+
+#define PA_PERIOD_TRACE_RECORDS 256
+
+typedef struct pa_period_record {
+    pa_usec_t wakeup;        /* When the thread woke up */
+    pa_usec_t target;        /* When its timer was due, 0 if there was none */
+    pa_usec_t render_usec;   /* How long rendering and writing took */
+    uint32_t written;        /* Bytes written to the device */
+    uint32_t avail;          /* Bytes free in the device buffer before writing */
+    uint32_t rewound;        /* Bytes rewound */
+    uint32_t inq_length;     /* Messages waiting for the IO thread */
+    uint32_t outq_length;    /* Messages waiting for the main thread */
+} pa_period_record;
+
+typedef struct pa_period_trace pa_period_trace;
+
+/* Called from the main thread, before the IO thread is started and after
+ * it has stopped. outq is where the IO thread posts messages for the main
+ * thread, inq the queue it reads itself. */
+pa_period_trace *pa_period_trace_new(const char *device, const char *path, pa_asyncmsgq *inq, pa_asyncmsgq *outq);
+void pa_period_trace_free(pa_period_trace *t);
+
+/* Called from the IO thread when it wakes up. Hands on a pending glitch,
+ * then returns the record for this iteration, with the wakeup, target and
+ * queue lengths filled in. target is 0 if the thread slept without a
+ * timer. */
+pa_period_record *pa_period_trace_begin(pa_period_trace *t, pa_usec_t target);
+
+/* Called from the IO thread. The ring is handed on with the next call to
+ * pa_period_trace_begin(). reason has to be a static string. */
+void pa_period_trace_glitch(pa_period_trace *t, const char *reason);
+
+#endif
@@ -25,4 +25,9 @@
 void pa_init_proplist(pa_proplist *p);
 char *pa_proplist_get_stream_group(pa_proplist *pl, const char *prefix, const char *cache);
 
+/* Like pa_proplist_iterate(), but also returns the value, which saves
+ * the lookup when the whole list is serialized. Lives in
+ * pulse/proplist.c. */
+const char *pa_proplist_iterate_data(pa_proplist *p, void **state, const void **data, size_t *nbytes);
+
 #endif
@@ -23,8 +23,10 @@
 
 #include <dbus/dbus.h>
 
+#include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
+#include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/dbus-util.h>
 #include <pulsecore/hashmap.h>
@@ -42,6 +44,12 @@ struct pa_dbus_protocol {
     pa_hashmap *connections; /* DBusConnection -> struct connection_entry */
     pa_idxset *extensions; /* Strings */
 
+    /* Property change signals waiting for the coalescing timer, keyed by
+     * "path interface.member". A newer signal replaces the queued one. */
+    pa_hashmap *pending_signals; /* String -> DBusMessage */
+    pa_time_event *flush_event;
+    pa_usec_t coalesce_usec;
+
     pa_hook hooks[PA_DBUS_PROTOCOL_HOOK_MAX];
 };
 
@@ -127,6 +135,10 @@ static pa_dbus_protocol *dbus_protocol_new(pa_core *c) {
     p->objects = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
     p->connections = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
     p->extensions = pa_idxset_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    p->pending_signals = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func,
+                                             pa_xfree, (pa_free_cb_t) dbus_message_unref);
+    p->flush_event = NULL;
+    p->coalesce_usec = 0;
 
     for (i = 0; i < PA_DBUS_PROTOCOL_HOOK_MAX; ++i)
         pa_hook_init(&p->hooks[i], p);
@@ -167,6 +179,10 @@ void pa_dbus_protocol_unref(pa_dbus_protocol *p) {
     pa_assert(pa_hashmap_isempty(p->connections));
     pa_assert(pa_idxset_isempty(p->extensions));
 
+    if (p->flush_event)
+        p->core->mainloop->time_free(p->flush_event);
+
+    pa_hashmap_free(p->pending_signals);
     pa_hashmap_free(p->objects);
     pa_hashmap_free(p->connections);
     pa_idxset_free(p->extensions, NULL);
@@ -1031,7 +1047,7 @@ void pa_dbus_protocol_remove_signal_listener(pa_dbus_protocol *p, DBusConnection
     }
 }
 
-void pa_dbus_protocol_send_signal(pa_dbus_protocol *p, DBusMessage *signal_msg) {
+static void send_signal_now(pa_dbus_protocol *p, DBusMessage *signal_msg) {
     struct connection_entry *conn_entry;
     struct signal_paths_entry *signal_paths_entry;
     void *state = NULL;
@@ -1066,6 +1082,78 @@ void pa_dbus_protocol_send_signal(pa_dbus_protocol *p, DBusMessage *signal_msg)
     pa_xfree(signal_string);
 }
 
+static void flush_pending_signals(pa_dbus_protocol *p) {
+    DBusMessage *signal_msg;
+
+    pa_assert(p);
+
+    if (p->flush_event)
+        p->core->mainloop->time_restart(p->flush_event, NULL);
+
+    /* The hashmap iterates in insertion order, and a replaced signal is
+     * re-inserted at the end, so clients see the changes in the order of
+     * their most recent update. */
+    while ((signal_msg = pa_hashmap_steal_first(p->pending_signals))) {
+        send_signal_now(p, signal_msg);
+        dbus_message_unref(signal_msg);
+    }
+}
+
+static void flush_event_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_dbus_protocol *p = userdata;
+
+    pa_assert(p);
+    pa_assert(e == p->flush_event);
+
+    flush_pending_signals(p);
+}
+
+void pa_dbus_protocol_send_signal(pa_dbus_protocol *p, DBusMessage *signal_msg) {
+    pa_assert(p);
+    pa_assert(signal_msg);
+
+    /* Don't let a signal overtake property changes that happened before it */
+    if (!pa_hashmap_isempty(p->pending_signals))
+        flush_pending_signals(p);
+
+    send_signal_now(p, signal_msg);
+}
+
+void pa_dbus_protocol_send_signal_latest(pa_dbus_protocol *p, DBusMessage *signal_msg) {
+    char *key;
+    bool was_empty;
+
+    pa_assert(p);
+    pa_assert(signal_msg);
+    pa_assert(dbus_message_get_type(signal_msg) == DBUS_MESSAGE_TYPE_SIGNAL);
+
+    if (p->coalesce_usec <= 0 || pa_hashmap_isempty(p->connections)) {
+        pa_dbus_protocol_send_signal(p, signal_msg);
+        return;
+    }
+
+    key = pa_sprintf_malloc("%s %s.%s", dbus_message_get_path(signal_msg),
+                            dbus_message_get_interface(signal_msg), dbus_message_get_member(signal_msg));
+
+    was_empty = pa_hashmap_isempty(p->pending_signals);
+    pa_hashmap_remove_and_free(p->pending_signals, key);
+    pa_assert_se(pa_hashmap_put(p->pending_signals, key, dbus_message_ref(signal_msg)) >= 0);
+
+    if (!p->flush_event)
+        p->flush_event = pa_core_rttime_new(p->core, pa_rtclock_now() + p->coalesce_usec, flush_event_cb, p);
+    else if (was_empty)
+        pa_core_rttime_restart(p->core, p->flush_event, pa_rtclock_now() + p->coalesce_usec);
+}
+
+void pa_dbus_protocol_set_signal_coalesce_usec(pa_dbus_protocol *p, pa_usec_t usec) {
+    pa_assert(p);
+
+    p->coalesce_usec = usec;
+
+    if (usec <= 0)
+        flush_pending_signals(p);
+}
+
 const char **pa_dbus_protocol_get_extensions(pa_dbus_protocol *p, unsigned *n) {
     const char **extensions;
     const char *ext_name;
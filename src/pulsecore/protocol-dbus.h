@@ -169,6 +169,19 @@ void pa_dbus_protocol_remove_signal_listener(pa_dbus_protocol *p, DBusConnection
  * pa_dbus_protocol_add_signal_listener(). */
 void pa_dbus_protocol_send_signal(pa_dbus_protocol *p, DBusMessage *signal);
 
+/* Like pa_dbus_protocol_send_signal(), but meant for signals that carry the
+ * new value of a property. If signal coalescing is enabled, the signal is
+ * held back for a while, and a later signal with the same path, interface
+ * and member replaces it, so a client only sees the latest value. Signals
+ * sent with pa_dbus_protocol_send_signal() flush the held back ones first,
+ * so the relative order of events is kept. The caller keeps its reference
+ * to the message. */
+void pa_dbus_protocol_send_signal_latest(pa_dbus_protocol *p, DBusMessage *signal);
+
+/* Sets for how long pa_dbus_protocol_send_signal_latest() holds signals
+ * back. 0 (the default) disables coalescing. */
+void pa_dbus_protocol_set_signal_coalesce_usec(pa_dbus_protocol *p, pa_usec_t usec);
+
 /* Returns an array of extension identifier strings. The strings pointers point
  * to the internal copies, so don't free the strings. The caller must free the
  * array, however. Also, do not save the returned pointer or any of the string
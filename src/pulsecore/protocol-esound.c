@@ -67,6 +67,18 @@
 #define PLAYBACK_BUFFER_FRAGMENTS (10)
 #define RECORD_BUFFER_SECONDS (5)
 
+/* Read up to this many times per wakeup while the socket keeps filling
+ * the requested size, instead of going through the main loop for every
+ * read. Bounded so that one client can't starve the others. */
+#define MAX_READS_PER_WAKEUP 8
+
+/* Recorded chunks sent with a single writev() */
+#ifdef HAVE_SYS_UIO_H
+#define MAX_WRITE_CHUNKS 16
+#else
+#define MAX_WRITE_CHUNKS 1
+#endif
+
 #define MAX_CACHE_SAMPLE_SIZE (2048000)
 
 #define DEFAULT_SINK_LATENCY (150*PA_USEC_PER_MSEC)
@@ -996,7 +1008,10 @@ static void client_kill_cb(pa_client *c) {
 
 /*** pa_iochannel callbacks ***/
 
+/* Returns 1 if the read got all it asked for, so more may be pending */
 static int do_read(connection *c) {
+    bool more = false;
+
     connection_assert_ref(c);
 
 /*     pa_log("READ"); */
@@ -1016,6 +1031,7 @@ static int do_read(connection *c) {
             return -1;
         }
 
+        more = (size_t) r == sizeof(c->request) - c->read_data_length;
         c->read_data_length += (size_t) r;
 
         if (c->read_data_length >= sizeof(c->request)) {
@@ -1072,6 +1088,7 @@ static int do_read(connection *c) {
             return -1;
         }
 
+        more = (size_t) r == handler->data_length - c->read_data_length;
         c->read_data_length += (size_t) r;
         if (c->read_data_length >= handler->data_length) {
             size_t l = c->read_data_length;
@@ -1103,6 +1120,7 @@ static int do_read(connection *c) {
             return -1;
         }
 
+        more = (size_t) r == c->scache.memchunk.length - c->scache.memchunk.index;
         c->scache.memchunk.index += (size_t) r;
         pa_assert(c->scache.memchunk.index <= c->scache.memchunk.length);
 
@@ -1179,9 +1197,37 @@ static int do_read(connection *c) {
 
         pa_atomic_sub(&c->playback.missing, (int) r);
         pa_asyncmsgq_post(c->sink_input->sink->asyncmsgq, PA_MSGOBJECT(c->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, &chunk, NULL);
+
+        more = (size_t) r == l;
     }
 
-    return 0;
+    return more ? 1 : 0;
+}
+
+/* Writes the chunks with a single system call where possible */
+static ssize_t write_chunks(pa_iochannel *io, pa_memchunk *chunks, unsigned n) {
+    ssize_t r;
+    unsigned k;
+#ifdef HAVE_SYS_UIO_H
+    struct iovec iov[MAX_WRITE_CHUNKS];
+
+    pa_assert(n <= MAX_WRITE_CHUNKS);
+
+    for (k = 0; k < n; k++) {
+        iov[k].iov_base = (uint8_t*) pa_memblock_acquire(chunks[k].memblock) + chunks[k].index;
+        iov[k].iov_len = chunks[k].length;
+    }
+
+    r = pa_iochannel_writev(io, iov, (int) n);
+#else
+    r = pa_iochannel_write(io, (uint8_t*) pa_memblock_acquire(chunks[0].memblock) + chunks[0].index, chunks[0].length);
+    n = 1;
+#endif
+
+    for (k = 0; k < n; k++)
+        pa_memblock_release(chunks[k].memblock);
+
+    return r;
 }
 
 static int do_write(connection *c) {
@@ -1205,21 +1251,17 @@ static int do_write(connection *c) {
         return 1;
 
     } else if (c->state == ESD_STREAMING_DATA && c->source_output) {
-        pa_memchunk chunk;
+        pa_memchunk chunks[MAX_WRITE_CHUNKS];
+        unsigned n, k;
         ssize_t r;
-        void *p;
 
-        if (pa_memblockq_peek(c->output_memblockq, &chunk) < 0)
+        if (!(n = pa_memblockq_peek_chunks(c->output_memblockq, chunks, MAX_WRITE_CHUNKS)))
             return 0;
 
-        pa_assert(chunk.memblock);
-        pa_assert(chunk.length);
+        r = write_chunks(c->io, chunks, n);
 
-        p = pa_memblock_acquire(chunk.memblock);
-        r = pa_iochannel_write(c->io, (uint8_t*) p+chunk.index, chunk.length);
-        pa_memblock_release(chunk.memblock);
-
-        pa_memblock_unref(chunk.memblock);
+        for (k = 0; k < n; k++)
+            pa_memblock_unref(chunks[k].memblock);
 
         if (r < 0) {
             pa_log("write(): %s", pa_cstrerror(errno));
@@ -1241,9 +1283,18 @@ static void do_work(connection *c) {
     if (c->dead)
         return;
 
-    if (pa_iochannel_is_readable(c->io))
-        if (do_read(c) < 0)
+    if (pa_iochannel_is_readable(c->io)) {
+        unsigned n = 0;
+        int r;
+
+        /* Requests come in two parts, header and data, and clients
+         * often send the stream right after the request */
+        while ((r = do_read(c)) > 0 && ++n < MAX_READS_PER_WAKEUP)
+            ;
+
+        if (r < 0)
             goto fail;
+    }
 
     if (c->state == ESD_STREAMING_DATA && !c->sink_input && pa_iochannel_is_hungup(c->io))
         /* In case we are in capture mode we will never call read()
@@ -40,6 +40,12 @@
 #include <pulsecore/shared.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/mime-type.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/random.h>
+
+#ifdef HAVE_OPUS
+#include <pulsecore/opus-codec.h>
+#endif
 
 #include "protocol-http.h"
 
@@ -51,10 +57,12 @@
 #define URL_STATUS "/status"
 #define URL_LISTEN "/listen"
 #define URL_LISTEN_SOURCE "/listen/source/"
+#define URL_LISTEN_OPUS "/listen/opus/"
 
 #define MIME_HTML "text/html; charset=utf-8"
 #define MIME_TEXT "text/plain; charset=utf-8"
 #define MIME_CSS "text/css"
+#define MIME_OGG_OPUS "audio/ogg; codecs=opus"
 
 #define HTML_HEADER(t)                                                  \
     "<?xml version=\"1.0\"?>\n"                                         \
@@ -73,6 +81,18 @@
 #define RECORD_BUFFER_SECONDS (5)
 #define DEFAULT_SOURCE_LATENCY (300*PA_USEC_PER_MSEC)
 
+#ifdef HAVE_OPUS
+#define OPUS_FRAME_USEC (20*PA_USEC_PER_MSEC)
+/* Granule positions of Ogg Opus always count 48 kHz samples */
+#define OPUS_FRAME_GRANULES (OPUS_FRAME_USEC * 48000 / PA_USEC_PER_SEC)
+/* The highest bitrate Opus produces, bounds the listener queues */
+#define OPUS_MAX_BYTES_PER_SECOND (510000/8)
+
+#define OGG_HEADER_SIZE 27
+#define OGG_MAX_SEGMENTS 255
+#define OGG_FLAG_BOS 0x02
+#endif
+
 enum state {
     STATE_REQUEST_LINE,
     STATE_MIME_HEADER,
@@ -84,17 +104,59 @@ enum method {
     METHOD_HEAD
 };
 
+enum encoding {
+    ENCODING_PCM,
+#ifdef HAVE_OPUS
+    ENCODING_OGG_OPUS,
+#endif
+};
+
+struct broadcast;
+
 struct connection {
     pa_http_protocol *protocol;
     pa_iochannel *io;
     pa_ioline *line;
     pa_memblockq *output_memblockq;
-    pa_source_output *source_output;
+    struct broadcast *broadcast;
     pa_client *client;
     enum state state;
     char *url;
     enum method method;
     pa_module *module;
+
+    PA_LLIST_FIELDS(struct connection);
+};
+
+/* All listeners of one source that want the same encoding share a single
+ * source output. The audio is encoded once, and the resulting memblocks are
+ * pushed to the queue of every connection. A connection whose queue
+ * overflows is dropped, so one slow client doesn't hold up the others. */
+struct broadcast {
+    pa_http_protocol *protocol;
+    pa_module *module;
+    enum encoding encoding;
+
+    pa_source_output *source_output;
+    pa_sample_spec sample_spec;
+
+    /* Compressed streams are queued in plain bytes */
+    pa_sample_spec queue_sample_spec;
+    size_t max_queue_length;
+
+    PA_LLIST_HEAD(struct connection, connections);
+    bool sending;
+
+#ifdef HAVE_OPUS
+    pa_opus_codec *encoder;
+    uint32_t serial;
+    uint32_t page_sequence;
+    uint64_t granule_position;
+
+    /* The identification and comment header pages, which every listener
+     * needs before the first audio page */
+    pa_memchunk header_pages[2];
+#endif
 };
 
 struct pa_http_protocol {
@@ -102,6 +164,7 @@ struct pa_http_protocol {
 
     pa_core *core;
     pa_idxset *connections;
+    pa_idxset *broadcasts;
 
     pa_strlist *servers;
 };
@@ -110,14 +173,22 @@ enum {
     SOURCE_OUTPUT_MESSAGE_POST_DATA = PA_SOURCE_OUTPUT_MESSAGE_MAX
 };
 
+static void broadcast_free(struct broadcast *b);
+
 /* Called from main context */
 static void connection_unlink(struct connection *c) {
     pa_assert(c);
 
-    if (c->source_output) {
-        pa_source_output_unlink(c->source_output);
-        c->source_output->userdata = NULL;
-        pa_source_output_unref(c->source_output);
+    if (c->broadcast) {
+        struct broadcast *b = c->broadcast;
+
+        PA_LLIST_REMOVE(struct connection, b->connections, c);
+        c->broadcast = NULL;
+
+        /* While the broadcast is still walking its connections it frees
+         * itself once done */
+        if (!b->connections && !b->sending)
+            broadcast_free(b);
     }
 
     if (c->client)
@@ -160,6 +231,11 @@ static int do_write(struct connection *c) {
     pa_memblock_unref(chunk.memblock);
 
     if (r < 0) {
+        /* The socket is non-blocking, a full send buffer just means that
+         * we have to wait for the next io callback */
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
         pa_log("write(): %s", pa_cstrerror(errno));
         return -1;
     }
@@ -190,14 +266,198 @@ fail:
     connection_unlink(c);
 }
 
+/* Called from main context
+ * Hands one chunk to every listener. Connections that can't keep up are
+ * dropped. Only to be called with b->sending set, so that the broadcast
+ * stays around even if it loses its last listener. */
+static void broadcast_send(struct broadcast *b, const pa_memchunk *chunk) {
+    struct connection *c, *n;
+
+    pa_assert(b);
+    pa_assert(b->sending);
+    pa_assert(chunk);
+
+    PA_LLIST_FOREACH_SAFE(c, n, b->connections) {
+        if (pa_memblockq_push_align(c->output_memblockq, chunk) < 0) {
+            pa_log_info("HTTP listener %s is too slow, dropping it.", pa_strnull(pa_proplist_gets(c->client->proplist, "http-protocol.peer")));
+            connection_unlink(c);
+            continue;
+        }
+
+        /* The line is detached once the response header has been sent,
+         * until then the data just queues up */
+        if (c->io)
+            do_work(c);
+    }
+}
+
+#ifdef HAVE_OPUS
+static void write_le(uint8_t *p, uint64_t v, unsigned bytes) {
+    unsigned i;
+
+    for (i = 0; i < bytes; i++, v >>= 8)
+        p[i] = (uint8_t) v;
+}
+
+/* The CRC of Ogg pages: polynomial 0x04c11db7, not reflected, zero initial
+ * value and no final xor. Pages are small and rare enough that this doesn't
+ * need a table. */
+static uint32_t ogg_crc(const uint8_t *data, size_t length) {
+    uint32_t crc = 0;
+
+    while (length--) {
+        unsigned k;
+
+        crc ^= (uint32_t) *data++ << 24;
+        for (k = 0; k < 8; k++)
+            crc = (crc & 0x80000000U) ? (crc << 1) ^ 0x04c11db7U : crc << 1;
+    }
+
+    return crc;
+}
+
+static unsigned ogg_segments(size_t length) {
+    return (unsigned) (length / 255) + 1;
+}
+
+/* Builds a page that carries the n packets complete, the granule position
+ * of the broadcast is stored as is */
+static void ogg_page_new(struct broadcast *b, uint8_t flags, const uint8_t *const *packets, const size_t *lengths, unsigned n, pa_memchunk *page) {
+    size_t body = 0;
+    unsigned segments = 0, i;
+    uint8_t *d, *p;
+
+    for (i = 0; i < n; i++) {
+        body += lengths[i];
+        segments += ogg_segments(lengths[i]);
+    }
+
+    pa_assert(segments <= OGG_MAX_SEGMENTS);
+
+    page->index = 0;
+    page->length = OGG_HEADER_SIZE + segments + body;
+    page->memblock = pa_memblock_new(b->protocol->core->mempool, page->length);
+
+    d = p = pa_memblock_acquire(page->memblock);
+
+    memcpy(p, "OggS", 4);
+    p[4] = 0;
+    p[5] = flags;
+    write_le(p + 6, b->granule_position, 8);
+    write_le(p + 14, b->serial, 4);
+    write_le(p + 18, b->page_sequence++, 4);
+    write_le(p + 22, 0, 4);
+    p[26] = (uint8_t) segments;
+    p += OGG_HEADER_SIZE;
+
+    for (i = 0; i < n; i++) {
+        size_t l;
+
+        for (l = lengths[i]; l >= 255; l -= 255)
+            *p++ = 255;
+        *p++ = (uint8_t) l;
+    }
+
+    for (i = 0; i < n; i++) {
+        memcpy(p, packets[i], lengths[i]);
+        p += lengths[i];
+    }
+
+    write_le(d + 22, ogg_crc(d, page->length), 4);
+
+    pa_memblock_release(page->memblock);
+}
+
+/* Prepares the two header pages of an Ogg Opus stream as of RFC 7845 */
+static void ogg_opus_headers_new(struct broadcast *b) {
+    static const char vendor[] = PACKAGE_NAME " " PACKAGE_VERSION;
+    uint8_t head[19], tags[8 + 4 + sizeof(vendor) - 1 + 4];
+    const uint8_t *packet;
+    size_t length;
+
+    memcpy(head, "OpusHead", 8);
+    head[8] = 1;
+    head[9] = b->sample_spec.channels;
+    write_le(head + 10, pa_opus_codec_get_lookahead(b->encoder), 2);
+    write_le(head + 12, b->sample_spec.rate, 4);
+    write_le(head + 16, 0, 2);
+    head[18] = 0;
+
+    memcpy(tags, "OpusTags", 8);
+    write_le(tags + 8, sizeof(vendor) - 1, 4);
+    memcpy(tags + 12, vendor, sizeof(vendor) - 1);
+    write_le(tags + 12 + sizeof(vendor) - 1, 0, 4);
+
+    packet = head;
+    length = sizeof(head);
+    ogg_page_new(b, OGG_FLAG_BOS, &packet, &length, 1, &b->header_pages[0]);
+
+    packet = tags;
+    length = sizeof(tags);
+    ogg_page_new(b, 0, &packet, &length, 1, &b->header_pages[1]);
+}
+
+/* Encodes a chunk and sends the resulting packets as Ogg pages */
+static void broadcast_send_opus(struct broadcast *b, const pa_memchunk *chunk) {
+    const uint8_t *packets[OGG_MAX_SEGMENTS];
+    size_t lengths[OGG_MAX_SEGMENTS];
+    unsigned n = 0, segments = 0;
+    pa_memchunk encoded, page;
+    size_t frame_size, done = 0;
+    const uint8_t *d;
+
+    if (pa_opus_codec_process(b->encoder, chunk, &encoded) < 0 || !encoded.memblock)
+        return;
+
+    /* The codec output is a sequence of packets, each preceded by a
+     * 16-bit big endian length and padded to whole frames */
+    frame_size = pa_frame_size(&b->sample_spec);
+    d = pa_memblock_acquire_chunk(&encoded);
+
+    while (encoded.length - done >= 2) {
+        size_t l, padded;
+
+        l = ((size_t) d[done] << 8) | d[done + 1];
+        padded = PA_ROUND_UP(2 + l, frame_size);
+        pa_assert(encoded.length - done >= padded);
+
+        if (l > 0) {
+            if (segments + ogg_segments(l) > OGG_MAX_SEGMENTS) {
+                ogg_page_new(b, 0, packets, lengths, n, &page);
+                broadcast_send(b, &page);
+                pa_memblock_unref(page.memblock);
+                n = segments = 0;
+            }
+
+            packets[n] = d + done + 2;
+            lengths[n] = l;
+            n++;
+            segments += ogg_segments(l);
+            b->granule_position += OPUS_FRAME_GRANULES;
+        }
+
+        done += padded;
+    }
+
+    if (n > 0) {
+        ogg_page_new(b, 0, packets, lengths, n, &page);
+        broadcast_send(b, &page);
+        pa_memblock_unref(page.memblock);
+    }
+
+    pa_memblock_release(encoded.memblock);
+    pa_memblock_unref(encoded.memblock);
+}
+#endif
+
 /* Called from thread context, except when it is not */
 static int source_output_process_msg(pa_msgobject *m, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
     pa_source_output *o = PA_SOURCE_OUTPUT(m);
-    struct connection *c;
+    struct broadcast *b;
 
     pa_source_output_assert_ref(o);
 
-    if (!(c = o->userdata))
+    if (!(b = o->userdata))
         return -1;
 
     switch (code) {
@@ -205,8 +465,17 @@ static int source_output_process_msg(pa_msgobject *m, int code, void *userdata,
         case SOURCE_OUTPUT_MESSAGE_POST_DATA:
             /* While this function is usually called from IO thread
              * context, this specific command is not! */
-            pa_memblockq_push_align(c->output_memblockq, chunk);
-            do_work(c);
+            b->sending = true;
+#ifdef HAVE_OPUS
+            if (b->encoding == ENCODING_OGG_OPUS)
+                broadcast_send_opus(b, chunk);
+            else
+#endif
+                broadcast_send(b, chunk);
+            b->sending = false;
+
+            if (!b->connections)
+                broadcast_free(b);
             break;
 
         default:
@@ -218,10 +487,8 @@ static int source_output_process_msg(pa_msgobject *m, int code, void *userdata,
 
 /* Called from thread context */
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
-    struct connection *c;
-
     pa_source_output_assert_ref(o);
-    pa_assert_se(c = o->userdata);
+    pa_assert(o->userdata);
     pa_assert(chunk);
 
     pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(o), SOURCE_OUTPUT_MESSAGE_POST_DATA, NULL, 0, chunk, NULL);
@@ -229,22 +496,145 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
 
 /* Called from main context */
 static void source_output_kill_cb(pa_source_output *o) {
-    struct connection*c;
+    struct broadcast *b;
 
     pa_source_output_assert_ref(o);
-    pa_assert_se(c = o->userdata);
+    pa_assert_se(b = o->userdata);
 
-    connection_unlink(c);
+    /* The last connection takes the broadcast with it */
+    while (b->connections)
+        connection_unlink(b->connections);
 }
 
 /* Called from main context */
 static pa_usec_t source_output_get_latency_cb(pa_source_output *o) {
-    struct connection*c;
+    struct broadcast *b;
+    struct connection *c;
+    size_t length = 0;
 
     pa_source_output_assert_ref(o);
-    pa_assert_se(c = o->userdata);
+    pa_assert_se(b = o->userdata);
+
+    /* Only the queues of uncompressed streams translate into time */
+    if (b->encoding != ENCODING_PCM)
+        return 0;
+
+    PA_LLIST_FOREACH(c, b->connections)
+        length = PA_MAX(length, pa_memblockq_get_length(c->output_memblockq));
+
+    return pa_bytes_to_usec(length, &b->sample_spec);
+}
+
+/* Called from main context */
+static struct broadcast *broadcast_get(pa_http_protocol *p, pa_module *m, pa_source *source, enum encoding encoding) {
+    struct broadcast *b;
+    pa_source_output_new_data data;
+    pa_channel_map cm;
+    uint32_t idx;
+
+    PA_IDXSET_FOREACH(b, p->broadcasts, idx)
+        if (b->module == m && b->encoding == encoding && b->source_output->source == source)
+            return b;
+
+    b = pa_xnew0(struct broadcast, 1);
+    b->protocol = p;
+    b->module = m;
+    b->encoding = encoding;
+    b->sample_spec = source->sample_spec;
+    cm = source->channel_map;
+
+#ifdef HAVE_OPUS
+    if (encoding == ENCODING_OGG_OPUS) {
+        /* Channel mapping family 0 of Ogg Opus only knows mono and stereo */
+        pa_opus_sample_spec_fix(&b->sample_spec);
+        if (b->sample_spec.channels == 1)
+            pa_channel_map_init_mono(&cm);
+        else
+            pa_channel_map_init_stereo(&cm);
+
+        b->queue_sample_spec.format = PA_SAMPLE_U8;
+        b->queue_sample_spec.rate = b->sample_spec.rate;
+        b->queue_sample_spec.channels = 1;
+        b->max_queue_length = OPUS_MAX_BYTES_PER_SECOND * RECORD_BUFFER_SECONDS;
+    } else
+#endif
+    {
+        pa_sample_spec_mimefy(&b->sample_spec, &cm);
+        b->queue_sample_spec = b->sample_spec;
+        b->max_queue_length = pa_bytes_per_second(&b->sample_spec) * RECORD_BUFFER_SECONDS;
+    }
+
+    pa_source_output_new_data_init(&data);
+    data.driver = __FILE__;
+    data.module = m;
+    pa_source_output_new_data_set_source(&data, source, false);
+    pa_proplist_sets(data.proplist, PA_PROP_MEDIA_NAME, "HTTP stream");
+    pa_proplist_sets(data.proplist, PA_PROP_APPLICATION_NAME, "HTTP listeners");
+    pa_source_output_new_data_set_sample_spec(&data, &b->sample_spec);
+    pa_source_output_new_data_set_channel_map(&data, &cm);
+
+    pa_source_output_new(&b->source_output, p->core, &data);
+    pa_source_output_new_data_done(&data);
+
+    if (!b->source_output) {
+        pa_xfree(b);
+        return NULL;
+    }
+
+#ifdef HAVE_OPUS
+    if (encoding == ENCODING_OGG_OPUS) {
+        if (!(b->encoder = pa_opus_encoder_new(&b->sample_spec, OPUS_FRAME_USEC, 0, p->core->mempool))) {
+            pa_source_output_unlink(b->source_output);
+            pa_source_output_unref(b->source_output);
+            pa_xfree(b);
+            return NULL;
+        }
+
+        pa_random(&b->serial, sizeof(b->serial));
+        ogg_opus_headers_new(b);
+    }
+#endif
+
+    b->source_output->parent.process_msg = source_output_process_msg;
+    b->source_output->push = source_output_push_cb;
+    b->source_output->kill = source_output_kill_cb;
+    b->source_output->get_latency = source_output_get_latency_cb;
+    b->source_output->userdata = b;
+
+    pa_source_output_set_requested_latency(b->source_output, DEFAULT_SOURCE_LATENCY);
+
+    pa_idxset_put(p->broadcasts, b, NULL);
+
+    pa_source_output_put(b->source_output);
+
+    return b;
+}
 
-    return pa_bytes_to_usec(pa_memblockq_get_length(c->output_memblockq), &c->source_output->sample_spec);
+/* Called from main context */
+static void broadcast_free(struct broadcast *b) {
+    pa_assert(b);
+    pa_assert(!b->connections);
+
+    pa_idxset_remove_by_data(b->protocol->broadcasts, b, NULL);
+
+    if (b->source_output) {
+        pa_source_output_unlink(b->source_output);
+        b->source_output->userdata = NULL;
+        pa_source_output_unref(b->source_output);
+    }
+
+#ifdef HAVE_OPUS
+    if (b->encoder)
+        pa_opus_codec_free(b->encoder);
+
+    if (b->header_pages[0].memblock)
+        pa_memblock_unref(b->header_pages[0].memblock);
+
+    if (b->header_pages[1].memblock)
+        pa_memblock_unref(b->header_pages[1].memblock);
+#endif
+
+    pa_xfree(b);
 }
 
 /*** client callbacks ***/
@@ -477,8 +867,14 @@ static void handle_listen(struct connection *c) {
         m = pa_sample_spec_to_mime_type_mimefy(&sink->sample_spec, &sink->channel_map);
 
         pa_ioline_printf(c->line,
-                         "<a href=\"" URL_LISTEN_SOURCE "%s\" title=\"%s\">%s</a><br/>\n",
+                         "<a href=\"" URL_LISTEN_SOURCE "%s\" title=\"%s\">%s</a>",
                          sink->monitor_source->name, m, t);
+#ifdef HAVE_OPUS
+        pa_ioline_printf(c->line,
+                         " (<a href=\"" URL_LISTEN_OPUS "%s\" title=\"" MIME_OGG_OPUS "\">Opus</a>)",
+                         sink->monitor_source->name);
+#endif
+        pa_ioline_puts(c->line, "<br/>\n");
 
         pa_xfree(t);
         pa_xfree(m);
@@ -499,8 +895,14 @@ static void handle_listen(struct connection *c) {
         m = pa_sample_spec_to_mime_type_mimefy(&source->sample_spec, &source->channel_map);
 
         pa_ioline_printf(c->line,
-                         "<a href=\"" URL_LISTEN_SOURCE "%s\" title=\"%s\">%s</a><br/>\n",
+                         "<a href=\"" URL_LISTEN_SOURCE "%s\" title=\"%s\">%s</a>",
                          source->name, m, t);
+#ifdef HAVE_OPUS
+        pa_ioline_printf(c->line,
+                         " (<a href=\"" URL_LISTEN_OPUS "%s\" title=\"" MIME_OGG_OPUS "\">Opus</a>)",
+                         source->name);
+#endif
+        pa_ioline_puts(c->line, "<br/>\n");
 
         pa_xfree(m);
         pa_xfree(t);
@@ -525,19 +927,18 @@ static void line_drain_callback(pa_ioline *l, void *userdata) {
     pa_assert_se(c->io = pa_ioline_detach_iochannel(c->line));
     pa_iochannel_set_callback(c->io, io_callback, c);
 
-    pa_iochannel_socket_set_sndbuf(c->io, pa_memblockq_get_length(c->output_memblockq));
+    /* Keep the kernel buffer at about a second, so that a slow listener
+     * shows up in our queue rather than in the socket */
+    pa_iochannel_socket_set_sndbuf(c->io, c->broadcast->max_queue_length / RECORD_BUFFER_SECONDS);
 
     pa_ioline_unref(c->line);
     c->line = NULL;
 }
 
-static void handle_listen_prefix(struct connection *c, const char *source_name) {
+static void handle_listen_prefix(struct connection *c, const char *source_name, enum encoding encoding) {
     pa_source *source;
-    pa_source_output_new_data data;
-    pa_sample_spec ss;
-    pa_channel_map cm;
+    struct broadcast *b;
     char *t;
-    size_t l;
 
     pa_assert(c);
     pa_assert(source_name);
@@ -550,58 +951,50 @@ static void handle_listen_prefix(struct connection *c, const char *source_name)
         return;
     }
 
-    ss = source->sample_spec;
-    cm = source->channel_map;
-
-    pa_sample_spec_mimefy(&ss, &cm);
-
-    pa_source_output_new_data_init(&data);
-    data.driver = __FILE__;
-    data.module = c->module;
-    data.client = c->client;
-    pa_source_output_new_data_set_source(&data, source, false);
-    pa_proplist_update(data.proplist, PA_UPDATE_MERGE, c->client->proplist);
-    pa_source_output_new_data_set_sample_spec(&data, &ss);
-    pa_source_output_new_data_set_channel_map(&data, &cm);
-
-    pa_source_output_new(&c->source_output, c->protocol->core, &data);
-    pa_source_output_new_data_done(&data);
-
-    if (!c->source_output) {
+    if (!(b = broadcast_get(c->protocol, c->module, source, encoding))) {
         html_response(c, 403, "Cannot create source output", NULL);
         return;
     }
 
-    c->source_output->parent.process_msg = source_output_process_msg;
-    c->source_output->push = source_output_push_cb;
-    c->source_output->kill = source_output_kill_cb;
-    c->source_output->get_latency = source_output_get_latency_cb;
-    c->source_output->userdata = c;
+#ifdef HAVE_OPUS
+    if (encoding == ENCODING_OGG_OPUS)
+        t = pa_xstrdup(MIME_OGG_OPUS);
+    else
+#endif
+        t = pa_sample_spec_to_mime_type(&b->sample_spec, &b->source_output->channel_map);
+    http_response(c, 200, "OK", t);
+    pa_xfree(t);
 
-    pa_source_output_set_requested_latency(c->source_output, DEFAULT_SOURCE_LATENCY);
+    if (c->method == METHOD_HEAD) {
+        /* Don't leave an unused broadcast behind */
+        if (!b->connections)
+            broadcast_free(b);
+        pa_ioline_defer_close(c->line);
+        return;
+    }
 
-    l = (size_t) (pa_bytes_per_second(&ss)*RECORD_BUFFER_SECONDS);
     c->output_memblockq = pa_memblockq_new(
             "http protocol connection output_memblockq",
             0,
-            l,
+            b->max_queue_length,
             0,
-            &ss,
+            &b->queue_sample_spec,
             1,
             0,
             0,
             NULL);
 
-    pa_source_output_put(c->source_output);
+#ifdef HAVE_OPUS
+    /* A listener joining late still needs the stream headers first */
+    if (encoding == ENCODING_OGG_OPUS) {
+        pa_memblockq_push(c->output_memblockq, &b->header_pages[0]);
+        pa_memblockq_push(c->output_memblockq, &b->header_pages[1]);
+    }
+#endif
 
-    t = pa_sample_spec_to_mime_type(&ss, &cm);
-    http_response(c, 200, "OK", t);
-    pa_xfree(t);
+    c->broadcast = b;
+    PA_LLIST_PREPEND(struct connection, b->connections, c);
 
-    if (c->method == METHOD_HEAD) {
-        connection_unlink(c);
-        return;
-    }
     pa_ioline_set_callback(c->line, NULL, NULL);
 
     if (pa_ioline_is_drained(c->line))
@@ -624,7 +1017,11 @@ static void handle_url(struct connection *c) {
     else if (pa_streq(c->url, URL_LISTEN))
         handle_listen(c);
     else if (pa_startswith(c->url, URL_LISTEN_SOURCE))
-        handle_listen_prefix(c, c->url + sizeof(URL_LISTEN_SOURCE)-1);
+        handle_listen_prefix(c, c->url + sizeof(URL_LISTEN_SOURCE)-1, ENCODING_PCM);
+#ifdef HAVE_OPUS
+    else if (pa_startswith(c->url, URL_LISTEN_OPUS))
+        handle_listen_prefix(c, c->url + sizeof(URL_LISTEN_OPUS)-1, ENCODING_OGG_OPUS);
+#endif
     else
         html_response(c, 404, "Not Found", NULL);
 }
@@ -748,6 +1145,7 @@ static pa_http_protocol* http_protocol_new(pa_core *c) {
     PA_REFCNT_INIT(p);
     p->core = c;
     p->connections = pa_idxset_new(NULL, NULL);
+    p->broadcasts = pa_idxset_new(NULL, NULL);
 
     pa_assert_se(pa_shared_set(c, "http-protocol", p) >= 0);
 
@@ -786,6 +1184,10 @@ void pa_http_protocol_unref(pa_http_protocol *p) {
 
     pa_idxset_free(p->connections, NULL);
 
+    /* Broadcasts go away with their last connection */
+    pa_assert(pa_idxset_isempty(p->broadcasts));
+    pa_idxset_free(p->broadcasts, NULL);
+
     pa_strlist_free(p->servers);
 
     pa_assert_se(pa_shared_remove(p->core, "http-protocol") >= 0);
@@ -51,13 +51,23 @@
 #include <pulsecore/mem.h>
 #include <pulsecore/strlist.h>
 #include <pulsecore/shared.h>
+#include <pulsecore/ringbuffer.h>
+#include <pulsecore/fdsem.h>
+#include <pulsecore/poll.h>
+#include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/socket-util.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/ipacl.h>
+#include <pulsecore/ratelimit.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/mem.h>
 
+#ifdef HAVE_OPUS
+#include <pulsecore/opus-codec.h>
+#endif
+
 #include "protocol-native.h"
 
 /* #define PROTOCOL_NATIVE_DEBUG */
@@ -65,6 +75,9 @@
 /* Kick a client if it doesn't authenticate within this time */
 #define AUTH_TIMEOUT (60 * PA_USEC_PER_SEC)
 
+/* Changes of auth_group membership take effect after at most this */
+#define AUTH_GROUP_CACHE_USEC (10 * PA_USEC_PER_SEC)
+
 /* Don't accept more connection than this */
 #define MAX_CONNECTIONS 64
 
@@ -73,6 +86,20 @@
 #define DEFAULT_PROCESS_MSEC 20   /* 20ms */
 #define DEFAULT_FRAGSIZE_MSEC DEFAULT_TLENGTH_MSEC
 
+/* With adaptive-latency=1, the least tlength given to remote streams
+ * that leave it to us, and the most unsent data kept in the kernel */
+#define ADAPTIVE_MIN_TLENGTH_MSEC 50
+#define ADAPTIVE_NOTSENT_LOWAT (16*1024)
+
+/* Latency requests are answered from the timing snapshot if it is not
+ * older than this, like the client does with the timing page */
+#define TIMING_SNAPSHOT_MAX_AGE_USEC (100*PA_USEC_PER_MSEC)
+#define TIMING_SNAPSHOT_READ_TRIES 8
+
+/* The metering periods clients may ask for */
+#define METER_PERIOD_MIN (5*PA_USEC_PER_MSEC)
+#define METER_PERIOD_MAX (10*PA_USEC_PER_SEC)
+
 struct pa_native_protocol;
 
 typedef struct record_stream {
@@ -100,6 +127,12 @@ typedef struct record_stream {
     size_t on_the_fly_snapshot;
     pa_usec_t current_monitor_latency;
     pa_usec_t current_source_latency;
+
+#ifdef HAVE_OPUS
+    /* Set if the client asked for Opus, which is what we send then */
+    pa_opus_codec *encoder;
+    pa_format_info *opus_format;
+#endif
 } record_stream;
 
 #define RECORD_STREAM(o) (record_stream_cast(o))
@@ -134,6 +167,8 @@ typedef struct playback_stream {
     int64_t seek_windex;
 
     pa_atomic_t missing;
+    /* Requests must not overtake the reply that created the stream */
+    uint64_t reply_serial;
     pa_usec_t configured_sink_latency;
     /* Requested buffer attributes */
     pa_buffer_attr buffer_attr_req;
@@ -145,6 +180,34 @@ typedef struct playback_stream {
     size_t render_memblockq_length;
     pa_usec_t current_sink_latency;
     uint64_t playing_for, underrun_for;
+
+    /* Shared with the client after PA_COMMAND_ENABLE_TIMING_PAGE. The
+     * data pointer is only used from the sink thread. */
+    pa_memblock *timing_page;
+    pa_native_timing_page *timing_page_data;
+
+    /* The same data, always written by the sink thread and read by the
+     * main thread to answer latency requests without a round trip */
+    pa_native_timing_page timing_snapshot;
+
+    /* Playback data the client writes into shared memory instead of
+     * sending it, set up by PA_COMMAND_SYNC_DATA_RING. The ring is only
+     * accessed from the sink thread, which drains it before it handles
+     * anything else for the stream. */
+    pa_memblock *data_ring;
+    pa_ringbuffer data_ring_rb;
+
+    /* Posted by the client when data went into the empty ring. Created
+     * by the main thread, waited on by an item in the sink thread's
+     * rtpoll while the stream is attached to it. */
+    pa_fdsem *data_ring_sem;
+    pa_rtpoll_item *data_ring_item;
+
+#ifdef HAVE_OPUS
+    /* Set if the client sends Opus, which is decoded before playback */
+    pa_opus_codec *decoder;
+    pa_format_info *opus_format;
+#endif
 } playback_stream;
 
 #define PLAYBACK_STREAM(o) (playback_stream_cast(o))
@@ -167,6 +230,20 @@ typedef struct upload_stream {
 #define UPLOAD_STREAM(o) (upload_stream_cast(o))
 PA_DEFINE_PRIVATE_CLASS(upload_stream, output_stream);
 
+typedef struct pending_event {
+    pa_subscription_event_type_t type;
+    uint32_t index;
+
+    PA_LLIST_FIELDS(struct pending_event);
+} pending_event;
+
+/* A sink, source or sink input metered for the client */
+typedef struct meter_slot {
+    pa_subscription_event_type_t facility;
+    pa_msgobject *object;
+    pa_meter *meter;
+} meter_slot;
+
 struct pa_native_connection {
     pa_msgobject parent;
     pa_native_protocol *protocol;
@@ -186,8 +263,31 @@ struct pa_native_connection {
     pa_idxset *record_streams, *output_streams;
     uint32_t rrobin_index;
     pa_subscription *subscription;
+    /* Subscription events held back for the coalescing window */
+    PA_LLIST_HEAD(pending_event, pending_events);
+    pending_event *last_pending_event;
+    pa_time_event *subscription_event;
     pa_time_event *auth_timeout_event;
     pa_srbchannel *srbpending;
+
+    /* Requests of all playback streams are sent together from here
+     * once per main loop iteration, unless an srbchannel is in use */
+    pa_defer_event *request_event;
+
+    /* Only for TCP connections with adaptive-latency=1, otherwise -1 */
+    int tcp_fd;
+    /* Round trip time plus four deviations, from the kernel's estimate */
+    pa_usec_t network_delay;
+
+    /* Only used with client-max-request-rate set */
+    pa_ratelimit request_ratelimit;
+
+    /* Shared with the client after the first PA_COMMAND_ENABLE_METER and
+     * kept acquired, since the IO threads of the metered objects write
+     * into it */
+    pa_memblock *meter_page;
+    pa_native_meter_page *meter_page_data;
+    meter_slot meters[PA_NATIVE_METER_SLOTS];
 };
 
 #define PA_NATIVE_CONNECTION(o) (pa_native_connection_cast(o))
@@ -217,7 +317,10 @@ enum {
     SINK_INPUT_MESSAGE_SEEK,
     SINK_INPUT_MESSAGE_PREBUF_FORCE,
     SINK_INPUT_MESSAGE_UPDATE_LATENCY,
-    SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR
+    SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR,
+    SINK_INPUT_MESSAGE_SET_TIMING_PAGE,
+    SINK_INPUT_MESSAGE_SET_DATA_RING,
+    SINK_INPUT_MESSAGE_SYNC_DATA_RING
 };
 
 enum {
@@ -247,6 +350,8 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_send_event_cb(pa_sink_input *i, const char *event, pa_proplist *pl);
+static void sink_input_attach_cb(pa_sink_input *i);
+static void sink_input_detach_cb(pa_sink_input *i);
 
 static void native_connection_send_memblock(pa_native_connection *c);
 static void playback_stream_request_bytes(struct playback_stream*s);
@@ -263,6 +368,64 @@ static int source_output_process_msg(pa_msgobject *o, int code, void *userdata,
 
 /* structure management */
 
+/* Called from main context */
+static void trace_record(pa_native_connection *c, pa_native_trace_record *r) {
+    pa_assert(c);
+    pa_assert(c->options->trace);
+    pa_assert(r);
+
+    r->client = c->client->index;
+    pa_native_trace_write(c->options->trace, r);
+}
+
+/* Called from main context */
+static void trace_stream(pa_native_connection *c, pa_native_trace_type_t type, uint32_t channel,
+                         const pa_sample_spec *ss, const pa_channel_map *map, const pa_buffer_attr *attr,
+                         bool corked, bool adjust_latency, bool early_requests, bool variable_rate,
+                         bool dont_inhibit_auto_suspend, bool fail_on_suspend) {
+    pa_native_trace_record r;
+
+    pa_assert(c);
+
+    if (!c->options->trace)
+        return;
+
+    pa_zero(r);
+    r.type = type;
+    r.channel = channel;
+    r.sample_spec = *ss;
+    r.channel_map = *map;
+    r.buffer_attr = *attr;
+
+    /* The flags as the client would pass them to pa_stream_connect_*() */
+    r.flags =
+        (corked ? PA_STREAM_START_CORKED : 0) |
+        (adjust_latency ? PA_STREAM_ADJUST_LATENCY : 0) |
+        (early_requests ? PA_STREAM_EARLY_REQUESTS : 0) |
+        (variable_rate ? PA_STREAM_VARIABLE_RATE : 0) |
+        (dont_inhibit_auto_suspend ? PA_STREAM_DONT_INHIBIT_AUTO_SUSPEND : 0) |
+        (fail_on_suspend ? PA_STREAM_FAIL_ON_SUSPEND : 0);
+
+    trace_record(c, &r);
+}
+
+/* Called from main context */
+static void trace_delete_stream(pa_native_connection *c, uint32_t channel, bool record) {
+    pa_native_trace_record r;
+
+    pa_assert(c);
+
+    if (!c->options->trace)
+        return;
+
+    pa_zero(r);
+    r.type = PA_NATIVE_TRACE_DELETE_STREAM;
+    r.channel = channel;
+    r.record = record;
+
+    trace_record(c, &r);
+}
+
 /* Called from main context */
 static void upload_stream_unlink(upload_stream *s) {
     pa_assert(s);
@@ -339,6 +502,8 @@ static void record_stream_unlink(record_stream *s) {
         s->source_output = NULL;
     }
 
+    trace_delete_stream(s->connection, s->index, true);
+
     pa_assert_se(pa_idxset_remove_by_data(s->connection->record_streams, s, NULL) == s);
     s->connection = NULL;
     record_stream_unref(s);
@@ -351,6 +516,13 @@ static void record_stream_free(pa_object *o) {
 
     record_stream_unlink(s);
 
+#ifdef HAVE_OPUS
+    if (s->encoder)
+        pa_opus_codec_free(s->encoder);
+    if (s->opus_format)
+        pa_format_info_free(s->opus_format);
+#endif
+
     pa_memblockq_free(s->memblockq);
     pa_xfree(s);
 }
@@ -371,6 +543,21 @@ static int record_stream_process_msg(pa_msgobject *o, int code, void*userdata, i
              * currently on the fly */
             pa_atomic_sub(&s->on_the_fly, chunk->length);
 
+#ifdef HAVE_OPUS
+            if (s->encoder) {
+                pa_memchunk encoded;
+                int r;
+
+                if (pa_opus_codec_process(s->encoder, chunk, &encoded) < 0 || !encoded.memblock)
+                    break;
+
+                r = pa_memblockq_push_align(s->memblockq, &encoded);
+                pa_memblock_unref(encoded.memblock);
+
+                if (r < 0)
+                    return -1;
+            } else
+#endif
             if (pa_memblockq_push_align(s->memblockq, chunk) < 0) {
 /*                 pa_log_warn("Failed to push data into output queue."); */
                 return -1;
@@ -385,6 +572,74 @@ static int record_stream_process_msg(pa_msgobject *o, int code, void*userdata, i
     return 0;
 }
 
+/* Called from main context */
+static bool streams_quota_ok(pa_native_connection *c) {
+    pa_assert(c);
+
+    if (c->options->client_max_streams <= 0 ||
+        pa_idxset_size(c->record_streams) + pa_idxset_size(c->output_streams) < c->options->client_max_streams)
+        return true;
+
+    pa_log_info("Client %u has too many streams already.", c->client->index);
+    return false;
+}
+
+/* Called from main context. Returns how much the stream except may
+ * buffer, on top of what the other streams of the connection do. */
+static uint32_t buffer_quota_left(pa_native_connection *c, void *except) {
+    record_stream *r;
+    output_stream *o;
+    size_t used = 0;
+    uint32_t idx;
+
+    pa_assert(c);
+
+    if (c->options->client_max_buffer <= 0)
+        return (uint32_t) -1;
+
+    PA_IDXSET_FOREACH(r, c->record_streams, idx)
+        if (r != except)
+            used += r->buffer_attr.maxlength;
+
+    PA_IDXSET_FOREACH(o, c->output_streams, idx) {
+        if (o == except)
+            continue;
+
+        if (playback_stream_isinstance(o))
+            used += PLAYBACK_STREAM(o)->buffer_attr.maxlength;
+        else if (upload_stream_isinstance(o))
+            used += UPLOAD_STREAM(o)->memchunk.length + UPLOAD_STREAM(o)->length;
+    }
+
+    if (used >= c->options->client_max_buffer)
+        return 0;
+
+    return c->options->client_max_buffer - (uint32_t) used;
+}
+
+/* Called from main context */
+static bool buffer_quota_ok(pa_native_connection *c, size_t length) {
+    pa_assert(c);
+
+    if (buffer_quota_left(c, NULL) >= length)
+        return true;
+
+    pa_log_info("Client %u buffers too much already.", c->client->index);
+    return false;
+}
+
+/* Called from main context */
+static bool request_rate_ok(pa_native_connection *c) {
+    pa_assert(c);
+
+    if (c->options->client_max_request_rate <= 0 ||
+        pa_ratelimit_test(&c->request_ratelimit, PA_LOG_INFO))
+        return true;
+
+    pa_log_debug("Client %u sends requests too fast.", c->client->index);
+    return false;
+}
+
 /* Called from main context */
 static void fix_record_buffer_attr_pre(record_stream *s) {
 
@@ -403,6 +658,7 @@ static void fix_record_buffer_attr_pre(record_stream *s) {
 
     if (s->buffer_attr.maxlength == (uint32_t) -1 || s->buffer_attr.maxlength > MAX_MEMBLOCKQ_LENGTH)
         s->buffer_attr.maxlength = MAX_MEMBLOCKQ_LENGTH;
+    s->buffer_attr.maxlength = PA_MIN(s->buffer_attr.maxlength, buffer_quota_left(s->connection, s));
     if (s->buffer_attr.maxlength <= 0)
         s->buffer_attr.maxlength = (uint32_t) frame_size;
 
@@ -496,6 +752,39 @@ static void fix_record_buffer_attr_post(record_stream *s) {
         s->buffer_attr.fragsize = s->buffer_attr.maxlength;
 }
 
+#ifdef HAVE_OPUS
+/* If the client offers Opus, replaces the formats with the PCM the Opus
+ * stream carries and returns the Opus format. We then do the encoding or
+ * decoding ourselves, so that the stream works like any PCM stream
+ * otherwise. */
+static pa_format_info *take_opus_format(pa_idxset **formats, pa_sample_spec *ss) {
+    pa_format_info *f;
+    pa_channel_map map;
+    uint32_t idx;
+
+    if (!*formats)
+        return NULL;
+
+    PA_IDXSET_FOREACH(f, *formats, idx) {
+        if (f->encoding != PA_ENCODING_OPUS)
+            continue;
+
+        if (pa_opus_format_to_sample_spec(f, ss, &map) < 0)
+            continue;
+
+        f = pa_format_info_copy(f);
+
+        pa_idxset_free(*formats, (pa_free_cb_t) pa_format_info_free);
+        *formats = pa_idxset_new(NULL, NULL);
+        pa_idxset_put(*formats, pa_format_info_from_sample_spec(ss, &map), NULL);
+
+        return f;
+    }
+
+    return NULL;
+}
+#endif
+
 /* Called from main context */
 static record_stream* record_stream_new(
         pa_native_connection *c,
@@ -516,16 +805,34 @@ static record_stream* record_stream_new(
         pa_sink_input *direct_on_input,
         int *ret) {
 
+    /* Note: This function takes ownership of the 'formats' param */
+
     record_stream *s;
     pa_source_output *source_output = NULL;
     pa_source_output_new_data data;
     char *memblockq_name;
+#ifdef HAVE_OPUS
+    pa_format_info *opus_format;
+    pa_opus_codec *encoder = NULL;
+    pa_sample_spec opus_ss;
+#endif
 
     pa_assert(c);
     pa_assert(ss);
     pa_assert(p);
     pa_assert(ret);
 
+#ifdef HAVE_OPUS
+    if ((opus_format = take_opus_format(&formats, &opus_ss)) &&
+        !(encoder = pa_opus_encoder_new(&opus_ss, DEFAULT_PROCESS_MSEC * PA_USEC_PER_MSEC, 0, c->protocol->core->mempool))) {
+        pa_format_info_free(opus_format);
+        if (formats)
+            pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
+        *ret = PA_ERR_NOTSUPPORTED;
+        return NULL;
+    }
+#endif
+
     pa_source_output_new_data_init(&data);
 
     pa_proplist_update(data.proplist, PA_UPDATE_REPLACE, p);
@@ -558,8 +865,15 @@ static record_stream* record_stream_new(
 
     pa_source_output_new_data_done(&data);
 
-    if (!source_output)
+    if (!source_output) {
+#ifdef HAVE_OPUS
+        if (encoder) {
+            pa_opus_codec_free(encoder);
+            pa_format_info_free(opus_format);
+        }
+#endif
         return NULL;
+    }
 
     s = pa_msgobject_new(record_stream);
     s->parent.parent.free = record_stream_free;
@@ -598,6 +912,16 @@ static record_stream* record_stream_new(
     pa_memblockq_get_attr(s->memblockq, &s->buffer_attr);
     fix_record_buffer_attr_post(s);
 
+#ifdef HAVE_OPUS
+    if (encoder) {
+        /* Tie the frame length to the latency the client asked for */
+        s->encoder = encoder;
+        s->opus_format = opus_format;
+        pa_opus_codec_set_frame_usec(encoder, pa_opus_frame_usec_for_latency(
+                pa_bytes_to_usec(s->buffer_attr.fragsize, &source_output->sample_spec) + s->configured_source_latency));
+    }
+#endif
+
     *ss = s->source_output->sample_spec;
     *map = s->source_output->channel_map;
 
@@ -640,6 +964,8 @@ static void playback_stream_unlink(playback_stream *s) {
     if (s->drain_request)
         pa_pstream_send_error(s->connection->pstream, s->drain_tag, PA_ERR_NOENTITY);
 
+    trace_delete_stream(s->connection, s->index, false);
+
     pa_assert_se(pa_idxset_remove_by_data(s->connection->output_streams, s, NULL) == s);
     s->connection = NULL;
     playback_stream_unref(s);
@@ -652,10 +978,100 @@ static void playback_stream_free(pa_object* o) {
 
     playback_stream_unlink(s);
 
+    if (s->timing_page) {
+        pa_memblock_release(s->timing_page);
+        pa_memblock_unref(s->timing_page);
+    }
+
+    if (s->data_ring) {
+        pa_memblock_release(s->data_ring);
+        pa_memblock_unref(s->data_ring);
+    }
+
+    if (s->data_ring_sem)
+        pa_fdsem_free(s->data_ring_sem);
+
+#ifdef HAVE_OPUS
+    if (s->decoder)
+        pa_opus_codec_free(s->decoder);
+    if (s->opus_format)
+        pa_format_info_free(s->opus_format);
+#endif
+
     pa_memblockq_free(s->memblockq);
     pa_xfree(s);
 }
 
+/* Called from main context */
+static void playback_stream_send_buffer_attr_changed(playback_stream *s) {
+    pa_tagstruct *t;
+
+    playback_stream_assert_ref(s);
+
+    if (s->connection->version < 15)
+        return;
+
+    t = pa_tagstruct_new();
+    pa_tagstruct_putu32(t, PA_COMMAND_PLAYBACK_BUFFER_ATTR_CHANGED);
+    pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
+    pa_tagstruct_putu32(t, s->index);
+    pa_tagstruct_putu32(t, s->buffer_attr.maxlength);
+    pa_tagstruct_putu32(t, s->buffer_attr.tlength);
+    pa_tagstruct_putu32(t, s->buffer_attr.prebuf);
+    pa_tagstruct_putu32(t, s->buffer_attr.minreq);
+    pa_tagstruct_put_usec(t, s->configured_sink_latency);
+    pa_pstream_send_tagstruct(s->connection->pstream, t);
+}
+
+/* Called from main context */
+static void playback_stream_send_request(playback_stream *s) {
+    pa_tagstruct *t;
+    int l = 0;
+
+    for (;;) {
+        if ((l = pa_atomic_load(&s->missing)) <= 0)
+            return;
+
+        if (pa_atomic_cmpxchg(&s->missing, l, 0))
+            break;
+    }
+
+    t = pa_tagstruct_new();
+    pa_tagstruct_putu32(t, PA_COMMAND_REQUEST);
+    pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
+    pa_tagstruct_putu32(t, s->index);
+    pa_tagstruct_putu32(t, (uint32_t) l);
+
+    /* Don't leave the client waiting for this behind whatever
+     * large replies it has queued up */
+    if (pa_pstream_is_dequeued(s->connection->pstream, s->reply_serial))
+        pa_pstream_send_tagstruct_urgent(s->connection->pstream, t);
+    else
+        pa_pstream_send_tagstruct(s->connection->pstream, t);
+
+#ifdef PROTOCOL_NATIVE_DEBUG
+    pa_log("Requesting %lu bytes", (unsigned long) l);
+#endif
+}
+
+/* Called from main context */
+static void request_event_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    output_stream *o;
+    uint32_t idx;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(c->request_event == e);
+
+    m->defer_enable(e, 0);
+
+    /* The pstream writes out everything queued here with a single
+     * writev() */
+    PA_IDXSET_FOREACH(o, c->output_streams, idx)
+        if (playback_stream_isinstance(o))
+            playback_stream_send_request(PLAYBACK_STREAM(o));
+}
+
 /* Called from main context */
 static int playback_stream_process_msg(pa_msgobject *o, int code, void*userdata, int64_t offset, pa_memchunk *chunk) {
     playback_stream *s = PLAYBACK_STREAM(o);
@@ -667,27 +1083,21 @@ static int playback_stream_process_msg(pa_msgobject *o, int code, void*userdata,
     switch (code) {
 
         case PLAYBACK_STREAM_MESSAGE_REQUEST_DATA: {
-            pa_tagstruct *t;
-            int l = 0;
-
-            for (;;) {
-                if ((l = pa_atomic_load(&s->missing)) <= 0)
-                    return 0;
+            pa_native_connection *c = s->connection;
 
-                if (pa_atomic_cmpxchg(&s->missing, l, 0))
-                    break;
+            if (pa_pstream_has_srbchannel(c->pstream)) {
+                playback_stream_send_request(s);
+                break;
             }
 
-            t = pa_tagstruct_new();
-            pa_tagstruct_putu32(t, PA_COMMAND_REQUEST);
-            pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
-            pa_tagstruct_putu32(t, s->index);
-            pa_tagstruct_putu32(t, (uint32_t) l);
-            pa_pstream_send_tagstruct(s->connection->pstream, t);
+            /* Other streams of this client are likely to ask for data
+             * in the same iteration, let them catch up and send all
+             * requests in one go. */
+            if (c->request_event)
+                c->protocol->core->mainloop->defer_enable(c->request_event, 1);
+            else
+                c->request_event = c->protocol->core->mainloop->defer_new(c->protocol->core->mainloop, request_event_cb, c);
 
-#ifdef PROTOCOL_NATIVE_DEBUG
-            pa_log("Requesting %lu bytes", (unsigned long) l);
-#endif
             break;
         }
 
@@ -743,26 +1153,49 @@ static int playback_stream_process_msg(pa_msgobject *o, int code, void*userdata,
         case PLAYBACK_STREAM_MESSAGE_UPDATE_TLENGTH:
 
             s->buffer_attr.tlength = (uint32_t) offset;
+            playback_stream_send_buffer_attr_changed(s);
+            break;
+    }
 
-            if (s->connection->version >= 15) {
-                pa_tagstruct *t;
+    return 0;
+}
 
-                t = pa_tagstruct_new();
-                pa_tagstruct_putu32(t, PA_COMMAND_PLAYBACK_BUFFER_ATTR_CHANGED);
-                pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
-                pa_tagstruct_putu32(t, s->index);
-                pa_tagstruct_putu32(t, s->buffer_attr.maxlength);
-                pa_tagstruct_putu32(t, s->buffer_attr.tlength);
-                pa_tagstruct_putu32(t, s->buffer_attr.prebuf);
-                pa_tagstruct_putu32(t, s->buffer_attr.minreq);
-                pa_tagstruct_put_usec(t, s->configured_sink_latency);
-                pa_pstream_send_tagstruct(s->connection->pstream, t);
-            }
+/* Called from main context */
+static pa_usec_t adaptive_tlength_usec(pa_native_connection *c) {
+    pa_usec_t usec;
 
-            break;
+    /* Whatever the sink asks for needs to be requested from the client
+     * and to arrive here within one network delay. Twice that covers a
+     * request that crosses a refill already under way. */
+    usec = ADAPTIVE_MIN_TLENGTH_MSEC * PA_USEC_PER_MSEC + 2 * c->network_delay;
+
+    return PA_MIN(usec, DEFAULT_TLENGTH_MSEC * PA_USEC_PER_MSEC);
+}
+
+/* Called from main context. Returns true if the network delay changed
+ * enough to be worth resizing the streams for. */
+static bool update_network_delay(pa_native_connection *c) {
+    pa_usec_t rtt, rttvar, delay;
+
+    if (c->tcp_fd < 0)
+        return false;
+
+    if (pa_socket_get_tcp_rtt(c->tcp_fd, &rtt, &rttvar) < 0)
+        return false;
+
+    delay = rtt + 4 * rttvar;
+
+    /* Grow right away, but shrink only on a clear improvement, so that
+     * a jittery link doesn't make us bounce back and forth */
+    if (delay > c->network_delay + c->network_delay / 4 + PA_USEC_PER_MSEC ||
+        delay < c->network_delay / 2) {
+        pa_log_debug("Network delay of client %u is now %0.2f ms (rtt %0.2f ms)",
+                     c->client->index, (double) delay / PA_USEC_PER_MSEC, (double) rtt / PA_USEC_PER_MSEC);
+        c->network_delay = delay;
+        return true;
     }
 
-    return 0;
+    return false;
 }
 
 /* Called from main context */
@@ -796,9 +1229,19 @@ static void fix_playback_buffer_attr(playback_stream *s) {
 
     if (s->buffer_attr.maxlength == (uint32_t) -1 || s->buffer_attr.maxlength > MAX_MEMBLOCKQ_LENGTH)
         s->buffer_attr.maxlength = MAX_MEMBLOCKQ_LENGTH;
+    s->buffer_attr.maxlength = PA_MIN(s->buffer_attr.maxlength, buffer_quota_left(s->connection, s));
     if (s->buffer_attr.maxlength <= 0)
         s->buffer_attr.maxlength = (uint32_t) frame_size;
 
+    if (s->connection->tcp_fd >= 0) {
+        uint32_t adaptive = (uint32_t) pa_usec_to_bytes_round_up(adaptive_tlength_usec(s->connection), &s->sink_input->sample_spec);
+
+        /* Remote clients get just enough buffering for their network,
+         * and no less than that even if they asked for it */
+        if (s->buffer_attr.tlength == (uint32_t) -1 || s->buffer_attr.tlength < adaptive)
+            s->buffer_attr.tlength = adaptive;
+    }
+
     if (s->buffer_attr.tlength == (uint32_t) -1)
         s->buffer_attr.tlength = (uint32_t) pa_usec_to_bytes_round_up(DEFAULT_TLENGTH_MSEC*PA_USEC_PER_MSEC, &s->sink_input->sample_spec);
     if (s->buffer_attr.tlength <= 0)
@@ -971,6 +1414,11 @@ static playback_stream* playback_stream_new(
     int64_t start_index;
     pa_sink_input_new_data data;
     char *memblockq_name;
+#ifdef HAVE_OPUS
+    pa_format_info *opus_format;
+    pa_opus_codec *decoder = NULL;
+    pa_sample_spec opus_ss;
+#endif
 
     pa_assert(c);
     pa_assert(ss);
@@ -999,6 +1447,14 @@ static playback_stream* playback_stream_new(
         }
     }
 
+#ifdef HAVE_OPUS
+    if ((opus_format = take_opus_format(&formats, &opus_ss)) &&
+        !(decoder = pa_opus_decoder_new(&opus_ss, c->protocol->core->mempool))) {
+        *ret = PA_ERR_NOTSUPPORTED;
+        goto out;
+    }
+#endif
+
     pa_sink_input_new_data_init(&data);
 
     pa_proplist_update(data.proplist, PA_UPDATE_REPLACE, p);
@@ -1044,6 +1500,14 @@ static playback_stream* playback_stream_new(
     s->is_underrun = true;
     s->drain_request = false;
     pa_atomic_store(&s->missing, 0);
+    s->reply_serial = UINT64_MAX;
+    s->timing_page = NULL;
+    s->timing_page_data = NULL;
+    memset(&s->timing_snapshot, 0, sizeof(s->timing_snapshot));
+    s->data_ring = NULL;
+    pa_zero(s->data_ring_rb);
+    s->data_ring_sem = NULL;
+    s->data_ring_item = NULL;
     s->buffer_attr_req = *a;
     s->adjust_latency = adjust_latency;
     s->early_requests = early_requests;
@@ -1060,8 +1524,17 @@ static playback_stream* playback_stream_new(
     s->sink_input->moving = sink_input_moving_cb;
     s->sink_input->suspend = sink_input_suspend_cb;
     s->sink_input->send_event = sink_input_send_event_cb;
+    s->sink_input->attach = sink_input_attach_cb;
+    s->sink_input->detach = sink_input_detach_cb;
     s->sink_input->userdata = s;
 
+#ifdef HAVE_OPUS
+    s->decoder = decoder;
+    s->opus_format = opus_format;
+    decoder = NULL;
+    opus_format = NULL;
+#endif
+
     start_index = ssync ? pa_memblockq_get_read_index(ssync->memblockq) : 0;
 
     fix_playback_buffer_attr(s);
@@ -1106,6 +1579,13 @@ out:
     if (formats)
         pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
 
+#ifdef HAVE_OPUS
+    if (decoder)
+        pa_opus_codec_free(decoder);
+    if (opus_format)
+        pa_format_info_free(opus_format);
+#endif
+
     return s;
 }
 
@@ -1169,6 +1649,46 @@ static int native_connection_process_msg(pa_msgobject *o, int code, void*userdat
     return 0;
 }
 
+static void free_pending_event(pa_native_connection *c, pending_event *e) {
+    pa_assert(c);
+    pa_assert(e);
+
+    if (c->last_pending_event == e)
+        c->last_pending_event = e->prev;
+
+    PA_LLIST_REMOVE(pending_event, c->pending_events, e);
+    pa_xfree(e);
+}
+
+/* Called from main context */
+static void meter_slot_free(meter_slot *m) {
+    pa_assert(m);
+    pa_assert(m->meter);
+
+    switch (m->facility) {
+        case PA_SUBSCRIPTION_EVENT_SINK:
+            pa_sink_remove_meter(PA_SINK(m->object), m->meter);
+            break;
+
+        case PA_SUBSCRIPTION_EVENT_SOURCE:
+            pa_source_remove_meter(PA_SOURCE(m->object), m->meter);
+            break;
+
+        case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+            pa_sink_input_remove_meter(PA_SINK_INPUT(m->object), m->meter);
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+
+    pa_meter_free(m->meter);
+    pa_msgobject_unref(m->object);
+
+    m->meter = NULL;
+    m->object = NULL;
+}
+
 /* Called from main context */
 static void native_connection_unlink(pa_native_connection *c) {
     record_stream *r;
@@ -1181,9 +1701,6 @@ static void native_connection_unlink(pa_native_connection *c) {
 
     pa_hook_fire(&c->protocol->hooks[PA_NATIVE_HOOK_CONNECTION_UNLINK], c);
 
-    if (c->options)
-        pa_native_options_unref(c->options);
-
     if (c->srbpending)
         pa_srbchannel_free(c->srbpending);
 
@@ -1196,9 +1713,43 @@ static void native_connection_unlink(pa_native_connection *c) {
         else
             upload_stream_unlink(UPLOAD_STREAM(o));
 
+    if (c->options) {
+        /* Unref only now, unlinking the streams above may still trace */
+        if (c->options->trace) {
+            pa_native_trace_record rec;
+
+            pa_zero(rec);
+            rec.type = PA_NATIVE_TRACE_CLIENT_FREE;
+            trace_record(c, &rec);
+        }
+
+        pa_native_options_unref(c->options);
+    }
+
     if (c->subscription)
         pa_subscription_free(c->subscription);
 
+    while (c->pending_events)
+        free_pending_event(c, c->pending_events);
+
+    if (c->meter_page) {
+        unsigned k;
+
+        for (k = 0; k < PA_NATIVE_METER_SLOTS; k++)
+            if (c->meters[k].meter)
+                meter_slot_free(&c->meters[k]);
+
+        pa_memblock_release(c->meter_page);
+        pa_memblock_unref(c->meter_page);
+        c->meter_page = NULL;
+        c->meter_page_data = NULL;
+    }
+
+    if (c->subscription_event) {
+        c->protocol->core->mainloop->time_free(c->subscription_event);
+        c->subscription_event = NULL;
+    }
+
     if (c->pstream)
         pa_pstream_unlink(c->pstream);
 
@@ -1207,6 +1758,11 @@ static void native_connection_unlink(pa_native_connection *c) {
         c->auth_timeout_event = NULL;
     }
 
+    if (c->request_event) {
+        c->protocol->core->mainloop->defer_free(c->request_event);
+        c->request_event = NULL;
+    }
+
     pa_assert_se(pa_idxset_remove_by_data(c->protocol->connections, c, NULL) == c);
     c->protocol = NULL;
     pa_native_connection_unref(c);
@@ -1258,57 +1814,315 @@ static void native_connection_send_memblock(pa_native_connection *c) {
 
             pa_pstream_send_memblock(c->pstream, r->index, 0, PA_SEEK_RELATIVE, &schunk);
 
-            pa_memblockq_drop(r->memblockq, schunk.length);
-            pa_memblock_unref(schunk.memblock);
+            pa_memblockq_drop(r->memblockq, schunk.length);
+            pa_memblock_unref(schunk.memblock);
+
+            return;
+        }
+    }
+}
+
+/*** sink input callbacks ***/
+
+/* Called from thread context */
+static void handle_seek(playback_stream *s, int64_t indexw) {
+    playback_stream_assert_ref(s);
+
+/*     pa_log("handle_seek: %llu -- %i", (unsigned long long) s->sink_input->thread_info.underrun_for, pa_memblockq_is_readable(s->memblockq)); */
+
+    if (s->sink_input->thread_info.underrun_for > 0) {
+
+/*         pa_log("%lu vs. %lu", (unsigned long) pa_memblockq_get_length(s->memblockq), (unsigned long) pa_memblockq_get_prebuf(s->memblockq)); */
+
+        if (pa_memblockq_is_readable(s->memblockq)) {
+
+            /* We just ended an underrun, let's ask the sink
+             * for a complete rewind rewrite */
+
+            pa_log_debug("Requesting rewind due to end of underrun.");
+            pa_sink_input_request_rewind(s->sink_input,
+                                         (size_t) (s->sink_input->thread_info.underrun_for == (uint64_t) -1 ? 0 :
+                                                   s->sink_input->thread_info.underrun_for),
+                                         false, true, false);
+        }
+
+    } else {
+        int64_t indexr;
+
+        indexr = pa_memblockq_get_read_index(s->memblockq);
+
+        if (indexw < indexr) {
+            /* OK, the sink already asked for this data, so
+             * let's have it ask us again */
+
+            pa_log_debug("Requesting rewind due to rewrite.");
+            pa_sink_input_request_rewind(s->sink_input, (size_t) (indexr - indexw), true, false, false);
+        }
+    }
+
+    playback_stream_request_bytes(s);
+}
+
+static void flush_write_no_account(pa_memblockq *q) {
+    pa_memblockq_flush_write(q, false);
+}
+
+/* Called from thread context */
+static void playback_stream_update_timing_page(playback_stream *s) {
+    pa_native_timing_page *p, *shared;
+    pa_sink_input *i;
+
+    playback_stream_assert_ref(s);
+
+    p = &s->timing_snapshot;
+    i = s->sink_input;
+
+    /* Make the sequence number odd while we write, see native-common.h */
+    pa_atomic_inc(&p->seq);
+
+    p->playing =
+        i->thread_info.playing_for > 0 &&
+        i->sink->thread_info.state == PA_SINK_RUNNING &&
+        i->thread_info.state == PA_SINK_INPUT_RUNNING;
+    p->write_index = pa_memblockq_get_write_index(s->memblockq);
+    p->read_index = pa_memblockq_get_read_index(s->memblockq);
+    p->sink_usec =
+        pa_sink_get_latency_within_thread(i->sink, false) +
+        pa_bytes_to_usec(pa_memblockq_get_length(i->thread_info.render_memblockq), &i->sink->sample_spec);
+    p->underrun_for = i->thread_info.underrun_for;
+    p->playing_for = i->thread_info.playing_for;
+    p->timestamp = pa_rtclock_now();
+
+    pa_atomic_inc(&p->seq);
+
+    if (!(shared = s->timing_page_data))
+        return;
+
+    pa_atomic_inc(&shared->seq);
+
+    shared->playing = p->playing;
+    shared->write_index = p->write_index;
+    shared->read_index = p->read_index;
+    shared->sink_usec = p->sink_usec;
+    shared->underrun_for = p->underrun_for;
+    shared->playing_for = p->playing_for;
+    shared->timestamp = p->timestamp;
+
+    pa_atomic_inc(&shared->seq);
+}
+
+/* Called from main context. Returns false if the snapshot may not match
+ * what SINK_INPUT_MESSAGE_UPDATE_LATENCY would find, i.e. if it is too
+ * old, if data or seeks are still queued for the sink thread, or if the
+ * stream changed state since. */
+static bool playback_stream_read_timing_snapshot(playback_stream *s, bool running, pa_native_timing_page *r) {
+    const pa_native_timing_page *p;
+    bool playing;
+    unsigned tries;
+    pa_usec_t now;
+
+    playback_stream_assert_ref(s);
+    pa_assert(r);
+
+    if (pa_atomic_load(&s->seek_or_post_in_queue) > 0)
+        return false;
+
+    p = &s->timing_snapshot;
+
+    for (tries = 0;; tries++) {
+        int seq;
+
+        if (tries >= TIMING_SNAPSHOT_READ_TRIES)
+            return false;
+
+        if ((seq = pa_atomic_load(&p->seq)) & 1)
+            continue;
+
+        r->playing = p->playing;
+        r->write_index = p->write_index;
+        r->read_index = p->read_index;
+        r->sink_usec = p->sink_usec;
+        r->underrun_for = p->underrun_for;
+        r->playing_for = p->playing_for;
+        r->timestamp = p->timestamp;
+
+        if (pa_atomic_load(&p->seq) == seq)
+            break;
+    }
+
+    /* Nothing was published yet, or the state changed in between */
+    playing = running && r->playing_for > 0;
+    if (r->timestamp == 0 || !!r->playing != playing)
+        return false;
+
+    now = pa_rtclock_now();
+
+    if (r->timestamp > now || now - r->timestamp > TIMING_SNAPSHOT_MAX_AGE_USEC)
+        return false;
+
+    /* The read index has not moved since, so whatever was in the sink
+     * then has been playing for as long */
+    if (playing) {
+        pa_usec_t age = now - r->timestamp;
+
+        r->sink_usec = r->sink_usec > age ? r->sink_usec - age : 0;
+    }
+
+    return true;
+}
+
+/* Called from thread context */
+static void playback_stream_push(playback_stream *s, const pa_memchunk *chunk) {
+    if (pa_memblockq_push_align(s->memblockq, chunk) < 0) {
+        if (pa_log_ratelimit(PA_LOG_WARN))
+            pa_log_warn("Failed to push data into queue");
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_OVERFLOW, NULL, 0, NULL, NULL);
+        pa_memblockq_seek(s->memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, true);
+    }
+}
+
+/* Called from thread context */
+static void playback_stream_remove_data_ring_item(playback_stream *s) {
+    if (!s->data_ring_item)
+        return;
+
+    pa_rtpoll_item_free(s->data_ring_item);
+    s->data_ring_item = NULL;
+}
+
+/* Called from thread context. Moves all complete records from the data
+ * ring into the queue. The client may scribble over the shared memory
+ * at will, so everything read from it is checked, and the ring is
+ * given up on for good if it stops making sense. */
+static void playback_stream_drain_data_ring(playback_stream *s) {
+    pa_ringbuffer *rb = &s->data_ring_rb;
+    size_t frame_size;
+    int64_t windex;
+    bool pushed = false;
+
+    if (!rb->memory)
+        return;
+
+    frame_size = pa_frame_size(&s->sink_input->sample_spec);
+    windex = pa_memblockq_get_write_index(s->memblockq);
+
+    for (;;) {
+        pa_native_data_record r;
+        pa_memchunk chunk;
+        int count;
+
+        count = pa_atomic_load(rb->count);
+
+        if (count < 0 || count > rb->capacity)
+            goto fail;
+
+        if ((size_t) count < sizeof(r))
+            break;
+
+        pa_ringbuffer_copy_out(rb, 0, &r, sizeof(r));
+
+        if (r.seek > PA_SEEK_RELATIVE_END ||
+            r.length % frame_size != 0 ||
+            r.offset % (int64_t) frame_size != 0 ||
+            r.length > (uint32_t) count - sizeof(r))
+            goto fail;
+
+        if (r.seek != PA_SEEK_RELATIVE || r.offset != 0) {
+            pa_memblockq_seek(s->memblockq, r.offset, r.seek, r.seek == PA_SEEK_RELATIVE);
+            windex = PA_MIN(windex, pa_memblockq_get_write_index(s->memblockq));
+        }
+
+        if (r.length > 0) {
+            chunk.memblock = pa_memblock_new(s->sink_input->core->mempool, r.length);
+            chunk.index = 0;
+            chunk.length = r.length;
+
+            pa_ringbuffer_copy_out(rb, sizeof(r), pa_memblock_acquire(chunk.memblock), (int) r.length);
+            pa_memblock_release(chunk.memblock);
+
+            playback_stream_push(s, &chunk);
+            pa_memblock_unref(chunk.memblock);
+        }
+
+        pa_ringbuffer_drop(rb, (int) (sizeof(r) + r.length));
+        pushed = true;
+    }
+
+    goto finish;
+
+fail:
+    pa_log_warn("Client corrupted the data ring of '%s', not using it anymore.",
+                pa_strnull(pa_proplist_gets(s->sink_input->proplist, PA_PROP_MEDIA_NAME)));
+    pa_zero(*rb);
+    playback_stream_remove_data_ring_item(s);
+
+finish:
+    if (!pushed)
+        return;
 
-            return;
-        }
-    }
+    /* Leave the rewind to the POST_DATA that is still to come, if any */
+    if (s->seek_windex != -1)
+        s->seek_windex = PA_MIN(s->seek_windex, windex);
+    else
+        handle_seek(s, windex);
 }
 
-/*** sink input callbacks ***/
-
 /* Called from thread context */
-static void handle_seek(playback_stream *s, int64_t indexw) {
+static int data_ring_work_cb(pa_rtpoll_item *i) {
+    playback_stream *s = pa_rtpoll_item_get_userdata(i);
+    int64_t windex;
+
     playback_stream_assert_ref(s);
 
-/*     pa_log("handle_seek: %llu -- %i", (unsigned long long) s->sink_input->thread_info.underrun_for, pa_memblockq_is_readable(s->memblockq)); */
+    windex = pa_memblockq_get_write_index(s->memblockq);
+    playback_stream_drain_data_ring(s);
 
-    if (s->sink_input->thread_info.underrun_for > 0) {
+    /* Have the sink act on a rewind we might have requested before it
+     * goes back to sleep */
+    return pa_memblockq_get_write_index(s->memblockq) != windex ? 1 : 0;
+}
 
-/*         pa_log("%lu vs. %lu", (unsigned long) pa_memblockq_get_length(s->memblockq), (unsigned long) pa_memblockq_get_prebuf(s->memblockq)); */
+/* Called from thread context */
+static int data_ring_before_cb(pa_rtpoll_item *i) {
+    playback_stream *s = pa_rtpoll_item_get_userdata(i);
 
-        if (pa_memblockq_is_readable(s->memblockq)) {
+    if (pa_fdsem_before_poll(s->data_ring_sem) < 0)
+        return 1; /* 1 means immediate restart of the loop */
 
-            /* We just ended an underrun, let's ask the sink
-             * for a complete rewind rewrite */
+    return 0;
+}
 
-            pa_log_debug("Requesting rewind due to end of underrun.");
-            pa_sink_input_request_rewind(s->sink_input,
-                                         (size_t) (s->sink_input->thread_info.underrun_for == (uint64_t) -1 ? 0 :
-                                                   s->sink_input->thread_info.underrun_for),
-                                         false, true, false);
-        }
+/* Called from thread context */
+static void data_ring_after_cb(pa_rtpoll_item *i) {
+    playback_stream *s = pa_rtpoll_item_get_userdata(i);
 
-    } else {
-        int64_t indexr;
+    pa_fdsem_after_poll(s->data_ring_sem);
+}
 
-        indexr = pa_memblockq_get_read_index(s->memblockq);
+/* Called from thread context */
+static void playback_stream_add_data_ring_item(playback_stream *s) {
+    pa_rtpoll *rtpoll;
+    struct pollfd *pollfd;
 
-        if (indexw < indexr) {
-            /* OK, the sink already asked for this data, so
-             * let's have it ask us again */
+    pa_assert(!s->data_ring_item);
 
-            pa_log_debug("Requesting rewind due to rewrite.");
-            pa_sink_input_request_rewind(s->sink_input, (size_t) (indexr - indexw), true, false, false);
-        }
-    }
+    if (!s->data_ring_rb.memory || !s->data_ring_sem)
+        return;
 
-    playback_stream_request_bytes(s);
-}
+    /* Sinks without an rtpoll still drain the ring whenever they render */
+    if (!(rtpoll = s->sink_input->sink->thread_info.rtpoll))
+        return;
 
-static void flush_write_no_account(pa_memblockq *q) {
-    pa_memblockq_flush_write(q, false);
+    s->data_ring_item = pa_rtpoll_item_new(rtpoll, PA_RTPOLL_NORMAL, 1);
+
+    pollfd = pa_rtpoll_item_get_pollfd(s->data_ring_item, NULL);
+    pollfd->fd = pa_fdsem_get(s->data_ring_sem);
+    pollfd->events = POLLIN;
+
+    pa_rtpoll_item_set_userdata(s->data_ring_item, s);
+    pa_rtpoll_item_set_work_callback(s->data_ring_item, data_ring_work_cb);
+    pa_rtpoll_item_set_before_callback(s->data_ring_item, data_ring_before_cb);
+    pa_rtpoll_item_set_after_callback(s->data_ring_item, data_ring_after_cb);
 }
 
 /* Called from thread context */
@@ -1320,6 +2134,10 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
     s = PLAYBACK_STREAM(i->userdata);
     playback_stream_assert_ref(s);
 
+    /* Whatever the client put into the ring came before anything we are
+     * told now */
+    playback_stream_drain_data_ring(s);
+
     switch (code) {
 
         case SINK_INPUT_MESSAGE_SEEK:
@@ -1335,12 +2153,8 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
                 windex = PA_MIN(windex, pa_memblockq_get_write_index(s->memblockq));
             }
 
-            if (chunk && pa_memblockq_push_align(s->memblockq, chunk) < 0) {
-                if (pa_log_ratelimit(PA_LOG_WARN))
-                    pa_log_warn("Failed to push data into queue");
-                pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_OVERFLOW, NULL, 0, NULL, NULL);
-                pa_memblockq_seek(s->memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, true);
-            }
+            if (chunk)
+                playback_stream_push(s, chunk);
 
             /* If more data is in queue, we rewind later instead. */
             if (s->seek_windex != -1)
@@ -1409,6 +2223,7 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
                 }
             }
 
+            playback_stream_update_timing_page(s);
             return 0;
         }
 
@@ -1457,6 +2272,29 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
             pa_memblockq_get_attr(s->memblockq, &s->buffer_attr);
             return 0;
         }
+
+        case SINK_INPUT_MESSAGE_SET_TIMING_PAGE:
+            s->timing_page_data = userdata;
+            playback_stream_update_timing_page(s);
+            return 0;
+
+        case SINK_INPUT_MESSAGE_SET_DATA_RING: {
+            pa_native_data_ring *ring = userdata;
+
+            s->data_ring_rb.count = &ring->count;
+            s->data_ring_rb.capacity = (int) offset;
+            s->data_ring_rb.memory = (uint8_t*) ring + PA_ALIGN(sizeof(pa_native_data_ring));
+            s->data_ring_rb.readindex = s->data_ring_rb.writeindex = 0;
+
+            if (i->thread_info.attached)
+                playback_stream_add_data_ring_item(s);
+
+            return 0;
+        }
+
+        case SINK_INPUT_MESSAGE_SYNC_DATA_RING:
+            /* The ring was drained above, that's all */
+            return 0;
     }
 
     return pa_sink_input_process_msg(o, code, userdata, offset, chunk);
@@ -1510,6 +2348,8 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_log("%s, pop(): %lu", pa_proplist_gets(i->proplist, PA_PROP_MEDIA_NAME), (unsigned long) pa_memblockq_get_length(s->memblockq));
 #endif
 
+    playback_stream_drain_data_ring(s);
+
     if (!handle_input_underrun(s, false))
         s->is_underrun = false;
 
@@ -1525,6 +2365,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_memblockq_drop(s->memblockq, chunk->length);
     playback_stream_request_bytes(s);
+    playback_stream_update_timing_page(s);
 
     return 0;
 }
@@ -1614,6 +2455,28 @@ static void sink_input_send_event_cb(pa_sink_input *i, const char *event, pa_pro
     pa_pstream_send_tagstruct(s->connection->pstream, t);
 }
 
+/* Called from thread context */
+static void sink_input_attach_cb(pa_sink_input *i) {
+    playback_stream *s;
+
+    pa_sink_input_assert_ref(i);
+    s = PLAYBACK_STREAM(i->userdata);
+    playback_stream_assert_ref(s);
+
+    playback_stream_add_data_ring_item(s);
+}
+
+/* Called from thread context */
+static void sink_input_detach_cb(pa_sink_input *i) {
+    playback_stream *s;
+
+    pa_sink_input_assert_ref(i);
+    s = PLAYBACK_STREAM(i->userdata);
+    playback_stream_assert_ref(s);
+
+    playback_stream_remove_data_ring_item(s);
+}
+
 /* Called from main context */
 static void sink_input_suspend_cb(pa_sink_input *i, bool suspend) {
     playback_stream *s;
@@ -1902,6 +2765,8 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
     }
 
     CHECK_VALIDITY_GOTO(c->pstream, c->authorized, tag, PA_ERR_ACCESS, finish);
+    CHECK_VALIDITY_GOTO(c->pstream, request_rate_ok(c), tag, PA_ERR_BUSY, finish);
+    CHECK_VALIDITY_GOTO(c->pstream, streams_quota_ok(c) && buffer_quota_ok(c, 1), tag, PA_ERR_TOOLARGE, finish);
     CHECK_VALIDITY_GOTO(c->pstream, !sink_name || pa_namereg_is_valid_name_or_wildcard(sink_name, PA_NAMEREG_SINK), tag, PA_ERR_INVALID, finish);
     CHECK_VALIDITY_GOTO(c->pstream, sink_index == PA_INVALID_INDEX || !sink_name, tag, PA_ERR_INVALID, finish);
     CHECK_VALIDITY_GOTO(c->pstream, !sink_name || sink_index == PA_INVALID_INDEX, tag, PA_ERR_INVALID, finish);
@@ -2027,7 +2892,10 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
         }
     }
 
+    /* The stream memblockq keeps the history for rewinds anyway, so
+     * there's no need to keep it a second time after resampling */
     flags =
+        PA_SINK_INPUT_NO_RENDER_HISTORY |
         (corked ? PA_SINK_INPUT_START_CORKED : 0) |
         (no_remap ? PA_SINK_INPUT_NO_REMAP : 0) |
         (no_remix ? PA_SINK_INPUT_NO_REMIX : 0) |
@@ -2088,6 +2956,11 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
 
     if (c->version >= 21) {
         /* Send back the format we negotiated */
+#ifdef HAVE_OPUS
+        if (s->opus_format)
+            pa_tagstruct_put_format_info(reply, s->opus_format);
+        else
+#endif
         if (s->sink_input->format)
             pa_tagstruct_put_format_info(reply, s->sink_input->format);
         else {
@@ -2098,6 +2971,10 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
     }
 
     pa_pstream_send_tagstruct(c->pstream, reply);
+    s->reply_serial = pa_pstream_get_queue_serial(c->pstream);
+
+    trace_stream(c, PA_NATIVE_TRACE_PLAYBACK_STREAM, s->index, &ss, &map, &s->buffer_attr,
+                 corked, adjust_latency, early_requests, variable_rate, dont_inhibit_auto_suspend, fail_on_suspend);
 
 finish:
     if (p)
@@ -2224,6 +3101,8 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
     }
 
     CHECK_VALIDITY_GOTO(c->pstream, c->authorized, tag, PA_ERR_ACCESS, finish);
+    CHECK_VALIDITY_GOTO(c->pstream, request_rate_ok(c), tag, PA_ERR_BUSY, finish);
+    CHECK_VALIDITY_GOTO(c->pstream, streams_quota_ok(c) && buffer_quota_ok(c, 1), tag, PA_ERR_TOOLARGE, finish);
     CHECK_VALIDITY_GOTO(c->pstream, !source_name || pa_namereg_is_valid_name_or_wildcard(source_name, PA_NAMEREG_SOURCE), tag, PA_ERR_INVALID, finish);
     CHECK_VALIDITY_GOTO(c->pstream, source_index == PA_INVALID_INDEX || !source_name, tag, PA_ERR_INVALID, finish);
     CHECK_VALIDITY_GOTO(c->pstream, !source_name || source_index == PA_INVALID_INDEX, tag, PA_ERR_INVALID, finish);
@@ -2368,6 +3247,8 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
         (passthrough ? PA_SOURCE_OUTPUT_PASSTHROUGH : 0);
 
     s = record_stream_new(c, source, &ss, &map, formats, &attr, volume_set ? &volume : NULL, muted, muted_set, flags, p, adjust_latency, early_requests, relative_volume, peak_detect, direct_on_input, &ret);
+    /* We no longer own the formats idxset */
+    formats = NULL;
 
     CHECK_VALIDITY_GOTO(c->pstream, s, tag, ret, finish);
 
@@ -2402,6 +3283,11 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
 
     if (c->version >= 22) {
         /* Send back the format we negotiated */
+#ifdef HAVE_OPUS
+        if (s->opus_format)
+            pa_tagstruct_put_format_info(reply, s->opus_format);
+        else
+#endif
         if (s->source_output->format)
             pa_tagstruct_put_format_info(reply, s->source_output->format);
         else {
@@ -2413,6 +3299,9 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
 
     pa_pstream_send_tagstruct(c->pstream, reply);
 
+    trace_stream(c, PA_NATIVE_TRACE_RECORD_STREAM, s->index, &ss, &map, &s->buffer_attr,
+                 corked, adjust_latency, early_requests, variable_rate, dont_inhibit_auto_suspend, fail_on_suspend);
+
 finish:
     if (p)
         pa_proplist_free(p);
@@ -2474,7 +3363,8 @@ static void setup_srbchannel(pa_native_connection *c, pa_mem_type_t shm_type) {
         return;
     }
 
-    if (!(c->rw_mempool = pa_mempool_new(shm_type, c->protocol->core->shm_size, true))) {
+    if (!(c->rw_mempool = pa_mempool_new_with_slot_sizes(shm_type, c->protocol->core->shm_size, true,
+                                                        c->protocol->core->shm_slot_sizes, c->protocol->core->n_shm_slot_sizes))) {
         pa_log_warn("Disabling srbchannel, reason: Failed to allocate shared "
                     "writable memory pool.");
         return;
@@ -2534,6 +3424,50 @@ static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32
     c->srbpending = NULL;
 }
 
+#ifdef HAVE_CREDS
+struct auth_group_entry {
+    gid_t gid;
+    bool member;
+    pa_usec_t until;
+};
+
+/* Looking up a group can mean asking a directory service, which blocks
+ * the main thread. When many clients connect at once, e.g. after the
+ * session started, only do that once per user. */
+static bool creds_in_auth_group(pa_native_options *o, const pa_creds *creds) {
+    struct auth_group_entry *e;
+    pa_usec_t now;
+    int r;
+
+    pa_assert(o);
+    pa_assert(o->auth_group);
+    pa_assert(creds);
+
+    now = pa_rtclock_now();
+
+    if (!o->auth_group_cache)
+        o->auth_group_cache = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL, pa_xfree);
+
+    if (!(e = pa_hashmap_get(o->auth_group_cache, PA_UINT32_TO_PTR(creds->uid)))) {
+        e = pa_xnew0(struct auth_group_entry, 1);
+        pa_hashmap_put(o->auth_group_cache, PA_UINT32_TO_PTR(creds->uid), e);
+    }
+
+    if (now >= e->until) {
+        if ((e->gid = pa_get_gid_of_group(o->auth_group)) == (gid_t) -1)
+            pa_log_warn("Failed to get GID of group '%s'", o->auth_group);
+
+        if ((r = pa_uid_in_group(creds->uid, o->auth_group)) < 0)
+            pa_log_warn("Failed to check group membership.");
+
+        e->member = r > 0;
+        e->until = now + AUTH_GROUP_CACHE_USEC;
+    }
+
+    return (e->gid != (gid_t) -1 && e->gid == creds->gid) || e->member;
+}
+#endif
+
 static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     const void*cookie;
@@ -2587,22 +3521,8 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
         if ((creds = pa_pdispatch_creds(pd))) {
             if (creds->uid == getuid())
                 success = true;
-            else if (c->options->auth_group) {
-                int r;
-                gid_t gid;
-
-                if ((gid = pa_get_gid_of_group(c->options->auth_group)) == (gid_t) -1)
-                    pa_log_warn("Failed to get GID of group '%s'", c->options->auth_group);
-                else if (gid == creds->gid)
-                    success = true;
-
-                if (!success) {
-                    if ((r = pa_uid_in_group(creds->uid, c->options->auth_group)) < 0)
-                        pa_log_warn("Failed to check group membership.");
-                    else if (r > 0)
-                        success = true;
-                }
-            }
+            else if (c->options->auth_group)
+                success = creds_in_auth_group(c->options, creds);
 
             pa_log_info("Got credentials: uid=%lu gid=%lu success=%i",
                         (unsigned long) creds->uid,
@@ -2658,6 +3578,9 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_log_debug("Negotiated SHM: %s", pa_yes_no(do_shm));
     pa_pstream_enable_shm(c->pstream, do_shm);
 
+    if (do_shm && c->version >= 33)
+        pa_pstream_set_max_exports(c->pstream, PA_MEMEXPORT_SLOTS_MAX);
+
     /* Do not declare memfd support for 9.0 client libraries (protocol v31).
      *
      * Although they support memfd transport, such 9.0 clients has an iochannel
@@ -2776,6 +3699,7 @@ static void command_lookup(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_
     }
 
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, request_rate_ok(c), tag, PA_ERR_BUSY);
     CHECK_VALIDITY(c->pstream, name && pa_namereg_is_valid_name_or_wildcard(name, command == PA_COMMAND_LOOKUP_SINK ? PA_NAMEREG_SINK : PA_NAMEREG_SOURCE), tag, PA_ERR_INVALID);
 
     if (command == PA_COMMAND_LOOKUP_SINK) {
@@ -2835,6 +3759,7 @@ static void command_stat(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     }
 
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, request_rate_ok(c), tag, PA_ERR_BUSY);
 
     stat = pa_mempool_get_stat(c->protocol->core->mempool);
 
@@ -2847,58 +3772,381 @@ static void command_stat(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
+/* Called from main context. Puts the timing fields of a playback latency
+ * reply, tv is the time the client sent with its request. */
+static void playback_stream_put_latency(playback_stream *s, pa_tagstruct *reply, const struct timeval *tv) {
+    struct timeval now;
+    pa_native_timing_page snapshot;
+    bool running;
+
+    playback_stream_assert_ref(s);
+
+    running =
+        pa_sink_get_state(s->sink_input->sink) == PA_SINK_RUNNING &&
+        pa_sink_input_get_state(s->sink_input) == PA_SINK_INPUT_RUNNING;
+
+    /* Get an atomic snapshot of all timing parameters, from what the
+     * sink thread published last if that is still accurate */
+    if (!playback_stream_read_timing_snapshot(s, running, &snapshot)) {
+        pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_UPDATE_LATENCY, s, 0, NULL) == 0);
+
+        snapshot.playing = s->playing_for > 0 && running;
+        snapshot.write_index = s->write_index;
+        snapshot.read_index = s->read_index;
+        snapshot.sink_usec =
+            s->current_sink_latency +
+            pa_bytes_to_usec(s->render_memblockq_length, &s->sink_input->sink->sample_spec);
+        snapshot.underrun_for = s->underrun_for;
+        snapshot.playing_for = s->playing_for;
+    }
+
+    pa_tagstruct_put_usec(reply, snapshot.sink_usec);
+    pa_tagstruct_put_usec(reply, 0);
+    pa_tagstruct_put_boolean(reply, !!snapshot.playing);
+    pa_tagstruct_put_timeval(reply, tv);
+    pa_tagstruct_put_timeval(reply, pa_gettimeofday(&now));
+    pa_tagstruct_puts64(reply, snapshot.write_index);
+    pa_tagstruct_puts64(reply, snapshot.read_index);
+
+    if (s->connection->version >= 13) {
+        pa_tagstruct_putu64(reply, snapshot.underrun_for);
+        pa_tagstruct_putu64(reply, snapshot.playing_for);
+    }
+}
+
+/* Called from main context. Clients ask for latencies regularly while
+ * playing, which makes it a good moment to follow up on the network. */
+static void follow_network_delay(pa_native_connection *c) {
+    if (update_network_delay(c)) {
+        output_stream *o;
+        uint32_t i;
+
+        PA_IDXSET_FOREACH(o, c->output_streams, i) {
+            playback_stream *p;
+            uint32_t tlength;
+
+            if (!playback_stream_isinstance(o))
+                continue;
+
+            p = PLAYBACK_STREAM(o);
+            tlength = p->buffer_attr.tlength;
+
+            fix_playback_buffer_attr(p);
+
+            if (p->buffer_attr.tlength == tlength)
+                continue;
+
+            pa_assert_se(pa_asyncmsgq_send(p->sink_input->sink->asyncmsgq, PA_MSGOBJECT(p->sink_input), SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR, NULL, 0, NULL) == 0);
+            playback_stream_send_buffer_attr_changed(p);
+        }
+    }
+}
+
 static void command_get_playback_latency(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_tagstruct *reply;
     playback_stream *s;
-    struct timeval tv, now;
+    struct timeval tv;
+    uint32_t idx;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        pa_tagstruct_get_timeval(t, &tv) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    s = pa_idxset_get_by_index(c->output_streams, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+
+    reply = reply_new(tag);
+    playback_stream_put_latency(s, reply, &tv);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+
+    follow_network_delay(c);
+}
+
+static void command_enable_timing_page(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    playback_stream *s;
+    pa_memchunk chunk;
+    uint32_t idx;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    s = pa_idxset_get_by_index(c->output_streams, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, !s->timing_page, tag, PA_ERR_EXIST);
+
+    /* The page is only of use if the client maps it rather than getting a
+     * copy, so we put it into the pool shared with the client for the
+     * srbchannel, which is there only if the pstream does SHM */
+    CHECK_VALIDITY(c->pstream, c->rw_mempool, tag, PA_ERR_NOTSUPPORTED);
+
+    s->timing_page = pa_memblock_new_pool(c->rw_mempool, sizeof(pa_native_timing_page));
+    CHECK_VALIDITY(c->pstream, s->timing_page, tag, PA_ERR_INTERNAL);
+
+    memset(pa_memblock_acquire(s->timing_page), 0, sizeof(pa_native_timing_page));
+    pa_memblock_release(s->timing_page);
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+
+    chunk.memblock = s->timing_page;
+    chunk.index = 0;
+    chunk.length = sizeof(pa_native_timing_page);
+    pa_pstream_send_memblock(c->pstream, s->index, 0, PA_SEEK_RELATIVE, &chunk);
+
+    /* The sink thread keeps the block acquired from now on, we release it
+     * when the stream is freed */
+    pa_asyncmsgq_post(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SET_TIMING_PAGE, pa_memblock_acquire(s->timing_page), 0, NULL, NULL);
+}
+
+static void command_sync_data_ring(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    playback_stream *s;
     uint32_t idx;
 
     pa_native_connection_assert_ref(c);
     pa_assert(t);
 
-    if (pa_tagstruct_getu32(t, &idx) < 0 ||
-        pa_tagstruct_get_timeval(t, &tv) < 0 ||
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    s = pa_idxset_get_by_index(c->output_streams, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+
+    /* Like the timing page the ring has to live in the pool shared with
+     * the client. Data that needs decoding, or that has to end up in all
+     * streams of a sync group at the same time, keeps going over the
+     * pstream. */
+    CHECK_VALIDITY(c->pstream, c->rw_mempool, tag, PA_ERR_NOTSUPPORTED);
+#ifdef HAVE_OPUS
+    CHECK_VALIDITY(c->pstream, !s->decoder, tag, PA_ERR_NOTSUPPORTED);
+#endif
+    CHECK_VALIDITY(c->pstream, !s->sink_input->sync_prev && !s->sink_input->sync_next, tag, PA_ERR_NOTSUPPORTED);
+
+    if (!s->data_ring) {
+#ifdef HAVE_CREDS
+        pa_native_data_ring *ring;
+        pa_memchunk chunk;
+        size_t capacity;
+        int fd;
+
+        s->data_ring = pa_memblock_new_pool(c->rw_mempool, (size_t) -1);
+        CHECK_VALIDITY(c->pstream, s->data_ring, tag, PA_ERR_INTERNAL);
+
+        chunk.memblock = s->data_ring;
+        chunk.index = 0;
+        chunk.length = pa_memblock_get_length(s->data_ring);
+        capacity = chunk.length - PA_ALIGN(sizeof(pa_native_data_ring));
+
+        ring = pa_memblock_acquire(s->data_ring);
+        pa_atomic_store(&ring->count, 0);
+        ring->capacity = (uint32_t) capacity;
+
+        /* Without a way to wake up the sink thread data could sit in
+         * the ring for as long as the sink sleeps */
+        if (!(s->data_ring_sem = pa_fdsem_new_shm(&ring->sem))) {
+            pa_memblock_release(s->data_ring);
+            pa_memblock_unref(s->data_ring);
+            s->data_ring = NULL;
+            pa_pstream_send_error(c->pstream, tag, PA_ERR_NOTSUPPORTED);
+            return;
+        }
+
+        pa_memblock_release(s->data_ring);
+
+        pa_pstream_send_memblock(c->pstream, s->index, PA_NATIVE_DATA_RING_OFFSET, PA_SEEK_RELATIVE, &chunk);
+
+        /* The sink thread keeps the block acquired from now on, we
+         * release it when the stream is freed. It keeps its own idea of
+         * the capacity, since the client could change the header. */
+        pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SET_DATA_RING, pa_memblock_acquire(s->data_ring), (int64_t) capacity, NULL) == 0);
+
+        /* The client gets its end of the semaphore with the reply, we
+         * keep ours open */
+        fd = pa_fdsem_get(s->data_ring_sem);
+        pa_pstream_send_tagstruct_with_fds(c->pstream, reply_new(tag), 1, &fd, false);
+        return;
+#else
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_NOTSUPPORTED);
+        return;
+#endif
+    } else
+        /* Everything the client wrote into the ring before sending us
+         * this is in the queue when this returns */
+        pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SYNC_DATA_RING, NULL, 0, NULL) == 0);
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
+static void command_enable_meter(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_msgobject *object = NULL;
+    pa_meter_levels *levels;
+    pa_tagstruct *reply;
+    meter_slot *m;
+    uint32_t facility, idx, slot;
+    pa_usec_t period;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &facility) < 0 ||
+        pa_tagstruct_getu32(t, &idx) < 0 ||
+        pa_tagstruct_get_usec(t, &period) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream,
+                   facility == PA_SUBSCRIPTION_EVENT_SINK ||
+                   facility == PA_SUBSCRIPTION_EVENT_SOURCE ||
+                   facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT, tag, PA_ERR_INVALID);
+    CHECK_VALIDITY(c->pstream, period >= METER_PERIOD_MIN && period <= METER_PERIOD_MAX, tag, PA_ERR_INVALID);
+
+    if (facility == PA_SUBSCRIPTION_EVENT_SINK) {
+        pa_sink *sink;
+
+        if ((sink = pa_idxset_get_by_index(c->protocol->core->sinks, idx)) && PA_SINK_IS_LINKED(sink->state))
+            object = PA_MSGOBJECT(sink);
+
+    } else if (facility == PA_SUBSCRIPTION_EVENT_SOURCE) {
+        pa_source *source;
+
+        if ((source = pa_idxset_get_by_index(c->protocol->core->sources, idx)) && PA_SOURCE_IS_LINKED(source->state))
+            object = PA_MSGOBJECT(source);
+
+    } else {
+        pa_sink_input *si;
+
+        if ((si = pa_idxset_get_by_index(c->protocol->core->sink_inputs, idx)) && PA_SINK_INPUT_IS_LINKED(si->state))
+            object = PA_MSGOBJECT(si);
+    }
+
+    CHECK_VALIDITY(c->pstream, object, tag, PA_ERR_NOENTITY);
+
+    /* Like the timing page, the meters have to be mapped by the client */
+    CHECK_VALIDITY(c->pstream, c->rw_mempool, tag, PA_ERR_NOTSUPPORTED);
+
+    for (slot = 0; slot < PA_NATIVE_METER_SLOTS; slot++)
+        if (!c->meters[slot].meter)
+            break;
+
+    CHECK_VALIDITY(c->pstream, slot < PA_NATIVE_METER_SLOTS, tag, PA_ERR_TOOLARGE);
+
+    if (!c->meter_page) {
+        pa_memchunk chunk;
+
+        c->meter_page = pa_memblock_new_pool(c->rw_mempool, sizeof(pa_native_meter_page));
+        CHECK_VALIDITY(c->pstream, c->meter_page, tag, PA_ERR_INTERNAL);
+
+        c->meter_page_data = pa_memblock_acquire(c->meter_page);
+        memset(c->meter_page_data, 0, sizeof(pa_native_meter_page));
+
+        chunk.memblock = c->meter_page;
+        chunk.index = 0;
+        chunk.length = sizeof(pa_native_meter_page);
+        pa_pstream_send_memblock(c->pstream, PA_NATIVE_METER_CHANNEL, 0, PA_SEEK_RELATIVE, &chunk);
+    }
+
+    /* The slot may have been used before, so readers have to see it
+     * change */
+    levels = &c->meter_page_data->slots[slot];
+    pa_atomic_inc(&levels->seq);
+    levels->channels = 0;
+    levels->timestamp = 0;
+    memset(levels->peak, 0, sizeof(levels->peak));
+    memset(levels->rms, 0, sizeof(levels->rms));
+    pa_atomic_inc(&levels->seq);
+
+    m = &c->meters[slot];
+    m->facility = facility;
+    m->object = pa_msgobject_ref(object);
+    m->meter = pa_meter_new(levels, period);
+
+    if (facility == PA_SUBSCRIPTION_EVENT_SINK)
+        pa_sink_add_meter(PA_SINK(object), m->meter);
+    else if (facility == PA_SUBSCRIPTION_EVENT_SOURCE)
+        pa_source_add_meter(PA_SOURCE(object), m->meter);
+    else
+        pa_sink_input_add_meter(PA_SINK_INPUT(object), m->meter);
+
+    reply = reply_new(tag);
+    pa_tagstruct_putu32(reply, slot);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
+static void command_disable_meter(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t slot;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &slot) < 0 ||
         !pa_tagstruct_eof(t)) {
         protocol_error(c);
         return;
     }
 
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
-    s = pa_idxset_get_by_index(c->output_streams, idx);
-    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
-    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, slot < PA_NATIVE_METER_SLOTS && c->meters[slot].meter, tag, PA_ERR_NOENTITY);
+
+    meter_slot_free(&c->meters[slot]);
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
+/* Called from main context. Puts the timing fields of a record latency
+ * reply, tv is the time the client sent with its request. */
+static void record_stream_put_latency(record_stream *s, pa_tagstruct *reply, const struct timeval *tv) {
+    struct timeval now;
+
+    record_stream_assert_ref(s);
 
     /* Get an atomic snapshot of all timing parameters */
-    pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_UPDATE_LATENCY, s, 0, NULL) == 0);
+    pa_assert_se(pa_asyncmsgq_send(s->source_output->source->asyncmsgq, PA_MSGOBJECT(s->source_output), SOURCE_OUTPUT_MESSAGE_UPDATE_LATENCY, s, 0, NULL) == 0);
 
-    reply = reply_new(tag);
+    pa_tagstruct_put_usec(reply, s->current_monitor_latency);
     pa_tagstruct_put_usec(reply,
-                          s->current_sink_latency +
-                          pa_bytes_to_usec(s->render_memblockq_length, &s->sink_input->sink->sample_spec));
-    pa_tagstruct_put_usec(reply, 0);
+                          s->current_source_latency +
+                          pa_bytes_to_usec(s->on_the_fly_snapshot, &s->source_output->sample_spec));
     pa_tagstruct_put_boolean(reply,
-                             s->playing_for > 0 &&
-                             pa_sink_get_state(s->sink_input->sink) == PA_SINK_RUNNING &&
-                             pa_sink_input_get_state(s->sink_input) == PA_SINK_INPUT_RUNNING);
-    pa_tagstruct_put_timeval(reply, &tv);
+                             pa_source_get_state(s->source_output->source) == PA_SOURCE_RUNNING &&
+                             pa_source_output_get_state(s->source_output) == PA_SOURCE_OUTPUT_RUNNING);
+    pa_tagstruct_put_timeval(reply, tv);
     pa_tagstruct_put_timeval(reply, pa_gettimeofday(&now));
-    pa_tagstruct_puts64(reply, s->write_index);
-    pa_tagstruct_puts64(reply, s->read_index);
-
-    if (c->version >= 13) {
-        pa_tagstruct_putu64(reply, s->underrun_for);
-        pa_tagstruct_putu64(reply, s->playing_for);
-    }
-
-    pa_pstream_send_tagstruct(c->pstream, reply);
+    pa_tagstruct_puts64(reply, pa_memblockq_get_write_index(s->memblockq));
+    pa_tagstruct_puts64(reply, pa_memblockq_get_read_index(s->memblockq));
 }
 
 static void command_get_record_latency(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_tagstruct *reply;
     record_stream *s;
-    struct timeval tv, now;
+    struct timeval tv;
     uint32_t idx;
 
     pa_native_connection_assert_ref(c);
@@ -2915,22 +4163,76 @@ static void command_get_record_latency(pa_pdispatch *pd, uint32_t command, uint3
     s = pa_idxset_get_by_index(c->record_streams, idx);
     CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
 
-    /* Get an atomic snapshot of all timing parameters */
-    pa_assert_se(pa_asyncmsgq_send(s->source_output->source->asyncmsgq, PA_MSGOBJECT(s->source_output), SOURCE_OUTPUT_MESSAGE_UPDATE_LATENCY, s, 0, NULL) == 0);
+    reply = reply_new(tag);
+    record_stream_put_latency(s, reply, &tv);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
+/* Called from main context. One reply for the timing of many streams, so
+ * that clients with lots of them don't need a round trip for each. */
+static void command_get_latency_batch(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_tagstruct *reply;
+    struct timeval tv;
+    uint32_t n, k;
+    bool any_playback = false;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_get_timeval(t, &tv) < 0 ||
+        pa_tagstruct_getu32(t, &n) < 0) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
 
     reply = reply_new(tag);
-    pa_tagstruct_put_usec(reply, s->current_monitor_latency);
-    pa_tagstruct_put_usec(reply,
-                          s->current_source_latency +
-                          pa_bytes_to_usec(s->on_the_fly_snapshot, &s->source_output->sample_spec));
-    pa_tagstruct_put_boolean(reply,
-                             pa_source_get_state(s->source_output->source) == PA_SOURCE_RUNNING &&
-                             pa_source_output_get_state(s->source_output) == PA_SOURCE_OUTPUT_RUNNING);
-    pa_tagstruct_put_timeval(reply, &tv);
-    pa_tagstruct_put_timeval(reply, pa_gettimeofday(&now));
-    pa_tagstruct_puts64(reply, pa_memblockq_get_write_index(s->memblockq));
-    pa_tagstruct_puts64(reply, pa_memblockq_get_read_index(s->memblockq));
+
+    for (k = 0; k < n; k++) {
+        uint32_t idx;
+        bool record;
+
+        if (pa_tagstruct_getu32(t, &idx) < 0 ||
+            pa_tagstruct_get_boolean(t, &record) < 0) {
+            pa_tagstruct_free(reply);
+            protocol_error(c);
+            return;
+        }
+
+        /* Streams that are gone are only flagged, so that the client
+         * still gets the timing of all the others */
+        if (record) {
+            record_stream *r = pa_idxset_get_by_index(c->record_streams, idx);
+
+            pa_tagstruct_put_boolean(reply, !!r);
+
+            if (r)
+                record_stream_put_latency(r, reply, &tv);
+        } else {
+            output_stream *o = pa_idxset_get_by_index(c->output_streams, idx);
+            bool valid = o && playback_stream_isinstance(o);
+
+            pa_tagstruct_put_boolean(reply, valid);
+
+            if (valid) {
+                playback_stream_put_latency(PLAYBACK_STREAM(o), reply, &tv);
+                any_playback = true;
+            }
+        }
+    }
+
+    if (!pa_tagstruct_eof(t)) {
+        pa_tagstruct_free(reply);
+        protocol_error(c);
+        return;
+    }
+
     pa_pstream_send_tagstruct(c->pstream, reply);
+
+    if (any_playback)
+        follow_network_delay(c);
 }
 
 static void command_create_upload_stream(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -2960,6 +4262,8 @@ static void command_create_upload_stream(pa_pdispatch *pd, uint32_t command, uin
     CHECK_VALIDITY(c->pstream, map.channels == ss.channels, tag, PA_ERR_INVALID);
     CHECK_VALIDITY(c->pstream, (length % pa_frame_size(&ss)) == 0 && length > 0, tag, PA_ERR_INVALID);
     CHECK_VALIDITY(c->pstream, length <= PA_SCACHE_ENTRY_SIZE_MAX, tag, PA_ERR_TOOLARGE);
+    CHECK_VALIDITY(c->pstream, request_rate_ok(c), tag, PA_ERR_BUSY);
+    CHECK_VALIDITY(c->pstream, streams_quota_ok(c) && buffer_quota_ok(c, length), tag, PA_ERR_TOOLARGE);
 
     p = pa_proplist_new();
 
@@ -3286,6 +4590,11 @@ static void client_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_c
 
     if (c->version >= 13)
         pa_tagstruct_put_proplist(t, client->proplist);
+
+    if (c->version >= 33) {
+        pa_tagstruct_put_usec(t, pa_client_get_render_usec(client));
+        pa_tagstruct_putu64(t, pa_client_get_memory(client));
+    }
 }
 
 static void card_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_card *card) {
@@ -3401,6 +4710,72 @@ static void sink_input_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t,
         pa_tagstruct_put_format_info(t, s->format);
 }
 
+/* Like sink_input_fill_tagstruct(), but only with the fields asked for,
+ * in the order of their flags */
+static void sink_input_fill_tagstruct_filtered(pa_native_connection *c, pa_tagstruct *t, pa_sink_input *s, pa_sink_input_info_field_t fields) {
+    pa_sample_spec fixed_ss;
+
+    pa_assert(t);
+    pa_sink_input_assert_ref(s);
+
+    fixup_sample_spec(c, &fixed_ss, &s->sample_spec);
+
+    pa_tagstruct_putu32(t, s->index);
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_NAME)
+        pa_tagstruct_puts(t, pa_strnull(pa_proplist_gets(s->proplist, PA_PROP_MEDIA_NAME)));
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_OWNER) {
+        pa_tagstruct_putu32(t, s->module ? s->module->index : PA_INVALID_INDEX);
+        pa_tagstruct_putu32(t, s->client ? s->client->index : PA_INVALID_INDEX);
+    }
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_SINK)
+        pa_tagstruct_putu32(t, s->sink->index);
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_SAMPLE_SPEC) {
+        pa_tagstruct_put_sample_spec(t, &fixed_ss);
+        pa_tagstruct_put_channel_map(t, &s->channel_map);
+    }
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_VOLUME) {
+        pa_cvolume v;
+        bool has_volume;
+
+        has_volume = pa_sink_input_is_volume_readable(s);
+        if (has_volume)
+            pa_sink_input_get_volume(s, &v, true);
+        else
+            pa_cvolume_reset(&v, fixed_ss.channels);
+
+        pa_tagstruct_put_cvolume(t, &v);
+        pa_tagstruct_put_boolean(t, s->muted);
+        pa_tagstruct_put_boolean(t, has_volume);
+        pa_tagstruct_put_boolean(t, s->volume_writable);
+    }
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_LATENCY) {
+        pa_usec_t sink_latency;
+
+        pa_tagstruct_put_usec(t, pa_sink_input_get_latency(s, &sink_latency));
+        pa_tagstruct_put_usec(t, sink_latency);
+    }
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_DRIVER) {
+        pa_tagstruct_puts(t, pa_resample_method_to_string(pa_sink_input_get_resample_method(s)));
+        pa_tagstruct_puts(t, s->driver);
+    }
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_CORKED)
+        pa_tagstruct_put_boolean(t, (pa_sink_input_get_state(s) == PA_SINK_INPUT_CORKED));
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_PROPLIST)
+        pa_tagstruct_put_proplist(t, s->proplist);
+
+    if (fields & PA_SINK_INPUT_INFO_FIELD_FORMAT)
+        pa_tagstruct_put_format_info(t, s->format);
+}
+
 static void source_output_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_source_output *s) {
     pa_sample_spec fixed_ss;
     pa_usec_t source_latency;
@@ -3503,6 +4878,7 @@ static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
     }
 
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, request_rate_ok(c), tag, PA_ERR_BUSY);
     CHECK_VALIDITY(c->pstream, !name ||
                    (command == PA_COMMAND_GET_SINK_INFO &&
                     pa_namereg_is_valid_name_or_wildcard(name, PA_NAMEREG_SINK)) ||
@@ -3586,6 +4962,7 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
     }
 
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, request_rate_ok(c), tag, PA_ERR_BUSY);
 
     reply = reply_new(tag);
 
@@ -3634,6 +5011,36 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
+static void command_get_sink_input_info_list_filtered(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_sink_input *si;
+    uint32_t fields, idx;
+    uint64_t since;
+    pa_tagstruct *reply;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &fields) < 0 ||
+        pa_tagstruct_getu64(t, &since) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, (fields & ~PA_SINK_INPUT_INFO_FIELD_ALL) == 0, tag, PA_ERR_INVALID);
+
+    reply = reply_new(tag);
+    pa_tagstruct_putu64(reply, c->protocol->core->change_generation);
+
+    PA_IDXSET_FOREACH(si, c->protocol->core->sink_inputs, idx)
+        if (si->change_generation > since)
+            sink_input_fill_tagstruct_filtered(c, reply, si, fields);
+
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
 static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_tagstruct *reply;
@@ -3650,6 +5057,7 @@ static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t
     }
 
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, request_rate_ok(c), tag, PA_ERR_BUSY);
 
     reply = reply_new(tag);
     pa_tagstruct_puts(reply, PACKAGE_NAME);
@@ -3679,11 +5087,47 @@ static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
-static void subscription_cb(pa_core *core, pa_subscription_event_type_t e, uint32_t idx, void *userdata) {
-    pa_tagstruct *t;
+static void command_get_xrun_event_info_list(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_tagstruct *reply;
+    pa_core *core;
+    uint64_t n;
 
     pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (!pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, c->version >= 33, tag, PA_ERR_NOTSUPPORTED);
+
+    core = c->protocol->core;
+    reply = reply_new(tag);
+
+    /* Oldest first */
+    n = core->n_xrun_events > PA_CORE_XRUN_EVENTS_MAX ? core->n_xrun_events - PA_CORE_XRUN_EVENTS_MAX : 0;
+    for (; n < core->n_xrun_events; n++) {
+        const pa_xrun_event *e = &core->xrun_events[n % PA_CORE_XRUN_EVENTS_MAX];
+        struct timeval tv;
+
+        pa_tagstruct_putu64(reply, e->serial);
+        pa_tagstruct_put_timeval(reply, pa_timeval_store(&tv, e->timestamp));
+        pa_tagstruct_putu32(reply, e->cause);
+        pa_tagstruct_putu32(reply, e->device_type);
+        pa_tagstruct_putu32(reply, e->device_index);
+        pa_tagstruct_putu32(reply, e->stream_index);
+        pa_tagstruct_put_usec(reply, e->watermark_before);
+        pa_tagstruct_put_usec(reply, e->watermark_after);
+    }
+
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
+static void send_subscription_event(pa_native_connection *c, pa_subscription_event_type_t e, uint32_t idx) {
+    pa_tagstruct *t;
 
     t = pa_tagstruct_new();
     pa_tagstruct_putu32(t, PA_COMMAND_SUBSCRIBE_EVENT);
@@ -3693,6 +5137,70 @@ static void subscription_cb(pa_core *core, pa_subscription_event_type_t e, uint3
     pa_pstream_send_tagstruct(c->pstream, t);
 }
 
+/* Called from main context */
+static void flush_subscription_events(pa_native_connection *c) {
+    while (c->pending_events) {
+        send_subscription_event(c, c->pending_events->type, c->pending_events->index);
+        free_pending_event(c, c->pending_events);
+    }
+}
+
+static void subscription_timeout(pa_mainloop_api*m, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+
+    pa_assert(m);
+    pa_native_connection_assert_ref(c);
+    pa_assert(c->subscription_event == e);
+
+    m->time_free(c->subscription_event);
+    c->subscription_event = NULL;
+
+    flush_subscription_events(c);
+}
+
+static void subscription_cb(pa_core *core, pa_subscription_event_type_t e, uint32_t idx, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pending_event *i, *n;
+
+    pa_native_connection_assert_ref(c);
+
+    if (c->options->subscription_coalesce_usec <= 0) {
+        send_subscription_event(c, e, idx);
+        return;
+    }
+
+    /* Collapse events for the same object within the window, much like
+     * pa_subscription_post() does for a single main loop iteration.
+     * Clients will look up the current state anyway. */
+    if ((e & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_NEW) {
+        for (i = c->last_pending_event; i; i = n) {
+            n = i->prev;
+
+            if (((e ^ i->type) & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) || i->index != idx)
+                continue;
+
+            if ((e & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+                free_pending_event(c, i);
+                continue;
+            }
+
+            /* A "new" or "change" event for the object is still pending */
+            return;
+        }
+    }
+
+    i = pa_xnew(pending_event, 1);
+    i->type = e;
+    i->index = idx;
+
+    PA_LLIST_INSERT_AFTER(pending_event, c->pending_events, c->last_pending_event, i);
+    c->last_pending_event = i;
+
+    if (!c->subscription_event)
+        c->subscription_event = pa_core_rttime_new(c->protocol->core, pa_rtclock_now() + c->options->subscription_coalesce_usec,
+                                                   subscription_timeout, c);
+}
+
 static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_subscription_mask_t m;
@@ -3709,6 +5217,9 @@ static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag,
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
     CHECK_VALIDITY(c->pstream, (m & ~PA_SUBSCRIPTION_MASK_ALL) == 0, tag, PA_ERR_INVALID);
 
+    /* Whatever is pending was subscribed to before */
+    flush_subscription_events(c);
+
     if (c->subscription)
         pa_subscription_free(c->subscription);
 
@@ -3957,6 +5468,10 @@ static void command_trigger_or_flush_or_prebuf_playback_stream(pa_pdispatch *pd,
 
     switch (command) {
         case PA_COMMAND_FLUSH_PLAYBACK_STREAM:
+#ifdef HAVE_OPUS
+            if (s->decoder)
+                pa_opus_codec_reset(s->decoder);
+#endif
             pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_FLUSH, NULL, 0, NULL);
             break;
 
@@ -4936,11 +6451,55 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 
     [PA_COMMAND_REGISTER_MEMFD_SHMID] = command_register_memfd_shmid,
 
+    [PA_COMMAND_GET_XRUN_EVENT_INFO_LIST] = command_get_xrun_event_info_list,
+    [PA_COMMAND_GET_SINK_INPUT_INFO_LIST_FILTERED] = command_get_sink_input_info_list_filtered,
+    [PA_COMMAND_ENABLE_TIMING_PAGE] = command_enable_timing_page,
+    [PA_COMMAND_SYNC_DATA_RING] = command_sync_data_ring,
+    [PA_COMMAND_ENABLE_METER] = command_enable_meter,
+    [PA_COMMAND_DISABLE_METER] = command_disable_meter,
+    [PA_COMMAND_GET_LATENCY_BATCH] = command_get_latency_batch,
+
     [PA_COMMAND_EXTENSION] = command_extension
 };
 
 /*** pstream callbacks ***/
 
+/* Called from main context */
+static void trace_packet(pa_native_connection *c, pa_packet *packet) {
+    pa_native_trace_record r;
+    const void *data;
+    size_t length;
+    pa_tagstruct *ts;
+    uint32_t tag;
+
+    pa_zero(r);
+    r.type = PA_NATIVE_TRACE_COMMAND;
+    r.channel = PA_INVALID_INDEX;
+
+    data = pa_packet_data(packet, &length);
+    r.length = (uint32_t) length;
+
+    ts = pa_tagstruct_new_fixed(data, length);
+
+    if (pa_tagstruct_getu32(ts, &r.command) < 0 ||
+        pa_tagstruct_getu32(ts, &tag) < 0) {
+        /* pdispatch will complain about this one */
+        pa_tagstruct_free(ts);
+        return;
+    }
+
+    /* Most commands for one stream start with its channel, and many of
+     * those that take a flag have it right after */
+    if (pa_tagstruct_getu32(ts, &r.channel) < 0)
+        r.channel = PA_INVALID_INDEX;
+    else if (pa_tagstruct_get_boolean(ts, &r.flag) < 0)
+        r.flag = false;
+
+    pa_tagstruct_free(ts);
+
+    trace_record(c, &r);
+}
+
 static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, pa_cmsg_ancil_data *ancil_data, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
 
@@ -4948,6 +6507,9 @@ static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, pa_cmsg_an
     pa_assert(packet);
     pa_native_connection_assert_ref(c);
 
+    if (c->options->trace)
+        trace_packet(c, packet);
+
     if (pa_pdispatch_run(c->pdispatch, packet, ancil_data, c) < 0) {
         pa_log("invalid packet.");
         native_connection_unlink(c);
@@ -4968,6 +6530,18 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
         return;
     }
 
+    if (c->options->trace) {
+        pa_native_trace_record r;
+
+        pa_zero(r);
+        r.type = PA_NATIVE_TRACE_WRITE;
+        r.channel = channel;
+        r.length = (uint32_t) chunk->length;
+        r.offset = offset;
+        r.seek = seek;
+        trace_record(c, &r);
+    }
+
 #ifdef PROTOCOL_NATIVE_DEBUG
     pa_log("got %lu bytes from client", (unsigned long) chunk->length);
 #endif
@@ -4982,6 +6556,22 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
             return;
         }
 
+#ifdef HAVE_OPUS
+        if (ps->decoder) {
+            pa_memchunk decoded;
+
+            /* Seeking makes no sense in a compressed stream, only the data
+             * is of interest */
+            if (!chunk->memblock || pa_opus_codec_process(ps->decoder, chunk, &decoded) < 0 || !decoded.memblock)
+                return;
+
+            pa_atomic_inc(&ps->seek_or_post_in_queue);
+            pa_asyncmsgq_post(ps->sink_input->sink->asyncmsgq, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, &decoded, NULL);
+            pa_memblock_unref(decoded.memblock);
+            return;
+        }
+#endif
+
         pa_atomic_inc(&ps->seek_or_post_in_queue);
         if (chunk->memblock) {
             if (seek != PA_SEEK_RELATIVE || offset != 0)
@@ -5081,6 +6671,16 @@ static void client_kill_cb(pa_client *c) {
     pa_log_info("Connection killed.");
 }
 
+static size_t client_get_memory_cb(pa_client *client) {
+    pa_native_connection *c;
+
+    pa_assert(client);
+    c = PA_NATIVE_CONNECTION(client->userdata);
+    pa_native_connection_assert_ref(c);
+
+    return pa_pstream_get_imported_size(c->pstream);
+}
+
 static void client_send_event_cb(pa_client *client, const char*event, pa_proplist *pl) {
     pa_tagstruct *t;
     pa_native_connection *c;
@@ -5175,8 +6775,25 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
     c->client = client;
     c->client->kill = client_kill_cb;
     c->client->send_event = client_send_event_cb;
+    c->client->get_memory = client_get_memory_cb;
     c->client->userdata = c;
 
+    c->tcp_fd = -1;
+    c->network_delay = 0;
+
+    if (o->client_max_request_rate > 0)
+        PA_INIT_RATELIMIT(c->request_ratelimit, PA_USEC_PER_SEC, o->client_max_request_rate);
+
+    if (o->adaptive_latency && !c->is_local) {
+        c->tcp_fd = pa_iochannel_get_send_fd(io);
+
+        /* Keep the bulk of the stream data in the pstream queue rather
+         * than in the socket, where it would hold up replies to latency
+         * queries and thus skew the timing */
+        pa_socket_set_tcp_notsent_lowat(c->tcp_fd, ADAPTIVE_NOTSENT_LOWAT);
+        update_network_delay(c);
+    }
+
     c->rw_mempool = NULL;
 
     c->pstream = pa_pstream_new(p->core->mainloop, io, p->core->mempool);
@@ -5194,9 +6811,21 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
 
     c->rrobin_index = PA_IDXSET_INVALID;
     c->subscription = NULL;
+    PA_LLIST_HEAD_INIT(pending_event, c->pending_events);
+    c->last_pending_event = NULL;
+    c->subscription_event = NULL;
+    c->request_event = NULL;
 
     pa_idxset_put(p->connections, c, NULL);
 
+    if (o->trace) {
+        pa_native_trace_record r;
+
+        pa_zero(r);
+        r.type = PA_NATIVE_TRACE_CLIENT_NEW;
+        trace_record(c, &r);
+    }
+
 #ifdef HAVE_CREDS
     if (pa_iochannel_creds_supported(io))
         pa_iochannel_creds_enable(io);
@@ -5365,18 +6994,25 @@ void pa_native_options_unref(pa_native_options *o) {
 
     pa_xfree(o->auth_group);
 
+    if (o->auth_group_cache)
+        pa_hashmap_free(o->auth_group_cache);
+
     if (o->auth_ip_acl)
         pa_ip_acl_free(o->auth_ip_acl);
 
     if (o->auth_cookie)
         pa_auth_cookie_unref(o->auth_cookie);
 
+    if (o->trace)
+        pa_native_trace_free(o->trace);
+
     pa_xfree(o);
 }
 
 int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
     bool enabled;
-    const char *acl;
+    uint32_t coalesce_msec;
+    const char *acl, *trace_file;
 
     pa_assert(o);
     pa_assert(PA_REFCNT_VALUE(o) >= 1);
@@ -5388,6 +7024,33 @@ int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
         return -1;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "adaptive-latency", &o->adaptive_latency) < 0) {
+        pa_log("adaptive-latency= expects a boolean argument.");
+        return -1;
+    }
+
+    coalesce_msec = 0;
+    if (pa_modargs_get_value_u32(ma, "subscription-coalesce-msec", &coalesce_msec) < 0 || coalesce_msec > 1000) {
+        pa_log("subscription-coalesce-msec= expects a value between 0 and 1000.");
+        return -1;
+    }
+    o->subscription_coalesce_usec = coalesce_msec * PA_USEC_PER_MSEC;
+
+    if (pa_modargs_get_value_u32(ma, "client-max-streams", &o->client_max_streams) < 0) {
+        pa_log("client-max-streams= expects a number of streams.");
+        return -1;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "client-max-buffer", &o->client_max_buffer) < 0) {
+        pa_log("client-max-buffer= expects a size in bytes.");
+        return -1;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "client-max-request-rate", &o->client_max_request_rate) < 0) {
+        pa_log("client-max-request-rate= expects a number of requests per second.");
+        return -1;
+    }
+
     if (pa_modargs_get_value_boolean(ma, "auth-anonymous", &o->auth_anonymous) < 0) {
         pa_log("auth-anonymous= expects a boolean argument.");
         return -1;
@@ -5462,6 +7125,18 @@ int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
     } else
           o->auth_cookie = NULL;
 
+    if ((trace_file = pa_modargs_get_value(ma, "trace-file", NULL))) {
+        pa_native_trace *t;
+
+        if (!(t = pa_native_trace_new(trace_file)))
+            return -1;
+
+        if (o->trace)
+            pa_native_trace_free(o->trace);
+
+        o->trace = t;
+    }
+
     return 0;
 }
 
@@ -27,6 +27,7 @@
 #include <pulsecore/iochannel.h>
 #include <pulsecore/module.h>
 #include <pulsecore/modargs.h>
+#include <pulsecore/native-trace.h>
 #include <pulsecore/strlist.h>
 #include <pulsecore/hook-list.h>
 #include <pulsecore/pstream.h>
@@ -43,9 +44,23 @@ typedef struct pa_native_options {
 
     bool auth_anonymous;
     bool srbchannel;
+    /* Size the buffers of remote TCP clients after the network delay */
+    bool adaptive_latency;
+    /* Hold back subscription events this long to collapse repeats */
+    pa_usec_t subscription_coalesce_usec;
+    /* Per client limits, 0 if unlimited: streams of all kinds, the sum
+     * of their maxlength (or sample length for uploads), and
+     * introspection and stream creation requests per second */
+    uint32_t client_max_streams;
+    uint32_t client_max_buffer;
+    uint32_t client_max_request_rate;
     char *auth_group;
+    /* Results of looking up auth_group, by uid */
+    pa_hashmap *auth_group_cache;
     pa_ip_acl *auth_ip_acl;
     pa_auth_cookie *auth_cookie;
+    /* Record what the clients do into this, if set */
+    pa_native_trace *trace;
 } pa_native_options;
 
 typedef enum pa_native_hook {
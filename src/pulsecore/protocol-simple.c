@@ -92,6 +92,18 @@ enum {
 #define DEFAULT_SINK_LATENCY (300*PA_USEC_PER_MSEC)
 #define DEFAULT_SOURCE_LATENCY (300*PA_USEC_PER_MSEC)
 
+/* Read up to this many times per wakeup while the socket keeps filling
+ * the requested size, instead of going through the main loop for every
+ * read. Bounded so that one client can't starve the others. */
+#define MAX_READS_PER_WAKEUP 8
+
+/* Recorded chunks sent with a single writev() */
+#ifdef HAVE_SYS_UIO_H
+#define MAX_WRITE_CHUNKS 16
+#else
+#define MAX_WRITE_CHUNKS 1
+#endif
+
 static void connection_unlink(connection *c) {
     pa_assert(c);
 
@@ -199,32 +211,53 @@ static int do_read(connection *c) {
     pa_asyncmsgq_post(c->sink_input->sink->asyncmsgq, PA_MSGOBJECT(c->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, &chunk, NULL);
     pa_atomic_sub(&c->playback.missing, (int) r);
 
-    return 0;
+    /* More may be waiting if we got all we asked for */
+    return (size_t) r == l;
+}
+
+/* Writes the chunks with a single system call where possible */
+static ssize_t write_chunks(pa_iochannel *io, pa_memchunk *chunks, unsigned n) {
+    ssize_t r;
+    unsigned k;
+#ifdef HAVE_SYS_UIO_H
+    struct iovec iov[MAX_WRITE_CHUNKS];
+
+    pa_assert(n <= MAX_WRITE_CHUNKS);
+
+    for (k = 0; k < n; k++) {
+        iov[k].iov_base = (uint8_t*) pa_memblock_acquire(chunks[k].memblock) + chunks[k].index;
+        iov[k].iov_len = chunks[k].length;
+    }
+
+    r = pa_iochannel_writev(io, iov, (int) n);
+#else
+    r = pa_iochannel_write(io, (uint8_t*) pa_memblock_acquire(chunks[0].memblock) + chunks[0].index, chunks[0].length);
+    n = 1;
+#endif
+
+    for (k = 0; k < n; k++)
+        pa_memblock_release(chunks[k].memblock);
+
+    return r;
 }
 
 static int do_write(connection *c) {
-    pa_memchunk chunk;
+    pa_memchunk chunks[MAX_WRITE_CHUNKS];
+    unsigned n, k;
     ssize_t r;
-    void *p;
 
     connection_assert_ref(c);
 
     if (!c->source_output)
         return 0;
 
-    if (pa_memblockq_peek(c->output_memblockq, &chunk) < 0) {
-/*         pa_log("peek failed"); */
+    if (!(n = pa_memblockq_peek_chunks(c->output_memblockq, chunks, MAX_WRITE_CHUNKS)))
         return 0;
-    }
 
-    pa_assert(chunk.memblock);
-    pa_assert(chunk.length);
+    r = write_chunks(c->io, chunks, n);
 
-    p = pa_memblock_acquire(chunk.memblock);
-    r = pa_iochannel_write(c->io, (uint8_t*) p+chunk.index, chunk.length);
-    pa_memblock_release(chunk.memblock);
-
-    pa_memblock_unref(chunk.memblock);
+    for (k = 0; k < n; k++)
+        pa_memblock_unref(chunks[k].memblock);
 
     if (r < 0) {
         pa_log("write(): %s", pa_cstrerror(errno));
@@ -242,9 +275,16 @@ static void do_work(connection *c) {
     if (c->dead)
         return;
 
-    if (pa_iochannel_is_readable(c->io))
-        if (do_read(c) < 0)
+    if (pa_iochannel_is_readable(c->io)) {
+        unsigned n = 0;
+        int r;
+
+        while ((r = do_read(c)) > 0 && ++n < MAX_READS_PER_WAKEUP)
+            ;
+
+        if (r < 0)
             goto fail;
+    }
 
     if (!c->sink_input && pa_iochannel_is_hungup(c->io))
         goto fail;
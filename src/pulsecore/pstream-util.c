@@ -31,21 +31,29 @@
 #include "pstream-util.h"
 
 static void pa_pstream_send_tagstruct_with_ancil_data(pa_pstream *p, pa_tagstruct *t, pa_cmsg_ancil_data *ancil_data) {
-    size_t length;
-    const uint8_t *data;
     pa_packet *packet;
 
     pa_assert(p);
     pa_assert(t);
 
-    pa_assert_se(data = pa_tagstruct_data(t, &length));
-    pa_assert_se(packet = pa_packet_new_data(data, length));
-    pa_tagstruct_free(t);
+    pa_assert_se(packet = pa_tagstruct_free_to_packet(t));
 
     pa_pstream_send_packet(p, packet, ancil_data);
     pa_packet_unref(packet);
 }
 
+void pa_pstream_send_tagstruct_urgent(pa_pstream *p, pa_tagstruct *t) {
+    pa_packet *packet;
+
+    pa_assert(p);
+    pa_assert(t);
+
+    pa_assert_se(packet = pa_tagstruct_free_to_packet(t));
+
+    pa_pstream_send_packet_urgent(p, packet);
+    pa_packet_unref(packet);
+}
+
 #ifdef HAVE_CREDS
 
 void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds) {
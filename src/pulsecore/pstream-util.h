@@ -31,6 +31,9 @@ void pa_pstream_send_tagstruct_with_fds(pa_pstream *p, pa_tagstruct *t, int nfd,
 
 #define pa_pstream_send_tagstruct(p, t) pa_pstream_send_tagstruct_with_creds((p), (t), NULL)
 
+/* The tagstruct is freed! See pa_pstream_send_packet_urgent(). */
+void pa_pstream_send_tagstruct_urgent(pa_pstream *p, pa_tagstruct *t);
+
 void pa_pstream_send_error(pa_pstream *p, uint32_t tag, uint32_t error);
 void pa_pstream_send_simple_ack(pa_pstream *p, uint32_t tag);
 
@@ -40,6 +40,7 @@
 #include <pulsecore/refcnt.h>
 #include <pulsecore/flist.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/trace.h>
 
 #include "pstream.h"
 
@@ -77,12 +78,22 @@ typedef uint32_t pa_pstream_descriptor[PA_PSTREAM_DESCRIPTOR_MAX];
 
 #define MINIBUF_SIZE (256)
 
+/* How many of the queued items are gathered into one vectored write, in
+ * addition to the one currently being written */
+#define WRITE_AHEAD_MAX (8)
+
 /* To allow uploading a single sample in one frame, this value should be the
  * same size (16 MB) as PA_SCACHE_ENTRY_SIZE_MAX from pulsecore/core-scache.h.
  */
 #define FRAME_SIZE_MAX_ALLOW (1024*1024*16)
 
-PA_STATIC_FLIST_DECLARE(items, 0, pa_xfree);
+/* Items, packets and queue entries are all recycled through free lists
+ * shared by every connection. With many busy clients the default size
+ * of those is soon exhausted, and each further item then goes back to
+ * malloc(). */
+#define ITEMS_FLIST_SIZE 1024
+
+PA_STATIC_FLIST_DECLARE(items, ITEMS_FLIST_SIZE, pa_xfree);
 
 struct item_info {
     enum {
@@ -109,6 +120,18 @@ struct item_info {
     uint32_t block_id;
 };
 
+struct pstream_write {
+    union {
+        uint8_t minibuf[MINIBUF_SIZE];
+        pa_pstream_descriptor descriptor;
+    };
+    struct item_info* current;
+    void *data;
+    size_t index;
+    int minibuf_validsize;
+    pa_memchunk memchunk;
+};
+
 struct pstream_read {
     pa_pstream_descriptor descriptor;
     pa_memblock *memblock;
@@ -129,19 +152,21 @@ struct pa_pstream {
 
     pa_queue *send_queue;
 
+    /* Packets that may overtake the send queue, see
+     * pa_pstream_send_packet_urgent() */
+    pa_queue *urgent_queue;
+
+    /* Number of items pushed into and popped from the send queue */
+    uint64_t n_queued, n_dequeued;
+
     bool dead;
 
-    struct {
-        union {
-            uint8_t minibuf[MINIBUF_SIZE];
-            pa_pstream_descriptor descriptor;
-        };
-        struct item_info* current;
-        void *data;
-        size_t index;
-        int minibuf_validsize;
-        pa_memchunk memchunk;
-    } write;
+    struct pstream_write write;
+
+    /* Items taken from the send queue already, that follow the one in
+     * write. Only used for vectored writes to the iochannel. */
+    struct pstream_write write_ahead[WRITE_AHEAD_MAX];
+    unsigned n_write_ahead;
 
     struct pstream_read readio, readsrb;
 
@@ -234,6 +259,20 @@ void pa_cmsg_ancil_data_close_fds(struct pa_cmsg_ancil_data *ancil) {
 
 static int do_write(pa_pstream *p);
 static int do_read(pa_pstream *p, struct pstream_read *re);
+static void prepare_next_write_item(pa_pstream *p);
+
+/* Whether the next piece to write has to go through the socket even
+ * though an srbchannel is active */
+static bool write_needs_socket(pa_pstream *p) {
+    if (!p->write.current)
+        prepare_next_write_item(p);
+
+#ifdef HAVE_CREDS
+    return p->write.current && p->send_ancil_data_now;
+#else
+    return false;
+#endif
+}
 
 static void do_pstream_read_write(pa_pstream *p) {
     pa_assert(p);
@@ -244,8 +283,19 @@ static void do_pstream_read_write(pa_pstream *p) {
     p->mainloop->defer_enable(p->defer_event, 0);
 
     if (!p->dead && p->srb) {
-         do_write(p);
-         while (!p->dead && do_read(p, &p->readsrb) == 0);
+        int r = 0;
+
+        /* The ringbuffer doesn't have to wait for the socket to become
+         * writable, so move everything queued right away. The peer is
+         * only woken up once for all of it. */
+        while (!p->dead && p->srb && !write_needs_socket(p) && (r = do_write(p)) > 0)
+            ;
+
+        if (r < 0)
+            goto fail;
+
+        /* Writing out the queue may have switched channels */
+        while (!p->dead && p->srb && do_read(p, &p->readsrb) == 0);
     }
 
     if (!p->dead && pa_iochannel_is_readable(p->io)) {
@@ -334,6 +384,7 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     m->defer_enable(p->defer_event, 0);
 
     p->send_queue = pa_queue_new();
+    p->urgent_queue = pa_queue_new();
 
     p->mempool = pool;
 
@@ -401,11 +452,14 @@ static void item_free(void *item) {
 }
 
 static void pstream_free(pa_pstream *p) {
+    unsigned i;
+
     pa_assert(p);
 
     pa_pstream_unlink(p);
 
     pa_queue_free(p->send_queue, item_free);
+    pa_queue_free(p->urgent_queue, item_free);
 
     if (p->write.current)
         item_free(p->write.current);
@@ -413,6 +467,13 @@ static void pstream_free(pa_pstream *p) {
     if (p->write.memchunk.memblock)
         pa_memblock_unref(p->write.memchunk.memblock);
 
+    for (i = 0; i < p->n_write_ahead; i++) {
+        item_free(p->write_ahead[i].current);
+
+        if (p->write_ahead[i].memchunk.memblock)
+            pa_memblock_unref(p->write_ahead[i].memchunk.memblock);
+    }
+
     if (p->readsrb.memblock)
         pa_memblock_unref(p->readsrb.memblock);
 
@@ -431,6 +492,23 @@ static void pstream_free(pa_pstream *p) {
     pa_xfree(p);
 }
 
+static void push_item(pa_pstream *p, struct item_info *i) {
+    pa_queue_push(p->send_queue, i);
+    p->n_queued++;
+}
+
+static struct item_info *pop_item(pa_pstream *p) {
+    struct item_info *i;
+
+    if ((i = pa_queue_pop(p->urgent_queue)))
+        return i;
+
+    if ((i = pa_queue_pop(p->send_queue)))
+        p->n_dequeued++;
+
+    return i;
+}
+
 void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, pa_cmsg_ancil_data *ancil_data) {
     struct item_info *i;
 
@@ -461,11 +539,56 @@ void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, pa_cmsg_ancil_data
     }
 #endif
 
-    pa_queue_push(p->send_queue, i);
+    push_item(p, i);
 
     p->mainloop->defer_enable(p->defer_event, 1);
 }
 
+void pa_pstream_send_packet_urgent(pa_pstream *p, pa_packet *packet) {
+    struct item_info *i;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(packet);
+
+    if (p->dead)
+        return;
+
+    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
+        i = pa_xnew(struct item_info, 1);
+
+    i->type = PA_PSTREAM_ITEM_PACKET;
+    i->packet = pa_packet_ref(packet);
+#ifdef HAVE_CREDS
+    i->with_ancil_data = false;
+#endif
+
+    pa_queue_push(p->urgent_queue, i);
+
+    p->mainloop->defer_enable(p->defer_event, 1);
+}
+
+uint64_t pa_pstream_get_queue_serial(pa_pstream *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    return p->n_queued;
+}
+
+bool pa_pstream_is_dequeued(pa_pstream *p, uint64_t serial) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    return p->n_dequeued >= serial;
+}
+
+bool pa_pstream_has_srbchannel(pa_pstream *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    return !!p->srb;
+}
+
 void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa_seek_mode_t seek_mode, const pa_memchunk *chunk) {
     size_t length, idx;
     size_t bsm;
@@ -503,7 +626,7 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
         i->with_ancil_data = false;
 #endif
 
-        pa_queue_push(p->send_queue, i);
+        push_item(p, i);
 
         idx += n;
         length -= n;
@@ -530,7 +653,7 @@ void pa_pstream_send_release(pa_pstream *p, uint32_t block_id) {
     item->with_ancil_data = false;
 #endif
 
-    pa_queue_push(p->send_queue, item);
+    push_item(p, item);
     p->mainloop->defer_enable(p->defer_event, 1);
 }
 
@@ -567,7 +690,7 @@ void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id) {
     item->with_ancil_data = false;
 #endif
 
-    pa_queue_push(p->send_queue, item);
+    push_item(p, item);
     p->mainloop->defer_enable(p->defer_event, 1);
 }
 
@@ -584,68 +707,66 @@ static void memexport_revoke_cb(pa_memexport *e, uint32_t block_id, void *userda
         pa_pstream_send_revoke(p, block_id);
 }
 
-static void prepare_next_write_item(pa_pstream *p) {
+static void prepare_write_item(pa_pstream *p, struct pstream_write *w, struct item_info *item) {
     pa_assert(p);
-    pa_assert(PA_REFCNT_VALUE(p) > 0);
-
-    p->write.current = pa_queue_pop(p->send_queue);
-
-    if (!p->write.current)
-        return;
-    p->write.index = 0;
-    p->write.data = NULL;
-    p->write.minibuf_validsize = 0;
-    pa_memchunk_reset(&p->write.memchunk);
-
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
-
-    if (p->write.current->type == PA_PSTREAM_ITEM_PACKET) {
+    pa_assert(w);
+    pa_assert(item);
+
+    w->current = item;
+    w->index = 0;
+    w->data = NULL;
+    w->minibuf_validsize = 0;
+    pa_memchunk_reset(&w->memchunk);
+
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+    w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
+
+    if (w->current->type == PA_PSTREAM_ITEM_PACKET) {
         size_t plen;
 
-        pa_assert(p->write.current->packet);
+        pa_assert(w->current->packet);
 
-        p->write.data = (void *) pa_packet_data(p->write.current->packet, &plen);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) plen);
+        w->data = (void *) pa_packet_data(w->current->packet, &plen);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) plen);
 
         if (plen <= MINIBUF_SIZE - PA_PSTREAM_DESCRIPTOR_SIZE) {
-            memcpy(&p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE], p->write.data, plen);
-            p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + plen;
+            memcpy(&w->minibuf[PA_PSTREAM_DESCRIPTOR_SIZE], w->data, plen);
+            w->minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + plen;
         }
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
+    } else if (w->current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(w->current->block_id);
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
+    } else if (w->current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(w->current->block_id);
 
     } else {
         uint32_t flags;
         bool send_payload = true;
 
-        pa_assert(p->write.current->type == PA_PSTREAM_ITEM_MEMBLOCK);
-        pa_assert(p->write.current->chunk.memblock);
+        pa_assert(w->current->type == PA_PSTREAM_ITEM_MEMBLOCK);
+        pa_assert(w->current->chunk.memblock);
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(p->write.current->channel);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) p->write.current->offset) >> 32));
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) p->write.current->offset));
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(w->current->channel);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) w->current->offset) >> 32));
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) w->current->offset));
 
-        flags = (uint32_t) (p->write.current->seek_mode & PA_FLAG_SEEKMASK);
+        flags = (uint32_t) (w->current->seek_mode & PA_FLAG_SEEKMASK);
 
         if (p->use_shm) {
             pa_mem_type_t type;
             uint32_t block_id, shm_id;
             size_t offset, length;
-            uint32_t *shm_info = (uint32_t *) &p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE];
+            uint32_t *shm_info = (uint32_t *) &w->minibuf[PA_PSTREAM_DESCRIPTOR_SIZE];
             size_t shm_size = sizeof(uint32_t) * PA_PSTREAM_SHM_MAX;
-            pa_mempool *current_pool = pa_memblock_get_pool(p->write.current->chunk.memblock);
+            pa_mempool *current_pool = pa_memblock_get_pool(w->current->chunk.memblock);
             pa_memexport *current_export;
 
             if (p->mempool == current_pool)
@@ -654,7 +775,7 @@ static void prepare_next_write_item(pa_pstream *p) {
                 pa_assert_se(current_export = pa_memexport_new(current_pool, memexport_revoke_cb, p));
 
             if (pa_memexport_put(current_export,
-                                 p->write.current->chunk.memblock,
+                                 w->current->chunk.memblock,
                                  &type,
                                  &block_id,
                                  &shm_id,
@@ -685,11 +806,11 @@ static void prepare_next_write_item(pa_pstream *p) {
 
                     shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
                     shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
-                    shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + p->write.current->chunk.index));
-                    shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
+                    shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + w->current->chunk.index));
+                    shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) w->current->chunk.length);
 
-                    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(shm_size);
-                    p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + shm_size;
+                    w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(shm_size);
+                    w->minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + shm_size;
                 }
             }
 /*             else */
@@ -702,12 +823,29 @@ static void prepare_next_write_item(pa_pstream *p) {
         }
 
         if (send_payload) {
-            p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
-            p->write.memchunk = p->write.current->chunk;
-            pa_memblock_ref(p->write.memchunk.memblock);
+            w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) w->current->chunk.length);
+            w->memchunk = w->current->chunk;
+            pa_memblock_ref(w->memchunk.memblock);
         }
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
+        w->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
+    }
+}
+
+static void prepare_next_write_item(pa_pstream *p) {
+    struct item_info *item;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    if (p->n_write_ahead > 0) {
+        p->write = p->write_ahead[0];
+        memmove(p->write_ahead, p->write_ahead + 1, --p->n_write_ahead * sizeof(struct pstream_write));
+    } else if ((item = pop_item(p)))
+        prepare_write_item(p, &p->write, item);
+    else {
+        p->write.current = NULL;
+        return;
     }
 
 #ifdef HAVE_CREDS
@@ -730,6 +868,126 @@ static void check_srbpending(pa_pstream *p) {
         pa_srbchannel_set_callback(p->srb, srb_callback, p);
 }
 
+static size_t write_item_length(struct pstream_write *w) {
+    return PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+}
+
+static void finish_write_item(pa_pstream *p) {
+    pa_assert(p->write.current);
+    item_free(p->write.current);
+    p->write.current = NULL;
+
+    if (p->write.memchunk.memblock)
+        pa_memblock_unref(p->write.memchunk.memblock);
+
+    pa_memchunk_reset(&p->write.memchunk);
+
+    if (p->drain_callback && !pa_pstream_is_pending(p))
+        p->drain_callback(p, p->drain_callback_userdata);
+}
+
+#ifdef HAVE_SYS_UIO_H
+/* Fills in the iovecs for the rest of the item, that is at most the
+ * remaining descriptor and the payload. Memblocks that are acquired for
+ * that are appended to acquired. Returns the number of iovecs used. */
+static unsigned write_item_iovec(struct pstream_write *w, struct iovec *iov, pa_memblock **acquired, unsigned *n_acquired) {
+    unsigned n = 0;
+    size_t length;
+
+    if (w->minibuf_validsize > 0) {
+        iov[n].iov_base = w->minibuf + w->index;
+        iov[n++].iov_len = w->minibuf_validsize - w->index;
+        return n;
+    }
+
+    if (w->index < PA_PSTREAM_DESCRIPTOR_SIZE) {
+        iov[n].iov_base = (uint8_t*) w->descriptor + w->index;
+        iov[n++].iov_len = PA_PSTREAM_DESCRIPTOR_SIZE - w->index;
+    }
+
+    if ((length = ntohl(w->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH])) > 0) {
+        size_t index = w->index > PA_PSTREAM_DESCRIPTOR_SIZE ? w->index - PA_PSTREAM_DESCRIPTOR_SIZE : 0;
+        void *d;
+
+        pa_assert(w->data || w->memchunk.memblock);
+
+        if (w->data)
+            d = w->data;
+        else {
+            d = pa_memblock_acquire_chunk(&w->memchunk);
+            acquired[(*n_acquired)++] = w->memchunk.memblock;
+        }
+
+        iov[n].iov_base = (uint8_t*) d + index;
+        iov[n++].iov_len = length - index;
+    }
+
+    return n;
+}
+
+/* Writes the current item together with as many of the queued items as
+ * possible in one go, instead of one write per descriptor and payload.
+ * Items that come with ancillary data need a write of their own, so they
+ * end the batch. */
+static int do_writev(pa_pstream *p) {
+    struct iovec iov[2 * (WRITE_AHEAD_MAX + 1)];
+    pa_memblock *acquired[WRITE_AHEAD_MAX + 1];
+    unsigned n_iov, n_acquired = 0, i;
+    size_t l = 0;
+    ssize_t r;
+
+    n_iov = write_item_iovec(&p->write, iov, acquired, &n_acquired);
+
+    for (i = 0;; i++) {
+        if (i >= p->n_write_ahead) {
+            struct item_info *item;
+
+            if (p->n_write_ahead >= WRITE_AHEAD_MAX || !(item = pop_item(p)))
+                break;
+
+            prepare_write_item(p, &p->write_ahead[p->n_write_ahead++], item);
+        }
+
+#ifdef HAVE_CREDS
+        if (p->write_ahead[i].current->with_ancil_data)
+            break;
+#endif
+
+        n_iov += write_item_iovec(&p->write_ahead[i], iov + n_iov, acquired, &n_acquired);
+    }
+
+    for (i = 0; i < n_iov; i++)
+        l += iov[i].iov_len;
+
+    r = pa_iochannel_writev(p->io, iov, (int) n_iov);
+
+    for (i = 0; i < n_acquired; i++)
+        pa_memblock_release(acquired[i]);
+
+    if (r < 0)
+        return -1;
+
+    PA_TRACE2(pstream_send, p, r);
+
+    for (l -= (size_t) r; r > 0;) {
+        size_t left = write_item_length(&p->write) - p->write.index;
+
+        if ((size_t) r < left) {
+            p->write.index += (size_t) r;
+            break;
+        }
+
+        r -= (ssize_t) left;
+        finish_write_item(p);
+
+        if (r > 0)
+            prepare_next_write_item(p);
+    }
+
+    return l == 0 ? 1 : 0;
+}
+#endif
+
 static int do_write(pa_pstream *p) {
     void *d;
     size_t l;
@@ -748,6 +1006,15 @@ static int do_write(pa_pstream *p) {
         return 0;
     }
 
+#ifdef HAVE_SYS_UIO_H
+    if (!p->srb
+#ifdef HAVE_CREDS
+        && !p->send_ancil_data_now
+#endif
+        )
+        return do_writev(p);
+#endif
+
     if (p->write.minibuf_validsize > 0) {
         d = p->write.minibuf + p->write.index;
         l = p->write.minibuf_validsize - p->write.index;
@@ -793,21 +1060,12 @@ static int do_write(pa_pstream *p) {
     if (release_memblock)
         pa_memblock_release(release_memblock);
 
-    p->write.index += (size_t) r;
-
-    if (p->write.index >= PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH])) {
-        pa_assert(p->write.current);
-        item_free(p->write.current);
-        p->write.current = NULL;
-
-        if (p->write.memchunk.memblock)
-            pa_memblock_unref(p->write.memchunk.memblock);
+    PA_TRACE2(pstream_send, p, r);
 
-        pa_memchunk_reset(&p->write.memchunk);
+    p->write.index += (size_t) r;
 
-        if (p->drain_callback && !pa_pstream_is_pending(p))
-            p->drain_callback(p, p->drain_callback_userdata);
-    }
+    if (p->write.index >= write_item_length(&p->write))
+        finish_write_item(p);
 
     return (size_t) r == l ? 1 : 0;
 
@@ -907,6 +1165,8 @@ static int do_read(pa_pstream *p, struct pstream_read *re) {
     if (release_memblock)
         pa_memblock_release(release_memblock);
 
+    PA_TRACE2(pstream_receive, p, r);
+
     re->index += (size_t) r;
 
     if (re->index == PA_PSTREAM_DESCRIPTOR_SIZE) {
@@ -1157,7 +1417,7 @@ bool pa_pstream_is_pending(pa_pstream *p) {
     if (p->dead)
         b = false;
     else
-        b = p->write.current || !pa_queue_isempty(p->send_queue);
+        b = p->write.current || p->n_write_ahead > 0 || !pa_queue_isempty(p->send_queue) || !pa_queue_isempty(p->urgent_queue);
 
     return b;
 }
@@ -1247,6 +1507,21 @@ void pa_pstream_enable_memfd(pa_pstream *p) {
     }
 }
 
+void pa_pstream_set_max_exports(pa_pstream *p, unsigned n) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    if (p->export)
+        pa_memexport_set_max_slots(p->export, n);
+}
+
+size_t pa_pstream_get_imported_size(pa_pstream *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    return p->import ? pa_memimport_get_size(p->import) : 0;
+}
+
 bool pa_pstream_get_shm(pa_pstream *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
@@ -55,6 +55,19 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
 void pa_pstream_send_release(pa_pstream *p, uint32_t block_id);
 void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id);
 
+/* Queues a packet ahead of everything sent the usual way that hasn't
+ * started going out yet. Meant for short notifications the peer
+ * shouldn't wait for behind bulky replies. To keep one from overtaking a
+ * packet it depends on, take pa_pstream_get_queue_serial() after sending
+ * that one and use the urgent path only once pa_pstream_is_dequeued()
+ * holds for it. */
+void pa_pstream_send_packet_urgent(pa_pstream *p, pa_packet *packet);
+uint64_t pa_pstream_get_queue_serial(pa_pstream *p);
+bool pa_pstream_is_dequeued(pa_pstream *p, uint64_t serial);
+
+/* Whether packets currently go through a shared ringbuffer channel */
+bool pa_pstream_has_srbchannel(pa_pstream *p);
+
 void pa_pstream_set_receive_packet_callback(pa_pstream *p, pa_pstream_packet_cb_t cb, void *userdata);
 void pa_pstream_set_receive_memblock_callback(pa_pstream *p, pa_pstream_memblock_cb_t cb, void *userdata);
 void pa_pstream_set_drain_callback(pa_pstream *p, pa_pstream_notify_cb_t cb, void *userdata);
@@ -66,7 +79,14 @@ bool pa_pstream_is_pending(pa_pstream *p);
 
 void pa_pstream_enable_shm(pa_pstream *p, bool enable);
 void pa_pstream_enable_memfd(pa_pstream *p);
+
+/* Lets a SHM enabled pstream have up to n blocks out at a time, which
+ * the peer has to be able to import, see PA_MEMEXPORT_SLOTS_DEFAULT */
+void pa_pstream_set_max_exports(pa_pstream *p, unsigned n);
 bool pa_pstream_get_shm(pa_pstream *p);
+
+/* Returns how many bytes of the peer's memory blocks we hold */
+size_t pa_pstream_get_imported_size(pa_pstream *p);
 bool pa_pstream_get_memfd(pa_pstream *p);
 
 /* Enables shared ringbuffer channel. Note that the srbchannel is now owned by the pstream.
@@ -29,7 +29,9 @@
 
 #include "queue.h"
 
-PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
+#define ENTRIES_FLIST_SIZE 1024
+
+PA_STATIC_FLIST_DECLARE(entries, ENTRIES_FLIST_SIZE, pa_xfree);
 
 struct queue_entry {
     struct queue_entry *next;
@@ -30,21 +30,26 @@
     pa_atomic_t _ref
 
 #define PA_REFCNT_VALUE(p) \
-    pa_atomic_load(&(p)->_ref)
+    pa_atomic_load_relaxed(&(p)->_ref)
 
 #define PA_REFCNT_INIT_ZERO(p) \
     pa_atomic_store(&(p)->_ref, 0)
 
 #ifndef DEBUG_REF
 
+/* Taking a reference needs no ordering, the caller already holds one
+ * that keeps the object alive. Dropping one must make our writes
+ * visible to whoever frees the object, and the freeing thread must
+ * see them, hence acq_rel. */
+
 #define PA_REFCNT_INIT(p) \
     pa_atomic_store(&(p)->_ref, 1)
 
 #define PA_REFCNT_INC(p) \
-    pa_atomic_inc(&(p)->_ref)
+    pa_atomic_inc_relaxed(&(p)->_ref)
 
 #define PA_REFCNT_DEC(p) \
-    (pa_atomic_dec(&(p)->_ref)-1)
+    (pa_atomic_dec_acq_rel(&(p)->_ref)-1)
 
 #else
 
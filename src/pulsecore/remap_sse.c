@@ -22,8 +22,11 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <pulse/sample.h>
 #include <pulse/volume.h>
+#include <pulse/xmalloc.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 
@@ -99,6 +102,9 @@
                 "4:                             \n\t"
 
 #if defined (__i386__) || defined (__amd64__)
+
+#include <immintrin.h>
+
 static void remap_mono_to_stereo_s16ne_sse2(pa_remap_t *m, int16_t *dst, const int16_t *src, unsigned n) {
     pa_reg_x86 temp, temp2;
 
@@ -121,9 +127,189 @@ static void remap_mono_to_stereo_float32ne_sse2(pa_remap_t *m, float *dst, const
     );
 }
 
+/* The float matrix remappers below follow remap_channels_matrix_float32ne_c():
+ * coefficients are clamped the same way and the products are summed in
+ * input channel order, so the results match except that zero factors are
+ * multiplied in rather than skipped within a vector. Their state
+ * holds the matrix columns (the factors of one input channel for all
+ * output channels) padded to two vectors, leaving out input channels that
+ * do not contribute to any output. */
+#define MATRIX_MAX_OUT 8
+
+typedef struct matrix_state {
+    unsigned n_cols;
+    unsigned ic[PA_CHANNELS_MAX];
+    float col[PA_CHANNELS_MAX][MATRIX_MAX_OUT];
+} matrix_state;
+
+static matrix_state *matrix_state_new(const pa_remap_t *m) {
+    matrix_state *st;
+    unsigned oc, ic;
+
+    st = pa_xnew0(matrix_state, 1);
+
+    for (ic = 0; ic < m->i_ss.channels; ic++) {
+        bool used = false;
+
+        for (oc = 0; oc < m->o_ss.channels; oc++) {
+            float vol = m->map_table_f[oc][ic];
+
+            if (vol <= 0.0f)
+                continue;
+
+            st->col[st->n_cols][oc] = vol >= 1.0f ? 1.0f : vol;
+            used = true;
+        }
+
+        if (used)
+            st->ic[st->n_cols++] = ic;
+    }
+
+    return st;
+}
+
+__attribute__((target("sse")))
+static inline __m128 matrix_frame_sse(const matrix_state *st, const float *src, __m128 *hi) {
+    __m128 lo = _mm_setzero_ps();
+    unsigned k;
+
+    *hi = _mm_setzero_ps();
+
+    for (k = 0; k < st->n_cols; k++) {
+        __m128 s = _mm_set1_ps(src[st->ic[k]]);
+
+        lo = _mm_add_ps(lo, _mm_mul_ps(s, _mm_loadu_ps(st->col[k])));
+        *hi = _mm_add_ps(*hi, _mm_mul_ps(s, _mm_loadu_ps(st->col[k] + 4)));
+    }
+
+    return lo;
+}
+
+/* Generic matrix: one frame per iteration, all output channels at once.
+ * The vector stores spill past the end of the frame, which is fine as long
+ * as the next frame overwrites it, so the last few frames go through a
+ * temporary buffer. */
+__attribute__((target("sse")))
+static void remap_channels_matrix_float32ne_sse(pa_remap_t *m, float *dst, const float *src, unsigned n) {
+    const matrix_state *st = m->state;
+    unsigned n_ic = m->i_ss.channels;
+    unsigned n_oc = m->o_ss.channels;
+    unsigned width = n_oc > 4 ? 8 : 4;
+    float *end = dst + n * n_oc;
+    __m128 lo, hi;
+
+    for (; n > 0 && dst + width <= end; n--, src += n_ic, dst += n_oc) {
+        lo = matrix_frame_sse(st, src, &hi);
+
+        _mm_storeu_ps(dst, lo);
+        if (width > 4)
+            _mm_storeu_ps(dst + 4, hi);
+    }
+
+    for (; n > 0; n--, src += n_ic, dst += n_oc) {
+        float tmp[MATRIX_MAX_OUT];
+
+        lo = matrix_frame_sse(st, src, &hi);
+
+        _mm_storeu_ps(tmp, lo);
+        _mm_storeu_ps(tmp + 4, hi);
+        memcpy(dst, tmp, n_oc * sizeof(float));
+    }
+}
+
+/* Downmix to stereo, two frames per iteration. For each input channel k the
+ * samples of both frames are spread to [ a_k a_k b_k b_k ] and multiplied
+ * with [ L_k R_k L_k R_k ]. */
+#define DOWNMIX_ACCUMULATE(k, x, y, sel)                                   \
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_shuffle_ps(x, y, sel), f[k]))
+
+__attribute__((target("sse")))
+static void downmix_factors_sse(const pa_remap_t *m, __m128 f[]) {
+    unsigned ic;
+
+    for (ic = 0; ic < m->i_ss.channels; ic++) {
+        float l = m->map_table_f[0][ic], r = m->map_table_f[1][ic];
+
+        l = l <= 0.0f ? 0.0f : (l >= 1.0f ? 1.0f : l);
+        r = r <= 0.0f ? 0.0f : (r >= 1.0f ? 1.0f : r);
+        f[ic] = _mm_setr_ps(l, r, l, r);
+    }
+}
+
+static void downmix_tail(pa_remap_t *m, float *dst, const float *src, unsigned n) {
+    for (; n > 0; n--, src += m->i_ss.channels, dst += 2) {
+        unsigned ic;
+
+        dst[0] = dst[1] = 0.0f;
+
+        for (ic = 0; ic < m->i_ss.channels; ic++) {
+            float l = m->map_table_f[0][ic], r = m->map_table_f[1][ic];
+
+            if (l > 0.0f)
+                dst[0] += src[ic] * (l >= 1.0f ? 1.0f : l);
+            if (r > 0.0f)
+                dst[1] += src[ic] * (r >= 1.0f ? 1.0f : r);
+        }
+    }
+}
+
+__attribute__((target("sse")))
+static void remap_5_1_to_stereo_float32ne_sse(pa_remap_t *m, float *dst, const float *src, unsigned n) {
+    __m128 f[6];
+
+    downmix_factors_sse(m, f);
+
+    for (; n >= 2; n -= 2, src += 12, dst += 4) {
+        __m128 v0 = _mm_loadu_ps(src);
+        __m128 v1 = _mm_loadu_ps(src + 4);
+        __m128 v2 = _mm_loadu_ps(src + 8);
+        __m128 acc = _mm_setzero_ps();
+
+        DOWNMIX_ACCUMULATE(0, v0, v1, _MM_SHUFFLE(2, 2, 0, 0));
+        DOWNMIX_ACCUMULATE(1, v0, v1, _MM_SHUFFLE(3, 3, 1, 1));
+        DOWNMIX_ACCUMULATE(2, v0, v2, _MM_SHUFFLE(0, 0, 2, 2));
+        DOWNMIX_ACCUMULATE(3, v0, v2, _MM_SHUFFLE(1, 1, 3, 3));
+        DOWNMIX_ACCUMULATE(4, v1, v2, _MM_SHUFFLE(2, 2, 0, 0));
+        DOWNMIX_ACCUMULATE(5, v1, v2, _MM_SHUFFLE(3, 3, 1, 1));
+
+        _mm_storeu_ps(dst, acc);
+    }
+
+    downmix_tail(m, dst, src, n);
+}
+
+__attribute__((target("sse")))
+static void remap_7_1_to_stereo_float32ne_sse(pa_remap_t *m, float *dst, const float *src, unsigned n) {
+    __m128 f[8];
+
+    downmix_factors_sse(m, f);
+
+    for (; n >= 2; n -= 2, src += 16, dst += 4) {
+        __m128 v0 = _mm_loadu_ps(src);
+        __m128 v1 = _mm_loadu_ps(src + 4);
+        __m128 v2 = _mm_loadu_ps(src + 8);
+        __m128 v3 = _mm_loadu_ps(src + 12);
+        __m128 acc = _mm_setzero_ps();
+
+        DOWNMIX_ACCUMULATE(0, v0, v2, _MM_SHUFFLE(0, 0, 0, 0));
+        DOWNMIX_ACCUMULATE(1, v0, v2, _MM_SHUFFLE(1, 1, 1, 1));
+        DOWNMIX_ACCUMULATE(2, v0, v2, _MM_SHUFFLE(2, 2, 2, 2));
+        DOWNMIX_ACCUMULATE(3, v0, v2, _MM_SHUFFLE(3, 3, 3, 3));
+        DOWNMIX_ACCUMULATE(4, v1, v3, _MM_SHUFFLE(0, 0, 0, 0));
+        DOWNMIX_ACCUMULATE(5, v1, v3, _MM_SHUFFLE(1, 1, 1, 1));
+        DOWNMIX_ACCUMULATE(6, v1, v3, _MM_SHUFFLE(2, 2, 2, 2));
+        DOWNMIX_ACCUMULATE(7, v1, v3, _MM_SHUFFLE(3, 3, 3, 3));
+
+        _mm_storeu_ps(dst, acc);
+    }
+
+    downmix_tail(m, dst, src, n);
+}
+
 /* set the function that will execute the remapping based on the matrices */
 static void init_remap_sse2(pa_remap_t *m) {
     unsigned n_oc, n_ic;
+    int8_t arrange[PA_CHANNELS_MAX];
 
     n_oc = m->o_ss.channels;
     n_ic = m->i_ss.channels;
@@ -135,6 +321,25 @@ static void init_remap_sse2(pa_remap_t *m) {
         pa_log_info("Using SSE2 mono to stereo remapping");
         pa_set_remap_func(m, (pa_do_remap_func_t) remap_mono_to_stereo_s16ne_sse2,
             (pa_do_remap_func_t) remap_mono_to_stereo_float32ne_sse2);
+    } else if (m->format != PA_SAMPLE_FLOAT32NE || n_ic == 1 || n_oc == 1 ||
+            (pa_setup_remap_arrange(m, arrange) && (n_oc == 2 || n_oc == 4))) {
+
+        /* leave mono and plain copies to the generic code */
+    } else if (n_ic == 6 && n_oc == 2) {
+
+        pa_log_info("Using SSE 5.1 to stereo remapping");
+        m->do_remap = (pa_do_remap_func_t) remap_5_1_to_stereo_float32ne_sse;
+    } else if (n_ic == 8 && n_oc == 2) {
+
+        pa_log_info("Using SSE 7.1 to stereo remapping");
+        m->do_remap = (pa_do_remap_func_t) remap_7_1_to_stereo_float32ne_sse;
+    } else if (n_oc <= MATRIX_MAX_OUT) {
+
+        pa_log_info("Using SSE matrix remapping");
+        m->do_remap = (pa_do_remap_func_t) remap_channels_matrix_float32ne_sse;
+
+        /* setup state */
+        m->state = matrix_state_new(m);
     }
 }
 #endif /* defined (__i386__) || defined (__amd64__) */
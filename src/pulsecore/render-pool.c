@@ -0,0 +1,222 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/fdsem.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/shared.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+#include "render-pool.h"
+
+#define MAX_RENDER_THREADS 64
+
+struct helper {
+    pa_render_pool *pool;
+    pa_thread *thread;
+    pa_fdsem *wakeup;
+};
+
+struct pa_render_pool {
+    PA_REFCNT_DECLARE;
+
+    pa_core *core;
+
+    struct helper *helpers;
+    unsigned n_helpers;
+
+    pa_atomic_t busy;
+    pa_atomic_t quit;
+
+    /* The run in progress. Written by the caller before the helpers are
+     * woken up, only read by them. */
+    pa_render_pool_cb_t cb;
+    void *userdata;
+    unsigned n_tasks;
+    pa_thread_mq *thread_mq;
+
+    pa_atomic_t next_task;
+    pa_atomic_t n_running; /* helpers woken up that haven't finished yet */
+    pa_fdsem *done;
+};
+
+/* Called from the caller's IO thread as well as the helpers */
+static void run_tasks(pa_render_pool *p) {
+    int k;
+
+    while ((k = pa_atomic_inc(&p->next_task)) < (int) p->n_tasks)
+        p->cb((unsigned) k, p->userdata);
+}
+
+static void thread_func(void *userdata) {
+    struct helper *h = userdata;
+    pa_render_pool *p = h->pool;
+
+    pa_log_debug("Thread starting up");
+
+    if (p->core->thread_affinity)
+        pa_set_thread_affinity(p->core->thread_affinity);
+
+    if (p->core->realtime_scheduling)
+        pa_make_realtime(p->core->realtime_priority);
+
+    for (;;) {
+        pa_fdsem_wait(h->wakeup);
+
+        if (pa_atomic_load(&p->quit))
+            break;
+
+        pa_thread_mq_set_helper(p->thread_mq);
+        run_tasks(p);
+        pa_thread_mq_set_helper(NULL);
+
+        if (pa_atomic_dec(&p->n_running) == 1)
+            pa_fdsem_post(p->done);
+    }
+
+    pa_log_debug("Thread shutting down");
+}
+
+static void pool_free(pa_render_pool *p) {
+    unsigned k;
+
+    pa_atomic_store(&p->quit, 1);
+
+    for (k = 0; k < p->n_helpers; k++)
+        pa_fdsem_post(p->helpers[k].wakeup);
+
+    for (k = 0; k < p->n_helpers; k++) {
+        pa_thread_free(p->helpers[k].thread);
+        pa_fdsem_free(p->helpers[k].wakeup);
+    }
+
+    if (p->done)
+        pa_fdsem_free(p->done);
+
+    pa_xfree(p->helpers);
+    pa_xfree(p);
+}
+
+pa_render_pool *pa_render_pool_get(pa_core *core) {
+    pa_render_pool *p;
+    unsigned k, n;
+
+    pa_assert(core);
+    pa_assert_ctl_context();
+
+    if ((n = PA_MIN(core->render_threads, MAX_RENDER_THREADS)) <= 0)
+        return NULL;
+
+    if ((p = pa_shared_get(core, "render-pool"))) {
+        PA_REFCNT_INC(p);
+        return p;
+    }
+
+    p = pa_xnew0(pa_render_pool, 1);
+    PA_REFCNT_INIT(p);
+    p->core = core;
+    p->helpers = pa_xnew0(struct helper, n);
+
+    if (!(p->done = pa_fdsem_new()))
+        goto fail;
+
+    for (k = 0; k < n; k++) {
+        char name[16];
+
+        p->helpers[k].pool = p;
+
+        if (!(p->helpers[k].wakeup = pa_fdsem_new()))
+            goto fail;
+
+        pa_snprintf(name, sizeof(name), "render-%u", k);
+        if (!(p->helpers[k].thread = pa_thread_new(name, thread_func, &p->helpers[k]))) {
+            pa_fdsem_free(p->helpers[k].wakeup);
+            goto fail;
+        }
+
+        p->n_helpers++;
+    }
+
+    pa_assert_se(pa_shared_set(core, "render-pool", p) >= 0);
+
+    pa_log_info("Started %u render threads.", n);
+
+    return p;
+
+fail:
+    pa_log("Failed to start render threads.");
+    pool_free(p);
+    return NULL;
+}
+
+void pa_render_pool_unref(pa_render_pool *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) >= 1);
+    pa_assert_ctl_context();
+
+    if (PA_REFCNT_DEC(p) > 0)
+        return;
+
+    pa_assert_se(pa_shared_remove(p->core, "render-pool") >= 0);
+    pool_free(p);
+}
+
+void pa_render_pool_run(pa_render_pool *p, unsigned n, pa_render_pool_cb_t cb, void *userdata) {
+    unsigned k, n_wakeup;
+
+    pa_assert(p);
+    pa_assert(cb);
+    pa_assert_io_context();
+
+    if (n <= 1 || !pa_atomic_cmpxchg(&p->busy, 0, 1)) {
+        for (k = 0; k < n; k++)
+            cb(k, userdata);
+
+        return;
+    }
+
+    p->cb = cb;
+    p->userdata = userdata;
+    p->n_tasks = n;
+    p->thread_mq = pa_thread_mq_get();
+    pa_atomic_store(&p->next_task, 0);
+
+    /* The caller works on the tasks, too */
+    n_wakeup = PA_MIN(p->n_helpers, n - 1);
+    pa_atomic_store(&p->n_running, (int) n_wakeup);
+
+    for (k = 0; k < n_wakeup; k++)
+        pa_fdsem_post(p->helpers[k].wakeup);
+
+    run_tasks(p);
+
+    /* A post left over from an earlier run only causes an extra check */
+    while (pa_atomic_load(&p->n_running) > 0)
+        pa_fdsem_wait(p->done);
+
+    pa_atomic_store(&p->busy, 0);
+}
@@ -0,0 +1,47 @@
+#ifndef foopulsecorerenderpoolhfoo
+#define foopulsecorerenderpoolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulsecore/core.h>
+
+/* Helper threads that take part in the rendering of IO threads, for
+ * sinks with so many inputs that peeking them one after the other
+ * doesn't fit into a period. A run hands out tasks 0 to n-1 to the
+ * helpers and the calling thread, and returns once all are done. The
+ * tasks must be independent of each other, so the result is the same
+ * as if they were run in order. While a run is in progress, the helpers
+ * act on behalf of the caller's IO thread, pa_thread_mq_get() returns
+ * its pa_thread_mq.
+ *
+ * Tasks are claimed through an atomic counter and nothing is allocated,
+ * so a run doesn't take locks. There is one pool per core; if a second
+ * IO thread wants to run while the pool is busy, it runs its tasks on its
+ * own instead of waiting. */
+
+typedef void (*pa_render_pool_cb_t)(unsigned k, void *userdata);
+
+/* Both to be called from the main thread. Returns NULL if the core is
+ * configured without render threads. */
+pa_render_pool *pa_render_pool_get(pa_core *core);
+void pa_render_pool_unref(pa_render_pool *p);
+
+/* Called from IO thread context */
+void pa_render_pool_run(pa_render_pool *p, unsigned n, pa_render_pool_cb_t cb, void *userdata);
+
+#endif
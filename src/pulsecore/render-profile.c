@@ -0,0 +1,99 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "render-profile.h"
+
+static pa_atomic_t enabled = PA_ATOMIC_INIT(0);
+
+void pa_render_profile_set_enabled(bool b) {
+    pa_atomic_store(&enabled, b);
+}
+
+bool pa_render_profile_get_enabled(void) {
+    return pa_atomic_load(&enabled);
+}
+
+pa_usec_t pa_render_profile_start(void) {
+
+    if (PA_LIKELY(!pa_atomic_load(&enabled)))
+        return 0;
+
+    return pa_rtclock_now();
+}
+
+void pa_render_profile_stop(pa_render_profile *p, pa_usec_t start) {
+    pa_assert(p);
+
+    if (PA_LIKELY(start == 0))
+        return;
+
+    pa_render_profile_add(p, pa_rtclock_now() - start);
+}
+
+void pa_render_profile_add(pa_render_profile *p, pa_usec_t usec) {
+    unsigned k;
+
+    pa_assert(p);
+
+    if (usec >= ((pa_usec_t) 1 << PA_RENDER_PROFILE_BUCKETS))
+        k = PA_RENDER_PROFILE_BUCKETS - 1;
+    else
+        k = pa_ulog2((unsigned) usec);
+
+    p->buckets[k]++;
+    p->n++;
+    p->total += usec;
+
+    if (usec > p->max)
+        p->max = usec;
+}
+
+pa_usec_t pa_render_profile_bucket_limit(unsigned bucket) {
+    pa_assert(bucket < PA_RENDER_PROFILE_BUCKETS);
+
+    if (bucket == PA_RENDER_PROFILE_BUCKETS - 1)
+        return (pa_usec_t) -1;
+
+    return (pa_usec_t) 2 << bucket;
+}
+
+const char *pa_render_stage_to_string(pa_render_stage_t stage) {
+    static const char * const table[PA_RENDER_STAGE_MAX] = {
+        [PA_RENDER_STAGE_SINK_RENDER] = "render",
+        [PA_RENDER_STAGE_SINK_WRITE] = "device-write",
+        [PA_RENDER_STAGE_SINK_ENCODE] = "device-encode",
+        [PA_RENDER_STAGE_SOURCE_POST] = "post",
+        [PA_RENDER_STAGE_INPUT_PEEK] = "peek",
+        [PA_RENDER_STAGE_INPUT_POP] = "pop",
+        [PA_RENDER_STAGE_RESAMPLE] = "resample",
+        [PA_RENDER_STAGE_OUTPUT_PUSH] = "push"
+    };
+
+    pa_assert(stage < PA_RENDER_STAGE_MAX);
+
+    return table[stage];
+}
@@ -0,0 +1,73 @@
+#ifndef foopulsecorerenderprofilehfoo
+#define foopulsecorerenderprofilehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+#include <pulsecore/macro.h>
+
+/* Optional timing of the stages of the render path in the IO threads.
+ * Each sink, source, sink input and source output keeps one histogram
+ * per stage in its thread_info, which only its IO thread writes to. The
+ * main thread fetches copies with a message when it wants to show them.
+ * While profiling is disabled, which is the default, a stage costs one
+ * atomic load. */
+
+typedef enum pa_render_stage {
+    PA_RENDER_STAGE_SINK_RENDER,    /* pa_sink_render() and friends */
+    PA_RENDER_STAGE_SINK_WRITE,     /* the driver writing one period to the device */
+    PA_RENDER_STAGE_SINK_ENCODE,    /* the driver encoding one packet, e.g. SBC for bluetooth */
+    PA_RENDER_STAGE_SOURCE_POST,    /* pa_source_post() */
+    PA_RENDER_STAGE_INPUT_PEEK,     /* pa_sink_input_peek() */
+    PA_RENDER_STAGE_INPUT_POP,      /* the pop() callback of a sink input, e.g. a filter */
+    PA_RENDER_STAGE_RESAMPLE,       /* pa_resampler_run() on behalf of a stream */
+    PA_RENDER_STAGE_OUTPUT_PUSH,    /* pa_source_output_push() */
+    PA_RENDER_STAGE_MAX
+} pa_render_stage_t;
+
+/* Bucket k counts the durations of less than 2^(k+1) usec that didn't fit
+ * into bucket k-1, the last bucket counts everything longer */
+#define PA_RENDER_PROFILE_BUCKETS 16
+
+typedef struct pa_render_profile {
+    uint64_t n;
+    pa_usec_t total;
+    pa_usec_t max;
+    uint64_t buckets[PA_RENDER_PROFILE_BUCKETS];
+} pa_render_profile;
+
+void pa_render_profile_set_enabled(bool enabled);
+bool pa_render_profile_get_enabled(void);
+
+/* Returns the start time of a stage, or 0 if profiling is disabled */
+pa_usec_t pa_render_profile_start(void);
+
+/* Accounts the time since start, if it isn't 0 */
+void pa_render_profile_stop(pa_render_profile *p, pa_usec_t start);
+
+void pa_render_profile_add(pa_render_profile *p, pa_usec_t usec);
+
+/* Returns the upper limit of the durations in a bucket, in usec, or
+ * (pa_usec_t) -1 for the last one */
+pa_usec_t pa_render_profile_bucket_limit(unsigned bucket);
+
+const char *pa_render_stage_to_string(pa_render_stage_t stage);
+
+#endif
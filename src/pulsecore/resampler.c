@@ -28,12 +28,17 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/trace.h>
 
 #include "resampler.h"
 
 /* Number of samples of extra space we allow the resamplers to return */
 #define EXTRA_FRAMES 128
 
+/* Number of frames the fused convert and remap stage processes per pass.
+ * Both intermediate blocks are small enough to stay in the L1 cache. */
+#define FUSED_BLOCK_FRAMES 256
+
 struct ffmpeg_data { /* data specific to ffmpeg */
     struct AVResampleContext *state;
 };
@@ -118,6 +123,7 @@ static int (* const init_table[])(pa_resampler *r) = {
     [PA_RESAMPLER_SOXR_HQ]                 = NULL,
     [PA_RESAMPLER_SOXR_VHQ]                = NULL,
 #endif
+    [PA_RESAMPLER_POLYPHASE]               = pa_resampler_polyphase_init,
 };
 
 static pa_resample_method_t choose_auto_resampler(pa_resample_flags_t flags) {
@@ -163,9 +169,6 @@ static pa_resample_method_t fix_method(
             }
             /* Else fall through */
         case PA_RESAMPLER_FFMPEG:
-        case PA_RESAMPLER_SOXR_MQ:
-        case PA_RESAMPLER_SOXR_HQ:
-        case PA_RESAMPLER_SOXR_VHQ:
             if (flags & PA_RESAMPLER_VARIABLE_RATE) {
                 pa_log_info("Resampler '%s' cannot do variable rate, reverting to resampler 'auto'.", pa_resample_method_to_string(method));
                 method = PA_RESAMPLER_AUTO;
@@ -181,6 +184,18 @@ static pa_resample_method_t fix_method(
             }
             break;
 
+        /* The polyphase filter bank of ratios with large numbers in
+         * them would be too large */
+        case PA_RESAMPLER_POLYPHASE:
+            if (flags & PA_RESAMPLER_VARIABLE_RATE) {
+                pa_log_info("Resampler 'polyphase' cannot do variable rate, reverting to resampler 'auto'.");
+                method = PA_RESAMPLER_AUTO;
+            } else if (!pa_polyphase_rates_supported(rate_a, rate_b)) {
+                pa_log_info("Resampler 'polyphase' cannot convert %u Hz to %u Hz, reverting to resampler 'auto'.", rate_a, rate_b);
+                method = PA_RESAMPLER_AUTO;
+            }
+            break;
+
         default:
             break;
     }
@@ -335,9 +350,12 @@ pa_resampler* pa_resampler_new(
     pa_assert(method >= 0);
     pa_assert(method < PA_RESAMPLER_MAX);
 
+    r = pa_xnew0(pa_resampler, 1);
+    r->requested_method = method;
+    r->crossover_freq = crossover_freq;
+
     method = fix_method(flags, method, a->rate, b->rate);
 
-    r = pa_xnew0(pa_resampler, 1);
     r->mempool = pool;
     r->method = method;
     r->flags = flags;
@@ -428,6 +446,14 @@ pa_resampler* pa_resampler_new(
     if (init_table[method](r) < 0)
         goto fail;
 
+    /* Without rate change and LFE filter the format conversions and the
+     * remapping can be done in one pass over the data, block by block */
+    if (!r->impl.resample && !r->lfe_filter && r->map_required &&
+        (r->to_work_format_func || r->from_work_format_func)) {
+        r->fused_buf = pa_xmalloc(FUSED_BLOCK_FRAMES * r->w_sz * (r->i_ss.channels + r->o_ss.channels));
+        pa_log_debug("  using fused convert and remap stage");
+    }
+
     return r;
 
 fail:
@@ -460,9 +486,118 @@ void pa_resampler_free(pa_resampler *r) {
 
     free_remap(&r->remap);
 
+    pa_xfree(r->fused_buf);
     pa_xfree(r);
 }
 
+static void drop_buf(pa_memchunk *buf, size_t *size) {
+    if (buf->memblock) {
+        pa_memblock_unref(buf->memblock);
+        pa_memchunk_reset(buf);
+    }
+
+    *size = 0;
+}
+
+void pa_resampler_cache_init(pa_resampler_cache *c) {
+    pa_assert(c);
+
+    c->n_idle = 0;
+}
+
+void pa_resampler_cache_done(pa_resampler_cache *c) {
+    pa_assert(c);
+
+    while (c->n_idle > 0)
+        pa_resampler_free(c->idle[--c->n_idle]);
+}
+
+static bool cache_match(pa_resampler *r, pa_mempool *pool,
+                        const pa_sample_spec *a, const pa_channel_map *am,
+                        const pa_sample_spec *b, const pa_channel_map *bm,
+                        unsigned crossover_freq, pa_resample_method_t method, pa_resample_flags_t flags) {
+    pa_channel_map auto_map;
+
+    if (r->mempool != pool ||
+        r->requested_method != method ||
+        r->flags != flags ||
+        r->crossover_freq != crossover_freq ||
+        !pa_sample_spec_equal(&r->i_ss, a) ||
+        !pa_sample_spec_equal(&r->o_ss, b))
+        return false;
+
+    if (!am)
+        am = pa_channel_map_init_auto(&auto_map, a->channels, PA_CHANNEL_MAP_DEFAULT);
+    if (!am || !pa_channel_map_equal(&r->i_cm, am))
+        return false;
+
+    if (!bm)
+        bm = pa_channel_map_init_auto(&auto_map, b->channels, PA_CHANNEL_MAP_DEFAULT);
+    if (!bm || !pa_channel_map_equal(&r->o_cm, bm))
+        return false;
+
+    return true;
+}
+
+pa_resampler* pa_resampler_cache_get(
+        pa_resampler_cache *c,
+        pa_mempool *pool,
+        const pa_sample_spec *a,
+        const pa_channel_map *am,
+        const pa_sample_spec *b,
+        const pa_channel_map *bm,
+        unsigned crossover_freq,
+        pa_resample_method_t method,
+        pa_resample_flags_t flags) {
+
+    unsigned j;
+
+    pa_assert(c);
+
+    /* Look at the most recently returned resamplers first */
+    for (j = c->n_idle; j > 0; j--) {
+        pa_resampler *r = c->idle[j - 1];
+
+        if (!cache_match(r, pool, a, am, b, bm, crossover_freq, method, flags))
+            continue;
+
+        memmove(c->idle + j - 1, c->idle + j, (c->n_idle - j) * sizeof(pa_resampler*));
+        c->n_idle--;
+
+        pa_log_debug("Reusing cached resampler (method %s)", pa_resample_method_to_string(r->method));
+        return r;
+    }
+
+    return pa_resampler_new(pool, a, am, b, bm, crossover_freq, method, flags);
+}
+
+void pa_resampler_cache_put(pa_resampler_cache *c, pa_resampler *r) {
+    pa_assert(c);
+    pa_assert(r);
+
+    if (r->quality_lowered) {
+        pa_resampler_free(r);
+        return;
+    }
+
+    /* Clear the filter history and let go of the bounce buffers, so
+     * that idle resamplers don't keep mempool slots busy */
+    pa_resampler_reset(r);
+
+    drop_buf(&r->to_work_format_buf, &r->to_work_format_buf_size);
+    drop_buf(&r->remap_buf, &r->remap_buf_size);
+    drop_buf(&r->resample_buf, &r->resample_buf_size);
+    drop_buf(&r->from_work_format_buf, &r->from_work_format_buf_size);
+
+    if (c->n_idle >= PA_RESAMPLER_CACHE_MAX) {
+        pa_resampler_free(c->idle[0]);
+        memmove(c->idle, c->idle + 1, (PA_RESAMPLER_CACHE_MAX - 1) * sizeof(pa_resampler*));
+        c->n_idle--;
+    }
+
+    c->idle[c->n_idle++] = r;
+}
+
 void pa_resampler_set_input_rate(pa_resampler *r, uint32_t rate) {
     pa_assert(r);
     pa_assert(rate > 0);
@@ -580,16 +715,25 @@ void pa_resampler_reset(pa_resampler *r) {
     *r->have_leftover = false;
 }
 
-void pa_resampler_rewind(pa_resampler *r, size_t out_frames) {
+void pa_resampler_rewind(pa_resampler *r, size_t out_bytes, size_t in_bytes) {
     pa_assert(r);
 
-    /* For now, we don't have any rewindable resamplers, so we just
-       reset the resampler instead (and hope that nobody hears the difference). */
-    if (r->impl.reset)
+    if (r->impl.rewind) {
+        size_t n_frames = in_bytes / r->i_fz, leftover = 0;
+
+        /* Part of that input never made it past the leftover buffer */
+        if (*r->have_leftover)
+            leftover = r->leftover_buf->length / r->w_fz;
+
+        r->impl.rewind(r, (unsigned) (n_frames > leftover ? n_frames - leftover : 0));
+
+    } else if (r->impl.reset)
+        /* Resamplers that can't rewind are reset instead (and we hope that
+         * nobody hears the difference) */
         r->impl.reset(r);
 
     if (r->lfe_filter)
-        pa_lfe_filter_rewind(r->lfe_filter, out_frames);
+        pa_lfe_filter_rewind(r->lfe_filter, out_bytes);
 
     *r->have_leftover = false;
 }
@@ -600,6 +744,38 @@ pa_resample_method_t pa_resampler_get_method(pa_resampler *r) {
     return r->method;
 }
 
+int pa_resampler_lower_quality(pa_resampler *r) {
+    pa_resample_method_t old_method;
+
+    pa_assert(r);
+
+    if (!r->impl.lower_quality)
+        return -1;
+
+    old_method = r->method;
+
+    if (r->impl.lower_quality(r) < 0)
+        return -1;
+
+    pa_log_info("Lowered resampler quality from %s to %s.",
+                pa_resample_method_to_string(old_method), pa_resample_method_to_string(r->method));
+
+    r->quality_lowered = true;
+    return 0;
+}
+
+bool pa_resampler_same_config(pa_resampler *a, pa_resampler *b) {
+    pa_assert(a);
+    pa_assert(b);
+
+    return a->method == b->method &&
+        a->flags == b->flags &&
+        pa_sample_spec_equal(&a->i_ss, &b->i_ss) &&
+        pa_sample_spec_equal(&a->o_ss, &b->o_ss) &&
+        pa_channel_map_equal(&a->i_cm, &b->i_cm) &&
+        pa_channel_map_equal(&a->o_cm, &b->o_cm);
+}
+
 const pa_channel_map* pa_resampler_input_channel_map(pa_resampler *r) {
     pa_assert(r);
 
@@ -659,7 +835,8 @@ static const char * const resample_methods[] = {
     "peaks",
     "soxr-mq",
     "soxr-hq",
-    "soxr-vhq"
+    "soxr-vhq",
+    "polyphase"
 };
 
 const char *pa_resample_method_to_string(pa_resample_method_t m) {
@@ -1428,6 +1605,57 @@ static pa_memchunk *convert_from_work_format(pa_resampler *r, pa_memchunk *input
     return &r->from_work_format_buf;
 }
 
+static pa_memchunk *convert_remap_fused(pa_resampler *r, pa_memchunk *input) {
+    unsigned n_frames, n;
+    uint8_t *src, *dst, *work_in, *work_out;
+    pa_remap_t *remap = &r->remap;
+
+    pa_assert(r);
+    pa_assert(input);
+    pa_assert(input->memblock);
+    pa_assert(r->fused_buf);
+
+    /* Convert to the work format, remap and convert to the output format in
+     * blocks of FUSED_BLOCK_FRAMES, so that the input is read and the output
+     * is written only once. The result is placed in from_work_format_buf. */
+
+    n_frames = (unsigned) (input->length / r->i_fz);
+    fit_buf(r, &r->from_work_format_buf, r->o_fz * n_frames, &r->from_work_format_buf_size, 0);
+
+    src = pa_memblock_acquire_chunk(input);
+    dst = pa_memblock_acquire(r->from_work_format_buf.memblock);
+
+    work_in = r->fused_buf;
+    work_out = work_in + FUSED_BLOCK_FRAMES * r->w_sz * r->i_ss.channels;
+
+    for (; n_frames > 0; n_frames -= n) {
+        uint8_t *s = src, *d = dst;
+
+        n = PA_MIN(n_frames, FUSED_BLOCK_FRAMES);
+
+        if (r->to_work_format_func) {
+            r->to_work_format_func(n * r->i_ss.channels, src, work_in);
+            s = work_in;
+        }
+
+        if (r->from_work_format_func)
+            d = work_out;
+
+        remap->do_remap(remap, d, s, n);
+
+        if (r->from_work_format_func)
+            r->from_work_format_func(n * r->o_ss.channels, work_out, dst);
+
+        src += n * r->i_fz;
+        dst += n * r->o_fz;
+    }
+
+    pa_memblock_release(input->memblock);
+    pa_memblock_release(r->from_work_format_buf.memblock);
+
+    return &r->from_work_format_buf;
+}
+
 void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out) {
     pa_memchunk *buf;
 
@@ -1438,6 +1666,14 @@ void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out)
     pa_assert(in->memblock);
     pa_assert(in->length % r->i_fz == 0);
 
+    PA_TRACE2(resampler_run, r, in->length);
+
+    if (r->fused_buf) {
+        *out = *convert_remap_fused(r, (pa_memchunk*) in);
+        pa_memchunk_reset(&r->from_work_format_buf);
+        return;
+    }
+
     buf = (pa_memchunk*) in;
     buf = convert_to_work_format(r, buf);
 
@@ -39,6 +39,15 @@ struct pa_resampler_impl {
     unsigned (*resample)(pa_resampler *r, const pa_memchunk *in, unsigned in_n_frames, pa_memchunk *out, unsigned *out_n_frames);
 
     void (*reset)(pa_resampler *r);
+
+    /* Optional. Goes back to where the resampler was in_n_frames of
+     * input earlier. Without it, the resampler is reset instead. */
+    void (*rewind)(pa_resampler *r, unsigned in_n_frames);
+
+    /* Optional. Switches to a cheaper setting of the same method and
+     * updates r->method, returns a negative value if there is none. */
+    int (*lower_quality)(pa_resampler *r);
+
     void *data;
 };
 
@@ -61,6 +70,7 @@ typedef enum pa_resample_method {
     PA_RESAMPLER_SOXR_MQ,
     PA_RESAMPLER_SOXR_HQ,
     PA_RESAMPLER_SOXR_VHQ,
+    PA_RESAMPLER_POLYPHASE,
     PA_RESAMPLER_MAX
 } pa_resample_method_t;
 
@@ -76,6 +86,11 @@ struct pa_resampler {
     pa_resample_method_t method;
     pa_resample_flags_t flags;
 
+    /* The method and crossover frequency as passed to pa_resampler_new(),
+     * used for matching against pa_resampler_cache_get() requests */
+    pa_resample_method_t requested_method;
+    unsigned crossover_freq;
+
     pa_sample_spec i_ss, o_ss;
     pa_channel_map i_cm, o_cm;
     size_t i_fz, o_fz, w_fz, w_sz;
@@ -108,8 +123,15 @@ struct pa_resampler {
     pa_remap_t remap;
     bool map_required;
 
+    /* work memory of the fused convert and remap stage, NULL if unused */
+    void *fused_buf;
+
     pa_lfe_filter_t *lfe_filter;
 
+    /* Set by pa_resampler_lower_quality(), such resamplers no longer
+     * match their requested method and aren't cached */
+    bool quality_lowered;
+
     pa_resampler_impl impl;
 };
 
@@ -125,6 +147,39 @@ pa_resampler* pa_resampler_new(
 
 void pa_resampler_free(pa_resampler *r);
 
+#define PA_RESAMPLER_CACHE_MAX 4
+
+/* A small set of idle resamplers that can be handed out again instead
+ * of building new ones. Streams are often created with the same
+ * conversion as one that was just destroyed (notification sounds,
+ * clients that reconnect), and setting up the filter state, remapping
+ * matrix and LFE filter is a noticeable part of the stream setup
+ * time. Only to be used from the main thread. */
+typedef struct pa_resampler_cache {
+    pa_resampler *idle[PA_RESAMPLER_CACHE_MAX];
+    unsigned n_idle;
+} pa_resampler_cache;
+
+void pa_resampler_cache_init(pa_resampler_cache *c);
+void pa_resampler_cache_done(pa_resampler_cache *c);
+
+/* Like pa_resampler_new(), but reuses an idle resampler for the same
+ * conversion if there is one */
+pa_resampler* pa_resampler_cache_get(
+        pa_resampler_cache *c,
+        pa_mempool *pool,
+        const pa_sample_spec *a,
+        const pa_channel_map *am,
+        const pa_sample_spec *b,
+        const pa_channel_map *bm,
+        unsigned crossover_freq,
+        pa_resample_method_t resample_method,
+        pa_resample_flags_t flags);
+
+/* Hands a resampler back to the cache, evicting and freeing the oldest
+ * idle one when the cache is full */
+void pa_resampler_cache_put(pa_resampler_cache *c, pa_resampler *r);
+
 /* Returns the size of an input memory block which is required to return the specified amount of output data */
 size_t pa_resampler_request(pa_resampler *r, size_t out_length);
 
@@ -146,12 +201,20 @@ void pa_resampler_set_output_rate(pa_resampler *r, uint32_t rate);
 /* Reinitialize state of the resampler, possibly due to seeking or other discontinuities */
 void pa_resampler_reset(pa_resampler *r);
 
-/* Rewind resampler */
-void pa_resampler_rewind(pa_resampler *r, size_t out_frames);
+/* Rewind resampler. out_bytes of output are dropped, and in_bytes of
+ * input that led to them will be passed in again. */
+void pa_resampler_rewind(pa_resampler *r, size_t out_bytes, size_t in_bytes);
 
 /* Return the resampling method of the resampler object */
 pa_resample_method_t pa_resampler_get_method(pa_resampler *r);
 
+/* Make the resampler cheaper, for IO threads that run out of CPU time.
+ * Returns a negative value if it already is as cheap as it gets. */
+int pa_resampler_lower_quality(pa_resampler *r);
+
+/* Returns true if both resamplers turn the same input into the same output */
+bool pa_resampler_same_config(pa_resampler *a, pa_resampler *b);
+
 /* Try to parse the resampler method */
 pa_resample_method_t pa_parse_resample_method(const char *string);
 
@@ -173,8 +236,33 @@ int pa_resampler_peaks_init(pa_resampler *r);
 int pa_resampler_speex_init(pa_resampler *r);
 int pa_resampler_trivial_init(pa_resampler*r);
 int pa_resampler_soxr_init(pa_resampler *r);
+int pa_resampler_polyphase_init(pa_resampler *r);
 
 /* Resampler-specific quirks */
 bool pa_speex_is_fixed_point(void);
+bool pa_polyphase_rates_supported(uint32_t in_rate, uint32_t out_rate);
+
+/* The inner loop of the polyphase resampler, n is a multiple of 8 */
+typedef float (*pa_polyphase_dot_func_t)(const float *a, const float *b, unsigned n);
+
+pa_polyphase_dot_func_t pa_get_polyphase_dot_func(void);
+void pa_set_polyphase_dot_func(pa_polyphase_dot_func_t func);
+
+/* The inner loops of the peaks resampler: raise max[c] to the largest
+ * absolute value of channel c in n_frames interleaved frames. For S16 the
+ * absolute value saturates, so -0x8000 counts as 0x7FFF. */
+typedef void (*pa_peaks_s16_func_t)(const int16_t *src, unsigned channels, unsigned n_frames, int16_t *max);
+typedef void (*pa_peaks_float_func_t)(const float *src, unsigned channels, unsigned n_frames, float *max);
+
+pa_peaks_s16_func_t pa_get_peaks_s16_func(void);
+void pa_set_peaks_s16_func(pa_peaks_s16_func_t func);
+pa_peaks_float_func_t pa_get_peaks_float_func(void);
+void pa_set_peaks_float_func(pa_peaks_float_func_t func);
+
+/* Finds the per channel peaks of a block of S16NE or FLOAT32NE data
+ * directly, for users that want one value per block and have no use for
+ * a resampler. peaks are linear, 1.0 being full scale. Returns false for
+ * other formats. */
+bool pa_peaks_find(const void *src, const pa_sample_spec *ss, unsigned n_frames, float *peaks);
 
 #endif
@@ -34,9 +34,99 @@ struct peaks_data { /* data specific to the peak finder pseudo resampler */
     int16_t max_i[PA_CHANNELS_MAX];
 };
 
+static void peaks_s16_c(const int16_t *src, unsigned channels, unsigned n_frames, int16_t *max) {
+    unsigned c;
+
+    for (; n_frames > 0; n_frames--)
+        for (c = 0; c < channels; c++) {
+            int16_t n = *src == -0x8000 ? 0x7FFF : abs(*src);
+
+            src++;
+
+            if (n > max[c])
+                max[c] = n;
+        }
+}
+
+static void peaks_float_c(const float *src, unsigned channels, unsigned n_frames, float *max) {
+    unsigned c;
+
+    /* 1ch is treated separately, because that is the common case */
+    if (channels == 1) {
+        for (; n_frames > 0; n_frames--) {
+            float n = fabsf(*src++);
+
+            if (n > max[0])
+                max[0] = n;
+        }
+
+        return;
+    }
+
+    for (; n_frames > 0; n_frames--)
+        for (c = 0; c < channels; c++) {
+            float n = fabsf(*src++);
+
+            if (n > max[c])
+                max[c] = n;
+        }
+}
+
+static pa_peaks_s16_func_t peaks_s16_func = peaks_s16_c;
+static pa_peaks_float_func_t peaks_float_func = peaks_float_c;
+
+pa_peaks_s16_func_t pa_get_peaks_s16_func(void) {
+    return peaks_s16_func;
+}
+
+void pa_set_peaks_s16_func(pa_peaks_s16_func_t func) {
+    pa_assert(func);
+
+    peaks_s16_func = func;
+}
+
+pa_peaks_float_func_t pa_get_peaks_float_func(void) {
+    return peaks_float_func;
+}
+
+void pa_set_peaks_float_func(pa_peaks_float_func_t func) {
+    pa_assert(func);
+
+    peaks_float_func = func;
+}
+
+bool pa_peaks_find(const void *src, const pa_sample_spec *ss, unsigned n_frames, float *peaks) {
+    unsigned c;
+
+    pa_assert(src);
+    pa_assert(ss);
+    pa_assert(peaks);
+
+    if (ss->format == PA_SAMPLE_S16NE) {
+        int16_t max[PA_CHANNELS_MAX] = { 0 };
+
+        peaks_s16_func(src, ss->channels, n_frames, max);
+
+        for (c = 0; c < ss->channels; c++)
+            peaks[c] = (float) max[c] / 0x7FFF;
+
+        return true;
+    }
+
+    if (ss->format == PA_SAMPLE_FLOAT32NE) {
+        for (c = 0; c < ss->channels; c++)
+            peaks[c] = 0;
+
+        peaks_float_func(src, ss->channels, n_frames, peaks);
+        return true;
+    }
+
+    return false;
+}
+
 static unsigned peaks_resample(pa_resampler *r, const pa_memchunk *input, unsigned in_n_frames, pa_memchunk *output, unsigned *out_n_frames) {
     unsigned c, o_index = 0;
-    unsigned i, i_end = 0;
+    unsigned i, i_end = 0, n;
     void *src, *dst;
     struct peaks_data *peaks_data;
 
@@ -58,34 +148,13 @@ static unsigned peaks_resample(pa_resampler *r, const pa_memchunk *input, unsign
 
         pa_assert_fp(o_index * r->w_fz < pa_memblock_get_length(output->memblock));
 
-        /* 1ch float is treated separately, because that is the common case */
-        if (r->work_channels == 1 && r->work_format == PA_SAMPLE_FLOAT32NE) {
-            float *s = (float*) src + i;
-            float *d = (float*) dst + o_index;
-
-            for (; i < i_end && i < in_n_frames; i++) {
-                float n = fabsf(*s++);
+        n = i < i_end ? PA_MIN(i_end, in_n_frames) - PA_MIN(i, in_n_frames) : 0;
 
-                if (n > peaks_data->max_f[0])
-                    peaks_data->max_f[0] = n;
-            }
-
-            if (i == i_end) {
-                *d = peaks_data->max_f[0];
-                peaks_data->max_f[0] = 0;
-                o_index++, peaks_data->o_counter++;
-            }
-        } else if (r->work_format == PA_SAMPLE_S16NE) {
-            int16_t *s = (int16_t*) src + r->work_channels * i;
+        if (r->work_format == PA_SAMPLE_S16NE) {
             int16_t *d = (int16_t*) dst + r->work_channels * o_index;
 
-            for (; i < i_end && i < in_n_frames; i++)
-                for (c = 0; c < r->work_channels; c++) {
-                    int16_t n = abs(*s++);
-
-                    if (n > peaks_data->max_i[c])
-                        peaks_data->max_i[c] = n;
-                }
+            peaks_s16_func((int16_t*) src + r->work_channels * i, r->work_channels, n, peaks_data->max_i);
+            i += n;
 
             if (i == i_end) {
                 for (c = 0; c < r->work_channels; c++, d++) {
@@ -95,16 +164,10 @@ static unsigned peaks_resample(pa_resampler *r, const pa_memchunk *input, unsign
                 o_index++, peaks_data->o_counter++;
             }
         } else {
-            float *s = (float*) src + r->work_channels * i;
             float *d = (float*) dst + r->work_channels * o_index;
 
-            for (; i < i_end && i < in_n_frames; i++)
-                for (c = 0; c < r->work_channels; c++) {
-                    float n = fabsf(*s++);
-
-                    if (n > peaks_data->max_f[c])
-                        peaks_data->max_f[c] = n;
-                }
+            peaks_float_func((float*) src + r->work_channels * i, r->work_channels, n, peaks_data->max_f);
+            i += n;
 
             if (i == i_end) {
                 for (c = 0; c < r->work_channels; c++, d++) {
@@ -0,0 +1,217 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/resampler.h>
+
+#if (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__)
+
+#include <immintrin.h>
+
+/* The functions in this file produce the same results as the generic ones
+ * in peaks.c. A vector of W samples covers W / channels frames, so W frames
+ * make up exactly one vector per channel. Each of those vectors gets its own
+ * accumulator, which are folded into the per channel maxima at the end. */
+
+static void peaks_s16_tail(const int16_t *src, unsigned channels, unsigned n_frames, int16_t *max) {
+    unsigned c;
+
+    for (; n_frames > 0; n_frames--)
+        for (c = 0; c < channels; c++) {
+            int16_t n = *src == -0x8000 ? 0x7FFF : abs(*src);
+
+            src++;
+
+            if (n > max[c])
+                max[c] = n;
+        }
+}
+
+static void peaks_float_tail(const float *src, unsigned channels, unsigned n_frames, float *max) {
+    unsigned c;
+
+    for (; n_frames > 0; n_frames--)
+        for (c = 0; c < channels; c++) {
+            float n = fabsf(*src++);
+
+            if (n > max[c])
+                max[c] = n;
+        }
+}
+
+static void fold_s16(const int16_t *acc, unsigned n, unsigned channels, int16_t *max) {
+    unsigned i, c;
+
+    for (i = 0, c = 0; i < n; i++) {
+        if (acc[i] > max[c])
+            max[c] = acc[i];
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+static void fold_float(const float *acc, unsigned n, unsigned channels, float *max) {
+    unsigned i, c;
+
+    for (i = 0, c = 0; i < n; i++) {
+        if (acc[i] > max[c])
+            max[c] = acc[i];
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+__attribute__((target("sse2")))
+static void peaks_s16_sse2(const int16_t *src, unsigned channels, unsigned n_frames, int16_t *max) {
+    __m128i acc[PA_CHANNELS_MAX];
+    int16_t r[8 * PA_CHANNELS_MAX];
+    const __m128i zero = _mm_setzero_si128();
+    unsigned n, k;
+
+    if (n_frames < 8) {
+        peaks_s16_tail(src, channels, n_frames, max);
+        return;
+    }
+
+    for (k = 0; k < channels; k++)
+        acc[k] = zero;
+
+    for (n = n_frames / 8; n > 0; n--)
+        for (k = 0; k < channels; k++, src += 8) {
+            __m128i s = _mm_loadu_si128((const __m128i*) src);
+
+            /* The saturating negation turns -0x8000 into 0x7FFF */
+            acc[k] = _mm_max_epi16(acc[k], _mm_max_epi16(s, _mm_subs_epi16(zero, s)));
+        }
+
+    for (k = 0; k < channels; k++)
+        _mm_storeu_si128((__m128i*) (r + 8 * k), acc[k]);
+
+    fold_s16(r, 8 * channels, channels, max);
+    peaks_s16_tail(src, channels, n_frames % 8, max);
+}
+
+/* max_ps returns its second operand if either is NaN, so with the
+ * accumulator second NaNs are skipped, as they are by the generic code */
+__attribute__((target("sse")))
+static void peaks_float_sse(const float *src, unsigned channels, unsigned n_frames, float *max) {
+    __m128 acc[PA_CHANNELS_MAX];
+    float r[4 * PA_CHANNELS_MAX];
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    unsigned n, k;
+
+    if (n_frames < 4) {
+        peaks_float_tail(src, channels, n_frames, max);
+        return;
+    }
+
+    for (k = 0; k < channels; k++)
+        acc[k] = _mm_setzero_ps();
+
+    for (n = n_frames / 4; n > 0; n--)
+        for (k = 0; k < channels; k++, src += 4)
+            acc[k] = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(src), mask), acc[k]);
+
+    for (k = 0; k < channels; k++)
+        _mm_storeu_ps(r + 4 * k, acc[k]);
+
+    fold_float(r, 4 * channels, channels, max);
+    peaks_float_tail(src, channels, n_frames % 4, max);
+}
+
+__attribute__((target("avx2")))
+static void peaks_s16_avx2(const int16_t *src, unsigned channels, unsigned n_frames, int16_t *max) {
+    __m256i acc[PA_CHANNELS_MAX];
+    int16_t r[16 * PA_CHANNELS_MAX];
+    unsigned n, k;
+
+    if (n_frames < 16) {
+        peaks_s16_sse2(src, channels, n_frames, max);
+        return;
+    }
+
+    for (k = 0; k < channels; k++)
+        acc[k] = _mm256_setzero_si256();
+
+    for (n = n_frames / 16; n > 0; n--)
+        for (k = 0; k < channels; k++, src += 16) {
+            __m256i s = _mm256_loadu_si256((const __m256i*) src);
+
+            acc[k] = _mm256_max_epi16(acc[k], _mm256_max_epi16(s, _mm256_subs_epi16(_mm256_setzero_si256(), s)));
+        }
+
+    for (k = 0; k < channels; k++)
+        _mm256_storeu_si256((__m256i*) (r + 16 * k), acc[k]);
+
+    fold_s16(r, 16 * channels, channels, max);
+    peaks_s16_sse2(src, channels, n_frames % 16, max);
+}
+
+__attribute__((target("avx")))
+static void peaks_float_avx(const float *src, unsigned channels, unsigned n_frames, float *max) {
+    __m256 acc[PA_CHANNELS_MAX];
+    float r[8 * PA_CHANNELS_MAX];
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    unsigned n, k;
+
+    if (n_frames < 8) {
+        peaks_float_sse(src, channels, n_frames, max);
+        return;
+    }
+
+    for (k = 0; k < channels; k++)
+        acc[k] = _mm256_setzero_ps();
+
+    for (n = n_frames / 8; n > 0; n--)
+        for (k = 0; k < channels; k++, src += 8)
+            acc[k] = _mm256_max_ps(_mm256_and_ps(_mm256_loadu_ps(src), mask), acc[k]);
+
+    for (k = 0; k < channels; k++)
+        _mm256_storeu_ps(r + 8 * k, acc[k]);
+
+    fold_float(r, 8 * channels, channels, max);
+    peaks_float_sse(src, channels, n_frames % 8, max);
+}
+
+#endif /* (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__) */
+
+void pa_peaks_func_init_x86(pa_cpu_x86_flag_t flags) {
+#if (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__)
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized peak detection.");
+        pa_set_peaks_s16_func(peaks_s16_avx2);
+    } else if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized peak detection.");
+        pa_set_peaks_s16_func(peaks_s16_sse2);
+    }
+
+    if (flags & PA_CPU_X86_AVX)
+        pa_set_peaks_float_func(peaks_float_avx);
+    else if (flags & PA_CPU_X86_SSE)
+        pa_set_peaks_float_func(peaks_float_sse);
+#endif /* (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__) */
+}
@@ -0,0 +1,434 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/resampler.h>
+
+/* A windowed sinc filter bank with one set of taps for each of the L
+ * phases of a fixed rational ratio L/M, like 160/147 for 44100 -> 48000
+ * Hz. Each output frame is then a single dot product of a row of the
+ * bank with the input history, which the SIMD versions of the dot
+ * product do a whole vector at a time.
+ *
+ * The input history is kept for a while, so that the resampler can be
+ * rewound by recomputing its position instead of being reset.
+ *
+ * The bank only depends on the ratio, so all resamplers with the same
+ * one share it read-only. Only the history is per resampler. */
+
+/* Taps per phase when upsampling. Downsampling takes proportionally
+ * more, to keep the same transition band relative to the output rate.
+ * Always a multiple of 8, the width of the widest SIMD version. */
+#define BASE_TAPS 64
+
+/* Kaiser window for about 80 dB of stopband attenuation */
+#define ATTENUATION 80.0
+#define KAISER_BETA (0.1102 * (ATTENUATION - 8.7))
+
+/* Keeps the bank below 1 MiB or so */
+#define MAX_PHASES 1024
+#define MAX_TAPS 256
+
+/* How much input is kept for rewinding, about the size of a timer based
+ * scheduling buffer */
+#define REWIND_USEC (2 * PA_USEC_PER_SEC)
+
+struct polyphase_bank {
+    unsigned n_phases, step;   /* L and M */
+    unsigned n_taps;
+    float *taps;               /* n_phases rows of n_taps */
+
+    unsigned ref;              /* protected by bank_mutex */
+    PA_LLIST_FIELDS(struct polyphase_bank);
+};
+
+static pa_static_mutex bank_mutex = PA_STATIC_MUTEX_INIT;
+static PA_LLIST_HEAD(struct polyphase_bank, banks) = NULL;
+
+struct polyphase_data {
+    unsigned n_phases, step;   /* copied from the bank */
+    unsigned n_taps;
+    const float *bank;
+    struct polyphase_bank *shared;
+
+    unsigned channels;
+
+    /* A ring per channel, of ring_size frames plus a copy of the first
+     * n_taps after the end, so that every window is contiguous */
+    float *history;
+    unsigned ring_size;
+
+    uint64_t n_written;        /* frames written to the ring, including
+                                * the zeros at the start */
+    uint64_t out_index;        /* next output frame */
+    uint64_t in_pos;           /* its first tap, as a ring frame index */
+    unsigned phase;            /* its row of the bank */
+};
+
+static float dot_c(const float *a, const float *b, unsigned n) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+
+    /* Four independent sums, so that the adds don't wait for each other */
+    for (; n >= 4; n -= 4, a += 4, b += 4) {
+        s0 += a[0] * b[0];
+        s1 += a[1] * b[1];
+        s2 += a[2] * b[2];
+        s3 += a[3] * b[3];
+    }
+
+    for (; n > 0; n--)
+        s0 += *(a++) * *(b++);
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+static pa_polyphase_dot_func_t dot_func = dot_c;
+
+pa_polyphase_dot_func_t pa_get_polyphase_dot_func(void) {
+    return dot_func;
+}
+
+void pa_set_polyphase_dot_func(pa_polyphase_dot_func_t func) {
+    pa_assert(func);
+
+    dot_func = func;
+}
+
+static void get_ratio(uint32_t in_rate, uint32_t out_rate, unsigned *l, unsigned *m) {
+    unsigned g = pa_gcd(in_rate, out_rate);
+
+    *l = out_rate / g;
+    *m = in_rate / g;
+}
+
+bool pa_polyphase_rates_supported(uint32_t in_rate, uint32_t out_rate) {
+    unsigned l, m;
+
+    get_ratio(in_rate, out_rate, &l, &m);
+
+    return l <= MAX_PHASES && (uint64_t) BASE_TAPS * m <= (uint64_t) MAX_TAPS * l;
+}
+
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    unsigned k;
+
+    for (k = 1; term > sum * 1e-12; k++) {
+        double t = x / (2 * k);
+
+        term *= t * t;
+        sum += term;
+    }
+
+    return sum;
+}
+
+static void make_bank(struct polyphase_bank *d) {
+    double scale, fc, beta_i0;
+    unsigned p, k, half;
+
+    /* Cut off at the lower of the two Nyquist frequencies, with the
+     * stopband starting right there */
+    scale = d->n_phases < d->step ? (double) d->n_phases / d->step : 1.0;
+    fc = scale * (1.0 - (ATTENUATION - 8.0) / (2.285 * BASE_TAPS) / (2.0 * M_PI));
+
+    half = d->n_taps / 2;
+    beta_i0 = bessel_i0(KAISER_BETA);
+
+    for (p = 0; p < d->n_phases; p++) {
+        float *row = d->taps + p * d->n_taps;
+        double sum = 0.0;
+
+        for (k = 0; k < d->n_taps; k++) {
+            /* Distance of tap k from the output position, in input frames */
+            double u = (double) p / d->n_phases + half - 1 - k, h, w;
+
+            h = u == 0.0 ? fc : sin(M_PI * fc * u) / (M_PI * u);
+
+            w = u / half;
+            w = w >= 1.0 || w <= -1.0 ? 0.0 : bessel_i0(KAISER_BETA * sqrt(1.0 - w * w)) / beta_i0;
+
+            row[k] = (float) (h * w);
+            sum += row[k];
+        }
+
+        /* Unity gain at DC for every phase */
+        for (k = 0; k < d->n_taps; k++)
+            row[k] = (float) (row[k] / sum);
+    }
+}
+
+static struct polyphase_bank *bank_ref(unsigned n_phases, unsigned step, unsigned n_taps) {
+    struct polyphase_bank *b;
+    pa_mutex *m;
+
+    m = pa_static_mutex_get(&bank_mutex, false, false);
+    pa_mutex_lock(m);
+
+    PA_LLIST_FOREACH(b, banks)
+        if (b->n_phases == n_phases && b->step == step && b->n_taps == n_taps)
+            break;
+
+    if (b)
+        b->ref++;
+    else {
+        b = pa_xnew0(struct polyphase_bank, 1);
+        b->n_phases = n_phases;
+        b->step = step;
+        b->n_taps = n_taps;
+        b->taps = pa_xnew(float, n_phases * n_taps);
+        b->ref = 1;
+
+        make_bank(b);
+        PA_LLIST_PREPEND(struct polyphase_bank, banks, b);
+
+        pa_log_debug("Created polyphase filter bank for ratio %u/%u.", n_phases, step);
+    }
+
+    pa_mutex_unlock(m);
+
+    return b;
+}
+
+static void bank_unref(struct polyphase_bank *b) {
+    pa_mutex *m;
+
+    m = pa_static_mutex_get(&bank_mutex, false, false);
+    pa_mutex_lock(m);
+
+    pa_assert(b->ref >= 1);
+
+    if (--b->ref == 0) {
+        PA_LLIST_REMOVE(struct polyphase_bank, banks, b);
+        pa_xfree(b->taps);
+        pa_xfree(b);
+    }
+
+    pa_mutex_unlock(m);
+}
+
+/* Called with the output position, sets where its window starts */
+static void seek_output(struct polyphase_data *d, uint64_t out_index) {
+    uint64_t t = out_index * d->step;
+
+    d->out_index = out_index;
+    d->in_pos = t / d->n_phases;
+    d->phase = (unsigned) (t % d->n_phases);
+}
+
+static void clear_history(struct polyphase_data *d) {
+    unsigned c, stride = d->ring_size + d->n_taps;
+
+    /* The first outputs are centered on the first input frame, the
+     * window before it is silence */
+    for (c = 0; c < d->channels; c++) {
+        memset(d->history + c * stride, 0, d->n_taps * sizeof(float));
+        memset(d->history + c * stride + d->ring_size, 0, d->n_taps * sizeof(float));
+    }
+
+    d->n_written = d->n_taps / 2 - 1;
+    seek_output(d, 0);
+}
+
+static void write_history(struct polyphase_data *d, const float *src, unsigned n_frames) {
+    unsigned stride = d->ring_size + d->n_taps;
+
+    for (; n_frames > 0; n_frames--, d->n_written++) {
+        unsigned pos = (unsigned) (d->n_written % d->ring_size), c;
+
+        for (c = 0; c < d->channels; c++) {
+            float *h = d->history + c * stride;
+
+            h[pos] = *src;
+            if (pos < d->n_taps)
+                h[pos + d->ring_size] = *src;
+
+            src++;
+        }
+    }
+}
+
+/* Returns the number of frames written to dst */
+static unsigned read_history(struct polyphase_data *d, float *dst, unsigned max_frames) {
+    unsigned stride = d->ring_size + d->n_taps, n = 0;
+
+    while (n < max_frames && d->in_pos + d->n_taps <= d->n_written) {
+        const float *row = d->bank + d->phase * d->n_taps;
+        const float *h = d->history + (unsigned) (d->in_pos % d->ring_size);
+        unsigned c;
+
+        for (c = 0; c < d->channels; c++)
+            *(dst++) = dot_func(row, h + c * stride, d->n_taps);
+
+        n++;
+        d->out_index++;
+        d->phase += d->step;
+        d->in_pos += d->phase / d->n_phases;
+        d->phase %= d->n_phases;
+    }
+
+    return n;
+}
+
+static unsigned polyphase_resample(pa_resampler *r, const pa_memchunk *input, unsigned in_n_frames, pa_memchunk *output, unsigned *out_n_frames) {
+    struct polyphase_data *d;
+    const float *src;
+    float *dst;
+    unsigned done = 0, max_chunk;
+
+    pa_assert(r);
+    pa_assert(input);
+    pa_assert(output);
+    pa_assert(out_n_frames);
+
+    d = r->impl.data;
+
+    src = pa_memblock_acquire_chunk(input);
+    dst = pa_memblock_acquire_chunk(output);
+
+    /* Don't overwrite the windows of outputs that are still due */
+    max_chunk = d->ring_size - 2 * d->n_taps;
+
+    while (in_n_frames > 0) {
+        unsigned n = PA_MIN(in_n_frames, max_chunk);
+
+        /* Out of room, the rest is left over for the next call */
+        if (done >= *out_n_frames)
+            break;
+
+        write_history(d, src, n);
+        src += n * d->channels;
+        in_n_frames -= n;
+
+        done += read_history(d, dst + done * d->channels, *out_n_frames - done);
+    }
+
+    pa_memblock_release(input->memblock);
+    pa_memblock_release(output->memblock);
+
+    *out_n_frames = done;
+
+    return in_n_frames;
+}
+
+static void polyphase_reset(pa_resampler *r) {
+    pa_assert(r);
+
+    clear_history(r->impl.data);
+}
+
+static void polyphase_rewind(pa_resampler *r, unsigned in_n_frames) {
+    struct polyphase_data *d;
+    uint64_t end, out_index = 0;
+
+    pa_assert(r);
+
+    d = r->impl.data;
+
+    if (in_n_frames == 0)
+        return;
+
+    /* We can only go back to where the input still is in the ring,
+     * and not before the initial silence */
+    if ((uint64_t) in_n_frames + d->n_taps / 2 - 1 > d->n_written ||
+        (uint64_t) in_n_frames + 2 * d->n_taps > d->ring_size) {
+        pa_log_debug("Can't rewind %u frames, resetting.", in_n_frames);
+        clear_history(d);
+        return;
+    }
+
+    end = d->n_written - in_n_frames;
+
+    /* The outputs that this much input would have produced */
+    if (end >= d->n_taps)
+        out_index = ((end - d->n_taps + 1) * d->n_phases + d->step - 1) / d->step;
+
+    d->n_written = end;
+
+    /* Normally everything due was read last time, and no output is
+     * ahead of the input */
+    if (out_index < d->out_index)
+        seek_output(d, out_index);
+}
+
+static void polyphase_free(pa_resampler *r) {
+    struct polyphase_data *d;
+
+    pa_assert(r);
+
+    if (!(d = r->impl.data))
+        return;
+
+    bank_unref(d->shared);
+    pa_xfree(d->history);
+    pa_xfree(d);
+}
+
+int pa_resampler_polyphase_init(pa_resampler *r) {
+    struct polyphase_data *d;
+    unsigned n_taps, l, m;
+
+    pa_assert(r);
+    pa_assert(r->work_format == PA_SAMPLE_FLOAT32NE);
+
+    if (!pa_polyphase_rates_supported(r->i_ss.rate, r->o_ss.rate))
+        return -1;
+
+    d = pa_xnew0(struct polyphase_data, 1);
+    get_ratio(r->i_ss.rate, r->o_ss.rate, &l, &m);
+
+    n_taps = BASE_TAPS;
+    if (m > l)
+        n_taps = (BASE_TAPS * m + l - 1) / l;
+
+    d->shared = bank_ref(l, m, PA_ROUND_UP(n_taps, 8));
+    d->n_phases = l;
+    d->step = m;
+    d->n_taps = d->shared->n_taps;
+    d->bank = d->shared->taps;
+
+    d->channels = r->work_channels;
+    d->ring_size = (unsigned) pa_usec_to_bytes(REWIND_USEC, &r->i_ss) / r->i_fz + 2 * d->n_taps + 4096;
+
+    d->history = pa_xnew(float, d->channels * (d->ring_size + d->n_taps));
+
+    clear_history(d);
+
+    pa_log_info("Polyphase resampler with %u phases of %u taps, ratio %u/%u.", d->n_phases, d->n_taps, d->n_phases, d->step);
+
+    r->impl.free = polyphase_free;
+    r->impl.resample = polyphase_resample;
+    r->impl.reset = polyphase_reset;
+    r->impl.rewind = polyphase_rewind;
+    r->impl.data = d;
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/resampler.h>
+
+#if (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__)
+
+#include <immintrin.h>
+
+/* Like the volume functions in svolume_avx.c, these are compiled with
+ * per-function target attributes. The sums are taken in a different
+ * order than in the C version, so the results differ in the last bits. */
+
+__attribute__((target("sse")))
+static float dot_sse(const float *a, const float *b, unsigned n) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    float r[4];
+
+    for (; n > 0; n -= 8, a += 8, b += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a), _mm_loadu_ps(b)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + 4), _mm_loadu_ps(b + 4)));
+    }
+
+    _mm_storeu_ps(r, _mm_add_ps(s0, s1));
+
+    return (r[0] + r[1]) + (r[2] + r[3]);
+}
+
+__attribute__((target("avx")))
+static float dot_avx(const float *a, const float *b, unsigned n) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m128 s;
+
+    /* Two sums, so that an add doesn't wait for the one before it */
+    for (; n >= 16; n -= 16, a += 16, b += 16) {
+        s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b)));
+        s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(a + 8), _mm256_loadu_ps(b + 8)));
+    }
+
+    if (n > 0)
+        s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b)));
+
+    s0 = _mm256_add_ps(s0, s1);
+    s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+
+    return _mm_cvtss_f32(s);
+}
+
+#endif /* (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__) */
+
+void pa_polyphase_func_init_x86(pa_cpu_x86_flag_t flags) {
+#if (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__)
+    if (flags & PA_CPU_X86_AVX) {
+        pa_log_info("Initialising AVX optimized polyphase resampler.");
+        pa_set_polyphase_dot_func(dot_avx);
+    } else if (flags & PA_CPU_X86_SSE) {
+        pa_log_info("Initialising SSE optimized polyphase resampler.");
+        pa_set_polyphase_dot_func(dot_sse);
+    }
+#endif /* (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__) */
+}
@@ -26,6 +26,15 @@
 
 #include <pulsecore/resampler.h>
 
+/* In variable rate mode the context is created for up to this many times
+ * the initial conversion ratio, and rate changes within that range are
+ * done by changing the ratio of the running context */
+#define VR_MAX_RATIO_FACTOR 2
+
+/* Rate changes are spread over this many milliseconds of output, so that
+ * drift compensation doesn't cause steps */
+#define VR_SLEW_MSEC 10
+
 static unsigned resampler_soxr_resample(pa_resampler *r, const pa_memchunk *input, unsigned in_n_frames,
                                         pa_memchunk *output, unsigned *out_n_frames) {
     soxr_t state;
@@ -93,7 +102,13 @@ static void resampler_soxr_update_rates(pa_resampler *r) {
 
     pa_assert(r);
 
-    /* There is no update method in libsoxr,
+    /* A variable rate context can change its ratio on the fly, libsoxr
+     * refuses ratios above the maximum the context was created for */
+    if ((r->flags & PA_RESAMPLER_VARIABLE_RATE) && r->impl.data &&
+        !soxr_set_io_ratio(r->impl.data, (double) r->i_ss.rate / r->o_ss.rate, r->o_ss.rate * VR_SLEW_MSEC / 1000))
+        return;
+
+    /* Otherwise there is no update method in libsoxr,
      * so just re-create the resampler context */
 
     old_state = r->impl.data;
@@ -150,9 +165,21 @@ int pa_resampler_soxr_init(pa_resampler *r) {
             pa_assert_not_reached();
     }
 
-    quality = soxr_quality_spec(quality_recipe, 0);
+    if (r->flags & PA_RESAMPLER_VARIABLE_RATE) {
+        /* The rates given to soxr_create() only set the maximum ratio
+         * of a variable rate context, the actual one is set separately */
+        quality = soxr_quality_spec(quality_recipe, SOXR_VR);
+        state = soxr_create((double) r->i_ss.rate / r->o_ss.rate * VR_MAX_RATIO_FACTOR, 1, r->work_channels, &err, &io_spec, &quality, &runtime_spec);
+
+        if (state && (err = soxr_set_io_ratio(state, (double) r->i_ss.rate / r->o_ss.rate, 0))) {
+            soxr_delete(state);
+            state = NULL;
+        }
+    } else {
+        quality = soxr_quality_spec(quality_recipe, 0);
+        state = soxr_create(r->i_ss.rate, r->o_ss.rate, r->work_channels, &err, &io_spec, &quality, &runtime_spec);
+    }
 
-    state = soxr_create(r->i_ss.rate, r->o_ss.rate, r->work_channels, &err, &io_spec, &quality, &runtime_spec);
     if (!state) {
         pa_log_error("Failed to create libsoxr resampler context: %s.", (err ? err : "[unknown error]"));
         return -1;
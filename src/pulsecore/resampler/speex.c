@@ -134,6 +134,31 @@ static void speex_reset(pa_resampler *r) {
     pa_assert_se(speex_resampler_reset_mem(state) == 0);
 }
 
+static int speex_lower_quality(pa_resampler *r) {
+    SpeexResamplerState *state;
+    int q;
+
+    pa_assert(r);
+
+    state = r->impl.data;
+    speex_resampler_get_quality(state, &q);
+
+    if (q <= SPEEX_RESAMPLER_QUALITY_MIN)
+        return -1;
+
+    q--;
+
+    if (speex_resampler_set_quality(state, q) != RESAMPLER_ERR_SUCCESS)
+        return -1;
+
+    if (r->method >= PA_RESAMPLER_SPEEX_FIXED_BASE && r->method <= PA_RESAMPLER_SPEEX_FIXED_MAX)
+        r->method = PA_RESAMPLER_SPEEX_FIXED_BASE + q;
+    else
+        r->method = PA_RESAMPLER_SPEEX_FLOAT_BASE + q;
+
+    return 0;
+}
+
 static void speex_free(pa_resampler *r) {
     SpeexResamplerState *state;
     pa_assert(r);
@@ -154,6 +179,7 @@ int pa_resampler_speex_init(pa_resampler *r) {
     r->impl.free = speex_free;
     r->impl.update_rates = speex_update_rates;
     r->impl.reset = speex_reset;
+    r->impl.lower_quality = speex_lower_quality;
 
     if (r->method >= PA_RESAMPLER_SPEEX_FIXED_BASE && r->method <= PA_RESAMPLER_SPEEX_FIXED_MAX) {
 
@@ -0,0 +1,103 @@
+#ifndef foopulseringbufferhfoo
+#define foopulseringbufferhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  Copyright 2014 David Henningsson, Canonical Ltd.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/* A lock-free ringbuffer for exactly one reader and one writer, which
+ * may run in different threads or processes. Only count is shared,
+ * each side keeps its own index. */
+typedef struct pa_ringbuffer pa_ringbuffer;
+
+struct pa_ringbuffer {
+    pa_atomic_t *count; /* amount of data in the buffer */
+    int capacity;
+    uint8_t *memory;
+    int readindex, writeindex;
+};
+
+static inline void *pa_ringbuffer_peek(pa_ringbuffer *r, int *count) {
+    int c = pa_atomic_load_acquire(r->count);
+
+    if (r->readindex + c > r->capacity)
+        *count = r->capacity - r->readindex;
+    else
+        *count = c;
+
+    return r->memory + r->readindex;
+}
+
+/* Returns true only if the buffer was completely full before the drop. */
+static inline bool pa_ringbuffer_drop(pa_ringbuffer *r, int count) {
+    bool b = pa_atomic_sub(r->count, count) >= r->capacity;
+
+    r->readindex += count;
+    r->readindex %= r->capacity;
+
+    return b;
+}
+
+static inline void *pa_ringbuffer_begin_write(pa_ringbuffer *r, int *count) {
+    int c = pa_atomic_load_acquire(r->count);
+
+    *count = PA_MIN(r->capacity - r->writeindex, r->capacity - c);
+
+    return r->memory + r->writeindex;
+}
+
+/* Returns true only if the buffer was empty before the write. */
+static inline bool pa_ringbuffer_end_write(pa_ringbuffer *r, int count) {
+    bool b = pa_atomic_add(r->count, count) == 0;
+
+    r->writeindex += count;
+    r->writeindex %= r->capacity;
+
+    return b;
+}
+
+/* Copies length bytes that start skip bytes after the read index out
+ * of the buffer, wrapping around as needed, without dropping them.
+ * The caller must have checked that they are there. */
+static inline void pa_ringbuffer_copy_out(pa_ringbuffer *r, int skip, void *data, int length) {
+    int i = (r->readindex + skip) % r->capacity;
+    int n = PA_MIN(length, r->capacity - i);
+
+    memcpy(data, r->memory + i, n);
+    memcpy((uint8_t*) data + n, r->memory, length - n);
+}
+
+/* Copies length bytes to skip bytes after the write index, wrapping
+ * around as needed. They only become visible to the reader with
+ * pa_ringbuffer_end_write(), which may cover several such copies at
+ * once. The caller must have checked that there is room for them. */
+static inline void pa_ringbuffer_copy_in(pa_ringbuffer *r, int skip, const void *data, int length) {
+    int i = (r->writeindex + skip) % r->capacity;
+    int n = PA_MIN(length, r->capacity - i);
+
+    memcpy(r->memory + i, data, n);
+    memcpy(r->memory, (const uint8_t*) data + n, length - n);
+}
+
+#endif
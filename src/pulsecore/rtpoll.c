@@ -26,6 +26,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
 
 #include <pulse/xmalloc.h>
 #include <pulse/timeval.h>
@@ -45,17 +51,38 @@
 /* #define DEBUG_TIMING */
 
 struct pa_rtpoll {
-    struct pollfd *pollfd, *pollfd2;
-    unsigned n_pollfd_alloc, n_pollfd_used;
+    /* Every item keeps its slots in the pollfd array for as long as it
+     * lives. Slots of freed items are disabled with fd = -1 and only
+     * reused when the array is compacted. */
+    struct pollfd *pollfd;
+    unsigned n_pollfd_alloc, n_pollfd_used, n_pollfd_holes;
+
+    /* The items that have callbacks, in the order of the item list, so
+     * that pa_rtpoll_run() doesn't need to walk all the others. Updated
+     * at the start of pa_rtpoll_run() if callbacks_changed is set. */
+    pa_rtpoll_item **work_items, **poll_items;
+    unsigned n_work_items, n_poll_items, n_callback_items_alloc;
 
     struct timeval next_elapse;
     bool timer_enabled:1;
 
     bool scan_for_dead:1;
     bool running:1;
-    bool rebuild_needed:1;
+    bool callbacks_changed:1;
     bool quit:1;
     bool timer_elapsed:1;
+    bool timer_slack_changed:1;
+
+    pa_usec_t timer_slack;
+
+#ifdef HAVE_SYS_TIMERFD_H
+    /* When available, the timer is an absolute timerfd that is polled
+     * like any other fd, instead of the poll() timeout. timerfd_armed
+     * is the time it is currently armed at, or zero. */
+    int timer_fd;
+    pa_rtpoll_item *timer_item;
+    struct timeval timer_fd_armed;
+#endif
 
 #ifdef DEBUG_TIMING
     pa_usec_t timestamp;
@@ -71,8 +98,7 @@ struct pa_rtpoll_item {
 
     pa_rtpoll_priority_t priority;
 
-    struct pollfd *pollfd;
-    unsigned n_pollfd;
+    unsigned pollfd_idx, n_pollfd;
 
     int (*work_cb)(pa_rtpoll_item *i);
     int (*before_cb)(pa_rtpoll_item *i);
@@ -84,6 +110,77 @@ struct pa_rtpoll_item {
 
 PA_STATIC_FLIST_DECLARE(items, 0, pa_xfree);
 
+static struct pollfd *item_pollfd(pa_rtpoll_item *i) {
+    return i->n_pollfd > 0 ? i->rtpoll->pollfd + i->pollfd_idx : NULL;
+}
+
+#ifdef HAVE_SYS_TIMERFD_H
+static void timer_fd_init(pa_rtpoll *p) {
+    struct pollfd *pollfd;
+
+    p->timer_fd = -1;
+
+    if (getenv("PULSE_NO_TIMERFD"))
+        return;
+
+    if ((p->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0) {
+        pa_log_debug("timerfd_create() failed, using the poll() timeout: %s", pa_cstrerror(errno));
+        return;
+    }
+
+    /* Nobody but us looks at this one, hence no callbacks */
+    p->timer_item = pa_rtpoll_item_new(p, PA_RTPOLL_NEVER, 1);
+    pollfd = pa_rtpoll_item_get_pollfd(p->timer_item, NULL);
+    pollfd->fd = p->timer_fd;
+    pollfd->events = POLLIN;
+}
+
+/* Arms the timerfd at next_elapse, or disarms it if NULL */
+static void timer_fd_arm(pa_rtpoll *p, const struct timeval *next_elapse) {
+    struct itimerspec its;
+
+    pa_zero(its);
+
+    if (next_elapse) {
+        if (pa_timeval_cmp(next_elapse, &p->timer_fd_armed) == 0)
+            return;
+
+        its.it_value.tv_sec = next_elapse->tv_sec;
+        its.it_value.tv_nsec = next_elapse->tv_usec * PA_NSEC_PER_USEC;
+    } else if (p->timer_fd_armed.tv_sec == 0 && p->timer_fd_armed.tv_usec == 0)
+        return;
+
+    /* This also resets any expiration that has not been read yet */
+    pa_assert_se(timerfd_settime(p->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0);
+
+    if (next_elapse)
+        p->timer_fd_armed = *next_elapse;
+    else
+        pa_zero(p->timer_fd_armed);
+}
+
+/* Returns true if the timerfd woke us up */
+static bool timer_fd_elapsed(pa_rtpoll *p) {
+    struct pollfd *pollfd;
+    uint64_t expirations;
+
+    pollfd = pa_rtpoll_item_get_pollfd(p->timer_item, NULL);
+
+    if (!(pollfd->revents & POLLIN))
+        return false;
+
+    pollfd->revents = 0;
+
+    /* One-shot timer, so there is nothing left armed after this */
+    if (read(p->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        pa_log_error("Failed to read from timerfd: %s", pa_cstrerror(errno));
+
+    pa_zero(p->timer_fd_armed);
+
+    return true;
+}
+#endif
+
 pa_rtpoll *pa_rtpoll_new(void) {
     pa_rtpoll *p;
 
@@ -91,7 +188,10 @@ pa_rtpoll *pa_rtpoll_new(void) {
 
     p->n_pollfd_alloc = 32;
     p->pollfd = pa_xnew(struct pollfd, p->n_pollfd_alloc);
-    p->pollfd2 = pa_xnew(struct pollfd, p->n_pollfd_alloc);
+
+#ifdef HAVE_SYS_TIMERFD_H
+    timer_fd_init(p);
+#endif
 
 #ifdef DEBUG_TIMING
     p->timestamp = pa_rtclock_now();
@@ -100,49 +200,61 @@ pa_rtpoll *pa_rtpoll_new(void) {
     return p;
 }
 
-static void rtpoll_rebuild(pa_rtpoll *p) {
-
-    struct pollfd *e, *t;
+/* Moves the slots of all items together, dropping the holes */
+static void rtpoll_compact(pa_rtpoll *p) {
+    struct pollfd *pollfd;
     pa_rtpoll_item *i;
-    int ra = 0;
+    unsigned n = 0;
 
     pa_assert(p);
 
-    p->rebuild_needed = false;
+    pollfd = pa_xnew(struct pollfd, p->n_pollfd_alloc);
+
+    for (i = p->items; i; i = i->next) {
+
+        if (i->n_pollfd <= 0)
+            continue;
 
-    if (p->n_pollfd_used > p->n_pollfd_alloc) {
-        /* Hmm, we have to allocate some more space */
-        p->n_pollfd_alloc = p->n_pollfd_used * 2;
-        p->pollfd2 = pa_xrealloc(p->pollfd2, p->n_pollfd_alloc * sizeof(struct pollfd));
-        ra = 1;
+        memcpy(pollfd + n, p->pollfd + i->pollfd_idx, i->n_pollfd * sizeof(struct pollfd));
+        i->pollfd_idx = n;
+        n += i->n_pollfd;
     }
 
-    e = p->pollfd2;
+    pa_assert(n == p->n_pollfd_used - p->n_pollfd_holes);
 
-    for (i = p->items; i; i = i->next) {
+    pa_xfree(p->pollfd);
+    p->pollfd = pollfd;
+    p->n_pollfd_used = n;
+    p->n_pollfd_holes = 0;
+}
+
+static void rtpoll_update_callbacks(pa_rtpoll *p) {
+    pa_rtpoll_item *i;
+    unsigned n = 0;
 
-        if (i->n_pollfd > 0) {
-            size_t l = i->n_pollfd * sizeof(struct pollfd);
+    pa_assert(p);
 
-            if (i->pollfd)
-                memcpy(e, i->pollfd, l);
-            else
-                memset(e, 0, l);
+    p->callbacks_changed = false;
 
-            i->pollfd = e;
-        } else
-            i->pollfd = NULL;
+    for (i = p->items; i && i->priority < PA_RTPOLL_NEVER; i = i->next)
+        n++;
 
-        e += i->n_pollfd;
+    if (n > p->n_callback_items_alloc) {
+        p->n_callback_items_alloc = PA_MAX(n, p->n_callback_items_alloc * 2);
+        p->work_items = pa_xrenew(pa_rtpoll_item*, p->work_items, p->n_callback_items_alloc);
+        p->poll_items = pa_xrenew(pa_rtpoll_item*, p->poll_items, p->n_callback_items_alloc);
     }
 
-    pa_assert((unsigned) (e - p->pollfd2) == p->n_pollfd_used);
-    t = p->pollfd;
-    p->pollfd = p->pollfd2;
-    p->pollfd2 = t;
+    p->n_work_items = p->n_poll_items = 0;
 
-    if (ra)
-        p->pollfd2 = pa_xrealloc(p->pollfd2, p->n_pollfd_alloc * sizeof(struct pollfd));
+    for (i = p->items; i && i->priority < PA_RTPOLL_NEVER; i = i->next) {
+
+        if (i->work_cb)
+            p->work_items[p->n_work_items++] = i;
+
+        if (i->before_cb || i->after_cb)
+            p->poll_items[p->n_poll_items++] = i;
+    }
 }
 
 static void rtpoll_item_destroy(pa_rtpoll_item *i) {
@@ -154,12 +266,28 @@ static void rtpoll_item_destroy(pa_rtpoll_item *i) {
 
     PA_LLIST_REMOVE(pa_rtpoll_item, p->items, i);
 
-    p->n_pollfd_used -= i->n_pollfd;
+    if (i->n_pollfd > 0) {
+        if (i->pollfd_idx + i->n_pollfd == p->n_pollfd_used)
+            p->n_pollfd_used -= i->n_pollfd;
+        else {
+            unsigned k;
+
+            for (k = i->pollfd_idx; k < i->pollfd_idx + i->n_pollfd; k++) {
+                p->pollfd[k].fd = -1;
+                p->pollfd[k].events = p->pollfd[k].revents = 0;
+            }
+
+            p->n_pollfd_holes += i->n_pollfd;
+        }
+
+        if (p->n_pollfd_holes > 16 && p->n_pollfd_holes > p->n_pollfd_used / 2)
+            rtpoll_compact(p);
+    }
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(items), i) < 0)
         pa_xfree(i);
 
-    p->rebuild_needed = true;
+    p->callbacks_changed = true;
 }
 
 void pa_rtpoll_free(pa_rtpoll *p) {
@@ -168,43 +296,24 @@ void pa_rtpoll_free(pa_rtpoll *p) {
     while (p->items)
         rtpoll_item_destroy(p->items);
 
+#ifdef HAVE_SYS_TIMERFD_H
+    if (p->timer_fd >= 0)
+        pa_close(p->timer_fd);
+#endif
+
     pa_xfree(p->pollfd);
-    pa_xfree(p->pollfd2);
+    pa_xfree(p->work_items);
+    pa_xfree(p->poll_items);
 
     pa_xfree(p);
 }
 
-static void reset_revents(pa_rtpoll_item *i) {
-    struct pollfd *f;
-    unsigned n;
-
-    pa_assert(i);
-
-    if (!(f = pa_rtpoll_item_get_pollfd(i, &n)))
-        return;
-
-    for (; n > 0; n--)
-        f[n-1].revents = 0;
-}
-
-static void reset_all_revents(pa_rtpoll *p) {
-    pa_rtpoll_item *i;
-
-    pa_assert(p);
-
-    for (i = p->items; i; i = i->next) {
-
-        if (i->dead)
-            continue;
-
-        reset_revents(i);
-    }
-}
-
 int pa_rtpoll_run(pa_rtpoll *p) {
     pa_rtpoll_item *i;
+    unsigned n, m;
     int r = 0;
     struct timeval timeout;
+    bool use_timeout;
 
     pa_assert(p);
     pa_assert(!p->running);
@@ -216,14 +325,24 @@ int pa_rtpoll_run(pa_rtpoll *p) {
     p->running = true;
     p->timer_elapsed = false;
 
+    /* The slack belongs to the thread, so it can only be set from here */
+    if (p->timer_slack_changed) {
+        pa_rtclock_set_thread_timer_slack(p->timer_slack);
+        p->timer_slack_changed = false;
+    }
+
+    /* Items created or given callbacks while we run are only looked at
+     * from the next iteration on */
+    if (p->callbacks_changed)
+        rtpoll_update_callbacks(p);
+
     /* First, let's do some work */
-    for (i = p->items; i && i->priority < PA_RTPOLL_NEVER; i = i->next) {
+    for (n = 0; n < p->n_work_items; n++) {
         int k;
 
-        if (i->dead)
-            continue;
+        i = p->work_items[n];
 
-        if (!i->work_cb)
+        if (i->dead || !i->work_cb)
             continue;
 
         if (p->quit) {
@@ -244,25 +363,22 @@ int pa_rtpoll_run(pa_rtpoll *p) {
     }
 
     /* Now let's prepare for entering the sleep */
-    for (i = p->items; i && i->priority < PA_RTPOLL_NEVER; i = i->next) {
+    for (n = 0; n < p->n_poll_items; n++) {
         int k = 0;
 
-        if (i->dead)
-            continue;
+        i = p->poll_items[n];
 
-        if (!i->before_cb)
+        if (i->dead || !i->before_cb)
             continue;
 
         if (p->quit || (k = i->before_cb(i)) != 0) {
 
             /* Hmm, this one doesn't let us enter the poll, so rewind everything */
 
-            for (i = i->prev; i; i = i->prev) {
+            for (m = n; m > 0; m--) {
+                i = p->poll_items[m-1];
 
-                if (i->dead)
-                    continue;
-
-                if (!i->after_cb)
+                if (i->dead || !i->after_cb)
                     continue;
 
                 i->after_cb(i);
@@ -277,20 +393,32 @@ int pa_rtpoll_run(pa_rtpoll *p) {
         }
     }
 
-    if (p->rebuild_needed)
-        rtpoll_rebuild(p);
-
     pa_zero(timeout);
+    use_timeout = p->quit || p->timer_enabled;
 
     /* Calculate timeout */
     if (!p->quit && p->timer_enabled) {
         struct timeval now;
         pa_rtclock_get(&now);
 
-        if (pa_timeval_cmp(&p->next_elapse, &now) > 0)
+        if (pa_timeval_cmp(&p->next_elapse, &now) > 0) {
             pa_timeval_add(&timeout, pa_timeval_diff(&p->next_elapse, &now));
+
+#ifdef HAVE_SYS_TIMERFD_H
+            if (p->timer_fd >= 0) {
+                timer_fd_arm(p, &p->next_elapse);
+                use_timeout = false;
+            }
+#endif
+        }
     }
 
+#ifdef HAVE_SYS_TIMERFD_H
+    /* Don't let a stale deadline wake us up while we sleep forever */
+    if (p->timer_fd >= 0 && !use_timeout && !p->timer_enabled)
+        timer_fd_arm(p, NULL);
+#endif
+
 #ifdef DEBUG_TIMING
     {
         pa_usec_t now = pa_rtclock_now();
@@ -311,10 +439,16 @@ int pa_rtpoll_run(pa_rtpoll *p) {
         struct timespec ts;
         ts.tv_sec = timeout.tv_sec;
         ts.tv_nsec = timeout.tv_usec * 1000;
-        r = ppoll(p->pollfd, p->n_pollfd_used, (p->quit || p->timer_enabled) ? &ts : NULL, NULL);
+        r = ppoll(p->pollfd, p->n_pollfd_used, use_timeout ? &ts : NULL, NULL);
     }
 #else
-    r = pa_poll(p->pollfd, p->n_pollfd_used, (p->quit || p->timer_enabled) ? (int) ((timeout.tv_sec*1000) + (timeout.tv_usec / 1000)) : -1);
+    r = pa_poll(p->pollfd, p->n_pollfd_used, use_timeout ? (int) ((timeout.tv_sec*1000) + (timeout.tv_usec / 1000)) : -1);
+#endif
+
+#ifdef HAVE_SYS_TIMERFD_H
+    /* The timerfd counts as timeout, not as an fd event */
+    if (p->timer_fd >= 0 && r > 0 && timer_fd_elapsed(p))
+        r--;
 #endif
 
     p->timer_elapsed = r == 0;
@@ -337,16 +471,15 @@ int pa_rtpoll_run(pa_rtpoll *p) {
         else
             pa_log_error("poll(): %s", pa_cstrerror(errno));
 
-        reset_all_revents(p);
+        for (n = 0; n < p->n_pollfd_used; n++)
+            p->pollfd[n].revents = 0;
     }
 
     /* Let's tell everyone that we left the sleep */
-    for (i = p->items; i && i->priority < PA_RTPOLL_NEVER; i = i->next) {
+    for (n = 0; n < p->n_poll_items; n++) {
+        i = p->poll_items[n];
 
-        if (i->dead)
-            continue;
-
-        if (!i->after_cb)
+        if (i->dead || !i->after_cb)
             continue;
 
         i->after_cb(i);
@@ -357,12 +490,12 @@ finish:
     p->running = false;
 
     if (p->scan_for_dead) {
-        pa_rtpoll_item *n;
+        pa_rtpoll_item *next;
 
         p->scan_for_dead = false;
 
-        for (i = p->items; i; i = n) {
-            n = i->next;
+        for (i = p->items; i; i = next) {
+            next = i->next;
 
             if (i->dead)
                 rtpoll_item_destroy(i);
@@ -397,6 +530,13 @@ void pa_rtpoll_set_timer_disabled(pa_rtpoll *p) {
     p->timer_enabled = false;
 }
 
+void pa_rtpoll_set_timer_slack(pa_rtpoll *p, pa_usec_t usec) {
+    pa_assert(p);
+
+    p->timer_slack = usec;
+    p->timer_slack_changed = true;
+}
+
 pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsigned n_fds) {
     pa_rtpoll_item *i, *j, *l = NULL;
 
@@ -408,7 +548,7 @@ pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsi
     i->rtpoll = p;
     i->dead = false;
     i->n_pollfd = n_fds;
-    i->pollfd = NULL;
+    i->pollfd_idx = 0;
     i->priority = prio;
 
     i->userdata = NULL;
@@ -416,6 +556,21 @@ pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsi
     i->after_cb = NULL;
     i->work_cb = NULL;
 
+    /* New slots always go to the end, so nobody else has to move */
+    if (n_fds > 0) {
+        if (p->n_pollfd_used + n_fds > p->n_pollfd_alloc && p->n_pollfd_holes > 0)
+            rtpoll_compact(p);
+
+        if (p->n_pollfd_used + n_fds > p->n_pollfd_alloc) {
+            p->n_pollfd_alloc = PA_MAX(p->n_pollfd_used + n_fds, p->n_pollfd_alloc * 2);
+            p->pollfd = pa_xrenew(struct pollfd, p->pollfd, p->n_pollfd_alloc);
+        }
+
+        i->pollfd_idx = p->n_pollfd_used;
+        memset(p->pollfd + i->pollfd_idx, 0, n_fds * sizeof(struct pollfd));
+        p->n_pollfd_used += n_fds;
+    }
+
     for (j = p->items; j; j = j->next) {
         if (prio <= j->priority)
             break;
@@ -425,10 +580,7 @@ pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsi
 
     PA_LLIST_INSERT_AFTER(pa_rtpoll_item, p->items, j ? j->prev : l, i);
 
-    if (n_fds > 0) {
-        p->rebuild_needed = 1;
-        p->n_pollfd_used += n_fds;
-    }
+    p->callbacks_changed = true;
 
     return i;
 }
@@ -448,14 +600,10 @@ void pa_rtpoll_item_free(pa_rtpoll_item *i) {
 struct pollfd *pa_rtpoll_item_get_pollfd(pa_rtpoll_item *i, unsigned *n_fds) {
     pa_assert(i);
 
-    if (i->n_pollfd > 0)
-        if (i->rtpoll->rebuild_needed)
-            rtpoll_rebuild(i->rtpoll);
-
     if (n_fds)
         *n_fds = i->n_pollfd;
 
-    return i->pollfd;
+    return item_pollfd(i);
 }
 
 void pa_rtpoll_item_set_before_callback(pa_rtpoll_item *i, int (*before_cb)(pa_rtpoll_item *i)) {
@@ -463,6 +611,7 @@ void pa_rtpoll_item_set_before_callback(pa_rtpoll_item *i, int (*before_cb)(pa_r
     pa_assert(i->priority < PA_RTPOLL_NEVER);
 
     i->before_cb = before_cb;
+    i->rtpoll->callbacks_changed = true;
 }
 
 void pa_rtpoll_item_set_after_callback(pa_rtpoll_item *i, void (*after_cb)(pa_rtpoll_item *i)) {
@@ -470,6 +619,7 @@ void pa_rtpoll_item_set_after_callback(pa_rtpoll_item *i, void (*after_cb)(pa_rt
     pa_assert(i->priority < PA_RTPOLL_NEVER);
 
     i->after_cb = after_cb;
+    i->rtpoll->callbacks_changed = true;
 }
 
 void pa_rtpoll_item_set_work_callback(pa_rtpoll_item *i, int (*work_cb)(pa_rtpoll_item *i)) {
@@ -477,6 +627,7 @@ void pa_rtpoll_item_set_work_callback(pa_rtpoll_item *i, int (*work_cb)(pa_rtpol
     pa_assert(i->priority < PA_RTPOLL_NEVER);
 
     i->work_cb = work_cb;
+    i->rtpoll->callbacks_changed = true;
 }
 
 void pa_rtpoll_item_set_userdata(pa_rtpoll_item *i, void *userdata) {
@@ -502,7 +653,7 @@ static int fdsem_before(pa_rtpoll_item *i) {
 static void fdsem_after(pa_rtpoll_item *i) {
     pa_assert(i);
 
-    pa_assert((i->pollfd[0].revents & ~POLLIN) == 0);
+    pa_assert((item_pollfd(i)->revents & ~POLLIN) == 0);
     pa_fdsem_after_poll(i->userdata);
 }
 
@@ -539,7 +690,7 @@ static int asyncmsgq_read_before(pa_rtpoll_item *i) {
 static void asyncmsgq_read_after(pa_rtpoll_item *i) {
     pa_assert(i);
 
-    pa_assert((i->pollfd[0].revents & ~POLLIN) == 0);
+    pa_assert((item_pollfd(i)->revents & ~POLLIN) == 0);
     pa_asyncmsgq_read_after_poll(i->userdata);
 }
 
@@ -602,7 +753,7 @@ static int asyncmsgq_write_before(pa_rtpoll_item *i) {
 static void asyncmsgq_write_after(pa_rtpoll_item *i) {
     pa_assert(i);
 
-    pa_assert((i->pollfd[0].revents & ~POLLIN) == 0);
+    pa_assert((item_pollfd(i)->revents & ~POLLIN) == 0);
     pa_asyncmsgq_write_after_poll(i->userdata);
 }
 
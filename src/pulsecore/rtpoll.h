@@ -64,6 +64,12 @@ void pa_rtpoll_set_timer_absolute(pa_rtpoll *p, pa_usec_t usec);
 void pa_rtpoll_set_timer_relative(pa_rtpoll *p, pa_usec_t usec);
 void pa_rtpoll_set_timer_disabled(pa_rtpoll *p);
 
+/* Sets the timer slack of the thread the rtpoll is run in. Takes
+ * effect with the next pa_rtpoll_run(). The timer itself is a timerfd
+ * where available, which isn't subject to the slack, but everything
+ * else the thread sleeps on is. */
+void pa_rtpoll_set_timer_slack(pa_rtpoll *p, pa_usec_t usec);
+
 /* Return true when the elapsed timer was the reason for
  * the last pa_rtpoll_run() invocation to finish */
 bool pa_rtpoll_timer_elapsed(pa_rtpoll *p);
@@ -83,6 +83,15 @@ typedef void (*pa_do_volume_func_t) (void *samples, const void *volumes, unsigne
 pa_do_volume_func_t pa_get_volume_func(pa_sample_format_t f);
 void pa_set_volume_func(pa_sample_format_t f, pa_do_volume_func_t func);
 
+/* Applies a linear gain ramp. volumes[] holds the linear factor of
+ * each channel for the first frame, steps[] is added to it once per
+ * frame. On return volumes[] holds the factors for the frame following
+ * the last one processed. */
+typedef void (*pa_do_volume_ramp_func_t) (void *samples, float *volumes, const float *steps, unsigned channels, unsigned length);
+
+pa_do_volume_ramp_func_t pa_get_volume_ramp_func(pa_sample_format_t f);
+void pa_set_volume_ramp_func(pa_sample_format_t f, pa_do_volume_ramp_func_t func);
+
 size_t pa_convert_size(size_t size, const pa_sample_spec *from, const pa_sample_spec *to);
 
 #define PA_CHANNEL_POSITION_MASK_LEFT                                   \
@@ -23,6 +23,7 @@
 
 #include "cpu-arm.h"
 #include "sconv.h"
+#include "sconv-s16le.h"
 
 #include <math.h>
 #include <arm_neon.h>
@@ -85,6 +86,27 @@ static void pa_sconv_s16le_to_f32ne_neon(unsigned n, const int16_t *src, float *
     }
 }
 
+/* vcvt with 31 fraction bits converts and scales by 2^-31 in one step and
+ * rounds to nearest, so these match the generic code exactly. The float to
+ * 32 bit direction is left to the generic code since NEON conversions to
+ * integer truncate instead of rounding. */
+static void pa_sconv_s32le_to_f32ne_neon(unsigned n, const int32_t *src, float *dst) {
+    for (; n >= 4; n -= 4, src += 4, dst += 4)
+        vst1q_f32(dst, vcvtq_n_f32_s32(vld1q_s32(src), 31));
+
+    pa_sconv_s32le_to_float32ne(n, src, dst);
+}
+
+static void pa_sconv_s24_32le_to_f32ne_neon(unsigned n, const uint32_t *src, float *dst) {
+    for (; n >= 4; n -= 4, src += 4, dst += 4) {
+        int32x4_t v = vshlq_n_s32(vreinterpretq_s32_u32(vld1q_u32(src)), 8);
+
+        vst1q_f32(dst, vcvtq_n_f32_s32(v, 31));
+    }
+
+    pa_sconv_s24_32le_to_float32ne(n, src, dst);
+}
+
 void pa_convert_func_init_neon(pa_cpu_arm_flag_t flags) {
     pa_log_info("Initialising ARM NEON optimized conversions.");
     pa_set_convert_from_float32ne_function(PA_SAMPLE_S16LE, (pa_convert_func_t) pa_sconv_s16le_from_f32ne_neon);
@@ -92,5 +114,7 @@ void pa_convert_func_init_neon(pa_cpu_arm_flag_t flags) {
 #ifndef WORDS_BIGENDIAN
     pa_set_convert_from_s16ne_function(PA_SAMPLE_FLOAT32LE, (pa_convert_func_t) pa_sconv_s16le_to_f32ne_neon);
     pa_set_convert_to_s16ne_function(PA_SAMPLE_FLOAT32LE, (pa_convert_func_t) pa_sconv_s16le_from_f32ne_neon);
+    pa_set_convert_to_float32ne_function(PA_SAMPLE_S32LE, (pa_convert_func_t) pa_sconv_s32le_to_f32ne_neon);
+    pa_set_convert_to_float32ne_function(PA_SAMPLE_S24_32LE, (pa_convert_func_t) pa_sconv_s24_32le_to_f32ne_neon);
 #endif
 }
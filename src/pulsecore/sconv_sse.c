@@ -24,9 +24,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <pulsecore/macro.h>
 #include <pulsecore/endianmacros.h>
+#include <pulsecore/g711.h>
+#include <pulsecore/sconv-s16le.h>
 
 #include "cpu-x86.h"
 #include "sconv.h"
@@ -158,6 +161,287 @@ static void pa_sconv_s16le_from_f32ne_sse2(unsigned n, const float *a, int16_t *
     );
 }
 
+#include <immintrin.h>
+
+/* The 32 bit and 24 bit conversions below give the same results as the
+ * generic versions in sconv-s16le.c: integer to float conversion rounds to
+ * nearest and the scaling by 2^31 is exact, and the float to integer
+ * conversion rounds according to MXCSR like lrintf(). Conversions of
+ * values >= 2^31 return 0x80000000, which is flipped to 0x7fffffff to
+ * saturate the same way PA_CLAMP_UNLIKELY() does. Leftovers are handed to
+ * the generic code. */
+
+__attribute__((target("sse2")))
+static inline __m128 s32_to_float_sse2(__m128i v) {
+    return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f / (1U << 31)));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i s32_from_float_sse2(__m128 v) {
+    const __m128 s32_scale = _mm_set1_ps((float) (1U << 31));
+
+    v = _mm_mul_ps(v, s32_scale);
+    return _mm_xor_si128(_mm_cvtps_epi32(v), _mm_castps_si128(_mm_cmpge_ps(v, s32_scale)));
+}
+
+__attribute__((target("sse2")))
+static void pa_sconv_s32le_to_f32ne_sse2(unsigned n, const int32_t *a, float *b) {
+    for (; n >= 4; n -= 4, a += 4, b += 4)
+        _mm_storeu_ps(b, s32_to_float_sse2(_mm_loadu_si128((const __m128i *) a)));
+
+    pa_sconv_s32le_to_float32ne(n, a, b);
+}
+
+__attribute__((target("sse2")))
+static void pa_sconv_s32le_from_f32ne_sse2(unsigned n, const float *a, int32_t *b) {
+    for (; n >= 4; n -= 4, a += 4, b += 4)
+        _mm_storeu_si128((__m128i *) b, s32_from_float_sse2(_mm_loadu_ps(a)));
+
+    pa_sconv_s32le_from_float32ne(n, a, b);
+}
+
+__attribute__((target("sse2")))
+static void pa_sconv_s24_32le_to_f32ne_sse2(unsigned n, const uint32_t *a, float *b) {
+    for (; n >= 4; n -= 4, a += 4, b += 4) {
+        __m128i v = _mm_slli_epi32(_mm_loadu_si128((const __m128i *) a), 8);
+
+        _mm_storeu_ps(b, s32_to_float_sse2(v));
+    }
+
+    pa_sconv_s24_32le_to_float32ne(n, a, b);
+}
+
+__attribute__((target("sse2")))
+static void pa_sconv_s24_32le_from_f32ne_sse2(unsigned n, const float *a, uint32_t *b) {
+    for (; n >= 4; n -= 4, a += 4, b += 4) {
+        __m128i v = _mm_srli_epi32(s32_from_float_sse2(_mm_loadu_ps(a)), 8);
+
+        _mm_storeu_si128((__m128i *) b, v);
+    }
+
+    pa_sconv_s24_32le_from_float32ne(n, a, b);
+}
+
+/* Packed 24 bit samples, four per iteration. The 12 bytes are moved in and
+ * out as one 8 byte and one 4 byte access so nothing beyond the buffers is
+ * touched. */
+__attribute__((target("ssse3")))
+static void pa_sconv_s24le_to_f32ne_ssse3(unsigned n, const uint8_t *a, float *b) {
+    const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+
+    for (; n >= 4; n -= 4, a += 12, b += 4) {
+        uint32_t hi;
+        __m128i v;
+
+        memcpy(&hi, a + 8, sizeof(hi));
+        v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) a), _mm_cvtsi32_si128((int) hi));
+
+        _mm_storeu_ps(b, s32_to_float_sse2(_mm_shuffle_epi8(v, spread)));
+    }
+
+    pa_sconv_s24le_to_float32ne(n, a, b);
+}
+
+__attribute__((target("ssse3")))
+static void pa_sconv_s24le_from_f32ne_ssse3(unsigned n, const float *a, uint8_t *b) {
+    const __m128i pack = _mm_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+
+    for (; n >= 4; n -= 4, a += 4, b += 12) {
+        __m128i v = _mm_shuffle_epi8(s32_from_float_sse2(_mm_loadu_ps(a)), pack);
+        uint32_t hi = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+
+        _mm_storel_epi64((__m128i *) b, v);
+        memcpy(b + 8, &hi, sizeof(hi));
+    }
+
+    pa_sconv_s24le_from_float32ne(n, a, b);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 s32_to_float_avx2(__m256i v) {
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1.0f / (1U << 31)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i s32_from_float_avx2(__m256 v) {
+    const __m256 s32_scale = _mm256_set1_ps((float) (1U << 31));
+
+    v = _mm256_mul_ps(v, s32_scale);
+    return _mm256_xor_si256(_mm256_cvtps_epi32(v), _mm256_castps_si256(_mm256_cmp_ps(v, s32_scale, _CMP_GE_OQ)));
+}
+
+__attribute__((target("avx2")))
+static void pa_sconv_s32le_to_f32ne_avx2(unsigned n, const int32_t *a, float *b) {
+    for (; n >= 8; n -= 8, a += 8, b += 8)
+        _mm256_storeu_ps(b, s32_to_float_avx2(_mm256_loadu_si256((const __m256i *) a)));
+
+    pa_sconv_s32le_to_float32ne(n, a, b);
+}
+
+__attribute__((target("avx2")))
+static void pa_sconv_s32le_from_f32ne_avx2(unsigned n, const float *a, int32_t *b) {
+    for (; n >= 8; n -= 8, a += 8, b += 8)
+        _mm256_storeu_si256((__m256i *) b, s32_from_float_avx2(_mm256_loadu_ps(a)));
+
+    pa_sconv_s32le_from_float32ne(n, a, b);
+}
+
+__attribute__((target("avx2")))
+static void pa_sconv_s24_32le_to_f32ne_avx2(unsigned n, const uint32_t *a, float *b) {
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m256i v = _mm256_slli_epi32(_mm256_loadu_si256((const __m256i *) a), 8);
+
+        _mm256_storeu_ps(b, s32_to_float_avx2(v));
+    }
+
+    pa_sconv_s24_32le_to_float32ne(n, a, b);
+}
+
+__attribute__((target("avx2")))
+static void pa_sconv_s24_32le_from_f32ne_avx2(unsigned n, const float *a, uint32_t *b) {
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m256i v = _mm256_srli_epi32(s32_from_float_avx2(_mm256_loadu_ps(a)), 8);
+
+        _mm256_storeu_si256((__m256i *) b, v);
+    }
+
+    pa_sconv_s24_32le_from_float32ne(n, a, b);
+}
+
+/* The G.711 coders below give the same results as the ones in g711.c,
+ * which find the segment by searching the table of segment ends. Here
+ * the segment is the number of ends a magnitude lies above, and the
+ * variable shift of the mantissa is done as a high multiplication with a
+ * power of two that is halved for every segment. */
+
+static const int16_t ulaw_seg_end[8] = { 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF };
+static const int16_t alaw_seg_end[8] = { 0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF };
+
+__attribute__((target("sse2")))
+static void ulaw_from_s16ne_sse2(unsigned n, const int16_t *a, uint8_t *b) {
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m128i x, s, seg = _mm_setzero_si128(), m = _mm_set1_epi16((short) 0x8000), u;
+        unsigned k;
+
+        /* 14 bit magnitude, clipped and biased */
+        x = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) a), 2);
+        s = _mm_srai_epi16(x, 15);
+        x = _mm_sub_epi16(_mm_xor_si128(x, s), s);
+        x = _mm_add_epi16(_mm_min_epi16(x, _mm_set1_epi16(8159)), _mm_set1_epi16(0x84 >> 2));
+
+        for (k = 0; k < 8; k++) {
+            __m128i above = _mm_cmpgt_epi16(x, _mm_set1_epi16(ulaw_seg_end[k]));
+
+            seg = _mm_sub_epi16(seg, above);
+            m = _mm_sub_epi16(m, _mm_and_si128(_mm_srli_epi16(m, 1), above));
+        }
+
+        /* x >> (seg + 1), segment 8 is the maximum value 0x7F */
+        u = _mm_or_si128(_mm_slli_epi16(seg, 4), _mm_and_si128(_mm_mulhi_epu16(x, m), _mm_set1_epi16(0xF)));
+        u = _mm_min_epi16(u, _mm_set1_epi16(0x7F));
+
+        /* Complement, leaving the sign bit clear for negative values */
+        u = _mm_xor_si128(u, _mm_add_epi16(_mm_set1_epi16(0xFF), _mm_and_si128(s, _mm_set1_epi16(-0x80))));
+
+        _mm_storel_epi64((__m128i *) b, _mm_packus_epi16(u, u));
+    }
+
+    for (; n > 0; n--, a++, b++)
+        *b = st_14linear2ulaw(*a >> 2);
+}
+
+__attribute__((target("sse2")))
+static void ulaw_to_s16ne_sse2(unsigned n, const uint8_t *a, int16_t *b) {
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m128i u, t, bit, s;
+
+        u = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) a), _mm_setzero_si128());
+        u = _mm_xor_si128(u, _mm_set1_epi16(0xFF));
+
+        t = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(u, _mm_set1_epi16(0xF)), 3), _mm_set1_epi16(0x84));
+
+        /* t <<= segment, one bit of the segment number at a time */
+        bit = _mm_cmpeq_epi16(_mm_and_si128(u, _mm_set1_epi16(0x10)), _mm_set1_epi16(0x10));
+        t = _mm_add_epi16(t, _mm_and_si128(t, bit));
+        bit = _mm_cmpeq_epi16(_mm_and_si128(u, _mm_set1_epi16(0x20)), _mm_set1_epi16(0x20));
+        t = _mm_or_si128(_mm_andnot_si128(bit, t), _mm_and_si128(bit, _mm_slli_epi16(t, 2)));
+        bit = _mm_cmpeq_epi16(_mm_and_si128(u, _mm_set1_epi16(0x40)), _mm_set1_epi16(0x40));
+        t = _mm_or_si128(_mm_andnot_si128(bit, t), _mm_and_si128(bit, _mm_slli_epi16(t, 4)));
+
+        t = _mm_sub_epi16(t, _mm_set1_epi16(0x84));
+        s = _mm_cmpeq_epi16(_mm_and_si128(u, _mm_set1_epi16(0x80)), _mm_set1_epi16(0x80));
+
+        _mm_storeu_si128((__m128i *) b, _mm_sub_epi16(_mm_xor_si128(t, s), s));
+    }
+
+    for (; n > 0; n--, a++, b++)
+        *b = st_ulaw2linear16(*a);
+}
+
+__attribute__((target("sse2")))
+static void alaw_from_s16ne_sse2(unsigned n, const int16_t *a, uint8_t *b) {
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m128i x, s, seg, m = _mm_set1_epi16((short) 0x8000), v;
+        unsigned k;
+
+        /* 13 bit magnitude, negative values are one less */
+        x = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) a), 3);
+        s = _mm_srai_epi16(x, 15);
+        x = _mm_xor_si128(x, s);
+
+        /* The mantissa of segments 0 and 1 is shifted by one */
+        seg = _mm_sub_epi16(_mm_setzero_si128(), _mm_cmpgt_epi16(x, _mm_set1_epi16(alaw_seg_end[0])));
+
+        for (k = 1; k < 8; k++) {
+            __m128i above = _mm_cmpgt_epi16(x, _mm_set1_epi16(alaw_seg_end[k]));
+
+            seg = _mm_sub_epi16(seg, above);
+            m = _mm_sub_epi16(m, _mm_and_si128(_mm_srli_epi16(m, 1), above));
+        }
+
+        v = _mm_or_si128(_mm_slli_epi16(seg, 4), _mm_and_si128(_mm_mulhi_epu16(x, m), _mm_set1_epi16(0xF)));
+
+        /* Even bit inversion, the sign bit is set for positive values */
+        v = _mm_xor_si128(v, _mm_add_epi16(_mm_set1_epi16(0xD5), _mm_and_si128(s, _mm_set1_epi16(-0x80))));
+
+        _mm_storel_epi64((__m128i *) b, _mm_packus_epi16(v, v));
+    }
+
+    for (; n > 0; n--, a++, b++)
+        *b = st_13linear2alaw(*a >> 3);
+}
+
+__attribute__((target("sse2")))
+static void alaw_to_s16ne_sse2(unsigned n, const uint8_t *a, int16_t *b) {
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        __m128i v, t, bit, seg0, s;
+
+        v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) a), _mm_setzero_si128());
+        v = _mm_xor_si128(v, _mm_set1_epi16(0x55));
+
+        seg0 = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(0x70)), _mm_setzero_si128());
+        t = _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xF)), 4);
+        t = _mm_add_epi16(t, _mm_or_si128(_mm_and_si128(seg0, _mm_set1_epi16(8)), _mm_andnot_si128(seg0, _mm_set1_epi16(0x108))));
+
+        /* t <<= segment - 1 for segments above 0, as (t << segment) >> 1
+         * which fits into 16 unsigned bits */
+        bit = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(0x10)), _mm_set1_epi16(0x10));
+        t = _mm_add_epi16(t, _mm_and_si128(t, bit));
+        bit = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(0x20)), _mm_set1_epi16(0x20));
+        t = _mm_or_si128(_mm_andnot_si128(bit, t), _mm_and_si128(bit, _mm_slli_epi16(t, 2)));
+        bit = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(0x40)), _mm_set1_epi16(0x40));
+        t = _mm_or_si128(_mm_andnot_si128(bit, t), _mm_and_si128(bit, _mm_slli_epi16(t, 4)));
+        t = _mm_or_si128(_mm_and_si128(seg0, t), _mm_andnot_si128(seg0, _mm_srli_epi16(t, 1)));
+
+        s = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(0x80)), _mm_setzero_si128());
+
+        _mm_storeu_si128((__m128i *) b, _mm_sub_epi16(_mm_xor_si128(t, s), s));
+    }
+
+    for (; n > 0; n--, a++, b++)
+        *b = st_alaw2linear16(*a);
+}
+
 #endif /* defined (__i386__) || defined (__amd64__) */
 
 void pa_convert_func_init_sse(pa_cpu_x86_flag_t flags) {
@@ -173,5 +457,33 @@ void pa_convert_func_init_sse(pa_cpu_x86_flag_t flags) {
         pa_set_convert_to_s16ne_function(PA_SAMPLE_FLOAT32LE, (pa_convert_func_t) pa_sconv_s16le_from_f32ne_sse);
     }
 
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized 24/32 bit conversions.");
+        pa_set_convert_to_float32ne_function(PA_SAMPLE_S32LE, (pa_convert_func_t) pa_sconv_s32le_to_f32ne_avx2);
+        pa_set_convert_from_float32ne_function(PA_SAMPLE_S32LE, (pa_convert_func_t) pa_sconv_s32le_from_f32ne_avx2);
+        pa_set_convert_to_float32ne_function(PA_SAMPLE_S24_32LE, (pa_convert_func_t) pa_sconv_s24_32le_to_f32ne_avx2);
+        pa_set_convert_from_float32ne_function(PA_SAMPLE_S24_32LE, (pa_convert_func_t) pa_sconv_s24_32le_from_f32ne_avx2);
+    } else if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized 24/32 bit conversions.");
+        pa_set_convert_to_float32ne_function(PA_SAMPLE_S32LE, (pa_convert_func_t) pa_sconv_s32le_to_f32ne_sse2);
+        pa_set_convert_from_float32ne_function(PA_SAMPLE_S32LE, (pa_convert_func_t) pa_sconv_s32le_from_f32ne_sse2);
+        pa_set_convert_to_float32ne_function(PA_SAMPLE_S24_32LE, (pa_convert_func_t) pa_sconv_s24_32le_to_f32ne_sse2);
+        pa_set_convert_from_float32ne_function(PA_SAMPLE_S24_32LE, (pa_convert_func_t) pa_sconv_s24_32le_from_f32ne_sse2);
+    }
+
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized G.711 conversions.");
+        pa_set_convert_to_s16ne_function(PA_SAMPLE_ULAW, (pa_convert_func_t) ulaw_to_s16ne_sse2);
+        pa_set_convert_from_s16ne_function(PA_SAMPLE_ULAW, (pa_convert_func_t) ulaw_from_s16ne_sse2);
+        pa_set_convert_to_s16ne_function(PA_SAMPLE_ALAW, (pa_convert_func_t) alaw_to_s16ne_sse2);
+        pa_set_convert_from_s16ne_function(PA_SAMPLE_ALAW, (pa_convert_func_t) alaw_from_s16ne_sse2);
+    }
+
+    if (flags & PA_CPU_X86_SSSE3) {
+        pa_log_info("Initialising SSSE3 optimized packed 24 bit conversions.");
+        pa_set_convert_to_float32ne_function(PA_SAMPLE_S24LE, (pa_convert_func_t) pa_sconv_s24le_to_f32ne_ssse3);
+        pa_set_convert_from_float32ne_function(PA_SAMPLE_S24LE, (pa_convert_func_t) pa_sconv_s24le_from_f32ne_ssse3);
+    }
+
 #endif /* defined (__i386__) || defined (__amd64__) */
 }
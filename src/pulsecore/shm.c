@@ -30,6 +30,9 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
 #include <dirent.h>
 #include <signal.h>
 
@@ -115,6 +118,8 @@ static int privatemem_create(pa_shm *m, size_t size) {
     m->id = 0;
     m->size = size;
     m->do_unlink = false;
+    m->sealed = false;
+    m->pinned = false;
     m->fd = -1;
 
 #ifdef MAP_ANONYMOUS
@@ -138,6 +143,9 @@ static int privatemem_create(pa_shm *m, size_t size) {
     return 0;
 }
 
+/* Set once stale segments have been looked for in this process */
+static pa_atomic_t cleaned_up = PA_ATOMIC_INIT(0);
+
 static int sharedmem_create(pa_shm *m, pa_mem_type_t type, size_t size, mode_t mode) {
 #if defined(HAVE_SHM_OPEN) || defined(HAVE_MEMFD)
     char fn[32];
@@ -145,15 +153,17 @@ static int sharedmem_create(pa_shm *m, pa_mem_type_t type, size_t size, mode_t m
     struct shm_marker *marker;
     bool do_unlink = false;
 
-    /* Each time we create a new SHM area, let's first drop all stale
-     * ones */
-    pa_shm_cleanup();
-
     pa_random(&m->id, sizeof(m->id));
 
     switch (type) {
 #ifdef HAVE_SHM_OPEN
     case PA_MEM_TYPE_SHARED_POSIX:
+        /* The first time we create a new SHM area, let's drop all stale
+         * ones. memfd areas go away with their last user, so there is
+         * nothing to clean up for those. */
+        if (pa_atomic_load(&cleaned_up) == 0)
+            pa_shm_cleanup();
+
         segment_name(fn, sizeof(fn), m->id);
         fd = shm_open(fn, O_RDWR|O_CREAT|O_EXCL, mode);
         do_unlink = true;
@@ -176,12 +186,25 @@ static int sharedmem_create(pa_shm *m, pa_mem_type_t type, size_t size, mode_t m
     m->type = type;
     m->size = size + shm_marker_size(type);
     m->do_unlink = do_unlink;
+    m->sealed = false;
+    m->pinned = false;
 
     if (ftruncate(fd, (off_t) m->size) < 0) {
         pa_log("ftruncate() failed: %s", pa_cstrerror(errno));
         goto fail;
     }
 
+#ifdef HAVE_MEMFD
+    /* Fix the size for good, so that whoever we share the memfd with can
+     * map it without having to trap SIGBUS on it */
+    if (type == PA_MEM_TYPE_SHARED_MEMFD) {
+        if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) < 0)
+            pa_log_debug("Sealing memfd failed: %s", pa_cstrerror(errno));
+        else
+            m->sealed = true;
+    }
+#endif
+
 #ifndef MAP_NORESERVE
 #define MAP_NORESERVE 0
 #endif
@@ -311,6 +334,11 @@ void pa_shm_punch(pa_shm *m, size_t offset, size_t size) {
     pa_assert(m->ptr != MAP_FAILED);
 #endif
 
+    /* Giving pinned pages back would just make the next user fault
+     * them in again */
+    if (m->pinned)
+        return;
+
     /* You're welcome to implement this as NOOP on systems that don't
      * support it */
 
@@ -344,12 +372,71 @@ void pa_shm_punch(pa_shm *m, size_t offset, size_t size) {
 #endif
 }
 
+int pa_shm_pin(pa_shm *m, bool huge_pages, bool lock) {
+    const size_t page_size = pa_page_size();
+    volatile uint8_t *p;
+    size_t o;
+
+    pa_assert(m);
+    pa_assert(m->ptr);
+    pa_assert(m->size > 0);
+
+    m->pinned = true;
+
+#ifdef MADV_HUGEPAGE
+    /* Needs to happen before the first touch, so that the faults below
+     * already get huge pages. For memfd/POSIX shm this only has an effect
+     * if the kernel's shmem_enabled setting allows advising. */
+    if (huge_pages && PA_PAGE_ALIGN_PTR(m->ptr) == m->ptr) {
+        if (madvise(m->ptr, PA_PAGE_ALIGN(m->size), MADV_HUGEPAGE) < 0)
+            pa_log_debug("madvise(MADV_HUGEPAGE) failed: %s", pa_cstrerror(errno));
+    }
+#else
+    if (huge_pages)
+        pa_log_debug("Transparent huge pages not supported on this platform.");
+#endif
+
+    /* The segment is fresh, nothing lives in it yet, so writing every
+     * page to itself is harmless and makes sure the pages are really
+     * allocated, not just mapped to the zero page. */
+    for (o = 0, p = m->ptr; o < m->size; o += page_size)
+        p[o] = p[o];
+
+    if (!lock)
+        return 0;
+
+#if defined(HAVE_SYS_MMAN_H) && !defined(__ANDROID__)
+#if defined(HAVE_SYS_RESOURCE_H) && defined(RLIMIT_MEMLOCK)
+    {
+        struct rlimit rl;
+
+        if (getrlimit(RLIMIT_MEMLOCK, &rl) >= 0 && rl.rlim_cur != RLIM_INFINITY && (rlim_t) m->size > rl.rlim_cur) {
+            pa_log_warn("Not locking the %lu bytes memory pool, RLIMIT_MEMLOCK is %lu bytes.",
+                        (unsigned long) m->size, (unsigned long) rl.rlim_cur);
+            return -1;
+        }
+    }
+#endif
+
+    if (mlock(m->ptr, m->size) < 0) {
+        pa_log_warn("mlock() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+#else
+    pa_log_warn("Memory locking requested but not supported on platform.");
+    return -1;
+#endif
+}
+
 static int shm_attach(pa_shm *m, pa_mem_type_t type, unsigned id, int memfd_fd, bool writable, bool for_cleanup) {
 #if defined(HAVE_SHM_OPEN) || defined(HAVE_MEMFD)
     char fn[32];
     int fd = -1;
     int prot;
     struct stat st;
+    bool sealed = false;
 
     pa_assert(m);
 
@@ -387,6 +474,18 @@ static int shm_attach(pa_shm *m, pa_mem_type_t type, unsigned id, int memfd_fd,
         goto fail;
     }
 
+#ifdef HAVE_MEMFD
+    /* The seals can't be removed once set, so checking them before
+     * mapping is enough to know the mapping stays backed */
+    if (type == PA_MEM_TYPE_SHARED_MEMFD) {
+        int seals;
+
+        if ((seals = fcntl(fd, F_GET_SEALS)) >= 0 &&
+            (seals & (F_SEAL_SHRINK|F_SEAL_SEAL)) == (F_SEAL_SHRINK|F_SEAL_SEAL))
+            sealed = true;
+    }
+#endif
+
     prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
     if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(st.st_size), prot, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
         pa_log("mmap() failed: %s", pa_cstrerror(errno));
@@ -405,6 +504,8 @@ static int shm_attach(pa_shm *m, pa_mem_type_t type, unsigned id, int memfd_fd,
     m->id = id;
     m->size = (size_t) st.st_size;
     m->do_unlink = false;
+    m->sealed = sealed;
+    m->pinned = false;
     m->fd = -1;
 
     return 0;
@@ -426,6 +527,8 @@ int pa_shm_attach(pa_shm *m, pa_mem_type_t type, unsigned id, int memfd_fd, bool
 
 int pa_shm_cleanup(void) {
 
+    pa_atomic_store(&cleaned_up, 1);
+
 #ifdef HAVE_SHM_OPEN
 #ifdef SHM_PATH
     DIR *d;
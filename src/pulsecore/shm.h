@@ -34,6 +34,14 @@ typedef struct pa_shm {
     /* Only for type = PA_MEM_TYPE_SHARED_POSIX */
     bool do_unlink:1;
 
+    /* Only for type = PA_MEM_TYPE_SHARED_MEMFD: the size of the file is
+     * sealed, so the other side can't truncate it under our mapping and
+     * accessing it can't raise SIGBUS. */
+    bool sealed:1;
+
+    /* Set by pa_shm_pin(): the pages are faulted in and must stay */
+    bool pinned:1;
+
     /* Only for type = PA_MEM_TYPE_SHARED_MEMFD
      *
      * To avoid fd leaks, we keep this fd open only until we pass it
@@ -54,8 +62,18 @@ int pa_shm_attach(pa_shm *m, pa_mem_type_t type, unsigned id, int memfd_fd, bool
 
 void pa_shm_punch(pa_shm *m, size_t offset, size_t size);
 
+/* Faults in all pages of the segment now, after asking for transparent
+ * huge pages if huge_pages is set, and if lock is set also locks them
+ * into memory as far as RLIMIT_MEMLOCK allows. Afterwards
+ * pa_shm_punch() is a no-op for the segment. Returns 0 on success, -1
+ * if the pages could not be locked (they are still faulted in). */
+int pa_shm_pin(pa_shm *m, bool huge_pages, bool lock);
+
 void pa_shm_free(pa_shm *m);
 
+/* Removes the POSIX SHM segments of processes that died. This happens
+ * automatically when the first POSIX SHM segment of a process is
+ * created, later ones don't look again. */
 int pa_shm_cleanup(void);
 
 #endif
@@ -38,6 +38,7 @@
 #include <pulsecore/play-memblockq.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/trace.h>
 
 #include "sink-input.h"
 
@@ -452,7 +453,8 @@ int pa_sink_input_new(
 
         /* Note: for passthrough content we need to adjust the output rate to that of the current sink-input */
         if (!pa_sink_input_new_data_is_passthrough(data)) /* no resampler for passthrough content */
-            if (!(resampler = pa_resampler_new(
+            if (!(resampler = pa_resampler_cache_get(
+                          &core->resampler_cache,
                           core->mempool,
                           &data->sample_spec, &data->channel_map,
                           &data->sink->sample_spec, &data->sink->channel_map,
@@ -517,6 +519,10 @@ int pa_sink_input_new(
 
     i->muted = data->muted;
 
+    i->ramp_factor = PA_VOLUME_NORM;
+    i->ramp_factor_items = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL,
+                                               (pa_free_cb_t) volume_factor_entry_free);
+
     if (data->sync_base) {
         i->sync_next = data->sync_base->sync_next;
         i->sync_prev = data->sync_base;
@@ -539,14 +545,19 @@ int pa_sink_input_new(
     i->thread_info.resampler = resampler;
     i->thread_info.soft_volume = i->soft_volume;
     i->thread_info.muted = i->muted;
+    i->thread_info.ramp_factor = i->thread_info.ramp_factor_from = PA_VOLUME_NORM;
+    i->thread_info.ramp_factor_frames = i->thread_info.ramp_factor_pos = 0;
     i->thread_info.requested_sink_latency = (pa_usec_t) -1;
     i->thread_info.rewrite_nbytes = 0;
     i->thread_info.rewrite_flush = false;
     i->thread_info.dont_rewind_render = false;
+    i->thread_info.passthrough = pa_sink_input_is_passthrough(i);
     i->thread_info.underrun_for = (uint64_t) -1;
     i->thread_info.underrun_for_sink = 0;
     i->thread_info.playing_for = 0;
+    i->thread_info.zero_copy_bytes = 0;
     i->thread_info.direct_outputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    PA_LLIST_HEAD_INIT(pa_meter, i->thread_info.meters);
 
     pa_assert_se(pa_idxset_put(core->sink_inputs, i, &i->index) == 0);
     pa_assert_se(pa_idxset_put(i->sink->inputs, pa_sink_input_ref(i), NULL) == 0);
@@ -555,7 +566,7 @@ int pa_sink_input_new(
         pa_assert_se(pa_idxset_put(i->client->sink_inputs, i, NULL) >= 0);
 
     memblockq_name = pa_sprintf_malloc("sink input render_memblockq [%u]", i->index);
-    i->thread_info.render_memblockq = pa_memblockq_new(
+    i->thread_info.render_memblockq = pa_memblockq_new_ring(
             memblockq_name,
             0,
             MEMBLOCKQ_MAXLENGTH,
@@ -712,6 +723,14 @@ void pa_sink_input_unlink(pa_sink_input *i) {
 
         if (i->sink->asyncmsgq)
             pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i->sink), PA_SINK_MESSAGE_REMOVE_INPUT, i, 0, NULL) == 0);
+
+        /* The IO thread is done with us now */
+        if (i->client)
+            i->client->unlinked_render_usec += i->thread_info.render_profile[PA_RENDER_STAGE_INPUT_PEEK].total;
+
+        if (i->thread_info.zero_copy_bytes > 0)
+            pa_log_debug("Sink input %u: %llu bytes were mixed without copying.",
+                         i->index, (unsigned long long) i->thread_info.zero_copy_bytes);
     }
 
     reset_callbacks(i);
@@ -753,8 +772,11 @@ static void sink_input_free(pa_object *o) {
     if (i->thread_info.render_memblockq)
         pa_memblockq_free(i->thread_info.render_memblockq);
 
+    if (i->thread_info.premix_memblockq)
+        pa_memblockq_free(i->thread_info.premix_memblockq);
+
     if (i->thread_info.resampler)
-        pa_resampler_free(i->thread_info.resampler);
+        pa_resampler_cache_put(&i->core->resampler_cache, i->thread_info.resampler);
 
     if (i->format)
         pa_format_info_free(i->format);
@@ -774,6 +796,9 @@ static void sink_input_free(pa_object *o) {
     if (i->volume_factor_sink_items)
         pa_hashmap_free(i->volume_factor_sink_items);
 
+    if (i->ramp_factor_items)
+        pa_hashmap_free(i->ramp_factor_items);
+
     pa_xfree(i->driver);
     pa_xfree(i);
 }
@@ -851,6 +876,100 @@ pa_usec_t pa_sink_input_get_latency(pa_sink_input *i, pa_usec_t *sink_latency) {
     return r[0];
 }
 
+/* Called from thread context. Returns whether a ramp of ramp_factor is
+ * in progress, and if so the factor at the current position and the
+ * number of frames left. */
+static bool ramp_factor_get(pa_sink_input *i, pa_volume_t *current, size_t *left) {
+    size_t pos = i->thread_info.ramp_factor_pos, frames = i->thread_info.ramp_factor_frames;
+
+    if (pos >= frames)
+        return false;
+
+    if (current) {
+        double from = pa_sw_volume_to_linear(i->thread_info.ramp_factor_from);
+        double to = pa_sw_volume_to_linear(i->thread_info.ramp_factor);
+
+        *current = pa_sw_volume_from_linear(from + (to - from) * (double) pos / (double) frames);
+    }
+
+    if (left)
+        *left = frames - pos;
+
+    return true;
+}
+
+/* Called from thread context */
+static void ramp_factor_start(pa_sink_input *i, pa_volume_t factor, pa_usec_t ramp_usec) {
+    pa_volume_t current;
+
+    if (!ramp_factor_get(i, &current, NULL))
+        current = i->thread_info.ramp_factor;
+
+    i->thread_info.ramp_factor = factor;
+    i->thread_info.ramp_factor_from = current;
+    i->thread_info.ramp_factor_frames = current == factor ? 0 :
+        pa_usec_to_bytes(ramp_usec, &i->sink->sample_spec) / pa_frame_size(&i->sink->sample_spec);
+    i->thread_info.ramp_factor_pos = 0;
+}
+
+/* Called from thread context */
+void pa_sink_input_fade_in_within_thread(pa_sink_input *i, pa_usec_t usec) {
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+
+    if (i->thread_info.ramp_factor == PA_VOLUME_MUTED)
+        return;
+
+    /* A ramp in progress ends where it would have ended anyway */
+    i->thread_info.ramp_factor_from = PA_VOLUME_MUTED;
+    i->thread_info.ramp_factor_frames = pa_usec_to_bytes(usec, &i->sink->sample_spec) / pa_frame_size(&i->sink->sample_spec);
+    i->thread_info.ramp_factor_pos = 0;
+}
+
+/* Called from thread context */
+static void ramp_factor_advance(pa_sink_input *i, size_t nbytes) {
+    if (i->thread_info.ramp_factor_pos >= i->thread_info.ramp_factor_frames)
+        return;
+
+    i->thread_info.ramp_factor_pos += nbytes / pa_frame_size(&i->sink->sample_spec);
+
+    if (i->thread_info.ramp_factor_pos >= i->thread_info.ramp_factor_frames)
+        i->thread_info.ramp_factor_frames = i->thread_info.ramp_factor_pos = 0;
+}
+
+/* Called from thread context. Rewound data gets rendered again, so move
+ * the ramp back, but not to before its start. */
+static void ramp_factor_rewind(pa_sink_input *i, size_t nbytes) {
+    size_t frames = nbytes / pa_frame_size(&i->sink->sample_spec);
+
+    if (i->thread_info.ramp_factor_pos >= i->thread_info.ramp_factor_frames)
+        return;
+
+    i->thread_info.ramp_factor_pos -= PA_MIN(frames, i->thread_info.ramp_factor_pos);
+}
+
+/* Called from thread context */
+static int input_pop(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
+
+    /* What was popped for a premix but not mixed before the input left
+     * it comes first */
+    if (i->thread_info.premix_memblockq && pa_memblockq_get_length(i->thread_info.premix_memblockq) > 0) {
+        pa_assert_se(pa_memblockq_peek(i->thread_info.premix_memblockq, chunk) >= 0);
+        pa_memblockq_drop(i->thread_info.premix_memblockq, chunk->length);
+        return 0;
+    }
+
+    return i->pop(i, length, chunk);
+}
+
+/* Called from thread context */
+static void meters_process(pa_sink_input *i, const pa_memchunk *chunk, const pa_sample_spec *ss, const pa_cvolume *volume) {
+    pa_meter *m;
+
+    PA_LLIST_FOREACH(m, i->thread_info.meters)
+        pa_meter_process(m, chunk, ss, volume);
+}
+
 /* Called from thread context */
 void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa_memchunk *chunk, pa_cvolume *volume) {
     bool do_volume_adj_here, need_volume_factor_sink;
@@ -858,6 +977,7 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
     size_t block_size_max_sink, block_size_max_sink_input;
     size_t ilength;
     size_t ilength_full;
+    pa_usec_t start;
 
     pa_sink_input_assert_ref(i);
     pa_sink_input_assert_io_context(i);
@@ -870,6 +990,8 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
     pa_log_debug("peek");
 #endif
 
+    start = pa_render_profile_start();
+
     block_size_max_sink_input = i->thread_info.resampler ?
         pa_resampler_max_block_size(i->thread_info.resampler) :
         pa_frame_align(pa_mempool_block_size_max(i->core->mempool), &i->sample_spec);
@@ -908,18 +1030,34 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
 
     while (!pa_memblockq_is_readable(i->thread_info.render_memblockq)) {
         pa_memchunk tchunk;
+        pa_usec_t pop_start;
+        int r = -1;
 
         /* There's nothing in our render queue. We need to fill it up
          * with data from the implementor. */
 
-        if (i->thread_info.state == PA_SINK_INPUT_CORKED ||
-            i->pop(i, ilength, &tchunk) < 0) {
+        if (i->thread_info.state != PA_SINK_INPUT_CORKED) {
+            pop_start = pa_render_profile_start();
+            r = input_pop(i, ilength, &tchunk);
+            pa_render_profile_stop(&i->thread_info.render_profile[PA_RENDER_STAGE_INPUT_POP], pop_start);
+        }
+
+        if (r < 0) {
 
             /* OK, we're corked or the implementor didn't give us any
              * data, so let's just hand out silence */
             pa_atomic_store(&i->thread_info.drained, 1);
 
             pa_memblockq_seek(i->thread_info.render_memblockq, (int64_t) slength, PA_SEEK_RELATIVE, true);
+
+            /* Only report the transition from playing to starving */
+            if (r < 0 && i->thread_info.state != PA_SINK_INPUT_CORKED &&
+                i->thread_info.underrun_for == 0 && i->thread_info.playing_for > 0) {
+                PA_TRACE2(sink_input_underrun, i->index, slength);
+                pa_core_post_xrun_event(i->core, PA_XRUN_CAUSE_CLIENT_UNDERRUN, PA_DEVICE_TYPE_SINK,
+                                        i->sink->index, i->index, 0, 0);
+            }
+
             i->thread_info.playing_for = 0;
             if (i->thread_info.underrun_for != (uint64_t) -1) {
                 i->thread_info.underrun_for += ilength_full;
@@ -937,15 +1075,28 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
         i->thread_info.underrun_for_sink = 0;
         i->thread_info.playing_for += tchunk.length;
 
+        /* If neither resampling nor volume adjustment is necessary the
+         * data is passed on as is. There's no need to split it up then,
+         * and memblocks imported from the client end up in the sink's
+         * pa_mix_info array without any copying. Silence stays silence
+         * at any volume, and is stored as a hole by the render queue, so
+         * the sink skips this input when mixing. With a resampler it
+         * still has to go through it to keep the filter history right. */
+        if (!i->thread_info.resampler &&
+            ((!need_volume_factor_sink && (!do_volume_adj_here || volume_is_norm)) || pa_memblock_is_silence(tchunk.memblock))) {
+            pa_memblockq_push_align(i->thread_info.render_memblockq, &tchunk);
+            pa_memblock_unref(tchunk.memblock);
+            continue;
+        }
+
         while (tchunk.length > 0) {
             pa_memchunk wchunk;
             bool nvfs = need_volume_factor_sink;
 
-            wchunk = tchunk;
-            pa_memblock_ref(wchunk.memblock);
-
-            if (wchunk.length > block_size_max_sink_input)
-                wchunk.length = block_size_max_sink_input;
+            /* The last piece takes over our reference, so that the
+             * volume can be applied in place unless the implementor
+             * still holds on to the block */
+            pa_memchunk_take(&wchunk, &tchunk, block_size_max_sink_input);
 
             /* It might be necessary to adjust the volume here */
             if (do_volume_adj_here && !volume_is_norm) {
@@ -979,7 +1130,11 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
                 pa_memblockq_push_align(i->thread_info.render_memblockq, &wchunk);
             } else {
                 pa_memchunk rchunk;
+                pa_usec_t resample_start;
+
+                resample_start = pa_render_profile_start();
                 pa_resampler_run(i->thread_info.resampler, &wchunk, &rchunk);
+                pa_render_profile_stop(&i->thread_info.render_profile[PA_RENDER_STAGE_RESAMPLE], resample_start);
 
 #ifdef SINK_INPUT_DEBUG
                 pa_log_debug("pushing %lu", (unsigned long) rchunk.length);
@@ -998,12 +1153,7 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
             }
 
             pa_memblock_unref(wchunk.memblock);
-
-            tchunk.index += wchunk.length;
-            tchunk.length -= wchunk.length;
         }
-
-        pa_memblock_unref(tchunk.memblock);
     }
 
     pa_assert_se(pa_memblockq_peek(i->thread_info.render_memblockq, chunk) >= 0);
@@ -1029,6 +1179,32 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
         pa_cvolume_mute(volume, i->sink->sample_spec.channels);
     else
         *volume = i->thread_info.soft_volume;
+
+    /* The ramp factor applies to what is peeked, not to what is in the
+     * render queue, so changing it never needs a rewind. While it is
+     * ramping we apply it to a copy of the chunk ourselves, otherwise
+     * the sink can do it together with the rest of the volume. */
+    if (!i->thread_info.muted) {
+        pa_volume_t current;
+        size_t left;
+
+        if (!ramp_factor_get(i, &current, &left)) {
+            if (i->thread_info.ramp_factor != PA_VOLUME_NORM)
+                pa_sw_cvolume_multiply_scalar(volume, volume, i->thread_info.ramp_factor);
+
+        } else if (!pa_memblock_is_silence(chunk->memblock)) {
+            pa_cvolume from, to;
+
+            pa_memchunk_make_writable(chunk, 0);
+            pa_cvolume_set(&from, i->sink->sample_spec.channels, current);
+            pa_cvolume_set(&to, i->sink->sample_spec.channels, i->thread_info.ramp_factor);
+            pa_volume_memchunk_ramp(chunk, &i->sink->sample_spec, &from, &to, left);
+        }
+    }
+
+    meters_process(i, chunk, &i->sink->sample_spec, volume);
+
+    pa_render_profile_stop(&i->thread_info.render_profile[PA_RENDER_STAGE_INPUT_PEEK], start);
 }
 
 /* Called from thread context */
@@ -1045,6 +1221,224 @@ void pa_sink_input_drop(pa_sink_input *i, size_t nbytes /* in sink sample spec *
 #endif
 
     pa_memblockq_drop(i->thread_info.render_memblockq, nbytes);
+    ramp_factor_advance(i, nbytes);
+}
+
+/* Called from thread context. Rewinds the implementor so that the data
+ * from max_rewrite bytes before the write index of the render memblockq
+ * on is rendered again, but not more than rewrite_nbytes (in the local
+ * domain). Returns true if the implementor was told. */
+static bool rewrite_from_implementor(pa_sink_input *i, size_t max_rewrite /* in sink sample spec */, size_t rewrite_nbytes) {
+    size_t amount, in_amount;
+
+    /* Transform into local domain */
+    if (i->thread_info.resampler)
+        max_rewrite = pa_resampler_request(i->thread_info.resampler, max_rewrite);
+
+    /* Calculate how much of the rewinded data should actually be rewritten */
+    amount = PA_MIN(rewrite_nbytes, max_rewrite);
+
+    if (amount <= 0)
+        return false;
+
+    pa_log_debug("Have to rewind %lu bytes on implementor.", (unsigned long) amount);
+
+    /* Tell the implementor */
+    if (i->process_rewind)
+        i->process_rewind(i, amount);
+
+    in_amount = amount;
+
+    /* Convert back to sink domain */
+    if (i->thread_info.resampler)
+        amount = pa_resampler_result(i->thread_info.resampler, amount);
+
+    if (amount > 0)
+        /* Ok, now update the write pointer */
+        pa_memblockq_seek(i->thread_info.render_memblockq, - ((int64_t) amount), PA_SEEK_RELATIVE, true);
+
+    if (i->thread_info.rewrite_flush)
+        pa_memblockq_silence(i->thread_info.render_memblockq);
+
+    /* And rewind the resampler */
+    if (i->thread_info.resampler)
+        pa_resampler_rewind(i->thread_info.resampler, amount, in_amount);
+
+    return true;
+}
+
+/* Called from thread context. Undoes pa_sink_input_drop() for data that
+ * the sink took but never played, without telling the implementor
+ * unless the render memblockq keeps no history. */
+void pa_sink_input_unread(pa_sink_input *i, size_t nbytes /* in sink sample spec */) {
+    size_t lbq;
+
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert(PA_SINK_INPUT_IS_LINKED(i->thread_info.state));
+    pa_assert(pa_frame_aligned(nbytes, &i->sink->sample_spec));
+
+    if (nbytes <= 0)
+        return;
+
+    lbq = pa_memblockq_get_length(i->thread_info.render_memblockq);
+
+    pa_memblockq_rewind(i->thread_info.render_memblockq, nbytes);
+    ramp_factor_rewind(i, nbytes);
+
+    /* Without history the data has to come from the implementor again */
+    if (i->flags & PA_SINK_INPUT_NO_RENDER_HISTORY)
+        rewrite_from_implementor(i, nbytes + lbq, (size_t) -1);
+}
+
+/* Called from thread context */
+bool pa_sink_input_can_premix(pa_sink_input *i, pa_resampler *r) {
+    pa_resampler *own;
+
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert(r);
+
+    if (i->thread_info.state != PA_SINK_INPUT_RUNNING)
+        return false;
+
+    if (!(own = i->thread_info.resampler))
+        return false;
+
+    /* The rate of these may change at any time */
+    if (!pa_resampler_same_config(own, r) || (own->flags & PA_RESAMPLER_VARIABLE_RATE))
+        return false;
+
+    /* With the same channel map the sink applies the stream volume after
+     * resampling, which gives the same result as applying it before */
+    if (!pa_channel_map_equal(&i->channel_map, &i->sink->channel_map))
+        return false;
+
+    if (!pa_cvolume_is_norm(&i->volume_factor_sink))
+        return false;
+
+    /* These expect to see the stream on its own */
+    if (pa_hashmap_size(i->thread_info.direct_outputs) > 0)
+        return false;
+
+    /* Once mixed the data of this input can't be rewound and rendered
+     * again, e.g. for a volume change */
+    if (i->sink->thread_info.max_rewind > 0)
+        return false;
+
+    /* The ramp factor is applied when peeking */
+    if (i->thread_info.ramp_factor != PA_VOLUME_NORM || ramp_factor_get(i, NULL, NULL))
+        return false;
+
+    /* Data that was already rendered the normal way is played first */
+    if (pa_memblockq_get_length(i->thread_info.render_memblockq) > 0)
+        return false;
+
+    return true;
+}
+
+/* Called from thread context */
+void pa_sink_input_premix_peek(pa_sink_input *i, size_t length /* in the input's sample spec */, pa_memchunk *chunk, pa_cvolume *volume) {
+    pa_memblockq *q;
+    pa_usec_t start;
+
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert(i->thread_info.premixed);
+    pa_assert(pa_frame_aligned(length, &i->thread_info.sample_spec));
+    pa_assert(length > 0);
+    pa_assert(chunk);
+    pa_assert(volume);
+
+    start = pa_render_profile_start();
+
+    if (!(q = i->thread_info.premix_memblockq)) {
+        pa_memchunk silence;
+        char *memblockq_name;
+
+        pa_silence_memchunk_get(&i->core->silence_cache, i->core->mempool, &silence, &i->thread_info.sample_spec, 0);
+
+        memblockq_name = pa_sprintf_malloc("sink input premix_memblockq [%u]", i->index);
+        q = i->thread_info.premix_memblockq = pa_memblockq_new_ring(
+                memblockq_name,
+                0,
+                MEMBLOCKQ_MAXLENGTH,
+                0,
+                &i->thread_info.sample_spec,
+                0,
+                1,
+                0,
+                &silence);
+        pa_xfree(memblockq_name);
+
+        pa_memblock_unref(silence.memblock);
+    }
+
+    while (pa_memblockq_get_length(q) < length) {
+        size_t missing = length - pa_memblockq_get_length(q);
+        pa_memchunk tchunk;
+        pa_usec_t pop_start;
+        int r;
+
+        pop_start = pa_render_profile_start();
+        r = i->pop(i, missing, &tchunk);
+        pa_render_profile_stop(&i->thread_info.render_profile[PA_RENDER_STAGE_INPUT_POP], pop_start);
+
+        if (r < 0) {
+            size_t slength = pa_resampler_result(i->thread_info.resampler, missing);
+
+            pa_atomic_store(&i->thread_info.drained, 1);
+
+            pa_memblockq_seek(q, (int64_t) missing, PA_SEEK_RELATIVE, true);
+
+            /* Only report the transition from playing to starving */
+            if (i->thread_info.underrun_for == 0 && i->thread_info.playing_for > 0) {
+                PA_TRACE2(sink_input_underrun, i->index, slength);
+                pa_core_post_xrun_event(i->core, PA_XRUN_CAUSE_CLIENT_UNDERRUN, PA_DEVICE_TYPE_SINK,
+                                        i->sink->index, i->index, 0, 0);
+            }
+
+            i->thread_info.playing_for = 0;
+            if (i->thread_info.underrun_for != (uint64_t) -1) {
+                i->thread_info.underrun_for += missing;
+                i->thread_info.underrun_for_sink += slength;
+            }
+            break;
+        }
+
+        pa_atomic_store(&i->thread_info.drained, 0);
+
+        pa_assert(tchunk.length > 0);
+        pa_assert(tchunk.memblock);
+
+        i->thread_info.underrun_for = 0;
+        i->thread_info.underrun_for_sink = 0;
+        i->thread_info.playing_for += tchunk.length;
+
+        pa_memblockq_push_align(q, &tchunk);
+        pa_memblock_unref(tchunk.memblock);
+    }
+
+    pa_assert_se(pa_memblockq_peek_fixed_size(q, length, chunk) >= 0);
+
+    if (i->thread_info.muted)
+        pa_cvolume_mute(volume, i->thread_info.sample_spec.channels);
+    else
+        *volume = i->thread_info.soft_volume;
+
+    meters_process(i, chunk, &i->thread_info.sample_spec, volume);
+
+    pa_render_profile_stop(&i->thread_info.render_profile[PA_RENDER_STAGE_INPUT_PEEK], start);
+}
+
+/* Called from thread context */
+void pa_sink_input_premix_drop(pa_sink_input *i, size_t length /* in the input's sample spec */) {
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert(i->thread_info.premix_memblockq);
+    pa_assert(pa_frame_aligned(length, &i->thread_info.sample_spec));
+
+    pa_memblockq_drop(i->thread_info.premix_memblockq, length);
 }
 
 /* Called from thread context */
@@ -1066,7 +1460,7 @@ bool pa_sink_input_process_underrun(pa_sink_input *i) {
 /* Called from thread context */
 void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sample spec */) {
     size_t lbq;
-    bool called = false;
+    bool called = false, rewrite_all = false;
 
     pa_sink_input_assert_ref(i);
     pa_sink_input_assert_io_context(i);
@@ -1082,6 +1476,11 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
     if (nbytes > 0 && !i->thread_info.dont_rewind_render) {
         pa_log_debug("Have to rewind %lu bytes on render memblockq.", (unsigned long) nbytes);
         pa_memblockq_rewind(i->thread_info.render_memblockq, nbytes);
+        ramp_factor_rewind(i, nbytes);
+
+        /* There's no history in the render memblockq to rewind into,
+         * so all of it has to be rendered again */
+        rewrite_all = !!(i->flags & PA_SINK_INPUT_NO_RENDER_HISTORY);
     }
 
     if (i->thread_info.rewrite_nbytes == (size_t) -1) {
@@ -1091,43 +1490,9 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
 
         pa_memblockq_flush_write(i->thread_info.render_memblockq, true);
 
-    } else if (i->thread_info.rewrite_nbytes > 0) {
-        size_t max_rewrite, amount;
-
-        /* Calculate how much make sense to rewrite at most */
-        max_rewrite = nbytes + lbq;
-
-        /* Transform into local domain */
-        if (i->thread_info.resampler)
-            max_rewrite = pa_resampler_request(i->thread_info.resampler, max_rewrite);
-
-        /* Calculate how much of the rewinded data should actually be rewritten */
-        amount = PA_MIN(i->thread_info.rewrite_nbytes, max_rewrite);
-
-        if (amount > 0) {
-            pa_log_debug("Have to rewind %lu bytes on implementor.", (unsigned long) amount);
-
-            /* Tell the implementor */
-            if (i->process_rewind)
-                i->process_rewind(i, amount);
-            called = true;
-
-            /* Convert back to sink domain */
-            if (i->thread_info.resampler)
-                amount = pa_resampler_result(i->thread_info.resampler, amount);
-
-            if (amount > 0)
-                /* Ok, now update the write pointer */
-                pa_memblockq_seek(i->thread_info.render_memblockq, - ((int64_t) amount), PA_SEEK_RELATIVE, true);
-
-            if (i->thread_info.rewrite_flush)
-                pa_memblockq_silence(i->thread_info.render_memblockq);
-
-            /* And rewind the resampler */
-            if (i->thread_info.resampler)
-                pa_resampler_rewind(i->thread_info.resampler, amount);
-        }
-    }
+    } else if (i->thread_info.rewrite_nbytes > 0 || rewrite_all)
+        /* Rewrite at most what we rewound plus what is still queued */
+        called = rewrite_from_implementor(i, nbytes + lbq, rewrite_all ? (size_t) -1 : i->thread_info.rewrite_nbytes);
 
     if (!called)
         if (i->process_rewind)
@@ -1164,7 +1529,14 @@ void pa_sink_input_update_max_rewind(pa_sink_input *i, size_t nbytes  /* in the
     pa_assert(PA_SINK_INPUT_IS_LINKED(i->thread_info.state));
     pa_assert(pa_frame_aligned(nbytes, &i->sink->sample_spec));
 
-    pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, nbytes);
+    if (i->flags & PA_SINK_INPUT_NO_RENDER_HISTORY) {
+        pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, 0);
+
+        /* The implementor also has to render again what is still queued
+         * in the render memblockq, which is at most one block */
+        nbytes += pa_frame_align(pa_mempool_block_size_max(i->core->mempool), &i->sink->sample_spec);
+    } else
+        pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, nbytes);
 
     if (i->update_max_rewind)
         i->update_max_rewind(i, i->thread_info.resampler ? pa_resampler_request(i->thread_info.resampler, nbytes) : nbytes);
@@ -1244,6 +1616,41 @@ pa_usec_t pa_sink_input_get_requested_latency(pa_sink_input *i) {
     return i->thread_info.requested_sink_latency;
 }
 
+/* Called from main context. m is fed with the data the input hands to
+ * its sink, until it is removed with pa_sink_input_remove_meter(). The
+ * meter stays with the input when it is moved. */
+void pa_sink_input_add_meter(pa_sink_input *i, pa_meter *m) {
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(m);
+
+    if (PA_SINK_INPUT_IS_LINKED(i->state) && i->sink)
+        pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_ADD_METER, m, 0, NULL) == 0);
+    else
+        /* Not realized yet, being moved or gone from the IO thread */
+        PA_LLIST_PREPEND(pa_meter, i->thread_info.meters, m);
+}
+
+/* Called from main context */
+void pa_sink_input_remove_meter(pa_sink_input *i, pa_meter *m) {
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(m);
+
+    if (PA_SINK_INPUT_IS_LINKED(i->state) && i->sink)
+        pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_REMOVE_METER, m, 0, NULL) == 0);
+    else
+        PA_LLIST_REMOVE(pa_meter, i->thread_info.meters, m);
+}
+
+/* Called from main context. Nobody waits for the IO thread to take the
+ * volume, and if it is behind, only the last of several changes in a row
+ * reaches it. */
+static void post_soft_volume(pa_sink_input *i) {
+    pa_asyncmsgq_post_latest(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME,
+                             pa_xnewdup(pa_cvolume, &i->soft_volume, 1), 0, pa_xfree);
+}
+
 /* Called from main context */
 void pa_sink_input_set_volume(pa_sink_input *i, const pa_cvolume *volume, bool save, bool absolute) {
     pa_cvolume v;
@@ -1281,9 +1688,13 @@ void pa_sink_input_set_volume(pa_sink_input *i, const pa_cvolume *volume, bool s
 
     if (pa_sink_flat_volume_enabled(i->sink)) {
         /* We are in flat volume mode, so let's update all sink input
-         * volumes and update the flat volume of the sink */
+         * volumes and update the flat volume of the sink, unless
+         * only this input is affected */
 
-        pa_sink_set_volume(i->sink, NULL, true, save);
+        if (pa_sink_update_flat_volume_for_input(i->sink, i, save))
+            post_soft_volume(i);
+        else
+            pa_sink_set_volume(i->sink, NULL, true, save);
 
     } else {
         /* OK, we are in normal volume mode. The volume only affects
@@ -1292,7 +1703,7 @@ void pa_sink_input_set_volume(pa_sink_input *i, const pa_cvolume *volume, bool s
         pa_sink_input_set_reference_ratio(i, &i->volume);
 
         /* Copy the new soft_volume to the thread_info struct */
-        pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME, NULL, 0, NULL) == 0);
+        post_soft_volume(i);
     }
 }
 
@@ -1320,7 +1731,7 @@ void pa_sink_input_add_volume_factor(pa_sink_input *i, const char *key, const pa
     pa_sw_cvolume_multiply(&i->soft_volume, &i->real_ratio, &i->volume_factor);
 
     /* Copy the new soft_volume to the thread_info struct */
-    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME, NULL, 0, NULL) == 0);
+    post_soft_volume(i);
 }
 
 /* Returns 0 if an entry was removed and -1 if no entry for the given key was
@@ -1351,7 +1762,63 @@ int pa_sink_input_remove_volume_factor(pa_sink_input *i, const char *key) {
     pa_sw_cvolume_multiply(&i->soft_volume, &i->real_ratio, &i->volume_factor);
 
     /* Copy the new soft_volume to the thread_info struct */
-    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME, NULL, 0, NULL) == 0);
+    post_soft_volume(i);
+
+    return 0;
+}
+
+/* Called from main context */
+static void post_ramp_factor(pa_sink_input *i, pa_usec_t ramp_usec) {
+    pa_volume_t factor = PA_VOLUME_NORM;
+    struct volume_factor_entry *v;
+    void *state = NULL;
+
+    PA_HASHMAP_FOREACH(v, i->ramp_factor_items, state)
+        factor = pa_sw_volume_multiply(factor, v->volume.values[0]);
+
+    if (factor == i->ramp_factor)
+        return;
+
+    i->ramp_factor = factor;
+
+    /* While moving the new sink picks it up in pa_sink_input_finish_move() */
+    if (i->sink)
+        pa_asyncmsgq_post_latest(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_SET_RAMP_FACTOR,
+                                 PA_UINT32_TO_PTR(factor), (int64_t) ramp_usec, NULL);
+}
+
+/* Called from main context. Like pa_sink_input_add_volume_factor(), but
+ * the factor applies to all channels and is faded in over ramp_usec by
+ * the IO thread, starting with the data it renders next. Nothing that
+ * was rendered already is rewound for it. */
+void pa_sink_input_add_ramp_factor(pa_sink_input *i, const char *key, pa_volume_t factor, pa_usec_t ramp_usec) {
+    struct volume_factor_entry *v;
+    pa_cvolume f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_INPUT_IS_LINKED(i->state));
+    pa_assert(key);
+    pa_assert(PA_VOLUME_IS_VALID(factor));
+
+    v = volume_factor_entry_new(key, pa_cvolume_set(&f, 1, factor));
+    pa_assert_se(pa_hashmap_put(i->ramp_factor_items, v->key, v) >= 0);
+
+    post_ramp_factor(i, ramp_usec);
+}
+
+/* Returns 0 if an entry was removed and -1 if no entry for the given key was
+ * found. */
+int pa_sink_input_remove_ramp_factor(pa_sink_input *i, const char *key, pa_usec_t ramp_usec) {
+    pa_sink_input_assert_ref(i);
+    pa_assert(key);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_INPUT_IS_LINKED(i->state));
+
+    if (pa_hashmap_remove_and_free(i->ramp_factor_items, key) < 0)
+        return -1;
+
+    post_ramp_factor(i, ramp_usec);
 
     return 0;
 }
@@ -1874,7 +2341,7 @@ static void update_volume_due_to_moving(pa_sink_input *i, pa_sink *dest) {
 }
 
 /* Called from main context */
-int pa_sink_input_finish_move(pa_sink_input *i, pa_sink *dest, bool save) {
+static int finish_move(pa_sink_input *i, pa_sink *dest, bool save, bool seamless) {
     struct volume_factor_entry *v;
     void *state = NULL;
 
@@ -1933,7 +2400,11 @@ int pa_sink_input_finish_move(pa_sink_input *i, pa_sink *dest, bool save) {
     if (pa_sink_input_is_passthrough(i))
         pa_sink_enter_passthrough(i->sink);
 
-    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i->sink), PA_SINK_MESSAGE_FINISH_MOVE, i, 0, NULL) == 0);
+    /* The position of a ramp would be in frames of the old sink */
+    i->thread_info.ramp_factor = i->ramp_factor;
+    i->thread_info.ramp_factor_frames = i->thread_info.ramp_factor_pos = 0;
+
+    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i->sink), PA_SINK_MESSAGE_FINISH_MOVE, i, seamless, NULL) == 0);
 
     pa_log_debug("Successfully moved sink input %i to %s.", i->index, dest->name);
 
@@ -1944,6 +2415,11 @@ int pa_sink_input_finish_move(pa_sink_input *i, pa_sink *dest, bool save) {
     return 0;
 }
 
+/* Called from main context */
+int pa_sink_input_finish_move(pa_sink_input *i, pa_sink *dest, bool save) {
+    return finish_move(i, dest, save, false);
+}
+
 /* Called from main context */
 void pa_sink_input_fail_move(pa_sink_input *i) {
 
@@ -1963,7 +2439,7 @@ void pa_sink_input_fail_move(pa_sink_input *i) {
 }
 
 /* Called from main context */
-int pa_sink_input_move_to(pa_sink_input *i, pa_sink *dest, bool save) {
+static int move_to(pa_sink_input *i, pa_sink *dest, bool save, bool seamless) {
     int r;
 
     pa_sink_input_assert_ref(i);
@@ -1985,7 +2461,7 @@ int pa_sink_input_move_to(pa_sink_input *i, pa_sink *dest, bool save) {
         return r;
     }
 
-    if ((r = pa_sink_input_finish_move(i, dest, save)) < 0) {
+    if ((r = finish_move(i, dest, save, seamless)) < 0) {
         pa_sink_input_fail_move(i);
         pa_sink_input_unref(i);
         return r;
@@ -1996,6 +2472,16 @@ int pa_sink_input_move_to(pa_sink_input *i, pa_sink *dest, bool save) {
     return 0;
 }
 
+/* Called from main context */
+int pa_sink_input_move_to(pa_sink_input *i, pa_sink *dest, bool save) {
+    return move_to(i, dest, save, false);
+}
+
+/* Called from main context */
+int pa_sink_input_move_to_seamless(pa_sink_input *i, pa_sink *dest, bool save) {
+    return move_to(i, dest, save, true);
+}
+
 /* Called from IO thread context except when cork() is called without a valid sink. */
 void pa_sink_input_set_state_within_thread(pa_sink_input *i, pa_sink_input_state_t state) {
     bool corking, uncorking;
@@ -2054,16 +2540,25 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
 
     switch (code) {
 
-        case PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME:
-            if (!pa_cvolume_equal(&i->thread_info.soft_volume, &i->soft_volume)) {
-                i->thread_info.soft_volume = i->soft_volume;
+        case PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME: {
+            const pa_cvolume *v = userdata ? userdata : &i->soft_volume;
+
+            if (!pa_cvolume_equal(&i->thread_info.soft_volume, v)) {
+                i->thread_info.soft_volume = *v;
+                i->sink->thread_info.volume_rewind = true;
                 pa_sink_input_request_rewind(i, 0, true, false, false);
             }
             return 0;
+        }
+
+        case PA_SINK_INPUT_MESSAGE_SET_RAMP_FACTOR:
+            ramp_factor_start(i, PA_PTR_TO_UINT32(userdata), (pa_usec_t) offset);
+            return 0;
 
         case PA_SINK_INPUT_MESSAGE_SET_SOFT_MUTE:
             if (i->thread_info.muted != i->muted) {
                 i->thread_info.muted = i->muted;
+                i->sink->thread_info.volume_rewind = true;
                 pa_sink_input_request_rewind(i, 0, true, false, false);
             }
             return 0;
@@ -2072,6 +2567,8 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
             pa_usec_t *r = userdata;
 
             r[0] += pa_bytes_to_usec(pa_memblockq_get_length(i->thread_info.render_memblockq), &i->sink->sample_spec);
+            if (i->thread_info.premix_memblockq)
+                r[0] += pa_bytes_to_usec(pa_memblockq_get_length(i->thread_info.premix_memblockq), &i->thread_info.sample_spec);
             r[1] += pa_sink_get_latency_within_thread(i->sink, false);
 
             return 0;
@@ -2111,6 +2608,14 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
             *r = i->thread_info.requested_sink_latency;
             return 0;
         }
+
+        case PA_SINK_INPUT_MESSAGE_ADD_METER:
+            PA_LLIST_PREPEND(pa_meter, i->thread_info.meters, (pa_meter*) userdata);
+            return 0;
+
+        case PA_SINK_INPUT_MESSAGE_REMOVE_METER:
+            PA_LLIST_REMOVE(pa_meter, i->thread_info.meters, (pa_meter*) userdata);
+            return 0;
     }
 
     return -PA_ERR_NOTIMPLEMENTED;
@@ -2221,11 +2726,18 @@ void pa_sink_input_request_rewind(
         if (i->thread_info.resampler)
             nbytes = pa_resampler_result(i->thread_info.resampler, nbytes);
 
+        /* Inputs outside of the deep bus don't need the deep inputs
+         * to be rewound with them */
         if (nbytes > lbq)
-            pa_sink_request_rewind(i->sink, nbytes - lbq);
+            nbytes -= lbq;
         else
             /* This call will make sure process_rewind() is called later */
-            pa_sink_request_rewind(i->sink, 0);
+            nbytes = 0;
+
+        if (i->thread_info.deep)
+            pa_sink_request_rewind(i->sink, nbytes);
+        else
+            pa_sink_request_rewind_fast_lane(i->sink, nbytes);
     }
 }
 
@@ -2297,7 +2809,7 @@ int pa_sink_input_update_rate(pa_sink_input *i) {
          !pa_sample_spec_equal(&i->sample_spec, &i->sink->sample_spec) ||
          !pa_channel_map_equal(&i->channel_map, &i->sink->channel_map))) {
 
-        new_resampler = pa_resampler_new(i->core->mempool,
+        new_resampler = pa_resampler_cache_get(&i->core->resampler_cache, i->core->mempool,
                                      &i->sample_spec, &i->channel_map,
                                      &i->sink->sample_spec, &i->sink->channel_map,
                                      i->core->lfe_crossover_freq,
@@ -2319,14 +2831,20 @@ int pa_sink_input_update_rate(pa_sink_input *i) {
         return 0;
 
     if (i->thread_info.resampler)
-        pa_resampler_free(i->thread_info.resampler);
+        pa_resampler_cache_put(&i->core->resampler_cache, i->thread_info.resampler);
 
     i->thread_info.resampler = new_resampler;
 
     pa_memblockq_free(i->thread_info.render_memblockq);
 
+    /* Popped in the old sample spec */
+    if (i->thread_info.premix_memblockq) {
+        pa_memblockq_free(i->thread_info.premix_memblockq);
+        i->thread_info.premix_memblockq = NULL;
+    }
+
     memblockq_name = pa_sprintf_malloc("sink input render_memblockq [%u]", i->index);
-    i->thread_info.render_memblockq = pa_memblockq_new(
+    i->thread_info.render_memblockq = pa_memblockq_new_ring(
             memblockq_name,
             0,
             MEMBLOCKQ_MAXLENGTH,
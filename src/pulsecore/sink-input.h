@@ -27,6 +27,8 @@
 #include <pulse/sample.h>
 #include <pulse/format.h>
 #include <pulsecore/memblockq.h>
+#include <pulsecore/meter.h>
+#include <pulsecore/render-profile.h>
 #include <pulsecore/resampler.h>
 #include <pulsecore/module.h>
 #include <pulsecore/client.h>
@@ -58,12 +60,21 @@ typedef enum pa_sink_input_flags {
     PA_SINK_INPUT_DONT_INHIBIT_AUTO_SUSPEND = 256,
     PA_SINK_INPUT_NO_CREATE_ON_SUSPEND = 512,
     PA_SINK_INPUT_KILL_ON_SUSPEND = 1024,
-    PA_SINK_INPUT_PASSTHROUGH = 2048
+    PA_SINK_INPUT_PASSTHROUGH = 2048,
+    /* The implementor keeps enough history to render again anything
+     * the sink rewinds, so the render memblockq keeps none and rewinds
+     * always rewrite from the implementor */
+    PA_SINK_INPUT_NO_RENDER_HISTORY = 4096
 } pa_sink_input_flags_t;
 
 struct pa_sink_input {
     pa_msgobject parent;
 
+    /* The reference counter in parent is changed from the IO thread
+     * too. Main thread fields follow, then thread_info, each starting
+     * on their own cache line. */
+    PA_CACHELINE_PAD(_pad_ref);
+
     uint32_t index;
     pa_core *core;
 
@@ -91,6 +102,10 @@ struct pa_sink_input {
     pa_channel_map channel_map;
     pa_format_info *format;
 
+    /* The core's change_generation when this sink input was last
+     * announced as new or changed */
+    uint64_t change_generation;
+
     pa_sink_input *sync_prev, *sync_next;
 
     /* Also see http://www.freedesktop.org/wiki/Software/PulseAudio/Documentation/Developer/Volumes/ */
@@ -111,6 +126,14 @@ struct pa_sink_input {
     pa_cvolume volume_factor_sink; /* A second volume factor in format of the sink this stream is connected to. */
     pa_hashmap *volume_factor_sink_items;
 
+    /* ramp_factor is yet another internal volume, the product of the
+     * items in ramp_factor_items. Unlike volume_factor it is applied by
+     * the IO thread to data that wasn't rendered yet, faded in over a
+     * given time and without a rewind. Modules use
+     * pa_sink_input_add/remove_ramp_factor() to change it. */
+    pa_volume_t ramp_factor;
+    pa_hashmap *ramp_factor_items;
+
     bool volume_writable:1;
 
     bool muted:1;
@@ -221,27 +244,63 @@ struct pa_sink_input {
      * mute status changes. Called from main context */
     void (*mute_changed)(pa_sink_input *i); /* may be NULL */
 
+    /* Copy of thread_info.render_profile, updated by
+     * pa_sink_update_render_profile() */
+    pa_render_profile render_profile[PA_RENDER_STAGE_MAX];
+
+    void *userdata;
+
+    PA_CACHELINE_PAD(_pad_thread_info);
+
     struct {
+        /* What the render loop touches for every input, kept together */
         pa_sink_input_state_t state;
-        pa_atomic_t drained;
+        bool muted:1;
+        pa_resampler *resampler;                     /* may be NULL */
+
+        /* We maintain a history of resampled audio data here. */
+        pa_memblockq *render_memblockq;
 
         pa_cvolume soft_volume;
-        bool muted:1;
+
+        /* Changes of ramp_factor are faded in linearly, starting at
+         * ramp_factor_from. ramp_factor_pos counts the frames dropped
+         * since, in the sink's sample spec, the ramp is over once it
+         * reaches ramp_factor_frames. */
+        pa_volume_t ramp_factor, ramp_factor_from;
+        size_t ramp_factor_frames, ramp_factor_pos;
 
         bool attached:1; /* True only between ->attach() and ->detach() calls */
 
         /* rewrite_nbytes: 0: rewrite nothing, (size_t) -1: rewrite everything, otherwise how many bytes to rewrite */
         bool rewrite_flush:1, dont_rewind_render:1;
+
+        /* pa_sink_input_is_passthrough(), which can't change after
+         * creation. The sink copies such an input verbatim. */
+        bool passthrough:1;
         size_t rewrite_nbytes;
         uint64_t underrun_for, playing_for;
         uint64_t underrun_for_sink; /* Like underrun_for, but in sink sample spec */
 
+        /* Bytes of imported (client SHM/memfd) memory that were mixed
+         * straight from the client's memblocks, in sink sample spec */
+        uint64_t zero_copy_bytes;
+
         pa_sample_spec sample_spec;
 
-        pa_resampler *resampler;                     /* may be NULL */
+        /* Set by the sink if other inputs use a resampler with the same
+         * configuration. premixed is true while the input is mixed into
+         * that premix instead of being peeked as usual, premix_memblockq
+         * holds what was popped for it but not mixed yet, in the input's
+         * sample spec. */
+        pa_sink_premix *premix;
+        bool premixed:1;
+        pa_memblockq *premix_memblockq;
 
-        /* We maintain a history of resampled audio data here. */
-        pa_memblockq *render_memblockq;
+        /* Set by the sink while the input is mixed into its deep bus.
+         * Its render_memblockq is then ahead of the final mix by what
+         * the bus holds. */
+        bool deep:1;
 
         pa_sink_input *sync_prev, *sync_next;
 
@@ -249,9 +308,15 @@ struct pa_sink_input {
         pa_usec_t requested_sink_latency;
 
         pa_hashmap *direct_outputs;
-    } thread_info;
 
-    void *userdata;
+        pa_render_profile render_profile[PA_RENDER_STAGE_MAX];
+
+        /* Fed with what the input hands to the sink, after volume */
+        PA_LLIST_HEAD(pa_meter, meters);
+
+        /* Also read from the main thread, see pa_sink_input_get_state() */
+        pa_atomic_t drained;
+    } thread_info;
 };
 
 PA_DECLARE_PUBLIC_CLASS(pa_sink_input);
@@ -260,11 +325,14 @@ PA_DECLARE_PUBLIC_CLASS(pa_sink_input);
 enum {
     PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME,
     PA_SINK_INPUT_MESSAGE_SET_SOFT_MUTE,
+    PA_SINK_INPUT_MESSAGE_SET_RAMP_FACTOR,
     PA_SINK_INPUT_MESSAGE_GET_LATENCY,
     PA_SINK_INPUT_MESSAGE_SET_RATE,
     PA_SINK_INPUT_MESSAGE_SET_STATE,
     PA_SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY,
     PA_SINK_INPUT_MESSAGE_GET_REQUESTED_LATENCY,
+    PA_SINK_INPUT_MESSAGE_ADD_METER,
+    PA_SINK_INPUT_MESSAGE_REMOVE_METER,
     PA_SINK_INPUT_MESSAGE_MAX
 };
 
@@ -367,6 +435,8 @@ bool pa_sink_input_is_volume_readable(pa_sink_input *i);
 void pa_sink_input_set_volume(pa_sink_input *i, const pa_cvolume *volume, bool save, bool absolute);
 void pa_sink_input_add_volume_factor(pa_sink_input *i, const char *key, const pa_cvolume *volume_factor);
 int pa_sink_input_remove_volume_factor(pa_sink_input *i, const char *key);
+void pa_sink_input_add_ramp_factor(pa_sink_input *i, const char *key, pa_volume_t factor, pa_usec_t ramp_usec);
+int pa_sink_input_remove_ramp_factor(pa_sink_input *i, const char *key, pa_usec_t ramp_usec);
 pa_cvolume *pa_sink_input_get_volume(pa_sink_input *i, pa_cvolume *volume, bool absolute);
 
 void pa_sink_input_set_mute(pa_sink_input *i, bool mute, bool save);
@@ -380,6 +450,13 @@ pa_resample_method_t pa_sink_input_get_resample_method(pa_sink_input *i);
 void pa_sink_input_send_event(pa_sink_input *i, const char *name, pa_proplist *data);
 
 int pa_sink_input_move_to(pa_sink_input *i, pa_sink *dest, bool save);
+
+/* The same as pa_sink_input_move_to() but the stream continues on the
+ * new sink where it left the old one: only as much of it is skipped as
+ * the new sink can take back by rewinding, and it is faded in. Nothing
+ * gets lost this way, but the stream may fall behind the wall clock by
+ * the latency the new sink can't rewind. */
+int pa_sink_input_move_to_seamless(pa_sink_input *i, pa_sink *dest, bool save);
 bool pa_sink_input_may_move(pa_sink_input *i); /* may this sink input move at all? */
 bool pa_sink_input_may_move_to(pa_sink_input *i, pa_sink *dest); /* may this sink input move to this sink? */
 
@@ -394,10 +471,20 @@ pa_sink_input_state_t pa_sink_input_get_state(pa_sink_input *i);
 
 pa_usec_t pa_sink_input_get_requested_latency(pa_sink_input *i);
 
+void pa_sink_input_add_meter(pa_sink_input *i, pa_meter *m);
+void pa_sink_input_remove_meter(pa_sink_input *i, pa_meter *m);
+
 /* To be used exclusively by the sink driver IO thread */
 
 void pa_sink_input_peek(pa_sink_input *i, size_t length, pa_memchunk *chunk, pa_cvolume *volume);
 void pa_sink_input_drop(pa_sink_input *i, size_t length);
+void pa_sink_input_unread(pa_sink_input *i, size_t length);
+/* Whether the input may be mixed before resampling and then go through r
+ * instead of its own resampler at this point */
+bool pa_sink_input_can_premix(pa_sink_input *i, pa_resampler *r);
+/* Like peek and drop, but for exactly length bytes of unresampled data */
+void pa_sink_input_premix_peek(pa_sink_input *i, size_t length /* in the input's sample spec */, pa_memchunk *chunk, pa_cvolume *volume);
+void pa_sink_input_premix_drop(pa_sink_input *i, size_t length /* in the input's sample spec */);
 void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in the sink's sample spec */);
 void pa_sink_input_update_max_rewind(pa_sink_input *i, size_t nbytes  /* in the sink's sample spec */);
 void pa_sink_input_update_max_request(pa_sink_input *i, size_t nbytes  /* in the sink's sample spec */);
@@ -408,6 +495,9 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
 
 pa_usec_t pa_sink_input_set_requested_latency_within_thread(pa_sink_input *i, pa_usec_t usec);
 
+/* Ramps the stream up from silence to its current ramp factor */
+void pa_sink_input_fade_in_within_thread(pa_sink_input *i, pa_usec_t usec);
+
 bool pa_sink_input_safe_to_remove(pa_sink_input *i);
 bool pa_sink_input_process_underrun(pa_sink_input *i);
 
@@ -45,31 +45,54 @@
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/play-memblockq.h>
-#include <pulsecore/flist.h>
+#include <pulsecore/render-pool.h>
+#include <pulsecore/trace.h>
 
 #include "sink.h"
 
-#define MAX_MIX_CHANNELS 32
+#define MIX_INFO_INITIAL_SIZE 32
+
+/* Below this many inputs peeking them in parallel doesn't pay off */
+#define PARALLEL_PEEK_MIN_INPUTS 4
 #define MIX_BUFFER_LENGTH (pa_page_size())
 #define ABSOLUTE_MIN_LATENCY (500)
 #define ABSOLUTE_MAX_LATENCY (10*PA_USEC_PER_SEC)
 #define DEFAULT_FIXED_LATENCY (250*PA_USEC_PER_MSEC)
 
-PA_DEFINE_PUBLIC_CLASS(pa_sink, pa_msgobject);
-
-struct pa_sink_volume_change {
-    pa_usec_t at;
-    pa_cvolume hw_volume;
-
-    PA_LLIST_FIELDS(pa_sink_volume_change);
+/* Soft volume changes are faded in over this time. Sinks with a latency
+ * above SOFT_VOLUME_REWIND_LATENCY additionally rewind, so that the
+ * change doesn't take that long to become audible. */
+#define SOFT_VOLUME_RAMP_USEC (10*PA_USEC_PER_MSEC)
+#define SOFT_VOLUME_REWIND_LATENCY (50*PA_USEC_PER_MSEC)
+
+/* Streams moved with pa_sink_input_move_to_seamless() are faded in over
+ * this time */
+#define SEAMLESS_MOVE_FADE_USEC (10*PA_USEC_PER_MSEC)
+
+/* A resampler run once per rendered chunk on the mix of all inputs whose
+ * own resamplers have the same configuration */
+struct pa_sink_premix {
+    pa_resampler *resampler;
+    pa_memblockq *memblockq; /* resampled mix not played yet, in the sink's sample spec */
+    pa_mix_info *info; /* scratch space, one entry per assigned input */
+    unsigned n_inputs; /* assigned inputs */
+    unsigned n_active; /* inputs actually mixed into it for the current chunk */
+    bool idle:1; /* was not run for the last chunk, its history is stale */
+    bool peeked:1; /* is part of the current chunk */
+
+    PA_LLIST_FIELDS(pa_sink_premix);
 };
 
+PA_DEFINE_PUBLIC_CLASS(pa_sink, pa_msgobject);
+
 struct sink_message_set_port {
     pa_device_port *port;
     int ret;
 };
 
 static void sink_free(pa_object *s);
+static void premix_free(pa_sink *s, pa_sink_premix *f);
+static void request_rewind(pa_sink *s, size_t nbytes, bool deep);
 
 static void pa_sink_volume_change_push(pa_sink *s);
 static void pa_sink_volume_change_flush(pa_sink *s);
@@ -151,6 +174,7 @@ static void reset_callbacks(pa_sink *s) {
     pa_assert(s);
 
     s->set_state = NULL;
+    s->suspend_cause_changed = NULL;
     s->get_volume = NULL;
     s->set_volume = NULL;
     s->write_volume = NULL;
@@ -158,6 +182,7 @@ static void reset_callbacks(pa_sink *s) {
     s->set_mute = NULL;
     s->request_rewind = NULL;
     s->update_requested_latency = NULL;
+    s->cpu_overload = NULL;
     s->set_port = NULL;
     s->get_formats = NULL;
     s->set_formats = NULL;
@@ -265,6 +290,7 @@ pa_sink* pa_sink_new(
     s->sample_spec = data->sample_spec;
     s->channel_map = data->channel_map;
     s->default_sample_rate = s->sample_spec.rate;
+    s->supported_rates = NULL;
 
     if (data->alternate_sample_rate_is_set)
         s->alternate_sample_rate = data->alternate_sample_rate;
@@ -314,6 +340,11 @@ pa_sink* pa_sink_new(
     else
         s->port_latency_offset = 0;
 
+    s->latency_smoother = NULL;
+    pa_atomic_store(&s->latency_base.seq, 0);
+    s->latency_base.valid = false;
+    s->latency_base.usec = 0;
+
     s->save_volume = data->save_volume;
     s->save_muted = data->save_muted;
 
@@ -327,11 +358,36 @@ pa_sink* pa_sink_new(
     s->thread_info.rtpoll = NULL;
     s->thread_info.inputs = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL,
                                                 (pa_free_cb_t) pa_sink_input_unref);
+    s->thread_info.mix_info_size = MIX_INFO_INITIAL_SIZE;
+    s->thread_info.mix_info = pa_xnew(pa_mix_info, s->thread_info.mix_info_size);
+    s->thread_info.render_inputs = pa_xnew(pa_sink_input*, s->thread_info.mix_info_size);
+    s->thread_info.n_render_inputs = 0;
+    PA_LLIST_HEAD_INIT(pa_sink_premix, s->thread_info.premixes);
+    PA_LLIST_HEAD_INIT(pa_meter, s->thread_info.meters);
+    pa_cpu_budget_init(&s->thread_info.cpu_budget, core->io_thread_cpu_budget);
+    s->thread_info.deep_bus_latency = 0;
+    s->thread_info.deep_bus_memblockq = NULL;
+    s->thread_info.deep_bus_info = pa_xnew(pa_mix_info, s->thread_info.mix_info_size);
+    s->thread_info.deep_bus_history = 0;
+    s->thread_info.n_deep_inputs = 0;
+    s->thread_info.deep_bus_peeked = false;
+    s->thread_info.render_pool = pa_render_pool_get(core);
+    s->thread_info.render_latency = 0;
+    s->thread_info.render_latency_valid = false;
+    s->thread_info.mix_func = pa_get_mix_func_for_channels(s->sample_spec.format, s->sample_spec.channels);
     s->thread_info.soft_volume =  s->soft_volume;
     s->thread_info.soft_muted = s->muted;
+    s->thread_info.soft_volume_ramp_from = s->soft_volume;
+    s->thread_info.soft_volume_ramp_frames = s->thread_info.soft_volume_ramp_pos = 0;
     s->thread_info.state = s->state;
     s->thread_info.rewind_nbytes = 0;
     s->thread_info.rewind_requested = false;
+    s->thread_info.rewind_deep = false;
+    s->thread_info.refill_limit = 0;
+    s->thread_info.volume_rewind = false;
+    s->thread_info.volume_horizon_usec = core->volume_horizon_usec;
+    pa_zero(s->thread_info.rewind_stats);
+    pa_zero(s->thread_info.passthrough_stats);
     s->thread_info.max_rewind = 0;
     s->thread_info.max_request = 0;
     s->thread_info.requested_latency_valid = false;
@@ -340,8 +396,8 @@ pa_sink* pa_sink_new(
     s->thread_info.max_latency = ABSOLUTE_MAX_LATENCY;
     s->thread_info.fixed_latency = flags & PA_SINK_DYNAMIC_LATENCY ? 0 : DEFAULT_FIXED_LATENCY;
 
-    PA_LLIST_HEAD_INIT(pa_sink_volume_change, s->thread_info.volume_changes);
-    s->thread_info.volume_changes_tail = NULL;
+    s->thread_info.volume_changes_head = 0;
+    s->thread_info.n_volume_changes = 0;
     pa_sw_cvolume_divide(&s->thread_info.current_hw_volume, &s->real_volume, &s->soft_volume);
     s->thread_info.volume_change_safety_margin = core->deferred_volume_safety_margin_usec;
     s->thread_info.volume_change_extra_delay = core->deferred_volume_extra_delay_usec;
@@ -741,6 +797,19 @@ static void sink_free(pa_object *o) {
 
     pa_idxset_free(s->inputs, NULL);
     pa_hashmap_free(s->thread_info.inputs);
+    pa_xfree(s->supported_rates);
+    pa_xfree(s->thread_info.mix_info);
+    pa_xfree(s->thread_info.render_inputs);
+
+    while (s->thread_info.premixes)
+        premix_free(s, s->thread_info.premixes);
+
+    if (s->thread_info.deep_bus_memblockq)
+        pa_memblockq_free(s->thread_info.deep_bus_memblockq);
+    pa_xfree(s->thread_info.deep_bus_info);
+
+    if (s->thread_info.render_pool)
+        pa_render_pool_unref(s->thread_info.render_pool);
 
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
@@ -839,11 +908,15 @@ void pa_sink_set_mixer_dirty(pa_sink *s, bool is_dirty) {
 
 /* Called from main context */
 int pa_sink_suspend(pa_sink *s, bool suspend, pa_suspend_cause_t cause) {
+    pa_suspend_cause_t old_cause;
+
     pa_sink_assert_ref(s);
     pa_assert_ctl_context();
     pa_assert(PA_SINK_IS_LINKED(s->state));
     pa_assert(cause != 0);
 
+    old_cause = s->suspend_cause;
+
     if (suspend) {
         s->suspend_cause |= cause;
         s->monitor_source->suspend_cause |= cause;
@@ -873,8 +946,12 @@ int pa_sink_suspend(pa_sink *s, bool suspend, pa_suspend_cause_t cause) {
         }
     }
 
-    if ((pa_sink_get_state(s) == PA_SINK_SUSPENDED) == !!s->suspend_cause)
+    if ((pa_sink_get_state(s) == PA_SINK_SUSPENDED) == !!s->suspend_cause) {
+        if (s->suspend_cause && s->suspend_cause != old_cause && s->suspend_cause_changed)
+            s->suspend_cause_changed(s, old_cause);
+
         return 0;
+    }
 
     pa_log_debug("Suspend cause of sink %s is 0x%04x, %s", s->name, s->suspend_cause, s->suspend_cause ? "suspending" : "resuming");
 
@@ -994,10 +1071,86 @@ size_t pa_sink_process_input_underruns(pa_sink *s, size_t left_to_play) {
     return left_to_play - result;
 }
 
+/* Called from IO thread context. Returns whether a soft volume ramp is
+ * in progress, and if so the volume at the current position and the
+ * number of frames left. */
+static bool soft_volume_ramp_get(pa_sink *s, pa_cvolume *current, size_t *left) {
+    size_t pos = s->thread_info.soft_volume_ramp_pos, frames = s->thread_info.soft_volume_ramp_frames;
+    unsigned c;
+
+    if (pos >= frames)
+        return false;
+
+    if (current) {
+        current->channels = s->thread_info.soft_volume.channels;
+
+        for (c = 0; c < current->channels; c++) {
+            double from = pa_sw_volume_to_linear(s->thread_info.soft_volume_ramp_from.values[c]);
+            double to = pa_sw_volume_to_linear(s->thread_info.soft_volume.values[c]);
+
+            current->values[c] = pa_sw_volume_from_linear(from + (to - from) * (double) pos / (double) frames);
+        }
+    }
+
+    if (left)
+        *left = frames - pos;
+
+    return true;
+}
+
+/* Called from IO thread context */
+static void soft_volume_ramp_start(pa_sink *s, const pa_cvolume *volume) {
+    pa_cvolume current;
+
+    if (!soft_volume_ramp_get(s, &current, NULL))
+        current = s->thread_info.soft_volume;
+
+    s->thread_info.soft_volume = *volume;
+
+    if (!pa_cvolume_compatible(&current, &s->sample_spec) || !pa_cvolume_compatible(volume, &s->sample_spec)) {
+        s->thread_info.soft_volume_ramp_frames = s->thread_info.soft_volume_ramp_pos = 0;
+        return;
+    }
+
+    s->thread_info.soft_volume_ramp_from = current;
+    s->thread_info.soft_volume_ramp_frames = pa_usec_to_bytes(SOFT_VOLUME_RAMP_USEC, &s->sample_spec) / pa_frame_size(&s->sample_spec);
+    s->thread_info.soft_volume_ramp_pos = 0;
+}
+
+/* Called from IO thread context */
+static void soft_volume_ramp_stop(pa_sink *s) {
+    s->thread_info.soft_volume_ramp_frames = s->thread_info.soft_volume_ramp_pos = 0;
+}
+
+/* Called from IO thread context */
+static void soft_volume_ramp_advance(pa_sink *s, size_t nbytes) {
+    if (s->thread_info.soft_volume_ramp_pos >= s->thread_info.soft_volume_ramp_frames)
+        return;
+
+    s->thread_info.soft_volume_ramp_pos += nbytes / pa_frame_size(&s->sample_spec);
+
+    if (s->thread_info.soft_volume_ramp_pos >= s->thread_info.soft_volume_ramp_frames)
+        soft_volume_ramp_stop(s);
+}
+
+/* Called from IO thread context. Rewound data gets rendered again, so
+ * move the ramp back, possibly to before its start, which makes the
+ * change take effect earlier. */
+static void soft_volume_ramp_rewind(pa_sink *s, size_t nbytes) {
+    size_t frames = nbytes / pa_frame_size(&s->sample_spec);
+
+    if (s->thread_info.soft_volume_ramp_pos >= s->thread_info.soft_volume_ramp_frames)
+        return;
+
+    s->thread_info.soft_volume_ramp_pos -= PA_MIN(frames, s->thread_info.soft_volume_ramp_pos);
+}
+
 /* Called from IO thread context */
 void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     pa_sink_input *i;
     void *state = NULL;
+    size_t deep_nbytes = nbytes;
+    bool fast_lane = false;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1013,15 +1166,58 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     s->thread_info.rewind_nbytes = 0;
     s->thread_info.rewind_requested = false;
 
+    if (s->thread_info.n_deep_inputs > 0) {
+        pa_memblockq *bq = s->thread_info.deep_bus_memblockq;
+        size_t queued = pa_memblockq_get_length(bq);
+
+        /* If the deep inputs don't need to change anything and the
+         * bus still has what is to be rewritten, it is simply played
+         * again. Otherwise the deep inputs are rewound to where the
+         * final mix is, which includes what the bus holds ahead. */
+        fast_lane =
+            !s->thread_info.rewind_deep &&
+            nbytes <= s->thread_info.deep_bus_history &&
+            queued + nbytes <= s->thread_info.max_rewind;
+
+        if (fast_lane) {
+            pa_memblockq_rewind(bq, nbytes);
+            s->thread_info.deep_bus_history -= nbytes;
+        } else {
+            deep_nbytes = queued + nbytes;
+            pa_memblockq_flush_write(bq, true);
+            s->thread_info.deep_bus_history = 0;
+        }
+    }
+
+    s->thread_info.rewind_deep = false;
+
     if (nbytes > 0) {
+        PA_TRACE2(sink_rewind, s->index, nbytes);
         pa_log_debug("Processing rewind...");
+        s->thread_info.rewind_stats.n_rewinds++;
+        s->thread_info.rewind_stats.n_bytes += nbytes;
+
+        if (fast_lane)
+            s->thread_info.rewind_stats.n_fast_lane++;
+
         if (s->flags & PA_SINK_DEFERRED_VOLUME)
             pa_sink_volume_change_rewind(s, nbytes);
+
+        soft_volume_ramp_rewind(s, nbytes);
+
+        if (s->thread_info.volume_rewind && s->thread_info.volume_horizon_usec > 0)
+            s->thread_info.refill_limit = pa_usec_to_bytes(s->thread_info.volume_horizon_usec, &s->sample_spec);
     }
 
+    s->thread_info.volume_rewind = false;
+
     PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
         pa_sink_input_assert_ref(i);
-        pa_sink_input_process_rewind(i, nbytes);
+
+        if (!i->thread_info.deep)
+            pa_sink_input_process_rewind(i, nbytes);
+        else
+            pa_sink_input_process_rewind(i, fast_lane ? 0 : deep_nbytes);
     }
 
     if (nbytes > 0) {
@@ -1030,30 +1226,626 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     }
 }
 
+/* Called from IO thread context. Returns how much of a buffer of
+ * buffer_size bytes should be left unused by the next fill, given that
+ * the sink would normally leave unused bytes free. While a refill limit
+ * is in effect this is larger, so that the next stream volume change
+ * has less to rewrite. */
+size_t pa_sink_get_refill_unused_within_thread(pa_sink *s, size_t buffer_size, size_t unused) {
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    if (s->thread_info.refill_limit <= 0 || s->thread_info.refill_limit >= buffer_size)
+        return unused;
+
+    return PA_MAX(unused, buffer_size - s->thread_info.refill_limit);
+}
+
+/* Called from IO thread context, after each fill of the buffer. Grows
+ * the refill limit and lifts it once it no longer restricts anything. */
+void pa_sink_refilled_within_thread(pa_sink *s, size_t buffer_size, size_t unused) {
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    if (s->thread_info.refill_limit <= 0)
+        return;
+
+    s->thread_info.refill_limit *= 2;
+
+    if (unused >= buffer_size || s->thread_info.refill_limit >= buffer_size - unused)
+        s->thread_info.refill_limit = 0;
+}
+
 /* Called from IO thread context */
-static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, unsigned maxinfo) {
+static pa_sink_premix *premix_new(pa_sink *s, pa_resampler *r) {
+    pa_sink_premix *f;
+    pa_resampler *resampler;
+    char *memblockq_name;
+
+    if (!(resampler = pa_resampler_new(s->core->mempool, &r->i_ss, &r->i_cm, &r->o_ss, &r->o_cm,
+                                       s->core->lfe_crossover_freq, r->method, r->flags)))
+        return NULL;
+
+    f = pa_xnew0(pa_sink_premix, 1);
+    f->resampler = resampler;
+    f->idle = true;
+
+    memblockq_name = pa_sprintf_malloc("sink premix_memblockq [%u]", s->index);
+    f->memblockq = pa_memblockq_new_ring(
+            memblockq_name,
+            0,
+            pa_mempool_block_size_max(s->core->mempool) * 2,
+            0,
+            &s->sample_spec,
+            0,
+            1,
+            0,
+            &s->silence);
+    pa_xfree(memblockq_name);
+
+    PA_LLIST_PREPEND(pa_sink_premix, s->thread_info.premixes, f);
+
+    return f;
+}
+
+static void premix_free(pa_sink *s, pa_sink_premix *f) {
+    PA_LLIST_REMOVE(pa_sink_premix, s->thread_info.premixes, f);
+
+    pa_resampler_free(f->resampler);
+    pa_memblockq_free(f->memblockq);
+    pa_xfree(f->info);
+    pa_xfree(f);
+}
+
+/* Called from IO thread context */
+static void premix_leave(pa_sink_input *i) {
+
+    /* The input's own resampler hasn't seen the data that went through
+     * the shared one */
+    if (i->thread_info.premixed && i->thread_info.resampler)
+        pa_resampler_reset(i->thread_info.resampler);
+
+    i->thread_info.premix = NULL;
+    i->thread_info.premixed = false;
+}
+
+/* Called from IO thread context. Groups the render inputs by the
+ * configuration of their resamplers. Existing groups are kept where
+ * possible, so that rebuilding doesn't disturb the other streams. */
+static void update_premixes(pa_sink *s) {
+    pa_sink_premix *f, *next;
+    unsigned j, k, n;
+
+    n = s->thread_info.n_render_inputs;
+
+    PA_LLIST_FOREACH(f, s->thread_info.premixes)
+        f->n_inputs = 0;
+
+    for (j = 0; j < n && s->core->premix_inputs; j++) {
+        pa_sink_input *i = s->thread_info.render_inputs[j];
+        pa_resampler *r = i->thread_info.resampler;
+
+        if (!r || (r->flags & PA_RESAMPLER_VARIABLE_RATE) || i->thread_info.deep)
+            continue;
+
+        PA_LLIST_FOREACH(f, s->thread_info.premixes)
+            if (pa_resampler_same_config(r, f->resampler))
+                break;
+
+        if (!f) {
+            /* Only worth it if some other input would join */
+            for (k = j + 1; k < n; k++)
+                if (!s->thread_info.render_inputs[k]->thread_info.deep &&
+                    s->thread_info.render_inputs[k]->thread_info.resampler &&
+                    pa_resampler_same_config(r, s->thread_info.render_inputs[k]->thread_info.resampler))
+                    break;
+
+            if (k >= n || !(f = premix_new(s, r)))
+                continue;
+        }
+
+        i->thread_info.premix = f;
+        f->n_inputs++;
+    }
+
+    PA_LLIST_FOREACH_SAFE(f, next, s->thread_info.premixes) {
+        if (f->n_inputs >= 2) {
+            f->info = pa_xrenew(pa_mix_info, f->info, f->n_inputs);
+            continue;
+        }
+
+        for (j = 0; j < n; j++)
+            if (s->thread_info.render_inputs[j]->thread_info.premix == f)
+                s->thread_info.render_inputs[j]->thread_info.premix = NULL;
+
+        premix_free(s, f);
+    }
+}
+
+/* Called from IO thread context. Decides which inputs are mixed into
+ * their premix for the current chunk. */
+static void premix_begin(pa_sink *s) {
+    pa_sink_premix *f;
+    unsigned k;
+
+    PA_LLIST_FOREACH(f, s->thread_info.premixes)
+        f->n_active = 0;
+
+    for (k = 0; k < s->thread_info.n_render_inputs; k++) {
+        pa_sink_input *i = s->thread_info.render_inputs[k];
+
+        if ((f = i->thread_info.premix) && pa_sink_input_can_premix(i, f->resampler))
+            f->n_active++;
+    }
+
+    for (k = 0; k < s->thread_info.n_render_inputs; k++) {
+        pa_sink_input *i = s->thread_info.render_inputs[k];
+        bool premixed;
+
+        premixed = (f = i->thread_info.premix) &&
+            f->n_active >= 2 &&
+            pa_sink_input_can_premix(i, f->resampler);
+
+        if (!premixed && i->thread_info.premixed)
+            pa_resampler_reset(i->thread_info.resampler);
+
+        i->thread_info.premixed = premixed;
+    }
+}
+
+/* Called from IO thread context. Mixes the active inputs of f at their
+ * own rate, resamples the mix once and returns what there is of it. */
+static bool premix_peek(pa_sink *s, pa_sink_premix *f, size_t length, pa_memchunk *chunk) {
+    size_t frame_size;
+    unsigned k, n;
+
+    if (f->n_active < 2) {
+        /* The few frames the resampler returned in excess are mixed
+         * data of inputs that are on their own now */
+        pa_memblockq_flush_read(f->memblockq);
+        f->idle = true;
+        return false;
+    }
+
+    if (f->idle) {
+        pa_resampler_reset(f->resampler);
+        f->idle = false;
+    }
+
+    frame_size = pa_frame_size(&f->resampler->i_ss);
+
+    while (!pa_memblockq_is_readable(f->memblockq)) {
+        pa_memchunk mchunk, rchunk;
+        size_t ilength;
+        pa_usec_t start;
+        void *ptr;
+
+        ilength = PA_MIN(pa_resampler_request(f->resampler, length), pa_resampler_max_block_size(f->resampler));
+        ilength = PA_MAX(ilength, frame_size);
+
+        n = 0;
+        for (k = 0; k < s->thread_info.n_render_inputs; k++) {
+            pa_sink_input *i = s->thread_info.render_inputs[k];
+
+            if (i->thread_info.premix != f || !i->thread_info.premixed)
+                continue;
+
+            pa_assert(n < f->n_inputs);
+            pa_sink_input_premix_peek(i, ilength, &f->info[n].chunk, &f->info[n].volume);
+            f->info[n].userdata = i;
+            n++;
+        }
+
+        pa_assert(n == f->n_active);
+
+        mchunk.memblock = pa_memblock_new(s->core->mempool, ilength);
+        mchunk.index = 0;
+
+        ptr = pa_memblock_acquire(mchunk.memblock);
+        mchunk.length = pa_mix(f->info, n, ptr, ilength, &f->resampler->i_ss, NULL, false);
+        pa_memblock_release(mchunk.memblock);
+
+        for (k = 0; k < n; k++) {
+            pa_memblock_unref(f->info[k].chunk.memblock);
+            pa_sink_input_premix_drop(f->info[k].userdata, ilength);
+        }
+
+        start = pa_render_profile_start();
+        pa_resampler_run(f->resampler, &mchunk, &rchunk);
+        pa_render_profile_stop(&s->thread_info.render_profile[PA_RENDER_STAGE_RESAMPLE], start);
+
+        if (rchunk.memblock) {
+            pa_memblockq_push_align(f->memblockq, &rchunk);
+            pa_memblock_unref(rchunk.memblock);
+        }
+
+        pa_memblock_unref(mchunk.memblock);
+    }
+
+    pa_assert_se(pa_memblockq_peek(f->memblockq, chunk) >= 0);
+    f->peeked = true;
+
+    return true;
+}
+
+/* Called from IO thread context */
+static bool input_wants_deep_bus(pa_sink *s, pa_sink_input *i) {
+
+    if (i->thread_info.passthrough)
+        return false;
+
+    return i->thread_info.requested_sink_latency == (pa_usec_t) -1 ||
+        i->thread_info.requested_sink_latency >= s->thread_info.deep_bus_latency;
+}
+
+/* Called from IO thread context. Gives the deep inputs back what was
+ * mixed into the bus but not played yet, and forgets the history of the
+ * bus, so that the set of deep inputs can change. */
+static void deep_bus_settle(pa_sink *s) {
     pa_sink_input *i;
-    unsigned n = 0;
-    void *state = NULL;
+    void *state;
+    size_t queued;
+
+    if (!s->thread_info.deep_bus_memblockq)
+        return;
+
+    queued = pa_memblockq_get_length(s->thread_info.deep_bus_memblockq);
+
+    if (queued > 0)
+        PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+            if (i->thread_info.deep)
+                pa_sink_input_unread(i, queued);
+
+    pa_memblockq_flush_write(s->thread_info.deep_bus_memblockq, true);
+    s->thread_info.deep_bus_history = 0;
+}
+
+/* Called from IO thread context. Decides which inputs are mixed into the
+ * deep bus. That is only worth it while some other input needs a lower
+ * latency. Returns true if the set of deep inputs changed. */
+static bool update_deep_bus(pa_sink *s) {
+    pa_sink_input *i;
+    void *state;
+    unsigned n_deep = 0;
+    bool fast_lane = false, changed = false;
+
+    if (!s->thread_info.deep_bus_memblockq)
+        return false;
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        if (!input_wants_deep_bus(s, i)) {
+            fast_lane = true;
+            break;
+        }
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+        bool deep = fast_lane && input_wants_deep_bus(s, i);
+
+        if (deep != i->thread_info.deep)
+            changed = true;
+
+        if (deep)
+            n_deep++;
+    }
+
+    if (!changed && n_deep == s->thread_info.n_deep_inputs)
+        return false;
+
+    deep_bus_settle(s);
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        i->thread_info.deep = fast_lane && input_wants_deep_bus(s, i);
+
+    s->thread_info.n_deep_inputs = n_deep;
+
+    if (n_deep > 0)
+        pa_log_debug("Mixing %u inputs into the deep bus of sink %s.", n_deep, s->name);
+
+    return true;
+}
+
+/* Called from IO thread context, before i leaves the sink */
+static void deep_bus_leave(pa_sink *s, pa_sink_input *i) {
+
+    if (!i->thread_info.deep)
+        return;
+
+    deep_bus_settle(s);
+    i->thread_info.deep = false;
+}
+
+/* Called from IO thread context. While the deep bus is used, deep
+ * inputs are rewound by what the bus holds ahead on top of the rewind of
+ * the sink, so they need to keep more history. */
+static size_t input_max_rewind(pa_sink *s) {
+
+    if (!s->thread_info.deep_bus_memblockq || s->thread_info.max_rewind <= 0)
+        return s->thread_info.max_rewind;
+
+    return 2 * s->thread_info.max_rewind +
+        pa_frame_align(pa_mempool_block_size_max(s->core->mempool), &s->sample_spec);
+}
+
+/* Called from IO thread context. Rebuilds the array of inputs that the
+ * render loop walks, and makes sure the mix info array can hold an entry
+ * for every one of them, so that rendering never has to allocate memory or
+ * skip inputs. The arrays only grow. */
+static void update_render_inputs(pa_sink *s) {
+    pa_sink_input *i;
+    void *state;
+    unsigned n;
+
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    n = pa_hashmap_size(s->thread_info.inputs);
+
+    if (n > s->thread_info.mix_info_size) {
+        while (s->thread_info.mix_info_size < n)
+            s->thread_info.mix_info_size *= 2;
+
+        s->thread_info.mix_info = pa_xrenew(pa_mix_info, s->thread_info.mix_info, s->thread_info.mix_info_size);
+        s->thread_info.render_inputs = pa_xrenew(pa_sink_input*, s->thread_info.render_inputs, s->thread_info.mix_info_size);
+        s->thread_info.deep_bus_info = pa_xrenew(pa_mix_info, s->thread_info.deep_bus_info, s->thread_info.mix_info_size);
+    }
+
+    update_deep_bus(s);
+
+    n = 0;
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+        premix_leave(i);
+        s->thread_info.render_inputs[n++] = i;
+    }
+
+    s->thread_info.n_render_inputs = n;
+
+    update_premixes(s);
+}
+
+/* Called from IO thread context. Drops what was mixed of i and passes it
+ * on to the direct outputs on it. m is the entry of i in the mix info, if
+ * it had one, its chunk may be taken over. */
+static void input_drop(pa_sink *s, pa_sink_input *i, pa_mix_info *m, size_t length) {
+
+    /* Drop read data */
+    pa_sink_input_drop(i, length);
+
+    if (m && m->chunk.memblock && !pa_memblock_is_ours(m->chunk.memblock))
+        i->thread_info.zero_copy_bytes += length;
+
+    if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state)) {
+
+        if (pa_hashmap_size(i->thread_info.direct_outputs) > 0) {
+            void *ostate = NULL;
+            pa_source_output *o;
+            pa_memchunk c;
+
+            if (m && m->chunk.memblock) {
+                pa_assert(length <= m->chunk.length);
+
+                /* The input has dropped the data already, so if we take
+                 * over the reference of the mix info we are often the
+                 * only one left and can apply the volume in place */
+                pa_memchunk_take(&c, &m->chunk, length);
+
+                pa_memchunk_make_writable(&c, 0);
+                pa_volume_memchunk(&c, &s->sample_spec, &m->volume);
+            } else {
+                c = s->silence;
+                pa_memblock_ref(c.memblock);
+                pa_assert(length <= c.length);
+                c.length = length;
+            }
+
+            while ((o = pa_hashmap_iterate(i->thread_info.direct_outputs, &ostate, NULL))) {
+                pa_source_output_assert_ref(o);
+                pa_assert(o->direct_on_input == i);
+                pa_source_post_direct(s->monitor_source, o, &c);
+            }
+
+            pa_memblock_unref(c.memblock);
+        }
+    }
+}
+
+/* Called from IO thread context. Mixes the next chunk of the deep inputs
+ * into the bus. The inputs are dropped right away, the bus keeps the mix
+ * until it is played. */
+static void deep_bus_mix(pa_sink *s, size_t length) {
+    pa_mix_info *info = s->thread_info.deep_bus_info;
+    pa_memchunk chunk;
+    unsigned k, n = 0, p = 0;
+    size_t mixlength = length;
+
+    for (k = 0; k < s->thread_info.n_render_inputs; k++) {
+        pa_sink_input *i = s->thread_info.render_inputs[k];
+
+        if (!i->thread_info.deep)
+            continue;
+
+        pa_sink_input_peek(i, length, &info[n].chunk, &info[n].volume);
+
+        if (info[n].chunk.length < mixlength)
+            mixlength = info[n].chunk.length;
+
+        if (pa_memblock_is_silence(info[n].chunk.memblock)) {
+            pa_memblock_unref(info[n].chunk.memblock);
+            continue;
+        }
+
+        info[n].userdata = i;
+        n++;
+    }
+
+    if (n == 0) {
+        chunk = s->silence;
+        pa_memblock_ref(chunk.memblock);
+
+        if (chunk.length > mixlength)
+            chunk.length = mixlength;
+    } else {
+        void *ptr;
+
+        chunk.memblock = pa_memblock_new(s->core->mempool, mixlength);
+        chunk.index = 0;
+
+        ptr = pa_memblock_acquire(chunk.memblock);
+        chunk.length = pa_mix_with_func(s->thread_info.mix_func, info, n, ptr, mixlength, &s->sample_spec, NULL, false);
+        pa_memblock_release(chunk.memblock);
+    }
+
+    /* info is in the order of render_inputs */
+    for (k = 0; k < s->thread_info.n_render_inputs; k++) {
+        pa_sink_input *i = s->thread_info.render_inputs[k];
+        pa_mix_info *m = NULL;
+
+        if (!i->thread_info.deep)
+            continue;
+
+        if (p < n && info[p].userdata == i)
+            m = info + p++;
+
+        input_drop(s, i, m, chunk.length);
+    }
+
+    for (k = 0; k < n; k++)
+        if (info[k].chunk.memblock)
+            pa_memblock_unref(info[k].chunk.memblock);
+
+    pa_memblockq_push_align(s->thread_info.deep_bus_memblockq, &chunk);
+    pa_memblock_unref(chunk.memblock);
+}
+
+/* Called from IO thread context */
+static bool deep_bus_peek(pa_sink *s, size_t length, pa_memchunk *chunk) {
+
+    if (s->thread_info.n_deep_inputs <= 0)
+        return false;
+
+    while (!pa_memblockq_is_readable(s->thread_info.deep_bus_memblockq))
+        deep_bus_mix(s, length);
+
+    pa_assert_se(pa_memblockq_peek(s->thread_info.deep_bus_memblockq, chunk) >= 0);
+    s->thread_info.deep_bus_peeked = true;
+
+    return true;
+}
+
+struct peek_job {
+    pa_mix_info *info;
+    size_t length;
+};
+
+/* Called from IO thread context, or from a render pool thread on its
+ * behalf. Touches nothing but the input and its entry, apart from
+ * reading the latency cached in fill_mix_info(). */
+static void peek_task(unsigned k, void *userdata) {
+    struct peek_job *job = userdata;
+    pa_mix_info *e = job->info + k;
+
+    pa_sink_input_peek(e->userdata, job->length, &e->chunk, &e->volume);
+}
+
+/* Called from IO thread context */
+static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, unsigned maxinfo) {
+    pa_sink_input **inputs;
+    struct peek_job job;
+    unsigned n = 0, k, m;
     size_t mixlength = *length;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
     pa_assert(info);
+    pa_assert(maxinfo >= s->thread_info.n_render_inputs);
 
-    while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL)) && maxinfo > 0) {
-        pa_sink_input_assert_ref(i);
+    inputs = s->thread_info.render_inputs;
+
+    if (s->thread_info.premixes) {
+        pa_sink_premix *f;
+
+        premix_begin(s);
 
-        pa_sink_input_peek(i, *length, &info->chunk, &info->volume);
+        /* There are at least two inputs in every premix that is used */
+        PA_LLIST_FOREACH(f, s->thread_info.premixes) {
+            if (!premix_peek(s, f, *length, &info->chunk))
+                continue;
+
+            if (mixlength == 0 || info->chunk.length < mixlength)
+                mixlength = info->chunk.length;
+
+            pa_cvolume_reset(&info->volume, s->sample_spec.channels);
+            info->userdata = NULL;
+
+            info++;
+            n++;
+            maxinfo--;
+        }
+    }
+
+    /* The deep bus takes the place of at least one input */
+    if (deep_bus_peek(s, *length, &info->chunk)) {
 
         if (mixlength == 0 || info->chunk.length < mixlength)
             mixlength = info->chunk.length;
 
-        if (pa_memblock_is_silence(info->chunk.memblock)) {
+        if (pa_memblock_is_silence(info->chunk.memblock))
             pa_memblock_unref(info->chunk.memblock);
+        else {
+            pa_cvolume_reset(&info->volume, s->sample_spec.channels);
+            info->userdata = NULL;
+
+            info++;
+            n++;
+            maxinfo--;
+        }
+    }
+
+    /* The remaining inputs are peeked into the entries that follow,
+     * userdata says which input an entry is for until then */
+    for (k = 0, m = 0; k < s->thread_info.n_render_inputs && m < maxinfo; k++) {
+        pa_sink_input *i = inputs[k];
+
+        pa_sink_input_assert_ref(i);
+
+        if (i->thread_info.premixed || i->thread_info.deep)
+            continue;
+
+        info[m++].userdata = i;
+    }
+
+    job.info = info;
+    job.length = *length;
+
+    if (s->thread_info.render_pool && m >= PARALLEL_PEEK_MIN_INPUTS) {
+        /* Pop callbacks may ask for the sink latency, and the
+         * implementations update their smoothers when they answer. Ask
+         * once here so that the render threads only read the result. */
+        s->thread_info.render_latency = pa_sink_get_latency_within_thread(s, true);
+        s->thread_info.render_latency_valid = true;
+
+        pa_render_pool_run(s->thread_info.render_pool, m, peek_task, &job);
+
+        s->thread_info.render_latency_valid = false;
+    } else
+        for (k = 0; k < m; k++)
+            peek_task(k, &job);
+
+    /* Drop the silent ones, in the same order as without the pool */
+    for (k = 0; k < m; k++) {
+        pa_mix_info *e = job.info + k;
+        pa_sink_input *i = e->userdata;
+
+        if (mixlength == 0 || e->chunk.length < mixlength)
+            mixlength = e->chunk.length;
+
+        if (pa_memblock_is_silence(e->chunk.memblock)) {
+            pa_memblock_unref(e->chunk.memblock);
             continue;
         }
 
+        if (e != info)
+            *info = *e;
+
         info->userdata = pa_sink_input_ref(i);
 
         pa_assert(info->chunk.memblock);
@@ -1061,7 +1853,6 @@ static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, uns
 
         info++;
         n++;
-        maxinfo--;
     }
 
     if (mixlength > 0)
@@ -1072,9 +1863,7 @@ static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, uns
 
 /* Called from IO thread context */
 static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *result) {
-    pa_sink_input *i;
-    void *state;
-    unsigned p = 0;
+    unsigned p = 0, k;
     unsigned n_unreffed = 0;
 
     pa_sink_assert_ref(s);
@@ -1085,12 +1874,17 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
 
     /* We optimize for the case where the order of the inputs has not changed */
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+    for (k = 0; k < s->thread_info.n_render_inputs; k++) {
+        pa_sink_input *i = s->thread_info.render_inputs[k];
         unsigned j;
         pa_mix_info* m = NULL;
 
         pa_sink_input_assert_ref(i);
 
+        /* Was consumed through its premix or the deep bus */
+        if (i->thread_info.premixed || i->thread_info.deep)
+            continue;
+
         /* Let's try to find the matching entry info the pa_mix_info array */
         for (j = 0; j < n; j ++) {
 
@@ -1104,40 +1898,7 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
                 p = 0;
         }
 
-        /* Drop read data */
-        pa_sink_input_drop(i, result->length);
-
-        if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state)) {
-
-            if (pa_hashmap_size(i->thread_info.direct_outputs) > 0) {
-                void *ostate = NULL;
-                pa_source_output *o;
-                pa_memchunk c;
-
-                if (m && m->chunk.memblock) {
-                    c = m->chunk;
-                    pa_memblock_ref(c.memblock);
-                    pa_assert(result->length <= c.length);
-                    c.length = result->length;
-
-                    pa_memchunk_make_writable(&c, 0);
-                    pa_volume_memchunk(&c, &s->sample_spec, &m->volume);
-                } else {
-                    c = s->silence;
-                    pa_memblock_ref(c.memblock);
-                    pa_assert(result->length <= c.length);
-                    c.length = result->length;
-                }
-
-                while ((o = pa_hashmap_iterate(i->thread_info.direct_outputs, &ostate, NULL))) {
-                    pa_source_output_assert_ref(o);
-                    pa_assert(o->direct_on_input == i);
-                    pa_source_post_direct(s->monitor_source, o, &c);
-                }
-
-                pa_memblock_unref(c.memblock);
-            }
-        }
+        input_drop(s, i, m, result->length);
 
         if (m) {
             if (m->chunk.memblock) {
@@ -1152,8 +1913,24 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
         }
     }
 
+    if (s->thread_info.premixes) {
+        pa_sink_premix *f;
+
+        PA_LLIST_FOREACH(f, s->thread_info.premixes)
+            if (f->peeked) {
+                pa_memblockq_drop(f->memblockq, result->length);
+                f->peeked = false;
+            }
+    }
+
+    if (s->thread_info.deep_bus_peeked) {
+        pa_memblockq_drop(s->thread_info.deep_bus_memblockq, result->length);
+        s->thread_info.deep_bus_history = PA_MIN(s->thread_info.deep_bus_history + result->length, s->thread_info.max_rewind);
+        s->thread_info.deep_bus_peeked = false;
+    }
+
     /* Now drop references to entries that are included in the
-     * pa_mix_info array but don't exist anymore */
+     * pa_mix_info array, but don't belong to an input (anymore) */
 
     if (n_unreffed < n) {
         for (; n > 0; info++, n--) {
@@ -1164,15 +1941,43 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
         }
     }
 
+    if (s->thread_info.meters) {
+        pa_meter *meter;
+
+        PA_LLIST_FOREACH(meter, s->thread_info.meters)
+            pa_meter_process(meter, result, &s->sample_spec, NULL);
+    }
+
     if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state))
         pa_source_post(s->monitor_source, result);
 }
 
 /* Called from IO thread context */
-void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
+static void check_cpu_budget(pa_sink *s) {
+    pa_sink_input *i;
+    void *state = NULL;
+
+    if (!pa_cpu_budget_test(&s->thread_info.cpu_budget))
+        return;
+
+    pa_log_warn("IO thread of sink %s is over its CPU budget, lowering quality.", s->name);
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        if (i->thread_info.resampler)
+            pa_resampler_lower_quality(i->thread_info.resampler);
+
+    if (s->cpu_overload)
+        s->cpu_overload(s);
+}
+
+/* Called from IO thread context. With mix false the inputs are peeked
+ * and dropped as usual, but their data is not mixed and result is
+ * silence of the rendered length. */
+static void sink_render(pa_sink *s, size_t length, pa_memchunk *result, bool mix) {
+    pa_mix_info *info;
     unsigned n;
     size_t block_size_max;
+    pa_usec_t start;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1190,7 +1995,11 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
         return;
     }
 
+    check_cpu_budget(s);
+
     pa_sink_ref(s);
+    start = pa_render_profile_start();
+    PA_TRACE2(sink_render_start, s->index, length);
 
     if (length <= 0)
         length = pa_frame_align(MIX_BUFFER_LENGTH, &s->sample_spec);
@@ -1201,9 +2010,10 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    info = s->thread_info.mix_info;
+    n = fill_mix_info(s, &length, info, s->thread_info.mix_info_size);
 
-    if (n == 0) {
+    if (n == 0 || !mix) {
 
         *result = s->silence;
         pa_memblock_ref(result->memblock);
@@ -1212,7 +2022,9 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
             result->length = length;
 
     } else if (n == 1) {
-        pa_cvolume volume;
+        pa_cvolume volume, from;
+        size_t ramp;
+        bool ramping;
 
         *result = info[0].chunk;
         pa_memblock_ref(result->memblock);
@@ -1222,42 +2034,126 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
         pa_sw_cvolume_multiply(&volume, &s->thread_info.soft_volume, &info[0].volume);
 
-        if (s->thread_info.soft_muted || pa_cvolume_is_muted(&volume)) {
+        if ((ramping = soft_volume_ramp_get(s, &from, &ramp)))
+            pa_sw_cvolume_multiply(&from, &from, &info[0].volume);
+
+        if (s->thread_info.soft_muted || (pa_cvolume_is_muted(&volume) && (!ramping || pa_cvolume_is_muted(&from)))) {
             pa_memblock_unref(result->memblock);
             pa_silence_memchunk_get(&s->core->silence_cache,
                                     s->core->mempool,
                                     result,
                                     &s->sample_spec,
                                     result->length);
+        } else if (ramping) {
+            pa_memchunk_make_writable(result, 0);
+            pa_volume_memchunk_ramp(result, &s->sample_spec, &from, &volume, ramp);
         } else if (!pa_cvolume_is_norm(&volume)) {
             pa_memchunk_make_writable(result, 0);
             pa_volume_memchunk(result, &s->sample_spec, &volume);
         }
     } else {
         void *ptr;
+        pa_cvolume from;
+        size_t ramp;
+        bool ramping;
+
+        ramping = soft_volume_ramp_get(s, &from, &ramp);
+
         result->memblock = pa_memblock_new(s->core->mempool, length);
 
         ptr = pa_memblock_acquire(result->memblock);
-        result->length = pa_mix(info, n,
-                                ptr, length,
-                                &s->sample_spec,
-                                &s->thread_info.soft_volume,
-                                s->thread_info.soft_muted);
+        result->length = pa_mix_with_func(s->thread_info.mix_func,
+                                          info, n,
+                                          ptr, length,
+                                          &s->sample_spec,
+                                          ramping ? NULL : &s->thread_info.soft_volume,
+                                          s->thread_info.soft_muted);
         pa_memblock_release(result->memblock);
 
         result->index = 0;
+
+        if (ramping && !s->thread_info.soft_muted)
+            pa_volume_memchunk_ramp(result, &s->sample_spec, &from, &s->thread_info.soft_volume, ramp);
     }
 
+    soft_volume_ramp_advance(s, result->length);
     inputs_drop(s, info, n, result);
 
+    PA_TRACE2(sink_render_end, s->index, result->length);
+    pa_render_profile_stop(&s->thread_info.render_profile[PA_RENDER_STAGE_SINK_RENDER], start);
     pa_sink_unref(s);
 }
 
+/* Called from IO thread context */
+void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
+    sink_render(s, length, result, true);
+}
+
+/* Called from IO thread context. For sinks that throw their data away,
+ * like the null sink: the inputs are consumed at the same pace as with
+ * pa_sink_render(), but they are only mixed if the monitor source has
+ * outputs to post the mix to, or there are meters to feed. Returns the
+ * number of bytes consumed. */
+size_t pa_sink_render_discard(pa_sink *s, size_t length) {
+    pa_memchunk chunk;
+    pa_source *m;
+    bool mix;
+
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    m = s->monitor_source;
+    mix = s->thread_info.meters ||
+        (m && PA_SOURCE_IS_LINKED(m->thread_info.state) && (m->thread_info.n_post_outputs > 0 || m->thread_info.meters));
+
+    sink_render(s, length, &chunk, mix);
+
+    pa_memblock_unref(chunk.memblock);
+
+    return chunk.length;
+}
+
+/* Called from IO thread context. A passthrough input is always alone
+ * on its sink and its data has to reach the device bit exact, so it
+ * is copied straight into target: no mix info, no volume or ramp and
+ * no monitor, which is suspended in passthrough mode anyway. The
+ * history for rewinds stays with the input as usual. */
+static void render_passthrough(pa_sink *s, pa_sink_input *i, size_t length, pa_memchunk *target) {
+    pa_memchunk chunk;
+    pa_cvolume volume;
+
+    pa_sink_input_peek(i, length, &chunk, &volume);
+
+    if (chunk.length < length)
+        length = chunk.length;
+    if (target->length > length) {
+        target->length = length;
+        s->thread_info.passthrough_stats.n_short++;
+    }
+
+    if (pa_memblock_is_silence(chunk.memblock)) {
+        pa_silence_memchunk(target, &s->sample_spec);
+        s->thread_info.passthrough_stats.n_silence++;
+    } else {
+        pa_memchunk_memcpy(target, &chunk);
+
+        if (!pa_memblock_is_ours(chunk.memblock))
+            i->thread_info.zero_copy_bytes += target->length;
+    }
+
+    pa_memblock_unref(chunk.memblock);
+    pa_sink_input_drop(i, target->length);
+
+    s->thread_info.passthrough_stats.n_renders++;
+    s->thread_info.passthrough_stats.n_bytes += target->length;
+}
+
 /* Called from IO thread context */
 void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
+    pa_mix_info *info;
     unsigned n;
     size_t length, block_size_max;
+    pa_usec_t start;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1275,7 +2171,11 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
         return;
     }
 
+    check_cpu_budget(s);
+
     pa_sink_ref(s);
+    start = pa_render_profile_start();
+    PA_TRACE2(sink_render_start, s->index, target->length);
 
     length = target->length;
     block_size_max = pa_mempool_block_size_max(s->core->mempool);
@@ -1284,7 +2184,17 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    if (s->thread_info.n_render_inputs == 1 && s->thread_info.render_inputs[0]->thread_info.passthrough) {
+        render_passthrough(s, s->thread_info.render_inputs[0], length, target);
+
+        PA_TRACE2(sink_render_end, s->index, target->length);
+        pa_render_profile_stop(&s->thread_info.render_profile[PA_RENDER_STAGE_SINK_RENDER], start);
+        pa_sink_unref(s);
+        return;
+    }
+
+    info = s->thread_info.mix_info;
+    n = fill_mix_info(s, &length, info, s->thread_info.mix_info_size);
 
     if (n == 0) {
         if (target->length > length)
@@ -1292,14 +2202,19 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
         pa_silence_memchunk(target, &s->sample_spec);
     } else if (n == 1) {
-        pa_cvolume volume;
+        pa_cvolume volume, from;
+        size_t ramp;
+        bool ramping;
 
         if (target->length > length)
             target->length = length;
 
         pa_sw_cvolume_multiply(&volume, &s->thread_info.soft_volume, &info[0].volume);
 
-        if (s->thread_info.soft_muted || pa_cvolume_is_muted(&volume))
+        if ((ramping = soft_volume_ramp_get(s, &from, &ramp)))
+            pa_sw_cvolume_multiply(&from, &from, &info[0].volume);
+
+        if (s->thread_info.soft_muted || (pa_cvolume_is_muted(&volume) && (!ramping || pa_cvolume_is_muted(&from))))
             pa_silence_memchunk(target, &s->sample_spec);
         else {
             pa_memchunk vchunk;
@@ -1310,7 +2225,10 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
             if (vchunk.length > length)
                 vchunk.length = length;
 
-            if (!pa_cvolume_is_norm(&volume)) {
+            if (ramping) {
+                pa_memchunk_make_writable(&vchunk, 0);
+                pa_volume_memchunk_ramp(&vchunk, &s->sample_spec, &from, &volume, ramp);
+            } else if (!pa_cvolume_is_norm(&volume)) {
                 pa_memchunk_make_writable(&vchunk, 0);
                 pa_volume_memchunk(&vchunk, &s->sample_spec, &volume);
             }
@@ -1321,20 +2239,32 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     } else {
         void *ptr;
+        pa_cvolume from;
+        size_t ramp;
+        bool ramping;
+
+        ramping = soft_volume_ramp_get(s, &from, &ramp);
 
         ptr = pa_memblock_acquire(target->memblock);
 
-        target->length = pa_mix(info, n,
-                                (uint8_t*) ptr + target->index, length,
-                                &s->sample_spec,
-                                &s->thread_info.soft_volume,
-                                s->thread_info.soft_muted);
+        target->length = pa_mix_with_func(s->thread_info.mix_func,
+                                          info, n,
+                                          (uint8_t*) ptr + target->index, length,
+                                          &s->sample_spec,
+                                          ramping ? NULL : &s->thread_info.soft_volume,
+                                          s->thread_info.soft_muted);
 
         pa_memblock_release(target->memblock);
+
+        if (ramping && !s->thread_info.soft_muted)
+            pa_volume_memchunk_ramp(target, &s->sample_spec, &from, &s->thread_info.soft_volume, ramp);
     }
 
+    soft_volume_ramp_advance(s, target->length);
     inputs_drop(s, info, n, target);
 
+    PA_TRACE2(sink_render_end, s->index, target->length);
+    pa_render_profile_stop(&s->thread_info.render_profile[PA_RENDER_STAGE_SINK_RENDER], start);
     pa_sink_unref(s);
 }
 
@@ -1410,6 +2340,75 @@ void pa_sink_render_full(pa_sink *s, size_t length, pa_memchunk *result) {
     pa_sink_unref(s);
 }
 
+/* What it takes to resample from one rate to the other, in samples per
+ * second going in and out. Rates of different families, like 44.1 and
+ * 48 kHz, need much longer filters, so they count twice. */
+static uint64_t resample_cost(uint32_t from, uint32_t to) {
+    uint64_t cost;
+
+    if (from == to)
+        return 0;
+
+    cost = (uint64_t) from + to;
+
+    if (pa_gcd(from, to) < 1000)
+        cost *= 2;
+
+    return cost;
+}
+
+static bool rate_is_supported(pa_sink *s, uint32_t rate) {
+    unsigned *r;
+
+    for (r = s->supported_rates; *r; r++)
+        if (*r == rate)
+            return true;
+
+    return false;
+}
+
+/* Called from main thread. Picks the rate that is cheapest for a new
+ * stream at rate and the corked streams waiting for the sink together.
+ * The candidates are the default and alternate rates, and the rates of
+ * these streams that the sink supports and that aren't lower than the
+ * default or alternate rate. Ties go to the current rate, then to the
+ * default rate. */
+static uint32_t pick_rate(pa_sink *s, uint32_t rate) {
+    uint32_t candidates[2 + 1 + PA_MAX_INPUTS_PER_SINK], min_rate, best = 0;
+    uint64_t best_cost = 0;
+    unsigned n = 0, j;
+    pa_sink_input *i;
+    uint32_t idx;
+
+    candidates[n++] = s->sample_spec.rate;
+    candidates[n++] = s->default_sample_rate;
+    if (s->alternate_sample_rate)
+        candidates[n++] = s->alternate_sample_rate;
+
+    min_rate = s->alternate_sample_rate ? PA_MIN(s->default_sample_rate, s->alternate_sample_rate) : s->default_sample_rate;
+
+    if (rate >= min_rate && rate_is_supported(s, rate))
+        candidates[n++] = rate;
+
+    PA_IDXSET_FOREACH(i, s->inputs, idx)
+        if (i->sample_spec.rate >= min_rate && rate_is_supported(s, i->sample_spec.rate) && n < PA_ELEMENTSOF(candidates))
+            candidates[n++] = i->sample_spec.rate;
+
+    for (j = 0; j < n; j++) {
+        uint64_t cost = resample_cost(rate, candidates[j]);
+
+        PA_IDXSET_FOREACH(i, s->inputs, idx)
+            cost += resample_cost(i->sample_spec.rate, candidates[j]);
+
+        if (best == 0 || cost < best_cost) {
+            best = candidates[j];
+            best_cost = cost;
+        }
+    }
+
+    return best;
+}
+
 /* Called from main thread */
 int pa_sink_reconfigure(pa_sink *s, pa_sample_spec *spec, bool passthrough) {
     int ret = -1;
@@ -1430,7 +2429,7 @@ int pa_sink_reconfigure(pa_sink *s, pa_sample_spec *spec, bool passthrough) {
     if (!s->reconfigure)
         return -1;
 
-    if (PA_UNLIKELY(default_rate == alternate_rate && !passthrough && !avoid_resampling)) {
+    if (PA_UNLIKELY(default_rate == alternate_rate && !passthrough && !avoid_resampling && !s->supported_rates)) {
         pa_log_debug("Default and alternate sample rates are the same, so there is no point in switching.");
         return -1;
     }
@@ -1461,6 +2460,10 @@ int pa_sink_reconfigure(pa_sink *s, pa_sample_spec *spec, bool passthrough) {
         /* We just try to set the sink input's sample rate if it's not too low */
         desired_spec.rate = spec->rate;
 
+    } else if (s->supported_rates) {
+        /* The sink told us what it can do, weigh up all of it */
+        desired_spec.rate = pick_rate(s, spec->rate);
+
     } else if (default_rate == spec->rate || alternate_rate == spec->rate) {
         /* We can directly try to use this rate */
         desired_spec.rate = spec->rate;
@@ -1510,6 +2513,31 @@ int pa_sink_reconfigure(pa_sink *s, pa_sample_spec *spec, bool passthrough) {
     return ret;
 }
 
+/* Called from main thread. Calculates the latency from what the IO
+ * thread published last, see pa_sink_set_latency_smoother(). */
+static bool get_latency_concurrent(pa_sink *s, int64_t *usec) {
+    pa_usec_t played;
+    int64_t base;
+    bool valid;
+    int seq;
+
+    seq = pa_atomic_load(&s->latency_base.seq);
+    if (seq & 1)
+        return false;
+
+    valid = s->latency_base.valid;
+    base = s->latency_base.usec;
+
+    if (pa_atomic_load(&s->latency_base.seq) != seq || !valid)
+        return false;
+
+    if (!pa_smoother_get_concurrent(s->latency_smoother, pa_rtclock_now(), &played))
+        return false;
+
+    *usec = base - (int64_t) played;
+    return true;
+}
+
 /* Called from main thread */
 pa_usec_t pa_sink_get_latency(pa_sink *s) {
     int64_t usec = 0;
@@ -1526,7 +2554,8 @@ pa_usec_t pa_sink_get_latency(pa_sink *s) {
     if (!(s->flags & PA_SINK_LATENCY))
         return 0;
 
-    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) == 0);
+    if (!s->latency_smoother || !get_latency_concurrent(s, &usec))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) == 0);
 
     /* the return value is unsigned, so check that the offset can be added to usec without
      * underflowing. */
@@ -1555,14 +2584,19 @@ int64_t pa_sink_get_latency_within_thread(pa_sink *s, bool allow_negative) {
     if (!(s->flags & PA_SINK_LATENCY))
         return 0;
 
-    o = PA_MSGOBJECT(s);
+    if (s->thread_info.render_latency_valid)
+        usec = s->thread_info.render_latency;
+    else {
+        o = PA_MSGOBJECT(s);
+
+        /* FIXME: We probably should make this a proper vtable callback instead of going through process_msg() */
 
-    /* FIXME: We probably should make this a proper vtable callback instead of going through process_msg() */
+        o->process_msg(o, PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL);
 
-    o->process_msg(o, PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL);
+        usec += s->thread_info.port_latency_offset;
+    }
 
     /* If allow_negative is false, the call should only return positive values, */
-    usec += s->thread_info.port_latency_offset;
     if (!allow_negative && usec < 0)
         usec = 0;
 
@@ -1727,6 +2761,51 @@ static void compute_reference_ratios(pa_sink *s) {
     }
 }
 
+/* Called from main context. For inputs whose origin sink doesn't share
+ * the volume with s. */
+static void compute_real_ratio(pa_sink *s, pa_sink_input *i) {
+    unsigned c;
+    pa_cvolume remapped;
+
+    /*
+     * This basically calculates:
+     *
+     * i->real_ratio := i->volume / s->real_volume
+     * i->soft_volume := i->real_ratio * i->volume_factor
+     */
+
+    remapped = s->real_volume;
+    pa_cvolume_remap(&remapped, &s->channel_map, &i->channel_map);
+
+    i->real_ratio.channels = i->sample_spec.channels;
+    i->soft_volume.channels = i->sample_spec.channels;
+
+    for (c = 0; c < i->sample_spec.channels; c++) {
+
+        if (remapped.values[c] <= PA_VOLUME_MUTED) {
+            /* We leave i->real_ratio untouched */
+            i->soft_volume.values[c] = PA_VOLUME_MUTED;
+            continue;
+        }
+
+        /* Don't lose accuracy unless necessary */
+        if (pa_sw_volume_multiply(
+                    i->real_ratio.values[c],
+                    remapped.values[c]) != i->volume.values[c])
+
+            i->real_ratio.values[c] = pa_sw_volume_divide(
+                    i->volume.values[c],
+                    remapped.values[c]);
+
+        i->soft_volume.values[c] = pa_sw_volume_multiply(
+                i->real_ratio.values[c],
+                i->volume_factor.values[c]);
+    }
+
+    /* We don't copy the soft_volume to the thread_info data
+     * here. That must be done by the caller */
+}
+
 /* Called from main context. Only called for the root sink in volume sharing
  * cases, except for internal recursive calls. */
 static void compute_real_ratios(pa_sink *s) {
@@ -1739,8 +2818,6 @@ static void compute_real_ratios(pa_sink *s) {
     pa_assert(pa_sink_flat_volume_enabled(s));
 
     PA_IDXSET_FOREACH(i, s->inputs, idx) {
-        unsigned c;
-        pa_cvolume remapped;
 
         if (i->origin_sink && (i->origin_sink->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER)) {
             /* The origin sink uses volume sharing, so this input's real ratio
@@ -1755,43 +2832,7 @@ static void compute_real_ratios(pa_sink *s) {
             continue;
         }
 
-        /*
-         * This basically calculates:
-         *
-         * i->real_ratio := i->volume / s->real_volume
-         * i->soft_volume := i->real_ratio * i->volume_factor
-         */
-
-        remapped = s->real_volume;
-        pa_cvolume_remap(&remapped, &s->channel_map, &i->channel_map);
-
-        i->real_ratio.channels = i->sample_spec.channels;
-        i->soft_volume.channels = i->sample_spec.channels;
-
-        for (c = 0; c < i->sample_spec.channels; c++) {
-
-            if (remapped.values[c] <= PA_VOLUME_MUTED) {
-                /* We leave i->real_ratio untouched */
-                i->soft_volume.values[c] = PA_VOLUME_MUTED;
-                continue;
-            }
-
-            /* Don't lose accuracy unless necessary */
-            if (pa_sw_volume_multiply(
-                        i->real_ratio.values[c],
-                        remapped.values[c]) != i->volume.values[c])
-
-                i->real_ratio.values[c] = pa_sw_volume_divide(
-                        i->volume.values[c],
-                        remapped.values[c]);
-
-            i->soft_volume.values[c] = pa_sw_volume_multiply(
-                    i->real_ratio.values[c],
-                    i->volume_factor.values[c]);
-        }
-
-        /* We don't copy the soft_volume to the thread_info data
-         * here. That must be done by the caller */
+        compute_real_ratio(s, i);
     }
 }
 
@@ -2124,6 +3165,53 @@ void pa_sink_set_volume(
         pa_assert_se(pa_asyncmsgq_send(root_sink->asyncmsgq, PA_MSGOBJECT(root_sink), PA_SINK_MESSAGE_SET_SHARED_VOLUME, NULL, 0, NULL) == 0);
 }
 
+/* Called from main thread, after the volume of i, which is connected to a
+ * flat volume sink, changed. pa_sink_set_volume(s, NULL, ...) would
+ * recompute the volumes of the whole sink tree and sync all of them to the
+ * IO thread. Most of the time the loudest stream stays as loud as it was
+ * though, and then the sink volume, and the ratios and soft volumes of all
+ * other inputs, don't change. In that case only i is updated here, and the
+ * caller only needs to pass i's soft volume to the IO thread. Returns false
+ * if the full recomputation is needed. */
+bool pa_sink_update_flat_volume_for_input(pa_sink *s, pa_sink_input *i, bool save) {
+    pa_cvolume max_volume, reference_volume;
+
+    pa_sink_assert_ref(s);
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_IS_LINKED(s->state));
+    pa_assert(i->sink == s);
+    pa_assert(pa_sink_flat_volume_enabled(s));
+
+    /* Keep the volume sharing cases on the general path */
+    if (s->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER)
+        return false;
+
+    if (i->origin_sink && (i->origin_sink->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER))
+        return false;
+
+    if (!has_inputs(s))
+        return false;
+
+    pa_cvolume_mute(&max_volume, s->channel_map.channels);
+    get_maximum_input_volume(s, &max_volume, &s->channel_map);
+
+    if (!pa_cvolume_equal(&max_volume, &s->real_volume))
+        return false;
+
+    /* The reference volume would be pushed up to the real volume */
+    pa_cvolume_merge(&reference_volume, &s->reference_volume, &s->real_volume);
+    if (!pa_cvolume_equal(&reference_volume, &s->reference_volume))
+        return false;
+
+    s->save_volume = s->save_volume || save;
+
+    compute_real_ratio(s, i);
+    compute_reference_ratio(i);
+
+    return true;
+}
+
 /* Called from the io thread if sync volume is used, otherwise from the main thread.
  * Only to be called by sink implementor */
 void pa_sink_set_soft_volume(pa_sink *s, const pa_cvolume *volume) {
@@ -2143,6 +3231,8 @@ void pa_sink_set_soft_volume(pa_sink *s, const pa_cvolume *volume) {
 
     if (PA_SINK_IS_LINKED(s->state) && !(s->flags & PA_SINK_DEFERRED_VOLUME))
         pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_SET_VOLUME, NULL, 0, NULL) == 0);
+    else if (PA_SINK_IS_LINKED(s->state))
+        soft_volume_ramp_start(s, &s->soft_volume);
     else
         s->thread_info.soft_volume = s->soft_volume;
 }
@@ -2508,6 +3598,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
              * PA_SINK_MESSAGE_FINISH_MOVE, too. */
 
             pa_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
+            update_render_inputs(s);
 
             /* Since the caller sleeps in pa_sink_input_put(), we can
              * safely access data outside of thread_info even though
@@ -2543,7 +3634,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             if (i->thread_info.requested_sink_latency != (pa_usec_t) -1)
                 pa_sink_input_set_requested_latency_within_thread(i, i->thread_info.requested_sink_latency);
 
-            pa_sink_input_update_max_rewind(i, s->thread_info.max_rewind);
+            pa_sink_input_update_max_rewind(i, input_max_rewind(s));
             pa_sink_input_update_max_request(i, s->thread_info.max_request);
 
             /* We don't rewind here automatically. This is left to the
@@ -2562,11 +3653,14 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
 
         case PA_SINK_MESSAGE_REMOVE_INPUT: {
             pa_sink_input *i = PA_SINK_INPUT(userdata);
+            bool deep = i->thread_info.deep;
 
             /* If you change anything here, make sure to change the
              * sink input handling a few lines down at
              * PA_SINK_MESSAGE_START_MOVE, too. */
 
+            deep_bus_leave(s, i);
+
             pa_sink_input_detach(i);
 
             pa_sink_input_set_state_within_thread(i, i->state);
@@ -2589,8 +3683,9 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             }
 
             pa_hashmap_remove_and_free(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index));
+            update_render_inputs(s);
             pa_sink_invalidate_requested_latency(s, true);
-            pa_sink_request_rewind(s, (size_t) -1);
+            request_rewind(s, (size_t) -1, deep);
 
             /* In flat volume mode we need to update the volume as
              * well */
@@ -2599,6 +3694,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
 
         case PA_SINK_MESSAGE_START_MOVE: {
             pa_sink_input *i = PA_SINK_INPUT(userdata);
+            bool deep = i->thread_info.deep;
 
             /* We don't support moving synchronized streams. */
             pa_assert(!i->sync_prev);
@@ -2606,6 +3702,10 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             pa_assert(!i->thread_info.sync_next);
             pa_assert(!i->thread_info.sync_prev);
 
+            /* Takes back what the deep bus holds of the stream before
+             * the rewind below */
+            deep_bus_leave(s, i);
+
             if (i->thread_info.state != PA_SINK_INPUT_CORKED) {
                 pa_usec_t usec = 0;
                 size_t sink_nbytes, total_nbytes;
@@ -2666,11 +3766,12 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
 
             /* Let's remove the sink input ...*/
             pa_hashmap_remove_and_free(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index));
+            update_render_inputs(s);
 
             pa_sink_invalidate_requested_latency(s, true);
 
             pa_log_debug("Requesting rewind due to started move");
-            pa_sink_request_rewind(s, (size_t) -1);
+            request_rewind(s, (size_t) -1, deep);
 
             /* In flat volume mode we need to update the volume as
              * well */
@@ -2687,6 +3788,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             pa_assert(!i->thread_info.sync_prev);
 
             pa_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
+            update_render_inputs(s);
 
             pa_sink_input_attach(i);
 
@@ -2716,11 +3818,21 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
                 usec = pa_sink_get_latency_within_thread(s, false);
                 nbytes = pa_usec_to_bytes(usec, &s->sample_spec);
 
+                /* For a seamless move we go with option 1 as far as
+                 * the sink can't rewind: drop only what the rewind
+                 * will hopefully give back, and fade the stream in
+                 * so that joining the data already queued in the sink
+                 * doesn't click. */
+                if (offset) {
+                    nbytes = PA_MIN(nbytes, s->thread_info.max_rewind);
+                    pa_sink_input_fade_in_within_thread(i, SEAMLESS_MOVE_FADE_USEC);
+                }
+
                 if (nbytes > 0)
                     pa_sink_input_drop(i, nbytes);
 
                 pa_log_debug("Requesting rewind due to finished move");
-                pa_sink_request_rewind(s, nbytes);
+                request_rewind(s, nbytes, i->thread_info.deep);
             }
 
             /* Updating the requested sink latency has to be done
@@ -2731,7 +3843,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             if (i->thread_info.requested_sink_latency != (pa_usec_t) -1)
                 pa_sink_input_set_requested_latency_within_thread(i, i->thread_info.requested_sink_latency);
 
-            pa_sink_input_update_max_rewind(i, s->thread_info.max_rewind);
+            pa_sink_input_update_max_rewind(i, input_max_rewind(s));
             pa_sink_input_update_max_request(i, s->thread_info.max_request);
 
             return o->process_msg(o, PA_SINK_MESSAGE_SET_SHARED_VOLUME, NULL, 0, NULL);
@@ -2757,8 +3869,14 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
         case PA_SINK_MESSAGE_SET_VOLUME:
 
             if (!pa_cvolume_equal(&s->thread_info.soft_volume, &s->soft_volume)) {
-                s->thread_info.soft_volume = s->soft_volume;
-                pa_sink_request_rewind(s, (size_t) -1);
+                pa_usec_t latency;
+
+                soft_volume_ramp_start(s, &s->soft_volume);
+
+                /* With short buffers the ramp is heard soon enough anyway */
+                latency = pa_sink_get_requested_latency_within_thread(s);
+                if (latency == (pa_usec_t) -1 || latency > SOFT_VOLUME_REWIND_LATENCY)
+                    pa_sink_request_rewind_fast_lane(s, (size_t) -1);
             }
 
             /* Fall through ... */
@@ -2778,7 +3896,8 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             /* In case sink implementor reset SW volume. */
             if (!pa_cvolume_equal(&s->thread_info.soft_volume, &s->soft_volume)) {
                 s->thread_info.soft_volume = s->soft_volume;
-                pa_sink_request_rewind(s, (size_t) -1);
+                soft_volume_ramp_stop(s);
+                pa_sink_request_rewind_fast_lane(s, (size_t) -1);
             }
 
             return 0;
@@ -2787,7 +3906,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
 
             if (s->thread_info.soft_muted != s->muted) {
                 s->thread_info.soft_muted = s->muted;
-                pa_sink_request_rewind(s, (size_t) -1);
+                pa_sink_request_rewind_fast_lane(s, (size_t) -1);
             }
 
             if (s->flags & PA_SINK_DEFERRED_VOLUME && s->set_mute)
@@ -2819,6 +3938,10 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
                 pa_sink_input *i;
                 void *state = NULL;
 
+                /* pa_sink_reconfigure() might have changed the spec */
+                if (s->thread_info.state != PA_SINK_SUSPENDED)
+                    s->thread_info.mix_func = pa_get_mix_func_for_channels(s->sample_spec.format, s->sample_spec.channels);
+
                 while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL)))
                     if (i->suspend_within_thread)
                         i->suspend_within_thread(i, s->thread_info.state == PA_SINK_SUSPENDED);
@@ -2878,6 +4001,38 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             *((size_t*) userdata) = s->thread_info.max_request;
             return 0;
 
+        case PA_SINK_MESSAGE_GET_REWIND_STATS:
+
+            *((pa_sink_rewind_stats*) userdata) = s->thread_info.rewind_stats;
+            return 0;
+
+        case PA_SINK_MESSAGE_GET_PASSTHROUGH_STATS:
+
+            *((pa_sink_passthrough_stats*) userdata) = s->thread_info.passthrough_stats;
+            return 0;
+
+        case PA_SINK_MESSAGE_GET_RENDER_PROFILE: {
+            pa_sink_input *i;
+            void *state = NULL;
+
+            /* The main thread is waiting for us, so we can write to
+             * the copies it owns */
+            memcpy(s->render_profile, s->thread_info.render_profile, sizeof(s->render_profile));
+
+            PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+                memcpy(i->render_profile, i->thread_info.render_profile, sizeof(i->render_profile));
+
+            return 0;
+        }
+
+        case PA_SINK_MESSAGE_ADD_METER:
+            PA_LLIST_PREPEND(pa_meter, s->thread_info.meters, (pa_meter*) userdata);
+            return 0;
+
+        case PA_SINK_MESSAGE_REMOVE_METER:
+            PA_LLIST_REMOVE(pa_meter, s->thread_info.meters, (pa_meter*) userdata);
+            return 0;
+
         case PA_SINK_MESSAGE_SET_MAX_REWIND:
 
             pa_sink_set_max_rewind_within_thread(s, (size_t) offset);
@@ -2973,8 +4128,29 @@ void pa_sink_attach_within_thread(pa_sink *s) {
         pa_source_attach_within_thread(s->monitor_source);
 }
 
-/* Called from IO thread */
-void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
+/* Called from IO thread. Returns how many bytes the sink holds that
+ * have not been played yet, or (size_t) -1 if the sink can't tell. A
+ * latency of zero is taken as unknown too, some sinks report that while
+ * they are starting up. */
+static size_t queued_bytes_within_thread(pa_sink *s) {
+    int64_t usec = 0;
+
+    if (s->thread_info.state == PA_SINK_SUSPENDED || !(s->flags & PA_SINK_LATENCY))
+        return (size_t) -1;
+
+    /* Unlike pa_sink_get_latency_within_thread() this leaves out the port
+     * latency offset, which doesn't correspond to any buffered data */
+    PA_MSGOBJECT(s)->process_msg(PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL);
+
+    if (usec <= 0)
+        return (size_t) -1;
+
+    return pa_usec_to_bytes_round_up((pa_usec_t) usec, &s->sample_spec);
+}
+
+/* Called from IO thread. deep is false if the deep bus doesn't need to
+ * be mixed again, see pa_sink_process_rewind(). */
+static void request_rewind(pa_sink *s, size_t nbytes, bool deep) {
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
     pa_assert(PA_SINK_IS_LINKED(s->thread_info.state));
@@ -2984,10 +4160,22 @@ void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
 
     nbytes = PA_MIN(nbytes, s->thread_info.max_rewind);
 
+    /* Nothing that has already been played can be rewritten, so don't
+     * go back further than what is queued ahead of the playback
+     * position. Otherwise every stream would have to replay all of its
+     * history, even if the sink only holds a fraction of max_rewind at
+     * the moment. */
+    if (nbytes > 0)
+        nbytes = PA_MIN(nbytes, queued_bytes_within_thread(s));
+
+    s->thread_info.rewind_deep = s->thread_info.rewind_deep || deep;
+
     if (s->thread_info.rewind_requested &&
         nbytes <= s->thread_info.rewind_nbytes)
         return;
 
+    s->thread_info.rewind_stats.n_requested++;
+
     s->thread_info.rewind_nbytes = nbytes;
     s->thread_info.rewind_requested = true;
 
@@ -2995,6 +4183,17 @@ void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
         s->request_rewind(s);
 }
 
+/* Called from IO thread */
+void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
+    request_rewind(s, nbytes, true);
+}
+
+/* Called from IO thread. Like pa_sink_request_rewind(), for changes that
+ * don't affect the inputs mixed into the deep bus. */
+void pa_sink_request_rewind_fast_lane(pa_sink *s, size_t nbytes) {
+    request_rewind(s, nbytes, false);
+}
+
 /* Called from IO thread */
 pa_usec_t pa_sink_get_requested_latency_within_thread(pa_sink *s) {
     pa_usec_t result = (pa_usec_t) -1;
@@ -3063,14 +4262,57 @@ void pa_sink_set_max_rewind_within_thread(pa_sink *s, size_t max_rewind) {
 
     s->thread_info.max_rewind = max_rewind;
 
+    if (s->thread_info.deep_bus_memblockq) {
+        pa_memblockq_set_maxrewind(s->thread_info.deep_bus_memblockq, max_rewind);
+        s->thread_info.deep_bus_history = PA_MIN(s->thread_info.deep_bus_history, max_rewind);
+    }
+
     if (PA_SINK_IS_LINKED(s->thread_info.state))
         PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
-            pa_sink_input_update_max_rewind(i, s->thread_info.max_rewind);
+            pa_sink_input_update_max_rewind(i, input_max_rewind(s));
 
     if (s->monitor_source)
         pa_source_set_max_rewind_within_thread(s->monitor_source, s->thread_info.max_rewind);
 }
 
+/* Called from main thread, before pa_sink_put(). Streams that request at
+ * least this latency are mixed ahead into the deep bus while others need
+ * less, see update_deep_bus(). 0 disables the deep bus. */
+void pa_sink_set_deep_bus_latency(pa_sink *s, pa_usec_t latency) {
+    char *memblockq_name;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(s->state == PA_SINK_INIT);
+
+    s->thread_info.deep_bus_latency = latency;
+
+    if (latency <= 0) {
+        if (s->thread_info.deep_bus_memblockq) {
+            pa_memblockq_free(s->thread_info.deep_bus_memblockq);
+            s->thread_info.deep_bus_memblockq = NULL;
+        }
+
+        return;
+    }
+
+    if (s->thread_info.deep_bus_memblockq)
+        return;
+
+    memblockq_name = pa_sprintf_malloc("sink deep_bus_memblockq [%u]", s->index);
+    s->thread_info.deep_bus_memblockq = pa_memblockq_new_ring(
+            memblockq_name,
+            0,
+            pa_mempool_block_size_max(s->core->mempool) * 2,
+            0,
+            &s->sample_spec,
+            0,
+            1,
+            s->thread_info.max_rewind,
+            &s->silence);
+    pa_xfree(memblockq_name);
+}
+
 /* Called from main thread */
 void pa_sink_set_max_rewind(pa_sink *s, size_t max_rewind) {
     pa_sink_assert_ref(s);
@@ -3128,6 +4370,10 @@ void pa_sink_invalidate_requested_latency(pa_sink *s, bool dynamic) {
 
     if (PA_SINK_IS_LINKED(s->thread_info.state)) {
 
+        /* A stream may have moved between the deep bus and the fast lane */
+        if (update_deep_bus(s))
+            update_render_inputs(s);
+
         if (s->update_requested_latency)
             s->update_requested_latency(s);
 
@@ -3306,6 +4552,51 @@ void pa_sink_set_fixed_latency_within_thread(pa_sink *s, pa_usec_t latency) {
     pa_source_set_fixed_latency_within_thread(s->monitor_source, latency);
 }
 
+/* Called from main context. rates is 0 terminated and copied. */
+void pa_sink_set_supported_rates(pa_sink *s, const unsigned *rates) {
+    unsigned n;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+
+    pa_xfree(s->supported_rates);
+    s->supported_rates = NULL;
+
+    if (!rates)
+        return;
+
+    for (n = 0; rates[n]; n++)
+        ;
+
+    s->supported_rates = pa_xmemdup(rates, (n + 1) * sizeof(unsigned));
+}
+
+/* Called from main context, before the sink is put. The smoother must
+ * stay around as long as the sink does. */
+void pa_sink_set_latency_smoother(pa_sink *s, pa_smoother *smoother) {
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(s->state == PA_SINK_INIT);
+
+    s->latency_smoother = smoother;
+}
+
+/* Called from IO thread context, see sink.h */
+void pa_sink_set_latency_base_within_thread(pa_sink *s, bool valid, int64_t usec) {
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+    pa_assert(s->latency_smoother);
+
+    if (s->latency_base.valid == valid && s->latency_base.usec == usec)
+        return;
+
+    /* Make the sequence number odd while we write */
+    pa_atomic_inc(&s->latency_base.seq);
+    s->latency_base.valid = valid;
+    s->latency_base.usec = usec;
+    pa_atomic_inc(&s->latency_base.seq);
+}
+
 /* Called from main context */
 void pa_sink_set_port_latency_offset(pa_sink *s, int64_t offset) {
     pa_sink_assert_ref(s);
@@ -3320,6 +4611,71 @@ void pa_sink_set_port_latency_offset(pa_sink *s, int64_t offset) {
     pa_hook_fire(&s->core->hooks[PA_CORE_HOOK_SINK_PORT_LATENCY_OFFSET_CHANGED], s);
 }
 
+/* Called from main context */
+void pa_sink_get_rewind_stats(pa_sink *s, pa_sink_rewind_stats *stats) {
+    pa_assert_ctl_context();
+    pa_sink_assert_ref(s);
+    pa_assert(stats);
+
+    if (!PA_SINK_IS_LINKED(s->state)) {
+        *stats = s->thread_info.rewind_stats;
+        return;
+    }
+
+    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_REWIND_STATS, stats, 0, NULL) == 0);
+}
+
+/* Called from main context */
+void pa_sink_get_passthrough_stats(pa_sink *s, pa_sink_passthrough_stats *stats) {
+    pa_assert_ctl_context();
+    pa_sink_assert_ref(s);
+    pa_assert(stats);
+
+    if (!PA_SINK_IS_LINKED(s->state)) {
+        *stats = s->thread_info.passthrough_stats;
+        return;
+    }
+
+    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_PASSTHROUGH_STATS, stats, 0, NULL) == 0);
+}
+
+/* Called from main context. Refreshes the render_profile copies of the sink
+ * and of all of its inputs. */
+void pa_sink_update_render_profile(pa_sink *s) {
+    pa_assert_ctl_context();
+    pa_sink_assert_ref(s);
+
+    if (!PA_SINK_IS_LINKED(s->state))
+        return;
+
+    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_RENDER_PROFILE, NULL, 0, NULL) == 0);
+}
+
+/* Called from main context. m is fed with everything the sink renders,
+ * until it is removed with pa_sink_remove_meter(). */
+void pa_sink_add_meter(pa_sink *s, pa_meter *m) {
+    pa_assert_ctl_context();
+    pa_sink_assert_ref(s);
+    pa_assert(m);
+
+    if (PA_SINK_IS_LINKED(s->state))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_ADD_METER, m, 0, NULL) == 0);
+    else
+        PA_LLIST_PREPEND(pa_meter, s->thread_info.meters, m);
+}
+
+/* Called from main context */
+void pa_sink_remove_meter(pa_sink *s, pa_meter *m) {
+    pa_assert_ctl_context();
+    pa_sink_assert_ref(s);
+    pa_assert(m);
+
+    if (PA_SINK_IS_LINKED(s->state))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_REMOVE_METER, m, 0, NULL) == 0);
+    else
+        PA_LLIST_REMOVE(pa_meter, s->thread_info.meters, m);
+}
+
 /* Called from main context */
 size_t pa_sink_get_max_rewind(pa_sink *s) {
     size_t r;
@@ -3568,108 +4924,97 @@ unsigned pa_device_init_priority(pa_proplist *p) {
     return priority;
 }
 
-PA_STATIC_FLIST_DECLARE(pa_sink_volume_change, 0, pa_xfree);
-
-/* Called from the IO thread. */
-static pa_sink_volume_change *pa_sink_volume_change_new(pa_sink *s) {
-    pa_sink_volume_change *c;
-    if (!(c = pa_flist_pop(PA_STATIC_FLIST_GET(pa_sink_volume_change))))
-        c = pa_xnew(pa_sink_volume_change, 1);
-
-    PA_LLIST_INIT(pa_sink_volume_change, c);
-    c->at = 0;
-    pa_cvolume_reset(&c->hw_volume, s->sample_spec.channels);
-    return c;
-}
-
-/* Called from the IO thread. */
-static void pa_sink_volume_change_free(pa_sink_volume_change *c) {
-    pa_assert(c);
-    if (pa_flist_push(PA_STATIC_FLIST_GET(pa_sink_volume_change), c) < 0)
-        pa_xfree(c);
+/* Called from the IO thread. The i-th queued change, 0 is the next one
+ * to expire. */
+static inline pa_sink_volume_change *volume_change_nth(pa_sink *s, unsigned i) {
+    return &s->thread_info.volume_changes[(s->thread_info.volume_changes_head + i) % PA_SINK_VOLUME_CHANGES_MAX];
 }
 
 /* Called from the IO thread. */
 void pa_sink_volume_change_push(pa_sink *s) {
     pa_sink_volume_change *c = NULL;
-    pa_sink_volume_change *nc = NULL;
-    pa_sink_volume_change *pc = NULL;
+    pa_cvolume hw_volume;
+    pa_usec_t at;
+    unsigned k, n;
     uint32_t safety_margin = s->thread_info.volume_change_safety_margin;
 
     const char *direction = NULL;
 
     pa_assert(s);
-    nc = pa_sink_volume_change_new(s);
 
     /* NOTE: There is already more different volumes in pa_sink that I can remember.
      *       Adding one more volume for HW would get us rid of this, but I am trying
      *       to survive with the ones we already have. */
-    pa_sw_cvolume_divide(&nc->hw_volume, &s->real_volume, &s->soft_volume);
+    pa_sw_cvolume_divide(&hw_volume, &s->real_volume, &s->soft_volume);
 
-    if (!s->thread_info.volume_changes && pa_cvolume_equal(&nc->hw_volume, &s->thread_info.current_hw_volume)) {
+    n = s->thread_info.n_volume_changes;
+
+    if (n == 0 && pa_cvolume_equal(&hw_volume, &s->thread_info.current_hw_volume)) {
         pa_log_debug("Volume not changing");
-        pa_sink_volume_change_free(nc);
         return;
     }
 
-    nc->at = pa_sink_get_latency_within_thread(s, false);
-    nc->at += pa_rtclock_now() + s->thread_info.volume_change_extra_delay;
+    at = pa_sink_get_latency_within_thread(s, false);
+    at += pa_rtclock_now() + s->thread_info.volume_change_extra_delay;
 
-    if (s->thread_info.volume_changes_tail) {
-        for (c = s->thread_info.volume_changes_tail; c; c = c->prev) {
-            /* If volume is going up let's do it a bit late. If it is going
-             * down let's do it a bit early. */
-            if (pa_cvolume_avg(&nc->hw_volume) > pa_cvolume_avg(&c->hw_volume)) {
-                if (nc->at + safety_margin > c->at) {
-                    nc->at += safety_margin;
-                    direction = "up";
-                    break;
-                }
-            }
-            else if (nc->at - safety_margin > c->at) {
-                    nc->at -= safety_margin;
-                    direction = "down";
-                    break;
+    /* Find the last queued change that stays, k ends up as the number
+     * of changes before the new one */
+    for (k = n; k > 0; k--) {
+        c = volume_change_nth(s, k - 1);
+
+        /* If volume is going up let's do it a bit late. If it is going
+         * down let's do it a bit early. */
+        if (pa_cvolume_avg(&hw_volume) > pa_cvolume_avg(&c->hw_volume)) {
+            if (at + safety_margin > c->at) {
+                at += safety_margin;
+                direction = "up";
+                break;
             }
         }
+        else if (at - safety_margin > c->at) {
+                at -= safety_margin;
+                direction = "down";
+                break;
+        }
     }
 
-    if (c == NULL) {
-        if (pa_cvolume_avg(&nc->hw_volume) > pa_cvolume_avg(&s->thread_info.current_hw_volume)) {
-            nc->at += safety_margin;
+    if (k == 0) {
+        if (pa_cvolume_avg(&hw_volume) > pa_cvolume_avg(&s->thread_info.current_hw_volume)) {
+            at += safety_margin;
             direction = "up";
         } else {
-            nc->at -= safety_margin;
+            at -= safety_margin;
             direction = "down";
         }
-        PA_LLIST_PREPEND(pa_sink_volume_change, s->thread_info.volume_changes, nc);
-    }
-    else {
-        PA_LLIST_INSERT_AFTER(pa_sink_volume_change, s->thread_info.volume_changes, c, nc);
     }
 
-    pa_log_debug("Volume going %s to %d at %llu", direction, pa_cvolume_avg(&nc->hw_volume), (long long unsigned) nc->at);
+    pa_log_debug("Volume going %s to %d at %llu", direction, pa_cvolume_avg(&hw_volume), (long long unsigned) at);
 
     /* We can ignore volume events that came earlier but should happen later than this. */
-    PA_LLIST_FOREACH_SAFE(c, pc, nc->next) {
+    for (; n > k; n--) {
+        c = volume_change_nth(s, n - 1);
         pa_log_debug("Volume change to %d at %llu was dropped", pa_cvolume_avg(&c->hw_volume), (long long unsigned) c->at);
-        pa_sink_volume_change_free(c);
     }
-    nc->next = NULL;
-    s->thread_info.volume_changes_tail = nc;
+
+    if (k >= PA_SINK_VOLUME_CHANGES_MAX) {
+        k = PA_SINK_VOLUME_CHANGES_MAX - 1;
+        c = volume_change_nth(s, k);
+        pa_log_debug("Volume change queue full, change to %d at %llu was dropped",
+                     pa_cvolume_avg(&c->hw_volume), (long long unsigned) c->at);
+    }
+
+    c = volume_change_nth(s, k);
+    c->at = at;
+    c->hw_volume = hw_volume;
+    s->thread_info.n_volume_changes = k + 1;
 }
 
 /* Called from the IO thread. */
 static void pa_sink_volume_change_flush(pa_sink *s) {
-    pa_sink_volume_change *c = s->thread_info.volume_changes;
     pa_assert(s);
-    s->thread_info.volume_changes = NULL;
-    s->thread_info.volume_changes_tail = NULL;
-    while (c) {
-        pa_sink_volume_change *next = c->next;
-        pa_sink_volume_change_free(c);
-        c = next;
-    }
+
+    s->thread_info.volume_changes_head = 0;
+    s->thread_info.n_volume_changes = 0;
 }
 
 /* Called from the IO thread. */
@@ -3679,7 +5024,7 @@ bool pa_sink_volume_change_apply(pa_sink *s, pa_usec_t *usec_to_next) {
 
     pa_assert(s);
 
-    if (!s->thread_info.volume_changes || !PA_SINK_IS_LINKED(s->state)) {
+    if (s->thread_info.n_volume_changes == 0 || !PA_SINK_IS_LINKED(s->state)) {
         if (usec_to_next)
             *usec_to_next = 0;
         return ret;
@@ -3689,29 +5034,33 @@ bool pa_sink_volume_change_apply(pa_sink *s, pa_usec_t *usec_to_next) {
 
     now = pa_rtclock_now();
 
-    while (s->thread_info.volume_changes && now >= s->thread_info.volume_changes->at) {
-        pa_sink_volume_change *c = s->thread_info.volume_changes;
-        PA_LLIST_REMOVE(pa_sink_volume_change, s->thread_info.volume_changes, c);
+    while (s->thread_info.n_volume_changes > 0 && now >= volume_change_nth(s, 0)->at) {
+        pa_sink_volume_change *c = volume_change_nth(s, 0);
+
         pa_log_debug("Volume change to %d at %llu was written %llu usec late",
                      pa_cvolume_avg(&c->hw_volume), (long long unsigned) c->at, (long long unsigned) (now - c->at));
         ret = true;
         s->thread_info.current_hw_volume = c->hw_volume;
-        pa_sink_volume_change_free(c);
+
+        s->thread_info.volume_changes_head = (s->thread_info.volume_changes_head + 1) % PA_SINK_VOLUME_CHANGES_MAX;
+        s->thread_info.n_volume_changes--;
     }
 
     if (ret)
         s->write_volume(s);
 
-    if (s->thread_info.volume_changes) {
+    if (s->thread_info.n_volume_changes > 0) {
+        pa_usec_t at = volume_change_nth(s, 0)->at;
+
         if (usec_to_next)
-            *usec_to_next = s->thread_info.volume_changes->at - now;
+            *usec_to_next = at - now;
         if (pa_log_ratelimit(PA_LOG_DEBUG))
-            pa_log_debug("Next volume change in %lld usec", (long long) (s->thread_info.volume_changes->at - now));
+            pa_log_debug("Next volume change in %lld usec", (long long) (at - now));
     }
     else {
         if (usec_to_next)
             *usec_to_next = 0;
-        s->thread_info.volume_changes_tail = NULL;
+        s->thread_info.volume_changes_head = 0;
     }
     return ret;
 }
@@ -3719,7 +5068,7 @@ bool pa_sink_volume_change_apply(pa_sink *s, pa_usec_t *usec_to_next) {
 /* Called from the IO thread. */
 static void pa_sink_volume_change_rewind(pa_sink *s, size_t nbytes) {
     /* All the queued volume events later than current latency are shifted to happen earlier. */
-    pa_sink_volume_change *c;
+    unsigned i;
     pa_volume_t prev_vol = pa_cvolume_avg(&s->thread_info.current_hw_volume);
     pa_usec_t rewound = pa_bytes_to_usec(nbytes, &s->sample_spec);
     pa_usec_t limit = pa_sink_get_latency_within_thread(s, false);
@@ -3727,8 +5076,10 @@ static void pa_sink_volume_change_rewind(pa_sink *s, size_t nbytes) {
     pa_log_debug("latency = %lld", (long long) limit);
     limit += pa_rtclock_now() + s->thread_info.volume_change_extra_delay;
 
-    PA_LLIST_FOREACH(c, s->thread_info.volume_changes) {
+    for (i = 0; i < s->thread_info.n_volume_changes; i++) {
+        pa_sink_volume_change *c = volume_change_nth(s, i);
         pa_usec_t modified_limit = limit;
+
         if (prev_vol > pa_cvolume_avg(&c->hw_volume))
             modified_limit -= s->thread_info.volume_change_safety_margin;
         else
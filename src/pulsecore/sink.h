@@ -33,6 +33,8 @@
 #include <pulsecore/core.h>
 #include <pulsecore/idxset.h>
 #include <pulsecore/memchunk.h>
+#include <pulsecore/meter.h>
+#include <pulsecore/mix.h>
 #include <pulsecore/source.h>
 #include <pulsecore/module.h>
 #include <pulsecore/asyncmsgq.h>
@@ -40,12 +42,24 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/device-port.h>
 #include <pulsecore/card.h>
+#include <pulsecore/cpu-budget.h>
 #include <pulsecore/queue.h>
+#include <pulsecore/render-profile.h>
+#include <pulsecore/time-smoother.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/sink-input.h>
 
 #define PA_MAX_INPUTS_PER_SINK 256
 
+/* Size of the deferred volume change queue. If it overflows, the newest
+ * queued change is replaced. */
+#define PA_SINK_VOLUME_CHANGES_MAX 16
+
+struct pa_sink_volume_change {
+    pa_usec_t at;
+    pa_cvolume hw_volume;
+};
+
 /* Returns true if sink is linked: registered and accessible from client side. */
 static inline bool PA_SINK_IS_LINKED(pa_sink_state_t x) {
     return x == PA_SINK_RUNNING || x == PA_SINK_IDLE || x == PA_SINK_SUSPENDED;
@@ -56,9 +70,28 @@ typedef void(*pa_sink_cb_t)(pa_sink *s);
 
 typedef int (*pa_sink_get_mute_cb_t)(pa_sink *s, bool *mute);
 
+typedef struct pa_sink_rewind_stats {
+    uint64_t n_requested; /* requests, those of the same cycle merged */
+    uint64_t n_rewinds;   /* rewinds that actually went back in time */
+    uint64_t n_bytes;     /* bytes rendered again, in the sink's sample spec */
+    uint64_t n_fast_lane; /* rewinds that replayed the deep bus instead of its inputs */
+} pa_sink_rewind_stats;
+
+typedef struct pa_sink_passthrough_stats {
+    uint64_t n_renders;   /* blocks copied straight from the input */
+    uint64_t n_bytes;     /* bytes copied that way */
+    uint64_t n_silence;   /* blocks the input had no data for */
+    uint64_t n_short;     /* blocks shorter than the space offered */
+} pa_sink_passthrough_stats;
+
 struct pa_sink {
     pa_msgobject parent;
 
+    /* The reference counter in parent is changed from the IO thread
+     * too. Main thread fields follow, then thread_info, each starting
+     * on their own cache line. */
+    PA_CACHELINE_PAD(_pad_ref);
+
     uint32_t index;
     pa_core *core;
 
@@ -83,6 +116,9 @@ struct pa_sink {
     pa_channel_map channel_map;
     uint32_t default_sample_rate;
     uint32_t alternate_sample_rate;
+    /* Rates the sink can be reconfigured to, 0 terminated, or NULL if
+     * it only knows about the default and alternate rate */
+    unsigned *supported_rates;
 
     pa_idxset *inputs;
     unsigned n_corked;
@@ -120,6 +156,17 @@ struct pa_sink {
     /* The latency offset is inherited from the currently active port */
     int64_t port_latency_offset;
 
+    /* If set, the latency is latency_base minus the smoother's estimate,
+     * and pa_sink_get_latency() calculates it without asking the IO
+     * thread. latency_base is updated by the IO thread, seq is odd while
+     * that happens. */
+    pa_smoother *latency_smoother;
+    struct {
+        pa_atomic_t seq;
+        bool valid;
+        int64_t usec;
+    } latency_base;
+
     unsigned priority;
 
     bool set_mute_in_progress;
@@ -129,6 +176,12 @@ struct pa_sink {
      * inhibited */
     int (*set_state)(pa_sink *s, pa_sink_state_t state); /* may be NULL */
 
+    /* Called when the suspend cause changes while the sink is and stays
+     * suspended. Sinks that keep their device open while suspended for
+     * PA_SUSPEND_IDLE_SOFT alone set this to learn when to close it, or
+     * to open it again. Called from main context. */
+    void (*suspend_cause_changed)(pa_sink *s, pa_suspend_cause_t old_cause); /* may be NULL */
+
     /* Sink drivers that support hardware volume may set this
      * callback. This is called when the current volume needs to be
      * re-read from the hardware.
@@ -230,6 +283,12 @@ struct pa_sink {
      * thread context. */
     pa_sink_cb_t update_requested_latency; /* may be NULL */
 
+    /* Called when the IO thread used more CPU time than its budget, see
+     * cpu-budget.h, after the resamplers of the inputs have been made
+     * cheaper. May trade latency for fewer wakeups. Called from IO
+     * thread context. */
+    pa_sink_cb_t cpu_overload; /* may be NULL */
+
     /* Called whenever the port shall be changed. Called from IO
      * thread if deferred volumes are enabled, and main thread otherwise. */
     int (*set_port)(pa_sink *s, pa_device_port *port); /* may be NULL */
@@ -248,17 +307,74 @@ struct pa_sink {
      * main thread. */
     int (*reconfigure)(pa_sink *s, pa_sample_spec *spec, bool passthrough);
 
+    /* Copy of thread_info.render_profile, updated by
+     * pa_sink_update_render_profile() */
+    pa_render_profile render_profile[PA_RENDER_STAGE_MAX];
+
+    void *userdata;
+
+    PA_CACHELINE_PAD(_pad_thread_info);
+
     /* Contains copies of the above data so that the real-time worker
      * thread can work without access locking */
     struct {
         pa_sink_state_t state;
         pa_hashmap *inputs;
 
+        /* The inputs in the order of the hashmap above, as a plain
+         * array for the render loop. It is rebuilt whenever the hashmap
+         * changes. */
+        pa_sink_input **render_inputs;
+        unsigned n_render_inputs;
+
+        /* Scratch space for pa_sink_render(), one entry per input. It
+         * is grown when inputs are attached so that rendering itself
+         * never allocates. render_inputs has the same size. */
+        pa_mix_info *mix_info;
+        unsigned mix_info_size;
+
+        /* Inputs whose resamplers have the same configuration are mixed
+         * before resampling and resampled once. Rebuilt together with
+         * render_inputs, see fill_mix_info(). */
+        PA_LLIST_HEAD(pa_sink_premix, premixes);
+
+        /* With deep_bus_latency set, inputs that don't ask for less
+         * latency than that are mixed ahead into deep_bus_memblockq,
+         * which then enters the final mix like a single input. The
+         * other inputs form the fast lane. Rewinds needed only by the
+         * fast lane replay deep_bus_history instead of rewinding the
+         * deep inputs, see pa_sink_process_rewind(). The bus is only
+         * used while there is at least one fast lane input. */
+        pa_usec_t deep_bus_latency;
+        pa_memblockq *deep_bus_memblockq;
+        pa_mix_info *deep_bus_info; /* scratch space, same size as mix_info */
+        size_t deep_bus_history; /* played bytes of the bus that can be rewound */
+        unsigned n_deep_inputs;
+        bool deep_bus_peeked:1; /* is part of the current chunk */
+
+        /* Helps peeking the inputs if the core has render threads, see
+         * fill_mix_info(). While the pool runs, the latency is answered
+         * from render_latency instead of asking the implementation. */
+        pa_render_pool *render_pool;
+        int64_t render_latency;
+        bool render_latency_valid:1;
+
         pa_rtpoll *rtpoll;
 
+        /* Looked up for the sample spec of the sink whenever it starts,
+         * the spec can only change while the sink is suspended */
+        pa_do_mix_func_t mix_func;
+
         pa_cvolume soft_volume;
         bool soft_muted:1;
 
+        /* Changes of soft_volume are faded in linearly, starting at
+         * soft_volume_ramp_from. soft_volume_ramp_pos counts the frames
+         * rendered since, the ramp is over once it reaches
+         * soft_volume_ramp_frames. */
+        pa_cvolume soft_volume_ramp_from;
+        size_t soft_volume_ramp_frames, soft_volume_ramp_pos;
+
         /* The requested latency is used for dynamic latency
          * sinks. For fixed latency sinks it is always identical to
          * the fixed_latency. See below. */
@@ -276,6 +392,26 @@ struct pa_sink {
         /* Maximum of what clients requested to rewind in this cycle */
         size_t rewind_nbytes;
         bool rewind_requested;
+        bool rewind_deep; /* the deep inputs have to be rewound, too */
+
+        /* After a rewind caused by a stream volume or mute change the
+         * sink refills at most refill_limit bytes of its buffer, and
+         * the limit doubles with every fill until the buffer is full
+         * again. That way changes that follow shortly after only need
+         * to rewrite little. 0 means no limit is in effect.
+         * volume_rewind marks the pending rewind as caused by such a
+         * change, volume_horizon_usec is the initial limit. */
+        size_t refill_limit;
+        bool volume_rewind:1;
+        pa_usec_t volume_horizon_usec;
+
+        /* Statistics: how often rewinds were requested and processed,
+         * and how many bytes the inputs had to render again */
+        pa_sink_rewind_stats rewind_stats;
+
+        /* Statistics of the passthrough render path, see
+         * render_passthrough() */
+        pa_sink_passthrough_stats passthrough_stats;
 
         /* Both dynamic and fixed latencies will be clamped to this
          * range. */
@@ -291,10 +427,10 @@ struct pa_sink {
         int64_t port_latency_offset;
 
         /* Delayed volume change events are queued here. The events
-         * are stored in expiration order. The one expiring next is in
-         * the head of the list. */
-        PA_LLIST_HEAD(pa_sink_volume_change, volume_changes);
-        pa_sink_volume_change *volume_changes_tail;
+         * are stored in expiration order in a ring, the one expiring
+         * next is at volume_changes_head. */
+        pa_sink_volume_change volume_changes[PA_SINK_VOLUME_CHANGES_MAX];
+        unsigned volume_changes_head, n_volume_changes;
         /* This value is updated in pa_sink_volume_change_apply() and
          * used only by sinks with PA_SINK_DEFERRED_VOLUME. */
         pa_cvolume current_hw_volume;
@@ -304,9 +440,13 @@ struct pa_sink {
         uint32_t volume_change_safety_margin;
         /* Usec delay added to all volume change events, may be negative. */
         int32_t volume_change_extra_delay;
-    } thread_info;
 
-    void *userdata;
+        pa_render_profile render_profile[PA_RENDER_STAGE_MAX];
+        pa_cpu_budget cpu_budget;
+
+        /* Fed with everything the sink renders */
+        PA_LLIST_HEAD(pa_meter, meters);
+    } thread_info;
 };
 
 PA_DECLARE_PUBLIC_CLASS(pa_sink);
@@ -338,6 +478,11 @@ typedef enum pa_sink_message {
     PA_SINK_MESSAGE_SET_PORT,
     PA_SINK_MESSAGE_UPDATE_VOLUME_AND_MUTE,
     PA_SINK_MESSAGE_SET_PORT_LATENCY_OFFSET,
+    PA_SINK_MESSAGE_GET_REWIND_STATS,
+    PA_SINK_MESSAGE_GET_PASSTHROUGH_STATS,
+    PA_SINK_MESSAGE_GET_RENDER_PROFILE,
+    PA_SINK_MESSAGE_ADD_METER,
+    PA_SINK_MESSAGE_REMOVE_METER,
     PA_SINK_MESSAGE_MAX
 } pa_sink_message_t;
 
@@ -405,9 +550,12 @@ void pa_sink_set_asyncmsgq(pa_sink *s, pa_asyncmsgq *q);
 void pa_sink_set_rtpoll(pa_sink *s, pa_rtpoll *p);
 
 void pa_sink_set_max_rewind(pa_sink *s, size_t max_rewind);
+void pa_sink_set_deep_bus_latency(pa_sink *s, pa_usec_t latency);
 void pa_sink_set_max_request(pa_sink *s, size_t max_request);
 void pa_sink_set_latency_range(pa_sink *s, pa_usec_t min_latency, pa_usec_t max_latency);
 void pa_sink_set_fixed_latency(pa_sink *s, pa_usec_t latency);
+void pa_sink_set_latency_smoother(pa_sink *s, pa_smoother *smoother);
+void pa_sink_set_supported_rates(pa_sink *s, const unsigned *rates);
 
 void pa_sink_set_soft_volume(pa_sink *s, const pa_cvolume *volume);
 void pa_sink_volume_changed(pa_sink *s, const pa_cvolume *new_volume);
@@ -432,6 +580,11 @@ void pa_sink_get_latency_range(pa_sink *s, pa_usec_t *min_latency, pa_usec_t *ma
 pa_usec_t pa_sink_get_fixed_latency(pa_sink *s);
 
 size_t pa_sink_get_max_rewind(pa_sink *s);
+void pa_sink_get_rewind_stats(pa_sink *s, pa_sink_rewind_stats *stats);
+void pa_sink_get_passthrough_stats(pa_sink *s, pa_sink_passthrough_stats *stats);
+void pa_sink_update_render_profile(pa_sink *s);
+void pa_sink_add_meter(pa_sink *s, pa_meter *m);
+void pa_sink_remove_meter(pa_sink *s, pa_meter *m);
 size_t pa_sink_get_max_request(pa_sink *s);
 
 int pa_sink_update_status(pa_sink*s);
@@ -454,6 +607,7 @@ void pa_sink_enter_passthrough(pa_sink *s);
 void pa_sink_leave_passthrough(pa_sink *s);
 
 void pa_sink_set_volume(pa_sink *sink, const pa_cvolume *volume, bool sendmsg, bool save);
+bool pa_sink_update_flat_volume_for_input(pa_sink *s, pa_sink_input *i, bool save);
 const pa_cvolume *pa_sink_get_volume(pa_sink *sink, bool force_refresh);
 
 void pa_sink_set_mute(pa_sink *sink, bool mute, bool save);
@@ -498,6 +652,7 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result);
 void pa_sink_render_full(pa_sink *s, size_t length, pa_memchunk *result);
 void pa_sink_render_into(pa_sink*s, pa_memchunk *target);
 void pa_sink_render_into_full(pa_sink *s, pa_memchunk *target);
+size_t pa_sink_render_discard(pa_sink *s, size_t length);
 
 void pa_sink_process_rewind(pa_sink *s, size_t nbytes);
 
@@ -520,9 +675,17 @@ bool pa_sink_volume_change_apply(pa_sink *s, pa_usec_t *usec_to_next);
 
 size_t pa_sink_process_input_underruns(pa_sink *s, size_t left_to_play);
 
+size_t pa_sink_get_refill_unused_within_thread(pa_sink *s, size_t buffer_size, size_t unused);
+void pa_sink_refilled_within_thread(pa_sink *s, size_t buffer_size, size_t unused);
+
+/* For sinks with a latency smoother: the latency is usec minus the
+ * smoother's estimate from now on, or unknown if !valid */
+void pa_sink_set_latency_base_within_thread(pa_sink *s, bool valid, int64_t usec);
+
 /*** To be called exclusively by sink input drivers, from IO context */
 
 void pa_sink_request_rewind(pa_sink*s, size_t nbytes);
+void pa_sink_request_rewind_fast_lane(pa_sink *s, size_t nbytes);
 
 void pa_sink_invalidate_requested_latency(pa_sink *s, bool dynamic);
 
@@ -24,6 +24,7 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/types.h>
 #include <stdio.h>
@@ -72,6 +73,13 @@ int deny_severity = LOG_WARNING;
 
 #include "socket-server.h"
 
+/* Connections accepted per wakeup, so that a burst of clients doesn't
+ * cost a main loop iteration each, but other events still get a turn */
+#define ACCEPT_BATCH 32
+
+/* The kernel caps this further, at net.core.somaxconn on Linux */
+#define DEFAULT_BACKLOG SOMAXCONN
+
 struct pa_socket_server {
     PA_REFCNT_DECLARE;
     int fd;
@@ -91,29 +99,20 @@ struct pa_socket_server {
     } type;
 };
 
-static void callback(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
-    pa_socket_server *s = userdata;
+/* Returns false if there was no connection waiting */
+static bool accept_one(pa_socket_server *s) {
     pa_iochannel *io;
     int nfd;
 
-    pa_assert(s);
-    pa_assert(PA_REFCNT_VALUE(s) >= 1);
-    pa_assert(s->mainloop == mainloop);
-    pa_assert(s->io_event == e);
-    pa_assert(e);
-    pa_assert(fd >= 0);
-    pa_assert(fd == s->fd);
-
-    pa_socket_server_ref(s);
-
-    if ((nfd = pa_accept_cloexec(fd, NULL, NULL)) < 0) {
-        pa_log("accept(): %s", pa_cstrerror(errno));
-        goto finish;
+    if ((nfd = pa_accept_cloexec(s->fd, NULL, NULL)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            pa_log("accept(): %s", pa_cstrerror(errno));
+        return false;
     }
 
     if (!s->on_connection) {
         pa_close(nfd);
-        goto finish;
+        return true;
     }
 
 #ifdef HAVE_LIBWRAP
@@ -126,7 +125,7 @@ static void callback(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_ev
         if (!hosts_access(&req)) {
             pa_log_warn("TCP connection refused by tcpwrap.");
             pa_close(nfd);
-            goto finish;
+            return true;
         }
 
         pa_log_info("TCP connection accepted by tcpwrap.");
@@ -142,7 +141,29 @@ static void callback(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_ev
     pa_assert_se(io = pa_iochannel_new(s->mainloop, nfd, nfd));
     s->on_connection(s, io, s->userdata);
 
-finish:
+    return true;
+}
+
+static void callback(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
+    pa_socket_server *s = userdata;
+    unsigned n;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(s->mainloop == mainloop);
+    pa_assert(s->io_event == e);
+    pa_assert(e);
+    pa_assert(fd >= 0);
+    pa_assert(fd == s->fd);
+
+    pa_socket_server_ref(s);
+
+    /* Stop once nobody but us holds a reference anymore, the owner
+     * might have freed the server from the callback */
+    for (n = 0; n < ACCEPT_BATCH && PA_REFCNT_VALUE(s) > 1; n++)
+        if (!accept_one(s))
+            break;
+
     pa_socket_server_unref(s);
 }
 
@@ -157,6 +178,10 @@ static pa_socket_server* socket_server_new(pa_mainloop_api *m, int fd) {
     s->fd = fd;
     s->mainloop = m;
 
+    /* Accepting in batches relies on accept() not blocking once the
+     * queue is empty */
+    pa_make_fd_nonblock(fd);
+
     pa_assert_se(s->io_event = m->io_new(m, fd, PA_IO_EVENT_INPUT, callback, s));
 
     return s;
@@ -220,7 +245,7 @@ pa_socket_server* pa_socket_server_new_unix(pa_mainloop_api *m, const char *file
         * inodes. */
         chmod(filename, 0777);
 
-        if (listen(fd, 5) < 0) {
+        if (listen(fd, DEFAULT_BACKLOG) < 0) {
             pa_log("listen(): %s", pa_cstrerror(errno));
             goto fail;
         }
@@ -308,7 +333,7 @@ pa_socket_server* pa_socket_server_new_ipv4(pa_mainloop_api *m, uint32_t address
             }
         }
 
-        if (listen(fd, 5) < 0) {
+        if (listen(fd, DEFAULT_BACKLOG) < 0) {
             pa_log("listen(): %s", pa_cstrerror(errno));
             goto fail;
         }
@@ -396,7 +421,7 @@ pa_socket_server* pa_socket_server_new_ipv6(pa_mainloop_api *m, const uint8_t ad
             }
         }
 
-        if (listen(fd, 5) < 0) {
+        if (listen(fd, DEFAULT_BACKLOG) < 0) {
             pa_log("listen(): %s", pa_cstrerror(errno));
             goto fail;
         }
@@ -501,6 +526,21 @@ void pa_socket_server_unref(pa_socket_server *s) {
         socket_server_free(s);
 }
 
+int pa_socket_server_set_backlog(pa_socket_server *s, unsigned backlog) {
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(backlog > 0);
+
+    /* Listening again only changes the backlog, also on sockets passed
+     * in by systemd */
+    if (listen(s->fd, (int) PA_MIN(backlog, (unsigned) INT_MAX)) < 0) {
+        pa_log("listen(): %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
 void pa_socket_server_set_callback(pa_socket_server*s, pa_socket_server_on_connection_cb_t on_connection, void *userdata) {
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
@@ -48,6 +48,9 @@ typedef void (*pa_socket_server_on_connection_cb_t)(pa_socket_server*s, pa_iocha
 
 void pa_socket_server_set_callback(pa_socket_server*s, pa_socket_server_on_connection_cb_t connection_cb, void *userdata);
 
+/* How many connections may wait to be accepted, SOMAXCONN by default */
+int pa_socket_server_set_backlog(pa_socket_server *s, unsigned backlog);
+
 char *pa_socket_server_get_address(pa_socket_server *s, char *c, size_t l);
 
 #endif
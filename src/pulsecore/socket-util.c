@@ -221,6 +221,50 @@ int pa_socket_set_sndbuf(int fd, size_t l) {
     return 0;
 }
 
+int pa_socket_set_tcp_notsent_lowat(int fd, size_t l) {
+#ifdef TCP_NOTSENT_LOWAT
+    int lowat = (int) l;
+
+    pa_assert(fd >= 0);
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const void *) &lowat, sizeof(lowat)) < 0) {
+        pa_log_warn("TCP_NOTSENT_LOWAT: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int pa_socket_get_tcp_rtt(int fd, pa_usec_t *rtt, pa_usec_t *rttvar) {
+#if defined(TCP_INFO) && defined(__linux__)
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    pa_assert(fd >= 0);
+    pa_assert(rtt);
+    pa_assert(rttvar);
+
+    pa_zero(info);
+
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, (void *) &info, &len) < 0)
+        return -1;
+
+    /* The kernel has no estimate before the first acknowledgement */
+    if (info.tcpi_rtt == 0)
+        return -1;
+
+    *rtt = (pa_usec_t) info.tcpi_rtt;
+    *rttvar = (pa_usec_t) info.tcpi_rttvar;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 #ifdef HAVE_SYS_UN_H
 
 int pa_unix_socket_is_stale(const char *fn) {
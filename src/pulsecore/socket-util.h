@@ -23,6 +23,8 @@
 
 #include <sys/types.h>
 
+#include <pulse/sample.h>
+
 #include <pulsecore/socket.h>
 #include <pulsecore/macro.h>
 
@@ -35,6 +37,14 @@ void pa_make_udp_socket_low_delay(int fd);
 int pa_socket_set_sndbuf(int fd, size_t l);
 int pa_socket_set_rcvbuf(int fd, size_t l);
 
+/* Limits how much data may wait unsent in the kernel, so that it queues
+ * up in user space instead, where it is still cheap to reorder */
+int pa_socket_set_tcp_notsent_lowat(int fd, size_t l);
+
+/* Returns the kernel's smoothed round trip time estimate for a TCP
+ * socket, and its mean deviation. Fails for anything not TCP. */
+int pa_socket_get_tcp_rtt(int fd, pa_usec_t *rtt, pa_usec_t *rttvar);
+
 int pa_unix_socket_is_stale(const char *fn);
 int pa_unix_socket_remove_stale(const char *fn);
 
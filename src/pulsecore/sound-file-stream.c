@@ -35,6 +35,9 @@
 #include <pulsecore/core-error.h>
 #include <pulsecore/sink-input.h>
 #include <pulsecore/log.h>
+#include <pulsecore/asyncq.h>
+#include <pulsecore/fdsem.h>
+#include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/mix.h>
@@ -44,6 +47,10 @@
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* How many blocks the reader thread may decode ahead of playback. With
+ * the default block size that's about half a MiB. */
+#define READAHEAD_BLOCKS 8
+
 typedef struct file_stream {
     pa_msgobject parent;
     pa_core *core;
@@ -51,6 +58,17 @@ typedef struct file_stream {
 
     SNDFILE *sndfile;
     sf_count_t (*readf_function)(SNDFILE *sndfile, void *ptr, sf_count_t frames);
+    pa_sample_spec sample_spec;
+
+    /* Reading and decoding the file may block, so it is done by a
+     * thread of its own, which hands pa_memchunks to the IO thread
+     * through readahead. The IO thread posts readahead_sem whenever it
+     * took one, the main thread to make the reader quit. */
+    pa_thread *reader;
+    pa_asyncq *readahead;
+    pa_fdsem *readahead_sem;
+    pa_atomic_t reader_done;
+    pa_atomic_t reader_quit;
 
     /* We need this memblockq here to easily fulfill rewind requests
      * (even beyond the file start!) */
@@ -79,11 +97,30 @@ static void file_stream_unlink(file_stream *u) {
     file_stream_unref(u);
 }
 
+static void memchunk_free(void *p) {
+    pa_memchunk *c = p;
+
+    pa_memblock_unref(c->memblock);
+    pa_xfree(c);
+}
+
 /* Called from main context */
 static void file_stream_free(pa_object *o) {
     file_stream *u = FILE_STREAM(o);
     pa_assert(u);
 
+    if (u->reader) {
+        pa_atomic_store(&u->reader_quit, 1);
+        pa_fdsem_post(u->readahead_sem);
+        pa_thread_free(u->reader);
+    }
+
+    if (u->readahead)
+        pa_asyncq_free(u->readahead, memchunk_free);
+
+    if (u->readahead_sem)
+        pa_fdsem_free(u->readahead_sem);
+
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
@@ -133,6 +170,82 @@ static void sink_input_state_change_cb(pa_sink_input *i, pa_sink_input_state_t s
         pa_sink_input_request_rewind(i, 0, false, true, true);
 }
 
+/* Called from the reader thread */
+static void reader_thread_func(void *userdata) {
+    file_stream *u = userdata;
+    size_t fs, length;
+
+    pa_log_debug("Reader thread starting up");
+
+    fs = u->readf_function ? pa_frame_size(&u->sample_spec) : 1;
+    length = pa_frame_align(pa_mempool_block_size_max(u->core->mempool), &u->sample_spec);
+
+    while (!pa_atomic_load(&u->reader_quit)) {
+        pa_memchunk *c;
+        void *p;
+        sf_count_t n;
+
+        c = pa_xnew(pa_memchunk, 1);
+        c->memblock = pa_memblock_new(u->core->mempool, length);
+        c->index = 0;
+
+        p = pa_memblock_acquire(c->memblock);
+
+        if (u->readf_function)
+            n = u->readf_function(u->sndfile, p, (sf_count_t) (length/fs));
+        else
+            n = sf_read_raw(u->sndfile, p, (sf_count_t) length);
+
+        pa_memblock_release(c->memblock);
+
+        if (n <= 0) {
+            memchunk_free(c);
+            break;
+        }
+
+        c->length = (size_t) n * fs;
+
+        /* Wait for the IO thread to make room */
+        while (pa_asyncq_push(u->readahead, c, false) < 0) {
+            pa_fdsem_wait(u->readahead_sem);
+
+            if (pa_atomic_load(&u->reader_quit)) {
+                memchunk_free(c);
+                goto finish;
+            }
+        }
+    }
+
+finish:
+    /* Only after the last push, see sink_input_pop_cb() */
+    pa_atomic_store(&u->reader_done, 1);
+
+    pa_log_debug("Reader thread shutting down");
+}
+
+/* Called from IO thread context. Returns false if the reader is done
+ * and everything it read has been taken. */
+static bool take_readahead(file_stream *u) {
+    pa_memchunk *c;
+
+    if (!(c = pa_asyncq_pop(u->readahead, false))) {
+
+        if (!pa_atomic_load(&u->reader_done))
+            return true;
+
+        /* It might have pushed once more before it said so */
+        if (!(c = pa_asyncq_pop(u->readahead, false)))
+            return false;
+    }
+
+    pa_memblockq_push(u->memblockq, c);
+    memchunk_free(c);
+
+    pa_fdsem_post(u->readahead_sem);
+
+    return true;
+}
+
 /* Called from IO thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
     file_stream *u;
@@ -146,10 +259,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
         return -1;
 
     for (;;) {
-        pa_memchunk tchunk;
-        size_t fs;
-        void *p;
-        sf_count_t n;
+        size_t l;
 
         if (pa_memblockq_peek(u->memblockq, chunk) >= 0) {
             chunk->length = PA_MIN(chunk->length, length);
@@ -157,36 +267,14 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
             return 0;
         }
 
-        if (!u->sndfile)
-            break;
-
-        tchunk.memblock = pa_memblock_new(i->sink->core->mempool, length);
-        tchunk.index = 0;
-
-        p = pa_memblock_acquire(tchunk.memblock);
-
-        if (u->readf_function) {
-            fs = pa_frame_size(&i->sample_spec);
-            n = u->readf_function(u->sndfile, p, (sf_count_t) (length/fs));
-        } else {
-            fs = 1;
-            n = sf_read_raw(u->sndfile, p, (sf_count_t) length);
-        }
-
-        pa_memblock_release(tchunk.memblock);
-
-        if (n <= 0) {
-            pa_memblock_unref(tchunk.memblock);
+        l = pa_memblockq_get_length(u->memblockq);
 
-            sf_close(u->sndfile);
-            u->sndfile = NULL;
+        if (!take_readahead(u))
             break;
-        }
 
-        tchunk.length = (size_t) n * fs;
-
-        pa_memblockq_push(u->memblockq, &tchunk);
-        pa_memblock_unref(tchunk.memblock);
+        /* The reader has not caught up, play silence for now */
+        if (pa_memblockq_get_length(u->memblockq) == l)
+            return -1;
     }
 
     if (pa_sink_input_safe_to_remove(i)) {
@@ -248,6 +336,11 @@ int pa_play_file(
     u->sink_input = NULL;
     u->sndfile = NULL;
     u->readf_function = NULL;
+    u->reader = NULL;
+    u->readahead = NULL;
+    u->readahead_sem = NULL;
+    pa_atomic_store(&u->reader_done, 0);
+    pa_atomic_store(&u->reader_quit, 0);
     u->memblockq = NULL;
 
     if ((fd = pa_open_cloexec(fname, O_RDONLY, 0)) < 0) {
@@ -255,10 +348,8 @@ int pa_play_file(
         goto fail;
     }
 
-    /* FIXME: For now we just use posix_fadvise to avoid page faults
-     * when accessing the file data. Eventually we should move the
-     * file reader into the main event loop and pass the data over the
-     * asyncmsgq. */
+    /* The reader thread copes with slow reads, but there is no reason
+     * not to tell the kernel what we are up to */
 
 #ifdef HAVE_POSIX_FADVISE
     if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL) < 0) {
@@ -294,6 +385,13 @@ int pa_play_file(
     }
 
     u->readf_function = pa_sndfile_readf_function(&ss);
+    u->sample_spec = ss;
+
+    if (!(u->readahead = pa_asyncq_new(READAHEAD_BLOCKS)) ||
+        !(u->readahead_sem = pa_fdsem_new())) {
+        pa_log("Failed to set up the read-ahead queue.");
+        goto fail;
+    }
 
     pa_sink_input_new_data_init(&data);
     pa_sink_input_new_data_set_sink(&data, sink, false);
@@ -305,6 +403,15 @@ int pa_play_file(
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_FILENAME, fname);
     pa_sndfile_init_proplist(u->sndfile, data.proplist);
 
+    /* From here on the file belongs to the reader. It starts before we
+     * are heard, so that the first blocks are there when the sink asks
+     * for them. */
+    if (!(u->reader = pa_thread_new("sndfile-reader", reader_thread_func, u))) {
+        pa_log("Failed to create reader thread.");
+        pa_sink_input_new_data_done(&data);
+        goto fail;
+    }
+
     pa_sink_input_new(&u->sink_input, sink->core, &data);
     pa_sink_input_new_data_done(&data);
 
@@ -397,7 +397,8 @@ int pa_source_output_new(
         !pa_channel_map_equal(&data->channel_map, &data->source->channel_map)) {
 
         if (!pa_source_output_new_data_is_passthrough(data)) /* no resampler for passthrough content */
-            if (!(resampler = pa_resampler_new(
+            if (!(resampler = pa_resampler_cache_get(
+                        &core->resampler_cache,
                         core->mempool,
                         &data->source->sample_spec, &data->source->channel_map,
                         &data->sample_spec, &data->channel_map,
@@ -598,6 +599,10 @@ void pa_source_output_unlink(pa_source_output*o) {
 
         if (o->source->asyncmsgq)
             pa_assert_se(pa_asyncmsgq_send(o->source->asyncmsgq, PA_MSGOBJECT(o->source), PA_SOURCE_MESSAGE_REMOVE_OUTPUT, o, 0, NULL) == 0);
+
+        /* The IO thread is done with us now */
+        if (o->client)
+            o->client->unlinked_render_usec += o->thread_info.render_profile[PA_RENDER_STAGE_OUTPUT_PUSH].total;
     }
 
     reset_callbacks(o);
@@ -635,7 +640,7 @@ static void source_output_free(pa_object* mo) {
         pa_memblockq_free(o->thread_info.delay_memblockq);
 
     if (o->thread_info.resampler)
-        pa_resampler_free(o->thread_info.resampler);
+        pa_resampler_cache_put(&o->core->resampler_cache, o->thread_info.resampler);
 
     if (o->format)
         pa_format_info_free(o->format);
@@ -725,6 +730,7 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
     bool volume_is_norm;
     size_t length;
     size_t limit, mbs = 0;
+    pa_usec_t start;
 
     pa_source_output_assert_ref(o);
     pa_source_output_assert_io_context(o);
@@ -737,6 +743,8 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
 
     pa_assert(o->thread_info.state == PA_SOURCE_OUTPUT_RUNNING);
 
+    start = pa_render_profile_start();
+
     if (pa_memblockq_push(o->thread_info.delay_memblockq, chunk) < 0) {
         pa_log_debug("Delay queue overflow!");
         pa_memblockq_seek(o->thread_info.delay_memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, true);
@@ -811,6 +819,7 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
             o->push(o, &qchunk);
         else {
             pa_memchunk rchunk;
+            pa_usec_t resample_start;
 
             if (mbs == 0)
                 mbs = pa_resampler_max_block_size(o->thread_info.resampler);
@@ -818,7 +827,9 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
             if (qchunk.length > mbs)
                 qchunk.length = mbs;
 
+            resample_start = pa_render_profile_start();
             pa_resampler_run(o->thread_info.resampler, &qchunk, &rchunk);
+            pa_render_profile_stop(&o->thread_info.render_profile[PA_RENDER_STAGE_RESAMPLE], resample_start);
 
             if (rchunk.length > 0)
                 o->push(o, &rchunk);
@@ -830,6 +841,59 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
         pa_memblock_unref(qchunk.memblock);
         pa_memblockq_drop(o->thread_info.delay_memblockq, qchunk.length);
     }
+
+    pa_render_profile_stop(&o->thread_info.render_profile[PA_RENDER_STAGE_OUTPUT_PUSH], start);
+}
+
+/* Called from thread context */
+bool pa_source_output_can_share_resampler(pa_source_output *o, pa_resampler *r, pa_cvolume *volume) {
+    pa_resampler *own;
+
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert(r);
+    pa_assert(volume);
+
+    if (!o->push || o->thread_info.state != PA_SOURCE_OUTPUT_RUNNING)
+        return false;
+
+    if (!(own = o->thread_info.resampler))
+        return false;
+
+    /* The rate of these may change at any time */
+    if (!pa_resampler_same_config(own, r) || (own->flags & PA_RESAMPLER_VARIABLE_RATE))
+        return false;
+
+    /* Data that is held back in the delay queue has to go through it */
+    if (!o->process_rewind && o->source->thread_info.max_rewind > 0)
+        return false;
+
+    if (pa_memblockq_get_length(o->thread_info.delay_memblockq) > 0)
+        return false;
+
+    /* Same as what pa_source_output_push() applies before resampling,
+     * outputs sharing r need to agree on it */
+    if (o->thread_info.muted)
+        pa_cvolume_mute(volume, o->source->sample_spec.channels);
+    else
+        pa_sw_cvolume_multiply(volume, &o->thread_info.soft_volume, &o->volume_factor_source);
+
+    return true;
+}
+
+/* Called from thread context */
+void pa_source_output_push_shared(pa_source_output *o, const pa_memchunk *rchunk) {
+    pa_usec_t start;
+
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert(o->thread_info.fanout_shared);
+    pa_assert(rchunk);
+    pa_assert(pa_frame_aligned(rchunk->length, &o->thread_info.sample_spec));
+
+    start = pa_render_profile_start();
+    o->push(o, rchunk);
+    pa_render_profile_stop(&o->thread_info.render_profile[PA_RENDER_STAGE_OUTPUT_PUSH], start);
 }
 
 /* Called from thread context */
@@ -844,6 +908,8 @@ void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes /* in so
         return;
 
     if (o->process_rewind) {
+        size_t in_nbytes = nbytes;
+
         pa_assert(pa_memblockq_get_length(o->thread_info.delay_memblockq) == 0);
 
         if (o->thread_info.resampler)
@@ -855,7 +921,7 @@ void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes /* in so
             o->process_rewind(o, nbytes);
 
         if (o->thread_info.resampler)
-            pa_resampler_rewind(o->thread_info.resampler, nbytes);
+            pa_resampler_rewind(o->thread_info.resampler, nbytes, in_nbytes);
 
     } else
         pa_memblockq_rewind(o->thread_info.delay_memblockq, nbytes);
@@ -990,7 +1056,8 @@ void pa_source_output_set_volume(pa_source_output *o, const pa_cvolume *volume,
         set_real_ratio(o, volume);
 
         /* Copy the new soft_volume to the thread_info struct */
-        pa_assert_se(pa_asyncmsgq_send(o->source->asyncmsgq, PA_MSGOBJECT(o), PA_SOURCE_OUTPUT_MESSAGE_SET_SOFT_VOLUME, NULL, 0, NULL) == 0);
+        pa_asyncmsgq_post_latest(o->source->asyncmsgq, PA_MSGOBJECT(o), PA_SOURCE_OUTPUT_MESSAGE_SET_SOFT_VOLUME,
+                                 pa_xnewdup(pa_cvolume, &o->soft_volume, 1), 0, pa_xfree);
     }
 
     /* The volume changed, let's tell people so */
@@ -1654,6 +1721,7 @@ int pa_source_output_process_msg(pa_msgobject *mo, int code, void *userdata, int
         case PA_SOURCE_OUTPUT_MESSAGE_SET_STATE:
 
             pa_source_output_set_state_within_thread(o, PA_PTR_TO_UINT(userdata));
+            pa_source_update_post_outputs(o->source);
 
             return 0;
 
@@ -1672,11 +1740,13 @@ int pa_source_output_process_msg(pa_msgobject *mo, int code, void *userdata, int
             return 0;
         }
 
-        case PA_SOURCE_OUTPUT_MESSAGE_SET_SOFT_VOLUME:
-            if (!pa_cvolume_equal(&o->thread_info.soft_volume, &o->soft_volume)) {
-                o->thread_info.soft_volume = o->soft_volume;
-            }
+        case PA_SOURCE_OUTPUT_MESSAGE_SET_SOFT_VOLUME: {
+            const pa_cvolume *v = userdata ? userdata : &o->soft_volume;
+
+            if (!pa_cvolume_equal(&o->thread_info.soft_volume, v))
+                o->thread_info.soft_volume = *v;
             return 0;
+        }
 
         case PA_SOURCE_OUTPUT_MESSAGE_SET_SOFT_MUTE:
             if (o->thread_info.muted != o->muted) {
@@ -1738,7 +1808,7 @@ int pa_source_output_update_rate(pa_source_output *o) {
          !pa_sample_spec_equal(&o->sample_spec, &o->source->sample_spec) ||
          !pa_channel_map_equal(&o->channel_map, &o->source->channel_map))) {
 
-        new_resampler = pa_resampler_new(o->core->mempool,
+        new_resampler = pa_resampler_cache_get(&o->core->resampler_cache, o->core->mempool,
                                      &o->source->sample_spec, &o->source->channel_map,
                                      &o->sample_spec, &o->channel_map,
                                      o->core->lfe_crossover_freq,
@@ -1760,7 +1830,7 @@ int pa_source_output_update_rate(pa_source_output *o) {
         return 0;
 
     if (o->thread_info.resampler)
-        pa_resampler_free(o->thread_info.resampler);
+        pa_resampler_cache_put(&o->core->resampler_cache, o->thread_info.resampler);
 
     o->thread_info.resampler = new_resampler;
 
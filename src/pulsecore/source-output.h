@@ -26,6 +26,7 @@
 #include <pulse/sample.h>
 #include <pulse/format.h>
 #include <pulsecore/memblockq.h>
+#include <pulsecore/render-profile.h>
 #include <pulsecore/resampler.h>
 #include <pulsecore/module.h>
 #include <pulsecore/client.h>
@@ -62,6 +63,11 @@ typedef enum pa_source_output_flags {
 struct pa_source_output {
     pa_msgobject parent;
 
+    /* The reference counter in parent is changed from the IO thread
+     * too. Main thread fields follow, then thread_info, each starting
+     * on their own cache line. */
+    PA_CACHELINE_PAD(_pad_ref);
+
     uint32_t index;
     pa_core *core;
 
@@ -187,6 +193,14 @@ struct pa_source_output {
      * mute status changes. Called from main context */
     void (*mute_changed)(pa_source_output *o); /* may be NULL */
 
+    /* Copy of thread_info.render_profile, updated by
+     * pa_source_update_render_profile() */
+    pa_render_profile render_profile[PA_RENDER_STAGE_MAX];
+
+    void *userdata;
+
+    PA_CACHELINE_PAD(_pad_thread_info);
+
     struct {
         pa_source_output_state_t state;
 
@@ -199,6 +213,12 @@ struct pa_source_output {
 
         pa_resampler* resampler;              /* may be NULL */
 
+        /* Set by the source if other outputs use a resampler with the
+         * same configuration. fanout_shared is true while the output
+         * is fed from that shared resampler instead of its own. */
+        pa_source_fanout *fanout;
+        bool fanout_shared:1;
+
         /* We maintain a delay memblockq here for source outputs that
          * don't implement rewind() */
         pa_memblockq *delay_memblockq;
@@ -207,9 +227,9 @@ struct pa_source_output {
         pa_usec_t requested_source_latency;
 
         pa_sink_input *direct_on_input;       /* may be NULL */
-    } thread_info;
 
-    void *userdata;
+        pa_render_profile render_profile[PA_RENDER_STAGE_MAX];
+    } thread_info;
 };
 
 PA_DECLARE_PUBLIC_CLASS(pa_source_output);
@@ -340,6 +360,12 @@ pa_usec_t pa_source_output_get_requested_latency(pa_source_output *o);
 /* To be used exclusively by the source driver thread */
 
 void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk);
+/* Whether the output may be fed data converted by r instead of its own
+ * resampler at this point. If so, *volume is set to what has to be
+ * applied to the data before it goes through r. */
+bool pa_source_output_can_share_resampler(pa_source_output *o, pa_resampler *r, pa_cvolume *volume);
+/* Hands already converted data to an output fed from a shared resampler */
+void pa_source_output_push_shared(pa_source_output *o, const pa_memchunk *rchunk);
 void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes);
 void pa_source_output_update_max_rewind(pa_source_output *o, size_t nbytes);
 
@@ -47,6 +47,20 @@
 #define ABSOLUTE_MAX_LATENCY (10*PA_USEC_PER_SEC)
 #define DEFAULT_FIXED_LATENCY (250*PA_USEC_PER_MSEC)
 
+#define POST_OUTPUTS_INITIAL_SIZE 8
+
+/* A resampler run once per posted chunk on behalf of all post outputs
+ * whose own resamplers have the same configuration */
+struct pa_source_fanout {
+    pa_resampler *resampler;
+    unsigned n_outputs; /* assigned outputs */
+    unsigned n_active; /* outputs actually fed from it for the current chunk */
+    pa_cvolume volume; /* applied once before resampling for the current chunk */
+    bool idle:1; /* was not run for the last chunk, its history is stale */
+
+    PA_LLIST_FIELDS(pa_source_fanout);
+};
+
 PA_DEFINE_PUBLIC_CLASS(pa_source, pa_msgobject);
 
 struct pa_source_volume_change {
@@ -65,6 +79,7 @@ static void source_free(pa_object *o);
 
 static void pa_source_volume_change_push(pa_source *s);
 static void pa_source_volume_change_flush(pa_source *s);
+static void fanout_free(pa_source *s, pa_source_fanout *f);
 
 pa_source_new_data* pa_source_new_data_init(pa_source_new_data *data) {
     pa_assert(data);
@@ -148,6 +163,7 @@ static void reset_callbacks(pa_source *s) {
     s->get_mute = NULL;
     s->set_mute = NULL;
     s->update_requested_latency = NULL;
+    s->cpu_overload = NULL;
     s->set_port = NULL;
     s->get_formats = NULL;
     s->reconfigure = NULL;
@@ -302,6 +318,11 @@ pa_source* pa_source_new(
     else
         s->port_latency_offset = 0;
 
+    s->latency_smoother = NULL;
+    pa_atomic_store(&s->latency_base.seq, 0);
+    s->latency_base.valid = false;
+    s->latency_base.usec = 0;
+
     s->save_volume = data->save_volume;
     s->save_muted = data->save_muted;
 
@@ -315,6 +336,12 @@ pa_source* pa_source_new(
     s->thread_info.rtpoll = NULL;
     s->thread_info.outputs = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL,
                                                  (pa_free_cb_t) pa_source_output_unref);
+    s->thread_info.post_outputs_size = POST_OUTPUTS_INITIAL_SIZE;
+    s->thread_info.post_outputs = pa_xnew(pa_source_output*, s->thread_info.post_outputs_size);
+    s->thread_info.n_post_outputs = 0;
+    PA_LLIST_HEAD_INIT(pa_source_fanout, s->thread_info.fanouts);
+    PA_LLIST_HEAD_INIT(pa_meter, s->thread_info.meters);
+    pa_cpu_budget_init(&s->thread_info.cpu_budget, core->io_thread_cpu_budget);
     s->thread_info.soft_volume = s->soft_volume;
     s->thread_info.soft_muted = s->muted;
     s->thread_info.state = s->state;
@@ -675,6 +702,10 @@ static void source_free(pa_object *o) {
 
     pa_idxset_free(s->outputs, NULL);
     pa_hashmap_free(s->thread_info.outputs);
+    pa_xfree(s->thread_info.post_outputs);
+
+    while (s->thread_info.fanouts)
+        fanout_free(s, s->thread_info.fanouts);
 
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
@@ -908,10 +939,269 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
 }
 
 /* Called from IO thread context */
-void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
+static pa_source_fanout *fanout_new(pa_source *s, pa_resampler *r) {
+    pa_source_fanout *f;
+    pa_resampler *resampler;
+
+    if (!(resampler = pa_resampler_new(s->core->mempool, &r->i_ss, &r->i_cm, &r->o_ss, &r->o_cm,
+                                       s->core->lfe_crossover_freq, r->method, r->flags)))
+        return NULL;
+
+    f = pa_xnew0(pa_source_fanout, 1);
+    f->resampler = resampler;
+    f->idle = true;
+
+    PA_LLIST_PREPEND(pa_source_fanout, s->thread_info.fanouts, f);
+
+    return f;
+}
+
+static void fanout_free(pa_source *s, pa_source_fanout *f) {
+    PA_LLIST_REMOVE(pa_source_fanout, s->thread_info.fanouts, f);
+
+    pa_resampler_free(f->resampler);
+    pa_xfree(f);
+}
+
+/* Called from IO thread context */
+static void fanout_leave(pa_source_output *o) {
+
+    /* The output's own resampler hasn't seen the data that went
+     * through the shared one */
+    if (o->thread_info.fanout_shared && o->thread_info.resampler)
+        pa_resampler_reset(o->thread_info.resampler);
+
+    o->thread_info.fanout = NULL;
+    o->thread_info.fanout_shared = false;
+}
+
+/* Called from IO thread context. Groups the post outputs by the
+ * configuration of their resamplers. Existing groups are kept where
+ * possible, so that rebuilding doesn't disturb the shared streams. */
+static void update_fanouts(pa_source *s) {
+    pa_source_fanout *f, *next;
+    unsigned j, k, n;
+
+    n = s->thread_info.n_post_outputs;
+
+    PA_LLIST_FOREACH(f, s->thread_info.fanouts)
+        f->n_outputs = 0;
+
+    for (j = 0; j < n; j++) {
+        pa_source_output *o = s->thread_info.post_outputs[j];
+        pa_resampler *r = o->thread_info.resampler;
+
+        if (!r || (r->flags & PA_RESAMPLER_VARIABLE_RATE))
+            continue;
+
+        PA_LLIST_FOREACH(f, s->thread_info.fanouts)
+            if (pa_resampler_same_config(r, f->resampler))
+                break;
+
+        if (!f) {
+            /* Only worth it if some other output would join */
+            for (k = j + 1; k < n; k++)
+                if (s->thread_info.post_outputs[k]->thread_info.resampler &&
+                    pa_resampler_same_config(r, s->thread_info.post_outputs[k]->thread_info.resampler))
+                    break;
+
+            if (k >= n || !(f = fanout_new(s, r)))
+                continue;
+        }
+
+        o->thread_info.fanout = f;
+        f->n_outputs++;
+    }
+
+    PA_LLIST_FOREACH_SAFE(f, next, s->thread_info.fanouts) {
+        if (f->n_outputs >= 2)
+            continue;
+
+        for (j = 0; j < n; j++)
+            if (s->thread_info.post_outputs[j]->thread_info.fanout == f)
+                s->thread_info.post_outputs[j]->thread_info.fanout = NULL;
+
+        fanout_free(s, f);
+    }
+}
+
+/* Called from IO thread context. Whether o is fed from its fanout for the
+ * current chunk. The first eligible output decides on the volume of the
+ * group, outputs with a different one take their own path. */
+static bool fanout_join(pa_source_output *o) {
+    pa_source_fanout *f;
+    pa_cvolume v;
+
+    if (!(f = o->thread_info.fanout) || !pa_source_output_can_share_resampler(o, f->resampler, &v))
+        return false;
+
+    if (f->n_active == 0) {
+        f->volume = v;
+        return true;
+    }
+
+    return pa_cvolume_equal(&v, &f->volume);
+}
+
+/* Called from IO thread context. Runs each shared resampler once, after
+ * applying the group's volume, and hands the result to all outputs fed
+ * from it, the remaining outputs get the chunk as usual. */
+static void post_outputs(pa_source *s, const pa_memchunk *chunk) {
+    pa_source_fanout *f;
+    unsigned k;
+
+    if (!s->thread_info.fanouts) {
+        for (k = 0; k < s->thread_info.n_post_outputs; k++)
+            pa_source_output_push(s->thread_info.post_outputs[k], chunk);
+
+        return;
+    }
+
+    PA_LLIST_FOREACH(f, s->thread_info.fanouts)
+        f->n_active = 0;
+
+    for (k = 0; k < s->thread_info.n_post_outputs; k++) {
+        pa_source_output *o = s->thread_info.post_outputs[k];
+
+        if (fanout_join(o))
+            o->thread_info.fanout->n_active++;
+    }
+
+    for (k = 0; k < s->thread_info.n_post_outputs; k++) {
+        pa_source_output *o = s->thread_info.post_outputs[k];
+        bool shared;
+
+        shared = (f = o->thread_info.fanout) &&
+            f->n_active >= 2 &&
+            fanout_join(o);
+
+        if (!shared) {
+            if (o->thread_info.fanout_shared) {
+                pa_resampler_reset(o->thread_info.resampler);
+                o->thread_info.fanout_shared = false;
+            }
+
+            pa_source_output_push(o, chunk);
+        } else
+            o->thread_info.fanout_shared = true;
+    }
+
+    PA_LLIST_FOREACH(f, s->thread_info.fanouts) {
+        pa_memchunk ichunk, vchunk;
+        size_t mbs;
+        pa_usec_t start;
+
+        if (f->n_active < 2) {
+            f->idle = true;
+            continue;
+        }
+
+        if (f->idle) {
+            pa_resampler_reset(f->resampler);
+            f->idle = false;
+        }
+
+        mbs = pa_resampler_max_block_size(f->resampler);
+        ichunk = *chunk;
+        pa_memchunk_reset(&vchunk);
+
+        if (!pa_cvolume_is_norm(&f->volume)) {
+            vchunk = *chunk;
+            pa_memblock_ref(vchunk.memblock);
+            pa_memchunk_make_writable(&vchunk, 0);
+
+            if (pa_cvolume_is_muted(&f->volume))
+                pa_silence_memchunk(&vchunk, &s->sample_spec);
+            else
+                pa_volume_memchunk(&vchunk, &s->sample_spec, &f->volume);
+
+            ichunk = vchunk;
+        }
+
+        while (ichunk.length > 0) {
+            pa_memchunk in = ichunk, rchunk;
+
+            if (in.length > mbs)
+                in.length = mbs;
+
+            start = pa_render_profile_start();
+            pa_resampler_run(f->resampler, &in, &rchunk);
+            pa_render_profile_stop(&s->thread_info.render_profile[PA_RENDER_STAGE_RESAMPLE], start);
+
+            if (rchunk.length > 0) {
+                for (k = 0; k < s->thread_info.n_post_outputs; k++) {
+                    pa_source_output *o = s->thread_info.post_outputs[k];
+
+                    if (o->thread_info.fanout == f && o->thread_info.fanout_shared)
+                        pa_source_output_push_shared(o, &rchunk);
+                }
+            }
+
+            if (rchunk.memblock)
+                pa_memblock_unref(rchunk.memblock);
+
+            ichunk.index += in.length;
+            ichunk.length -= in.length;
+        }
+
+        if (vchunk.memblock)
+            pa_memblock_unref(vchunk.memblock);
+    }
+}
+
+/* Called from IO thread context, see source.h */
+void pa_source_update_post_outputs(pa_source *s) {
+    pa_source_output *o;
+    void *state;
+    unsigned n;
+
+    pa_source_assert_ref(s);
+    pa_source_assert_io_context(s);
+
+    n = pa_hashmap_size(s->thread_info.outputs);
+
+    if (n > s->thread_info.post_outputs_size) {
+        while (s->thread_info.post_outputs_size < n)
+            s->thread_info.post_outputs_size *= 2;
+
+        s->thread_info.post_outputs = pa_xrenew(pa_source_output*, s->thread_info.post_outputs, s->thread_info.post_outputs_size);
+    }
+
+    n = 0;
+    PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
+        fanout_leave(o);
+
+        if (!o->thread_info.direct_on_input && o->thread_info.state != PA_SOURCE_OUTPUT_CORKED)
+            s->thread_info.post_outputs[n++] = o;
+    }
+
+    s->thread_info.n_post_outputs = n;
+
+    update_fanouts(s);
+}
+
+/* Called from IO thread context */
+static void check_cpu_budget(pa_source *s) {
     pa_source_output *o;
     void *state = NULL;
 
+    if (!pa_cpu_budget_test(&s->thread_info.cpu_budget))
+        return;
+
+    pa_log_warn("IO thread of source %s is over its CPU budget, lowering quality.", s->name);
+
+    PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
+        if (o->thread_info.resampler)
+            pa_resampler_lower_quality(o->thread_info.resampler);
+
+    if (s->cpu_overload)
+        s->cpu_overload(s);
+}
+
+/* Called from IO thread context */
+void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
+    pa_usec_t start;
+
     pa_source_assert_ref(s);
     pa_source_assert_io_context(s);
     pa_assert(PA_SOURCE_IS_LINKED(s->thread_info.state));
@@ -920,6 +1210,28 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
     if (s->thread_info.state == PA_SOURCE_SUSPENDED)
         return;
 
+    check_cpu_budget(s);
+
+    if (s->thread_info.meters) {
+        pa_cvolume muted;
+        pa_meter *m;
+
+        /* The meters apply the volume while measuring */
+        if (s->thread_info.soft_muted)
+            pa_cvolume_mute(&muted, s->sample_spec.channels);
+
+        PA_LLIST_FOREACH(m, s->thread_info.meters)
+            pa_meter_process(m, chunk, &s->sample_spec, s->thread_info.soft_muted ? &muted : &s->thread_info.soft_volume);
+    }
+
+    /* Nobody to post to: don't bother applying the volume. Outputs that
+     * are attached directly to a sink input get their data through
+     * pa_source_post_direct() instead. */
+    if (s->thread_info.n_post_outputs == 0)
+        return;
+
+    start = pa_render_profile_start();
+
     if (s->thread_info.soft_muted || !pa_cvolume_is_norm(&s->thread_info.soft_volume)) {
         pa_memchunk vchunk = *chunk;
 
@@ -931,23 +1243,13 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
         else
             pa_volume_memchunk(&vchunk, &s->sample_spec, &s->thread_info.soft_volume);
 
-        while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
-            pa_source_output_assert_ref(o);
-
-            if (!o->thread_info.direct_on_input)
-                pa_source_output_push(o, &vchunk);
-        }
+        post_outputs(s, &vchunk);
 
         pa_memblock_unref(vchunk.memblock);
-    } else {
-
-        while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
-            pa_source_output_assert_ref(o);
+    } else
+        post_outputs(s, chunk);
 
-            if (!o->thread_info.direct_on_input)
-                pa_source_output_push(o, chunk);
-        }
-    }
+    pa_render_profile_stop(&s->thread_info.render_profile[PA_RENDER_STAGE_SOURCE_POST], start);
 }
 
 /* Called from IO thread context */
@@ -1107,6 +1409,31 @@ int pa_source_reconfigure(pa_source *s, pa_sample_spec *spec, bool passthrough)
     return ret;
 }
 
+/* Called from main thread. Calculates the latency from what the IO
+ * thread published last, see pa_source_set_latency_smoother(). */
+static bool get_latency_concurrent(pa_source *s, int64_t *usec) {
+    pa_usec_t recorded;
+    int64_t base;
+    bool valid;
+    int seq;
+
+    seq = pa_atomic_load(&s->latency_base.seq);
+    if (seq & 1)
+        return false;
+
+    valid = s->latency_base.valid;
+    base = s->latency_base.usec;
+
+    if (pa_atomic_load(&s->latency_base.seq) != seq || !valid)
+        return false;
+
+    if (!pa_smoother_get_concurrent(s->latency_smoother, pa_rtclock_now(), &recorded))
+        return false;
+
+    *usec = (int64_t) recorded - base;
+    return true;
+}
+
 /* Called from main thread */
 pa_usec_t pa_source_get_latency(pa_source *s) {
     int64_t usec;
@@ -1121,7 +1448,8 @@ pa_usec_t pa_source_get_latency(pa_source *s) {
     if (!(s->flags & PA_SOURCE_LATENCY))
         return 0;
 
-    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_GET_LATENCY, &usec, 0, NULL) == 0);
+    if (!s->latency_smoother || !get_latency_concurrent(s, &usec))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_GET_LATENCY, &usec, 0, NULL) == 0);
 
     /* The return value is unsigned, so check that the offset can be added to usec without
      * underflowing. */
@@ -2065,6 +2393,7 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
             pa_source_output_attach(o);
 
             pa_source_output_set_state_within_thread(o, o->state);
+            pa_source_update_post_outputs(s);
 
             if (o->thread_info.requested_source_latency != (pa_usec_t) -1)
                 pa_source_output_set_requested_latency_within_thread(o, o->thread_info.requested_source_latency);
@@ -2093,7 +2422,9 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
                 o->thread_info.direct_on_input = NULL;
             }
 
+            fanout_leave(o);
             pa_hashmap_remove_and_free(s->thread_info.outputs, PA_UINT32_TO_PTR(o->index));
+            pa_source_update_post_outputs(s);
             pa_source_invalidate_requested_latency(s, true);
 
             /* In flat volume mode we need to update the volume as
@@ -2229,6 +2560,28 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
             *((size_t*) userdata) = s->thread_info.max_rewind;
             return 0;
 
+        case PA_SOURCE_MESSAGE_GET_RENDER_PROFILE: {
+            pa_source_output *o;
+            void *state = NULL;
+
+            /* The main thread is waiting for us, so we can write to
+             * the copies it owns */
+            memcpy(s->render_profile, s->thread_info.render_profile, sizeof(s->render_profile));
+
+            PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
+                memcpy(o->render_profile, o->thread_info.render_profile, sizeof(o->render_profile));
+
+            return 0;
+        }
+
+        case PA_SOURCE_MESSAGE_ADD_METER:
+            PA_LLIST_PREPEND(pa_meter, s->thread_info.meters, (pa_meter*) userdata);
+            return 0;
+
+        case PA_SOURCE_MESSAGE_REMOVE_METER:
+            PA_LLIST_REMOVE(pa_meter, s->thread_info.meters, (pa_meter*) userdata);
+            return 0;
+
         case PA_SOURCE_MESSAGE_SET_MAX_REWIND:
 
             pa_source_set_max_rewind_within_thread(s, (size_t) offset);
@@ -2590,6 +2943,32 @@ void pa_source_set_fixed_latency_within_thread(pa_source *s, pa_usec_t latency)
     pa_source_invalidate_requested_latency(s, false);
 }
 
+/* Called from main context, before the source is put. The smoother must
+ * stay around as long as the source does. */
+void pa_source_set_latency_smoother(pa_source *s, pa_smoother *smoother) {
+    pa_source_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(s->state == PA_SOURCE_INIT);
+
+    s->latency_smoother = smoother;
+}
+
+/* Called from IO thread context, see source.h */
+void pa_source_set_latency_base_within_thread(pa_source *s, bool valid, int64_t usec) {
+    pa_source_assert_ref(s);
+    pa_source_assert_io_context(s);
+    pa_assert(s->latency_smoother);
+
+    if (s->latency_base.valid == valid && s->latency_base.usec == usec)
+        return;
+
+    /* Make the sequence number odd while we write */
+    pa_atomic_inc(&s->latency_base.seq);
+    s->latency_base.valid = valid;
+    s->latency_base.usec = usec;
+    pa_atomic_inc(&s->latency_base.seq);
+}
+
 /* Called from main thread */
 void pa_source_set_port_latency_offset(pa_source *s, int64_t offset) {
     pa_source_assert_ref(s);
@@ -2604,6 +2983,43 @@ void pa_source_set_port_latency_offset(pa_source *s, int64_t offset) {
     pa_hook_fire(&s->core->hooks[PA_CORE_HOOK_SOURCE_PORT_LATENCY_OFFSET_CHANGED], s);
 }
 
+/* Called from main thread. Refreshes the render_profile copies of the
+ * source and of all of its outputs. */
+void pa_source_update_render_profile(pa_source *s) {
+    pa_assert_ctl_context();
+    pa_source_assert_ref(s);
+
+    if (!PA_SOURCE_IS_LINKED(s->state))
+        return;
+
+    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_GET_RENDER_PROFILE, NULL, 0, NULL) == 0);
+}
+
+/* Called from main thread. m is fed with everything posted to the
+ * source, until it is removed with pa_source_remove_meter(). */
+void pa_source_add_meter(pa_source *s, pa_meter *m) {
+    pa_assert_ctl_context();
+    pa_source_assert_ref(s);
+    pa_assert(m);
+
+    if (PA_SOURCE_IS_LINKED(s->state))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_ADD_METER, m, 0, NULL) == 0);
+    else
+        PA_LLIST_PREPEND(pa_meter, s->thread_info.meters, m);
+}
+
+/* Called from main thread */
+void pa_source_remove_meter(pa_source *s, pa_meter *m) {
+    pa_assert_ctl_context();
+    pa_source_assert_ref(s);
+    pa_assert(m);
+
+    if (PA_SOURCE_IS_LINKED(s->state))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_REMOVE_METER, m, 0, NULL) == 0);
+    else
+        PA_LLIST_REMOVE(pa_meter, s->thread_info.meters, m);
+}
+
 /* Called from main thread */
 size_t pa_source_get_max_rewind(pa_source *s) {
     size_t r;
@@ -34,14 +34,18 @@
 #include <pulsecore/core.h>
 #include <pulsecore/idxset.h>
 #include <pulsecore/memchunk.h>
+#include <pulsecore/meter.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/module.h>
 #include <pulsecore/asyncmsgq.h>
 #include <pulsecore/msgobject.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/card.h>
+#include <pulsecore/cpu-budget.h>
 #include <pulsecore/device-port.h>
 #include <pulsecore/queue.h>
+#include <pulsecore/render-profile.h>
+#include <pulsecore/time-smoother.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/source-output.h>
 
@@ -60,6 +64,11 @@ typedef int (*pa_source_get_mute_cb_t)(pa_source *s, bool *mute);
 struct pa_source {
     pa_msgobject parent;
 
+    /* The reference counter in parent is changed from the IO thread
+     * too. Main thread fields follow, then thread_info, each starting
+     * on their own cache line. */
+    PA_CACHELINE_PAD(_pad_ref);
+
     uint32_t index;
     pa_core *core;
 
@@ -121,6 +130,17 @@ struct pa_source {
     /* The latency offset is inherited from the currently active port */
     int64_t port_latency_offset;
 
+    /* If set, the latency is the smoother's estimate minus latency_base,
+     * and pa_source_get_latency() calculates it without asking the IO
+     * thread. latency_base is updated by the IO thread, seq is odd while
+     * that happens. */
+    pa_smoother *latency_smoother;
+    struct {
+        pa_atomic_t seq;
+        bool valid;
+        int64_t usec;
+    } latency_base;
+
     unsigned priority;
 
     bool set_mute_in_progress;
@@ -194,6 +214,12 @@ struct pa_source {
      * thread context. */
     pa_source_cb_t update_requested_latency; /* may be NULL */
 
+    /* Called when the IO thread used more CPU time than its budget, see
+     * cpu-budget.h, after the resamplers of the outputs have been made
+     * cheaper. May trade latency for fewer wakeups. Called from IO
+     * thread context. */
+    pa_source_cb_t cpu_overload; /* may be NULL */
+
     /* Called whenever the port shall be changed. Called from IO
      * thread if deferred volumes are enabled, and main thread otherwise. */
     int (*set_port)(pa_source *s, pa_device_port *port); /*ditto */
@@ -206,12 +232,32 @@ struct pa_source {
      * main thread. */
     int (*reconfigure)(pa_source *s, pa_sample_spec *spec, bool passthrough);
 
+    /* Copy of thread_info.render_profile, updated by
+     * pa_source_update_render_profile() */
+    pa_render_profile render_profile[PA_RENDER_STAGE_MAX];
+
+    void *userdata;
+
+    PA_CACHELINE_PAD(_pad_thread_info);
+
     /* Contains copies of the above data so that the real-time worker
      * thread can work without access locking */
     struct {
         pa_source_state_t state;
         pa_hashmap *outputs;
 
+        /* The uncorked outputs from the hashmap above that are not
+         * connected to a specific sink input, as a plain array for
+         * pa_source_post(). It is rebuilt whenever the hashmap or the
+         * state of an output changes. */
+        pa_source_output **post_outputs;
+        unsigned n_post_outputs, post_outputs_size;
+
+        /* Resamplers shared by post outputs that would all convert
+         * the captured data the same way. Rebuilt together with
+         * post_outputs, see pa_source_post(). */
+        PA_LLIST_HEAD(pa_source_fanout, fanouts);
+
         pa_rtpoll *rtpoll;
 
         pa_cvolume soft_volume;
@@ -246,9 +292,13 @@ struct pa_source {
         uint32_t volume_change_safety_margin;
         /* Usec delay added to all volume change events, may be negative. */
         int32_t volume_change_extra_delay;
-    } thread_info;
 
-    void *userdata;
+        pa_render_profile render_profile[PA_RENDER_STAGE_MAX];
+        pa_cpu_budget cpu_budget;
+
+        /* Fed with everything posted to the source */
+        PA_LLIST_HEAD(pa_meter, meters);
+    } thread_info;
 };
 
 PA_DECLARE_PUBLIC_CLASS(pa_source);
@@ -276,6 +326,9 @@ typedef enum pa_source_message {
     PA_SOURCE_MESSAGE_SET_PORT,
     PA_SOURCE_MESSAGE_UPDATE_VOLUME_AND_MUTE,
     PA_SOURCE_MESSAGE_SET_PORT_LATENCY_OFFSET,
+    PA_SOURCE_MESSAGE_GET_RENDER_PROFILE,
+    PA_SOURCE_MESSAGE_ADD_METER,
+    PA_SOURCE_MESSAGE_REMOVE_METER,
     PA_SOURCE_MESSAGE_MAX
 } pa_source_message_t;
 
@@ -345,6 +398,7 @@ void pa_source_set_rtpoll(pa_source *s, pa_rtpoll *p);
 void pa_source_set_max_rewind(pa_source *s, size_t max_rewind);
 void pa_source_set_latency_range(pa_source *s, pa_usec_t min_latency, pa_usec_t max_latency);
 void pa_source_set_fixed_latency(pa_source *s, pa_usec_t latency);
+void pa_source_set_latency_smoother(pa_source *s, pa_smoother *smoother);
 
 void pa_source_set_soft_volume(pa_source *s, const pa_cvolume *volume);
 void pa_source_volume_changed(pa_source *s, const pa_cvolume *new_volume);
@@ -365,6 +419,9 @@ void pa_source_get_latency_range(pa_source *s, pa_usec_t *min_latency, pa_usec_t
 pa_usec_t pa_source_get_fixed_latency(pa_source *s);
 
 size_t pa_source_get_max_rewind(pa_source *s);
+void pa_source_update_render_profile(pa_source *s);
+void pa_source_add_meter(pa_source *s, pa_meter *m);
+void pa_source_remove_meter(pa_source *s, pa_meter *m);
 
 int pa_source_update_status(pa_source*s);
 int pa_source_suspend(pa_source *s, bool suspend, pa_suspend_cause_t cause);
@@ -440,6 +497,10 @@ void pa_source_set_max_rewind_within_thread(pa_source *s, size_t max_rewind);
 void pa_source_set_latency_range_within_thread(pa_source *s, pa_usec_t min_latency, pa_usec_t max_latency);
 void pa_source_set_fixed_latency_within_thread(pa_source *s, pa_usec_t latency);
 
+/* For sources with a latency smoother: the latency is the smoother's
+ * estimate minus usec from now on, or unknown if !valid */
+void pa_source_set_latency_base_within_thread(pa_source *s, bool valid, int64_t usec);
+
 void pa_source_update_volume_and_mute(pa_source *s);
 
 bool pa_source_volume_change_apply(pa_source *s, pa_usec_t *usec_to_next);
@@ -456,6 +517,10 @@ int64_t pa_source_get_latency_within_thread(pa_source *s, bool allow_negative);
  * sets s->reference_volume and fires change notifications. */
 void pa_source_set_reference_volume_direct(pa_source *s, const pa_cvolume *volume);
 
+/* Called from the IO thread, from source-output.c only, when the state of an
+ * attached output has changed. */
+void pa_source_update_post_outputs(pa_source *s);
+
 #define pa_source_assert_io_context(s) \
     pa_assert(pa_thread_mq_get() || !PA_SOURCE_IS_LINKED((s)->state))
 
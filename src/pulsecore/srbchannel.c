@@ -24,57 +24,11 @@
 #include "srbchannel.h"
 
 #include <pulsecore/atomic.h>
+#include <pulsecore/ringbuffer.h>
 #include <pulse/xmalloc.h>
 
 /* #define DEBUG_SRBCHANNEL */
 
-/* This ringbuffer might be useful in other contexts too, but
- * right now it's only used inside the srbchannel, so let's keep it here
- * for the time being. */
-typedef struct pa_ringbuffer pa_ringbuffer;
-
-struct pa_ringbuffer {
-    pa_atomic_t *count; /* amount of data in the buffer */
-    int capacity;
-    uint8_t *memory;
-    int readindex, writeindex;
-};
-
-static void *pa_ringbuffer_peek(pa_ringbuffer *r, int *count) {
-    int c = pa_atomic_load(r->count);
-
-    if (r->readindex + c > r->capacity)
-        *count = r->capacity - r->readindex;
-    else
-        *count = c;
-
-    return r->memory + r->readindex;
-}
-
-/* Returns true only if the buffer was completely full before the drop. */
-static bool pa_ringbuffer_drop(pa_ringbuffer *r, int count) {
-    bool b = pa_atomic_sub(r->count, count) >= r->capacity;
-
-    r->readindex += count;
-    r->readindex %= r->capacity;
-
-    return b;
-}
-
-static void *pa_ringbuffer_begin_write(pa_ringbuffer *r, int *count) {
-    int c = pa_atomic_load(r->count);
-
-    *count = PA_MIN(r->capacity - r->writeindex, r->capacity - c);
-
-    return r->memory + r->writeindex;
-}
-
-static void pa_ringbuffer_end_write(pa_ringbuffer *r, int count) {
-    pa_atomic_add(r->count, count);
-    r->writeindex += count;
-    r->writeindex %= r->capacity;
-}
-
 struct pa_srbchannel {
     pa_ringbuffer rb_read, rb_write;
     pa_fdsem *sem_read, *sem_write;
@@ -95,10 +49,18 @@ struct pa_srbchannel {
  *    side to read it
  * 2) We have read something from our receive buffer that was previously
  *    completely full, and want the other side to continue writing
+ *
+ * In both cases we only signal on the transition: the reader consumes the
+ * buffer until it is empty before it polls again, so data written to a
+ * non-empty buffer will be picked up without a separate wakeup. pa_fdsem
+ * itself only touches the eventfd if the other side has announced that it
+ * is about to sleep (the waiting counter in the shared pa_fdsem_data), so
+ * while the reader is busy no syscalls are made at all.
 */
 
 size_t pa_srbchannel_write(pa_srbchannel *sr, const void *data, size_t l) {
     size_t written = 0;
+    bool was_empty = false;
 
     while (l > 0) {
         int towrite;
@@ -115,16 +77,19 @@ size_t pa_srbchannel_write(pa_srbchannel *sr, const void *data, size_t l) {
         }
 
         memcpy(ptr, data, towrite);
-        pa_ringbuffer_end_write(&sr->rb_write, towrite);
+        if (pa_ringbuffer_end_write(&sr->rb_write, towrite))
+            was_empty = true;
         written += towrite;
         data = (uint8_t*) data + towrite;
         l -= towrite;
     }
+    if (was_empty) {
 #ifdef DEBUG_SRBCHANNEL
-    pa_log("Wrote %d bytes to srbchannel, signalling fdsem", (int) written);
+        pa_log("Wrote %d bytes to empty srbchannel, signalling fdsem", (int) written);
 #endif
+        pa_fdsem_post(sr->sem_write);
+    }
 
-    pa_fdsem_post(sr->sem_write);
     return written;
 }
 
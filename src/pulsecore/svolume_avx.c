@@ -0,0 +1,229 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/endianmacros.h>
+
+#include "cpu-x86.h"
+
+#include "sample-util.h"
+
+#if (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__)
+
+#include <immintrin.h>
+
+/* The functions in this file produce bit-identical results to the generic
+ * implementations in svolume_c.c. They are compiled with per-function target
+ * attributes, so no special compiler flags are needed.
+ *
+ * pa_volume_memchunk() repeats the per-channel factors into the padding
+ * after the last channel, so the factors for a whole vector can be loaded
+ * directly from the current channel position. The position advances by
+ * step = (samples per vector) % channels per iteration. */
+
+static inline unsigned advance_channel(unsigned channel, unsigned step, unsigned channels) {
+    channel += step;
+
+    if (channel >= channels)
+        channel -= channels;
+
+    return channel;
+}
+
+static void volume_s16ne_tail(int16_t *samples, const int32_t *volumes, unsigned channels, unsigned channel, unsigned n) {
+    for (; n > 0; n--, samples++) {
+        int32_t t = pa_mult_s16_volume(*samples, volumes[channel]);
+
+        *samples = (int16_t) PA_CLAMP_UNLIKELY(t, -0x8000, 0x7FFF);
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void volume_s16re_tail(int16_t *samples, const int32_t *volumes, unsigned channels, unsigned channel, unsigned n) {
+    for (; n > 0; n--, samples++) {
+        int32_t t = pa_mult_s16_volume(PA_INT16_SWAP(*samples), volumes[channel]);
+
+        t = PA_CLAMP_UNLIKELY(t, -0x8000, 0x7FFF);
+        *samples = PA_INT16_SWAP((int16_t) t);
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void volume_s32ne_tail(int32_t *samples, const int32_t *volumes, unsigned channels, unsigned channel, unsigned n) {
+    for (; n > 0; n--, samples++) {
+        int64_t t = ((int64_t) *samples * volumes[channel]) >> 16;
+
+        *samples = (int32_t) PA_CLAMP_UNLIKELY(t, -0x80000000LL, 0x7FFFFFFFLL);
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+static void volume_float32ne_tail(float *samples, const float *volumes, unsigned channels, unsigned channel, unsigned n) {
+    for (; n > 0; n--, samples++) {
+        *samples *= volumes[channel];
+
+        if (PA_UNLIKELY(++channel >= channels))
+            channel = 0;
+    }
+}
+
+/* (s * cv) >> 16 for 8 s16 samples, computed as s * hi + ((s * lo) >> 16)
+ * with hi and lo being the upper and lower 16 bits of the 32 bit factor,
+ * which is exactly what pa_mult_s16_volume() calculates. */
+__attribute__((target("avx2")))
+static inline __m256i mult_s16_volume_avx2(__m128i s, const int32_t *cv) {
+    __m256i v, s32;
+
+    v = _mm256_loadu_si256((const __m256i*) cv);
+    s32 = _mm256_cvtepi16_epi32(s);
+
+    return _mm256_add_epi32(
+            _mm256_mullo_epi32(s32, _mm256_srai_epi32(v, 16)),
+            _mm256_srai_epi32(_mm256_mullo_epi32(s32, _mm256_and_si256(v, _mm256_set1_epi32(0xFFFF))), 16));
+}
+
+/* 16 s16 samples, clamped by the saturating pack */
+__attribute__((target("avx2")))
+static inline __m256i volume_s16_avx2(__m256i s, const int32_t *cv) {
+    __m256i r;
+
+    r = _mm256_packs_epi32(mult_s16_volume_avx2(_mm256_castsi256_si128(s), cv),
+                           mult_s16_volume_avx2(_mm256_extracti128_si256(s, 1), cv + 8));
+
+    /* packs works on 128 bit lanes, restore the sample order */
+    return _mm256_permute4x64_epi64(r, 0xD8);
+}
+
+__attribute__((target("avx2")))
+static void pa_volume_s16ne_avx2(int16_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned channel = 0, step = 16 % channels, n;
+
+    length /= sizeof(int16_t);
+
+    for (n = length / 16; n > 0; n--, samples += 16) {
+        __m256i s = _mm256_loadu_si256((const __m256i*) samples);
+
+        _mm256_storeu_si256((__m256i*) samples, volume_s16_avx2(s, volumes + channel));
+
+        channel = advance_channel(channel, step, channels);
+    }
+
+    volume_s16ne_tail(samples, volumes, channels, channel, length % 16);
+}
+
+__attribute__((target("avx2")))
+static void pa_volume_s16re_avx2(int16_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned channel = 0, step = 16 % channels, n;
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+    length /= sizeof(int16_t);
+
+    for (n = length / 16; n > 0; n--, samples += 16) {
+        __m256i s = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) samples), swap);
+
+        _mm256_storeu_si256((__m256i*) samples, _mm256_shuffle_epi8(volume_s16_avx2(s, volumes + channel), swap));
+
+        channel = advance_channel(channel, step, channels);
+    }
+
+    volume_s16re_tail(samples, volumes, channels, channel, length % 16);
+}
+
+/* (s * cv) >> 16 for 4 s32 samples with 64 bit intermediates, clamped to
+ * 32 bits. AVX2 has no 64 bit arithmetic shift, so the sign is shifted in by
+ * hand. */
+__attribute__((target("avx2")))
+static inline __m128i volume_s32_avx2(__m128i s, const int32_t *cv) {
+    const __m256i max = _mm256_set1_epi64x(0x7FFFFFFFLL);
+    const __m256i min = _mm256_set1_epi64x(-0x80000000LL);
+    __m256i p, sign;
+
+    p = _mm256_mul_epi32(_mm256_cvtepi32_epi64(s), _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) cv)));
+    sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), p);
+    p = _mm256_or_si256(_mm256_srli_epi64(p, 16), _mm256_slli_epi64(sign, 48));
+
+    p = _mm256_blendv_epi8(p, max, _mm256_cmpgt_epi64(p, max));
+    p = _mm256_blendv_epi8(p, min, _mm256_cmpgt_epi64(min, p));
+
+    /* Pick the low 32 bits of each 64 bit lane */
+    return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(p, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7)));
+}
+
+__attribute__((target("avx2")))
+static void pa_volume_s32ne_avx2(int32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned channel = 0, step = 8 % channels, n;
+
+    length /= sizeof(int32_t);
+
+    for (n = length / 8; n > 0; n--, samples += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i*) samples);
+
+        _mm_storeu_si128((__m128i*) samples, volume_s32_avx2(_mm256_castsi256_si128(s), volumes + channel));
+        _mm_storeu_si128((__m128i*) (samples + 4), volume_s32_avx2(_mm256_extracti128_si256(s, 1), volumes + channel + 4));
+
+        channel = advance_channel(channel, step, channels);
+    }
+
+    volume_s32ne_tail(samples, volumes, channels, channel, length % 8);
+}
+
+__attribute__((target("avx")))
+static void pa_volume_float32ne_avx(float *samples, const float *volumes, unsigned channels, unsigned length) {
+    unsigned channel = 0, step = 8 % channels, n;
+
+    length /= sizeof(float);
+
+    for (n = length / 8; n > 0; n--, samples += 8) {
+        _mm256_storeu_ps(samples, _mm256_mul_ps(_mm256_loadu_ps(samples), _mm256_loadu_ps(volumes + channel)));
+
+        channel = advance_channel(channel, step, channels);
+    }
+
+    volume_float32ne_tail(samples, volumes, channels, channel, length % 8);
+}
+
+#endif /* (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__) */
+
+void pa_volume_func_init_avx(pa_cpu_x86_flag_t flags) {
+#if (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__)
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized volume functions.");
+
+        pa_set_volume_func(PA_SAMPLE_S16NE, (pa_do_volume_func_t) pa_volume_s16ne_avx2);
+        pa_set_volume_func(PA_SAMPLE_S16RE, (pa_do_volume_func_t) pa_volume_s16re_avx2);
+        pa_set_volume_func(PA_SAMPLE_S32NE, (pa_do_volume_func_t) pa_volume_s32ne_avx2);
+    }
+
+    if (flags & PA_CPU_X86_AVX) {
+        pa_log_info("Initialising AVX optimized float volume function.");
+
+        pa_set_volume_func(PA_SAMPLE_FLOAT32NE, (pa_do_volume_func_t) pa_volume_float32ne_avx);
+    }
+#endif /* (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__) */
+}
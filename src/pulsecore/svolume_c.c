@@ -242,6 +242,135 @@ static void pa_volume_s24_32re_c(uint32_t *samples, const int32_t *volumes, unsi
     }
 }
 
+/* Gain ramps. The factor for frame n is computed as volumes[c] + n *
+ * steps[c] rather than accumulated, so that the optimized versions can
+ * produce identical results. */
+
+static void advance_ramp(float *volumes, const float *steps, unsigned channels, unsigned frames) {
+    unsigned channel;
+
+    for (channel = 0; channel < channels; channel++)
+        volumes[channel] += (float) frames * steps[channel];
+}
+
+static void pa_volume_ramp_s16ne_c(int16_t *samples, float *volumes, const float *steps, unsigned channels, unsigned length) {
+    unsigned channel, frame;
+
+    length /= sizeof(int16_t);
+
+    for (channel = 0, frame = 0; length; length--) {
+        float t = (float) *samples * (volumes[channel] + (float) frame * steps[channel]);
+
+        t = PA_CLAMP_UNLIKELY(t, -32768.0f, 32767.0f);
+        *samples++ = (int16_t) t;
+
+        if (PA_UNLIKELY(++channel >= channels)) {
+            channel = 0;
+            frame++;
+        }
+    }
+
+    advance_ramp(volumes, steps, channels, frame);
+}
+
+static void pa_volume_ramp_s16re_c(int16_t *samples, float *volumes, const float *steps, unsigned channels, unsigned length) {
+    unsigned channel, frame;
+
+    length /= sizeof(int16_t);
+
+    for (channel = 0, frame = 0; length; length--) {
+        float t = (float) PA_INT16_SWAP(*samples) * (volumes[channel] + (float) frame * steps[channel]);
+
+        t = PA_CLAMP_UNLIKELY(t, -32768.0f, 32767.0f);
+        *samples++ = PA_INT16_SWAP((int16_t) t);
+
+        if (PA_UNLIKELY(++channel >= channels)) {
+            channel = 0;
+            frame++;
+        }
+    }
+
+    advance_ramp(volumes, steps, channels, frame);
+}
+
+static void pa_volume_ramp_float32ne_c(float *samples, float *volumes, const float *steps, unsigned channels, unsigned length) {
+    unsigned channel, frame;
+
+    length /= sizeof(float);
+
+    for (channel = 0, frame = 0; length; length--) {
+        *samples++ *= volumes[channel] + (float) frame * steps[channel];
+
+        if (PA_UNLIKELY(++channel >= channels)) {
+            channel = 0;
+            frame++;
+        }
+    }
+
+    advance_ramp(volumes, steps, channels, frame);
+}
+
+static void pa_volume_ramp_float32re_c(float *samples, float *volumes, const float *steps, unsigned channels, unsigned length) {
+    unsigned channel, frame;
+
+    length /= sizeof(float);
+
+    for (channel = 0, frame = 0; length; length--) {
+        float t;
+
+        t = PA_READ_FLOAT32RE(samples);
+        t *= volumes[channel] + (float) frame * steps[channel];
+        PA_WRITE_FLOAT32RE(samples++, t);
+
+        if (PA_UNLIKELY(++channel >= channels)) {
+            channel = 0;
+            frame++;
+        }
+    }
+
+    advance_ramp(volumes, steps, channels, frame);
+}
+
+static void pa_volume_ramp_s32ne_c(int32_t *samples, float *volumes, const float *steps, unsigned channels, unsigned length) {
+    unsigned channel, frame;
+
+    length /= sizeof(int32_t);
+
+    for (channel = 0, frame = 0; length; length--) {
+        double t = (double) *samples * (volumes[channel] + (float) frame * steps[channel]);
+
+        t = PA_CLAMP_UNLIKELY(t, -2147483648.0, 2147483647.0);
+        *samples++ = (int32_t) t;
+
+        if (PA_UNLIKELY(++channel >= channels)) {
+            channel = 0;
+            frame++;
+        }
+    }
+
+    advance_ramp(volumes, steps, channels, frame);
+}
+
+static void pa_volume_ramp_s32re_c(int32_t *samples, float *volumes, const float *steps, unsigned channels, unsigned length) {
+    unsigned channel, frame;
+
+    length /= sizeof(int32_t);
+
+    for (channel = 0, frame = 0; length; length--) {
+        double t = (double) PA_INT32_SWAP(*samples) * (volumes[channel] + (float) frame * steps[channel]);
+
+        t = PA_CLAMP_UNLIKELY(t, -2147483648.0, 2147483647.0);
+        *samples++ = PA_INT32_SWAP((int32_t) t);
+
+        if (PA_UNLIKELY(++channel >= channels)) {
+            channel = 0;
+            frame++;
+        }
+    }
+
+    advance_ramp(volumes, steps, channels, frame);
+}
+
 static pa_do_volume_func_t do_volume_table[] = {
     [PA_SAMPLE_U8]        = (pa_do_volume_func_t) pa_volume_u8_c,
     [PA_SAMPLE_ALAW]      = (pa_do_volume_func_t) pa_volume_alaw_c,
@@ -269,3 +398,26 @@ void pa_set_volume_func(pa_sample_format_t f, pa_do_volume_func_t func) {
 
     do_volume_table[f] = func;
 }
+
+/* The remaining formats are ramped through float32ne by
+ * pa_volume_memchunk_ramp() */
+static pa_do_volume_ramp_func_t do_volume_ramp_table[] = {
+    [PA_SAMPLE_S16NE]     = (pa_do_volume_ramp_func_t) pa_volume_ramp_s16ne_c,
+    [PA_SAMPLE_S16RE]     = (pa_do_volume_ramp_func_t) pa_volume_ramp_s16re_c,
+    [PA_SAMPLE_FLOAT32NE] = (pa_do_volume_ramp_func_t) pa_volume_ramp_float32ne_c,
+    [PA_SAMPLE_FLOAT32RE] = (pa_do_volume_ramp_func_t) pa_volume_ramp_float32re_c,
+    [PA_SAMPLE_S32NE]     = (pa_do_volume_ramp_func_t) pa_volume_ramp_s32ne_c,
+    [PA_SAMPLE_S32RE]     = (pa_do_volume_ramp_func_t) pa_volume_ramp_s32re_c,
+};
+
+pa_do_volume_ramp_func_t pa_get_volume_ramp_func(pa_sample_format_t f) {
+    pa_assert(pa_sample_format_valid(f));
+
+    return do_volume_ramp_table[f];
+}
+
+void pa_set_volume_ramp_func(pa_sample_format_t f, pa_do_volume_ramp_func_t func) {
+    pa_assert(pa_sample_format_valid(f));
+
+    do_volume_ramp_table[f] = func;
+}
@@ -34,6 +34,8 @@
 
 #if (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__)
 
+#include <immintrin.h>
+
 #define VOLUME_32x16(s,v)                  /* .. |   vh  |   vl  | */                   \
       " pxor %%xmm4, %%xmm4          \n\t" /* .. |    0  |    0  | */                   \
       " punpcklwd %%xmm4, "#s"       \n\t" /* .. |    0  |   p0  | */                   \
@@ -249,6 +251,141 @@ static void pa_volume_s16re_sse2(int16_t *samples, const int32_t *volumes, unsig
     );
 }
 
+/* Gain ramps, with the same results as the generic versions in
+ * svolume_c.c. Eight samples are processed per iteration, whose frame
+ * indices only advance uniformly if the channel count divides 8; other
+ * layouts are left to the scalar loops. */
+
+static void ramp_s16ne_tail(int16_t *samples, const float *volumes, const float *steps, unsigned channels, unsigned frame, unsigned n) {
+    unsigned channel;
+
+    for (channel = 0; n > 0; n--) {
+        float t = (float) *samples * (volumes[channel] + (float) frame * steps[channel]);
+
+        t = PA_CLAMP_UNLIKELY(t, -32768.0f, 32767.0f);
+        *samples++ = (int16_t) t;
+
+        if (PA_UNLIKELY(++channel >= channels)) {
+            channel = 0;
+            frame++;
+        }
+    }
+}
+
+static void ramp_float32ne_tail(float *samples, const float *volumes, const float *steps, unsigned channels, unsigned frame, unsigned n) {
+    unsigned channel;
+
+    for (channel = 0; n > 0; n--) {
+        *samples++ *= volumes[channel] + (float) frame * steps[channel];
+
+        if (PA_UNLIKELY(++channel >= channels)) {
+            channel = 0;
+            frame++;
+        }
+    }
+}
+
+/* Per lane start factor, step and frame index for 8 consecutive samples */
+static void ramp_lanes(const float *volumes, const float *steps, unsigned channels, float *v, float *s, float *f) {
+    unsigned k;
+
+    for (k = 0; k < 8; k++) {
+        v[k] = volumes[k % channels];
+        s[k] = steps[k % channels];
+        f[k] = (float) (k / channels);
+    }
+}
+
+static void advance_ramp(float *volumes, const float *steps, unsigned channels, unsigned frames) {
+    unsigned channel;
+
+    for (channel = 0; channel < channels; channel++)
+        volumes[channel] += (float) frames * steps[channel];
+}
+
+__attribute__((target("sse2")))
+static void pa_volume_ramp_s16ne_sse2(int16_t *samples, float *volumes, const float *steps, unsigned channels, unsigned length) {
+    float v[8], s[8], f[8];
+    __m128 v0, v1, s0, s1, f0, f1, inc;
+    const __m128 lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+    unsigned n, done = 0;
+
+    length /= sizeof(int16_t);
+
+    if (8 % channels == 0) {
+        ramp_lanes(volumes, steps, channels, v, s, f);
+
+        v0 = _mm_loadu_ps(v);
+        v1 = _mm_loadu_ps(v + 4);
+        s0 = _mm_loadu_ps(s);
+        s1 = _mm_loadu_ps(s + 4);
+        f0 = _mm_loadu_ps(f);
+        f1 = _mm_loadu_ps(f + 4);
+        inc = _mm_set1_ps((float) (8 / channels));
+
+        for (n = length / 8; n > 0; n--, samples += 8) {
+            __m128i x, a, b;
+            __m128 t0, t1;
+
+            x = _mm_loadu_si128((const __m128i*) samples);
+
+            /* Sign extend to 32 bit */
+            a = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+            b = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+            t0 = _mm_mul_ps(_mm_cvtepi32_ps(a), _mm_add_ps(v0, _mm_mul_ps(f0, s0)));
+            t1 = _mm_mul_ps(_mm_cvtepi32_ps(b), _mm_add_ps(v1, _mm_mul_ps(f1, s1)));
+
+            t0 = _mm_min_ps(_mm_max_ps(t0, lo), hi);
+            t1 = _mm_min_ps(_mm_max_ps(t1, lo), hi);
+
+            _mm_storeu_si128((__m128i*) samples, _mm_packs_epi32(_mm_cvttps_epi32(t0), _mm_cvttps_epi32(t1)));
+
+            f0 = _mm_add_ps(f0, inc);
+            f1 = _mm_add_ps(f1, inc);
+        }
+
+        done = length - length % 8;
+    }
+
+    ramp_s16ne_tail(samples, volumes, steps, channels, done / channels, length - done);
+    advance_ramp(volumes, steps, channels, length / channels);
+}
+
+__attribute__((target("sse2")))
+static void pa_volume_ramp_float32ne_sse2(float *samples, float *volumes, const float *steps, unsigned channels, unsigned length) {
+    float v[8], s[8], f[8];
+    __m128 v0, v1, s0, s1, f0, f1, inc;
+    unsigned n, done = 0;
+
+    length /= sizeof(float);
+
+    if (8 % channels == 0) {
+        ramp_lanes(volumes, steps, channels, v, s, f);
+
+        v0 = _mm_loadu_ps(v);
+        v1 = _mm_loadu_ps(v + 4);
+        s0 = _mm_loadu_ps(s);
+        s1 = _mm_loadu_ps(s + 4);
+        f0 = _mm_loadu_ps(f);
+        f1 = _mm_loadu_ps(f + 4);
+        inc = _mm_set1_ps((float) (8 / channels));
+
+        for (n = length / 8; n > 0; n--, samples += 8) {
+            _mm_storeu_ps(samples, _mm_mul_ps(_mm_loadu_ps(samples), _mm_add_ps(v0, _mm_mul_ps(f0, s0))));
+            _mm_storeu_ps(samples + 4, _mm_mul_ps(_mm_loadu_ps(samples + 4), _mm_add_ps(v1, _mm_mul_ps(f1, s1))));
+
+            f0 = _mm_add_ps(f0, inc);
+            f1 = _mm_add_ps(f1, inc);
+        }
+
+        done = length - length % 8;
+    }
+
+    ramp_float32ne_tail(samples, volumes, steps, channels, done / channels, length - done);
+    advance_ramp(volumes, steps, channels, length / channels);
+}
+
 #endif /* (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__) */
 
 void pa_volume_func_init_sse(pa_cpu_x86_flag_t flags) {
@@ -258,6 +395,9 @@ void pa_volume_func_init_sse(pa_cpu_x86_flag_t flags) {
 
         pa_set_volume_func(PA_SAMPLE_S16NE, (pa_do_volume_func_t) pa_volume_s16ne_sse2);
         pa_set_volume_func(PA_SAMPLE_S16RE, (pa_do_volume_func_t) pa_volume_s16re_sse2);
+
+        pa_set_volume_ramp_func(PA_SAMPLE_S16NE, (pa_do_volume_ramp_func_t) pa_volume_ramp_s16ne_sse2);
+        pa_set_volume_ramp_func(PA_SAMPLE_FLOAT32NE, (pa_do_volume_ramp_func_t) pa_volume_ramp_float32ne_sse2);
     }
 #endif /* (!defined(__APPLE__) && !defined(__FreeBSD__) && !defined(__FreeBSD_kernel__) && defined (__i386__)) || defined (__amd64__) */
 }
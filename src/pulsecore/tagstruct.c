@@ -36,11 +36,15 @@
 #include <pulsecore/socket.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/packet.h>
+#include <pulsecore/proplist-util.h>
 
 #include "tagstruct.h"
 
 #define MAX_TAG_SIZE (64*1024)
-#define MAX_APPENDED_SIZE 128
+/* Same as for packets, so that small tagstructs are sent without
+ * touching the heap */
+#define MAX_APPENDED_SIZE 256
 #define GROW_TAG_SIZE 100
 
 struct pa_tagstruct {
@@ -97,18 +101,40 @@ void pa_tagstruct_free(pa_tagstruct*t) {
         pa_xfree(t);
 }
 
+pa_packet *pa_tagstruct_free_to_packet(pa_tagstruct *t) {
+    pa_packet *p;
+
+    pa_assert(t);
+
+    if (t->type == PA_TAGSTRUCT_DYNAMIC) {
+        /* The packet takes over the buffer */
+        p = pa_packet_new_dynamic(t->data, t->length);
+        t->type = PA_TAGSTRUCT_FIXED;
+    } else
+        p = pa_packet_new_data(t->data, t->length);
+
+    pa_tagstruct_free(t);
+    return p;
+}
+
 static inline void extend(pa_tagstruct*t, size_t l) {
+    size_t n;
+
     pa_assert(t);
     pa_assert(t->type != PA_TAGSTRUCT_FIXED);
 
     if (t->length+l <= t->allocated)
         return;
 
+    /* Grow geometrically, so that a large reply is built with a
+     * handful of reallocations rather than one every few entries */
+    n = PA_MAX(t->length + l + GROW_TAG_SIZE, t->allocated * 2);
+
     if (t->type == PA_TAGSTRUCT_DYNAMIC)
-        t->data = pa_xrealloc(t->data, t->allocated = t->length + l + GROW_TAG_SIZE);
+        t->data = pa_xrealloc(t->data, t->allocated = n);
     else if (t->type == PA_TAGSTRUCT_APPENDED) {
         t->type = PA_TAGSTRUCT_DYNAMIC;
-        t->data = pa_xmalloc(t->allocated = t->length + l + GROW_TAG_SIZE);
+        t->data = pa_xmalloc(t->allocated = n);
         memcpy(t->data, t->per_type.appended, t->length);
     }
 }
@@ -322,11 +348,10 @@ void pa_tagstruct_put_proplist(pa_tagstruct *t, pa_proplist *p) {
         const void *d;
         size_t l;
 
-        if (!(k = pa_proplist_iterate(p, &state)))
+        if (!(k = pa_proplist_iterate_data(p, &state, &d, &l)))
             break;
 
         pa_tagstruct_puts(t, k);
-        pa_assert_se(pa_proplist_get(p, k, &d, &l) >= 0);
         pa_tagstruct_putu32(t, (uint32_t) l);
         pa_tagstruct_put_arbitrary(t, d, l);
     }
@@ -604,9 +629,6 @@ int pa_tagstruct_get_proplist(pa_tagstruct *t, pa_proplist *p) {
         if (!k)
             break;
 
-        if (!pa_proplist_key_valid(k))
-            return -1;
-
         if (pa_tagstruct_getu32(t, &length) < 0)
             return -1;
 
@@ -616,8 +638,12 @@ int pa_tagstruct_get_proplist(pa_tagstruct *t, pa_proplist *p) {
         if (pa_tagstruct_get_arbitrary(t, &d, length) < 0)
             return -1;
 
-        if (p)
-            pa_assert_se(pa_proplist_set(p, k, d, length) >= 0);
+        /* pa_proplist_set() checks the key itself */
+        if (p) {
+            if (pa_proplist_set(p, k, d, length) < 0)
+                return -1;
+        } else if (!pa_proplist_key_valid(k))
+            return -1;
     }
 
     return 0;
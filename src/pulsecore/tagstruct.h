@@ -31,6 +31,7 @@
 #include <pulse/proplist.h>
 
 #include <pulsecore/macro.h>
+#include <pulsecore/packet.h>
 
 typedef struct pa_tagstruct pa_tagstruct;
 
@@ -63,6 +64,9 @@ enum {
 pa_tagstruct *pa_tagstruct_new(void);
 pa_tagstruct *pa_tagstruct_new_fixed(const uint8_t* data, size_t length);
 void pa_tagstruct_free(pa_tagstruct*t);
+/* Frees the tagstruct and returns a packet with its contents. The
+ * buffer is handed over rather than copied where possible. */
+pa_packet *pa_tagstruct_free_to_packet(pa_tagstruct *t);
 
 int pa_tagstruct_eof(pa_tagstruct*t);
 const uint8_t* pa_tagstruct_data(pa_tagstruct*t, size_t *l);
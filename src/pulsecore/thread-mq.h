@@ -46,6 +46,10 @@ void pa_thread_mq_install(pa_thread_mq *q);
 /* Return the pa_thread_mq object that is set for the current thread */
 pa_thread_mq *pa_thread_mq_get(void);
 
+/* For helper threads that run code on behalf of the thread q is
+ * installed for. NULL unsets it again. */
+void pa_thread_mq_set_helper(pa_thread_mq *q);
+
 /* Verify that we are in control context (aka 'main context'). */
 #define pa_assert_ctl_context(s) \
     pa_assert(!pa_thread_mq_get())
@@ -28,11 +28,21 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/macro.h>
+#include <pulsecore/atomic.h>
 
 #include "time-smoother.h"
 
 #define HISTORY_MAX 64
 
+/* The regression sums are kept relative to a base point, which is moved
+ * to the oldest entry in the history at least every HISTORY_MAX puts, or
+ * earlier if a new entry gets too far from it. This keeps the sums exact
+ * in double precision, so adding and removing entries leaves no error. */
+#define BASE_MAX_DISTANCE (1U << 26)
+
+/* How often pa_smoother_get_concurrent() tries to get a consistent copy */
+#define CONCURRENT_TRIES_MAX 8
+
 /*
  * Implementation of a time smoothing algorithm to synchronize remote
  * clocks to a local one. Evens out noise, adjusts to clock skew and
@@ -54,38 +64,58 @@
  *
  * If 'monotonic' is true the resulting estimation function is
  * guaranteed to be monotonic.
+ *
+ * Both adding a measurement and estimating take constant time: the sums
+ * for the regression are updated as entries enter and leave the history,
+ * and the polynomial is only calculated once per measurement.
  */
 
-struct pa_smoother {
-    pa_usec_t adjust_time, history_time;
-
-    pa_usec_t time_offset;
-
+/* Everything needed to evaluate the estimation function */
+struct curve {
     pa_usec_t px, py;     /* Point p, where we want to reach stability */
     double dp;            /* Gradient we want at point p */
 
     pa_usec_t ex, ey;     /* Point e, which we estimated before and need to smooth to */
     double de;            /* Gradient we estimated for point e */
+
+    /* Cached parameters for our interpolation polynomial y=ax^3+b^2+cx */
+    double a, b, c;
+    bool abc_valid:1;
+
+    bool monotonic:1;
+    bool paused:1;
+
+    pa_usec_t time_offset;
+    pa_usec_t pause_time;
+};
+
+struct pa_smoother {
+    pa_usec_t adjust_time, history_time;
+
+    struct curve curve;
+
     pa_usec_t ry;         /* The original y value for ex */
 
                           /* History of last measurements */
     pa_usec_t history_x[HISTORY_MAX], history_y[HISTORY_MAX];
     unsigned history_idx, n_history;
 
+    /* Sums of the history relative to (base_x|base_y) for avg_gradient() */
+    pa_usec_t base_x, base_y;
+    double sum_x, sum_y, sum_xx, sum_xy;
+    unsigned n_since_rebase;
+
     /* To even out for monotonicity */
     pa_usec_t last_y, last_x;
 
-    /* Cached parameters for our interpolation polynomial y=ax^3+b^2+cx */
-    double a, b, c;
-    bool abc_valid:1;
-
-    bool monotonic:1;
-    bool paused:1;
     bool smoothing:1; /* If false we skip the polynomial interpolation step */
 
-    pa_usec_t pause_time;
-
     unsigned min_history;
+
+    /* A copy of the curve for pa_smoother_get_concurrent(). seq is odd
+     * while the copy is updated and changes with every update. */
+    pa_atomic_t seq;
+    struct curve shared;
 };
 
 pa_smoother* pa_smoother_new(
@@ -108,9 +138,11 @@ pa_smoother* pa_smoother_new(
     s->adjust_time = adjust_time;
     s->history_time = history_time;
     s->min_history = min_history;
-    s->monotonic = monotonic;
+    s->curve.monotonic = monotonic;
     s->smoothing = smoothing;
 
+    pa_atomic_store(&s->seq, 0);
+
     pa_smoother_reset(s, time_offset, paused);
 
     return s;
@@ -132,6 +164,38 @@ void pa_smoother_free(pa_smoother* s) {
         x = ((x)+1) % HISTORY_MAX;              \
     } while(false)
 
+static void sums_add(pa_smoother *s, pa_usec_t x, pa_usec_t y, double sign) {
+    double dx, dy;
+
+    dx = (double) ((int64_t) x - (int64_t) s->base_x);
+    dy = (double) ((int64_t) y - (int64_t) s->base_y);
+
+    s->sum_x += sign * dx;
+    s->sum_y += sign * dy;
+    s->sum_xx += sign * dx * dx;
+    s->sum_xy += sign * dx * dy;
+}
+
+/* Recalculates the sums relative to the oldest entry */
+static void sums_rebase(pa_smoother *s) {
+    unsigned i, j;
+
+    s->sum_x = s->sum_y = s->sum_xx = s->sum_xy = 0;
+    s->n_since_rebase = 0;
+
+    if (s->n_history <= 0)
+        return;
+
+    s->base_x = s->history_x[s->history_idx];
+    s->base_y = s->history_y[s->history_idx];
+
+    i = s->history_idx;
+    for (j = s->n_history; j > 0; j--) {
+        sums_add(s, s->history_x[i], s->history_y[i], 1);
+        REDUCE_INC(i);
+    }
+}
+
 static void drop_old(pa_smoother *s, pa_usec_t x) {
 
     /* Drop items from history which are too old, but make sure to
@@ -145,6 +209,7 @@ static void drop_old(pa_smoother *s, pa_usec_t x) {
             break;
 
         /* Item is too old, let's drop it */
+        sums_add(s, s->history_x[s->history_idx], s->history_y[s->history_idx], -1);
         REDUCE_INC(s->history_idx);
 
         s->n_history --;
@@ -152,24 +217,33 @@ static void drop_old(pa_smoother *s, pa_usec_t x) {
 }
 
 static void add_to_history(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
-    unsigned j, i;
+    unsigned j;
     pa_assert(s);
 
-    /* First try to update an existing history entry */
-    i = s->history_idx;
-    for (j = s->n_history; j > 0; j--) {
+    /* First try to update the newest history entry. x doesn't go back
+     * in time, so that is the only one that can match */
+    if (s->n_history > 0) {
+        j = s->history_idx + s->n_history - 1;
+        REDUCE(j);
 
-        if (s->history_x[i] == x) {
-            s->history_y[i] = y;
+        if (s->history_x[j] == x) {
+            sums_add(s, x, s->history_y[j], -1);
+            s->history_y[j] = y;
+            sums_add(s, x, y, 1);
             return;
         }
-
-        REDUCE_INC(i);
     }
 
     /* Drop old entries */
     drop_old(s, x);
 
+    /* And make sure we don't store more entries than fit in */
+    if (s->n_history >= HISTORY_MAX) {
+        sums_add(s, s->history_x[s->history_idx], s->history_y[s->history_idx], -1);
+        REDUCE_INC(s->history_idx);
+        s->n_history--;
+    }
+
     /* Calculate position for new entry */
     j = s->history_idx + s->n_history;
     REDUCE(j);
@@ -181,67 +255,39 @@ static void add_to_history(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
     /* Adjust counter */
     s->n_history ++;
 
-    /* And make sure we don't store more entries than fit in */
-    if (s->n_history > HISTORY_MAX) {
-        s->history_idx += s->n_history - HISTORY_MAX;
-        REDUCE(s->history_idx);
-        s->n_history = HISTORY_MAX;
-    }
+    if (s->n_history == 1 ||
+        ++s->n_since_rebase >= HISTORY_MAX ||
+        x < s->base_x || x - s->base_x > BASE_MAX_DISTANCE ||
+        (y > s->base_y ? y - s->base_y : s->base_y - y) > BASE_MAX_DISTANCE)
+        sums_rebase(s);
+    else
+        sums_add(s, x, y, 1);
 }
 
 static double avg_gradient(pa_smoother *s, pa_usec_t x) {
-    unsigned i, j, c = 0;
-    int64_t ax = 0, ay = 0, k, t;
-    double r;
+    double n, k, t, r;
 
-    /* FIXME: Optimization: Jason Newton suggested that instead of
-     * going through the history on each iteration we could calculated
-     * avg_gradient() as we go.
-     *
-     * Second idea: it might make sense to weight history entries:
-     * more recent entries should matter more than old ones. */
+    /* FIXME: it might make sense to weight history entries: more
+     * recent entries should matter more than old ones. */
 
     /* Too few measurements, assume gradient of 1 */
     if (s->n_history < s->min_history)
         return 1;
 
-    /* First, calculate average of all measurements */
-    i = s->history_idx;
-    for (j = s->n_history; j > 0; j--) {
-
-        ax += (int64_t) s->history_x[i];
-        ay += (int64_t) s->history_y[i];
-        c++;
+    /* Linear regression from the sums */
+    n = (double) s->n_history;
+    k = n * s->sum_xy - s->sum_x * s->sum_y;
+    t = n * s->sum_xx - s->sum_x * s->sum_x;
 
-        REDUCE_INC(i);
-    }
-
-    pa_assert(c >= s->min_history);
-    ax /= c;
-    ay /= c;
-
-    /* Now, do linear regression */
-    k = t = 0;
-
-    i = s->history_idx;
-    for (j = s->n_history; j > 0; j--) {
-        int64_t dx, dy;
-
-        dx = (int64_t) s->history_x[i] - ax;
-        dy = (int64_t) s->history_y[i] - ay;
-
-        k += dx*dy;
-        t += dx*dx;
-
-        REDUCE_INC(i);
-    }
+    if (t <= 0)
+        return 1;
 
-    r = (double) k / (double) t;
+    r = k / t;
 
-    return (s->monotonic && r < 0) ? 0 : r;
+    return (s->curve.monotonic && r < 0) ? 0 : r;
 }
 
-static void calc_abc(pa_smoother *s) {
+static void calc_abc(struct curve *s) {
     pa_usec_t ex, ey, px, py;
     int64_t kx, ky;
     double de, dp;
@@ -274,7 +320,9 @@ static void calc_abc(pa_smoother *s) {
     s->abc_valid = true;
 }
 
-static void estimate(pa_smoother *s, pa_usec_t x, pa_usec_t *y, double *deriv) {
+/* Called with a curve that has its polynomial calculated already, unless
+ * it is the smoother's own */
+static void estimate(struct curve *s, pa_usec_t x, pa_usec_t *y, double *deriv) {
     pa_assert(s);
     pa_assert(y);
 
@@ -342,6 +390,19 @@ static void estimate(pa_smoother *s, pa_usec_t x, pa_usec_t *y, double *deriv) {
     }
 }
 
+/* Updates the copy of the curve that other threads read */
+static void publish(pa_smoother *s) {
+
+    /* Readers mustn't write to their copy */
+    if (s->curve.ex < s->curve.px)
+        calc_abc(&s->curve);
+
+    /* Make the sequence number odd while we write */
+    pa_atomic_inc(&s->seq);
+    s->shared = s->curve;
+    pa_atomic_inc(&s->seq);
+}
+
 void pa_smoother_put(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
     pa_usec_t ney;
     double nde;
@@ -350,18 +411,18 @@ void pa_smoother_put(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
     pa_assert(s);
 
     /* Fix up x value */
-    if (s->paused)
-        x = s->pause_time;
+    if (s->curve.paused)
+        x = s->curve.pause_time;
 
-    x = PA_LIKELY(x >= s->time_offset) ? x - s->time_offset : 0;
+    x = PA_LIKELY(x >= s->curve.time_offset) ? x - s->curve.time_offset : 0;
 
-    is_new = x >= s->ex;
+    is_new = x >= s->curve.ex;
 
     if (is_new) {
         /* First, we calculate the position we'd estimate for x, so that
          * we can adjust our position smoothly from this one */
-        estimate(s, x, &ney, &nde);
-        s->ex = x; s->ey = ney; s->de = nde;
+        estimate(&s->curve, x, &ney, &nde);
+        s->curve.ex = x; s->curve.ey = ney; s->curve.de = nde;
         s->ry = y;
     }
 
@@ -369,21 +430,23 @@ void pa_smoother_put(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
     add_to_history(s, x, y);
 
     /* And determine the average gradient of the history */
-    s->dp = avg_gradient(s, x);
+    s->curve.dp = avg_gradient(s, x);
 
     /* And calculate when we want to be on track again */
     if (s->smoothing) {
-        s->px = s->ex + s->adjust_time;
-        s->py = s->ry + (pa_usec_t) llrint(s->dp * (double) s->adjust_time);
+        s->curve.px = s->curve.ex + s->adjust_time;
+        s->curve.py = s->ry + (pa_usec_t) llrint(s->curve.dp * (double) s->adjust_time);
     } else {
-        s->px = s->ex;
-        s->py = s->ry;
+        s->curve.px = s->curve.ex;
+        s->curve.py = s->ry;
     }
 
-    s->abc_valid = false;
+    s->curve.abc_valid = false;
+
+    publish(s);
 
 #ifdef DEBUG_DATA
-    pa_log_debug("%p, put(%llu | %llu) = %llu", s, (unsigned long long) (x + s->time_offset), (unsigned long long) x, (unsigned long long) y);
+    pa_log_debug("%p, put(%llu | %llu) = %llu", s, (unsigned long long) (x + s->curve.time_offset), (unsigned long long) x, (unsigned long long) y);
 #endif
 }
 
@@ -393,18 +456,18 @@ pa_usec_t pa_smoother_get(pa_smoother *s, pa_usec_t x) {
     pa_assert(s);
 
     /* Fix up x value */
-    if (s->paused)
-        x = s->pause_time;
+    if (s->curve.paused)
+        x = s->curve.pause_time;
 
-    x = PA_LIKELY(x >= s->time_offset) ? x - s->time_offset : 0;
+    x = PA_LIKELY(x >= s->curve.time_offset) ? x - s->curve.time_offset : 0;
 
-    if (s->monotonic)
+    if (s->curve.monotonic)
         if (x <= s->last_x)
             x = s->last_x;
 
-    estimate(s, x, &y, NULL);
+    estimate(&s->curve, x, &y, NULL);
 
-    if (s->monotonic) {
+    if (s->curve.monotonic) {
 
         /* Make sure the querier doesn't jump forth and back. */
         s->last_x = x;
@@ -416,16 +479,52 @@ pa_usec_t pa_smoother_get(pa_smoother *s, pa_usec_t x) {
     }
 
 #ifdef DEBUG_DATA
-    pa_log_debug("%p, get(%llu | %llu) = %llu", s, (unsigned long long) (x + s->time_offset), (unsigned long long) x, (unsigned long long) y);
+    pa_log_debug("%p, get(%llu | %llu) = %llu", s, (unsigned long long) (x + s->curve.time_offset), (unsigned long long) x, (unsigned long long) y);
 #endif
 
     return y;
 }
 
+bool pa_smoother_get_concurrent(pa_smoother *s, pa_usec_t x, pa_usec_t *y) {
+    struct curve c;
+    unsigned tries;
+    int seq;
+
+    pa_assert(s);
+    pa_assert(y);
+
+    /* Get a consistent copy, the writer only holds the sequence number
+     * odd for as long as it takes to copy the curve */
+    for (tries = 0;; tries++) {
+        if (tries >= CONCURRENT_TRIES_MAX)
+            return false;
+
+        seq = pa_atomic_load(&s->seq);
+        if (seq & 1)
+            continue;
+
+        c = s->shared;
+
+        if (pa_atomic_load(&s->seq) == seq)
+            break;
+    }
+
+    /* Fix up x value */
+    if (c.paused)
+        x = c.pause_time;
+
+    x = PA_LIKELY(x >= c.time_offset) ? x - c.time_offset : 0;
+
+    estimate(&c, x, y, NULL);
+
+    return true;
+}
+
 void pa_smoother_set_time_offset(pa_smoother *s, pa_usec_t offset) {
     pa_assert(s);
 
-    s->time_offset = offset;
+    s->curve.time_offset = offset;
+    publish(s);
 
 #ifdef DEBUG_DATA
     pa_log_debug("offset(%llu)", (unsigned long long) offset);
@@ -435,42 +534,48 @@ void pa_smoother_set_time_offset(pa_smoother *s, pa_usec_t offset) {
 void pa_smoother_pause(pa_smoother *s, pa_usec_t x) {
     pa_assert(s);
 
-    if (s->paused)
+    if (s->curve.paused)
         return;
 
 #ifdef DEBUG_DATA
     pa_log_debug("pause(%llu)", (unsigned long long) x);
 #endif
 
-    s->paused = true;
-    s->pause_time = x;
+    s->curve.paused = true;
+    s->curve.pause_time = x;
+    publish(s);
 }
 
 void pa_smoother_resume(pa_smoother *s, pa_usec_t x, bool fix_now) {
     pa_assert(s);
 
-    if (!s->paused)
+    if (!s->curve.paused)
         return;
 
-    if (x < s->pause_time)
-        x = s->pause_time;
+    if (x < s->curve.pause_time)
+        x = s->curve.pause_time;
 
 #ifdef DEBUG_DATA
     pa_log_debug("resume(%llu)", (unsigned long long) x);
 #endif
 
-    s->paused = false;
-    s->time_offset += x - s->pause_time;
+    s->curve.paused = false;
+    s->curve.time_offset += x - s->curve.pause_time;
 
     if (fix_now)
         pa_smoother_fix_now(s);
+    else
+        publish(s);
 }
 
 void pa_smoother_fix_now(pa_smoother *s) {
     pa_assert(s);
 
-    s->px = s->ex;
-    s->py = s->ry;
+    s->curve.px = s->curve.ex;
+    s->curve.py = s->ry;
+    s->curve.abc_valid = false;
+
+    publish(s);
 }
 
 pa_usec_t pa_smoother_translate(pa_smoother *s, pa_usec_t x, pa_usec_t y_delay) {
@@ -480,17 +585,17 @@ pa_usec_t pa_smoother_translate(pa_smoother *s, pa_usec_t x, pa_usec_t y_delay)
     pa_assert(s);
 
     /* Fix up x value */
-    if (s->paused)
-        x = s->pause_time;
+    if (s->curve.paused)
+        x = s->curve.pause_time;
 
-    x = PA_LIKELY(x >= s->time_offset) ? x - s->time_offset : 0;
+    x = PA_LIKELY(x >= s->curve.time_offset) ? x - s->curve.time_offset : 0;
 
-    estimate(s, x, &ney, &nde);
+    estimate(&s->curve, x, &ney, &nde);
 
     /* Play safe and take the larger gradient, so that we wakeup
      * earlier when this is used for sleeping */
-    if (s->dp > nde)
-        nde = s->dp;
+    if (s->curve.dp > nde)
+        nde = s->curve.dp;
 
 #ifdef DEBUG_DATA
     pa_log_debug("translate(%llu) = %llu (%0.2f)", (unsigned long long) y_delay, (unsigned long long) ((double) y_delay / nde), nde);
@@ -502,21 +607,24 @@ pa_usec_t pa_smoother_translate(pa_smoother *s, pa_usec_t x, pa_usec_t y_delay)
 void pa_smoother_reset(pa_smoother *s, pa_usec_t time_offset, bool paused) {
     pa_assert(s);
 
-    s->px = s->py = 0;
-    s->dp = 1;
+    s->curve.px = s->curve.py = 0;
+    s->curve.dp = 1;
 
-    s->ex = s->ey = s->ry = 0;
-    s->de = 1;
+    s->curve.ex = s->curve.ey = s->ry = 0;
+    s->curve.de = 1;
 
     s->history_idx = 0;
     s->n_history = 0;
+    sums_rebase(s);
 
     s->last_y = s->last_x = 0;
 
-    s->abc_valid = false;
+    s->curve.abc_valid = false;
+
+    s->curve.paused = paused;
+    s->curve.time_offset = s->curve.pause_time = time_offset;
 
-    s->paused = paused;
-    s->time_offset = s->pause_time = time_offset;
+    publish(s);
 
 #ifdef DEBUG_DATA
     pa_log_debug("reset()");
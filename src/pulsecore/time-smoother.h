@@ -42,6 +42,11 @@ void pa_smoother_put(pa_smoother *s, pa_usec_t x, pa_usec_t y);
 /* Returns an interpolated value based on the dataset. x = local/system time, return value = remote time */
 pa_usec_t pa_smoother_get(pa_smoother *s, pa_usec_t x);
 
+/* Like pa_smoother_get(), but may be called from any thread while the
+ * smoother is updated by another one. Doesn't even out for monotonicity.
+ * Returns false if the smoother was being updated for too long. */
+bool pa_smoother_get_concurrent(pa_smoother *s, pa_usec_t x, pa_usec_t *y);
+
 /* Translates a time span from the remote time domain to the local one. x = local/system time when to estimate, y_delay = remote time span */
 pa_usec_t pa_smoother_translate(pa_smoother *s, pa_usec_t x, pa_usec_t y_delay);
 
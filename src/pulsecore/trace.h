@@ -0,0 +1,48 @@
+#ifndef foopulsecoretracehfoo
+#define foopulsecoretracehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Static tracepoints for the hot paths. When built with USDT support
+ * each probe site is a single nop that perf, bpftrace or SystemTap can
+ * attach to at run time, e.g.
+ *
+ *     bpftrace -e 'usdt:/usr/bin/pulseaudio:pulseaudio:sink_underrun { ... }'
+ *
+ * Without it they compile to nothing. Arguments need to be integers or
+ * pointers. */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define PA_TRACE0(name) DTRACE_PROBE(pulseaudio, name)
+#define PA_TRACE1(name, a) DTRACE_PROBE1(pulseaudio, name, a)
+#define PA_TRACE2(name, a, b) DTRACE_PROBE2(pulseaudio, name, a, b)
+#define PA_TRACE3(name, a, b, c) DTRACE_PROBE3(pulseaudio, name, a, b, c)
+
+#else
+
+#define PA_TRACE0(name) do { } while (false)
+#define PA_TRACE1(name, a) do { } while (false)
+#define PA_TRACE2(name, a, b) do { } while (false)
+#define PA_TRACE3(name, a, b, c) do { } while (false)
+
+#endif
+
+#endif
@@ -26,11 +26,14 @@ typedef struct pa_card_profile pa_card_profile;
 typedef struct pa_client pa_client;
 typedef struct pa_core pa_core;
 typedef struct pa_device_port pa_device_port;
+typedef struct pa_render_pool pa_render_pool;
 typedef struct pa_sink pa_sink;
 typedef struct pa_sink_volume_change pa_sink_volume_change;
 typedef struct pa_sink_input pa_sink_input;
+typedef struct pa_sink_premix pa_sink_premix;
 typedef struct pa_source pa_source;
 typedef struct pa_source_volume_change pa_source_volume_change;
+typedef struct pa_source_fanout pa_source_fanout;
 typedef struct pa_source_output pa_source_output;
 
 
@@ -0,0 +1,206 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+
+#include "watermark-model.h"
+
+/*
+ * Wakeup lateness is kept in a histogram with four buckets per octave,
+ * starting at 250us. 48 buckets cover everything up to about one
+ * second, later wakeups land in the last bucket.
+ *
+ * Every sample is added with a fixed weight, and all buckets are halved
+ * once per 'half_life', so a single spike stops mattering after a few
+ * half lives instead of pinning the watermark for good.
+ *
+ * The suggested watermark is the 99th percentile plus a margin of at
+ * least 'margin' or half the percentile, whichever is larger. It is
+ * raised immediately, but only lowered when the suggestion drops below
+ * three quarters of the current value and no raise happened for 'hold'.
+ */
+
+#define N_BUCKETS 48
+#define FIRST_EDGE_USEC 250
+#define SAMPLE_WEIGHT 256
+#define MIN_WEIGHT (32 * SAMPLE_WEIGHT)
+#define MAX_DECAY_STEPS 32
+#define TAIL_QUANTILE 0.99
+
+struct pa_watermark_model {
+    pa_usec_t half_life, hold, margin;
+
+    pa_usec_t edges[N_BUCKETS];
+    uint32_t buckets[N_BUCKETS];
+    uint64_t total;
+
+    pa_usec_t next_decay;
+    pa_usec_t hold_until;
+};
+
+pa_watermark_model* pa_watermark_model_new(pa_usec_t half_life, pa_usec_t hold, pa_usec_t margin) {
+    pa_watermark_model *m;
+    double edge = FIRST_EDGE_USEC;
+    unsigned i;
+
+    pa_assert(half_life > 0);
+
+    m = pa_xnew0(pa_watermark_model, 1);
+    m->half_life = half_life;
+    m->hold = hold;
+    m->margin = margin;
+
+    for (i = 0; i < N_BUCKETS; i++) {
+        m->edges[i] = (pa_usec_t) edge;
+        edge *= 1.189207115; /* 2^(1/4) */
+    }
+
+    return m;
+}
+
+void pa_watermark_model_free(pa_watermark_model *m) {
+    pa_assert(m);
+
+    pa_xfree(m);
+}
+
+void pa_watermark_model_reset(pa_watermark_model *m) {
+    pa_assert(m);
+
+    memset(m->buckets, 0, sizeof(m->buckets));
+    m->total = 0;
+    m->next_decay = 0;
+    m->hold_until = 0;
+}
+
+static void decay(pa_watermark_model *m, pa_usec_t now) {
+    unsigned i, steps = 0;
+
+    if (m->next_decay == 0) {
+        m->next_decay = now + m->half_life;
+        return;
+    }
+
+    while (now >= m->next_decay) {
+        m->next_decay += m->half_life;
+
+        if (++steps > MAX_DECAY_STEPS) {
+            /* Nothing from that long ago is worth keeping */
+            memset(m->buckets, 0, sizeof(m->buckets));
+            m->total = 0;
+            m->next_decay = now + m->half_life;
+            return;
+        }
+
+        m->total = 0;
+        for (i = 0; i < N_BUCKETS; i++) {
+            m->buckets[i] >>= 1;
+            m->total += m->buckets[i];
+        }
+    }
+}
+
+static unsigned bucket_for(pa_watermark_model *m, pa_usec_t lateness) {
+    unsigned i;
+
+    for (i = 0; i < N_BUCKETS - 1; i++)
+        if (lateness <= m->edges[i])
+            break;
+
+    return i;
+}
+
+static void put(pa_watermark_model *m, pa_usec_t now, pa_usec_t lateness) {
+    unsigned i;
+
+    decay(m, now);
+
+    i = bucket_for(m, lateness);
+
+    /* Saturate rather than wrap, a full bucket dominates anyway */
+    if (m->buckets[i] <= UINT32_MAX - SAMPLE_WEIGHT) {
+        m->buckets[i] += SAMPLE_WEIGHT;
+        m->total += SAMPLE_WEIGHT;
+    }
+}
+
+void pa_watermark_model_add(pa_watermark_model *m, pa_usec_t now, pa_usec_t lateness) {
+    pa_assert(m);
+
+    put(m, now, lateness);
+}
+
+void pa_watermark_model_dropout(pa_watermark_model *m, pa_usec_t now, pa_usec_t watermark) {
+    pa_assert(m);
+
+    put(m, now, watermark + m->margin);
+    m->hold_until = now + m->hold;
+}
+
+pa_usec_t pa_watermark_model_quantile(pa_watermark_model *m, double q) {
+    uint64_t limit, sum = 0;
+    unsigned i;
+
+    pa_assert(m);
+    pa_assert(q >= 0.0 && q <= 1.0);
+
+    if (m->total < MIN_WEIGHT)
+        return 0;
+
+    limit = (uint64_t) ((double) m->total * q);
+
+    for (i = 0; i < N_BUCKETS - 1; i++) {
+        sum += m->buckets[i];
+
+        if (sum >= limit)
+            break;
+    }
+
+    return m->edges[i];
+}
+
+pa_usec_t pa_watermark_model_suggest(pa_watermark_model *m, pa_usec_t now, pa_usec_t current) {
+    pa_usec_t tail, target;
+
+    pa_assert(m);
+
+    if ((tail = pa_watermark_model_quantile(m, TAIL_QUANTILE)) <= 0)
+        return current;
+
+    target = tail + PA_MAX(m->margin, tail / 2);
+
+    if (target > current) {
+        m->hold_until = now + m->hold;
+        return target;
+    }
+
+    if (now < m->hold_until)
+        return current;
+
+    if (target >= current - current / 4)
+        return current;
+
+    return target;
+}
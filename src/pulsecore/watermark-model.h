@@ -0,0 +1,55 @@
+#ifndef foopulsewatermarkmodelhfoo
+#define foopulsewatermarkmodelhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulsecore/macro.h>
+#include <pulse/sample.h>
+
+/* Tracks how late timer based wakeups of a device are and derives a
+ * wakeup watermark from the tail of that distribution. Used by the
+ * ALSA sink and source in tsched mode. */
+
+typedef struct pa_watermark_model pa_watermark_model;
+
+/* half_life: how quickly old samples lose weight
+ * hold: minimum time after a raise before the watermark may drop again
+ * margin: minimum headroom added on top of the measured tail */
+pa_watermark_model* pa_watermark_model_new(pa_usec_t half_life, pa_usec_t hold, pa_usec_t margin);
+void pa_watermark_model_free(pa_watermark_model *m);
+
+void pa_watermark_model_reset(pa_watermark_model *m);
+
+/* Adds a wakeup that came 'lateness' later than planned. now = system time */
+void pa_watermark_model_add(pa_watermark_model *m, pa_usec_t now, pa_usec_t lateness);
+
+/* Records a dropout at the given watermark. Its real lateness is
+ * unknown, so it is counted as at least the watermark plus margin, and
+ * further decreases are held back */
+void pa_watermark_model_dropout(pa_watermark_model *m, pa_usec_t now, pa_usec_t watermark);
+
+/* Returns the lateness below which the fraction q of the recorded
+ * wakeups fell, or 0 if there is not enough data yet */
+pa_usec_t pa_watermark_model_quantile(pa_watermark_model *m, double q);
+
+/* Returns the watermark to use next. Raises immediately when the tail
+ * gets close to 'current', lowers only after the hold time and when the
+ * suggested value is clearly below 'current'. */
+pa_usec_t pa_watermark_model_suggest(pa_watermark_model *m, pa_usec_t now, pa_usec_t current);
+
+#endif
@@ -25,11 +25,16 @@
 
 #include <check.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 #include <pulse/util.h>
 #include <pulsecore/asyncq.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/core-rtclock.h>
+
+#define BENCH_ITEMS 1000000
 
 static void producer(void *_q) {
     pa_asyncq *q = _q;
@@ -65,6 +70,36 @@ static void consumer(void *_q) {
     pa_log_debug("popped end");
 }
 
+/* Same as above, but without logging and sleeping, so that both threads
+ * hammer the cells concurrently. Any reordering between the store of a
+ * cell and its load shows up as a sequence error. */
+static void bench_producer(void *_q) {
+    pa_asyncq *q = _q;
+    unsigned i;
+
+    for (i = 0; i < BENCH_ITEMS; i++)
+        pa_asyncq_push(q, PA_UINT_TO_PTR(i+1), true);
+
+    pa_asyncq_push(q, PA_UINT_TO_PTR(-1), true);
+}
+
+static void bench_consumer(void *_q) {
+    pa_asyncq *q = _q;
+    void *p;
+    unsigned i;
+
+    for (i = 0;; i++) {
+        p = pa_asyncq_pop(q, true);
+
+        if (p == PA_UINT_TO_PTR(-1))
+            break;
+
+        fail_unless(p == PA_UINT_TO_PTR(i+1));
+    }
+
+    fail_unless(i == BENCH_ITEMS);
+}
+
 START_TEST (asyncq_test) {
     pa_asyncq *q;
     pa_thread *t1, *t2;
@@ -87,6 +122,60 @@ START_TEST (asyncq_test) {
 }
 END_TEST
 
+START_TEST (asyncq_length_test) {
+    pa_asyncq *q;
+    unsigned i;
+
+    q = pa_asyncq_new(16);
+    fail_unless(q != NULL);
+
+    fail_unless(pa_asyncq_get_length(q) == 0);
+
+    for (i = 0; i < 16; i++)
+        fail_unless(pa_asyncq_push(q, PA_UINT_TO_PTR(i+1), false) == 0);
+
+    fail_unless(pa_asyncq_get_length(q) == 16);
+
+    /* Wrap around */
+    for (i = 0; i < 10; i++)
+        fail_unless(pa_asyncq_pop(q, false) == PA_UINT_TO_PTR(i+1));
+    for (i = 0; i < 4; i++)
+        fail_unless(pa_asyncq_push(q, PA_UINT_TO_PTR(i+17), false) == 0);
+
+    fail_unless(pa_asyncq_get_length(q) == 10);
+
+    pa_asyncq_free(q, NULL);
+}
+END_TEST
+
+START_TEST (asyncq_bench) {
+    pa_asyncq *q;
+    pa_thread *t1, *t2;
+    pa_usec_t start, stop;
+
+    q = pa_asyncq_new(0);
+    fail_unless(q != NULL);
+
+    start = pa_rtclock_now();
+
+    t1 = pa_thread_new("producer", bench_producer, q);
+    fail_unless(t1 != NULL);
+    t2 = pa_thread_new("consumer", bench_consumer, q);
+    fail_unless(t2 != NULL);
+
+    pa_thread_free(t1);
+    pa_thread_free(t2);
+
+    stop = pa_rtclock_now();
+
+    pa_log_info("%u items in %0.2f ms, %0.1f ns per item", BENCH_ITEMS,
+                (double) (stop - start) / PA_USEC_PER_MSEC,
+                (double) (stop - start) * 1000 / BENCH_ITEMS);
+
+    pa_asyncq_free(q, NULL);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -96,6 +185,9 @@ int main(int argc, char *argv[]) {
     s = suite_create("Async Queue");
     tc = tcase_create("asyncq");
     tcase_add_test(tc, asyncq_test);
+    tcase_add_test(tc, asyncq_length_test);
+    tcase_add_test(tc, asyncq_bench);
+    tcase_set_timeout(tc, 60);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
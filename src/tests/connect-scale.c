@@ -0,0 +1,705 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Connection scaling harness. Where connect-stress repeatedly opens a
+ * fixed number of streams, this ramps up to a large number of clients
+ * against a running daemon. Each client subscribes to all events,
+ * periodically introspects the server and optionally has a playback
+ * and a record stream. Once per report interval it prints
+ *
+ *   - the round trip time of a dedicated probe client, as a measure of
+ *     how long the daemon's main loop takes to get to a request,
+ *   - the reply delay of the introspection requests of all clients,
+ *   - the daemon's resident memory and memory per client. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <locale.h>
+#include <sys/types.h>
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/pid.h>
+
+typedef struct client {
+    unsigned index;
+    pa_context *context;
+    pa_stream *playback, *record;
+    pa_time_event *introspect_event;
+    pa_usec_t request_time;
+    unsigned request_type;
+    bool ready;
+} client;
+
+/* Latency samples of one report interval */
+typedef struct stats {
+    pa_usec_t *samples;
+    unsigned n, size;
+} stats;
+
+static pa_mainloop_api *api = NULL;
+static pa_context *probe = NULL;
+static pa_time_event *ramp_event = NULL, *report_event = NULL, *probe_event = NULL;
+
+static client *clients = NULL;
+static unsigned n_started = 0, n_ready = 0, n_failed = 0;
+static unsigned long n_events = 0;
+
+static stats probe_stats, request_stats;
+static pa_usec_t probe_request_time = 0;
+static pa_usec_t start_time = 0, full_time = 0;
+
+static pid_t daemon_pid = 0;
+static unsigned long base_rss = 0;
+static pa_stat_info last_stat;
+static bool have_stat = false;
+
+static char *server = NULL;
+static unsigned n_clients = 1000;
+static unsigned ramp_step = 50;
+static pa_usec_t ramp_interval = PA_USEC_PER_SEC;
+static unsigned playback_every = 10, record_every = 20;
+static pa_usec_t introspect_interval = 2 * PA_USEC_PER_SEC;
+static pa_usec_t probe_interval = 100 * PA_USEC_PER_MSEC;
+static pa_usec_t report_interval = PA_USEC_PER_SEC;
+static pa_usec_t hold_time = 10 * PA_USEC_PER_SEC;
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 8000,
+    .channels = 1
+};
+
+static void stats_add(stats *s, pa_usec_t v) {
+    if (s->n >= s->size) {
+        s->size = PA_MAX(s->size * 2, 256U);
+        s->samples = pa_xrenew(pa_usec_t, s->samples, s->size);
+    }
+
+    s->samples[s->n++] = v;
+}
+
+static int usec_compare(const void *a, const void *b) {
+    pa_usec_t x = *(const pa_usec_t *) a, y = *(const pa_usec_t *) b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Formats count, median, 99th percentile and maximum in msec and
+ * resets the samples */
+static char *stats_flush(stats *s, char *buf, size_t l) {
+
+    if (s->n == 0) {
+        pa_snprintf(buf, l, "%6u %8s %8s %8s", 0, "-", "-", "-");
+        return buf;
+    }
+
+    qsort(s->samples, s->n, sizeof(pa_usec_t), usec_compare);
+
+    pa_snprintf(buf, l, "%6u %8.2f %8.2f %8.2f", s->n,
+                (double) s->samples[s->n / 2] / PA_USEC_PER_MSEC,
+                (double) s->samples[(s->n * 99) / 100] / PA_USEC_PER_MSEC,
+                (double) s->samples[s->n - 1] / PA_USEC_PER_MSEC);
+
+    s->n = 0;
+    return buf;
+}
+
+static unsigned long read_rss(pid_t pid) {
+    char fn[64], line[256];
+    unsigned long rss = 0;
+    FILE *f;
+
+    if (pid <= 0)
+        return 0;
+
+    pa_snprintf(fn, sizeof(fn), "/proc/%lu/status", (unsigned long) pid);
+
+    if (!(f = fopen(fn, "r")))
+        return 0;
+
+    while (fgets(line, sizeof(line), f))
+        if (pa_startswith(line, "VmRSS:")) {
+            rss = strtoul(line + 6, NULL, 10);
+            break;
+        }
+
+    fclose(f);
+    return rss;
+}
+
+static void stream_write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    void *data;
+
+    while (nbytes > 0) {
+        size_t n = nbytes;
+
+        if (pa_stream_begin_write(s, &data, &n) < 0 || n == 0)
+            return;
+
+        memset(data, 0, n);
+        pa_stream_write(s, data, n, NULL, 0, PA_SEEK_RELATIVE);
+        nbytes -= PA_MIN(n, nbytes);
+    }
+}
+
+static void stream_read_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    const void *data;
+
+    while (pa_stream_readable_size(s) > 0) {
+        if (pa_stream_peek(s, &data, &nbytes) < 0)
+            return;
+
+        if (nbytes == 0)
+            return;
+
+        pa_stream_drop(s);
+    }
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    client *c = userdata;
+
+    if (pa_stream_get_state(s) == PA_STREAM_FAILED)
+        pa_log_warn("Stream of client %u failed: %s", c->index, pa_strerror(pa_context_errno(c->context)));
+}
+
+static pa_stream *create_stream(client *c, bool playback) {
+    pa_buffer_attr attr;
+    pa_stream *s;
+    char name[64];
+
+    pa_snprintf(name, sizeof(name), "%s #%u", playback ? "playback" : "record", c->index);
+
+    if (!(s = pa_stream_new(c->context, name, &sample_spec, NULL))) {
+        pa_log_warn("pa_stream_new() failed: %s", pa_strerror(pa_context_errno(c->context)));
+        return NULL;
+    }
+
+    /* 100 ms buffers, these are about load on the server, not about
+     * low latency */
+    attr.maxlength = (uint32_t) -1;
+    attr.tlength = attr.fragsize = (uint32_t) pa_usec_to_bytes(100 * PA_USEC_PER_MSEC, &sample_spec);
+    attr.prebuf = attr.minreq = (uint32_t) -1;
+
+    pa_stream_set_state_callback(s, stream_state_cb, c);
+
+    if (playback) {
+        pa_stream_set_write_callback(s, stream_write_cb, c);
+        pa_stream_connect_playback(s, NULL, &attr, PA_STREAM_ADJUST_LATENCY, NULL, NULL);
+    } else {
+        pa_stream_set_read_callback(s, stream_read_cb, c);
+        pa_stream_connect_record(s, NULL, &attr, PA_STREAM_ADJUST_LATENCY);
+    }
+
+    return s;
+}
+
+static void request_done(client *c) {
+    stats_add(&request_stats, pa_rtclock_now() - c->request_time);
+    c->request_time = 0;
+}
+
+static void sink_info_cb(pa_context *ctx, const pa_sink_info *i, int eol, void *userdata) {
+    if (eol)
+        request_done(userdata);
+}
+
+static void sink_input_info_cb(pa_context *ctx, const pa_sink_input_info *i, int eol, void *userdata) {
+    if (eol)
+        request_done(userdata);
+}
+
+static void client_info_cb(pa_context *ctx, const pa_client_info *i, int eol, void *userdata) {
+    if (eol)
+        request_done(userdata);
+}
+
+static void server_info_cb(pa_context *ctx, const pa_server_info *i, void *userdata) {
+    request_done(userdata);
+}
+
+static void introspect_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    client *c = userdata;
+    pa_operation *o = NULL;
+
+    pa_context_rttime_restart(c->context, e, pa_rtclock_now() + introspect_interval);
+
+    /* A reply that is still outstanding is a delay on its own, don't
+     * pile up more requests behind it */
+    if (c->request_time > 0)
+        return;
+
+    c->request_time = pa_rtclock_now();
+
+    switch (c->request_type++ % 4) {
+        case 0:
+            o = pa_context_get_server_info(c->context, server_info_cb, c);
+            break;
+        case 1:
+            o = pa_context_get_sink_info_list(c->context, sink_info_cb, c);
+            break;
+        case 2:
+            o = pa_context_get_sink_input_info_list(c->context, sink_input_info_cb, c);
+            break;
+        case 3:
+            o = pa_context_get_client_info_list(c->context, client_info_cb, c);
+            break;
+    }
+
+    if (o)
+        pa_operation_unref(o);
+    else
+        c->request_time = 0;
+}
+
+static void subscribe_cb(pa_context *ctx, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    n_events++;
+}
+
+static void client_state_cb(pa_context *ctx, void *userdata) {
+    client *c = userdata;
+
+    switch (pa_context_get_state(ctx)) {
+        case PA_CONTEXT_READY: {
+            pa_operation *o;
+
+            c->ready = true;
+            n_ready++;
+
+            pa_context_set_subscribe_callback(ctx, subscribe_cb, c);
+            if ((o = pa_context_subscribe(ctx, PA_SUBSCRIPTION_MASK_ALL, NULL, NULL)))
+                pa_operation_unref(o);
+
+            if (playback_every > 0 && c->index % playback_every == 0)
+                c->playback = create_stream(c, true);
+
+            if (record_every > 0 && c->index % record_every == 0)
+                c->record = create_stream(c, false);
+
+            /* Spread the requests of all clients evenly over the interval */
+            c->introspect_event = pa_context_rttime_new(ctx,
+                                                        pa_rtclock_now() + (pa_usec_t) (rand() % (int) (introspect_interval / PA_USEC_PER_MSEC + 1)) * PA_USEC_PER_MSEC,
+                                                        introspect_cb, c);
+            break;
+        }
+
+        case PA_CONTEXT_FAILED:
+        case PA_CONTEXT_TERMINATED:
+            if (c->ready)
+                n_ready--;
+
+            n_failed++;
+            c->ready = false;
+
+            pa_log_warn("Client %u disconnected: %s", c->index, pa_strerror(pa_context_errno(ctx)));
+
+            if (c->introspect_event) {
+                api->time_free(c->introspect_event);
+                c->introspect_event = NULL;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void client_start(client *c, unsigned idx) {
+    char name[64];
+
+    c->index = idx;
+    pa_snprintf(name, sizeof(name), "connect-scale #%u", idx);
+
+    if (!(c->context = pa_context_new(api, name))) {
+        n_failed++;
+        return;
+    }
+
+    pa_context_set_state_callback(c->context, client_state_cb, c);
+
+    if (pa_context_connect(c->context, server, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
+        pa_log_warn("pa_context_connect() failed: %s", pa_strerror(pa_context_errno(c->context)));
+        n_failed++;
+    }
+}
+
+static void client_free(client *c) {
+    if (c->introspect_event)
+        api->time_free(c->introspect_event);
+
+    if (c->playback) {
+        pa_stream_disconnect(c->playback);
+        pa_stream_unref(c->playback);
+    }
+
+    if (c->record) {
+        pa_stream_disconnect(c->record);
+        pa_stream_unref(c->record);
+    }
+
+    if (c->context) {
+        pa_context_set_state_callback(c->context, NULL, NULL);
+        pa_context_disconnect(c->context);
+        pa_context_unref(c->context);
+    }
+}
+
+static void ramp_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    unsigned i;
+
+    for (i = 0; i < ramp_step && n_started < n_clients; i++, n_started++)
+        client_start(&clients[n_started], n_started);
+
+    if (n_started < n_clients)
+        pa_context_rttime_restart(probe, e, pa_rtclock_now() + ramp_interval);
+    else {
+        full_time = pa_rtclock_now();
+        a->time_free(e);
+        ramp_event = NULL;
+    }
+}
+
+static void probe_reply_cb(pa_context *ctx, const pa_server_info *i, void *userdata) {
+    stats_add(&probe_stats, pa_rtclock_now() - probe_request_time);
+    probe_request_time = 0;
+}
+
+static void stat_cb(pa_context *ctx, const pa_stat_info *i, void *userdata) {
+    if (i) {
+        last_stat = *i;
+        have_stat = true;
+    }
+}
+
+static void probe_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    pa_operation *o;
+
+    pa_context_rttime_restart(probe, e, pa_rtclock_now() + probe_interval);
+
+    if (probe_request_time > 0)
+        return;
+
+    probe_request_time = pa_rtclock_now();
+
+    if ((o = pa_context_get_server_info(probe, probe_reply_cb, NULL)))
+        pa_operation_unref(o);
+    else
+        probe_request_time = 0;
+}
+
+static void report_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    char p[64], r[64];
+    unsigned long rss;
+    pa_usec_t now = pa_rtclock_now();
+    pa_operation *o;
+
+    rss = read_rss(daemon_pid);
+
+    printf("  %7.1f %6u %6u %5u %s %s %8lu %8.1f %8lu %10lu\n",
+           (double) (now - start_time) / PA_USEC_PER_SEC,
+           n_started, n_ready, n_failed,
+           stats_flush(&probe_stats, p, sizeof(p)),
+           stats_flush(&request_stats, r, sizeof(r)),
+           rss,
+           n_ready > 0 && rss > base_rss ? (double) (rss - base_rss) / n_ready : 0.0,
+           have_stat ? (unsigned long) last_stat.memblock_total_size / 1024 : 0UL,
+           n_events);
+    fflush(stdout);
+
+    if ((o = pa_context_stat(probe, stat_cb, NULL)))
+        pa_operation_unref(o);
+
+    if (full_time > 0 && now >= full_time + hold_time) {
+        api->quit(api, 0);
+        return;
+    }
+
+    pa_context_rttime_restart(probe, e, now + report_interval);
+}
+
+static void probe_state_cb(pa_context *ctx, void *userdata) {
+    switch (pa_context_get_state(ctx)) {
+        case PA_CONTEXT_READY:
+            base_rss = read_rss(daemon_pid);
+            start_time = pa_rtclock_now();
+
+            printf("# %7s %6s %6s %5s %6s %8s %8s %8s %6s %8s %8s %8s %8s %8s %8s %10s\n",
+                   "time/s", "start", "ready", "fail",
+                   "probes", "p50/ms", "p99/ms", "max/ms",
+                   "reqs", "p50/ms", "p99/ms", "max/ms",
+                   "rss/kB", "kB/cli", "pool/kB", "events");
+            fflush(stdout);
+
+            ramp_event = pa_context_rttime_new(probe, start_time, ramp_cb, NULL);
+            probe_event = pa_context_rttime_new(probe, start_time, probe_cb, NULL);
+            report_event = pa_context_rttime_new(probe, start_time + report_interval, report_cb, NULL);
+            break;
+
+        case PA_CONTEXT_FAILED:
+        case PA_CONTEXT_TERMINATED:
+            pa_log_error("Probe connection failed: %s", pa_strerror(pa_context_errno(ctx)));
+            api->quit(api, 1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void raise_fd_limit(void) {
+#ifdef HAVE_SYS_RESOURCE_H
+    struct rlimit rl;
+
+    /* Every client needs a socket and possibly memfds for the streams */
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        return;
+
+    rl.rlim_cur = rl.rlim_max;
+
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+        pa_log_warn("Failed to raise file descriptor limit: %s", pa_cstrerror(errno));
+    else if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t) n_clients * 4 + 64)
+        pa_log_warn("File descriptor limit %lu is probably too low for %u clients.", (unsigned long) rl.rlim_cur, n_clients);
+#endif
+}
+
+static int parse_msec(const char *s, pa_usec_t *usec) {
+    uint32_t v;
+
+    if (pa_atou(s, &v) < 0)
+        return -1;
+
+    *usec = (pa_usec_t) v * PA_USEC_PER_MSEC;
+    return 0;
+}
+
+static void help(const char *argv0) {
+    printf("%s [options]\n\n"
+           "-h, --help                            Show this help\n"
+           "-v, --verbose                         Print debug messages\n"
+           "-s, --server=SERVER                   The server to connect to\n"
+           "-n, --clients=N                       Number of clients to ramp up to (1000)\n"
+           "      --step=N                        Clients to add per ramp step (50)\n"
+           "      --step-interval=MSEC            Time between ramp steps (1000)\n"
+           "      --playback-every=N              Give every Nth client a playback stream,\n"
+           "                                      0 disables (10)\n"
+           "      --record-every=N                Give every Nth client a record stream,\n"
+           "                                      0 disables (20)\n"
+           "      --introspect-interval=MSEC      Time between introspection requests of\n"
+           "                                      each client (2000)\n"
+           "      --probe-interval=MSEC           Time between main loop probes (100)\n"
+           "      --report-interval=MSEC          Time between reports (1000)\n"
+           "      --hold=MSEC                     Keep running this long after all clients\n"
+           "                                      are started (10000)\n"
+           "      --pid=PID                       The daemon process, for memory statistics\n"
+           "                                      (defaults to the one in the runtime directory)\n",
+           argv0);
+}
+
+enum {
+    ARG_STEP = 256,
+    ARG_STEP_INTERVAL,
+    ARG_PLAYBACK_EVERY,
+    ARG_RECORD_EVERY,
+    ARG_INTROSPECT_INTERVAL,
+    ARG_PROBE_INTERVAL,
+    ARG_REPORT_INTERVAL,
+    ARG_HOLD,
+    ARG_PID
+};
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m = NULL;
+    int ret = 1, c;
+    unsigned i;
+    uint32_t pid;
+
+    static const struct option long_options[] = {
+        {"help",                  0, NULL, 'h'},
+        {"verbose",               0, NULL, 'v'},
+        {"server",                1, NULL, 's'},
+        {"clients",               1, NULL, 'n'},
+        {"step",                  1, NULL, ARG_STEP},
+        {"step-interval",         1, NULL, ARG_STEP_INTERVAL},
+        {"playback-every",        1, NULL, ARG_PLAYBACK_EVERY},
+        {"record-every",          1, NULL, ARG_RECORD_EVERY},
+        {"introspect-interval",   1, NULL, ARG_INTROSPECT_INTERVAL},
+        {"probe-interval",        1, NULL, ARG_PROBE_INTERVAL},
+        {"report-interval",       1, NULL, ARG_REPORT_INTERVAL},
+        {"hold",                  1, NULL, ARG_HOLD},
+        {"pid",                   1, NULL, ARG_PID},
+        {NULL,                    0, NULL, 0}
+    };
+
+    setlocale(LC_ALL, "");
+
+    pa_log_set_level(PA_LOG_WARN);
+
+    while ((c = getopt_long(argc, argv, "hvs:n:", long_options, NULL)) != -1) {
+
+        switch (c) {
+            case 'h':
+                help(argv[0]);
+                ret = 0;
+                goto quit;
+
+            case 'v':
+                pa_log_set_level(PA_LOG_DEBUG);
+                break;
+
+            case 's':
+                pa_xfree(server);
+                server = pa_xstrdup(optarg);
+                break;
+
+            case 'n':
+                if (pa_atou(optarg, &n_clients) < 0 || n_clients == 0) {
+                    pa_log_error("Invalid number of clients: %s", optarg);
+                    goto quit;
+                }
+                break;
+
+            case ARG_STEP:
+                if (pa_atou(optarg, &ramp_step) < 0 || ramp_step == 0) {
+                    pa_log_error("Invalid ramp step: %s", optarg);
+                    goto quit;
+                }
+                break;
+
+            case ARG_PLAYBACK_EVERY:
+                if (pa_atou(optarg, &playback_every) < 0) {
+                    pa_log_error("Invalid playback stream ratio: %s", optarg);
+                    goto quit;
+                }
+                break;
+
+            case ARG_RECORD_EVERY:
+                if (pa_atou(optarg, &record_every) < 0) {
+                    pa_log_error("Invalid record stream ratio: %s", optarg);
+                    goto quit;
+                }
+                break;
+
+            case ARG_STEP_INTERVAL:
+            case ARG_INTROSPECT_INTERVAL:
+            case ARG_PROBE_INTERVAL:
+            case ARG_REPORT_INTERVAL:
+            case ARG_HOLD: {
+                pa_usec_t *t =
+                    c == ARG_STEP_INTERVAL ? &ramp_interval :
+                    c == ARG_INTROSPECT_INTERVAL ? &introspect_interval :
+                    c == ARG_PROBE_INTERVAL ? &probe_interval :
+                    c == ARG_REPORT_INTERVAL ? &report_interval : &hold_time;
+
+                if (parse_msec(optarg, t) < 0 || (c != ARG_HOLD && *t == 0)) {
+                    pa_log_error("Invalid time: %s", optarg);
+                    goto quit;
+                }
+                break;
+            }
+
+            case ARG_PID:
+                if (pa_atou(optarg, &pid) < 0 || pid == 0) {
+                    pa_log_error("Invalid PID: %s", optarg);
+                    goto quit;
+                }
+                daemon_pid = (pid_t) pid;
+                break;
+
+            default:
+                goto quit;
+        }
+    }
+
+    if (daemon_pid == 0 && !server && pa_pid_file_check_running(&daemon_pid, "pulseaudio") < 0) {
+        pa_log_warn("Could not find the daemon process, not reporting memory usage.");
+        daemon_pid = 0;
+    }
+
+    raise_fd_limit();
+
+    /* All clients share one main loop, so that the harness itself needs
+     * no more than one thread regardless of the number of clients */
+    m = pa_mainloop_new();
+    api = pa_mainloop_get_api(m);
+
+    clients = pa_xnew0(client, n_clients);
+
+    if (!(probe = pa_context_new(api, "connect-scale probe"))) {
+        pa_log_error("pa_context_new() failed.");
+        goto quit;
+    }
+
+    pa_context_set_state_callback(probe, probe_state_cb, NULL);
+
+    if (pa_context_connect(probe, server, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
+        pa_log_error("pa_context_connect() failed: %s", pa_strerror(pa_context_errno(probe)));
+        goto quit;
+    }
+
+    if (pa_mainloop_run(m, &ret) < 0) {
+        pa_log_error("pa_mainloop_run() failed.");
+        ret = 1;
+    }
+
+quit:
+    if (clients) {
+        for (i = 0; i < n_started; i++)
+            client_free(&clients[i]);
+
+        pa_xfree(clients);
+    }
+
+    if (ramp_event)
+        api->time_free(ramp_event);
+    if (probe_event)
+        api->time_free(probe_event);
+    if (report_event)
+        api->time_free(report_event);
+
+    if (probe) {
+        pa_context_set_state_callback(probe, NULL, NULL);
+        pa_context_disconnect(probe);
+        pa_context_unref(probe);
+    }
+
+    if (m)
+        pa_mainloop_free(m);
+
+    pa_xfree(probe_stats.samples);
+    pa_xfree(request_stats.samples);
+    pa_xfree(server);
+
+    return ret;
+}
@@ -0,0 +1,160 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+#include <math.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <pulsecore/filter/convolver.h>
+
+#define N_INPUTS 3
+#define N_OUTPUTS 3
+#define PARTITION_SIZE 32
+#define IR_LENGTH 100
+#define N_FRAMES 2000
+#define MAX_ERROR 1e-5
+
+static float random_float(void) {
+    return (float) rand() / RAND_MAX * 2.0f - 1.0f;
+}
+
+/* Time domain reference, with the delay of the convolver */
+static void reference(const float *ir, bool *active, const float *src, float *dst, unsigned n_frames, unsigned latency) {
+    unsigned t, in, out, j;
+
+    for (t = 0; t < n_frames; t++) {
+        for (out = 0; out < N_OUTPUTS; out++) {
+            double sum = 0;
+
+            for (in = 0; in < N_INPUTS; in++) {
+                if (!active[in * N_OUTPUTS + out])
+                    continue;
+
+                for (j = 0; j < IR_LENGTH && j + latency <= t; j++)
+                    sum += src[(t - latency - j) * N_INPUTS + in] * ir[(in * N_OUTPUTS + out) * IR_LENGTH + j];
+            }
+
+            dst[t * N_OUTPUTS + out] = (float) sum;
+        }
+    }
+}
+
+static void compare(const float *a, const float *b, unsigned start, unsigned end) {
+    unsigned i;
+
+    for (i = start * N_OUTPUTS; i < end * N_OUTPUTS; i++) {
+        if (fabs(a[i] - b[i]) > MAX_ERROR) {
+            pa_log_error("Mismatch at frame %u, output %u: %f != %f", i / N_OUTPUTS, i % N_OUTPUTS, a[i], b[i]);
+            ck_abort();
+        }
+    }
+}
+
+START_TEST (convolver_test) {
+    pa_convolver *c;
+    float *ir, *src, *dst, *ref;
+    bool active[N_INPUTS * N_OUTPUTS];
+    unsigned i, in, out, done, rewind_pos, latency;
+
+    ir = pa_xnew(float, N_INPUTS * N_OUTPUTS * IR_LENGTH);
+    src = pa_xnew(float, N_FRAMES * N_INPUTS);
+    dst = pa_xnew(float, N_FRAMES * N_OUTPUTS);
+    ref = pa_xnew(float, N_FRAMES * N_OUTPUTS);
+
+    for (i = 0; i < N_INPUTS * N_OUTPUTS * IR_LENGTH; i++)
+        ir[i] = random_float() / IR_LENGTH;
+    for (i = 0; i < N_FRAMES * N_INPUTS; i++)
+        src[i] = random_float();
+
+    pa_assert_se(c = pa_convolver_new(N_INPUTS, N_OUTPUTS, PARTITION_SIZE, IR_LENGTH));
+    latency = pa_convolver_get_latency(c);
+
+    /* Leave one impulse response unset */
+    for (in = 0; in < N_INPUTS; in++) {
+        for (out = 0; out < N_OUTPUTS; out++) {
+            active[in * N_OUTPUTS + out] = in != 1 || out != 2;
+
+            if (active[in * N_OUTPUTS + out])
+                pa_convolver_set_ir(c, in, out, ir + (in * N_OUTPUTS + out) * IR_LENGTH, IR_LENGTH);
+        }
+    }
+
+    reference(ir, active, src, ref, N_FRAMES, latency);
+
+    /* Process in chunks that are not aligned to the partitions */
+    for (done = 0; done < N_FRAMES; ) {
+        unsigned n = PA_MIN(1 + (unsigned) rand() % 100, N_FRAMES - done);
+
+        pa_convolver_process(c, src + done * N_INPUTS, dst + done * N_OUTPUTS, n);
+        done += n;
+    }
+
+    compare(dst, ref, 0, N_FRAMES);
+
+    /* Rewind into the middle of a partition and reprocess */
+    rewind_pos = N_FRAMES / 2 + PARTITION_SIZE / 3;
+    pa_assert_se(rewind_pos >= pa_convolver_get_history(c));
+
+    pa_convolver_rewind(c, src + (rewind_pos - pa_convolver_get_history(c)) * N_INPUTS, pa_convolver_get_history(c));
+    memset(dst, 0, N_FRAMES * N_OUTPUTS * sizeof(float));
+    pa_convolver_process(c, src + rewind_pos * N_INPUTS, dst + rewind_pos * N_OUTPUTS, N_FRAMES - rewind_pos);
+
+    compare(dst, ref, rewind_pos, N_FRAMES);
+
+    /* After a reset the filter behaves as a new one */
+    pa_convolver_reset(c);
+    pa_convolver_process(c, src, dst, N_FRAMES);
+
+    compare(dst, ref, 0, N_FRAMES);
+
+    pa_convolver_free(c);
+
+    pa_xfree(ir);
+    pa_xfree(src);
+    pa_xfree(dst);
+    pa_xfree(ref);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Convolver");
+    tc = tcase_create("convolver");
+    tcase_add_test(tc, convolver_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,877 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Throughput of the dispatchable sample processing kernels. Every
+ * kernel is run with each instruction set level the CPU supports, for
+ * a range of buffer sizes and sample alignments. Unlike the cpu-*-test
+ * programs nothing is checked for correctness here; those tests cover
+ * that. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <locale.h>
+
+#include <pulse/rtclock.h>
+
+#include <pulsecore/cpu.h>
+#include <pulsecore/cpu-arm.h>
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/endianmacros.h>
+#include <pulsecore/random.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/mix.h>
+#include <pulsecore/remap.h>
+#include <pulsecore/sconv.h>
+#include <pulsecore/resampler.h>
+#include <pulsecore/filter/lfe-filter.h>
+
+#define MAX_FRAMES 16384
+#define MAX_CHANNELS 4
+#define MAX_ALIGN 16
+#define BUF_SIZE ((MAX_FRAMES * MAX_CHANNELS + MAX_ALIGN) * 4)
+#define VOLUME_PADDING 16
+#define ROUNDS 5
+#define ROUND_USEC 2000
+
+static PA_DECLARE_ALIGNED(64, uint8_t, buf_a[BUF_SIZE]);
+static PA_DECLARE_ALIGNED(64, uint8_t, buf_b[BUF_SIZE]);
+static PA_DECLARE_ALIGNED(64, uint8_t, buf_c[BUF_SIZE]);
+
+static const char *kernel_filter = NULL;
+static pa_mempool *pool = NULL;
+
+/* Snapshot of all dispatch tables, used to go back to the generic code
+ * before setting up the next instruction set level */
+typedef struct func_table {
+    pa_do_volume_func_t volume[PA_SAMPLE_MAX];
+    pa_do_volume_ramp_func_t volume_ramp[PA_SAMPLE_MAX];
+    pa_do_mix_func_t mix[PA_SAMPLE_MAX];
+    pa_convert_func_t to_float32ne[PA_SAMPLE_MAX], from_float32ne[PA_SAMPLE_MAX];
+    pa_convert_func_t to_s16ne[PA_SAMPLE_MAX], from_s16ne[PA_SAMPLE_MAX];
+    pa_init_remap_func_t init_remap;
+    pa_polyphase_dot_func_t polyphase_dot;
+} func_table;
+
+static func_table generic_funcs;
+
+static void save_funcs(func_table *t) {
+    pa_sample_format_t f;
+
+    for (f = 0; f < PA_SAMPLE_MAX; f++) {
+        t->volume[f] = pa_get_volume_func(f);
+        t->volume_ramp[f] = pa_get_volume_ramp_func(f);
+        t->mix[f] = pa_get_mix_func(f);
+        t->to_float32ne[f] = pa_get_convert_to_float32ne_function(f);
+        t->from_float32ne[f] = pa_get_convert_from_float32ne_function(f);
+        t->to_s16ne[f] = pa_get_convert_to_s16ne_function(f);
+        t->from_s16ne[f] = pa_get_convert_from_s16ne_function(f);
+    }
+
+    t->init_remap = pa_get_init_remap_func();
+    t->polyphase_dot = pa_get_polyphase_dot_func();
+}
+
+static void restore_funcs(const func_table *t) {
+    pa_sample_format_t f;
+
+    for (f = 0; f < PA_SAMPLE_MAX; f++) {
+        pa_set_volume_func(f, t->volume[f]);
+        pa_set_volume_ramp_func(f, t->volume_ramp[f]);
+        pa_set_mix_func(f, t->mix[f]);
+        pa_set_convert_to_float32ne_function(f, t->to_float32ne[f]);
+        pa_set_convert_from_float32ne_function(f, t->from_float32ne[f]);
+        pa_set_convert_to_s16ne_function(f, t->to_s16ne[f]);
+        pa_set_convert_from_s16ne_function(f, t->from_s16ne[f]);
+    }
+
+    pa_set_init_remap_func(t->init_remap);
+    pa_set_polyphase_dot_func(t->polyphase_dot);
+}
+
+/* Instruction set levels. Each one enables the flags of the previous
+ * levels plus its own, mirroring what pa_cpu_init() would do on a CPU
+ * that has exactly these extensions. */
+typedef struct isa_level {
+    const char *name;
+    unsigned required, mask;
+} isa_level;
+
+#if defined (__i386__) || defined (__amd64__)
+static const isa_level levels[] = {
+    { "generic", 0, 0 },
+    { "c",       0, 0 },
+    { "mmx",     PA_CPU_X86_MMX, PA_CPU_X86_MMX | PA_CPU_X86_MMXEXT | PA_CPU_X86_CMOV },
+    { "sse",     PA_CPU_X86_SSE2, PA_CPU_X86_MMX | PA_CPU_X86_MMXEXT | PA_CPU_X86_CMOV |
+                 PA_CPU_X86_SSE | PA_CPU_X86_SSE2 | PA_CPU_X86_SSE3 | PA_CPU_X86_SSSE3 |
+                 PA_CPU_X86_SSE4_1 | PA_CPU_X86_SSE4_2 },
+    { "avx",     PA_CPU_X86_AVX, PA_CPU_X86_MMX | PA_CPU_X86_MMXEXT | PA_CPU_X86_CMOV |
+                 PA_CPU_X86_SSE | PA_CPU_X86_SSE2 | PA_CPU_X86_SSE3 | PA_CPU_X86_SSSE3 |
+                 PA_CPU_X86_SSE4_1 | PA_CPU_X86_SSE4_2 | PA_CPU_X86_AVX },
+    { "avx2",    PA_CPU_X86_AVX2, ~0U & ~PA_CPU_X86_AVX512F },
+    { "avx512",  PA_CPU_X86_AVX512F, ~0U },
+};
+#elif defined (__arm__) || defined (__aarch64__)
+static const isa_level levels[] = {
+    { "generic", 0, 0 },
+    { "c",       0, 0 },
+    { "armv6",   PA_CPU_ARM_V6, ~0U & ~PA_CPU_ARM_NEON },
+    { "neon",    PA_CPU_ARM_NEON, ~0U },
+};
+#else
+static const isa_level levels[] = {
+    { "generic", 0, 0 },
+    { "c",       0, 0 },
+};
+#endif
+
+static unsigned get_cpu_flags(void) {
+#if defined (__i386__) || defined (__amd64__)
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+    return flags;
+#elif defined (__arm__) || defined (__aarch64__)
+    pa_cpu_arm_flag_t flags = 0;
+
+    pa_cpu_get_arm_flags(&flags);
+    return flags;
+#else
+    return 0;
+#endif
+}
+
+static void apply_level(const isa_level *l, unsigned cpu_flags) {
+    pa_cpu_info cpu_info = { PA_CPU_UNDEFINED, {}, false };
+    unsigned flags = cpu_flags & l->mask;
+
+    restore_funcs(&generic_funcs);
+
+    if (pa_streq(l->name, "generic"))
+        return;
+
+    /* The special cased C implementations */
+    pa_remap_func_init(&cpu_info);
+    pa_mix_func_init(&cpu_info);
+
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_MMX) {
+        pa_volume_func_init_mmx(flags);
+        pa_remap_func_init_mmx(flags);
+    }
+
+    if (flags & (PA_CPU_X86_SSE | PA_CPU_X86_SSE2)) {
+        pa_volume_func_init_sse(flags);
+        pa_remap_func_init_sse(flags);
+        pa_convert_func_init_sse(flags);
+        pa_mix_func_init_sse(flags);
+        pa_polyphase_func_init_x86(flags);
+    }
+
+    if (flags & PA_CPU_X86_AVX)
+        pa_volume_func_init_avx(flags);
+#elif defined (__arm__) || defined (__aarch64__)
+    if (flags & PA_CPU_ARM_V6)
+        pa_volume_func_init_arm(flags);
+
+#ifdef HAVE_NEON
+    if (flags & PA_CPU_ARM_NEON) {
+        pa_convert_func_init_neon(flags);
+        pa_mix_func_init_neon(flags);
+        pa_remap_func_init_neon(flags);
+        pa_polyphase_func_init_neon(flags);
+    }
+#endif
+#endif
+}
+
+/* Where available we count time stamp counter ticks, i.e. reference
+ * cycles at the nominal clock rate, which don't depend on frequency
+ * scaling. */
+static inline uint64_t read_cycles(void) {
+#if defined (__i386__) || defined (__amd64__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static bool have_cycles(void) {
+#if defined (__i386__) || defined (__amd64__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+typedef void (*bench_func_t)(void *userdata);
+
+static void measure(
+        const char *level,
+        const char *kernel,
+        unsigned frames,
+        unsigned align,
+        unsigned samples,
+        bench_func_t func,
+        void *userdata) {
+
+    unsigned n = 1, i, r;
+    pa_usec_t start, elapsed;
+    double best_cycles = 0, best_usec = 0;
+
+    /* Warm up caches and find an iteration count that runs for a
+     * measurable amount of time */
+    for (;;) {
+        start = pa_rtclock_now();
+        for (i = 0; i < n; i++)
+            func(userdata);
+        elapsed = pa_rtclock_now() - start;
+
+        if (elapsed >= ROUND_USEC || n >= (1U << 30))
+            break;
+
+        n *= 2;
+    }
+
+    for (r = 0; r < ROUNDS; r++) {
+        uint64_t c0, c1;
+        double cycles, usec;
+
+        start = pa_rtclock_now();
+        c0 = read_cycles();
+        for (i = 0; i < n; i++)
+            func(userdata);
+        c1 = read_cycles();
+        elapsed = pa_rtclock_now() - start;
+
+        cycles = (double) (c1 - c0) / n;
+        usec = (double) elapsed / n;
+
+        if (r == 0 || cycles < best_cycles)
+            best_cycles = cycles;
+        if (r == 0 || usec < best_usec)
+            best_usec = usec;
+    }
+
+    if (have_cycles() && best_cycles > 0)
+        printf("%-8s %-36s %6u %5u %12.3f %12.1f\n", level, kernel, frames, align,
+               samples / best_cycles, best_usec > 0 ? samples / best_usec : 0);
+    else
+        printf("%-8s %-36s %6u %5u %12s %12.1f\n", level, kernel, frames, align,
+               "-", best_usec > 0 ? samples / best_usec : 0);
+
+    fflush(stdout);
+}
+
+static bool kernel_wanted(const char *kernel) {
+    return !kernel_filter || strstr(kernel, kernel_filter);
+}
+
+static void fill_random(pa_sample_format_t f, void *p, unsigned n) {
+    unsigned i;
+
+    if (f == PA_SAMPLE_FLOAT32NE || f == PA_SAMPLE_FLOAT32RE) {
+        for (i = 0; i < n; i++)
+            ((float *) p)[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+
+        if (f == PA_SAMPLE_FLOAT32RE)
+            for (i = 0; i < n; i++)
+                ((uint32_t *) p)[i] = PA_UINT32_SWAP(((uint32_t *) p)[i]);
+    } else
+        pa_random(p, n * pa_sample_size_of_format(f));
+}
+
+/* Volume */
+
+struct volume_bench {
+    pa_do_volume_func_t func;
+    void *samples;
+    union {
+        int32_t i;
+        float f;
+    } volumes[MAX_CHANNELS + VOLUME_PADDING];
+    unsigned channels, length;
+};
+
+static void volume_run(void *userdata) {
+    struct volume_bench *b = userdata;
+
+    b->func(b->samples, b->volumes, b->channels, b->length);
+}
+
+static void bench_volume(const char *level, unsigned frames, unsigned align) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S16RE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    struct volume_bench b;
+    unsigned f, i;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        char kernel[64];
+        size_t ss = pa_sample_size_of_format(formats[f]);
+
+        pa_snprintf(kernel, sizeof(kernel), "volume %s 2ch", pa_sample_format_to_string(formats[f]));
+
+        if (!kernel_wanted(kernel) || !(b.func = pa_get_volume_func(formats[f])))
+            continue;
+
+        b.channels = 2;
+        b.samples = buf_a + align * ss;
+        b.length = frames * b.channels * ss;
+
+        /* Unity gain, so that repeated runs don't saturate or
+         * produce denormals */
+        for (i = 0; i < PA_ELEMENTSOF(b.volumes); i++) {
+            if (formats[f] == PA_SAMPLE_FLOAT32NE)
+                b.volumes[i].f = 1.0f;
+            else
+                b.volumes[i].i = 0x10000;
+        }
+
+        fill_random(formats[f], b.samples, frames * b.channels);
+        measure(level, kernel, frames, align, frames * b.channels, volume_run, &b);
+    }
+}
+
+/* Volume ramps */
+
+struct volume_ramp_bench {
+    pa_do_volume_ramp_func_t func;
+    void *samples;
+    float volumes[MAX_CHANNELS], steps[MAX_CHANNELS];
+    unsigned channels, length;
+};
+
+static void volume_ramp_run(void *userdata) {
+    struct volume_ramp_bench *b = userdata;
+    unsigned c;
+
+    /* Start over every time so that the factors stay in range */
+    for (c = 0; c < b->channels; c++)
+        b->volumes[c] = 0.5f;
+
+    b->func(b->samples, b->volumes, b->steps, b->channels, b->length);
+}
+
+static void bench_volume_ramp(const char *level, unsigned frames, unsigned align) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    struct volume_ramp_bench b;
+    unsigned f, c;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        char kernel[64];
+        size_t ss = pa_sample_size_of_format(formats[f]);
+
+        pa_snprintf(kernel, sizeof(kernel), "volume-ramp %s 2ch", pa_sample_format_to_string(formats[f]));
+
+        if (!kernel_wanted(kernel) || !(b.func = pa_get_volume_ramp_func(formats[f])))
+            continue;
+
+        b.channels = 2;
+        b.samples = buf_a + align * ss;
+        b.length = frames * b.channels * ss;
+
+        for (c = 0; c < b.channels; c++)
+            b.steps[c] = 0.5f / frames;
+
+        fill_random(formats[f], b.samples, frames * b.channels);
+        measure(level, kernel, frames, align, frames * b.channels, volume_ramp_run, &b);
+    }
+}
+
+/* Mixing */
+
+struct mix_bench {
+    pa_do_mix_func_t func;
+    pa_mix_info streams[2];
+    void *data;
+    unsigned channels, length;
+};
+
+static void mix_run(void *userdata) {
+    struct mix_bench *b = userdata;
+
+    b->func(b->streams, 2, b->channels, b->data, b->length);
+}
+
+static void bench_mix(const char *level, unsigned frames, unsigned align) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    static const unsigned channels[] = { 1, 2, 4 };
+    struct mix_bench b;
+    unsigned f, c, i, j;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        for (c = 0; c < PA_ELEMENTSOF(channels); c++) {
+            char kernel[64];
+            size_t ss = pa_sample_size_of_format(formats[f]);
+
+            pa_snprintf(kernel, sizeof(kernel), "mix %s %uch", pa_sample_format_to_string(formats[f]), channels[c]);
+
+            if (!kernel_wanted(kernel) || !(b.func = pa_get_mix_func(formats[f])))
+                continue;
+
+            pa_zero(b.streams);
+            b.channels = channels[c];
+            b.length = frames * b.channels * ss;
+            b.data = buf_c + align * ss;
+            b.streams[0].ptr = buf_a + align * ss;
+            b.streams[1].ptr = buf_b + align * ss;
+
+            for (i = 0; i < 2; i++) {
+                fill_random(formats[f], b.streams[i].ptr, frames * b.channels);
+
+                for (j = 0; j < PA_ELEMENTSOF(b.streams[i].linear); j++) {
+                    if (formats[f] == PA_SAMPLE_FLOAT32NE)
+                        b.streams[i].linear[j].f = 0.5f;
+                    else
+                        b.streams[i].linear[j].i = 0x8000;
+                }
+            }
+
+            measure(level, kernel, frames, align, frames * b.channels * 2, mix_run, &b);
+        }
+    }
+}
+
+/* Channel remapping */
+
+struct remap_bench {
+    pa_remap_t remap;
+    void *src, *dst;
+    unsigned frames;
+};
+
+static void remap_run(void *userdata) {
+    struct remap_bench *b = userdata;
+
+    b->remap.do_remap(&b->remap, b->dst, b->src, b->frames);
+}
+
+static void bench_remap(const char *level, unsigned frames, unsigned align) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_FLOAT32NE };
+    static const struct {
+        unsigned in, out;
+        bool rearrange;
+    } layouts[] = {
+        { 1, 2, false },
+        { 1, 4, false },
+        { 2, 1, false },
+        { 2, 4, false },
+        { 4, 2, false },
+        { 2, 2, true },
+    };
+    struct remap_bench b;
+    unsigned f, l, i, o;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        for (l = 0; l < PA_ELEMENTSOF(layouts); l++) {
+            char kernel[64];
+            size_t ss = pa_sample_size_of_format(formats[f]);
+
+            pa_snprintf(kernel, sizeof(kernel), "remap %s %u->%uch%s", pa_sample_format_to_string(formats[f]),
+                        layouts[l].in, layouts[l].out, layouts[l].rearrange ? " arrange" : "");
+
+            if (!kernel_wanted(kernel))
+                continue;
+
+            pa_zero(b.remap);
+            b.remap.format = formats[f];
+            b.remap.i_ss.channels = (uint8_t) layouts[l].in;
+            b.remap.o_ss.channels = (uint8_t) layouts[l].out;
+
+            for (o = 0; o < layouts[l].out; o++)
+                for (i = 0; i < layouts[l].in; i++) {
+                    if (layouts[l].rearrange) {
+                        b.remap.map_table_f[o][i] = (o == i) ? 1.0f : 0.0f;
+                        b.remap.map_table_i[o][i] = (o == i) ? 0x10000 : 0;
+                    } else {
+                        b.remap.map_table_f[o][i] = 1.0f / layouts[l].in;
+                        b.remap.map_table_i[o][i] = 0x10000 / layouts[l].in;
+                    }
+                }
+
+            pa_init_remap_func(&b.remap);
+
+            if (!b.remap.do_remap)
+                continue;
+
+            b.frames = frames;
+            b.src = buf_a + align * ss;
+            b.dst = buf_b + align * ss;
+
+            fill_random(formats[f], b.src, frames * layouts[l].in);
+            measure(level, kernel, frames, align, frames * layouts[l].in, remap_run, &b);
+        }
+    }
+}
+
+/* Sample format conversion */
+
+struct sconv_bench {
+    pa_convert_func_t func;
+    void *src, *dst;
+    unsigned n;
+};
+
+static void sconv_run(void *userdata) {
+    struct sconv_bench *b = userdata;
+
+    b->func(b->n, b->src, b->dst);
+}
+
+static void bench_sconv(const char *level, unsigned frames, unsigned align) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S16RE, PA_SAMPLE_S24NE,
+                                                  PA_SAMPLE_S24_32NE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32RE };
+    struct sconv_bench b;
+    unsigned f, d;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        for (d = 0; d < 2; d++) {
+            char kernel[64];
+            size_t ss = pa_sample_size_of_format(formats[f]);
+
+            if (d == 0) {
+                pa_snprintf(kernel, sizeof(kernel), "sconv %s->float32ne", pa_sample_format_to_string(formats[f]));
+                b.func = pa_get_convert_to_float32ne_function(formats[f]);
+                b.src = buf_a + align * ss;
+                b.dst = buf_b + align * sizeof(float);
+            } else {
+                pa_snprintf(kernel, sizeof(kernel), "sconv float32ne->%s", pa_sample_format_to_string(formats[f]));
+                b.func = pa_get_convert_from_float32ne_function(formats[f]);
+                b.src = buf_a + align * sizeof(float);
+                b.dst = buf_b + align * ss;
+            }
+
+            if (!kernel_wanted(kernel) || !b.func)
+                continue;
+
+            /* Stereo */
+            b.n = frames * 2;
+
+            fill_random(d == 0 ? formats[f] : PA_SAMPLE_FLOAT32NE, b.src, b.n);
+            measure(level, kernel, frames, align, b.n, sconv_run, &b);
+        }
+    }
+}
+
+/* The inner loop of the polyphase resampler */
+
+struct dot_bench {
+    pa_polyphase_dot_func_t func;
+    const float *a, *b;
+    unsigned n;
+    volatile float result;
+};
+
+static void dot_run(void *userdata) {
+    struct dot_bench *b = userdata;
+
+    b->result = b->func(b->a, b->b, b->n);
+}
+
+static void bench_polyphase_dot(const char *level, unsigned frames, unsigned align) {
+    struct dot_bench b;
+    const char *kernel = "polyphase dot";
+
+    if (!kernel_wanted(kernel) || frames % 8)
+        return;
+
+    b.func = pa_get_polyphase_dot_func();
+    b.a = (const float *) buf_a + align;
+    b.b = (const float *) buf_b + align;
+    b.n = frames;
+
+    fill_random(PA_SAMPLE_FLOAT32NE, (float *) b.a, frames);
+    fill_random(PA_SAMPLE_FLOAT32NE, (float *) b.b, frames);
+    measure(level, kernel, frames, align, frames, dot_run, &b);
+}
+
+/* Resamplers and the LFE crossover filter use memblocks, so they can
+ * only be run at the alignment the memory pool hands out */
+
+struct resampler_bench {
+    pa_resampler *r;
+    pa_memchunk in;
+};
+
+static void resampler_run(void *userdata) {
+    struct resampler_bench *b = userdata;
+    pa_memchunk out;
+
+    pa_resampler_run(b->r, &b->in, &out);
+
+    if (out.memblock)
+        pa_memblock_unref(out.memblock);
+}
+
+static void bench_resamplers(const char *level, unsigned frames) {
+    static const uint32_t rates[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 48000, 96000 } };
+    struct resampler_bench b;
+    pa_resample_method_t m;
+    unsigned i;
+
+    for (m = 0; m < PA_RESAMPLER_MAX; m++) {
+        if (m == PA_RESAMPLER_AUTO || m == PA_RESAMPLER_COPY || !pa_resample_method_supported(m))
+            continue;
+
+        for (i = 0; i < PA_ELEMENTSOF(rates); i++) {
+            pa_sample_spec a, o;
+            char kernel[64];
+            void *d;
+
+            pa_snprintf(kernel, sizeof(kernel), "resampler %s %u->%u", pa_resample_method_to_string(m),
+                        rates[i][0], rates[i][1]);
+
+            if (!kernel_wanted(kernel))
+                continue;
+
+            a.format = o.format = PA_SAMPLE_FLOAT32NE;
+            a.channels = o.channels = 2;
+            a.rate = rates[i][0];
+            o.rate = rates[i][1];
+
+            if (!(b.r = pa_resampler_new(pool, &a, NULL, &o, NULL, 0, m, 0)))
+                continue;
+
+            if (frames * pa_frame_size(&a) > pa_resampler_max_block_size(b.r)) {
+                pa_resampler_free(b.r);
+                continue;
+            }
+
+            b.in.memblock = pa_memblock_new(pool, frames * pa_frame_size(&a));
+            b.in.index = 0;
+            b.in.length = pa_memblock_get_length(b.in.memblock);
+
+            d = pa_memblock_acquire(b.in.memblock);
+            fill_random(PA_SAMPLE_FLOAT32NE, d, frames * 2);
+            pa_memblock_release(b.in.memblock);
+
+            measure(level, kernel, frames, 0, frames * 2, resampler_run, &b);
+
+            pa_memblock_unref(b.in.memblock);
+            pa_resampler_free(b.r);
+        }
+    }
+}
+
+struct lfe_bench {
+    pa_lfe_filter_t *lfe;
+    pa_memchunk chunk;
+};
+
+static void lfe_run(void *userdata) {
+    struct lfe_bench *b = userdata;
+
+    pa_lfe_filter_process(b->lfe, &b->chunk);
+}
+
+static void bench_lfe(const char *level, unsigned frames) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_FLOAT32NE };
+    pa_channel_map map = { 3, { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_RIGHT, PA_CHANNEL_POSITION_LFE } };
+    struct lfe_bench b;
+    unsigned f;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        pa_sample_spec ss;
+        char kernel[64];
+        void *d;
+
+        pa_snprintf(kernel, sizeof(kernel), "lfe-filter %s 2.1ch", pa_sample_format_to_string(formats[f]));
+
+        if (!kernel_wanted(kernel))
+            continue;
+
+        ss.format = formats[f];
+        ss.channels = 3;
+        ss.rate = 48000;
+
+        if (!(b.lfe = pa_lfe_filter_new(&ss, &map, 120, 0)))
+            continue;
+
+        b.chunk.memblock = pa_memblock_new(pool, frames * pa_frame_size(&ss));
+        b.chunk.index = 0;
+        b.chunk.length = pa_memblock_get_length(b.chunk.memblock);
+
+        d = pa_memblock_acquire(b.chunk.memblock);
+        fill_random(formats[f], d, frames * ss.channels);
+        pa_memblock_release(b.chunk.memblock);
+
+        measure(level, kernel, frames, 0, frames * ss.channels, lfe_run, &b);
+
+        pa_memblock_unref(b.chunk.memblock);
+        pa_lfe_filter_free(b.lfe);
+    }
+}
+
+static int parse_list(const char *s, unsigned *v, unsigned max_n, unsigned max_value) {
+    const char *state = NULL;
+    char *k;
+    unsigned n = 0;
+
+    while ((k = pa_split(s, ",", &state))) {
+        if (n >= max_n || pa_atou(k, &v[n]) < 0 || v[n] > max_value) {
+            pa_xfree(k);
+            return -1;
+        }
+
+        pa_xfree(k);
+        n++;
+    }
+
+    return (int) n;
+}
+
+static void help(const char *argv0) {
+    printf("%s [options]\n\n"
+           "-h, --help                            Show this help\n"
+           "-v, --verbose                         Print debug messages\n"
+           "      --sizes=FRAMES,...              Buffer sizes in frames (defaults to\n"
+           "                                      64,256,1024,4096)\n"
+           "      --alignments=SAMPLES,...        Sample offsets from a 64 byte boundary\n"
+           "                                      (defaults to 0,1,3)\n"
+           "      --level=NAME                    Only run this instruction set level\n"
+           "      --kernel=STRING                 Only run kernels whose name contains STRING\n"
+           "\n"
+           "Throughput is reported in samples per reference cycle where a cycle counter\n"
+           "is available, and in samples per microsecond.\n",
+           argv0);
+}
+
+enum {
+    ARG_SIZES = 256,
+    ARG_ALIGNMENTS,
+    ARG_LEVEL,
+    ARG_KERNEL
+};
+
+int main(int argc, char *argv[]) {
+    unsigned sizes[16] = { 64, 256, 1024, 4096 }, alignments[16] = { 0, 1, 3 };
+    unsigned n_sizes = 4, n_alignments = 3;
+    const char *level_filter = NULL;
+    unsigned cpu_flags, l, s, a;
+    int ret = 1, c, n;
+
+    static const struct option long_options[] = {
+        {"help",                  0, NULL, 'h'},
+        {"verbose",               0, NULL, 'v'},
+        {"sizes",                 1, NULL, ARG_SIZES},
+        {"alignments",            1, NULL, ARG_ALIGNMENTS},
+        {"level",                 1, NULL, ARG_LEVEL},
+        {"kernel",                1, NULL, ARG_KERNEL},
+        {NULL,                    0, NULL, 0}
+    };
+
+    setlocale(LC_ALL, "");
+
+    pa_log_set_level(PA_LOG_WARN);
+
+    while ((c = getopt_long(argc, argv, "hv", long_options, NULL)) != -1) {
+
+        switch (c) {
+            case 'h':
+                help(argv[0]);
+                ret = 0;
+                goto quit;
+
+            case 'v':
+                pa_log_set_level(PA_LOG_DEBUG);
+                break;
+
+            case ARG_SIZES:
+                if ((n = parse_list(optarg, sizes, PA_ELEMENTSOF(sizes), MAX_FRAMES)) <= 0) {
+                    pa_log_error("Invalid buffer sizes: %s", optarg);
+                    goto quit;
+                }
+                n_sizes = (unsigned) n;
+                break;
+
+            case ARG_ALIGNMENTS:
+                if ((n = parse_list(optarg, alignments, PA_ELEMENTSOF(alignments), MAX_ALIGN - 1)) <= 0) {
+                    pa_log_error("Invalid alignments: %s", optarg);
+                    goto quit;
+                }
+                n_alignments = (unsigned) n;
+                break;
+
+            case ARG_LEVEL:
+                level_filter = optarg;
+                break;
+
+            case ARG_KERNEL:
+                kernel_filter = optarg;
+                break;
+
+            default:
+                goto quit;
+        }
+    }
+
+    pa_assert_se(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true));
+
+    /* Set up the plain C implementations and remember them */
+    {
+        pa_cpu_info cpu_info = { PA_CPU_UNDEFINED, {}, true };
+
+        pa_remap_func_init(&cpu_info);
+        pa_mix_func_init(&cpu_info);
+        save_funcs(&generic_funcs);
+    }
+
+    cpu_flags = get_cpu_flags();
+
+    printf("%-8s %-36s %6s %5s %12s %12s\n", "level", "kernel", "frames", "align", "samples/cyc", "samples/usec");
+
+    for (l = 0; l < PA_ELEMENTSOF(levels); l++) {
+        if ((levels[l].required & cpu_flags) != levels[l].required)
+            continue;
+
+        if (level_filter && !pa_streq(level_filter, levels[l].name))
+            continue;
+
+        apply_level(&levels[l], cpu_flags);
+
+        for (s = 0; s < n_sizes; s++) {
+            for (a = 0; a < n_alignments; a++) {
+                bench_volume(levels[l].name, sizes[s], alignments[a]);
+                bench_volume_ramp(levels[l].name, sizes[s], alignments[a]);
+                bench_mix(levels[l].name, sizes[s], alignments[a]);
+                bench_remap(levels[l].name, sizes[s], alignments[a]);
+                bench_sconv(levels[l].name, sizes[s], alignments[a]);
+                bench_polyphase_dot(levels[l].name, sizes[s], alignments[a]);
+            }
+
+            bench_resamplers(levels[l].name, sizes[s]);
+            bench_lfe(levels[l].name, sizes[s]);
+        }
+    }
+
+    restore_funcs(&generic_funcs);
+    ret = 0;
+
+quit:
+    if (pool)
+        pa_mempool_unref(pool);
+
+    return ret;
+}
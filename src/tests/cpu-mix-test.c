@@ -23,6 +23,7 @@
 
 #include <pulsecore/cpu.h>
 #include <pulsecore/cpu-arm.h>
+#include <pulsecore/cpu-x86.h>
 #include <pulsecore/random.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/mix.h>
@@ -196,6 +197,207 @@ START_TEST (mix_neon_test) {
 END_TEST
 #endif /* defined (__arm__) && defined (__linux__) && defined (HAVE_NEON) */
 
+#define NSTREAMS_MAX 9
+
+/* Mixes nstreams streams of random data in the given format with random
+ * volumes and compares the result bit by bit with the reference function */
+static void run_mix_format_test(
+        pa_do_mix_func_t func,
+        pa_do_mix_func_t orig_func,
+        pa_sample_format_t format,
+        unsigned nstreams,
+        unsigned channels,
+        int align,
+        bool perf) {
+
+    pa_sample_spec ss;
+    pa_mempool *pool;
+    pa_mix_info m[NSTREAMS_MAX];
+    pa_memblock *out, *out_ref;
+    uint8_t *samples, *samples_ref;
+    size_t fs, length;
+    unsigned i, c;
+
+    pa_assert(nstreams <= NSTREAMS_MAX);
+    pa_assert(channels <= 8);
+
+    ss.format = format;
+    ss.rate = 44100;
+    ss.channels = channels;
+    fs = pa_frame_size(&ss);
+
+    /* Misalign the buffers by align samples */
+    length = (SAMPLES - 8) * fs;
+
+    fail_unless((pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true)) != NULL, NULL);
+
+    for (i = 0; i < nstreams; i++) {
+        m[i].chunk.memblock = pa_memblock_new(pool, SAMPLES * fs);
+        m[i].chunk.index = align * pa_sample_size(&ss);
+        m[i].chunk.length = length;
+
+        if (format == PA_SAMPLE_FLOAT32NE) {
+            float *f = pa_memblock_acquire_chunk(&m[i].chunk);
+            size_t j;
+
+            for (j = 0; j < length / sizeof(float); j++)
+                f[j] = (float) (rand() - RAND_MAX / 2) / (RAND_MAX / 2);
+
+            pa_memblock_release(m[i].chunk.memblock);
+        } else {
+            pa_random(pa_memblock_acquire_chunk(&m[i].chunk), length);
+            pa_memblock_release(m[i].chunk.memblock);
+        }
+
+        /* Include muted channels and amplification */
+        for (c = 0; c < channels; c++) {
+            if (format == PA_SAMPLE_FLOAT32NE)
+                m[i].linear[c].f = (i + c) % 5 == 0 ? 0.0f : (float) ((i + c) % 7) / 3.0f;
+            else
+                m[i].linear[c].i = (i + c) % 5 == 0 ? 0 : 0x5555 * (int32_t) ((i + c) % 7);
+        }
+    }
+
+    out = pa_memblock_new(pool, SAMPLES * fs);
+    out_ref = pa_memblock_new(pool, SAMPLES * fs);
+    samples = (uint8_t*) pa_memblock_acquire(out) + align * pa_sample_size(&ss);
+    samples_ref = (uint8_t*) pa_memblock_acquire(out_ref) + align * pa_sample_size(&ss);
+
+    acquire_mix_streams(m, nstreams);
+    orig_func(m, nstreams, channels, samples_ref, length);
+    release_mix_streams(m, nstreams);
+
+    acquire_mix_streams(m, nstreams);
+    func(m, nstreams, channels, samples, length);
+    release_mix_streams(m, nstreams);
+
+    if (memcmp(samples, samples_ref, length) != 0) {
+        pa_log_debug("Correctness test failed: format=%s, streams=%u, channels=%u, align=%d",
+                     pa_sample_format_to_string(format), nstreams, channels, align);
+        ck_abort();
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %s %u-stream %u-channel mixing performance with %d sample alignment",
+                     pa_sample_format_to_string(format), nstreams, channels, align);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            acquire_mix_streams(m, nstreams);
+            func(m, nstreams, channels, samples, length);
+            release_mix_streams(m, nstreams);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            acquire_mix_streams(m, nstreams);
+            orig_func(m, nstreams, channels, samples_ref, length);
+            release_mix_streams(m, nstreams);
+        } PA_RUNTIME_TEST_RUN_STOP
+    }
+
+    pa_memblock_release(out);
+    pa_memblock_release(out_ref);
+    pa_memblock_unref(out);
+    pa_memblock_unref(out_ref);
+
+    for (i = 0; i < nstreams; i++)
+        pa_memblock_unref(m[i].chunk.memblock);
+
+    pa_mempool_unref(pool);
+}
+
+static void run_mix_format_tests(pa_do_mix_func_t func, pa_do_mix_func_t orig_func, pa_sample_format_t format) {
+    unsigned nstreams, channels;
+
+    for (nstreams = 2; nstreams <= NSTREAMS_MAX; nstreams += 7)
+        for (channels = 1; channels <= 8; channels++)
+            run_mix_format_test(func, orig_func, format, nstreams, channels, 3, false);
+
+    run_mix_format_test(func, orig_func, format, 2, 2, 1, true);
+    run_mix_format_test(func, orig_func, format, NSTREAMS_MAX, 6, 1, true);
+}
+
+START_TEST (mix_channels_test) {
+    pa_cpu_info cpu_info = { PA_CPU_UNDEFINED, {}, true };
+    const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    const unsigned channels[] = { 2, 6 };
+    pa_do_mix_func_t orig_func[PA_ELEMENTSOF(formats)];
+    unsigned f, c, nstreams;
+
+    /* The functions specialized for a channel count have to match the
+     * generic ones */
+    pa_mix_func_init(&cpu_info);
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++)
+        orig_func[f] = pa_get_mix_func(formats[f]);
+
+    cpu_info.force_generic_code = false;
+    pa_mix_func_init(&cpu_info);
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++)
+        for (c = 0; c < PA_ELEMENTSOF(channels); c++) {
+            pa_do_mix_func_t func = pa_get_mix_func_for_channels(formats[f], channels[c]);
+
+            pa_log_debug("Checking %u-channel mix (%s)", channels[c], pa_sample_format_to_string(formats[f]));
+
+            for (nstreams = 2; nstreams <= NSTREAMS_MAX; nstreams += 7)
+                run_mix_format_test(func, orig_func[f], formats[f], nstreams, channels[c], 3, false);
+
+            run_mix_format_test(func, orig_func[f], formats[f], NSTREAMS_MAX, channels[c], 1, true);
+        }
+}
+END_TEST
+
+#if defined (__i386__) || defined (__amd64__)
+
+START_TEST (mix_sse_test) {
+    pa_cpu_info cpu_info = { PA_CPU_UNDEFINED, {}, true };
+    pa_cpu_x86_flag_t flags = 0;
+    pa_do_mix_func_t orig_s16, orig_s32, orig_float;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    /* Run the SIMD variants one by one, from the oldest instruction set
+     * to the newest */
+    pa_mix_func_init(&cpu_info);
+    orig_s16 = pa_get_mix_func(PA_SAMPLE_S16NE);
+    orig_s32 = pa_get_mix_func(PA_SAMPLE_S32NE);
+    orig_float = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+
+    if (flags & PA_CPU_X86_SSE) {
+        pa_log_debug("Checking SSE mix (float)");
+        pa_mix_func_init_sse(PA_CPU_X86_SSE);
+        run_mix_format_tests(pa_get_mix_func(PA_SAMPLE_FLOAT32NE), orig_float, PA_SAMPLE_FLOAT32NE);
+    }
+
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_debug("Checking SSE2 mix (s16)");
+        pa_mix_func_init_sse(PA_CPU_X86_SSE | PA_CPU_X86_SSE2);
+        run_mix_format_tests(pa_get_mix_func(PA_SAMPLE_S16NE), orig_s16, PA_SAMPLE_S16NE);
+    }
+
+    if (flags & PA_CPU_X86_AVX) {
+        pa_log_debug("Checking AVX mix (float)");
+        pa_mix_func_init_sse(flags & (PA_CPU_X86_SSE | PA_CPU_X86_SSE2 | PA_CPU_X86_AVX));
+        run_mix_format_tests(pa_get_mix_func(PA_SAMPLE_FLOAT32NE), orig_float, PA_SAMPLE_FLOAT32NE);
+    }
+
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_debug("Checking AVX2 mix (s16, s32)");
+        pa_mix_func_init_sse(flags & (PA_CPU_X86_SSE | PA_CPU_X86_SSE2 | PA_CPU_X86_AVX | PA_CPU_X86_AVX2));
+        run_mix_format_tests(pa_get_mix_func(PA_SAMPLE_S16NE), orig_s16, PA_SAMPLE_S16NE);
+        run_mix_format_tests(pa_get_mix_func(PA_SAMPLE_S32NE), orig_s32, PA_SAMPLE_S32NE);
+    }
+
+    if (flags & PA_CPU_X86_AVX512F) {
+        pa_log_debug("Checking AVX-512 mix (float)");
+        pa_mix_func_init_sse(flags);
+        run_mix_format_tests(pa_get_mix_func(PA_SAMPLE_FLOAT32NE), orig_float, PA_SAMPLE_FLOAT32NE);
+    }
+
+    pa_mix_func_init(&cpu_info);
+}
+END_TEST
+#endif /* defined (__i386__) || defined (__amd64__) */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -209,8 +411,12 @@ int main(int argc, char *argv[]) {
 
     tc = tcase_create("mix");
     tcase_add_test(tc, mix_special_test);
+    tcase_add_test(tc, mix_channels_test);
 #if defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)
     tcase_add_test(tc, mix_neon_test);
+#endif
+#if defined (__i386__) || defined (__amd64__)
+    tcase_add_test(tc, mix_sse_test);
 #endif
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
@@ -0,0 +1,218 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/random.h>
+#include <pulsecore/resampler.h>
+
+#include "runtime-test-util.h"
+
+#define FRAMES 1027
+#define CHANNELS_MAX 8
+#define TIMES 1000
+#define TIMES2 100
+
+static int16_t s16[FRAMES * CHANNELS_MAX];
+static float f32[FRAMES * CHANNELS_MAX];
+
+static void fill_samples(void) {
+    unsigned i;
+
+    pa_random(s16, sizeof(s16));
+
+    for (i = 0; i < PA_ELEMENTSOF(f32); i++)
+        f32[i] = (float) (rand() - RAND_MAX / 2) / (RAND_MAX / 2);
+
+    /* The one value whose absolute value does not fit */
+    s16[5 * CHANNELS_MAX + 3] = -0x8000;
+    f32[7 * CHANNELS_MAX + 1] = NAN;
+}
+
+/* Compares the peaks over n_frames frames, starting at an odd sample so
+ * that nothing is aligned */
+static void run_peaks_test(
+        pa_peaks_s16_func_t func_s16,
+        pa_peaks_s16_func_t orig_s16,
+        pa_peaks_float_func_t func_float,
+        pa_peaks_float_func_t orig_float,
+        unsigned channels,
+        unsigned n_frames,
+        bool perf) {
+
+    int16_t max_i[PA_CHANNELS_MAX] = { 0 }, max_i_ref[PA_CHANNELS_MAX] = { 0 };
+    float max_f[PA_CHANNELS_MAX] = { 0 }, max_f_ref[PA_CHANNELS_MAX] = { 0 };
+    unsigned c;
+
+    pa_assert(n_frames < FRAMES);
+
+    if (func_s16) {
+        orig_s16(s16 + 1, channels, n_frames, max_i_ref);
+        func_s16(s16 + 1, channels, n_frames, max_i);
+
+        for (c = 0; c < channels; c++)
+            if (max_i[c] != max_i_ref[c]) {
+                pa_log_debug("Correctness test failed: s16, channels=%u, frames=%u, channel %u: %d != %d",
+                             channels, n_frames, c, max_i[c], max_i_ref[c]);
+                ck_abort();
+            }
+    }
+
+    if (func_float) {
+        orig_float(f32 + 1, channels, n_frames, max_f_ref);
+        func_float(f32 + 1, channels, n_frames, max_f);
+
+        for (c = 0; c < channels; c++)
+            if (max_f[c] != max_f_ref[c]) {
+                pa_log_debug("Correctness test failed: float, channels=%u, frames=%u, channel %u: %f != %f",
+                             channels, n_frames, c, max_f[c], max_f_ref[c]);
+                ck_abort();
+            }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %u-channel peak detection performance", channels);
+
+        if (func_s16) {
+            PA_RUNTIME_TEST_RUN_START("s16 func", TIMES, TIMES2) {
+                func_s16(s16 + 1, channels, n_frames, max_i);
+            } PA_RUNTIME_TEST_RUN_STOP
+
+            PA_RUNTIME_TEST_RUN_START("s16 orig", TIMES, TIMES2) {
+                orig_s16(s16 + 1, channels, n_frames, max_i_ref);
+            } PA_RUNTIME_TEST_RUN_STOP
+        }
+
+        if (func_float) {
+            PA_RUNTIME_TEST_RUN_START("float func", TIMES, TIMES2) {
+                func_float(f32 + 1, channels, n_frames, max_f);
+            } PA_RUNTIME_TEST_RUN_STOP
+
+            PA_RUNTIME_TEST_RUN_START("float orig", TIMES, TIMES2) {
+                orig_float(f32 + 1, channels, n_frames, max_f_ref);
+            } PA_RUNTIME_TEST_RUN_STOP
+        }
+    }
+}
+
+static void run_peaks_tests(
+        pa_peaks_s16_func_t func_s16,
+        pa_peaks_s16_func_t orig_s16,
+        pa_peaks_float_func_t func_float,
+        pa_peaks_float_func_t orig_float) {
+
+    unsigned channels, n_frames;
+
+    for (channels = 1; channels <= CHANNELS_MAX; channels++)
+        for (n_frames = 0; n_frames < FRAMES; n_frames += n_frames < 40 ? 1 : 97)
+            run_peaks_test(func_s16, orig_s16, func_float, orig_float, channels, n_frames, false);
+
+    run_peaks_test(func_s16, orig_s16, func_float, orig_float, 2, FRAMES - 1, true);
+}
+
+START_TEST (peaks_find_test) {
+    const pa_sample_spec ss = { PA_SAMPLE_S16NE, 44100, 2 }, ss_f = { PA_SAMPLE_FLOAT32NE, 44100, 2 };
+    const pa_sample_spec ss_u8 = { PA_SAMPLE_U8, 44100, 2 };
+    const int16_t s[] = { 0x4000, -0x2000, -0x8000, 0x1000 };
+    const float f[] = { -0.25f, 0.125f, 0.5f, -1.0f };
+    float peaks[2];
+
+    fail_unless(pa_peaks_find(s, &ss, 2, peaks));
+    fail_unless(peaks[0] == 1.0f);
+    fail_unless(fabsf(peaks[1] - 0.25f) < 0.001f);
+
+    fail_unless(pa_peaks_find(f, &ss_f, 2, peaks));
+    fail_unless(peaks[0] == 0.5f);
+    fail_unless(peaks[1] == 1.0f);
+
+    fail_unless(!pa_peaks_find(s, &ss_u8, 2, peaks));
+}
+END_TEST
+
+#if defined (__i386__) || defined (__amd64__)
+START_TEST (peaks_sse_test) {
+    pa_peaks_s16_func_t orig_s16;
+    pa_peaks_float_func_t orig_float;
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+    fill_samples();
+
+    /* Nothing has been initialised yet, so these are the generic ones */
+    orig_s16 = pa_get_peaks_s16_func();
+    orig_float = pa_get_peaks_float_func();
+
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_debug("Checking SSE/SSE2 peak detection");
+        pa_peaks_func_init_x86(PA_CPU_X86_SSE | PA_CPU_X86_SSE2);
+        run_peaks_tests(pa_get_peaks_s16_func(), orig_s16, pa_get_peaks_float_func(), orig_float);
+    }
+
+    if (flags & PA_CPU_X86_AVX) {
+        pa_log_debug("Checking AVX peak detection (float)");
+        pa_peaks_func_init_x86(flags & (PA_CPU_X86_SSE | PA_CPU_X86_SSE2 | PA_CPU_X86_AVX));
+        run_peaks_tests(NULL, orig_s16, pa_get_peaks_float_func(), orig_float);
+    }
+
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_debug("Checking AVX2 peak detection (s16)");
+        pa_peaks_func_init_x86(flags);
+        run_peaks_tests(pa_get_peaks_s16_func(), orig_s16, NULL, orig_float);
+    }
+
+    pa_set_peaks_s16_func(orig_s16);
+    pa_set_peaks_float_func(orig_float);
+}
+END_TEST
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("CPU");
+
+    tc = tcase_create("peaks");
+    tcase_add_test(tc, peaks_find_test);
+#if defined (__i386__) || defined (__amd64__)
+    tcase_add_test(tc, peaks_sse_test);
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
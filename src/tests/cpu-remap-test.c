@@ -223,6 +223,38 @@ static void remap_init_test_channels(
     remap_test_channels(&remap_func, &remap_orig);
 }
 
+static void init_remap_none(pa_remap_t *m) {
+    /* Leaves m->do_remap unset, so pa_init_remap_func() takes the C code */
+}
+
+/* Like remap_init_test_channels(), but compares against the generic C
+ * code, the init function installed before might not handle the
+ * remapping at all */
+static void remap_init_generic_test_channels(
+        pa_init_remap_func_t init_func,
+        pa_sample_format_t f,
+        unsigned in_channels,
+        unsigned out_channels,
+        bool rearrange) {
+
+    pa_cpu_info cpu_info = { PA_CPU_UNDEFINED, {}, false };
+    pa_remap_t remap_orig, remap_func;
+
+    cpu_info.force_generic_code = true;
+    pa_remap_func_init(&cpu_info);
+    pa_set_init_remap_func(init_remap_none);
+    setup_remap_channels(&remap_orig, f, in_channels, out_channels, rearrange);
+    pa_init_remap_func(&remap_orig);
+
+    cpu_info.force_generic_code = false;
+    pa_remap_func_init(&cpu_info);
+    pa_set_init_remap_func(init_func);
+    setup_remap_channels(&remap_func, f, in_channels, out_channels, rearrange);
+    init_func(&remap_func);
+
+    remap_test_channels(&remap_func, &remap_orig);
+}
+
 static void remap_init2_test_channels(
         pa_sample_format_t f,
         unsigned in_channels,
@@ -321,6 +353,18 @@ START_TEST (remap_sse2_test) {
 
     pa_log_debug("Checking SSE2 remap (s16, mono->stereo)");
     remap_init_test_channels(init_func, orig_init_func, PA_SAMPLE_S16NE, 1, 2, false);
+
+    pa_log_debug("Checking SSE remap (float, 5.1->stereo)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 6, 2, false);
+    pa_log_debug("Checking SSE remap (float, 7.1->stereo)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 8, 2, false);
+
+    pa_log_debug("Checking SSE remap (float, 3-channel->5-channel)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 3, 5, false);
+    pa_log_debug("Checking SSE remap (float, 8-channel->6-channel)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 8, 6, false);
+    pa_log_debug("Checking SSE remap (float, 6-channel->3-channel rearrange)");
+    remap_init_generic_test_channels(init_func, PA_SAMPLE_FLOAT32NE, 6, 3, true);
 }
 END_TEST
 #endif /* defined (__i386__) || defined (__amd64__) */
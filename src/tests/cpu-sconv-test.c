@@ -134,6 +134,140 @@ static void run_conv_test_s16_to_float(
 }
 #endif /* defined (__arm__) && defined (__linux__) && defined (HAVE_NEON) */
 
+/* 24 and 32 bit conversions are expected to be bit-exact */
+static void run_conv_test_float_to_s32(
+        pa_convert_func_t func,
+        pa_convert_func_t orig_func,
+        pa_sample_format_t format,
+        int align,
+        bool correct,
+        bool perf) {
+
+    PA_DECLARE_ALIGNED(8, uint8_t, s[SAMPLES * 4]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint8_t, s_ref[SAMPLES * 4]) = { 0 };
+    PA_DECLARE_ALIGNED(8, float, f[SAMPLES]);
+    size_t ss = pa_sample_size_of_format(format);
+    uint8_t *samples, *samples_ref;
+    float *floats;
+    int i, nsamples;
+
+    /* Force sample alignment as requested */
+    samples = s + (8 - align) * ss;
+    samples_ref = s_ref + (8 - align) * ss;
+    floats = f + (8 - align);
+    nsamples = SAMPLES - (8 - align);
+
+    for (i = 0; i < nsamples; i++) {
+        floats[i] = 2.1f * (rand()/(float) RAND_MAX - 0.5f);
+    }
+
+    if (correct) {
+        orig_func(nsamples, floats, samples_ref);
+        func(nsamples, floats, samples);
+
+        for (i = 0; i < nsamples; i++) {
+            if (memcmp(samples + i * ss, samples_ref + i * ss, ss)) {
+                pa_log_debug("Correctness test failed: align=%d", align);
+                pa_log_debug("%d: %.24f\n", i, floats[i]);
+                ck_abort();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing sconv performance with %d sample alignment", align);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            func(nsamples, floats, samples);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            orig_func(nsamples, floats, samples_ref);
+        } PA_RUNTIME_TEST_RUN_STOP
+    }
+}
+
+static void run_conv_test_s32_to_float(
+        pa_convert_func_t func,
+        pa_convert_func_t orig_func,
+        pa_sample_format_t format,
+        int align,
+        bool correct,
+        bool perf) {
+
+    PA_DECLARE_ALIGNED(8, float, f[SAMPLES]) = { 0.0f };
+    PA_DECLARE_ALIGNED(8, float, f_ref[SAMPLES]) = { 0.0f };
+    PA_DECLARE_ALIGNED(8, uint8_t, s[SAMPLES * 4]);
+    size_t ss = pa_sample_size_of_format(format);
+    float *floats, *floats_ref;
+    uint8_t *samples;
+    int i, nsamples;
+
+    /* Force sample alignment as requested */
+    floats = f + (8 - align);
+    floats_ref = f_ref + (8 - align);
+    samples = s + (8 - align) * ss;
+    nsamples = SAMPLES - (8 - align);
+
+    pa_random(samples, nsamples * ss);
+
+    if (correct) {
+        orig_func(nsamples, samples, floats_ref);
+        func(nsamples, samples, floats);
+
+        for (i = 0; i < nsamples; i++) {
+            if (floats[i] != floats_ref[i]) {
+                pa_log_debug("Correctness test failed: align=%d", align);
+                pa_log_debug("%d: %.24f != %.24f\n", i, floats[i], floats_ref[i]);
+                ck_abort();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing sconv performance with %d sample alignment", align);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            func(nsamples, samples, floats);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            orig_func(nsamples, samples, floats_ref);
+        } PA_RUNTIME_TEST_RUN_STOP
+    }
+}
+
+static void conv_test_s32_formats(void (*init_func)(void)) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S32LE, PA_SAMPLE_S24_32LE, PA_SAMPLE_S24LE };
+    pa_convert_func_t orig_from[PA_ELEMENTSOF(formats)], orig_to[PA_ELEMENTSOF(formats)];
+    unsigned i;
+    int align;
+
+    for (i = 0; i < PA_ELEMENTSOF(formats); i++) {
+        orig_from[i] = pa_get_convert_from_float32ne_function(formats[i]);
+        orig_to[i] = pa_get_convert_to_float32ne_function(formats[i]);
+    }
+
+    init_func();
+
+    for (i = 0; i < PA_ELEMENTSOF(formats); i++) {
+        pa_convert_func_t from = pa_get_convert_from_float32ne_function(formats[i]);
+        pa_convert_func_t to = pa_get_convert_to_float32ne_function(formats[i]);
+
+        if (from != orig_from[i]) {
+            pa_log_debug("Checking sconv (float -> %s)", pa_sample_format_to_string(formats[i]));
+            for (align = 0; align < 8; align++)
+                run_conv_test_float_to_s32(from, orig_from[i], formats[i], align, true, align == 7);
+        }
+
+        if (to != orig_to[i]) {
+            pa_log_debug("Checking sconv (%s -> float)", pa_sample_format_to_string(formats[i]));
+            for (align = 0; align < 8; align++)
+                run_conv_test_s32_to_float(to, orig_to[i], formats[i], align, true, align == 7);
+        }
+    }
+}
+
 #if defined (__i386__) || defined (__amd64__)
 START_TEST (sconv_sse2_test) {
     pa_cpu_x86_flag_t flags = 0;
@@ -188,6 +322,98 @@ START_TEST (sconv_sse_test) {
     run_conv_test_float_to_s16(sse_func, orig_func, 7, true, true);
 }
 END_TEST
+
+static pa_cpu_x86_flag_t x86_flags;
+
+static void init_sse_s32(void) {
+    pa_convert_func_init_sse(x86_flags & (PA_CPU_X86_SSE2 | PA_CPU_X86_SSSE3));
+}
+
+static void init_avx2_s32(void) {
+    pa_convert_func_init_sse(x86_flags);
+}
+
+START_TEST (sconv_s32_sse_test) {
+    pa_cpu_get_x86_flags(&x86_flags);
+
+    if (!(x86_flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    conv_test_s32_formats(init_sse_s32);
+}
+END_TEST
+
+START_TEST (sconv_s32_avx2_test) {
+    pa_cpu_get_x86_flags(&x86_flags);
+
+    if (!(x86_flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    conv_test_s32_formats(init_avx2_s32);
+}
+END_TEST
+
+/* All 16 bit values and all codes, so the comparison is exhaustive */
+static void run_conv_test_g711(pa_sample_format_t format, const pa_convert_func_t orig[2]) {
+    static int16_t s[0x10000 + 1], s_ref[0x10000 + 1];
+    static uint8_t c[0x10000 + 1], c_ref[0x10000 + 1];
+    pa_convert_func_t from, to;
+    unsigned i;
+
+    from = pa_get_convert_from_s16ne_function(format);
+    to = pa_get_convert_to_s16ne_function(format);
+
+    pa_log_debug("Checking SSE2 sconv (s16 <-> %s)", pa_sample_format_to_string(format));
+
+    /* Start at an odd sample, so that nothing is aligned */
+    for (i = 0; i < 0x10000; i++)
+        s[i + 1] = (int16_t) (i - 0x8000);
+
+    orig[0](0x10000, s + 1, c_ref + 1);
+    from(0x10000, s + 1, c + 1);
+    fail_unless(memcmp(c + 1, c_ref + 1, 0x10000) == 0);
+
+    for (i = 0; i < 0x10000; i++)
+        c[i + 1] = (uint8_t) i;
+
+    orig[1](0x10000, c + 1, s_ref + 1);
+    to(0x10000, c + 1, s + 1);
+    fail_unless(memcmp(s + 1, s_ref + 1, 0x10000 * sizeof(int16_t)) == 0);
+
+    PA_RUNTIME_TEST_RUN_START("func", TIMES / 10, TIMES2) {
+        from(0x10000, s + 1, c + 1);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    PA_RUNTIME_TEST_RUN_START("orig", TIMES / 10, TIMES2) {
+        orig[0](0x10000, s + 1, c_ref + 1);
+    } PA_RUNTIME_TEST_RUN_STOP
+}
+
+START_TEST (sconv_g711_sse2_test) {
+    pa_convert_func_t orig_ulaw[2], orig_alaw[2];
+
+    pa_cpu_get_x86_flags(&x86_flags);
+
+    if (!(x86_flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    orig_ulaw[0] = pa_get_convert_from_s16ne_function(PA_SAMPLE_ULAW);
+    orig_ulaw[1] = pa_get_convert_to_s16ne_function(PA_SAMPLE_ULAW);
+    orig_alaw[0] = pa_get_convert_from_s16ne_function(PA_SAMPLE_ALAW);
+    orig_alaw[1] = pa_get_convert_to_s16ne_function(PA_SAMPLE_ALAW);
+
+    pa_convert_func_init_sse(PA_CPU_X86_SSE2);
+
+    run_conv_test_g711(PA_SAMPLE_ULAW, orig_ulaw);
+    run_conv_test_g711(PA_SAMPLE_ALAW, orig_alaw);
+}
+END_TEST
 #endif /* defined (__i386__) || defined (__amd64__) */
 
 #if defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)
@@ -230,6 +456,24 @@ START_TEST (sconv_neon_test) {
     run_conv_test_s16_to_float(neon_to_func, orig_to_func, 7, true, true);
 }
 END_TEST
+
+static void init_neon_s32(void) {
+    pa_convert_func_init_neon(PA_CPU_ARM_NEON);
+}
+
+START_TEST (sconv_s32_neon_test) {
+    pa_cpu_arm_flag_t flags = 0;
+
+    pa_cpu_get_arm_flags(&flags);
+
+    if (!(flags & PA_CPU_ARM_NEON)) {
+        pa_log_info("NEON not supported. Skipping");
+        return;
+    }
+
+    conv_test_s32_formats(init_neon_s32);
+}
+END_TEST
 #endif /* defined (__arm__) && defined (__linux__) && defined (HAVE_NEON) */
 
 int main(int argc, char *argv[]) {
@@ -247,9 +491,13 @@ int main(int argc, char *argv[]) {
 #if defined (__i386__) || defined (__amd64__)
     tcase_add_test(tc, sconv_sse2_test);
     tcase_add_test(tc, sconv_sse_test);
+    tcase_add_test(tc, sconv_s32_sse_test);
+    tcase_add_test(tc, sconv_s32_avx2_test);
+    tcase_add_test(tc, sconv_g711_sse2_test);
 #endif
 #if defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)
     tcase_add_test(tc, sconv_neon_test);
+    tcase_add_test(tc, sconv_s32_neon_test);
 #endif
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
@@ -101,6 +101,81 @@ static void run_volume_test(
 }
 
 #if defined (__i386__) || defined (__amd64__)
+static void run_volume_format_test(
+        pa_do_volume_func_t func,
+        pa_do_volume_func_t orig_func,
+        pa_sample_format_t format,
+        int align,
+        int channels,
+        bool perf) {
+
+    PA_DECLARE_ALIGNED(8, uint8_t, s[SAMPLES * 4]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint8_t, s_ref[SAMPLES * 4]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint8_t, s_orig[SAMPLES * 4]) = { 0 };
+    union {
+        int32_t i;
+        float f;
+    } volumes[channels + PADDING];
+    uint8_t *samples, *samples_ref, *samples_orig;
+    size_t ss = pa_sample_size_of_format(format);
+    int i, padding, nsamples, size;
+
+    /* Force sample alignment as requested */
+    samples = s + (8 - align) * ss;
+    samples_ref = s_ref + (8 - align) * ss;
+    samples_orig = s_orig + (8 - align) * ss;
+    nsamples = SAMPLES - (8 - align);
+    if (nsamples % channels)
+        nsamples -= nsamples % channels;
+    size = nsamples * ss;
+
+    if (format == PA_SAMPLE_FLOAT32NE) {
+        for (i = 0; i < nsamples; i++)
+            ((float *) samples)[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+    } else
+        pa_random(samples, size);
+    memcpy(samples_ref, samples, size);
+    memcpy(samples_orig, samples, size);
+
+    /* Use factors up to 4.0 to cover clamping as well */
+    for (i = 0; i < channels; i++) {
+        if (format == PA_SAMPLE_FLOAT32NE)
+            volumes[i].f = 4.0f * rand() / RAND_MAX;
+        else
+            volumes[i].i = rand() % 0x40000;
+    }
+    for (padding = 0; padding < PADDING; padding++, i++)
+        volumes[i] = volumes[padding];
+
+    orig_func(samples_ref, volumes, channels, size);
+    func(samples, volumes, channels, size);
+
+    for (i = 0; i < size; i += ss) {
+        if (memcmp(samples + i, samples_ref + i, ss) != 0) {
+            pa_log_debug("Correctness test failed: format=%s, align=%d, channels=%d, sample %d",
+                    pa_sample_format_to_string(format), align, channels, (int) (i / ss));
+            ck_abort();
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %s svolume %dch performance with %d sample alignment",
+                pa_sample_format_to_string(format), channels, align);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            memcpy(samples, samples_orig, size);
+            func(samples, volumes, channels, size);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            memcpy(samples_ref, samples_orig, size);
+            orig_func(samples_ref, volumes, channels, size);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        fail_unless(memcmp(samples_ref, samples, size) == 0);
+    }
+}
+
 START_TEST (svolume_mmx_test) {
     pa_do_volume_func_t orig_func, mmx_func;
     pa_cpu_x86_flag_t flags = 0;
@@ -154,6 +229,152 @@ START_TEST (svolume_sse_test) {
     run_volume_test(sse_func, orig_func, 7, 3, true, true);
 }
 END_TEST
+
+START_TEST (svolume_avx_test) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S16RE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    pa_do_volume_func_t orig_func[PA_ELEMENTSOF(formats)], avx_func;
+    pa_cpu_x86_flag_t flags = 0;
+    unsigned f;
+    int i, j;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX)) {
+        pa_log_info("AVX not supported. Skipping");
+        return;
+    }
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++)
+        orig_func[f] = pa_get_volume_func(formats[f]);
+    pa_volume_func_init_avx(flags);
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        avx_func = pa_get_volume_func(formats[f]);
+
+        if (avx_func == orig_func[f]) {
+            pa_log_info("No AVX svolume for %s. Skipping", pa_sample_format_to_string(formats[f]));
+            continue;
+        }
+
+        pa_log_debug("Checking AVX %s svolume", pa_sample_format_to_string(formats[f]));
+        for (i = 1; i <= 8; i++) {
+            for (j = 0; j < 7; j++)
+                run_volume_format_test(avx_func, orig_func[f], formats[f], j, i, false);
+        }
+        run_volume_format_test(avx_func, orig_func[f], formats[f], 7, 1, true);
+        run_volume_format_test(avx_func, orig_func[f], formats[f], 7, 2, true);
+        run_volume_format_test(avx_func, orig_func[f], formats[f], 7, 6, true);
+    }
+}
+END_TEST
+
+static void run_volume_ramp_test(
+        pa_do_volume_ramp_func_t func,
+        pa_do_volume_ramp_func_t orig_func,
+        pa_sample_format_t format,
+        int align,
+        int channels,
+        bool perf) {
+
+    PA_DECLARE_ALIGNED(8, uint8_t, s[SAMPLES * 4]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint8_t, s_ref[SAMPLES * 4]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint8_t, s_orig[SAMPLES * 4]) = { 0 };
+    float volumes[channels], volumes_ref[channels], volumes_orig[channels], steps[channels];
+    uint8_t *samples, *samples_ref, *samples_orig;
+    size_t ss = pa_sample_size_of_format(format);
+    int i, nsamples, size;
+
+    /* Force sample alignment as requested */
+    samples = s + (8 - align) * ss;
+    samples_ref = s_ref + (8 - align) * ss;
+    samples_orig = s_orig + (8 - align) * ss;
+    nsamples = SAMPLES - (8 - align);
+    if (nsamples % channels)
+        nsamples -= nsamples % channels;
+    size = nsamples * ss;
+
+    if (format == PA_SAMPLE_FLOAT32NE) {
+        for (i = 0; i < nsamples; i++)
+            ((float *) samples)[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+    } else
+        pa_random(samples, size);
+    memcpy(samples_ref, samples, size);
+    memcpy(samples_orig, samples, size);
+
+    /* Ramp between random factors up to 4.0 to cover clamping as well */
+    for (i = 0; i < channels; i++) {
+        volumes_orig[i] = 4.0f * rand() / RAND_MAX;
+        steps[i] = (4.0f * rand() / RAND_MAX - volumes_orig[i]) / (nsamples / channels);
+    }
+
+    memcpy(volumes, volumes_orig, sizeof(volumes));
+    memcpy(volumes_ref, volumes_orig, sizeof(volumes));
+
+    orig_func(samples_ref, volumes_ref, steps, channels, size);
+    func(samples, volumes, steps, channels, size);
+
+    for (i = 0; i < size; i += ss) {
+        if (memcmp(samples + i, samples_ref + i, ss) != 0) {
+            pa_log_debug("Correctness test failed: format=%s, align=%d, channels=%d, sample %d",
+                    pa_sample_format_to_string(format), align, channels, (int) (i / ss));
+            ck_abort();
+        }
+    }
+
+    fail_unless(memcmp(volumes, volumes_ref, sizeof(volumes)) == 0);
+
+    if (perf) {
+        pa_log_debug("Testing %s volume ramp %dch performance with %d sample alignment",
+                pa_sample_format_to_string(format), channels, align);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            memcpy(samples, samples_orig, size);
+            memcpy(volumes, volumes_orig, sizeof(volumes));
+            func(samples, volumes, steps, channels, size);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            memcpy(samples_ref, samples_orig, size);
+            memcpy(volumes_ref, volumes_orig, sizeof(volumes));
+            orig_func(samples_ref, volumes_ref, steps, channels, size);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        fail_unless(memcmp(samples_ref, samples, size) == 0);
+    }
+}
+
+START_TEST (svolume_ramp_sse_test) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_FLOAT32NE };
+    pa_do_volume_ramp_func_t orig_func[PA_ELEMENTSOF(formats)], sse_func;
+    pa_cpu_x86_flag_t flags = 0;
+    unsigned f;
+    int i, j;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++)
+        orig_func[f] = pa_get_volume_ramp_func(formats[f]);
+    pa_volume_func_init_sse(flags);
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        sse_func = pa_get_volume_ramp_func(formats[f]);
+
+        pa_log_debug("Checking SSE2 %s volume ramp", pa_sample_format_to_string(formats[f]));
+        for (i = 1; i <= 8; i++) {
+            for (j = 0; j < 7; j++)
+                run_volume_ramp_test(sse_func, orig_func[f], formats[f], j, i, false);
+        }
+        run_volume_ramp_test(sse_func, orig_func[f], formats[f], 7, 1, true);
+        run_volume_ramp_test(sse_func, orig_func[f], formats[f], 7, 2, true);
+        run_volume_ramp_test(sse_func, orig_func[f], formats[f], 7, 6, true);
+    }
+}
+END_TEST
 #endif /* defined (__i386__) || defined (__amd64__) */
 
 #if defined (__arm__) && defined (__linux__)
@@ -230,6 +451,8 @@ int main(int argc, char *argv[]) {
 #if defined (__i386__) || defined (__amd64__)
     tcase_add_test(tc, svolume_mmx_test);
     tcase_add_test(tc, svolume_sse_test);
+    tcase_add_test(tc, svolume_avx_test);
+    tcase_add_test(tc, svolume_ramp_sse_test);
 #endif
 #if defined (__arm__) && defined (__linux__)
     tcase_add_test(tc, svolume_arm_test);
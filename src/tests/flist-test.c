@@ -23,17 +23,22 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 #include <pulse/util.h>
 #include <pulse/xmalloc.h>
 #include <pulsecore/flist.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/atomic.h>
 
 #define THREADS_MAX 20
 
 static pa_flist *flist;
 static int quit = 0;
+static pa_atomic_t operations = PA_ATOMIC_INIT(0);
 
 static void spin(void) {
     int k;
@@ -48,16 +53,17 @@ static void thread_func(void *data) {
     char *s = data;
     int n = 0;
     int b = 1;
+    int ops = 0;
 
     while (!quit) {
         char *text;
 
         /* Allocate some memory, if possible take it from the flist */
         if (b && (text = pa_flist_pop(flist)))
-            pa_log("%s: popped '%s'", s, text);
+            pa_log_debug("%s: popped '%s'", s, text);
         else {
             text = pa_sprintf_malloc("Block %i, allocated by %s", n++, s);
-            pa_log("%s: allocated '%s'", s, text);
+            pa_log_debug("%s: allocated '%s'", s, text);
         }
 
         b = !b;
@@ -66,35 +72,49 @@ static void thread_func(void *data) {
 
         /* Give it back to the flist if possible */
         if (pa_flist_push(flist, text) < 0) {
-            pa_log("%s: failed to push back '%s'", s, text);
+            pa_log_debug("%s: failed to push back '%s'", s, text);
             pa_xfree(text);
         } else
-            pa_log("%s: pushed", s);
+            pa_log_debug("%s: pushed", s);
+
+        ops += 2;
 
         spin();
     }
 
+    pa_atomic_add(&operations, ops);
+
     if (pa_flist_push(flist, s) < 0)
         pa_xfree(s);
 }
 
 int main(int argc, char* argv[]) {
     pa_thread *threads[THREADS_MAX];
-    int i;
+    int i, seconds = 60;
+    pa_usec_t start, stop;
+
+    if (argc > 1)
+        seconds = atoi(argv[1]);
 
     flist = pa_flist_new(0);
 
+    start = pa_rtclock_now();
+
     for (i = 0; i < THREADS_MAX; i++) {
         threads[i] = pa_thread_new("test", thread_func, pa_sprintf_malloc("Thread #%i", i+1));
         pa_assert(threads[i]);
     }
 
-    pa_msleep(60000);
+    pa_msleep(seconds * 1000);
     quit = 1;
 
     for (i = 0; i < THREADS_MAX; i++)
         pa_thread_free(threads[i]);
 
+    stop = pa_rtclock_now();
+
+    pa_log("%i push/pop operations in %0.1f s", pa_atomic_load(&operations), (double) (stop - start) / PA_USEC_PER_SEC);
+
     pa_flist_free(flist, pa_xfree);
 
     return 0;
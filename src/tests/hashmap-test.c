@@ -0,0 +1,268 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "runtime-test-util.h"
+
+#define N_ENTRIES 1000
+
+#define TIMES 10
+#define TIMES2 10
+
+START_TEST (hashmap_test) {
+    pa_hashmap *h;
+    void *state, *value;
+    const void *key;
+    unsigned i, n;
+
+    h = pa_hashmap_new(NULL, NULL);
+
+    for (i = 0; i < N_ENTRIES; i++)
+        fail_unless(pa_hashmap_put(h, PA_UINT_TO_PTR(i), PA_UINT_TO_PTR(i + 1)) == 0);
+
+    fail_unless(pa_hashmap_put(h, PA_UINT_TO_PTR(0), NULL) < 0);
+    fail_unless(pa_hashmap_size(h) == N_ENTRIES);
+
+    for (i = 0; i < N_ENTRIES; i++)
+        fail_unless(pa_hashmap_get(h, PA_UINT_TO_PTR(i)) == PA_UINT_TO_PTR(i + 1));
+
+    fail_unless(pa_hashmap_get(h, PA_UINT_TO_PTR(N_ENTRIES)) == NULL);
+
+    /* Remove every other entry, including the current one, while iterating */
+    n = 0;
+    PA_HASHMAP_FOREACH_KV(key, value, h, state) {
+        fail_unless(PA_PTR_TO_UINT(key) == n);
+        fail_unless(PA_PTR_TO_UINT(value) == n + 1);
+
+        if (n % 2 == 0)
+            fail_unless(pa_hashmap_remove(h, key) == value);
+
+        n++;
+    }
+
+    fail_unless(n == N_ENTRIES);
+    fail_unless(pa_hashmap_size(h) == N_ENTRIES / 2);
+
+    /* Adding more entries compacts the removed ones, the order stays the
+     * same */
+    for (i = N_ENTRIES; i < 2 * N_ENTRIES; i++)
+        fail_unless(pa_hashmap_put(h, PA_UINT_TO_PTR(i), PA_UINT_TO_PTR(i + 1)) == 0);
+
+    n = 1;
+    PA_HASHMAP_FOREACH_KV(key, value, h, state) {
+        fail_unless(PA_PTR_TO_UINT(key) == n);
+        n += n < N_ENTRIES - 1 ? 2 : 1;
+    }
+
+    fail_unless(n == 2 * N_ENTRIES);
+
+    n = 2 * N_ENTRIES;
+    PA_HASHMAP_FOREACH_BACKWARDS(value, h, state) {
+        fail_unless(PA_PTR_TO_UINT(value) == n);
+        n -= n <= N_ENTRIES ? 2 : 1;
+    }
+
+    fail_unless(n == 0);
+
+    fail_unless(pa_hashmap_first(h) == PA_UINT_TO_PTR(2));
+    fail_unless(pa_hashmap_last(h) == PA_UINT_TO_PTR(2 * N_ENTRIES));
+    fail_unless(pa_hashmap_steal_first(h) == PA_UINT_TO_PTR(2));
+    fail_unless(pa_hashmap_get(h, PA_UINT_TO_PTR(1)) == NULL);
+
+    while (pa_hashmap_steal_first(h))
+        ;
+
+    fail_unless(pa_hashmap_isempty(h));
+    fail_unless(pa_hashmap_first(h) == NULL);
+
+    pa_hashmap_free(h);
+}
+END_TEST
+
+START_TEST (idxset_test) {
+    pa_idxset *s;
+    void *data;
+    uint32_t idx, i;
+
+    s = pa_idxset_new(NULL, NULL);
+
+    for (i = 0; i < N_ENTRIES; i++) {
+        fail_unless(pa_idxset_put(s, PA_UINT32_TO_PTR(i + 1), &idx) == 0);
+        fail_unless(idx == i);
+    }
+
+    fail_unless(pa_idxset_put(s, PA_UINT32_TO_PTR(5), &idx) < 0);
+    fail_unless(idx == 4);
+
+    for (i = 0; i < N_ENTRIES; i++) {
+        fail_unless(pa_idxset_get_by_index(s, i) == PA_UINT32_TO_PTR(i + 1));
+        fail_unless(pa_idxset_get_by_data(s, PA_UINT32_TO_PTR(i + 1), &idx) == PA_UINT32_TO_PTR(i + 1));
+        fail_unless(idx == i);
+    }
+
+    /* Remove the current and the following entry while iterating */
+    i = 0;
+    PA_IDXSET_FOREACH(data, s, idx) {
+        fail_unless(idx == i);
+
+        if (idx % 3 == 0) {
+            fail_unless(pa_idxset_remove_by_index(s, idx) == data);
+            if (idx + 1 < N_ENTRIES)
+                fail_unless(pa_idxset_remove_by_data(s, PA_UINT32_TO_PTR(idx + 2), NULL));
+            i += 2;
+        } else
+            i++;
+    }
+
+    fail_unless(pa_idxset_size(s) == N_ENTRIES / 3);
+
+    /* pa_idxset_next() continues after removed entries */
+    idx = 0;
+    fail_unless(pa_idxset_next(s, &idx) == PA_UINT32_TO_PTR(3));
+    fail_unless(idx == 2);
+
+    idx = N_ENTRIES - 3;
+    fail_unless(pa_idxset_next(s, &idx) == PA_UINT32_TO_PTR(N_ENTRIES - 1));
+    fail_unless(idx == N_ENTRIES - 2);
+    fail_unless(pa_idxset_next(s, &idx) == NULL);
+    fail_unless(idx == PA_IDXSET_INVALID);
+
+    idx = N_ENTRIES - 2;
+    fail_unless(pa_idxset_rrobin(s, &idx) == PA_UINT32_TO_PTR(3));
+    fail_unless(idx == 2);
+
+    /* Growing keeps both the order and the indexes */
+    for (i = 0; i < N_ENTRIES; i++)
+        fail_unless(pa_idxset_put(s, PA_UINT32_TO_PTR(N_ENTRIES + i + 1), NULL) == 0);
+
+    fail_unless(pa_idxset_first(s, &idx) == PA_UINT32_TO_PTR(3));
+    fail_unless(idx == 2);
+    fail_unless(pa_idxset_get_by_index(s, N_ENTRIES + 10) == PA_UINT32_TO_PTR(N_ENTRIES + 11));
+
+    i = 0;
+    PA_IDXSET_FOREACH(data, s, idx) {
+        fail_unless(PA_PTR_TO_UINT32(data) == idx + 1);
+        i++;
+    }
+
+    fail_unless(i == pa_idxset_size(s));
+
+    pa_idxset_free(s, NULL);
+}
+END_TEST
+
+/* Lookup and iteration speed for different sizes, should stay roughly
+ * constant per entry */
+static void run_benchmark(unsigned n_entries) {
+    pa_hashmap *h;
+    pa_idxset *s;
+    void **keys, *state, *data;
+    uint32_t idx;
+    unsigned i, n = 0;
+    char label[64];
+
+    h = pa_hashmap_new(NULL, NULL);
+    s = pa_idxset_new(NULL, NULL);
+    keys = pa_xnew(void*, n_entries);
+
+    for (i = 0; i < n_entries; i++) {
+        /* Heap addresses, as used by most of the callers */
+        keys[i] = pa_xnew(int, 1);
+        pa_hashmap_put(h, keys[i], keys[i]);
+        pa_idxset_put(s, keys[i], NULL);
+    }
+
+    pa_snprintf(label, sizeof(label), "hashmap lookup, %u entries", n_entries);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES * 100000 / n_entries + 1, TIMES2) {
+        for (i = 0; i < n_entries; i++)
+            n += pa_hashmap_get(h, keys[i]) != NULL;
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_snprintf(label, sizeof(label), "hashmap iteration, %u entries", n_entries);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES * 100000 / n_entries + 1, TIMES2) {
+        PA_HASHMAP_FOREACH(data, h, state)
+            n++;
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_snprintf(label, sizeof(label), "idxset lookup by data, %u entries", n_entries);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES * 100000 / n_entries + 1, TIMES2) {
+        for (i = 0; i < n_entries; i++)
+            n += pa_idxset_get_by_data(s, keys[i], NULL) != NULL;
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_snprintf(label, sizeof(label), "idxset lookup by index, %u entries", n_entries);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES * 100000 / n_entries + 1, TIMES2) {
+        for (i = 0; i < n_entries; i++)
+            n += pa_idxset_get_by_index(s, i) != NULL;
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_snprintf(label, sizeof(label), "idxset iteration, %u entries", n_entries);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES * 100000 / n_entries + 1, TIMES2) {
+        PA_IDXSET_FOREACH(data, s, idx)
+            n++;
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    fail_unless(n > 0);
+
+    pa_hashmap_free(h);
+    pa_idxset_free(s, pa_xfree);
+    pa_xfree(keys);
+}
+
+START_TEST (benchmark_test) {
+    run_benchmark(10);
+    run_benchmark(1000);
+    run_benchmark(100000);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Hashmap");
+    tc = tcase_create("hashmap");
+    tcase_add_test(tc, hashmap_test);
+    tcase_add_test(tc, idxset_test);
+    tcase_add_test(tc, benchmark_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
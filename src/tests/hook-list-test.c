@@ -4,9 +4,13 @@
 
 #include <check.h>
 
+#include <pulse/proplist.h>
+
 #include <pulsecore/hook-list.h>
 #include <pulsecore/log.h>
 
+static int n_matched;
+
 static pa_hook_result_t func1(const char *hook_data, const char *call_data, const char *slot_data) {
     pa_log("(func1) hook=%s call=%s slot=%s", hook_data, call_data, slot_data);
     /* succeed when it runs to here */
@@ -41,6 +45,56 @@ START_TEST (hooklist_test) {
 }
 END_TEST
 
+static pa_proplist *get_proplist(pa_proplist *p) {
+    return p;
+}
+
+static pa_hook_result_t count_func(void *hook_data, pa_proplist *call_data, void *slot_data) {
+    n_matched++;
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t set_role_func(void *hook_data, pa_proplist *call_data, void *slot_data) {
+    pa_proplist_sets(call_data, PA_PROP_MEDIA_ROLE, "event");
+    return PA_HOOK_OK;
+}
+
+START_TEST (hooklist_match_test) {
+    pa_hook hook;
+    pa_hook_slot *slot;
+    pa_proplist *p;
+
+    pa_hook_init(&hook, NULL);
+    pa_hook_set_proplist_cb(&hook, (pa_hook_proplist_cb_t) get_proplist);
+
+    slot = pa_hook_connect(&hook, PA_HOOK_NORMAL, (pa_hook_cb_t) count_func, NULL);
+    pa_hook_slot_match_proplist(slot, PA_PROP_MEDIA_ROLE, "event");
+    slot = pa_hook_connect(&hook, PA_HOOK_NORMAL, (pa_hook_cb_t) count_func, NULL);
+    pa_hook_slot_match_proplist(slot, PA_PROP_MEDIA_ROLE, NULL);
+
+    p = pa_proplist_new();
+
+    n_matched = 0;
+    pa_hook_fire(&hook, p);
+    fail_unless(n_matched == 0);
+
+    pa_proplist_sets(p, PA_PROP_MEDIA_ROLE, "music");
+    n_matched = 0;
+    pa_hook_fire(&hook, p);
+    fail_unless(n_matched == 1);
+
+    /* Rules are checked against the properties as earlier slots left them */
+    pa_proplist_clear(p);
+    pa_hook_connect(&hook, PA_HOOK_EARLY, (pa_hook_cb_t) set_role_func, NULL);
+    n_matched = 0;
+    pa_hook_fire(&hook, p);
+    fail_unless(n_matched == 2);
+
+    pa_proplist_free(p);
+    pa_hook_done(&hook);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -50,6 +104,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Hook List");
     tc = tcase_create("hooklist");
     tcase_add_test(tc, hooklist_test);
+    tcase_add_test(tc, hooklist_match_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
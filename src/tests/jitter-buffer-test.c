@@ -0,0 +1,247 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/memblockq.h>
+
+#include <modules/rtp/jitter-buffer.h>
+
+#define RATE 8000
+/* 10 ms packets */
+#define PACKET_FRAMES 80
+#define PACKET_USEC (10*PA_USEC_PER_MSEC)
+#define N_PACKETS 8
+/* 200 Hz */
+#define PERIOD_FRAMES 40
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = RATE,
+    .channels = 1
+};
+
+static int16_t sine(unsigned frame) {
+    return (int16_t) (10000 * sin(2 * M_PI * (frame % PERIOD_FRAMES) / PERIOD_FRAMES));
+}
+
+/* Sends packet seq, carrying either a sine or its sequence number in every frame */
+static void push(pa_jitter_buffer *jb, pa_mempool *pool, uint16_t seq, pa_usec_t now, bool use_sine) {
+    pa_memchunk chunk;
+    int16_t *d;
+    unsigned i;
+
+    chunk.memblock = pa_memblock_new(pool, PACKET_FRAMES * sizeof(int16_t));
+    chunk.index = 0;
+    chunk.length = PACKET_FRAMES * sizeof(int16_t);
+
+    d = pa_memblock_acquire(chunk.memblock);
+    for (i = 0; i < PACKET_FRAMES; i++)
+        d[i] = use_sine ? sine(seq * PACKET_FRAMES + i) : (int16_t) seq;
+    pa_memblock_release(chunk.memblock);
+
+    pa_jitter_buffer_push(jb, seq, (uint32_t) seq * PACKET_FRAMES, now, &chunk);
+    pa_memblock_unref(chunk.memblock);
+}
+
+/* Reads the whole queue, which must not have holes */
+static unsigned read_queue(pa_memblockq *q, int16_t *dst) {
+    unsigned n = 0;
+    pa_memchunk chunk;
+
+    while (pa_memblockq_peek(q, &chunk) >= 0) {
+        const int16_t *s;
+
+        fail_unless(chunk.memblock != NULL);
+
+        s = pa_memblock_acquire_chunk(&chunk);
+        memcpy(dst + n, s, chunk.length);
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+
+        n += (unsigned) (chunk.length / sizeof(int16_t));
+        pa_memblockq_drop(q, chunk.length);
+    }
+
+    return n;
+}
+
+START_TEST (reorder_test) {
+    pa_mempool *pool;
+    pa_memblockq *q;
+    pa_jitter_buffer *jb;
+    pa_jitter_buffer_stats stats;
+    int16_t out[N_PACKETS * PACKET_FRAMES];
+    unsigned n, i;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    q = pa_memblockq_new("test", 0, 1024*1024, 0, &ss, 0, 0, 0, NULL);
+    jb = pa_jitter_buffer_new(&ss, pool, 100 * PA_USEC_PER_MSEC);
+
+    push(jb, pool, 0, PA_USEC_PER_SEC, false);
+    pa_jitter_buffer_release(jb, PA_USEC_PER_SEC, q, false);
+
+    /* Packet 2 is held back while 1 is missing */
+    push(jb, pool, 2, PA_USEC_PER_SEC + 2 * PACKET_USEC, false);
+    pa_jitter_buffer_release(jb, PA_USEC_PER_SEC + 2 * PACKET_USEC, q, false);
+    fail_unless(pa_jitter_buffer_get_length(jb) == PACKET_FRAMES * sizeof(int16_t));
+
+    push(jb, pool, 1, PA_USEC_PER_SEC + 2 * PACKET_USEC + 1000, false);
+    pa_jitter_buffer_release(jb, PA_USEC_PER_SEC + 2 * PACKET_USEC + 1000, q, false);
+    fail_unless(pa_jitter_buffer_get_length(jb) == 0);
+
+    n = read_queue(q, out);
+    fail_unless(n == 3 * PACKET_FRAMES);
+    for (i = 0; i < n; i++)
+        fail_unless(out[i] == (int16_t) (i / PACKET_FRAMES));
+
+    pa_jitter_buffer_get_stats(jb, &stats);
+    fail_unless(stats.reordered == 1);
+    fail_unless(stats.lost == 0);
+    fail_unless(stats.late == 0);
+
+    pa_jitter_buffer_free(jb);
+    pa_memblockq_free(q);
+    pa_mempool_unref(pool);
+}
+END_TEST
+
+START_TEST (conceal_test) {
+    pa_mempool *pool;
+    pa_memblockq *q;
+    pa_jitter_buffer *jb;
+    pa_jitter_buffer_stats stats;
+    int16_t out[N_PACKETS * PACKET_FRAMES];
+    pa_usec_t now = PA_USEC_PER_SEC;
+    unsigned n, i;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    q = pa_memblockq_new("test", 0, 1024*1024, 0, &ss, 0, 0, 0, NULL);
+    jb = pa_jitter_buffer_new(&ss, pool, 100 * PA_USEC_PER_MSEC);
+
+    for (i = 0; i < N_PACKETS; i++, now += PACKET_USEC) {
+        /* Packet 5 gets lost */
+        if (i == 5)
+            continue;
+
+        push(jb, pool, (uint16_t) i, now, true);
+        pa_jitter_buffer_release(jb, now, q, false);
+
+        if (i == 6) {
+            /* The packet after the gap is held back for the target delay */
+            fail_unless(pa_jitter_buffer_get_length(jb) == PACKET_FRAMES * sizeof(int16_t));
+
+            pa_jitter_buffer_get_stats(jb, &stats);
+            pa_jitter_buffer_release(jb, now + stats.target - 1, q, false);
+            fail_unless(pa_jitter_buffer_get_length(jb) == PACKET_FRAMES * sizeof(int16_t));
+
+            pa_jitter_buffer_release(jb, now + stats.target, q, false);
+            fail_unless(pa_jitter_buffer_get_length(jb) == 0);
+        }
+    }
+
+    n = read_queue(q, out);
+    fail_unless(n == N_PACKETS * PACKET_FRAMES);
+
+    /* A periodic signal is continued through the gap */
+    for (i = 5 * PACKET_FRAMES; i < 6 * PACKET_FRAMES; i++)
+        fail_unless(abs(out[i] - sine(i)) < 100);
+
+    /* The packets around it are untouched, except for the cross-fade */
+    for (i = 0; i < 5 * PACKET_FRAMES; i++)
+        fail_unless(out[i] == sine(i));
+    for (i = 7 * PACKET_FRAMES; i < N_PACKETS * PACKET_FRAMES; i++)
+        fail_unless(out[i] == sine(i));
+
+    pa_jitter_buffer_get_stats(jb, &stats);
+    fail_unless(stats.lost == 1);
+    fail_unless(stats.late == 0);
+
+    /* The lost packet arrives after all */
+    push(jb, pool, 5, now, true);
+    pa_jitter_buffer_release(jb, now, q, false);
+    fail_unless(pa_memblockq_get_length(q) == 0);
+
+    pa_jitter_buffer_get_stats(jb, &stats);
+    fail_unless(stats.late == 1);
+
+    pa_jitter_buffer_free(jb);
+    pa_memblockq_free(q);
+    pa_mempool_unref(pool);
+}
+END_TEST
+
+START_TEST (force_test) {
+    pa_mempool *pool;
+    pa_memblockq *q;
+    pa_jitter_buffer *jb;
+    pa_jitter_buffer_stats stats;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    q = pa_memblockq_new("test", 0, 1024*1024, 0, &ss, 0, 0, 0, NULL);
+    jb = pa_jitter_buffer_new(&ss, pool, 100 * PA_USEC_PER_MSEC);
+
+    push(jb, pool, 0, PA_USEC_PER_SEC, false);
+    push(jb, pool, 3, PA_USEC_PER_SEC, false);
+    pa_jitter_buffer_release(jb, PA_USEC_PER_SEC, q, false);
+    fail_unless(pa_jitter_buffer_get_length(jb) > 0);
+
+    /* Without enough audio to repeat, the gap is left silent */
+    pa_jitter_buffer_release(jb, PA_USEC_PER_SEC, q, true);
+    fail_unless(pa_jitter_buffer_get_length(jb) == 0);
+    fail_unless(pa_memblockq_get_write_index(q) == 4 * PACKET_FRAMES * sizeof(int16_t));
+
+    pa_jitter_buffer_get_stats(jb, &stats);
+    fail_unless(stats.lost == 2);
+
+    pa_jitter_buffer_free(jb);
+    pa_memblockq_free(q);
+    pa_mempool_unref(pool);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Jitter Buffer");
+    tc = tcase_create("jitterbuffer");
+    tcase_add_test(tc, reorder_test);
+    tcase_add_test(tc, conceal_test);
+    tcase_add_test(tc, force_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
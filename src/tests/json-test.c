@@ -22,8 +22,10 @@
 #endif
 
 #include <check.h>
+#include <math.h>
 
 #include <pulse/json.h>
+#include <pulse/xmalloc.h>
 #include <pulsecore/core-util.h>
 
 START_TEST (string_test) {
@@ -244,6 +246,7 @@ START_TEST(bad_test) {
         "[ [ [ [ [ [ [ [ [ [ [ [ [ [ [ [ [ [ [ [ { \"a\": \"b\" } ] ] ] ] ] ] ] ] ] ] ] ] ] ] ] ] ] ] ] ]" /* Nested too deep */,
         "asdf" /* Unquoted string */,
         "{ a: true }" /* Unquoted key in object */,
+        "{ \"a\": true, }" /* Trailing comma in object */,
         "\"    \a\"" /* Alarm is not a valid character */
     };
 
@@ -257,6 +260,54 @@ START_TEST(bad_test) {
 }
 END_TEST
 
+START_TEST(encoder_test) {
+    pa_json_encoder *encoder;
+    pa_json_object *o, *expected;
+    char *s;
+
+    encoder = pa_json_encoder_new();
+    pa_json_encoder_begin_element_object(encoder);
+    pa_json_encoder_add_member_string(encoder, "name", "a \"quoted\"\\string\n");
+    pa_json_encoder_add_member_int(encoder, "index", -42);
+    pa_json_encoder_add_member_double(encoder, "balance", -0.25, 2);
+    pa_json_encoder_add_member_double(encoder, "db", -INFINITY, 2);
+    pa_json_encoder_add_member_bool(encoder, "mute", true);
+    pa_json_encoder_add_member_null(encoder, "owner");
+    pa_json_encoder_begin_member_array(encoder, "ports");
+    pa_json_encoder_add_element_string(encoder, "analog-output");
+    pa_json_encoder_add_element_int(encoder, 7);
+    pa_json_encoder_begin_element_object(encoder);
+    pa_json_encoder_end_object(encoder);
+    pa_json_encoder_end_array(encoder);
+    pa_json_encoder_begin_member_object(encoder, "empty");
+    pa_json_encoder_end_object(encoder);
+    pa_json_encoder_end_object(encoder);
+    s = pa_json_encoder_to_string_free(encoder);
+
+    fail_unless(pa_streq(s, "{\"name\":\"a \\\"quoted\\\"\\\\string\\n\",\"index\":-42,\"balance\":-0.25,"
+                            "\"db\":null,\"mute\":true,\"owner\":null,\"ports\":[\"analog-output\",7,{}],\"empty\":{}}"));
+
+    o = pa_json_parse(s);
+    expected = pa_json_parse("{ \"name\": \"a \\\"quoted\\\"\\\\string\\n\", \"index\": -42, \"balance\": -0.25, "
+                             "\"db\": null, \"mute\": true, \"owner\": null, \"ports\": [ \"analog-output\", 7, { } ], \"empty\": { } }");
+    fail_unless(o != NULL);
+    fail_unless(expected != NULL);
+    fail_unless(pa_json_object_equal(o, expected));
+
+    pa_json_object_free(o);
+    pa_json_object_free(expected);
+    pa_xfree(s);
+
+    encoder = pa_json_encoder_new();
+    pa_json_encoder_begin_element_array(encoder);
+    pa_json_encoder_add_element_string(encoder, NULL);
+    pa_json_encoder_end_array(encoder);
+    s = pa_json_encoder_to_string_free(encoder);
+    fail_unless(pa_streq(s, "[null]"));
+    pa_xfree(s);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -273,6 +324,7 @@ int main(int argc, char *argv[]) {
     tcase_add_test(tc, object_test);
     tcase_add_test(tc, array_test);
     tcase_add_test(tc, bad_test);
+    tcase_add_test(tc, encoder_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
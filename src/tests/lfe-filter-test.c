@@ -68,7 +68,7 @@ static int compare_data_block(struct lfe_filter_test *lft, void *a, void *b) {
 
     pa_assert(lft->ss->format == PA_SAMPLE_S16NE);
 
-    for (i = 0; i < ONE_BLOCK_SAMPLES; i++) {
+    for (i = 0; i < ONE_BLOCK_SAMPLES * lft->ss->channels; i++) {
         if (abs(*r++ - *u++) > TOLERANT_VARIATION) {
             pa_log_error("lfe-filter-test: test failed, the output data in the position 0x%x of a block does not equal!", i);
             ret = -1;
@@ -172,6 +172,42 @@ START_TEST (lfe_filter_test) {
 }
 END_TEST
 
+/* the surround filters run several channels at once, check that rewinding
+   restores the state of every channel */
+START_TEST (lfe_filter_surround_test) {
+    pa_sample_spec a;
+    int ret;
+    unsigned i, crossover_freq = 120;
+    pa_channel_map chmap;
+    struct lfe_filter_test lft;
+    short *tmp_ptr;
+
+    a.channels = 6;
+    a.rate = 48000;
+    a.format = PA_SAMPLE_S16NE;
+    pa_channel_map_init_extend(&chmap, a.channels, PA_CHANNEL_MAP_DEFAULT);
+
+    lft.ss = &a;
+    pa_assert_se(lft.pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true));
+
+    ori_sample_ptr = pa_xmalloc(pa_frame_size(lft.ss) * TOTAL_SAMPLES);
+    tmp_ptr = (short *) ori_sample_ptr;
+    for (i = 0; i < pa_frame_size(lft.ss) * TOTAL_SAMPLES / sizeof(short); i++)
+        *tmp_ptr++ = random();
+
+    pa_assert_se(lft.lf = pa_lfe_filter_new(&a, &chmap, crossover_freq, a.rate * 10));
+    ret = lfe_filter_rewind_test(&lft, ONE_BLOCK_SAMPLES + ONE_BLOCK_SAMPLES / 3);
+    if (ret)
+        pa_log_error("lfe-filer-test: 5.1 rewind to middle of block test failed!!!");
+    pa_lfe_filter_free(lft.lf);
+
+    pa_xfree(ori_sample_ptr);
+    pa_mempool_unref(lft.pool);
+
+    fail_unless(ret == 0);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -184,6 +220,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("lfe-filter");
     tc = tcase_create("lfe-filter");
     tcase_add_test(tc, lfe_filter_test);
+    tcase_add_test(tc, lfe_filter_surround_test);
     tcase_set_timeout(tc, 10);
     suite_add_tcase(s, tc);
 
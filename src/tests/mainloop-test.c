@@ -27,9 +27,13 @@
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-rtclock.h>
+#include <pulsecore/log.h>
+
+#include "runtime-test-util.h"
 
 #ifdef GLIB_MAIN_LOOP
 
@@ -120,15 +124,156 @@ START_TEST (mainloop_test) {
 }
 END_TEST
 
+#ifndef GLIB_MAIN_LOOP
+
+#define N_TIME_EVENTS 1000
+
+static pa_usec_t last_fired;
+static unsigned n_fired;
+
+static void order_tcb(pa_mainloop_api*a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    pa_usec_t *due = userdata, now = pa_rtclock_now();
+
+    fail_unless(*due != PA_USEC_INVALID);
+    fail_unless(now >= *due);
+    fail_unless(*due >= last_fired);
+
+    last_fired = *due;
+    *due = PA_USEC_INVALID;
+    n_fired++;
+}
+
+/* Time events fire in order, and only if still enabled */
+START_TEST (time_event_order_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    pa_time_event **te;
+    pa_usec_t *due, start;
+    struct timeval tv;
+    unsigned i, n_expected = 0;
+
+    m = pa_mainloop_new();
+    fail_if(!m);
+    a = pa_mainloop_get_api(m);
+
+    te = pa_xnew(pa_time_event*, N_TIME_EVENTS);
+    due = pa_xnew(pa_usec_t, N_TIME_EVENTS);
+
+    start = pa_rtclock_now();
+    for (i = 0; i < N_TIME_EVENTS; i++) {
+        due[i] = start + (pa_usec_t) (rand() % 50) * PA_USEC_PER_MSEC;
+        te[i] = a->time_new(a, pa_timeval_rtstore(&tv, due[i], true), order_tcb, &due[i]);
+    }
+
+    for (i = 0; i < N_TIME_EVENTS; i++) {
+        switch (i % 4) {
+            case 0:
+                /* Move it */
+                due[i] = start + (pa_usec_t) (rand() % 50) * PA_USEC_PER_MSEC;
+                a->time_restart(te[i], pa_timeval_rtstore(&tv, due[i], true));
+                n_expected++;
+                break;
+
+            case 1:
+                /* Disable it */
+                a->time_restart(te[i], NULL);
+                due[i] = PA_USEC_INVALID;
+                break;
+
+            case 2:
+                /* Disable it and enable it again */
+                a->time_restart(te[i], NULL);
+                a->time_restart(te[i], pa_timeval_rtstore(&tv, due[i], true));
+                n_expected++;
+                break;
+
+            default:
+                n_expected++;
+        }
+    }
+
+    while (n_fired < n_expected)
+        fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+
+    for (i = 0; i < N_TIME_EVENTS; i++) {
+        fail_unless(due[i] == PA_USEC_INVALID);
+        a->time_free(te[i]);
+    }
+
+    pa_xfree(te);
+    pa_xfree(due);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+static void never_tcb(pa_mainloop_api*a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    fail();
+}
+
+/* Restarting a time event and waking up should not get slower with
+ * more time events around */
+static void run_time_event_benchmark(unsigned n_events) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    pa_time_event **te;
+    pa_usec_t start;
+    struct timeval tv;
+    unsigned i;
+    char label[64];
+
+    m = pa_mainloop_new();
+    fail_if(!m);
+    a = pa_mainloop_get_api(m);
+
+    te = pa_xnew(pa_time_event*, n_events);
+
+    start = pa_rtclock_now() + 3600 * PA_USEC_PER_SEC;
+    for (i = 0; i < n_events; i++)
+        te[i] = a->time_new(a, pa_timeval_rtstore(&tv, start + (pa_usec_t) rand() % PA_USEC_PER_SEC, true), never_tcb, NULL);
+
+    pa_snprintf(label, sizeof(label), "time event restart, %u events", n_events);
+    PA_RUNTIME_TEST_RUN_START(label, 10000, 10) {
+        a->time_restart(te[rand() % n_events], pa_timeval_rtstore(&tv, start + (pa_usec_t) rand() % PA_USEC_PER_SEC, true));
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_snprintf(label, sizeof(label), "main loop iteration, %u time events", n_events);
+    PA_RUNTIME_TEST_RUN_START(label, 1000, 10) {
+        pa_mainloop_iterate(m, 0, NULL);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    for (i = 0; i < n_events; i++)
+        a->time_free(te[i]);
+
+    pa_xfree(te);
+    pa_mainloop_free(m);
+}
+
+START_TEST (time_event_benchmark_test) {
+    run_time_event_benchmark(10);
+    run_time_event_benchmark(1000);
+    run_time_event_benchmark(10000);
+}
+END_TEST
+
+#endif /* GLIB_MAIN_LOOP */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
     TCase *tc;
     SRunner *sr;
 
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
     s = suite_create("MainLoop");
     tc = tcase_create("mainloop");
     tcase_add_test(tc, mainloop_test);
+#ifndef GLIB_MAIN_LOOP
+    tcase_add_test(tc, time_event_order_test);
+    tcase_add_test(tc, time_event_benchmark_test);
+#endif
+    tcase_set_timeout(tc, 60);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
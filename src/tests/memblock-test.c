@@ -176,6 +176,174 @@ START_TEST (memblock_test) {
 }
 END_TEST
 
+START_TEST (slot_classes_test) {
+    static const size_t slot_sizes[] = { 1000, 4096, 16384 };
+    static const size_t merged_slot_sizes[] = { 1000, 1024 };
+    const pa_mempool_stat *s;
+    pa_mempool *pool;
+    pa_memblock *small[16], *mb;
+    unsigned i, n_small;
+
+    pool = pa_mempool_new_with_slot_sizes(PA_MEM_TYPE_PRIVATE, 256 * 1024, true, slot_sizes, PA_ELEMENTSOF(slot_sizes));
+    fail_unless(pool != NULL);
+
+    s = pa_mempool_get_stat(pool);
+    fail_unless(s->n_slot_classes == 3);
+    fail_unless(s->slot_size[0] == 1024);
+    fail_unless(s->slot_size[1] == 4096);
+    fail_unless(s->slot_size[2] == 16384);
+    fail_unless(pa_mempool_block_size_max(pool) < 16384);
+
+    /* 256K / 16 for each of the smaller classes */
+    n_small = s->n_slots[0];
+    fail_unless(n_small == 16);
+
+    /* Small blocks take the small slots */
+    for (i = 0; i < n_small; i++) {
+        small[i] = pa_memblock_new_pool(pool, 256);
+        fail_unless(small[i] != NULL);
+    }
+
+    fail_unless(pa_atomic_load(&s->n_slots_allocated[0]) == (int) n_small);
+    fail_unless(pa_atomic_load(&s->n_slots_allocated[1]) == 0);
+
+    /* Once they are used up the next class is used */
+    mb = pa_memblock_new_pool(pool, 256);
+    fail_unless(mb != NULL);
+    fail_unless(pa_atomic_load(&s->n_slots_allocated[1]) == 1);
+    fail_unless(pa_atomic_load(&s->n_slot_class_full[0]) == 1);
+    pa_memblock_unref(mb);
+
+    for (i = 0; i < n_small; i++)
+        pa_memblock_unref(small[i]);
+
+    fail_unless(pa_atomic_load(&s->n_slots_allocated[0]) == 0);
+    fail_unless(pa_atomic_load(&s->n_slots_allocated[1]) == 0);
+
+    /* Larger blocks go directly to a class they fit in */
+    mb = pa_memblock_new_pool(pool, 8000);
+    fail_unless(mb != NULL);
+    fail_unless(pa_atomic_load(&s->n_slots_allocated[2]) == 1);
+    pa_memblock_unref(mb);
+
+    fail_unless(pa_memblock_new_pool(pool, 16385) == NULL);
+    fail_unless(pa_atomic_load(&s->n_too_large_for_pool) == 1);
+
+    print_stats(pool, "slot classes");
+
+    pa_mempool_vacuum(pool);
+    pa_mempool_unref(pool);
+
+    /* Sizes that are the same after alignment make one class, which
+     * being the largest gets the whole pool */
+    pool = pa_mempool_new_with_slot_sizes(PA_MEM_TYPE_PRIVATE, 256 * 1024, true, merged_slot_sizes, PA_ELEMENTSOF(merged_slot_sizes));
+    fail_unless(pool != NULL);
+
+    s = pa_mempool_get_stat(pool);
+    fail_unless(s->n_slot_classes == 1);
+    fail_unless(s->slot_size[0] == 1024);
+    fail_unless(s->n_slots[0] == 256);
+
+    pa_mempool_unref(pool);
+}
+END_TEST
+
+START_TEST (thread_cache_test) {
+    const pa_mempool_stat *s;
+    pa_mempool *pool;
+    pa_memblock *mb, *mb2;
+    int hits;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    fail_unless(pool != NULL);
+    s = pa_mempool_get_stat(pool);
+
+    mb = pa_memblock_new_pool(pool, 100);
+    fail_unless(mb != NULL);
+    fail_unless(pa_atomic_load(&s->n_cache_hits) == 0);
+    pa_memblock_unref(mb);
+
+    /* The slot just freed is handed out again without going through the
+     * shared free list */
+    hits = pa_atomic_load(&s->n_cache_hits);
+    mb2 = pa_memblock_new_pool(pool, 100);
+    fail_unless(mb2 == mb);
+    fail_unless(pa_atomic_load(&s->n_cache_hits) == hits + 1);
+    pa_memblock_unref(mb2);
+
+    print_stats(pool, "thread cache");
+
+    pa_mempool_unref(pool);
+
+    /* Blocks of a pool that is gone are not handed out for a new one */
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    s = pa_mempool_get_stat(pool);
+    mb = pa_memblock_new_pool(pool, 100);
+    fail_unless(mb != NULL);
+    fail_unless(pa_atomic_load(&s->n_cache_hits) == 0);
+    pa_memblock_unref(mb);
+    pa_mempool_unref(pool);
+}
+END_TEST
+
+START_TEST (export_slots_test) {
+    const pa_mempool_stat *s;
+    pa_mempool *pool;
+    pa_memexport *export;
+    pa_memblock *mb[PA_MEMEXPORT_SLOTS_DEFAULT + 2];
+    uint32_t ids[PA_MEMEXPORT_SLOTS_DEFAULT + 2];
+    pa_mem_type_t mem_type;
+    uint32_t shm_id;
+    size_t offset, size;
+    unsigned i, j;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_SHARED_POSIX, 0, true);
+    fail_unless(pool != NULL);
+    s = pa_mempool_get_stat(pool);
+
+    export = pa_memexport_new(pool, revoke_cb, (void*) "A");
+    fail_unless(export != NULL);
+
+    for (i = 0; i < PA_ELEMENTSOF(mb); i++) {
+        mb[i] = pa_memblock_new_pool(pool, 100);
+        fail_unless(mb[i] != NULL);
+    }
+
+    for (i = 0; i < PA_MEMEXPORT_SLOTS_DEFAULT; i++)
+        fail_unless(pa_memexport_put(export, mb[i], &mem_type, &ids[i], &shm_id, &offset, &size) == 0);
+
+    /* Out of slots, the caller has to send the data itself */
+    fail_unless(pa_memexport_put(export, mb[i], &mem_type, &ids[i], &shm_id, &offset, &size) < 0);
+    fail_unless(pa_atomic_load(&s->n_export_failed) == 1);
+
+    /* Peers that can take more get more */
+    pa_memexport_set_max_slots(export, PA_MEMEXPORT_SLOTS_MAX);
+
+    for (; i < PA_ELEMENTSOF(mb); i++)
+        fail_unless(pa_memexport_put(export, mb[i], &mem_type, &ids[i], &shm_id, &offset, &size) == 0);
+
+    for (i = 0; i < PA_ELEMENTSOF(ids); i++)
+        for (j = i + 1; j < PA_ELEMENTSOF(ids); j++)
+            fail_unless(ids[i] != ids[j]);
+
+    fail_unless(pa_atomic_load(&s->n_exported) == (int) PA_ELEMENTSOF(mb));
+
+    /* Released ids can't be released twice, and their slots are reused */
+    fail_unless(pa_memexport_process_release(export, ids[5]) == 0);
+    fail_unless(pa_memexport_process_release(export, ids[5]) < 0);
+    fail_unless(pa_memexport_put(export, mb[5], &mem_type, &ids[5], &shm_id, &offset, &size) == 0);
+    fail_unless(ids[5] != ids[4] && ids[5] != ids[6]);
+
+    pa_memexport_free(export);
+    fail_unless(pa_atomic_load(&s->n_exported) == 0);
+
+    for (i = 0; i < PA_ELEMENTSOF(mb); i++)
+        pa_memblock_unref(mb[i]);
+
+    pa_mempool_unref(pool);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -188,6 +356,9 @@ int main(int argc, char *argv[]) {
     s = suite_create("Memblock");
     tc = tcase_create("memblock");
     tcase_add_test(tc, memblock_test);
+    tcase_add_test(tc, slot_classes_test);
+    tcase_add_test(tc, thread_cache_test);
+    tcase_add_test(tc, export_slots_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -26,6 +26,7 @@
 #include <check.h>
 
 #include <pulsecore/memblockq.h>
+#include <pulsecore/sample-util.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/strbuf.h>
@@ -250,7 +251,11 @@ START_TEST (memblockq_test) {
 
     silence = memchunk_from_str(p, "__");
 
-    bq = pa_memblockq_new("test memblockq", 0, 200, 10, &ss, 4, 4, 40, &silence);
+    /* Run for both the list and the array backend */
+    if (_i == 0)
+        bq = pa_memblockq_new("test memblockq", 0, 200, 10, &ss, 4, 4, 40, &silence);
+    else
+        bq = pa_memblockq_new_ring("test memblockq", 0, 200, 10, &ss, 4, 4, 40, &silence);
     fail_unless(bq != NULL);
     check_queue_invariants(bq);
 
@@ -632,6 +637,294 @@ START_TEST (memblockq_test_tlength_change) {
 }
 END_TEST
 
+static char *peek_all(pa_memblockq *bq, size_t length) {
+    pa_memchunk chunk;
+    pa_strbuf *buf;
+    void *q;
+
+    buf = pa_strbuf_new();
+
+    fail_unless(pa_memblockq_peek_fixed_size(bq, length, &chunk) == 0);
+    q = pa_memblock_acquire(chunk.memblock);
+    pa_strbuf_putsn(buf, (char*) q + chunk.index, chunk.length);
+    pa_memblock_release(chunk.memblock);
+    pa_memblock_unref(chunk.memblock);
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+/* Random pushes, seeks, drops and rewinds on both backends must give
+ * the same results */
+START_TEST (memblockq_test_ring) {
+    pa_mempool *p;
+    pa_memblockq *list, *ring;
+    pa_memchunk silence, data;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_U8,
+        .rate = 48000,
+        .channels = 1
+    };
+    unsigned i;
+
+    p = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    ck_assert_ptr_ne(p, NULL);
+
+    silence = memchunk_from_str(p, "________");
+    data = memchunk_from_str(p, "0123456789abcdefghijklmnopqrstuvwxyz");
+
+    list = pa_memblockq_new("test memblockq", 0, 400, 200, &ss, 0, 1, 100, &silence);
+    ring = pa_memblockq_new_ring("test memblockq", 0, 400, 200, &ss, 0, 1, 100, &silence);
+
+    srand(4711);
+
+    for (i = 0; i < 20000; i++) {
+        int64_t offset;
+        size_t length;
+        char *a, *b;
+
+        switch (rand() % 5) {
+            case 0:
+            case 1: {
+                pa_memchunk chunk = data;
+
+                /* Consecutive pieces get merged */
+                chunk.index = (size_t) rand() % 30;
+                chunk.length = 1 + (size_t) rand() % (data.length - chunk.index);
+
+                ck_assert_int_eq(pa_memblockq_push(list, &chunk), pa_memblockq_push(ring, &chunk));
+                break;
+            }
+
+            case 2:
+                offset = (int64_t) (rand() % 61) - 40;
+                pa_memblockq_seek(list, offset, PA_SEEK_RELATIVE, true);
+                pa_memblockq_seek(ring, offset, PA_SEEK_RELATIVE, true);
+                break;
+
+            case 3:
+                length = (size_t) rand() % 50;
+                pa_memblockq_drop(list, length);
+                pa_memblockq_drop(ring, length);
+                break;
+
+            case 4:
+                length = (size_t) rand() % 20;
+                pa_memblockq_rewind(list, length);
+                pa_memblockq_rewind(ring, length);
+                break;
+        }
+
+        ck_assert_int_eq(pa_memblockq_get_read_index(list), pa_memblockq_get_read_index(ring));
+        ck_assert_int_eq(pa_memblockq_get_write_index(list), pa_memblockq_get_write_index(ring));
+        ck_assert_int_eq(pa_memblockq_get_nblocks(list), pa_memblockq_get_nblocks(ring));
+
+        a = peek_all(list, 64);
+        b = peek_all(ring, 64);
+        ck_assert_str_eq(a, b);
+        pa_xfree(a);
+        pa_xfree(b);
+    }
+
+    pa_memblockq_free(list);
+    pa_memblockq_free(ring);
+    pa_memblock_unref(silence.memblock);
+    pa_memblock_unref(data.memblock);
+    pa_mempool_unref(p);
+}
+END_TEST
+
+START_TEST (memblockq_test_silence_holes) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk silence, data, quiet, chunk;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_S16BE,
+        .rate = 48000,
+        .channels = 1
+    };
+
+    p = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    ck_assert_ptr_ne(p, NULL);
+
+    silence = memchunk_from_str(p, "__");
+    data = memchunk_from_str(p, "1234");
+    quiet.memblock = pa_memblock_new(p, 4);
+    quiet.index = 0;
+    quiet.length = 4;
+    pa_silence_memchunk(&quiet, &ss);
+    pa_memblock_set_is_silence(silence.memblock, true);
+
+    bq = pa_memblockq_new("test memblockq", 0, 200, 100, &ss, 0, 2, 0, &silence);
+    fail_unless(bq != NULL);
+
+    /* Silence flagged blocks at the end of the queue only move the
+     * write index */
+    ck_assert_int_eq(pa_memblockq_push(bq, &data), 0);
+    ck_assert_int_eq(pa_memblockq_push(bq, &silence), 0);
+    ck_assert_int_eq(pa_memblockq_push(bq, &silence), 0);
+    ck_assert_int_eq(pa_memblockq_get_nblocks(bq), 1);
+    ck_assert_int_eq(pa_memblockq_get_length(bq), 8);
+    check_queue_invariants(bq);
+
+    pa_memblockq_drop(bq, 4);
+    ck_assert_int_eq(pa_memblockq_peek(bq, &chunk), 0);
+    fail_unless(pa_memblock_is_silence(chunk.memblock));
+    ck_assert_int_eq(chunk.length, 2);
+    pa_memblock_unref(chunk.memblock);
+
+    /* Silence overwriting queued data is stored as usual */
+    ck_assert_int_eq(pa_memblockq_push(bq, &data), 0);
+    pa_memblockq_seek(bq, -4, PA_SEEK_RELATIVE, true);
+    ck_assert_int_eq(pa_memblockq_push(bq, &silence), 0);
+    ck_assert_int_eq(pa_memblockq_get_nblocks(bq), 2);
+    check_queue_invariants(bq);
+
+    /* Unflagged blocks are always stored, even if they happen to be
+     * quiet */
+    pa_memblockq_seek(bq, 0, PA_SEEK_RELATIVE_END, true);
+    ck_assert_int_eq(pa_memblockq_push(bq, &quiet), 0);
+    ck_assert_int_eq(pa_memblockq_get_nblocks(bq), 3);
+    check_queue_invariants(bq);
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(silence.memblock);
+    pa_memblock_unref(data.memblock);
+    pa_memblock_unref(quiet.memblock);
+    pa_mempool_unref(p);
+}
+END_TEST
+
+START_TEST (memblockq_test_peek_chunks) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk silence, a, b, chunks[4];
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_U8,
+        .rate = 48000,
+        .channels = 1
+    };
+
+    p = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    ck_assert_ptr_ne(p, NULL);
+
+    silence = memchunk_from_str(p, "__");
+    a = memchunk_from_str(p, "1234");
+    b = memchunk_from_str(p, "abcd");
+
+    bq = pa_memblockq_new("test memblockq", 0, 200, 100, &ss, 0, 1, 0, &silence);
+    fail_unless(bq != NULL);
+
+    ck_assert_int_eq(pa_memblockq_peek_chunks(bq, chunks, 4), 0);
+
+    ck_assert_int_eq(pa_memblockq_push(bq, &a), 0);
+    ck_assert_int_eq(pa_memblockq_push(bq, &b), 0);
+    pa_memblockq_seek(bq, 2, PA_SEEK_RELATIVE, true);
+    ck_assert_int_eq(pa_memblockq_push(bq, &a), 0);
+
+    /* Starts in the middle of a block, stops at the hole */
+    pa_memblockq_drop(bq, 1);
+    ck_assert_int_eq(pa_memblockq_peek_chunks(bq, chunks, 4), 2);
+    ck_assert_int_eq(chunks[0].length, 3);
+    ck_assert_int_eq(chunks[1].length, 4);
+    fail_unless(chunks[1].memblock == b.memblock);
+    pa_memblock_unref(chunks[0].memblock);
+    pa_memblock_unref(chunks[1].memblock);
+
+    ck_assert_int_eq(pa_memblockq_peek_chunks(bq, chunks, 1), 1);
+    ck_assert_int_eq(chunks[0].length, 3);
+    pa_memblock_unref(chunks[0].memblock);
+
+    /* Nothing but silence at the read index */
+    pa_memblockq_drop(bq, 7);
+    ck_assert_int_eq(pa_memblockq_peek_chunks(bq, chunks, 4), 0);
+
+    pa_memblockq_drop(bq, 2);
+    ck_assert_int_eq(pa_memblockq_peek_chunks(bq, chunks, 4), 1);
+    ck_assert_int_eq(chunks[0].length, 4);
+    pa_memblock_unref(chunks[0].memblock);
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(silence.memblock);
+    pa_memblock_unref(a.memblock);
+    pa_memblock_unref(b.memblock);
+    pa_mempool_unref(p);
+}
+END_TEST
+
+START_TEST (memblockq_test_peek_fixed_size_chunks) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk silence, a, b, chunks[4];
+    pa_strbuf *buf;
+    char *str;
+    unsigned n, i;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_U8,
+        .rate = 48000,
+        .channels = 1
+    };
+
+    p = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    ck_assert_ptr_ne(p, NULL);
+
+    silence = memchunk_from_str(p, "__");
+    a = memchunk_from_str(p, "1234");
+    b = memchunk_from_str(p, "abcd");
+
+    bq = pa_memblockq_new("test memblockq", 0, 200, 100, &ss, 0, 1, 0, &silence);
+    fail_unless(bq != NULL);
+
+    ck_assert_int_eq(pa_memblockq_push(bq, &a), 0);
+    ck_assert_int_eq(pa_memblockq_push(bq, &b), 0);
+    pa_memblockq_seek(bq, 2, PA_SEEK_RELATIVE, true);
+    ck_assert_int_eq(pa_memblockq_push(bq, &a), 0);
+    pa_memblockq_drop(bq, 1);
+
+    /* Fits into the first block */
+    ck_assert_int_eq(pa_memblockq_peek_fixed_size_chunks(bq, 2, chunks, 4), 1);
+    ck_assert_int_eq(chunks[0].length, 2);
+    fail_unless(chunks[0].memblock == a.memblock);
+    pa_memblock_unref(chunks[0].memblock);
+
+    /* The hole is filled with silence, nothing is copied */
+    ck_assert_int_eq(pa_memblockq_peek_fixed_size_chunks(bq, 12, chunks, 4), 4);
+    ck_assert_int_eq(chunks[0].length, 3);
+    ck_assert_int_eq(chunks[1].length, 4);
+    ck_assert_int_eq(chunks[2].length, 2);
+    ck_assert_int_eq(chunks[3].length, 3);
+    fail_unless(chunks[1].memblock == b.memblock);
+    fail_unless(chunks[2].memblock == silence.memblock);
+    fail_unless(chunks[3].memblock == a.memblock);
+    for (i = 0; i < 4; i++)
+        pa_memblock_unref(chunks[i].memblock);
+
+    /* Not enough chunks, the rest is copied into the last one, and the
+     * end of the queue is padded with silence */
+    for (n = 1; n <= 2; n++) {
+        unsigned k;
+
+        k = pa_memblockq_peek_fixed_size_chunks(bq, 15, chunks, n);
+        ck_assert_int_eq(k, n);
+
+        buf = pa_strbuf_new();
+        for (i = 0; i < k; i++) {
+            dump_chunk(&chunks[i], buf);
+            pa_memblock_unref(chunks[i].memblock);
+        }
+        fprintf(stderr, "\n");
+
+        str = pa_strbuf_to_string_free(buf);
+        ck_assert_str_eq(str, "234abcd__1234__");
+        pa_xfree(str);
+    }
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(silence.memblock);
+    pa_memblock_unref(a.memblock);
+    pa_memblock_unref(b.memblock);
+    pa_mempool_unref(p);
+}
+END_TEST
 
 int main(int argc, char *argv[]) {
     int failed = 0;
@@ -646,10 +939,14 @@ int main(int argc, char *argv[]) {
     tc = tcase_create("memblockq");
     tcase_add_test(tc, memchunk_from_str_test);
     tcase_add_test(tc, memblockq_test_initial_properties);
-    tcase_add_test(tc, memblockq_test);
+    tcase_add_loop_test(tc, memblockq_test, 0, 2);
     tcase_add_test(tc, memblockq_test_length_changes);
     tcase_add_test(tc, memblockq_test_pop_missing);
     tcase_add_test(tc, memblockq_test_tlength_change);
+    tcase_add_test(tc, memblockq_test_ring);
+    tcase_add_test(tc, memblockq_test_silence_holes);
+    tcase_add_test(tc, memblockq_test_peek_chunks);
+    tcase_add_test(tc, memblockq_test_peek_fixed_size_chunks);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
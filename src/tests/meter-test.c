@@ -0,0 +1,167 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/memblock.h>
+#include <pulsecore/meter.h>
+#include <pulsecore/sample-util.h>
+
+#define RATE 8000
+/* 10 ms */
+#define PERIOD_FRAMES 80
+#define PERIOD_USEC (10*PA_USEC_PER_MSEC)
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = RATE,
+    .channels = 2
+};
+
+/* A square wave of half full scale on the left, a quarter on the right */
+static void make_chunk(pa_mempool *pool, unsigned n_frames, pa_memchunk *chunk) {
+    int16_t *d;
+    unsigned i;
+
+    chunk->memblock = pa_memblock_new(pool, n_frames * pa_frame_size(&ss));
+    chunk->index = 0;
+    chunk->length = n_frames * pa_frame_size(&ss);
+
+    d = pa_memblock_acquire(chunk->memblock);
+
+    for (i = 0; i < n_frames; i++) {
+        d[2*i] = (i & 1) ? -0x4000 : 0x4000;
+        d[2*i+1] = (i & 1) ? -0x2000 : 0x2000;
+    }
+
+    pa_memblock_release(chunk->memblock);
+}
+
+static bool near(float a, float b) {
+    return fabsf(a - b) < 0.001f;
+}
+
+START_TEST (levels_test) {
+    pa_mempool *pool;
+    pa_meter_levels levels;
+    pa_meter *m;
+    pa_memchunk chunk;
+    pa_cvolume volume;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    memset(&levels, 0, sizeof(levels));
+    m = pa_meter_new(&levels, PERIOD_USEC);
+
+    /* Not a whole period yet */
+    make_chunk(pool, PERIOD_FRAMES / 2, &chunk);
+    pa_meter_process(m, &chunk, &ss, NULL);
+    fail_unless(pa_atomic_load(&levels.seq) == 0);
+    fail_unless(levels.timestamp == 0);
+
+    pa_meter_process(m, &chunk, &ss, NULL);
+    pa_memblock_unref(chunk.memblock);
+
+    fail_unless(pa_atomic_load(&levels.seq) == 2);
+    fail_unless(levels.channels == 2);
+    fail_unless(levels.timestamp > 0);
+    fail_unless(near(levels.peak[0], 0.5f));
+    fail_unless(near(levels.rms[0], 0.5f));
+    fail_unless(near(levels.peak[1], 0.25f));
+    fail_unless(near(levels.rms[1], 0.25f));
+
+    /* The volume is applied while measuring */
+    pa_cvolume_set(&volume, 2, PA_VOLUME_NORM);
+    volume.values[1] = pa_sw_volume_from_linear(0.5);
+
+    make_chunk(pool, PERIOD_FRAMES, &chunk);
+    pa_meter_process(m, &chunk, &ss, &volume);
+    pa_memblock_unref(chunk.memblock);
+
+    fail_unless(pa_atomic_load(&levels.seq) == 4);
+    fail_unless(near(levels.peak[0], 0.5f));
+    fail_unless(near(levels.peak[1], 0.125f));
+    fail_unless(near(levels.rms[1], 0.125f));
+
+    pa_meter_free(m);
+    pa_mempool_unref(pool);
+}
+END_TEST
+
+START_TEST (silence_test) {
+    pa_mempool *pool;
+    pa_meter_levels levels;
+    pa_meter *m;
+    pa_memchunk chunk;
+    pa_silence_cache cache;
+
+    pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+    pa_silence_cache_init(&cache);
+    memset(&levels, 0, sizeof(levels));
+    m = pa_meter_new(&levels, PERIOD_USEC);
+
+    make_chunk(pool, PERIOD_FRAMES, &chunk);
+    pa_meter_process(m, &chunk, &ss, NULL);
+    pa_memblock_unref(chunk.memblock);
+    fail_unless(pa_atomic_load(&levels.seq) == 2);
+
+    /* Silence of three periods is counted without being looked at, and
+     * publishes three times */
+    pa_silence_memchunk_get(&cache, pool, &chunk, &ss, 3 * PERIOD_FRAMES * pa_frame_size(&ss));
+    fail_unless(pa_memblock_is_silence(chunk.memblock));
+
+    pa_meter_process(m, &chunk, &ss, NULL);
+    pa_memblock_unref(chunk.memblock);
+
+    fail_unless(pa_atomic_load(&levels.seq) == 8);
+    fail_unless(levels.peak[0] == 0.0f);
+    fail_unless(levels.rms[1] == 0.0f);
+
+    pa_meter_free(m);
+    pa_silence_cache_done(&cache);
+    pa_mempool_unref(pool);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Meter");
+    tc = tcase_create("meter");
+    tcase_add_test(tc, levels_test);
+    tcase_add_test(tc, silence_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
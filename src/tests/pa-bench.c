@@ -0,0 +1,916 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* A latency and load benchmark. For each combination of stream count,
+ * sample spec, resampler and timer based scheduling setting a private
+ * daemon is started, either with a null sink (latency is measured
+ * through its monitor source) or with a pair of ALSA devices that are
+ * looped back, e.g. by snd-aloop. One stream plays a short pulse twice
+ * a second which is detected on the capture side; the others play
+ * silence to load the mixer. The results are written out as JSON. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <locale.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+
+#define DEFAULT_DURATION 10
+#define DEFAULT_LATENCY_MSEC 25
+#define DEFAULT_SINK_RATE 48000
+#define WARMUP_USEC (2 * PA_USEC_PER_SEC)
+#define STARTUP_TIMEOUT_USEC (10 * PA_USEC_PER_SEC)
+#define PULSE_PERIOD_MSEC 500
+#define PULSE_LENGTH_MSEC 2
+#define PULSE_AMPLITUDE 0.8
+#define DETECT_THRESHOLD 0.4f
+
+typedef struct bench_options {
+    const char *daemon_binary;
+    const char *dl_search_path;
+    const char *device; /* "null" or "alsa" */
+    const char *sink_device, *source_device;
+    unsigned sink_rate;
+    unsigned duration;
+    unsigned latency_msec;
+    char *streams, *specs, *resamplers, *tsched;
+} bench_options;
+
+typedef struct bench_config {
+    unsigned n_streams;
+    pa_sample_spec ss;
+    const char *resample_method;
+    bool tsched;
+} bench_config;
+
+typedef struct proc_stats {
+    unsigned long long ticks;
+    unsigned long long wakeups;
+    bool valid;
+} proc_stats;
+
+typedef struct bench_state {
+    const bench_options *options;
+    const bench_config *config;
+    pid_t daemon_pid;
+
+    pa_mainloop *mainloop;
+    pa_context *context;
+    pa_stream **play_streams;
+    pa_stream *rec_stream;
+    unsigned n_ready;
+
+    bool measuring;
+    char *error;
+
+    uint64_t frames_written;
+    size_t period_frames, pulse_frames;
+    pa_usec_t pulse_written_at;
+    bool in_pulse;
+
+    pa_usec_t latency_min, latency_max, latency_sum;
+    unsigned latency_count, pulses_lost;
+    unsigned underflows, overflows;
+
+    pa_usec_t start_time, end_time;
+    proc_stats start_stats, end_stats;
+} bench_state;
+
+static void bench_fail(bench_state *b, const char *message) {
+    if (!b->error)
+        b->error = pa_xstrdup(message);
+
+    pa_mainloop_quit(b->mainloop, 1);
+}
+
+/* Returns the user+system time of the daemon in clock ticks and the
+ * number of times any of its threads went to sleep voluntarily, which
+ * bounds the number of wakeups. Linux only. */
+static void read_proc_stats(pid_t pid, proc_stats *s) {
+    char path[64], buf[1024], *p;
+    DIR *d;
+    struct dirent *de;
+    FILE *f;
+    unsigned long long utime, stime;
+
+    pa_zero(*s);
+
+    pa_snprintf(path, sizeof(path), "/proc/%lu/stat", (unsigned long) pid);
+    if (!(f = fopen(path, "r")))
+        return;
+
+    if (!fgets(buf, sizeof(buf), f) || !(p = strrchr(buf, ')')) ||
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+        fclose(f);
+        return;
+    }
+
+    fclose(f);
+    s->ticks = utime + stime;
+
+    pa_snprintf(path, sizeof(path), "/proc/%lu/task", (unsigned long) pid);
+    if (!(d = opendir(path)))
+        return;
+
+    while ((de = readdir(d))) {
+        char *fn;
+
+        if (de->d_name[0] == '.')
+            continue;
+
+        fn = pa_sprintf_malloc("%s/%s/status", path, de->d_name);
+        f = fopen(fn, "r");
+        pa_xfree(fn);
+
+        if (!f)
+            continue;
+
+        while (fgets(buf, sizeof(buf), f)) {
+            unsigned long long n;
+
+            if (sscanf(buf, "voluntary_ctxt_switches: %llu", &n) == 1)
+                s->wakeups += n;
+        }
+
+        fclose(f);
+    }
+
+    closedir(d);
+    s->valid = true;
+}
+
+static void fill_pattern(bench_state *b, void *data, size_t n_frames, bool pulses) {
+    const pa_sample_spec *ss = &b->config->ss;
+    size_t i;
+    unsigned c;
+
+    for (i = 0; i < n_frames; i++) {
+        uint64_t pos = b->frames_written + i;
+        double v = 0;
+
+        if (pulses && (pos % b->period_frames) < b->pulse_frames) {
+            v = PULSE_AMPLITUDE;
+
+            if (pos % b->period_frames == 0 && b->measuring) {
+                if (b->pulse_written_at)
+                    b->pulses_lost++;
+                b->pulse_written_at = pa_rtclock_now();
+            }
+        }
+
+        for (c = 0; c < ss->channels; c++) {
+            switch (ss->format) {
+                case PA_SAMPLE_S16NE:
+                    ((int16_t*) data)[i * ss->channels + c] = (int16_t) (v * 0x7FFF);
+                    break;
+                case PA_SAMPLE_S32NE:
+                    ((int32_t*) data)[i * ss->channels + c] = (int32_t) (v * 0x7FFFFFFF);
+                    break;
+                case PA_SAMPLE_FLOAT32NE:
+                    ((float*) data)[i * ss->channels + c] = (float) v;
+                    break;
+                default:
+                    pa_assert_not_reached();
+            }
+        }
+    }
+}
+
+static void write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    bench_state *b = userdata;
+    size_t fs = pa_frame_size(&b->config->ss);
+    bool pulses = s == b->play_streams[0];
+    void *data;
+
+    while (nbytes > 0) {
+        size_t l = nbytes;
+
+        if (pa_stream_begin_write(s, &data, &l) < 0 || l < fs) {
+            bench_fail(b, "pa_stream_begin_write() failed");
+            return;
+        }
+
+        l = PA_MIN(l, nbytes);
+        l = (l / fs) * fs;
+
+        fill_pattern(b, data, l / fs, pulses);
+
+        if (pulses)
+            b->frames_written += l / fs;
+
+        if (pa_stream_write(s, data, l, NULL, 0, PA_SEEK_RELATIVE) < 0) {
+            bench_fail(b, "pa_stream_write() failed");
+            return;
+        }
+
+        nbytes -= l;
+    }
+}
+
+static void read_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    bench_state *b = userdata;
+    const void *data;
+    size_t l;
+
+    while (pa_stream_readable_size(s) > 0) {
+        if (pa_stream_peek(s, &data, &l) < 0) {
+            bench_fail(b, "pa_stream_peek() failed");
+            return;
+        }
+
+        if (l == 0)
+            break;
+
+        if (data) {
+            const float *f = data;
+            size_t i, n = l / sizeof(float);
+
+            for (i = 0; i < n; i++) {
+                bool high = f[i] > DETECT_THRESHOLD || f[i] < -DETECT_THRESHOLD;
+
+                if (high && !b->in_pulse && b->pulse_written_at) {
+                    pa_usec_t latency = pa_rtclock_now() - b->pulse_written_at;
+
+                    b->latency_min = b->latency_count ? PA_MIN(b->latency_min, latency) : latency;
+                    b->latency_max = PA_MAX(b->latency_max, latency);
+                    b->latency_sum += latency;
+                    b->latency_count++;
+                    b->pulse_written_at = 0;
+                }
+
+                b->in_pulse = high;
+            }
+        }
+
+        pa_stream_drop(s);
+    }
+}
+
+static void underflow_cb(pa_stream *s, void *userdata) {
+    bench_state *b = userdata;
+
+    if (b->measuring)
+        b->underflows++;
+}
+
+static void overflow_cb(pa_stream *s, void *userdata) {
+    bench_state *b = userdata;
+
+    if (b->measuring)
+        b->overflows++;
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    bench_state *b = userdata;
+
+    switch (pa_stream_get_state(s)) {
+        case PA_STREAM_READY:
+            b->n_ready++;
+            break;
+        case PA_STREAM_FAILED:
+            bench_fail(b, pa_strerror(pa_context_errno(b->context)));
+            break;
+        default:
+            break;
+    }
+}
+
+static void end_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    bench_state *b = userdata;
+
+    b->end_time = pa_rtclock_now();
+    read_proc_stats(b->daemon_pid, &b->end_stats);
+    b->measuring = false;
+
+    pa_mainloop_quit(b->mainloop, 0);
+}
+
+static void warmup_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    bench_state *b = userdata;
+
+    if (b->n_ready < b->config->n_streams + 1) {
+        bench_fail(b, "Streams did not become ready in time");
+        return;
+    }
+
+    b->start_time = pa_rtclock_now();
+    read_proc_stats(b->daemon_pid, &b->start_stats);
+    b->pulse_written_at = 0;
+    b->measuring = true;
+
+    a->time_free(e);
+
+    pa_context_rttime_new(b->context, b->start_time + b->options->duration * PA_USEC_PER_SEC, end_cb, b);
+}
+
+static pa_stream *new_stream(bench_state *b, const char *name, const pa_sample_spec *ss) {
+    pa_stream *s;
+
+    if (!(s = pa_stream_new(b->context, name, ss, NULL))) {
+        bench_fail(b, pa_strerror(pa_context_errno(b->context)));
+        return NULL;
+    }
+
+    pa_stream_set_state_callback(s, stream_state_cb, b);
+    return s;
+}
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    bench_state *b = userdata;
+    const bench_config *cfg = b->config;
+    pa_buffer_attr attr;
+    pa_sample_spec rec_ss;
+    unsigned i;
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_READY:
+            break;
+        case PA_CONTEXT_FAILED:
+        case PA_CONTEXT_TERMINATED:
+            bench_fail(b, pa_strerror(pa_context_errno(c)));
+            return;
+        default:
+            return;
+    }
+
+    attr.maxlength = (uint32_t) -1;
+    attr.tlength = (uint32_t) pa_usec_to_bytes(b->options->latency_msec * PA_USEC_PER_MSEC, &cfg->ss);
+    attr.prebuf = 0;
+    attr.minreq = (uint32_t) -1;
+    attr.fragsize = (uint32_t) -1;
+
+    for (i = 0; i < cfg->n_streams; i++) {
+        char name[32];
+
+        pa_snprintf(name, sizeof(name), "bench: play %u", i);
+
+        if (!(b->play_streams[i] = new_stream(b, name, &cfg->ss)))
+            return;
+
+        pa_stream_set_write_callback(b->play_streams[i], write_cb, b);
+        pa_stream_set_underflow_callback(b->play_streams[i], underflow_cb, b);
+
+        if (pa_stream_connect_playback(b->play_streams[i], "bench", &attr,
+                                       PA_STREAM_ADJUST_LATENCY, NULL, NULL) < 0) {
+            bench_fail(b, pa_strerror(pa_context_errno(c)));
+            return;
+        }
+    }
+
+    rec_ss.format = PA_SAMPLE_FLOAT32NE;
+    rec_ss.rate = cfg->ss.rate;
+    rec_ss.channels = 1;
+
+    attr.tlength = (uint32_t) -1;
+    attr.fragsize = (uint32_t) pa_usec_to_bytes(5 * PA_USEC_PER_MSEC, &rec_ss);
+
+    if (!(b->rec_stream = new_stream(b, "bench: record", &rec_ss)))
+        return;
+
+    pa_stream_set_read_callback(b->rec_stream, read_cb, b);
+    pa_stream_set_overflow_callback(b->rec_stream, overflow_cb, b);
+
+    if (pa_stream_connect_record(b->rec_stream,
+                                 pa_streq(b->options->device, "alsa") ? "bench_in" : "bench.monitor",
+                                 &attr, PA_STREAM_ADJUST_LATENCY) < 0) {
+        bench_fail(b, pa_strerror(pa_context_errno(c)));
+        return;
+    }
+
+    pa_context_rttime_new(c, pa_rtclock_now() + WARMUP_USEC, warmup_cb, b);
+}
+
+static pid_t start_daemon(const bench_options *o, const bench_config *cfg, const char *dir) {
+    char *argv[16];
+    unsigned n = 0, i;
+    pid_t pid;
+
+    argv[n++] = pa_xstrdup(o->daemon_binary);
+    argv[n++] = pa_xstrdup("-n");
+    argv[n++] = pa_xstrdup("--daemonize=no");
+    argv[n++] = pa_xstrdup("--use-pid-file=no");
+    argv[n++] = pa_xstrdup("--exit-idle-time=-1");
+    argv[n++] = pa_xstrdup("--log-target=stderr");
+    argv[n++] = pa_xstrdup("--log-level=error");
+    argv[n++] = pa_sprintf_malloc("--resample-method=%s", cfg->resample_method);
+
+    if (o->dl_search_path)
+        argv[n++] = pa_sprintf_malloc("--dl-search-path=%s", o->dl_search_path);
+
+    argv[n++] = pa_sprintf_malloc("--load=module-native-protocol-unix socket=%s/native auth-anonymous=1", dir);
+
+    if (pa_streq(o->device, "alsa")) {
+        argv[n++] = pa_sprintf_malloc("--load=module-alsa-sink sink_name=bench device=%s rate=%u tsched=%i",
+                                      o->sink_device, o->sink_rate, cfg->tsched);
+        argv[n++] = pa_sprintf_malloc("--load=module-alsa-source source_name=bench_in device=%s rate=%u tsched=%i",
+                                      o->source_device, o->sink_rate, cfg->tsched);
+    } else
+        argv[n++] = pa_sprintf_malloc("--load=module-null-sink sink_name=bench rate=%u", o->sink_rate);
+
+    argv[n] = NULL;
+    pa_assert(n < PA_ELEMENTSOF(argv));
+
+    if ((pid = fork()) < 0)
+        pa_log_error("fork() failed: %s", pa_cstrerror(errno));
+    else if (pid == 0) {
+        char *state = pa_sprintf_malloc("%s/state", dir);
+
+        setenv("PULSE_RUNTIME_PATH", dir, 1);
+        setenv("PULSE_STATE_PATH", state, 1);
+        unsetenv("PULSE_SERVER");
+
+        execvp(argv[0], argv);
+        pa_log_error("Failed to execute %s: %s", argv[0], pa_cstrerror(errno));
+        _exit(1);
+    }
+
+    for (i = 0; i < n; i++)
+        pa_xfree(argv[i]);
+
+    return pid;
+}
+
+static void stop_daemon(pid_t pid) {
+    int status;
+
+    kill(pid, SIGTERM);
+
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+}
+
+static void remove_tree(const char *path) {
+    DIR *d;
+    struct dirent *de;
+
+    if ((d = opendir(path))) {
+        while ((de = readdir(d))) {
+            char *fn;
+
+            if (pa_streq(de->d_name, ".") || pa_streq(de->d_name, ".."))
+                continue;
+
+            fn = pa_sprintf_malloc("%s/%s", path, de->d_name);
+            remove_tree(fn);
+            pa_xfree(fn);
+        }
+
+        closedir(d);
+        rmdir(path);
+    } else
+        unlink(path);
+}
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(f, "\\u%04x", (unsigned char) *s);
+        else
+            fputc(*s, f);
+    }
+
+    fputc('"', f);
+}
+
+static void run_config(const bench_options *o, const bench_config *cfg, FILE *out) {
+    bench_state b;
+    char dir[] = "/tmp/pa-bench-XXXXXX", *socket_path = NULL, *server = NULL;
+    char ss_str[PA_SAMPLE_SPEC_SNPRINT_MAX];
+    pa_usec_t timeout;
+    unsigned i;
+
+    pa_zero(b);
+    b.options = o;
+    b.config = cfg;
+    b.daemon_pid = -1;
+    b.period_frames = (size_t) cfg->ss.rate * PULSE_PERIOD_MSEC / 1000;
+    b.pulse_frames = (size_t) cfg->ss.rate * PULSE_LENGTH_MSEC / 1000;
+    b.play_streams = pa_xnew0(pa_stream*, cfg->n_streams);
+
+    if (!mkdtemp(dir)) {
+        b.error = pa_sprintf_malloc("mkdtemp() failed: %s", pa_cstrerror(errno));
+        goto finish;
+    }
+
+    if ((b.daemon_pid = start_daemon(o, cfg, dir)) < 0) {
+        b.error = pa_xstrdup("Failed to start the daemon");
+        goto finish;
+    }
+
+    /* Wait until the daemon created its socket */
+    socket_path = pa_sprintf_malloc("%s/native", dir);
+    timeout = pa_rtclock_now() + STARTUP_TIMEOUT_USEC;
+
+    while (access(socket_path, F_OK) < 0) {
+        if (pa_rtclock_now() > timeout || waitpid(b.daemon_pid, NULL, WNOHANG) == b.daemon_pid) {
+            b.error = pa_xstrdup("Daemon did not come up");
+            goto finish;
+        }
+
+        pa_msleep(50);
+    }
+
+    b.mainloop = pa_mainloop_new();
+    b.context = pa_context_new(pa_mainloop_get_api(b.mainloop), "pa-bench");
+    pa_context_set_state_callback(b.context, context_state_cb, &b);
+
+    server = pa_sprintf_malloc("unix:%s", socket_path);
+
+    if (pa_context_connect(b.context, server, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0)
+        b.error = pa_xstrdup(pa_strerror(pa_context_errno(b.context)));
+    else
+        pa_mainloop_run(b.mainloop, NULL);
+
+finish:
+    pa_sample_spec_snprint(ss_str, sizeof(ss_str), &cfg->ss);
+
+    fprintf(out, "    { \"streams\": %u, \"sample_spec\": ", cfg->n_streams);
+    json_string(out, ss_str);
+    fprintf(out, ", \"resample_method\": ");
+    json_string(out, cfg->resample_method);
+    fprintf(out, ", \"tsched\": %s", cfg->tsched ? "true" : "false");
+
+    if (b.error) {
+        fprintf(out, ", \"error\": ");
+        json_string(out, b.error);
+    } else {
+        double seconds = (double) (b.end_time - b.start_time) / PA_USEC_PER_SEC;
+
+        if (b.latency_count)
+            fprintf(out, ", \"latency_usec\": { \"min\": %llu, \"avg\": %llu, \"max\": %llu, \"count\": %u }",
+                    (unsigned long long) b.latency_min,
+                    (unsigned long long) (b.latency_sum / b.latency_count),
+                    (unsigned long long) b.latency_max,
+                    b.latency_count);
+        else
+            fprintf(out, ", \"latency_usec\": null");
+
+        if (b.start_stats.valid && b.end_stats.valid && seconds > 0) {
+            double cpu = (double) (b.end_stats.ticks - b.start_stats.ticks) / sysconf(_SC_CLK_TCK) / seconds * 100;
+
+            fprintf(out, ", \"wakeups_per_sec\": %.1f, \"cpu_percent\": %.2f, \"cpu_percent_per_stream\": %.3f",
+                    (double) (b.end_stats.wakeups - b.start_stats.wakeups) / seconds,
+                    cpu, cpu / cfg->n_streams);
+        } else
+            fprintf(out, ", \"wakeups_per_sec\": null, \"cpu_percent\": null, \"cpu_percent_per_stream\": null");
+
+        fprintf(out, ", \"underflows\": %u, \"overflows\": %u, \"pulses_lost\": %u",
+                b.underflows, b.overflows, b.pulses_lost);
+    }
+
+    fprintf(out, " }");
+
+    for (i = 0; i < cfg->n_streams; i++)
+        if (b.play_streams[i]) {
+            pa_stream_disconnect(b.play_streams[i]);
+            pa_stream_unref(b.play_streams[i]);
+        }
+
+    if (b.rec_stream) {
+        pa_stream_disconnect(b.rec_stream);
+        pa_stream_unref(b.rec_stream);
+    }
+
+    if (b.context) {
+        pa_context_disconnect(b.context);
+        pa_context_unref(b.context);
+    }
+
+    if (b.mainloop)
+        pa_mainloop_free(b.mainloop);
+
+    if (b.daemon_pid > 0)
+        stop_daemon(b.daemon_pid);
+
+    remove_tree(dir);
+
+    pa_xfree(b.play_streams);
+    pa_xfree(b.error);
+    pa_xfree(socket_path);
+    pa_xfree(server);
+}
+
+static int parse_spec(const char *s, pa_sample_spec *ss) {
+    char *format;
+    const char *state = NULL;
+    char *rate, *channels;
+    uint32_t n;
+    int r = -1;
+
+    format = pa_split(s, ":", &state);
+    rate = pa_split(s, ":", &state);
+    channels = pa_split(s, ":", &state);
+
+    if (!format || !rate || !channels)
+        goto finish;
+
+    if ((ss->format = pa_parse_sample_format(format)) != PA_SAMPLE_S16NE &&
+        ss->format != PA_SAMPLE_S32NE && ss->format != PA_SAMPLE_FLOAT32NE)
+        goto finish;
+
+    if (pa_atou(rate, &ss->rate) < 0)
+        goto finish;
+
+    if (pa_atou(channels, &n) < 0 || n > PA_CHANNELS_MAX)
+        goto finish;
+
+    ss->channels = (uint8_t) n;
+    r = pa_sample_spec_valid(ss) ? 0 : -1;
+
+finish:
+    pa_xfree(format);
+    pa_xfree(rate);
+    pa_xfree(channels);
+
+    return r;
+}
+
+static void help(const char *argv0) {
+    printf("%s [options]\n\n"
+           "-h, --help                            Show this help\n"
+           "      --daemon=PATH                   Daemon binary (defaults to pulseaudio)\n"
+           "      --dl-search-path=PATH           Module search path passed to the daemon\n"
+           "      --device=null|alsa              Measure with a null sink or looped back ALSA\n"
+           "                                      devices (defaults to null)\n"
+           "      --sink-device=DEV               ALSA playback device (defaults to hw:Loopback,0)\n"
+           "      --source-device=DEV             ALSA capture device (defaults to hw:Loopback,1)\n"
+           "      --sink-rate=RATE                Device sample rate (defaults to %u)\n"
+           "      --streams=N,...                 Stream counts (defaults to 1,4,16)\n"
+           "      --specs=FORMAT:RATE:CHANNELS,...\n"
+           "                                      Stream sample specs (defaults to\n"
+           "                                      s16ne:44100:2,float32ne:48000:2)\n"
+           "      --resamplers=METHOD,...         Resample methods (defaults to speex-float-1)\n"
+           "      --tsched=BOOL,...               Timer based scheduling settings to test, ALSA\n"
+           "                                      only (defaults to 1)\n"
+           "      --duration=SECONDS              Measurement time per run (defaults to %u)\n"
+           "      --latency-msec=MSEC             Requested playback latency (defaults to %u)\n"
+           "      --output=FILE                   Write the JSON results to FILE instead of\n"
+           "                                      standard output\n"
+           "\n"
+           "Sample format must be one of s16ne, s32ne or float32ne.\n",
+           argv0, DEFAULT_SINK_RATE, DEFAULT_DURATION, DEFAULT_LATENCY_MSEC);
+}
+
+enum {
+    ARG_DAEMON = 256,
+    ARG_DL_SEARCH_PATH,
+    ARG_DEVICE,
+    ARG_SINK_DEVICE,
+    ARG_SOURCE_DEVICE,
+    ARG_SINK_RATE,
+    ARG_STREAMS,
+    ARG_SPECS,
+    ARG_RESAMPLERS,
+    ARG_TSCHED,
+    ARG_DURATION,
+    ARG_LATENCY_MSEC,
+    ARG_OUTPUT
+};
+
+int main(int argc, char *argv[]) {
+    bench_options o;
+    bench_config cfg;
+    FILE *out = stdout;
+    const char *output = NULL;
+    const char *s_state = NULL, *p_state, *r_state, *t_state;
+    char *n_str, *p_str, *r_str, *t_str;
+    bool first = true;
+    int ret = 1, c, tsched;
+
+    static const struct option long_options[] = {
+        {"help",                  0, NULL, 'h'},
+        {"daemon",                1, NULL, ARG_DAEMON},
+        {"dl-search-path",        1, NULL, ARG_DL_SEARCH_PATH},
+        {"device",                1, NULL, ARG_DEVICE},
+        {"sink-device",           1, NULL, ARG_SINK_DEVICE},
+        {"source-device",         1, NULL, ARG_SOURCE_DEVICE},
+        {"sink-rate",             1, NULL, ARG_SINK_RATE},
+        {"streams",               1, NULL, ARG_STREAMS},
+        {"specs",                 1, NULL, ARG_SPECS},
+        {"resamplers",            1, NULL, ARG_RESAMPLERS},
+        {"tsched",                1, NULL, ARG_TSCHED},
+        {"duration",              1, NULL, ARG_DURATION},
+        {"latency-msec",          1, NULL, ARG_LATENCY_MSEC},
+        {"output",                1, NULL, ARG_OUTPUT},
+        {NULL,                    0, NULL, 0}
+    };
+
+    setlocale(LC_ALL, "");
+
+    pa_log_set_level(PA_LOG_WARN);
+
+    pa_zero(o);
+    o.daemon_binary = "pulseaudio";
+    o.device = "null";
+    o.sink_device = "hw:Loopback,0";
+    o.source_device = "hw:Loopback,1";
+    o.sink_rate = DEFAULT_SINK_RATE;
+    o.duration = DEFAULT_DURATION;
+    o.latency_msec = DEFAULT_LATENCY_MSEC;
+
+    while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+
+        switch (c) {
+            case 'h':
+                help(argv[0]);
+                ret = 0;
+                goto quit;
+
+            case ARG_DAEMON:
+                o.daemon_binary = optarg;
+                break;
+
+            case ARG_DL_SEARCH_PATH:
+                o.dl_search_path = optarg;
+                break;
+
+            case ARG_DEVICE:
+                if (!pa_streq(optarg, "null") && !pa_streq(optarg, "alsa")) {
+                    pa_log_error("Invalid device type: %s", optarg);
+                    goto quit;
+                }
+                o.device = optarg;
+                break;
+
+            case ARG_SINK_DEVICE:
+                o.sink_device = optarg;
+                break;
+
+            case ARG_SOURCE_DEVICE:
+                o.source_device = optarg;
+                break;
+
+            case ARG_SINK_RATE:
+                if (pa_atou(optarg, &o.sink_rate) < 0 || !pa_sample_rate_valid(o.sink_rate)) {
+                    pa_log_error("Invalid sample rate: %s", optarg);
+                    goto quit;
+                }
+                break;
+
+            case ARG_STREAMS:
+                pa_xfree(o.streams);
+                o.streams = pa_xstrdup(optarg);
+                break;
+
+            case ARG_SPECS:
+                pa_xfree(o.specs);
+                o.specs = pa_xstrdup(optarg);
+                break;
+
+            case ARG_RESAMPLERS:
+                pa_xfree(o.resamplers);
+                o.resamplers = pa_xstrdup(optarg);
+                break;
+
+            case ARG_TSCHED:
+                pa_xfree(o.tsched);
+                o.tsched = pa_xstrdup(optarg);
+                break;
+
+            case ARG_DURATION:
+                if (pa_atou(optarg, &o.duration) < 0 || o.duration == 0) {
+                    pa_log_error("Invalid duration: %s", optarg);
+                    goto quit;
+                }
+                break;
+
+            case ARG_LATENCY_MSEC:
+                if (pa_atou(optarg, &o.latency_msec) < 0 || o.latency_msec == 0) {
+                    pa_log_error("Invalid latency: %s", optarg);
+                    goto quit;
+                }
+                break;
+
+            case ARG_OUTPUT:
+                output = optarg;
+                break;
+
+            default:
+                goto quit;
+        }
+    }
+
+    if (!o.streams)
+        o.streams = pa_xstrdup("1,4,16");
+    if (!o.specs)
+        o.specs = pa_xstrdup("s16ne:44100:2,float32ne:48000:2");
+    if (!o.resamplers)
+        o.resamplers = pa_xstrdup("speex-float-1");
+    if (!o.tsched || pa_streq(o.device, "null")) {
+        /* The null sink has no notion of timer based scheduling */
+        pa_xfree(o.tsched);
+        o.tsched = pa_xstrdup("1");
+    }
+
+    if (output && !(out = fopen(output, "w"))) {
+        pa_log_error("Failed to open %s: %s", output, pa_cstrerror(errno));
+        goto quit;
+    }
+
+    /* We get killed by SIGPIPE if a daemon dies under us otherwise */
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(out, "{\n  \"version\": ");
+    json_string(out, pa_get_library_version());
+    fprintf(out, ",\n  \"device\": ");
+    json_string(out, o.device);
+    fprintf(out, ",\n  \"duration\": %u,\n  \"latency_msec\": %u,\n  \"results\": [\n",
+            o.duration, o.latency_msec);
+
+    while ((n_str = pa_split(o.streams, ",", &s_state))) {
+        if (pa_atou(n_str, &cfg.n_streams) < 0 || cfg.n_streams == 0) {
+            pa_log_error("Invalid stream count: %s", n_str);
+            pa_xfree(n_str);
+            goto quit;
+        }
+        pa_xfree(n_str);
+
+        p_state = NULL;
+        while ((p_str = pa_split(o.specs, ",", &p_state))) {
+            if (parse_spec(p_str, &cfg.ss) < 0) {
+                pa_log_error("Invalid sample spec: %s", p_str);
+                pa_xfree(p_str);
+                goto quit;
+            }
+            pa_xfree(p_str);
+
+            r_state = NULL;
+            while ((r_str = pa_split(o.resamplers, ",", &r_state))) {
+                cfg.resample_method = r_str;
+
+                t_state = NULL;
+                while ((t_str = pa_split(o.tsched, ",", &t_state))) {
+                    if ((tsched = pa_parse_boolean(t_str)) < 0) {
+                        pa_log_error("Invalid tsched setting: %s", t_str);
+                        pa_xfree(t_str);
+                        pa_xfree(r_str);
+                        goto quit;
+                    }
+                    pa_xfree(t_str);
+
+                    cfg.tsched = !!tsched;
+
+                    if (!first)
+                        fprintf(out, ",\n");
+                    first = false;
+
+                    run_config(&o, &cfg, out);
+                    fflush(out);
+                }
+
+                pa_xfree(r_str);
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    ret = 0;
+
+quit:
+    if (out && out != stdout)
+        fclose(out);
+
+    pa_xfree(o.streams);
+    pa_xfree(o.specs);
+    pa_xfree(o.resamplers);
+    pa_xfree(o.tsched);
+
+    return ret;
+}
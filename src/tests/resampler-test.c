@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <locale.h>
+#include <math.h>
 
 #include <pulse/pulseaudio.h>
 
@@ -37,6 +38,7 @@
 #include <pulsecore/memblock.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/cpu.h>
 
 static void dump_block(const char *label, const pa_sample_spec *ss, const pa_memchunk *chunk) {
     void *d;
@@ -251,6 +253,59 @@ static pa_memblock* generate_block(pa_mempool *pool, const pa_sample_spec *ss) {
     return r;
 }
 
+/* Resamples a sine of the given frequency, and returns how far above
+ * everything else in the result that sine is, in dB */
+static double measure_snr(pa_mempool *pool, pa_resampler *r, const pa_sample_spec *a, const pa_sample_spec *b, double freq) {
+    pa_memchunk i, j;
+    float *d;
+    double ss = 0, cc = 0, sc = 0, xs = 0, xc = 0, det, sa, ca, signal = 0, noise = 0;
+    unsigned k, n, skip;
+
+    i.memblock = pa_memblock_new(pool, pa_usec_to_bytes(PA_USEC_PER_SEC / 2, a));
+    i.index = 0;
+    i.length = pa_memblock_get_length(i.memblock);
+
+    d = pa_memblock_acquire(i.memblock);
+    for (k = 0; k < i.length / sizeof(float); k++)
+        d[k] = (float) (0.5 * sin(2 * M_PI * freq * (k / a->channels) / a->rate));
+    pa_memblock_release(i.memblock);
+
+    pa_resampler_run(r, &i, &j);
+    pa_memblock_unref(i.memblock);
+
+    /* Fit a sine of that frequency to the first channel of the result,
+     * leaving out the start, where the filter is still filling up */
+    d = pa_memblock_acquire_chunk(&j);
+    n = (unsigned) (j.length / pa_frame_size(b));
+    skip = n / 8;
+
+    for (k = skip; k < n; k++) {
+        double s = sin(2 * M_PI * freq * k / b->rate), c = cos(2 * M_PI * freq * k / b->rate);
+
+        ss += s * s;
+        cc += c * c;
+        sc += s * c;
+        xs += d[k * b->channels] * s;
+        xc += d[k * b->channels] * c;
+    }
+
+    det = ss * cc - sc * sc;
+    sa = (xs * cc - xc * sc) / det;
+    ca = (xc * ss - xs * sc) / det;
+
+    for (k = skip; k < n; k++) {
+        double y = sa * sin(2 * M_PI * freq * k / b->rate) + ca * cos(2 * M_PI * freq * k / b->rate);
+
+        signal += y * y;
+        noise += (d[k * b->channels] - y) * (d[k * b->channels] - y);
+    }
+
+    pa_memblock_release(j.memblock);
+    pa_memblock_unref(j.memblock);
+
+    return 10 * log10(signal / noise);
+}
+
 static void help(const char *argv0) {
     printf("%s [options]\n\n"
            "-h, --help                            Show this help\n"
@@ -263,6 +318,8 @@ static void help(const char *argv0) {
            "      --to-channels=CHANNELS          To number of channels (defaults to 1)\n"
            "      --resample-method=METHOD        Resample method (defaults to auto)\n"
            "      --seconds=SECONDS               From stream duration (defaults to 60)\n"
+           "      --quality                       Measure the signal to noise ratio of sines\n"
+           "                                      instead of the speed\n"
            "\n"
            "If the formats are not specified, the test performs all formats combinations,\n"
            "back and forth.\n"
@@ -284,7 +341,8 @@ enum {
     ARG_TO_CHANNELS,
     ARG_SECONDS,
     ARG_RESAMPLE_METHOD,
-    ARG_DUMP_RESAMPLE_METHODS
+    ARG_DUMP_RESAMPLE_METHODS,
+    ARG_QUALITY
 };
 
 static void dump_resample_methods(void) {
@@ -300,7 +358,7 @@ int main(int argc, char *argv[]) {
     pa_mempool *pool = NULL;
     pa_sample_spec a, b;
     int ret = 1, c;
-    bool all_formats = true;
+    bool all_formats = true, quality = false;
     pa_resample_method_t method;
     int seconds;
     unsigned crossover_freq = 120;
@@ -318,6 +376,7 @@ int main(int argc, char *argv[]) {
         {"seconds",               1, NULL, ARG_SECONDS},
         {"resample-method",       1, NULL, ARG_RESAMPLE_METHOD},
         {"dump-resample-methods", 0, NULL, ARG_DUMP_RESAMPLE_METHODS},
+        {"quality",               0, NULL, ARG_QUALITY},
         {NULL,                    0, NULL, 0}
     };
 
@@ -398,6 +457,10 @@ int main(int argc, char *argv[]) {
                 method = pa_parse_resample_method(optarg);
                 break;
 
+            case ARG_QUALITY:
+                quality = true;
+                break;
+
             default:
                 goto quit;
         }
@@ -406,11 +469,40 @@ int main(int argc, char *argv[]) {
     ret = 0;
     pa_assert_se(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true));
 
+    if (quality) {
+        static const double freqs[] = { 100, 1000, 5000, 10000, 15000, 18000, 20000 };
+        pa_resampler *resampler;
+        unsigned f;
+
+        /* Float samples, so that only the resampler is measured */
+        a.format = b.format = PA_SAMPLE_FLOAT32NE;
+
+        pa_assert_se(resampler = pa_resampler_new(pool, &a, NULL, &b, NULL, crossover_freq, method, 0));
+        pa_log_info("=== %s: %d Hz -> %d Hz", pa_resample_method_to_string(pa_resampler_get_method(resampler)), a.rate, b.rate);
+
+        for (f = 0; f < PA_ELEMENTSOF(freqs); f++) {
+            if (freqs[f] >= 0.45 * PA_MIN(a.rate, b.rate))
+                break;
+
+            pa_resampler_reset(resampler);
+            pa_log_info("%5.0f Hz: %5.1f dB", freqs[f], measure_snr(pool, resampler, &a, &b, freqs[f]));
+        }
+
+        pa_resampler_free(resampler);
+
+        goto quit;
+    }
+
     if (!all_formats) {
 
         pa_resampler *resampler;
         pa_memchunk i, j;
         pa_usec_t ts;
+        pa_cpu_info cpu_info;
+
+        /* Benchmark the optimized functions, unless PULSE_NO_SIMD is set */
+        pa_zero(cpu_info);
+        pa_cpu_init(&cpu_info);
 
         pa_log_debug("Compilation CFLAGS: %s", PA_CFLAGS);
         pa_log_debug("=== %d seconds: %d Hz %d ch (%s) -> %d Hz %d ch (%s)", seconds,
@@ -149,6 +149,43 @@ START_TEST (volume_test) {
 }
 END_TEST
 
+START_TEST (cvolume_conversion_test) {
+    pa_cvolume cv, r;
+    double linear[PA_CHANNELS_MAX], dB[PA_CHANNELS_MAX];
+    pa_volume_t v;
+    unsigned c;
+
+    /* Every volume survives the way to dB and linear and back */
+    for (v = PA_VOLUME_MUTED; v <= PA_VOLUME_NORM*4; v++) {
+        fail_unless(pa_sw_volume_from_dB(pa_sw_volume_to_dB(v)) == v);
+        fail_unless(pa_sw_volume_from_linear(pa_sw_volume_to_linear(v)) == v);
+    }
+
+    fail_unless(pa_sw_volume_to_dB(PA_VOLUME_NORM) == 0.0);
+    fail_unless(pa_sw_volume_from_dB(0.0) == PA_VOLUME_NORM);
+    fail_unless(pa_sw_volume_from_dB(1e6) == PA_VOLUME_MAX);
+
+    /* The batched versions agree with the per channel ones */
+    cv.channels = PA_CHANNELS_MAX;
+    for (c = 0; c < cv.channels; c++)
+        cv.values[c] = (pa_volume_t) (c * PA_VOLUME_NORM / 7);
+
+    fail_unless(pa_sw_cvolume_to_linear(linear, &cv) == linear);
+    fail_unless(pa_sw_cvolume_to_dB(dB, &cv) == dB);
+
+    for (c = 0; c < cv.channels; c++) {
+        fail_unless(linear[c] == pa_sw_volume_to_linear(cv.values[c]));
+        fail_unless(dB[c] == pa_sw_volume_to_dB(cv.values[c]));
+    }
+
+    fail_unless(pa_sw_cvolume_from_linear(&r, linear, cv.channels) == &r);
+    fail_unless(pa_cvolume_equal(&r, &cv));
+
+    fail_unless(pa_sw_cvolume_from_dB(&r, dB, cv.channels) == &r);
+    fail_unless(pa_cvolume_equal(&r, &cv));
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -158,6 +195,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Volume");
     tc = tcase_create("volume");
     tcase_add_test(tc, volume_test);
+    tcase_add_test(tc, cvolume_conversion_test);
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
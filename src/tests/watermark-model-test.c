@@ -0,0 +1,162 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/watermark-model.h>
+
+#define HALF_LIFE (10*PA_USEC_PER_SEC)
+#define HOLD (5*PA_USEC_PER_SEC)
+#define MARGIN (5*PA_USEC_PER_MSEC)
+#define PERIOD (10*PA_USEC_PER_MSEC)
+
+/* Feeds one wakeup per PERIOD, every 'every'th one being 'late' instead of 'lateness' */
+static pa_usec_t feed(pa_watermark_model *m, pa_usec_t now, pa_usec_t duration, pa_usec_t lateness, unsigned every, pa_usec_t late) {
+    pa_usec_t end = now + duration;
+    unsigned n = 0;
+
+    for (; now < end; now += PERIOD)
+        pa_watermark_model_add(m, now, every && ++n % every == 0 ? late : lateness);
+
+    return now;
+}
+
+START_TEST (quantile_test) {
+    pa_watermark_model *m;
+    pa_usec_t q;
+
+    m = pa_watermark_model_new(HALF_LIFE, HOLD, MARGIN);
+
+    /* Not enough data yet */
+    pa_watermark_model_add(m, PA_USEC_PER_SEC, PA_USEC_PER_MSEC);
+    fail_unless(pa_watermark_model_quantile(m, 0.99) == 0);
+    fail_unless(pa_watermark_model_suggest(m, PA_USEC_PER_SEC, 20 * PA_USEC_PER_MSEC) == 20 * PA_USEC_PER_MSEC);
+
+    /* One in 200 wakeups is badly late, which is below the 1% tail */
+    feed(m, PA_USEC_PER_SEC, 5 * PA_USEC_PER_SEC, PA_USEC_PER_MSEC, 200, 50 * PA_USEC_PER_MSEC);
+    q = pa_watermark_model_quantile(m, 0.99);
+    fail_unless(q >= PA_USEC_PER_MSEC);
+    fail_unless(q < 2 * PA_USEC_PER_MSEC);
+
+    /* But it is above the 0.1% tail */
+    fail_unless(pa_watermark_model_quantile(m, 0.999) >= 50 * PA_USEC_PER_MSEC);
+
+    pa_watermark_model_reset(m);
+    fail_unless(pa_watermark_model_quantile(m, 0.99) == 0);
+
+    pa_watermark_model_free(m);
+}
+END_TEST
+
+START_TEST (recover_test) {
+    pa_watermark_model *m;
+    pa_usec_t now = PA_USEC_PER_SEC, w;
+
+    m = pa_watermark_model_new(HALF_LIFE, HOLD, MARGIN);
+
+    now = feed(m, now, 2 * PA_USEC_PER_SEC, PA_USEC_PER_MSEC, 0, 0);
+
+    /* A single dropout after which the caller doubled the watermark */
+    pa_watermark_model_dropout(m, now, 20 * PA_USEC_PER_MSEC);
+    w = 40 * PA_USEC_PER_MSEC;
+
+    /* Held back for a while */
+    now = feed(m, now, HOLD / 2, PA_USEC_PER_MSEC, 0, 0);
+    fail_unless(pa_watermark_model_suggest(m, now, w) == w);
+
+    /* Then straight down to the tail plus margin, not step by step */
+    now = feed(m, now, HOLD, PA_USEC_PER_MSEC, 0, 0);
+    w = pa_watermark_model_suggest(m, now, w);
+    fail_unless(w >= PA_USEC_PER_MSEC + MARGIN);
+    fail_unless(w < 2 * PA_USEC_PER_MSEC + MARGIN);
+
+    /* Small changes of the tail don't move it back and forth */
+    fail_unless(pa_watermark_model_suggest(m, now, w + PA_USEC_PER_MSEC) == w + PA_USEC_PER_MSEC);
+
+    pa_watermark_model_free(m);
+}
+END_TEST
+
+START_TEST (raise_test) {
+    pa_watermark_model *m;
+    pa_usec_t now = PA_USEC_PER_SEC, w = 10 * PA_USEC_PER_MSEC;
+
+    m = pa_watermark_model_new(HALF_LIFE, HOLD, MARGIN);
+
+    /* Wakeups are getting late by more than the margin allows for */
+    now = feed(m, now, 2 * PA_USEC_PER_SEC, 8 * PA_USEC_PER_MSEC, 0, 0);
+    w = pa_watermark_model_suggest(m, now, w);
+    fail_unless(w > 12 * PA_USEC_PER_MSEC);
+
+    /* Back to normal, but a raise holds off decreases too */
+    now = feed(m, now, HOLD / 2, PA_USEC_PER_MSEC, 0, 0);
+    fail_unless(pa_watermark_model_suggest(m, now, w) == w);
+
+    pa_watermark_model_free(m);
+}
+END_TEST
+
+START_TEST (decay_test) {
+    pa_watermark_model *m;
+    pa_usec_t now = PA_USEC_PER_SEC;
+
+    m = pa_watermark_model_new(HALF_LIFE, HOLD, MARGIN);
+
+    now = feed(m, now, 10 * PA_USEC_PER_SEC, 30 * PA_USEC_PER_MSEC, 0, 0);
+    fail_unless(pa_watermark_model_quantile(m, 0.99) >= 30 * PA_USEC_PER_MSEC);
+
+    /* The old samples fade out after a few half lives */
+    now = feed(m, now, 8 * HALF_LIFE, PA_USEC_PER_MSEC, 0, 0);
+    fail_unless(pa_watermark_model_quantile(m, 0.99) < 2 * PA_USEC_PER_MSEC);
+
+    /* After a very long pause nothing is left */
+    pa_watermark_model_add(m, now + 100 * HALF_LIFE, PA_USEC_PER_MSEC);
+    fail_unless(pa_watermark_model_quantile(m, 0.99) == 0);
+
+    pa_watermark_model_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Watermark Model");
+    tc = tcase_create("watermarkmodel");
+    tcase_add_test(tc, quantile_test);
+    tcase_add_test(tc, recover_test);
+    tcase_add_test(tc, raise_test);
+    tcase_add_test(tc, decay_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
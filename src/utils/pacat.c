@@ -40,6 +40,7 @@
 
 #include <pulsecore/core-util.h>
 #include <pulsecore/i18n.h>
+#include <pulsecore/llist.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/sndfile-util.h>
@@ -76,6 +77,21 @@ static size_t partialframe_len = 0;
 static void *buffer = NULL;
 static size_t buffer_length = 0, buffer_index = 0;
 
+/* Recording buffers handed to STDOUT with vmsplice(). The pipe references
+ * their memory rather than a copy, so they are kept until the reader has
+ * read everything up to end. If STDOUT isn't a pipe we write() instead. */
+struct spliced_buffer {
+    PA_LLIST_FIELDS(struct spliced_buffer);
+
+    void *data;
+    uint64_t end;
+};
+
+static bool use_vmsplice = true;
+static uint64_t stdout_written = 0;
+static PA_LLIST_HEAD(struct spliced_buffer, spliced_buffers);
+static struct spliced_buffer *spliced_buffers_tail = NULL;
+
 static void *silence_buffer = NULL;
 static size_t silence_buffer_length = 0;
 
@@ -586,6 +602,66 @@ static void stdin_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_even
         pa_stream_cancel_write(stream);
 }
 
+static void spliced_buffer_free(struct spliced_buffer *s) {
+    if (spliced_buffers_tail == s)
+        spliced_buffers_tail = s->prev;
+
+    PA_LLIST_REMOVE(struct spliced_buffer, spliced_buffers, s);
+    pa_xfree(s->data);
+    pa_xfree(s);
+}
+
+/* Frees the buffers the reader is done with */
+static void reap_spliced_buffers(int fd) {
+    size_t unread;
+
+    if (!spliced_buffers || pa_pipe_unread(fd, &unread) < 0)
+        return;
+
+    while (spliced_buffers && spliced_buffers->end + unread <= stdout_written)
+        spliced_buffer_free(spliced_buffers);
+}
+
+/* Returns true if the data went out, or will with the next try */
+static bool splice_buffer(int fd) {
+    struct spliced_buffer *s;
+    ssize_t r;
+
+    if ((r = pa_vmsplice(fd, (uint8_t*) buffer + buffer_index, buffer_length)) < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return true;
+
+        if (verbose)
+            pa_log(_("vmsplice() failed, writing instead: %s"), strerror(errno));
+
+        use_vmsplice = false;
+        return false;
+    }
+
+    stdout_written += (uint64_t) r;
+    buffer_length -= (size_t) r;
+    buffer_index += (size_t) r;
+
+    /* The pipe references the buffer now, so the next read must not
+     * realloc() it. Hand it over and continue with a copy of the rest. */
+    s = pa_xnew(struct spliced_buffer, 1);
+    PA_LLIST_INIT(struct spliced_buffer, s);
+    s->data = buffer;
+    s->end = stdout_written;
+
+    if (spliced_buffers_tail)
+        PA_LLIST_INSERT_AFTER(struct spliced_buffer, spliced_buffers, spliced_buffers_tail, s);
+    else
+        PA_LLIST_PREPEND(struct spliced_buffer, spliced_buffers, s);
+
+    spliced_buffers_tail = s;
+
+    buffer = buffer_length > 0 ? pa_xmemdup((uint8_t*) s->data + buffer_index, buffer_length) : NULL;
+    buffer_index = 0;
+
+    return true;
+}
+
 /* Some data may be written to STDOUT */
 static void stdout_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
     ssize_t r;
@@ -594,6 +670,8 @@ static void stdout_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_eve
     pa_assert(e);
     pa_assert(stdio_event == e);
 
+    reap_spliced_buffers(fd);
+
     if (!buffer) {
         mainloop_api->io_enable(stdio_event, PA_IO_EVENT_NULL);
         return;
@@ -601,6 +679,9 @@ static void stdout_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_eve
 
     pa_assert(buffer_length);
 
+    if (use_vmsplice && splice_buffer(fd))
+        return;
+
     if ((r = pa_write(fd, (uint8_t*) buffer+buffer_index, buffer_length, userdata)) <= 0) {
         pa_log(_("write() failed: %s"), strerror(errno));
         quit(1);
@@ -610,6 +691,7 @@ static void stdout_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_eve
         return;
     }
 
+    stdout_written += (uint64_t) r;
     buffer_length -= (uint32_t) r;
     buffer_index += (uint32_t) r;
 
@@ -1238,6 +1320,10 @@ quit:
     pa_xfree(buffer);
     pa_xfree(partialframe_buf);
 
+    /* Buffers the pipe still references are left alone, freeing them might
+     * scribble over data the reader hasn't seen yet. We exit anyway. */
+    reap_spliced_buffers(STDOUT_FILENO);
+
     pa_xfree(server);
     pa_xfree(device);
 
@@ -36,10 +36,12 @@
 
 #include <pulse/pulseaudio.h>
 #include <pulse/ext-device-restore.h>
+#include <pulse/json.h>
 
 #include <pulsecore/i18n.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
 #include <pulsecore/log.h>
 #include <pulsecore/sndfile-util.h>
 
@@ -100,6 +102,28 @@ static int actions = 0;
 
 static bool nl = false;
 
+/* With --format=json the list callbacks add to json_encoder instead of
+ * printing. A plain "list" writes one object with an array member per
+ * type, "list TYPE" just the array. json_list_type is the type whose
+ * array is open. Everything is printed once the last reply is in. */
+static enum {
+    FORMAT_TEXT,
+    FORMAT_JSON
+} output_format = FORMAT_TEXT;
+
+static pa_json_encoder *json_encoder = NULL;
+static const char *json_list_type = NULL;
+static bool json_per_type = false;
+
+/* Batch mode: commands are read from batch_file, one per line, and
+ * sent over the same connection. batch_line is the line of the command
+ * parsed last, batch_failed is set once any of them failed. */
+static FILE *batch_file = NULL;
+static uint32_t batch_line = 0;
+static bool batch_failed = false;
+
+#define MAX_BATCH_ARGS 256
+
 static enum {
     NONE,
     EXIT,
@@ -151,11 +175,85 @@ static void drain(void) {
         pa_operation_unref(o);
 }
 
+static void batch_run(pa_context *c);
+
+static void json_begin(bool per_type) {
+    pa_assert(!json_encoder);
+
+    json_encoder = pa_json_encoder_new();
+    json_list_type = NULL;
+    json_per_type = per_type;
+
+    if (per_type)
+        pa_json_encoder_begin_element_object(json_encoder);
+}
+
+/* Called by the list callbacks before their first entry. The replies
+ * of the lists arrive one after the other, so only one array is open. */
+static void json_begin_list(const char *type) {
+    pa_assert(json_encoder);
+
+    if (json_list_type && pa_streq(json_list_type, type))
+        return;
+
+    if (json_list_type)
+        pa_json_encoder_end_array(json_encoder);
+
+    if (json_per_type)
+        pa_json_encoder_begin_member_array(json_encoder, type);
+    else
+        pa_json_encoder_begin_element_array(json_encoder);
+
+    json_list_type = type;
+}
+
+static void json_flush(void) {
+    char *s;
+
+    if (!json_encoder)
+        return;
+
+    /* No reply for a single list if it failed, still print valid JSON */
+    if (!json_list_type && !json_per_type)
+        pa_json_encoder_begin_element_array(json_encoder);
+
+    if (json_list_type || !json_per_type)
+        pa_json_encoder_end_array(json_encoder);
+
+    if (json_per_type)
+        pa_json_encoder_end_object(json_encoder);
+
+    s = pa_json_encoder_to_string_free(json_encoder);
+    json_encoder = NULL;
+    json_list_type = NULL;
+
+    printf("%s\n", s);
+    pa_xfree(s);
+}
+
 static void complete_action(void) {
     pa_assert(actions > 0);
 
-    if (!(--actions))
-        drain();
+    if (!(--actions)) {
+        json_flush();
+
+        if (batch_file)
+            batch_run(context);
+        else
+            drain();
+    }
+}
+
+/* Alone a failed command ends pactl. In batch mode the commands after
+ * it still run, and only the exit status tells about the failure. */
+static void command_failed(void) {
+    if (!batch_file) {
+        quit(1);
+        return;
+    }
+
+    batch_failed = true;
+    complete_action();
 }
 
 static void stat_callback(pa_context *c, const pa_stat_info *i, void *userdata) {
@@ -234,6 +332,335 @@ static const char* get_available_str_ynonly(int available) {
     return "";
 }
 
+static const char *json_available_str(int available) {
+    switch (available) {
+        case PA_PORT_AVAILABLE_YES: return "yes";
+        case PA_PORT_AVAILABLE_NO: return "no";
+    }
+    return "unknown";
+}
+
+static void json_add_index(const char *name, uint32_t idx) {
+    if (idx == PA_INVALID_INDEX)
+        pa_json_encoder_add_member_null(json_encoder, name);
+    else
+        pa_json_encoder_add_member_int(json_encoder, name, idx);
+}
+
+/* Entries that aren't strings are left out */
+static void json_add_proplist(const char *name, pa_proplist *p) {
+    void *state = NULL;
+    const char *key;
+
+    pa_json_encoder_begin_member_object(json_encoder, name);
+
+    while ((key = pa_proplist_iterate(p, &state))) {
+        const char *value;
+
+        if ((value = pa_proplist_gets(p, key)))
+            pa_json_encoder_add_member_string(json_encoder, key, value);
+    }
+
+    pa_json_encoder_end_object(json_encoder);
+}
+
+static void json_add_volume_value(pa_volume_t v, bool db) {
+    pa_json_encoder_add_member_int(json_encoder, "value", v);
+    pa_json_encoder_add_member_double(json_encoder, "value_percent", v * 100.0 / PA_VOLUME_NORM, 0);
+
+    if (db)
+        pa_json_encoder_add_member_double(json_encoder, "db", pa_sw_volume_to_dB(v), 2);
+    else
+        pa_json_encoder_add_member_null(json_encoder, "db");
+}
+
+static void json_add_volume(const char *name, const pa_cvolume *v, const pa_channel_map *map, bool db) {
+    unsigned c;
+
+    pa_json_encoder_begin_member_object(json_encoder, name);
+
+    for (c = 0; c < v->channels; c++) {
+        pa_json_encoder_begin_member_object(json_encoder, pa_channel_position_to_string(map->map[c]));
+        json_add_volume_value(v->values[c], db);
+        pa_json_encoder_end_object(json_encoder);
+    }
+
+    pa_json_encoder_end_object(json_encoder);
+}
+
+static void json_add_sample_spec(const pa_sample_spec *ss, const pa_channel_map *map) {
+    char s[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
+
+    if (pa_sample_spec_valid(ss)) {
+        pa_json_encoder_add_member_string(json_encoder, "sample_specification", pa_sample_spec_snprint(s, sizeof(s), ss));
+        pa_json_encoder_add_member_string(json_encoder, "channel_map", pa_channel_map_snprint(cm, sizeof(cm), map));
+    } else {
+        pa_json_encoder_add_member_null(json_encoder, "sample_specification");
+        pa_json_encoder_add_member_null(json_encoder, "channel_map");
+    }
+}
+
+static void json_add_formats(pa_format_info **formats, uint8_t n_formats) {
+    char f[PA_FORMAT_INFO_SNPRINT_MAX];
+    uint8_t j;
+
+    pa_json_encoder_begin_member_array(json_encoder, "formats");
+    for (j = 0; j < n_formats; j++)
+        pa_json_encoder_add_element_string(json_encoder, pa_format_info_snprint(f, sizeof(f), formats[j]));
+    pa_json_encoder_end_array(json_encoder);
+}
+
+static void json_add_flag(const char *flag, bool set) {
+    if (set)
+        pa_json_encoder_add_element_string(json_encoder, flag);
+}
+
+static void json_add_sink(const pa_sink_info *i) {
+    static const char *state_table[] = {
+        [1+PA_SINK_INVALID_STATE] = "n/a",
+        [1+PA_SINK_RUNNING] = "RUNNING",
+        [1+PA_SINK_IDLE] = "IDLE",
+        [1+PA_SINK_SUSPENDED] = "SUSPENDED"
+    };
+
+    pa_json_encoder_begin_element_object(json_encoder);
+    pa_json_encoder_add_member_int(json_encoder, "index", i->index);
+    pa_json_encoder_add_member_string(json_encoder, "state", state_table[1+i->state]);
+    pa_json_encoder_add_member_string(json_encoder, "name", i->name);
+    pa_json_encoder_add_member_string(json_encoder, "description", i->description);
+    pa_json_encoder_add_member_string(json_encoder, "driver", i->driver);
+    json_add_sample_spec(&i->sample_spec, &i->channel_map);
+    json_add_index("owner_module", i->owner_module);
+    pa_json_encoder_add_member_bool(json_encoder, "mute", i->mute);
+    json_add_volume("volume", &i->volume, &i->channel_map, i->flags & PA_SINK_DECIBEL_VOLUME);
+    pa_json_encoder_add_member_double(json_encoder, "balance", pa_cvolume_get_balance(&i->volume, &i->channel_map), 2);
+    pa_json_encoder_begin_member_object(json_encoder, "base_volume");
+    json_add_volume_value(i->base_volume, i->flags & PA_SINK_DECIBEL_VOLUME);
+    pa_json_encoder_end_object(json_encoder);
+    pa_json_encoder_add_member_string(json_encoder, "monitor_source", i->monitor_source_name);
+    pa_json_encoder_add_member_int(json_encoder, "latency_usec", i->latency);
+    pa_json_encoder_add_member_int(json_encoder, "configured_latency_usec", i->configured_latency);
+
+    pa_json_encoder_begin_member_array(json_encoder, "flags");
+    json_add_flag("HARDWARE", i->flags & PA_SINK_HARDWARE);
+    json_add_flag("NETWORK", i->flags & PA_SINK_NETWORK);
+    json_add_flag("HW_MUTE_CTRL", i->flags & PA_SINK_HW_MUTE_CTRL);
+    json_add_flag("HW_VOLUME_CTRL", i->flags & PA_SINK_HW_VOLUME_CTRL);
+    json_add_flag("DECIBEL_VOLUME", i->flags & PA_SINK_DECIBEL_VOLUME);
+    json_add_flag("LATENCY", i->flags & PA_SINK_LATENCY);
+    json_add_flag("SET_FORMATS", i->flags & PA_SINK_SET_FORMATS);
+    pa_json_encoder_end_array(json_encoder);
+
+    json_add_proplist("properties", i->proplist);
+
+    pa_json_encoder_begin_member_array(json_encoder, "ports");
+    if (i->ports) {
+        pa_sink_port_info **p;
+
+        for (p = i->ports; *p; p++) {
+            pa_json_encoder_begin_element_object(json_encoder);
+            pa_json_encoder_add_member_string(json_encoder, "name", (*p)->name);
+            pa_json_encoder_add_member_string(json_encoder, "description", (*p)->description);
+            pa_json_encoder_add_member_int(json_encoder, "priority", (*p)->priority);
+            pa_json_encoder_add_member_string(json_encoder, "availability", json_available_str((*p)->available));
+            pa_json_encoder_end_object(json_encoder);
+        }
+    }
+    pa_json_encoder_end_array(json_encoder);
+
+    pa_json_encoder_add_member_string(json_encoder, "active_port", i->active_port ? i->active_port->name : NULL);
+    json_add_formats(i->formats, i->n_formats);
+    pa_json_encoder_end_object(json_encoder);
+}
+
+static void json_add_source(const pa_source_info *i) {
+    static const char *state_table[] = {
+        [1+PA_SOURCE_INVALID_STATE] = "n/a",
+        [1+PA_SOURCE_RUNNING] = "RUNNING",
+        [1+PA_SOURCE_IDLE] = "IDLE",
+        [1+PA_SOURCE_SUSPENDED] = "SUSPENDED"
+    };
+
+    pa_json_encoder_begin_element_object(json_encoder);
+    pa_json_encoder_add_member_int(json_encoder, "index", i->index);
+    pa_json_encoder_add_member_string(json_encoder, "state", state_table[1+i->state]);
+    pa_json_encoder_add_member_string(json_encoder, "name", i->name);
+    pa_json_encoder_add_member_string(json_encoder, "description", i->description);
+    pa_json_encoder_add_member_string(json_encoder, "driver", i->driver);
+    json_add_sample_spec(&i->sample_spec, &i->channel_map);
+    json_add_index("owner_module", i->owner_module);
+    pa_json_encoder_add_member_bool(json_encoder, "mute", i->mute);
+    json_add_volume("volume", &i->volume, &i->channel_map, i->flags & PA_SOURCE_DECIBEL_VOLUME);
+    pa_json_encoder_add_member_double(json_encoder, "balance", pa_cvolume_get_balance(&i->volume, &i->channel_map), 2);
+    pa_json_encoder_begin_member_object(json_encoder, "base_volume");
+    json_add_volume_value(i->base_volume, i->flags & PA_SOURCE_DECIBEL_VOLUME);
+    pa_json_encoder_end_object(json_encoder);
+    pa_json_encoder_add_member_string(json_encoder, "monitor_of_sink", i->monitor_of_sink_name);
+    pa_json_encoder_add_member_int(json_encoder, "latency_usec", i->latency);
+    pa_json_encoder_add_member_int(json_encoder, "configured_latency_usec", i->configured_latency);
+
+    pa_json_encoder_begin_member_array(json_encoder, "flags");
+    json_add_flag("HARDWARE", i->flags & PA_SOURCE_HARDWARE);
+    json_add_flag("NETWORK", i->flags & PA_SOURCE_NETWORK);
+    json_add_flag("HW_MUTE_CTRL", i->flags & PA_SOURCE_HW_MUTE_CTRL);
+    json_add_flag("HW_VOLUME_CTRL", i->flags & PA_SOURCE_HW_VOLUME_CTRL);
+    json_add_flag("DECIBEL_VOLUME", i->flags & PA_SOURCE_DECIBEL_VOLUME);
+    json_add_flag("LATENCY", i->flags & PA_SOURCE_LATENCY);
+    pa_json_encoder_end_array(json_encoder);
+
+    json_add_proplist("properties", i->proplist);
+
+    pa_json_encoder_begin_member_array(json_encoder, "ports");
+    if (i->ports) {
+        pa_source_port_info **p;
+
+        for (p = i->ports; *p; p++) {
+            pa_json_encoder_begin_element_object(json_encoder);
+            pa_json_encoder_add_member_string(json_encoder, "name", (*p)->name);
+            pa_json_encoder_add_member_string(json_encoder, "description", (*p)->description);
+            pa_json_encoder_add_member_int(json_encoder, "priority", (*p)->priority);
+            pa_json_encoder_add_member_string(json_encoder, "availability", json_available_str((*p)->available));
+            pa_json_encoder_end_object(json_encoder);
+        }
+    }
+    pa_json_encoder_end_array(json_encoder);
+
+    pa_json_encoder_add_member_string(json_encoder, "active_port", i->active_port ? i->active_port->name : NULL);
+    json_add_formats(i->formats, i->n_formats);
+    pa_json_encoder_end_object(json_encoder);
+}
+
+static void json_add_module(const pa_module_info *i) {
+    pa_json_encoder_begin_element_object(json_encoder);
+    pa_json_encoder_add_member_int(json_encoder, "index", i->index);
+    pa_json_encoder_add_member_string(json_encoder, "name", i->name);
+    pa_json_encoder_add_member_string(json_encoder, "argument", i->argument);
+    json_add_index("usage_counter", i->n_used);
+    json_add_proplist("properties", i->proplist);
+    pa_json_encoder_end_object(json_encoder);
+}
+
+static void json_add_client(const pa_client_info *i) {
+    pa_json_encoder_begin_element_object(json_encoder);
+    pa_json_encoder_add_member_int(json_encoder, "index", i->index);
+    pa_json_encoder_add_member_string(json_encoder, "driver", i->driver);
+    json_add_index("owner_module", i->owner_module);
+    pa_json_encoder_add_member_int(json_encoder, "render_usec", i->render_usec);
+    pa_json_encoder_add_member_int(json_encoder, "memory", i->memory);
+    json_add_proplist("properties", i->proplist);
+    pa_json_encoder_end_object(json_encoder);
+}
+
+static void json_add_card(const pa_card_info *i) {
+    pa_json_encoder_begin_element_object(json_encoder);
+    pa_json_encoder_add_member_int(json_encoder, "index", i->index);
+    pa_json_encoder_add_member_string(json_encoder, "name", i->name);
+    pa_json_encoder_add_member_string(json_encoder, "driver", i->driver);
+    json_add_index("owner_module", i->owner_module);
+    json_add_proplist("properties", i->proplist);
+
+    pa_json_encoder_begin_member_array(json_encoder, "profiles");
+    if (i->n_profiles > 0) {
+        pa_card_profile_info2 **p;
+
+        for (p = i->profiles2; *p; p++) {
+            pa_json_encoder_begin_element_object(json_encoder);
+            pa_json_encoder_add_member_string(json_encoder, "name", (*p)->name);
+            pa_json_encoder_add_member_string(json_encoder, "description", (*p)->description);
+            pa_json_encoder_add_member_int(json_encoder, "sinks", (*p)->n_sinks);
+            pa_json_encoder_add_member_int(json_encoder, "sources", (*p)->n_sources);
+            pa_json_encoder_add_member_int(json_encoder, "priority", (*p)->priority);
+            pa_json_encoder_add_member_bool(json_encoder, "available", (*p)->available);
+            pa_json_encoder_end_object(json_encoder);
+        }
+    }
+    pa_json_encoder_end_array(json_encoder);
+
+    pa_json_encoder_add_member_string(json_encoder, "active_profile", i->active_profile ? i->active_profile->name : NULL);
+
+    pa_json_encoder_begin_member_array(json_encoder, "ports");
+    if (i->ports) {
+        pa_card_port_info **p;
+
+        for (p = i->ports; *p; p++) {
+            pa_card_profile_info **pr;
+
+            pa_json_encoder_begin_element_object(json_encoder);
+            pa_json_encoder_add_member_string(json_encoder, "name", (*p)->name);
+            pa_json_encoder_add_member_string(json_encoder, "description", (*p)->description);
+            pa_json_encoder_add_member_int(json_encoder, "priority", (*p)->priority);
+            pa_json_encoder_add_member_int(json_encoder, "latency_offset_usec", (*p)->latency_offset);
+            pa_json_encoder_add_member_string(json_encoder, "availability", json_available_str((*p)->available));
+            json_add_proplist("properties", (*p)->proplist);
+
+            pa_json_encoder_begin_member_array(json_encoder, "profiles");
+            for (pr = (*p)->profiles; pr && *pr; pr++)
+                pa_json_encoder_add_element_string(json_encoder, (*pr)->name);
+            pa_json_encoder_end_array(json_encoder);
+
+            pa_json_encoder_end_object(json_encoder);
+        }
+    }
+    pa_json_encoder_end_array(json_encoder);
+
+    pa_json_encoder_end_object(json_encoder);
+}
+
+static void json_add_stream(uint32_t index, const char *driver, uint32_t owner_module, uint32_t client,
+                            const pa_sample_spec *ss, const pa_channel_map *map, const pa_format_info *format,
+                            bool corked, bool mute, const pa_cvolume *volume,
+                            pa_usec_t buffer_usec, const char *resample_method) {
+    char f[PA_FORMAT_INFO_SNPRINT_MAX];
+
+    pa_json_encoder_add_member_int(json_encoder, "index", index);
+    pa_json_encoder_add_member_string(json_encoder, "driver", driver);
+    json_add_index("owner_module", owner_module);
+    json_add_index("client", client);
+    json_add_sample_spec(ss, map);
+    pa_json_encoder_add_member_string(json_encoder, "format", pa_format_info_snprint(f, sizeof(f), format));
+    pa_json_encoder_add_member_bool(json_encoder, "corked", corked);
+    pa_json_encoder_add_member_bool(json_encoder, "mute", mute);
+    json_add_volume("volume", volume, map, true);
+    pa_json_encoder_add_member_double(json_encoder, "balance", pa_cvolume_get_balance(volume, map), 2);
+    pa_json_encoder_add_member_int(json_encoder, "buffer_latency_usec", buffer_usec);
+    pa_json_encoder_add_member_string(json_encoder, "resample_method", resample_method);
+}
+
+static void json_add_sink_input(const pa_sink_input_info *i) {
+    pa_json_encoder_begin_element_object(json_encoder);
+    json_add_stream(i->index, i->driver, i->owner_module, i->client, &i->sample_spec, &i->channel_map, i->format,
+                    i->corked, i->mute, &i->volume, i->buffer_usec, i->resample_method);
+    pa_json_encoder_add_member_int(json_encoder, "sink", i->sink);
+    pa_json_encoder_add_member_int(json_encoder, "sink_latency_usec", i->sink_usec);
+    json_add_proplist("properties", i->proplist);
+    pa_json_encoder_end_object(json_encoder);
+}
+
+static void json_add_source_output(const pa_source_output_info *i) {
+    pa_json_encoder_begin_element_object(json_encoder);
+    json_add_stream(i->index, i->driver, i->owner_module, i->client, &i->sample_spec, &i->channel_map, i->format,
+                    i->corked, i->mute, &i->volume, i->buffer_usec, i->resample_method);
+    pa_json_encoder_add_member_int(json_encoder, "source", i->source);
+    pa_json_encoder_add_member_int(json_encoder, "source_latency_usec", i->source_usec);
+    json_add_proplist("properties", i->proplist);
+    pa_json_encoder_end_object(json_encoder);
+}
+
+static void json_add_sample(const pa_sample_info *i) {
+    pa_json_encoder_begin_element_object(json_encoder);
+    pa_json_encoder_add_member_int(json_encoder, "index", i->index);
+    pa_json_encoder_add_member_string(json_encoder, "name", i->name);
+    json_add_sample_spec(&i->sample_spec, &i->channel_map);
+    json_add_volume("volume", &i->volume, &i->channel_map, true);
+    pa_json_encoder_add_member_double(json_encoder, "balance", pa_cvolume_get_balance(&i->volume, &i->channel_map), 2);
+    pa_json_encoder_add_member_int(json_encoder, "duration_usec", i->duration);
+    pa_json_encoder_add_member_int(json_encoder, "bytes", i->bytes);
+    pa_json_encoder_add_member_bool(json_encoder, "lazy", i->lazy);
+    pa_json_encoder_add_member_string(json_encoder, "filename", i->filename);
+    json_add_proplist("properties", i->proplist);
+    pa_json_encoder_end_object(json_encoder);
+}
+
 static void get_sink_info_callback(pa_context *c, const pa_sink_info *i, int is_last, void *userdata) {
 
     static const char *state_table[] = {
@@ -257,6 +684,9 @@ static void get_sink_info_callback(pa_context *c, const pa_sink_info *i, int is_
         return;
     }
 
+    if (json_encoder)
+        json_begin_list("sinks");
+
     if (is_last) {
         complete_action();
         return;
@@ -264,6 +694,11 @@ static void get_sink_info_callback(pa_context *c, const pa_sink_info *i, int is_
 
     pa_assert(i);
 
+    if (json_encoder) {
+        json_add_sink(i);
+        return;
+    }
+
     if (nl && !short_list_format)
         printf("\n");
     nl = true;
@@ -364,6 +799,9 @@ static void get_source_info_callback(pa_context *c, const pa_source_info *i, int
         return;
     }
 
+    if (json_encoder)
+        json_begin_list("sources");
+
     if (is_last) {
         complete_action();
         return;
@@ -371,6 +809,11 @@ static void get_source_info_callback(pa_context *c, const pa_source_info *i, int
 
     pa_assert(i);
 
+    if (json_encoder) {
+        json_add_source(i);
+        return;
+    }
+
     if (nl && !short_list_format)
         printf("\n");
     nl = true;
@@ -457,6 +900,9 @@ static void get_module_info_callback(pa_context *c, const pa_module_info *i, int
         return;
     }
 
+    if (json_encoder)
+        json_begin_list("modules");
+
     if (is_last) {
         complete_action();
         return;
@@ -464,6 +910,11 @@ static void get_module_info_callback(pa_context *c, const pa_module_info *i, int
 
     pa_assert(i);
 
+    if (json_encoder) {
+        json_add_module(i);
+        return;
+    }
+
     if (nl && !short_list_format)
         printf("\n");
     nl = true;
@@ -490,7 +941,7 @@ static void get_module_info_callback(pa_context *c, const pa_module_info *i, int
 }
 
 static void get_client_info_callback(pa_context *c, const pa_client_info *i, int is_last, void *userdata) {
-    char t[32];
+    char t[32], m[PA_BYTES_SNPRINT_MAX];
     char *pl;
 
     if (is_last < 0) {
@@ -499,6 +950,9 @@ static void get_client_info_callback(pa_context *c, const pa_client_info *i, int
         return;
     }
 
+    if (json_encoder)
+        json_begin_list("clients");
+
     if (is_last) {
         complete_action();
         return;
@@ -506,6 +960,11 @@ static void get_client_info_callback(pa_context *c, const pa_client_info *i, int
 
     pa_assert(i);
 
+    if (json_encoder) {
+        json_add_client(i);
+        return;
+    }
+
     if (nl && !short_list_format)
         printf("\n");
     nl = true;
@@ -523,10 +982,14 @@ static void get_client_info_callback(pa_context *c, const pa_client_info *i, int
     printf(_("Client #%u\n"
              "\tDriver: %s\n"
              "\tOwner Module: %s\n"
+             "\tRender Time: %0.1f ms\n"
+             "\tMemory: %s\n"
              "\tProperties:\n\t\t%s\n"),
            i->index,
            pa_strnull(i->driver),
            i->owner_module != PA_INVALID_INDEX ? t : _("n/a"),
+           (double) i->render_usec / PA_USEC_PER_MSEC,
+           pa_bytes_snprint(m, sizeof(m), (unsigned) i->memory),
            pl = pa_proplist_to_string_sep(i->proplist, "\n\t\t"));
 
     pa_xfree(pl);
@@ -542,6 +1005,9 @@ static void get_card_info_callback(pa_context *c, const pa_card_info *i, int is_
         return;
     }
 
+    if (json_encoder)
+        json_begin_list("cards");
+
     if (is_last) {
         complete_action();
         return;
@@ -549,6 +1015,11 @@ static void get_card_info_callback(pa_context *c, const pa_card_info *i, int is_
 
     pa_assert(i);
 
+    if (json_encoder) {
+        json_add_card(i);
+        return;
+    }
+
     if (nl && !short_list_format)
         printf("\n");
     nl = true;
@@ -624,6 +1095,9 @@ static void get_sink_input_info_callback(pa_context *c, const pa_sink_input_info
         return;
     }
 
+    if (json_encoder)
+        json_begin_list("sink-inputs");
+
     if (is_last) {
         complete_action();
         return;
@@ -631,6 +1105,11 @@ static void get_sink_input_info_callback(pa_context *c, const pa_sink_input_info
 
     pa_assert(i);
 
+    if (json_encoder) {
+        json_add_sink_input(i);
+        return;
+    }
+
     if (nl && !short_list_format)
         printf("\n");
     nl = true;
@@ -694,6 +1173,9 @@ static void get_source_output_info_callback(pa_context *c, const pa_source_outpu
         return;
     }
 
+    if (json_encoder)
+        json_begin_list("source-outputs");
+
     if (is_last) {
         complete_action();
         return;
@@ -701,6 +1183,11 @@ static void get_source_output_info_callback(pa_context *c, const pa_source_outpu
 
     pa_assert(i);
 
+    if (json_encoder) {
+        json_add_source_output(i);
+        return;
+    }
+
     if (nl && !short_list_format)
         printf("\n");
     nl = true;
@@ -764,6 +1251,9 @@ static void get_sample_info_callback(pa_context *c, const pa_sample_info *i, int
         return;
     }
 
+    if (json_encoder)
+        json_begin_list("samples");
+
     if (is_last) {
         complete_action();
         return;
@@ -771,6 +1261,11 @@ static void get_sample_info_callback(pa_context *c, const pa_sample_info *i, int
 
     pa_assert(i);
 
+    if (json_encoder) {
+        json_add_sample(i);
+        return;
+    }
+
     if (nl && !short_list_format)
         printf("\n");
     nl = true;
@@ -812,10 +1307,20 @@ static void get_sample_info_callback(pa_context *c, const pa_sample_info *i, int
     pa_xfree(pl);
 }
 
+/* userdata of these callbacks is the batch line of the command, or 0 */
+static void log_failure(pa_context *c, void *userdata) {
+    uint32_t line = PA_PTR_TO_UINT32(userdata);
+
+    if (line > 0)
+        pa_log(_("Line %u: Failure: %s"), line, pa_strerror(pa_context_errno(c)));
+    else
+        pa_log(_("Failure: %s"), pa_strerror(pa_context_errno(c)));
+}
+
 static void simple_callback(pa_context *c, int success, void *userdata) {
     if (!success) {
-        pa_log(_("Failure: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        log_failure(c, userdata);
+        command_failed();
         return;
     }
 
@@ -824,8 +1329,8 @@ static void simple_callback(pa_context *c, int success, void *userdata) {
 
 static void index_callback(pa_context *c, uint32_t idx, void *userdata) {
     if (idx == PA_INVALID_INDEX) {
-        pa_log(_("Failure: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        log_failure(c, userdata);
+        command_failed();
         return;
     }
 
@@ -834,22 +1339,42 @@ static void index_callback(pa_context *c, uint32_t idx, void *userdata) {
     complete_action();
 }
 
-static void volume_relative_adjust(pa_cvolume *cv) {
-    pa_assert(volume_flags & VOL_RELATIVE);
+/* The parsed volume of a set-*-volume command. It's needed once the
+ * current volume arrives, and batch mode may have parsed other
+ * commands by then. */
+struct volume_change {
+    pa_cvolume volume;
+    enum volume_flags flags;
+    uint32_t line;
+};
+
+static struct volume_change *volume_change_new(void) {
+    struct volume_change *v;
+
+    v = pa_xnew(struct volume_change, 1);
+    v->volume = volume;
+    v->flags = volume_flags;
+    v->line = batch_line;
+
+    return v;
+}
+
+static void volume_relative_adjust(struct volume_change *v, pa_cvolume *cv) {
+    pa_assert(v->flags & VOL_RELATIVE);
 
     /* Relative volume change is additive in case of UINT or PERCENT
      * and multiplicative for LINEAR or DECIBEL */
-    if ((volume_flags & 0x0F) == VOL_UINT || (volume_flags & 0x0F) == VOL_PERCENT) {
+    if ((v->flags & 0x0F) == VOL_UINT || (v->flags & 0x0F) == VOL_PERCENT) {
         unsigned i;
         for (i = 0; i < cv->channels; i++) {
-            if (cv->values[i] + volume.values[i] < PA_VOLUME_NORM)
+            if (cv->values[i] + v->volume.values[i] < PA_VOLUME_NORM)
                 cv->values[i] = PA_VOLUME_MUTED;
             else
-                cv->values[i] = cv->values[i] + volume.values[i] - PA_VOLUME_NORM;
+                cv->values[i] = cv->values[i] + v->volume.values[i] - PA_VOLUME_NORM;
         }
     }
-    if ((volume_flags & 0x0F) == VOL_LINEAR || (volume_flags & 0x0F) == VOL_DECIBEL)
-        pa_sw_cvolume_multiply(cv, cv, &volume);
+    if ((v->flags & 0x0F) == VOL_LINEAR || (v->flags & 0x0F) == VOL_DECIBEL)
+        pa_sw_cvolume_multiply(cv, cv, &v->volume);
 }
 
 static void unload_module_by_name_callback(pa_context *c, const pa_module_info *i, int is_last, void *userdata) {
@@ -857,13 +1382,14 @@ static void unload_module_by_name_callback(pa_context *c, const pa_module_info *
 
     if (is_last < 0) {
         pa_log(_("Failed to get module information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        command_failed();
         return;
     }
 
     if (is_last) {
         if (unloaded == false)
             pa_log(_("Failed to unload module: Module %s not loaded"), module_name);
+        unloaded = false;
         complete_action();
         return;
     }
@@ -873,110 +1399,139 @@ static void unload_module_by_name_callback(pa_context *c, const pa_module_info *
     if (pa_streq(module_name, i->name)) {
         unloaded = true;
         actions++;
-        pa_operation_unref(pa_context_unload_module(c, i->index, simple_callback, NULL));
+        pa_operation_unref(pa_context_unload_module(c, i->index, simple_callback, userdata));
     }
 }
 
-static void fill_volume(pa_cvolume *cv, unsigned supported) {
-    if (volume.channels == 1) {
-        pa_cvolume_set(&volume, supported, volume.values[0]);
-    } else if (volume.channels != supported) {
+static int fill_volume(struct volume_change *v, pa_cvolume *cv, unsigned supported) {
+    if (v->volume.channels == 1) {
+        pa_cvolume_set(&v->volume, supported, v->volume.values[0]);
+    } else if (v->volume.channels != supported) {
         pa_log(_("Failed to set volume: You tried to set volumes for %d channels, whereas channel/s supported = %d\n"),
-            volume.channels, supported);
-        quit(1);
-        return;
+            v->volume.channels, supported);
+        return -1;
     }
 
-    if (volume_flags & VOL_RELATIVE)
-        volume_relative_adjust(cv);
+    if (v->flags & VOL_RELATIVE)
+        volume_relative_adjust(v, cv);
     else
-        *cv = volume;
+        *cv = v->volume;
+
+    return 0;
 }
 
 static void get_sink_volume_callback(pa_context *c, const pa_sink_info *i, int is_last, void *userdata) {
+    struct volume_change *v = userdata;
     pa_cvolume cv;
 
     if (is_last < 0) {
         pa_log(_("Failed to get sink information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        pa_xfree(v);
+        command_failed();
         return;
     }
 
-    if (is_last)
+    if (is_last) {
+        pa_xfree(v);
         return;
+    }
 
     pa_assert(i);
 
     cv = i->volume;
-    fill_volume(&cv, i->channel_map.channels);
+    if (fill_volume(v, &cv, i->channel_map.channels) < 0) {
+        command_failed();
+        return;
+    }
 
-    pa_operation_unref(pa_context_set_sink_volume_by_name(c, sink_name, &cv, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_sink_volume_by_name(c, i->name, &cv, simple_callback, PA_UINT32_TO_PTR(v->line)));
 }
 
 static void get_source_volume_callback(pa_context *c, const pa_source_info *i, int is_last, void *userdata) {
+    struct volume_change *v = userdata;
     pa_cvolume cv;
 
     if (is_last < 0) {
         pa_log(_("Failed to get source information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        pa_xfree(v);
+        command_failed();
         return;
     }
 
-    if (is_last)
+    if (is_last) {
+        pa_xfree(v);
         return;
+    }
 
     pa_assert(i);
 
     cv = i->volume;
-    fill_volume(&cv, i->channel_map.channels);
+    if (fill_volume(v, &cv, i->channel_map.channels) < 0) {
+        command_failed();
+        return;
+    }
 
-    pa_operation_unref(pa_context_set_source_volume_by_name(c, source_name, &cv, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_source_volume_by_name(c, i->name, &cv, simple_callback, PA_UINT32_TO_PTR(v->line)));
 }
 
 static void get_sink_input_volume_callback(pa_context *c, const pa_sink_input_info *i, int is_last, void *userdata) {
+    struct volume_change *v = userdata;
     pa_cvolume cv;
 
     if (is_last < 0) {
         pa_log(_("Failed to get sink input information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        pa_xfree(v);
+        command_failed();
         return;
     }
 
-    if (is_last)
+    if (is_last) {
+        pa_xfree(v);
         return;
+    }
 
     pa_assert(i);
 
     cv = i->volume;
-    fill_volume(&cv, i->channel_map.channels);
+    if (fill_volume(v, &cv, i->channel_map.channels) < 0) {
+        command_failed();
+        return;
+    }
 
-    pa_operation_unref(pa_context_set_sink_input_volume(c, sink_input_idx, &cv, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_sink_input_volume(c, i->index, &cv, simple_callback, PA_UINT32_TO_PTR(v->line)));
 }
 
 static void get_source_output_volume_callback(pa_context *c, const pa_source_output_info *o, int is_last, void *userdata) {
+    struct volume_change *v = userdata;
     pa_cvolume cv;
 
     if (is_last < 0) {
         pa_log(_("Failed to get source output information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        pa_xfree(v);
+        command_failed();
         return;
     }
 
-    if (is_last)
+    if (is_last) {
+        pa_xfree(v);
         return;
+    }
 
     pa_assert(o);
 
     cv = o->volume;
-    fill_volume(&cv, o->channel_map.channels);
+    if (fill_volume(v, &cv, o->channel_map.channels) < 0) {
+        command_failed();
+        return;
+    }
 
-    pa_operation_unref(pa_context_set_source_output_volume(c, source_output_idx, &cv, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_source_output_volume(c, o->index, &cv, simple_callback, PA_UINT32_TO_PTR(v->line)));
 }
 
 static void sink_toggle_mute_callback(pa_context *c, const pa_sink_info *i, int is_last, void *userdata) {
     if (is_last < 0) {
         pa_log(_("Failed to get sink information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        command_failed();
         return;
     }
 
@@ -985,13 +1540,13 @@ static void sink_toggle_mute_callback(pa_context *c, const pa_sink_info *i, int
 
     pa_assert(i);
 
-    pa_operation_unref(pa_context_set_sink_mute_by_name(c, i->name, !i->mute, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_sink_mute_by_name(c, i->name, !i->mute, simple_callback, userdata));
 }
 
 static void source_toggle_mute_callback(pa_context *c, const pa_source_info *o, int is_last, void *userdata) {
     if (is_last < 0) {
         pa_log(_("Failed to get source information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        command_failed();
         return;
     }
 
@@ -1000,13 +1555,13 @@ static void source_toggle_mute_callback(pa_context *c, const pa_source_info *o,
 
     pa_assert(o);
 
-    pa_operation_unref(pa_context_set_source_mute_by_name(c, o->name, !o->mute, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_source_mute_by_name(c, o->name, !o->mute, simple_callback, userdata));
 }
 
 static void sink_input_toggle_mute_callback(pa_context *c, const pa_sink_input_info *i, int is_last, void *userdata) {
     if (is_last < 0) {
         pa_log(_("Failed to get sink input information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        command_failed();
         return;
     }
 
@@ -1015,13 +1570,13 @@ static void sink_input_toggle_mute_callback(pa_context *c, const pa_sink_input_i
 
     pa_assert(i);
 
-    pa_operation_unref(pa_context_set_sink_input_mute(c, i->index, !i->mute, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_sink_input_mute(c, i->index, !i->mute, simple_callback, userdata));
 }
 
 static void source_output_toggle_mute_callback(pa_context *c, const pa_source_output_info *o, int is_last, void *userdata) {
     if (is_last < 0) {
         pa_log(_("Failed to get source output information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        command_failed();
         return;
     }
 
@@ -1030,7 +1585,7 @@ static void source_output_toggle_mute_callback(pa_context *c, const pa_source_ou
 
     pa_assert(o);
 
-    pa_operation_unref(pa_context_set_source_output_mute(c, o->index, !o->mute, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_source_output_mute(c, o->index, !o->mute, simple_callback, userdata));
 }
 
 /* PA_MAX_FORMATS is defined in internal.h so we just define a sane value here */
@@ -1055,7 +1610,7 @@ static void set_sink_formats(pa_context *c, uint32_t sink, const char *str) {
         pa_xfree(format);
     }
 
-    o = pa_ext_device_restore_save_formats(c, PA_DEVICE_TYPE_SINK, sink, i, f_arr, simple_callback, NULL);
+    o = pa_ext_device_restore_save_formats(c, PA_DEVICE_TYPE_SINK, sink, i, f_arr, simple_callback, PA_UINT32_TO_PTR(batch_line));
     if (o) {
         pa_operation_unref(o);
         actions++;
@@ -1085,7 +1640,7 @@ static void stream_state_callback(pa_stream *s, void *userdata) {
             break;
 
         case PA_STREAM_TERMINATED:
-            drain();
+            complete_action();
             break;
 
         case PA_STREAM_FAILED:
@@ -1169,6 +1724,9 @@ static const char *subscription_event_facility_to_string(pa_subscription_event_t
 
     case PA_SUBSCRIPTION_EVENT_CARD:
         return _("card");
+
+    case PA_SUBSCRIPTION_EVENT_XRUN:
+        return _("xrun");
     }
 
     return _("unknown");
@@ -1184,281 +1742,294 @@ static void context_subscribe_callback(pa_context *c, pa_subscription_event_type
     fflush(stdout);
 }
 
-static void context_state_callback(pa_context *c, void *userdata) {
+/* Starts the operations of the parsed command */
+static void run_action(pa_context *c) {
     pa_operation *o = NULL;
 
-    pa_assert(c);
+    switch (action) {
+        case STAT:
+            o = pa_context_stat(c, stat_callback, NULL);
+            break;
 
-    switch (pa_context_get_state(c)) {
-        case PA_CONTEXT_CONNECTING:
-        case PA_CONTEXT_AUTHORIZING:
-        case PA_CONTEXT_SETTING_NAME:
+        case INFO:
+            o = pa_context_get_server_info(c, get_server_info_callback, NULL);
             break;
 
-        case PA_CONTEXT_READY:
-            switch (action) {
-                case STAT:
-                    o = pa_context_stat(c, stat_callback, NULL);
-                    break;
-
-                case INFO:
-                    o = pa_context_get_server_info(c, get_server_info_callback, NULL);
-                    break;
-
-                case PLAY_SAMPLE:
-                    o = pa_context_play_sample(c, sample_name, sink_name, PA_VOLUME_NORM, simple_callback, NULL);
-                    break;
-
-                case REMOVE_SAMPLE:
-                    o = pa_context_remove_sample(c, sample_name, simple_callback, NULL);
-                    break;
-
-                case UPLOAD_SAMPLE:
-                    sample_stream = pa_stream_new(c, sample_name, &sample_spec, NULL);
-                    pa_assert(sample_stream);
-
-                    pa_stream_set_state_callback(sample_stream, stream_state_callback, NULL);
-                    pa_stream_set_write_callback(sample_stream, stream_write_callback, NULL);
-                    pa_stream_connect_upload(sample_stream, sample_length);
-                    actions++;
-                    break;
-
-                case EXIT:
-                    o = pa_context_exit_daemon(c, simple_callback, NULL);
-                    break;
-
-                case LIST:
-                    if (list_type) {
-                        if (pa_streq(list_type, "modules"))
-                            o = pa_context_get_module_info_list(c, get_module_info_callback, NULL);
-                        else if (pa_streq(list_type, "sinks"))
-                            o = pa_context_get_sink_info_list(c, get_sink_info_callback, NULL);
-                        else if (pa_streq(list_type, "sources"))
-                            o = pa_context_get_source_info_list(c, get_source_info_callback, NULL);
-                        else if (pa_streq(list_type, "sink-inputs"))
-                            o = pa_context_get_sink_input_info_list(c, get_sink_input_info_callback, NULL);
-                        else if (pa_streq(list_type, "source-outputs"))
-                            o = pa_context_get_source_output_info_list(c, get_source_output_info_callback, NULL);
-                        else if (pa_streq(list_type, "clients"))
-                            o = pa_context_get_client_info_list(c, get_client_info_callback, NULL);
-                        else if (pa_streq(list_type, "samples"))
-                            o = pa_context_get_sample_info_list(c, get_sample_info_callback, NULL);
-                        else if (pa_streq(list_type, "cards"))
-                            o = pa_context_get_card_info_list(c, get_card_info_callback, NULL);
-                        else
-                            pa_assert_not_reached();
-                    } else {
-                        o = pa_context_get_module_info_list(c, get_module_info_callback, NULL);
-                        if (o) {
-                            pa_operation_unref(o);
-                            actions++;
-                        }
-
-                        o = pa_context_get_sink_info_list(c, get_sink_info_callback, NULL);
-                        if (o) {
-                            pa_operation_unref(o);
-                            actions++;
-                        }
-
-                        o = pa_context_get_source_info_list(c, get_source_info_callback, NULL);
-                        if (o) {
-                            pa_operation_unref(o);
-                            actions++;
-                        }
-                        o = pa_context_get_sink_input_info_list(c, get_sink_input_info_callback, NULL);
-                        if (o) {
-                            pa_operation_unref(o);
-                            actions++;
-                        }
-
-                        o = pa_context_get_source_output_info_list(c, get_source_output_info_callback, NULL);
-                        if (o) {
-                            pa_operation_unref(o);
-                            actions++;
-                        }
-
-                        o = pa_context_get_client_info_list(c, get_client_info_callback, NULL);
-                        if (o) {
-                            pa_operation_unref(o);
-                            actions++;
-                        }
-
-                        o = pa_context_get_sample_info_list(c, get_sample_info_callback, NULL);
-                        if (o) {
-                            pa_operation_unref(o);
-                            actions++;
-                        }
-
-                        o = pa_context_get_card_info_list(c, get_card_info_callback, NULL);
-                        if (o) {
-                            pa_operation_unref(o);
-                            actions++;
-                        }
-
-                        o = NULL;
-                    }
-                    break;
-
-                case MOVE_SINK_INPUT:
-                    o = pa_context_move_sink_input_by_name(c, sink_input_idx, sink_name, simple_callback, NULL);
-                    break;
-
-                case MOVE_SOURCE_OUTPUT:
-                    o = pa_context_move_source_output_by_name(c, source_output_idx, source_name, simple_callback, NULL);
-                    break;
-
-                case LOAD_MODULE:
-                    o = pa_context_load_module(c, module_name, module_args, index_callback, NULL);
-                    break;
-
-                case UNLOAD_MODULE:
-                    if (module_name)
-                        o = pa_context_get_module_info_list(c, unload_module_by_name_callback, NULL);
-                    else
-                        o = pa_context_unload_module(c, module_index, simple_callback, NULL);
-                    break;
-
-                case SUSPEND_SINK:
-                    if (sink_name)
-                        o = pa_context_suspend_sink_by_name(c, sink_name, suspend, simple_callback, NULL);
-                    else
-                        o = pa_context_suspend_sink_by_index(c, PA_INVALID_INDEX, suspend, simple_callback, NULL);
-                    break;
-
-                case SUSPEND_SOURCE:
-                    if (source_name)
-                        o = pa_context_suspend_source_by_name(c, source_name, suspend, simple_callback, NULL);
-                    else
-                        o = pa_context_suspend_source_by_index(c, PA_INVALID_INDEX, suspend, simple_callback, NULL);
-                    break;
-
-                case SET_CARD_PROFILE:
-                    o = pa_context_set_card_profile_by_name(c, card_name, profile_name, simple_callback, NULL);
-                    break;
-
-                case SET_SINK_PORT:
-                    o = pa_context_set_sink_port_by_name(c, sink_name, port_name, simple_callback, NULL);
-                    break;
-
-                case SET_DEFAULT_SINK:
-                    o = pa_context_set_default_sink(c, sink_name, simple_callback, NULL);
-                    break;
-
-                case SET_SOURCE_PORT:
-                    o = pa_context_set_source_port_by_name(c, source_name, port_name, simple_callback, NULL);
-                    break;
-
-                case SET_DEFAULT_SOURCE:
-                    o = pa_context_set_default_source(c, source_name, simple_callback, NULL);
-                    break;
-
-                case SET_SINK_MUTE:
-                    if (mute == TOGGLE_MUTE)
-                        o = pa_context_get_sink_info_by_name(c, sink_name, sink_toggle_mute_callback, NULL);
-                    else
-                        o = pa_context_set_sink_mute_by_name(c, sink_name, mute, simple_callback, NULL);
-                    break;
-
-                case SET_SOURCE_MUTE:
-                    if (mute == TOGGLE_MUTE)
-                        o = pa_context_get_source_info_by_name(c, source_name, source_toggle_mute_callback, NULL);
-                    else
-                        o = pa_context_set_source_mute_by_name(c, source_name, mute, simple_callback, NULL);
-                    break;
-
-                case SET_SINK_INPUT_MUTE:
-                    if (mute == TOGGLE_MUTE)
-                        o = pa_context_get_sink_input_info(c, sink_input_idx, sink_input_toggle_mute_callback, NULL);
-                    else
-                        o = pa_context_set_sink_input_mute(c, sink_input_idx, mute, simple_callback, NULL);
-                    break;
-
-                case SET_SOURCE_OUTPUT_MUTE:
-                    if (mute == TOGGLE_MUTE)
-                        o = pa_context_get_source_output_info(c, source_output_idx, source_output_toggle_mute_callback, NULL);
-                    else
-                        o = pa_context_set_source_output_mute(c, source_output_idx, mute, simple_callback, NULL);
-                    break;
-
-                case SET_SINK_VOLUME:
-                    o = pa_context_get_sink_info_by_name(c, sink_name, get_sink_volume_callback, NULL);
-                    break;
-
-                case SET_SOURCE_VOLUME:
-                    o = pa_context_get_source_info_by_name(c, source_name, get_source_volume_callback, NULL);
-                    break;
-
-                case SET_SINK_INPUT_VOLUME:
-                    o = pa_context_get_sink_input_info(c, sink_input_idx, get_sink_input_volume_callback, NULL);
-                    break;
-
-                case SET_SOURCE_OUTPUT_VOLUME:
-                    o = pa_context_get_source_output_info(c, source_output_idx, get_source_output_volume_callback, NULL);
-                    break;
-
-                case SET_SINK_FORMATS:
-                    set_sink_formats(c, sink_idx, formats);
-                    break;
-
-                case SET_PORT_LATENCY_OFFSET:
-                    o = pa_context_set_port_latency_offset(c, card_name, port_name, latency_offset, simple_callback, NULL);
-                    break;
-
-                case SUBSCRIBE:
-                    pa_context_set_subscribe_callback(c, context_subscribe_callback, NULL);
-
-                    o = pa_context_subscribe(c,
-                                             PA_SUBSCRIPTION_MASK_SINK|
-                                             PA_SUBSCRIPTION_MASK_SOURCE|
-                                             PA_SUBSCRIPTION_MASK_SINK_INPUT|
-                                             PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT|
-                                             PA_SUBSCRIPTION_MASK_MODULE|
-                                             PA_SUBSCRIPTION_MASK_CLIENT|
-                                             PA_SUBSCRIPTION_MASK_SAMPLE_CACHE|
-                                             PA_SUBSCRIPTION_MASK_SERVER|
-                                             PA_SUBSCRIPTION_MASK_CARD,
-                                             NULL,
-                                             NULL);
-                    break;
-
-                default:
-                    pa_assert_not_reached();
-            }
+        case PLAY_SAMPLE:
+            o = pa_context_play_sample(c, sample_name, sink_name, PA_VOLUME_NORM, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
 
-            if (o) {
-                pa_operation_unref(o);
-                actions++;
-            }
+        case REMOVE_SAMPLE:
+            o = pa_context_remove_sample(c, sample_name, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
 
-            if (actions == 0) {
-                pa_log("Operation failed: %s", pa_strerror(pa_context_errno(c)));
-                quit(1);
-            }
+        case UPLOAD_SAMPLE:
+            sample_stream = pa_stream_new(c, sample_name, &sample_spec, NULL);
+            pa_assert(sample_stream);
 
+            pa_stream_set_state_callback(sample_stream, stream_state_callback, NULL);
+            pa_stream_set_write_callback(sample_stream, stream_write_callback, NULL);
+            pa_stream_connect_upload(sample_stream, sample_length);
+            actions++;
             break;
 
-        case PA_CONTEXT_TERMINATED:
-            quit(0);
+        case EXIT:
+            o = pa_context_exit_daemon(c, simple_callback, PA_UINT32_TO_PTR(batch_line));
             break;
 
-        case PA_CONTEXT_FAILED:
-        default:
-            pa_log(_("Connection failure: %s"), pa_strerror(pa_context_errno(c)));
-            quit(1);
-    }
-}
-
-static void exit_signal_callback(pa_mainloop_api *m, pa_signal_event *e, int sig, void *userdata) {
-    pa_log(_("Got SIGINT, exiting."));
-    quit(0);
-}
+        case LIST:
+            if (output_format == FORMAT_JSON)
+                json_begin(!list_type);
+
+            if (list_type) {
+                if (pa_streq(list_type, "modules"))
+                    o = pa_context_get_module_info_list(c, get_module_info_callback, NULL);
+                else if (pa_streq(list_type, "sinks"))
+                    o = pa_context_get_sink_info_list(c, get_sink_info_callback, NULL);
+                else if (pa_streq(list_type, "sources"))
+                    o = pa_context_get_source_info_list(c, get_source_info_callback, NULL);
+                else if (pa_streq(list_type, "sink-inputs"))
+                    o = pa_context_get_sink_input_info_list(c, get_sink_input_info_callback, NULL);
+                else if (pa_streq(list_type, "source-outputs"))
+                    o = pa_context_get_source_output_info_list(c, get_source_output_info_callback, NULL);
+                else if (pa_streq(list_type, "clients"))
+                    o = pa_context_get_client_info_list(c, get_client_info_callback, NULL);
+                else if (pa_streq(list_type, "samples"))
+                    o = pa_context_get_sample_info_list(c, get_sample_info_callback, NULL);
+                else if (pa_streq(list_type, "cards"))
+                    o = pa_context_get_card_info_list(c, get_card_info_callback, NULL);
+                else
+                    pa_assert_not_reached();
+            } else {
+                o = pa_context_get_module_info_list(c, get_module_info_callback, NULL);
+                if (o) {
+                    pa_operation_unref(o);
+                    actions++;
+                }
 
-static int parse_volume(const char *vol_spec, pa_volume_t *vol, enum volume_flags *vol_flags) {
-    double v;
-    char *vs;
-    const char *atod_input;
+                o = pa_context_get_sink_info_list(c, get_sink_info_callback, NULL);
+                if (o) {
+                    pa_operation_unref(o);
+                    actions++;
+                }
 
-    pa_assert(vol_spec);
+                o = pa_context_get_source_info_list(c, get_source_info_callback, NULL);
+                if (o) {
+                    pa_operation_unref(o);
+                    actions++;
+                }
+                o = pa_context_get_sink_input_info_list(c, get_sink_input_info_callback, NULL);
+                if (o) {
+                    pa_operation_unref(o);
+                    actions++;
+                }
+
+                o = pa_context_get_source_output_info_list(c, get_source_output_info_callback, NULL);
+                if (o) {
+                    pa_operation_unref(o);
+                    actions++;
+                }
+
+                o = pa_context_get_client_info_list(c, get_client_info_callback, NULL);
+                if (o) {
+                    pa_operation_unref(o);
+                    actions++;
+                }
+
+                o = pa_context_get_sample_info_list(c, get_sample_info_callback, NULL);
+                if (o) {
+                    pa_operation_unref(o);
+                    actions++;
+                }
+
+                o = pa_context_get_card_info_list(c, get_card_info_callback, NULL);
+                if (o) {
+                    pa_operation_unref(o);
+                    actions++;
+                }
+
+                o = NULL;
+            }
+            break;
+
+        case MOVE_SINK_INPUT:
+            o = pa_context_move_sink_input_by_name(c, sink_input_idx, sink_name, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case MOVE_SOURCE_OUTPUT:
+            o = pa_context_move_source_output_by_name(c, source_output_idx, source_name, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case LOAD_MODULE:
+            o = pa_context_load_module(c, module_name, module_args, index_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case UNLOAD_MODULE:
+            if (module_name)
+                o = pa_context_get_module_info_list(c, unload_module_by_name_callback, PA_UINT32_TO_PTR(batch_line));
+            else
+                o = pa_context_unload_module(c, module_index, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SUSPEND_SINK:
+            if (sink_name)
+                o = pa_context_suspend_sink_by_name(c, sink_name, suspend, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            else
+                o = pa_context_suspend_sink_by_index(c, PA_INVALID_INDEX, suspend, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SUSPEND_SOURCE:
+            if (source_name)
+                o = pa_context_suspend_source_by_name(c, source_name, suspend, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            else
+                o = pa_context_suspend_source_by_index(c, PA_INVALID_INDEX, suspend, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_CARD_PROFILE:
+            o = pa_context_set_card_profile_by_name(c, card_name, profile_name, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_SINK_PORT:
+            o = pa_context_set_sink_port_by_name(c, sink_name, port_name, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_DEFAULT_SINK:
+            o = pa_context_set_default_sink(c, sink_name, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_SOURCE_PORT:
+            o = pa_context_set_source_port_by_name(c, source_name, port_name, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_DEFAULT_SOURCE:
+            o = pa_context_set_default_source(c, source_name, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_SINK_MUTE:
+            if (mute == TOGGLE_MUTE)
+                o = pa_context_get_sink_info_by_name(c, sink_name, sink_toggle_mute_callback, PA_UINT32_TO_PTR(batch_line));
+            else
+                o = pa_context_set_sink_mute_by_name(c, sink_name, mute, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_SOURCE_MUTE:
+            if (mute == TOGGLE_MUTE)
+                o = pa_context_get_source_info_by_name(c, source_name, source_toggle_mute_callback, PA_UINT32_TO_PTR(batch_line));
+            else
+                o = pa_context_set_source_mute_by_name(c, source_name, mute, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_SINK_INPUT_MUTE:
+            if (mute == TOGGLE_MUTE)
+                o = pa_context_get_sink_input_info(c, sink_input_idx, sink_input_toggle_mute_callback, PA_UINT32_TO_PTR(batch_line));
+            else
+                o = pa_context_set_sink_input_mute(c, sink_input_idx, mute, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_SOURCE_OUTPUT_MUTE:
+            if (mute == TOGGLE_MUTE)
+                o = pa_context_get_source_output_info(c, source_output_idx, source_output_toggle_mute_callback, PA_UINT32_TO_PTR(batch_line));
+            else
+                o = pa_context_set_source_output_mute(c, source_output_idx, mute, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SET_SINK_VOLUME:
+            o = pa_context_get_sink_info_by_name(c, sink_name, get_sink_volume_callback, volume_change_new());
+            break;
+
+        case SET_SOURCE_VOLUME:
+            o = pa_context_get_source_info_by_name(c, source_name, get_source_volume_callback, volume_change_new());
+            break;
+
+        case SET_SINK_INPUT_VOLUME:
+            o = pa_context_get_sink_input_info(c, sink_input_idx, get_sink_input_volume_callback, volume_change_new());
+            break;
+
+        case SET_SOURCE_OUTPUT_VOLUME:
+            o = pa_context_get_source_output_info(c, source_output_idx, get_source_output_volume_callback, volume_change_new());
+            break;
+
+        case SET_SINK_FORMATS:
+            set_sink_formats(c, sink_idx, formats);
+            break;
+
+        case SET_PORT_LATENCY_OFFSET:
+            o = pa_context_set_port_latency_offset(c, card_name, port_name, latency_offset, simple_callback, PA_UINT32_TO_PTR(batch_line));
+            break;
+
+        case SUBSCRIBE:
+            pa_context_set_subscribe_callback(c, context_subscribe_callback, NULL);
+
+            o = pa_context_subscribe(c,
+                                     PA_SUBSCRIPTION_MASK_SINK|
+                                     PA_SUBSCRIPTION_MASK_SOURCE|
+                                     PA_SUBSCRIPTION_MASK_SINK_INPUT|
+                                     PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT|
+                                     PA_SUBSCRIPTION_MASK_MODULE|
+                                     PA_SUBSCRIPTION_MASK_CLIENT|
+                                     PA_SUBSCRIPTION_MASK_SAMPLE_CACHE|
+                                     PA_SUBSCRIPTION_MASK_SERVER|
+                                     PA_SUBSCRIPTION_MASK_CARD,
+                                     NULL,
+                                     NULL);
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+
+    if (o) {
+        pa_operation_unref(o);
+        actions++;
+    }
+}
+
+static void context_state_callback(pa_context *c, void *userdata) {
+    pa_assert(c);
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_CONNECTING:
+        case PA_CONTEXT_AUTHORIZING:
+        case PA_CONTEXT_SETTING_NAME:
+            break;
+
+        case PA_CONTEXT_READY:
+            if (batch_file) {
+                batch_run(c);
+                break;
+            }
+
+            run_action(c);
+
+            if (actions == 0) {
+                pa_log("Operation failed: %s", pa_strerror(pa_context_errno(c)));
+                quit(1);
+            }
+
+            break;
+
+        case PA_CONTEXT_TERMINATED:
+            quit(batch_failed ? 1 : 0);
+            break;
+
+        case PA_CONTEXT_FAILED:
+        default:
+            pa_log(_("Connection failure: %s"), pa_strerror(pa_context_errno(c)));
+            quit(1);
+    }
+}
+
+static void exit_signal_callback(pa_mainloop_api *m, pa_signal_event *e, int sig, void *userdata) {
+    pa_log(_("Got SIGINT, exiting."));
+    quit(0);
+}
+
+static int parse_volume(const char *vol_spec, pa_volume_t *vol, enum volume_flags *vol_flags) {
+    double v;
+    char *vs;
+    const char *atod_input;
+
+    pa_assert(vol_spec);
     pa_assert(vol);
     pa_assert(vol_flags);
 
@@ -1581,6 +2152,7 @@ static void help(const char *argv0) {
     printf("%s %s %s %s\n", argv0, _("[options]"), "set-sink-formats", _("#N FORMATS"));
     printf("%s %s %s %s\n", argv0, _("[options]"), "set-port-latency-offset", _("CARD-NAME|CARD-#N PORT OFFSET"));
     printf("%s %s %s\n",    argv0, _("[options]"), "subscribe");
+    printf("%s %s %s %s\n", argv0, _("[options]"), "batch", _("[FILE]"));
     printf(_("\nThe special names @DEFAULT_SINK@, @DEFAULT_SOURCE@ and @DEFAULT_MONITOR@\n"
              "can be used to specify the default sink, source and monitor.\n"));
 
@@ -1588,472 +2160,644 @@ static void help(const char *argv0) {
              "  -h, --help                            Show this help\n"
              "      --version                         Show version\n\n"
              "  -s, --server=SERVER                   The name of the server to connect to\n"
-             "  -n, --client-name=NAME                How to call this client on the server\n"));
+             "  -n, --client-name=NAME                How to call this client on the server\n"
+             "  -f, --format=FORMAT                   The format of the list output: text or json\n"));
 }
 
-enum {
-    ARG_VERSION = 256
-};
+/* Parses one command, argv[0] being its name, into action and the
+ * parameters above. Returns 1 if the command only printed the help. */
+static int parse_command(const char *bn, int argc, char *argv[]) {
+    pa_assert(argc > 0);
+
+    if (pa_streq(argv[0], "stat")) {
+        action = STAT;
+
+    } else if (pa_streq(argv[0], "info"))
+        action = INFO;
+
+    else if (pa_streq(argv[0], "exit"))
+        action = EXIT;
+
+    else if (pa_streq(argv[0], "list")) {
+        action = LIST;
+
+        for (int i = 1; i < argc; i++) {
+            if (pa_streq(argv[i], "modules") || pa_streq(argv[i], "clients") ||
+                pa_streq(argv[i], "sinks")   || pa_streq(argv[i], "sink-inputs") ||
+                pa_streq(argv[i], "sources") || pa_streq(argv[i], "source-outputs") ||
+                pa_streq(argv[i], "samples") || pa_streq(argv[i], "cards")) {
+                list_type = pa_xstrdup(argv[i]);
+            } else if (pa_streq(argv[i], "short")) {
+                short_list_format = true;
+            } else {
+                pa_log(_("Specify nothing, or one of: %s"), "modules, sinks, sources, sink-inputs, source-outputs, clients, samples, cards");
+                return -1;
+            }
+        }
 
-int main(int argc, char *argv[]) {
-    pa_mainloop *m = NULL;
-    int ret = 1, c;
-    char *server = NULL, *bn;
+    } else if (pa_streq(argv[0], "upload-sample")) {
+        struct SF_INFO sfi;
+        action = UPLOAD_SAMPLE;
 
-    static const struct option long_options[] = {
-        {"server",      1, NULL, 's'},
-        {"client-name", 1, NULL, 'n'},
-        {"version",     0, NULL, ARG_VERSION},
-        {"help",        0, NULL, 'h'},
-        {NULL,          0, NULL, 0}
-    };
+        if (argc <= 1) {
+            pa_log(_("Please specify a sample file to load"));
+            return -1;
+        }
 
-    setlocale(LC_ALL, "");
-#ifdef ENABLE_NLS
-    bindtextdomain(GETTEXT_PACKAGE, PULSE_LOCALEDIR);
-#endif
+        if (argc > 2)
+            sample_name = pa_xstrdup(argv[2]);
+        else {
+            char *f = pa_path_get_filename(argv[1]);
+            sample_name = pa_xstrndup(f, strcspn(f, "."));
+        }
 
-    bn = pa_path_get_filename(argv[0]);
+        pa_zero(sfi);
+        if (!(sndfile = sf_open(argv[1], SFM_READ, &sfi))) {
+            pa_log(_("Failed to open sound file."));
+            return -1;
+        }
 
-    proplist = pa_proplist_new();
+        if (pa_sndfile_read_sample_spec(sndfile, &sample_spec) < 0) {
+            pa_log(_("Failed to determine sample specification from file."));
+            return -1;
+        }
+        sample_spec.format = PA_SAMPLE_FLOAT32;
 
-    while ((c = getopt_long(argc, argv, "+s:n:h", long_options, NULL)) != -1) {
-        switch (c) {
-            case 'h' :
-                help(bn);
-                ret = 0;
-                goto quit;
+        if (pa_sndfile_read_channel_map(sndfile, &channel_map) < 0) {
+            if (sample_spec.channels > 2)
+                pa_log(_("Warning: Failed to determine sample specification from file."));
+            pa_channel_map_init_extend(&channel_map, sample_spec.channels, PA_CHANNEL_MAP_DEFAULT);
+        }
 
-            case ARG_VERSION:
-                printf(_("pactl %s\n"
-                         "Compiled with libpulse %s\n"
-                         "Linked with libpulse %s\n"),
-                       PACKAGE_VERSION,
-                       pa_get_headers_version(),
-                       pa_get_library_version());
-                ret = 0;
-                goto quit;
+        pa_assert(pa_channel_map_compatible(&channel_map, &sample_spec));
+        sample_length = (size_t) sfi.frames*pa_frame_size(&sample_spec);
 
-            case 's':
-                pa_xfree(server);
-                server = pa_xstrdup(optarg);
-                break;
+    } else if (pa_streq(argv[0], "play-sample")) {
+        action = PLAY_SAMPLE;
+        if (argc != 2 && argc != 3) {
+            pa_log(_("You have to specify a sample name to play"));
+            return -1;
+        }
 
-            case 'n': {
-                char *t;
+        sample_name = pa_xstrdup(argv[1]);
 
-                if (!(t = pa_locale_to_utf8(optarg)) ||
-                    pa_proplist_sets(proplist, PA_PROP_APPLICATION_NAME, t) < 0) {
+        if (argc > 2)
+            sink_name = pa_xstrdup(argv[2]);
 
-                    pa_log(_("Invalid client name '%s'"), t ? t : optarg);
-                    pa_xfree(t);
-                    goto quit;
-                }
+    } else if (pa_streq(argv[0], "remove-sample")) {
+        action = REMOVE_SAMPLE;
+        if (argc != 2) {
+            pa_log(_("You have to specify a sample name to remove"));
+            return -1;
+        }
 
-                pa_xfree(t);
-                break;
-            }
+        sample_name = pa_xstrdup(argv[1]);
 
-            default:
-                goto quit;
+    } else if (pa_streq(argv[0], "move-sink-input")) {
+        action = MOVE_SINK_INPUT;
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink input index and a sink"));
+            return -1;
         }
-    }
 
-    if (optind < argc) {
-        if (pa_streq(argv[optind], "stat")) {
-            action = STAT;
+        sink_input_idx = (uint32_t) atoi(argv[1]);
+        sink_name = pa_xstrdup(argv[2]);
 
-        } else if (pa_streq(argv[optind], "info"))
-            action = INFO;
+    } else if (pa_streq(argv[0], "move-source-output")) {
+        action = MOVE_SOURCE_OUTPUT;
+        if (argc != 3) {
+            pa_log(_("You have to specify a source output index and a source"));
+            return -1;
+        }
 
-        else if (pa_streq(argv[optind], "exit"))
-            action = EXIT;
+        source_output_idx = (uint32_t) atoi(argv[1]);
+        source_name = pa_xstrdup(argv[2]);
 
-        else if (pa_streq(argv[optind], "list")) {
-            action = LIST;
+    } else if (pa_streq(argv[0], "load-module")) {
+        int i;
+        size_t n = 0;
+        char *p;
 
-            for (int i = optind+1; i < argc; i++) {
-                if (pa_streq(argv[i], "modules") || pa_streq(argv[i], "clients") ||
-                    pa_streq(argv[i], "sinks")   || pa_streq(argv[i], "sink-inputs") ||
-                    pa_streq(argv[i], "sources") || pa_streq(argv[i], "source-outputs") ||
-                    pa_streq(argv[i], "samples") || pa_streq(argv[i], "cards")) {
-                    list_type = pa_xstrdup(argv[i]);
-                } else if (pa_streq(argv[i], "short")) {
-                    short_list_format = true;
-                } else {
-                    pa_log(_("Specify nothing, or one of: %s"), "modules, sinks, sources, sink-inputs, source-outputs, clients, samples, cards");
-                    goto quit;
-                }
-            }
+        action = LOAD_MODULE;
 
-        } else if (pa_streq(argv[optind], "upload-sample")) {
-            struct SF_INFO sfi;
-            action = UPLOAD_SAMPLE;
+        if (argc <= 1) {
+            pa_log(_("You have to specify a module name and arguments."));
+            return -1;
+        }
 
-            if (optind+1 >= argc) {
-                pa_log(_("Please specify a sample file to load"));
-                goto quit;
-            }
+        module_name = pa_xstrdup(argv[1]);
 
-            if (optind+2 < argc)
-                sample_name = pa_xstrdup(argv[optind+2]);
-            else {
-                char *f = pa_path_get_filename(argv[optind+1]);
-                sample_name = pa_xstrndup(f, strcspn(f, "."));
-            }
+        for (i = 2; i < argc; i++)
+            n += strlen(argv[i])+1;
 
-            pa_zero(sfi);
-            if (!(sndfile = sf_open(argv[optind+1], SFM_READ, &sfi))) {
-                pa_log(_("Failed to open sound file."));
-                goto quit;
-            }
+        if (n > 0) {
+            p = module_args = pa_xmalloc(n);
 
-            if (pa_sndfile_read_sample_spec(sndfile, &sample_spec) < 0) {
-                pa_log(_("Failed to determine sample specification from file."));
-                goto quit;
-            }
-            sample_spec.format = PA_SAMPLE_FLOAT32;
+            for (i = 2; i < argc; i++)
+                p += sprintf(p, "%s%s", p == module_args ? "" : " ", argv[i]);
+        }
 
-            if (pa_sndfile_read_channel_map(sndfile, &channel_map) < 0) {
-                if (sample_spec.channels > 2)
-                    pa_log(_("Warning: Failed to determine sample specification from file."));
-                pa_channel_map_init_extend(&channel_map, sample_spec.channels, PA_CHANNEL_MAP_DEFAULT);
-            }
+    } else if (pa_streq(argv[0], "unload-module")) {
+        action = UNLOAD_MODULE;
 
-            pa_assert(pa_channel_map_compatible(&channel_map, &sample_spec));
-            sample_length = (size_t) sfi.frames*pa_frame_size(&sample_spec);
+        if (argc != 2) {
+            pa_log(_("You have to specify a module index or name"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "play-sample")) {
-            action = PLAY_SAMPLE;
-            if (argc != optind+2 && argc != optind+3) {
-                pa_log(_("You have to specify a sample name to play"));
-                goto quit;
-            }
+        if (pa_atou(argv[1], &module_index) < 0)
+            module_name = pa_xstrdup(argv[1]);
 
-            sample_name = pa_xstrdup(argv[optind+1]);
+    } else if (pa_streq(argv[0], "suspend-sink")) {
+        int b;
 
-            if (optind+2 < argc)
-                sink_name = pa_xstrdup(argv[optind+2]);
+        action = SUSPEND_SINK;
 
-        } else if (pa_streq(argv[optind], "remove-sample")) {
-            action = REMOVE_SAMPLE;
-            if (argc != optind+2) {
-                pa_log(_("You have to specify a sample name to remove"));
-                goto quit;
-            }
+        if (argc > 3 || argc <= 1) {
+            pa_log(_("You may not specify more than one sink. You have to specify a boolean value."));
+            return -1;
+        }
 
-            sample_name = pa_xstrdup(argv[optind+1]);
+        if ((b = pa_parse_boolean(argv[argc-1])) < 0) {
+            pa_log(_("Invalid suspend specification."));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "move-sink-input")) {
-            action = MOVE_SINK_INPUT;
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink input index and a sink"));
-                goto quit;
-            }
+        suspend = !!b;
 
-            sink_input_idx = (uint32_t) atoi(argv[optind+1]);
-            sink_name = pa_xstrdup(argv[optind+2]);
+        if (argc > 2)
+            sink_name = pa_xstrdup(argv[1]);
 
-        } else if (pa_streq(argv[optind], "move-source-output")) {
-            action = MOVE_SOURCE_OUTPUT;
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source output index and a source"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "suspend-source")) {
+        int b;
 
-            source_output_idx = (uint32_t) atoi(argv[optind+1]);
-            source_name = pa_xstrdup(argv[optind+2]);
+        action = SUSPEND_SOURCE;
 
-        } else if (pa_streq(argv[optind], "load-module")) {
-            int i;
-            size_t n = 0;
-            char *p;
+        if (argc > 3 || argc <= 1) {
+            pa_log(_("You may not specify more than one source. You have to specify a boolean value."));
+            return -1;
+        }
+
+        if ((b = pa_parse_boolean(argv[argc-1])) < 0) {
+            pa_log(_("Invalid suspend specification."));
+            return -1;
+        }
 
-            action = LOAD_MODULE;
+        suspend = !!b;
 
-            if (argc <= optind+1) {
-                pa_log(_("You have to specify a module name and arguments."));
-                goto quit;
-            }
+        if (argc > 2)
+            source_name = pa_xstrdup(argv[1]);
+    } else if (pa_streq(argv[0], "set-card-profile")) {
+        action = SET_CARD_PROFILE;
 
-            module_name = argv[optind+1];
+        if (argc != 3) {
+            pa_log(_("You have to specify a card name/index and a profile name"));
+            return -1;
+        }
 
-            for (i = optind+2; i < argc; i++)
-                n += strlen(argv[i])+1;
+        card_name = pa_xstrdup(argv[1]);
+        profile_name = pa_xstrdup(argv[2]);
 
-            if (n > 0) {
-                p = module_args = pa_xmalloc(n);
+    } else if (pa_streq(argv[0], "set-sink-port")) {
+        action = SET_SINK_PORT;
 
-                for (i = optind+2; i < argc; i++)
-                    p += sprintf(p, "%s%s", p == module_args ? "" : " ", argv[i]);
-            }
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink name/index and a port name"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "unload-module")) {
-            action = UNLOAD_MODULE;
+        sink_name = pa_xstrdup(argv[1]);
+        port_name = pa_xstrdup(argv[2]);
 
-            if (argc != optind+2) {
-                pa_log(_("You have to specify a module index or name"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "set-default-sink")) {
+        action = SET_DEFAULT_SINK;
 
-            if (pa_atou(argv[optind + 1], &module_index) < 0)
-                module_name = argv[optind + 1];
+        if (argc != 2) {
+            pa_log(_("You have to specify a sink name"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "suspend-sink")) {
-            int b;
+        sink_name = pa_xstrdup(argv[1]);
 
-            action = SUSPEND_SINK;
+    } else if (pa_streq(argv[0], "set-source-port")) {
+        action = SET_SOURCE_PORT;
 
-            if (argc > optind+3 || optind+1 >= argc) {
-                pa_log(_("You may not specify more than one sink. You have to specify a boolean value."));
-                goto quit;
-            }
+        if (argc != 3) {
+            pa_log(_("You have to specify a source name/index and a port name"));
+            return -1;
+        }
 
-            if ((b = pa_parse_boolean(argv[argc-1])) < 0) {
-                pa_log(_("Invalid suspend specification."));
-                goto quit;
-            }
+        source_name = pa_xstrdup(argv[1]);
+        port_name = pa_xstrdup(argv[2]);
 
-            suspend = !!b;
+    } else if (pa_streq(argv[0], "set-default-source")) {
+        action = SET_DEFAULT_SOURCE;
 
-            if (argc > optind+2)
-                sink_name = pa_xstrdup(argv[optind+1]);
+        if (argc != 2) {
+            pa_log(_("You have to specify a source name"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "suspend-source")) {
-            int b;
+        source_name = pa_xstrdup(argv[1]);
 
-            action = SUSPEND_SOURCE;
+    } else if (pa_streq(argv[0], "set-sink-volume")) {
+        action = SET_SINK_VOLUME;
 
-            if (argc > optind+3 || optind+1 >= argc) {
-                pa_log(_("You may not specify more than one source. You have to specify a boolean value."));
-                goto quit;
-            }
+        if (argc < 3) {
+            pa_log(_("You have to specify a sink name/index and a volume"));
+            return -1;
+        }
 
-            if ((b = pa_parse_boolean(argv[argc-1])) < 0) {
-                pa_log(_("Invalid suspend specification."));
-                goto quit;
-            }
+        sink_name = pa_xstrdup(argv[1]);
 
-            suspend = !!b;
+        if (parse_volumes(argv+2, argc-2) < 0)
+            return -1;
 
-            if (argc > optind+2)
-                source_name = pa_xstrdup(argv[optind+1]);
-        } else if (pa_streq(argv[optind], "set-card-profile")) {
-            action = SET_CARD_PROFILE;
+    } else if (pa_streq(argv[0], "set-source-volume")) {
+        action = SET_SOURCE_VOLUME;
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a card name/index and a profile name"));
-                goto quit;
-            }
+        if (argc < 3) {
+            pa_log(_("You have to specify a source name/index and a volume"));
+            return -1;
+        }
 
-            card_name = pa_xstrdup(argv[optind+1]);
-            profile_name = pa_xstrdup(argv[optind+2]);
+        source_name = pa_xstrdup(argv[1]);
 
-        } else if (pa_streq(argv[optind], "set-sink-port")) {
-            action = SET_SINK_PORT;
+        if (parse_volumes(argv+2, argc-2) < 0)
+            return -1;
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink name/index and a port name"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "set-sink-input-volume")) {
+        action = SET_SINK_INPUT_VOLUME;
 
-            sink_name = pa_xstrdup(argv[optind+1]);
-            port_name = pa_xstrdup(argv[optind+2]);
+        if (argc < 3) {
+            pa_log(_("You have to specify a sink input index and a volume"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "set-default-sink")) {
-            action = SET_DEFAULT_SINK;
+        if (pa_atou(argv[1], &sink_input_idx) < 0) {
+            pa_log(_("Invalid sink input index"));
+            return -1;
+        }
 
-            if (argc != optind+2) {
-                pa_log(_("You have to specify a sink name"));
-                goto quit;
-            }
+        if (parse_volumes(argv+2, argc-2) < 0)
+            return -1;
 
-            sink_name = pa_xstrdup(argv[optind+1]);
+    } else if (pa_streq(argv[0], "set-source-output-volume")) {
+        action = SET_SOURCE_OUTPUT_VOLUME;
 
-        } else if (pa_streq(argv[optind], "set-source-port")) {
-            action = SET_SOURCE_PORT;
+        if (argc < 3) {
+            pa_log(_("You have to specify a source output index and a volume"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source name/index and a port name"));
-                goto quit;
-            }
+        if (pa_atou(argv[1], &source_output_idx) < 0) {
+            pa_log(_("Invalid source output index"));
+            return -1;
+        }
 
-            source_name = pa_xstrdup(argv[optind+1]);
-            port_name = pa_xstrdup(argv[optind+2]);
+        if (parse_volumes(argv+2, argc-2) < 0)
+            return -1;
 
-        } else if (pa_streq(argv[optind], "set-default-source")) {
-            action = SET_DEFAULT_SOURCE;
+    } else if (pa_streq(argv[0], "set-sink-mute")) {
+        action = SET_SINK_MUTE;
 
-            if (argc != optind+2) {
-                pa_log(_("You have to specify a source name"));
-                goto quit;
-            }
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink name/index and a mute action (0, 1, or 'toggle')"));
+            return -1;
+        }
 
-            source_name = pa_xstrdup(argv[optind+1]);
+        if ((mute = parse_mute(argv[2])) == INVALID_MUTE) {
+            pa_log(_("Invalid mute specification"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "set-sink-volume")) {
-            action = SET_SINK_VOLUME;
+        sink_name = pa_xstrdup(argv[1]);
 
-            if (argc < optind+3) {
-                pa_log(_("You have to specify a sink name/index and a volume"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "set-source-mute")) {
+        action = SET_SOURCE_MUTE;
 
-            sink_name = pa_xstrdup(argv[optind+1]);
+        if (argc != 3) {
+            pa_log(_("You have to specify a source name/index and a mute action (0, 1, or 'toggle')"));
+            return -1;
+        }
 
-            if (parse_volumes(argv+optind+2, argc-(optind+2)) < 0)
-                goto quit;
+        if ((mute = parse_mute(argv[2])) == INVALID_MUTE) {
+            pa_log(_("Invalid mute specification"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "set-source-volume")) {
-            action = SET_SOURCE_VOLUME;
+        source_name = pa_xstrdup(argv[1]);
 
-            if (argc < optind+3) {
-                pa_log(_("You have to specify a source name/index and a volume"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "set-sink-input-mute")) {
+        action = SET_SINK_INPUT_MUTE;
 
-            source_name = pa_xstrdup(argv[optind+1]);
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink input index and a mute action (0, 1, or 'toggle')"));
+            return -1;
+        }
 
-            if (parse_volumes(argv+optind+2, argc-(optind+2)) < 0)
-                goto quit;
+        if (pa_atou(argv[1], &sink_input_idx) < 0) {
+            pa_log(_("Invalid sink input index specification"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "set-sink-input-volume")) {
-            action = SET_SINK_INPUT_VOLUME;
+        if ((mute = parse_mute(argv[2])) == INVALID_MUTE) {
+            pa_log(_("Invalid mute specification"));
+            return -1;
+        }
 
-            if (argc < optind+3) {
-                pa_log(_("You have to specify a sink input index and a volume"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "set-source-output-mute")) {
+        action = SET_SOURCE_OUTPUT_MUTE;
 
-            if (pa_atou(argv[optind+1], &sink_input_idx) < 0) {
-                pa_log(_("Invalid sink input index"));
-                goto quit;
-            }
+        if (argc != 3) {
+            pa_log(_("You have to specify a source output index and a mute action (0, 1, or 'toggle')"));
+            return -1;
+        }
 
-            if (parse_volumes(argv+optind+2, argc-(optind+2)) < 0)
-                goto quit;
+        if (pa_atou(argv[1], &source_output_idx) < 0) {
+            pa_log(_("Invalid source output index specification"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "set-source-output-volume")) {
-            action = SET_SOURCE_OUTPUT_VOLUME;
+        if ((mute = parse_mute(argv[2])) == INVALID_MUTE) {
+            pa_log(_("Invalid mute specification"));
+            return -1;
+        }
 
-            if (argc < optind+3) {
-                pa_log(_("You have to specify a source output index and a volume"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "subscribe"))
 
-            if (pa_atou(argv[optind+1], &source_output_idx) < 0) {
-                pa_log(_("Invalid source output index"));
-                goto quit;
-            }
+        action = SUBSCRIBE;
 
-            if (parse_volumes(argv+optind+2, argc-(optind+2)) < 0)
-                goto quit;
+    else if (pa_streq(argv[0], "set-sink-formats")) {
+        int32_t tmp;
 
-        } else if (pa_streq(argv[optind], "set-sink-mute")) {
-            action = SET_SINK_MUTE;
+        if (argc != 3 || pa_atoi(argv[1], &tmp) < 0) {
+            pa_log(_("You have to specify a sink index and a semicolon-separated list of supported formats"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink name/index and a mute action (0, 1, or 'toggle')"));
-                goto quit;
-            }
+        sink_idx = tmp;
+        action = SET_SINK_FORMATS;
+        formats = pa_xstrdup(argv[2]);
 
-            if ((mute = parse_mute(argv[optind+2])) == INVALID_MUTE) {
-                pa_log(_("Invalid mute specification"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "set-port-latency-offset")) {
+        action = SET_PORT_LATENCY_OFFSET;
 
-            sink_name = pa_xstrdup(argv[optind+1]);
+        if (argc != 4) {
+            pa_log(_("You have to specify a card name/index, a port name and a latency offset"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "set-source-mute")) {
-            action = SET_SOURCE_MUTE;
+        card_name = pa_xstrdup(argv[1]);
+        port_name = pa_xstrdup(argv[2]);
+        if (pa_atoi(argv[3], &latency_offset) < 0) {
+            pa_log(_("Could not parse latency offset"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source name/index and a mute action (0, 1, or 'toggle')"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "help")) {
+        help(bn);
+        return 1;
+    }
 
-            if ((mute = parse_mute(argv[optind+2])) == INVALID_MUTE) {
-                pa_log(_("Invalid mute specification"));
-                goto quit;
-            }
+    if (action == NONE) {
+        pa_log(_("No valid command specified."));
+        return -1;
+    }
 
-            source_name = pa_xstrdup(argv[optind+1]);
+    return 0;
+}
 
-        } else if (pa_streq(argv[optind], "set-sink-input-mute")) {
-            action = SET_SINK_INPUT_MUTE;
+/* Forgets the parameters of the previous command */
+static void reset_command(void) {
+    action = NONE;
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink input index and a mute action (0, 1, or 'toggle')"));
-                goto quit;
-            }
+    pa_xfree(list_type);
+    pa_xfree(sample_name);
+    pa_xfree(sink_name);
+    pa_xfree(source_name);
+    pa_xfree(module_name);
+    pa_xfree(module_args);
+    pa_xfree(card_name);
+    pa_xfree(profile_name);
+    pa_xfree(port_name);
+    pa_xfree(formats);
+    list_type = sample_name = sink_name = source_name = module_name = module_args = NULL;
+    card_name = profile_name = port_name = formats = NULL;
 
-            if (pa_atou(argv[optind+1], &sink_input_idx) < 0) {
-                pa_log(_("Invalid sink input index specification"));
-                goto quit;
-            }
+    sink_input_idx = source_output_idx = sink_idx = PA_INVALID_INDEX;
+    short_list_format = false;
+    module_index = 0;
+    mute = INVALID_MUTE;
 
-            if ((mute = parse_mute(argv[optind+2])) == INVALID_MUTE) {
-                pa_log(_("Invalid mute specification"));
-                goto quit;
-            }
+    if (sample_stream) {
+        pa_stream_unref(sample_stream);
+        sample_stream = NULL;
+    }
+
+    if (sndfile) {
+        sf_close(sndfile);
+        sndfile = NULL;
+    }
 
-        } else if (pa_streq(argv[optind], "set-source-output-mute")) {
-            action = SET_SOURCE_OUTPUT_MUTE;
+    sample_length = 0;
+}
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source output index and a mute action (0, 1, or 'toggle')"));
-                goto quit;
-            }
+/* Whether the next command may be sent before this one is done. The
+ * server answers the requests of a connection in order, so results
+ * are still printed in the order of the input. The callbacks of the
+ * other commands use the parsed parameters, or print more than one
+ * reply, so reading stops until nothing is in flight anymore. */
+static bool action_is_pipelined(void) {
+    switch (action) {
+        case STAT:
+        case INFO:
+        case LIST:
+        case UPLOAD_SAMPLE:
+        case SUBSCRIBE:
+            return false;
+
+        case UNLOAD_MODULE:
+            return !module_name;
+
+        default:
+            return true;
+    }
+}
+
+/* Sends the commands of batch_file until one has to finish first, or
+ * the file ends. Called again from complete_action() whenever the
+ * operations in flight are done. */
+static void batch_run(pa_context *c) {
+    char line[4096];
+
+    while (fgets(line, sizeof(line), batch_file)) {
+        char *args[MAX_BATCH_ARGS];
+        const char *state = NULL;
+        char *a;
+        int n = 0, before, r;
+
+        action = NONE;
+        batch_line++;
+
+        if (!strchr(line, '\n') && !feof(batch_file)) {
+            int ch;
+
+            pa_log(_("Line %u: Line too long, ignored"), batch_line);
+            batch_failed = true;
+
+            while ((ch = fgetc(batch_file)) != EOF && ch != '\n')
+                ;
+            continue;
+        }
+
+        while (n < MAX_BATCH_ARGS && (a = pa_split_spaces(line, &state)))
+            args[n++] = a;
+
+        if (n == 0 || args[0][0] == '#')
+            r = 0;
+        else if (n >= MAX_BATCH_ARGS || pa_streq(args[0], "subscribe") || pa_streq(args[0], "batch")) {
+            pa_log(_("Line %u: Command not supported in batch mode"), batch_line);
+            r = -1;
+        } else {
+            reset_command();
+            r = parse_command("pactl", n, args);
+        }
+
+        while (n > 0)
+            pa_xfree(args[--n]);
+
+        if (r < 0) {
+            pa_log(_("Line %u: Invalid command, ignored"), batch_line);
+            batch_failed = true;
+        }
+
+        if (r != 0 || action == NONE)
+            continue;
+
+        before = actions;
+        run_action(c);
+
+        if (actions == before) {
+            pa_log(_("Line %u: Operation failed: %s"), batch_line, pa_strerror(pa_context_errno(c)));
+            batch_failed = true;
+        } else if (!action_is_pipelined())
+            return;
+    }
+
+    if (ferror(batch_file)) {
+        pa_log(_("Failed to read commands: %s"), pa_cstrerror(errno));
+        batch_failed = true;
+    }
+
+    if (actions == 0)
+        drain();
+}
+
+enum {
+    ARG_VERSION = 256
+};
 
-            if (pa_atou(argv[optind+1], &source_output_idx) < 0) {
-                pa_log(_("Invalid source output index specification"));
+int main(int argc, char *argv[]) {
+    pa_mainloop *m = NULL;
+    int ret = 1, c;
+    char *server = NULL, *bn;
+
+    static const struct option long_options[] = {
+        {"server",      1, NULL, 's'},
+        {"client-name", 1, NULL, 'n'},
+        {"format",      1, NULL, 'f'},
+        {"version",     0, NULL, ARG_VERSION},
+        {"help",        0, NULL, 'h'},
+        {NULL,          0, NULL, 0}
+    };
+
+    setlocale(LC_ALL, "");
+#ifdef ENABLE_NLS
+    bindtextdomain(GETTEXT_PACKAGE, PULSE_LOCALEDIR);
+#endif
+
+    bn = pa_path_get_filename(argv[0]);
+
+    proplist = pa_proplist_new();
+
+    while ((c = getopt_long(argc, argv, "+s:n:f:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'h' :
+                help(bn);
+                ret = 0;
                 goto quit;
-            }
 
-            if ((mute = parse_mute(argv[optind+2])) == INVALID_MUTE) {
-                pa_log(_("Invalid mute specification"));
+            case ARG_VERSION:
+                printf(_("pactl %s\n"
+                         "Compiled with libpulse %s\n"
+                         "Linked with libpulse %s\n"),
+                       PACKAGE_VERSION,
+                       pa_get_headers_version(),
+                       pa_get_library_version());
+                ret = 0;
                 goto quit;
-            }
 
-        } else if (pa_streq(argv[optind], "subscribe"))
+            case 's':
+                pa_xfree(server);
+                server = pa_xstrdup(optarg);
+                break;
 
-            action = SUBSCRIBE;
+            case 'n': {
+                char *t;
 
-        else if (pa_streq(argv[optind], "set-sink-formats")) {
-            int32_t tmp;
+                if (!(t = pa_locale_to_utf8(optarg)) ||
+                    pa_proplist_sets(proplist, PA_PROP_APPLICATION_NAME, t) < 0) {
 
-            if (argc != optind+3 || pa_atoi(argv[optind+1], &tmp) < 0) {
-                pa_log(_("You have to specify a sink index and a semicolon-separated list of supported formats"));
-                goto quit;
-            }
+                    pa_log(_("Invalid client name '%s'"), t ? t : optarg);
+                    pa_xfree(t);
+                    goto quit;
+                }
 
-            sink_idx = tmp;
-            action = SET_SINK_FORMATS;
-            formats = pa_xstrdup(argv[optind+2]);
+                pa_xfree(t);
+                break;
+            }
 
-        } else if (pa_streq(argv[optind], "set-port-latency-offset")) {
-            action = SET_PORT_LATENCY_OFFSET;
+            case 'f':
+                if (pa_streq(optarg, "text"))
+                    output_format = FORMAT_TEXT;
+                else if (pa_streq(optarg, "json"))
+                    output_format = FORMAT_JSON;
+                else {
+                    pa_log(_("Invalid format '%s'"), optarg);
+                    goto quit;
+                }
+                break;
 
-            if (argc != optind+4) {
-                pa_log(_("You have to specify a card name/index, a port name and a latency offset"));
+            default:
                 goto quit;
-            }
+        }
+    }
 
-            card_name = pa_xstrdup(argv[optind+1]);
-            port_name = pa_xstrdup(argv[optind+2]);
-            if (pa_atoi(argv[optind + 3], &latency_offset) < 0) {
-                pa_log(_("Could not parse latency offset"));
+    if (optind < argc && pa_streq(argv[optind], "batch")) {
+        if (argc > optind+2) {
+            pa_log(_("You may specify at most one file to read commands from"));
+            goto quit;
+        }
+
+        if (optind+1 < argc && !pa_streq(argv[optind+1], "-")) {
+            if (!(batch_file = pa_fopen_cloexec(argv[optind+1], "r"))) {
+                pa_log(_("Failed to open %s: %s"), argv[optind+1], pa_cstrerror(errno));
                 goto quit;
             }
+        } else
+            batch_file = stdin;
 
-        } else if (pa_streq(argv[optind], "help")) {
-            help(bn);
-            ret = 0;
+    } else if (optind < argc) {
+        int r;
+
+        if ((r = parse_command(bn, argc - optind, argv + optind)) != 0) {
+            ret = r < 0 ? 1 : 0;
             goto quit;
         }
     }
 
-    if (action == NONE) {
+    if (action == NONE && !batch_file) {
         pa_log(_("No valid command specified."));
         goto quit;
     }
@@ -2087,8 +2831,10 @@ int main(int argc, char *argv[]) {
     }
 
 quit:
-    if (sample_stream)
-        pa_stream_unref(sample_stream);
+    reset_command();
+
+    if (json_encoder)
+        pa_json_encoder_free(json_encoder);
 
     if (context)
         pa_context_unref(context);
@@ -2099,18 +2845,9 @@ quit:
     }
 
     pa_xfree(server);
-    pa_xfree(list_type);
-    pa_xfree(sample_name);
-    pa_xfree(sink_name);
-    pa_xfree(source_name);
-    pa_xfree(module_args);
-    pa_xfree(card_name);
-    pa_xfree(profile_name);
-    pa_xfree(port_name);
-    pa_xfree(formats);
 
-    if (sndfile)
-        sf_close(sndfile);
+    if (batch_file && batch_file != stdin)
+        fclose(batch_file);
 
     if (proplist)
         pa_proplist_free(proplist);
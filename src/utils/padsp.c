@@ -32,6 +32,7 @@
 
 #include <sys/soundcard.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -104,11 +105,22 @@ struct fd_info {
 
     int optr_n_blocks;
 
+    /* Set while the application has the playback buffer mmap()ed. The
+     * playback stream is fed from this ring at ring_read, the way a
+     * sound card reads its DMA buffer, and the application learns how
+     * far that got with SNDCTL_DSP_GETOPTR. The socket isn't used for
+     * playback then. */
+    void *ring;
+    size_t ring_size;
+    size_t ring_read;
+    uint64_t ring_consumed;
+
     PA_LLIST_FIELDS(fd_info);
 };
 
 static int dsp_drain(fd_info *i);
 static void fd_info_remove_from_list(fd_info *i);
+static void fd_info_shutdown(fd_info *i);
 
 static pthread_mutex_t fd_infos_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t func_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -135,6 +147,11 @@ static int (*___xstat64)(int, const char *, struct stat64 *) = NULL;
 #endif
 static int (*_fclose)(FILE *f) = NULL;
 static int (*_access)(const char *, int) = NULL;
+static void* (*_mmap)(void *, size_t, int, int, int, off_t) = NULL;
+static int (*_munmap)(void *, size_t) = NULL;
+#ifdef HAVE_OPEN64
+static void* (*_mmap64)(void *, size_t, int, int, int, off64_t) = NULL;
+#endif
 
 /* dlsym() violates ISO C, so confide the breakage into this function to
  * avoid warnings. */
@@ -191,6 +208,30 @@ do { \
     pthread_mutex_unlock(&func_mutex); \
 } while(0)
 
+#define LOAD_MMAP_FUNC() \
+do { \
+    pthread_mutex_lock(&func_mutex); \
+    if (!_mmap) \
+        _mmap = (void* (*)(void *, size_t, int, int, int, off_t)) dlsym_fn(RTLD_NEXT, "mmap"); \
+    pthread_mutex_unlock(&func_mutex); \
+} while(0)
+
+#define LOAD_MMAP64_FUNC() \
+do { \
+    pthread_mutex_lock(&func_mutex); \
+    if (!_mmap64) \
+        _mmap64 = (void* (*)(void *, size_t, int, int, int, off64_t)) dlsym_fn(RTLD_NEXT, "mmap64"); \
+    pthread_mutex_unlock(&func_mutex); \
+} while(0)
+
+#define LOAD_MUNMAP_FUNC() \
+do { \
+    pthread_mutex_lock(&func_mutex); \
+    if (!_munmap) \
+        _munmap = (int (*)(void *, size_t)) dlsym_fn(RTLD_NEXT, "munmap"); \
+    pthread_mutex_unlock(&func_mutex); \
+} while(0)
+
 #define LOAD_ACCESS_FUNC() \
 do { \
     pthread_mutex_lock(&func_mutex); \
@@ -652,6 +693,9 @@ static fd_info* fd_info_new(fd_info_type_t type, int *_errno) {
     i->sink_index = (uint32_t) -1;
     i->source_index = (uint32_t) -1;
     i->optr_n_blocks = 0;
+    i->ring = NULL;
+    i->ring_size = i->ring_read = 0;
+    i->ring_consumed = 0;
     PA_LLIST_INIT(fd_info, i);
 
     reset_params(i);
@@ -788,10 +832,61 @@ static void fix_metrics(fd_info *i) {
     debug(DEBUG_LEVEL_NORMAL, __FILE__": fixated metrics to %i fragments, %li bytes each.\n", i->n_fragments, (long)i->fragment_size);
 }
 
+/* Called with the mainloop locked */
+static int fd_info_copy_ring(fd_info *i) {
+    size_t n;
+
+    n = pa_stream_writable_size(i->play_stream);
+    if (n == (size_t)-1) {
+        debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_writable_size(): %s\n",
+            pa_strerror(pa_context_errno(i->context)));
+        return -1;
+    }
+
+    while (n >= i->fragment_size) {
+        void *data;
+        size_t length = i->fragment_size, k;
+
+        /* Copy straight into the memory block that is sent to the
+         * server, which is all the copying there is in this mode */
+        if (pa_stream_begin_write(i->play_stream, &data, &length) < 0) {
+            debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_begin_write(): %s\n", pa_strerror(pa_context_errno(i->context)));
+            return -1;
+        }
+
+        length = pa_frame_align(PA_MIN(length, i->fragment_size), &i->sample_spec);
+        if (length <= 0) {
+            pa_stream_cancel_write(i->play_stream);
+            break;
+        }
+
+        k = PA_MIN(length, i->ring_size - i->ring_read);
+        memcpy(data, (uint8_t *) i->ring + i->ring_read, k);
+        memcpy((uint8_t *) data + k, i->ring, length - k);
+
+        if (pa_stream_write(i->play_stream, data, length, NULL, 0LL, PA_SEEK_RELATIVE) < 0) {
+            debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_write(): %s\n", pa_strerror(pa_context_errno(i->context)));
+            return -1;
+        }
+
+        i->ring_read = (i->ring_read + length) % i->ring_size;
+        i->ring_consumed += length;
+        n -= length;
+    }
+
+    return 0;
+}
+
 static void stream_request_cb(pa_stream *s, size_t length, void *userdata) {
     fd_info *i = userdata;
     assert(s);
 
+    if (s == i->play_stream && i->ring) {
+        if (fd_info_copy_ring(i) < 0)
+            fd_info_shutdown(i);
+        return;
+    }
+
     if (i->io_event) {
         pa_mainloop_api *api;
         size_t n;
@@ -858,7 +953,7 @@ static int fd_info_copy_data(fd_info *i, int force) {
     if (!i->play_stream && !i->rec_stream)
         return -1;
 
-    if ((i->play_stream) && (pa_stream_get_state(i->play_stream) == PA_STREAM_READY)) {
+    if (!i->ring && (i->play_stream) && (pa_stream_get_state(i->play_stream) == PA_STREAM_READY)) {
         n = pa_stream_writable_size(i->play_stream);
 
         if (n == (size_t)-1) {
@@ -1047,6 +1142,11 @@ static int create_playback_stream(fd_info *i) {
     attr.maxlength = (uint32_t) (i->fragment_size * (i->n_fragments+1));
     attr.tlength = (uint32_t) (i->fragment_size * i->n_fragments);
     attr.prebuf = (uint32_t) i->fragment_size;
+
+    /* With a mmap()ed ring the application already keeps up to a whole
+     * buffer ahead of us, don't add another one on top of that */
+    if (i->ring)
+        attr.tlength = (uint32_t) (i->fragment_size * 2);
     attr.minreq = (uint32_t) i->fragment_size;
 
     flags = PA_STREAM_INTERPOLATE_TIMING|PA_STREAM_AUTO_TIMING_UPDATE|PA_STREAM_EARLY_REQUESTS;
@@ -1862,6 +1962,13 @@ static int dsp_drain(fd_info *i) {
 
     pa_threaded_mainloop_lock(i->mainloop);
 
+    /* Like a sound card, we keep looping over an mmap()ed ring until
+     * stopped, so there is no end to wait for */
+    if (i->ring) {
+        r = 0;
+        goto fail;
+    }
+
     if (dsp_empty_socket(i) < 0)
         goto fail;
 
@@ -2109,7 +2216,7 @@ static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno)
         case SNDCTL_DSP_GETCAPS:
             debug(DEBUG_LEVEL_NORMAL, __FILE__": SNDCTL_DSP_CAPS\n");
 
-            *(int*) argp = DSP_CAP_DUPLEX | DSP_CAP_TRIGGER
+            *(int*) argp = DSP_CAP_DUPLEX | DSP_CAP_TRIGGER | DSP_CAP_MMAP
 #ifdef DSP_CAP_MULTI
               | DSP_CAP_MULTI
 #endif
@@ -2170,6 +2277,8 @@ static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno)
             dsp_flush_socket(i);
 
             i->optr_n_blocks = 0;
+            i->ring_read = 0;
+            i->ring_consumed = 0;
 
             pa_threaded_mainloop_unlock(i->mainloop);
             break;
@@ -2210,7 +2319,14 @@ static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno)
 
             i->play_precork = !((*(int*) argp) & PCM_ENABLE_OUTPUT);
 
-            if (i->play_stream) {
+            if (i->ring && !i->play_stream) {
+                /* Creating the stream corked or not is all the
+                 * triggering it needs */
+                pa_threaded_mainloop_lock(i->mainloop);
+                if (create_playback_stream(i) < 0)
+                    *_errno = EIO;
+                pa_threaded_mainloop_unlock(i->mainloop);
+            } else if (i->play_stream) {
                 if (dsp_cork(i, i->play_stream, !((*(int*) argp) & PCM_ENABLE_OUTPUT)) < 0)
                     *_errno = EIO;
                 if (dsp_trigger(i) < 0)
@@ -2335,6 +2451,17 @@ static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno)
 
             pa_threaded_mainloop_lock(i->mainloop);
 
+            if (i->ring) {
+                int m = (int) (i->ring_consumed / i->fragment_size);
+
+                info->bytes = (int) i->ring_consumed;
+                info->blocks = m - i->optr_n_blocks;
+                info->ptr = (int) i->ring_read;
+                i->optr_n_blocks = m;
+
+                goto exit_loop2;
+            }
+
             for (;;) {
                 pa_usec_t usec;
 
@@ -2394,6 +2521,172 @@ fail:
     return ret;
 }
 
+static void *dsp_mmap(fd_info *i, size_t length, int prot, int *_errno) {
+    void *ring = MAP_FAILED;
+
+    debug(DEBUG_LEVEL_NORMAL, __FILE__": mmap() of %lu bytes\n", (unsigned long) length);
+
+    /* Recording doesn't go through a ring, read() still works for that */
+    if (!(prot & PROT_WRITE) || i->thread_fd == -1) {
+        debug(DEBUG_LEVEL_NORMAL, __FILE__": only mmap() for playback is supported\n");
+        *_errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    pa_threaded_mainloop_lock(i->mainloop);
+
+    if (i->ring) {
+        *_errno = EBUSY;
+        goto finish;
+    }
+
+    fix_metrics(i);
+
+    if (pa_frame_align(length, &i->sample_spec) < i->fragment_size) {
+        *_errno = EINVAL;
+        goto finish;
+    }
+
+    LOAD_MMAP_FUNC();
+    if ((ring = _mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        *_errno = errno;
+        debug(DEBUG_LEVEL_NORMAL, __FILE__": mmap() failed: %s\n", strerror(errno));
+        goto finish;
+    }
+
+    pa_silence_memory(ring, length, &i->sample_spec);
+
+    i->ring = ring;
+    i->ring_size = pa_frame_align(length, &i->sample_spec);
+    i->ring_read = 0;
+    i->ring_consumed = 0;
+    i->optr_n_blocks = 0;
+
+    /* Don't play data the application wrote before */
+    dsp_flush_fd(i->thread_fd);
+    i->io_flags &= ~PA_IO_EVENT_INPUT;
+    if (i->io_event)
+        pa_threaded_mainloop_get_api(i->mainloop)->io_enable(i->io_event, i->io_flags);
+
+    if (!i->play_stream && create_playback_stream(i) < 0)
+        debug(DEBUG_LEVEL_NORMAL, __FILE__": failed to create the playback stream, retrying on SNDCTL_DSP_SETTRIGGER\n");
+
+    debug(DEBUG_LEVEL_NORMAL, __FILE__": mapped a ring of %lu bytes\n", (unsigned long) i->ring_size);
+
+finish:
+    pa_threaded_mainloop_unlock(i->mainloop);
+
+    return ring;
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    fd_info *i;
+    void *r;
+    int _errno = 0;
+
+    /* Most calls are anonymous mappings from the allocator, get them out
+     * of the way first */
+    if (fd < 0 || (flags & MAP_ANONYMOUS) || !function_enter()) {
+        LOAD_MMAP_FUNC();
+        return _mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    if (!(i = fd_info_find(fd))) {
+        function_exit();
+        LOAD_MMAP_FUNC();
+        return _mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    if (i->type == FD_INFO_STREAM && offset == 0)
+        r = dsp_mmap(i, length, prot, &_errno);
+    else {
+        r = MAP_FAILED;
+        _errno = i->type == FD_INFO_STREAM ? EINVAL : ENODEV;
+    }
+
+    fd_info_unref(i);
+
+    if (_errno)
+        errno = _errno;
+
+    function_exit();
+
+    return r;
+}
+
+#ifdef HAVE_OPEN64
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset) {
+    fd_info *i;
+    void *r;
+    int _errno = 0;
+
+    if (fd < 0 || (flags & MAP_ANONYMOUS) || !function_enter()) {
+        LOAD_MMAP64_FUNC();
+        return _mmap64(addr, length, prot, flags, fd, offset);
+    }
+
+    if (!(i = fd_info_find(fd))) {
+        function_exit();
+        LOAD_MMAP64_FUNC();
+        return _mmap64(addr, length, prot, flags, fd, offset);
+    }
+
+    if (i->type == FD_INFO_STREAM && offset == 0)
+        r = dsp_mmap(i, length, prot, &_errno);
+    else {
+        r = MAP_FAILED;
+        _errno = i->type == FD_INFO_STREAM ? EINVAL : ENODEV;
+    }
+
+    fd_info_unref(i);
+
+    if (_errno)
+        errno = _errno;
+
+    function_exit();
+
+    return r;
+}
+
+#endif
+
+int munmap(void *addr, size_t length) {
+    fd_info *i;
+
+    pthread_mutex_lock(&fd_infos_mutex);
+
+    for (i = fd_infos; i; i = i->next)
+        if (i->ring == addr) {
+            fd_info_ref(i);
+            break;
+        }
+
+    pthread_mutex_unlock(&fd_infos_mutex);
+
+    if (i) {
+        debug(DEBUG_LEVEL_NORMAL, __FILE__": munmap() of the playback ring\n");
+
+        /* Stop feeding from the ring before it goes away */
+        pa_threaded_mainloop_lock(i->mainloop);
+
+        i->ring = NULL;
+        i->ring_size = i->ring_read = 0;
+
+        if (i->io_event) {
+            i->io_flags |= PA_IO_EVENT_INPUT;
+            pa_threaded_mainloop_get_api(i->mainloop)->io_enable(i->io_event, i->io_flags);
+        }
+
+        pa_threaded_mainloop_unlock(i->mainloop);
+
+        fd_info_unref(i);
+    }
+
+    LOAD_MUNMAP_FUNC();
+    return _munmap(addr, length);
+}
+
 #ifndef __GLIBC__
 int ioctl(int fd, int request, ...) {
 #else
@@ -0,0 +1,618 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <locale.h>
+
+#include <pulse/pulseaudio.h>
+
+#include <pulsecore/i18n.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/queue.h>
+#include <pulsecore/native-common.h>
+#include <pulsecore/native-trace.h>
+
+/* Replays a trace recorded with the trace-file= argument of
+ * module-native-protocol-*: every client of the trace gets its own
+ * context, which creates the same streams, writes as much (silence) as
+ * the original client did and sends the same stream and introspection
+ * requests, all at the same time relative to the start of the trace. */
+
+struct client {
+    uint32_t index;
+    pa_context *context;
+
+    /* Trace channel -> pa_stream, playback and record streams have
+     * separate channels */
+    pa_hashmap *playback_streams;
+    pa_hashmap *record_streams;
+
+    /* Records that came in before the context was ready */
+    pa_queue *pending;
+};
+
+static pa_mainloop_api *mainloop_api = NULL;
+static char *server = NULL;
+
+static pa_native_trace *trace = NULL;
+static pa_native_trace_record next_record;
+static struct timeval start_tv;
+static pa_time_event *time_event = NULL;
+
+static pa_hashmap *clients = NULL;
+
+static void *silence = NULL;
+static size_t silence_length = 0;
+
+static uint64_t n_records = 0, n_replayed = 0, n_skipped = 0, n_streams = 0, n_bytes = 0;
+
+static void quit(int ret) {
+    pa_assert(mainloop_api);
+    mainloop_api->quit(mainloop_api, ret);
+}
+
+static void stream_free(pa_stream *s) {
+    pa_stream_set_state_callback(s, NULL, NULL);
+    pa_stream_set_read_callback(s, NULL, NULL);
+
+    if (pa_stream_get_state(s) == PA_STREAM_CREATING || pa_stream_get_state(s) == PA_STREAM_READY)
+        pa_stream_disconnect(s);
+
+    pa_stream_unref(s);
+}
+
+static void client_free(struct client *c) {
+    pa_assert(c);
+
+    pa_hashmap_free(c->playback_streams);
+    pa_hashmap_free(c->record_streams);
+
+    if (c->context) {
+        pa_context_set_state_callback(c->context, NULL, NULL);
+        pa_context_disconnect(c->context);
+        pa_context_unref(c->context);
+    }
+
+    pa_queue_free(c->pending, pa_xfree);
+    pa_xfree(c);
+}
+
+static void stream_state_callback(pa_stream *s, void *userdata) {
+    pa_assert(s);
+
+    if (pa_stream_get_state(s) == PA_STREAM_FAILED)
+        fprintf(stderr, _("Stream error: %s\n"), pa_strerror(pa_context_errno(pa_stream_get_context(s))));
+}
+
+static void stream_read_callback(pa_stream *s, size_t length, void *userdata) {
+    const void *data;
+
+    pa_assert(s);
+
+    /* Take the data to keep the server busy like the original client
+     * did, but don't look at it */
+    while (pa_stream_readable_size(s) > 0) {
+        if (pa_stream_peek(s, &data, &length) < 0 || length == 0)
+            return;
+
+        pa_stream_drop(s);
+    }
+}
+
+static void create_stream(struct client *c, const pa_native_trace_record *r) {
+    pa_stream *s;
+    char name[64];
+    bool record = r->type == PA_NATIVE_TRACE_RECORD_STREAM;
+    int ret;
+
+    pa_snprintf(name, sizeof(name), "pareplay %s stream %u", record ? "record" : "playback", r->channel);
+
+    if (!(s = pa_stream_new(c->context, name, &r->sample_spec, &r->channel_map))) {
+        fprintf(stderr, _("pa_stream_new() failed: %s\n"), pa_strerror(pa_context_errno(c->context)));
+        n_skipped++;
+        return;
+    }
+
+    pa_stream_set_state_callback(s, stream_state_callback, NULL);
+
+    if (record) {
+        pa_stream_set_read_callback(s, stream_read_callback, NULL);
+        ret = pa_stream_connect_record(s, NULL, &r->buffer_attr, r->flags);
+    } else
+        ret = pa_stream_connect_playback(s, NULL, &r->buffer_attr, r->flags, NULL, NULL);
+
+    if (ret < 0) {
+        fprintf(stderr, _("Failed to connect stream: %s\n"), pa_strerror(pa_context_errno(c->context)));
+        pa_stream_unref(s);
+        n_skipped++;
+        return;
+    }
+
+    pa_hashmap_remove_and_free(record ? c->record_streams : c->playback_streams, PA_UINT32_TO_PTR(r->channel));
+    pa_hashmap_put(record ? c->record_streams : c->playback_streams, PA_UINT32_TO_PTR(r->channel), s);
+
+    n_streams++;
+    n_replayed++;
+}
+
+static pa_stream *get_stream(pa_hashmap *streams, uint32_t channel) {
+    pa_stream *s;
+
+    if (!(s = pa_hashmap_get(streams, PA_UINT32_TO_PTR(channel))))
+        return NULL;
+
+    if (pa_stream_get_state(s) != PA_STREAM_READY)
+        return NULL;
+
+    return s;
+}
+
+static void write_stream(struct client *c, const pa_native_trace_record *r) {
+    pa_stream *s;
+
+    if (r->length <= 0 || !(s = get_stream(c->playback_streams, r->channel))) {
+        n_skipped++;
+        return;
+    }
+
+    if (silence_length < r->length) {
+        pa_xfree(silence);
+        silence_length = r->length;
+        silence = pa_xmalloc0(silence_length);
+    }
+
+    if (pa_stream_write(s, silence, r->length, NULL, r->offset, r->seek) < 0) {
+        fprintf(stderr, _("pa_stream_write() failed: %s\n"), pa_strerror(pa_context_errno(c->context)));
+        n_skipped++;
+        return;
+    }
+
+    n_bytes += r->length;
+    n_replayed++;
+}
+
+/* We only generate the same requests, the replies are of no interest */
+static void sink_info_callback(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {}
+static void source_info_callback(pa_context *c, const pa_source_info *i, int eol, void *userdata) {}
+static void sink_input_info_callback(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata) {}
+static void source_output_info_callback(pa_context *c, const pa_source_output_info *i, int eol, void *userdata) {}
+static void client_info_callback(pa_context *c, const pa_client_info *i, int eol, void *userdata) {}
+static void card_info_callback(pa_context *c, const pa_card_info *i, int eol, void *userdata) {}
+static void module_info_callback(pa_context *c, const pa_module_info *i, int eol, void *userdata) {}
+static void server_info_callback(pa_context *c, const pa_server_info *i, void *userdata) {}
+
+static void run_command(struct client *c, const pa_native_trace_record *r) {
+    pa_operation *o = NULL;
+    pa_stream *s = NULL;
+
+    switch (r->command) {
+        case PA_COMMAND_CORK_PLAYBACK_STREAM:
+        case PA_COMMAND_FLUSH_PLAYBACK_STREAM:
+        case PA_COMMAND_TRIGGER_PLAYBACK_STREAM:
+        case PA_COMMAND_PREBUF_PLAYBACK_STREAM:
+        case PA_COMMAND_DRAIN_PLAYBACK_STREAM:
+        case PA_COMMAND_GET_PLAYBACK_LATENCY:
+            s = get_stream(c->playback_streams, r->channel);
+            break;
+
+        case PA_COMMAND_CORK_RECORD_STREAM:
+        case PA_COMMAND_FLUSH_RECORD_STREAM:
+        case PA_COMMAND_GET_RECORD_LATENCY:
+            s = get_stream(c->record_streams, r->channel);
+            break;
+
+        default:
+            break;
+    }
+
+    switch (r->command) {
+        case PA_COMMAND_CORK_PLAYBACK_STREAM:
+        case PA_COMMAND_CORK_RECORD_STREAM:
+            if (s)
+                o = pa_stream_cork(s, r->flag, NULL, NULL);
+            break;
+
+        case PA_COMMAND_FLUSH_PLAYBACK_STREAM:
+        case PA_COMMAND_FLUSH_RECORD_STREAM:
+            if (s)
+                o = pa_stream_flush(s, NULL, NULL);
+            break;
+
+        case PA_COMMAND_TRIGGER_PLAYBACK_STREAM:
+            if (s)
+                o = pa_stream_trigger(s, NULL, NULL);
+            break;
+
+        case PA_COMMAND_PREBUF_PLAYBACK_STREAM:
+            if (s)
+                o = pa_stream_prebuf(s, NULL, NULL);
+            break;
+
+        case PA_COMMAND_DRAIN_PLAYBACK_STREAM:
+            if (s)
+                o = pa_stream_drain(s, NULL, NULL);
+            break;
+
+        case PA_COMMAND_GET_PLAYBACK_LATENCY:
+        case PA_COMMAND_GET_RECORD_LATENCY:
+            if (s)
+                o = pa_stream_update_timing_info(s, NULL, NULL);
+            break;
+
+        case PA_COMMAND_SUBSCRIBE:
+            /* The first argument is the mask */
+            o = pa_context_subscribe(c->context, r->channel, NULL, NULL);
+            break;
+
+        case PA_COMMAND_GET_SERVER_INFO:
+            o = pa_context_get_server_info(c->context, server_info_callback, NULL);
+            break;
+
+        case PA_COMMAND_GET_SINK_INFO_LIST:
+            o = pa_context_get_sink_info_list(c->context, sink_info_callback, NULL);
+            break;
+
+        case PA_COMMAND_GET_SOURCE_INFO_LIST:
+            o = pa_context_get_source_info_list(c->context, source_info_callback, NULL);
+            break;
+
+        case PA_COMMAND_GET_SINK_INPUT_INFO_LIST:
+            o = pa_context_get_sink_input_info_list(c->context, sink_input_info_callback, NULL);
+            break;
+
+        case PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST:
+            o = pa_context_get_source_output_info_list(c->context, source_output_info_callback, NULL);
+            break;
+
+        case PA_COMMAND_GET_CLIENT_INFO_LIST:
+            o = pa_context_get_client_info_list(c->context, client_info_callback, NULL);
+            break;
+
+        case PA_COMMAND_GET_CARD_INFO_LIST:
+            o = pa_context_get_card_info_list(c->context, card_info_callback, NULL);
+            break;
+
+        case PA_COMMAND_GET_MODULE_INFO_LIST:
+            o = pa_context_get_module_info_list(c->context, module_info_callback, NULL);
+            break;
+
+        default:
+            /* Connection setup and stream creation are done by libpulse
+             * for us, everything else isn't replayed */
+            break;
+    }
+
+    if (!o) {
+        n_skipped++;
+        return;
+    }
+
+    pa_operation_unref(o);
+    n_replayed++;
+}
+
+static void run_record(struct client *c, const pa_native_trace_record *r) {
+    pa_assert(c);
+    pa_assert(r);
+
+    if (!c->context) {
+        /* The connection failed */
+        n_skipped++;
+        return;
+    }
+
+    switch (r->type) {
+        case PA_NATIVE_TRACE_COMMAND:
+            run_command(c, r);
+            break;
+
+        case PA_NATIVE_TRACE_PLAYBACK_STREAM:
+        case PA_NATIVE_TRACE_RECORD_STREAM:
+            create_stream(c, r);
+            break;
+
+        case PA_NATIVE_TRACE_DELETE_STREAM:
+            pa_hashmap_remove_and_free(r->record ? c->record_streams : c->playback_streams, PA_UINT32_TO_PTR(r->channel));
+            n_replayed++;
+            break;
+
+        case PA_NATIVE_TRACE_WRITE:
+            write_stream(c, r);
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+static void context_state_callback(pa_context *context, void *userdata) {
+    struct client *c = userdata;
+    pa_native_trace_record *r;
+
+    pa_assert(c);
+
+    switch (pa_context_get_state(context)) {
+        case PA_CONTEXT_CONNECTING:
+        case PA_CONTEXT_AUTHORIZING:
+        case PA_CONTEXT_SETTING_NAME:
+        case PA_CONTEXT_TERMINATED:
+            break;
+
+        case PA_CONTEXT_READY:
+            while ((r = pa_queue_pop(c->pending))) {
+                run_record(c, r);
+                pa_xfree(r);
+            }
+            break;
+
+        case PA_CONTEXT_FAILED:
+        default:
+            fprintf(stderr, _("Connection of client %u failed: %s\n"), c->index, pa_strerror(pa_context_errno(context)));
+
+            pa_hashmap_remove_all(c->playback_streams);
+            pa_hashmap_remove_all(c->record_streams);
+
+            pa_context_unref(c->context);
+            c->context = NULL;
+            break;
+    }
+}
+
+static void client_new(uint32_t index) {
+    struct client *c;
+    char name[64];
+
+    c = pa_xnew0(struct client, 1);
+    c->index = index;
+    c->playback_streams = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL, (pa_free_cb_t) stream_free);
+    c->record_streams = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL, (pa_free_cb_t) stream_free);
+    c->pending = pa_queue_new();
+
+    pa_hashmap_remove_and_free(clients, PA_UINT32_TO_PTR(index));
+    pa_hashmap_put(clients, PA_UINT32_TO_PTR(index), c);
+
+    pa_snprintf(name, sizeof(name), "pareplay client %u", index);
+
+    if (!(c->context = pa_context_new(mainloop_api, name))) {
+        fprintf(stderr, _("pa_context_new() failed.\n"));
+        n_skipped++;
+        return;
+    }
+
+    pa_context_set_state_callback(c->context, context_state_callback, c);
+
+    if (pa_context_connect(c->context, server, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
+        fprintf(stderr, _("pa_context_connect() failed: %s\n"), pa_strerror(pa_context_errno(c->context)));
+        pa_context_unref(c->context);
+        c->context = NULL;
+        n_skipped++;
+        return;
+    }
+
+    n_replayed++;
+}
+
+static void dispatch_record(const pa_native_trace_record *r) {
+    struct client *c;
+
+    pa_assert(r);
+
+    n_records++;
+
+    if (r->type == PA_NATIVE_TRACE_CLIENT_NEW) {
+        client_new(r->client);
+        return;
+    }
+
+    if (!(c = pa_hashmap_get(clients, PA_UINT32_TO_PTR(r->client)))) {
+        /* The client connected before the trace was started */
+        n_skipped++;
+        return;
+    }
+
+    if (r->type == PA_NATIVE_TRACE_CLIENT_FREE) {
+        pa_hashmap_remove_and_free(clients, PA_UINT32_TO_PTR(r->client));
+        n_replayed++;
+        return;
+    }
+
+    if (c->context && pa_context_get_state(c->context) != PA_CONTEXT_READY)
+        pa_queue_push(c->pending, pa_xnewdup(pa_native_trace_record, r, 1));
+    else
+        run_record(c, r);
+}
+
+static void finish(void) {
+    static bool finished = false;
+
+    if (finished)
+        return;
+
+    finished = true;
+
+    /* Clients that were still connected at the end of the trace */
+    pa_hashmap_remove_all(clients);
+
+    printf(_("Replayed %llu of %llu records, skipped %llu. Created %llu streams, wrote %llu bytes.\n"),
+           (unsigned long long) n_replayed, (unsigned long long) n_records, (unsigned long long) n_skipped,
+           (unsigned long long) n_streams, (unsigned long long) n_bytes);
+
+    quit(0);
+}
+
+static void time_event_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct timeval next;
+    int r;
+
+    for (;;) {
+        dispatch_record(&next_record);
+
+        if ((r = pa_native_trace_read(trace, &next_record)) < 0) {
+            fprintf(stderr, _("Failed to read trace.\n"));
+            quit(1);
+            return;
+        }
+
+        if (r == 0) {
+            finish();
+            return;
+        }
+
+        if (next_record.time > pa_timeval_age(&start_tv))
+            break;
+    }
+
+    next = start_tv;
+    pa_timeval_add(&next, next_record.time);
+    m->time_restart(e, &next);
+}
+
+static void sigint_callback(pa_mainloop_api *m, pa_signal_event *e, int sig, void *userdata) {
+    fprintf(stderr, _("Got SIGINT, exiting.\n"));
+    finish();
+}
+
+static void help(const char *argv0) {
+
+    printf(_("%s [options] TRACEFILE\n\n"
+           "Replay the clients recorded with the trace-file= argument of\n"
+           "module-native-protocol-unix or module-native-protocol-tcp.\n\n"
+           "  -h, --help                            Show this help\n"
+           "      --version                         Show version\n"
+           "  -s, --server=SERVER                   The name of the server to connect to\n\n"),
+           argv0);
+}
+
+enum {
+    ARG_VERSION = 256
+};
+
+int main(int argc, char *argv[]) {
+    pa_mainloop* m = NULL;
+    int c, r, ret = 1;
+    char *bn;
+    struct timeval tv;
+
+    static const struct option long_options[] = {
+        {"server",      1, NULL, 's'},
+        {"version",     0, NULL, ARG_VERSION},
+        {"help",        0, NULL, 'h'},
+        {NULL,          0, NULL, 0}
+    };
+
+    setlocale(LC_ALL, "");
+#ifdef ENABLE_NLS
+    bindtextdomain(GETTEXT_PACKAGE, PULSE_LOCALEDIR);
+#endif
+
+    bn = pa_path_get_filename(argv[0]);
+
+    while ((c = getopt_long(argc, argv, "s:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'h' :
+                help(bn);
+                ret = 0;
+                goto quit;
+
+            case ARG_VERSION:
+                printf(_("pareplay %s\n"
+                         "Compiled with libpulse %s\n"
+                         "Linked with libpulse %s\n"),
+                       PACKAGE_VERSION,
+                       pa_get_headers_version(),
+                       pa_get_library_version());
+                ret = 0;
+                goto quit;
+
+            case 's':
+                pa_xfree(server);
+                server = pa_xstrdup(optarg);
+                break;
+
+            default:
+                goto quit;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        help(bn);
+        goto quit;
+    }
+
+    if (!(trace = pa_native_trace_open(argv[optind])))
+        goto quit;
+
+    if ((r = pa_native_trace_read(trace, &next_record)) <= 0) {
+        fprintf(stderr, r < 0 ? _("Failed to read trace.\n") : _("Trace is empty.\n"));
+        goto quit;
+    }
+
+    if (!(m = pa_mainloop_new())) {
+        fprintf(stderr, _("pa_mainloop_new() failed.\n"));
+        goto quit;
+    }
+
+    pa_assert_se(mainloop_api = pa_mainloop_get_api(m));
+    pa_assert_se(pa_signal_init(mainloop_api) == 0);
+    pa_signal_new(SIGINT, sigint_callback, NULL);
+#ifdef SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    clients = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL, (pa_free_cb_t) client_free);
+
+    pa_gettimeofday(&start_tv);
+    tv = start_tv;
+    pa_timeval_add(&tv, next_record.time);
+    pa_assert_se(time_event = mainloop_api->time_new(mainloop_api, &tv, time_event_callback, NULL));
+
+    if (pa_mainloop_run(m, &ret) < 0) {
+        fprintf(stderr, _("pa_mainloop_run() failed.\n"));
+        goto quit;
+    }
+
+quit:
+    if (time_event)
+        mainloop_api->time_free(time_event);
+
+    if (clients)
+        pa_hashmap_free(clients);
+
+    if (m) {
+        pa_signal_done();
+        pa_mainloop_free(m);
+    }
+
+    if (trace)
+        pa_native_trace_free(trace);
+
+    pa_xfree(silence);
+    pa_xfree(server);
+
+    return ret;
+}